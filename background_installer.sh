@@ -46,7 +46,7 @@ function linux_install_deps {
         $1 apt-get install -y build-essential pkg-config bison flex autoconf \
                               automake libtool make git \
                               sqlite3 cmake curl python3 python3-venv \
-                              libopen62541-dev
+                              libopen62541-dev libssl-dev
     #Installing dependencies for opensuse tumbleweed
     elif [ -x /usr/bin/zypper ]; then
         $1 zypper ref
@@ -158,7 +158,7 @@ function install_opendnp3 {
     echo "[OPEN DNP3]"
     cd "$OPENPLC_DIR/utils/dnp3_src"
     swap_on "$1"
-    cmake .
+    cmake -DDNP3_TLS=ON .
     make
     $1 make install || fail "Error installing OpenDNP3"
     $1 ldconfig
@@ -23,7 +23,7 @@ cd open62541
 
 echo "Building open62541..."
 mkdir build && cd build
-cmake -DBUILD_SHARED_LIBS=ON -DCMAKE_BUILD_TYPE=Release ..
+cmake -DBUILD_SHARED_LIBS=ON -DCMAKE_BUILD_TYPE=Release -DUA_ENABLE_HISTORIZING=ON ..
 make -j$(nproc)
 sudo make install
 sudo ldconfig
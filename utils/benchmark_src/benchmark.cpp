@@ -0,0 +1,681 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// Benchmarks of the protocol handlers and the scan of the runtime. This file
+// takes the place of main.cpp: it is linked with the runtime sources and a
+// glueVars.cpp generated for an empty program (see build_benchmark.sh), and
+// installs a synthetic program of a configurable number of points per area.
+// Each benchmark reports the time and the heap allocations per operation.
+//
+// Results can be saved and used as the baseline of a later run, which fails
+// (exit status 1) when a benchmark got slower than the tolerance allows,
+// allocates more than it used to or can no longer run (a request that is
+// answered with an error is not timed):
+//
+//     ./benchmark -p 512 -s baseline.txt
+//     ./benchmark -p 512 -b baseline.txt -T 10
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "ladder.h"
+#include "plc_program.h"
+#include "oplc_snap7.h"
+
+#define MAX_BENCHMARKS      32
+#define MAX_FRAME           1024
+#define BENCH_CLIENT_FD     1000    // socket the ENIP session is registered for
+#define MB_MAX_READ_BITS    2000
+#define MB_MAX_READ_REGS    125
+#define MB_MAX_WRITE_REGS   123
+#define MB_MEMORY_START     1024    // first holding register of %MW
+#define PCCC_MAX_WORDS      122
+#define S7_DB1002_SIZE      (BUFFER_SIZE * 2)
+
+// Globals of main.cpp used by the runtime sources
+IEC_BOOL __DEBUG;
+unsigned long __tick = 0;
+pthread_mutex_t bufferLock;
+uint8_t run_openplc = 1;
+bool scan_paced_by_hardware = false;
+
+// Snap7 wrapper, the server is created but never listens
+extern bool s7Running;
+void S7API EventCallBack(void *usrPtr, PSrvEvent PEvent, int Size);
+
+struct Benchmark
+{
+    const char *name;
+    const char *description;
+    bool (*setup)(void);
+    void (*run)(void);
+};
+
+struct BenchResult
+{
+    char name[64];
+    double ns_per_op;
+    double allocs_per_op;
+};
+
+static int points = 256;
+static int round_ms = 200;
+static int rounds = 5;
+static int opcua_port = 48410;
+static bool opcua_started = false;
+
+static unsigned char request[MAX_FRAME];
+static int request_size;
+static unsigned char frame[MAX_FRAME];
+
+static PlcLocatedVariable *located = NULL;
+static char (*located_names)[16] = NULL;
+
+//-----------------------------------------------------------------------------
+// Synthetic program. Every scan copies the inputs to the outputs and updates
+// the memory points, so the published image changes on all the points
+//-----------------------------------------------------------------------------
+unsigned long long common_ticktime__ = 20000000ULL;
+
+void config_init__(void)
+{
+}
+
+void config_run__(unsigned long tick)
+{
+    for (int i = 0; i < points; i++)
+    {
+        bool_output_image[i / 8][i % 8] = bool_input_image[i / 8][i % 8] ^ (tick & 1);
+        int_output_image[i] = int_input_image[i] + (IEC_UINT)tick;
+        int_memory_image[i] = (IEC_UINT)(tick + i);
+        dint_memory_image[i] += 1;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Installs the located variables of the synthetic program on the program
+// the runtime got from glueVars, so the OPC UA server exports them: %QX, %IW,
+// %QW, %MW and %MD nodes for every point. The memory points are marked as
+// present, so the snapshots publish them
+//-----------------------------------------------------------------------------
+static void installLocatedVariables()
+{
+    static const char *prefixes[] = {"QX", "IW", "QW", "MW", "MD"};
+    int count = 5 * points;
+    located = (PlcLocatedVariable *)calloc(count + 1, sizeof(PlcLocatedVariable));
+    located_names = (char (*)[16])calloc(count, 16);
+
+    for (int i = 0; i < count; i++)
+    {
+        int kind = i / points;
+        int index = i % points;
+        PlcLocatedVariable *var = &located[i];
+        var->node_id = 4000000 + i;
+        var->name = located_names[i];
+        var->location = located_names[i];
+        var->count = 1;
+        if (kind == 0) snprintf(located_names[i], 16, "%s%d_%d", prefixes[kind], index / 8, index % 8);
+        else snprintf(located_names[i], 16, "%s%d", prefixes[kind], index);
+
+        switch (kind)
+        {
+            case 0: var->size = 'X'; var->value = &bool_output_image[index / 8][index % 8]; break;
+            case 1: var->size = 'W'; var->value = &int_input_image[index]; break;
+            case 2: var->size = 'W'; var->value = &int_output_image[index]; break;
+            case 3:
+                var->size = 'W';
+                var->value = &int_memory_image[index];
+                int_memory_present[index / 8] |= 1 << (index % 8);
+                break;
+            default:
+                var->size = 'D';
+                var->value = &dint_memory_image[index];
+                dint_memory_present[index / 8] |= 1 << (index % 8);
+                break;
+        }
+    }
+
+    PlcProgram *program = plcProgram();
+    program->located_variables = located;
+    program->located_variable_count = count;
+}
+
+static void writeBE16(unsigned char *p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+static void writeLE16(unsigned char *p, uint16_t value)
+{
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+static int minPoints(int limit)
+{
+    return points < limit ? points : limit;
+}
+
+//-----------------------------------------------------------------------------
+// Applies the writes queued by a benchmark, as the next scan would
+//-----------------------------------------------------------------------------
+static void applyWrites()
+{
+    pthread_mutex_lock(&bufferLock);
+    applyProcessImageWrites();
+    pthread_mutex_unlock(&bufferLock);
+}
+
+//-----------------------------------------------------------------------------
+// Scan: queued writes, program and publication of the process image
+//-----------------------------------------------------------------------------
+static void runScan()
+{
+    pthread_mutex_lock(&bufferLock);
+    applyProcessImageWrites();
+    config_run__(__tick++);
+    publishProcessImage();
+    pthread_mutex_unlock(&bufferLock);
+}
+
+//-----------------------------------------------------------------------------
+// Modbus/TCP
+//-----------------------------------------------------------------------------
+static void modbusHeader(int function, int start, int count, int pdu_size)
+{
+    memset(request, 0, sizeof(request));
+    writeBE16(&request[0], 1);
+    writeBE16(&request[4], pdu_size + 1);
+    request[6] = 1;
+    request[7] = function;
+    writeBE16(&request[8], start);
+    writeBE16(&request[10], count);
+    request_size = 6 + 1 + pdu_size;
+}
+
+static void runModbus()
+{
+    memcpy(frame, request, request_size);
+    processModbusMessage(frame, request_size);
+}
+
+static void runModbusWrite()
+{
+    runModbus();
+    applyWrites();
+}
+
+//-----------------------------------------------------------------------------
+// Sends the request once. An exception response means the benchmark would
+// only time the error path
+//-----------------------------------------------------------------------------
+static bool modbusAnswered()
+{
+    runModbusWrite();
+    return frame[7] == request[7];
+}
+
+static bool setupModbusReadCoils()
+{
+    modbusHeader(1, 0, minPoints(MB_MAX_READ_BITS), 5);
+    return modbusAnswered();
+}
+
+static bool setupModbusReadHolding()
+{
+    modbusHeader(3, 0, minPoints(MB_MAX_READ_REGS), 5);
+    return modbusAnswered();
+}
+
+static bool setupModbusWriteRegisters()
+{
+    int count = minPoints(MB_MAX_WRITE_REGS);
+    modbusHeader(16, MB_MEMORY_START, count, 6 + 2 * count);
+    request[12] = 2 * count;
+    for (int i = 0; i < count; i++) writeBE16(&request[13 + 2 * i], i);
+    return modbusAnswered();
+}
+
+//-----------------------------------------------------------------------------
+// PCCC typed logical read/write of the N7 file, directly and encapsulated on
+// an EtherNet/IP SendRRData of a registered session
+//-----------------------------------------------------------------------------
+static int pcccRequest(unsigned char *pccc, int function)
+{
+    int count = minPoints(PCCC_MAX_WORDS);
+    pccc[0] = 0x0f;
+    pccc[1] = 0;
+    writeLE16(&pccc[2], 1);
+    pccc[4] = function;
+    pccc[5] = 2 * count;
+    pccc[6] = 7;
+    pccc[7] = 0x89;
+    pccc[8] = 0;
+    pccc[9] = 0;
+    if (function == 0xA2) return 10;
+
+    for (int i = 0; i < count; i++) writeLE16(&pccc[10 + 2 * i], i);
+    return 10 + 2 * count;
+}
+
+static void runPccc()
+{
+    memcpy(frame, request, request_size);
+    processPCCCMessage(frame, request_size);
+}
+
+static void runPcccWrite()
+{
+    runPccc();
+    applyWrites();
+}
+
+static bool setupPcccRead()
+{
+    memset(request, 0, sizeof(request));
+    request_size = pcccRequest(request, 0xA2);
+    runPcccWrite();
+    return frame[1] == 0;
+}
+
+static bool setupPcccWrite()
+{
+    memset(request, 0, sizeof(request));
+    request_size = pcccRequest(request, 0xAA);
+    runPcccWrite();
+    return frame[1] == 0;
+}
+
+static void runEnip()
+{
+    memcpy(frame, request, request_size);
+    processEnipMessage(frame, request_size, BENCH_CLIENT_FD);
+}
+
+static bool setupEnipPcccRead()
+{
+    // Register Session
+    memset(frame, 0, sizeof(frame));
+    frame[0] = 0x65;
+    writeLE16(&frame[2], 4);
+    writeLE16(&frame[24], 1);
+    if (processEnipMessage(frame, 28, BENCH_CLIENT_FD) != 28) return false;
+
+    memset(request, 0, sizeof(request));
+    memcpy(&request[4], &frame[4], 4);
+    if (request[4] == 0 && request[5] == 0 && request[6] == 0 && request[7] == 0) return false;
+
+    // SendRRData with the PCCC request on the second item
+    int pccc_size = pcccRequest(&request[41], 0xA2);
+    request[0] = 0x6f;
+    writeLE16(&request[2], 17 + pccc_size);
+    writeLE16(&request[30], 2);
+    request[32] = 0x81;
+    writeLE16(&request[34], 1);
+    request[37] = 0x91;
+    writeLE16(&request[39], pccc_size);
+    request_size = 41 + pccc_size;
+
+    runEnip();
+    return frame[8] == 0 && frame[9] == 0 && frame[10] == 0 && frame[11] == 0 && frame[42] == 0;
+}
+
+//-----------------------------------------------------------------------------
+// S7: refresh of the shadow areas after a scan and a client write to DB1002
+//-----------------------------------------------------------------------------
+static bool setupSnap7()
+{
+    initializeSnap7();
+    __atomic_store_n(&s7Running, true, __ATOMIC_RELEASE);
+    return true;
+}
+
+static void runSnap7Refresh()
+{
+    pthread_mutex_lock(&bufferLock);
+    applyProcessImageWrites();
+    config_run__(__tick++);
+    publishProcessImage();
+    updateSnap7Image();
+    pthread_mutex_unlock(&bufferLock);
+}
+
+static void runSnap7Write()
+{
+    TSrvEvent event;
+    memset(&event, 0, sizeof(event));
+    event.EvtCode = evcDataWrite;
+    event.EvtRetCode = evrNoError;
+    event.EvtParam1 = S7AreaDB;
+    event.EvtParam2 = 1002;
+    event.EvtParam3 = 0;
+    event.EvtParam4 = minPoints(S7_DB1002_SIZE / 2) * 2;
+    EventCallBack(NULL, &event, sizeof(event));
+    applyWrites();
+}
+
+//-----------------------------------------------------------------------------
+// OPC UA: copy of the node values at the end of a scan. The server is
+// started on its own thread and must be listening before the copy is timed
+//-----------------------------------------------------------------------------
+static void *benchOpcuaThread(void *arg)
+{
+    opcuaStartServer(opcua_port);
+    return NULL;
+}
+
+static bool serverListening(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return false;
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bool listening = connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0;
+    close(fd);
+    return listening;
+}
+
+static bool setupOpcua()
+{
+    if (opcua_port == 0) return false;
+    if (!opcua_started)
+    {
+        pthread_t thread;
+        pthread_create(&thread, NULL, benchOpcuaThread, NULL);
+        pthread_detach(thread);
+        opcua_started = true;
+        for (int i = 0; i < 100 && !serverListening(opcua_port); i++) sleepms(50);
+    }
+    return serverListening(opcua_port);
+}
+
+static void runOpcua()
+{
+    opcuaUpdateNodeValues();
+}
+
+static const Benchmark benchmarks[] = {
+    {"scan", "writes, program and image publication", NULL, runScan},
+    {"modbus_read_coils", "FC1, one coil per point (max 2000)", setupModbusReadCoils, runModbus},
+    {"modbus_read_holding", "FC3, one register per point (max 125)", setupModbusReadHolding, runModbus},
+    {"modbus_write_registers", "FC16 on %MW (max 123), applied", setupModbusWriteRegisters, runModbusWrite},
+    {"pccc_read", "typed read of N7 (max 122 words)", setupPcccRead, runPccc},
+    {"pccc_write", "typed write of N7 (max 122 words), applied", setupPcccWrite, runPcccWrite},
+    {"enip_pccc_read", "SendRRData carrying pccc_read", setupEnipPcccRead, runEnip},
+    {"s7_refresh", "scan followed by the shadow area refresh", setupSnap7, runSnap7Refresh},
+    {"s7_client_write", "data write event on DB1002, applied", setupSnap7, runSnap7Write},
+    {"opcua_update", "copy of the node values (5 nodes per point)", setupOpcua, runOpcua},
+};
+
+static uint64_t nowNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+// Runs a benchmark for the configured rounds. The time per operation is the
+// median of the rounds, the allocations are averaged over all of them
+//-----------------------------------------------------------------------------
+static void runBenchmark(const Benchmark *bench, BenchResult *result)
+{
+    // Warm up and size the rounds
+    uint64_t operations = 0;
+    uint64_t start = nowNs();
+    uint64_t elapsed = 0;
+    while (elapsed < 20000000ULL)
+    {
+        bench->run();
+        operations++;
+        elapsed = nowNs() - start;
+    }
+    uint64_t per_round = (uint64_t)round_ms * 1000000ULL * operations / elapsed;
+    if (per_round == 0) per_round = 1;
+
+    double samples[64];
+    uint64_t total_operations = 0;
+    uint32_t allocations = 0;
+    for (int r = 0; r < rounds; r++)
+    {
+        uint32_t caught = heapAllocationCount();
+        armHeapCheck(HEAP_CHECK_COUNT);
+        start = nowNs();
+        for (uint64_t i = 0; i < per_round; i++) bench->run();
+        elapsed = nowNs() - start;
+        armHeapCheck(HEAP_CHECK_OFF);
+        allocations += heapAllocationCount() - caught;
+        total_operations += per_round;
+        samples[r] = (double)elapsed / per_round;
+    }
+
+    // Insertion sort, there are only a few rounds
+    for (int i = 1; i < rounds; i++)
+    {
+        double value = samples[i];
+        int j = i - 1;
+        for (; j >= 0 && samples[j] > value; j--) samples[j + 1] = samples[j];
+        samples[j + 1] = value;
+    }
+
+    snprintf(result->name, sizeof(result->name), "%s", bench->name);
+    result->ns_per_op = samples[rounds / 2];
+    result->allocs_per_op = (double)allocations / total_operations;
+}
+
+//-----------------------------------------------------------------------------
+// Reads the results saved by a previous run. Returns the number read, or -1
+// if the file can't be opened
+//-----------------------------------------------------------------------------
+static int loadResults(const char *path, BenchResult *results, int max_results, int *file_points)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return -1;
+
+    char line[256];
+    int count = 0;
+    *file_points = 0;
+    while (fgets(line, sizeof(line), f) != NULL && count < max_results)
+    {
+        if (sscanf(line, "# points %d", file_points) == 1) continue;
+        if (line[0] == '#' || line[0] == '\n') continue;
+
+        BenchResult *result = &results[count];
+        if (sscanf(line, "%63s %lf %lf", result->name, &result->ns_per_op, &result->allocs_per_op) == 3) count++;
+    }
+    fclose(f);
+    return count;
+}
+
+static bool saveResults(const char *path, const BenchResult *results, int count)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL) return false;
+
+    fprintf(f, "# OpenPLC benchmark results: name, ns/op, allocations/op\n");
+    fprintf(f, "# points %d\n", points);
+    for (int i = 0; i < count; i++)
+    {
+        fprintf(f, "%s %.1f %.3f\n", results[i].name, results[i].ns_per_op, results[i].allocs_per_op);
+    }
+    fclose(f);
+    return true;
+}
+
+static void usage(const char *program)
+{
+    printf("Usage: %s [options]\n\n", program);
+    printf("  -p points     points per area of the synthetic process image (1-1024, default 256)\n");
+    printf("  -t ms         duration of each round (default 200)\n");
+    printf("  -r rounds     rounds per benchmark, the median is reported (default 5)\n");
+    printf("  -f name       only run the benchmarks whose name contains name\n");
+    printf("  -o port       port of the OPC UA server, 0 skips opcua_update (default 48410)\n");
+    printf("  -s file       save the results to file\n");
+    printf("  -b file       compare with the results saved on file, fail on regressions\n");
+    printf("  -T percent    slowdown tolerated against the baseline (default 10)\n");
+    printf("  -l            list the benchmarks\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *filter = NULL;
+    const char *save_path = NULL;
+    const char *baseline_path = NULL;
+    double tolerance = 10.0;
+
+    int option;
+    while ((option = getopt(argc, argv, "p:t:r:f:o:s:b:T:lh")) != -1)
+    {
+        switch (option)
+        {
+            case 'p': points = atoi(optarg); break;
+            case 't': round_ms = atoi(optarg); break;
+            case 'r': rounds = atoi(optarg); break;
+            case 'f': filter = optarg; break;
+            case 'o': opcua_port = atoi(optarg); break;
+            case 's': save_path = optarg; break;
+            case 'b': baseline_path = optarg; break;
+            case 'T': tolerance = atof(optarg); break;
+            case 'l':
+                for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+                {
+                    printf("%-24s %s\n", benchmarks[i].name, benchmarks[i].description);
+                }
+                return 0;
+            default:
+                usage(argv[0]);
+                return option == 'h' ? 0 : 2;
+        }
+    }
+    if (points < 1 || points > BUFFER_SIZE || round_ms < 1 || rounds < 1 || rounds > 64 || tolerance < 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    BenchResult baseline[MAX_BENCHMARKS];
+    int baseline_count = 0;
+    if (baseline_path != NULL)
+    {
+        int baseline_points;
+        baseline_count = loadResults(baseline_path, baseline, MAX_BENCHMARKS, &baseline_points);
+        if (baseline_count < 0)
+        {
+            printf("Error: can't read the baseline %s\n", baseline_path);
+            return 2;
+        }
+        if (baseline_points != 0 && baseline_points != points)
+        {
+            printf("Error: the baseline was recorded with %d points, not %d\n", baseline_points, points);
+            return 2;
+        }
+    }
+
+    // Same initialization as main.cpp, without the hardware and the servers
+    configureHeap();
+    initializeLog();
+    pthread_mutex_init(&bufferLock, NULL);
+    initializePlcProgram();
+    plcProgram()->config_init();
+    plcProgram()->glue_vars();
+    installLocatedVariables();
+    mapUnusedIO();
+    buildImageRanges();
+    initializeProcessImage();
+
+    printf("OpenPLC benchmark: %d points per area, %d rounds of %d ms\n\n", points, rounds, round_ms);
+    printf("%-24s %12s %10s", "benchmark", "ns/op", "allocs/op");
+    if (baseline_path != NULL) printf(" %12s %8s", "baseline", "change");
+    printf("\n");
+
+    BenchResult results[MAX_BENCHMARKS];
+    int count = 0;
+    int regressions = 0;
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+    {
+        const Benchmark *bench = &benchmarks[i];
+        if (filter != NULL && strstr(bench->name, filter) == NULL) continue;
+
+        const BenchResult *previous = NULL;
+        for (int b = 0; b < baseline_count && previous == NULL; b++)
+        {
+            if (strcmp(baseline[b].name, bench->name) == 0) previous = &baseline[b];
+        }
+
+        // A request the runtime stopped answering fails the comparison
+        if (bench->setup != NULL && !bench->setup())
+        {
+            printf("%-24s %12s", bench->name, "skipped");
+            if (previous != NULL)
+            {
+                printf("  REGRESSION (was measured on the baseline)");
+                regressions++;
+            }
+            printf("\n");
+            continue;
+        }
+
+        BenchResult *result = &results[count++];
+        runBenchmark(bench, result);
+        printf("%-24s %12.1f %10.3f", result->name, result->ns_per_op, result->allocs_per_op);
+
+        if (previous != NULL)
+        {
+            double change = previous->ns_per_op > 0 ? (result->ns_per_op / previous->ns_per_op - 1.0) * 100.0 : 0;
+            bool slower = change > tolerance;
+            bool allocates = result->allocs_per_op > previous->allocs_per_op + 0.001;
+            printf(" %12.1f %+7.1f%%", previous->ns_per_op, change);
+            if (slower || allocates)
+            {
+                printf("  REGRESSION%s", allocates ? " (allocations)" : "");
+                regressions++;
+            }
+        }
+        else if (baseline_path != NULL)
+        {
+            printf(" %12s", "new");
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    if (save_path != NULL && !saveResults(save_path, results, count))
+    {
+        printf("Error: can't write the results to %s\n", save_path);
+        return 2;
+    }
+    if (baseline_path != NULL)
+    {
+        printf("\n%d regression%s against %s (tolerance %.1f%%)\n", regressions, regressions == 1 ? "" : "s", baseline_path, tolerance);
+    }
+
+    run_openplc = 0;
+    return regressions > 0 ? 1 : 0;
+}
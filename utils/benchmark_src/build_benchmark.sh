@@ -0,0 +1,77 @@
+#!/bin/bash
+# Builds the benchmark of the protocol handlers and the scan (benchmark.cpp).
+# The runtime sources of webserver/core are compiled as they are for the
+# linux platform, with benchmark.cpp in place of main.cpp and the glueVars.cpp
+# and debug.cpp of an empty program. The sources generated for the uploaded
+# program and the hardware layer are left out.
+#
+# The client load generator of jitter_test.sh (loadgen.cpp) is built along
+# with it, against the client side of the same libraries.
+#
+# Usage: ./build_benchmark.sh [optimization flags]   (default -O2)
+# The benchmark is written to build/benchmark and the load generator to
+# build/loadgen. Run them with -h for their options.
+
+cd "$(dirname "$0")"
+OPENPLC_DIR="$(pwd)/../.."
+CORE_DIR="$OPENPLC_DIR/webserver/core"
+BUILD_DIR="$(pwd)/build"
+
+OPT_FLAGS="$*"
+if [ -z "$OPT_FLAGS" ]; then
+    OPT_FLAGS="-O2"
+fi
+
+if pkg-config --exists open62541; then
+    OPEN62541_PC="open62541"
+elif pkg-config --exists libopen62541; then
+    OPEN62541_PC="libopen62541"
+else
+    echo "Error: open62541 not found via pkg-config (neither 'open62541' nor 'libopen62541')."
+    exit 1
+fi
+
+mkdir -p "$BUILD_DIR/obj"
+
+# The runtime sources take the size of the images from core/image_size.h,
+# the empty program is generated with the same size
+echo "Generating glueVars for an empty program..."
+g++ -std=c++11 ../glue_generator_src/glue_generator.cpp -o "$BUILD_DIR/glue_generator" || exit 1
+: > "$BUILD_DIR/LOCATED_VARIABLES.h"
+IMAGE_SIZE=$(tr -d '\r' 2>/dev/null < "$CORE_DIR/image_size.h" | awk '$1 == "#define" && $2 == "BUFFER_SIZE" { print $3 }')
+"$BUILD_DIR/glue_generator" --image-size "${IMAGE_SIZE:-1024}" "$BUILD_DIR/LOCATED_VARIABLES.h" "$BUILD_DIR/glueVars.cpp" > /dev/null || exit 1
+cp -f "$CORE_DIR/debug.blank" "$BUILD_DIR/debug.cpp"
+
+RUNTIME_ARGS="-std=gnu++11 -I $CORE_DIR -I $CORE_DIR/lib -I ../snap7_src/wrapper -pthread -fpermissive -w $OPT_FLAGS `pkg-config --cflags libmodbus` `pkg-config --cflags "$OPEN62541_PC"`"
+RUNTIME_LIBS="-lrt `pkg-config --libs libmodbus` -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal `pkg-config --libs "$OPEN62541_PC"` -rdynamic -ldl"
+
+objects=""
+pids=""
+for src in "$CORE_DIR"/*.cpp ../snap7_src/wrapper/oplc_snap7.cpp "$BUILD_DIR/glueVars.cpp" "$BUILD_DIR/debug.cpp" benchmark.cpp; do
+    name=$(basename "$src" .cpp)
+    case "$src" in
+        "$CORE_DIR"/main.cpp|"$CORE_DIR"/glueVars.cpp|"$CORE_DIR"/debug.cpp|"$CORE_DIR"/c_blocks_code.cpp|"$CORE_DIR"/hardware_layer.cpp)
+            continue
+            ;;
+    esac
+    obj="$BUILD_DIR/obj/$name.o"
+    objects="$objects $obj"
+    echo "Compiling $name.cpp"
+    g++ -c "$src" -o "$obj" $RUNTIME_ARGS &
+    pids="$pids $!"
+done
+failed=0
+for pid in $pids; do
+    wait $pid || failed=1
+done
+if [ $failed -ne 0 ]; then
+    echo "Error compiling the benchmark"
+    exit 1
+fi
+
+g++ $objects -o "$BUILD_DIR/benchmark" $RUNTIME_ARGS $RUNTIME_LIBS || exit 1
+echo "Benchmark built on $BUILD_DIR/benchmark"
+
+echo "Compiling loadgen.cpp"
+g++ loadgen.cpp -o "$BUILD_DIR/loadgen" $RUNTIME_ARGS $RUNTIME_LIBS || exit 1
+echo "Load generator built on $BUILD_DIR/loadgen"
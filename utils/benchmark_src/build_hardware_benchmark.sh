@@ -0,0 +1,59 @@
+#!/bin/bash
+# Builds the benchmark of the hardware layers on mocked buses
+# (hardware_benchmark.cpp). Each layer of webserver/core/hardware_layers is
+# linked with the mocked I2C, SPI, GPIO, sysfs and serial backends of
+# mock_bus/, which answer the wiringPi calls and, through the --wrap of the
+# linker, the file syscalls of the layer. No board or wiringPi is needed.
+#
+# Usage: ./build_hardware_benchmark.sh [layers]   (default: sequent pixtend2l neuron raspberrypi)
+# The benchmark of each layer is written to build/hw_<layer>. Run it with -h
+# for its options. OPT_FLAGS sets the optimization flags (default -O2).
+
+cd "$(dirname "$0")"
+OPENPLC_DIR="$(pwd)/../.."
+CORE_DIR="$OPENPLC_DIR/webserver/core"
+BUILD_DIR="$(pwd)/build"
+
+LAYERS="$*"
+if [ -z "$LAYERS" ]; then
+    LAYERS="sequent pixtend2l neuron raspberrypi"
+fi
+if [ -z "$OPT_FLAGS" ]; then
+    OPT_FLAGS="-O2"
+fi
+
+# The layers must call the syscalls themselves for --wrap to see them, not
+# the _chk variants of _FORTIFY_SOURCE
+WRAPPED="open open64 close read write pread pread64 pwrite pwrite64 ioctl mmap mmap64 munmap"
+WRAP_FLAGS=""
+for symbol in $WRAPPED; do
+    WRAP_FLAGS="$WRAP_FLAGS -Wl,--wrap=$symbol"
+done
+COMPILE_ARGS="-std=gnu++11 -I mock_bus -I $CORE_DIR -I $CORE_DIR/lib -pthread -fpermissive -w -U_FORTIFY_SOURCE $OPT_FLAGS"
+
+mkdir -p "$BUILD_DIR/obj"
+
+echo "Compiling mock_bus.cpp"
+g++ -c mock_bus/mock_bus.cpp -o "$BUILD_DIR/obj/mock_bus.o" $COMPILE_ARGS || exit 1
+
+failed=0
+for layer in $LAYERS; do
+    if [ ! -f "$CORE_DIR/hardware_layers/$layer.cpp" ]; then
+        echo "Error: there is no hardware layer $layer"
+        failed=1
+        continue
+    fi
+    echo "Building hw_$layer"
+    if g++ -c "$CORE_DIR/hardware_layers/$layer.cpp" -o "$BUILD_DIR/obj/hw_layer_$layer.o" $COMPILE_ARGS && \
+       g++ -c hardware_benchmark.cpp -o "$BUILD_DIR/obj/hw_benchmark_$layer.o" $COMPILE_ARGS \
+           -DHW_LAYER_$layer -DHW_LAYER_NAME="\"$layer\"" && \
+       g++ "$BUILD_DIR/obj/hw_benchmark_$layer.o" "$BUILD_DIR/obj/hw_layer_$layer.o" "$BUILD_DIR/obj/mock_bus.o" \
+           -o "$BUILD_DIR/hw_$layer" $COMPILE_ARGS $WRAP_FLAGS -lrt; then
+        echo "Benchmark of $layer built on $BUILD_DIR/hw_$layer"
+    else
+        echo "Error building the benchmark of $layer"
+        failed=1
+    fi
+done
+
+exit $failed
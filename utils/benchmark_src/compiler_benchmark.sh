@@ -0,0 +1,258 @@
+#!/bin/bash
+# Compiler and generated code benchmark. Compiles every program of the corpus
+# (corpus/*.st, plus a large ladder program generated here) with the regular
+# toolchain (scripts/compile_program.sh) and runs each one on virtual time,
+# so the scans run back to back. For every program the report shows the
+# time spent on iec2c, the time spent building the generated code, the text
+# size of the runtime and the time the program takes per scan (the
+# plc_program phase of the scan profile).
+#
+# It is the check for the changes to matiec (stage3, stage4/generate_c) and
+# to the lib/*.h the generated code includes: run it before and after the
+# change with the same board and build profile, the second run with -b on
+# the report of the first. The runtime objects are cached by
+# compile_program.sh, a blank program is compiled first so the build times
+# only count the generated code and the link.
+#
+# The benchmark replaces the program compiled on webserver/core, so it must
+# not be run while the runtime is in use. The previous program is compiled
+# back at the end.
+#
+# Usage: ./compiler_benchmark.sh [options]
+#   -d seconds    run time of each program (default 10)
+#   -n rungs      rungs of the generated ladder program (default 500)
+#   -p list       programs to run, comma separated (default: all of them)
+#   -o file       also write the report to this file
+#   -b file       report of a previous run to compare with. The benchmark
+#                 fails when a value got worse by more than the threshold
+#   -t percent    threshold of the comparison (default 10)
+
+cd "$(dirname "$0")"
+BENCH_DIR="$(pwd)"
+WEBSERVER_DIR="$BENCH_DIR/../../webserver"
+INTERACTIVE_PORT=43628
+
+DURATION=10
+RUNGS=500
+PROGRAMS=""
+OUTPUT=""
+BASELINE=""
+THRESHOLD=10
+
+while getopts "d:n:p:o:b:t:h" opt; do
+    case $opt in
+        d) DURATION=$OPTARG ;;
+        n) RUNGS=$OPTARG ;;
+        p) PROGRAMS=$OPTARG ;;
+        o) OUTPUT=$OPTARG ;;
+        b) BASELINE=$OPTARG ;;
+        t) THRESHOLD=$OPTARG ;;
+        *) sed -n '2,/^$/s/^# \{0,1\}//p' "$0"; exit 2 ;;
+    esac
+done
+
+if [ -n "$BASELINE" ] && [ ! -f "$BASELINE" ]; then
+    echo "Error: $BASELINE not found"
+    exit 2
+fi
+
+# Large ladder program, as the editor writes the rungs out: contacts and
+# coils as boolean expressions, set and reset coils as IFs, and a timer on
+# every fourth rung
+generate_ladder() {
+    echo "PROGRAM ladder_prog"
+    echo "  VAR"
+    for ((i = 0; i < 64; i++)); do
+        echo "    in_$i AT %IX$((i / 8)).$((i % 8)) : BOOL;"
+        echo "    out_$i AT %QX$((i / 8)).$((i % 8)) : BOOL;"
+    done
+    for ((r = 0; r < RUNGS; r++)); do
+        echo "    m_$r : BOOL;"
+        if [ $((r % 4)) -eq 3 ]; then
+            echo "    t_$r : TON;"
+        fi
+    done
+    echo "  END_VAR"
+    for ((r = 0; r < RUNGS; r++)); do
+        a=$((r % 64))
+        b=$(((r * 7 + 3) % 64))
+        c=$(((r * 13 + 5) % 64))
+        prev=$(((r + RUNGS - 1) % RUNGS))
+        case $((r % 4)) in
+            0) echo "  m_$r := (in_$a AND NOT in_$b OR m_$r) AND NOT in_$c;" ;;
+            1) echo "  m_$r := in_$a AND m_$prev OR in_$b AND NOT m_$prev;" ;;
+            2) echo "  IF in_$a AND m_$prev THEN"
+               echo "    m_$r := TRUE;"
+               echo "  END_IF;"
+               echo "  IF in_$b OR NOT m_$prev THEN"
+               echo "    m_$r := FALSE;"
+               echo "  END_IF;" ;;
+            3) echo "  t_$r(IN := m_$prev OR in_$c, PT := T#$((r % 50 + 10))ms);"
+               echo "  m_$r := t_$r.Q;" ;;
+        esac
+        if [ $r -lt 64 ]; then
+            echo "  out_$r := m_$r;"
+        fi
+    done
+    echo "END_PROGRAM"
+    echo ""
+    echo "CONFIGURATION Config0"
+    echo "  RESOURCE Res0 ON PLC"
+    echo "    TASK Main(INTERVAL := T#10ms,PRIORITY := 0);"
+    echo "    PROGRAM Inst0 WITH Main : ladder_prog;"
+    echo "  END_RESOURCE"
+    echo "END_CONFIGURATION"
+}
+
+# Prefixes every line with the time it was read, in nanoseconds
+timestamp_lines() {
+    while IFS= read -r line; do
+        echo "$(date +%s%N) $line"
+    done
+}
+
+# Nanoseconds between the lines starting with $2 and $3 of a timestamped log
+phase_time() {
+    awk -v from="$2" -v to="$3" '
+        start == "" && index(substr($0, index($0, " ") + 1), from) == 1 { start = $1; next }
+        start != "" && index(substr($0, index($0, " ") + 1), to) == 1 { print $1 - start; exit }
+    ' "$1"
+}
+
+# Sends a text command to the interactive server
+send_command() {
+    exec 3<>/dev/tcp/127.0.0.1/$INTERACTIVE_PORT || return 1
+    printf '%s' "$1" >&3
+    read -t 5 -r answer <&3
+    exec 3>&-
+}
+
+# Compiles and runs one program of st_files, and prints its line of the report
+benchmark_program() {
+    local name="$1"
+    local file="$2"
+    local log
+    log=$(mktemp /tmp/compiler_benchmark.XXXXXX)
+
+    ./scripts/compile_program.sh "$file" 2>&1 | timestamp_lines > "$log"
+    if ! grep -q "Compilation finished successfully" "$log"; then
+        printf "%-14s compilation failed, see %s\n" "$name" "$log"
+        return 1
+    fi
+    local iec2c_ns build_ns text
+    iec2c_ns=$(phase_time "$log" "Generating C files..." "Including Siemens S7")
+    build_ns=$(phase_time "$log" "Moving Files..." "Compilation finished")
+    text=$(size -B core/openplc | awk 'NR == 2 { print $1 }')
+    rm -f "$log"
+
+    local runtime_log
+    runtime_log=$(mktemp /tmp/compiler_benchmark_runtime.XXXXXX)
+    ./core/openplc --virtual-time > "$runtime_log" 2>&1 &
+    local pid=$!
+    local i
+    for ((i = 0; i < 50; i++)); do
+        if exec 3<>/dev/tcp/127.0.0.1/$INTERACTIVE_PORT 2>/dev/null; then
+            exec 3>&-
+            break
+        fi
+        sleep 0.2
+    done
+    sleep "$DURATION"
+    send_command "quit()"
+    wait $pid
+
+    # p50 and p99 of the plc_program phase, in us
+    local scan
+    scan=$(awk '/^###Profile:/ { profile = 1; next } profile && $1 == "plc_program" { print $3, $4; exit }' "$runtime_log")
+    rm -f "$runtime_log"
+    if [ -z "$scan" ]; then
+        scan="- -"
+    fi
+
+    echo "$name $iec2c_ns $build_ns $text $scan" | \
+        awk '{ printf "%-14s %10.1f %10.1f %10.1f %12s %12s\n", $1, $2 / 1000000, $3 / 1000000, $4 / 1024, $5, $6 }'
+}
+
+# Compares a report with the baseline. Prints the values that got worse by
+# more than the threshold and fails if there's any
+compare_reports() {
+    awk -v threshold="$THRESHOLD" '
+        /^#/ { next }
+        FNR == NR { if ($1 != "program") for (i = 2; i <= NF; i++) base[$1, i] = $i; next }
+        $1 == "program" { for (i = 2; i <= NF; i++) column[i] = $i; next }
+        {
+            for (i = 2; i <= NF; i++) {
+                if (!(($1, i) in base) || base[$1, i] == "-" || $i == "-" || base[$1, i] <= 0) continue
+                change = ($i - base[$1, i]) * 100 / base[$1, i]
+                if (change > threshold) {
+                    printf "%s: %s %s -> %s (%+.1f%%)\n", $1, column[i], base[$1, i], $i, change
+                    worse = 1
+                }
+            }
+        }
+        END { exit worse }
+    ' "$BASELINE" "$1"
+}
+
+cd "$WEBSERVER_DIR"
+PREVIOUS_PROGRAM=$(cat active_program 2>/dev/null)
+if exec 3<>/dev/tcp/127.0.0.1/$INTERACTIVE_PORT 2>/dev/null; then
+    exec 3>&-
+    echo "Error: the runtime is already running, stop it first"
+    exit 2
+fi
+if [ -s scripts/build_host ]; then
+    echo "Error: scripts/build_host is set, the benchmark must build on this machine"
+    exit 2
+fi
+
+echo "Compiling the runtime with a blank program..."
+if ! ./scripts/compile_program.sh blank_program.st > /tmp/compiler_benchmark_blank.log 2>&1; then
+    echo "Error compiling the blank program, see /tmp/compiler_benchmark_blank.log"
+    exit 1
+fi
+
+generate_ladder > st_files/bench_ladder.st
+for file in "$BENCH_DIR"/corpus/*.st; do
+    cp -f "$file" "st_files/bench_$(basename "$file")"
+done
+
+REPORT=$(mktemp /tmp/compiler_benchmark_report.XXXXXX)
+{
+    echo "# $(uname -srm), $(nproc) CPUs, build profile $(cat scripts/build_profile 2>/dev/null || echo release)"
+    echo "# ${DURATION}s per program, $RUNGS ladder rungs"
+    printf "%-14s %10s %10s %10s %12s %12s\n" "program" "iec2c_ms" "build_ms" "text_kb" "scan_p50_us" "scan_p99_us"
+} > "$REPORT"
+cat "$REPORT"
+
+STATUS=0
+for file in st_files/bench_*.st; do
+    name=$(basename "$file" .st)
+    name=${name#bench_}
+    if [ -n "$PROGRAMS" ] && [[ ",$PROGRAMS," != *",$name,"* ]]; then
+        continue
+    fi
+    line=$(benchmark_program "$name" "$(basename "$file")") || STATUS=1
+    echo "$line" | tee -a "$REPORT"
+done
+
+if [ -n "$OUTPUT" ]; then
+    cp -f "$REPORT" "$OUTPUT"
+fi
+if [ -n "$BASELINE" ]; then
+    echo ""
+    echo "=== Compared with $BASELINE (threshold $THRESHOLD%)"
+    if compare_reports "$REPORT"; then
+        echo "No regression"
+    else
+        STATUS=1
+    fi
+fi
+rm -f "$REPORT" st_files/bench_*.st st_files/bench_*.st.dbg
+
+if [ -n "$PREVIOUS_PROGRAM" ] && [ -f "st_files/$PREVIOUS_PROGRAM" ]; then
+    echo "Compiling $PREVIOUS_PROGRAM back..."
+    ./scripts/compile_program.sh "$PREVIOUS_PROGRAM" > /dev/null 2>&1 || echo "Error compiling $PREVIOUS_PROGRAM back"
+fi
+
+exit $STATUS
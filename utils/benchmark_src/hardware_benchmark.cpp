@@ -0,0 +1,538 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// Benchmark of a hardware layer on mocked buses. This file is linked with
+// one layer of webserver/core/hardware_layers and the mocked I2C, SPI, GPIO,
+// sysfs and serial backends of mock_bus/ (see build_hardware_benchmark.sh),
+// and runs the scan of the runtime around it: updateBuffersIn, the program
+// and updateBuffersOut, once per period. Every point of the process image
+// is located, and the program toggles the outputs on every scan unless -k
+// is given.
+//
+// For each part of the scan the report shows its time and the syscalls, bus
+// transactions and bus time it takes per scan. The I/O threads some layers
+// run are reported apart, per scan as well. The buses take the time set
+// with -l, so the times are the ones of the board, not of the machine the
+// benchmark runs on, and two versions of a layer can be compared without
+// the hardware:
+//
+//     ./hw_neuron -s 2000 -o baseline.txt
+//     ./hw_neuron -s 2000 -b baseline.txt -T 10
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "ladder.h"
+#include "mock_bus.h"
+
+#define MAX_SCANS           100000
+#define TOGGLED_BOOL_BYTES  32      //%QX0.0 to %QX31.7
+#define TOGGLED_WORDS       64      //%QW0 to %QW63
+#define MAX_RESULTS         64
+
+//Process image of the layer. Every point is located
+IEC_BOOL *bool_input[BUFFER_SIZE][8];
+IEC_BOOL *bool_output[BUFFER_SIZE][8];
+IEC_BYTE *byte_input[BUFFER_SIZE];
+IEC_BYTE *byte_output[BUFFER_SIZE];
+IEC_UINT *int_input[BUFFER_SIZE];
+IEC_UINT *int_output[BUFFER_SIZE];
+IEC_UDINT *dint_input[BUFFER_SIZE];
+IEC_UDINT *dint_output[BUFFER_SIZE];
+IEC_ULINT *lint_input[BUFFER_SIZE];
+IEC_ULINT *lint_output[BUFFER_SIZE];
+IEC_REAL *real_input[BUFFER_SIZE];
+IEC_REAL *real_output[BUFFER_SIZE];
+IEC_LREAL *lreal_input[BUFFER_SIZE];
+IEC_LREAL *lreal_output[BUFFER_SIZE];
+
+static IEC_BOOL bool_input_storage[BUFFER_SIZE][8];
+static IEC_BOOL bool_output_storage[BUFFER_SIZE][8];
+static IEC_BYTE byte_input_storage[BUFFER_SIZE];
+static IEC_BYTE byte_output_storage[BUFFER_SIZE];
+static IEC_UINT int_input_storage[BUFFER_SIZE];
+static IEC_UINT int_output_storage[BUFFER_SIZE];
+static IEC_UDINT dint_input_storage[BUFFER_SIZE];
+static IEC_UDINT dint_output_storage[BUFFER_SIZE];
+static IEC_ULINT lint_input_storage[BUFFER_SIZE];
+static IEC_ULINT lint_output_storage[BUFFER_SIZE];
+static IEC_REAL real_input_storage[BUFFER_SIZE];
+static IEC_REAL real_output_storage[BUFFER_SIZE];
+static IEC_LREAL lreal_input_storage[BUFFER_SIZE];
+static IEC_LREAL lreal_output_storage[BUFFER_SIZE];
+
+//Runtime functions used by the hardware layers
+pthread_mutex_t bufferLock = PTHREAD_MUTEX_INITIALIZER;
+
+void lockProfiled(pthread_mutex_t *lock, LockSite *site)
+{
+    pthread_mutex_lock(lock);
+}
+
+void unlockProfiled(pthread_mutex_t *lock)
+{
+    pthread_mutex_unlock(lock);
+}
+
+static bool verbose = false;
+
+extern "C" void openplc_log(char *logmsg)
+{
+    if (verbose) printf("%s", logmsg);
+}
+
+void setThreadClass(int thread_class, const char *name) {}
+
+void sleep_until(struct timespec *ts, long long delay)
+{
+    ts->tv_sec += delay / 1000000000LL;
+    ts->tv_nsec += delay % 1000000000LL;
+    if (ts->tv_nsec >= 1000000000L)
+    {
+        ts->tv_nsec -= 1000000000L;
+        ts->tv_sec++;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, ts, NULL);
+}
+
+void startGpioEvents(const char *chip, const int *lines, int count) {}
+void stopGpioEvents() {}
+
+//Parts of the scan that are measured
+#define PART_INPUTS         0
+#define PART_PROGRAM        1
+#define PART_OUTPUTS        2
+#define PARTS               3
+
+static const char *part_names[PARTS] = {"updateBuffersIn", "program", "updateBuffersOut"};
+
+//What a part of the scan cost over the run
+struct PartCost
+{
+    uint64_t *times;        //ns of each scan
+    MockCounters total;
+};
+
+//A value of the report, as it is saved and compared
+struct Result
+{
+    char name[64];
+    double value;
+};
+
+static int scans = 1000;
+static int period_us = 10000;
+static bool toggle_outputs = true;
+
+//-----------------------------------------------------------------------------
+// The layers that are driven by the program (the function blocks of the
+// Sequent cards) get their calls here, as a program with two relay cards and
+// two input cards would make them
+//-----------------------------------------------------------------------------
+#ifdef HW_LAYER_sequent
+int relay8Init(int stack);
+int relays8Set(uint8_t stack, uint8_t val);
+int digIn8Init(int stack);
+int digIn8Get(uint8_t stack, uint8_t *val);
+
+static void initializeLayerProgram()
+{
+    relay8Init(0);
+    relay8Init(1);
+    digIn8Init(2);
+    digIn8Init(3);
+}
+
+static void runLayerProgram()
+{
+    for (int stack = 0; stack < 2; stack++)
+    {
+        relays8Set(stack, byte_output_storage[stack]);
+    }
+    for (int stack = 2; stack < 4; stack++)
+    {
+        uint8_t value;
+        if (digIn8Get(stack, &value) == 0) byte_input_storage[stack] = value;
+    }
+}
+#else
+static void initializeLayerProgram() {}
+static void runLayerProgram() {}
+#endif
+
+template <typename T> static void locate(T **pointers, T *storage)
+{
+    for (int i = 0; i < BUFFER_SIZE; i++) pointers[i] = &storage[i];
+}
+
+static void locateImage()
+{
+    for (int i = 0; i < BUFFER_SIZE; i++)
+    {
+        for (int j = 0; j < 8; j++)
+        {
+            bool_input[i][j] = &bool_input_storage[i][j];
+            bool_output[i][j] = &bool_output_storage[i][j];
+        }
+    }
+    locate(byte_input, byte_input_storage);
+    locate(byte_output, byte_output_storage);
+    locate(int_input, int_input_storage);
+    locate(int_output, int_output_storage);
+    locate(dint_input, dint_input_storage);
+    locate(dint_output, dint_output_storage);
+    locate(lint_input, lint_input_storage);
+    locate(lint_output, lint_output_storage);
+    locate(real_input, real_input_storage);
+    locate(real_output, real_output_storage);
+    locate(lreal_input, lreal_input_storage);
+    locate(lreal_output, lreal_output_storage);
+}
+
+//-----------------------------------------------------------------------------
+// The program of the benchmark: a new value for the outputs on every scan
+//-----------------------------------------------------------------------------
+static void runProgram(int scan)
+{
+    if (toggle_outputs)
+    {
+        lockBuffer();
+        for (int i = 0; i < TOGGLED_BOOL_BYTES; i++)
+        {
+            for (int j = 0; j < 8; j++) bool_output_storage[i][j] = (scan + i + j) & 1;
+            byte_output_storage[i] = (IEC_BYTE)(scan + i);
+        }
+        for (int i = 0; i < TOGGLED_WORDS; i++)
+        {
+            int_output_storage[i] = (IEC_UINT)(scan * 64 + i);
+        }
+        unlockBuffer();
+    }
+    runLayerProgram();
+}
+
+static uint64_t nowNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void addCounters(MockCounters *total, const MockCounters *before, const MockCounters *after)
+{
+    total->syscalls += after->syscalls - before->syscalls;
+    for (int i = 0; i < MOCK_BUSES; i++)
+    {
+        total->transactions[i] += after->transactions[i] - before->transactions[i];
+        total->bytes[i] += after->bytes[i] - before->bytes[i];
+    }
+    total->bus_ns += after->bus_ns - before->bus_ns;
+}
+
+static int compareTimes(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentileUs(uint64_t *sorted, int count, double percentile)
+{
+    int index = (int)(percentile * (count - 1) / 100.0 + 0.5);
+    return sorted[index] / 1000.0;
+}
+
+static void addResult(Result *results, int *count, const char *part, const char *value_name, double value)
+{
+    if (*count == MAX_RESULTS) return;
+    snprintf(results[*count].name, sizeof(results[*count].name), "%s.%s", part, value_name);
+    results[*count].value = value;
+    (*count)++;
+}
+
+//-----------------------------------------------------------------------------
+// Prints the cost per scan of a part and adds it to the results
+//-----------------------------------------------------------------------------
+static void reportCounters(const char *part, const MockCounters *total, int count, Result *results, int *result_count)
+{
+    printf("%-18s syscalls %8.2f   bus %9.1f us", part, (double)total->syscalls / count, total->bus_ns / 1000.0 / count);
+    addResult(results, result_count, part, "syscalls", (double)total->syscalls / count);
+    addResult(results, result_count, part, "bus_us", total->bus_ns / 1000.0 / count);
+    for (int i = 0; i < MOCK_BUSES; i++)
+    {
+        if (total->transactions[i] == 0) continue;
+        printf("   %s %.2f (%.1f B)", mock_bus_names[i], (double)total->transactions[i] / count, (double)total->bytes[i] / count);
+        addResult(results, result_count, part, mock_bus_names[i], (double)total->transactions[i] / count);
+    }
+    printf("\n");
+}
+
+static int loadResults(const char *path, Result *results, int max_results)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return -1;
+
+    char line[256];
+    int count = 0;
+    while (fgets(line, sizeof(line), f) != NULL && count < max_results)
+    {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        if (sscanf(line, "%63s %lf", results[count].name, &results[count].value) == 2) count++;
+    }
+    fclose(f);
+    return count;
+}
+
+static bool saveResults(const char *path, const Result *results, int count)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL) return false;
+
+    fprintf(f, "# OpenPLC hardware layer benchmark: value per scan (times in us)\n");
+    for (int i = 0; i < count; i++)
+    {
+        fprintf(f, "%s %.3f\n", results[i].name, results[i].value);
+    }
+    fclose(f);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Parses a list of latencies, bus=us[:us per byte] separated by commas. The
+// bus "all" sets every bus
+//-----------------------------------------------------------------------------
+static bool parseLatencies(char *list)
+{
+    for (char *item = strtok(list, ","); item != NULL; item = strtok(NULL, ","))
+    {
+        char bus_name[16];
+        double transaction_us = 0, byte_us = -1;
+        if (sscanf(item, "%15[a-z0-9]=%lf:%lf", bus_name, &transaction_us, &byte_us) < 2) return false;
+        if (transaction_us < 0) return false;
+
+        bool found = false;
+        for (int bus = 0; bus < MOCK_BUSES; bus++)
+        {
+            if (strcmp(bus_name, "all") != 0 && strcmp(bus_name, mock_bus_names[bus]) != 0) continue;
+            uint64_t transaction_ns, byte_ns;
+            getMockLatency(bus, &transaction_ns, &byte_ns);
+            if (byte_us >= 0) byte_ns = (uint64_t)(byte_us * 1000);
+            setMockLatency(bus, (uint64_t)(transaction_us * 1000), byte_ns);
+            found = true;
+        }
+        if (!found) return false;
+    }
+    return true;
+}
+
+static void usage(const char *program)
+{
+    printf("Usage: %s [options]\n\n", program);
+    printf("  -s scans      scans to run (1-%d, default 1000)\n", MAX_SCANS);
+    printf("  -p us         scan period (default 10000)\n");
+    printf("  -l list       latencies of the buses, bus=us[:us per byte] comma separated.\n");
+    printf("                The buses are i2c, spi, gpio, sysfs, serial or all\n");
+    printf("  -n points     digital inputs of the mocked UniPi sysfs, with half as many\n");
+    printf("                outputs and relays and a quarter as many analog points (default 16)\n");
+    printf("  -w            no /dev/gpiomem, the GPIO goes through wiringPi\n");
+    printf("  -k            keep the outputs constant\n");
+    printf("  -o file       save the results to file\n");
+    printf("  -b file       compare with the results saved on file, fail on regressions\n");
+    printf("  -T percent    increase tolerated against the baseline (default 10)\n");
+    printf("  -v            print the log of the layer\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *save_path = NULL;
+    const char *baseline_path = NULL;
+    double tolerance = 10.0;
+    int points = 16;
+
+    int option;
+    while ((option = getopt(argc, argv, "s:p:l:n:wko:b:T:vh")) != -1)
+    {
+        switch (option)
+        {
+            case 's': scans = atoi(optarg); break;
+            case 'p': period_us = atoi(optarg); break;
+            case 'l':
+                if (!parseLatencies(optarg))
+                {
+                    printf("Error: invalid latency list\n");
+                    return 2;
+                }
+                break;
+            case 'n': points = atoi(optarg); break;
+            case 'w': setMockGpiomem(false); break;
+            case 'k': toggle_outputs = false; break;
+            case 'o': save_path = optarg; break;
+            case 'b': baseline_path = optarg; break;
+            case 'T': tolerance = atof(optarg); break;
+            case 'v': verbose = true; break;
+            default:
+                usage(argv[0]);
+                return option == 'h' ? 0 : 2;
+        }
+    }
+    if (scans < 1 || scans > MAX_SCANS || period_us < 0 || points < 0 || points > 171 || tolerance < 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    Result baseline[MAX_RESULTS];
+    int baseline_count = 0;
+    if (baseline_path != NULL)
+    {
+        baseline_count = loadResults(baseline_path, baseline, MAX_RESULTS);
+        if (baseline_count < 0)
+        {
+            printf("Error: can't read the baseline %s\n", baseline_path);
+            return 2;
+        }
+    }
+
+    setMockSysfsPoints(points);
+    markScanThread();
+    locateImage();
+
+    printf("OpenPLC hardware layer benchmark: %s, %d scans of %d us\n", HW_LAYER_NAME, scans, period_us);
+    printf("Bus latencies (us per transaction / per byte):");
+    for (int bus = 0; bus < MOCK_BUSES; bus++)
+    {
+        uint64_t transaction_ns, byte_ns;
+        getMockLatency(bus, &transaction_ns, &byte_ns);
+        printf(" %s %.1f/%.1f", mock_bus_names[bus], transaction_ns / 1000.0, byte_ns / 1000.0);
+    }
+    printf("\n\n");
+
+    MockCounters before, after, background_start, background_end;
+    MockCounters init_cost;
+    memset(&init_cost, 0, sizeof(init_cost));
+    readMockCounters(&before, NULL);
+    uint64_t init_start = nowNs();
+    initializeHardware();
+    initializeLayerProgram();
+    uint64_t init_ns = nowNs() - init_start;
+    readMockCounters(&after, NULL);
+    addCounters(&init_cost, &before, &after);
+
+    PartCost parts[PARTS];
+    for (int p = 0; p < PARTS; p++)
+    {
+        parts[p].times = (uint64_t *)calloc(scans, sizeof(uint64_t));
+        memset(&parts[p].total, 0, sizeof(parts[p].total));
+    }
+    uint64_t *scan_times = (uint64_t *)calloc(scans, sizeof(uint64_t));
+
+    // The I/O threads of the layer are counted from the first scan on
+    readMockCounters(NULL, &background_start);
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (int scan = 0; scan < scans; scan++)
+    {
+        uint64_t scan_start = nowNs();
+        for (int p = 0; p < PARTS; p++)
+        {
+            readMockCounters(&before, NULL);
+            uint64_t start = nowNs();
+            switch (p)
+            {
+                case PART_INPUTS: updateBuffersIn(); break;
+                case PART_PROGRAM: runProgram(scan); break;
+                case PART_OUTPUTS: updateBuffersOut(); break;
+            }
+            parts[p].times[scan] = nowNs() - start;
+            readMockCounters(&after, NULL);
+            addCounters(&parts[p].total, &before, &after);
+        }
+        scan_times[scan] = nowNs() - scan_start;
+
+        sleep_until(&next, period_us * 1000LL);
+    }
+    readMockCounters(NULL, &background_end);
+    MockCounters background;
+    memset(&background, 0, sizeof(background));
+    addCounters(&background, &background_start, &background_end);
+
+    Result results[MAX_RESULTS];
+    int result_count = 0;
+
+    printf("%-18s %10s %10s %10s %10s\n", "time (us)", "p50", "p99", "max", "mean");
+    for (int p = 0; p <= PARTS; p++)
+    {
+        const char *name = (p < PARTS) ? part_names[p] : "scan";
+        uint64_t *times = (p < PARTS) ? parts[p].times : scan_times;
+        uint64_t sum = 0;
+        for (int i = 0; i < scans; i++) sum += times[i];
+        qsort(times, scans, sizeof(uint64_t), compareTimes);
+        printf("%-18s %10.1f %10.1f %10.1f %10.1f\n", name, percentileUs(times, scans, 50), percentileUs(times, scans, 99),
+               times[scans - 1] / 1000.0, sum / 1000.0 / scans);
+        // Only the median is compared, the tail depends on the load of the
+        // machine more than on the layer
+        addResult(results, &result_count, name, "p50_us", percentileUs(times, scans, 50));
+    }
+
+    printf("\nPer scan\n");
+    for (int p = 0; p < PARTS; p++)
+    {
+        reportCounters(part_names[p], &parts[p].total, scans, results, &result_count);
+    }
+    reportCounters("I/O threads", &background, scans, results, &result_count);
+    printf("\nInitialization: %.1f ms, %llu syscalls\n", init_ns / 1000000.0, (unsigned long long)init_cost.syscalls);
+
+    int regressions = 0;
+    if (baseline_path != NULL)
+    {
+        printf("\n=== Compared with %s (tolerance %.0f%%)\n", baseline_path, tolerance);
+        for (int i = 0; i < result_count; i++)
+        {
+            for (int b = 0; b < baseline_count; b++)
+            {
+                if (strcmp(baseline[b].name, results[i].name) != 0) continue;
+                // A syscall or a transaction that wasn't there is a regression
+                // however small the baseline is. Times under a microsecond
+                // are noise
+                double slack = strstr(results[i].name, "_us") != NULL ? 1.0 : 0.005;
+                bool worse = results[i].value > baseline[b].value * (1 + tolerance / 100) &&
+                             results[i].value - baseline[b].value > slack;
+                if (worse)
+                {
+                    printf("%-32s %10.3f -> %10.3f  REGRESSION\n", results[i].name, baseline[b].value, results[i].value);
+                    regressions++;
+                }
+            }
+        }
+        if (regressions == 0) printf("No regression\n");
+    }
+
+    if (save_path != NULL && !saveResults(save_path, results, result_count))
+    {
+        printf("Error: can't write %s\n", save_path);
+        return 2;
+    }
+
+    finalizeHardware();
+    return regressions > 0 ? 1 : 0;
+}
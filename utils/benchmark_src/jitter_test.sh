@@ -0,0 +1,192 @@
+#!/bin/bash
+# Scan jitter test. Builds a synthetic program of a configurable size with the
+# regular toolchain (scripts/compile_program.sh), runs the real runtime with
+# the Modbus, S7, DNP3 and OPC UA servers started and loads them with the
+# clients of loadgen (see build_benchmark.sh). When the load ends the runtime
+# is stopped and the report shows the kernel it ran on, the cycle time and
+# latency histograms the runtime prints on exit and the client latencies.
+# It is meant to qualify boards and kernel configurations (PREEMPT_RT or not)
+# by running the same test on each of them.
+#
+# The test replaces the program compiled on webserver/core, so it must not be
+# run while the runtime is in use. The previous program is compiled back at
+# the end unless -k is given. The runtime needs root to listen on ports 102
+# and 502.
+#
+# Usage: ./jitter_test.sh [options]
+#   -p points     located %IW/%QW/%MW points of the program (default 256, up to 1024)
+#   -w loops      iterations of the busy loop on every scan (default 1000)
+#   -t ms         task interval of the program (default 10)
+#   -d seconds    duration of the load (default 60)
+#   -r rate       requests per second of each client (default 100)
+#   -c clients    clients per protocol (default 1)
+#   -P list       protocols to load, comma separated (default modbus,s7,dnp3,opcua)
+#   -o file       also write the report to this file
+#   -k            keep the test program compiled when done
+
+cd "$(dirname "$0")"
+BENCH_DIR="$(pwd)"
+WEBSERVER_DIR="$BENCH_DIR/../../webserver"
+LOADGEN="$BENCH_DIR/build/loadgen"
+INTERACTIVE_PORT=43628
+MODBUS_PORT=502
+DNP3_PORT=20000
+OPCUA_PORT=4840
+PROGRAM=jitter_test.st
+
+POINTS=256
+LOOPS=1000
+INTERVAL=10
+DURATION=60
+RATE=100
+CLIENTS=1
+PROTOCOLS="modbus,s7,dnp3,opcua"
+OUTPUT=""
+KEEP=0
+
+while getopts "p:w:t:d:r:c:P:o:kh" opt; do
+    case $opt in
+        p) POINTS=$OPTARG ;;
+        w) LOOPS=$OPTARG ;;
+        t) INTERVAL=$OPTARG ;;
+        d) DURATION=$OPTARG ;;
+        r) RATE=$OPTARG ;;
+        c) CLIENTS=$OPTARG ;;
+        P) PROTOCOLS=$OPTARG ;;
+        o) OUTPUT=$OPTARG ;;
+        k) KEEP=1 ;;
+        *) sed -n '2,/^$/s/^# \{0,1\}//p' "$0"; exit 2 ;;
+    esac
+done
+
+if [ "$POINTS" -lt 1 ] || [ "$POINTS" -gt 1024 ]; then
+    echo "Error: the number of points must be between 1 and 1024"
+    exit 2
+fi
+if [ ! -x "$LOADGEN" ]; then
+    echo "Error: $LOADGEN not found, build it with build_benchmark.sh"
+    exit 2
+fi
+
+# Sends a text command to the interactive server and prints its answer
+send_command() {
+    exec 3<>/dev/tcp/127.0.0.1/$INTERACTIVE_PORT || return 1
+    printf '%s' "$1" >&3
+    read -t 5 -r answer <&3
+    exec 3>&-
+    echo "$1: $answer"
+}
+
+# Port of a protocol on the loadgen command line, 0 if it is not loaded
+protocol_port() {
+    case ",$PROTOCOLS," in
+        *",$1,"*) echo "$2" ;;
+        *) echo 0 ;;
+    esac
+}
+
+# Synthetic program: every point copies its input plus its memory word to the
+# output and counts on the memory word, followed by a busy loop
+generate_program() {
+    echo "PROGRAM jitter_prog"
+    echo "  VAR"
+    for ((i = 0; i < POINTS; i++)); do
+        echo "    in_$i AT %IW$i : INT;"
+        echo "    out_$i AT %QW$i : INT;"
+        echo "    mem_$i AT %MW$i : INT;"
+    done
+    echo "    loops : DINT := $LOOPS;"
+    echo "    i : DINT;"
+    echo "    acc : DINT;"
+    echo "  END_VAR"
+    for ((i = 0; i < POINTS; i++)); do
+        echo "  out_$i := in_$i + mem_$i;"
+        echo "  mem_$i := mem_$i + 1;"
+    done
+    echo "  acc := 0;"
+    echo "  FOR i := 1 TO loops DO"
+    echo "    acc := acc + i * 3;"
+    echo "  END_FOR;"
+    echo "END_PROGRAM"
+    echo ""
+    echo "CONFIGURATION Config0"
+    echo "  RESOURCE Res0 ON PLC"
+    echo "    TASK Main(INTERVAL := T#${INTERVAL}ms,PRIORITY := 0);"
+    echo "    PROGRAM Inst0 WITH Main : jitter_prog;"
+    echo "  END_RESOURCE"
+    echo "END_CONFIGURATION"
+}
+
+cd "$WEBSERVER_DIR"
+PREVIOUS_PROGRAM=$(cat active_program 2>/dev/null)
+if exec 3<>/dev/tcp/127.0.0.1/$INTERACTIVE_PORT 2>/dev/null; then
+    exec 3>&-
+    echo "Error: the runtime is already running, stop it first"
+    exit 2
+fi
+
+echo "Compiling a program of $POINTS points..."
+generate_program > st_files/$PROGRAM
+if ! ./scripts/compile_program.sh $PROGRAM > /tmp/jitter_compile.log 2>&1; then
+    echo "Error compiling the test program, see /tmp/jitter_compile.log"
+    exit 1
+fi
+
+RUNTIME_LOG=$(mktemp /tmp/jitter_runtime.XXXXXX)
+./core/openplc > "$RUNTIME_LOG" 2>&1 &
+RUNTIME_PID=$!
+for ((i = 0; i < 50; i++)); do
+    if exec 3<>/dev/tcp/127.0.0.1/$INTERACTIVE_PORT 2>/dev/null; then
+        exec 3>&-
+        break
+    fi
+    sleep 0.2
+done
+
+MB=$(protocol_port modbus $MODBUS_PORT)
+S7=$(protocol_port s7 102)
+DNP=$(protocol_port dnp3 $DNP3_PORT)
+UA=$(protocol_port opcua $OPCUA_PORT)
+[ "$MB" != 0 ] && send_command "start_modbus($MODBUS_PORT)"
+[ "$S7" != 0 ] && send_command "start_snap7()"
+[ "$DNP" != 0 ] && send_command "start_dnp3($DNP3_PORT)"
+[ "$UA" != 0 ] && send_command "start_opcua($OPCUA_PORT)"
+sleep 2
+
+LOADGEN_LOG=$(mktemp /tmp/jitter_loadgen.XXXXXX)
+"$LOADGEN" -d "$DURATION" -r "$RATE" -c "$CLIENTS" -m "$MB" -s "$S7" -n "$DNP" -u "$UA" > "$LOADGEN_LOG" 2>&1
+LOADGEN_STATUS=$?
+
+send_command "quit()"
+wait $RUNTIME_PID
+
+{
+    echo "=== Kernel"
+    uname -a
+    if [ "$(cat /sys/kernel/realtime 2>/dev/null)" = "1" ] || uname -v | grep -q "PREEMPT_RT"; then
+        echo "PREEMPT_RT: yes"
+    else
+        echo "PREEMPT_RT: no"
+    fi
+    echo "CPUs: $(nproc)"
+    echo ""
+    echo "=== Test"
+    echo "points=$POINTS loops=$LOOPS interval=${INTERVAL}ms duration=${DURATION}s rate=$RATE clients=$CLIENTS protocols=$PROTOCOLS"
+    echo ""
+    echo "=== Runtime"
+    sed -n '/^###Summary/,$p' "$RUNTIME_LOG"
+    echo ""
+    echo "=== Clients"
+    cat "$LOADGEN_LOG"
+} | if [ -n "$OUTPUT" ]; then tee "$OUTPUT"; else cat; fi
+
+rm -f "$RUNTIME_LOG" "$LOADGEN_LOG"
+if [ $KEEP -eq 0 ]; then
+    rm -f st_files/$PROGRAM
+    if [ -n "$PREVIOUS_PROGRAM" ] && [ -f "st_files/$PREVIOUS_PROGRAM" ]; then
+        echo "Compiling $PREVIOUS_PROGRAM back..."
+        ./scripts/compile_program.sh "$PREVIOUS_PROGRAM" > /dev/null 2>&1 || echo "Error compiling $PREVIOUS_PROGRAM back"
+    fi
+fi
+
+exit $LOADGEN_STATUS
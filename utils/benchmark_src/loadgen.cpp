@@ -0,0 +1,564 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// Client load generator for a running OpenPLC runtime. It opens Modbus/TCP,
+// S7, DNP3 and OPC UA clients against the runtime, each one sending requests
+// at a fixed rate for a given time, and reports the number of requests, the
+// errors and the latency percentiles per protocol. It is used together with
+// the cycle time and latency histograms the runtime prints when it stops to
+// find out how the scan holds up under client load (see jitter_test.sh):
+//
+//     ./loadgen -d 60 -r 200 -c 2 -n 0
+//
+// A protocol is left out by setting its port to 0. The DNP3 outstation takes
+// a single connection, so DNP3 always gets one master whatever -c says.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <modbus.h>
+
+#include <asiodnp3/DNP3Manager.h>
+#include <asiodnp3/DefaultMasterApplication.h>
+#include <asiodnp3/PrintingChannelListener.h>
+#include <asiodnp3/ConsoleLogger.h>
+#include <opendnp3/LogLevels.h>
+
+#include <open62541/client.h>
+#include <open62541/client_config_default.h>
+#include <open62541/client_highlevel.h>
+
+#include "oplc_snap7.h"
+
+#define MAX_PROTOCOLS       4
+#define MAX_WORDS           120
+#define MB_MEMORY_START     1024    // first holding register of %MW
+#define S7_DB_OUTPUTS       102     // %QW
+#define S7_DB_MEMORY        1002    // %MW
+#define OPCUA_FIRST_NODE    4000000
+
+using namespace opendnp3;
+using namespace asiodnp3;
+using namespace asiopal;
+
+struct LoadClient
+{
+    const char *protocol;
+    int index;
+    std::vector<uint32_t> latencies; // ns, one per successful request
+    uint64_t requests;
+    uint64_t errors;
+    char error[128];
+};
+
+static std::string host = "127.0.0.1";
+static int duration = 10;
+static int rate = 100;              // requests per second of each client, 0 = no pause
+static int clients = 1;
+static int words = 32;
+static int write_percent = 25;
+static int modbus_port = 502;
+static int s7_port = 102;
+static int dnp3_port = 20000;
+static int opcua_port = 4840;
+static int dnp3_local = 1;
+static int dnp3_remote = 10;
+
+static std::atomic<bool> stopping(false);
+
+//-----------------------------------------------------------------------------
+// Returns the monotonic time in nanoseconds
+//-----------------------------------------------------------------------------
+static uint64_t nowNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+// Sleeps until the next request of a client is due. The schedule is kept
+// absolute, so a slow answer does not lower the rate of the next requests
+//-----------------------------------------------------------------------------
+static void waitNextRequest(struct timespec *next)
+{
+    if (rate <= 0) return;
+
+    next->tv_nsec += 1000000000L / rate;
+    while (next->tv_nsec >= 1000000000L)
+    {
+        next->tv_nsec -= 1000000000L;
+        next->tv_sec++;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL) == EINTR);
+}
+
+//-----------------------------------------------------------------------------
+// Counts the outcome of a request that started at start_ns
+//-----------------------------------------------------------------------------
+static void recordRequest(LoadClient *client, uint64_t start_ns, bool ok)
+{
+    client->requests++;
+    if (!ok)
+    {
+        client->errors++;
+        return;
+    }
+
+    uint64_t elapsed = nowNs() - start_ns;
+    client->latencies.push_back(elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed);
+}
+
+//-----------------------------------------------------------------------------
+// Modbus/TCP client: reads %QW holding registers and writes %MW ones
+//-----------------------------------------------------------------------------
+static void *modbusClient(void *arg)
+{
+    LoadClient *client = (LoadClient *)arg;
+    uint16_t values[MAX_WORDS];
+
+    modbus_t *ctx = modbus_new_tcp(host.c_str(), modbus_port);
+    if (ctx == NULL || modbus_connect(ctx) == -1)
+    {
+        snprintf(client->error, sizeof(client->error), "connection failed: %s", modbus_strerror(errno));
+        if (ctx != NULL) modbus_free(ctx);
+        return NULL;
+    }
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (uint64_t n = 0; !stopping; n++)
+    {
+        uint64_t start = nowNs();
+        bool ok;
+        if ((int)(n % 100) < write_percent)
+        {
+            for (int i = 0; i < words; i++) values[i] = (uint16_t)(n + i);
+            ok = modbus_write_registers(ctx, MB_MEMORY_START + client->index * words, words, values) == words;
+        }
+        else
+        {
+            ok = modbus_read_registers(ctx, 0, words, values) == words;
+        }
+        recordRequest(client, start, ok);
+        waitNextRequest(&next);
+    }
+
+    modbus_close(ctx);
+    modbus_free(ctx);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// S7 client: reads %QW from DB102 and writes %MW on DB1002
+//-----------------------------------------------------------------------------
+static void *s7Client(void *arg)
+{
+    LoadClient *client = (LoadClient *)arg;
+    byte data[MAX_WORDS * 2];
+
+    S7Object cli = Cli_Create();
+    uint16_t port = (uint16_t)s7_port;
+    Cli_SetParam(cli, p_u16_RemotePort, &port);
+    int result = Cli_ConnectTo(cli, host.c_str(), 0, 1);
+    if (result != 0)
+    {
+        snprintf(client->error, sizeof(client->error), "connection failed: error 0x%x", result);
+        Cli_Destroy(&cli);
+        return NULL;
+    }
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (uint64_t n = 0; !stopping; n++)
+    {
+        uint64_t start = nowNs();
+        if ((int)(n % 100) < write_percent)
+        {
+            for (int i = 0; i < words * 2; i++) data[i] = (byte)(n + i);
+            result = Cli_DBWrite(cli, S7_DB_MEMORY, client->index * words * 2, words * 2, data);
+        }
+        else
+        {
+            result = Cli_DBRead(cli, S7_DB_OUTPUTS, 0, words * 2, data);
+        }
+        recordRequest(client, start, result == 0);
+        waitNextRequest(&next);
+    }
+
+    Cli_Disconnect(cli);
+    Cli_Destroy(&cli);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Measurements are discarded, the DNP3 client only times the class scans
+//-----------------------------------------------------------------------------
+class DiscardSOEHandler : public ISOEHandler
+{
+public:
+    void Process(const HeaderInfo&, const ICollection<Indexed<Binary>>&) override {}
+    void Process(const HeaderInfo&, const ICollection<Indexed<DoubleBitBinary>>&) override {}
+    void Process(const HeaderInfo&, const ICollection<Indexed<Analog>>&) override {}
+    void Process(const HeaderInfo&, const ICollection<Indexed<Counter>>&) override {}
+    void Process(const HeaderInfo&, const ICollection<Indexed<FrozenCounter>>&) override {}
+    void Process(const HeaderInfo&, const ICollection<Indexed<BinaryOutputStatus>>&) override {}
+    void Process(const HeaderInfo&, const ICollection<Indexed<AnalogOutputStatus>>&) override {}
+    void Process(const HeaderInfo&, const ICollection<Indexed<OctetString>>&) override {}
+    void Process(const HeaderInfo&, const ICollection<Indexed<TimeAndInterval>>&) override {}
+    void Process(const HeaderInfo&, const ICollection<Indexed<BinaryCommandEvent>>&) override {}
+    void Process(const HeaderInfo&, const ICollection<Indexed<AnalogCommandEvent>>&) override {}
+    void Process(const HeaderInfo&, const ICollection<Indexed<SecurityStat>>&) override {}
+    void Process(const HeaderInfo&, const ICollection<DNPTime>&) override {}
+
+protected:
+    void Start() override {}
+    void End() override {}
+};
+
+//-----------------------------------------------------------------------------
+// Completion of the class scan a DNP3 client is waiting for
+//-----------------------------------------------------------------------------
+class ScanCompletion : public ITaskCallback
+{
+public:
+    void OnStart() override {}
+    void OnComplete(TaskCompletion result) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->result = result;
+        done = true;
+        completed.notify_one();
+    }
+    void OnDestroyed() override {}
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = false;
+    }
+
+    // The master times out the scan on its own (responseTimeout), the wait
+    // limit only covers a task that never completes
+    bool wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!completed.wait_for(lock, std::chrono::seconds(10), [this] { return done; })) return false;
+        return result == TaskCompletion::SUCCESS;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable completed;
+    bool done = false;
+    TaskCompletion result = TaskCompletion::FAILURE_NO_COMMS;
+};
+
+//-----------------------------------------------------------------------------
+// DNP3 master: integrity (class 0123) scans of the outstation
+//-----------------------------------------------------------------------------
+static void *dnp3Client(void *arg)
+{
+    LoadClient *client = (LoadClient *)arg;
+
+    DNP3Manager manager(1, ConsoleLogger::Create());
+    std::string name = "loadgen_" + std::to_string(client->index);
+    auto channel = manager.AddTCPClient(name, levels::NOTHING, ChannelRetry::Default(), host, "0.0.0.0",
+                                        (uint16_t)dnp3_port, PrintingChannelListener::Create());
+
+    MasterStackConfig config;
+    config.master.responseTimeout = openpal::TimeDuration::Seconds(2);
+    config.master.disableUnsolOnStartup = true;
+    config.master.unsolClassMask = ClassField::None();
+    config.master.startupIntegrityClassMask = ClassField::None();
+    config.link.LocalAddr = (uint16_t)dnp3_local;
+    config.link.RemoteAddr = (uint16_t)dnp3_remote;
+
+    auto master = channel->AddMaster(name, std::make_shared<DiscardSOEHandler>(), DefaultMasterApplication::Create(), config);
+    master->Enable();
+
+    ScanCompletion completion;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (!stopping)
+    {
+        completion.reset();
+        uint64_t start = nowNs();
+        master->ScanClasses(ClassField::AllClasses(), TaskConfig::With(completion));
+        recordRequest(client, start, completion.wait());
+        waitNextRequest(&next);
+    }
+
+    // The callback lives on this stack, so the channel is shut down while it
+    // is still valid
+    channel->Shutdown();
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Finds the index of the OpenPLC namespace on the NamespaceArray of the
+// server. Returns -1 if the server does not have it
+//-----------------------------------------------------------------------------
+static int openplcNamespace(UA_Client *ua)
+{
+    UA_Variant value;
+    UA_Variant_init(&value);
+    int index = -1;
+    if (UA_Client_readValueAttribute(ua, UA_NODEID_NUMERIC(0, UA_NS0ID_SERVER_NAMESPACEARRAY), &value) == UA_STATUSCODE_GOOD &&
+        UA_Variant_hasArrayType(&value, &UA_TYPES[UA_TYPES_STRING]))
+    {
+        UA_String *names = (UA_String *)value.data;
+        for (size_t i = 0; i < value.arrayLength; i++)
+        {
+            if (names[i].length == strlen("http://openplc.org/") &&
+                memcmp(names[i].data, "http://openplc.org/", names[i].length) == 0)
+            {
+                index = (int)i;
+                break;
+            }
+        }
+    }
+    UA_Variant_clear(&value);
+    return index;
+}
+
+//-----------------------------------------------------------------------------
+// OPC UA client: reads the values of the first located variable nodes in a
+// single Read request
+//-----------------------------------------------------------------------------
+static void *opcuaClient(void *arg)
+{
+    LoadClient *client = (LoadClient *)arg;
+
+    UA_Client *ua = UA_Client_new();
+    UA_ClientConfig_setDefault(UA_Client_getConfig(ua));
+    std::string url = "opc.tcp://" + host + ":" + std::to_string(opcua_port);
+    UA_StatusCode status = UA_Client_connect(ua, url.c_str());
+    if (status != UA_STATUSCODE_GOOD)
+    {
+        snprintf(client->error, sizeof(client->error), "connection failed: %s", UA_StatusCode_name(status));
+        UA_Client_delete(ua);
+        return NULL;
+    }
+
+    int ns = openplcNamespace(ua);
+    if (ns < 0)
+    {
+        snprintf(client->error, sizeof(client->error), "the server has no http://openplc.org/ namespace");
+        UA_Client_disconnect(ua);
+        UA_Client_delete(ua);
+        return NULL;
+    }
+
+    std::vector<UA_ReadValueId> ids(words);
+    for (int i = 0; i < words; i++)
+    {
+        UA_ReadValueId_init(&ids[i]);
+        ids[i].nodeId = UA_NODEID_NUMERIC((UA_UInt16)ns, OPCUA_FIRST_NODE + i);
+        ids[i].attributeId = UA_ATTRIBUTEID_VALUE;
+    }
+    UA_ReadRequest request;
+    UA_ReadRequest_init(&request);
+    request.nodesToRead = ids.data();
+    request.nodesToReadSize = ids.size();
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (!stopping)
+    {
+        uint64_t start = nowNs();
+        UA_ReadResponse response = UA_Client_Service_read(ua, request);
+        bool ok = response.responseHeader.serviceResult == UA_STATUSCODE_GOOD &&
+                  response.resultsSize == ids.size();
+        UA_ReadResponse_clear(&response);
+        recordRequest(client, start, ok);
+        waitNextRequest(&next);
+    }
+
+    UA_Client_disconnect(ua);
+    UA_Client_delete(ua);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Prints the requests, errors and latency percentiles (in microseconds) of
+// all the clients of a protocol together
+//-----------------------------------------------------------------------------
+static void printProtocolReport(const char *protocol, std::vector<LoadClient *> &all)
+{
+    std::vector<uint32_t> latencies;
+    uint64_t requests = 0, errors = 0;
+    bool used = false;
+    for (LoadClient *client : all)
+    {
+        if (strcmp(client->protocol, protocol) != 0) continue;
+
+        used = true;
+        if (client->error[0] != '\0') printf("%s client %d: %s\n", protocol, client->index, client->error);
+        requests += client->requests;
+        errors += client->errors;
+        latencies.insert(latencies.end(), client->latencies.begin(), client->latencies.end());
+    }
+    if (!used) return;
+
+    std::sort(latencies.begin(), latencies.end());
+    auto at = [&latencies](double fraction) -> double
+    {
+        if (latencies.empty()) return 0;
+        size_t index = (size_t)(fraction * latencies.size());
+        if (index >= latencies.size()) index = latencies.size() - 1;
+        return latencies[index] / 1000.0;
+    };
+
+    printf("%-8s %10llu %8llu %9.1f %10.1f %10.1f %10.1f %10.1f\n", protocol,
+           (unsigned long long)requests, (unsigned long long)errors, requests / (double)duration,
+           at(0.50), at(0.99), at(0.999), latencies.empty() ? 0.0 : latencies.back() / 1000.0);
+}
+
+//-----------------------------------------------------------------------------
+// Prints the options of the load generator
+//-----------------------------------------------------------------------------
+static void usage(const char *program)
+{
+    printf("Usage: %s [options]\n", program);
+    printf("  -H host      address of the runtime (default %s)\n", host.c_str());
+    printf("  -d seconds   duration of the load (default %d)\n", duration);
+    printf("  -r rate      requests per second of each client, 0 = as fast as possible (default %d)\n", rate);
+    printf("  -c clients   clients per protocol (default %d)\n", clients);
+    printf("  -w words     registers, words or nodes per request, up to %d (default %d)\n", MAX_WORDS, words);
+    printf("  -W percent   share of Modbus and S7 requests that are writes (default %d)\n", write_percent);
+    printf("  -m port      Modbus/TCP port, 0 to leave it out (default %d)\n", modbus_port);
+    printf("  -s port      S7 port, 0 to leave it out (default %d)\n", s7_port);
+    printf("  -n port      DNP3 port, 0 to leave it out (default %d)\n", dnp3_port);
+    printf("  -u port      OPC UA port, 0 to leave it out (default %d)\n", opcua_port);
+    printf("  -L addr      DNP3 link address of the master (default %d)\n", dnp3_local);
+    printf("  -R addr      DNP3 link address of the outstation (default %d)\n", dnp3_remote);
+    printf("  -h           show this help\n");
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "H:d:r:c:w:W:m:s:n:u:L:R:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'H': host = optarg; break;
+            case 'd': duration = atoi(optarg); break;
+            case 'r': rate = atoi(optarg); break;
+            case 'c': clients = atoi(optarg); break;
+            case 'w': words = atoi(optarg); break;
+            case 'W': write_percent = atoi(optarg); break;
+            case 'm': modbus_port = atoi(optarg); break;
+            case 's': s7_port = atoi(optarg); break;
+            case 'n': dnp3_port = atoi(optarg); break;
+            case 'u': opcua_port = atoi(optarg); break;
+            case 'L': dnp3_local = atoi(optarg); break;
+            case 'R': dnp3_remote = atoi(optarg); break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (duration <= 0 || rate < 0 || clients <= 0 || words <= 0 || words > MAX_WORDS ||
+        write_percent < 0 || write_percent > 100)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    struct
+    {
+        const char *protocol;
+        int port;
+        void *(*run)(void *);
+    } protocols[MAX_PROTOCOLS] =
+    {
+        {"modbus", modbus_port, modbusClient},
+        {"s7", s7_port, s7Client},
+        {"dnp3", dnp3_port, dnp3Client},
+        {"opcua", opcua_port, opcuaClient}
+    };
+
+    std::vector<LoadClient *> all;
+    std::vector<pthread_t> threads;
+    for (int p = 0; p < MAX_PROTOCOLS; p++)
+    {
+        if (protocols[p].port <= 0) continue;
+
+        int count = protocols[p].run == dnp3Client ? 1 : clients;
+        for (int i = 0; i < count; i++)
+        {
+            LoadClient *client = new LoadClient();
+            client->protocol = protocols[p].protocol;
+            client->index = i;
+            client->requests = 0;
+            client->errors = 0;
+            client->error[0] = '\0';
+            if (rate > 0) client->latencies.reserve((size_t)rate * duration);
+
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, protocols[p].run, client) != 0)
+            {
+                fprintf(stderr, "Could not start the %s client %d\n", client->protocol, i);
+                delete client;
+                continue;
+            }
+            all.push_back(client);
+            threads.push_back(thread);
+        }
+    }
+    if (all.empty())
+    {
+        fprintf(stderr, "No protocol to load\n");
+        return 2;
+    }
+
+    printf("Loading %s with %d client(s) per protocol for %d s\n", host.c_str(), clients, duration);
+    fflush(stdout);
+    sleep(duration);
+    stopping = true;
+    for (pthread_t thread : threads) pthread_join(thread, NULL);
+
+    bool failed = false;
+    printf("%-8s %10s %8s %9s %10s %10s %10s %10s\n", "protocol", "requests", "errors", "req/s", "p50(us)", "p99(us)", "p99.9(us)", "max(us)");
+    for (int p = 0; p < MAX_PROTOCOLS; p++)
+    {
+        printProtocolReport(protocols[p].protocol, all);
+    }
+    for (LoadClient *client : all)
+    {
+        if (client->error[0] != '\0' || client->errors > 0) failed = true;
+        delete client;
+    }
+
+    return failed ? 1 : 0;
+}
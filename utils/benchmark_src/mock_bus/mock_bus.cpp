@@ -0,0 +1,692 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// Mocked I2C, SPI, GPIO, sysfs and serial backends of the hardware layer
+// benchmark. The file syscalls of the hardware layer are wrapped by the
+// linker (see build_hardware_benchmark.sh): the devices the layers use are
+// opened on /dev/null and recorded on a table of mock files, the calls on
+// them are answered here. Any other file goes to the real syscall and isn't
+// counted.
+//
+// The mocked devices answer every transfer, reads get zeros except for the
+// sysfs attributes of the UniPi Neuron, whose digital inputs toggle on every
+// read. The real wiringPi does the GPIO through mapped registers, so its pin
+// calls are counted as GPIO accesses without a syscall. The accesses to the
+// registers mapped from /dev/gpiomem are plain memory accesses, only the
+// mmap is counted.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <linux/spi/spidev.h>
+#include <atomic>
+
+#include "mock_bus.h"
+#include "wiringPi.h"
+#include "wiringPiSPI.h"
+#include "wiringSerial.h"
+#include "softPwm.h"
+
+#define MOCK_MAX_FDS            4096
+#define MOCK_SPIN_LIMIT_NS      50000   //shorter waits spin, longer ones sleep
+#define MOCK_GPIO_PINS          64
+#define SYSFS_GROUP_PATH        "/sys/devices/platform/unipi_plc/io_group"
+
+//Kinds of the mock files
+#define MOCK_FILE_NONE          0
+#define MOCK_FILE_I2C           1
+#define MOCK_FILE_SPI           2
+#define MOCK_FILE_GPIOMEM       3
+#define MOCK_FILE_SERIAL        4
+#define MOCK_FILE_SYSFS_DI      5
+#define MOCK_FILE_SYSFS_AI      6
+#define MOCK_FILE_SYSFS_OUT     7
+
+extern "C"
+{
+    int __real_open(const char *path, int flags, ...);
+    int __real_close(int fd);
+    ssize_t __real_read(int fd, void *buf, size_t count);
+    ssize_t __real_write(int fd, const void *buf, size_t count);
+    ssize_t __real_pread(int fd, void *buf, size_t count, off_t offset);
+    ssize_t __real_pwrite(int fd, const void *buf, size_t count, off_t offset);
+    int __real_ioctl(int fd, unsigned long request, ...);
+    void *__real_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+    int __real_munmap(void *addr, size_t length);
+}
+
+struct MockFile
+{
+    std::atomic<uint8_t> kind;
+    uint32_t speed_hz;          //SPI clock
+    std::atomic<uint32_t> reads;
+};
+
+struct AtomicCounters
+{
+    std::atomic<uint64_t> syscalls;
+    std::atomic<uint64_t> transactions[MOCK_BUSES];
+    std::atomic<uint64_t> bytes[MOCK_BUSES];
+    std::atomic<uint64_t> bus_ns;
+};
+
+const char *mock_bus_names[MOCK_BUSES] = {"i2c", "spi", "gpio", "sysfs", "serial"};
+
+//Defaults close to the boards: I2C at 100 kHz (9 clocks per byte), SPI at
+//1 MHz, wiringPi pin accesses on mapped registers, sysfs attributes of a
+//kernel driver that talks to the board over SPI, serial at 115200 baud
+static uint64_t latency_transaction_ns[MOCK_BUSES] = {20000, 5000, 100, 30000, 5000};
+static uint64_t latency_byte_ns[MOCK_BUSES] = {90000, 8000, 0, 0, 87000};
+
+static MockFile mock_files[MOCK_MAX_FDS];
+static AtomicCounters scan_counters;
+static AtomicCounters background_counters;
+static thread_local bool scan_thread = false;
+
+static int sysfs_points = 16;
+static bool gpiomem_available = true;
+static void *gpio_registers = NULL;
+static std::atomic<int> gpio_levels[MOCK_GPIO_PINS];
+static int spi_channel_fds[2] = {-1, -1};
+
+void setMockLatency(int bus, uint64_t transaction_ns, uint64_t byte_ns)
+{
+    if (bus < 0 || bus >= MOCK_BUSES) return;
+    latency_transaction_ns[bus] = transaction_ns;
+    latency_byte_ns[bus] = byte_ns;
+}
+
+void getMockLatency(int bus, uint64_t *transaction_ns, uint64_t *byte_ns)
+{
+    *transaction_ns = latency_transaction_ns[bus];
+    *byte_ns = latency_byte_ns[bus];
+}
+
+void setMockSysfsPoints(int points)
+{
+    sysfs_points = points;
+}
+
+void setMockGpiomem(bool available)
+{
+    gpiomem_available = available;
+}
+
+void markScanThread()
+{
+    scan_thread = true;
+}
+
+static void copyCounters(AtomicCounters *from, MockCounters *to)
+{
+    to->syscalls = from->syscalls.load(std::memory_order_relaxed);
+    for (int i = 0; i < MOCK_BUSES; i++)
+    {
+        to->transactions[i] = from->transactions[i].load(std::memory_order_relaxed);
+        to->bytes[i] = from->bytes[i].load(std::memory_order_relaxed);
+    }
+    to->bus_ns = from->bus_ns.load(std::memory_order_relaxed);
+}
+
+void readMockCounters(MockCounters *scan, MockCounters *background)
+{
+    if (scan != NULL) copyCounters(&scan_counters, scan);
+    if (background != NULL) copyCounters(&background_counters, background);
+}
+
+static uint64_t monotonicNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+// Waits for the time the bus takes. The short waits spin, as a driver
+// polling its controller would, the long ones sleep
+//-----------------------------------------------------------------------------
+static void waitBus(uint64_t ns)
+{
+    if (ns == 0) return;
+    if (ns >= MOCK_SPIN_LIMIT_NS)
+    {
+        struct timespec wait;
+        wait.tv_sec = ns / 1000000000ULL;
+        wait.tv_nsec = ns % 1000000000ULL;
+        nanosleep(&wait, NULL);
+        return;
+    }
+    uint64_t end = monotonicNs() + ns;
+    while (monotonicNs() < end);
+}
+
+//-----------------------------------------------------------------------------
+// Counts a call on the counters of the calling thread and waits for the bus.
+// byte_ns overrides the latency per byte of the bus when it isn't 0
+//-----------------------------------------------------------------------------
+static void busCall(int bus, int syscalls, uint64_t transactions, uint64_t bytes, uint64_t byte_ns = 0)
+{
+    AtomicCounters *counters = scan_thread ? &scan_counters : &background_counters;
+    uint64_t ns = transactions * latency_transaction_ns[bus] + bytes * (byte_ns ? byte_ns : latency_byte_ns[bus]);
+
+    counters->syscalls.fetch_add(syscalls, std::memory_order_relaxed);
+    counters->transactions[bus].fetch_add(transactions, std::memory_order_relaxed);
+    counters->bytes[bus].fetch_add(bytes, std::memory_order_relaxed);
+    counters->bus_ns.fetch_add(ns, std::memory_order_relaxed);
+    waitBus(ns);
+}
+
+static void countSyscall()
+{
+    AtomicCounters *counters = scan_thread ? &scan_counters : &background_counters;
+    counters->syscalls.fetch_add(1, std::memory_order_relaxed);
+}
+
+static int mockKind(int fd)
+{
+    if (fd < 0 || fd >= MOCK_MAX_FDS) return MOCK_FILE_NONE;
+    return mock_files[fd].kind.load(std::memory_order_acquire);
+}
+
+//-----------------------------------------------------------------------------
+// Opens a mock file of the given kind on /dev/null
+//-----------------------------------------------------------------------------
+static int openMockFile(int kind, uint32_t speed_hz = 0)
+{
+    int fd = __real_open("/dev/null", O_RDWR);
+    if (fd < 0) return fd;
+    if (fd >= MOCK_MAX_FDS)
+    {
+        __real_close(fd);
+        errno = EMFILE;
+        return -1;
+    }
+    mock_files[fd].speed_hz = speed_hz;
+    mock_files[fd].reads.store(0, std::memory_order_relaxed);
+    mock_files[fd].kind.store(kind, std::memory_order_release);
+    countSyscall();
+    return fd;
+}
+
+//-----------------------------------------------------------------------------
+// Kind of the sysfs attribute of the UniPi Neuron on path, MOCK_FILE_NONE
+// if the mocked board doesn't have it. The board has one I/O group with
+// sysfs_points digital inputs, half of them digital outputs and relays and
+// a quarter of them analog inputs and outputs, plus four user leds
+//-----------------------------------------------------------------------------
+static int sysfsKind(const char *path)
+{
+    int group, major, minor;
+    char type[3];
+    char attribute[32];
+
+    if (strncmp(path, SYSFS_GROUP_PATH, strlen(SYSFS_GROUP_PATH)) != 0) return MOCK_FILE_NONE;
+    path += strlen(SYSFS_GROUP_PATH);
+
+    if (sscanf(path, "%d/leds/unipi:green:uled-x%d/%31s", &group, &minor, attribute) == 3)
+    {
+        return (group == 1 && minor < 4 && strcmp(attribute, "brightness") == 0) ? MOCK_FILE_SYSFS_OUT : MOCK_FILE_NONE;
+    }
+    if (sscanf(path, "%d/%2[a-z]_%d_%d/%31s", &group, type, &major, &minor, attribute) != 5) return MOCK_FILE_NONE;
+    if (group != 1 || major < 1 || minor < 1 || minor > 19) return MOCK_FILE_NONE;
+
+    int index = (major - 1) * 19 + minor - 1;
+    if (strcmp(type, "di") == 0 && strcmp(attribute, "di_value") == 0)
+    {
+        return index < sysfs_points ? MOCK_FILE_SYSFS_DI : MOCK_FILE_NONE;
+    }
+    if ((strcmp(type, "do") == 0 && strcmp(attribute, "do_value") == 0) ||
+        (strcmp(type, "ro") == 0 && strcmp(attribute, "ro_value") == 0))
+    {
+        return index < sysfs_points / 2 ? MOCK_FILE_SYSFS_OUT : MOCK_FILE_NONE;
+    }
+    if (strcmp(type, "ai") == 0 && strcmp(attribute, "in_voltage0_raw") == 0)
+    {
+        return index < sysfs_points / 4 ? MOCK_FILE_SYSFS_AI : MOCK_FILE_NONE;
+    }
+    if (strcmp(type, "ao") == 0 && strcmp(attribute, "out_voltage0_raw") == 0)
+    {
+        return index < sysfs_points / 4 ? MOCK_FILE_SYSFS_OUT : MOCK_FILE_NONE;
+    }
+    return MOCK_FILE_NONE;
+}
+
+//-----------------------------------------------------------------------------
+// Value of a sysfs attribute, as the driver formats it
+//-----------------------------------------------------------------------------
+static ssize_t readSysfs(int fd, void *buf, size_t count)
+{
+    char value[32];
+    uint32_t reads = mock_files[fd].reads.fetch_add(1, std::memory_order_relaxed);
+
+    switch (mockKind(fd))
+    {
+        case MOCK_FILE_SYSFS_DI: snprintf(value, sizeof(value), "%d\n", reads & 1); break;
+        case MOCK_FILE_SYSFS_AI: snprintf(value, sizeof(value), "%u\n", (reads * 37) % 10000); break;
+        default: snprintf(value, sizeof(value), "0\n"); break;
+    }
+
+    size_t length = strlen(value);
+    if (length > count) length = count;
+    memcpy(buf, value, length);
+    busCall(MOCK_BUS_SYSFS, 1, 1, length);
+    return length;
+}
+
+static ssize_t writeMock(int fd, size_t count)
+{
+    switch (mockKind(fd))
+    {
+        case MOCK_FILE_SYSFS_DI:
+        case MOCK_FILE_SYSFS_AI:
+        case MOCK_FILE_SYSFS_OUT: busCall(MOCK_BUS_SYSFS, 1, 1, count); break;
+        case MOCK_FILE_SERIAL: busCall(MOCK_BUS_SERIAL, 1, 1, count); break;
+        case MOCK_FILE_I2C: busCall(MOCK_BUS_I2C, 1, 1, count); break;
+        case MOCK_FILE_SPI: busCall(MOCK_BUS_SPI, 1, 1, count); break;
+        default: countSyscall(); break;
+    }
+    return count;
+}
+
+static ssize_t readMock(int fd, void *buf, size_t count)
+{
+    switch (mockKind(fd))
+    {
+        case MOCK_FILE_SYSFS_DI:
+        case MOCK_FILE_SYSFS_AI:
+        case MOCK_FILE_SYSFS_OUT: return readSysfs(fd, buf, count);
+        case MOCK_FILE_SERIAL: countSyscall(); return 0;
+        case MOCK_FILE_I2C: memset(buf, 0, count); busCall(MOCK_BUS_I2C, 1, 1, count); return count;
+        case MOCK_FILE_SPI: memset(buf, 0, count); busCall(MOCK_BUS_SPI, 1, 1, count); return count;
+        default: countSyscall(); return count;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// I2C_RDWR runs its messages as one combined transaction, each message is a
+// bus transaction of its own (a start, the address and the data)
+//-----------------------------------------------------------------------------
+static int ioctlI2c(unsigned long request, void *arg)
+{
+    if (request == I2C_RDWR)
+    {
+        struct i2c_rdwr_ioctl_data *transfer = (struct i2c_rdwr_ioctl_data *)arg;
+        uint64_t bytes = 0;
+        for (uint32_t i = 0; i < transfer->nmsgs; i++)
+        {
+            struct i2c_msg *msg = &transfer->msgs[i];
+            if (msg->flags & I2C_M_RD) memset(msg->buf, 0, msg->len);
+            bytes += msg->len + 1;
+        }
+        busCall(MOCK_BUS_I2C, 1, transfer->nmsgs, bytes);
+        return transfer->nmsgs;
+    }
+    if (request == I2C_SMBUS)
+    {
+        struct i2c_smbus_ioctl_data *data = (struct i2c_smbus_ioctl_data *)arg;
+        if (data->read_write == I2C_SMBUS_READ && data->data != NULL) memset(data->data, 0, sizeof(*data->data));
+        busCall(MOCK_BUS_I2C, 1, 2, 3);
+        return 0;
+    }
+
+    //I2C_SLAVE and the other settings of the adapter
+    countSyscall();
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// SPI_IOC_MESSAGE(n) runs n transfers, each one at its own clock if it sets
+// one. The other requests set the mode of the device
+//-----------------------------------------------------------------------------
+static int ioctlSpi(int fd, unsigned long request, void *arg)
+{
+    if (_IOC_TYPE(request) == SPI_IOC_MAGIC && _IOC_NR(request) == 0 && _IOC_DIR(request) == _IOC_WRITE)
+    {
+        struct spi_ioc_transfer *transfers = (struct spi_ioc_transfer *)arg;
+        int count = _IOC_SIZE(request) / sizeof(struct spi_ioc_transfer);
+        int length = 0;
+        countSyscall();
+        for (int i = 0; i < count; i++)
+        {
+            uint32_t speed = transfers[i].speed_hz ? transfers[i].speed_hz : mock_files[fd].speed_hz;
+            if (transfers[i].rx_buf != 0) memset((void *)(uintptr_t)transfers[i].rx_buf, 0, transfers[i].len);
+            busCall(MOCK_BUS_SPI, 0, 1, transfers[i].len, speed ? 8000000000ULL / speed : 0);
+            length += transfers[i].len;
+        }
+        return length;
+    }
+
+    countSyscall();
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Syscalls wrapped by the linker
+//-----------------------------------------------------------------------------
+extern "C" int __wrap_open(const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+    if (flags & O_CREAT)
+    {
+        va_list args;
+        va_start(args, flags);
+        mode = va_arg(args, int);
+        va_end(args);
+    }
+
+    if (strncmp(path, "/dev/i2c-", 9) == 0) return openMockFile(MOCK_FILE_I2C);
+    if (strncmp(path, "/dev/spidev", 11) == 0) return openMockFile(MOCK_FILE_SPI);
+    if (strcmp(path, "/dev/gpiomem") == 0 || strcmp(path, "/dev/mem") == 0)
+    {
+        if (gpiomem_available) return openMockFile(MOCK_FILE_GPIOMEM);
+        countSyscall();
+        errno = ENOENT;
+        return -1;
+    }
+    if (strncmp(path, "/dev/tty", 8) == 0) return openMockFile(MOCK_FILE_SERIAL);
+    if (strncmp(path, "/sys/", 5) == 0)
+    {
+        int kind = sysfsKind(path);
+        if (kind != MOCK_FILE_NONE) return openMockFile(kind);
+        countSyscall();
+        errno = ENOENT;
+        return -1;
+    }
+
+    return __real_open(path, flags, mode);
+}
+
+extern "C" int __wrap_open64(const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+    if (flags & O_CREAT)
+    {
+        va_list args;
+        va_start(args, flags);
+        mode = va_arg(args, int);
+        va_end(args);
+    }
+    return __wrap_open(path, flags, mode);
+}
+
+extern "C" int __wrap_close(int fd)
+{
+    if (mockKind(fd) != MOCK_FILE_NONE)
+    {
+        mock_files[fd].kind.store(MOCK_FILE_NONE, std::memory_order_release);
+        countSyscall();
+    }
+    return __real_close(fd);
+}
+
+extern "C" ssize_t __wrap_read(int fd, void *buf, size_t count)
+{
+    if (mockKind(fd) == MOCK_FILE_NONE) return __real_read(fd, buf, count);
+    return readMock(fd, buf, count);
+}
+
+extern "C" ssize_t __wrap_write(int fd, const void *buf, size_t count)
+{
+    if (mockKind(fd) == MOCK_FILE_NONE) return __real_write(fd, buf, count);
+    return writeMock(fd, count);
+}
+
+extern "C" ssize_t __wrap_pread(int fd, void *buf, size_t count, off_t offset)
+{
+    if (mockKind(fd) == MOCK_FILE_NONE) return __real_pread(fd, buf, count, offset);
+    return readMock(fd, buf, count);
+}
+
+extern "C" ssize_t __wrap_pread64(int fd, void *buf, size_t count, off_t offset)
+{
+    return __wrap_pread(fd, buf, count, offset);
+}
+
+extern "C" ssize_t __wrap_pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+    if (mockKind(fd) == MOCK_FILE_NONE) return __real_pwrite(fd, buf, count, offset);
+    return writeMock(fd, count);
+}
+
+extern "C" ssize_t __wrap_pwrite64(int fd, const void *buf, size_t count, off_t offset)
+{
+    return __wrap_pwrite(fd, buf, count, offset);
+}
+
+extern "C" int __wrap_ioctl(int fd, unsigned long request, ...)
+{
+    va_list args;
+    va_start(args, request);
+    void *arg = va_arg(args, void *);
+    va_end(args);
+
+    switch (mockKind(fd))
+    {
+        case MOCK_FILE_NONE: return __real_ioctl(fd, request, arg);
+        case MOCK_FILE_I2C: return ioctlI2c(request, arg);
+        case MOCK_FILE_SPI: return ioctlSpi(fd, request, arg);
+        case MOCK_FILE_SERIAL:
+            //FIONREAD of serialDataAvail, nothing is ever received
+            if (arg != NULL && request == FIONREAD) *(int *)arg = 0;
+            countSyscall();
+            return 0;
+        default: countSyscall(); return 0;
+    }
+}
+
+extern "C" void *__wrap_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+    if (mockKind(fd) != MOCK_FILE_GPIOMEM) return __real_mmap(addr, length, prot, flags, fd, offset);
+
+    countSyscall();
+    void *registers = NULL;
+    if (posix_memalign(&registers, 4096, length) != 0) return MAP_FAILED;
+    memset(registers, 0, length);
+    gpio_registers = registers;
+    return registers;
+}
+
+extern "C" void *__wrap_mmap64(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+    return __wrap_mmap(addr, length, prot, flags, fd, offset);
+}
+
+extern "C" int __wrap_munmap(void *addr, size_t length)
+{
+    if (addr == NULL || addr != gpio_registers) return __real_munmap(addr, length);
+
+    countSyscall();
+    free(gpio_registers);
+    gpio_registers = NULL;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// wiringPi
+//-----------------------------------------------------------------------------
+static const int wpi_to_gpio[] = {17, 18, 27, 22, 23, 24, 25, 4, 2, 3, 8, 7, 10, 9, 11, 14,
+                                  15, 28, 29, 30, 31, 5, 6, 13, 19, 26, 12, 16, 20, 21, 0, 1};
+
+static void gpioAccess()
+{
+    busCall(MOCK_BUS_GPIO, 0, 1, 0);
+}
+
+int wiringPiSetup(void) { return 0; }
+int wiringPiSetupGpio(void) { return 0; }
+void pinMode(int pin, int mode) { gpioAccess(); }
+void pullUpDnControl(int pin, int pud) { gpioAccess(); }
+void pwmSetMode(int mode) { gpioAccess(); }
+void pwmSetRange(unsigned int range) { gpioAccess(); }
+void pwmSetClock(int divisor) { gpioAccess(); }
+void pwmWrite(int pin, int value) { gpioAccess(); }
+int piHiPri(const int priority) { return 0; }
+
+int digitalRead(int pin)
+{
+    gpioAccess();
+    if (pin < 0 || pin >= MOCK_GPIO_PINS) return LOW;
+    return gpio_levels[pin].load(std::memory_order_relaxed);
+}
+
+void digitalWrite(int pin, int value)
+{
+    gpioAccess();
+    if (pin >= 0 && pin < MOCK_GPIO_PINS) gpio_levels[pin].store(value != 0, std::memory_order_relaxed);
+}
+
+int analogRead(int pin)
+{
+    gpioAccess();
+    return 0;
+}
+
+void analogWrite(int pin, int value)
+{
+    gpioAccess();
+}
+
+int wpiPinToGpio(int pin)
+{
+    if (pin < 0 || pin >= (int)(sizeof(wpi_to_gpio) / sizeof(wpi_to_gpio[0]))) return -1;
+    return wpi_to_gpio[pin];
+}
+
+void delay(unsigned int ms)
+{
+    struct timespec wait;
+    wait.tv_sec = ms / 1000;
+    wait.tv_nsec = (ms % 1000) * 1000000L;
+    nanosleep(&wait, NULL);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    waitBus((uint64_t)us * 1000);
+}
+
+unsigned int millis(void)
+{
+    return (unsigned int)(monotonicNs() / 1000000ULL);
+}
+
+unsigned int micros(void)
+{
+    return (unsigned int)(monotonicNs() / 1000ULL);
+}
+
+//-----------------------------------------------------------------------------
+// wiringPiSPI. A transfer is one SPI_IOC_MESSAGE ioctl on the real library
+//-----------------------------------------------------------------------------
+int wiringPiSPISetupMode(int channel, int speed, int mode)
+{
+    channel &= 1;
+    spi_channel_fds[channel] = openMockFile(MOCK_FILE_SPI, speed);
+    return spi_channel_fds[channel];
+}
+
+int wiringPiSPISetup(int channel, int speed)
+{
+    return wiringPiSPISetupMode(channel, speed, 0);
+}
+
+int wiringPiSPIGetFd(int channel)
+{
+    return spi_channel_fds[channel & 1];
+}
+
+int wiringPiSPIDataRW(int channel, unsigned char *data, int len)
+{
+    int fd = spi_channel_fds[channel & 1];
+    if (mockKind(fd) != MOCK_FILE_SPI) return -1;
+
+    uint32_t speed = mock_files[fd].speed_hz;
+    memset(data, 0, len);
+    busCall(MOCK_BUS_SPI, 1, 1, len, speed ? 8000000000ULL / speed : 0);
+    return len;
+}
+
+//-----------------------------------------------------------------------------
+// wiringSerial
+//-----------------------------------------------------------------------------
+int serialOpen(const char *device, const int baud)
+{
+    return openMockFile(MOCK_FILE_SERIAL);
+}
+
+void serialClose(const int fd)
+{
+    __wrap_close(fd);
+}
+
+void serialFlush(const int fd)
+{
+    countSyscall();
+}
+
+void serialPutchar(const int fd, const unsigned char c)
+{
+    writeMock(fd, 1);
+}
+
+void serialPuts(const int fd, const char *s)
+{
+    writeMock(fd, strlen(s));
+}
+
+int serialDataAvail(const int fd)
+{
+    countSyscall();
+    return 0;
+}
+
+int serialGetchar(const int fd)
+{
+    countSyscall();
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// softPwm. The real library toggles the pin from a thread of its own, which
+// isn't counted
+//-----------------------------------------------------------------------------
+int softPwmCreate(int pin, int value, int range)
+{
+    gpioAccess();
+    return 0;
+}
+
+void softPwmWrite(int pin, int value)
+{
+    gpioAccess();
+}
+
+void softPwmStop(int pin)
+{
+    gpioAccess();
+}
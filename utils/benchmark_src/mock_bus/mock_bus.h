@@ -0,0 +1,70 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// Mocked buses of the hardware layer benchmark (hardware_benchmark.cpp). The
+// hardware layer is linked with -Wl,--wrap for the file syscalls, so opening
+// /dev/i2c-*, /dev/spidev*, /dev/gpiomem or a sysfs attribute gives a mock
+// file, and with the wiringPi API of mock_bus.cpp. Every call on a mock file
+// is counted as a syscall, the messages it carries as bus transactions, and
+// takes the time the bus would take to run them.
+//-----------------------------------------------------------------------------
+
+#ifndef MOCK_BUS_H
+#define MOCK_BUS_H
+
+#include <stdint.h>
+
+//Buses of the mock
+#define MOCK_BUS_I2C        0
+#define MOCK_BUS_SPI        1
+#define MOCK_BUS_GPIO       2
+#define MOCK_BUS_SYSFS      3
+#define MOCK_BUS_SERIAL     4
+#define MOCK_BUSES          5
+
+//What the calls of a thread (or a set of threads) cost on the mocked buses
+struct MockCounters
+{
+    uint64_t syscalls;
+    uint64_t transactions[MOCK_BUSES];  //I2C messages, SPI transfers, GPIO pin
+                                        //accesses, sysfs reads and writes,
+                                        //serial writes
+    uint64_t bytes[MOCK_BUSES];
+    uint64_t bus_ns;                    //time spent waiting for the buses
+};
+
+extern const char *mock_bus_names[MOCK_BUSES];
+
+//Latency of a bus: a fixed time per transaction plus a time per byte. The
+//SPI transfers that set their speed take 8 bits of that clock per byte
+void setMockLatency(int bus, uint64_t transaction_ns, uint64_t byte_ns);
+void getMockLatency(int bus, uint64_t *transaction_ns, uint64_t *byte_ns);
+
+//Points of each kind the mocked sysfs of the UniPi Neuron exposes
+void setMockSysfsPoints(int points);
+
+//Without /dev/gpiomem the layers fall back to the wiringPi calls
+void setMockGpiomem(bool available);
+
+//The calls of the thread that marks itself go on the scan counters, the
+//calls of every other thread (the I/O threads of the layers) on the
+//background counters
+void markScanThread();
+void readMockCounters(MockCounters *scan, MockCounters *background);
+
+#endif
@@ -0,0 +1,17 @@
+// wiringPi software PWM API of the mocked bus (mock_bus.cpp)
+#ifndef MOCK_SOFTPWM_H
+#define MOCK_SOFTPWM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int softPwmCreate(int pin, int value, int range);
+void softPwmWrite(int pin, int value);
+void softPwmStop(int pin);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
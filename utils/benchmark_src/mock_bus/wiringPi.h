@@ -0,0 +1,47 @@
+// wiringPi API of the mocked bus (mock_bus.cpp), for the hardware layer
+// benchmark. Only what the hardware layers use is declared
+#ifndef MOCK_WIRINGPI_H
+#define MOCK_WIRINGPI_H
+
+#define LOW             0
+#define HIGH            1
+
+#define INPUT           0
+#define OUTPUT          1
+#define PWM_OUTPUT      2
+
+#define PUD_OFF         0
+#define PUD_DOWN        1
+#define PUD_UP          2
+
+#define PWM_MODE_MS     0
+#define PWM_MODE_BAL    1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int wiringPiSetup(void);
+int wiringPiSetupGpio(void);
+void pinMode(int pin, int mode);
+void pullUpDnControl(int pin, int pud);
+int digitalRead(int pin);
+void digitalWrite(int pin, int value);
+void pwmWrite(int pin, int value);
+void pwmSetMode(int mode);
+void pwmSetRange(unsigned int range);
+void pwmSetClock(int divisor);
+int analogRead(int pin);
+void analogWrite(int pin, int value);
+int wpiPinToGpio(int pin);
+int piHiPri(const int priority);
+void delay(unsigned int ms);
+void delayMicroseconds(unsigned int us);
+unsigned int millis(void);
+unsigned int micros(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
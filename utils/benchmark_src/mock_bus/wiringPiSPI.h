@@ -0,0 +1,18 @@
+// wiringPi SPI API of the mocked bus (mock_bus.cpp)
+#ifndef MOCK_WIRINGPISPI_H
+#define MOCK_WIRINGPISPI_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int wiringPiSPIGetFd(int channel);
+int wiringPiSPIDataRW(int channel, unsigned char *data, int len);
+int wiringPiSPISetupMode(int channel, int speed, int mode);
+int wiringPiSPISetup(int channel, int speed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,21 @@
+// wiringPi serial API of the mocked bus (mock_bus.cpp)
+#ifndef MOCK_WIRINGSERIAL_H
+#define MOCK_WIRINGSERIAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int serialOpen(const char *device, const int baud);
+void serialClose(const int fd);
+void serialFlush(const int fd);
+void serialPutchar(const int fd, const unsigned char c);
+void serialPuts(const int fd, const char *s);
+int serialDataAvail(const int fd);
+int serialGetchar(const int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
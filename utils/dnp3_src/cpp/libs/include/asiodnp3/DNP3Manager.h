@@ -60,12 +60,15 @@ public:
 	*	@param handler Callback interface for log messages
 	*	@param onThreadStart Action to run when a thread pool thread starts
 	*	@param onThreadExit Action to run just before a thread pool thread exits
+	*	@param timerResolutionMs When not zero, timers expire on multiples of this many
+	*	milliseconds, so the periodic timers of many sessions share the wake ups of the pool
 	*/
 	DNP3Manager(
 	    uint32_t concurrencyHint,
 	    std::shared_ptr<openpal::ILogHandler> handler = std::shared_ptr<openpal::ILogHandler>(),
 	std::function<void()> onThreadStart = []() {},
-	std::function<void()> onThreadExit = []() {}
+	std::function<void()> onThreadExit = []() {},
+	uint32_t timerResolutionMs = 0
 	);
 
 	~DNP3Manager();
@@ -70,6 +70,9 @@ public:
 
 private:
 
+	// rounds an expiration up to the timer resolution of the IO
+	steady_clock_t::time_point Coarsen(const steady_clock_t::time_point& expiration) const;
+
 	// we hold a shared_ptr to the pool so that it cannot dissapear while the strand is still executing
 	std::shared_ptr<IO> io;
 
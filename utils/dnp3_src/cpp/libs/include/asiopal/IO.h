@@ -23,6 +23,8 @@
 
 #include <asio.hpp>
 
+#include <chrono>
+
 namespace asiopal
 {
 
@@ -34,10 +36,26 @@ class IO
 
 public:
 
+	IO() {}
+
+	/**
+	* A concurrency hint of 1 tells asio that a single thread runs the service.
+	* The completed operations then go to a queue of that thread, without the
+	* interrupt of the reactor and the wake up of another thread each time
+	*/
+	explicit IO(std::size_t concurrencyHint) : service(concurrencyHint) {}
+
 	virtual ~IO() {}
 
 	asio::io_service service;
 
+	/**
+	* When not zero, the expirations of the timers started by the executors are
+	* rounded up to a multiple of this resolution, so timers that expire close
+	* to each other are run by one wake up of the service
+	*/
+	std::chrono::milliseconds timerResolution = std::chrono::milliseconds(0);
+
 };
 
 }
@@ -43,6 +43,8 @@ struct TLSConfig
 	* @param allowTLSv11 Allow TLS version 1.1 (default false)
 	* @param allowTLSv12 Allow TLS version 1.2 (default true)
 	* @param cipherList The openssl cipher-list, defaults to "" which does not modify the default cipher list
+	* @param sessionResumption Let clients resume their sessions with session tickets or the session cache (servers only, default false)
+	* @param sessionTimeout Seconds a session can be resumed after its full handshake
 	*
 	* localCertFilePath and privateKeyFilePath can optionally be the same file, i.e. a PEM that contains both pieces of data.
 	*
@@ -55,7 +57,9 @@ struct TLSConfig
 	    bool allowTLSv10 = false,
 	    bool allowTLSv11 = false,
 	    bool allowTLSv12 = true,
-	    const std::string& cipherList = ""
+	    const std::string& cipherList = "",
+	    bool sessionResumption = false,
+	    long sessionTimeout = 7200
 	) :
 		peerCertFilePath(peerCertFilePath),
 		localCertFilePath(localCertFilePath),
@@ -64,7 +68,9 @@ struct TLSConfig
 		allowTLSv10(allowTLSv10),
 		allowTLSv11(allowTLSv11),
 		allowTLSv12(allowTLSv12),
-		cipherList(cipherList)
+		cipherList(cipherList),
+		sessionResumption(sessionResumption),
+		sessionTimeout(sessionTimeout)
 	{}
 
 	/// Certificate file used to verify the peer or server. Can be CA file or a self-signed cert provided by other party.
@@ -91,6 +97,13 @@ struct TLSConfig
 	/// openssl format cipher list
 	std::string cipherList;
 
+	/// Resume sessions with session tickets or the server session cache, so a reconnecting
+	/// client skips the certificate exchange and key agreement of a full handshake (servers only)
+	bool sessionResumption;
+
+	/// Seconds a session can be resumed after its full handshake
+	long sessionTimeout;
+
 };
 
 }
@@ -29,8 +29,9 @@ DNP3Manager::DNP3Manager(
     uint32_t concurrencyHint,
     std::shared_ptr<openpal::ILogHandler> handler,
     std::function<void()> onThreadStart,
-    std::function<void()> onThreadExit) :
-	impl(std::make_unique<DNP3ManagerImpl>(concurrencyHint, handler, onThreadStart, onThreadExit))
+    std::function<void()> onThreadExit,
+    uint32_t timerResolutionMs) :
+	impl(std::make_unique<DNP3ManagerImpl>(concurrencyHint, handler, onThreadStart, onThreadExit, timerResolutionMs))
 {
 
 }
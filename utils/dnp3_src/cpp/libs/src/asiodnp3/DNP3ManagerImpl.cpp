@@ -47,14 +47,23 @@ DNP3ManagerImpl::DNP3ManagerImpl(
     uint32_t concurrencyHint,
     std::shared_ptr<openpal::ILogHandler> handler,
     std::function<void()> onThreadStart,
-    std::function<void()> onThreadExit
+    std::function<void()> onThreadExit,
+    uint32_t timerResolutionMs
 ) :
 	logger(handler, "manager", opendnp3::levels::ALL),
-	io(std::make_shared<asiopal::IO>()),
+	io(CreateIO(concurrencyHint, timerResolutionMs)),
 	threadpool(logger, io, concurrencyHint, onThreadStart, onThreadExit),
 	resources(ResourceManager::Create())
 {}
 
+std::shared_ptr<asiopal::IO> DNP3ManagerImpl::CreateIO(uint32_t concurrencyHint, uint32_t timerResolutionMs)
+{
+	// With one thread in the pool, asio can skip the cross-thread wake ups
+	auto io = (concurrencyHint == 1) ? std::make_shared<asiopal::IO>(1) : std::make_shared<asiopal::IO>();
+	io->timerResolution = std::chrono::milliseconds(timerResolutionMs);
+	return io;
+}
+
 DNP3ManagerImpl::~DNP3ManagerImpl()
 {
 	this->Shutdown();
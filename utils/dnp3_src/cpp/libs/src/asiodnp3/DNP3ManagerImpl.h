@@ -52,7 +52,8 @@ public:
 	    uint32_t concurrencyHint,
 	    std::shared_ptr<openpal::ILogHandler> handler,
 	    std::function<void()> onThreadStart,
-	    std::function<void()> onThreadExit
+	    std::function<void()> onThreadExit,
+	    uint32_t timerResolutionMs
 	);
 
 	~DNP3ManagerImpl();
@@ -123,6 +124,8 @@ public:
 
 private:
 
+	static std::shared_ptr<asiopal::IO> CreateIO(uint32_t concurrencyHint, uint32_t timerResolutionMs);
+
 	openpal::Logger logger;
 	const std::shared_ptr<asiopal::IO> io;
 	asiopal::ThreadPool threadpool;
@@ -78,9 +78,14 @@ bool MasterTLSServer::VerifyCallback(uint64_t sessionid, bool preverified, asio:
 	char subjectName[MAX_SUBJECT_NAME];
 	X509_NAME_oneline(X509_get_subject_name(cert), subjectName, MAX_SUBJECT_NAME);
 
+	// the thumbprint, X509 is opaque since OpenSSL 1.1
+	uint8_t sha1Hash[SHA_DIGEST_LENGTH] = { 0 };
+	unsigned int hashLength = SHA_DIGEST_LENGTH;
+	X509_digest(cert, EVP_sha1(), sha1Hash, &hashLength);
+
 	X509Info info(
 	    depth,
-	    RSlice(cert->sha1_hash, SHA_DIGEST_LENGTH), // the thumbprint
+	    RSlice(sha1Hash, SHA_DIGEST_LENGTH),
 	    std::string(subjectName)
 	);
 
@@ -49,7 +49,7 @@ TLSServerIOHandler::TLSServerIOHandler(
 	IOHandler(logger, listener),
 	executor(executor),
 	endpoint(endpoint),
-	config(config)
+	context(std::make_shared<asiopal::SSLContext>(logger, true, config, ec))
 {}
 
 
@@ -70,7 +70,7 @@ void TLSServerIOHandler::BeginChannelAccept()
 	};
 
 	std::error_code ec;
-	this->server = std::make_shared<Server>(this->logger, this->executor, this->endpoint, this->config, ec);
+	this->server = std::make_shared<Server>(this->logger, this->executor, this->endpoint, this->context, ec);
 
 	if (ec)
 	{
@@ -79,7 +79,10 @@ void TLSServerIOHandler::BeginChannelAccept()
 	else
 	{
 		this->server->StartAcceptingConnection(callback, ec);
-		FORMAT_LOG_BLOCK(this->logger, flags::ERR, "Unable to begin accepting connections: %s", ec.message().c_str());
+		if (ec)
+		{
+			FORMAT_LOG_BLOCK(this->logger, flags::ERR, "Unable to begin accepting connections: %s", ec.message().c_str());
+		}
 	}
 }
 
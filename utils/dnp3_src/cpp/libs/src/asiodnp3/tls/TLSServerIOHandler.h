@@ -45,10 +45,10 @@ class TLSServerIOHandler final : public IOHandler
 		    const openpal::Logger& logger,
 		    const std::shared_ptr<asiopal::Executor>& executor,
 		    const asiopal::IPEndpoint& endpoint,
-		    const asiopal::TLSConfig& config,
+		    const std::shared_ptr<asiopal::SSLContext>& context,
 		    std::error_code& ec
 		) :
-			TLSServer(logger, executor, endpoint, config, ec)
+			TLSServer(logger, executor, endpoint, context, ec)
 		{}
 
 		void StartAcceptingConnection(const callback_t& callback, std::error_code& ec)
@@ -107,7 +107,8 @@ private:
 
 	const std::shared_ptr<asiopal::Executor> executor;
 	const asiopal::IPEndpoint endpoint;
-	const asiopal::TLSConfig config;
+	// created once, so sessions negotiated before the server was suspended can be resumed
+	const std::shared_ptr<asiopal::SSLContext> context;
 	std::shared_ptr<Server> server;
 };
 
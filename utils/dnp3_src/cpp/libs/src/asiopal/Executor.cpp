@@ -61,7 +61,7 @@ openpal::ITimer* Executor::Start(const steady_clock_t::time_point& expiration, c
 {
 	auto timer = std::make_shared<Timer>(this->strand.get_io_service());
 
-	timer->timer.expires_at(expiration);
+	timer->timer.expires_at(Coarsen(expiration));
 
 	// neither the executor nor the timer can be deleted while the timer is still active
 	auto callback = [timer, runnable, self = shared_from_this()](const std::error_code & ec)
@@ -77,6 +77,18 @@ openpal::ITimer* Executor::Start(const steady_clock_t::time_point& expiration, c
 	return timer.get();
 }
 
+steady_clock_t::time_point Executor::Coarsen(const steady_clock_t::time_point& expiration) const
+{
+	const auto resolution = std::chrono::duration_cast<steady_clock_t::duration>(io->timerResolution);
+	if (resolution.count() <= 0 || expiration > steady_clock_t::time_point::max() - resolution)
+	{
+		return expiration;
+	}
+
+	const auto remainder = expiration.time_since_epoch() % resolution;
+	return (remainder.count() == 0) ? expiration : expiration + (resolution - remainder);
+}
+
 void Executor::Post(const action_t& runnable)
 {
 	auto callback = [runnable, self = shared_from_this()]()
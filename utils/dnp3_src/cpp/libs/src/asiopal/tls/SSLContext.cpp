@@ -42,10 +42,30 @@ int SSLContext::GetVerifyMode(bool server)
 
 std::error_code SSLContext::ApplyConfig(const TLSConfig& config, bool server, std::error_code& ec)
 {
-	// turn off session caching completely
-	SSL_CTX_set_session_cache_mode(value.native_handle(), SSL_SESS_CACHE_OFF);
+	auto OPTIONS = asio::ssl::context::default_workarounds | asio::ssl::context::no_sslv2 | asio::ssl::context::no_sslv3;
 
-	auto OPTIONS = asio::ssl::context::default_workarounds | asio::ssl::context::no_sslv2 | asio::ssl::context::no_sslv3 | SSL_OP_NO_TICKET;
+	if (server && config.sessionResumption)
+	{
+		// resume from the session cache or from the tickets issued by this context. The context
+		// must outlive the listeners that use it, or a restarted listener would forget them
+		SSL_CTX_set_session_cache_mode(value.native_handle(), SSL_SESS_CACHE_SERVER);
+		SSL_CTX_set_timeout(value.native_handle(), config.sessionTimeout);
+
+		// required to resume sessions with verified peers
+		static const unsigned char SESSION_ID_CONTEXT[] = "opendnp3";
+		SSL_CTX_set_session_id_context(value.native_handle(), SESSION_ID_CONTEXT, sizeof(SESSION_ID_CONTEXT) - 1);
+	}
+	else
+	{
+		// turn off session caching completely
+		SSL_CTX_set_session_cache_mode(value.native_handle(), SSL_SESS_CACHE_OFF);
+		OPTIONS |= SSL_OP_NO_TICKET;
+	}
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	// ECDHE key exchange needs a curve before OpenSSL 1.1, which picks one on its own
+	SSL_CTX_set_ecdh_auto(value.native_handle(), 1);
+#endif
 
 	if (!config.allowTLSv10)
 	{
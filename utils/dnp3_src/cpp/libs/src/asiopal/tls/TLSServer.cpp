@@ -42,7 +42,7 @@ TLSServer::TLSServer(
 ) :
 	logger(logger),
 	executor(executor),
-	ctx(logger, true, config, ec),
+	ctx(std::make_shared<SSLContext>(logger, true, config, ec)),
 	endpoint(ip::tcp::v4(), endpoint.port),
 	acceptor(executor->strand.get_io_service()),
 	session_id(0)
@@ -53,6 +53,23 @@ TLSServer::TLSServer(
 	}
 }
 
+TLSServer::TLSServer(
+    const openpal::Logger& logger,
+    const std::shared_ptr<Executor>& executor,
+    const IPEndpoint& endpoint,
+    const std::shared_ptr<SSLContext>& context,
+    std::error_code& ec
+) :
+	logger(logger),
+	executor(executor),
+	ctx(context),
+	endpoint(ip::tcp::v4(), endpoint.port),
+	acceptor(executor->strand.get_io_service()),
+	session_id(0)
+{
+	this->ConfigureListener(endpoint.address, ec);
+}
+
 void TLSServer::Shutdown()
 {
 	this->acceptor.close();
@@ -91,7 +108,7 @@ void TLSServer::StartAccept(std::error_code& ec)
 	auto self(shared_from_this());
 
 	// this could be a unique_ptr once move semantics are supported in lambdas
-	auto stream = std::make_shared<asio::ssl::stream<asio::ip::tcp::socket>>(this->executor->strand.get_io_service(), self->ctx.value);
+	auto stream = std::make_shared<asio::ssl::stream<asio::ip::tcp::socket>>(this->executor->strand.get_io_service(), self->ctx->value);
 
 	auto verify = [this, ID](bool preverified, asio::ssl::verify_context & ctx)
 	{
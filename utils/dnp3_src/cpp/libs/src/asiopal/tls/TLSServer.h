@@ -54,6 +54,16 @@ public:
 	    std::error_code& ec
 	);
 
+	/// Listen with a context shared with other listeners, e.g. the ones that replace this one,
+	/// so that the sessions it negotiates can be resumed on them
+	TLSServer(
+	    const openpal::Logger& logger,
+	    const std::shared_ptr<Executor>& executor,
+	    const IPEndpoint& endpoint,
+	    const std::shared_ptr<SSLContext>& context,
+	    std::error_code& ec
+	);
+
 	/// Stop listening for connections, permanently shutting down the listener
 	void Shutdown() override;
 
@@ -76,7 +86,7 @@ private:
 	std::error_code ConfigureContext(const TLSConfig& config, std::error_code& ec);
 	std::error_code ConfigureListener(const std::string& adapter, std::error_code& ec);
 
-	SSLContext ctx;
+	std::shared_ptr<SSLContext> ctx;
 	asio::ip::tcp::endpoint endpoint;
 	asio::ip::tcp::acceptor acceptor;
 
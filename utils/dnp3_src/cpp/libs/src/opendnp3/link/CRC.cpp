@@ -61,10 +61,41 @@ uint16_t CRC::crcTable[256] =
 	0x91AF, 0xA7F1, 0xFD13, 0xCB4D, 0x48D7, 0x7E89, 0x246B, 0x1235
 };
 
+CRC::SliceTables::SliceTables()
+{
+	for (int i = 0; i < 256; ++i)
+	{
+		table[0][i] = crcTable[i];
+	}
+
+	// table[k][i] is the CRC of the byte i followed by k zero bytes
+	for (int k = 1; k < SLICES; ++k)
+	{
+		for (int i = 0; i < 256; ++i)
+		{
+			const uint16_t previous = table[k - 1][i];
+			table[k][i] = crcTable[previous & 0xFF] ^ (previous >> 8);
+		}
+	}
+}
+
+const CRC::SliceTables CRC::sliceTables;
+
 uint16_t CRC::CalcCrc(const uint8_t* input, uint32_t length)
 {
+	const auto& t = sliceTables.table;
 	uint16_t CRC = 0;
 
+	// slicing-by-8: the full 16 byte blocks of a frame take two steps
+	while (length >= SLICES)
+	{
+		CRC = t[7][(CRC ^ input[0]) & 0xFF] ^ t[6][((CRC >> 8) ^ input[1]) & 0xFF] ^
+		      t[5][input[2]] ^ t[4][input[3]] ^ t[3][input[4]] ^
+		      t[2][input[5]] ^ t[1][input[6]] ^ t[0][input[7]];
+		input += SLICES;
+		length -= SLICES;
+	}
+
 	for (uint32_t i = 0; i < length; ++i)
 	{
 		uint8_t index = (CRC ^ input[i]) & 0xFF;
@@ -42,8 +42,21 @@ public:
 
 private:
 
+	static const int SLICES = 8;
+
+	// Tables of the CRC of every byte followed by 0 to 7 zero bytes, built
+	// from crcTable, so 8 bytes of input are processed per step
+	struct SliceTables
+	{
+		SliceTables();
+
+		uint16_t table[SLICES][256];
+	};
+
 	static uint16_t crcTable[256]; //Precomputed CRC lookup table
 
+	static const SliceTables sliceTables;
+
 };
 
 }
@@ -36,7 +36,7 @@ LinkLayerParser::LinkLayerParser(const Logger& logger) :
 	logger(logger),
 	state(State::FindSync),
 	frameSize(0),
-	buffer(rxBuffer, LPDU_MAX_FRAME_SIZE)
+	buffer(rxBuffer, RX_BUFFER_SIZE)
 {
 
 }
@@ -64,7 +64,7 @@ void LinkLayerParser::OnRead(uint32_t numBytes, IFrameSink& sink)
 		state = State::FindSync;
 	}
 
-	buffer.Shift();
+	buffer.Shift(LPDU_MAX_FRAME_SIZE);
 }
 
 LinkLayerParser::State LinkLayerParser::ParseUntilComplete()
@@ -174,8 +174,8 @@ void LinkLayerParser::PushFrame(IFrameSink& sink)
 void LinkLayerParser::TransferUserData()
 {
 	uint32_t len = header.GetLength() - LPDU_MIN_LENGTH;
-	LinkFrame::ReadUserData(buffer.ReadBuffer() + LPDU_HEADER_SIZE, rxBuffer, len);
-	userData = RSlice(rxBuffer, len);
+	LinkFrame::ReadUserData(buffer.ReadBuffer() + LPDU_HEADER_SIZE, userDataBuffer, len);
+	userData = RSlice(userDataBuffer, len);
 }
 
 bool LinkLayerParser::ReadHeader()
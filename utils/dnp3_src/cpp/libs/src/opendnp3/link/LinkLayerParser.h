@@ -94,8 +94,15 @@ private:
 	uint32_t frameSize;
 	openpal::RSlice userData;
 
+	// room for several frames, so a burst is read in fewer calls and only the partial
+	// frame at its end is shifted, once the free tail can't hold a whole frame
+	static const uint32_t RX_BUFFER_SIZE = 4 * LPDU_MAX_FRAME_SIZE;
+
 	// buffer where received data is written
-	uint8_t rxBuffer[LPDU_MAX_FRAME_SIZE];
+	uint8_t rxBuffer[RX_BUFFER_SIZE];
+
+	// user data of the last frame, without the block CRCs
+	uint8_t userDataBuffer[LPDU_MAX_USER_DATA_SIZE];
 
 	// facade over the rxBuffer that provides ability to "shift" as data is read
 	ShiftableBuffer buffer;
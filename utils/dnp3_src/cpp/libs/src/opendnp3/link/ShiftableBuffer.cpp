@@ -49,6 +49,18 @@ void ShiftableBuffer::Shift()
 	writePos = numRead;
 }
 
+void ShiftableBuffer::Shift(uint32_t minWriteBytes)
+{
+	if (this->NumBytesRead() == 0)
+	{
+		this->Reset();
+	}
+	else if (this->NumWriteBytes() < minWriteBytes)
+	{
+		this->Shift();
+	}
+}
+
 void ShiftableBuffer::Reset()
 {
 	writePos = 0;
@@ -62,6 +62,11 @@ public:
 	/// being to free space for further writing.
 	void Shift();
 
+	/// Shift only if fewer than minWriteBytes can be written, so a stream of frames is moved once
+	/// per several frames instead of after every read. A buffer with no unread bytes is rewound
+	/// without copying.
+	void Shift(uint32_t minWriteBytes);
+
 	/// Reset the buffer to its initial state, empty
 	void Reset();
 
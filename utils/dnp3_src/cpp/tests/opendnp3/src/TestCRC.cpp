@@ -25,6 +25,8 @@
 
 #include <opendnp3/link/CRC.h>
 
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
 #include <vector>
 #include <string>
@@ -43,4 +45,50 @@ TEST_CASE(SUITE("CrcTest"))
 	REQUIRE(CRC::CalcCrc(hs, 8) == 0x21E9);
 }
 
+// bit at a time CRC-16/DNP, the definition the table driven CRC must match
+static uint16_t ReferenceCrc(const uint8_t* input, uint32_t length)
+{
+	uint16_t crc = 0;
+	for (uint32_t i = 0; i < length; ++i)
+	{
+		crc ^= input[i];
+		for (int bit = 0; bit < 8; ++bit)
+		{
+			crc = (crc & 1) ? ((crc >> 1) ^ 0xA6BC) : (crc >> 1);
+		}
+	}
+	return ~crc;
+}
+
+TEST_CASE(SUITE("CrcMatchesReferenceForAllLengths"))
+{
+	std::vector<uint8_t> data(64);
+	srand(1);
+	for (auto& byte : data)
+	{
+		byte = static_cast<uint8_t>(rand());
+	}
+
+	for (uint32_t length = 0; length <= data.size(); ++length)
+	{
+		REQUIRE(CRC::CalcCrc(data.data(), length) == ReferenceCrc(data.data(), length));
+	}
+}
+
+// run with: testopendnp3 "[benchmark]"
+TEST_CASE(SUITE("CrcThroughputOfFrameBlocks"), "[.][benchmark]")
+{
+	const int BLOCKS = 1000000;
+	std::vector<uint8_t> block(16, 0x5A);
+	uint16_t sum = 0;
 
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < BLOCKS; ++i)
+	{
+		block[0] = static_cast<uint8_t>(i);
+		sum ^= CRC::CalcCrc(block.data(), 16);
+	}
+	auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout << "CRC of a 16 byte block: " << static_cast<double>(elapsed) / BLOCKS << " ns (" << sum << ")" << std::endl;
+}
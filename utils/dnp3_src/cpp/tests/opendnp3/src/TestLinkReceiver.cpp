@@ -26,6 +26,7 @@
 #include <testlib/BufferHelpers.h>
 
 #include <openpal/container/Buffer.h>
+#include <openpal/util/Comparisons.h>
 
 using namespace openpal;
 using namespace opendnp3;
@@ -308,3 +309,39 @@ TEST_CASE(SUITE("ManyReceives"))
 	}
 }
 
+// Test that a burst of frames split at arbitrary points across reads is parsed
+// without losing bytes when the partial frame at its end is shifted
+TEST_CASE(SUITE("BurstsAcrossShifts"))
+{
+	ByteStr data(250, 0); //initializes a buffer with increasing value
+
+	Buffer buffer(292);
+	auto writeTo = buffer.GetWSlice();
+	auto frame = LinkFrame::FormatUnconfirmedUserData(writeTo, true, 1, 2, data, data.Size(), nullptr);
+
+	const uint32_t NUM_FRAMES = 20;
+	Buffer stream(NUM_FRAMES * frame.Size());
+	Buffer expected(NUM_FRAMES * data.Size());
+	for (uint32_t i = 0; i < NUM_FRAMES; ++i)
+	{
+		memcpy(stream() + i * frame.Size(), frame, frame.Size());
+		memcpy(expected() + i * data.Size(), data, data.Size());
+	}
+
+	LinkParserTest t;
+	uint32_t pos = 0;
+	uint32_t chunk = 1;
+	while (pos < stream.Size())
+	{
+		auto buff = t.parser.WriteBuff();
+		uint32_t count = openpal::Min<uint32_t>(openpal::Min<uint32_t>(chunk, buff.Size()), stream.Size() - pos);
+		memcpy(buff, stream() + pos, count);
+		t.parser.OnRead(count, t.sink);
+		pos += count;
+		chunk = (chunk * 7 + 3) % 700 + 1;
+	}
+
+	REQUIRE(t.sink.m_num_frames == NUM_FRAMES);
+	REQUIRE(t.sink.CheckLast(LinkFunction::PRI_UNCONFIRMED_USER_DATA, true, 1, 2));
+	REQUIRE(t.sink.BufferEquals(expected.ToRSlice()));
+}
@@ -89,6 +89,36 @@ TEST_CASE(SUITE("Shifting"))
 	b.Shift();
 }
 
+TEST_CASE(SUITE("ShiftOnlyWhenTailIsShort"))
+{
+	Buffer buffer(100);
+	ShiftableBuffer b(buffer(), buffer.Size());
+
+	for(size_t i = 0; i < b.NumWriteBytes(); ++i) b.WriteBuff()[i] = static_cast<uint8_t>(i);
+
+	// 30 bytes free, no shift needed for 20
+	b.AdvanceWrite(70);
+	b.AdvanceRead(60);
+	b.Shift(20);
+	REQUIRE(b.NumWriteBytes() == 30);
+	REQUIRE(b.NumBytesRead() == 10);
+	REQUIRE(b.ReadBuffer()[0] == 60);
+
+	// 30 bytes free, shifted for 40
+	b.Shift(40);
+	REQUIRE(b.NumWriteBytes() == 90);
+	REQUIRE(b.NumBytesRead() == 10);
+	REQUIRE(b.ReadBuffer()[0] == 60);
+	REQUIRE(b.ReadBuffer() == buffer());
+
+	// everything read, rewound whatever the tail
+	b.AdvanceWrite(50);
+	b.AdvanceRead(60);
+	b.Shift(0);
+	REQUIRE(b.NumWriteBytes() == 100);
+	REQUIRE(b.NumBytesRead() == 0);
+}
+
 TEST_CASE(SUITE("SyncNoPattern"))
 {
 	Buffer buffer(100);
@@ -3,15 +3,32 @@
 #include <string>
 #include <cstring>
 #include <cstdlib>
+#include <cctype>
+#include <sstream>
+#include <vector>
 
 #define MAX_LINE_INPUT 1024
 #define MAX_LOCAL_BUFFER 100
 
+// The images never get smaller than the 1024 entries the protocol servers map
+// (Modbus, DNP3, S7), and the special functions stay on %ML1024 and up
+#define IMAGE_MIN_SIZE 1024
+#define IMAGE_MAX_SIZE 65536
+#define SPECIAL_FUNCTIONS_START 1024
+
+// Protocols of the protocol map, on the order of its addresses
+#define PROTOCOL_MAP_MODBUS 0
+#define PROTOCOL_MAP_DNP3 1
+#define PROTOCOL_MAP_PCCC 2
+#define PROTOCOL_MAP_S7 3
+#define PROTOCOL_MAP_COUNT 4
+
 using namespace std;
 
 /// Write the header to the output stream. The header is common among all glueVars files.
 /// @param glueVars The output stream to write to.
-void generateHeader(ostream& glueVars)
+/// @param imageSize The number of entries of the I/O and memory images.
+void generateHeader(ostream& glueVars, int imageSize = IMAGE_MIN_SIZE)
 {
 	glueVars << 	"\
 //-----------------------------------------------------------------------------\r\n\
@@ -39,62 +56,193 @@ void generateHeader(ostream& glueVars)
 //-----------------------------------------------------------------------------\r\n\
 \r\n\
 #include \"iec_std_lib.h\"\r\n\
+#include \"plc_program.h\"\r\n\
 \r\n\
 TIME __CURRENT_TIME;\r\n\
 extern unsigned long long common_ticktime__;\r\n\
+extern unsigned long task_count__ __attribute__((weak));\r\n\
+extern unsigned long task_period_ticks__[] __attribute__((weak));\r\n\
+void config_init__(void);\r\n\
+void config_run__(unsigned long tick);\r\n\
+#include \"debug.h\"\r\n\
+extern \"C\" void readScanTime(int32_t *tv_sec, int32_t *tv_nsec);\r\n\
 \r\n\
 //Internal buffers for I/O and memory. These buffers are defined in the\r\n\
 //auto-generated glueVars.cpp file\r\n\
-#define BUFFER_SIZE		1024\r\n\
+#define BUFFER_SIZE		" << imageSize << "\r\n\
+\r\n\
+//The buffers, images and presence bitmaps belong to the runtime. A program\r\n\
+//built for an online change only declares them, so the new program works\r\n\
+//on the process image of the one it replaces\r\n\
+#ifdef OPLC_ONLINE_PROGRAM\r\n\
+#define __GLUE_SHARED extern\r\n\
+#else\r\n\
+#define __GLUE_SHARED\r\n\
+#endif\r\n\
+\r\n\
+//The pointer tables are glued once, when the program starts, and the\r\n\
+//runtime makes them read-only from then on. Page-aligned so it can protect\r\n\
+//whole pages of them\r\n\
+#define __POINTER_ALIGN __attribute__((aligned(4096)))\r\n\
 \r\n\
 //Booleans\r\n\
-IEC_BOOL *bool_input[BUFFER_SIZE][8];\r\n\
-IEC_BOOL *bool_output[BUFFER_SIZE][8];\r\n\
+__GLUE_SHARED IEC_BOOL *bool_input[BUFFER_SIZE][8] __POINTER_ALIGN;\r\n\
+__GLUE_SHARED IEC_BOOL *bool_output[BUFFER_SIZE][8] __POINTER_ALIGN;\r\n\
 \r\n\
 //Bytes\r\n\
-IEC_BYTE *byte_input[BUFFER_SIZE];\r\n\
-IEC_BYTE *byte_output[BUFFER_SIZE];\r\n\
+__GLUE_SHARED IEC_BYTE *byte_input[BUFFER_SIZE] __POINTER_ALIGN;\r\n\
+__GLUE_SHARED IEC_BYTE *byte_output[BUFFER_SIZE] __POINTER_ALIGN;\r\n\
 \r\n\
 //Analog I/O\r\n\
-IEC_UINT *int_input[BUFFER_SIZE];\r\n\
-IEC_UINT *int_output[BUFFER_SIZE];\r\n\
+__GLUE_SHARED IEC_UINT *int_input[BUFFER_SIZE] __POINTER_ALIGN;\r\n\
+__GLUE_SHARED IEC_UINT *int_output[BUFFER_SIZE] __POINTER_ALIGN;\r\n\
 \r\n\
 //32bit I/O\r\n\
-IEC_UDINT *dint_input[BUFFER_SIZE];\r\n\
-IEC_UDINT *dint_output[BUFFER_SIZE];\r\n\
+__GLUE_SHARED IEC_UDINT *dint_input[BUFFER_SIZE] __POINTER_ALIGN;\r\n\
+__GLUE_SHARED IEC_UDINT *dint_output[BUFFER_SIZE] __POINTER_ALIGN;\r\n\
 \r\n\
 //64bit I/O\r\n\
-IEC_ULINT *lint_input[BUFFER_SIZE];\r\n\
-IEC_ULINT *lint_output[BUFFER_SIZE];\r\n\
+__GLUE_SHARED IEC_ULINT *lint_input[BUFFER_SIZE] __POINTER_ALIGN;\r\n\
+__GLUE_SHARED IEC_ULINT *lint_output[BUFFER_SIZE] __POINTER_ALIGN;\r\n\
 \r\n\
 //Real I/O\r\n\
-IEC_REAL *real_input[BUFFER_SIZE];\r\n\
-IEC_REAL *real_output[BUFFER_SIZE];\r\n\
+__GLUE_SHARED IEC_REAL *real_input[BUFFER_SIZE] __POINTER_ALIGN;\r\n\
+__GLUE_SHARED IEC_REAL *real_output[BUFFER_SIZE] __POINTER_ALIGN;\r\n\
 \r\n\
 //Long Real I/O\r\n\
-IEC_LREAL *lreal_input[BUFFER_SIZE];\r\n\
-IEC_LREAL *lreal_output[BUFFER_SIZE];\r\n\
+__GLUE_SHARED IEC_LREAL *lreal_input[BUFFER_SIZE] __POINTER_ALIGN;\r\n\
+__GLUE_SHARED IEC_LREAL *lreal_output[BUFFER_SIZE] __POINTER_ALIGN;\r\n\
 \r\n\
 //Memory\r\n\
-IEC_UINT *int_memory[BUFFER_SIZE];\r\n\
-IEC_UDINT *dint_memory[BUFFER_SIZE];\r\n\
-IEC_ULINT *lint_memory[BUFFER_SIZE];\r\n\
-IEC_REAL *real_memory[BUFFER_SIZE];\r\n\
-IEC_LREAL *lreal_memory[BUFFER_SIZE];\r\n\
+__GLUE_SHARED IEC_UINT *int_memory[BUFFER_SIZE] __POINTER_ALIGN;\r\n\
+__GLUE_SHARED IEC_UDINT *dint_memory[BUFFER_SIZE] __POINTER_ALIGN;\r\n\
+__GLUE_SHARED IEC_ULINT *lint_memory[BUFFER_SIZE] __POINTER_ALIGN;\r\n\
+__GLUE_SHARED IEC_REAL *real_memory[BUFFER_SIZE] __POINTER_ALIGN;\r\n\
+__GLUE_SHARED IEC_LREAL *lreal_memory[BUFFER_SIZE] __POINTER_ALIGN;\r\n\
 \r\n\
 //Special Functions\r\n\
-IEC_ULINT *special_functions[BUFFER_SIZE];\r\n\
+__GLUE_SHARED IEC_ULINT *special_functions[BUFFER_SIZE] __POINTER_ALIGN;\r\n\
 \r\n\
+//Contiguous images. The located variables are stored directly on these\r\n\
+//arrays, so bulk accesses can be done over contiguous memory. Every area\r\n\
+//starts on a cache line of its own. Release builds (OPLC_HUGE_PAGES) lay\r\n\
+//them out in order on a section of whole 2 MB pages, which the runtime\r\n\
+//backs with huge pages\r\n\
+#if defined(OPLC_HUGE_PAGES) && !defined(OPLC_ONLINE_PROGRAM)\r\n\
+#define __IMAGE_SECTION section(\".bss.oplc_image\"), no_reorder\r\n\
+#define __IMAGE_ALIGN __attribute__((aligned(64), __IMAGE_SECTION))\r\n\
+#define __IMAGE_PAGE_ALIGN __attribute__((aligned(2 * 1024 * 1024), __IMAGE_SECTION))\r\n\
+#else\r\n\
+#define __IMAGE_ALIGN __attribute__((aligned(64)))\r\n\
+#define __IMAGE_PAGE_ALIGN __IMAGE_ALIGN\r\n\
+#endif\r\n\
+__GLUE_SHARED IEC_BOOL bool_input_image[BUFFER_SIZE][8] __IMAGE_PAGE_ALIGN;\r\n\
+__GLUE_SHARED IEC_BOOL bool_output_image[BUFFER_SIZE][8] __IMAGE_ALIGN;\r\n\
+__GLUE_SHARED IEC_BOOL bool_memory_image[BUFFER_SIZE][8] __IMAGE_ALIGN;\r\n\
+__GLUE_SHARED IEC_BYTE byte_input_image[BUFFER_SIZE] __IMAGE_ALIGN;\r\n\
+__GLUE_SHARED IEC_BYTE byte_output_image[BUFFER_SIZE] __IMAGE_ALIGN;\r\n\
+__GLUE_SHARED IEC_BYTE byte_memory_image[BUFFER_SIZE] __IMAGE_ALIGN;\r\n\
+__GLUE_SHARED IEC_UINT int_input_image[BUFFER_SIZE] __IMAGE_ALIGN;\r\n\
+__GLUE_SHARED IEC_UINT int_output_image[BUFFER_SIZE] __IMAGE_ALIGN;\r\n\
+__GLUE_SHARED IEC_UINT int_memory_image[BUFFER_SIZE] __IMAGE_ALIGN;\r\n\
+__GLUE_SHARED IEC_UDINT dint_input_image[BUFFER_SIZE] __IMAGE_ALIGN;\r\n\
+__GLUE_SHARED IEC_UDINT dint_output_image[BUFFER_SIZE] __IMAGE_ALIGN;\r\n\
+__GLUE_SHARED IEC_UDINT dint_memory_image[BUFFER_SIZE] __IMAGE_ALIGN;\r\n\
+__GLUE_SHARED IEC_ULINT lint_input_image[BUFFER_SIZE] __IMAGE_ALIGN;\r\n\
+__GLUE_SHARED IEC_ULINT lint_output_image[BUFFER_SIZE] __IMAGE_ALIGN;\r\n\
+__GLUE_SHARED IEC_ULINT lint_memory_image[2 * BUFFER_SIZE] __IMAGE_ALIGN; //%ML1024+ (special functions) from entry 1024 on\r\n\
+__GLUE_SHARED IEC_REAL real_input_image[BUFFER_SIZE] __IMAGE_ALIGN;\r\n\
+__GLUE_SHARED IEC_REAL real_output_image[BUFFER_SIZE] __IMAGE_ALIGN;\r\n\
+__GLUE_SHARED IEC_REAL real_memory_image[BUFFER_SIZE] __IMAGE_ALIGN;\r\n\
+__GLUE_SHARED IEC_LREAL lreal_input_image[BUFFER_SIZE] __IMAGE_ALIGN;\r\n\
+__GLUE_SHARED IEC_LREAL lreal_output_image[BUFFER_SIZE] __IMAGE_ALIGN;\r\n\
+__GLUE_SHARED IEC_LREAL lreal_memory_image[BUFFER_SIZE] __IMAGE_ALIGN;\r\n\
+#if defined(OPLC_HUGE_PAGES) && !defined(OPLC_ONLINE_PROGRAM)\r\n\
+IEC_BYTE image_pages_end[0] __attribute__((used)) __IMAGE_PAGE_ALIGN; //pads the section to whole pages\r\n\
+#endif\r\n\
 \r\n\
-#define __LOCATED_VAR(type, name, ...) type __##name;\r\n\
-#include \"LOCATED_VARIABLES.h\"\r\n\
-#undef __LOCATED_VAR\r\n\
-#define __LOCATED_VAR(type, name, ...) type* name = &__##name;\r\n\
+//Presence bitmaps. A bit is set for every position used by a located\r\n\
+//variable. Booleans use one byte per address, other areas one bit per entry\r\n\
+__GLUE_SHARED IEC_BYTE bool_input_present[BUFFER_SIZE];\r\n\
+__GLUE_SHARED IEC_BYTE bool_output_present[BUFFER_SIZE];\r\n\
+__GLUE_SHARED IEC_BYTE byte_input_present[BUFFER_SIZE / 8];\r\n\
+__GLUE_SHARED IEC_BYTE byte_output_present[BUFFER_SIZE / 8];\r\n\
+__GLUE_SHARED IEC_BYTE int_input_present[BUFFER_SIZE / 8];\r\n\
+__GLUE_SHARED IEC_BYTE int_output_present[BUFFER_SIZE / 8];\r\n\
+__GLUE_SHARED IEC_BYTE dint_input_present[BUFFER_SIZE / 8];\r\n\
+__GLUE_SHARED IEC_BYTE dint_output_present[BUFFER_SIZE / 8];\r\n\
+__GLUE_SHARED IEC_BYTE lint_input_present[BUFFER_SIZE / 8];\r\n\
+__GLUE_SHARED IEC_BYTE lint_output_present[BUFFER_SIZE / 8];\r\n\
+__GLUE_SHARED IEC_BYTE real_input_present[BUFFER_SIZE / 8];\r\n\
+__GLUE_SHARED IEC_BYTE real_output_present[BUFFER_SIZE / 8];\r\n\
+__GLUE_SHARED IEC_BYTE lreal_input_present[BUFFER_SIZE / 8];\r\n\
+__GLUE_SHARED IEC_BYTE lreal_output_present[BUFFER_SIZE / 8];\r\n\
+__GLUE_SHARED IEC_BYTE int_memory_present[BUFFER_SIZE / 8];\r\n\
+__GLUE_SHARED IEC_BYTE dint_memory_present[BUFFER_SIZE / 8];\r\n\
+__GLUE_SHARED IEC_BYTE lint_memory_present[BUFFER_SIZE / 8];\r\n\
+__GLUE_SHARED IEC_BYTE real_memory_present[BUFFER_SIZE / 8];\r\n\
+__GLUE_SHARED IEC_BYTE lreal_memory_present[BUFFER_SIZE / 8];\r\n\
+\r\n\
+#define __IMAGE_IX(a, b) bool_input_image[a][b]\r\n\
+#define __IMAGE_QX(a, b) bool_output_image[a][b]\r\n\
+#define __IMAGE_MX(a, b) bool_memory_image[a][b]\r\n\
+#define __IMAGE_IB(a) byte_input_image[a]\r\n\
+#define __IMAGE_QB(a) byte_output_image[a]\r\n\
+#define __IMAGE_MB(a) byte_memory_image[a]\r\n\
+#define __IMAGE_IW(a) int_input_image[a]\r\n\
+#define __IMAGE_QW(a) int_output_image[a]\r\n\
+#define __IMAGE_MW(a) int_memory_image[a]\r\n\
+#define __IMAGE_ID(a) dint_input_image[a]\r\n\
+#define __IMAGE_QD(a) dint_output_image[a]\r\n\
+#define __IMAGE_MD(a) dint_memory_image[a]\r\n\
+#define __IMAGE_IL(a) lint_input_image[a]\r\n\
+#define __IMAGE_QL(a) lint_output_image[a]\r\n\
+#define __IMAGE_ML(a) lint_memory_image[a]\r\n\
+#define __IMAGE_IR(a) real_input_image[a]\r\n\
+#define __IMAGE_QR(a) real_output_image[a]\r\n\
+#define __IMAGE_MR(a) real_memory_image[a]\r\n\
+#define __IMAGE_IF(a) lreal_input_image[a]\r\n\
+#define __IMAGE_QF(a) lreal_output_image[a]\r\n\
+#define __IMAGE_MF(a) lreal_memory_image[a]\r\n\
+\r\n\
+#define __LOCATED_VAR(type, name, loc, size, ...) type* name = (type *)&__IMAGE_##loc##size(__VA_ARGS__);\r\n\
 #include \"LOCATED_VARIABLES.h\"\r\n\
 #undef __LOCATED_VAR\r\n\
 \r\n\
 void glueVars()\r\n\
-{\r\n";
+{\r\n\
+	//Every buffer entry points to its slot on the contiguous images\r\n\
+	for (int i = 0; i < BUFFER_SIZE; i++)\r\n\
+	{\r\n\
+		for (int j = 0; j < 8; j++)\r\n\
+		{\r\n\
+			bool_input[i][j] = &bool_input_image[i][j];\r\n\
+			bool_output[i][j] = &bool_output_image[i][j];\r\n\
+		}\r\n\
+		byte_input[i] = &byte_input_image[i];\r\n\
+		byte_output[i] = &byte_output_image[i];\r\n\
+		int_input[i] = &int_input_image[i];\r\n\
+		int_output[i] = &int_output_image[i];\r\n\
+		dint_input[i] = &dint_input_image[i];\r\n\
+		dint_output[i] = &dint_output_image[i];\r\n\
+		lint_input[i] = &lint_input_image[i];\r\n\
+		lint_output[i] = &lint_output_image[i];\r\n\
+		real_input[i] = &real_input_image[i];\r\n\
+		real_output[i] = &real_output_image[i];\r\n\
+		lreal_input[i] = &lreal_input_image[i];\r\n\
+		lreal_output[i] = &lreal_output_image[i];\r\n\
+		int_memory[i] = &int_memory_image[i];\r\n\
+		dint_memory[i] = &dint_memory_image[i];\r\n\
+		real_memory[i] = &real_memory_image[i];\r\n\
+		lreal_memory[i] = &lreal_memory_image[i];\r\n\
+	}\r\n\
+	//%ML" << SPECIAL_FUNCTIONS_START << " and up are the special functions\r\n\
+	for (int i = 0; i < " << SPECIAL_FUNCTIONS_START << "; i++)\r\n\
+	{\r\n\
+		lint_memory[i] = &lint_memory_image[i];\r\n\
+	}\r\n\
+\r\n\
+	//Located variables\r\n";
 }
 
 int parseIecVars(istream& locatedVars, char *varName, char *varType)
@@ -168,6 +316,16 @@ void findPositions(char *varName, int *pos1, int *pos2)
 	*pos2 = atoi(tempBuffer);
 }
 
+/// Write the statement that flags a position as used on the presence bitmap of an area.
+/// @param glueVars The output stream to write to.
+/// @param area The name of the area (e.g. int_output).
+/// @param index The byte of the bitmap.
+/// @param bit The bit inside the byte.
+void markPresent(ostream& glueVars, const char *area, int index, int bit)
+{
+	glueVars << "\t" << area << "_present[" << index << "] |= (1 << " << bit << ");\r\n";
+}
+
 void glueVar(ostream& glueVars, char *varName, char *varType)
 {
 	cout << "varName: " << varName << "\tvarType: " << varType << endl;
@@ -187,24 +345,31 @@ void glueVar(ostream& glueVars, char *varName, char *varType)
 		{
 			case 'X':
 				glueVars << "\tbool_input[" << pos1 << "][" << pos2 << "] = (IEC_BOOL *)" << varName << ";\r\n";
+				markPresent(glueVars, "bool_input", pos1, pos2);
 				break;
 			case 'B':
 				glueVars << "\tbyte_input[" << pos1 << "] = (IEC_BYTE *)" << varName << ";\r\n";
+				markPresent(glueVars, "byte_input", pos1 / 8, pos1 % 8);
 				break;
 			case 'W':
 				glueVars << "\tint_input[" << pos1 << "] = (IEC_UINT *)" << varName << ";\r\n";
+				markPresent(glueVars, "int_input", pos1 / 8, pos1 % 8);
 				break;
 			case 'D':
 				glueVars << "\tdint_input[" << pos1 << "] = (IEC_UDINT *)" << varName << ";\r\n";
+				markPresent(glueVars, "dint_input", pos1 / 8, pos1 % 8);
 				break;
 			case 'L':
 				glueVars << "\tlint_input[" << pos1 << "] = (IEC_ULINT *)" << varName << ";\r\n";
+				markPresent(glueVars, "lint_input", pos1 / 8, pos1 % 8);
 				break;
 			case 'R':
 				glueVars << "\treal_input[" << pos1 << "] = (IEC_REAL *)" << varName << ";\r\n";
+				markPresent(glueVars, "real_input", pos1 / 8, pos1 % 8);
 				break;
 			case 'F':
 				glueVars << "\tlreal_input[" << pos1 << "] = (IEC_LREAL *)" << varName << ";\r\n";
+				markPresent(glueVars, "lreal_input", pos1 / 8, pos1 % 8);
 				break;
 		}
 	}
@@ -215,24 +380,31 @@ void glueVar(ostream& glueVars, char *varName, char *varType)
 		{
 			case 'X':
 				glueVars << "\tbool_output[" << pos1 << "][" << pos2 << "] = (IEC_BOOL *)" << varName << ";\r\n";
+				markPresent(glueVars, "bool_output", pos1, pos2);
 				break;
            	case 'B':
 				glueVars << "\tbyte_output[" << pos1 << "] = (IEC_BYTE *)" << varName << ";\r\n";
+				markPresent(glueVars, "byte_output", pos1 / 8, pos1 % 8);
 				break;
 			case 'W':
 				glueVars << "\tint_output[" << pos1 << "] = (IEC_UINT *)" << varName << ";\r\n";
+				markPresent(glueVars, "int_output", pos1 / 8, pos1 % 8);
 				break;
 			case 'D':
 				glueVars << "\tdint_output[" << pos1 << "] = (IEC_UDINT *)" << varName << ";\r\n";
+				markPresent(glueVars, "dint_output", pos1 / 8, pos1 % 8);
 				break;
 			case 'L':
 				glueVars << "\tlint_output[" << pos1 << "] = (IEC_ULINT *)" << varName << ";\r\n";
+				markPresent(glueVars, "lint_output", pos1 / 8, pos1 % 8);
 				break;
 			case 'R':
 				glueVars << "\treal_output[" << pos1 << "] = (IEC_REAL *)" << varName << ";\r\n";
+				markPresent(glueVars, "real_output", pos1 / 8, pos1 % 8);
 				break;
 			case 'F':
 				glueVars << "\tlreal_output[" << pos1 << "] = (IEC_LREAL *)" << varName << ";\r\n";
+				markPresent(glueVars, "lreal_output", pos1 / 8, pos1 % 8);
 				break;
 		}
 	}
@@ -243,21 +415,28 @@ void glueVar(ostream& glueVars, char *varName, char *varType)
 		{
 			case 'W':
 				glueVars << "\tint_memory[" << pos1 << "] = (IEC_UINT *)" << varName << ";\r\n";
+				markPresent(glueVars, "int_memory", pos1 / 8, pos1 % 8);
 				break;
 			case 'D':
 				glueVars << "\tdint_memory[" << pos1 << "] = (IEC_UDINT *)" << varName << ";\r\n";
+				markPresent(glueVars, "dint_memory", pos1 / 8, pos1 % 8);
 				break;
 			case 'L':
-				if (pos1 > 1023)
-					glueVars << "\tspecial_functions[" << (pos1-1024) << "] = (IEC_ULINT *)" << varName << ";\r\n";
+				if (pos1 >= SPECIAL_FUNCTIONS_START)
+					glueVars << "\tspecial_functions[" << (pos1 - SPECIAL_FUNCTIONS_START) << "] = (IEC_ULINT *)" << varName << ";\r\n";
 				else
+				{
 					glueVars << "\tlint_memory[" << pos1 << "] = (IEC_ULINT *)" << varName << ";\r\n";
+					markPresent(glueVars, "lint_memory", pos1 / 8, pos1 % 8);
+				}
 				break;
 			case 'R':
 				glueVars << "\treal_memory[" << pos1 << "] = (IEC_REAL *)" << varName << ";\r\n";
+				markPresent(glueVars, "real_memory", pos1 / 8, pos1 % 8);
 				break;
 			case 'F':
 				glueVars << "\tlreal_memory[" << pos1 << "] = (IEC_LREAL *)" << varName << ";\r\n";
+				markPresent(glueVars, "lreal_memory", pos1 / 8, pos1 % 8);
 				break;
 		}
 	}
@@ -267,20 +446,546 @@ void generateBottom(ostream& glueVars)
 {
 	glueVars << "}\r\n\
 \r\n\
+//Called at the start of every scan. The time elapsed since the runtime\r\n\
+//started is read from the scan clock, so skipped or late ticks don't\r\n\
+//make __CURRENT_TIME drift\r\n\
 void updateTime()\r\n\
 {\r\n\
-	__CURRENT_TIME.tv_sec  += common_ticktime__ / 1000000000ULL;\r\n\
-	__CURRENT_TIME.tv_nsec += common_ticktime__ % 1000000000ULL;\r\n\
-\r\n\
-	if (__CURRENT_TIME.tv_nsec >= 1000000000ULL)\r\n\
-	{\r\n\
-		__CURRENT_TIME.tv_nsec -= 1000000000ULL;\r\n\
-		__CURRENT_TIME.tv_sec += 1;\r\n\
-	}\r\n\
+	readScanTime(&__CURRENT_TIME.tv_sec, &__CURRENT_TIME.tv_nsec);\r\n\
 }";
 }
 
-void generateBody(istream& locatedVars, ostream& glueVars) {
+/// Split a line of the VARIABLES.csv file on its ';' separators.
+/// @param line The line to split.
+/// @return The fields of the line.
+vector<string> splitVariableLine(const string& line)
+{
+	vector<string> fields;
+	size_t start = 0;
+	size_t end;
+	while ((end = line.find(';', start)) != string::npos)
+	{
+		fields.push_back(line.substr(start, end - start));
+		start = end + 1;
+	}
+	fields.push_back(line.substr(start));
+	return fields;
+}
+
+/// Translate the C path of a variable on VARIABLES.csv (e.g. CONFIG0.RES0.INSTANCE0.COUNT)
+/// into the C expression of its value. Variables of a program instance or of a
+/// global function block are reached through the object that holds them, globals
+/// are named after their domain (CONFIG0__X, RES0__X).
+/// @param path The C path of the variable.
+/// @param objects The paths of the program instances and global function blocks.
+/// @param objectNames The C names of the objects, on the same order.
+/// @return The C expression of the variable, without the .value member.
+string variableExpression(const string& path, const vector<string>& objects, const vector<string>& objectNames)
+{
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		if (path.compare(0, objects[i].size() + 1, objects[i] + ".") == 0)
+			return objectNames[i] + path.substr(objects[i].size());
+	}
+
+	size_t last = path.rfind('.');
+	if (last == string::npos)
+		return path;
+	size_t domain = path.rfind('.', last - 1);
+	domain = (domain == string::npos) ? 0 : domain + 1;
+	return path.substr(domain, last - domain) + "__" + path.substr(last + 1);
+}
+
+/// Write the table of the variables that are not located, read from the VARIABLES.csv
+/// file generated by the MATIEC compiler. The runtime matches them by name and type
+/// to carry the program state over an online change, and keeps the ones the program
+/// flags as RETAIN on config_init on the persistent storage. Also writes the force overlay,
+/// that copies the forced values of the located variables over their locations on a
+/// program built with direct access (OPLC_DIRECT_ACCESS).
+/// @param variables The VARIABLES.csv contents to read from.
+/// @param glueVars The output stream to write to.
+void generateProgramVariables(istream& variables, ostream& glueVars)
+{
+	vector<string> objects, objectNames;
+	stringstream declarations, table, overlay;
+	string line, section;
+
+	while (getline(variables, line))
+	{
+		if (!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		if (line.compare(0, 2, "//") == 0)
+		{
+			section = line;
+			continue;
+		}
+
+		vector<string> fields = splitVariableLine(line);
+		if (section == "// Programs" && fields.size() >= 3)
+		{
+			string name = variableExpression(fields[1], vector<string>(), vector<string>());
+			objects.push_back(fields[1]);
+			objectNames.push_back(name);
+			declarations << "extern " << fields[2] << " " << name << ";\r\n";
+		}
+		else if (section == "// Variables" && fields.size() >= 6)
+		{
+			string expression = variableExpression(fields[3], objects, objectNames);
+			bool known = false;
+			for (size_t i = 0; i < objects.size(); i++)
+				known = known || objects[i] == fields[3];
+			if (fields[1] == "FB" && !known && expression.find('.') == string::npos)
+			{
+				//function block declared as a global
+				objects.push_back(fields[3]);
+				objectNames.push_back(expression);
+				declarations << "extern " << fields[4] << " " << expression << ";\r\n";
+			}
+			else if (fields[1] == "VAR")
+			{
+				if (expression.find('.') == string::npos)
+					declarations << "extern __IEC_" << fields[5] << "_t " << expression << ";\r\n";
+				table << "\t{\"" << fields[2] << "\", \"" << fields[5] << "\", &" << expression << ".value, sizeof(" << expression << ".value), &" << expression << ".flags},\r\n";
+			}
+			else if (fields[1] == "IN" || fields[1] == "OUT" || fields[1] == "MEM" || fields[1] == "EXT")
+			{
+				//located global
+				if (expression.find('.') == string::npos)
+					declarations << "extern __IEC_" << fields[5] << "_p " << expression << ";\r\n";
+				overlay << "\t__FORCE_LOCATED(" << expression << ")\r\n";
+			}
+		}
+	}
+
+	glueVars << "\r\n\r\n\
+//Variables of the program that are not located. An online change copies\r\n\
+//their values to the variables with the same name and type on the new program,\r\n\
+//and the persistent storage keeps the ones flagged as RETAIN\r\n";
+	if (!objects.empty() || !declarations.str().empty())
+	{
+		glueVars << "#include \"accessor.h\"\r\n#include \"POUS.h\"\r\n\r\n" << declarations.str() << "\r\n";
+	}
+	glueVars << "static const PlcVariable program_variables[] =\r\n{\r\n" << table.str() << "\t{NULL, NULL, NULL, 0, NULL}\r\n};";
+
+	glueVars << "\r\n\r\n\
+//Writes the forced values of the located variables over their locations.\r\n\
+//The accessors of a program built with direct access ignore the force\r\n\
+//flags, so the runtime calls this before and after the program runs while\r\n\
+//there are forced variables\r\n\
+void applyForceOverlay()\r\n{\r\n" << overlay.str() << "}";
+}
+
+/// Write a string as a C string literal.
+/// @param text The string to write.
+/// @return The quoted string, with quotes and backslashes escaped.
+string cString(const string& text)
+{
+	string quoted = "\"";
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		if (text[i] == '"' || text[i] == '\\')
+			quoted += '\\';
+		quoted += text[i];
+	}
+	return quoted + "\"";
+}
+
+/// Get the address on the contiguous images of a located variable exported by
+/// the OPC UA server. Only the areas with a buffer on the runtime are exported,
+/// so %MX, %MB and the special functions (%ML1024+) are left out.
+/// @param area The area of the variable (I, Q or M).
+/// @param size The size of the variable (X, B, W, D, L, R or F).
+/// @param pos1 The index of the variable on its area.
+/// @param pos2 The bit of a boolean.
+/// @param expression Receives the C expression of the address.
+/// @param imageSize The number of entries of the images.
+/// @return false if the variable can't be exported.
+bool locatedAddress(char area, char size, int pos1, int pos2, string *expression, int imageSize = IMAGE_MIN_SIZE)
+{
+	if (pos1 < 0 || pos1 >= imageSize || (size == 'X' && (pos2 < 0 || pos2 >= 8)))
+		return false;
+	if (area != 'I' && area != 'Q' && area != 'M')
+		return false;
+	if (area == 'M' && (size == 'X' || size == 'B'))
+		return false;
+	if (area == 'M' && size == 'L' && pos1 >= SPECIAL_FUNCTIONS_START)
+		return false;
+
+	string kind = (area == 'I') ? "input" : (area == 'Q') ? "output" : "memory";
+	stringstream address;
+	switch (size)
+	{
+		case 'X': address << "&bool_" << kind << "_image[" << pos1 << "][" << pos2 << "]"; break;
+		case 'B': address << "&byte_" << kind << "_image[" << pos1 << "]"; break;
+		case 'W': address << "&int_" << kind << "_image[" << pos1 << "]"; break;
+		case 'D': address << "&dint_" << kind << "_image[" << pos1 << "]"; break;
+		case 'L': address << "&lint_" << kind << "_image[" << pos1 << "]"; break;
+		case 'R': address << "&real_" << kind << "_image[" << pos1 << "]"; break;
+		case 'F': address << "&lreal_" << kind << "_image[" << pos1 << "]"; break;
+		default: return false;
+	}
+	*expression = address.str();
+	return true;
+}
+
+/// Parse a single IEC location (e.g. %QX0.1 or %MW12).
+/// @param location The location to parse.
+/// @param area Receives the area of the variable (I, Q or M).
+/// @param size Receives the size of the variable (X, B, W, D, L, R or F).
+/// @param pos1 Receives the index of the variable on its area.
+/// @param pos2 Receives the bit of a boolean.
+/// @return false if the text isn't a location.
+bool parseLocation(const string& location, char *area, char *size, int *pos1, int *pos2)
+{
+	if (location.size() < 4 || location[0] != '%' || !isdigit((unsigned char)location[3]))
+		return false;
+
+	*area = location[1];
+	*size = location[2];
+	*pos1 = atoi(location.c_str() + 3);
+	*pos2 = 0;
+	if (*size == 'X')
+	{
+		size_t dot = location.find('.');
+		if (dot == string::npos)
+			return false;
+		*pos2 = atoi(location.c_str() + dot + 1);
+	}
+	return true;
+}
+
+/// Write the entry of a located variable on the OPC UA address space table. A
+/// range of locations (e.g. %MW0..%MW999) is exported as a single array node,
+/// which is backed by the contiguous slots of the range on the images.
+/// @param glueVars The output stream to write to.
+/// @param nodeId The node id of the variable.
+/// @param name The display name of the node.
+/// @param location The IEC location of the variable (e.g. %QX0.1) or range.
+/// @param imageSize The number of entries of the images.
+/// @return false if the location can't be exported.
+bool addressSpaceEntry(ostream& glueVars, unsigned long nodeId, const string& name, const string& location, int imageSize = IMAGE_MIN_SIZE)
+{
+	size_t dots = location.find("..");
+	string first = location.substr(0, dots);
+
+	char area, size;
+	int pos1, pos2;
+	if (!parseLocation(first, &area, &size, &pos1, &pos2))
+		return false;
+
+	string address;
+	if (!locatedAddress(area, size, pos1, pos2, &address, imageSize))
+		return false;
+
+	int count = 1;
+	if (dots != string::npos)
+	{
+		char lastArea, lastSize;
+		int lastPos1, lastPos2;
+		string last;
+		if (!parseLocation(location.substr(dots + 2), &lastArea, &lastSize, &lastPos1, &lastPos2))
+			return false;
+		if (lastArea != area || lastSize != size || !locatedAddress(lastArea, lastSize, lastPos1, lastPos2, &last, imageSize))
+			return false;
+		// Booleans are laid out as 8 consecutive bits per address
+		count = (size == 'X') ? (lastPos1 * 8 + lastPos2) - (pos1 * 8 + pos2) + 1 : lastPos1 - pos1 + 1;
+		if (count < 1)
+			return false;
+	}
+
+	glueVars << "\t{" << nodeId << ", " << cString(name) << ", \"" << location << "\", '" << size << "', " << address << ", " << count << "},\r\n";
+	return true;
+}
+
+/// Write the OPC UA address space of the program. Every exported located variable
+/// gets a node id, a display name, its location and its address on the images, so
+/// the server builds its nodes from the table without reading any file. When the
+/// OPCUA_VARIABLES.csv mapping (name,location,datatype) is given, only the variables
+/// it lists are exported, named after it and walked from the end of the file, which
+/// keeps the node ids of the runtimes that read the file at startup. Otherwise all
+/// the located variables are exported on the order of LOCATED_VARIABLES.h and named
+/// after their location (e.g. QX0_1). The list may also give a range of locations
+/// (e.g. Registers,%MW0..%MW999,UINT), exported as one array node.
+/// @param located The names of the located variables (e.g. __QX0_1).
+/// @param names The OPCUA_VARIABLES.csv contents to read from, may be empty.
+/// @param glueVars The output stream to write to.
+/// @param imageSize The number of entries of the images.
+void generateAddressSpace(const vector<string>& located, istream& names, ostream& glueVars, int imageSize = IMAGE_MIN_SIZE)
+{
+	vector<string> displayNames, locations;
+	string line;
+	bool headerChecked = false;
+
+	while (getline(names, line))
+	{
+		if (line.empty() || line[0] == '\r' || line[0] == '#' || line.compare(0, 2, "//") == 0)
+			continue;
+
+		vector<string> fields;
+		stringstream fieldStream(line);
+		string field;
+		while (getline(fieldStream, field, ','))
+		{
+			size_t first = field.find_first_not_of(" \t\r\n");
+			size_t last = field.find_last_not_of(" \t\r\n");
+			fields.push_back(first == string::npos ? "" : field.substr(first, last - first + 1));
+		}
+		if (fields.size() < 2)
+			continue;
+
+		// Skip header line if present
+		if (!headerChecked)
+		{
+			headerChecked = true;
+			string header = fields[0];
+			for (size_t i = 0; i < header.size(); i++)
+				header[i] = tolower((unsigned char)header[i]);
+			if (header == "name")
+				continue;
+		}
+		displayNames.push_back(fields[0]);
+		locations.push_back(fields[1]);
+	}
+
+	stringstream table;
+	unsigned long nodeId = 4000000;
+	if (!locations.empty())
+	{
+		for (size_t i = locations.size(); i-- > 0; )
+		{
+			if (addressSpaceEntry(table, nodeId, displayNames[i], locations[i], imageSize))
+				nodeId++;
+			else
+				cout << "***Invalid location " << locations[i] << " for OPC UA variable " << displayNames[i] << "***" << endl;
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < located.size(); i++)
+		{
+			char varName[MAX_LOCAL_BUFFER];
+			strncpy(varName, located[i].c_str(), sizeof(varName) - 1);
+			varName[sizeof(varName) - 1] = '\0';
+			if (strlen(varName) < 5)
+				continue;
+
+			int pos1, pos2;
+			findPositions(varName, &pos1, &pos2);
+			stringstream location;
+			location << "%" << varName[2] << varName[3] << pos1;
+			if (varName[3] == 'X')
+				location << "." << pos2;
+
+			if (addressSpaceEntry(table, nodeId, varName + 2, location.str(), imageSize))
+				nodeId++;
+		}
+	}
+
+	glueVars << "\r\n\r\n\
+//Located variables exported by the OPC UA server, on node id order\r\n\
+static const PlcLocatedVariable located_variables[] =\r\n{\r\n" << table.str() << "\t{0, NULL, NULL, 0, NULL, 0}\r\n};";
+}
+
+/// Get the address of an entry of the images on a protocol server. This is the
+/// address map of tagProtocolAddress() on the runtime (tag_database.cpp): Modbus
+/// and DNP3 put %QW, %MW, %MD and %ML one after the other on the holding
+/// registers / analog outputs, PCCC packs 16 bits per element and puts %MW after
+/// %QW on the N file, S7 uses the PE and PA areas and DB2, DB102, DB1002 and DB1004.
+/// @param area The area of the entry (I, Q or M).
+/// @param size The size of the entry (X, B, W, D, L, R or F).
+/// @param position The entry on the area, byte * 8 + bit for booleans.
+/// @param protocol The protocol, one of the PROTOCOL_MAP_* tables.
+/// @return The "{table, bit, address}" initializer of the address, with table 0
+/// if the protocol doesn't reach the entry.
+string protocolAddress(char area, char size, long position, int protocol)
+{
+	long table = 0, bit = 0, address = 0;
+
+	switch (protocol)
+	{
+		case PROTOCOL_MAP_MODBUS:
+			if (size == 'X' && area != 'M' && position < 8192)
+			{
+				table = (area == 'I') ? 2 : 1;
+				address = position;
+			}
+			else if (position >= 1024)
+			{
+				break;
+			}
+			else if (area == 'I' && size == 'W')
+			{
+				table = 4;
+				address = position;
+			}
+			else if (area == 'Q' && size == 'W')
+			{
+				table = 3;
+				address = position;
+			}
+			else if (area == 'M' && (size == 'W' || size == 'D' || size == 'L'))
+			{
+				table = 3;
+				address = (size == 'W') ? 1024 + position : (size == 'D') ? 2048 + position * 2 : 4096 + position * 4;
+			}
+			break;
+
+		case PROTOCOL_MAP_DNP3:
+			if (size == 'X' && area != 'M' && position < 8192)
+			{
+				table = (area == 'I') ? 1 : 10;
+				address = position;
+			}
+			else if (area == 'I' && size == 'W' && position < 1024)
+			{
+				table = 30;
+				address = position;
+			}
+			else if (area == 'Q' && size == 'W' && position < 1024)
+			{
+				table = 40;
+				address = position;
+			}
+			else if (area == 'M' && (size == 'W' || size == 'D' || size == 'L'))
+			{
+				long point = (size == 'W') ? 1024 + position : (size == 'D') ? 2048 + position : 4096 + position;
+				long last = (size == 'W') ? 2047 : (size == 'D') ? 4095 : 8191;
+				if (point < last)
+				{
+					table = 40;
+					address = point;
+				}
+			}
+			break;
+
+		case PROTOCOL_MAP_PCCC:
+			if (size == 'X' && area != 'M')
+			{
+				table = (area == 'I') ? 0x8c : 0x8b;
+				address = position / 16;
+				bit = position % 16;
+			}
+			else if (area == 'Q' && size == 'W' && position < 1024)
+			{
+				table = 0x89;
+				address = position;
+			}
+			else if (area == 'M' && size == 'W')
+			{
+				table = 0x89;
+				address = 1024 + position;
+			}
+			else if (area == 'M' && size == 'D')
+			{
+				table = 0x91;
+				address = position;
+			}
+			break;
+
+		case PROTOCOL_MAP_S7:
+			if (size == 'X' && area != 'M')
+			{
+				table = (area == 'I') ? 0x81 : 0x82;
+				address = position / 8;
+				bit = position % 8;
+			}
+			else if (size == 'W')
+			{
+				table = (area == 'I') ? 2 : (area == 'Q') ? 102 : 1002;
+				address = position * 2;
+			}
+			else if (area == 'M' && size == 'D')
+			{
+				table = 1004;
+				address = position * 4;
+			}
+			break;
+	}
+
+	if (table == 0)
+		return "{0, 0, 0}";
+	stringstream entry;
+	entry << "{" << table << ", " << bit << ", " << address << "}";
+	return entry.str();
+}
+
+/// Write the protocol map of the program: every located variable with a slot on
+/// the images, its address on the images and its address on every protocol
+/// server, resolved here once. The runtime builds its tag database from the
+/// table without scanning the images or translating any location.
+/// @param located The names of the located variables (e.g. __QX0_1).
+/// @param glueVars The output stream to write to.
+/// @param imageSize The number of entries of the images.
+void generateProtocolMap(const vector<string>& located, ostream& glueVars, int imageSize = IMAGE_MIN_SIZE)
+{
+	stringstream table;
+	for (size_t i = 0; i < located.size(); i++)
+	{
+		char varName[MAX_LOCAL_BUFFER];
+		strncpy(varName, located[i].c_str(), sizeof(varName) - 1);
+		varName[sizeof(varName) - 1] = '\0';
+		if (strlen(varName) < 5)
+			continue;
+
+		char area = varName[2], size = varName[3];
+		int pos1, pos2;
+		findPositions(varName, &pos1, &pos2);
+		string address;
+		if (!locatedAddress(area, size, pos1, pos2, &address, imageSize))
+			continue;
+
+		long position = (size == 'X') ? pos1 * 8L + pos2 : pos1;
+		table << "\t{'" << area << "', '" << size << "', " << position << ", " << address;
+		for (int protocol = 0; protocol < PROTOCOL_MAP_COUNT; protocol++)
+			table << ", " << protocolAddress(area, size, position, protocol);
+		table << "},\r\n";
+	}
+
+	glueVars << "\r\n\r\n\
+//Located variables with their address on the Modbus, DNP3, PCCC and S7 servers\r\n\
+static const PlcProtocolMapping protocol_map[] =\r\n{\r\n" << table.str() << "\t{0, 0, 0, NULL, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}}\r\n};";
+}
+
+/// Write the function that hands the entry points of the program to the runtime.
+/// @param glueVars The output stream to write to.
+void generateProgramInterface(ostream& glueVars)
+{
+	glueVars << "\r\n\r\n\
+//Entry points of this program. The runtime gets them from the executable\r\n\
+//or from the shared object loaded by an online change\r\n\
+extern \"C\" void getPlcProgram(PlcProgram *program)\r\n\
+{\r\n\
+	program->version = PLC_PROGRAM_VERSION;\r\n\
+	program->image_size = BUFFER_SIZE;\r\n\
+	program->real_frac_bits = PLC_REAL_FRAC_BITS;\r\n\
+	program->config_init = config_init__;\r\n\
+	program->config_run = config_run__;\r\n\
+	program->common_ticktime = &common_ticktime__;\r\n\
+	program->task_count = &task_count__;\r\n\
+	program->task_period_ticks = task_period_ticks__;\r\n\
+	program->glue_vars = glueVars;\r\n\
+	program->update_time = updateTime;\r\n\
+	program->variables = program_variables;\r\n\
+	program->variable_count = sizeof(program_variables) / sizeof(program_variables[0]) - 1;\r\n\
+	program->located_variables = located_variables;\r\n\
+	program->located_variable_count = sizeof(located_variables) / sizeof(located_variables[0]) - 1;\r\n\
+	program->protocol_map = protocol_map;\r\n\
+	program->protocol_map_count = sizeof(protocol_map) / sizeof(protocol_map[0]) - 1;\r\n\
+	program->get_var_count = get_var_count;\r\n\
+	program->get_var_size = get_var_size;\r\n\
+	program->get_var_addr = get_var_addr;\r\n\
+	program->set_trace = set_trace;\r\n\
+	program->trace_reset = trace_reset;\r\n\
+	program->set_endianness = set_endianness;\r\n\
+#ifdef OPLC_DIRECT_ACCESS\r\n\
+	program->force_overlay = applyForceOverlay;\r\n\
+#else\r\n\
+	program->force_overlay = NULL;\r\n\
+#endif\r\n\
+}\r\n";
+}
+
+void generateBody(istream& locatedVars, ostream& glueVars, vector<string> *located = NULL) {
     // Start the generation process.
     char iecVar_name[100];
     char iecVar_type[100];
@@ -288,34 +993,108 @@ void generateBody(istream& locatedVars, ostream& glueVars) {
     while (parseIecVars(locatedVars, iecVar_name, iecVar_type))
     {
         glueVar(glueVars, iecVar_name, iecVar_type);
+        if (located != NULL)
+            located->push_back(iecVar_name);
     }
 }
 
+/// Get the number of entries the images need for the located variables of a
+/// program: the highest index used plus the headroom, rounded up to 64 entries
+/// and never below IMAGE_MIN_SIZE. The special functions (%ML1024+) have their
+/// own table and are not counted.
+/// @param located The names of the located variables (e.g. __QX0_1).
+/// @param headroom The entries to leave free after the highest one used.
+/// @return The number of entries of the images, more than IMAGE_MAX_SIZE if they don't fit.
+int imageSize(const vector<string>& located, int headroom)
+{
+	long highest = -1;
+	for (size_t i = 0; i < located.size(); i++)
+	{
+		char varName[MAX_LOCAL_BUFFER];
+		strncpy(varName, located[i].c_str(), sizeof(varName) - 1);
+		varName[sizeof(varName) - 1] = '\0';
+		if (strlen(varName) < 5)
+			continue;
+
+		int pos1, pos2;
+		findPositions(varName, &pos1, &pos2);
+		if (varName[2] == 'M' && varName[3] == 'L' && pos1 >= SPECIAL_FUNCTIONS_START)
+			continue;
+		if (pos1 > highest)
+			highest = pos1;
+	}
+
+	long size = (highest + 1 + headroom + 63) / 64 * 64;
+	if (size < IMAGE_MIN_SIZE)
+		return IMAGE_MIN_SIZE;
+	return size > IMAGE_MAX_SIZE ? IMAGE_MAX_SIZE + 1 : (int)size;
+}
+
+/// Write the header that sets the size of the images for the runtime. The
+/// runtime sources include it from ladder.h, so they are built with the same
+/// images as glueVars.cpp.
+/// @param imageSizeHeader The output stream to write to.
+/// @param imageSize The number of entries of the images.
+void generateImageSize(ostream& imageSizeHeader, int imageSize)
+{
+	imageSizeHeader << "\
+//Size of the I/O and memory images of the program, generated by the\r\n\
+//glue_generator program with glueVars.cpp. PLEASE DON'T EDIT THIS FILE!\r\n\
+#ifndef IMAGE_SIZE_H\r\n\
+#define IMAGE_SIZE_H\r\n\
+#define BUFFER_SIZE		" << imageSize << "\r\n\
+#endif\r\n";
+}
+
 /// This is our main function. We define it with a different name and then
 /// call it from the main function so that we can mock it for the purpose
 /// of testing.
 int mainImpl(int argc, char *argv[])
 {
+	// The options come before the paths
+	int headroom = 0;
+	int fixed_size = 0;
+	int first = 1;
+	while (first + 1 < argc && (strcmp(argv[first], "--headroom") == 0 || strcmp(argv[first], "--image-size") == 0))
+	{
+		if (strcmp(argv[first], "--headroom") == 0)
+			headroom = atoi(argv[first + 1]);
+		else
+			fixed_size = atoi(argv[first + 1]);
+		first += 2;
+	}
+	argc -= first - 1;
+	argv += first - 1;
+
 	// Parse the command line arguments - if they exist. Show the help if there are too many arguments
     // or if the first argument is for help.
     bool show_help = argc >= 2 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0);
-    if (show_help || (argc != 1 && argc != 3)) {
+    if (show_help || (argc != 1 && argc != 3 && argc != 4 && argc != 5)) {
 		cout << "Usage " << endl << endl;
-		cout << "  glue_generator [options] <path-to-located-variables.h> <path-to-glue-vars.cpp>" << endl << endl;
+		cout << "  glue_generator [options] <path-to-located-variables.h> <path-to-glue-vars.cpp> [<path-to-variables.csv> [<path-to-opcua-variables.csv>]]" << endl << endl;
 		cout << "Reads the LOCATED_VARIABLES.h file generated by the MATIEC compiler and produces" << endl;
-		cout << "glueVars.cpp for the OpenPLC runtime. If not specified, paths are relative to" << endl;
-		cout << "the current directory." << endl << endl;
+		cout << "glueVars.cpp for the OpenPLC runtime. The variables listed on VARIABLES.csv are" << endl;
+		cout << "added to the table used by online changes. The OPC UA address space is built from" << endl;
+		cout << "the located variables, named after OPCUA_VARIABLES.csv when it is given. The size" << endl;
+		cout << "of the I/O and memory images is written to image_size.h, next to glueVars.cpp. If" << endl;
+		cout << "not specified, paths are relative to the current directory." << endl << endl;
 		cout << "Options" << endl;
-		cout << "  --help,-h   = Print usage information and exit." << endl;
+		cout << "  --help,-h          = Print usage information and exit." << endl;
+		cout << "  --headroom N       = Entries left free on the images after the highest one used." << endl;
+		cout << "  --image-size N     = Use images of N entries, the size of a running runtime." << endl;
 		return 0;
 	}
 
-	// If we have 3 arguments, then the user provided input and output paths
+	// If we have 3 to 5 arguments, then the user provided input and output paths
 	string input_file_name("LOCATED_VARIABLES.h");
 	string output_file_name("glueVars.cpp");
-	if (argc == 3) {
+	string variables_file_name("VARIABLES.csv");
+	string opcua_file_name("OPCUA_VARIABLES.csv");
+	if (argc >= 3) {
 		input_file_name = argv[1];
 		output_file_name = argv[2];
+		variables_file_name = (argc >= 4) ? argv[3] : "";
+		opcua_file_name = (argc == 5) ? argv[4] : "";
 	}
 
 	// Try to open the files for reading and writing.
@@ -324,16 +1103,54 @@ int mainImpl(int argc, char *argv[])
         cout << "Error opening located variables file at " << input_file_name << endl;
 		return 1;
 	}
+
+	// The located variables are read first, they decide the size of the images
+	vector<string> located;
+	stringstream body;
+	generateBody(locatedVars, body, &located);
+	int image_size = imageSize(located, headroom < 0 ? 0 : headroom);
+	if (fixed_size > 0)
+	{
+		if (imageSize(located, 0) > fixed_size || fixed_size < IMAGE_MIN_SIZE || fixed_size % 8 != 0)
+		{
+			cout << "Error: the located variables don't fit on images of " << fixed_size << " entries" << endl;
+			return 3;
+		}
+		image_size = fixed_size;
+	}
+	if (image_size > IMAGE_MAX_SIZE)
+	{
+		cout << "Error: the located variables need more than " << IMAGE_MAX_SIZE << " entries per area" << endl;
+		return 3;
+	}
+
 	ofstream glueVars(output_file_name, ios::trunc);
 	if (!glueVars.is_open()) {
 		cout << "Error opening glue variables file at " << output_file_name << endl;
 		return 2;
 	}
 
-    generateHeader(glueVars);
-    generateBody(locatedVars, glueVars);
+	size_t separator = output_file_name.find_last_of('/');
+	string image_size_file_name = (separator == string::npos) ? "image_size.h" : output_file_name.substr(0, separator + 1) + "image_size.h";
+	ofstream imageSizeHeader(image_size_file_name, ios::trunc);
+	if (!imageSizeHeader.is_open()) {
+		cout << "Error opening image size file at " << image_size_file_name << endl;
+		return 2;
+	}
+	generateImageSize(imageSizeHeader, image_size);
+
+    generateHeader(glueVars, image_size);
+    glueVars << body.str();
 	generateBottom(glueVars);
 
+	// Programs compiled without the variables list still get an empty table
+	ifstream variables(variables_file_name, ios::in);
+	generateProgramVariables(variables, glueVars);
+	ifstream opcuaNames(opcua_file_name, ios::in);
+	generateAddressSpace(located, opcuaNames, glueVars, image_size);
+	generateProtocolMap(located, glueVars, image_size);
+	generateProgramInterface(glueVars);
+
 	return 0;
 }
 
@@ -1,5 +1,7 @@
 // Catch2 will provide a main() function
 #define CATCH_CONFIG_MAIN
+// The alternate signal stack of catch.hpp doesn't build with glibc >= 2.34
+#define CATCH_CONFIG_NO_POSIX_SIGNALS
 #include "catch.hpp"
 #include <sstream>
 
@@ -14,12 +16,16 @@ using namespace std;
 SCENARIO("Commmand line", "[main]") {
     GIVEN("<no pre-conditions>") {
         WHEN("-h command line arguments") {
-            char* args[2] = { "glue_generator", "-h" };
+            char arg0[] = "glue_generator";
+            char arg1[] = "-h";
+            char* args[2] = { arg0, arg1 };
             REQUIRE(mainImpl(2, args) == 0);
         }
 
         WHEN("--help command line arguments") {
-            char* args[2] = { "glue_generator", "-h" };
+            char arg0[] = "glue_generator";
+            char arg1[] = "--help";
+            char* args[2] = { arg0, arg1 };
             REQUIRE(mainImpl(2, args) == 0);
         }
     }
@@ -31,85 +37,351 @@ SCENARIO("", "") {
         WHEN("Contains single BOOL at %IX0") {
             std::stringstream input_stream("__LOCATED_VAR(BOOL,__IX0,I,X,0)");
             generateBody(input_stream, output_stream);
-            REQUIRE(output_stream.str() == "\tbool_input[0][0] = __IX0;\r\n");
+            REQUIRE(output_stream.str() == "\tbool_input[0][0] = (IEC_BOOL *)__IX0;\r\n\tbool_input_present[0] |= (1 << 0);\r\n");
         }
 
         WHEN("Contains single BOOL at %QX0") {
             std::stringstream input_stream("__LOCATED_VAR(BOOL,__QX0,Q,X,0)");
             generateBody(input_stream, output_stream);
-            REQUIRE(output_stream.str() == "\tbool_output[0][0] = __QX0;\r\n");
+            REQUIRE(output_stream.str() == "\tbool_output[0][0] = (IEC_BOOL *)__QX0;\r\n\tbool_output_present[0] |= (1 << 0);\r\n");
         }
 
         WHEN("Contains single BYTE at %IB0") {
             std::stringstream input_stream("__LOCATED_VAR(BYTE,__IB0,I,B,0)");
             generateBody(input_stream, output_stream);
-            REQUIRE(output_stream.str() == "\tbyte_input[0] = __IB0;\r\n");
+            REQUIRE(output_stream.str() == "\tbyte_input[0] = (IEC_BYTE *)__IB0;\r\n\tbyte_input_present[0] |= (1 << 0);\r\n");
         }
 
         WHEN("Contains single SINT at %IB1") {
             std::stringstream input_stream("__LOCATED_VAR(SINT,__IB1,I,B,1)");
             generateBody(input_stream, output_stream);
-            REQUIRE(output_stream.str() == "\tbyte_input[1] = __IB1;\r\n");
+            REQUIRE(output_stream.str() == "\tbyte_input[1] = (IEC_BYTE *)__IB1;\r\n\tbyte_input_present[0] |= (1 << 1);\r\n");
         }
 
         WHEN("Contains single SINT at %QB1") {
             std::stringstream input_stream("__LOCATED_VAR(SINT,__QB1,Q,B,1)");
             generateBody(input_stream, output_stream);
-            REQUIRE(output_stream.str() == "\tbyte_output[1] = __QB1;\r\n");
+            REQUIRE(output_stream.str() == "\tbyte_output[1] = (IEC_BYTE *)__QB1;\r\n\tbyte_output_present[0] |= (1 << 1);\r\n");
         }
 
         WHEN("Contains single USINT at %IB2") {
             std::stringstream input_stream("__LOCATED_VAR(USINT,__IB2,I,B,2)");
             generateBody(input_stream, output_stream);
-            REQUIRE(output_stream.str() == "\tbyte_input[2] = __IB2;\r\n");
+            REQUIRE(output_stream.str() == "\tbyte_input[2] = (IEC_BYTE *)__IB2;\r\n\tbyte_input_present[0] |= (1 << 2);\r\n");
         }
 
         WHEN("Contains single WORD at %IW0") {
             std::stringstream input_stream("__LOCATED_VAR(WORD,__IW0,I,W,0)");
             generateBody(input_stream, output_stream);
-            REQUIRE(output_stream.str() == "\tint_input[0] = __IW0;\r\n");
+            REQUIRE(output_stream.str() == "\tint_input[0] = (IEC_UINT *)__IW0;\r\n\tint_input_present[0] |= (1 << 0);\r\n");
         }
 
         WHEN("Contains single WORD at %QW0") {
             std::stringstream input_stream("__LOCATED_VAR(WORD,__QW0,Q,W,0)");
             generateBody(input_stream, output_stream);
-            REQUIRE(output_stream.str() == "\tint_output[0] = __QW0;\r\n");
+            REQUIRE(output_stream.str() == "\tint_output[0] = (IEC_UINT *)__QW0;\r\n\tint_output_present[0] |= (1 << 0);\r\n");
         }
 
         WHEN("Contains single INT at %IW1") {
             std::stringstream input_stream("__LOCATED_VAR(INT,__IW1,I,W,1)");
             generateBody(input_stream, output_stream);
-            REQUIRE(output_stream.str() == "\tint_input[1] = __IW1;\r\n");
+            REQUIRE(output_stream.str() == "\tint_input[1] = (IEC_UINT *)__IW1;\r\n\tint_input_present[0] |= (1 << 1);\r\n");
         }
 
         WHEN("Contains single UINT at %IW2") {
             std::stringstream input_stream("__LOCATED_VAR(UINT,__IW2,I,W,2)");
             generateBody(input_stream, output_stream);
-            REQUIRE(output_stream.str() == "\tint_input[2] = __IW2;\r\n");
+            REQUIRE(output_stream.str() == "\tint_input[2] = (IEC_UINT *)__IW2;\r\n\tint_input_present[0] |= (1 << 2);\r\n");
         }
 
         WHEN("Contains single INT at %MW2") {
             std::stringstream input_stream("__LOCATED_VAR(INT,__MW2,M,W,2)");
             generateBody(input_stream, output_stream);
-            REQUIRE(output_stream.str() == "\tint_memory[2] = __MW2;\r\n");
+            REQUIRE(output_stream.str() == "\tint_memory[2] = (IEC_UINT *)__MW2;\r\n\tint_memory_present[0] |= (1 << 2);\r\n");
         }
 
         WHEN("Contains single DWORD at %MD0") {
             std::stringstream input_stream("__LOCATED_VAR(DWORD,__MD2,M,D,2)");
             generateBody(input_stream, output_stream);
-            REQUIRE(output_stream.str() == "\tdint_memory[2] = (IEC_DINT *)__MD2;\r\n");
+            REQUIRE(output_stream.str() == "\tdint_memory[2] = (IEC_UDINT *)__MD2;\r\n\tdint_memory_present[0] |= (1 << 2);\r\n");
         }
 
         WHEN("Contains single LINT at %ML1") {
              std::stringstream input_stream("__LOCATED_VAR(LINT,__ML1,M,L,1)");
              generateBody(input_stream, output_stream);
-            REQUIRE(output_stream.str() == "\tlint_memory[1] = (IEC_LINT *)__ML1;\r\n");
+            REQUIRE(output_stream.str() == "\tlint_memory[1] = (IEC_ULINT *)__ML1;\r\n\tlint_memory_present[0] |= (1 << 1);\r\n");
         }
 
         WHEN("Contains single LINT at %ML1024") {
             std::stringstream input_stream("__LOCATED_VAR(LINT,__ML1024,M,L,1024)");
             generateBody(input_stream, output_stream);
-            REQUIRE(output_stream.str() == "\tspecial_functions[0] = (IEC_LINT *)__ML1024;\r\n");
+            REQUIRE(output_stream.str() == "\tspecial_functions[0] = (IEC_ULINT *)__ML1024;\r\n");
+        }
+    }
+
+    GIVEN("The glueVars header") {
+        std::stringstream output_stream;
+        generateHeader(output_stream);
+
+        THEN("Located variables are stored on the contiguous images") {
+            REQUIRE(output_stream.str().find("#define __LOCATED_VAR(type, name, loc, size, ...) type* name = (type *)&__IMAGE_##loc##size(__VA_ARGS__);") != string::npos);
+            REQUIRE(output_stream.str().find("bool_input[i][j] = &bool_input_image[i][j];") != string::npos);
+        }
+    }
+}
+
+SCENARIO("Program variables", "[variables]") {
+    GIVEN("VARIABLES.csv as a stream") {
+        std::stringstream output_stream;
+        WHEN("Contains program, resource and configuration variables") {
+            std::stringstream input_stream(
+                "// Programs\n"
+                "0;CONFIG0.RES0.INSTANCE0;MAIN;\n"
+                "\n"
+                "// Variables\n"
+                "0;VAR;CONFIG0.SETPOINT;CONFIG0.SETPOINT;INT;INT;0;\n"
+                "1;VAR;CONFIG0.RES0.ENABLE;CONFIG0.RES0.ENABLE;BOOL;BOOL;0;\n"
+                "2;FB;CONFIG0.RES0.INSTANCE0;CONFIG0.RES0.INSTANCE0;MAIN;;0;\n"
+                "3;OUT;CONFIG0.RES0.INSTANCE0.LAMP;CONFIG0.RES0.INSTANCE0.LAMP;BOOL;BOOL;0;\n"
+                "4;VAR;CONFIG0.RES0.INSTANCE0.COUNT;CONFIG0.RES0.INSTANCE0.COUNT;DINT;DINT;1;\n"
+                "5;FB;CONFIG0.RES0.INSTANCE0.TON0;CONFIG0.RES0.INSTANCE0.TON0;TON;;0;\n"
+                "6;VAR;CONFIG0.RES0.INSTANCE0.TON0.ET;CONFIG0.RES0.INSTANCE0.TON0.ET;TIME;TIME;0;\n"
+                "7;VAR;CONFIG0.RES0.INSTANCE0.STEP1.X;CONFIG0.RES0.INSTANCE0.__step_list[0].X;BOOL;BOOL;\n"
+                "8;OUT;CONFIG0.RES0.ALARM;CONFIG0.RES0.ALARM;BOOL;BOOL;0;\n"
+                "\n"
+                "// Ticktime\n"
+                "20000000\n");
+            generateProgramVariables(input_stream, output_stream);
+            string output = output_stream.str();
+
+            THEN("The objects and globals are declared") {
+                REQUIRE(output.find("extern MAIN RES0__INSTANCE0;\r\n") != string::npos);
+                REQUIRE(output.find("extern __IEC_INT_t CONFIG0__SETPOINT;\r\n") != string::npos);
+                REQUIRE(output.find("extern __IEC_BOOL_t RES0__ENABLE;\r\n") != string::npos);
+                REQUIRE(output.find("extern TON") == string::npos);
+            }
+
+            THEN("Only the variables that are not located are listed") {
+                size_t start = output.find("program_variables[]");
+                string table = output.substr(start, output.find("};", start) - start);
+                REQUIRE(output.find("\t{\"CONFIG0.SETPOINT\", \"INT\", &CONFIG0__SETPOINT.value, sizeof(CONFIG0__SETPOINT.value), &CONFIG0__SETPOINT.flags},\r\n") != string::npos);
+                REQUIRE(output.find("\t{\"CONFIG0.RES0.INSTANCE0.COUNT\", \"DINT\", &RES0__INSTANCE0.COUNT.value, sizeof(RES0__INSTANCE0.COUNT.value), &RES0__INSTANCE0.COUNT.flags},\r\n") != string::npos);
+                REQUIRE(output.find("&RES0__INSTANCE0.TON0.ET.value") != string::npos);
+                REQUIRE(output.find("\t{\"CONFIG0.RES0.INSTANCE0.STEP1.X\", \"BOOL\", &RES0__INSTANCE0.__step_list[0].X.value,") != string::npos);
+                REQUIRE(table.find("LAMP") == string::npos);
+                REQUIRE(table.find("ALARM") == string::npos);
+            }
+
+            THEN("The force overlay covers the located variables") {
+                REQUIRE(output.find("extern __IEC_BOOL_p RES0__ALARM;\r\n") != string::npos);
+                REQUIRE(output.find("__FORCE_LOCATED(RES0__INSTANCE0.COUNT)") == string::npos);
+                REQUIRE(output.find("\t__FORCE_LOCATED(RES0__INSTANCE0.LAMP)\r\n") != string::npos);
+                REQUIRE(output.find("\t__FORCE_LOCATED(RES0__ALARM)\r\n") != string::npos);
+            }
+        }
+
+        WHEN("There is no variables list") {
+            std::stringstream input_stream("");
+            generateProgramVariables(input_stream, output_stream);
+
+            THEN("The table only holds its terminator") {
+                REQUIRE(output_stream.str().find("POUS.h") == string::npos);
+                REQUIRE(output_stream.str().find("program_variables[] =\r\n{\r\n\t{NULL, NULL, NULL, 0, NULL}\r\n};") != string::npos);
+                REQUIRE(output_stream.str().find("void applyForceOverlay()\r\n{\r\n}") != string::npos);
+            }
+        }
+    }
+}
+
+SCENARIO("OPC UA address space", "[opcua]") {
+    GIVEN("The located variables of a program") {
+        std::stringstream output_stream;
+        vector<string> located;
+        located.push_back("__IX0_1");
+        located.push_back("__QW3");
+        located.push_back("__MX0_0");
+        located.push_back("__MD2");
+        located.push_back("__ML1024");
+        located.push_back("__IF7");
+
+        WHEN("There is no OPC UA variables list") {
+            std::stringstream names("");
+            generateAddressSpace(located, names, output_stream);
+            string output = output_stream.str();
+
+            THEN("Every exported variable is named after its location") {
+                REQUIRE(output.find("\t{4000000, \"IX0_1\", \"%IX0.1\", 'X', &bool_input_image[0][1], 1},\r\n") != string::npos);
+                REQUIRE(output.find("\t{4000001, \"QW3\", \"%QW3\", 'W', &int_output_image[3], 1},\r\n") != string::npos);
+                REQUIRE(output.find("\t{4000002, \"MD2\", \"%MD2\", 'D', &dint_memory_image[2], 1},\r\n") != string::npos);
+                REQUIRE(output.find("\t{4000003, \"IF7\", \"%IF7\", 'F', &lreal_input_image[7], 1},\r\n") != string::npos);
+            }
+
+            THEN("The areas without a runtime buffer are left out") {
+                REQUIRE(output.find("MX0_0") == string::npos);
+                REQUIRE(output.find("ML1024") == string::npos);
+                REQUIRE(output.find("\t{0, NULL, NULL, 0, NULL, 0}\r\n};") != string::npos);
+            }
+        }
+
+        WHEN("The OPC UA variables list names some of them") {
+            std::stringstream names(
+                "name,location,datatype\r\n"
+                "# comment\r\n"
+                "Start Button, %IX0.1, BOOL\r\n"
+                "Speed \"set\",%QW3,INT\r\n"
+                "Broken,%QX1,BOOL\r\n");
+            generateAddressSpace(located, names, output_stream);
+            string output = output_stream.str();
+
+            THEN("Only the listed variables are exported, from the end of the list") {
+                REQUIRE(output.find("\t{4000000, \"Speed \\\"set\\\"\", \"%QW3\", 'W', &int_output_image[3], 1},\r\n") != string::npos);
+                REQUIRE(output.find("\t{4000001, \"Start Button\", \"%IX0.1\", 'X', &bool_input_image[0][1], 1},\r\n") != string::npos);
+                REQUIRE(output.find("Broken") == string::npos);
+                REQUIRE(output.find("MD2") == string::npos);
+            }
+        }
+
+        WHEN("The OPC UA variables list gives ranges of locations") {
+            std::stringstream names(
+                "Registers,%MW0..%MW999,UINT\r\n"
+                "Inputs,%IX0.6..%IX1.1,BOOL\r\n"
+                "Mixed,%MW0..%MD3,UINT\r\n"
+                "Reversed,%QW9..%QW2,UINT\r\n");
+            generateAddressSpace(located, names, output_stream);
+            string output = output_stream.str();
+
+            THEN("Each range is exported as one array node") {
+                REQUIRE(output.find("\t{4000000, \"Inputs\", \"%IX0.6..%IX1.1\", 'X', &bool_input_image[0][6], 4},\r\n") != string::npos);
+                REQUIRE(output.find("\t{4000001, \"Registers\", \"%MW0..%MW999\", 'W', &int_memory_image[0], 1000},\r\n") != string::npos);
+            }
+
+            THEN("Ranges across areas or sizes are left out") {
+                REQUIRE(output.find("Mixed") == string::npos);
+                REQUIRE(output.find("Reversed") == string::npos);
+            }
+        }
+    }
+
+    GIVEN("The program interface") {
+        std::stringstream output_stream;
+        generateProgramInterface(output_stream);
+
+        THEN("The runtime gets the address space table") {
+            REQUIRE(output_stream.str().find("program->located_variables = located_variables;") != string::npos);
+        }
+    }
+}
+
+SCENARIO("Protocol map", "[protocols]") {
+    GIVEN("The located variables of a program") {
+        std::stringstream output_stream;
+        vector<string> located;
+        located.push_back("__IX1_2");
+        located.push_back("__QW3");
+        located.push_back("__MD2");
+        located.push_back("__ML5");
+        located.push_back("__IR4");
+        located.push_back("__MX0_0");
+        located.push_back("__ML1024");
+        generateProtocolMap(located, output_stream);
+        string output = output_stream.str();
+
+        THEN("Every variable gets its address on every protocol") {
+            REQUIRE(output.find("\t{'I', 'X', 10, &bool_input_image[1][2], {2, 0, 10}, {1, 0, 10}, {140, 10, 0}, {129, 2, 1}},\r\n") != string::npos);
+            REQUIRE(output.find("\t{'Q', 'W', 3, &int_output_image[3], {3, 0, 3}, {40, 0, 3}, {137, 0, 3}, {102, 0, 6}},\r\n") != string::npos);
+            REQUIRE(output.find("\t{'M', 'D', 2, &dint_memory_image[2], {3, 0, 2052}, {40, 0, 2050}, {145, 0, 2}, {1004, 0, 8}},\r\n") != string::npos);
+            REQUIRE(output.find("\t{'M', 'L', 5, &lint_memory_image[5], {3, 0, 4116}, {40, 0, 4101}, {0, 0, 0}, {0, 0, 0}},\r\n") != string::npos);
+        }
+
+        THEN("The protocols that don't reach a variable leave it out") {
+            REQUIRE(output.find("\t{'I', 'R', 4, &real_input_image[4], {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}},\r\n") != string::npos);
+        }
+
+        THEN("The areas without a runtime buffer are left out") {
+            REQUIRE(output.find("'M', 'X'") == string::npos);
+            REQUIRE(output.find("lint_memory_image[1024]") == string::npos);
+            REQUIRE(output.find("\t{0, 0, 0, NULL, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}}\r\n};") != string::npos);
+        }
+    }
+
+    GIVEN("The program interface") {
+        std::stringstream output_stream;
+        generateProgramInterface(output_stream);
+
+        THEN("The runtime gets the protocol map") {
+            REQUIRE(output_stream.str().find("program->protocol_map = protocol_map;") != string::npos);
+        }
+    }
+}
+
+SCENARIO("Image size", "[image]") {
+    GIVEN("The located variables of a program") {
+        vector<string> located;
+        located.push_back("__IX0_1");
+        located.push_back("__QW3");
+        located.push_back("__ML1500");
+
+        WHEN("They fit on the default images") {
+            THEN("The images keep the size mapped by the protocol servers") {
+                REQUIRE(imageSize(located, 0) == 1024);
+                REQUIRE(imageSize(located, 100) == 1024);
+            }
+        }
+
+        WHEN("A variable is located beyond the default images") {
+            located.push_back("__IW2000");
+            located.push_back("__QX1500_3");
+
+            THEN("The images hold the highest one plus the headroom, on whole blocks") {
+                REQUIRE(imageSize(located, 0) == 2048);
+                REQUIRE(imageSize(located, 64) == 2112);
+            }
+
+            THEN("The special functions are not counted") {
+                located.push_back("__ML5000");
+                REQUIRE(imageSize(located, 0) == 2048);
+            }
+        }
+
+        WHEN("A variable is located beyond the largest images") {
+            located.push_back("__MW70000");
+
+            THEN("The size is over the maximum") {
+                REQUIRE(imageSize(located, 0) > IMAGE_MAX_SIZE);
+            }
+        }
+    }
+
+    GIVEN("The size of the images") {
+        std::stringstream header_stream, size_stream, space_stream;
+        generateHeader(header_stream, 2048);
+        generateImageSize(size_stream, 2048);
+
+        THEN("glueVars.cpp and the runtime get the same size") {
+            REQUIRE(header_stream.str().find("#define BUFFER_SIZE\t\t2048\r\n") != string::npos);
+            REQUIRE(size_stream.str().find("#define BUFFER_SIZE\t\t2048\r\n") != string::npos);
+        }
+
+        THEN("The pointer tables start on a page of their own") {
+            REQUIRE(header_stream.str().find("IEC_UINT *int_output[BUFFER_SIZE] __POINTER_ALIGN;\r\n") != string::npos);
+            REQUIRE(header_stream.str().find("IEC_ULINT *special_functions[BUFFER_SIZE] __POINTER_ALIGN;\r\n") != string::npos);
+        }
+
+        THEN("The images start on a huge page of their own") {
+            REQUIRE(header_stream.str().find("IEC_BOOL bool_input_image[BUFFER_SIZE][8] __IMAGE_PAGE_ALIGN;\r\n") != string::npos);
+            REQUIRE(header_stream.str().find("IEC_BYTE image_pages_end[0] __attribute__((used)) __IMAGE_PAGE_ALIGN;") != string::npos);
+        }
+
+        THEN("lint_memory stops where the special functions start") {
+            REQUIRE(header_stream.str().find("for (int i = 0; i < 1024; i++)\r\n\t{\r\n\t\tlint_memory[i] = &lint_memory_image[i];") != string::npos);
+        }
+
+        THEN("The OPC UA server exports the variables of the larger images") {
+            vector<string> located;
+            located.push_back("__IW2000");
+            std::stringstream names("");
+            generateAddressSpace(located, names, space_stream, 2048);
+            REQUIRE(space_stream.str().find("&int_input_image[2000]") != string::npos);
         }
     }
 }
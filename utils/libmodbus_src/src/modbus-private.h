@@ -107,6 +107,9 @@ struct _modbus {
     struct timeval byte_timeout;
     const modbus_backend_t *backend;
     void *backend_data;
+    /* Response being received by modbus_receive_confirmation_nb() */
+    uint8_t nb_rsp[MODBUS_MAX_ADU_LENGTH];
+    int nb_rsp_length;
 };
 
 void _modbus_init_common(modbus_t *ctx);
@@ -1650,6 +1650,235 @@ int modbus_report_slave_id(modbus_t *ctx, int max_dest, uint8_t *dest)
     return rc;
 }
 
+/*
+ * Non-blocking client API (TCP only)
+ *
+ * modbus_send_request_nb() sends a request without waiting for its response,
+ * so several requests can be in flight on the same connection, told apart by
+ * their transaction IDs. modbus_receive_confirmation_nb() never waits either:
+ * it reads what the socket holds and returns a response once it is complete.
+ * The caller waits on modbus_get_socket() (select, poll, epoll...) and
+ * matches the response with its request by transaction ID.
+ */
+
+/* Builds a request in req and sends it. Returns the length of the request or
+   -1 if it could not be built or sent whole. */
+int modbus_send_request_nb(modbus_t *ctx, int function, int addr, int nb,
+                           const void *src, uint8_t *req)
+{
+    int rc;
+    int i;
+    int req_length;
+    int byte_count;
+    int max_nb;
+
+    if (ctx == NULL || ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_TCP) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    switch (function) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS:
+        max_nb = MODBUS_MAX_READ_BITS;
+        break;
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS:
+        max_nb = MODBUS_MAX_READ_REGISTERS;
+        break;
+    case MODBUS_FC_WRITE_MULTIPLE_COILS:
+        max_nb = MODBUS_MAX_WRITE_BITS;
+        break;
+    case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+        max_nb = MODBUS_MAX_WRITE_REGISTERS;
+        break;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (nb < 1 || nb > max_nb) {
+        if (ctx->debug) {
+            fprintf(stderr, "ERROR Invalid quantity of points (%d, max %d)\n",
+                    nb, max_nb);
+        }
+        errno = EMBMDATA;
+        return -1;
+    }
+
+    req_length = ctx->backend->build_request_basis(ctx, function, addr, nb, req);
+
+    if (function == MODBUS_FC_WRITE_MULTIPLE_COILS) {
+        const uint8_t *bits = src;
+        int pos = 0;
+
+        byte_count = (nb / 8) + ((nb % 8) ? 1 : 0);
+        req[req_length++] = byte_count;
+        for (i = 0; i < byte_count; i++) {
+            int bit;
+
+            req[req_length] = 0;
+            for (bit = 0x01; (bit & 0xFF) && pos < nb; bit = bit << 1) {
+                if (bits[pos++])
+                    req[req_length] |= bit;
+            }
+            req_length++;
+        }
+    } else if (function == MODBUS_FC_WRITE_MULTIPLE_REGISTERS) {
+        const uint16_t *registers = src;
+
+        byte_count = nb * 2;
+        req[req_length++] = byte_count;
+        for (i = 0; i < nb; i++) {
+            req[req_length++] = registers[i] >> 8;
+            req[req_length++] = registers[i] & 0x00FF;
+        }
+    }
+
+    req_length = ctx->backend->send_msg_pre(req, req_length);
+
+    if (ctx->debug) {
+        for (i = 0; i < req_length; i++)
+            printf("[%.2X]", req[i]);
+        printf("\n");
+    }
+
+    /* A request is much smaller than the socket buffer, a partial send
+       means the connection is not draining */
+    rc = ctx->backend->send(ctx, req, req_length);
+    if (rc == -1) {
+        _error_print(ctx, NULL);
+        return -1;
+    }
+    if (rc != req_length) {
+        errno = EMBBADDATA;
+        return -1;
+    }
+
+    return req_length;
+}
+
+/* Reads the available bytes of the next response. Returns the length of the
+   response stored in rsp once it is complete, 0 if more bytes are needed or
+   -1 on error. */
+int modbus_receive_confirmation_nb(modbus_t *ctx, uint8_t *rsp)
+{
+    const int header_length = ctx ? (int)ctx->backend->header_length : 0;
+
+    if (ctx == NULL || ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_TCP) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (;;) {
+        int rc;
+        int length_to_read;
+
+        if (ctx->nb_rsp_length < header_length) {
+            length_to_read = header_length - ctx->nb_rsp_length;
+        } else {
+            /* The MBAP length counts the unit id and the PDU */
+            int mbap_length = (ctx->nb_rsp[4] << 8) | ctx->nb_rsp[5];
+            if (mbap_length < 2 || 6 + mbap_length > MODBUS_MAX_ADU_LENGTH) {
+                ctx->nb_rsp_length = 0;
+                errno = EMBBADDATA;
+                _error_print(ctx, "invalid length");
+                return -1;
+            }
+            length_to_read = 6 + mbap_length - ctx->nb_rsp_length;
+        }
+
+        if (length_to_read == 0) {
+            int rsp_length = ctx->nb_rsp_length;
+
+            memcpy(rsp, ctx->nb_rsp, rsp_length);
+            ctx->nb_rsp_length = 0;
+            if (ctx->debug)
+                printf("\n");
+            return rsp_length;
+        }
+
+        rc = ctx->backend->recv(ctx, ctx->nb_rsp + ctx->nb_rsp_length, length_to_read);
+        if (rc == 0) {
+            errno = ECONNRESET;
+            rc = -1;
+        }
+        if (rc == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            _error_print(ctx, "read");
+            return -1;
+        }
+
+        if (ctx->debug) {
+            int i;
+            for (i = 0; i < rc; i++)
+                printf("<%.2X>", ctx->nb_rsp[ctx->nb_rsp_length + i]);
+        }
+        ctx->nb_rsp_length += rc;
+    }
+}
+
+/* Returns the transaction ID of a TCP request or response */
+int modbus_get_transaction_id(const uint8_t *msg)
+{
+    return (msg[0] << 8) | msg[1];
+}
+
+/* Checks a response received by modbus_receive_confirmation_nb() against its
+   request and, for reads, stores the values in dest (uint8_t per bit or
+   uint16_t per register). Returns the quantity of points of the response or
+   -1 and sets errno (with the exception code for exception responses). */
+int modbus_check_confirmation(modbus_t *ctx, uint8_t *req, uint8_t *rsp,
+                              int rsp_length, void *dest)
+{
+    int rc;
+    int i;
+    int offset;
+
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    rc = check_confirmation(ctx, req, rsp, rsp_length);
+    if (rc == -1)
+        return -1;
+
+    offset = ctx->backend->header_length;
+    switch (req[offset]) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS: {
+        uint8_t *bits = dest;
+        int nb = (req[offset + 3] << 8) | req[offset + 4];
+        int pos = 0;
+
+        for (i = offset + 2; i < offset + 2 + rc; i++) {
+            int bit;
+            for (bit = 0x01; (bit & 0xff) && pos < nb; bit = bit << 1) {
+                bits[pos++] = (rsp[i] & bit) ? TRUE : FALSE;
+            }
+        }
+        rc = nb;
+    }
+        break;
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS: {
+        uint16_t *registers = dest;
+
+        for (i = 0; i < rc; i++) {
+            registers[i] = (rsp[offset + 2 + (i << 1)] << 8) |
+                rsp[offset + 3 + (i << 1)];
+        }
+    }
+        break;
+    default:
+        break;
+    }
+
+    return rc;
+}
+
 void _modbus_init_common(modbus_t *ctx)
 {
     /* Slave and socket are initialized to -1 */
@@ -1664,6 +1893,8 @@ void _modbus_init_common(modbus_t *ctx)
 
     ctx->byte_timeout.tv_sec = 0;
     ctx->byte_timeout.tv_usec = _BYTE_TIMEOUT;
+
+    ctx->nb_rsp_length = 0;
 }
 
 /* Define the slave number */
@@ -1780,6 +2011,8 @@ int modbus_connect(modbus_t *ctx)
         return -1;
     }
 
+    /* Drop the partial response of the previous connection */
+    ctx->nb_rsp_length = 0;
     return ctx->backend->connect(ctx);
 }
 
@@ -1788,6 +2021,7 @@ void modbus_close(modbus_t *ctx)
     if (ctx == NULL)
         return;
 
+    ctx->nb_rsp_length = 0;
     ctx->backend->close(ctx);
 }
 
@@ -233,6 +233,13 @@ MODBUS_API int modbus_receive(modbus_t *ctx, uint8_t *req);
 
 MODBUS_API int modbus_receive_confirmation(modbus_t *ctx, uint8_t *rsp);
 
+MODBUS_API int modbus_send_request_nb(modbus_t *ctx, int function, int addr, int nb,
+                                      const void *src, uint8_t *req);
+MODBUS_API int modbus_receive_confirmation_nb(modbus_t *ctx, uint8_t *rsp);
+MODBUS_API int modbus_get_transaction_id(const uint8_t *msg);
+MODBUS_API int modbus_check_confirmation(modbus_t *ctx, uint8_t *req, uint8_t *rsp,
+                                         int rsp_length, void *dest);
+
 MODBUS_API int modbus_reply(modbus_t *ctx, const uint8_t *req,
                             int req_length, modbus_mapping_t *mb_mapping);
 MODBUS_API int modbus_reply_exception(modbus_t *ctx, const uint8_t *req,
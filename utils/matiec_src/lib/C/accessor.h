@@ -82,6 +82,39 @@
 #define __INIT_LOCATED_VALUE(name, initial)\
 	*(name.value) = initial;
 
+// POU profiling macros (stage4 option f). They open and close the body of
+// every program and function block. The runtime adds the time of each call
+// to the profile of its POU type, keeping the time spent in the POUs it
+// calls apart
+typedef struct __plc_pou_profile_t {
+	const char *name;
+	unsigned long generation;
+	unsigned long long calls;
+	unsigned long long total_ns;
+	unsigned long long self_ns;
+	unsigned long long max_ns;
+	struct __plc_pou_profile_t *next;
+} __plc_pou_profile_t;
+typedef struct {
+	unsigned long long start_ns;
+	unsigned long long outer_child_ns;
+} __plc_pou_frame_t;
+#ifdef __cplusplus
+extern "C" {
+#endif
+void __plc_pou_enter(__plc_pou_frame_t *frame);
+void __plc_pou_exit(__plc_pou_profile_t *profile, __plc_pou_frame_t *frame);
+#ifdef __cplusplus
+}
+#endif
+#define __PROFILE_POU_ENTER(name)\
+	static __plc_pou_profile_t __pou_profile = {#name, 0, 0, 0, 0, 0, NULL};\
+	__plc_pou_frame_t __pou_frame;\
+	__plc_pou_enter(&__pou_frame);
+#define __PROFILE_POU_EXIT(name)\
+	__plc_pou_exit(&__pou_profile, &__pou_frame);
+
+
 
 // variable getting macros
 #define __GET_VAR(name, ...)\
@@ -133,4 +166,9 @@
 #define __SET_LOCATED(prefix, name, suffix, new_value)\
 	if (!(prefix name.flags & __IEC_FORCE_FLAG)) *(prefix name.value) suffix = new_value
 
+// force flag test macro. The code that writes a variable without its setter
+// must check it first
+#define __IS_VAR_FORCED(name, ...)\
+	(name.flags & __IEC_FORCE_FLAG)
+
 #endif //__ACCESSOR_H
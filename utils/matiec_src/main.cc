@@ -109,7 +109,7 @@ void error_exit(const char *file_name, int line_no, const char *errmsg, ...) {
 
 
 static void printusage(const char *cmd) {
-  printf("\nsyntax: %s [<options>] [-O <output_options>] [-I <include_directory>] [-T <target_directory>] <input_file>\n", cmd);
+  printf("\nsyntax: %s [<options>] [-O <output_options>] [-I <include_directory>] [-T <target_directory>] [-L <library_cache>] <input_file>\n", cmd);
   printf(" -h : show this help message\n");
   printf(" -v : print version number\n");  
   printf(" -f : display full token location on error messages\n");
@@ -125,6 +125,7 @@ static void printusage(const char *cmd) {
   printf(" -b : allow functions returning VOID                 (a non-standard extension!)\n");
   printf(" -e : disable generation of implicit EN and ENO parameters.\n");
   printf(" -c : create conversion functions for enumerated data types\n");
+  printf(" -L : cache the library elements found when pre-parsing (-p) the standard library in the given file\n");
   printf(" -O : options for output (code generation) stage. Available options for %s are...\n", cmd);
   runtime_options.allow_missing_var_in    = false; /* disable: allow definition and invocation of POUs with no input, output and in_out parameters! */
   stage4_print_options();
@@ -158,6 +159,7 @@ int main(int argc, char **argv) {
   runtime_options.ref_nonstand_extensions = false; /* disable: Allow the use of non-standard extensions to REF_TO datatypes: REF_TO ANY, and REF_TO in struct elements! */
   runtime_options.nonliteral_in_array_size= false; /* disable: Allow the use of constant non-literals when specifying size of arrays (ARRAY [1..max] OF INT) */
   runtime_options.includedir              = NULL;  /* Include directory, where included files will be searched for... */
+  runtime_options.library_cache           = NULL;  /* File caching the library elements of the pre-parsing phase... */
 
   /* Default values for the command line options... */
   runtime_options.relaxed_datatype_model    = false; /* by default use the strict datatype equivalence model */
@@ -165,7 +167,7 @@ int main(int argc, char **argv) {
   /******************************************/
   /*   Parse command line options...        */
   /******************************************/
-  while ((optres = getopt(argc, argv, ":nehvfplsrRabicI:T:O:")) != -1) {
+  while ((optres = getopt(argc, argv, ":nehvfplsrRabicI:T:O:L:")) != -1) {
     switch(optres) {
     case 'h':
       printusage(argv[0]);
@@ -205,7 +207,10 @@ int main(int argc, char **argv) {
     case 'O':
       if (stage4_parse_options(optarg) < 0) errflg++;
       break;
-    case ':':       /* -I, -T, or -O without operand */
+    case 'L':
+      runtime_options.library_cache = optarg;
+      break;
+    case ':':       /* -I, -T, -O, or -L without operand */
       fprintf(stderr, "Option -%c requires an operand\n", optopt);
       errflg++;
       break;
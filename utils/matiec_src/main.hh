@@ -52,6 +52,7 @@ typedef struct {
 	bool ref_nonstand_extensions;  /* Allow the use of non-standard extensions to REF_TO datatypes: REF_TO ANY, and REF_TO in struct elements! */
 	bool nonliteral_in_array_size; /* Allow the use of constant non-literals when specifying size of arrays (ARRAY [1..max] OF INT) */
 	const char *includedir;        /* Include directory, where included files will be searched for... */
+	const char *library_cache;     /* File caching the library element names found by the pre-parsing of the standard library (NULL: no cache) */
 	
    /* options specific to stage3 */
 	bool relaxed_datatype_model;   /* Use the relaxed datatype equivalence model, instead of the default strict equivalence model */
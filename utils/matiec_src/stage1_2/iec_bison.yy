@@ -8462,6 +8462,7 @@ continue_statement:
 
 #include <stdio.h>	/* required for printf() */
 #include <errno.h>
+#include <sys/stat.h>	/* required for stat() */
 #include "../util/symtable.hh"
 
 
@@ -8748,8 +8749,104 @@ NULL
 extern const char *INCLUDE_DIRECTORIES[];
 
 
-static int parse_files(const char *libfilename, const char *filename) {
-  /* first parse the standard library file... */  
+/* The library element cache (-L option)
+ * ---------------------------------------
+ * The only result of pre-parsing the standard library that outlives the pre-parsing
+ * run is the set of names it leaves in the library_element_symtable (the AST is thrown
+ * away). Those names are written to the cache file, together with the size and
+ * modification time of every library file that was read, and a stamp of the command
+ * line options and of the iec2c executable (the token values are only valid for the
+ * iec2c that wrote them). When none of them changed, the next pre-parsing run
+ * restores the names from the cache and skips straight to the main file.
+ *
+ * The normal parsing run always parses the library, as the AST of the library is
+ * required by stage3 and stage4.
+ */
+#define LIBRARY_CACHE_VERSION 1
+
+static unsigned long library_cache_stamp(void) {
+  bool options[] = {runtime_options.allow_void_datatype,     runtime_options.allow_missing_var_in,
+                    runtime_options.disable_implicit_en_eno, runtime_options.safe_extensions,
+                    runtime_options.conversion_functions,    runtime_options.nested_comments,
+                    runtime_options.ref_standard_extensions, runtime_options.ref_nonstand_extensions,
+                    runtime_options.nonliteral_in_array_size};
+  unsigned long stamp = 2166136261UL;  /* FNV-1a */
+  for (unsigned int i = 0; i < sizeof(options) / sizeof(options[0]); i++)
+    stamp = ((stamp ^ (options[i] ? 1 : 0)) * 16777619UL) & 0xFFFFFFFFUL;
+
+  struct stat exe;
+  if (stat("/proc/self/exe", &exe) == 0) {
+    stamp = ((stamp ^ (unsigned long)exe.st_size)  * 16777619UL) & 0xFFFFFFFFUL;
+    stamp = ((stamp ^ (unsigned long)exe.st_mtime) * 16777619UL) & 0xFFFFFFFFUL;
+  }
+  return stamp;
+}
+
+/* Restores the library element names from the cache file.
+ * Returns false (and leaves the symtable untouched) if the cache is missing or stale.
+ */
+static bool load_library_cache(const char *cachefilename) {
+  FILE *cachefile = fopen(cachefilename, "r");
+  if (cachefile == NULL)
+    return false;
+
+  std::vector<std::pair<std::string, int> > names;
+  char line[4096];
+  unsigned int version;
+  unsigned long stamp;
+  bool valid = (fgets(line, sizeof(line), cachefile) != NULL)
+            && (sscanf(line, "iec2c library cache %u %lx", &version, &stamp) == 2)
+            && (version == LIBRARY_CACHE_VERSION)
+            && (stamp == library_cache_stamp());
+
+  while (valid && (fgets(line, sizeof(line), cachefile) != NULL)) {
+    line[strcspn(line, "\n")] = '\0';
+    long long size, mtime;
+    int token, start;
+    struct stat file;
+    if (sscanf(line, "file %lld %lld %n", &size, &mtime, &start) == 2)
+      valid = (stat(line + start, &file) == 0) && (file.st_size == size) && (file.st_mtime == mtime);
+    else if (sscanf(line, "name %d %n", &token, &start) == 1)
+      names.push_back(std::make_pair(std::string(line + start), token));
+    else
+      valid = false;
+  }
+  fclose(cachefile);
+
+  if (!valid || names.empty())
+    return false;
+
+  for (unsigned int i = 0; i < names.size(); i++)
+    library_element_symtable.insert(names[i].first.c_str(), names[i].second);
+  return true;
+}
+
+/* Writes the library element names and the library files they came from to the cache file.
+ * The file is written under a temporary name and then renamed, so a concurrent iec2c
+ * never reads half a cache. Failing to write the cache is not an error.
+ */
+static void save_library_cache(const char *cachefilename, const std::vector<std::string> &files) {
+  std::string tmpfilename = std::string(cachefilename) + ".tmp";
+  FILE *cachefile = fopen(tmpfilename.c_str(), "w");
+  if (cachefile == NULL)
+    return;
+
+  bool ok = fprintf(cachefile, "iec2c library cache %u %lx\n", LIBRARY_CACHE_VERSION, library_cache_stamp()) > 0;
+  for (unsigned int i = 0; ok && (i < files.size()); i++) {
+    struct stat file;
+    ok = (stat(files[i].c_str(), &file) == 0)
+      && (fprintf(cachefile, "file %lld %lld %s\n", (long long)file.st_size, (long long)file.st_mtime, files[i].c_str()) > 0);
+  }
+  for (library_element_symtable_t::iterator iter = library_element_symtable.begin();
+       ok && (iter != library_element_symtable.end()); iter++)
+    ok = fprintf(cachefile, "name %d %s\n", iter->second, iter->first.c_str()) > 0;
+
+  if ((fclose(cachefile) != 0) || !ok || (rename(tmpfilename.c_str(), cachefilename) != 0))
+    remove(tmpfilename.c_str());
+}
+
+
+static int parse_library(const char *libfilename) {
   /*   Do not debug the standard library, even if debug flag is set!
   #if YYDEBUG
     yydebug = 1;
@@ -8780,6 +8877,24 @@ static int parse_files(const char *libfilename, const char *filename) {
     fprintf (stderr, "\n%d error(s) found in %s. Bailing out!\n", yynerrs, libfilename);
     return -2;
   }
+  return 0;
+}
+
+
+static int parse_files(const char *libfilename, const char *filename) {
+  /* first parse the standard library file... */  
+  const char *cachefilename = get_preparse_state()? runtime_options.library_cache: NULL;
+  if ((cachefilename == NULL) || !load_library_cache(cachefilename)) {
+    included_file_names.clear();
+    int res = parse_library(libfilename);
+    if (res < 0)
+      return res;
+    if (cachefilename != NULL) {
+      std::vector<std::string> files(1, libfilename);
+      files.insert(files.end(), included_file_names.begin(), included_file_names.end());
+      save_library_cache(cachefilename, files);
+    }
+  }
 
   /* if by any chance the library is not complete, we now add the missing reserved keywords to the list!!!  */
   for(int i = 0; standard_function_block_names[i] != NULL; i++)
@@ -2057,6 +2057,8 @@ void include_file(const char *filename) {
       exit( 1 );
     }
     filehandle = fopen(full_name, "r");
+    if (filehandle != NULL)
+      included_file_names.push_back(full_name);
     free(full_name);
   }
 
@@ -154,6 +154,9 @@ void rst_pop_state(void) {pop_state__ = 0;}
  */
 /* static */ direct_variable_symtable_t direct_variable_symtable;
 
+/* The full names of the files included so far (see include_file() in flex)... */
+std::vector<std::string> included_file_names;
+
 /* Function only called from within flex!
  *
  * search for a symbol in either of the two symbol tables
@@ -48,6 +48,9 @@
 
 
 
+#include <string>
+#include <vector>
+
 /* file with the declarations of symbol tables... */
 #include "../util/symtable.hh"
 #include "stage1_2.hh"
@@ -141,6 +144,11 @@ void include_string(const char *source_code);
  */
 FILE *parse_file(const char *filename);
 
+/* Full names of the files included with the {#include ...} pragma, in the order
+ * they were opened. Used to know on which files a cached library depends.
+ */
+extern std::vector<std::string> included_file_names;
+
 
 /**********************************************************************************************/
 /* whether bison is doing the pre-parsing, where POU bodies and var declarations are ignored! */
@@ -1240,8 +1240,10 @@ constant_propagation_c::constant_propagation_c(symbol_c *symbol)
     current_resource = NULL;
     current_configuration = NULL;
     fixed_init_value_ = false;
+    constant_value_ = false;
     function_pou_ = false;
     values = NULL;
+    constants = NULL;
   }
 
 
@@ -1388,14 +1390,21 @@ void *constant_propagation_c::visit(library_c *symbol) {
 /*********************/
 /* B 1.4 - Variables */
 /*********************/
-#if DO_CONSTANT_PROPAGATION__
+/* Variables declared CONSTANT (including the VAR_EXTERNAL CONSTANT, that get the value of the
+ * VAR_GLOBAL CONSTANT of the configuration/resource) are always replaced by their value, so the
+ * expressions that use them are folded, and stage 4 can leave out the code they disable.
+ */
 void *constant_propagation_c::visit(symbolic_variable_c *symbol) {
 	std::string varName = get_var_name_c::get_name(symbol->var_name)->value;
+#if DO_CONSTANT_PROPAGATION__
 	if (values->count(varName) > 0) 
 		symbol->const_value = (*values)[varName];
+#else
+	if ((NULL != constants) && (constants->count(varName) > 0))
+		symbol->const_value = (*constants)[varName];
+#endif  // DO_CONSTANT_PROPAGATION__
 	return NULL;
 }
-#endif  // DO_CONSTANT_PROPAGATION__
 
 void *constant_propagation_c::visit(symbolic_constant_c *symbol) {
 	std::string varName = get_var_name_c::get_name(symbol->var_name)->value;
@@ -1409,10 +1418,15 @@ void *constant_propagation_c::visit(symbolic_constant_c *symbol) {
 /* B 1.4.3 - Declaration & Initialisation */
 /******************************************/
   
-void *constant_propagation_c::handle_var_decl(symbol_c *var_list, bool fixed_init_value) {
+void *constant_propagation_c::handle_var_decl(symbol_c *var_list, bool fixed_init_value, bool constant_value) {
+  /* The declarations may instantiate FBs, whose declarations are visited recursively => keep the flags of the caller */
+  bool prev_fixed_init_value = fixed_init_value_;
+  bool prev_constant_value   = constant_value_;
   fixed_init_value_ = fixed_init_value;
+  constant_value_   = constant_value;
   var_list->accept(*this); 
-  fixed_init_value_ = false; 
+  fixed_init_value_ = prev_fixed_init_value; 
+  constant_value_   = prev_constant_value;
   return NULL;
 }
 
@@ -1480,6 +1494,8 @@ void *constant_propagation_c::handle_var_list_decl(symbol_c *var_list, symbol_c
         // Notice that global variables are also placed in the values map!!
         var_global_values[var_name->value] = init_value->const_value;
     }
+    if (constant_value_ && (NULL != constants))
+      (*constants)[var_name->value] = init_value->const_value;
   }
   return NULL;
 }
@@ -1561,7 +1577,7 @@ void *constant_propagation_c::visit(input_output_declarations_c *symbol) {return
 /* VAR [CONSTANT] var_init_decl_list END_VAR */
 /* option -> may be NULL ! */
 //SYM_REF2(var_declarations_c, option, var_init_decl_list)
-void *constant_propagation_c::visit(var_declarations_c *symbol) {return handle_var_decl(symbol->var_init_decl_list, false);}
+void *constant_propagation_c::visit(var_declarations_c *symbol) {return handle_var_decl(symbol->var_init_decl_list, false, is_constant(symbol->option));}
 
 /*  VAR RETAIN var_init_decl_list END_VAR */
 //SYM_REF1(retentive_var_declarations_c, var_init_decl_list)             // Not needed since we inherit from iterator_visitor_c!
@@ -1585,7 +1601,7 @@ SYM_REF3(located_var_decl_c, variable_name, location, located_var_spec_init)
 /*| VAR_EXTERNAL [CONSTANT] external_declaration_list END_VAR */
 /* option -> may be NULL ! */
 // SYM_REF2(external_var_declarations_c, option, external_declaration_list)
-void *constant_propagation_c::visit(external_var_declarations_c *symbol) {return handle_var_decl(symbol->external_declaration_list, is_constant(symbol->option));}
+void *constant_propagation_c::visit(external_var_declarations_c *symbol) {return handle_var_decl(symbol->external_declaration_list, is_constant(symbol->option), is_constant(symbol->option));}
 
 /* helper symbol for external_var_declarations */
 /*| external_declaration_list external_declaration';' */
@@ -1628,6 +1644,8 @@ void *constant_propagation_c::visit(external_declaration_c *symbol) {
 //  (*values)[symbol->global_var_name->get_value()] = symbol->specification->const_value;
     (*values)[get_var_name_c::get_name(symbol->global_var_name)->value] = symbol->specification->const_value;
   }
+  if (constant_value_ && (NULL != constants))
+    (*constants)[get_var_name_c::get_name(symbol->global_var_name)->value] = symbol->specification->const_value;
   // If the datatype specification is a subrange or array, do constant folding of all the literals in that type declaration... (ex: literals in array subrange limits)
   symbol->specification->accept(*this);  // should never get to change the const_value of the symbol->specification symbol (only its children!).
   return NULL;
@@ -1656,7 +1674,7 @@ void *constant_propagation_c::visit(external_declaration_c *symbol) {
  * Nevertheless, since constant folding is idem-potent, it is simpler to just call handle_var_decl() instead
  * of writing some code specific for this situation!
  */
-void *constant_propagation_c::visit(global_var_declarations_c *symbol) {return handle_var_decl(symbol->global_var_decl_list, is_constant(symbol->option));}
+void *constant_propagation_c::visit(global_var_declarations_c *symbol) {return handle_var_decl(symbol->global_var_decl_list, is_constant(symbol->option), is_constant(symbol->option));}
 
 
 /* helper symbol for global_var_declarations */
@@ -1740,8 +1758,11 @@ SYM_LIST(var_init_decl_list_c)
 //SYM_REF4(function_declaration_c, derived_function_name, type_name, var_declarations_list, function_body, enumvalue_symtable_t enumvalue_symtable;)
 void *constant_propagation_c::visit(function_declaration_c *symbol) {
 	map_values_t local_values, *prev_pou_values;
+	map_values_t local_constants, *prev_pou_constants;
 	prev_pou_values = values; // store the current values map of whoever called this Function (a program, configuration, or resource)
 	values = &local_values;
+	prev_pou_constants = constants;
+	constants = &local_constants;
 	var_global_values.push(); /* Create inner scope - Not really needed, but do it just to be consistent. */
 
 	/* Add initial value of all declared variables into Values map. */
@@ -1752,6 +1773,7 @@ void *constant_propagation_c::visit(function_declaration_c *symbol) {
 
 	var_global_values.pop(); /* Delete inner scope */
 	values = prev_pou_values;
+	constants = prev_pou_constants;
 	return NULL;
 }
 
@@ -1766,7 +1788,7 @@ void *constant_propagation_c::visit(function_declaration_c *symbol) {
 /* option -> storage method, CONSTANT or <null> */
 // SYM_REF2(function_var_decls_c, option, decl_list)
 // NOTE: function_var_decls_c is only used inside Functions, so it is safe to call with fixed_init_value_ = true 
-void *constant_propagation_c::visit(function_var_decls_c *symbol) {return handle_var_decl(symbol->decl_list, true);}
+void *constant_propagation_c::visit(function_var_decls_c *symbol) {return handle_var_decl(symbol->decl_list, true, is_constant(symbol->option));}
 
 /* intermediate helper symbol for function_var_decls */
 // SYM_LIST(var2_init_decl_list_c) // Not needed since we inherit from iterator_c
@@ -1780,8 +1802,11 @@ void *constant_propagation_c::visit(function_var_decls_c *symbol) {return handle
 //SYM_REF3(function_block_declaration_c, fblock_name, var_declarations, fblock_body, enumvalue_symtable_t enumvalue_symtable;)
 void *constant_propagation_c::visit(function_block_declaration_c *symbol) {
 	map_values_t local_values, *prev_pou_values;
+	map_values_t local_constants, *prev_pou_constants;
 	prev_pou_values = values; // store the current values map of whoever instantited this FB (a program, configuration, or resource)
 	values = &local_values;
+	prev_pou_constants = constants;
+	constants = &local_constants;
 	var_global_values.push(); /* Create inner scope */
 
 	/* Add initial value of all declared variables into Values map. */
@@ -1791,6 +1816,7 @@ void *constant_propagation_c::visit(function_block_declaration_c *symbol) {
 
 	var_global_values.pop(); /* Delete inner scope */
 	values = prev_pou_values;
+	constants = prev_pou_constants;
 	return NULL;
 }
 
@@ -1814,8 +1840,11 @@ void *constant_propagation_c::visit(non_retentive_var_decls_c *symbol) {return h
 //SYM_REF3(program_declaration_c, program_type_name, var_declarations, function_block_body, enumvalue_symtable_t enumvalue_symtable;)
 void *constant_propagation_c::visit(program_declaration_c *symbol) {
 	map_values_t local_values, *prev_pou_values;
+	map_values_t local_constants, *prev_pou_constants;
 	prev_pou_values = values; // store the current values map of whoever instantited this Program (a configuration, or resource)
 	values = &local_values;
+	prev_pou_constants = constants;
+	constants = &local_constants;
 	var_global_values.push(); /* Create inner scope */
 
 	/* Add initial value of all declared variables into Values map. */
@@ -1825,6 +1854,7 @@ void *constant_propagation_c::visit(program_declaration_c *symbol) {
 
 	var_global_values.pop(); /* Delete inner scope */
 	values = prev_pou_values;
+	constants = prev_pou_constants;
 	return NULL;
 }
 
@@ -1845,8 +1875,9 @@ END_CONFIGURATION
 // SYM_REF5(configuration_declaration_c, configuration_name, global_var_declarations, resource_declarations, access_declarations, instance_specific_initializations, 
 //          enumvalue_symtable_t enumvalue_symtable; localvar_symbmap_t localvar_symbmap; localvar_symbvec_t localvar_symbvec;)
 void *constant_propagation_c::visit(configuration_declaration_c *symbol) {
-	map_values_t local_values;
+	map_values_t local_values, local_constants;
 	values = &local_values;
+	constants = &local_constants;
 	var_global_values.clear(); /* Clear global variables map */
 
 	/* Add initial value of all declared variables into Values map. */
@@ -1856,6 +1887,7 @@ void *constant_propagation_c::visit(configuration_declaration_c *symbol) {
 	current_configuration = NULL;
 
 	values = NULL;
+	constants = NULL;
 	return NULL;
 }
 
@@ -1875,6 +1907,7 @@ END_RESOURCE
 void *constant_propagation_c::visit(resource_declaration_c *symbol) {
 	var_global_values.push(); /* Create inner scope */
 	values->push(); /* Create inner scope */
+	constants->push(); /* Create inner scope */
 
 	/* Add initial value of all declared variables into Values map. */
 	function_pou_ = false;
@@ -1887,6 +1920,7 @@ void *constant_propagation_c::visit(resource_declaration_c *symbol) {
 
 	var_global_values.pop(); /* Delete inner scope */
 	values->pop(); /* Delete inner scope */
+	constants->pop(); /* Delete inner scope */
 	return NULL;
 }
 
@@ -212,16 +212,23 @@ class constant_propagation_c : public constant_folding_c {
     symbol_c *current_resource;
     symbol_c *current_configuration;
     map_values_t *values;
+    /* The values of the variables declared CONSTANT in the POU currently being analysed. Unlike the
+     * values map, these hold for the whole POU, so they are propagated even while the constant
+     * propagation algorithm is disabled (DO_CONSTANT_PROPAGATION__).
+     */
+    map_values_t *constants;
     map_values_t var_global_values;
     /* A stack of all the FB declarations currently being recursively constant propagated */
     std::deque<function_block_declaration_c *> fbs_currently_being_visited; // We use a deque instead of stack, so we can search in the stack using direct access to its elements!
 
     void *handle_var_list_decl(symbol_c *var_list, symbol_c *type_decl, bool is_global_var = false);
-    void *handle_var_decl     (symbol_c *var_list, bool fixed_init_value);
+    void *handle_var_decl     (symbol_c *var_list, bool fixed_init_value, bool constant_value = false);
     // Flag to indicate whether the variables in the variable declaration list will always have a fixed value when the POU is executed!
     // VAR CONSTANT ... END_VAR will always be true
     // VAR          ... END_VAR will always be true for functions (who initialise local variables every time they are called), but false for FBs and PROGRAMS
     bool fixed_init_value_; 
+    // Flag to indicate whether the variables in the variable declaration list are declared CONSTANT
+    bool constant_value_;
     bool function_pou_;
     bool is_constant(symbol_c *option);
     bool is_retain  (symbol_c *option);
@@ -237,9 +244,7 @@ class constant_propagation_c : public constant_folding_c {
     /*********************/
     /* B 1.4 - Variables */
     /*********************/
-    #if DO_CONSTANT_PROPAGATION__
     void *visit(symbolic_variable_c *symbol);
-    #endif // DO_CONSTANT_PROPAGATION__
     void *visit(symbolic_constant_c *symbol);
                              
     /******************************************/
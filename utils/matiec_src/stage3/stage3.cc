@@ -34,6 +34,15 @@
 
 #include "stage3.hh"
 
+#include <stdio.h>
+#include <stdlib.h>
+#if !defined(_WIN32) || defined(__CYGWIN__)
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#define STAGE3_FORK_CHECKS
+#endif
+
 #include "flow_control_analysis.hh"
 #include "fill_candidate_datatypes.hh"
 #include "narrow_candidate_datatypes.hh"
@@ -155,16 +164,103 @@ static int remove_forward_dependencies(symbol_c *tree_root, symbol_c **ordered_t
 }
 
 
+/* Checks that only read the AST and report errors (enum_declaration_check, declaration_safety,
+ * lvalue_check and case_elements_check) run in a child process, forked as soon as the
+ * analysis they depend on is complete, while this process goes on with the analysis that
+ * annotates the AST for stage4 (flow control, constant folding, type safety, array ranges).
+ * The child works on a copy-on-write snapshot of the AST, so the visitors (and the singletons
+ * in absyntax_utils) need no locking.
+ *
+ * Each child prints its diagnostics to a temporary file, and writes its error count to a pipe.
+ * The diagnostics of the checks are copied to stderr once the annotating passes are done,
+ * always in the same (pass) order, so the output does not depend on which child ends first.
+ *
+ * If a check can not be forked, it simply runs in this process.
+ */
+typedef struct {
+	pid_t  pid;          /* child running the check, 0 if it ran in this process */
+	FILE  *output;       /* diagnostics printed by the child */
+	int    result;       /* pipe where the child writes its error count */
+	int    error_count;  /* error count, if the check ran in this process */
+} stage3_check_t;
+
+
+static void start_check(stage3_check_t *check, int (*run_check)(symbol_c *), symbol_c *tree_root) {
+	check->pid    = 0;
+	check->output = NULL;
+	check->result = -1;
+#ifdef STAGE3_FORK_CHECKS
+	int result[2];
+	FILE *output = tmpfile();
+	if ((output != NULL) && (pipe(result) == 0)) {
+		fflush(NULL); /* the child must not flush a copy of our buffers when it exits */
+		pid_t pid = fork();
+		if (pid == 0) {
+			close(result[0]);
+			dup2(fileno(output), STDERR_FILENO);
+			int error_count = run_check(tree_root);
+			fflush(stderr);
+			bool ok = (write(result[1], &error_count, sizeof(error_count)) == sizeof(error_count));
+			_exit(ok? EXIT_SUCCESS: EXIT_FAILURE);
+		}
+		close(result[1]);
+		if (pid > 0) {
+			check->pid    = pid;
+			check->output = output;
+			check->result = result[0];
+			return;
+		}
+		close(result[0]);
+	}
+	if (output != NULL) fclose(output);
+#endif
+	check->error_count = run_check(tree_root);
+}
+
+
+/* Waits for a check, copies its diagnostics to stderr and returns its error count.
+ * A child that dies without returning its error count hit an internal compiler error
+ * (ERROR), in which case we bail out just like the check would have done in this process.
+ */
+static int finish_check(stage3_check_t *check) {
+#ifdef STAGE3_FORK_CHECKS
+	if (check->pid == 0) return check->error_count;
+
+	int status, error_count;
+	bool ok = (read(check->result, &error_count, sizeof(error_count)) == sizeof(error_count));
+	close(check->result);
+	ok = (waitpid(check->pid, &status, 0) == check->pid) && WIFEXITED(status) && (WEXITSTATUS(status) == EXIT_SUCCESS) && ok;
+
+	char buffer[4096];
+	size_t count;
+	rewind(check->output);
+	while ((count = fread(buffer, 1, sizeof(buffer), check->output)) > 0)
+		fwrite(buffer, 1, count, stderr);
+	fclose(check->output);
+
+	if (!ok) exit(EXIT_FAILURE);
+	return error_count;
+#else
+	return check->error_count;
+#endif
+}
+
+
 int stage3(symbol_c *tree_root, symbol_c **ordered_tree_root) {
 	int error_count = 0;
-	error_count += enum_declaration_check(tree_root);
+	stage3_check_t enum_job, declaration_job, lvalue_job, case_job;
+	start_check(&enum_job, enum_declaration_check, tree_root);
 	error_count += flow_control_analysis(tree_root);
 	error_count += constant_propagation(tree_root);
-	error_count += declaration_safety(tree_root);
+	start_check(&declaration_job, declaration_safety, tree_root);
+	start_check(&case_job, case_elements_check, tree_root);
 	error_count += type_safety(tree_root);
-	error_count += lvalue_check(tree_root);
+	start_check(&lvalue_job, lvalue_check, tree_root);
 	error_count += array_range_check(tree_root);
-	error_count += case_elements_check(tree_root);
+	error_count += finish_check(&enum_job);
+	error_count += finish_check(&declaration_job);
+	error_count += finish_check(&lvalue_job);
+	error_count += finish_check(&case_job);
 	error_count += remove_forward_dependencies(tree_root, ordered_tree_root);
 	
 	if (error_count > 0) {
@@ -154,6 +154,9 @@
 #define SET_EXTERNAL_FB "__SET_EXTERNAL_FB"
 #define SET_LOCATED "__SET_LOCATED"
 
+/* Force flag test for accessor macros */
+#define IS_VAR_FORCED "__IS_VAR_FORCED"
+
 /* Variable initial value symbol for accessor macros */
 #define INITIAL_VALUE "__INITIAL_VALUE"
 
@@ -178,6 +181,9 @@
 
 static int generate_line_directives__ = 0;
 static int generate_pou_filepairs__   = 0;
+static int generate_pou_units__       = 0;
+static int generate_program_table__   = 0;
+static int generate_pou_profile__     = 0;
 static int generate_plc_state_backup_fuctions__ = 0;
 
 #ifdef __unix__
@@ -186,12 +192,18 @@ static int generate_plc_state_backup_fuctions__ = 0;
 int  stage4_parse_options(char *options) {
   enum {LINE_OPT = 0,  
         SEPTFILE_OPT,
-        BACKUP_OPT    /* option to generate function to backup and restore internal PLC state */
+        BACKUP_OPT,   /* option to generate function to backup and restore internal PLC state */
+        UNITS_OPT,    /* option to compile each POU on its own translation unit */
+        PROGRAMS_OPT, /* option to hand the programs of each resource to the runtime to run */
+        PROFILE_OPT   /* option to time the body of every program and function block */
         /*, SOME_OTHER_OPT, YET_ANOTHER_OPT */};
   char *const token[] = {
         /*       LINE_OPT*/(char *)"l",
         /*   SEPTFILE_OPT*/(char *)"p",
         /*     BACKUP_OPT*/(char *)"b",
+        /*      UNITS_OPT*/(char *)"u",
+        /*   PROGRAMS_OPT*/(char *)"t",
+        /*    PROFILE_OPT*/(char *)"f",
         /* SOME_OTHER_OPT, ...             */
         NULL };
   /* unfortunately, the above commented out syntax for array initialization is valid in C, but not in C++ */
@@ -205,6 +217,9 @@ int  stage4_parse_options(char *options) {
       case     LINE_OPT: generate_line_directives__            = 1; break;
       case SEPTFILE_OPT: generate_pou_filepairs__              = 1; break;
       case   BACKUP_OPT: generate_plc_state_backup_fuctions__  = 1; break;
+      case    UNITS_OPT: generate_pou_units__                  = 1; break;
+      case PROGRAMS_OPT: generate_program_table__              = 1; break;
+      case  PROFILE_OPT: generate_pou_profile__                = 1; break;
       default          : fprintf(stderr, "Unrecognized option: -O %s\n", value); return -1; break;
      }
   }     
@@ -217,6 +232,12 @@ void stage4_print_options(void) {
   printf("      l : insert '#line' directives in generated C code.\n"); 
   printf("      p : place each POU in a separate pair of files (<pou_name>.c, <pou_name>.h).\n"); 
   printf("      b : generate functions to backup and restore internal PLC state.\n"); 
+  printf("      u : place the code of each POU in its own translation unit (POUS_<pou_name>.c),\n");
+  printf("          declared on POUS.h, so the POUs can be compiled separately and in parallel.\n");
+  printf("      t : run the programs of each resource from functions of their own, listed on a table\n");
+  printf("          handed to __plc_run_programs(), so the runtime may run independent programs in parallel.\n");
+  printf("      f : time the body of every program and function block with the __PROFILE_POU_ENTER/EXIT\n");
+  printf("          accessor macros, so the runtime can tell which POU types take the scan time.\n");
 }
 #else /* not __unix__ */
 /* getsubopt isn't supported with mingw, 
@@ -661,6 +682,10 @@ class calculate_common_ticktime_c: public iterator_visitor_c {
     /* after common_period ticks, all task period align again */
     unsigned long common_period;
 
+    /* interval of every task, in the order they are declared (0 for tasks
+     * without an INTERVAL, which must be evaluated on every tick) */
+    std::list<unsigned long long> task_intervals;
+
   public:
     calculate_common_ticktime_c(void){
       common_ticktime = 0;
@@ -712,6 +737,10 @@ class calculate_common_ticktime_c: public iterator_visitor_c {
       return common_ticktime;
     }
 
+    std::list<unsigned long long> get_task_intervals(void) {
+      return task_intervals;
+    }
+
     uint32_t get_greatest_tick_count(void) {
       if (common_period == 1) {
           return 0;
@@ -723,8 +752,11 @@ class calculate_common_ticktime_c: public iterator_visitor_c {
 /*  TASK task_name task_initialization */
 //SYM_REF2(task_configuration_c, task_name, task_initialization)  
     void *visit(task_initialization_c *symbol) {
-      if (symbol->interval_data_source != NULL) {
+      if (symbol->interval_data_source == NULL) {
+        task_intervals.push_back(0);
+      } else {
         unsigned long long time = calculate_time(symbol->interval_data_source);
+        task_intervals.push_back(time);
         if(!update_ticktime(time)) {
           /* time is being stored in ns resolution (MILLISECOND #define is set to 1000000)    */
           /* time is being stored in unsigned long long (ISO C99 guarantees at least 64 bits) */
@@ -841,6 +873,27 @@ class generate_c_pous_c {
    */ 
 
   private:
+    /* Print the start of the timing of a POU body (stage4 option f). Must come
+     * after any early return of the body, as only the __end label leads to the
+     * end of the timing.
+     */
+    static void print_profile_enter(stage4out_c &s4o, symbol_c *pou_name) {
+      if (!generate_pou_profile__) return;
+      generate_c_base_and_typeid_c print_base(&s4o);
+      s4o.print(s4o.indent_spaces + "__PROFILE_POU_ENTER(");
+      pou_name->accept(print_base);
+      s4o.print(")\n");
+    }
+
+    /* Print the end of the timing of a POU body, after the __end label */
+    static void print_profile_exit(stage4out_c &s4o, symbol_c *pou_name) {
+      if (!generate_pou_profile__) return;
+      generate_c_base_and_typeid_c print_base(&s4o);
+      s4o.print(s4o.indent_spaces + "__PROFILE_POU_EXIT(");
+      pou_name->accept(print_base);
+      s4o.print(")\n");
+    }
+
     static void print_end_of_block_label(stage4out_c &s4o) {
       /* Print and __end label for return statements!
        * If label is not used by at least one goto, compiler will generate a warning.
@@ -1210,6 +1263,8 @@ class generate_c_pous_c {
           s4o.print(s4o.indent_spaces + "}\n");
         }
       
+        print_profile_enter(s4o, symbol->fblock_name);
+
         /* (C.4) Initialize TEMP variables */
         /* function body */
         s4o.print(s4o.indent_spaces + "// Initialise TEMP variables\n");
@@ -1224,6 +1279,7 @@ class generate_c_pous_c {
         generate_c_SFC_IL_ST_c generate_c_code(&s4o, symbol->fblock_name, symbol, FB_FUNCTION_PARAM"->");
         symbol->fblock_body->accept(generate_c_code);
         print_end_of_block_label(s4o);
+        print_profile_exit(s4o, symbol->fblock_name);
         s4o.print(s4o.indent_spaces + "return;\n");
         s4o.indent_left();
         s4o.print(s4o.indent_spaces + "} // ");
@@ -1386,7 +1442,8 @@ class generate_c_pous_c {
       } else {
         s4o.print(" {\n");
         s4o.indent_right();
-          
+        print_profile_enter(s4o, symbol->program_type_name);
+
         /* (C.4) Initialize TEMP variables */
         /* function body */
         s4o.print(s4o.indent_spaces + "// Initialise TEMP variables\n");
@@ -1401,6 +1458,7 @@ class generate_c_pous_c {
         generate_c_SFC_IL_ST_c generate_c_code(&s4o, symbol->program_type_name, symbol, FB_FUNCTION_PARAM"->");
         symbol->function_block_body->accept(generate_c_code);
         print_end_of_block_label(s4o);
+        print_profile_exit(s4o, symbol->program_type_name);
         s4o.print(s4o.indent_spaces + "return;\n");
         s4o.indent_left();
         s4o.print(s4o.indent_spaces + "} // ");
@@ -1688,7 +1746,9 @@ class generate_c_resources_c: public generate_c_base_and_typeid_c {
     typedef enum {
       declare_dt,
       init_dt,
-      run_dt
+      run_dt,
+      runprogram_dt,  /* function running one program (option t) */
+      runtable_dt     /* entry of the program on the table handed to the runtime (option t) */
     } declaretype_t;
 
     declaretype_t wanted_declaretype;
@@ -1847,6 +1907,27 @@ END_RESOURCE
       /* (A.3) POUs inclusion */
       s4o.print("#include \"POUS.c\"\n\n");
       
+      /* With option t the run function hands the programs to the runtime, which
+       * decides which of them may run in parallel, so it must provide
+       * __plc_run_programs(). It returns once every program on the table ran.
+       */
+      if (generate_program_table__) {
+        s4o.print("#ifndef __PLC_RUN_PROGRAMS\n");
+        s4o.print("#define __PLC_RUN_PROGRAMS\n");
+        s4o.print("#ifdef __cplusplus\n");
+        s4o.print("extern \"C\" {\n");
+        s4o.print("#endif\n");
+        s4o.print("typedef struct {\n");
+        s4o.print("  const char *name;\n");
+        s4o.print("  void (*run)(void);\n");
+        s4o.print("} __plc_program_t;\n");
+        s4o.print("void __plc_run_programs(const __plc_program_t *programs, int count);\n");
+        s4o.print("#ifdef __cplusplus\n");
+        s4o.print("}\n");
+        s4o.print("#endif\n");
+        s4o.print("#endif\n\n");
+      }
+      
       wanted_declaretype = declare_dt;
       
       /* (A.4) Resource programs declaration... */
@@ -1893,6 +1974,12 @@ END_RESOURCE
       s4o.print("}\n\n");
       
       /* (C) Resource run function... */
+      /* (C.0) With option t, the functions running each program... */
+      if (generate_program_table__) {
+        wanted_declaretype = runprogram_dt;
+        symbol->program_configuration_list->accept(*this);
+      }
+      
       /* (C.1) Run function name... */
       s4o.print("void ");
       current_resource_name->accept(*this);
@@ -1906,7 +1993,17 @@ END_RESOURCE
       symbol->task_configuration_list->accept(*this);
       
       /* (C.3) Program run declaration... */
-      symbol->program_configuration_list->accept(*this);
+      if (generate_program_table__) {
+        s4o.print(s4o.indent_spaces + "static const __plc_program_t programs[] = {\n");
+        s4o.indent_right();
+        wanted_declaretype = runtable_dt;
+        symbol->program_configuration_list->accept(*this);
+        s4o.indent_left();
+        s4o.print(s4o.indent_spaces + "};\n");
+        s4o.print(s4o.indent_spaces + "__plc_run_programs(programs, sizeof(programs) / sizeof(programs[0]));\n");
+      }
+      else
+        symbol->program_configuration_list->accept(*this);
       
       s4o.indent_left();
       s4o.print("}\n\n");
@@ -1948,6 +2045,26 @@ END_RESOURCE
           print_retain();
           s4o.print(");\n");
           break;
+        case runtable_dt:
+          s4o.print(s4o.indent_spaces + "{\"");
+          symbol->program_name->accept(*this);
+          s4o.print("\", ");
+          current_resource_name->accept(*this);
+          s4o.print("__");
+          symbol->program_name->accept(*this);
+          s4o.print(FB_RUN_SUFFIX);
+          s4o.print("},\n");
+          break;
+        case runprogram_dt:
+          s4o.print("static void ");
+          current_resource_name->accept(*this);
+          s4o.print("__");
+          symbol->program_name->accept(*this);
+          s4o.print(FB_RUN_SUFFIX);
+          s4o.print("(void) {\n");
+          s4o.indent_right();
+          /* fall through: the body of the function is the code run_dt places
+           * on the resource run function */
         case run_dt: 
           { identifier_c *tmp_id = dynamic_cast<identifier_c*>(symbol->program_name);
             if (NULL == tmp_id) ERROR;
@@ -1980,6 +2097,11 @@ END_RESOURCE
             s4o.indent_left();
             s4o.print(s4o.indent_spaces + "}\n");
           }
+          
+          if (wanted_declaretype == runprogram_dt) {
+            s4o.indent_left();
+            s4o.print("}\n\n");
+          }
           break;
         default:
           break;
@@ -2640,10 +2762,22 @@ class generate_c_c: public iterator_visitor_c {
 /**************************************/
 /* WARNING: The following code is buggy when generating an independent pair of files for each POU, as the
  *          specially created stage4out_c (s4o_c and s4o_h) will not comply with the enable/disable_code_generation_pragma_c
+ *
+ * With the 'u' option the declarations of every POU stay on POUS.h, and its code goes to a
+ * POUS_<pou_name>.c file that only includes POUS.h. POUS.c, included by the resources, then only
+ * lists those files, which are compiled on their own and linked with the resources.
  */
 #define handle_pou(fname,pname) \
       if (!allow_output) return NULL;\
-      if (generate_pou_filepairs__) {\
+      if (generate_pou_units__) {\
+        std::string unit_name = std::string("POUS_") + get_datatype_info_c::get_id_str(pname);\
+        stage4out_c s4o_c(current_builddir, unit_name.c_str(), "c");\
+        s4o_c.print("#include \"POUS.h\"\n\n");\
+        symbol->accept(generate_c_implicit_typedecl);\
+        generate_c_pous_c::fname(symbol, pous_incl_s4o, true);\
+        generate_c_pous_c::fname(symbol, s4o_c,         false);\
+        pous_s4o.print("// "); pous_s4o.print(unit_name); pous_s4o.print(".c\n");\
+      } else if (generate_pou_filepairs__) {\
         const char *pou_name = get_datatype_info_c::get_id_str(pname);\
         stage4out_c s4o_c(current_builddir, pou_name, "c");\
         stage4out_c s4o_h(current_builddir, pou_name, "h");\
@@ -2720,6 +2854,16 @@ class generate_c_c: public iterator_visitor_c {
 
         symbol->configuration_name->accept(*this);
         
+        if (generate_pou_units__) {
+          /* The POUs compiled on their own units reach the globals through POUS.h */
+          pous_incl_s4o.print("\n// Globals of the configuration and its resources\n");
+          generate_c_vardecl_c vardecl(&pous_incl_s4o,
+                                       generate_c_vardecl_c::globalprototype_vf,
+                                       generate_c_vardecl_c::global_vt,
+                                       symbol->configuration_name);
+          vardecl.print(symbol);
+        }
+
         stage4out_c config_s4o(current_builddir, current_name, "c");
         stage4out_c config_incl_s4o(current_builddir, current_name, "h");
         generate_c_config_c generate_c_config(&config_s4o, &config_incl_s4o);
@@ -2734,6 +2878,19 @@ class generate_c_c: public iterator_visitor_c {
         config_s4o.print_long_integer(calculate_common_ticktime.get_greatest_tick_count());
         config_s4o.print("; /*tick*/\n");
 
+        /* task table, used by the runtime to skip the ticks on which no task is due */
+        std::list<unsigned long long> task_intervals = calculate_common_ticktime.get_task_intervals();
+        config_s4o.print("unsigned long task_count__ = ");
+        config_s4o.print_long_integer(task_intervals.size(), false);
+        config_s4o.print(";\n");
+        config_s4o.print("unsigned long task_period_ticks__[] = {");
+        for (std::list<unsigned long long>::iterator it = task_intervals.begin(); it != task_intervals.end(); ++it) {
+          if (it != task_intervals.begin()) config_s4o.print(", ");
+          config_s4o.print_long_integer((unsigned long)(*it / common_ticktime), false);
+        }
+        if (task_intervals.empty()) config_s4o.print("0");
+        config_s4o.print("}; /*tick, 0 = every tick*/\n");
+
         if (generate_plc_state_backup_fuctions__ > 0) {
           generate_c_backup_config_c generate_backup = generate_c_backup_config_c(&config_s4o);
           symbol->accept(generate_backup);
@@ -2749,6 +2906,13 @@ class generate_c_c: public iterator_visitor_c {
     void *visit(resource_declaration_c *symbol) {
       if (symbol->global_var_declarations != NULL)
         symbol->global_var_declarations->accept(generate_c_implicit_typedecl);
+      if (generate_pou_units__ && symbol->global_var_declarations != NULL) {
+        generate_c_vardecl_c vardecl(&pous_incl_s4o,
+                                     generate_c_vardecl_c::globalprototype_vf,
+                                     generate_c_vardecl_c::global_vt,
+                                     symbol->resource_name);
+        vardecl.print(symbol->global_var_declarations);
+      }
       symbol->resource_name->accept(*this);
       stage4out_c resources_s4o(current_builddir, current_name, "c");
       generate_c_resources_c generate_c_resources(&resources_s4o, current_configuration, symbol, common_ticktime);
@@ -44,7 +44,14 @@ class generate_c_sfc_elements_c: public generate_c_base_and_typeid_c {
       stepset_sg,
       stepreset_sg,
       actionassociation_sg,
-      actionbody_sg
+      actionbody_sg,
+      /* the same code, placed on the cases of a switch on the live steps or
+       * on the fired transitions (see generate_c_sfc_c) */
+      transitiondispatch_sg,
+      stepresetdispatch_sg,
+      stepsetdispatch_sg,
+      actionassociationdispatch_sg,
+      alwaysstep_sg
     } sfcgeneration_t;
 
   private:
@@ -61,6 +68,9 @@ class generate_c_sfc_elements_c: public generate_c_base_and_typeid_c {
 
     sfcgeneration_t wanted_sfcgeneration;
     
+    /* mark the steps set on the __live_steps bitset */
+    bool mark_live_steps;
+    
   public:
     generate_c_sfc_elements_c(stage4out_c *s4o_ptr, symbol_c *name, symbol_c *scope, const char *variable_prefix = NULL)
     : generate_c_base_and_typeid_c(s4o_ptr) {
@@ -69,6 +79,7 @@ class generate_c_sfc_elements_c: public generate_c_base_and_typeid_c {
       generate_c_code = new generate_c_SFC_IL_ST_c(s4o_ptr, name, scope, variable_prefix);
       search_var_instance_decl = new search_var_instance_decl_c(scope);
       this->set_variable_prefix(variable_prefix);
+      mark_live_steps = false;
     }
     
     ~generate_c_sfc_elements_c(void) {
@@ -89,6 +100,57 @@ class generate_c_sfc_elements_c: public generate_c_base_and_typeid_c {
 
     void reset_transition_number(void) {transition_number = 0;}
 
+    /* A transition with a priority resets its steps as soon as it fires, so the
+     * transitions of the chart must be tested in the order of their priorities */
+    bool has_transition_priorities(void) {
+      std::list<TRANSITION>::iterator pt;
+      for(pt = transition_list.begin(); pt != transition_list.end(); pt++) {
+        if (pt->symbol->integer != NULL) return true;
+      }
+      return false;
+    }
+
+    symbol_c *first_from_step(transition_c *transition) {
+      steps_c *steps = dynamic_cast<steps_c *>(transition->from_steps);
+      if (NULL == steps) ERROR;
+      if (steps->step_name != NULL) return steps->step_name;
+      step_name_list_c *step_name_list = dynamic_cast<step_name_list_c *>(steps->step_name_list);
+      if (NULL == step_name_list || step_name_list->n == 0) ERROR;
+      return step_name_list->get_element(0);
+    }
+
+    /* Prints the tests of the transitions on the cases of a switch on the live
+     * steps. A transition can only fire while all its steps are active, so it is
+     * tested on the case of the first one */
+    void generate_transition_dispatch(void) {
+      std::list<symbol_c *> steps;
+      std::list<TRANSITION>::iterator pt;
+      for(pt = transition_list.begin(); pt != transition_list.end(); pt++) {
+        symbol_c *step_name = first_from_step(pt->symbol);
+        std::list<symbol_c *>::iterator ps;
+        for(ps = steps.begin(); ps != steps.end(); ps++) {
+          if (!compare_identifiers(*ps, step_name)) break;
+        }
+        if (ps == steps.end()) steps.push_back(step_name);
+      }
+      
+      wanted_sfcgeneration = transitiondispatch_sg;
+      std::list<symbol_c *>::iterator ps;
+      for(ps = steps.begin(); ps != steps.end(); ps++) {
+        s4o.print(s4o.indent_spaces + "case ");
+        print_step_number(*ps);
+        s4o.print(":\n");
+        s4o.indent_right();
+        for(pt = transition_list.begin(); pt != transition_list.end(); pt++) {
+          if (compare_identifiers(first_from_step(pt->symbol), *ps)) continue;
+          transition_number = pt->index;
+          pt->symbol->accept(*this);
+        }
+        s4o.print(s4o.indent_spaces + "break;\n");
+        s4o.indent_left();
+      }
+    }
+
     void generate(symbol_c *symbol, sfcgeneration_t generation_type) {
       wanted_sfcgeneration = generation_type;
       switch (wanted_sfcgeneration) {
@@ -129,6 +191,19 @@ class generate_c_sfc_elements_c: public generate_c_base_and_typeid_c {
       s4o.print(transition_number);
     }
 
+    void print_step_number(symbol_c *step_name) {
+      s4o.print(SFC_STEP_ACTION_PREFIX);
+      step_name->accept(*this);
+    }
+
+    void print_mark_live_step(symbol_c *step_name) {
+      s4o.print(s4o.indent_spaces + "__live_steps[");
+      print_step_number(step_name);
+      s4o.print(" >> 6] |= (ULINT)1 << (");
+      print_step_number(step_name);
+      s4o.print(" & 63);\n");
+    }
+
     void print_reset_step(symbol_c *step_name) {
       s4o.print(s4o.indent_spaces);
       s4o.print(SET_VAR);
@@ -145,52 +220,50 @@ class generate_c_sfc_elements_c: public generate_c_base_and_typeid_c {
       s4o.print(",,1);\n" + s4o.indent_spaces);
       print_step_argument(step_name, "T.value");
       s4o.print(" = __time_to_timespec(1, 0, 0, 0, 0, 0);\n");
+      if (mark_live_steps)
+        print_mark_live_step(step_name);
     }
-    
-/*********************************************/
-/* B.1.6  Sequential function chart elements */
-/*********************************************/
-    
-    void *visit(initial_step_c *symbol) {
+
+    /* P, P0 and P1 associations reset their action while the step is inactive,
+     * so the associations of the step are evaluated on every scan */
+    bool has_pulse_association(symbol_c *action_association_list) {
+      list_c *list = (list_c *)action_association_list;
+      for(int i = 0; i < list->n; i++) {
+        action_association_c *association = dynamic_cast<action_association_c *>(list->get_element(i));
+        if (NULL == association || NULL == association->action_qualifier) continue;
+        action_qualifier_c *action_qualifier = dynamic_cast<action_qualifier_c *>(association->action_qualifier);
+        if (NULL == action_qualifier) continue;
+        const char *qualifier = (const char *)action_qualifier->action_qualifier->accept(*this);
+        if (qualifier != NULL && qualifier[0] == 'P') return true;
+      }
+      return false;
+    }
+
+    void print_step_associations(symbol_c *step_name, symbol_c *action_association_list) {
       switch (wanted_sfcgeneration) {
-        case actionassociation_sg:
-          if (((list_c*)symbol->action_association_list)->n > 0) {
-            s4o.print(s4o.indent_spaces + "// ");
-            symbol->step_name->accept(*this);
-            s4o.print(" action associations\n");
-            current_step = symbol->step_name;
-            s4o.print(s4o.indent_spaces + "{\n");
+        case actionassociationdispatch_sg:
+          if (((list_c*)action_association_list)->n > 0) {
+            s4o.print(s4o.indent_spaces + "case ");
+            print_step_number(step_name);
+            s4o.print(":\n");
             s4o.indent_right();
-            s4o.print(s4o.indent_spaces + "char active = ");
-            s4o.print(GET_VAR);
-            s4o.print("(");
-            print_step_argument(current_step, "X");
-            s4o.print(");\n");
-            s4o.print(s4o.indent_spaces + "char activated = active && !");
-            print_step_argument(current_step, "prev_state");
-            s4o.print(";\n");
-            s4o.print(s4o.indent_spaces + "char desactivated = !active && ");
-            print_step_argument(current_step, "prev_state");
-            s4o.print(";\n\n");
-            symbol->action_association_list->accept(*this);
+            wanted_sfcgeneration = actionassociation_sg;
+            print_step_associations(step_name, action_association_list);
+            wanted_sfcgeneration = actionassociationdispatch_sg;
+            s4o.print(s4o.indent_spaces + "break;\n");
             s4o.indent_left();
-            s4o.print(s4o.indent_spaces + "}\n\n");
           }
           break;
-        default:
+        case alwaysstep_sg:
+          if (has_pulse_association(action_association_list))
+            print_mark_live_step(step_name);
           break;
-      }
-      return NULL;
-    }
-    
-    void *visit(step_c *symbol) {
-      switch (wanted_sfcgeneration) {
         case actionassociation_sg:
-          if (((list_c*)symbol->action_association_list)->n > 0) {
+          if (((list_c*)action_association_list)->n > 0) {
             s4o.print(s4o.indent_spaces + "// ");
-            symbol->step_name->accept(*this);
+            step_name->accept(*this);
             s4o.print(" action associations\n");
-            current_step = symbol->step_name;
+            current_step = step_name;
             s4o.print(s4o.indent_spaces + "{\n");
             s4o.indent_right();
             s4o.print(s4o.indent_spaces + "char active = ");
@@ -204,7 +277,7 @@ class generate_c_sfc_elements_c: public generate_c_base_and_typeid_c {
             s4o.print(s4o.indent_spaces + "char desactivated = !active && ");
             print_step_argument(current_step, "prev_state");
             s4o.print(";\n\n");
-            symbol->action_association_list->accept(*this);
+            action_association_list->accept(*this);
             s4o.indent_left();
             s4o.print(s4o.indent_spaces + "}\n\n");
           }
@@ -212,6 +285,19 @@ class generate_c_sfc_elements_c: public generate_c_base_and_typeid_c {
         default:
           break;
       }
+    }
+    
+/*********************************************/
+/* B.1.6  Sequential function chart elements */
+/*********************************************/
+    
+    void *visit(initial_step_c *symbol) {
+      print_step_associations(symbol->step_name, symbol->action_association_list);
+      return NULL;
+    }
+    
+    void *visit(step_c *symbol) {
+      print_step_associations(symbol->step_name, symbol->action_association_list);
       return NULL;
     }
 
@@ -284,6 +370,26 @@ class generate_c_sfc_elements_c: public generate_c_base_and_typeid_c {
           s4o.indent_left();
           s4o.print(s4o.indent_spaces + "}\n");
           break;
+        case transitiondispatch_sg:
+          s4o.print(s4o.indent_spaces + "if (");
+          symbol->from_steps->accept(*this);
+          s4o.print(") {\n");
+          s4o.indent_right();
+          symbol->transition_condition->accept(*this);
+          s4o.print(s4o.indent_spaces + "if (");
+          s4o.print(GET_VAR);
+          s4o.print("(");
+          print_variable_prefix();
+          s4o.print("__transition_list[");
+          print_transition_number();
+          s4o.print("])) __fired_transitions[");
+          s4o.print(transition_number >> 6);
+          s4o.print("] |= (ULINT)1 << ");
+          s4o.print(transition_number & 63);
+          s4o.print(";\n");
+          s4o.indent_left();
+          s4o.print(s4o.indent_spaces + "}\n");
+          break;
         case stepset_sg:
           s4o.print(s4o.indent_spaces + "if (");
           s4o.print(GET_VAR);
@@ -298,6 +404,28 @@ class generate_c_sfc_elements_c: public generate_c_base_and_typeid_c {
           s4o.print(s4o.indent_spaces + "}\n");
           transition_number++;
           break;
+        case stepresetdispatch_sg:
+        case stepsetdispatch_sg:
+          s4o.print(s4o.indent_spaces + "case ");
+          print_transition_number();
+          s4o.print(":\n");
+          s4o.indent_right();
+          if (wanted_sfcgeneration == stepresetdispatch_sg) {
+            wanted_sfcgeneration = stepreset_sg;
+            symbol->from_steps->accept(*this);
+            wanted_sfcgeneration = stepresetdispatch_sg;
+          }
+          else {
+            wanted_sfcgeneration = stepset_sg;
+            mark_live_steps = true;
+            symbol->to_steps->accept(*this);
+            mark_live_steps = false;
+            wanted_sfcgeneration = stepsetdispatch_sg;
+          }
+          s4o.print(s4o.indent_spaces + "break;\n");
+          s4o.indent_left();
+          transition_number++;
+          break;
         case stepreset_sg:
           if (symbol->integer == NULL) {
             s4o.print(s4o.indent_spaces + "if (");
@@ -324,6 +452,7 @@ class generate_c_sfc_elements_c: public generate_c_base_and_typeid_c {
       switch (wanted_sfcgeneration) {
         case transitiontest_sg:
         case transitiontestdebug_sg:
+        case transitiondispatch_sg:
           // Transition condition is in IL
           if (symbol->transition_condition_il != NULL) {
             generate_c_il->declare_implicit_variable_back();
@@ -416,6 +545,7 @@ class generate_c_sfc_elements_c: public generate_c_base_and_typeid_c {
       if (symbol->step_name != NULL) {
         switch (wanted_sfcgeneration) {
           case transitiontest_sg:
+          case transitiondispatch_sg:
             s4o.print(GET_VAR);
             s4o.print("(");
             print_step_argument(symbol->step_name, "X");
@@ -440,6 +570,7 @@ class generate_c_sfc_elements_c: public generate_c_base_and_typeid_c {
     void *visit(step_name_list_c *symbol) {
       switch (wanted_sfcgeneration) {
         case transitiontest_sg:
+        case transitiondispatch_sg:
           for(int i = 0; i < symbol->n; i++) {
             s4o.print(GET_VAR);
             s4o.print("(");
@@ -680,6 +811,8 @@ class generate_c_sfc_c: public generate_c_base_and_typeid_c {
     generate_c_sfc_elements_c *generate_c_sfc_elements;
     search_var_instance_decl_c *search_var_instance_decl;
     
+    int step_count;
+    
   public:
     generate_c_sfc_c(stage4out_c *s4o_ptr, symbol_c *name, symbol_c *scope, const char *variable_prefix = NULL)
     : generate_c_base_and_typeid_c(s4o_ptr) {
@@ -701,21 +834,77 @@ class generate_c_sfc_c: public generate_c_base_and_typeid_c {
       return var_decl != NULL;
     }
 
+    /* Loop over the bits set on a bitset, switching on the index of each one */
+    void print_bitset_switch_begin(const char *bitset, int words) {
+      s4o.print(s4o.indent_spaces + "for (__word = 0; __word < ");
+      s4o.print(words);
+      s4o.print("; __word++) {\n");
+      s4o.indent_right();
+      s4o.print(s4o.indent_spaces + "__bits = ");
+      s4o.print(bitset);
+      s4o.print("[__word];\n");
+      s4o.print(s4o.indent_spaces + "while (__bits) {\n");
+      s4o.indent_right();
+      s4o.print(s4o.indent_spaces + "i = __word * 64 + __builtin_ctzll(__bits);\n");
+      s4o.print(s4o.indent_spaces + "__bits &= __bits - 1;\n");
+      s4o.print(s4o.indent_spaces + "switch (i) {\n");
+      s4o.indent_right();
+    }
+
+    void print_bitset_switch_end(void) {
+      s4o.print(s4o.indent_spaces + "default:\n");
+      s4o.print(s4o.indent_spaces + "  break;\n");
+      s4o.indent_left();
+      s4o.print(s4o.indent_spaces + "}\n");
+      s4o.indent_left();
+      s4o.print(s4o.indent_spaces + "}\n");
+      s4o.indent_left();
+      s4o.print(s4o.indent_spaces + "}\n");
+    }
+
 /*********************************************/
 /* B.1.6  Sequential function chart elements */
 /*********************************************/
     
+    /* Unless a transition has a priority, the steps that are active or were
+     * active on the last scan are placed on the __live_steps bitset, and the
+     * transitions that fire on __fired_transitions. Only the transitions
+     * leaving the live steps are tested, only the fired ones reset and set
+     * steps, and only the live steps evaluate their action associations, so a
+     * chart with many steps and few active ones does little work on each scan.
+     * The other steps would not change anything. While debugging (__DEBUG)
+     * every transition is tested, for the values shown by the debugger.
+     */
     void *visit(sequential_function_chart_c *symbol) {
       int i;
       
+      step_count = 0;
       generate_c_sfc_elements->reset_transition_number();
       for(i = 0; i < symbol->n; i++) {
         symbol->get_element(i)->accept(*this);
         generate_c_sfc_elements->generate(symbol->get_element(i), generate_c_sfc_elements_c::transitionlist_sg);
       }
+      int transition_count = 0;
+      for(i = 0; i < symbol->n; i++) {
+        if (dynamic_cast<transition_c *>(symbol->get_element(i)) != NULL) transition_count++;
+      }
+      bool dispatch = !generate_c_sfc_elements->has_transition_priorities();
+      int step_words = (step_count + 63) / 64;
+      int transition_words = transition_count > 0 ? (transition_count + 63) / 64 : 1;
       
       s4o.print(s4o.indent_spaces +"INT i;\n");
-      s4o.print(s4o.indent_spaces +"TIME elapsed_time, current_time;\n\n");
+      s4o.print(s4o.indent_spaces +"TIME elapsed_time, current_time;\n");
+      if (dispatch) {
+        s4o.print(s4o.indent_spaces +"ULINT __live_steps[");
+        s4o.print(step_words);
+        s4o.print("] = {0};\n");
+        s4o.print(s4o.indent_spaces +"ULINT __fired_transitions[");
+        s4o.print(transition_words);
+        s4o.print("] = {0};\n");
+        s4o.print(s4o.indent_spaces +"ULINT __bits;\n");
+        s4o.print(s4o.indent_spaces +"UINT __word;\n");
+      }
+      s4o.print("\n");
       
       /* generate elapsed_time initializations */
       s4o.print(s4o.indent_spaces + "// Calculate elapsed_time\n");
@@ -769,6 +958,8 @@ class generate_c_sfc_c: public generate_c_base_and_typeid_c {
       s4o.print("__step_list[i].T.value = __time_add(");
       print_variable_prefix();
       s4o.print("__step_list[i].T.value, elapsed_time);\n");
+      if (dispatch)
+        s4o.print(s4o.indent_spaces + "__live_steps[i >> 6] |= (ULINT)1 << (i & 63);\n");
       s4o.indent_left();
       s4o.print(s4o.indent_spaces + "}\n");
       s4o.indent_left();
@@ -844,33 +1035,37 @@ class generate_c_sfc_c: public generate_c_base_and_typeid_c {
       s4o.indent_left();
       s4o.print(s4o.indent_spaces + "}\n\n");
       
-      /* generate transition tests */
-      s4o.print(s4o.indent_spaces + "// Transitions fire test\n");
-      generate_c_sfc_elements->generate((symbol_c *)symbol, generate_c_sfc_elements_c::transitiontest_sg);
-      s4o.print("\n");
-      
-      /* generate transition reset steps */
-      s4o.print(s4o.indent_spaces + "// Transitions reset steps\n");
-      generate_c_sfc_elements->reset_transition_number();
-      for(i = 0; i < symbol->n; i++) {
-        generate_c_sfc_elements->generate(symbol->get_element(i), generate_c_sfc_elements_c::stepreset_sg);
-      }
-      s4o.print("\n");
-      
-      /* generate transition set steps */
-      s4o.print(s4o.indent_spaces + "// Transitions set steps\n");
-      generate_c_sfc_elements->reset_transition_number();
-      for(i = 0; i < symbol->n; i++) {
-        generate_c_sfc_elements->generate(symbol->get_element(i), generate_c_sfc_elements_c::stepset_sg);
-      }
-      s4o.print("\n");
-      
-      /* generate step association */
-      s4o.print(s4o.indent_spaces + "// Steps association\n");
-      for(i = 0; i < symbol->n; i++) {
-        generate_c_sfc_elements->generate(symbol->get_element(i), generate_c_sfc_elements_c::actionassociation_sg);
+      if (dispatch)
+        generate_dispatched_chart(symbol, step_words, transition_words);
+      else {
+        /* generate transition tests */
+        s4o.print(s4o.indent_spaces + "// Transitions fire test\n");
+        generate_c_sfc_elements->generate((symbol_c *)symbol, generate_c_sfc_elements_c::transitiontest_sg);
+        s4o.print("\n");
+        
+        /* generate transition reset steps */
+        s4o.print(s4o.indent_spaces + "// Transitions reset steps\n");
+        generate_c_sfc_elements->reset_transition_number();
+        for(i = 0; i < symbol->n; i++) {
+          generate_c_sfc_elements->generate(symbol->get_element(i), generate_c_sfc_elements_c::stepreset_sg);
+        }
+        s4o.print("\n");
+        
+        /* generate transition set steps */
+        s4o.print(s4o.indent_spaces + "// Transitions set steps\n");
+        generate_c_sfc_elements->reset_transition_number();
+        for(i = 0; i < symbol->n; i++) {
+          generate_c_sfc_elements->generate(symbol->get_element(i), generate_c_sfc_elements_c::stepset_sg);
+        }
+        s4o.print("\n");
+        
+        /* generate step association */
+        s4o.print(s4o.indent_spaces + "// Steps association\n");
+        for(i = 0; i < symbol->n; i++) {
+          generate_c_sfc_elements->generate(symbol->get_element(i), generate_c_sfc_elements_c::actionassociation_sg);
+        }
+        s4o.print("\n");
       }
-      s4o.print("\n");
       
       /* generate action state evaluation */
       s4o.print(s4o.indent_spaces + "// Actions state evaluation\n");
@@ -974,12 +1169,79 @@ class generate_c_sfc_c: public generate_c_base_and_typeid_c {
       return NULL;
     }
     
+    /* Transition tests, step resets and sets and action associations of a
+     * chart without transition priorities, done for the live steps and the
+     * fired transitions only */
+    void generate_dispatched_chart(sequential_function_chart_c *symbol, int step_words, int transition_words) {
+      int i;
+      
+      /* generate transition tests */
+      s4o.print(s4o.indent_spaces + "// Transitions fire test\n");
+      s4o.print(s4o.indent_spaces + "if (__DEBUG) {\n");
+      s4o.indent_right();
+      generate_c_sfc_elements->generate((symbol_c *)symbol, generate_c_sfc_elements_c::transitiontest_sg);
+      s4o.print(s4o.indent_spaces + "for (i = 0; i < ");
+      print_variable_prefix();
+      s4o.print("__nb_transitions; i++) {\n");
+      s4o.indent_right();
+      s4o.print(s4o.indent_spaces + "if (");
+      s4o.print(GET_VAR);
+      s4o.print("(");
+      print_variable_prefix();
+      s4o.print("__transition_list[i])) __fired_transitions[i >> 6] |= (ULINT)1 << (i & 63);\n");
+      s4o.indent_left();
+      s4o.print(s4o.indent_spaces + "}\n");
+      s4o.indent_left();
+      s4o.print(s4o.indent_spaces + "}\n");
+      s4o.print(s4o.indent_spaces + "else {\n");
+      s4o.indent_right();
+      print_bitset_switch_begin("__live_steps", step_words);
+      generate_c_sfc_elements->generate_transition_dispatch();
+      print_bitset_switch_end();
+      s4o.indent_left();
+      s4o.print(s4o.indent_spaces + "}\n\n");
+      
+      /* generate transition reset steps */
+      s4o.print(s4o.indent_spaces + "// Transitions reset steps\n");
+      print_bitset_switch_begin("__fired_transitions", transition_words);
+      generate_c_sfc_elements->reset_transition_number();
+      for(i = 0; i < symbol->n; i++) {
+        generate_c_sfc_elements->generate(symbol->get_element(i), generate_c_sfc_elements_c::stepresetdispatch_sg);
+      }
+      print_bitset_switch_end();
+      s4o.print("\n");
+      
+      /* generate transition set steps, the steps set become live */
+      s4o.print(s4o.indent_spaces + "// Transitions set steps\n");
+      print_bitset_switch_begin("__fired_transitions", transition_words);
+      generate_c_sfc_elements->reset_transition_number();
+      for(i = 0; i < symbol->n; i++) {
+        generate_c_sfc_elements->generate(symbol->get_element(i), generate_c_sfc_elements_c::stepsetdispatch_sg);
+      }
+      print_bitset_switch_end();
+      s4o.print("\n");
+      
+      /* generate step association, the steps with pulse actions are always live */
+      s4o.print(s4o.indent_spaces + "// Steps association\n");
+      for(i = 0; i < symbol->n; i++) {
+        generate_c_sfc_elements->generate(symbol->get_element(i), generate_c_sfc_elements_c::alwaysstep_sg);
+      }
+      print_bitset_switch_begin("__live_steps", step_words);
+      for(i = 0; i < symbol->n; i++) {
+        generate_c_sfc_elements->generate(symbol->get_element(i), generate_c_sfc_elements_c::actionassociationdispatch_sg);
+      }
+      print_bitset_switch_end();
+      s4o.print("\n");
+    }
+    
     void *visit(initial_step_c *symbol) {
+      step_count++;
       symbol->action_association_list->accept(*this);
       return NULL;
     }
 
     void *visit(step_c *symbol) {
+      step_count++;
       symbol->action_association_list->accept(*this);
       return NULL;
     }
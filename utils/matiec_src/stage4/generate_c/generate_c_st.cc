@@ -84,6 +84,15 @@ class generate_c_st_c: public generate_c_base_and_typeid_c {
 
     variablegeneration_t wanted_variablegeneration;
 
+    /* Element-wise FOR loops (see visit(for_statement_c *)).
+     * While the body of such a loop is being generated, vector_control_variable
+     * is its control variable and vector_arrays holds the number of the pointer
+     * generated for each array the body accesses.
+     */
+    symbol_c *vector_control_variable;
+    std::map<std::string, int> vector_arrays;
+    std::vector<symbol_c *> vector_array_symbols;
+
   public:
     generate_c_st_c(stage4out_c *s4o_ptr, symbol_c *name, symbol_c *scope, const char *variable_prefix = NULL)
     : generate_c_base_and_typeid_c(s4o_ptr) {
@@ -98,6 +107,7 @@ class generate_c_st_c: public generate_c_base_and_typeid_c {
       fcall_number = 0;
       fbname = name;
       wanted_variablegeneration = expression_vg;
+      vector_control_variable = NULL;
     }
 
     virtual ~generate_c_st_c(void) {
@@ -229,6 +239,334 @@ void *print_setter(symbol_c* symbol,
   return NULL;
 }
 
+
+
+/* Helpers of the element-wise FOR loops.
+ *
+ * A FOR loop is element-wise when it steps by 1 and its body only assigns
+ * elements of one dimensional arrays indexed by the control variable, from
+ * expressions made of constants, scalar variables and elements of arrays
+ * indexed by the control variable, with the numeric and bit operators and
+ * the numeric standard functions (see vector_function_kind()).
+ * Such a body has no side effects and no dependence between iterations, and
+ * the arrays are distinct variables of the POU, so the loop is generated as
+ * a plain C for() loop over __restrict__ pointers that the C compiler is
+ * free to vectorize.
+ */
+static const char *vector_var_name(symbol_c *symbol) {
+  token_c *name = get_var_name_c::get_name(symbol);
+  if (NULL == name) ERROR;
+  return name->value;
+}
+
+/* A variable of the POU itself (not VAR_EXTERNAL, VAR_IN_OUT or located) */
+bool is_vector_local(symbol_c *symbol) {
+  if (NULL == dynamic_cast<symbolic_variable_c *>(symbol)) return false;
+  if (!get_datatype_info_c::is_type_valid(symbol->datatype)) return false;
+  if ( get_datatype_info_c::is_function_block(symbol->datatype)) return false;
+  switch (analyse_variable_c::first_nonfb_vardecltype(symbol, scope_)) {
+    case search_var_instance_decl_c::input_vt:
+    case search_var_instance_decl_c::output_vt:
+    case search_var_instance_decl_c::private_vt:
+    case search_var_instance_decl_c::temp_vt:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool is_vector_control_variable(symbol_c *symbol, symbol_c *control_variable) {
+  if (NULL == dynamic_cast<symbolic_variable_c *>(symbol)) return false;
+  return strcasecmp(vector_var_name(symbol), vector_var_name(control_variable)) == 0;
+}
+
+bool is_vector_datatype(symbol_c *type) {
+  return get_datatype_info_c::is_type_valid(type)
+      && (get_datatype_info_c::is_ANY_NUM_compatible(type) || get_datatype_info_c::is_ANY_BIT_compatible(type));
+}
+
+/* An element of a one dimensional array of the POU, indexed by the control variable */
+bool is_vector_element(symbol_c *symbol, symbol_c *control_variable) {
+  array_variable_c *element = dynamic_cast<array_variable_c *>(symbol);
+  if (NULL == element) return false;
+  if (!is_vector_datatype(element->datatype)) return false;
+  if (!is_vector_local(element->subscripted_variable)) return false;
+
+  list_c *subscripts = dynamic_cast<list_c *>(element->subscript_list);
+  if ((NULL == subscripts) || (subscripts->n != 1)) return false;
+  if (!is_vector_control_variable(subscripts->get_element(0), control_variable)) return false;
+
+  symbol_c *array_type = search_varfb_instance_type->get_basetype_decl(element->subscripted_variable);
+  if (NULL == array_type) return false;
+  array_dimension_iterator_c dimensions(array_type);
+  if ((NULL == dimensions.next()) || (NULL != dimensions.next())) return false;
+
+  std::string array_name = vector_var_name(element->subscripted_variable);
+  if (vector_arrays.find(array_name) == vector_arrays.end()) {
+    vector_arrays[array_name] = vector_array_symbols.size();
+    vector_array_symbols.push_back(element->subscripted_variable);
+  }
+  return true;
+}
+
+/* An expression without side effects. When control_variable is NULL, the
+ * expression may not read arrays (nor the control variable, that is NULL).
+ */
+bool is_vector_expression(symbol_c *symbol, symbol_c *control_variable) {
+  if (   (NULL != dynamic_cast<integer_c         *>(symbol))
+      || (NULL != dynamic_cast<real_c            *>(symbol))
+      || (NULL != dynamic_cast<binary_integer_c  *>(symbol))
+      || (NULL != dynamic_cast<octal_integer_c   *>(symbol))
+      || (NULL != dynamic_cast<hex_integer_c     *>(symbol))
+      || (NULL != dynamic_cast<neg_integer_c     *>(symbol))
+      || (NULL != dynamic_cast<neg_real_c        *>(symbol))
+      || (NULL != dynamic_cast<integer_literal_c *>(symbol))
+      || (NULL != dynamic_cast<real_literal_c    *>(symbol))
+      || (NULL != dynamic_cast<boolean_literal_c *>(symbol))
+      || (NULL != dynamic_cast<boolean_true_c    *>(symbol))
+      || (NULL != dynamic_cast<boolean_false_c   *>(symbol)))
+    return true;
+
+  if (!is_vector_datatype(symbol->datatype)) return false;
+
+  if (NULL != dynamic_cast<symbolic_variable_c *>(symbol)) {
+    if (get_datatype_info_c::is_function_block(symbol->datatype)) return false;
+    return true;
+  }
+  if (NULL != dynamic_cast<array_variable_c *>(symbol))
+    return (NULL != control_variable) && is_vector_element(symbol, control_variable);
+
+#define __VECTOR_BINARY(class_name)\
+  if (NULL != dynamic_cast<class_name *>(symbol))\
+    return is_vector_expression(((class_name *)symbol)->l_exp, control_variable)\
+        && is_vector_expression(((class_name *)symbol)->r_exp, control_variable);
+  __VECTOR_BINARY(add_expression_c)
+  __VECTOR_BINARY(sub_expression_c)
+  __VECTOR_BINARY(mul_expression_c)
+  __VECTOR_BINARY(div_expression_c)
+  __VECTOR_BINARY(mod_expression_c)
+  __VECTOR_BINARY(and_expression_c)
+  __VECTOR_BINARY(or_expression_c)
+  __VECTOR_BINARY(xor_expression_c)
+#undef __VECTOR_BINARY
+  if (NULL != dynamic_cast<neg_expression_c *>(symbol))
+    return is_vector_expression(((neg_expression_c *)symbol)->exp, control_variable);
+  if (NULL != dynamic_cast<not_expression_c *>(symbol))
+    return is_vector_expression(((not_expression_c *)symbol)->exp, control_variable);
+  if (NULL != dynamic_cast<function_invocation_c *>(symbol)) {
+    std::vector<symbol_c *> values;
+    if (vector_fcall_none == vector_function_kind((function_invocation_c *)symbol, &values)) return false;
+    for (size_t i = 0; i < values.size(); i++)
+      if (!is_vector_expression(values[i], control_variable)) return false;
+    return true;
+  }
+
+  return false;
+}
+
+/* Calls of standard functions in element-wise loops.
+ *
+ * The functions of the library with a fixed number of inputs (the type
+ * conversions, ABS, SUB, LIMIT, SEL, ...) are inline C functions the C
+ * compiler expands in the loop, so they are called as usual. The
+ * extensible ADD, MUL, MAX and MIN take their inputs through a va_list in
+ * the library, which keeps the loop from being vectorized, so in these
+ * loops they are generated as expressions doing the same steps.
+ */
+typedef enum {
+  vector_fcall_none,      /* not in element-wise loops */
+  vector_fcall_library,   /* called as usual */
+  vector_fcall_add,
+  vector_fcall_mul,
+  vector_fcall_max,
+  vector_fcall_min
+} vector_fcall_t;
+
+static bool is_fname(const char *name, const char *fname) {
+  size_t length = strlen(fname);
+  return (strncasecmp(name, fname, length) == 0) && ((name[length] == '\0') || (name[length] == '_'));
+}
+
+/* Kind of a call of a standard function of numeric and bit types, with the
+ * values of its inputs, or vector_fcall_none for any other call */
+vector_fcall_t vector_function_kind(function_invocation_c *symbol, std::vector<symbol_c *> *values) {
+  function_declaration_c *f_decl = dynamic_cast<function_declaration_c *>(symbol->called_function_declaration);
+  if (NULL == f_decl) return vector_fcall_none;
+  if ((NULL == f_decl->first_file) || (NULL == strstr(f_decl->first_file, "standard_functions.txt"))) return vector_fcall_none;
+  if (!is_vector_datatype(symbol->datatype)) return vector_fcall_none;
+
+  list_c *params = dynamic_cast<list_c *>((NULL != symbol->formal_param_list)? symbol->formal_param_list : symbol->nonformal_param_list);
+  if (NULL == params) return vector_fcall_none;
+  for (int i = 0; i < params->n; i++) {
+    symbol_c *param = params->get_element(i);
+    /* the ENO of a call is an output */
+    if (NULL != dynamic_cast<output_variable_param_assignment_c *>(param)) return vector_fcall_none;
+    if (NULL != dynamic_cast<input_variable_param_assignment_c *>(param))
+      param = ((input_variable_param_assignment_c *)param)->expression;
+    values->push_back(param);
+  }
+
+  bool extensible = false;
+  function_param_iterator_c fp_iterator(f_decl);
+  while (NULL != fp_iterator.next())
+    if (fp_iterator.is_extensible_param()) extensible = true;
+  if (!extensible) return vector_fcall_library;
+
+  /* the extensible inputs are taken in order */
+  if (NULL != symbol->formal_param_list) return vector_fcall_none;
+  token_c *function_name = dynamic_cast<token_c *>(symbol->function_name);
+  if (NULL == function_name) return vector_fcall_none;
+  const char *name = function_name->value;
+  if (is_fname(name, "ADD")) return vector_fcall_add;
+  if (is_fname(name, "MUL")) return vector_fcall_mul;
+  if (is_fname(name, "MAX")) return vector_fcall_max;
+  if (is_fname(name, "MIN")) return vector_fcall_min;
+  return vector_fcall_none;
+}
+
+/* Checks if a FOR loop is element-wise, collecting the arrays it accesses */
+bool is_vector_for(for_statement_c *symbol) {
+  vector_arrays.clear();
+  vector_array_symbols.clear();
+
+  /* The code of FUNCTIONs doesn't access the variables through a prefix */
+  if (this->is_variable_prefix_null()) return false;
+  if (NULL != symbol->by_expression) return false;
+  if (!is_vector_local(symbol->control_variable)) return false;
+  if (!get_datatype_info_c::is_ANY_INT_compatible(symbol->control_variable->datatype)) return false;
+
+  /* The bounds are evaluated once, so they may not depend on the loop */
+  if (!is_vector_expression(symbol->beg_expression, NULL)) return false;
+  if (!is_vector_expression(symbol->end_expression, NULL)) return false;
+  if (symbol_references_variable(symbol->beg_expression, symbol->control_variable)) return false;
+  if (symbol_references_variable(symbol->end_expression, symbol->control_variable)) return false;
+
+  list_c *statements = dynamic_cast<list_c *>(symbol->statement_list);
+  if ((NULL == statements) || (statements->n == 0)) return false;
+  for (int i = 0; i < statements->n; i++) {
+    assignment_statement_c *assignment = dynamic_cast<assignment_statement_c *>(statements->get_element(i));
+    if (NULL == assignment) return false;
+    if (!is_vector_element(assignment->l_exp, symbol->control_variable)) return false;
+    if (!is_vector_expression(assignment->r_exp, symbol->control_variable)) return false;
+  }
+  return true;
+}
+
+/* Checks if an expression accepted by is_vector_expression() reads a variable */
+bool symbol_references_variable(symbol_c *symbol, symbol_c *variable) {
+  if (NULL != dynamic_cast<symbolic_variable_c *>(symbol))
+    return is_vector_control_variable(symbol, variable);
+
+#define __VECTOR_BINARY(class_name)\
+  if (NULL != dynamic_cast<class_name *>(symbol))\
+    return symbol_references_variable(((class_name *)symbol)->l_exp, variable)\
+        || symbol_references_variable(((class_name *)symbol)->r_exp, variable);
+  __VECTOR_BINARY(add_expression_c)
+  __VECTOR_BINARY(sub_expression_c)
+  __VECTOR_BINARY(mul_expression_c)
+  __VECTOR_BINARY(div_expression_c)
+  __VECTOR_BINARY(mod_expression_c)
+  __VECTOR_BINARY(and_expression_c)
+  __VECTOR_BINARY(or_expression_c)
+  __VECTOR_BINARY(xor_expression_c)
+#undef __VECTOR_BINARY
+  if (NULL != dynamic_cast<neg_expression_c *>(symbol))
+    return symbol_references_variable(((neg_expression_c *)symbol)->exp, variable);
+  if (NULL != dynamic_cast<not_expression_c *>(symbol))
+    return symbol_references_variable(((not_expression_c *)symbol)->exp, variable);
+  if (NULL != dynamic_cast<function_invocation_c *>(symbol)) {
+    std::vector<symbol_c *> values;
+    vector_function_kind((function_invocation_c *)symbol, &values);
+    for (size_t i = 0; i < values.size(); i++)
+      if (symbol_references_variable(values[i], variable)) return true;
+    return false;
+  }
+
+  return false;
+}
+
+/* Prints the base of a variable of the POU, as used by the accessor macros (e.g. data__->VAR) */
+void print_vector_variable(const char *accessor, symbol_c *symbol, const char *suffix) {
+  s4o.print(accessor);
+  s4o.print("(");
+  print_variable_prefix();
+  wanted_variablegeneration = complextype_base_vg;
+  symbol->accept(*this);
+  wanted_variablegeneration = expression_vg;
+  s4o.print(",");
+  s4o.print(suffix);
+  s4o.print(")");
+}
+
+/* An extensible standard function in an element-wise loop, with the steps
+ * of the library version: the inputs are taken in order, each step giving
+ * a value of the type of the function
+ */
+void *print_vector_extensible(vector_fcall_t kind, function_invocation_c *symbol, std::vector<symbol_c *> &values) {
+  symbol_c *type = symbol->datatype;
+  if      (get_datatype_info_c::is_ANY_INT_literal(type))  type = &get_datatype_info_c::lint_type_name;
+  else if (get_datatype_info_c::is_ANY_REAL_literal(type)) type = &get_datatype_info_c::lreal_type_name;
+
+  if ((kind == vector_fcall_add) || (kind == vector_fcall_mul)) {
+    const char *op = (kind == vector_fcall_add)? " + " : " * ";
+    for (size_t i = 1; i < values.size(); i++) {
+      s4o.print("((");
+      type->accept(*this);
+      s4o.print(")(");
+    }
+    s4o.print("(");
+    type->accept(*this);
+    s4o.print(")(");
+    values[0]->accept(*this);
+    s4o.print(")");
+    for (size_t i = 1; i < values.size(); i++) {
+      s4o.print(op);
+      s4o.print("(");
+      type->accept(*this);
+      s4o.print(")(");
+      values[i]->accept(*this);
+      s4o.print(")))");
+    }
+    return NULL;
+  }
+
+  /* MAX and MIN keep the running value on a temporary */
+  const char *cmp = (kind == vector_fcall_max)? " < " : " > ";
+  s4o.print("({");
+  type->accept(*this);
+  s4o.print(" __vector_m = (");
+  type->accept(*this);
+  s4o.print(")(");
+  values[0]->accept(*this);
+  s4o.print("), __vector_t;");
+  for (size_t i = 1; i < values.size(); i++) {
+    s4o.print(" __vector_t = (");
+    type->accept(*this);
+    s4o.print(")(");
+    values[i]->accept(*this);
+    s4o.print("); __vector_m = (__vector_m");
+    s4o.print(cmp);
+    s4o.print("__vector_t)? __vector_t : __vector_m;");
+  }
+  s4o.print(" __vector_m;})");
+  return NULL;
+}
+
+void print_vector_array_element(array_variable_c *symbol) {
+  int array = vector_arrays[vector_var_name(symbol->subscripted_variable)];
+  symbol_c *array_type = search_varfb_instance_type->get_basetype_decl(symbol->subscripted_variable);
+  if (NULL == array_type) ERROR;
+  array_dimension_iterator_c dimensions(array_type);
+  symbol_c *dimension = dimensions.next();
+  if (NULL == dimension) ERROR;
+
+  s4o.print("__for_array");
+  s4o.print(array);
+  s4o.print("[(__for_k) - (");
+  dimension->accept(*this);
+  s4o.print(")]");
+}
+
 /********************************/
 /* B 1.3.3 - Derived data types */
 /********************************/
@@ -255,6 +593,11 @@ void *visit(enumerated_type_declaration_c *symbol) {
 /* B 1.4 - Variables */
 /*********************/
 void *visit(symbolic_variable_c *symbol) {
+  if ((NULL != vector_control_variable) && (wanted_variablegeneration == expression_vg)
+      && is_vector_control_variable(symbol, vector_control_variable)) {
+    s4o.print("((__for_type)__for_k)");
+    return NULL;
+  }
   switch (wanted_variablegeneration) {
     case complextype_base_vg:
       symbol->var_name->accept(*this); //generate_c_base_c::visit(symbol);
@@ -383,6 +726,10 @@ void *visit(structured_variable_c *symbol) {
 /*  subscripted_variable '[' subscript_list ']' */
 //SYM_REF2(array_variable_c, subscripted_variable, subscript_list)
 void *visit(array_variable_c *symbol) {
+  if ((NULL != vector_control_variable) && (wanted_variablegeneration == expression_vg)) {
+    print_vector_array_element(symbol);
+    return NULL;
+  }
   switch (wanted_variablegeneration) {
     case complextype_base_vg:
       symbol->subscripted_variable->accept(*this);
@@ -729,6 +1076,13 @@ void *visit(not_expression_c *symbol) {
 }
 
 void *visit(function_invocation_c *symbol) {
+  if (NULL != vector_control_variable) {
+    std::vector<symbol_c *> values;
+    vector_fcall_t kind = vector_function_kind(symbol, &values);
+    if ((vector_fcall_none != kind) && (vector_fcall_library != kind))
+      return print_vector_extensible(kind, symbol, values);
+  }
+
   symbol_c* function_name = NULL;
   DECLARE_PARAM_LIST()
 
@@ -948,7 +1302,13 @@ void *visit(statement_list_c *symbol) {
 void *visit(assignment_statement_c *symbol) {
   symbol_c *left_type = symbol->l_exp->datatype;
   
-  if (this->is_variable_prefix_null()) {
+  if (NULL != vector_control_variable) {
+    /* body of an element-wise FOR loop, the arrays are reached through their pointers */
+    symbol->l_exp->accept(*this);
+    s4o.print(" = ");
+    print_check_function(left_type, symbol->r_exp);
+  }
+  else if (this->is_variable_prefix_null()) {
     symbol->l_exp->accept(*this);
     s4o.print(" = ");
     print_check_function(left_type, symbol->r_exp);
@@ -1133,21 +1493,47 @@ void *visit(not_paramassign_c *symbol) {
 /********************************/
 /* B 3.2.3 Selection Statements */
 /********************************/
-void *visit(if_statement_c *symbol) {
-  s4o.print("if (");
-  symbol->expression->accept(*this);
-  s4o.print(") {\n");
+/* The conditions folded to a constant by stage 3 (e.g. the ones testing a VAR CONSTANT or a
+ * VAR_GLOBAL CONSTANT of the configuration) select the branches at compile time: the branches
+ * that can never run are left out, and a branch that always runs ends the if..elsif chain.
+ */
+static bool is_const_false(symbol_c *expression) {return VALID_CVALUE(bool, expression) && !GET_CVALUE(bool, expression);}
+static bool is_const_true (symbol_c *expression) {return VALID_CVALUE(bool, expression) &&  GET_CVALUE(bool, expression);}
+
+/* Prints one branch of an if..elsif..else chain. Returns true if the branch always runs. */
+bool print_if_branch(symbol_c *expression, symbol_c *statement_list, bool *first) {
+  if ((NULL != expression) && is_const_false(expression)) return false;
+  bool taken = (NULL == expression) || is_const_true(expression);
+  if (*first) {
+    if (taken) {s4o.print("{\n");}
+    else       {s4o.print("if ("); expression->accept(*this); s4o.print(") {\n");}
+  } else {
+    s4o.print(s4o.indent_spaces);
+    if (taken) {s4o.print("} else {\n");}
+    else       {s4o.print("} else if ("); expression->accept(*this); s4o.print(") {\n");}
+  }
+  *first = false;
   s4o.indent_right();
-  symbol->statement_list->accept(*this);
+  statement_list->accept(*this);
   s4o.indent_left();
-  symbol->elseif_statement_list->accept(*this);
+  return taken;
+}
 
-  if (symbol->else_statement_list != NULL) {
-    s4o.print(s4o.indent_spaces); s4o.print("} else {\n");
-    s4o.indent_right();
-    symbol->else_statement_list->accept(*this);
-    s4o.indent_left();
+void *visit(if_statement_c *symbol) {
+  bool first = true;
+  bool taken = print_if_branch(symbol->expression, symbol->statement_list, &first);
+
+  list_c *elseif_list = dynamic_cast<list_c *>(symbol->elseif_statement_list);
+  for (int i = 0; !taken && (NULL != elseif_list) && (i < elseif_list->n); i++) {
+    elseif_statement_c *elseif = dynamic_cast<elseif_statement_c *>(elseif_list->get_element(i));
+    if (NULL == elseif) ERROR;
+    taken = print_if_branch(elseif->expression, elseif->statement_list, &first);
   }
+
+  if (!taken && (symbol->else_statement_list != NULL))
+    print_if_branch(NULL, symbol->else_statement_list, &first);
+
+  if (first) {s4o.print("{}"); return NULL;}  /* no branch can ever run */
   s4o.print(s4o.indent_spaces); s4o.print("}");
   return NULL;
 }
@@ -1242,6 +1628,79 @@ void *visit(case_list_c *symbol) {
 /* B 3.2.4 Iteration Statements */
 /********************************/
 void *visit(for_statement_c *symbol) {
+  if (is_vector_for(symbol))
+    return print_vector_for(symbol);
+  return print_for(symbol);
+}
+
+/* An element-wise FOR loop (see is_vector_for()). The bounds are evaluated
+ * once, the counter is kept on a C variable wide enough not to wrap, and the
+ * arrays are accessed through __restrict__ pointers, leaving a loop the C
+ * compiler can vectorize. For the accessors that honour the force flags, the
+ * loop falls back to the generic FOR when its control variable or one of its
+ * arrays is forced, as the pointers bypass the setters.
+ */
+void *print_vector_for(for_statement_c *symbol) {
+  s4o.print("/* FOR ... (element-wise) */\n" + s4o.indent_spaces);
+  s4o.print("if (!(");
+  print_vector_variable(IS_VAR_FORCED, symbol->control_variable, "");
+  for (size_t i = 0; i < vector_array_symbols.size(); i++) {
+    s4o.print(" || ");
+    print_vector_variable(IS_VAR_FORCED, vector_array_symbols[i], "");
+  }
+  s4o.print(")) {\n");
+  s4o.indent_right();
+
+  s4o.print(s4o.indent_spaces + "typedef __typeof__(");
+  print_vector_variable(GET_VAR, symbol->control_variable, "");
+  s4o.print(") __for_type;\n");
+  s4o.print(s4o.indent_spaces + "LINT __for_k = (__for_type)(");
+  symbol->beg_expression->accept(*this);
+  s4o.print(");\n");
+  s4o.print(s4o.indent_spaces + "LINT __for_end = (__for_type)(");
+  symbol->end_expression->accept(*this);
+  s4o.print(");\n");
+  for (size_t i = 0; i < vector_array_symbols.size(); i++) {
+    s4o.print(s4o.indent_spaces + "__typeof__(");
+    print_vector_variable(GET_VAR, vector_array_symbols[i], ".table[0]");
+    s4o.print(") *__restrict__ __for_array");
+    s4o.print((int)i);
+    s4o.print(" = ");
+    print_vector_variable(GET_VAR_REF, vector_array_symbols[i], ".table[0]");
+    s4o.print(";\n");
+  }
+
+  s4o.print(s4o.indent_spaces + "for (; __for_k <= __for_end; __for_k++) {\n");
+  s4o.indent_right();
+  vector_control_variable = symbol->control_variable;
+  symbol->statement_list->accept(*this);
+  vector_control_variable = NULL;
+  s4o.indent_left();
+  s4o.print(s4o.indent_spaces + "}\n");
+
+  /* the control variable ends as the FOR loop leaves it */
+  s4o.print(s4o.indent_spaces);
+  s4o.print(SET_VAR);
+  s4o.print("(");
+  print_variable_prefix();
+  s4o.print(",");
+  wanted_variablegeneration = complextype_base_vg;
+  symbol->control_variable->accept(*this);
+  wanted_variablegeneration = expression_vg;
+  s4o.print(",,(__for_type)__for_k);\n");
+
+  s4o.indent_left();
+  s4o.print(s4o.indent_spaces + "} else {\n");
+  s4o.indent_right();
+  s4o.print(s4o.indent_spaces);
+  print_for(symbol);
+  s4o.print("\n");
+  s4o.indent_left();
+  s4o.print(s4o.indent_spaces + "} /* END_FOR (element-wise) */");
+  return NULL;
+}
+
+void *print_for(for_statement_c *symbol) {
   /* Due to the way the GET/SET_GLOBAL accessor macros access VAR_GLOBAL variables,
    * these varibles cannot be used within a C for(;;) loop.
    * We must therefore implemnt the FOR END_FOR loop as a C while() loop
@@ -1344,6 +1803,7 @@ void *visit(for_statement_c *symbol) {
 }
 
 void *visit(while_statement_c *symbol) {
+  if (is_const_false(symbol->expression)) {s4o.print("{}"); return NULL;}  /* the loop never runs */
   s4o.print("while (");
   symbol->expression->accept(*this);
   s4o.print(") {\n");
@@ -37,6 +37,8 @@ TIsoTcpSocket::TIsoTcpSocket()
 	IsoPDUSize =1024;
     IsoMaxFragments=MaxIsoFragments;
     LastIsoError=0;
+    AheadStart=0;
+    AheadCount=0;
 }
 //---------------------------------------------------------------------------
 TIsoTcpSocket::~TIsoTcpSocket()
@@ -177,6 +179,48 @@ void TIsoTcpSocket::FragmentSkipped(int Size)
 // override for log purpose
 }
 //---------------------------------------------------------------------------
+void TIsoTcpSocket::Purge()
+{
+    AheadStart=0;
+    AheadCount=0;
+    TMsgSocket::Purge();
+}
+//---------------------------------------------------------------------------
+int TIsoTcpSocket::IsoRead(void *Data, int Min, int Max)
+{
+    int Size = 0;
+    int Received;
+
+    LastTcpError=0;
+    if (AheadCount>0)
+    {
+        Size = AheadCount<Max ? AheadCount : Max;
+        memcpy(Data, &Ahead[AheadStart], Size);
+        AheadStart+=Size;
+        AheadCount-=Size;
+    }
+    if (Size<Min)
+    {
+        RecvAvailable(pbyte(Data)+Size, Min-Size, Max-Size, Received);
+        Size+=Received;
+    }
+    return Size;
+}
+//---------------------------------------------------------------------------
+void TIsoTcpSocket::IsoReadAhead(void *Data, int Size)
+{
+    // The bytes come either from a recv, with nothing left ahead, or from
+    // the end of the ones just taken from Ahead
+    if (AheadCount>0)
+        AheadStart-=Size;
+    else
+    {
+        memcpy(Ahead, Data, Size);
+        AheadStart=0;
+    }
+    AheadCount+=Size;
+}
+//---------------------------------------------------------------------------
 int TIsoTcpSocket::isoConnect()
 {
 	pbyte TmpControlPDU;
@@ -184,6 +228,9 @@ int TIsoTcpSocket::isoConnect()
 	u_int Length;
 	int Result;
 
+	// A new connection has nothing read ahead
+	AheadStart=0;
+	AheadCount=0;
 	// Build the default connection telegram
 	BuildControlPDU();
     ControlPDU =&FControlPDU;
@@ -267,11 +314,19 @@ int TIsoTcpSocket::isoSendBuffer(void *Data, int Size)
 		PDU.COTP.HLength   =sizeof(TCOTP_DT)-1;
 		PDU.COTP.PDUType   =pdu_type_DT;
 		PDU.COTP.EoT_Num   =pdu_EoT;
-		// Fill payload
-		if (Data!=0) // Data=null ==> use internal buffer PDU.Payload
-            memcpy(&PDU.Payload, Data, Size);
-        // Send over TCP/IP
-        SendPacket(&PDU, IsoSize);
+		// Send over TCP/IP. Data=null ==> use internal buffer PDU.Payload,
+		// otherwise the payload is sent from where it was built
+		if ((Data==0) || (Data==&PDU.Payload))
+			SendPacket(&PDU, IsoSize);
+		else
+		{
+#ifdef OS_WINDOWS
+			memcpy(&PDU.Payload, Data, Size);
+			SendPacket(&PDU, IsoSize);
+#else
+			SendPacket(&PDU, DataHeaderSize, Data, Size);
+#endif
+		}
 
         if (LastTcpError!=0)
             Result =SetIsoError(errIsoSendPacket);
@@ -311,7 +366,7 @@ int TIsoTcpSocket::isoExchangeBuffer(void *Data, int &Size)
 bool TIsoTcpSocket::IsoPDUReady()
 {
     ClrIsoError();
-	return PacketReady(sizeof(TCOTP_DT));
+	return (AheadCount>=int(sizeof(TCOTP_DT))) || PacketReady(sizeof(TCOTP_DT)-AheadCount);
 }
 //---------------------------------------------------------------------------
 int TIsoTcpSocket::isoDisconnect(bool OnlyTCP)
@@ -368,13 +423,18 @@ int TIsoTcpSocket::isoSendPDU(PIsoDataPDU Data)
 int TIsoTcpSocket::isoRecvFragment(void *From, int Max, int &Size, bool &EoT)
 {
 	int DataLength;
+	int Received;
+	int Extra;
 
 	Size =0;
 	EoT =false;
     byte PDUType;
     ClrIsoError();
-	// header is received always from beginning
-	RecvPacket(&PDU, DataHeaderSize); // TPKT + COPT_DT
+	// header is received always from beginning (TPKT + COPT_DT). When the
+	// payload goes right after it, the whole fragment is read together,
+	// usually with a single recv
+	bool Contiguous = pbyte(From)==pbyte(&PDU)+DataHeaderSize;
+	Received =IsoRead(&PDU, DataHeaderSize, Contiguous ? DataHeaderSize+Max : DataHeaderSize);
 	if (LastTcpError==0)
 	{
         PDUType=PDU.COTP.PDUType;
@@ -394,13 +454,22 @@ int TIsoTcpSocket::isoRecvFragment(void *From, int Max, int &Size, bool &EoT)
 		DataLength = PDUSize(&PDU) - DataHeaderSize;
 		if (CheckPDU(&PDU, PDUType)!=0)
 			return LastIsoError;
+		// What was read past the fragment belongs to the next one
+		Extra =Received-DataHeaderSize-DataLength;
+		if (Extra>0)
+		{
+			IsoReadAhead(pbyte(&PDU)+DataHeaderSize+DataLength, Extra);
+			Received-=Extra;
+		}
 		// Checks for data presence
 		if (DataLength>0)  // payload present
 		{
 			// Check if the data fits in the buffer
 			if(DataLength<=Max)
 			{
-				RecvPacket(From, DataLength);
+				Received-=DataHeaderSize;
+				if (Received<DataLength)
+					IsoRead(pbyte(From)+Received, DataLength-Received, DataLength-Received);
 				if (LastTcpError!=0)
 					return SetIsoError(errIsoRecvPacket);
 				else
@@ -220,7 +220,18 @@ private:
 	int CheckPDU(void *pPDU, u_char PduTypeExpected);
 	// Receives the next fragment
 	int isoRecvFragment(void *From, int Max, int &Size, bool &EoT);
+	// Bytes received past the end of the last fragment : the start of the
+	// next telegrams, that the peer sent without waiting for the answer
+	byte Ahead[IsoFrameSize];
+	int AheadStart;
+	int AheadCount;
+	// Reads at least Min and at most Max bytes, the ones read ahead first
+	int IsoRead(void *Data, int Min, int Max);
+	// Keeps the bytes past the end of a fragment for the next one
+	void IsoReadAhead(void *Data, int Size);
 protected:
+	// Clears the socket input buffer and the bytes read ahead
+	void Purge();
 	TIsoDataPDU PDU;
 	int SetIsoError(int Error);
 	// Builds the control PDU starting from address properties
@@ -258,6 +269,9 @@ public:
 	int isoExchangeBuffer(void *Data, int & Size);
 	// A PDU is ready (at least its header) to be read
 	bool IsoPDUReady();
+	// True if the next telegram was already received, in part or in full,
+	// with the last one : the socket doesn't signal it anymore
+	bool IsoDataBuffered() { return AheadCount>0; }
 	// Same as isoSendBuffer, but the entire PDU has to be provided (in any case a check is performed)
 	int isoSendPDU(PIsoDataPDU Data);
 	// Same as isoRecvBuffer, but it returns the entire PDU, automatically enques the fragments
@@ -994,7 +994,7 @@ bool TSnap7Partner::Execute()
 		return false;
 
     // Checks if there is something to recv
-    if (Result && CanRead(WorkInterval))
+    if (Result && (IsoDataBuffered() || CanRead(WorkInterval)))
     {
         // Peeks info and returns PDU Kind
         isoRecvPDU(&PDU);
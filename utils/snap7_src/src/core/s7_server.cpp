@@ -46,7 +46,8 @@ bool TIsoTcpWorker::ExecuteRecv()
     TPDUKind PduKind;
     int PayloadSize;
 
-    if (CanRead(WorkInterval)) // should be Small to avoid time wait during the close
+    // A telegram read ahead with the last one is not signaled by the socket
+    if (IsoDataBuffered() || CanRead(WorkInterval)) // should be Small to avoid time wait during the close
     {
         isoRecvPDU(&PDU);
         if (LastTcpError==0)
@@ -94,7 +95,13 @@ bool TIsoTcpWorker::ExecuteRecv()
 //---------------------------------------------------------------------------
 bool TIsoTcpWorker::Execute()
 {
-    return ExecuteSend() && ExecuteRecv();
+    bool Result;
+    // The telegrams read ahead are served before going back to the socket,
+    // that the worker pool waits on
+    do
+        Result = ExecuteSend() && ExecuteRecv();
+    while (Result && IsoDataBuffered());
+    return Result;
 }
 //------------------------------------------------------------------------------
 // S7 WORKER CLASS
@@ -106,6 +113,8 @@ TS7Worker::TS7Worker()
     FPDULength=2048;
     DBCnt     =0;
     LastBlk   =Block_DB;
+    ItemArea  =NULL;
+    HeldCS    =NULL;
 }
 
 bool TS7Worker::ExecuteRecv()
@@ -321,6 +330,49 @@ PS7Area TS7Worker::GetArea(byte S7Code, word index)
     };
 }
 //------------------------------------------------------------------------------
+// The items of a multi-variable request very often address the same area
+// (i.e. many tags of the same DB), so the last area found is reused until an
+// item addresses another one. Only valid for the PDU being processed.
+//------------------------------------------------------------------------------
+PS7Area TS7Worker::GetItemArea(byte S7Code, word index)
+{
+    if ((ItemArea!=NULL) && (ItemAreaCode==S7Code) && ((S7Code!=S7AreaDB) || (ItemDBNumber==index)))
+        return ItemArea;
+
+    ItemArea=GetArea(S7Code, index);
+    ItemAreaCode=S7Code;
+    ItemDBNumber=index;
+    return ItemArea;
+}
+//------------------------------------------------------------------------------
+void TS7Worker::BeginItems()
+{
+    ReleaseArea();
+    ItemArea=NULL;
+}
+//------------------------------------------------------------------------------
+// Locks an area for the data copy of an item. The lock is kept while the next
+// items address the same area, so a multi-variable request locks each area
+// run once instead of once per item. Only one area is held at a time.
+//------------------------------------------------------------------------------
+void TS7Worker::HoldArea(PS7Area P)
+{
+    if (HeldCS==P->cs)
+        return;
+    ReleaseArea();
+    HeldCS=P->cs;
+    HeldCS->Enter();
+}
+//------------------------------------------------------------------------------
+void TS7Worker::ReleaseArea()
+{
+    if (HeldCS!=NULL)
+    {
+        HeldCS->Leave();
+        HeldCS=NULL;
+    }
+}
+//------------------------------------------------------------------------------
 word TS7Worker::ReadArea(PResFunReadItem ResItemData, PReqFunReadItem ReqItemPar,
      int &PDURemainder, TEv &EV)
 {
@@ -332,7 +384,6 @@ word TS7Worker::ReadArea(PResFunReadItem ResItemData, PReqFunReadItem ReqItemPar
     byte BitIndex, ByteVal;
 	int Multiplier;
     void *Source = NULL;
-    PSnapCriticalSection pcs;
 
     P=NULL;
     EV.EvStart   =0;
@@ -351,7 +402,7 @@ word TS7Worker::ReadArea(PResFunReadItem ResItemData, PReqFunReadItem ReqItemPar
 
 	if (!FServer->ResourceLess)
 	{
-		P = GetArea(ReqItemPar->Area, DBNum);
+		P = GetItemArea(ReqItemPar->Area, DBNum);
 		if (P == NULL)
 			return RA_NotFound(ResItemData, EV);
 	}
@@ -423,7 +474,9 @@ word TS7Worker::ReadArea(PResFunReadItem ResItemData, PReqFunReadItem ReqItemPar
 		Source = P->PData + Start;
 	}
 
-	// Read Event (before copy data)
+	// Read Event (before copy data). The user callback may lock the area
+	if (FServer->OnReadEvent!=NULL)
+		ReleaseArea();
     DoReadEvent(evcDataRead,0,EV.EvArea,EV.EvIndex,EV.EvStart,EV.EvSize);	
 
 	if (FServer->ResourceLess)
@@ -434,13 +487,10 @@ word TS7Worker::ReadArea(PResFunReadItem ResItemData, PReqFunReadItem ReqItemPar
 	}
 	else
 	{
-		// Lock the area
-		pcs = P->cs;
-		pcs->Enter();
+		// Lock the area (released by PerformFunctionRead)
+		HoldArea(P);
 		// Get Data
 		memcpy(&ResItemData->Data, Source, Size);
-		// Unlock the area
-		pcs->Leave();
 	}
 
     ResItemData->ReturnCode=0xFF;
@@ -505,7 +555,7 @@ bool TS7Worker::PerformFunctionRead()
     int ItemsCount, c,
     TotalSize,
     PDURemainder;
-    TEv EV;
+    TEv EV[MaxVars];
 
 	PDURemainder=FPDULength;
     // Stage 1 : Setup pointers and initial check
@@ -521,20 +571,25 @@ bool TS7Worker::PerformFunctionRead()
     // Stage 2 : gather data
     Offset=sizeof(TResFunReadParams);      // = 2
 
+    BeginItems();
     for (c = 0; c < ItemsCount; c++)
 	{
 		ResData[c]=PResFunReadItem(pbyte(ResParams)+Offset);
-		ItemSize=ReadArea(ResData[c],&ReqParams->Items[c],PDURemainder, EV);
+		ItemSize=ReadArea(ResData[c],&ReqParams->Items[c],PDURemainder, EV[c]);
 
         // S7 doesn't xfer odd byte amount
         if ((c<ItemsCount-1) && (ItemSize % 2 != 0))
 	      ItemSize++;
 		
         Offset+=(ItemSize+4);
-        // For multiple items we have to create multiple events
-        if (ItemsCount>1)
-            DoEvent(evcDataRead,EV.EvRetCode,EV.EvArea,EV.EvIndex,EV.EvStart,EV.EvSize);
     }
+    ReleaseArea();
+
+    // For multiple items we have to create multiple events, the areas must
+    // be unlocked since the callback may lock them
+    if (ItemsCount>1)
+        for (c = 0; c < ItemsCount; c++)
+            DoEvent(evcDataRead,EV[c].EvRetCode,EV[c].EvArea,EV[c].EvIndex,EV[c].EvStart,EV[c].EvSize);
     // Stage 3 : finalize the answer and send the packet
     Answer.Header.P=0x32;
     Answer.Header.PDUType=0x03;
@@ -553,7 +608,7 @@ bool TS7Worker::PerformFunctionRead()
     // For single item (most likely case) it's better to work with the event after
     // we sent the answer
     if (ItemsCount==1)
-        DoEvent(evcDataRead,EV.EvRetCode,EV.EvArea,EV.EvIndex,EV.EvStart,EV.EvSize);
+        DoEvent(evcDataRead,EV[0].EvRetCode,EV[0].EvArea,EV[0].EvIndex,EV[0].EvStart,EV[0].EvSize);
 
     return true;
 }
@@ -592,7 +647,6 @@ byte TS7Worker::WriteArea(PReqFunWriteDataItem ReqItemData, PReqFunWriteItem Req
 	word DBNum = 0;
 	word Elements;
     longword *PAdd;
-	PSnapCriticalSection pcs;
 	longword Start, Size, ASize, DataLen, AStart;
 	pbyte Target = NULL;
 	byte BitIndex;
@@ -612,7 +666,7 @@ byte TS7Worker::WriteArea(PReqFunWriteDataItem ReqItemData, PReqFunWriteItem Req
 	
 	if (!FServer->ResourceLess)
 	{
-		P=GetArea(ReqItemPar->Area, DBNum);
+		P=GetItemArea(ReqItemPar->Area, DBNum);
 		if (P==NULL)
 			return WA_NotFound(EV);
 	}
@@ -692,6 +746,8 @@ byte TS7Worker::WriteArea(PReqFunWriteDataItem ReqItemData, PReqFunWriteItem Req
 	}
 	else
 	{
+		// Lock the area (released by PerformFunctionWrite)
+		HoldArea(P);
 		if (ReqItemPar->TransportSize==S7WLBit)
 		{
 		  if ((ReqItemData->Data[0] & 0x01) != 0)   // bit set
@@ -700,12 +756,8 @@ byte TS7Worker::WriteArea(PReqFunWriteDataItem ReqItemData, PReqFunWriteItem Req
 			  *Target=*Target & (~BitMask[BitIndex]);
 		}
 		else {
-		  // Lock the area
-			pcs = P->cs;
-			pcs->Enter();
 			// Write Data
 			memcpy(Target, &ReqItemData->Data[0], Size);
-			pcs->Leave();
 		};
 	}
 	
@@ -723,7 +775,7 @@ bool TS7Worker::PerformFunctionWrite()
 	uintptr_t StartData;
 	int c, ItemsCount;
 	int ResDSize;
-	TEv EV;
+	TEv EV[MaxVars];
 
 	// Stage 1 : Setup pointers and initial check
 	ReqParams=PReqFunWriteParams(pbyte(PDUH_in)+sizeof(TS7ReqHeader));
@@ -731,6 +783,10 @@ bool TS7Worker::PerformFunctionWrite()
 
 	StartData=sizeof(TS7ReqHeader)+SwapWord(PDUH_in->ParLen);
 
+	// trunk to 20 max items.
+	if (ReqParams->ItemsCount>MaxVars)
+		ReqParams->ItemsCount=MaxVars;
+
 	ItemsCount=ReqParams->ItemsCount;
 	ResDSize  =ResHeaderSize23+2+ItemsCount;
 	for (c = 0; c < ItemsCount; c++)
@@ -751,13 +807,16 @@ bool TS7Worker::PerformFunctionWrite()
 	ResData->ItemCount=ReqParams->ItemsCount;
 
 	// Stage 2 : Write data
+	BeginItems();
 	for (c = 0; c < ItemsCount; c++)
-	{
-	  ResData->Data[c]=WriteArea(ReqData[c],&ReqParams->Items[c], EV);
-      // For multiple items we have to create multiple events
-      if (ItemsCount>1)
-           DoEvent(evcDataWrite,EV.EvRetCode,EV.EvArea,EV.EvIndex,EV.EvStart,EV.EvSize);
-    }
+	  ResData->Data[c]=WriteArea(ReqData[c],&ReqParams->Items[c], EV[c]);
+	ReleaseArea();
+
+    // For multiple items we have to create multiple events, the areas must
+    // be unlocked since the callback may lock them
+    if (ItemsCount>1)
+        for (c = 0; c < ItemsCount; c++)
+            DoEvent(evcDataWrite,EV[c].EvRetCode,EV[c].EvArea,EV[c].EvIndex,EV[c].EvStart,EV[c].EvSize);
 
     // Stage 3 : finalize the answer
     Answer.Header.P=0x32;
@@ -772,7 +831,7 @@ bool TS7Worker::PerformFunctionWrite()
     // For single item (most likely case) it's better to fire the event after
     // we sent the answer
     if (ItemsCount==1)
-        DoEvent(evcDataWrite,EV.EvRetCode,EV.EvArea,EV.EvIndex,EV.EvStart,EV.EvSize);
+        DoEvent(evcDataWrite,EV[0].EvRetCode,EV[0].EvArea,EV[0].EvIndex,EV[0].EvStart,EV[0].EvSize);
     return true;
 }
 //==============================================================================
@@ -1933,6 +1992,9 @@ int TSnap7Server::GetParam(int ParamNumber, void *pValue)
 	case p_i32_MaxClients:
 	    *Pint32_t(pValue)=MaxClients;
 	    break;
+	case p_i32_WorkerPool:
+	    *Pint32_t(pValue)=PoolSize;
+	    break;
 	case p_i32_PDURequest:
 		*Pint32_t(pValue) = ForcePDU;
 		break;
@@ -1977,6 +2039,17 @@ int TSnap7Server::SetParam(int ParamNumber, void *pValue)
          else
 	         return errSrvCannotChangeParam;
          break;
+	case p_i32_WorkerPool:
+	     if (Status==SrvStopped)
+	     {
+	         int Pool = *Pint32_t(pValue);
+	         if ((Pool < 0) || (Pool > MaxPoolThreads))
+	             return errSrvInvalidParams;
+	         PoolSize=Pool;
+	     }
+         else
+	         return errSrvCannotChangeParam;
+         break;
 	default: return errSrvInvalidParamNumber;
     }
     return 0;
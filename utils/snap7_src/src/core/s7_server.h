@@ -140,6 +140,15 @@ protected:
     bool PerformPDUUsrData(int &Size);
     // Second stage parse : PDU Request
     PS7Area GetArea(byte S7Code, word index);
+    // Area resolution and locking shared by the items of one PDU
+    PS7Area ItemArea;
+    byte ItemAreaCode;
+    word ItemDBNumber;
+    PSnapCriticalSection HeldCS;
+    PS7Area GetItemArea(byte S7Code, word index);
+    void BeginItems();
+    void HoldArea(PS7Area P);
+    void ReleaseArea();
     // Group Read Area
     bool PerformFunctionRead();
     // Subfunctions Read Data
@@ -170,6 +170,7 @@ const int p_i32_BSendTimeout    = 12;
 const int p_i32_BRecvTimeout    = 13;
 const int p_u32_RecoveryTime    = 14;
 const int p_u32_KeepAliveTime   = 15;
+const int p_i32_WorkerPool      = 16;
 
 // Bool param is passed as int32_t : 0->false, 1->true
 // String param (only set) is passed as pointer
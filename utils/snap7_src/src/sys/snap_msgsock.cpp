@@ -548,6 +548,36 @@ int TMsgSocket::SendPacket(void *Data, int Size)
     return Result;
 }
 //---------------------------------------------------------------------------
+#ifndef OS_WINDOWS
+int TMsgSocket::SendPacket(void *Header, int HeaderSize, void *Data, int Size)
+{
+    iovec Parts[2];
+    msghdr Msg;
+
+    LastTcpError=0;
+    if (SendTimeout>0)
+    {
+        if (!CanWrite(SendTimeout))
+        {
+            LastTcpError = WSAETIMEDOUT;
+            return LastTcpError;
+        }
+    }
+    Parts[0].iov_base = Header;
+    Parts[0].iov_len  = HeaderSize;
+    Parts[1].iov_base = Data;
+    Parts[1].iov_len  = Size;
+    memset(&Msg, 0, sizeof(Msg));
+    Msg.msg_iov    = Parts;
+    Msg.msg_iovlen = 2;
+    if (sendmsg(FSocket, &Msg, MSG_NOSIGNAL)==HeaderSize+Size)
+        return 0;
+
+    SockCheck(SOCKET_ERROR);
+    return SOCKET_ERROR;
+}
+#endif
+//---------------------------------------------------------------------------
 bool TMsgSocket::PacketReady(int Size)
 {
 	return (WaitingData()>=Size);
@@ -600,6 +630,47 @@ int TMsgSocket::RecvPacket(void *Data, int Size)
     return LastTcpError;
 }
 //---------------------------------------------------------------------------
+int TMsgSocket::RecvAvailable(void *Data, int Min, int Max, int &SizeRecvd)
+{
+    int BytesRead;
+    // Without MSG_DONTWAIT every recv waits for the socket first
+    bool Ready = MSG_DONTWAIT!=0;
+
+    SizeRecvd=0;
+    LastTcpError=0;
+    while ((SizeRecvd<Min) && (LastTcpError==0))
+    {
+        // The data is usually there already, the wait is only for the rest
+        if (!Ready)
+        {
+            if (!CanRead(RecvTimeout))
+            {
+                if (LastTcpError==0)
+                    LastTcpError = WSAETIMEDOUT;
+                break;
+            }
+        }
+        BytesRead=recv(FSocket, (char*)Data+SizeRecvd, Max-SizeRecvd, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (BytesRead>0)
+            SizeRecvd+=BytesRead;
+        else
+            if (BytesRead==0)
+                LastTcpError = WSAECONNRESET;  // Connection reset by Peer
+            else
+            {
+                LastTcpError = GetLastSocketError();
+                if (LastTcpError==WSAEWOULDBLOCK)
+                    LastTcpError = 0;
+            }
+        Ready = (BytesRead>0) && (MSG_DONTWAIT!=0);
+    }
+
+    if (LastTcpError==WSAECONNRESET)
+        Connected =false;
+
+    return LastTcpError;
+}
+//---------------------------------------------------------------------------
 int TMsgSocket::PeekPacket(void *Data, int Size)
 {
     int BytesRead;
@@ -32,6 +32,9 @@
 #if defined(OS_WINDOWS) || defined (OS_SOLARIS) || defined(OS_OSX)
 # define MSG_NOSIGNAL    0
 #endif
+#ifndef MSG_DONTWAIT
+# define MSG_DONTWAIT    0
+#endif
 //----------------------------------------------------------------------------
 // Non blocking connection to avoid root priviledges under UNIX 
 // i.e. raw socket pinger is not more used.
@@ -309,15 +312,26 @@ public:
         bool Ping(sockaddr_in Addr);
         // Sends a packet
         int SendPacket(void *Data,  int Size);
+#ifndef OS_WINDOWS
+        // Sends a packet made of a header and a payload that are not
+        // contiguous, with a single syscall and without copying them
+        int SendPacket(void *Header, int HeaderSize, void *Data, int Size);
+#endif
         // Returns true if a Packet at least of "Size" bytes is ready to be read
         bool PacketReady(int Size);
         // Receives everything
         int Receive(void *Data, int BufSize, int & SizeRecvd);
         // Receives a packet of size specified.
         int RecvPacket(void *Data, int Size);
+        // Receives at least Min and at most Max bytes, taking whatever is
+        // ready: usually a whole packet with a single recv
+        int RecvAvailable(void *Data, int Min, int Max, int &SizeRecvd);
         // Peeks a packet of size specified without extract it from the socket queue
         int PeekPacket(void *Data, int Size);
         virtual bool Execute();
+        // Socket descriptor, used by the worker pool of the server to wait
+        // for data on many connections at once
+        socket_t Handle() { return FSocket; }
 };
 
 typedef TMsgSocket *PMsgSocket;
@@ -25,6 +25,10 @@
 |=============================================================================*/
 
 #include "snap_tcpsrvr.h"
+#ifndef OS_WINDOWS
+#include <poll.h>
+#include <fcntl.h>
+#endif
 //---------------------------------------------------------------------------
 // EVENTS QUEUE
 //---------------------------------------------------------------------------
@@ -175,6 +179,133 @@ void TMsgListenerThread::Execute()
         };
     }
 }
+#ifndef OS_WINDOWS
+//---------------------------------------------------------------------------
+// POOL THREAD
+//---------------------------------------------------------------------------
+TMsgPoolThread::TMsgPoolThread(TCustomMsgServer *Server)
+{
+    FServer = Server;
+    FreeOnTerminate = false;
+    CSAdded = new TSnapCriticalSection();
+    AddedCount = 0;
+    ClientsCount = 0;
+    if (pipe(WakePipe) == 0)
+    {
+        fcntl(WakePipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(WakePipe[1], F_SETFL, O_NONBLOCK);
+    }
+    else
+        WakePipe[0] = WakePipe[1] = -1;
+}
+//---------------------------------------------------------------------------
+TMsgPoolThread::~TMsgPoolThread()
+{
+    // Connections added after the thread was stopped
+    for (int c = 0; c < AddedCount; c++)
+        delete Added[c];
+    if (WakePipe[0] >= 0)
+    {
+        close(WakePipe[0]);
+        close(WakePipe[1]);
+    }
+    delete CSAdded;
+}
+//---------------------------------------------------------------------------
+bool TMsgPoolThread::Add(PWorkerSocket Socket)
+{
+    bool Result;
+    CSAdded->Enter();
+    Result = (ClientsCount + AddedCount < MaxWorkers);
+    if (Result)
+        Added[AddedCount++] = Socket;
+    CSAdded->Leave();
+    if (Result)
+        Wake();
+    return Result;
+}
+//---------------------------------------------------------------------------
+void TMsgPoolThread::Wake()
+{
+    char c = 0;
+    // A full pipe already wakes the thread
+    if (WakePipe[1] >= 0 && write(WakePipe[1], &c, 1) < 0)
+        return;
+}
+//---------------------------------------------------------------------------
+void TMsgPoolThread::TakeAdded()
+{
+    CSAdded->Enter();
+    for (int c = 0; c < AddedCount; c++)
+        Clients[ClientsCount++] = Added[c];
+    AddedCount = 0;
+    CSAdded->Leave();
+}
+//---------------------------------------------------------------------------
+void TMsgPoolThread::Remove(int Index, longword Code)
+{
+    PWorkerSocket Socket = Clients[Index];
+    if (!FServer->Destroying)
+        FServer->DoEvent(Socket->ClientHandle, Code, 0, 0, 0, 0, 0);
+    delete Socket;
+    Clients[Index] = Clients[--ClientsCount];
+    FServer->PoolDelete();
+}
+//---------------------------------------------------------------------------
+void TMsgPoolThread::Execute()
+{
+    pollfd *Fds = new pollfd[MaxWorkers + 1];
+    char Drain[64];
+
+    while (!Terminated && !FServer->Destroying)
+    {
+        TakeAdded();
+        Fds[0].fd = WakePipe[0];
+        Fds[0].events = POLLIN;
+        for (int c = 0; c < ClientsCount; c++)
+        {
+            Fds[c + 1].fd = Clients[c]->Handle();
+            Fds[c + 1].events = POLLIN;
+            Fds[c + 1].revents = 0;
+        }
+
+        if (poll(Fds, ClientsCount + 1, PoolInterval) <= 0)
+            continue;
+        if (Fds[0].revents != 0)
+            while (read(WakePipe[0], Drain, sizeof(Drain)) > 0);
+
+        // Downwards, so a connection removed is replaced by one already served
+        for (int c = ClientsCount - 1; c >= 0 && !Terminated; c--)
+        {
+            bool Exception = false;
+            bool SelfClose = false;
+            if (Fds[c + 1].revents == 0)
+                continue;
+            try
+            {
+                if (!Clients[c]->Execute()) // False -> End of Activities
+                    SelfClose = true;
+            } catch (...)
+            {
+                Exception = true;
+            }
+            if (Exception)
+            {
+                Clients[c]->ForceClose();
+                Remove(c, evcClientException);
+            }
+            else
+                if (SelfClose)
+                    Remove(c, evcClientDisconnected);
+        }
+    }
+
+    TakeAdded();
+    while (ClientsCount > 0)
+        Remove(ClientsCount - 1, evcClientTerminated);
+    delete[] Fds;
+}
+#endif
 //---------------------------------------------------------------------------
 // TCP SERVER
 //---------------------------------------------------------------------------
@@ -195,6 +326,8 @@ TCustomMsgServer::TCustomMsgServer()
     ClientsCount = 0;
     LocalBind = 0;
     MaxClients = MaxWorkers;
+    PoolSize = 0;
+    PoolCount = 0;
     OnEvent = NULL;
 }
 //---------------------------------------------------------------------------
@@ -259,6 +392,70 @@ int TCustomMsgServer::StartListener()
     return Result;
 }
 //---------------------------------------------------------------------------
+void TCustomMsgServer::StartPool()
+{
+#ifndef OS_WINDOWS
+    PoolCount = 0;
+    while (PoolCount < PoolSize && PoolCount < MaxPoolThreads)
+    {
+        Pool[PoolCount] = new TMsgPoolThread(this);
+        Pool[PoolCount]->Start();
+        PoolCount++;
+    }
+#endif
+}
+//---------------------------------------------------------------------------
+void TCustomMsgServer::StopPool()
+{
+#ifndef OS_WINDOWS
+    int p;
+    for (p = 0; p < PoolCount; p++)
+    {
+        Pool[p]->Terminate();
+        Pool[p]->Wake();
+    }
+    for (p = 0; p < PoolCount; p++)
+    {
+        if (Pool[p]->WaitFor(WkTimeout) != WAIT_OBJECT_0)
+            Pool[p]->Kill();
+        delete Pool[p];
+    }
+    PoolCount = 0;
+#endif
+}
+#ifndef OS_WINDOWS
+//---------------------------------------------------------------------------
+void TCustomMsgServer::AddToPool(socket_t Sock)
+{
+    PWorkerSocket WorkerSocket;
+    PMsgPoolThread Target = Pool[0];
+    // The pool thread serving the fewest connections takes it
+    for (int p = 1; p < PoolCount; p++)
+    {
+        if (Pool[p]->ClientsCount < Target->ClientsCount)
+            Target = Pool[p];
+    }
+    WorkerSocket = CreateWorkerSocket(Sock);
+    if (Target->Add(WorkerSocket))
+    {
+        ClientsCount++;
+        DoEvent(WorkerSocket->ClientHandle, evcClientAdded, 0, 0, 0, 0, 0);
+    }
+    else
+    {
+        DoEvent(WorkerSocket->ClientHandle, evcClientNoRoom, 0, 0, 0, 0, 0);
+        delete WorkerSocket;
+    }
+}
+//---------------------------------------------------------------------------
+void TCustomMsgServer::PoolDelete()
+{
+    LockList();
+    ClientsCount--;
+    UnlockList();
+}
+#endif
+//---------------------------------------------------------------------------
 void TCustomMsgServer::TerminateAll() 
 {
     int c;
@@ -374,6 +571,14 @@ void TCustomMsgServer::Incoming(socket_t Sock)
     if (CanAccept(Sock))
     {
         LockList();
+#ifndef OS_WINDOWS
+        if (PoolCount > 0)
+        {
+            AddToPool(Sock);
+            UnlockList();
+            return;
+        }
+#endif
         // First position available in the thread buffer
         idx = FirstFree();
         if (idx >= 0)
@@ -408,9 +613,12 @@ int TCustomMsgServer::Start()
     int Result = 0;
     if (Status != SrvRunning)
     {
+        // The pool must be ready before the first connection is accepted
+        StartPool();
         Result = StartListener();
         if (Result != 0)
         {
+            StopPool();
             DoEvent(0, evcListenerCannotStart, Result, 0, 0, 0, 0);
             Status = SrvError;
         }
@@ -443,6 +651,8 @@ void TCustomMsgServer::Stop()
         // Kills the listener
         delete SockListener;
 
+        // Closes the connections of the worker pool
+        StopPool();
         // Terminate all client threads
         TerminateAll();
 
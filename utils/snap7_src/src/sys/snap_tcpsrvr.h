@@ -32,6 +32,7 @@
 
 #define MaxWorkers 1024
 #define MaxEvents  1500
+#define MaxPoolThreads 64
 
 const int SrvStopped = 0;
 const int SrvRunning = 1;
@@ -61,6 +62,7 @@ const longword errSrvCannotStart      = 0x00100000;
 
 const longword ThTimeout   = 2000; // Thread timeout
 const longword WkTimeout   = 3000; // Workers termination timeout
+const int PoolInterval     = 100;  // Pool threads check for termination every PoolInterval ms
 
 #pragma pack(1)
 
@@ -139,10 +141,44 @@ public:
 };
 typedef TMsgListenerThread *PMsgListenerThread;
 
+typedef TMsgSocket *PWorkerSocket;
+
+#ifndef OS_WINDOWS
+//---------------------------------------------------------------------------
+// POOL THREAD
+//---------------------------------------------------------------------------
+// Used instead of a worker thread per connection when the server has a
+// worker pool (PoolSize > 0). Every pool thread serves a share of the
+// connections: it waits for data on all of its sockets at once and runs the
+// worker of each socket that is ready.
+class TMsgPoolThread : public TSnapThread
+{
+private:
+        TCustomMsgServer *FServer;
+        // Critical section to lock the connections handed over by the listener
+        PSnapCriticalSection CSAdded;
+        PWorkerSocket Added[MaxWorkers];
+        int AddedCount;
+        PWorkerSocket Clients[MaxWorkers];
+        // Written to wake up the thread when a connection is added or on stop
+        int WakePipe[2];
+        void TakeAdded();
+        void Remove(int Index, longword Code);
+public:
+        // Connections served, read by the server to balance the pool
+        int ClientsCount;
+        TMsgPoolThread(TCustomMsgServer *Server);
+        ~TMsgPoolThread();
+        bool Add(PWorkerSocket Socket);
+        void Wake();
+        void Execute();
+};
+typedef TMsgPoolThread *PMsgPoolThread;
+#endif
+
 //---------------------------------------------------------------------------
 // TCP SERVER
 //---------------------------------------------------------------------------
-typedef TMsgSocket *PWorkerSocket;
 
 class TCustomMsgServer
 {
@@ -160,8 +196,17 @@ private:
         // Callback related
         pfn_SrvCallBack OnEvent;
         void *FUsrPtr;
+#ifndef OS_WINDOWS
+        // Worker pool
+        PMsgPoolThread Pool[MaxPoolThreads];
+        void AddToPool(socket_t Sock);
+        void PoolDelete();
+#endif
+        int PoolCount;
         // private methods
         int StartListener();
+        void StartPool();
+        void StopPool();
         void LockList();
         void UnlockList();
         int FirstFree();
@@ -190,6 +235,9 @@ protected:
 public:
         friend class TMsgWorkerThread;
         friend class TMsgListenerThread;
+#ifndef OS_WINDOWS
+        friend class TMsgPoolThread;
+#endif
         word LocalPort;
         longword LocalBind;
         longword LogMask;
@@ -197,6 +245,9 @@ public:
         int Status;
         int ClientsCount;
         int MaxClients;
+        // Threads serving all the connections, 0 for a thread per connection.
+        // Can be changed only while the server is stopped
+        int PoolSize;
         TCustomMsgServer();
         virtual ~TCustomMsgServer();
         // Starts the server
@@ -28,6 +28,10 @@
 |                                                                              |
 |=============================================================================*/
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <atomic>
 #include "oplc_snap7.h"
 #include "ladder.h"
 
@@ -750,500 +754,431 @@ bool TS7Partner::Linked()
 
 TS7Server *Server = NULL;
 bool s7Inited = false;
-#define MAX_S7IO BUFFER_SIZE*8
+bool s7Running = false;
+bool s7FullRefresh = true;
 #define MK_SIZE 16   
+#define S7_WRITE_CHUNK 64
+#define S7_EVENT_QUEUE 256          // Must be a power of two
+#define S7_EVENT_INTERVAL 100       // ms between two drains of the event queue
 
-typedef uint8_t* pByteArray[];
-typedef uint16_t* pWordArray[];
-typedef uint32_t* pDWordArray[];
+// Events handled by default: the server start/stop and the client
+// connections. Data writes are always added, the image needs them
+#define S7_DEFAULT_EVENT_MASK (evcServerStarted | evcServerStopped | evcListenerCannotStart | \
+                               evcClientAdded | evcClientRejected | evcClientNoRoom | evcClientException | \
+                               evcClientDisconnected | evcClientTerminated | evcClientsDropped)
 
-IEC_BOOL DI[MAX_S7IO];
-IEC_BOOL DQ[MAX_S7IO];
-IEC_UINT DB2[BUFFER_SIZE];
-IEC_UINT DB102[BUFFER_SIZE];
-IEC_UINT DB1002[BUFFER_SIZE];
-IEC_UDINT DB1004[BUFFER_SIZE];
-IEC_ULINT DB1008[BUFFER_SIZE];
-
-// Sometime WinCC request the access to low merkers. I guess to check if this 
-// is a Siemens real hardware or for watchdog purpose, since Merkers exist 
-// in *every* CPU even if it's empty.
-IEC_BYTE MK[MK_SIZE];
+// Shadow areas, used to index s7ForceVersion
+#define S7_SHADOW_PE     0
+#define S7_SHADOW_PA     1
+#define S7_SHADOW_DB2    2
+#define S7_SHADOW_DB102  3
+#define S7_SHADOW_DB1002 4
+#define S7_SHADOW_DB1004 5
+#define S7_SHADOW_AREAS  6
 
 //------------------------------------------------------------------------------
-// Returns the byte size of given Siemens WordLength
+// Shared resources.
 //------------------------------------------------------------------------------
-int DataSizeByte(int WordLength)
-{
-    switch (WordLength) {
-    case S7WLBit: return 1;  // S7 sends 1 byte per bit
-    case S7WLByte: return 1;
-    case S7WLChar: return 1;
-    case S7WLWord: return 2;
-    case S7WLDWord: return 4;
-    case S7WLInt: return 2;
-    case S7WLDInt: return 4;
-    case S7WLReal: return 4;
-    case S7WLCounter: return 2;
-    case S7WLTimer: return 2;
-    default: return 0;
-    }
-}
-//------------------------------------------------------------------------------
-// Events callback: it's fired after the completion of a S7 transaction or 
-// after a system operation.
-// Srv_EventText supplies a good enough default description, if you want to
-// customise it have a look at Snap7 Reference Manual pag.45
-//------------------------------------------------------------------------------
-void S7API EventCallBack(void* usrPtr, PSrvEvent PEvent, int Size)
-{
-    char s7text[512];
-    char log_msg[1000];
-    // log the event
-    Srv_EventText(PEvent, s7text, sizeof(s7text));
-    sprintf(log_msg, "Snap7: %s\n", s7text);
-    openplc_log(log_msg);
-};
-
-//------------------------------------------------------------------------------
-// Map unused vars.
-//------------------------------------------------------------------------------
-// The S7 driver cannot work on the holed memory, this would cause problems
-// for the client (HMI) that could drop access to the entire resource.
-// So we allocate everything left over from GlueVars and the modbus driver.
+// The S7 areas are registered straight on the server (RegisterArea) so that
+// clients read and write them without any callback. They are a shadow of the
+// OpenPLC image in S7 (big endian) byte order, refreshed once per scan by the
+// scan thread:
+//
+//   PE     -> %IX (one byte per 8 inputs)
+//   PA     -> %QX (one byte per 8 outputs)
+//   DB2    -> %IW
+//   DB102  -> %QW
+//   DB1002 -> %MW
+//   DB1004 -> %MD
 //
-// It might seem like a waste of memory to allocate a buffer for I / O since we 
-// know that modbus already did it. But in a modularity perspective we cannot 
-// tie ourselves to other drivers. If one day it is decided to make everything
-// modular, the S7 driver must be able to continue to function autonomously.
+// The refresh only rewrites the values that changed since the previous scan,
+// so a value written by a client stays on the shadow until the write queued
+// for it is applied by the scan thread. An area written by a client is then
+// refreshed in full once, in case the program did not keep the new value.
 //------------------------------------------------------------------------------
-void s7mapUnusedVars()
-{
-    // Clears memory
-    memset(&DI, 0, sizeof(DI));             // %DI
-    memset(&DQ, 0, sizeof(DQ));             // %DQ
-    memset(&DB2, 0, sizeof(DB2));           // %IW
-    memset(&DB102, 0, sizeof(DB102));       // %QW
-    memset(&DB1002, 0, sizeof(DB1002));     // %MW 
-    memset(&DB1004, 0, sizeof(DB1004));     // %MD
-    
-    memset(&MK, 0, sizeof(MK));             // Internal
-
-    for (int c = 0; c < MAX_S7IO; c++)
-        if (bool_input[c / 8][c % 8] == NULL) bool_input[c / 8][c % 8] = &DI[c];
+byte S7_PE[BUFFER_SIZE];
+byte S7_PA[BUFFER_SIZE];
+byte S7_DB2[BUFFER_SIZE * 2];
+byte S7_DB102[BUFFER_SIZE * 2];
+byte S7_DB1002[BUFFER_SIZE * 2];
+byte S7_DB1004[BUFFER_SIZE * 4];
 
-    for (int c = 0; c < MAX_S7IO; c++)
-        if (bool_output[c / 8][c % 8] == NULL) bool_output[c / 8][c % 8] = &DQ[c];
+// Values converted on the last refresh, used to find what changed
+IEC_BOOL last_bool_input[BUFFER_SIZE][8];
+IEC_BOOL last_bool_output[BUFFER_SIZE][8];
+IEC_UINT last_int_input[BUFFER_SIZE];
+IEC_UINT last_int_output[BUFFER_SIZE];
+IEC_UINT last_int_memory[BUFFER_SIZE];
+IEC_UDINT last_dint_memory[BUFFER_SIZE];
 
-    for (int c = 0; c < BUFFER_SIZE; c++)
-        if (int_input[c] == NULL) int_input[c] = &DB2[c];
-    for (int c = 0; c < BUFFER_SIZE; c++)
-        if (int_output[c] == NULL) int_output[c] = &DB102[c];
+// Process image version from which a shadow area must be refreshed in full.
+// Zero means that no refresh is pending
+uint32_t s7ForceVersion[S7_SHADOW_AREAS];
 
-    for (int c = 0; c < BUFFER_SIZE; c++)
-        if (int_memory[c] == NULL) int_memory[c] = &DB1002[c];
-    for (int c = 0; c < BUFFER_SIZE; c++)
-        if (dint_memory[c] == NULL) dint_memory[c] = &DB1004[c];
-}
-//------------------------------------------------------------------------------
-// Data access functions
-//------------------------------------------------------------------------------
-int getBytesFromByteArray(pByteArray byteArray, int Start, int Size, pbyte pUsrData)
-{
-    if (Start + Size >= BUFFER_SIZE)
-        return _s7error;
+// Process image version of the last refresh of the shadow areas
+uint32_t s7RefreshedVersion = 0;
 
-    for (int c = 0; c < Size; c++)
-        *(pUsrData + c) = *byteArray[Start + c];
+// Sometime WinCC request the access to low merkers. I guess to check if this 
+// is a Siemens real hardware or for watchdog purpose, since Merkers exist 
+// in *every* CPU even if it's empty.
+IEC_BYTE MK[MK_SIZE];
 
-    return _s7ok;
-}
 //------------------------------------------------------------------------------
-int putBytesToByteArray(pByteArray byteArray, int Start, int Size, pbyte pUsrData)
-{
-    if (Start + Size >= BUFFER_SIZE)
-        return _s7error;
-
-    for (int c = 0; c < Size; c++)
-        *byteArray[Start + c] = *(pUsrData + c);
-
-    return _s7ok;
-}
+// Writes the boolean image into a shadow area, one byte per 8 booleans. Only
+// the bytes whose booleans changed since the last refresh are rewritten, and
+// only those on the blocks of the process image that the scan changed
+// (Offset is where the image is on ProcessImageSnapshot) are compared
 //------------------------------------------------------------------------------
-int getBytesFromWordArray(pWordArray wordArray, int Start, int Size, pbyte pUsrData)
+void refreshBoolArea(int AreaCode, IEC_BOOL image[][8], IEC_BOOL last[][8], pbyte Shadow, bool Full,
+                     const ProcessImageChanges *Changes, size_t Offset)
 {
-    int WordStart = Start / 2;
-    int WordAmount = Size / 2;
-    uint16_t MyWord = NULL;
-    int idx = 0;
-
-    if (WordStart + WordAmount >= BUFFER_SIZE)
-        return _s7error;
-
-    for (int c = 0; c < WordAmount; c++)
+    Server->LockArea(AreaCode, 0);
+    for (int x = 0; x < BUFFER_SIZE; x++)
     {
-        MyWord = *wordArray[WordStart + c];
-        *(pUsrData + idx++) = (MyWord >> 8) & 0xFF;
-        *(pUsrData + idx++) = MyWord & 0xFF;
-    }
-
-    return _s7ok;
-}
-//------------------------------------------------------------------------------
-int putBytesToWordArray(pWordArray wordArray, int Start, int Size, pbyte pUsrData)
-{
-    int WordStart = Start / 2;
-    int WordAmount = Size / 2;
-    uint16_t WL, WH;
-    int idx = 0;
-
-    if (WordStart + WordAmount >= BUFFER_SIZE)
-        return _s7error;
+        if (!Full && !processImageChanged(Changes, Offset + x * 8, 8))
+            continue;
+        if (!Full && memcmp(image[x], last[x], 8) == 0)
+            continue;
 
-    for (int c = 0; c < WordAmount; c++)
-    {
-        WH = *(pUsrData + idx++);
-        WL = *(pUsrData + idx++);
-        *wordArray[WordStart + c] = (WH << 8) | WL;
+        byte Value = 0;
+        for (int c = 0; c < 8; c++)
+            if (image[x][c]) Value |= (1 << c);
+        Shadow[x] = Value;
+        memcpy(last[x], image[x], 8);
     }
-
-    return _s7ok;
+    Server->UnlockArea(AreaCode, 0);
 }
 //------------------------------------------------------------------------------
-int getBytesFromDWordArray(pDWordArray dwordArray, int Start, int Size, pbyte pUsrData)
+// Writes a word image into a shadow DB in big endian order
+//------------------------------------------------------------------------------
+void refreshWordDB(word DBNumber, IEC_UINT *image, IEC_UINT *last, pbyte Shadow, bool Full,
+                   const ProcessImageChanges *Changes, size_t Offset)
 {
-    int DWordStart = Start / 4;
-    int DWordAmount = Size / 4;
-    uint32_t MyDWord;
-    int idx = 0;
-
-    if (DWordStart + DWordAmount >= BUFFER_SIZE)
-        return _s7error;
-
-    for (int c = 0; c < DWordAmount; c++)
+    Server->LockArea(srvAreaDB, DBNumber);
+    for (int c = 0; c < BUFFER_SIZE; c++)
     {
-        MyDWord = *dwordArray[DWordStart + c];
-        *(pUsrData + idx++) = (MyDWord >> 24) & 0xFF;
-        *(pUsrData + idx++) = (MyDWord >> 16) & 0xFF;
-        *(pUsrData + idx++) = (MyDWord >> 8) & 0xFF;
-        *(pUsrData + idx++) = MyDWord & 0xFF;
-    }
+        if (!Full && !processImageChanged(Changes, Offset + c * sizeof(IEC_UINT), sizeof(IEC_UINT)))
+            continue;
+        if (!Full && image[c] == last[c])
+            continue;
 
-    return _s7ok;
+        Shadow[c * 2] = (image[c] >> 8) & 0xFF;
+        Shadow[c * 2 + 1] = image[c] & 0xFF;
+        last[c] = image[c];
+    }
+    Server->UnlockArea(srvAreaDB, DBNumber);
 }
 //------------------------------------------------------------------------------
-int putBytesToDWordArray(pDWordArray dwordArray, int Start, int Size, pbyte pUsrData)
+// Writes a double word image into a shadow DB in big endian order
+//------------------------------------------------------------------------------
+void refreshDWordDB(word DBNumber, IEC_UDINT *image, IEC_UDINT *last, pbyte Shadow, bool Full,
+                    const ProcessImageChanges *Changes, size_t Offset)
 {
-    int DWordStart = Start / 4;
-    int DWordAmount = Size / 4;
-    int idx = 0;
-    uint32_t DW3, DW2, DW1, DW0;
-
-    if (DWordStart + DWordAmount >= BUFFER_SIZE)
-        return _s7error;
-
-    for (int c = 0; c < DWordAmount; c++)
+    Server->LockArea(srvAreaDB, DBNumber);
+    for (int c = 0; c < BUFFER_SIZE; c++)
     {
-        DW0 = *(pUsrData + idx++);
-        DW1 = *(pUsrData + idx++);
-        DW2 = *(pUsrData + idx++);
-        DW3 = *(pUsrData + idx++);
+        if (!Full && !processImageChanged(Changes, Offset + c * sizeof(IEC_UDINT), sizeof(IEC_UDINT)))
+            continue;
+        if (!Full && image[c] == last[c])
+            continue;
 
-        *dwordArray[DWordStart + c] = (DW0 << 24) | (DW1 << 16) | (DW2 << 8) | DW3;
+        Shadow[c * 4] = (image[c] >> 24) & 0xFF;
+        Shadow[c * 4 + 1] = (image[c] >> 16) & 0xFF;
+        Shadow[c * 4 + 2] = (image[c] >> 8) & 0xFF;
+        Shadow[c * 4 + 3] = image[c] & 0xFF;
+        last[c] = image[c];
     }
-
-    return _s7ok;
+    Server->UnlockArea(srvAreaDB, DBNumber);
 }
 //------------------------------------------------------------------------------
-int getBitFromWordArray(pWordArray wordArray, int bitStart, pbyte pUsrData)
-{
-    uint16_t mask[16] = { 0x0001, 0x0002, 0x0004, 0x0008, 0x0010, 0x0020, 0x0040, 0x0080,
-                          0x0100, 0x0200, 0x0400, 0x0800, 0x1000, 0x2000, 0x4000, 0x8000 };
-
-    int WordIndex = bitStart / 16;
-    int BitIndex  = bitStart % 16;
-
-    if (WordIndex >= BUFFER_SIZE)
-        return _s7error;
-    
-    *pUsrData = (*wordArray[WordIndex] & mask[BitIndex]) != 0 ? 1 : 0;
-     
-    return _s7ok;
-}
+// Returns true if a shadow area must be refreshed in full on this scan
 //------------------------------------------------------------------------------
-int putBitToWordArray(pWordArray wordArray, int bitStart, pbyte pUsrData)
+bool fullRefreshDue(int Shadow, uint32_t Version)
 {
-    uint16_t mask[16] = { 0x0001, 0x0002, 0x0004, 0x0008, 0x0010, 0x0020, 0x0040, 0x0080,
-                          0x0100, 0x0200, 0x0400, 0x0800, 0x1000, 0x2000, 0x4000, 0x8000 };
-
-    int WordIndex = bitStart / 16;
-    int BitIndex = bitStart % 16;
-
-    if (WordIndex >= BUFFER_SIZE)
-        return _s7error;
-
-    if (*pUsrData != 0)
-        *wordArray[WordIndex] = *wordArray[WordIndex] | mask[BitIndex];
-    else
-        *wordArray[WordIndex] = *wordArray[WordIndex] & ~mask[BitIndex];
+    uint32_t Due = __atomic_load_n(&s7ForceVersion[Shadow], __ATOMIC_ACQUIRE);
+    if (Due == 0 || (int32_t)(Version - Due) < 0)
+        return false;
 
-    return _s7ok;
+    // A client write that pushed the version further is left pending
+    __atomic_compare_exchange_n(&s7ForceVersion[Shadow], &Due, 0, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    return true;
 }
 //------------------------------------------------------------------------------
-int getBitFromDWordArray(pDWordArray dwordArray, int bitStart, pbyte pUsrData)
-{
-    uint32_t mask[32] = { 0x00000001, 0x00000002, 0x00000004, 0x00000008, 0x00000010, 0x00000020, 0x00000040, 0x00000080,
-                          0x00000100, 0x00000200, 0x00000400, 0x00000800, 0x00001000, 0x00002000, 0x00004000, 0x00008000,
-                          0x00010000, 0x00020000, 0x00040000, 0x00080000, 0x00100000, 0x00200000, 0x00400000, 0x00800000,
-                          0x01000000, 0x02000000, 0x04000000, 0x08000000, 0x10000000, 0x20000000, 0x40000000, 0x80000000 };
-
-    int DWordIndex = bitStart / 32;
-    int BitIndex = bitStart % 32;
-
-    if (DWordIndex >= BUFFER_SIZE)
-        return _s7error;
-
-    *pUsrData = (*dwordArray[DWordIndex] & mask[BitIndex]) != 0 ? 1 : 0;
-
-    return _s7ok;
-}
+// Requests a full refresh of a shadow area once the writes queued so far are
+// applied. The version read after queueing is not published yet by a scan
+// that started after the writes were queued, so it is the one after it
 //------------------------------------------------------------------------------
-int putBitToDWordArray(pDWordArray dwordArray, int bitStart, pbyte pUsrData)
+void forceRefresh(int Shadow)
 {
-    uint32_t mask[32] = { 0x00000001, 0x00000002, 0x00000004, 0x00000008, 0x00000010, 0x00000020, 0x00000040, 0x00000080,
-                          0x00000100, 0x00000200, 0x00000400, 0x00000800, 0x00001000, 0x00002000, 0x00004000, 0x00008000,
-                          0x00010000, 0x00020000, 0x00040000, 0x00080000, 0x00100000, 0x00200000, 0x00400000, 0x00800000,
-                          0x01000000, 0x02000000, 0x04000000, 0x08000000, 0x10000000, 0x20000000, 0x40000000, 0x80000000 };
+    uint32_t Target = getProcessImageVersion() + 2;
+    if (Target == 0) Target = 1;
 
-    int DWordIndex = bitStart / 32;
-    int BitIndex = bitStart % 32;
-
-    if (DWordIndex >= BUFFER_SIZE)
-        return _s7error;
-
-    if (*pUsrData != 0)
-        *dwordArray[DWordIndex] = *dwordArray[DWordIndex] | mask[BitIndex];
-    else
-        *dwordArray[DWordIndex] = *dwordArray[DWordIndex] & ~mask[BitIndex];
-
-    return _s7ok;
-}
-//------------------------------------------------------------------------------
-int getMerker(PS7Tag PTag, pbyte pUsrData)
-{
-    int Start;
-    uint8_t mask[8] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80 };
-    if (PTag->WordLen == S7WLBit)
+    uint32_t Due = __atomic_load_n(&s7ForceVersion[Shadow], __ATOMIC_RELAXED);
+    while (Due == 0 || (int32_t)(Target - Due) > 0)
     {
-        Start = PTag->Start / 8;
-        if (Start >= MK_SIZE)
-            return _s7error;
-        *pUsrData = (MK[Start] & mask[PTag->Start % 8]) != 0 ? 1 : 0;
-    }
-    else {
-        if (PTag->Start >= MK_SIZE)
-            return _s7error;
-        *pUsrData = MK[PTag->Start];
+        if (__atomic_compare_exchange_n(&s7ForceVersion[Shadow], &Due, Target, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            break;
     }
-    return _s7ok;
 }
 //------------------------------------------------------------------------------
-int putMerker(PS7Tag PTag, pbyte pUsrData)
-{
-    int Start;
-    uint8_t mask[8] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80 };
-    if (PTag->WordLen == S7WLBit)
-    {
-        Start = PTag->Start / 8;
-        if (Start >= MK_SIZE)
-            return _s7error;
-        if (*pUsrData != 0)
-            MK[Start] = MK[Start] | mask[PTag->Start % 8];
-        else
-            MK[Start] = MK[Start] & ~mask[PTag->Start % 8];
-    }
-    else {
-        if (PTag->Start >= MK_SIZE)
-            return _s7error;
-        MK[PTag->Start] = *pUsrData;
-    }
-    return _s7ok;
-}
+// Refreshes the shadow areas from the OpenPLC image. Must be called by the
+// scan thread with bufferLock held, after the program logic has executed
 //------------------------------------------------------------------------------
-int getIOBit(bool isInput, int bitStart, pbyte pUsrData)
+void updateSnap7Image()
 {
-    uint16_t byteStart = bitStart / 8;
-    if (byteStart >= BUFFER_SIZE)
-        return _s7error;
+    if (!s7Inited || !__atomic_load_n(&s7Running, __ATOMIC_ACQUIRE))
+        return;
+
+    bool Full = __atomic_exchange_n(&s7FullRefresh, false, __ATOMIC_ACQ_REL);
+    uint32_t Version = getProcessImageVersion();
 
-    *pUsrData = isInput ? *bool_input[byteStart][bitStart % 8] : *bool_output[byteStart][bitStart % 8];
+    // The image was just published, so the changes since the last refresh
+    // tell which parts of it can be skipped
+    ProcessImageChanges Changes;
+    getProcessImageChanges(s7RefreshedVersion, Version, &Changes);
+    s7RefreshedVersion = Version;
 
-    return _s7ok;
+    refreshBoolArea(srvAreaPE, bool_input_image, last_bool_input, S7_PE,
+                    fullRefreshDue(S7_SHADOW_PE, Version) || Full,
+                    &Changes, offsetof(ProcessImageSnapshot, bool_input));
+    refreshBoolArea(srvAreaPA, bool_output_image, last_bool_output, S7_PA,
+                    fullRefreshDue(S7_SHADOW_PA, Version) || Full,
+                    &Changes, offsetof(ProcessImageSnapshot, bool_output));
+    refreshWordDB(2, int_input_image, last_int_input, S7_DB2,
+                  fullRefreshDue(S7_SHADOW_DB2, Version) || Full,
+                  &Changes, offsetof(ProcessImageSnapshot, int_input));
+    refreshWordDB(102, int_output_image, last_int_output, S7_DB102,
+                  fullRefreshDue(S7_SHADOW_DB102, Version) || Full,
+                  &Changes, offsetof(ProcessImageSnapshot, int_output));
+    refreshWordDB(1002, int_memory_image, last_int_memory, S7_DB1002,
+                  fullRefreshDue(S7_SHADOW_DB1002, Version) || Full,
+                  &Changes, offsetof(ProcessImageSnapshot, int_memory));
+    refreshDWordDB(1004, dint_memory_image, last_dint_memory, S7_DB1004,
+                   fullRefreshDue(S7_SHADOW_DB1004, Version) || Full,
+                   &Changes, offsetof(ProcessImageSnapshot, dint_memory));
 }
 //------------------------------------------------------------------------------
-int putIOBit(bool isInput, int bitStart, pbyte pUsrData)
+// Queues a group of writes, logging it if the queue is full. The client has
+// already got its answer at this point, so the write can only be dropped
+//------------------------------------------------------------------------------
+void flushS7Writes(ProcessImageWrite *writes, int count)
 {
-    int byteStart = bitStart / 8;
-    if (byteStart >= BUFFER_SIZE)
-        return _s7error;
-
-    if (isInput)
-        *bool_input[byteStart][bitStart % 8] = *pUsrData != 0 ? 1 : 0;
-    else
-        *bool_output[byteStart][bitStart % 8] = *pUsrData != 0 ? 1 : 0;
-
-    return _s7ok;
+    if (count > 0 && queueProcessImageWrites(writes, count) < 0)
+        openplc_log((char *)"Snap7: write queue is full, client write dropped\n");
 }
 //------------------------------------------------------------------------------
-int getIOBytes(bool isInput, int Start, int Size, pbyte pUsrData)
+// Queues the writes for a byte range of a shadow boolean area
+//------------------------------------------------------------------------------
+void queueBoolWrites(int AreaCode, uint8_t ImageArea, pbyte Shadow, int Start, int Size)
 {
-    uint8_t mask[8] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80 };
-
-    if (Start + Size >= BUFFER_SIZE)
-        return _s7error;
+    ProcessImageWrite writes[S7_WRITE_CHUNK * 8];
+    int count = 0;
 
-    for (int x = 0; x < Size; x++)
+    Server->LockArea(AreaCode, 0);
+    for (int x = Start; x < Start + Size && x < BUFFER_SIZE; x++)
     {
-        *(pUsrData + x) = 0;
         for (int c = 0; c < 8; c++)
         {
-            if (isInput)
-            {
-                if (*bool_input[Start + x][c]) *(pUsrData + x) |= mask[c];
-            }
-            else {
-                if (*bool_output[Start + x][c]) *(pUsrData + x) |= mask[c];
-            }
+            writes[count].area = ImageArea;
+            writes[count].bit = c;
+            writes[count].index = x;
+            writes[count].value = (Shadow[x] >> c) & 0x01;
+            writes[count].mask = 1;
+            count++;
+        }
+        if (count == S7_WRITE_CHUNK * 8)
+        {
+            flushS7Writes(writes, count);
+            count = 0;
         }
     }
-    return _s7ok;
+    Server->UnlockArea(AreaCode, 0);
+
+    flushS7Writes(writes, count);
 }
 //------------------------------------------------------------------------------
-int putIOBytes(bool isInput, int Start, int Size, pbyte pUsrData)
+// Queues the writes for a byte range of a shadow DB holding values of
+// ElementSize bytes. Elements written only in part are masked so that the
+// bytes the client did not touch are left alone
+//------------------------------------------------------------------------------
+void queueDBWrites(word DBNumber, uint8_t ImageArea, int ElementSize, pbyte Shadow, int Start, int Size)
 {
-    uint8_t mask[8] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80 };
+    ProcessImageWrite writes[S7_WRITE_CHUNK];
+    int count = 0;
+    int End = Start + Size;
+    if (End > BUFFER_SIZE * ElementSize)
+        End = BUFFER_SIZE * ElementSize;
 
-    if (Start + Size >= BUFFER_SIZE)
-        return _s7error;
-
-    for (int x = 0; x < Size; x++)
+    Server->LockArea(srvAreaDB, DBNumber);
+    for (int Element = Start / ElementSize; Element * ElementSize < End; Element++)
     {
-        for (int c = 0; c < 8; c++)
+        uint64_t Value = 0;
+        uint64_t Mask = 0;
+        for (int b = 0; b < ElementSize; b++)
         {
-            if (isInput)
-                *bool_input[Start + x][c] = *(pUsrData + x) & mask[c] ? 1 : 0;
-            else
-                *bool_output[Start + x][c] = *(pUsrData + x) & mask[c] ? 1 : 0;
+            int Offset = Element * ElementSize + b;
+            int Shift = (ElementSize - 1 - b) * 8;
+            Value |= (uint64_t)Shadow[Offset] << Shift;
+            if (Offset >= Start && Offset < End)
+                Mask |= (uint64_t)0xFF << Shift;
+        }
+
+        writes[count].area = ImageArea;
+        writes[count].bit = 0;
+        writes[count].index = Element;
+        writes[count].value = Value;
+        writes[count].mask = Mask;
+        if (++count == S7_WRITE_CHUNK)
+        {
+            flushS7Writes(writes, count);
+            count = 0;
         }
     }
-    return _s7ok;
+    Server->UnlockArea(srvAreaDB, DBNumber);
+
+    flushS7Writes(writes, count);
 }
 //------------------------------------------------------------------------------
-// Read/Write callback
+// Translates a completed client write into writes on the OpenPLC image
 //------------------------------------------------------------------------------
-// Data R/W callback: it's fired during(*) a S7 transaction
-//
-// (*) Warning, performing operations that take too long (such as accessing 
-//     disk or other slow devices) may cause the client to time out.
-//     Memory to memory operations are OK.
-// 
-// usrPtr : user pointer, used to contain an the object reference if an OOP 
-//          pattern is used (i.e. to share the "C" callback across classes).
-//          Here it's NULL.
-//
-// Sender : IP Address of the client (to be used with inet_ntoa() if needed).
-//
-// Operation: OperationRead or OperationWrite
-// 
-// PTag : Pointer to the Tag info (see definition in oplc_snap7.h)
-// 
-// pUsrData : Snap7 Server internal buffer.
-// 
-// Note : for each transaction the maximum data size is that of the negotiated 
-//        Siemens PDU which can be max 480 bytes. 
-//------------------------------------------------------------------------------
-int S7API RWAreaCallBack(void* usrPtr, int Sender, int Operation, PS7Tag PTag, void* pUsrData)
+void queueClientWrite(PSrvEvent PEvent)
 {
-    int Size = DataSizeByte(PTag->WordLen) * PTag->Elements;
-    if (Size == 0 || PTag->WordLen == S7WLCounter || PTag->WordLen == S7WLTimer) // Wrong WordLen or Elements = 0 
-        return _s7error;
-
-    bool DoRead = Operation == OperationRead;
-    int Result = _s7ok;
-
-    // Lock buffer
-    pthread_mutex_lock(&bufferLock);
+    int Start = PEvent->EvtParam3;
+    int Size = PEvent->EvtParam4;
 
-    switch (PTag->Area)
+    switch (PEvent->EvtParam1)
     {
     case S7AreaPE:
-    case S7AreaPA:
-        if (PTag->WordLen == S7WLBit)
-        {
-            Result = DoRead ? getIOBit(PTag->Area == S7AreaPE, PTag->Start, pbyte(pUsrData)) : putIOBit(PTag->Area == S7AreaPE, PTag->Start, pbyte(pUsrData));
-        }
-        else {
-            Result = DoRead ? getIOBytes(PTag->Area == S7AreaPE, PTag->Start, Size, pbyte(pUsrData)) : putIOBytes(PTag->Area == S7AreaPE, PTag->Start, Size, pbyte(pUsrData));
-        }
+        queueBoolWrites(srvAreaPE, PI_BOOL_INPUT, S7_PE, Start, Size);
+        forceRefresh(S7_SHADOW_PE);
         break;
-    case S7AreaMK:
-        Result = DoRead ? getMerker(PTag, pbyte(pUsrData)) : putMerker(PTag, pbyte(pUsrData));
+    case S7AreaPA:
+        queueBoolWrites(srvAreaPA, PI_BOOL_OUTPUT, S7_PA, Start, Size);
+        forceRefresh(S7_SHADOW_PA);
         break;
     case S7AreaDB:
-        switch (PTag->DBNumber)
+        switch (PEvent->EvtParam2)
         {
         case 2:
-            if (PTag->WordLen == S7WLBit)
-            {
-                Result = DoRead ? getBitFromWordArray(int_input, PTag->Start, pUsrData) : putBitToWordArray(int_input, PTag->Start, pUsrData);
-            }
-            else {
-                Result = DoRead ? getBytesFromWordArray(int_input, PTag->Start, Size, pbyte(pUsrData)) :
-                    putBytesToWordArray(int_input, PTag->Start, Size, pbyte(pUsrData));
-            }
+            queueDBWrites(2, PI_INT_INPUT, 2, S7_DB2, Start, Size);
+            forceRefresh(S7_SHADOW_DB2);
             break;
         case 102:
-            if (PTag->WordLen == S7WLBit)
-            {
-                Result = DoRead ? getBitFromWordArray(int_output, PTag->Start, pUsrData) : putBitToWordArray(int_output, PTag->Start, pUsrData);
-            }
-            else {
-                Result = DoRead ? getBytesFromWordArray(int_output, PTag->Start, Size, pbyte(pUsrData)) :
-                    putBytesToWordArray(int_output, PTag->Start, Size, pbyte(pUsrData));
-            }
+            queueDBWrites(102, PI_INT_OUTPUT, 2, S7_DB102, Start, Size);
+            forceRefresh(S7_SHADOW_DB102);
             break;
         case 1002:
-            if (PTag->WordLen == S7WLBit)
-            {
-                Result = DoRead ? getBitFromWordArray(int_memory, PTag->Start, pUsrData) : putBitToWordArray(int_memory, PTag->Start, pUsrData);
-            }
-            else {
-                Result = DoRead ? getBytesFromWordArray(int_memory, PTag->Start, Size, pbyte(pUsrData)) :
-                    putBytesToWordArray(int_memory, PTag->Start, Size, pbyte(pUsrData));
-            }
+            queueDBWrites(1002, PI_INT_MEMORY, 2, S7_DB1002, Start, Size);
+            forceRefresh(S7_SHADOW_DB1002);
             break;
         case 1004:
-            if (PTag->WordLen == S7WLBit)
-            {
-                Result = DoRead ? getBitFromDWordArray(dint_memory, PTag->Start, pUsrData) : putBitToDWordArray(dint_memory, PTag->Start, pUsrData);
-            }
-            else {
-                Result = DoRead ? getBytesFromDWordArray(dint_memory, PTag->Start, Size, pbyte(pUsrData)) :
-                    putBytesToDWordArray(dint_memory, PTag->Start, Size, pbyte(pUsrData));
-            }
+            queueDBWrites(1004, PI_DINT_MEMORY, 4, S7_DB1004, Start, Size);
+            forceRefresh(S7_SHADOW_DB1004);
             break;
-        default: // Illegal DB Number
-            Result = _s7error;
         }
         break;
-    default: // Unknown or unsupported Area 
-        Result = _s7error;
+    default: // MK is not part of the image
+        break;
+    }
+}
+//------------------------------------------------------------------------------
+// Events waiting for the event thread. Snap7 calls EventCallBack with its
+// event lock held, so there is never more than one producer at a time, and
+// the event thread is the only consumer. A full queue drops the event
+//------------------------------------------------------------------------------
+static TSrvEvent s7Events[S7_EVENT_QUEUE];
+static std::atomic<uint32_t> s7EventHead(0);
+static std::atomic<uint32_t> s7EventTail(0);
+static std::atomic<uint32_t> s7EventsDropped(0);
+static longword s7EventMask = S7_DEFAULT_EVENT_MASK;
+static pthread_t s7EventThread;
+static volatile bool s7EventThreadRunning = false;
+
+//------------------------------------------------------------------------------
+// Events callback: it's fired after the completion of a S7 transaction or 
+// after a system operation, on the worker thread of the client.
+//
+// A data write carries the area, start and size of a client write that must
+// be forwarded to the OpenPLC image while the shadow still holds it, so it is
+// handled here. Data reads (only when event_mask asks for them) are counted
+// for the metrics exporter. Every other event is queued for the event thread,
+// the worker doesn't format nor log anything.
+//------------------------------------------------------------------------------
+void S7API EventCallBack(void* usrPtr, PSrvEvent PEvent, int Size)
+{
+    if (PEvent->EvtCode == evcDataWrite)
+    {
+        recordProtocolRequest(S7_PROTOCOL, PEvent->EvtRetCode != evrNoError);
+        if (PEvent->EvtRetCode == evrNoError)
+            queueClientWrite(PEvent);
+        return;
+    }
+    if (PEvent->EvtCode == evcDataRead)
+    {
+        recordProtocolRequest(S7_PROTOCOL, PEvent->EvtRetCode != evrNoError);
+        return;
+    }
+
+    uint32_t head = s7EventHead.load(std::memory_order_relaxed);
+    if (head - s7EventTail.load(std::memory_order_acquire) >= S7_EVENT_QUEUE)
+    {
+        s7EventsDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
     }
-    // Unlock buffer
-    pthread_mutex_unlock(&bufferLock);
+    s7Events[head & (S7_EVENT_QUEUE - 1)] = *PEvent;
+    s7EventHead.store(head + 1, std::memory_order_release);
+};
+
+//------------------------------------------------------------------------------
+// Counts and logs the queued events.
+// Srv_EventText supplies a good enough default description, if you want to
+// customise it have a look at Snap7 Reference Manual pag.45
+//------------------------------------------------------------------------------
+static void drainSnap7Events()
+{
+    char s7text[512];
+    char log_msg[1000];
+
+    uint32_t tail = s7EventTail.load(std::memory_order_relaxed);
+    while (tail != s7EventHead.load(std::memory_order_acquire))
+    {
+        TSrvEvent Event = s7Events[tail & (S7_EVENT_QUEUE - 1)];
+        s7EventTail.store(++tail, std::memory_order_release);
 
-    return Result;
+        if (Event.EvtCode == evcClientAdded)
+            recordProtocolConnection(S7_PROTOCOL, true);
+        else if (Event.EvtCode == evcClientDisconnected || Event.EvtCode == evcClientTerminated || Event.EvtCode == evcClientException)
+            recordProtocolConnection(S7_PROTOCOL, false);
+
+        Srv_EventText(&Event, s7text, sizeof(s7text));
+        sprintf(log_msg, "Snap7: %s\n", s7text);
+        openplc_log(log_msg);
+    }
+
+    uint32_t dropped = s7EventsDropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0)
+    {
+        sprintf(log_msg, "Snap7: event queue full, %u events were dropped\n", dropped);
+        openplc_log(log_msg);
+    }
 }
+
+//------------------------------------------------------------------------------
+// Low priority thread handling the events queued by EventCallBack
+//------------------------------------------------------------------------------
+static void *snap7EventThread(void *arg)
+{
+    setThreadClass(THREAD_CLASS_BACKGROUND, "snap7_events");
+
+    while (s7EventThreadRunning)
+    {
+        drainSnap7Events();
+        sleepms(S7_EVENT_INTERVAL);
+    }
+    drainSnap7Events();
+    return NULL;
+}
+
 //------------------------------------------------------------------------------
 // Snap7 Server initialization
 //------------------------------------------------------------------------------
@@ -1251,25 +1186,81 @@ void initializeSnap7()
 {
     if (!s7Inited)
     {
-        s7mapUnusedVars();
+        memset(&MK, 0, sizeof(MK));
 
         Server = new TS7Server;
-        // With the next function we can limit the events to start/stop/client added etc.
-        // For a deep debug comment the line
-        Server->SetEventsMask(0x3ff);
+        // The events the callback gets are set from snap7.cfg when the
+        // server starts (event_mask). Snap7 also keeps every event on a log
+        // queue of its own, which nobody reads here
+        Server->SetEventsMask(S7_DEFAULT_EVENT_MASK | evcDataWrite);
+        Server->SetLogMask(0);
         // Set the Server events callback
         Server->SetEventsCallback(EventCallBack, NULL);
+        s7EventThreadRunning = true;
+        if (pthread_create(&s7EventThread, NULL, snap7EventThread, NULL) != 0)
+            s7EventThreadRunning = false;
 
         // Shared resources:
-        // We cannot directly share OpenPLC internal buffers, because:
-        // 1 - They are array of pointers to vars
-        // 2 - The access would be not synchronized (i.e. not consistent)
-        // So, we will use a callback and, inside it, we will perform a synchronized data transfer.
-        Server->SetRWAreaCallback(RWAreaCallBack, NULL);
+        // The OpenPLC buffers are arrays of pointers to vars, so the server
+        // shares the byte-swapped shadow areas refreshed by updateSnap7Image()
+        Server->RegisterArea(srvAreaPE, 0, &S7_PE, sizeof(S7_PE));
+        Server->RegisterArea(srvAreaPA, 0, &S7_PA, sizeof(S7_PA));
+        Server->RegisterArea(srvAreaMK, 0, &MK, sizeof(MK));
+        Server->RegisterArea(srvAreaDB, 2, &S7_DB2, sizeof(S7_DB2));
+        Server->RegisterArea(srvAreaDB, 102, &S7_DB102, sizeof(S7_DB102));
+        Server->RegisterArea(srvAreaDB, 1002, &S7_DB1002, sizeof(S7_DB1002));
+        Server->RegisterArea(srvAreaDB, 1004, &S7_DB1004, sizeof(S7_DB1004));
         s7Inited = true;
     }
  }
 
+//------------------------------------------------------------------------------
+// Reads snap7.cfg, which holds "key = value" lines:
+//     worker_pool = 4      threads serving all the clients, 0 (default) for
+//                          a thread per client
+//     max_clients = 1024   clients served at once
+//     event_mask = 0x3ff   Snap7 events (evc*) logged, the data reads are
+//                          counted instead. Data writes are always handled
+// A missing file keeps the library defaults and the connection events
+//------------------------------------------------------------------------------
+void loadSnap7Config()
+{
+    char line[256];
+    char log_msg[1000];
+    s7EventMask = S7_DEFAULT_EVENT_MASK;
+    FILE *f = fopen("snap7.cfg", "r");
+    if (f != NULL)
+    {
+        while (fgets(line, sizeof(line), f) != NULL)
+        {
+            char key[64];
+            char text[64];
+            if (line[0] == '#' || sscanf(line, " %63[a-z_] = %63s", key, text) != 2)
+                continue;
+
+            int value = (int)strtol(text, NULL, 0);
+            int result = -1;
+            if (strcmp(key, "worker_pool") == 0)
+                result = Server->SetParam(p_i32_WorkerPool, &value);
+            else if (strcmp(key, "max_clients") == 0)
+                result = Server->SetParam(p_i32_MaxClients, &value);
+            else if (strcmp(key, "event_mask") == 0)
+            {
+                s7EventMask = (longword)strtoul(text, NULL, 0);
+                result = 0;
+            }
+
+            if (result != 0)
+            {
+                sprintf(log_msg, "Snap7: invalid setting %s = %s in snap7.cfg\n", key, text);
+                openplc_log(log_msg);
+            }
+        }
+        fclose(f);
+    }
+    Server->SetEventsMask(s7EventMask | evcDataWrite);
+}
+
 //------------------------------------------------------------------------------
 // Snap7 Server start
 //------------------------------------------------------------------------------
@@ -1278,7 +1269,13 @@ void startSnap7()
     // Listen on S7 Port 102. 
     // If Server is already running the command will be ignored.
     if (s7Inited)
+    {
+        loadSnap7Config();
+        // The shadow areas are rebuilt on the next scan
+        __atomic_store_n(&s7FullRefresh, true, __ATOMIC_RELEASE);
+        __atomic_store_n(&s7Running, true, __ATOMIC_RELEASE);
         Server->StartTo("0.0.0.0"); // Success or fail will be logged into EventCallBack   
+    }
 }
 
 //------------------------------------------------------------------------------
@@ -1288,7 +1285,10 @@ void stopSnap7()
 {
     // If Server is already stopped the command will be ignored.
     if (s7Inited)
+    {
         Server->Stop();
+        __atomic_store_n(&s7Running, false, __ATOMIC_RELEASE);
+    }
 }
 
 //------------------------------------------------------------------------------
@@ -1300,7 +1300,13 @@ void finalizeSnap7()
     {
         s7Inited = false;
         Server->Stop();
+        s7Running = false;
         delete Server;
         Server = NULL;
+        if (s7EventThreadRunning)
+        {
+            s7EventThreadRunning = false;
+            pthread_join(s7EventThread, NULL);
+        }
     }
 }
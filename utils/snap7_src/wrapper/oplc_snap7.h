@@ -219,6 +219,7 @@ const int p_i32_BSendTimeout    = 12;
 const int p_i32_BRecvTimeout    = 13;
 const int p_u32_RecoveryTime    = 14;
 const int p_u32_KeepAliveTime   = 15;
+const int p_i32_WorkerPool      = 16;
 
 // Client/Partner Job status 
 const int JobComplete           = 0;
@@ -945,6 +946,7 @@ void initializeSnap7();
 void finalizeSnap7();
 void startSnap7();
 void stopSnap7();
+void updateSnap7Image();
 
 #endif // __cplusplus
 #endif // snap7_h
@@ -17,190 +17,965 @@
 //------
 //
 // This program is responsible for the optimization process after the initial
-// compilation from PLCOpen Editor. All it does is to scan the ST file for
-// first-level IF statements and concatenate identical statements together
+// compilation from PLCOpen Editor. The ST file is split into tokens and the
+// bodies of the POUs are parsed into a tree of statements. Ladder rungs that
+// drive several coils from the same contacts come out as a run of IF
+// statements with the same condition, so consecutive IFs with identical
+// conditions are joined into one when the first body can't change the value
+// of the condition. Everything else (including the comments and the layout)
+// is written out untouched.
+//
+// The expression level optimizations (common subexpressions, loop invariants,
+// strength reduction) are done by the C compiler on the code generated by
+// MatIEC, so they are not repeated here.
 
 // Thiago Alves, Sep 2017
 //-----------------------------------------------------------------------------
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <vector>
+#include <set>
+#include <map>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
 
 using namespace std;
 
-string final_program;
-vector<string> list_of_IFs;
-int current_line = 0;
+enum TokenType { TOKEN_IDENT, TOKEN_LITERAL, TOKEN_SYMBOL, TOKEN_END };
+
+struct Token
+{
+	TokenType type;
+	string text;
+	string upper;       // text in upper case, ST is case insensitive
+	string space;       // blanks and comments before the token
+	string prefix;      // code added before the token
+	string suffix;      // code added after the token
+	bool removed;
+};
+
+struct Statement
+{
+	size_t begin;               // first token
+	size_t end;                 // one past the last token (including the ';')
+	bool is_if;                 // IF cond THEN body END_IF; without ELSIF/ELSE
+	size_t cond_begin, cond_end;
+	size_t end_if;              // END_IF token of an IF
+	vector<Statement> body;      // body of an IF (THEN part) or a loop
+	vector< vector<Statement> > branches;   // ELSIF and ELSE parts of an IF
+};
+
+vector<Token> tokens;
+int merged_ifs = 0;
+int event_blocks = 0;
+string event_init;          // first scan flag, named after the program so an online change resets it
 
 //-----------------------------------------------------------------------------
-// Helper function - Verifies if the supplied line is an IF statement
+// Helper function - Splits the ST source into tokens. The blanks, comments
+// and pragmas are kept with the token that follows them
 //-----------------------------------------------------------------------------
-bool is_IF_statement(const string &line)
+void tokenize(const string &source)
 {
-	int i = 0;
-	for (i = 0; i < line.length(); i++)
+	size_t i = 0;
+	string space;
+	while (i < source.length())
 	{
-		if (line.at(i) != ' ')
-			break;
-	}
-	
-	if (line.size() >= 3 && i < line.length())
-	{
-		if (line.at(i) == 'I' && line.at(i+1) == 'F' && line.at(i+2) == ' ')
+		char c = source[i];
+		if (isspace((unsigned char)c))
+		{
+			space += c;
+			i++;
+		}
+		else if (c == '(' && i + 1 < source.length() && source[i+1] == '*')
+		{
+			size_t end = source.find("*)", i + 2);
+			end = (end == string::npos) ? source.length() : end + 2;
+			space += source.substr(i, end - i);
+			i = end;
+		}
+		else if (c == '/' && i + 1 < source.length() && source[i+1] == '/')
+		{
+			size_t end = source.find('\n', i);
+			end = (end == string::npos) ? source.length() : end;
+			space += source.substr(i, end - i);
+			i = end;
+		}
+		else if (c == '{')
 		{
-			return true;
+			size_t end = source.find('}', i);
+			end = (end == string::npos) ? source.length() : end + 1;
+			space += source.substr(i, end - i);
+			i = end;
+		}
+		else
+		{
+			Token token;
+			token.removed = false;
+			size_t start = i;
+			if (isalpha((unsigned char)c) || c == '_' || isdigit((unsigned char)c))
+			{
+				while (i < source.length() && (isalnum((unsigned char)source[i]) || source[i] == '_')) i++;
+				token.type = isdigit((unsigned char)c) ? TOKEN_LITERAL : TOKEN_IDENT;
+				//typed and based literals (T#1s, 16#FF, INT#5, TOD#12:00:00) and reals
+				if (i < source.length() && source[i] == '#')
+				{
+					i++;
+					while (i < source.length() && (isalnum((unsigned char)source[i]) || strchr("_.:-+", source[i]) != NULL)) i++;
+					token.type = TOKEN_LITERAL;
+				}
+				else if (token.type == TOKEN_LITERAL)
+				{
+					if (i + 1 < source.length() && source[i] == '.' && isdigit((unsigned char)source[i+1]))
+					{
+						i++;
+						while (i < source.length() && (isdigit((unsigned char)source[i]) || source[i] == '_')) i++;
+					}
+					if (i < source.length() && (source[i] == 'e' || source[i] == 'E'))
+					{
+						i++;
+						if (i < source.length() && (source[i] == '+' || source[i] == '-')) i++;
+						while (i < source.length() && isdigit((unsigned char)source[i])) i++;
+					}
+				}
+			}
+			else if (c == '\'' || c == '"')
+			{
+				i++;
+				while (i < source.length() && source[i] != c)
+				{
+					if (source[i] == '$') i++;
+					i++;
+				}
+				i++;
+				if (i > source.length()) i = source.length();
+				token.type = TOKEN_LITERAL;
+			}
+			else
+			{
+				static const char *pairs[] = { ":=", "=>", "<=", ">=", "<>", "**", "..", NULL };
+				i++;
+				for (int p = 0; pairs[p] != NULL; p++)
+				{
+					if (c == pairs[p][0] && i < source.length() && source[i] == pairs[p][1])
+					{
+						i++;
+						break;
+					}
+				}
+				token.type = TOKEN_SYMBOL;
+			}
+
+			token.text = source.substr(start, i - start);
+			token.upper = token.text;
+			for (size_t k = 0; k < token.upper.length(); k++) token.upper[k] = toupper((unsigned char)token.upper[k]);
+			token.space = space;
+			space.clear();
+			tokens.push_back(token);
 		}
 	}
+
+	Token end;
+	end.type = TOKEN_END;
+	end.removed = false;
+	end.space = space;
+	tokens.push_back(end);
+}
+
+//-----------------------------------------------------------------------------
+// Helper function - Verifies if token i is the keyword (or symbol) supplied
+//-----------------------------------------------------------------------------
+bool is_token(size_t i, const char *text)
+{
+	return i < tokens.size() && tokens[i].type != TOKEN_END && tokens[i].type != TOKEN_LITERAL && tokens[i].upper == text;
+}
+
+//-----------------------------------------------------------------------------
+// Helper function - Verifies if token i ends the statement list it is in
+//-----------------------------------------------------------------------------
+bool is_list_terminator(size_t i)
+{
+	static const char *terminators[] = { "END_IF", "ELSIF", "ELSE", "END_FOR", "END_WHILE", "UNTIL", "END_REPEAT",
+	                                     "END_CASE", "END_PROGRAM", "END_FUNCTION_BLOCK", "END_FUNCTION", NULL };
+	if (tokens[i].type == TOKEN_END) return true;
+	for (int t = 0; terminators[t] != NULL; t++)
+	{
+		if (is_token(i, terminators[t])) return true;
+	}
 	return false;
 }
 
+vector<Statement> parse_statements(size_t &i);
+
 //-----------------------------------------------------------------------------
-// Helper function - Verifies if the supplied line is an END_IF statement
+// Helper function - Skips the tokens up to the keyword supplied, at the
+// nesting level of the caller. Returns false if it was not found
 //-----------------------------------------------------------------------------
-bool is_END_IF_statement(const string &line)
+bool skip_to(size_t &i, const char *keyword)
 {
-	int i = 0;
-	for (i = 0; i < line.length(); i++)
+	int parens = 0;
+	while (tokens[i].type != TOKEN_END)
 	{
-		if (line.at(i) != ' ')
-			break;
+		if (is_token(i, "(") || is_token(i, "[")) parens++;
+		else if (is_token(i, ")") || is_token(i, "]")) parens--;
+		else if (parens == 0 && is_token(i, keyword)) return true;
+		else if (parens == 0 && is_list_terminator(i)) return false;
+		i++;
 	}
-	
-	if (line.size() >= 7)
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// Helper function - Parses one statement starting at token i. Loops and IFs
+// are parsed into their bodies, CASE statements are kept as a whole
+//-----------------------------------------------------------------------------
+Statement parse_statement(size_t &i)
+{
+	Statement statement;
+	statement.begin = i;
+	statement.is_if = false;
+	statement.cond_begin = statement.cond_end = statement.end_if = 0;
+
+	if (is_token(i, "IF"))
 	{
-		if (line.at(i) == 'E' && line.at(i+1) == 'N' && line.at(i+2) == 'D' && line.at(i+3) == '_' && line.at(i+4) == 'I' && line.at(i+5) == 'F' && line.at(i+6) == ';')
+		bool simple = true;
+		i++;
+		statement.cond_begin = i;
+		if (skip_to(i, "THEN"))
 		{
-			return true;
+			statement.cond_end = i;
+			i++;
+			statement.body = parse_statements(i);
+			while (is_token(i, "ELSIF") || is_token(i, "ELSE"))
+			{
+				simple = false;
+				bool elsif = is_token(i, "ELSIF");
+				i++;
+				if (elsif && !skip_to(i, "THEN")) break;
+				if (elsif) i++;
+				statement.branches.push_back(parse_statements(i));
+			}
+			if (is_token(i, "END_IF"))
+			{
+				statement.end_if = i;
+				statement.is_if = simple;
+				i++;
+			}
 		}
 	}
-	return false;
+	else if (is_token(i, "FOR") || is_token(i, "WHILE"))
+	{
+		const char *end = is_token(i, "FOR") ? "END_FOR" : "END_WHILE";
+		if (skip_to(i, "DO"))
+		{
+			i++;
+			statement.body = parse_statements(i);
+			if (is_token(i, end)) i++;
+		}
+	}
+	else if (is_token(i, "REPEAT"))
+	{
+		i++;
+		statement.body = parse_statements(i);
+		if (is_token(i, "UNTIL") && skip_to(++i, "END_REPEAT")) i++;
+	}
+	else if (is_token(i, "CASE"))
+	{
+		int depth = 0;
+		while (tokens[i].type != TOKEN_END)
+		{
+			if (is_token(i, "CASE")) depth++;
+			else if (is_token(i, "END_CASE") && --depth == 0)
+			{
+				i++;
+				break;
+			}
+			i++;
+		}
+	}
+	else
+	{
+		int parens = 0;
+		while (tokens[i].type != TOKEN_END && !(parens == 0 && (is_token(i, ";") || is_list_terminator(i))))
+		{
+			if (is_token(i, "(") || is_token(i, "[")) parens++;
+			else if (is_token(i, ")") || is_token(i, "]")) parens--;
+			i++;
+		}
+	}
+
+	if (is_token(i, ";")) i++;
+	else statement.is_if = false;   //the merge drops the ';' after END_IF
+	statement.end = i;
+	return statement;
 }
 
 //-----------------------------------------------------------------------------
-// Main function - All the magic happens here.
+// Helper function - Parses statements up to the end of the list they are in
 //-----------------------------------------------------------------------------
-int main(int argc, char *argv[])
+vector<Statement> parse_statements(size_t &i)
 {
-	//Verify if there are enough arguments
-	if (argc < 3)
+	vector<Statement> statements;
+	while (!is_list_terminator(i))
 	{
-		printf("You should provide the ST file to be optimized and the output file. \r\nEx: ./st_optimizer program.st output.st\r\n");
-		return 0;
+		size_t start = i;
+		statements.push_back(parse_statement(i));
+		if (i == start) i++;    //never loop on a token no statement starts with
 	}
-	
-	//Open file for reading
-	ifstream stfile(argv[1]);
-	if (stfile.is_open())
+	return statements;
+}
+
+//-----------------------------------------------------------------------------
+// Helper function - Verifies if the tokens on [begin, end) call a function or
+// FB, or dereference a pointer. They may then change any variable. The type
+// conversions and the usual standard functions don't
+//-----------------------------------------------------------------------------
+bool has_side_effects(size_t begin, size_t end)
+{
+	static const char *pure[] = { "ABS", "SQRT", "MIN", "MAX", "LIMIT", "SEL", "MUX", "MOVE", "TRUNC",
+	                              "SHL", "SHR", "ROL", "ROR", "AND", "OR", "XOR", "NOT", NULL };
+	for (size_t i = begin; i < end; i++)
 	{
-		string line;
-		//This big while loop scans the entire file looking for IF statements. All IF statements are
-		//stored in the list_of_IFs vector
-		while (getline(stfile, line))
+		if (is_token(i, "^")) return true;
+		if (tokens[i].type == TOKEN_IDENT && is_token(i + 1, "("))
 		{
-			current_line++;
-			if (is_IF_statement(line))
+			bool is_pure = tokens[i].upper.find("_TO_") != string::npos;
+			for (int p = 0; pure[p] != NULL && !is_pure; p++)
 			{
-				//If this line is an IF statement, we first need to verify if it is a duplicate
-				bool is_duplicate = false;
-				for (vector<string>::iterator it = list_of_IFs.begin(); it != list_of_IFs.end(); it++)
-				{
-					if (!line.compare(*it))
-					{
-						is_duplicate = true;
-					}
-				}
-				if (!is_duplicate)
+				is_pure = (tokens[i].upper == pure[p]);
+			}
+			if (!is_pure) return true;
+		}
+	}
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// Helper function - Adds the variables assigned on [begin, end) to written.
+// Only the name the variable starts with is kept (a for a.b[2]). Returns
+// false if the assignments can't be told apart
+//-----------------------------------------------------------------------------
+bool add_written_variables(size_t begin, size_t end, set<string> &written)
+{
+	if (has_side_effects(begin, end)) return false;
+	for (size_t i = begin; i < end; i++)
+	{
+		if (!is_token(i, ":=")) continue;
+
+		size_t pos = i;
+		string root;
+		while (pos > begin)
+		{
+			pos--;
+			if (is_token(pos, "]"))
+			{
+				int depth = 1;
+				while (pos > begin && depth > 0)
 				{
-					//If the line is NOT a duplicate, we need to store it in the final program and
-					//also store it in the list_of_IFs vector
-					string if_statement(line);
-					list_of_IFs.push_back(line);
-					final_program.append(line + "\n");
-					
-					//This while loop will copy all contents of the IF statement until it finds the
-					//END_IF terminator. Note: It will ignore sub-level IF statements
-					int count_for_break = 1;
-					while (getline(stfile, line))
-					{
-						current_line++;
-						if(is_IF_statement(line))
-							count_for_break++;
-						else if(is_END_IF_statement(line))
-							count_for_break--;
-						if (count_for_break == 0)
-							break;
-						
-						final_program.append(line + "\n");
-					}
-					
-					string end_if(line);
-					int current_position = current_line;
-					
-					//This while loop concatenates all identical IF statements together
-					while (getline(stfile, line))
-					{
-						if (!line.compare(if_statement))
-						{
-							count_for_break = 1;
-							while (getline(stfile, line))
-							{
-								if(is_IF_statement(line))
-									count_for_break++;
-								else if(is_END_IF_statement(line))
-									count_for_break--;
-								if (count_for_break == 0)
-									break;
-								
-								final_program.append(line + "\n");
-							}
-						}
-					}
-					
-					//For some reason ifstream.tellg() and ifstream.seekg() are not working,
-					//so this is the work-around
-					stfile.close();
-					stfile.open(argv[1]);
-					for (int i = 0; i < current_position; i++)
-					{
-						getline(stfile, line);
-					}
-					final_program.append(end_if + "\n");
+					pos--;
+					if (is_token(pos, "]")) depth++;
+					else if (is_token(pos, "[")) depth--;
 				}
-				else
+				continue;
+			}
+			if (tokens[pos].type != TOKEN_IDENT) break;
+			root = tokens[pos].upper;
+			if (pos > begin && is_token(pos - 1, ".")) pos--;
+			else break;
+		}
+		if (root.empty()) return false;
+		written.insert(root);
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Helper function - Verifies if two token ranges hold the same code
+//-----------------------------------------------------------------------------
+bool same_tokens(size_t a_begin, size_t a_end, size_t b_begin, size_t b_end)
+{
+	if (a_end - a_begin != b_end - b_begin) return false;
+	for (size_t k = 0; k < a_end - a_begin; k++)
+	{
+		const Token &a = tokens[a_begin + k];
+		const Token &b = tokens[b_begin + k];
+		if (a.type != b.type) return false;
+		if (a.type == TOKEN_IDENT ? (a.upper != b.upper) : (a.text != b.text)) return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Helper function - Removes the tokens on [begin, end). The comments before
+// them are moved to the next token that is kept
+//-----------------------------------------------------------------------------
+void remove_tokens(size_t begin, size_t end)
+{
+	string comments;
+	for (size_t i = begin; i < end; i++)
+	{
+		tokens[i].removed = true;
+		if (tokens[i].space.find_first_not_of(" \t\r\n") != string::npos) comments += tokens[i].space;
+	}
+	tokens[end].space = comments + tokens[end].space;
+}
+
+//-----------------------------------------------------------------------------
+// Joins the consecutive IF statements of a statement list that have the
+// same condition, as long as the bodies joined so far can't change what the
+// condition reads. The bodies are optimized first
+//-----------------------------------------------------------------------------
+void merge_ifs(vector<Statement> &statements)
+{
+	for (size_t s = 0; s < statements.size(); s++)
+	{
+		merge_ifs(statements[s].body);
+		for (size_t b = 0; b < statements[s].branches.size(); b++)
+		{
+			merge_ifs(statements[s].branches[b]);
+		}
+	}
+
+	size_t s = 0;
+	while (s < statements.size())
+	{
+		Statement &first = statements[s];
+		if (!first.is_if || has_side_effects(first.cond_begin, first.cond_end))
+		{
+			s++;
+			continue;
+		}
+
+		set<string> read;
+		for (size_t i = first.cond_begin; i < first.cond_end; i++)
+		{
+			if (tokens[i].type == TOKEN_IDENT) read.insert(tokens[i].upper);
+		}
+
+		set<string> written;
+		bool known = add_written_variables(first.cond_end, first.end_if, written);
+		size_t next = s + 1;
+		while (known && next < statements.size())
+		{
+			Statement &second = statements[next];
+			if (!second.is_if || !same_tokens(first.cond_begin, first.cond_end, second.cond_begin, second.cond_end)) break;
+
+			bool conflict = false;
+			for (set<string>::iterator it = written.begin(); it != written.end() && !conflict; it++)
+			{
+				conflict = (read.count(*it) > 0);
+			}
+			if (conflict) break;
+
+			//END_IF; IF cond THEN of the first and second statements go away
+			remove_tokens(first.end_if, second.cond_end + 1);
+			first.end_if = second.end_if;
+			first.end = second.end;
+			first.body.insert(first.body.end(), second.body.begin(), second.body.end());
+			known = add_written_variables(second.cond_end, second.end_if, written);
+			merged_ifs++;
+			next++;
+		}
+		statements.erase(statements.begin() + s + 1, statements.begin() + next);
+		s++;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Event driven rungs (-e). The top-level statements of a PROGRAM or
+// FUNCTION_BLOCK that only use elementary variables of the POU are grouped
+// in blocks, and each block only runs when one of the variables it uses
+// changed since the last time it ran. A block must give the same result if
+// it runs again on its own result, so a statement may not read what a later
+// statement of the block writes, and a statement reading what it writes
+// (a seal-in coil) must be a BOOL expression checked to be idempotent. FB
+// calls (timers, counters, edge detection) and everything else are not
+// grouped, so they run every scan
+//-----------------------------------------------------------------------------
+
+#define EVENT_BLOCK_MAX_STATEMENTS  16
+#define EVENT_IDEMPOTENCE_MAX_VARS  12
+#define EVENT_PREFIX                "OPLC_EVT_"
+
+struct RungAccess
+{
+	bool eligible;
+	set<string> reads;
+	set<string> writes;
+};
+
+//-----------------------------------------------------------------------------
+// Helper function - Reads the elementary variables declared on the VAR
+// sections of a POU (name -> type, both in upper case)
+//-----------------------------------------------------------------------------
+void read_declarations(size_t begin, size_t end, map<string, string> &variables)
+{
+	static const char *sections[] = { "VAR", "VAR_INPUT", "VAR_OUTPUT", "VAR_IN_OUT", "VAR_EXTERNAL", "VAR_TEMP", NULL };
+	static const char *elementary[] = { "BOOL", "SINT", "INT", "DINT", "LINT", "USINT", "UINT", "UDINT", "ULINT",
+	                                    "BYTE", "WORD", "DWORD", "LWORD", "REAL", "LREAL", "TIME", "DATE", "TOD",
+	                                    "TIME_OF_DAY", "DT", "DATE_AND_TIME", NULL };
+	size_t i = begin;
+	while (i < end)
+	{
+		bool section = false;
+		for (int v = 0; sections[v] != NULL && !section; v++)
+		{
+			section = is_token(i, sections[v]);
+		}
+		if (!section)
+		{
+			i++;
+			continue;
+		}
+		i++;
+		while (is_token(i, "CONSTANT") || is_token(i, "RETAIN") || is_token(i, "NON_RETAIN")) i++;
+
+		while (i < end && !is_token(i, "END_VAR"))
+		{
+			vector<string> names;
+			while (i < end && tokens[i].type == TOKEN_IDENT && !is_token(i, "END_VAR"))
+			{
+				names.push_back(tokens[i].upper);
+				i++;
+				if (!is_token(i, ",")) break;
+				i++;
+			}
+			if (is_token(i, "AT"))
+			{
+				while (i < end && !is_token(i, ":")) i++;
+			}
+
+			string type;
+			if (is_token(i, ":"))
+			{
+				i++;
+				if (tokens[i].type == TOKEN_IDENT && (is_token(i + 1, ";") || is_token(i + 1, ":=")))
 				{
-					//If this is a duplicated IF statement we just skip it with all its content
-					int count_for_break = 1;
-					while (getline(stfile, line))
+					for (int e = 0; elementary[e] != NULL && type.empty(); e++)
 					{
-						current_line++;
-						if(is_IF_statement(line))
-							count_for_break++;
-						else if(is_END_IF_statement(line))
-							count_for_break--;
-						if (count_for_break == 0)
-							break;
+						if (tokens[i].upper == elementary[e]) type = elementary[e];
 					}
 				}
 			}
-			else
+			for (size_t n = 0; n < names.size() && !type.empty(); n++)
+			{
+				variables[names[n]] = type;
+			}
+
+			int parens = 0;
+			while (i < end && !(parens == 0 && is_token(i, ";")) && !is_token(i, "END_VAR"))
 			{
-				final_program.append(line + "\n");
+				if (is_token(i, "(") || is_token(i, "[")) parens++;
+				else if (is_token(i, ")") || is_token(i, "]")) parens--;
+				i++;
 			}
+			if (is_token(i, ";")) i++;
+		}
+		if (is_token(i, "END_VAR")) i++;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Helper function - Verifies that the expression on [begin, end) only uses
+// operators, literals and the elementary variables supplied, and adds the
+// variables to reads
+//-----------------------------------------------------------------------------
+bool read_expression(size_t begin, size_t end, const map<string, string> &variables, set<string> &reads)
+{
+	static const char *operators[] = { "AND", "OR", "XOR", "NOT", "MOD", "TRUE", "FALSE", "(", ")", "+", "-",
+	                                   "*", "/", "**", "=", "<>", "<", ">", "<=", ">=", "&", NULL };
+	if (begin >= end) return false;
+	for (size_t i = begin; i < end; i++)
+	{
+		if (tokens[i].type == TOKEN_LITERAL) continue;
+
+		bool known = false;
+		for (int o = 0; operators[o] != NULL && !known; o++)
+		{
+			known = is_token(i, operators[o]);
 		}
-		
-		stfile.close();
+		if (known) continue;
+
+		if (tokens[i].type != TOKEN_IDENT || variables.count(tokens[i].upper) == 0) return false;
+		if (is_token(i + 1, ".") || is_token(i + 1, "[") || is_token(i + 1, "(")) return false;
+		reads.insert(tokens[i].upper);
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Helper function - Reads an assignment to an elementary variable on
+// [begin, end) (including the ';')
+//-----------------------------------------------------------------------------
+bool read_assignment(size_t begin, size_t end, const map<string, string> &variables, RungAccess &access)
+{
+	if (end < begin + 4 || !is_token(begin + 1, ":=") || !is_token(end - 1, ";")) return false;
+	if (tokens[begin].type != TOKEN_IDENT || variables.count(tokens[begin].upper) == 0) return false;
+	access.writes.insert(tokens[begin].upper);
+	return read_expression(begin + 2, end - 1, variables, access.reads);
+}
+
+//-----------------------------------------------------------------------------
+// Helper function - Evaluates a BOOL expression. Variable n of the
+// expression takes bit n of values. Sets ok to false on anything that is
+// not a BOOL operator, constant or variable
+//-----------------------------------------------------------------------------
+bool eval_bool_or(size_t &i, size_t end, const map<string, int> &bits, unsigned values, bool &ok);
+
+bool eval_bool_unary(size_t &i, size_t end, const map<string, int> &bits, unsigned values, bool &ok)
+{
+	if (i >= end) { ok = false; return false; }
+	if (is_token(i, "NOT"))
+	{
+		i++;
+		return !eval_bool_unary(i, end, bits, values, ok);
+	}
+	if (is_token(i, "("))
+	{
+		i++;
+		bool value = eval_bool_or(i, end, bits, values, ok);
+		if (!is_token(i, ")")) ok = false;
+		i++;
+		return value;
+	}
+	if (is_token(i, "TRUE") || is_token(i, "FALSE"))
+	{
+		return is_token(i++, "TRUE");
+	}
+	map<string, int>::const_iterator bit = bits.find(tokens[i].upper);
+	if (tokens[i].type != TOKEN_IDENT || bit == bits.end())
+	{
+		ok = false;
+		return false;
+	}
+	i++;
+	return (values >> bit->second) & 1;
+}
+
+bool eval_bool_and(size_t &i, size_t end, const map<string, int> &bits, unsigned values, bool &ok)
+{
+	bool value = eval_bool_unary(i, end, bits, values, ok);
+	while (ok && i < end && (is_token(i, "AND") || is_token(i, "&")))
+	{
+		i++;
+		bool right = eval_bool_unary(i, end, bits, values, ok);
+		value = value && right;
+	}
+	return value;
+}
+
+bool eval_bool_xor(size_t &i, size_t end, const map<string, int> &bits, unsigned values, bool &ok)
+{
+	bool value = eval_bool_and(i, end, bits, values, ok);
+	while (ok && i < end && is_token(i, "XOR"))
+	{
+		i++;
+		bool right = eval_bool_and(i, end, bits, values, ok);
+		value = (value != right);
+	}
+	return value;
+}
+
+bool eval_bool_or(size_t &i, size_t end, const map<string, int> &bits, unsigned values, bool &ok)
+{
+	bool value = eval_bool_xor(i, end, bits, values, ok);
+	while (ok && i < end && is_token(i, "OR"))
+	{
+		i++;
+		bool right = eval_bool_xor(i, end, bits, values, ok);
+		value = value || right;
+	}
+	return value;
+}
+
+//-----------------------------------------------------------------------------
+// Helper function - Verifies that the BOOL assignment on [begin, end) (which
+// reads the variable it writes) gives the same value when it runs again on
+// its own result, for every value of the variables it reads
+//-----------------------------------------------------------------------------
+bool is_idempotent(size_t begin, size_t end, const RungAccess &access, const map<string, string> &variables)
+{
+	if (access.reads.size() > EVENT_IDEMPOTENCE_MAX_VARS) return false;
+
+	map<string, int> bits;
+	int count = 0;
+	for (set<string>::const_iterator it = access.reads.begin(); it != access.reads.end(); it++)
+	{
+		if (variables.find(*it)->second != "BOOL") return false;
+		bits[*it] = count++;
+	}
+	const string &target = tokens[begin].upper;
+	if (variables.find(target)->second != "BOOL") return false;
+	int target_bit = bits[target];
+
+	for (unsigned values = 0; values < (1u << count); values++)
+	{
+		bool ok = true;
+		size_t pos = begin + 2;
+		bool first = eval_bool_or(pos, end - 1, bits, values, ok);
+		if (!ok || pos != end - 1) return false;
+
+		unsigned again_values = (values & ~(1u << target_bit)) | ((unsigned)first << target_bit);
+		pos = begin + 2;
+		bool again = eval_bool_or(pos, end - 1, bits, again_values, ok);
+		if (again != first) return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Helper function - Finds out what a top-level statement reads and writes,
+// and whether it can be part of an event driven block
+//-----------------------------------------------------------------------------
+RungAccess read_rung(const Statement &statement, const map<string, string> &variables)
+{
+	RungAccess access;
+	if (statement.is_if)
+	{
+		access.eligible = read_expression(statement.cond_begin, statement.cond_end, variables, access.reads);
+		for (size_t s = 0; s < statement.body.size() && access.eligible; s++)
+		{
+			access.eligible = statement.body[s].body.empty() && statement.body[s].branches.empty() &&
+			                  read_assignment(statement.body[s].begin, statement.body[s].end, variables, access);
+		}
+		if (statement.body.empty()) access.eligible = false;
 	}
-	
 	else
+	{
+		access.eligible = statement.body.empty() && statement.branches.empty() &&
+		                  read_assignment(statement.begin, statement.end, variables, access);
+	}
+	if (!access.eligible) return access;
+
+	bool self_reading = false;
+	for (set<string>::iterator it = access.writes.begin(); it != access.writes.end(); it++)
+	{
+		if (access.reads.count(*it) > 0) self_reading = true;
+	}
+	if (self_reading)
+	{
+		access.eligible = !statement.is_if && is_idempotent(statement.begin, statement.end, access, variables);
+	}
+	return access;
+}
+
+//-----------------------------------------------------------------------------
+// Helper function - Returns the indentation of the line token i starts
+//-----------------------------------------------------------------------------
+string indentation(size_t i)
+{
+	size_t line = tokens[i].space.find_last_of('\n');
+	if (line == string::npos) return "";
+	return tokens[i].space.substr(line + 1);
+}
+
+//-----------------------------------------------------------------------------
+// Helper function - Makes the statements [first, last] of a POU body run only
+// when one of the variables they use changed. The copies of the variables are
+// added to the declarations of the POU
+//-----------------------------------------------------------------------------
+void guard_block(const vector<Statement> &statements, size_t first, size_t last, const set<string> &used,
+                 const map<string, string> &variables, string &declarations)
+{
+	event_blocks++;
+	char block[32];
+	sprintf(block, "%s%d_", EVENT_PREFIX, event_blocks);
+
+	string indent = indentation(statements[first].begin);
+	string guard = "IF " + event_init;
+	string copies;
+	for (set<string>::const_iterator it = used.begin(); it != used.end(); it++)
+	{
+		const string &type = variables.find(*it)->second;
+		string copy = block + *it;
+		guard += (type == "BOOL") ? " OR (" + *it + " XOR " + copy + ")" : " OR (" + *it + " <> " + copy + ")";
+		copies += "\n" + indent + "  " + copy + " := " + *it + ";";
+		declarations += "    " + copy + " : " + type + ";\n";
+	}
+
+	tokens[statements[first].begin].prefix += guard + " THEN\n" + indent + "  ";
+	for (size_t i = statements[first].begin + 1; i < statements[last].end; i++)
+	{
+		if (tokens[i].space.find('\n') != string::npos) tokens[i].space += "  ";
+	}
+	tokens[statements[last].end - 1].suffix += copies + "\n" + indent + "END_IF;";
+}
+
+//-----------------------------------------------------------------------------
+// Helper function - Groups the top-level statements of a POU body into event
+// driven blocks. The body ends at token end
+//-----------------------------------------------------------------------------
+void make_event_driven(const vector<Statement> &statements, size_t decl_begin, size_t body, size_t end)
+{
+	map<string, string> variables;
+	read_declarations(decl_begin, body, variables);
+
+	string declarations;
+	size_t s = 0;
+	while (s < statements.size())
+	{
+		RungAccess access = read_rung(statements[s], variables);
+		if (!access.eligible)
+		{
+			s++;
+			continue;
+		}
+
+		size_t first = s;
+		set<string> block_reads(access.reads);
+		set<string> used(access.reads);
+		used.insert(access.writes.begin(), access.writes.end());
+		for (s++; s < statements.size() && s - first < EVENT_BLOCK_MAX_STATEMENTS; s++)
+		{
+			RungAccess next = read_rung(statements[s], variables);
+			if (!next.eligible) break;
+
+			//the statements already on the block must not read what this one writes
+			bool backwards = false;
+			for (set<string>::iterator it = next.writes.begin(); it != next.writes.end() && !backwards; it++)
+			{
+				backwards = (block_reads.count(*it) > 0);
+			}
+			if (backwards) break;
+
+			block_reads.insert(next.reads.begin(), next.reads.end());
+			used.insert(next.reads.begin(), next.reads.end());
+			used.insert(next.writes.begin(), next.writes.end());
+		}
+
+		//a single statement costs less than checking its variables
+		if (s - first > 1) guard_block(statements, first, s - 1, used, variables, declarations);
+	}
+
+	if (declarations.empty()) return;
+	string indent = indentation(body);
+	tokens[body].prefix = "VAR\n    " + event_init + " : BOOL := TRUE;\n" + declarations + "  END_VAR\n" + indent + tokens[body].prefix;
+	tokens[end].prefix = "  " + event_init + " := FALSE;\n" + tokens[end].prefix;
+}
+
+//-----------------------------------------------------------------------------
+// Helper function - Optimizes the bodies of the POUs. The declarations, the
+// configurations and the SFC POUs are left as they are, and so are the POUs
+// with VAR_IN_OUT, as their names may alias other variables. With
+// event_driven the rungs are grouped in event driven blocks instead of
+// having their IFs joined
+//-----------------------------------------------------------------------------
+void optimize_program(bool event_driven)
+{
+	size_t i = 0;
+	while (tokens[i].type != TOKEN_END)
+	{
+		if (is_token(i, "PROGRAM") || is_token(i, "FUNCTION_BLOCK") || is_token(i, "FUNCTION"))
+		{
+			string end = "END_" + tokens[i].upper;
+			bool skip = false;
+			size_t body = 0;
+			size_t k = i + 1;
+			for (; tokens[k].type != TOKEN_END && !is_token(k, end.c_str()); k++)
+			{
+				if (is_token(k, "INITIAL_STEP") || is_token(k, "STEP") || is_token(k, "TRANSITION") || is_token(k, "ACTION")) skip = true;
+				if (is_token(k, "VAR_IN_OUT")) skip = true;
+				if (is_token(k, "END_VAR")) body = k + 1;
+			}
+			if (body == 0)
+			{
+				//no declarations, the body starts after the name (and the type of a function)
+				body = i + 2;
+				if (tokens[i].upper == "FUNCTION" && is_token(body, ":")) body += 2;
+			}
+
+			if (!skip && body < k)
+			{
+				size_t pos = body;
+				vector<Statement> statements = parse_statements(pos);
+				if (pos == k && !event_driven) merge_ifs(statements);
+				if (pos == k && event_driven && tokens[i].upper != "FUNCTION") make_event_driven(statements, i + 1, body, k);
+			}
+			i = k;
+		}
+		else if (is_token(i, "TYPE") || is_token(i, "CONFIGURATION"))
+		{
+			string end = "END_" + tokens[i].upper;
+			while (tokens[i].type != TOKEN_END && !is_token(i, end.c_str())) i++;
+		}
+		if (tokens[i].type != TOKEN_END) i++;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Helper function - Writes the tokens back as ST
+//-----------------------------------------------------------------------------
+string render_program()
+{
+	string program;
+	for (size_t i = 0; i < tokens.size(); i++)
+	{
+		if (tokens[i].removed) continue;
+		program += tokens[i].space;
+		program += tokens[i].prefix;
+		program += tokens[i].text;
+		program += tokens[i].suffix;
+	}
+	return program;
+}
+
+//-----------------------------------------------------------------------------
+// Main function - All the magic happens here.
+//-----------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+	//-e makes the ladder rungs event driven
+	bool event_driven = (argc > 1 && string(argv[1]) == "-e");
+	if (event_driven)
+	{
+		argc--;
+		argv++;
+	}
+
+	//Verify if there are enough arguments
+	if (argc < 3)
+	{
+		printf("You should provide the ST file to be optimized and the output file. \r\nEx: ./st_optimizer [-e] program.st output.st\r\n");
+		return 0;
+	}
+
+	//Open file for reading
+	ifstream stfile(argv[1]);
+	if (!stfile.is_open())
 	{
 		printf("Couldn't open file \"%s\"\r\n", argv[1]);
 		return -1;
 	}
-	
+	stringstream source;
+	source << stfile.rdbuf();
+	stfile.close();
+
+	tokenize(source.str());
+	optimize_program(false);
+	string final_program = render_program();
+
+	//The event driven blocks are made on the program with its IFs joined
+	if (event_driven)
+	{
+		unsigned hash = 2166136261u;
+		for (size_t i = 0; i < final_program.length(); i++)
+		{
+			hash = (hash ^ (unsigned char)final_program[i]) * 16777619u;
+		}
+		char init[32];
+		sprintf(init, "%sINIT_%08X", EVENT_PREFIX, hash);
+		event_init = init;
+
+		tokens.clear();
+		tokenize(final_program);
+		optimize_program(true);
+		final_program = render_program();
+	}
+
 	//Finally, this opens/create the file to write the optimized program
-	/*
 	ofstream outfile(argv[2], ios::trunc);
 	if (outfile.is_open())
 	{
@@ -212,5 +987,8 @@ int main(int argc, char *argv[])
 		printf("Couldn't write to output file \"%s\"\r\n", argv[2]);
 		return -1;
 	}
-	*/
+
+	printf("%d IF statements joined\r\n", merged_ifs);
+	if (event_driven) printf("%d event driven blocks\r\n", event_blocks);
+	return 0;
 }
@@ -117,13 +117,29 @@ def checkSettingExists(conn, setting, defaultvalue):
 def checkTableSettings(conn):
     checkTableExists(conn, "Settings", createTableSettings)
     checkSettingExists(conn, 'Modbus_port', '502')
+    checkSettingExists(conn, 'Modbus_udp_port', 'disabled')
+    checkSettingExists(conn, 'Modbus_rtu', 'disabled')
     checkSettingExists(conn, 'Dnp3_port', '20000')
     checkSettingExists(conn, 'Start_run_mode', 'false')
     checkSettingExists(conn, 'snap7', 'false')
+    checkSettingExists(conn, 'Mqtt', 'false')
     checkSettingExists(conn, 'Slave_polling', '100')
     checkSettingExists(conn, 'Slave_timeout', '1000')
+    checkSettingExists(conn, 'Slave_write_refresh', '0')
+    checkSettingExists(conn, 'Slave_sync_offset', '0')
+    checkSettingExists(conn, 'Slave_sync_deadline', '0')
     checkSettingExists(conn, 'Enip_port', '44818')
     checkSettingExists(conn, 'Pstorage_polling', 'disabled')
+    checkSettingExists(conn, 'Opcua_data_source', 'false')
+    checkSettingExists(conn, 'Opcua_scan_sampling', 'disabled')
+    checkSettingExists(conn, 'Opcua_tuning', '')
+    checkSettingExists(conn, 'Opcua_security', 'policies=none')
+    checkSettingExists(conn, 'Modbus_response_cache', 'false')
+    checkSettingExists(conn, 'Pstorage_retain', 'false')
+    checkSettingExists(conn, 'Scan_overrun_policy', 'catch_up')
+    checkSettingExists(conn, 'Scan_phase_order', 'outputs_first')
+    checkSettingExists(conn, 'Load_shedding', '3')
+    checkSettingExists(conn, 'Scan_watchdog', 'disabled')
     return
 
 def checkTableSlave_dev(conn):
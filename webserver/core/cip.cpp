@@ -0,0 +1,559 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Software Stack.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the CIP services the EtherNet/IP server answers
+// besides PCCC: the Logix data table services Read Tag (0x4C) and Write Tag
+// (0x4D), which address the tags of the tag database by their symbolic
+// name, and the Multiple Service Packet (0x0A) that bundles many of them in
+// one message. Unconnected Send (0x52) requests are unwrapped.
+//
+// The services of a message are answered together: all their reads come
+// from one published snapshot of the process image and all their writes are
+// queued as one batch, so the scan applies them at once. Only the tags on
+// the areas the snapshots publish (%IX, %QX, %IW, %QW, %MW, %MD and %ML)
+// can be read or written, the %I tags are read only.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ladder.h"
+
+#define CIP_MAX_MESSAGE_SIZE        4000    // largest reply, as on a large forward open
+#define CIP_MAX_SERVICES            256     // services of a Multiple Service Packet
+#define CIP_MAX_TAG_NAME            128
+
+/*----------------Services----------------*/
+#define CIP_SVC_MULTIPLE_SERVICE    0x0A
+#define CIP_SVC_READ_TAG            0x4C
+#define CIP_SVC_WRITE_TAG           0x4D
+#define CIP_SVC_UNCONNECTED_SEND    0x52
+#define CIP_REPLY                   0x80
+
+/*----------------General status codes----------------*/
+#define CIP_STS_SUCCESS             0x00
+#define CIP_STS_NO_RESOURCES        0x02
+#define CIP_STS_PATH_SEGMENT_ERROR  0x04
+#define CIP_STS_PATH_UNKNOWN        0x05
+#define CIP_STS_NOT_SUPPORTED       0x08
+#define CIP_STS_PRIVILEGE_VIOLATION 0x0F
+#define CIP_STS_REPLY_TOO_LARGE     0x11
+#define CIP_STS_NOT_ENOUGH_DATA     0x13
+#define CIP_STS_TOO_MUCH_DATA       0x15
+#define CIP_STS_EMBEDDED_ERROR      0x1E
+#define CIP_STS_GENERAL_ERROR       0xFF
+
+// Extended status of the general error, as Logix controllers report them
+#define CIP_EXT_BEYOND_END          0x2105
+#define CIP_EXT_TYPE_MISMATCH       0x2107
+
+/*----------------Elementary data types----------------*/
+#define CIP_TYPE_BOOL               0xC1
+#define CIP_TYPE_INT                0xC3
+#define CIP_TYPE_DINT               0xC4
+#define CIP_TYPE_LINT               0xC5
+#define CIP_TYPE_UINT               0xC7
+#define CIP_TYPE_UDINT              0xC8
+#define CIP_TYPE_ULINT              0xC9
+#define CIP_TYPE_REAL               0xCA
+#define CIP_TYPE_LREAL              0xCB
+
+//-----------------------------------------------------------------------------
+// A tag service of a message. The request is resolved before any data is
+// touched, the reply is built once the reads and writes are done
+//-----------------------------------------------------------------------------
+struct CipTagService
+{
+    uint8_t service;
+    uint8_t status;
+    uint16_t ext_status;        // 0 when there is none
+    const Tag *tag;
+    uint8_t area;               // PI_* area of the tag
+    uint8_t width;              // bytes of an element on the image
+    uint16_t type;              // CIP_TYPE_* of the tag
+    uint32_t element;           // first element requested
+    uint16_t count;             // elements requested
+    const unsigned char *data;  // values of a write, little-endian
+};
+
+static uint16_t readLE16(const unsigned char *p)
+{
+    return (uint16_t)p[0] | ((uint16_t)p[1] << 8);
+}
+
+static uint32_t readLE32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void writeLE16(unsigned char *p, uint16_t value)
+{
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+//-----------------------------------------------------------------------------
+// Returns true if the service is answered by processCIPMessage()
+//-----------------------------------------------------------------------------
+bool cipServiceSupported(unsigned char service)
+{
+    return service == CIP_SVC_MULTIPLE_SERVICE || service == CIP_SVC_READ_TAG ||
+           service == CIP_SVC_WRITE_TAG || service == CIP_SVC_UNCONNECTED_SEND;
+}
+
+//-----------------------------------------------------------------------------
+// Finds the image area, the element width and the CIP type of a tag. Returns
+// false if the snapshots don't publish the area of the tag
+//-----------------------------------------------------------------------------
+static bool tagLayout(const Tag *tag, CipTagService *svc)
+{
+    if (tag->image_offset < 0)
+        return false;
+
+    bool is_signed = (tag->type == TAG_TYPE_SIGNED);
+    bool is_real = (tag->type == TAG_TYPE_REAL);
+    switch (tag->size)
+    {
+        case 'X':
+            svc->area = (tag->area == 'I') ? PI_BOOL_INPUT : PI_BOOL_OUTPUT;
+            svc->width = 1;
+            svc->type = CIP_TYPE_BOOL;
+            return true;
+        case 'W':
+            svc->area = (tag->area == 'I') ? PI_INT_INPUT : (tag->area == 'Q') ? PI_INT_OUTPUT : PI_INT_MEMORY;
+            svc->width = 2;
+            svc->type = is_signed ? CIP_TYPE_INT : CIP_TYPE_UINT;
+            return true;
+        case 'D':
+            svc->area = PI_DINT_MEMORY;
+            svc->width = 4;
+            svc->type = is_real ? CIP_TYPE_REAL : is_signed ? CIP_TYPE_DINT : CIP_TYPE_UDINT;
+            return true;
+        case 'L':
+            svc->area = PI_LINT_MEMORY;
+            svc->width = 8;
+            svc->type = is_real ? CIP_TYPE_LREAL : is_signed ? CIP_TYPE_LINT : CIP_TYPE_ULINT;
+            return true;
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+// Parses the request path of a tag service: the symbolic segments of the tag
+// name, joined by dots, and an optional element segment. Returns the CIP
+// status of the path
+//-----------------------------------------------------------------------------
+static uint8_t parseTagPath(const unsigned char *path, int path_size, char *name, uint32_t *element)
+{
+    int name_length = 0;
+    int i = 0;
+    *element = 0;
+    name[0] = '\0';
+
+    while (i < path_size)
+    {
+        if (path[i] == 0x91 && i + 2 <= path_size)
+        {
+            // ANSI extended symbolic segment, padded to an even size
+            int length = path[i + 1];
+            if (i + 2 + length > path_size || name_length + length + 2 > CIP_MAX_TAG_NAME)
+                return CIP_STS_PATH_SEGMENT_ERROR;
+            if (name_length > 0) name[name_length++] = '.';
+            memcpy(&name[name_length], &path[i + 2], length);
+            name_length += length;
+            name[name_length] = '\0';
+            i += 2 + length + (length & 1);
+        }
+        else if (path[i] == 0x28 && i + 2 <= path_size)
+        {
+            *element = path[i + 1];
+            i += 2;
+        }
+        else if (path[i] == 0x29 && i + 4 <= path_size)
+        {
+            *element = readLE16(&path[i + 2]);
+            i += 4;
+        }
+        else if (path[i] == 0x2A && i + 6 <= path_size)
+        {
+            *element = readLE32(&path[i + 2]);
+            i += 6;
+        }
+        else
+        {
+            return CIP_STS_PATH_SEGMENT_ERROR;
+        }
+    }
+
+    return (name_length > 0) ? CIP_STS_SUCCESS : CIP_STS_PATH_UNKNOWN;
+}
+
+//-----------------------------------------------------------------------------
+// Resolves a Read Tag or Write Tag request. The status of the service tells
+// whether it can be carried out
+//-----------------------------------------------------------------------------
+static void resolveTagService(const unsigned char *request, int request_size, CipTagService *svc)
+{
+    memset(svc, 0, sizeof(*svc));
+    if (request_size < 2)
+    {
+        svc->status = CIP_STS_NOT_ENOUGH_DATA;
+        return;
+    }
+
+    svc->service = request[0];
+    int path_size = request[1] * 2;
+    if (svc->service != CIP_SVC_READ_TAG && svc->service != CIP_SVC_WRITE_TAG)
+    {
+        svc->status = CIP_STS_NOT_SUPPORTED;
+        return;
+    }
+    if (2 + path_size > request_size)
+    {
+        svc->status = CIP_STS_NOT_ENOUGH_DATA;
+        return;
+    }
+
+    char name[CIP_MAX_TAG_NAME];
+    svc->status = parseTagPath(&request[2], path_size, name, &svc->element);
+    if (svc->status != CIP_STS_SUCCESS)
+        return;
+
+    svc->tag = findTag(name);
+    if (svc->tag == NULL || !tagLayout(svc->tag, svc))
+    {
+        svc->status = CIP_STS_PATH_UNKNOWN;
+        return;
+    }
+
+    // Read: element count. Write: data type, element count and the values
+    const unsigned char *data = &request[2 + path_size];
+    int data_size = request_size - 2 - path_size;
+    if (svc->service == CIP_SVC_READ_TAG)
+    {
+        if (data_size < 2)
+        {
+            svc->status = CIP_STS_NOT_ENOUGH_DATA;
+            return;
+        }
+        svc->count = readLE16(data);
+    }
+    else
+    {
+        if (data_size < 4)
+        {
+            svc->status = CIP_STS_NOT_ENOUGH_DATA;
+            return;
+        }
+        uint16_t type = readLE16(data);
+        svc->count = readLE16(&data[2]);
+        svc->data = &data[4];
+        if (svc->tag->area == 'I')
+        {
+            svc->status = CIP_STS_PRIVILEGE_VIOLATION;
+            return;
+        }
+        if (type != svc->type)
+        {
+            svc->status = CIP_STS_GENERAL_ERROR;
+            svc->ext_status = CIP_EXT_TYPE_MISMATCH;
+            return;
+        }
+        int expected = svc->count * svc->width;
+        if (data_size - 4 != expected)
+        {
+            svc->status = (data_size - 4 < expected) ? CIP_STS_NOT_ENOUGH_DATA : CIP_STS_TOO_MUCH_DATA;
+            return;
+        }
+    }
+
+    // element comes from the request and may be anything up to 0xFFFFFFFF,
+    // so it is checked on its own before the range is
+    if (svc->count == 0 || svc->element >= svc->tag->count || svc->count > svc->tag->count - svc->element)
+    {
+        svc->status = CIP_STS_GENERAL_ERROR;
+        svc->ext_status = CIP_EXT_BEYOND_END;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Queues the writes of all the services as one batch, one run per service.
+// The runs carry big-endian values, or the bits packed eight per byte
+//-----------------------------------------------------------------------------
+static void queueTagWrites(CipTagService *services, int count)
+{
+    ProcessImageRun runs[CIP_MAX_SERVICES];
+    unsigned char run_data[CIP_MAX_MESSAGE_SIZE];
+    int run_count = 0;
+    int data_length = 0;
+
+    for (int s = 0; s < count; s++)
+    {
+        CipTagService *svc = &services[s];
+        if (svc->service != CIP_SVC_WRITE_TAG || svc->status != CIP_STS_SUCCESS)
+            continue;
+
+        // The request may carry more data than a reply, the services that
+        // don't fit with the ones before them are not written
+        int bytes = (svc->width == 1) ? (svc->count + 7) / 8 : svc->count * svc->width;
+        if (bytes > (int)sizeof(run_data) - data_length)
+        {
+            svc->status = CIP_STS_NO_RESOURCES;
+            continue;
+        }
+
+        ProcessImageRun *run = &runs[run_count++];
+        unsigned char *dst = &run_data[data_length];
+        uint32_t position = svc->tag->position + svc->element;
+        if (svc->width == 1)
+        {
+            memset(dst, 0, bytes);
+            for (int i = 0; i < svc->count; i++)
+            {
+                if (svc->data[i]) dst[i / 8] |= 1 << (i % 8);
+            }
+        }
+        else
+        {
+            for (int i = 0; i < svc->count; i++)
+            {
+                for (int b = 0; b < svc->width; b++)
+                {
+                    dst[i * svc->width + b] = svc->data[i * svc->width + svc->width - 1 - b];
+                }
+            }
+        }
+        data_length += bytes;
+
+        run->area = svc->area;
+        run->index = position;
+        run->count = svc->count;
+        run->data = dst;
+    }
+
+    if (run_count > 0 && queueProcessImageBatch(NULL, 0, runs, run_count) < 0)
+    {
+        for (int s = 0; s < count; s++)
+        {
+            if (services[s].service == CIP_SVC_WRITE_TAG && services[s].status == CIP_STS_SUCCESS)
+                services[s].status = CIP_STS_NO_RESOURCES;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Builds the reply of a tag service. The values of a read come from the
+// snapshot given. Returns the size of the reply, or -1 if it doesn't fit in
+// max_size bytes
+//-----------------------------------------------------------------------------
+static int buildTagReply(const CipTagService *svc, const ProcessImageSnapshot *snap, unsigned char *reply, int max_size)
+{
+    if (max_size < 6)
+        return -1;
+
+    reply[0] = svc->service | CIP_REPLY;
+    reply[1] = 0x00;
+    reply[2] = svc->status;
+    reply[3] = 0x00;
+    if (svc->ext_status != 0)
+    {
+        reply[3] = 1;
+        writeLE16(&reply[4], svc->ext_status);
+        return 6;
+    }
+    if (svc->service != CIP_SVC_READ_TAG || svc->status != CIP_STS_SUCCESS)
+        return 4;
+
+    int data_size = svc->count * svc->width;
+    if (6 + data_size > max_size)
+        return -1;
+
+    writeLE16(&reply[4], svc->type);
+    const unsigned char *src = (const unsigned char *)snap + svc->tag->image_offset + svc->element * svc->width;
+    unsigned char *dst = &reply[6];
+    if (svc->width == 1)
+    {
+        for (int i = 0; i < svc->count; i++) dst[i] = src[i] ? 0xFF : 0x00;
+    }
+    else
+    {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        memcpy(dst, src, data_size);
+#else
+        for (int i = 0; i < svc->count; i++)
+        {
+            for (int b = 0; b < svc->width; b++) dst[i * svc->width + b] = src[i * svc->width + svc->width - 1 - b];
+        }
+#endif
+    }
+
+    return 6 + data_size;
+}
+
+//-----------------------------------------------------------------------------
+// Builds the error reply of a tag service that doesn't fit in the message
+//-----------------------------------------------------------------------------
+static int buildTooLargeReply(const CipTagService *svc, unsigned char *reply)
+{
+    reply[0] = svc->service | CIP_REPLY;
+    reply[1] = 0x00;
+    reply[2] = CIP_STS_REPLY_TOO_LARGE;
+    reply[3] = 0x00;
+    return 4;
+}
+
+//-----------------------------------------------------------------------------
+// Processes a Multiple Service Packet, or a single tag service when request
+// is not one. The reply is written to reply. Returns its size
+//-----------------------------------------------------------------------------
+static int processTagServices(const unsigned char *request, int request_size, unsigned char *reply)
+{
+    CipTagService services[CIP_MAX_SERVICES];
+    int service_count = 1;
+    bool multiple = (request[0] == CIP_SVC_MULTIPLE_SERVICE);
+
+    if (multiple)
+    {
+        // Addressed to the message router, then the number of services and
+        // the offset of each one from the number
+        int path_size = request[1] * 2;
+        const unsigned char *data = &request[2 + path_size];
+        int data_size = request_size - 2 - path_size;
+        reply[0] = CIP_SVC_MULTIPLE_SERVICE | CIP_REPLY;
+        reply[1] = 0x00;
+        reply[3] = 0x00;
+        if (data_size < 2 || data_size < 2 + 2 * readLE16(data))
+        {
+            reply[2] = CIP_STS_NOT_ENOUGH_DATA;
+            return 4;
+        }
+        service_count = readLE16(data);
+        if (service_count > CIP_MAX_SERVICES || 6 + 2 * service_count > CIP_MAX_MESSAGE_SIZE)
+        {
+            reply[2] = CIP_STS_NO_RESOURCES;
+            return 4;
+        }
+        for (int s = 0; s < service_count; s++)
+        {
+            int start = readLE16(&data[2 + 2 * s]);
+            int end = (s + 1 < service_count) ? readLE16(&data[4 + 2 * s]) : data_size;
+            if (start < 2 + 2 * service_count || end > data_size || end <= start)
+            {
+                memset(&services[s], 0, sizeof(services[s]));
+                services[s].service = (start < data_size) ? data[start] : 0;
+                services[s].status = CIP_STS_NOT_ENOUGH_DATA;
+                continue;
+            }
+            resolveTagService(&data[start], end - start, &services[s]);
+        }
+    }
+    else
+    {
+        resolveTagService(request, request_size, &services[0]);
+    }
+
+    queueTagWrites(services, service_count);
+
+    // Every read of the message is served by the same snapshot
+    int reply_size;
+    uint32_t sequence;
+    const ProcessImageSnapshot *snap;
+    do
+    {
+        snap = beginProcessImageRead(&sequence);
+        if (!multiple)
+        {
+            reply_size = buildTagReply(&services[0], snap, reply, CIP_MAX_MESSAGE_SIZE);
+            if (reply_size < 0) reply_size = buildTooLargeReply(&services[0], reply);
+            continue;
+        }
+
+        uint8_t status = CIP_STS_SUCCESS;
+        writeLE16(&reply[4], service_count);
+        reply_size = 6 + 2 * service_count;
+        for (int s = 0; s < service_count; s++)
+        {
+            writeLE16(&reply[6 + 2 * s], reply_size - 4);
+            int size = buildTagReply(&services[s], snap, &reply[reply_size], CIP_MAX_MESSAGE_SIZE - reply_size);
+            if (size < 0)
+            {
+                size = (CIP_MAX_MESSAGE_SIZE - reply_size >= 4) ? buildTooLargeReply(&services[s], &reply[reply_size]) : 0;
+                status = CIP_STS_EMBEDDED_ERROR;
+            }
+            if (services[s].status != CIP_STS_SUCCESS)
+                status = CIP_STS_EMBEDDED_ERROR;
+            reply_size += size;
+        }
+        reply[2] = status;
+    } while (!endProcessImageRead(snap, sequence));
+
+    return reply_size;
+}
+
+//-----------------------------------------------------------------------------
+// Processes a CIP request of the message router. The reply is written over
+// the request. Returns the size of the reply, or -1 if the request is too
+// short to be answered
+//-----------------------------------------------------------------------------
+int processCIPMessage(unsigned char *buffer, int buffer_size)
+{
+    unsigned char reply[CIP_MAX_MESSAGE_SIZE];
+    unsigned char *request = buffer;
+    int request_size = buffer_size;
+
+    if (buffer_size < 2 || 2 + buffer[1] * 2 > buffer_size)
+        return -1;
+
+    // Unconnected Send carries the request for the target with its size
+    // after the priority and the timeout ticks. A successful reply is the
+    // reply of the target alone
+    if (buffer[0] == CIP_SVC_UNCONNECTED_SEND)
+    {
+        int offset = 2 + buffer[1] * 2;
+        if (offset + 4 > buffer_size || offset + 4 + readLE16(&buffer[offset + 2]) > buffer_size)
+        {
+            buffer[0] = CIP_SVC_UNCONNECTED_SEND | CIP_REPLY;
+            buffer[1] = 0x00;
+            buffer[2] = CIP_STS_NOT_ENOUGH_DATA;
+            buffer[3] = 0x00;
+            return 4;
+        }
+        request_size = readLE16(&buffer[offset + 2]);
+        request = &buffer[offset + 4];
+        if (request_size < 2 || 2 + request[1] * 2 > request_size)
+            return -1;
+    }
+
+    int reply_size;
+    if (request[0] == CIP_SVC_MULTIPLE_SERVICE || request[0] == CIP_SVC_READ_TAG || request[0] == CIP_SVC_WRITE_TAG)
+    {
+        reply_size = processTagServices(request, request_size, reply);
+    }
+    else
+    {
+        reply[0] = request[0] | CIP_REPLY;
+        reply[1] = 0x00;
+        reply[2] = CIP_STS_NOT_SUPPORTED;
+        reply[3] = 0x00;
+        reply_size = 4;
+    }
+
+    memcpy(buffer, reply, reply_size);
+    return reply_size;
+}
@@ -9,6 +9,7 @@
 #include <asiodnp3/UpdateBuilder.h>
 
 #include <asiopal/UTCTimeSource.h>
+#include <asiopal/SerialTypes.h>
 #include <opendnp3/outstation/SimpleCommandHandler.h>
 
 #include <opendnp3/LogLevels.h>
@@ -18,13 +19,17 @@
 #include <thread>
 #include <iostream>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
+#include <math.h>
 #include <signal.h>
 #include <algorithm> 
 #include <functional> 
 #include <cctype>
 #include <locale>
 #include <fstream>
+#include <vector>
+#include <map>
 
 #include "ladder.h"
 
@@ -41,13 +46,25 @@
 #define MIN_64B_RANGE			4096
 #define MAX_64B_RANGE			8191
 
-#define OPLC_CYCLE              50000000
+// Longest wait for a new scan, so run_dnp3 is still checked when the
+// PLC is stopped
+#define DNP3_WAIT_TIMEOUT       100
 
-// Initial offset parameters (yurgen1975)
-int offset_di = 0;
-int offset_do = 0;
-int offset_ai = 0;
-int offset_ao = 0;
+// Longest wait of a command request for the scan that applies its outputs
+#define DNP3_COMMAND_TIMEOUT    1000
+
+// Number of scans between two updates of the outstation databases
+int update_decimation = 1;
+
+// Number of threads of the DNP3 manager pool, shared by all channels
+int thread_count = 1;
+
+// Resolution in ms of the timers of the pool, 0 for exact timers
+int timer_resolution = 0;
+
+// Ciphers of the TLS outstations unless tls_ciphers is set: ECDHE key
+// exchange only, so a leaked server key doesn't expose past sessions
+#define DNP3_TLS_CIPHERS        "ECDHE+AESGCM:ECDHE+CHACHA20:!aNULL"
 
 using namespace std;
 using namespace opendnp3;
@@ -82,60 +99,106 @@ static inline std::string &trim(std::string &s) {
 }
 
 
+//------------------------------------------------------------------
+// Copy of the process image values reported by the outstations
+//------------------------------------------------------------------
+struct DNP3Image {
+    IEC_BOOL bool_input[BUFFER_SIZE][8];
+    IEC_BOOL bool_output[BUFFER_SIZE][8];
+    IEC_UINT int_input[BUFFER_SIZE];
+    IEC_UINT int_output[BUFFER_SIZE];
+    IEC_UINT int_memory[BUFFER_SIZE];
+    IEC_UDINT dint_memory[BUFFER_SIZE];
+    IEC_ULINT lint_memory[BUFFER_SIZE];
+    IEC_BYTE bool_input_bits[BUFFER_SIZE];
+    IEC_BYTE bool_output_bits[BUFFER_SIZE];
+    uint64_t timestamp;
+    uint32_t version;
+};
+
+//------------------------------------------------------------------
+// Settings and state of one outstation. Every outstation answers its
+// own master and reports its own subset of points, selected by its
+// offsets. The last values applied to its database are kept so that
+// only the points that changed are sent to it
+//------------------------------------------------------------------
+struct DNP3Outstation {
+    DNP3Outstation(const DatabaseSizes& sizes) : config(sizes) {}
+
+    OutstationStackConfig config;
+    int port = 0;
+
+    // Serial line of the outstation. Without a device name the outstation
+    // is served on the TCP port
+    SerialSettings serial;
+
+    // TLS (DNP3 over TLS, IEC 62351-3) on the TCP
+    // port. Sessions are resumed by default, so a master reconnecting
+    // over a flaky link skips the full handshake
+    bool tls = false;
+    string tls_peer_cert;
+    string tls_local_cert;
+    string tls_private_key;
+    string tls_ciphers = DNP3_TLS_CIPHERS;
+    int tls_verify_depth = 0;
+    bool tls_session_resumption = true;
+    long tls_session_timeout = 7200;
+
+    // Initial offset parameters (yurgen1975)
+    int offset_di = 0;
+    int offset_do = 0;
+    int offset_ai = 0;
+    int offset_ao = 0;
+
+    std::shared_ptr<IOutstation> outstation;
+    DNP3Image applied_image;
+    bool full_update = true;
+};
+
 //-----------------------------------------------------------------------------
-// Class to handle commands from the master
+// Class to handle commands from the master. The outputs operated by a request
+// are queued together on the process image write queue when the request
+// ends, so one scan applies all of them, and the response is only sent once
+// it did
 //-----------------------------------------------------------------------------
 class CommandCallback: public ICommandHandler {
 public:
-   
+    CommandCallback(DNP3Outstation *settings) : os(settings) {}
+
     //CROB - changed to support offsets (yurgen1975)
     virtual CommandStatus Select(const ControlRelayOutputBlock& command, uint16_t index) {
-        index = index + offset_di;
+        index = index + os->offset_di;
         return CommandStatus::SUCCESS;
     }
     virtual CommandStatus Operate(const ControlRelayOutputBlock& command, uint16_t index, OperateType opType) {
-        index = index + offset_di;
+        index = index + os->offset_di;
         auto code = command.functionCode;
-        CommandStatus return_val;
-            
-           
-        if(code == ControlCode::LATCH_ON || code == ControlCode::LATCH_OFF) {
-            return_val = CommandStatus::SUCCESS;
-
-            IEC_BOOL crob_val = (code == ControlCode::LATCH_ON);
-                           
-            pthread_mutex_lock(&bufferLock);
-            if(bool_output[index/8][index%8] != NULL) {
-                *bool_output[index/8][index%8] = crob_val;
-            }
-            pthread_mutex_unlock(&bufferLock);
-        }
-        else {
-            return_val = CommandStatus::NOT_SUPPORTED;
-        }
-        return return_val;
+
+        if(code != ControlCode::LATCH_ON && code != ControlCode::LATCH_OFF)
+            return CommandStatus::NOT_SUPPORTED;
+        if(index / 8 >= BUFFER_SIZE)
+            return CommandStatus::OUT_OF_RANGE;
+
+        queueWrite(PI_BOOL_OUTPUT, index / 8, index % 8, code == ControlCode::LATCH_ON, 1);
+        return CommandStatus::SUCCESS;
     }
 
     //Analog Out - changed to support offsets (yurgen1975)
     virtual CommandStatus Select(const AnalogOutputInt16& command, uint16_t index) {
-        index = index + offset_ao;
+        index = index + os->offset_ao;
         return CommandStatus::SUCCESS;
     }
     virtual CommandStatus Operate(const AnalogOutputInt16& command, uint16_t index, OperateType opType) {
-        index = index + offset_ao;
-        auto ao_val = command.value;
-        pthread_mutex_lock(&bufferLock);
-        if(index < MIN_16B_RANGE && int_output[index] != NULL) {
-            *int_output[index] = ao_val;
-        }
-        else if(index < MAX_16B_RANGE && 
-                int_memory[index - MIN_16B_RANGE] != NULL) {
-            *int_memory[index - MIN_16B_RANGE] = ao_val;
-        }
-        else if(index > MAX_16B_RANGE) {
+        index = index + os->offset_ao;
+        IEC_UINT ao_val = (IEC_UINT)command.value;
+
+        if(index > MAX_16B_RANGE)
             return CommandStatus::OUT_OF_RANGE;
-        }
-        pthread_mutex_unlock(&bufferLock);
+
+        if(index < MIN_16B_RANGE)
+            queueWrite(PI_INT_OUTPUT, index, 0, ao_val, 0xFFFF);
+        else if(index < MAX_16B_RANGE)
+            queueWrite(PI_INT_MEMORY, index - MIN_16B_RANGE, 0, ao_val, 0xFFFF);
         return CommandStatus::SUCCESS;
     }
 
@@ -144,17 +207,12 @@ public:
         return CommandStatus::SUCCESS;
     }
     virtual CommandStatus Operate(const AnalogOutputInt32& command, uint16_t index, OperateType opType) {
-        auto ao_val = command.value;
+        IEC_UDINT ao_val = (IEC_UDINT)command.value;
 
         if(index < MIN_32B_RANGE || index >= MAX_32B_RANGE)
             return CommandStatus::OUT_OF_RANGE;
-        
-        pthread_mutex_lock(&bufferLock);
-        if(dint_memory[index - MIN_32B_RANGE] != NULL) {
-            *dint_memory[index - MIN_32B_RANGE] = ao_val;
-        }
-        pthread_mutex_unlock(&bufferLock);
 
+        queueWrite(PI_DINT_MEMORY, index - MIN_32B_RANGE, 0, ao_val, 0xFFFFFFFF);
         return CommandStatus::SUCCESS;
     }
 
@@ -164,17 +222,12 @@ public:
         return CommandStatus::SUCCESS;
     }
     virtual CommandStatus Operate(const AnalogOutputFloat32& command, uint16_t index, OperateType opType) {
-        auto ao_val = command.value;
+        IEC_UDINT ao_val = (IEC_UDINT)(IEC_DINT)command.value;
 
         if(index < MIN_32B_RANGE || index >= MAX_32B_RANGE)
             return CommandStatus::OUT_OF_RANGE;
-        
-        pthread_mutex_lock(&bufferLock);
-        if(dint_memory[index - MIN_32B_RANGE] != NULL) {
-            *dint_memory[index - MIN_32B_RANGE] = ao_val;
-        }
-        pthread_mutex_unlock(&bufferLock);
 
+        queueWrite(PI_DINT_MEMORY, index - MIN_32B_RANGE, 0, ao_val, 0xFFFFFFFF);
         return CommandStatus::SUCCESS;
     }
 
@@ -183,218 +236,615 @@ public:
         return CommandStatus::SUCCESS;
     }
     virtual CommandStatus Operate(const AnalogOutputDouble64& command, uint16_t index, OperateType opType) {
-        auto ao_val = command.value;
+        IEC_ULINT ao_val = (IEC_ULINT)(IEC_LINT)command.value;
 
         if(index < MIN_64B_RANGE || index >= MAX_64B_RANGE)
             return CommandStatus::OUT_OF_RANGE;
-        
-        pthread_mutex_lock(&bufferLock);
-        if(lint_memory[index - MIN_64B_RANGE] != NULL) {
-            *lint_memory[index - MIN_64B_RANGE] = ao_val;
-        }
-        pthread_mutex_unlock(&bufferLock);
 
+        queueWrite(PI_LINT_MEMORY, index - MIN_64B_RANGE, 0, ao_val, ~(IEC_ULINT)0);
         return CommandStatus::SUCCESS;
     }
 protected:
-    void Start() final {}
-    void End() final {}
+    // Called once per command request of the master
+    void Start() final {
+        recordProtocolRequest(DNP3_PROTOCOL, false);
+        writes.clear();
+    }
+    // The request is answered once this returns, so it waits for the scan
+    // that applies its writes
+    void End() final {
+        if (writes.empty())
+            return;
+
+        int result = applyProcessImageWritesSync(writes.data(), (int)writes.size(), DNP3_COMMAND_TIMEOUT);
+        if (result < 0) {
+            char log_msg[1000];
+            snprintf(log_msg, sizeof(log_msg), "DNP3: %d operated outputs %s\n", (int)writes.size(),
+                     result == -1 ? "dropped, the write queue is full" : "not applied by a scan yet, the response is sent anyway");
+            openplc_log(log_msg);
+        }
+        writes.clear();
+    }
+
+private:
+    void queueWrite(uint8_t area, uint16_t index, uint8_t bit, IEC_ULINT value, IEC_ULINT mask) {
+        ProcessImageWrite write;
+        write.area = area;
+        write.bit = bit;
+        write.index = index;
+        write.value = value;
+        write.mask = mask;
+        writes.push_back(write);
+    }
+
+    DNP3Outstation *os;
+    std::vector<ProcessImageWrite> writes;    // outputs operated by the current request
+};
+
+//-----------------------------------------------------------------------------
+// Prints the state changes of a channel and counts the time it is open as a
+// connection of the DNP3 server
+//-----------------------------------------------------------------------------
+class MetricsChannelListener final : public IChannelListener {
+public:
+    virtual void OnStateChange(ChannelState state) override {
+        std::cout << "channel state change: " << ChannelStateToString(state) << std::endl;
+        bool now_open = (state == ChannelState::OPEN);
+        if (now_open != open) recordProtocolConnection(DNP3_PROTOCOL, now_open);
+        open = now_open;
+    }
+
+    static std::shared_ptr<IChannelListener> Create() {
+        return std::make_shared<MetricsChannelListener>();
+    }
+
+private:
+    bool open = false;
 };
 
+static DNP3Image current_image;
+static ProcessImageChanges current_changes;
+
 //------------------------------------------------------------------
-// Function to update DNP3 values every time they may have changed
+// Copies the published process image into current_image without
+// taking bufferLock, retrying if the scan rewrote it meanwhile. The
+// blocks that changed since the previous copy are left on
+// current_changes
+//------------------------------------------------------------------
+static void read_image() {
+    uint32_t previous = current_image.version;
+    uint32_t sequence;
+    const ProcessImageSnapshot *snap;
+    do {
+        snap = beginProcessImageRead(&sequence);
+        memcpy(current_image.bool_input, snap->bool_input, sizeof(current_image.bool_input));
+        memcpy(current_image.bool_output, snap->bool_output, sizeof(current_image.bool_output));
+        memcpy(current_image.int_input, snap->int_input, sizeof(current_image.int_input));
+        memcpy(current_image.int_output, snap->int_output, sizeof(current_image.int_output));
+        memcpy(current_image.int_memory, snap->int_memory, sizeof(current_image.int_memory));
+        memcpy(current_image.dint_memory, snap->dint_memory, sizeof(current_image.dint_memory));
+        memcpy(current_image.lint_memory, snap->lint_memory, sizeof(current_image.lint_memory));
+        memcpy(current_image.bool_input_bits, snap->bool_input_bits, sizeof(current_image.bool_input_bits));
+        memcpy(current_image.bool_output_bits, snap->bool_output_bits, sizeof(current_image.bool_output_bits));
+        current_image.timestamp = snap->timestamp;
+        current_image.version = snap->version;
+    } while (!endProcessImageRead(snap, sequence));
+    getProcessImageChanges(previous, current_image.version, &current_changes);
+}
+
+//------------------------------------------------------------------
+// Returns the first bool from index i on (up to end) that differs
+// between two packed bool areas, or end if none does. Runs of 64
+// bools that are equal are skipped with a single compare
+//------------------------------------------------------------------
+static int next_toggled(const IEC_BYTE *cur, const IEC_BYTE *last, int i, int end) {
+    while(i < end) {
+        if(i % 64 == 0 && i + 64 <= end) {
+            uint64_t a, b;
+            memcpy(&a, cur + i/8, sizeof(a));
+            memcpy(&b, last + i/8, sizeof(b));
+            if(a == b) {
+                i += 64;
+                continue;
+            }
+        }
+        if(((cur[i/8] ^ last[i/8]) >> (i%8)) & 1)
+            return i;
+        i++;
+    }
+    return end;
+}
+
+//------------------------------------------------------------------
+// Time of the last change of an input, the time of the image for an
+// input that never changed
+//------------------------------------------------------------------
+static DNPTime input_time(int area, int index, uint64_t image_time) {
+    uint64_t changed = getInputChangeTime(area, index);
+    return DNPTime(changed ? changed / 1000 : image_time);
+}
+
+//------------------------------------------------------------------
+// Function to update DNP3 values every time they may have changed.
+// Must be called after read_image(). Only the points that changed since the last call are sent to the
+// outstation (all of them on the first call), so the database and
+// the event buffers are not churned by unchanged values. Analog
+// deadbands are applied by the outstation when generating events.
+// Points on blocks of the image that the scan didn't change are not
+// even compared. The inputs are timestamped with the time they changed
+// (see getInputChangeTime), so their events keep the sequence of events
+// of the inputs even when the outstations are updated every few scans.
+// The other points take the time the scan published them
 // Updated by Yurgen1975 to support slave devices: DI/DO address 800 and AI/AO address 100
 //------------------------------------------------------------------
-void update_vals(std::shared_ptr<IOutstation> outstation){
+void update_vals(DNP3Outstation *os){
     UpdateBuilder builder;
+    int changes = 0;
+    bool full_update = os->full_update;
+    int offset_di = os->offset_di;
+    int offset_do = os->offset_do;
+    int offset_ai = os->offset_ai;
+    int offset_ao = os->offset_ao;
+
+    DNP3Image *cur = &current_image;
+    DNP3Image *last = &os->applied_image;
+    const Flags online(0x01);
+    const DNPTime time(cur->timestamp);
+
+    // Every outstation is updated from each image, so the changes since
+    // the previous image are the changes since its last update
+    const ProcessImageChanges *dirty = &current_changes;
+    auto unchanged = [full_update, dirty](size_t offset, size_t size) {
+        return !full_update && !processImageChanged(dirty, offset, size);
+    };
+    const size_t data_start = offsetof(ProcessImageSnapshot, bool_input);
+    if(unchanged(data_start, sizeof(ProcessImageSnapshot) - data_start))
+        return;
+
     // Update Discrete input (Binary input) - changed to support offsets (yurgen1975)
-    for(int i = offset_di; i < MAX_DISCRETE_INPUT; i++) {
-        builder.Update(Binary((bool)(*bool_input[i/8][i%8])), i-offset_di);
+    // Only the bools that toggled are visited, found on the packed areas
+    for(int i = full_update ? offset_di : next_toggled(cur->bool_input_bits, last->bool_input_bits, offset_di, MAX_DISCRETE_INPUT);
+        i < MAX_DISCRETE_INPUT;
+        i = full_update ? i + 1 : next_toggled(cur->bool_input_bits, last->bool_input_bits, i + 1, MAX_DISCRETE_INPUT)) {
+        builder.Update(Binary((bool)cur->bool_input[i/8][i%8], online, input_time(PI_BOOL_INPUT, i, cur->timestamp)), i-offset_di);
+        changes++;
     }
 
     // Update Coils (Binary Output) - changed to support offsets (yurgen1975)
-    for(int i = offset_do; i < MAX_COILS; i++) {
-        builder.Update(BinaryOutputStatus((bool)(*bool_output[i/8][i%8])), i-offset_do);
-    }    
+    for(int i = full_update ? offset_do : next_toggled(cur->bool_output_bits, last->bool_output_bits, offset_do, MAX_COILS);
+        i < MAX_COILS;
+        i = full_update ? i + 1 : next_toggled(cur->bool_output_bits, last->bool_output_bits, i + 1, MAX_COILS)) {
+        builder.Update(BinaryOutputStatus((bool)cur->bool_output[i/8][i%8], online, time), i-offset_do);
+        changes++;
+    }
 
     // Update Input Registers (Analog Input) - changed to support offsets (yurgen1975)
     for (int i = offset_ai; i < MAX_INP_REGS; i++) {
-        builder.Update(Analog((int)(*int_input[i])), i-offset_ai);
+        if(unchanged(offsetof(ProcessImageSnapshot, int_input) + i * sizeof(IEC_UINT), sizeof(IEC_UINT)))
+            continue;
+        if(full_update || cur->int_input[i] != last->int_input[i]) {
+            builder.Update(Analog((int)cur->int_input[i], online, input_time(PI_INT_INPUT, i, cur->timestamp)), i-offset_ai);
+            changes++;
+        }
     }
     
     // Update Holding Registers (Analog Output) - changed to support offsets (yurgen1975)
     for (int i = offset_ao; i < MIN_16B_RANGE; i++) {
-        builder.Update(AnalogOutputStatus((int)(*int_output[i])), i-offset_ao);
-    }
-    // Update Holding registers for memory
-    for (int i = MIN_16B_RANGE; i < MAX_16B_RANGE; i++) {
-        if(int_memory[i - MIN_16B_RANGE] != NULL)
-            builder.Update(
-                    AnalogOutputStatus((int)(*int_memory[i - MIN_16B_RANGE])),
-                    i
-            );
-    } 
+        if(unchanged(offsetof(ProcessImageSnapshot, int_output) + i * sizeof(IEC_UINT), sizeof(IEC_UINT)))
+            continue;
+        if(full_update || cur->int_output[i] != last->int_output[i]) {
+            builder.Update(AnalogOutputStatus((int)cur->int_output[i], online, time), i-offset_ao);
+            changes++;
+        }
+    }
+    // Update Holding registers for memory. Only the entries located by the
+    // program are published, so only their ranges are walked
+    const ImageRanges *ranges = getImageRanges(PI_INT_MEMORY);
+    for (int r = 0; r < ranges->count; r++) {
+        const ImageRange *range = &ranges->ranges[r];
+        for (int idx = range->first; idx < (int)(range->first + range->count) && idx + MIN_16B_RANGE < MAX_16B_RANGE; idx++) {
+            if(unchanged(offsetof(ProcessImageSnapshot, int_memory) + idx * sizeof(IEC_UINT), sizeof(IEC_UINT)))
+                continue;
+            if(full_update || cur->int_memory[idx] != last->int_memory[idx]) {
+                builder.Update(AnalogOutputStatus((int)cur->int_memory[idx], online, time), idx + MIN_16B_RANGE);
+                changes++;
+            }
+        }
+    }
     // Update Holding registers for 32 b memory
-    for (int i = MIN_32B_RANGE; i < MAX_32B_RANGE; i++) {
-        if(dint_memory[i - MIN_32B_RANGE] != NULL)
-            builder.Update(
-                    AnalogOutputStatus((int)(*dint_memory[i - MIN_32B_RANGE])),
-                    i
-            );
-    } 
+    ranges = getImageRanges(PI_DINT_MEMORY);
+    for (int r = 0; r < ranges->count; r++) {
+        const ImageRange *range = &ranges->ranges[r];
+        for (int idx = range->first; idx < (int)(range->first + range->count) && idx + MIN_32B_RANGE < MAX_32B_RANGE; idx++) {
+            if(unchanged(offsetof(ProcessImageSnapshot, dint_memory) + idx * sizeof(IEC_UDINT), sizeof(IEC_UDINT)))
+                continue;
+            if(full_update || cur->dint_memory[idx] != last->dint_memory[idx]) {
+                builder.Update(AnalogOutputStatus((int)cur->dint_memory[idx], online, time), idx + MIN_32B_RANGE);
+                changes++;
+            }
+        }
+    }
     // Update Holding registers for 64 b memory
-    for (int i = MIN_64B_RANGE; 
-         (i < MAX_64B_RANGE && 
-            i - MIN_64B_RANGE < sizeof(lint_memory) / sizeof(lint_memory[0])); 
-         i++) {
-        if(lint_memory[i - MIN_64B_RANGE] != NULL)
-            builder.Update(
-                    AnalogOutputStatus((int)(*lint_memory[i - MIN_64B_RANGE])),
-                    i
-            );
-    } 
-    outstation->Apply(builder.Build());
+    ranges = getImageRanges(PI_LINT_MEMORY);
+    for (int r = 0; r < ranges->count; r++) {
+        const ImageRange *range = &ranges->ranges[r];
+        for (int idx = range->first; idx < (int)(range->first + range->count) && idx + MIN_64B_RANGE < MAX_64B_RANGE; idx++) {
+            if(unchanged(offsetof(ProcessImageSnapshot, lint_memory) + idx * sizeof(IEC_ULINT), sizeof(IEC_ULINT)))
+                continue;
+            if(full_update || cur->lint_memory[idx] != last->lint_memory[idx]) {
+                builder.Update(AnalogOutputStatus((int)cur->lint_memory[idx], online, time), idx + MIN_64B_RANGE);
+                changes++;
+            }
+        }
+    }
+
+    memcpy(last, cur, sizeof(DNP3Image));
+    os->full_update = false;
+
+    if(changes > 0)
+        os->outstation->Apply(builder.Build());
 }
 
 //----------------------------------------------------------------------
-// Need to parse 'database_size' first
+// Reads dnp3.cfg. Settings before the first [outstation] header are
+// shared by all outstations, every [outstation] section then defines
+// one outstation. A file without sections defines a single one
 //----------------------------------------------------------------------
-OutstationStackConfig create_config() {
+static void readConfigFile(vector<string> &shared, vector<vector<string>> &sections) {
     string line;
     ifstream cfgfile("dnp3.cfg");
-    bool found = false;
     if(cfgfile.is_open()) {
         while (getline(cfgfile, line)) {
-            if (line[0] == '#')
+            string stripped = line;
+            trim(stripped);
+            if (stripped.empty() || stripped[0] == '#')
                 continue;
-            try {
-                istringstream iss(line);
-                string token;
-                getline(iss, token, '=');
-                token = trim(token);
-                if (token == "database_size") {
-                    getline(iss, token, '=');
-                    return OutstationStackConfig(
-                               DatabaseSizes::AllTypes(atoi(token.c_str()))
-                           );
-                }
-                else 
-                    continue;
-            } catch(...) {
-                cout << "Malformatted Line: " << line << endl;
-                exit(1);
-            } 
-
+            if (stripped[0] == '[') {
+                sections.push_back(vector<string>());
+                continue;
+            }
+            if (sections.empty())
+                shared.push_back(line);
+            else
+                sections.back().push_back(line);
         }
     }
-    return OutstationStackConfig(DatabaseSizes::AllTypes(10));
+    if (sections.empty())
+        sections.push_back(vector<string>());
 }
 
 //----------------------------------------------------------------------
-// parse dnp3.cfg and set dnp3 settings
+// Need to parse 'database_size' first
 //----------------------------------------------------------------------
-OutstationStackConfig parseDNP3Config() {
-    string line;
-    ifstream cfgfile("dnp3.cfg");
-    OutstationStackConfig config = create_config();
-    if(cfgfile.is_open()) {
-        while (getline(cfgfile, line)) {
-            if (line[0] == '#')
-                continue;
-            try {
-                istringstream iss(line);
-                string token;
+static int findDatabaseSize(const vector<string> &lines, int size) {
+    for (const string &line : lines) {
+        try {
+            istringstream iss(line);
+            string token;
+            getline(iss, token, '=');
+            token = trim(token);
+            if (token == "database_size") {
                 getline(iss, token, '=');
-                token = trim(token);
-                if (token == "local_address") {
-                    getline(iss, token, '=');     
-                    config.link.LocalAddr = atoi(token.c_str());
-                } else if (token == "remote_address") {
-                    getline(iss, token, '=');     
-                    config.link.RemoteAddr = atoi(token.c_str());
-                } else if (token == "keep_alive_timeout") {
-                    getline(iss, token, '=');     
-                    if(token == "MAX") {
-                        config.link.KeepAliveTimeout = 
-                            openpal::TimeDuration::Max();
-                    }
-                    else {
-                        config.link.KeepAliveTimeout = 
-                            openpal::TimeDuration::Seconds(atoi(token.c_str()));
-                    }
-                } else if (token == "enable_unsolicited") {
-                    getline(iss, token, '=');
-                    if(token == "True")
-                        config.outstation.params.allowUnsolicited = true;
-                    else
-                        config.outstation.params.allowUnsolicited = false;
-                } else if (token == "select_timeout") {
-                    getline(iss, token, '=');     
-                    config.outstation.params.selectTimeout = 
-                        openpal::TimeDuration::Seconds(atoi(token.c_str()));
-                } else if (token == "max_controls_per_request") {
-                    getline(iss, token, '=');
-                    config.outstation.params.maxControlsPerRequest = 
-                        atoi(token.c_str()); 
-                } else if (token == "max_rx_frag_size") {
-                    getline(iss, token, '=');     
-                    config.outstation.params.maxRxFragSize = 
-                        atoi(token.c_str());
-                } else if (token == "max_tx_frag_size") {
-                    getline(iss, token, '=');     
-                    config.outstation.params.maxTxFragSize = 
-                        atoi(token.c_str());
-                } else if (token == "event_buffer_size") {
-                    getline(iss, token, '=');     
-                    config.outstation.eventBufferConfig =
-                        EventBufferConfig::AllTypes(atoi(token.c_str()));
+                size = atoi(token.c_str());
+            }
+        } catch(...) {
+            cout << "Malformatted Line: " << line << endl;
+            exit(1);
+        }
+    }
+    return size;
+}
+
+//----------------------------------------------------------------------
+// Splits a setting of one point, such as analog_deadband[3], into its
+// name and index. Settings of all points get index -1
+//----------------------------------------------------------------------
+static int pointIndex(string &token) {
+    size_t open = token.find('[');
+    if (open == string::npos || token.back() != ']')
+        return -1;
+    int index = atoi(token.substr(open + 1).c_str());
+    token = token.substr(0, open);
+    return index;
+}
+
+//----------------------------------------------------------------------
+// Maps a class number of dnp3.cfg (0 for static data only, 1 to 3 for
+// the event classes) to its PointClass
+//----------------------------------------------------------------------
+static PointClass pointClass(int number) {
+    switch (number) {
+        case 0: return PointClass::Class0;
+        case 2: return PointClass::Class2;
+        case 3: return PointClass::Class3;
+        default: return PointClass::Class1;
+    }
+}
+
+//----------------------------------------------------------------------
+// Sets a field of the points of a database table: every point if index
+// is -1, or only the point at index
+//----------------------------------------------------------------------
+template <class Table, class Setter>
+static void setPoints(Table &table, int index, Setter set) {
+    if (index < 0) {
+        for (uint16_t i = 0; i < table.Size(); i++)
+            set(table[i]);
+    } else if (index < table.Size()) {
+        set(table[index]);
+    } else {
+        cout << "DNP3 point index out of the database: " << index << endl;
+    }
+}
+
+//----------------------------------------------------------------------
+// Applies one dnp3.cfg setting to an outstation
+//----------------------------------------------------------------------
+static void applySetting(DNP3Outstation *os, const string &line) {
+    try {
+        istringstream iss(line);
+        string token;
+        getline(iss, token, '=');
+        token = trim(token);
+        int index = pointIndex(token);
+        DatabaseConfig &db = os->config.dbConfig;
+        EventBufferConfig &events = os->config.outstation.eventBufferConfig;
+        if (token == "local_address") {
+            getline(iss, token, '=');     
+            os->config.link.LocalAddr = atoi(token.c_str());
+        } else if (token == "remote_address") {
+            getline(iss, token, '=');     
+            os->config.link.RemoteAddr = atoi(token.c_str());
+        } else if (token == "keep_alive_timeout") {
+            getline(iss, token, '=');     
+            if(token == "MAX") {
+                os->config.link.KeepAliveTimeout = 
+                    openpal::TimeDuration::Max();
+            }
+            else {
+                os->config.link.KeepAliveTimeout = 
+                    openpal::TimeDuration::Seconds(atoi(token.c_str()));
+            }
+        } else if (token == "enable_unsolicited") {
+            getline(iss, token, '=');
+            if(token == "True")
+                os->config.outstation.params.allowUnsolicited = true;
+            else
+                os->config.outstation.params.allowUnsolicited = false;
+        } else if (token == "select_timeout") {
+            getline(iss, token, '=');     
+            os->config.outstation.params.selectTimeout = 
+                openpal::TimeDuration::Seconds(atoi(token.c_str()));
+        } else if (token == "max_controls_per_request") {
+            getline(iss, token, '=');
+            os->config.outstation.params.maxControlsPerRequest = 
+                atoi(token.c_str()); 
+        } else if (token == "max_rx_frag_size") {
+            getline(iss, token, '=');     
+            os->config.outstation.params.maxRxFragSize = 
+                atoi(token.c_str());
+        } else if (token == "max_tx_frag_size") {
+            getline(iss, token, '=');     
+            os->config.outstation.params.maxTxFragSize = 
+                atoi(token.c_str());
+        } else if (token == "event_buffer_size") {
+            getline(iss, token, '=');     
+            os->config.outstation.eventBufferConfig =
+                EventBufferConfig::AllTypes(atoi(token.c_str()));
+        } else if (token == "event_buffer_size_binary") {
+            getline(iss, token, '=');
+            events.maxBinaryEvents = atoi(token.c_str());
+        } else if (token == "event_buffer_size_binary_output") {
+            getline(iss, token, '=');
+            events.maxBinaryOutputStatusEvents = atoi(token.c_str());
+        } else if (token == "event_buffer_size_analog") {
+            getline(iss, token, '=');
+            events.maxAnalogEvents = atoi(token.c_str());
+        } else if (token == "event_buffer_size_analog_output") {
+            getline(iss, token, '=');
+            events.maxAnalogOutputStatusEvents = atoi(token.c_str());
+        } else if (token == "binary_class") {
+            getline(iss, token, '=');
+            PointClass clazz = pointClass(atoi(token.c_str()));
+            setPoints(db.binary, index, [clazz](BinaryConfig &point) { point.clazz = clazz; });
+        } else if (token == "binary_output_class") {
+            getline(iss, token, '=');
+            PointClass clazz = pointClass(atoi(token.c_str()));
+            setPoints(db.boStatus, index, [clazz](BOStatusConfig &point) { point.clazz = clazz; });
+        } else if (token == "analog_class") {
+            getline(iss, token, '=');
+            PointClass clazz = pointClass(atoi(token.c_str()));
+            setPoints(db.analog, index, [clazz](AnalogConfig &point) { point.clazz = clazz; });
+        } else if (token == "analog_output_class") {
+            getline(iss, token, '=');
+            PointClass clazz = pointClass(atoi(token.c_str()));
+            setPoints(db.aoStatus, index, [clazz](AOStatusConfig &point) { point.clazz = clazz; });
+        } else if (token == "analog_input_deadband") {
+            getline(iss, token, '=');
+            double deadband = atof(token.c_str());
+            setPoints(db.analog, index, [deadband](AnalogConfig &point) { point.deadband = deadband; });
+        } else if (token == "analog_output_deadband") {
+            getline(iss, token, '=');
+            double deadband = atof(token.c_str());
+            setPoints(db.aoStatus, index, [deadband](AOStatusConfig &point) { point.deadband = deadband; });
 
 // get offsets from dnp.cfg (yurgen1975)
-                } else if (token == "offset_di") {
-                    getline(iss, token, '=');     
-                    offset_di = atoi(token.c_str());
-                        
-                } else if (token == "offset_do") {
-                    getline(iss, token, '=');     
-                    offset_do = atoi(token.c_str());
-                        
-                } else if (token == "offset_ai") {
-                    getline(iss, token, '=');     
-                    offset_ai = atoi(token.c_str());
-                        
-                } else if (token == "offset_ao") {
-                    getline(iss, token, '=');     
-                    offset_ao = atoi(token.c_str());
+        } else if (token == "offset_di") {
+            getline(iss, token, '=');     
+            os->offset_di = atoi(token.c_str());
+                
+        } else if (token == "offset_do") {
+            getline(iss, token, '=');     
+            os->offset_do = atoi(token.c_str());
+                
+        } else if (token == "offset_ai") {
+            getline(iss, token, '=');     
+            os->offset_ai = atoi(token.c_str());
+                
+        } else if (token == "offset_ao") {
+            getline(iss, token, '=');     
+            os->offset_ao = atoi(token.c_str());
 // -------------------------------------------------------------------
 
-                } else if (token == "sol_confirm_timeout") {
-                    getline(iss, token, '=');     
-                    config.outstation.params.solConfirmTimeout =
-                        openpal::TimeDuration::Milliseconds(
-                            atoi(token.c_str())
-                        );
-                } else if (token == "unsol_confirm_timeout") {
-                    getline(iss, token, '=');     
-                    config.outstation.params.unsolConfirmTimeout = 
-                        openpal::TimeDuration::Milliseconds(
-                            atoi(token.c_str())
-                        );
-                } else if (token == "unsol_retry_timeout") {
-                    getline(iss, token, '=');
-                    config.outstation.params.unsolRetryTimeout = 
-                        openpal::TimeDuration::Milliseconds(
-                            atoi(token.c_str())
-                        );
-                }
-            }
-            catch(...) {
-                cout << "Malformatted Line: " << line << endl;
-                exit(1);
+        } else if (token == "port") {
+            getline(iss, token, '=');
+            os->port = atoi(token.c_str());
+        } else if (token == "serial_port") {
+            getline(iss, token, '=');
+            os->serial.deviceName = trim(token);
+        } else if (token == "baud_rate") {
+            getline(iss, token, '=');
+            os->serial.baud = atoi(token.c_str());
+        } else if (token == "data_bits") {
+            getline(iss, token, '=');
+            os->serial.dataBits = atoi(token.c_str());
+        } else if (token == "parity") {
+            getline(iss, token, '=');
+            token = trim(token);
+            if (token == "Even")
+                os->serial.parity = Parity::Even;
+            else if (token == "Odd")
+                os->serial.parity = Parity::Odd;
+            else
+                os->serial.parity = Parity::None;
+        } else if (token == "stop_bits") {
+            getline(iss, token, '=');
+            os->serial.stopBits = (atoi(token.c_str()) == 2) ? StopBits::Two : StopBits::One;
+        } else if (token == "flow_control") {
+            getline(iss, token, '=');
+            token = trim(token);
+            if (token == "Hardware")
+                os->serial.flowType = FlowControl::Hardware;
+            else if (token == "XONXOFF")
+                os->serial.flowType = FlowControl::XONXOFF;
+            else
+                os->serial.flowType = FlowControl::None;
+        } else if (token == "serial_open_delay") {
+            getline(iss, token, '=');
+            os->serial.asyncOpenDelay =
+                openpal::TimeDuration::Milliseconds(atoi(token.c_str()));
+        } else if (token == "tls_enabled") {
+            getline(iss, token, '=');
+            os->tls = trim(token) == "True";
+        } else if (token == "tls_peer_cert") {
+            getline(iss, token, '=');
+            os->tls_peer_cert = trim(token);
+        } else if (token == "tls_local_cert") {
+            getline(iss, token, '=');
+            os->tls_local_cert = trim(token);
+        } else if (token == "tls_private_key") {
+            getline(iss, token, '=');
+            os->tls_private_key = trim(token);
+        } else if (token == "tls_ciphers") {
+            getline(iss, token, '=');
+            os->tls_ciphers = trim(token);
+        } else if (token == "tls_verify_depth") {
+            getline(iss, token, '=');
+            os->tls_verify_depth = atoi(token.c_str());
+        } else if (token == "tls_session_resumption") {
+            getline(iss, token, '=');
+            os->tls_session_resumption = trim(token) == "True";
+        } else if (token == "tls_session_timeout") {
+            getline(iss, token, '=');
+            os->tls_session_timeout = atol(token.c_str());
+        } else if (token == "thread_count") {
+            getline(iss, token, '=');
+            thread_count = atoi(token.c_str());
+            if(thread_count < 1)
+                thread_count = 1;
+        } else if (token == "timer_resolution") {
+            getline(iss, token, '=');
+            timer_resolution = atoi(token.c_str());
+            if(timer_resolution < 0)
+                timer_resolution = 0;
+        } else if (token == "update_decimation") {
+            getline(iss, token, '=');
+            update_decimation = atoi(token.c_str());
+            if(update_decimation < 1)
+                update_decimation = 1;
+        } else if (token == "analog_deadband") {
+            getline(iss, token, '=');
+            double deadband = atof(token.c_str());
+            setPoints(db.analog, index, [deadband](AnalogConfig &point) { point.deadband = deadband; });
+            setPoints(db.aoStatus, index, [deadband](AOStatusConfig &point) { point.deadband = deadband; });
+        } else if (token == "sol_confirm_timeout") {
+            getline(iss, token, '=');     
+            os->config.outstation.params.solConfirmTimeout =
+                openpal::TimeDuration::Milliseconds(
+                    atoi(token.c_str())
+                );
+        } else if (token == "unsol_confirm_timeout") {
+            getline(iss, token, '=');     
+            os->config.outstation.params.unsolConfirmTimeout = 
+                openpal::TimeDuration::Milliseconds(
+                    atoi(token.c_str())
+                );
+        } else if (token == "unsol_retry_timeout") {
+            getline(iss, token, '=');
+            os->config.outstation.params.unsolRetryTimeout = 
+                openpal::TimeDuration::Milliseconds(
+                    atoi(token.c_str())
+                );
+        }
+    }
+    catch(...) {
+        cout << "Malformatted Line: " << line << endl;
+        exit(1);
+    }
+}
+
+//----------------------------------------------------------------------
+// Gives the analog points of the tags with a deadband on tags.cfg that
+// deadband, raw (deadband / scale). Points that dnp3.cfg already gave a
+// deadband keep it
+//----------------------------------------------------------------------
+static void applyTagDeadbands(DNP3Outstation *os) {
+    DatabaseConfig &db = os->config.dbConfig;
+    for (size_t t = 0; t < getTagCount(); t++) {
+        const Tag *tag = getTag(t);
+        const TagAddress &address = tag->address[DNP3_PROTOCOL];
+        if (tag->deadband <= 0 || tag->scale == 0 || address.table == 0)
+            continue;
+
+        double deadband = fabs(tag->deadband / tag->scale);
+        for (uint32_t element = 0; element < tag->count; element++) {
+            if (address.table == TAG_DNP3_ANALOG_INPUTS) {
+                int index = (int)(address.address + element) - os->offset_ai;
+                if (index >= 0 && index < db.analog.Size() && db.analog[index].deadband == 0)
+                    db.analog[index].deadband = deadband;
+            } else if (address.table == TAG_DNP3_ANALOG_OUTPUTS) {
+                int index = (int)(address.address + element) - os->offset_ao;
+                if (index >= 0 && index < db.aoStatus.Size() && db.aoStatus[index].deadband == 0)
+                    db.aoStatus[index].deadband = deadband;
             }
         }
     }
+}
 
-    return config;
+//----------------------------------------------------------------------
+// parse dnp3.cfg and set dnp3 settings for every outstation. Outstations
+// that do not set a port are served on the default one
+//----------------------------------------------------------------------
+vector<DNP3Outstation *> parseDNP3Config(int default_port) {
+    vector<string> shared;
+    vector<vector<string>> sections;
+    vector<DNP3Outstation *> outstations;
+
+    readConfigFile(shared, sections);
+    int shared_size = findDatabaseSize(shared, 10);
+    for (const vector<string> &section : sections) {
+        DNP3Outstation *os = new DNP3Outstation(
+                DatabaseSizes::AllTypes(findDatabaseSize(section, shared_size)));
+        os->port = default_port;
+        for (const string &line : shared)
+            applySetting(os, line);
+        for (const string &line : section)
+            applySetting(os, line);
+        applyTagDeadbands(os);
+        outstations.push_back(os);
+    }
+
+    return outstations;
 } 
 
 /*class ILogHandler
@@ -423,43 +873,90 @@ void dnp3StartServer(int port) {
 
     const uint32_t FILTERS = levels::NORMAL;
 
-    // Allocate a single thread to the pool since this is a single outstation
+    vector<DNP3Outstation *> outstations = parseDNP3Config(port);
+
+    // The thread pool is shared by all channels and outstations, and
+    // its threads get the settings of the dnp3 class of threads.cfg
     // Log messages to the console
-    DNP3Manager manager(1, ConsoleLogger::Create());
-
-    // Create a listener server
-    auto channel = manager.AddTCPServer("DNP3_Server", FILTERS, ChannelRetry::Default(), "0.0.0.0", port, PrintingChannelListener::Create());
-
-    // Create a new outstation with a log level, command handler, and
-    // config info this returns a thread-safe interface used for
-    // updating the outstation's database.
-    std::shared_ptr<ICommandHandler> cc = std::make_shared<CommandCallback>();
-    auto outstation = channel->AddOutstation(
-            "outstation",
-            cc, 
-            DefaultOutstationApplication::Create(), 
-            parseDNP3Config()
-    );
-
-    // Enable the outstation and start communications
-    outstation->Enable();
-    printf("DNP3 Enabled \n");
-
-    mapUnusedIO();
-
-    // Continuously update
-    struct timespec timer_start;
-    clock_gettime(CLOCK_MONOTONIC, &timer_start);
-    
+    DNP3Manager manager(thread_count, ConsoleLogger::Create(),
+                        []() { setThreadClass(THREAD_CLASS_DNP3, "dnp3_pool"); }, []() {},
+                        timer_resolution);
+
+    // Create one listener server per TCP port and one channel per serial
+    // line. Outstations on the same port or line share the channel and
+    // are told apart by their link addresses (multi-drop on serial). A
+    // serial channel uses the line settings of its first outstation
+    map<string, std::shared_ptr<IChannel>> channels;
+    for (size_t i = 0; i < outstations.size(); i++) {
+        DNP3Outstation *os = outstations[i];
+        bool serial = !os->serial.deviceName.empty();
+        string name = serial ? "DNP3_Serial_" + os->serial.deviceName :
+                      (os->tls ? "DNP3_TLS_Server_" : "DNP3_Server_") + to_string(os->port);
+        std::shared_ptr<IChannel> &channel = channels[name];
+        if (!channel) {
+            if (serial) {
+                channel = manager.AddSerial(name, FILTERS, ChannelRetry::Default(), os->serial, MetricsChannelListener::Create());
+            } else if (os->tls) {
+                // The channel keeps one TLS context for its lifetime, so
+                // the sessions it negotiated survive the reconnections
+                std::error_code ec;
+                TLSConfig tls(os->tls_peer_cert, os->tls_local_cert, os->tls_private_key, os->tls_verify_depth,
+                              false, false, true, os->tls_ciphers, os->tls_session_resumption, os->tls_session_timeout);
+                channel = manager.AddTLSServer(name, FILTERS, ChannelRetry::Default(), "0.0.0.0", os->port, tls, MetricsChannelListener::Create(), ec);
+                if (ec || !channel) {
+                    char log_msg[1000];
+                    snprintf(log_msg, sizeof(log_msg), "DNP3 TLS server on port %d could not be started: %s\n", os->port, ec.message().c_str());
+                    openplc_log(log_msg);
+                    channels.erase(name);
+                    outstations.erase(outstations.begin() + i);
+                    delete os;
+                    i--;
+                    continue;
+                }
+            } else {
+                channel = manager.AddTCPServer(name, FILTERS, ChannelRetry::Default(), "0.0.0.0", os->port, MetricsChannelListener::Create());
+            }
+        }
+
+        // Create a new outstation with a log level, command handler, and
+        // config info this returns a thread-safe interface used for
+        // updating the outstation's database.
+        std::shared_ptr<ICommandHandler> cc = std::make_shared<CommandCallback>(os);
+        os->outstation = channel->AddOutstation(
+                "outstation_" + to_string(i),
+                cc, 
+                DefaultOutstationApplication::Create(), 
+                os->config
+        );
+
+        // Enable the outstation and start communications
+        os->outstation->Enable();
+    }
+    printf("DNP3 Enabled (%d outstations, %d channels, %d threads)\n", (int)outstations.size(), (int)channels.size(), thread_count);
+
+    // Update the outstations every update_decimation scans, right after
+    // the scan publishes the process image
+    uint32_t version = getProcessImageVersion();
+    read_image();
+    for (DNP3Outstation *os : outstations)
+        update_vals(os);
+
     while(run_dnp3) 
     {
-        pthread_mutex_lock(&bufferLock);
-        update_vals(outstation);
-        pthread_mutex_unlock(&bufferLock);
-        sleep_until(&timer_start, OPLC_CYCLE);
+        uint32_t target = version + update_decimation * getLoadShedStep();
+        uint32_t current = waitProcessImage(target, DNP3_WAIT_TIMEOUT);
+        if((int32_t)(current - target) < 0)
+            continue;
+        version = current;
+        read_image();
+        for (DNP3Outstation *os : outstations)
+            update_vals(os);
     }
     
     printf("Shutting down DNP3 server\n");
-    channel->Shutdown();
+    for (auto &channel : channels)
+        channel.second->Shutdown();
+    for (DNP3Outstation *os : outstations)
+        delete os;
     printf("DNP3 Server deactivated\n");
 }
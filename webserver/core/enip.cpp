@@ -27,13 +27,47 @@
 #include <pthread.h>
 #include <time.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include "ladder.h"
 #include "enipStruct.h"	//This header file contains necessary structs for enip.cpp
 
 #define ENIP_MIN_LENGTH     28
 
-thread_local unsigned char enip_session[4];	// opens thread for session
+#define MAX_ENIP_SESSIONS           64
+#define MAX_ENIP_IO_CONNECTIONS     32
+#define MAX_ENIP_IO_WORDS           250     // largest class 1 connection size
+#define ENIP_IO_PACKET_SIZE         (24 + 2 * MAX_ENIP_IO_WORDS)
+#define ENIP_IO_PORT                2222
+#define ENIP_MIN_RPI                1000    // microseconds
+
+// Assembly instances that can be used as connection points of implicit
+// connections. The T->O data is produced from %IW or %QW starting at word 0,
+// and the O->T data is written to %QW starting at word 0
+#define ENIP_ASSEMBLY_INPUTS        100
+#define ENIP_ASSEMBLY_OUTPUTS       101
+#define ENIP_ASSEMBLY_CONSUMED      150
+
+#define ENIP_STATUS_NO_MEMORY       0x0002
+#define ENIP_STATUS_INVALID_SESSION 0x0064
+
+// Discovery commands, answered on TCP and on the UDP port of the server
+#define ENIP_LIST_SERVICES          0x0004
+#define ENIP_LIST_IDENTITY          0x0063
+#define ENIP_LIST_INTERFACES        0x0064
+
+// Identity object reported by ListIdentity
+#define ENIP_IDENTITY_VENDOR        0x0001
+#define ENIP_IDENTITY_DEVICE_TYPE   0x000E  // programmable logic controller
+#define ENIP_IDENTITY_PRODUCT_CODE  0x0001
+#define ENIP_IDENTITY_REVISION      0x0101  // minor on the high byte, major on the low one
+#define ENIP_IDENTITY_NAME          "OpenPLC Runtime"
+#define ENIP_DISCOVERY_SIZE         128     // largest discovery reply
 
 using namespace std;
 
@@ -67,6 +101,12 @@ int getEnipType(struct enip_data_Unknown *enipDataUnknown, struct enip_header *h
             // PCCC type 3 - Connected Data Item																										
             return 3;
         }
+        else if (enipDataUnknown->item1_data[0] == 0xb2 && cipServiceSupported(enipDataUnknown->item2_length[1]))
+        {
+            // CIP request of the message router (tag services, Multiple
+            // Service Packet) on the Unconnected Data Item
+            return 4;
+        }
         else if (enipDataUnknown->item1_id[0] == 0xa1)
         {
             // PCCC type 3 - Connected for 0x70 command SEND UNIT DATA	
@@ -260,30 +300,644 @@ void parseEnipDataConnected_0x70(unsigned char *buffer, struct enip_data_Connect
 
 
 //-----------------------------------------------------------------------------
-// Registers a ENIP Session
+// Session table. The session handle carries the slot of the session on its
+// lowest byte and a generation counter on the others, so looking a session
+// up is a single compare and stale handles are never accepted
+//-----------------------------------------------------------------------------
+struct EnipSession
+{
+    uint32_t handle;    // 0 when the slot is free
+    int client_fd;
+};
+
+static struct EnipSession enip_sessions[MAX_ENIP_SESSIONS];
+static uint32_t session_generation = 0;
+static pthread_mutex_t sessionLock = PTHREAD_MUTEX_INITIALIZER;
+
+//-----------------------------------------------------------------------------
+// Implicit (Class 1) I/O connections. Like the sessions, the O->T connection
+// id chosen by the PLC carries the slot of the connection, so the packets
+// received on the I/O port are matched with a single compare
+//-----------------------------------------------------------------------------
+struct EnipIOConnection
+{
+    bool in_use;
+    uint32_t o2t_id;                // chosen by the PLC
+    uint32_t t2o_id;                // chosen by the originator
+    uint16_t connection_serial;
+    uint16_t vendor_id;
+    uint32_t originator_serial;
+    struct sockaddr_in peer;
+    uint16_t produced_instance;
+    uint16_t consumed_instance;
+    int t2o_words;
+    int o2t_words;
+    uint32_t t2o_rpi;               // microseconds
+    uint32_t timeout;               // microseconds
+    uint32_t t2o_sequence;
+    uint16_t t2o_sequence_count;
+    int32_t o2t_sequence_count;     // -1 until the first packet is received
+    struct timespec next_send;
+    struct timespec o2t_deadline;
+    IEC_UINT last_produced[MAX_ENIP_IO_WORDS];
+};
+
+static struct EnipIOConnection io_connections[MAX_ENIP_IO_CONNECTIONS];
+static uint32_t connection_generation = 0;
+static pthread_mutex_t ioConnectionLock = PTHREAD_MUTEX_INITIALIZER;
+static int io_socket = -1;
+static bool io_thread_running = false;
+
+static uint16_t readLE16(const unsigned char *p)
+{
+    return (uint16_t)p[0] | ((uint16_t)p[1] << 8);
+}
+
+static uint32_t readLE32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void writeLE16(unsigned char *p, uint16_t value)
+{
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+static void writeLE32(unsigned char *p, uint32_t value)
+{
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = value >> 24;
+}
+
+static void addMicroseconds(struct timespec *ts, uint32_t microseconds)
+{
+    ts->tv_sec += microseconds / 1000000;
+    ts->tv_nsec += (long)(microseconds % 1000000) * 1000;
+    if (ts->tv_nsec >= 1000000000)
+    {
+        ts->tv_nsec -= 1000000000;
+        ts->tv_sec++;
+    }
+}
+
+static bool timeBefore(const struct timespec *a, const struct timespec *b)
+{
+    return (a->tv_sec < b->tv_sec) || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+//-----------------------------------------------------------------------------
+// Returns true if the session handle was registered by this client
+//-----------------------------------------------------------------------------
+static bool validEnipSession(uint32_t handle, int client_fd)
+{
+    uint32_t slot = handle & 0xFF;
+    if (handle == 0 || slot >= MAX_ENIP_SESSIONS) return false;
+
+    pthread_mutex_lock(&sessionLock);
+    bool valid = (enip_sessions[slot].handle == handle && enip_sessions[slot].client_fd == client_fd);
+    pthread_mutex_unlock(&sessionLock);
+
+    return valid;
+}
+
+//-----------------------------------------------------------------------------
+// Frees a session. Implicit connections opened through it are kept until
+// they are closed or time out, as they do not depend on the TCP connection
+//-----------------------------------------------------------------------------
+static void freeEnipSession(uint32_t handle, int client_fd)
+{
+    uint32_t slot = handle & 0xFF;
+    if (slot >= MAX_ENIP_SESSIONS) return;
+
+    pthread_mutex_lock(&sessionLock);
+    if (enip_sessions[slot].handle == handle && enip_sessions[slot].client_fd == client_fd)
+    {
+        enip_sessions[slot].handle = 0;
+    }
+    pthread_mutex_unlock(&sessionLock);
+}
+
+//-----------------------------------------------------------------------------
+// Frees all sessions registered by a client. Called by the server when the
+// client connection is closed
+//-----------------------------------------------------------------------------
+void closeEnipSessions(int client_fd)
+{
+    pthread_mutex_lock(&sessionLock);
+    for (int i = 0; i < MAX_ENIP_SESSIONS; i++)
+    {
+        if (enip_sessions[i].handle != 0 && enip_sessions[i].client_fd == client_fd)
+        {
+            enip_sessions[i].handle = 0;
+        }
+    }
+    pthread_mutex_unlock(&sessionLock);
+}
+
+//-----------------------------------------------------------------------------
+// Copies the words produced by a connection from the published process image
+//-----------------------------------------------------------------------------
+static void readProducedWords(struct EnipIOConnection *conn, IEC_UINT *words)
+{
+    uint32_t sequence;
+    const ProcessImageSnapshot *snap;
+    do
+    {
+        snap = beginProcessImageRead(&sequence);
+        const IEC_UINT *source = (conn->produced_instance == ENIP_ASSEMBLY_OUTPUTS) ? snap->int_output : snap->int_input;
+        memcpy(words, source, conn->t2o_words * sizeof(IEC_UINT));
+    } while (!endProcessImageRead(snap, sequence));
+}
+
+//-----------------------------------------------------------------------------
+// Sends one T->O packet of a connection. The sequence count only changes when
+// the data changes, as consumers use it to detect new data. Must be called
+// with ioConnectionLock held
+//-----------------------------------------------------------------------------
+static void produceConnection(struct EnipIOConnection *conn)
+{
+    unsigned char packet[ENIP_IO_PACKET_SIZE];
+    IEC_UINT words[MAX_ENIP_IO_WORDS];
+
+    readProducedWords(conn, words);
+    if (memcmp(words, conn->last_produced, conn->t2o_words * sizeof(IEC_UINT)) != 0)
+    {
+        memcpy(conn->last_produced, words, conn->t2o_words * sizeof(IEC_UINT));
+        conn->t2o_sequence_count++;
+    }
+
+    // Common packet format: sequenced address item + connected data item
+    writeLE16(&packet[0], 2);
+    writeLE16(&packet[2], 0x8002);
+    writeLE16(&packet[4], 8);
+    writeLE32(&packet[6], conn->t2o_id);
+    writeLE32(&packet[10], ++conn->t2o_sequence);
+    writeLE16(&packet[14], 0x00b1);
+    writeLE16(&packet[16], 2 + 2 * conn->t2o_words);
+    writeLE16(&packet[18], conn->t2o_sequence_count);
+    for (int i = 0; i < conn->t2o_words; i++)
+    {
+        writeLE16(&packet[20 + 2*i], words[i]);
+    }
+
+    sendto(io_socket, packet, 20 + 2 * conn->t2o_words, 0, (struct sockaddr *)&conn->peer, sizeof(conn->peer));
+}
+
+//-----------------------------------------------------------------------------
+// Handles an O->T packet received on the I/O port. New data (a new sequence
+// count while the originator is in run mode) is queued as writes to the
+// %QW words. Must be called with ioConnectionLock held
+//-----------------------------------------------------------------------------
+static void consumePacket(unsigned char *packet, int length, struct sockaddr_in *source)
+{
+    if (length < 20 || readLE16(&packet[0]) != 2 || readLE16(&packet[2]) != 0x8002 || readLE16(&packet[14]) != 0x00b1)
+        return;
+
+    uint32_t o2t_id = readLE32(&packet[6]);
+    uint32_t slot = o2t_id & 0xFF;
+    if (slot >= MAX_ENIP_IO_CONNECTIONS) return;
+
+    struct EnipIOConnection *conn = &io_connections[slot];
+    if (!conn->in_use || conn->o2t_id != o2t_id || conn->peer.sin_addr.s_addr != source->sin_addr.s_addr)
+        return;
+
+    // Any packet from the originator feeds the connection watchdog
+    clock_gettime(CLOCK_MONOTONIC, &conn->o2t_deadline);
+    addMicroseconds(&conn->o2t_deadline, conn->timeout);
+
+    int data_length = readLE16(&packet[16]);
+    if (data_length < 6 || 18 + data_length > length) return;
+
+    uint16_t sequence_count = readLE16(&packet[18]);
+    uint32_t run_idle = readLE32(&packet[20]);
+    if ((int32_t)sequence_count == conn->o2t_sequence_count || (run_idle & 1) == 0) return;
+    conn->o2t_sequence_count = sequence_count;
+
+    if (conn->consumed_instance != ENIP_ASSEMBLY_CONSUMED) return;
+
+    ProcessImageWrite writes[MAX_ENIP_IO_WORDS];
+    int words = (data_length - 6) / 2;
+    if (words > conn->o2t_words) words = conn->o2t_words;
+    for (int i = 0; i < words; i++)
+    {
+        writes[i].area = PI_INT_OUTPUT;
+        writes[i].bit = 0;
+        writes[i].index = i;
+        writes[i].value = readLE16(&packet[24 + 2*i]);
+        writes[i].mask = 0xFFFF;
+    }
+    if (words > 0 && queueProcessImageWrites(writes, words) < 0)
+    {
+        // Dropped, the next packet with new data will try again
+        conn->o2t_sequence_count = -1;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Thread that serves the implicit connections: produces the T->O data of
+// every connection at its RPI, consumes the O->T packets and closes the
+// connections whose originator stopped sending
+//-----------------------------------------------------------------------------
+static void *enipIOThread(void *arg)
+{
+    setThreadClass(THREAD_CLASS_COMM, "enip_io");
+
+    unsigned char packet[ENIP_IO_PACKET_SIZE];
+    char log_msg[1000];
+
+    while (run_enip)
+    {
+        struct timespec now, wake_up;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        wake_up = now;
+        addMicroseconds(&wake_up, 100000);
+
+        pthread_mutex_lock(&ioConnectionLock);
+        for (int i = 0; i < MAX_ENIP_IO_CONNECTIONS; i++)
+        {
+            struct EnipIOConnection *conn = &io_connections[i];
+            if (!conn->in_use) continue;
+
+            if (timeBefore(&conn->o2t_deadline, &now))
+            {
+                conn->in_use = false;
+                sprintf(log_msg, "ENIP: I/O connection 0x%08x timed out\n", conn->o2t_id);
+                openplc_log(log_msg);
+                continue;
+            }
+
+            if (!timeBefore(&now, &conn->next_send))
+            {
+                produceConnection(conn);
+                addMicroseconds(&conn->next_send, conn->t2o_rpi);
+                if (timeBefore(&conn->next_send, &now))
+                {
+                    // Fell behind, restart the period from now instead of bursting
+                    conn->next_send = now;
+                    addMicroseconds(&conn->next_send, conn->t2o_rpi);
+                }
+            }
+            if (timeBefore(&conn->next_send, &wake_up)) wake_up = conn->next_send;
+        }
+        pthread_mutex_unlock(&ioConnectionLock);
+
+        // Wait for O->T packets until the next connection is due
+        long timeout_ms = (wake_up.tv_sec - now.tv_sec) * 1000 + (wake_up.tv_nsec - now.tv_nsec) / 1000000;
+        struct pollfd pfd;
+        pfd.fd = io_socket;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, timeout_ms > 0 ? timeout_ms : 0) > 0)
+        {
+            struct sockaddr_in source;
+            socklen_t source_len = sizeof(source);
+            int length;
+            while ((length = recvfrom(io_socket, packet, sizeof(packet), 0, (struct sockaddr *)&source, &source_len)) > 0)
+            {
+                pthread_mutex_lock(&ioConnectionLock);
+                consumePacket(packet, length, &source);
+                pthread_mutex_unlock(&ioConnectionLock);
+                source_len = sizeof(source);
+            }
+        }
+    }
+
+    // The server was stopped, drop every connection
+    pthread_mutex_lock(&ioConnectionLock);
+    for (int i = 0; i < MAX_ENIP_IO_CONNECTIONS; i++)
+    {
+        io_connections[i].in_use = false;
+    }
+    close(io_socket);
+    io_socket = -1;
+    io_thread_running = false;
+    pthread_mutex_unlock(&ioConnectionLock);
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Opens the I/O port and starts the I/O thread if they are not running yet.
+// Must be called with ioConnectionLock held. Returns false on failure
+//-----------------------------------------------------------------------------
+static bool startEnipIO()
+{
+    char log_msg[1000];
+    if (io_thread_running) return true;
+
+    io_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (io_socket < 0)
+    {
+        sprintf(log_msg, "ENIP: error creating I/O socket => %s\n", strerror(errno));
+        openplc_log(log_msg);
+        return false;
+    }
+
+    int enable = 1;
+    setsockopt(io_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int));
+    fcntl(io_socket, F_SETFL, fcntl(io_socket, F_GETFL, 0) | O_NONBLOCK);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(ENIP_IO_PORT);
+    if (bind(io_socket, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        sprintf(log_msg, "ENIP: error binding I/O socket => %s\n", strerror(errno));
+        openplc_log(log_msg);
+        close(io_socket);
+        io_socket = -1;
+        return false;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, enipIOThread, NULL) != 0)
+    {
+        close(io_socket);
+        io_socket = -1;
+        return false;
+    }
+    pthread_detach(thread);
+    io_thread_running = true;
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Reads the connection points of a Forward Open connection path. The first
+// point is the consumed (O->T) one and the second the produced (T->O) one.
+// Returns the number of points found
+//-----------------------------------------------------------------------------
+static int parseConnectionPoints(unsigned char *path, int path_size, uint16_t *points)
+{
+    int count = 0;
+    int i = 0;
+    while (i + 1 < path_size && count < 2)
+    {
+        unsigned char segment = path[i];
+        if (segment == 0x2c)
+        {
+            points[count++] = path[i + 1];
+            i += 2;
+        }
+        else if (segment == 0x2d && i + 3 < path_size)
+        {
+            points[count++] = readLE16(&path[i + 2]);
+            i += 4;
+        }
+        else if (segment == 0x20 || segment == 0x24 || segment == 0x30)
+        {
+            i += 2;
+        }
+        else if (segment == 0x21 || segment == 0x25 || segment == 0x31)
+        {
+            i += 4;
+        }
+        else if (segment == 0x34)
+        {
+            i += 10;    // electronic key
+        }
+        else if (segment == 0x80)
+        {
+            i += 2 + 2 * path[i + 1];   // configuration data
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (count == 1)
+    {
+        // Input only connection, the O->T side is a heartbeat
+        points[1] = points[0];
+        points[0] = 0;
+    }
+    return count;
+}
+
+//-----------------------------------------------------------------------------
+// Opens an implicit (Class 1) connection requested by a Forward Open. Returns
+// the O->T connection id, or 0 with the CIP extended status on *status
+//-----------------------------------------------------------------------------
+static uint32_t openIOConnection(struct enip_data_Connected *request, int client_fd, uint16_t *status)
+{
+    char log_msg[1000];
+    uint16_t points[2] = {0, 0};
+    int path_size = 2 * request->connection_pathSize[0];
+    if (parseConnectionPoints(request->connection_path, path_size, points) == 0 ||
+        (points[1] != ENIP_ASSEMBLY_INPUTS && points[1] != ENIP_ASSEMBLY_OUTPUTS))
+    {
+        *status = 0x0117;   // invalid produced or consumed application path
+        return 0;
+    }
+
+    // Class 1 sizes include the 2 byte sequence count, and O->T data also
+    // carries the 4 byte run/idle header
+    int o2t_size = readLE16(request->o2t_netConnectParam) & 0x1ff;
+    int t2o_size = readLE16(request->t2o_netConnectParam) & 0x1ff;
+    int o2t_words = (o2t_size - 6) / 2;
+    int t2o_words = (t2o_size - 2) / 2;
+    if (o2t_words < 0) o2t_words = 0;
+    if (t2o_words <= 0 || t2o_words > MAX_ENIP_IO_WORDS || o2t_words > MAX_ENIP_IO_WORDS)
+    {
+        *status = 0x0109;   // invalid connection size
+        return 0;
+    }
+
+    struct sockaddr_in peer;
+    socklen_t peer_len = sizeof(peer);
+    if (getpeername(client_fd, (struct sockaddr *)&peer, &peer_len) < 0)
+    {
+        *status = 0x0204;   // connection timed out
+        return 0;
+    }
+    peer.sin_port = htons(ENIP_IO_PORT);
+
+    pthread_mutex_lock(&ioConnectionLock);
+    struct EnipIOConnection *conn = NULL;
+    int slot;
+    for (slot = 0; slot < MAX_ENIP_IO_CONNECTIONS; slot++)
+    {
+        if (!io_connections[slot].in_use)
+        {
+            conn = &io_connections[slot];
+            break;
+        }
+    }
+    if (conn == NULL || !startEnipIO())
+    {
+        pthread_mutex_unlock(&ioConnectionLock);
+        *status = 0x0113;   // out of connections
+        return 0;
+    }
+
+    connection_generation++;
+    if ((connection_generation & 0xFFFFFF) == 0) connection_generation++;
+    conn->o2t_id = ((connection_generation & 0xFFFFFF) << 8) | slot;
+    conn->t2o_id = readLE32(request->t2o_netConnectID);
+    conn->connection_serial = readLE16(request->connect_serialNo);
+    conn->vendor_id = readLE16(request->orig_vendorNo);
+    conn->originator_serial = readLE32(request->orig_serialNo);
+    conn->peer = peer;
+    conn->consumed_instance = points[0];
+    conn->produced_instance = points[1];
+    conn->o2t_words = o2t_words;
+    conn->t2o_words = t2o_words;
+    conn->t2o_rpi = readLE32(request->t2o_rpi);
+    if (conn->t2o_rpi < ENIP_MIN_RPI) conn->t2o_rpi = ENIP_MIN_RPI;
+    uint32_t o2t_rpi = readLE32(request->o2t_rpi);
+    if (o2t_rpi < ENIP_MIN_RPI) o2t_rpi = ENIP_MIN_RPI;
+    conn->timeout = o2t_rpi * (4 << (request->timeout_multiplier[0] & 0x07));
+    conn->t2o_sequence = 0;
+    conn->t2o_sequence_count = 0;
+    conn->o2t_sequence_count = -1;
+    memset(conn->last_produced, 0, sizeof(conn->last_produced));
+    clock_gettime(CLOCK_MONOTONIC, &conn->next_send);
+    conn->o2t_deadline = conn->next_send;
+    addMicroseconds(&conn->o2t_deadline, conn->timeout);
+    conn->in_use = true;
+    uint32_t o2t_id = conn->o2t_id;
+    uint32_t t2o_rpi = conn->t2o_rpi;
+    pthread_mutex_unlock(&ioConnectionLock);
+
+    sprintf(log_msg, "ENIP: opened I/O connection 0x%08x to %s (RPI %u us, %d words in, %d words out)\n",
+            o2t_id, inet_ntoa(peer.sin_addr), t2o_rpi, o2t_words, t2o_words);
+    openplc_log(log_msg);
+
+    return o2t_id;
+}
+
+//-----------------------------------------------------------------------------
+// Closes the implicit connection identified by the triad of a Forward Close.
+// Returns false if there is no such connection
+//-----------------------------------------------------------------------------
+static bool closeIOConnection(uint16_t connection_serial, uint16_t vendor_id, uint32_t originator_serial)
+{
+    bool found = false;
+    pthread_mutex_lock(&ioConnectionLock);
+    for (int i = 0; i < MAX_ENIP_IO_CONNECTIONS; i++)
+    {
+        struct EnipIOConnection *conn = &io_connections[i];
+        if (conn->in_use && conn->connection_serial == connection_serial &&
+            conn->vendor_id == vendor_id && conn->originator_serial == originator_serial)
+        {
+            conn->in_use = false;
+            found = true;
+        }
+    }
+    pthread_mutex_unlock(&ioConnectionLock);
+    return found;
+}
+
+//-----------------------------------------------------------------------------
+// Registers a ENIP Session on the session table. The handle is returned to
+// the client on the header, which carries an error status if the table is
+// full
 // Command Code: 0x65
 //-----------------------------------------------------------------------------  
-int registerEnipSession(struct enip_header *header)
+int registerEnipSession(struct enip_header *header, int client_fd)
 {	
-    unsigned char r[4];
-    srand((unsigned)time(NULL));
+    uint32_t handle = 0;
 
-    for (int i = 0; i < 4; ++i) 
-        r[i] = rand();
-    
-    memcpy(header->session_handle, &r[0], 4);
-    memcpy(&enip_session[0], &r[0], 4);
+    pthread_mutex_lock(&sessionLock);
+    for (int i = 0; i < MAX_ENIP_SESSIONS; i++)
+    {
+        if (enip_sessions[i].handle == 0)
+        {
+            session_generation++;
+            if ((session_generation & 0xFFFFFF) == 0) session_generation++;
+            handle = ((session_generation & 0xFFFFFF) << 8) | i;
+            enip_sessions[i].handle = handle;
+            enip_sessions[i].client_fd = client_fd;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sessionLock);
+
+    writeLE32(header->session_handle, handle);
+    if (handle == 0)
+        writeLE32(header->status, ENIP_STATUS_NO_MEMORY);
     
     return ENIP_MIN_LENGTH;
 }
 
 
+//-----------------------------------------------------------------------------
+// Builds the reply of a Forward Open that could not be served, with the CIP
+// extended status code. Returns the size of the response message in bytes
+//-----------------------------------------------------------------------------
+static int forwardOpenError(struct enip_header *header, struct enip_data_Connected *enipDataConnected, uint16_t status)
+{
+    uint16_t connection_serial = readLE16(enipDataConnected->connect_serialNo);
+    uint16_t vendor_id = readLE16(enipDataConnected->orig_vendorNo);
+    uint32_t originator_serial = readLE32(enipDataConnected->orig_serialNo);
+    unsigned char *reply = enipDataConnected->service;
+
+    enipDataConnected->timeout[0] = 0x00;
+    enipDataConnected->timeout[1] = 0x04;
+
+    reply[0] = 0xd4;
+    reply[1] = 0x00;
+    reply[2] = 0x01;    // connection failure
+    reply[3] = 0x01;    // one word of extended status
+    writeLE16(&reply[4], status);
+    writeLE16(&reply[6], connection_serial);
+    writeLE16(&reply[8], vendor_id);
+    writeLE32(&reply[10], originator_serial);
+    reply[14] = 0x00;   // remaining path size
+    reply[15] = 0x00;
+
+    writeLE16(enipDataConnected->item2_length, 16);
+    writeLE16(header->length, 32);
+    return 56;
+}
+
+
+//-----------------------------------------------------------------------------
+// Closes the connection of a Forward Close and builds its reply. Returns the
+// size of the response message in bytes
+//-----------------------------------------------------------------------------
+static int forwardClose(struct enip_header *header, struct enip_data_Connected *enipDataConnected)
+{
+    // The connection triad follows the request path and the timeout ticks
+    unsigned char *triad = enipDataConnected->request_path + 2 * enipDataConnected->request_pathSize[0] + 2;
+    uint16_t connection_serial = readLE16(&triad[0]);
+    uint16_t vendor_id = readLE16(&triad[2]);
+    uint32_t originator_serial = readLE32(&triad[4]);
+    unsigned char *reply = enipDataConnected->service;
+
+    // Explicit connections are not tracked, so closing them always succeeds
+    closeIOConnection(connection_serial, vendor_id, originator_serial);
+
+    enipDataConnected->timeout[0] = 0x00;
+    enipDataConnected->timeout[1] = 0x04;
+
+    reply[0] = 0xce;
+    reply[1] = 0x00;
+    reply[2] = 0x00;    // success
+    reply[3] = 0x00;
+    writeLE16(&reply[4], connection_serial);
+    writeLE16(&reply[6], vendor_id);
+    writeLE32(&reply[8], originator_serial);
+    reply[12] = 0x00;   // application reply size
+    reply[13] = 0x00;
+
+    writeLE16(enipDataConnected->item2_length, 14);
+    writeLE16(header->length, 30);
+    return 54;
+}
+
+
 //-----------------------------------------------------------------------------
 // SendRRData
 // Receives a PCCC msg and Responds
 // Command Code: 0x65
 //-----------------------------------------------------------------------------  
-int sendRRData(int enipType, struct enip_header *header, struct enip_data_Unknown *enipDataUnknown, struct enip_data_Unconnected *enipDataUnconnected, struct enip_data_Connected *enipDataConnected)
+int sendRRData(int enipType, struct enip_header *header, struct enip_data_Unknown *enipDataUnknown, struct enip_data_Unconnected *enipDataUnconnected, struct enip_data_Connected *enipDataConnected, int client_fd)
 {
     if (enipType == 1)
     {	
@@ -372,6 +1026,19 @@ int sendRRData(int enipType, struct enip_header *header, struct enip_data_Unknow
     }
     else if (enipType == 3)
     {
+        if (enipDataConnected->service[0] == 0x4e)
+            return forwardClose(header, enipDataConnected);
+
+        // Class 1 (cyclic I/O) connections get their own O->T connection id
+        uint32_t o2t_id = 0x01b8f05a;
+        if ((enipDataConnected->transport_trigger[0] & 0x0F) == 1)
+        {
+            uint16_t status;
+            o2t_id = openIOConnection(enipDataConnected, client_fd, &status);
+            if (o2t_id == 0)
+                return forwardOpenError(header, enipDataConnected, status);
+        }
+
         //change timeout value
         enipDataConnected->timeout[0] = 0x00;
         enipDataConnected->timeout[1] = 0x04;
@@ -389,10 +1056,7 @@ int sendRRData(int enipType, struct enip_header *header, struct enip_data_Unknow
         enipDataConnected->request_path[1] = 0x00;
         
         // change o2t_netConnectID
-        enipDataConnected->request_path[2] = 0x5a;
-        enipDataConnected->request_path[3] = 0xf0;
-        enipDataConnected->actual_timeout[0] = 0xb8;
-        enipDataConnected->actual_timeout[1] = 0x01;
+        writeLE32(&enipDataConnected->request_path[2], o2t_id);
         
         // start at the back and move up forward
         
@@ -421,6 +1085,27 @@ int sendRRData(int enipType, struct enip_header *header, struct enip_data_Unknow
         return messageSize;
         
     }
+    else if (enipType == 4)
+    {
+        uint16_t currentHeaderLength = get_HeaderLength(header);
+        uint16_t requestSize = get_Item2_DataLength_Unconnected(enipDataUnconnected);
+        if (currentHeaderLength < 16 || requestSize > currentHeaderLength - 16)
+            return -1;
+
+        //change timeout value
+        enipDataUnconnected->timeout[0] = 0x00;
+        enipDataUnconnected->timeout[1] = 0x04;
+
+        // the CIP request starts on the service byte and is replaced by its reply
+        int replySize = processCIPMessage(enipDataUnconnected->service, requestSize);
+        if (replySize < 0)
+            return -1;
+
+        writeLE16(enipDataUnconnected->item2_length, replySize);
+        writeLE16(header->length, 16 + replySize); // interface handle, timeout and the CPF items
+
+        return 40 + replySize;
+    }
     else
     {
         // log error to openPLC
@@ -431,6 +1116,29 @@ int sendRRData(int enipType, struct enip_header *header, struct enip_data_Unknow
 }
 
 
+//-----------------------------------------------------------------------------
+// SendUnitData for a CIP request of the message router on the connected
+// data item, after the sequence count
+//-----------------------------------------------------------------------------
+static int sendUnitDataCIP(struct enip_header *header, struct enip_data_Connected_0x70 *enipDataConnected_0x70)
+{
+    uint16_t currentHeaderLength = get_HeaderLength(header);
+    uint16_t currentItem2Size = get_Item2_DataLength_Connected_0x70(enipDataConnected_0x70);
+    if (currentItem2Size < 2 || currentHeaderLength < 20 || currentItem2Size > currentHeaderLength - 20)
+        return -1;
+
+    int replySize = processCIPMessage(enipDataConnected_0x70->service, currentItem2Size - 2);
+    if (replySize < 0)
+        return -1;
+
+    // the sequence count is echoed back before the reply
+    writeLE16(enipDataConnected_0x70->item2_length, replySize + 2);
+    writeLE16(header->length, replySize + 22);
+
+    return replySize + 46;
+}
+
+
 //-----------------------------------------------------------------------------
 // SendUnitData
 // Receives a PCCC msg and Responds
@@ -438,6 +1146,10 @@ int sendRRData(int enipType, struct enip_header *header, struct enip_data_Unknow
 //-----------------------------------------------------------------------------  
 int sendUnitData(struct enip_header *header, struct enip_data_Connected_0x70 *enipDataConnected_0x70)
 {
+    // Requests other than PCCC go to the CIP message router
+    if (enipDataConnected_0x70->service[0] != 0x4b)
+        return sendUnitDataCIP(header, enipDataConnected_0x70);
+
     //change the service response 0x4b -> 0xcb
     enipDataConnected_0x70->service[0] = 0xcb;
     
@@ -449,28 +1161,6 @@ int sendUnitData(struct enip_header *header, struct enip_data_Connected_0x70 *en
     //get pointer to beginning of pccc data to be passed
     unsigned char* pcccData = enipDataConnected_0x70->pcccData;
     
-    int masked_write_check = 0;
-    int write_check = 0;
-    int write_check_2 = 0;
-    if(pcccData[4] == 0xab)
-    {
-        masked_write_check = pcccData[5]; //Byte Size
-    }
-    
-    if(pcccData[4] == 0xaa)
-    {
-        //write_check = 2;
-        write_check = 2;
-    }
-    if(pcccData[4] == 0xa2 && pcccData[7] == 0x8a)
-    {
-        write_check_2 = -6;
-    }
-    //if(pcccData[4] == 0xa2 && pcccData[7] == 0x89)
-    //{
-        //write_check_2 = -2;
-    //}
-    
     //get the current Item2_Length
     uint16_t currentItem2Size = get_Item2_DataLength_Connected_0x70(enipDataConnected_0x70);
     
@@ -485,7 +1175,7 @@ int sendUnitData(struct enip_header *header, struct enip_data_Connected_0x70 *en
         
     //calculate Data Sizes
     uint16_t newItem2Size = newPcccSize + 13;
-    uint16_t newHeaderSize = newPcccSize + newItem2Size + 14 + masked_write_check + write_check + write_check_2; // Use to be '+ 16' uint16_t newHeaderSize = newPcccSize + newItem2Size + 16;
+    uint16_t newHeaderSize = newItem2Size + 20; // interface handle, timeout and the CPF items up to item2_length
     
     //change item2_length to match new cip data size
     enipDataConnected_0x70->item2_length[0] = newItem2Size & 0xFF;
@@ -505,12 +1195,302 @@ int sendUnitData(struct enip_header *header, struct enip_data_Connected_0x70 *en
 }
 
 
+//-----------------------------------------------------------------------------
+// Discovery. The ListIdentity, ListServices and ListInterfaces replies are
+// encoded once and kept: every request only copies one and fills in the
+// sender context and the address it came in on. The identity reply is
+// encoded again when the state it reports changes, which is whether an I/O
+// connection is open. The broadcasts of the discovery tools are answered on
+// the UDP port by a background thread, away from the protocol workers
+//-----------------------------------------------------------------------------
+static unsigned char identity_reply[ENIP_DISCOVERY_SIZE];
+static int identity_size = 0;
+static int identity_state = -1;
+static unsigned char services_reply[ENIP_DISCOVERY_SIZE];
+static int services_size = 0;
+static pthread_mutex_t discoveryLock = PTHREAD_MUTEX_INITIALIZER;
+static int discovery_socket = -1;
+static pthread_t discovery_thread;
+static bool discovery_running = false;
+
+//-----------------------------------------------------------------------------
+// Returns 1 if an implicit connection is open, the only state of the device
+// the identity reply reports. The table is read without the lock, a change
+// is picked up on the next request
+//-----------------------------------------------------------------------------
+static int identityState()
+{
+    for (int i = 0; i < MAX_ENIP_IO_CONNECTIONS; i++)
+    {
+        if (io_connections[i].in_use) return 1;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Writes the encapsulation header of a discovery reply with the CPF item
+// count. Returns the size written
+//-----------------------------------------------------------------------------
+static int encodeDiscoveryHeader(unsigned char *reply, uint16_t command, uint16_t length, uint16_t item_count)
+{
+    memset(reply, 0, 24);
+    writeLE16(&reply[0], command);
+    writeLE16(&reply[2], length);
+    writeLE16(&reply[24], item_count);
+    return 26;
+}
+
+//-----------------------------------------------------------------------------
+// Encodes the ListIdentity reply for a state. The socket address is left
+// for the request to fill in
+//-----------------------------------------------------------------------------
+static void encodeIdentityReply(int state)
+{
+    static const char name[] = ENIP_IDENTITY_NAME;
+    int name_length = sizeof(name) - 1;
+    uint16_t item_length = 34 + name_length;
+    unsigned char *item = &identity_reply[26];
+
+    encodeDiscoveryHeader(identity_reply, ENIP_LIST_IDENTITY, 2 + 4 + item_length, 1);
+    writeLE16(&item[0], 0x000C);                // CIP Identity item
+    writeLE16(&item[2], item_length);
+    writeLE16(&item[4], 1);                     // encapsulation protocol version
+    memset(&item[6], 0, 16);                    // socket address, big-endian
+    item[6] = 0x00;
+    item[7] = AF_INET;
+    writeLE16(&item[22], ENIP_IDENTITY_VENDOR);
+    writeLE16(&item[24], ENIP_IDENTITY_DEVICE_TYPE);
+    writeLE16(&item[26], ENIP_IDENTITY_PRODUCT_CODE);
+    writeLE16(&item[28], ENIP_IDENTITY_REVISION);
+    // Status: owned and at least one I/O connection in run mode, or no I/O
+    // connection established
+    writeLE16(&item[30], state ? 0x0061 : 0x0030);
+    writeLE32(&item[32], (uint32_t)gethostid());
+    item[36] = name_length;
+    memcpy(&item[37], name, name_length);
+    item[37 + name_length] = 0x03;              // operational
+
+    identity_size = 26 + 4 + item_length;
+    identity_state = state;
+}
+
+//-----------------------------------------------------------------------------
+// Encodes the ListServices reply: the communications service, with CIP
+// over TCP and class 0/1 over UDP
+//-----------------------------------------------------------------------------
+static void encodeServicesReply()
+{
+    unsigned char *item = &services_reply[26];
+    encodeDiscoveryHeader(services_reply, ENIP_LIST_SERVICES, 2 + 4 + 20, 1);
+    writeLE16(&item[0], 0x0100);                // Communications item
+    writeLE16(&item[2], 20);
+    writeLE16(&item[4], 1);                     // encapsulation protocol version
+    writeLE16(&item[6], 0x0120);                // capability flags
+    memset(&item[8], 0, 16);
+    memcpy(&item[8], "Communications", 14);
+    services_size = 26 + 4 + 20;
+}
+
+//-----------------------------------------------------------------------------
+// Answers a discovery request with the reply encoded for it. The request
+// header is replaced by the reply, local is the address the request came in
+// on. Returns the size of the reply, or 0 if the request is not a discovery
+// command
+//-----------------------------------------------------------------------------
+static int discoveryReply(unsigned char *buffer, int length, const struct sockaddr_in *local)
+{
+    if (length < 24)
+        return 0;
+
+    uint16_t command = readLE16(buffer);
+    unsigned char context[8];
+    memcpy(context, &buffer[12], 8);
+
+    int size;
+    if (command == ENIP_LIST_IDENTITY)
+    {
+        int state = identityState();
+        pthread_mutex_lock(&discoveryLock);
+        if (state != identity_state) encodeIdentityReply(state);
+        size = identity_size;
+        memcpy(buffer, identity_reply, size);
+        pthread_mutex_unlock(&discoveryLock);
+
+        // sin_port and sin_addr are on the network order already
+        memcpy(&buffer[34], &local->sin_port, 2);
+        memcpy(&buffer[36], &local->sin_addr, 4);
+    }
+    else if (command == ENIP_LIST_SERVICES)
+    {
+        pthread_mutex_lock(&discoveryLock);
+        if (services_size == 0) encodeServicesReply();
+        size = services_size;
+        memcpy(buffer, services_reply, size);
+        pthread_mutex_unlock(&discoveryLock);
+    }
+    else if (command == ENIP_LIST_INTERFACES)
+    {
+        size = encodeDiscoveryHeader(buffer, ENIP_LIST_INTERFACES, 2, 0);
+    }
+    else
+    {
+        return 0;
+    }
+
+    memcpy(&buffer[12], context, 8);
+    return size;
+}
+
+//-----------------------------------------------------------------------------
+// Thread that answers the discovery requests received on the UDP port. The
+// address each request came in on is taken from its packet info, so a
+// broadcast is answered with the address of the interface it reached
+//-----------------------------------------------------------------------------
+static void *enipDiscoveryThread(void *arg)
+{
+    setThreadClass(THREAD_CLASS_BACKGROUND, "enip_discovery");
+
+    unsigned char packet[ENIP_DISCOVERY_SIZE];
+    uint16_t port = *(uint16_t *)arg;
+    free(arg);
+
+    while (run_enip && discovery_running)
+    {
+        struct pollfd pfd;
+        pfd.fd = discovery_socket;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 100) <= 0) continue;
+
+        struct sockaddr_in source;
+        char control[CMSG_SPACE(sizeof(struct in_pktinfo))];
+        struct iovec iov;
+        struct msghdr msg;
+        int length;
+
+        iov.iov_base = packet;
+        iov.iov_len = sizeof(packet);
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &source;
+        msg.msg_namelen = sizeof(source);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        while ((length = recvmsg(discovery_socket, &msg, 0)) > 0)
+        {
+            struct sockaddr_in local;
+            memset(&local, 0, sizeof(local));
+            local.sin_family = AF_INET;
+            local.sin_port = htons(port);
+            for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+            {
+                if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO)
+                    local.sin_addr = ((struct in_pktinfo *)CMSG_DATA(cmsg))->ipi_spec_dst;
+            }
+
+            int size = discoveryReply(packet, length, &local);
+            if (size > 0)
+                sendto(discovery_socket, packet, size, 0, (struct sockaddr *)&source, sizeof(source));
+
+            msg.msg_namelen = sizeof(source);
+            msg.msg_controllen = sizeof(control);
+        }
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Opens the UDP port of the server and starts answering the discovery
+// requests on it, until the server or the discovery is stopped
+//-----------------------------------------------------------------------------
+void startEnipDiscovery(uint16_t port)
+{
+    char log_msg[1000];
+    if (discovery_running) return;
+
+    discovery_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (discovery_socket < 0)
+    {
+        sprintf(log_msg, "ENIP: error creating discovery socket => %s\n", strerror(errno));
+        openplc_log(log_msg);
+        return;
+    }
+
+    int enable = 1;
+    setsockopt(discovery_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int));
+    setsockopt(discovery_socket, IPPROTO_IP, IP_PKTINFO, &enable, sizeof(int));
+    fcntl(discovery_socket, F_SETFL, fcntl(discovery_socket, F_GETFL, 0) | O_NONBLOCK);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    uint16_t *thread_port = (uint16_t *)malloc(sizeof(uint16_t));
+    if (thread_port == NULL || bind(discovery_socket, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        sprintf(log_msg, "ENIP: error binding discovery socket => %s\n", strerror(errno));
+        openplc_log(log_msg);
+        free(thread_port);
+        close(discovery_socket);
+        discovery_socket = -1;
+        return;
+    }
+
+    *thread_port = port;
+    discovery_running = true;
+    if (pthread_create(&discovery_thread, NULL, enipDiscoveryThread, thread_port) != 0)
+    {
+        discovery_running = false;
+        free(thread_port);
+        close(discovery_socket);
+        discovery_socket = -1;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Stops the discovery thread and closes the UDP port
+//-----------------------------------------------------------------------------
+void stopEnipDiscovery()
+{
+    if (!discovery_running) return;
+
+    discovery_running = false;
+    pthread_join(discovery_thread, NULL);
+    close(discovery_socket);
+    discovery_socket = -1;
+    discovery_running = false;
+}
+
+
+//-----------------------------------------------------------------------------
+// Returns the size of the encapsulation message at the start of the buffer,
+// 0 if it has not been fully received yet, or -1 if it would not fit in a
+// buffer of max_size bytes
+//-----------------------------------------------------------------------------
+int getEnipFrameLength(unsigned char *buffer, int length, int max_size)
+{
+    // The 24 byte encapsulation header carries the data length on bytes 3-4
+    if (length < 24)
+        return 0;
+
+    uint16_t enip_data_size = ((uint16_t)buffer[3] << 8) | (uint16_t)buffer[2];
+    int message_size = 24 + enip_data_size;
+    if (message_size > max_size)
+        return -1;
+
+    return (length >= message_size) ? message_size : 0;
+}
+
+
 //-----------------------------------------------------------------------------
 // This function must parse and process the client request and write back the
 // response for it. The return value is the size of the response message in
-// bytes.
+// bytes. The client socket identifies the sessions registered by the client
 //-----------------------------------------------------------------------------
-int processEnipMessage(unsigned char *buffer, int buffer_size)
+int processEnipMessage(unsigned char *buffer, int buffer_size, int client_fd)
 {	
     // initialize logging system
     const int log_msg_max_size = 1000;
@@ -524,6 +1504,17 @@ int processEnipMessage(unsigned char *buffer, int buffer_size)
     struct enip_data_Connected enipDataConnected;
     struct enip_data_Connected_0x70 enipDataConnected_0x70;
 
+    // Discovery requests carry no data and are answered from the encoded replies
+    struct sockaddr_in local;
+    socklen_t local_len = sizeof(local);
+    if (buffer_size >= 24 && (buffer[0] == ENIP_LIST_IDENTITY || buffer[0] == ENIP_LIST_SERVICES ||
+                              buffer[0] == ENIP_LIST_INTERFACES) && buffer[1] == 0)
+    {
+        if (getsockname(client_fd, (struct sockaddr *)&local, &local_len) != 0 || local.sin_family != AF_INET)
+            memset(&local, 0, sizeof(local));
+        return discoveryReply(buffer, buffer_size, &local);
+    }
+
     if (parseEnipHeader(buffer, buffer_size, &header, &enipDataUnknown) < 0)
     {
         return -1;
@@ -533,12 +1524,28 @@ int processEnipMessage(unsigned char *buffer, int buffer_size)
 
     // Register a Session
     if (header.command[0] == 0x65)	
-        return registerEnipSession(&header);
+        return registerEnipSession(&header, client_fd);
+
+    // Unregister a Session. There is no reply
+    uint32_t session_handle = readLE32(header.session_handle);
+    if (header.command[0] == 0x66)
+    {
+        freeEnipSession(session_handle, client_fd);
+        return 0;
+    }
+
+    // Every other command must come from a registered session
+    if ((header.command[0] == 0x6f || header.command[0] == 0x70) && !validEnipSession(session_handle, client_fd))
+    {
+        writeLE32(header.status, ENIP_STATUS_INVALID_SESSION);
+        writeLE16(header.length, 0);
+        return 24;
+    }
 
     if (header.command[0] == 0x70)	// Send Unit Data ---> works with Connected Type
     {
         parseEnipDataConnected_0x70(buffer, &enipDataConnected_0x70);
-        uint16_t size = sendUnitData(&header, &enipDataConnected_0x70);
+        int size = sendUnitData(&header, &enipDataConnected_0x70);
         return size; //sendUnitData()
     }
 
@@ -575,7 +1582,7 @@ int processEnipMessage(unsigned char *buffer, int buffer_size)
     if (header.command[0] == 0x6f)	// Send RR Data
     {
         //writeDataContents(&enipDataUnknown);
-        uint16_t size = sendRRData(enipType, &header, &enipDataUnknown, &enipDataUnconnected, &enipDataConnected);
+        int size = sendRRData(enipType, &header, &enipDataUnknown, &enipDataUnconnected, &enipDataConnected, client_fd);
         return size;
     }
     /*else if (header.command[0] == 0x70)	// Send Unit Data ---> works with Connected Type
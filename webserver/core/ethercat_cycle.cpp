@@ -0,0 +1,462 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file runs the process data cycle of the EtherCAT master (ethercat_src).
+// By default the scan calls ethercat_callcyclic() itself when it wakes up,
+// holding bufferLock, so every scan waits for the round trip of the frame.
+//
+// With thread = true in ethercat_cycle.cfg the master runs on a thread of
+// its own (the ethercat class of threads.cfg) with its own cycle, aligned
+// to multiples of the cycle time, so the slave sync events (DC, configured
+// on the ethercat.cfg of the master) can be set on the same period. The
+// master works on a private copy of the process data and swaps it with an
+// exchange copy after each frame; the scan swaps the exchange copy with the
+// located variables, so the frame is in flight while the program executes
+// and the scan never waits for it. Only the points the master asked for
+// through the image callbacks are copied.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "ladder.h"
+#ifdef _ethercat_src
+#include "ethercat_src.h"
+#endif
+
+#define ETHERCAT_CONFIG_FILE    "ethercat_cycle.cfg"
+
+#define BITMAP_WORDS(bits)      (((bits) + 63) / 64)
+
+#ifdef _ethercat_src
+
+// Image callbacks of main.cpp, which hand the located variables to the master
+uint8_t *bool_input_call_back(int a, int b);
+uint8_t *bool_output_call_back(int a, int b);
+uint8_t *byte_input_call_back(int a);
+uint8_t *byte_output_call_back(int a);
+uint16_t *int_input_call_back(int a);
+uint16_t *int_output_call_back(int a);
+uint32_t *dint_input_call_back(int a);
+uint32_t *dint_output_call_back(int a);
+uint64_t *lint_input_call_back(int a);
+uint64_t *lint_output_call_back(int a);
+
+// Process data of the points mapped by the master
+struct EthercatImage
+{
+    IEC_BOOL bool_in[BUFFER_SIZE][8];
+    IEC_BOOL bool_out[BUFFER_SIZE][8];
+    IEC_BYTE byte_in[BUFFER_SIZE];
+    IEC_BYTE byte_out[BUFFER_SIZE];
+    IEC_UINT int_in[BUFFER_SIZE];
+    IEC_UINT int_out[BUFFER_SIZE];
+    IEC_UDINT dint_in[BUFFER_SIZE];
+    IEC_UDINT dint_out[BUFFER_SIZE];
+    IEC_ULINT lint_in[BUFFER_SIZE];
+    IEC_ULINT lint_out[BUFFER_SIZE];
+};
+
+// Points the master asked for, one bit per point (bools as byte * 8 + bit).
+// Set by the master thread through the callbacks, read by the scan
+struct EthercatPoints
+{
+    uint64_t bool_in[BITMAP_WORDS(BUFFER_SIZE * 8)];
+    uint64_t bool_out[BITMAP_WORDS(BUFFER_SIZE * 8)];
+    uint64_t byte_in[BITMAP_WORDS(BUFFER_SIZE)];
+    uint64_t byte_out[BITMAP_WORDS(BUFFER_SIZE)];
+    uint64_t int_in[BITMAP_WORDS(BUFFER_SIZE)];
+    uint64_t int_out[BITMAP_WORDS(BUFFER_SIZE)];
+    uint64_t dint_in[BITMAP_WORDS(BUFFER_SIZE)];
+    uint64_t dint_out[BITMAP_WORDS(BUFFER_SIZE)];
+    uint64_t lint_in[BITMAP_WORDS(BUFFER_SIZE)];
+    uint64_t lint_out[BITMAP_WORDS(BUFFER_SIZE)];
+};
+
+struct EthercatCycleConfig
+{
+    bool thread;
+    long long cycle_ns;         // 0 for the tick of the program
+    long long shift_ns;         // offset of the cycle from the multiples of the cycle time
+};
+
+static EthercatCycleConfig config;
+
+// The master image is only used by the master thread. The exchange image
+// is protected by exchangeLock
+static EthercatImage *master_image = NULL;
+static EthercatImage *exchange_image = NULL;
+static EthercatPoints points;
+static pthread_mutex_t exchangeLock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t ethercat_thread;
+static volatile bool ethercat_running = false;
+static volatile bool ethercat_failed = false;
+
+// Statistics of the master thread
+static uint64_t cycles = 0;
+static uint64_t overruns = 0;
+static long long max_lateness = 0;
+
+//-----------------------------------------------------------------------------
+// Image callbacks of the master thread. They hand the master its private
+// copy of the located points and note the ones it asked for
+//-----------------------------------------------------------------------------
+static inline void markPoint(uint64_t *bitmap, int index)
+{
+    uint64_t bit = 1ULL << (index % 64);
+    if ((__atomic_load_n(&bitmap[index / 64], __ATOMIC_RELAXED) & bit) == 0)
+    {
+        __atomic_fetch_or(&bitmap[index / 64], bit, __ATOMIC_RELAXED);
+    }
+}
+
+static uint8_t *threadBoolInput(int a, int b)
+{
+    if (bool_input[a][b] == NULL) return NULL;
+    markPoint(points.bool_in, a * 8 + b);
+    return &master_image->bool_in[a][b];
+}
+
+static uint8_t *threadBoolOutput(int a, int b)
+{
+    if (bool_output[a][b] == NULL) return NULL;
+    markPoint(points.bool_out, a * 8 + b);
+    return &master_image->bool_out[a][b];
+}
+
+static uint8_t *threadByteInput(int a)
+{
+    if (byte_input[a] == NULL) return NULL;
+    markPoint(points.byte_in, a);
+    return &master_image->byte_in[a];
+}
+
+static uint8_t *threadByteOutput(int a)
+{
+    if (byte_output[a] == NULL) return NULL;
+    markPoint(points.byte_out, a);
+    return &master_image->byte_out[a];
+}
+
+static uint16_t *threadIntInput(int a)
+{
+    if (int_input[a] == NULL) return NULL;
+    markPoint(points.int_in, a);
+    return &master_image->int_in[a];
+}
+
+static uint16_t *threadIntOutput(int a)
+{
+    if (int_output[a] == NULL) return NULL;
+    markPoint(points.int_out, a);
+    return &master_image->int_out[a];
+}
+
+static uint32_t *threadDintInput(int a)
+{
+    if (dint_input[a] == NULL) return NULL;
+    markPoint(points.dint_in, a);
+    return &master_image->dint_in[a];
+}
+
+static uint32_t *threadDintOutput(int a)
+{
+    if (dint_output[a] == NULL) return NULL;
+    markPoint(points.dint_out, a);
+    return &master_image->dint_out[a];
+}
+
+static uint64_t *threadLintInput(int a)
+{
+    if (lint_input[a] == NULL) return NULL;
+    markPoint(points.lint_in, a);
+    return &master_image->lint_in[a];
+}
+
+static uint64_t *threadLintOutput(int a)
+{
+    if (lint_output[a] == NULL) return NULL;
+    markPoint(points.lint_out, a);
+    return &master_image->lint_out[a];
+}
+
+//-----------------------------------------------------------------------------
+// Copies the marked entries of one area between two arrays. The macro walks
+// the bitmap a word at a time, so the unmapped parts of the area cost
+// nothing
+//-----------------------------------------------------------------------------
+#define COPY_MARKED(bitmap, words, statement)                               \
+    for (int w = 0; w < (words); w++)                                       \
+    {                                                                       \
+        uint64_t bits = __atomic_load_n(&(bitmap)[w], __ATOMIC_RELAXED);    \
+        while (bits)                                                        \
+        {                                                                   \
+            int i = w * 64 + __builtin_ctzll(bits);                         \
+            bits &= bits - 1;                                               \
+            statement;                                                      \
+        }                                                                   \
+    }
+
+//-----------------------------------------------------------------------------
+// Applies one setting of ethercat_cycle.cfg
+//-----------------------------------------------------------------------------
+static void applyEthercatCycleSetting(const char *section, char *key, char *value, void *context)
+{
+    if (key == NULL) return;
+
+    if (strcmp(key, "thread") == 0) config.thread = (strcmp(value, "true") == 0);
+    else if (strcmp(key, "cycle_time") == 0) config.cycle_ns = atoll(value) * 1000;
+    else if (strcmp(key, "shift") == 0) config.shift_ns = atoll(value) * 1000;
+}
+
+//-----------------------------------------------------------------------------
+// Reads ethercat_cycle.cfg. A missing file keeps the cycle on the scan
+//-----------------------------------------------------------------------------
+static void loadEthercatCycleConfig()
+{
+    memset(&config, 0, sizeof(config));
+
+    if (!parseSettingsFile(ETHERCAT_CONFIG_FILE, applyEthercatCycleSetting, NULL)) return;
+
+    if (config.cycle_ns < 0) config.cycle_ns = 0;
+    if (config.shift_ns < 0) config.shift_ns = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Copies the inputs the master received to the exchange image and the
+// outputs of the last scan to the master image
+//-----------------------------------------------------------------------------
+static void swapMasterImage()
+{
+    EthercatImage *m = master_image;
+    EthercatImage *x = exchange_image;
+
+    pthread_mutex_lock(&exchangeLock);
+    COPY_MARKED(points.bool_in, BITMAP_WORDS(BUFFER_SIZE * 8), x->bool_in[i/8][i%8] = m->bool_in[i/8][i%8]);
+    COPY_MARKED(points.byte_in, BITMAP_WORDS(BUFFER_SIZE), x->byte_in[i] = m->byte_in[i]);
+    COPY_MARKED(points.int_in, BITMAP_WORDS(BUFFER_SIZE), x->int_in[i] = m->int_in[i]);
+    COPY_MARKED(points.dint_in, BITMAP_WORDS(BUFFER_SIZE), x->dint_in[i] = m->dint_in[i]);
+    COPY_MARKED(points.lint_in, BITMAP_WORDS(BUFFER_SIZE), x->lint_in[i] = m->lint_in[i]);
+
+    COPY_MARKED(points.bool_out, BITMAP_WORDS(BUFFER_SIZE * 8), m->bool_out[i/8][i%8] = x->bool_out[i/8][i%8]);
+    COPY_MARKED(points.byte_out, BITMAP_WORDS(BUFFER_SIZE), m->byte_out[i] = x->byte_out[i]);
+    COPY_MARKED(points.int_out, BITMAP_WORDS(BUFFER_SIZE), m->int_out[i] = x->int_out[i]);
+    COPY_MARKED(points.dint_out, BITMAP_WORDS(BUFFER_SIZE), m->dint_out[i] = x->dint_out[i]);
+    COPY_MARKED(points.lint_out, BITMAP_WORDS(BUFFER_SIZE), m->lint_out[i] = x->lint_out[i]);
+    pthread_mutex_unlock(&exchangeLock);
+}
+
+//-----------------------------------------------------------------------------
+// Adds nanoseconds to a timespec
+//-----------------------------------------------------------------------------
+static void addNanoseconds(struct timespec *ts, long long ns)
+{
+    long long total = (long long)ts->tv_nsec + ns;
+    ts->tv_sec += total / 1000000000LL;
+    ts->tv_nsec = total % 1000000000LL;
+}
+
+//-----------------------------------------------------------------------------
+// Master thread. Sends one frame per cycle, at multiples of the cycle time
+// plus the shift. Cycles missed by an overrun are skipped, not caught up
+//-----------------------------------------------------------------------------
+static void *ethercatThread(void *arg)
+{
+    setThreadClass(THREAD_CLASS_ETHERCAT, "ethercat_master");
+
+    long long period = config.cycle_ns ? config.cycle_ns : *plcProgram()->common_ticktime;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    long long now_ns = (long long)next.tv_sec * 1000000000LL + next.tv_nsec;
+    long long start_ns = (now_ns / period + 1) * period + config.shift_ns % period;
+    next.tv_sec = start_ns / 1000000000LL;
+    next.tv_nsec = start_ns % 1000000000LL;
+
+    while (ethercat_running)
+    {
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        struct timespec woke;
+        clock_gettime(CLOCK_MONOTONIC, &woke);
+        long long lateness = (long long)(woke.tv_sec - next.tv_sec) * 1000000000LL + (woke.tv_nsec - next.tv_nsec);
+        if (lateness > max_lateness) max_lateness = lateness;
+
+        int result = ethercat_callcyclic(BUFFER_SIZE,
+                threadBoolInput, threadBoolOutput,
+                threadByteInput, threadByteOutput,
+                threadIntInput, threadIntOutput,
+                threadDintInput, threadDintOutput,
+                threadLintInput, threadLintOutput);
+        if (result)
+        {
+            ethercat_failed = true;
+            break;
+        }
+        swapMasterImage();
+        cycles++;
+
+        addNanoseconds(&next, period);
+        clock_gettime(CLOCK_MONOTONIC, &woke);
+        long long behind = (long long)(woke.tv_sec - next.tv_sec) * 1000000000LL + (woke.tv_nsec - next.tv_nsec);
+        if (behind > 0)
+        {
+            long long missed = behind / period + 1;
+            overruns += missed;
+            addNanoseconds(&next, missed * period);
+        }
+    }
+
+    return NULL;
+}
+
+#endif
+
+//-----------------------------------------------------------------------------
+// Reads ethercat_cycle.cfg and starts the master thread when it asks for
+// one. Called once the I/O is initialized, before the first scan
+//-----------------------------------------------------------------------------
+void startEthercatCycle()
+{
+#ifdef _ethercat_src
+    char log_msg[1000];
+
+    loadEthercatCycleConfig();
+    if (!config.thread) return;
+
+    master_image = (EthercatImage *)calloc(1, sizeof(EthercatImage));
+    exchange_image = (EthercatImage *)calloc(1, sizeof(EthercatImage));
+    if (master_image == NULL || exchange_image == NULL)
+    {
+        openplc_log((char *)"EtherCAT: out of memory, the cycle stays on the scan\n");
+        free(master_image);
+        free(exchange_image);
+        master_image = exchange_image = NULL;
+        config.thread = false;
+        return;
+    }
+
+    ethercat_running = true;
+    if (pthread_create(&ethercat_thread, NULL, ethercatThread, NULL) != 0)
+    {
+        ethercat_running = false;
+        config.thread = false;
+        openplc_log((char *)"EtherCAT: failed to start the master thread, the cycle stays on the scan\n");
+        return;
+    }
+
+    long long period = config.cycle_ns ? config.cycle_ns : *plcProgram()->common_ticktime;
+    sprintf(log_msg, "EtherCAT: process data cycle on its own thread, every %lld us (shift %lld us)\n",
+            period / 1000, config.shift_ns / 1000);
+    openplc_log(log_msg);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Runs the process data cycle of the scan: the frame itself when the master
+// has no thread, otherwise only checks the thread is still cycling. Returns
+// false once the master failed
+//-----------------------------------------------------------------------------
+bool runEthercatCycle()
+{
+#ifdef _ethercat_src
+    if (config.thread) return !ethercat_failed;
+
+    lockBuffer();
+    int result = ethercat_callcyclic(BUFFER_SIZE,
+            bool_input_call_back,
+            bool_output_call_back,
+            byte_input_call_back,
+            byte_output_call_back,
+            int_input_call_back,
+            int_output_call_back,
+            dint_input_call_back,
+            dint_output_call_back,
+            lint_input_call_back,
+            lint_output_call_back);
+    unlockBuffer();
+    return result == 0;
+#else
+    return true;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Copies the last inputs of the master thread to the located variables.
+// Called by the scan thread holding bufferLock
+//-----------------------------------------------------------------------------
+void exchangeEthercatInputs()
+{
+#ifdef _ethercat_src
+    if (!config.thread) return;
+
+    EthercatImage *x = exchange_image;
+    pthread_mutex_lock(&exchangeLock);
+    COPY_MARKED(points.bool_in, BITMAP_WORDS(BUFFER_SIZE * 8),
+                if (bool_input[i/8][i%8] != NULL) *bool_input[i/8][i%8] = x->bool_in[i/8][i%8]);
+    COPY_MARKED(points.byte_in, BITMAP_WORDS(BUFFER_SIZE), if (byte_input[i] != NULL) *byte_input[i] = x->byte_in[i]);
+    COPY_MARKED(points.int_in, BITMAP_WORDS(BUFFER_SIZE), if (int_input[i] != NULL) *int_input[i] = x->int_in[i]);
+    COPY_MARKED(points.dint_in, BITMAP_WORDS(BUFFER_SIZE), if (dint_input[i] != NULL) *dint_input[i] = x->dint_in[i]);
+    COPY_MARKED(points.lint_in, BITMAP_WORDS(BUFFER_SIZE), if (lint_input[i] != NULL) *lint_input[i] = x->lint_in[i]);
+    pthread_mutex_unlock(&exchangeLock);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Copies the located outputs for the next frames of the master thread.
+// Called by the scan thread holding bufferLock, after the program ran
+//-----------------------------------------------------------------------------
+void exchangeEthercatOutputs()
+{
+#ifdef _ethercat_src
+    if (!config.thread) return;
+
+    EthercatImage *x = exchange_image;
+    pthread_mutex_lock(&exchangeLock);
+    COPY_MARKED(points.bool_out, BITMAP_WORDS(BUFFER_SIZE * 8),
+                if (bool_output[i/8][i%8] != NULL) x->bool_out[i/8][i%8] = *bool_output[i/8][i%8]);
+    COPY_MARKED(points.byte_out, BITMAP_WORDS(BUFFER_SIZE), if (byte_output[i] != NULL) x->byte_out[i] = *byte_output[i]);
+    COPY_MARKED(points.int_out, BITMAP_WORDS(BUFFER_SIZE), if (int_output[i] != NULL) x->int_out[i] = *int_output[i]);
+    COPY_MARKED(points.dint_out, BITMAP_WORDS(BUFFER_SIZE), if (dint_output[i] != NULL) x->dint_out[i] = *dint_output[i]);
+    COPY_MARKED(points.lint_out, BITMAP_WORDS(BUFFER_SIZE), if (lint_output[i] != NULL) x->lint_out[i] = *lint_output[i]);
+    pthread_mutex_unlock(&exchangeLock);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Stops the master thread, before the master is terminated
+//-----------------------------------------------------------------------------
+void stopEthercatCycle()
+{
+#ifdef _ethercat_src
+    char log_msg[1000];
+
+    if (!config.thread || !ethercat_running) return;
+
+    ethercat_running = false;
+    pthread_join(ethercat_thread, NULL);
+
+    sprintf(log_msg, "EtherCAT: %llu cycles, %llu missed, %lld us of maximum wake up lateness\n",
+            (unsigned long long)cycles, (unsigned long long)overruns, max_lateness / 1000);
+    openplc_log(log_msg);
+#endif
+}
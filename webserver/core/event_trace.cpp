@@ -0,0 +1,382 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the event trace. The trace points of the runtime
+// (TRACE_SPAN in ladder.h) record spans of time: the phases of the scan,
+// the requests served by the Modbus and EtherNet/IP servers, the waits for
+// bufferLock and the time it was held, and the Modbus master transactions.
+// While the trace is stopped a trace point is a single relaxed load.
+//
+// Every thread writes to its own ring, claimed the first time it records an
+// event, so recording takes no lock and never allocates. The rings keep the
+// last TRACE_RING_EVENTS events of each thread. The trace can be frozen by
+// the first scan longer than a threshold, so the rings hold what every
+// thread was doing before the spike. The dump is a JSON trace (Trace Event
+// Format) that the Perfetto UI and chrome://tracing open directly.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <atomic>
+
+#include "ladder.h"
+
+#define TRACE_MAX_THREADS       32
+#define TRACE_RING_EVENTS       8192    // 256 KB per thread
+
+struct TraceEvent
+{
+    uint64_t start_ns;
+    uint64_t end_ns;
+    const void *detail;
+    uint32_t code;
+    uint16_t kind;
+    uint16_t arg;
+};
+
+struct TraceRing
+{
+    std::atomic<int> owner;             // tid of the thread writing to it, 0 if free
+    char thread_name[16];
+    std::atomic<uint64_t> head;         // events written since the trace started
+    TraceEvent events[TRACE_RING_EVENTS];
+};
+
+bool event_tracing = false;
+
+static TraceRing *rings = NULL;
+static std::atomic<uint32_t> trace_generation(0);    // bumped on every start
+static std::atomic<uint64_t> dropped_events(0);      // threads without a ring
+static uint64_t freeze_ns = 0;
+static std::atomic<uint64_t> frozen_scan_ns(0);
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static thread_local TraceRing *thread_ring = NULL;
+static thread_local uint32_t claim_failed_generation = 0;
+
+static const char *protocol_names[PROTOCOL_TYPES] = { "modbus", "dnp3", "enip", "opcua", "s7" };
+
+//-----------------------------------------------------------------------------
+// Returns a timestamp in nanoseconds
+//-----------------------------------------------------------------------------
+static uint64_t timestampNs(const struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+// Gives a ring to the calling thread. A free ring is taken first, then the
+// ring of a thread that has exited. Returns NULL if all the rings belong to
+// running threads
+//-----------------------------------------------------------------------------
+static TraceRing *claimRing()
+{
+    TraceRing *pool = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+    if (pool == NULL) return NULL;
+
+    int tid = (int)syscall(SYS_gettid);
+    TraceRing *ring = NULL;
+    for (int i = 0; i < TRACE_MAX_THREADS && ring == NULL; i++)
+    {
+        int expected = 0;
+        if (pool[i].owner.compare_exchange_strong(expected, tid)) ring = &pool[i];
+    }
+    for (int i = 0; i < TRACE_MAX_THREADS && ring == NULL; i++)
+    {
+        int owner = pool[i].owner.load();
+        if (owner != tid && syscall(SYS_tgkill, getpid(), owner, 0) == -1 && errno == ESRCH &&
+            pool[i].owner.compare_exchange_strong(owner, tid))
+        {
+            ring = &pool[i];
+        }
+    }
+    if (ring == NULL) return NULL;
+
+    if (pthread_getname_np(pthread_self(), ring->thread_name, sizeof(ring->thread_name)) != 0)
+    {
+        ring->thread_name[0] = '\0';
+    }
+    ring->head.store(0, std::memory_order_relaxed);
+    return ring;
+}
+
+//-----------------------------------------------------------------------------
+// Records a span on the ring of the calling thread. Called through the
+// TRACE_SPAN macro, only while the trace is running
+//-----------------------------------------------------------------------------
+void traceSpan(int kind, int arg, uint32_t code, const void *detail, const struct timespec *start, const struct timespec *end)
+{
+    TraceRing *ring = thread_ring;
+    if (ring == NULL)
+    {
+        uint32_t generation = trace_generation.load(std::memory_order_relaxed);
+        if (claim_failed_generation == generation)
+        {
+            dropped_events.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        ring = claimRing();
+        if (ring == NULL)
+        {
+            claim_failed_generation = generation;
+            dropped_events.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        thread_ring = ring;
+    }
+
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    TraceEvent *event = &ring->events[head % TRACE_RING_EVENTS];
+    event->start_ns = timestampNs(start);
+    event->end_ns = timestampNs(end);
+    event->detail = detail;
+    event->code = code;
+    event->kind = (uint16_t)kind;
+    event->arg = (uint16_t)arg;
+    ring->head.store(head + 1, std::memory_order_release);
+
+    // Freeze on the first scan over the threshold, keeping what led to it
+    if (kind == TRACE_SCAN_PHASE && arg == PROFILE_SCAN && freeze_ns > 0 &&
+        event->end_ns - event->start_ns > freeze_ns)
+    {
+        frozen_scan_ns.store(event->end_ns - event->start_ns, std::memory_order_relaxed);
+        __atomic_store_n(&event_tracing, false, __ATOMIC_RELAXED);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Starts the event trace, clearing the events recorded before. With
+// freeze_us greater than 0 the trace stops by itself after the first scan
+// longer than freeze_us microseconds. The rings are allocated the first
+// time. Returns false if they can't be allocated
+//-----------------------------------------------------------------------------
+bool startEventTrace(uint32_t freeze_us)
+{
+    char log_msg[1000];
+    pthread_mutex_lock(&trace_lock);
+    if (rings == NULL)
+    {
+        TraceRing *pool = (TraceRing *)calloc(TRACE_MAX_THREADS, sizeof(TraceRing));
+        if (pool == NULL)
+        {
+            pthread_mutex_unlock(&trace_lock);
+            openplc_log((char *)"Event trace: could not allocate the trace rings\n");
+            return false;
+        }
+        __atomic_store_n(&rings, pool, __ATOMIC_RELEASE);
+    }
+
+    __atomic_store_n(&event_tracing, false, __ATOMIC_RELAXED);
+    for (int i = 0; i < TRACE_MAX_THREADS; i++)
+    {
+        rings[i].head.store(0, std::memory_order_relaxed);
+    }
+    dropped_events.store(0, std::memory_order_relaxed);
+    frozen_scan_ns.store(0, std::memory_order_relaxed);
+    freeze_ns = (uint64_t)freeze_us * 1000;
+    trace_generation.fetch_add(1, std::memory_order_relaxed);
+    __atomic_store_n(&event_tracing, true, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&trace_lock);
+
+    if (freeze_us > 0)
+        sprintf(log_msg, "Event trace started, it stops on the first scan over %u us\n", freeze_us);
+    else
+        sprintf(log_msg, "Event trace started\n");
+    openplc_log(log_msg);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Stops the event trace. The events recorded are kept until it is started
+// again
+//-----------------------------------------------------------------------------
+void stopEventTrace()
+{
+    __atomic_store_n(&event_tracing, false, __ATOMIC_RELAXED);
+}
+
+//-----------------------------------------------------------------------------
+// Writes a string as a JSON string
+//-----------------------------------------------------------------------------
+static void writeJsonString(FILE *file, const char *s)
+{
+    fputc('"', file);
+    for (; *s != '\0'; s++)
+    {
+        if (*s == '"' || *s == '\\') fprintf(file, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20) fprintf(file, "\\u%04x", *s);
+        else fputc(*s, file);
+    }
+    fputc('"', file);
+}
+
+//-----------------------------------------------------------------------------
+// Writes an event of a ring as Trace Event Format objects. The lock events
+// overlap the scan phases, so they go as async events on tracks of their
+// own instead of complete events on the thread
+//-----------------------------------------------------------------------------
+static void writeEvent(FILE *file, const TraceEvent *event, int pid, int tid, uint64_t *async_id)
+{
+    double ts = event->start_ns / 1000.0;
+    double dur = (event->end_ns - event->start_ns) / 1000.0;
+
+    switch (event->kind)
+    {
+        case TRACE_SCAN_PHASE:
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"scan\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+                    scanPhaseName(event->arg), ts, dur, pid, tid);
+            break;
+
+        case TRACE_PROTOCOL_REQUEST:
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"protocol\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"function\":%u}}",
+                    event->arg < PROTOCOL_TYPES ? protocol_names[event->arg] : "unknown", ts, dur, pid, tid, event->code);
+            break;
+
+        case TRACE_LOCK_WAIT:
+        case TRACE_LOCK_HOLD:
+        {
+            const LockSite *site = (const LockSite *)event->detail;
+            const char *file_name = strrchr(site->file, '/');
+            file_name = file_name != NULL ? file_name + 1 : site->file;
+            const char *what = event->kind == TRACE_LOCK_WAIT ? "wait" : "hold";
+            uint64_t id = ++(*async_id);
+            fprintf(file, ",\n{\"name\":\"%s %s\",\"cat\":\"lock\",\"ph\":\"b\",\"id\":%llu,\"ts\":%.3f,\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"site\":\"%s:%d %s\"}}",
+                    site->lock_name, what, (unsigned long long)id, ts, pid, tid, file_name, site->line, site->function);
+            fprintf(file, ",\n{\"name\":\"%s %s\",\"cat\":\"lock\",\"ph\":\"e\",\"id\":%llu,\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+                    site->lock_name, what, (unsigned long long)id, event->end_ns / 1000.0, pid, tid);
+            break;
+        }
+
+        case TRACE_MB_MASTER:
+            fprintf(file, ",\n{\"name\":\"fc%u\",\"cat\":\"modbus_master\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"device\":", event->arg, ts, dur, pid, tid);
+            writeJsonString(file, (const char *)event->detail);
+            fprintf(file, ",\"error\":%u}}", event->code);
+            break;
+
+        case TRACE_PROGRAM:
+            fprintf(file, ",\n{\"name\":");
+            writeJsonString(file, (const char *)event->detail);
+            fprintf(file, ",\"cat\":\"program\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}", ts, dur, pid, tid);
+            break;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Stops the event trace and writes the events of every thread to a JSON
+// file. Returns 0 on success, -1 on failure
+//-----------------------------------------------------------------------------
+int dumpEventTrace(const char *path)
+{
+    char log_msg[1000];
+    pthread_mutex_lock(&trace_lock);
+    if (rings == NULL)
+    {
+        pthread_mutex_unlock(&trace_lock);
+        openplc_log((char *)"Event trace: the trace was never started\n");
+        return -1;
+    }
+
+    // Let the events being recorded land before reading the rings
+    stopEventTrace();
+    usleep(10000);
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        pthread_mutex_unlock(&trace_lock);
+        sprintf(log_msg, "Event trace: could not open %s: %s\n", path, strerror(errno));
+        openplc_log(log_msg);
+        return -1;
+    }
+
+    int pid = (int)getpid();
+    uint64_t async_id = 0;
+    uint64_t written = 0;
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+                  "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"openplc\"}}", pid, pid);
+    for (int i = 0; i < TRACE_MAX_THREADS; i++)
+    {
+        TraceRing *ring = &rings[i];
+        int tid = ring->owner.load();
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        if (tid == 0 || head == 0) continue;
+
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", pid, tid);
+        writeJsonString(file, ring->thread_name[0] != '\0' ? ring->thread_name : "thread");
+        fprintf(file, "}}");
+
+        uint64_t first = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+        for (uint64_t e = first; e < head; e++)
+        {
+            writeEvent(file, &ring->events[e % TRACE_RING_EVENTS], pid, tid, &async_id);
+        }
+        written += head - first;
+    }
+    fprintf(file, "\n]}\n");
+
+    bool failed = ferror(file) != 0;
+    if (fclose(file) != 0) failed = true;
+    pthread_mutex_unlock(&trace_lock);
+
+    if (failed)
+    {
+        sprintf(log_msg, "Event trace: could not write %s\n", path);
+        openplc_log(log_msg);
+        return -1;
+    }
+    sprintf(log_msg, "Event trace: %llu events written to %s\n", (unsigned long long)written, path);
+    openplc_log(log_msg);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Writes the state of the event trace. Returns the number of characters
+// written
+//-----------------------------------------------------------------------------
+int getEventTraceStatus(char *buffer, size_t buffer_size)
+{
+    uint64_t events = 0;
+    int threads = 0;
+    TraceRing *pool = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+    for (int i = 0; pool != NULL && i < TRACE_MAX_THREADS; i++)
+    {
+        uint64_t head = pool[i].head.load(std::memory_order_relaxed);
+        if (pool[i].owner.load() == 0 || head == 0) continue;
+        events += head > TRACE_RING_EVENTS ? TRACE_RING_EVENTS : head;
+        threads++;
+    }
+
+    const char *state = __atomic_load_n(&event_tracing, __ATOMIC_RELAXED) ? "running" :
+                        frozen_scan_ns.load(std::memory_order_relaxed) > 0 ? "frozen" : "stopped";
+    int written = snprintf(buffer, buffer_size, "state=%s events=%llu threads=%d dropped=%llu freeze_us=%llu frozen_scan_us=%llu\n",
+                           state, (unsigned long long)events, threads,
+                           (unsigned long long)dropped_events.load(std::memory_order_relaxed),
+                           (unsigned long long)(freeze_ns / 1000),
+                           (unsigned long long)(frozen_scan_ns.load(std::memory_order_relaxed) / 1000));
+    if (written > (int)buffer_size) written = buffer_size;
+    return written;
+}
@@ -0,0 +1,225 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the forced variable table used by the debugger. The
+// network threads never touch the forcing state of the program: they append
+// force and unforce requests to the active one of two tables, and the scan
+// thread swaps them at the start of the cycle and applies the retired table
+// as a whole, so a group of forces never lands split across two scans.
+// Programs built with direct access don't check the force flags on every
+// access, so the scan thread keeps the forced values and writes them over
+// the variables before and after the program runs (the force overlay).
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "ladder.h"
+#include "debug.h"
+
+#define FORCE_TABLE_SIZE    1024
+#define FORCE_DATA_SIZE     (32 * 1024)
+
+struct ForceEntry
+{
+    uint16_t index;
+    bool forced;
+    uint32_t offset;    // position of the value on the table data
+};
+
+struct ForceTable
+{
+    int count;
+    uint32_t data_size;
+    ForceEntry entries[FORCE_TABLE_SIZE];
+    uint8_t data[FORCE_DATA_SIZE];
+};
+
+//-----------------------------------------------------------------------------
+// Producers append to the active table holding forceLock. The scan thread
+// only swaps the active table (with trylock, so it never waits for a
+// producer) and applies the retired one without any lock
+//-----------------------------------------------------------------------------
+static ForceTable force_tables[2];
+static int active_table = 0;
+static pthread_mutex_t forceLock = PTHREAD_MUTEX_INITIALIZER;
+
+//-----------------------------------------------------------------------------
+// Values of the variables currently forced, as the program saw them once
+// forced. Only touched by the scan thread
+//-----------------------------------------------------------------------------
+struct ForcedValue
+{
+    uint16_t index;
+    uint32_t size;
+    uint32_t offset;    // position of the value on forced_data
+};
+
+static ForcedValue forced_values[FORCE_TABLE_SIZE];
+static int forced_count = 0;
+static uint8_t forced_data[FORCE_DATA_SIZE];
+static uint32_t forced_data_size = 0;
+
+//-----------------------------------------------------------------------------
+// Updates the forced values after set_trace() forced or unforced a variable
+//-----------------------------------------------------------------------------
+static void trackForcedValue(uint16_t index, bool forced)
+{
+    int slot = 0;
+    while (slot < forced_count && forced_values[slot].index != index) slot++;
+
+    if (slot < forced_count)
+    {
+        ForcedValue *value = &forced_values[slot];
+        if (forced)
+        {
+            memcpy(&forced_data[value->offset], plcProgram()->get_var_addr(index), value->size);
+            return;
+        }
+
+        // Unforced: close the gap left on the table and on the data
+        uint32_t end = value->offset + value->size;
+        memmove(&forced_data[value->offset], &forced_data[end], forced_data_size - end);
+        forced_data_size -= value->size;
+        for (int i = slot + 1; i < forced_count; i++)
+        {
+            forced_values[i - 1] = forced_values[i];
+            forced_values[i - 1].offset -= value->size;
+        }
+        forced_count--;
+        return;
+    }
+
+    if (!forced) return;
+    uint32_t size = (uint32_t)plcProgram()->get_var_size(index);
+    if (forced_count == FORCE_TABLE_SIZE || forced_data_size + size > FORCE_DATA_SIZE)
+    {
+        char log_msg[1000];
+        sprintf(log_msg, "Forcing: too many forced variables, variable %u is not kept forced\n", index);
+        openplc_log(log_msg);
+        return;
+    }
+
+    ForcedValue *value = &forced_values[forced_count++];
+    value->index = index;
+    value->size = size;
+    value->offset = forced_data_size;
+    memcpy(&forced_data[value->offset], plcProgram()->get_var_addr(index), size);
+    forced_data_size += size;
+}
+
+//-----------------------------------------------------------------------------
+// Appends a group of force/unforce requests to the forced variable table.
+// Each value is stored with the size of its variable (zero padded when the
+// request is shorter). The group is queued as a whole or not at all. Returns
+// 0 on success or -1 if the table is full
+//-----------------------------------------------------------------------------
+int queueForcedVariables(const ForceRequest *requests, int count)
+{
+    uint32_t sizes[FORCE_TABLE_SIZE];
+    uint32_t total_size = 0;
+    if (count > FORCE_TABLE_SIZE) return -1;
+    for (int i = 0; i < count; i++)
+    {
+        sizes[i] = (uint32_t)plcProgram()->get_var_size(requests[i].index);
+        total_size += sizes[i];
+    }
+
+    pthread_mutex_lock(&forceLock);
+    ForceTable *table = &force_tables[active_table];
+    if (table->count + count > FORCE_TABLE_SIZE || table->data_size + total_size > FORCE_DATA_SIZE)
+    {
+        pthread_mutex_unlock(&forceLock);
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        ForceEntry *entry = &table->entries[table->count++];
+        entry->index = requests[i].index;
+        entry->forced = requests[i].forced;
+        entry->offset = table->data_size;
+
+        uint8_t *value = &table->data[table->data_size];
+        uint32_t length = requests[i].length < sizes[i] ? requests[i].length : sizes[i];
+        memcpy(value, requests[i].value, length);
+        memset(value + length, 0, sizes[i] - length);
+        table->data_size += sizes[i];
+    }
+    pthread_mutex_unlock(&forceLock);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Applies the force requests queued since the last scan. Called by the scan
+// thread before the program runs, holding bufferLock. If a producer is
+// holding the table the requests are applied on the next scan
+//-----------------------------------------------------------------------------
+void applyForcedVariables()
+{
+    if (pthread_mutex_trylock(&forceLock) != 0) return;
+    ForceTable *retired = &force_tables[active_table];
+    if (retired->count == 0)
+    {
+        pthread_mutex_unlock(&forceLock);
+        return;
+    }
+    active_table = 1 - active_table;
+    pthread_mutex_unlock(&forceLock);
+
+    for (int i = 0; i < retired->count; i++)
+    {
+        ForceEntry *entry = &retired->entries[i];
+        plcProgram()->set_trace((size_t)entry->index, entry->forced, &retired->data[entry->offset]);
+        trackForcedValue(entry->index, entry->forced);
+    }
+    retired->count = 0;
+    retired->data_size = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Writes the forced values over the variables of a program built with direct
+// access. Called by the scan thread before and after the program runs,
+// holding bufferLock, so the program reads the forced values and the I/O and
+// the protocols never see what the program wrote to forced variables. The
+// located variables get their forced value from the program overlay
+//-----------------------------------------------------------------------------
+void overlayForcedVariables()
+{
+    if (forced_count == 0) return;
+    PlcProgram *program = plcProgram();
+    if (program->force_overlay == NULL) return;
+
+    for (int i = 0; i < forced_count; i++)
+    {
+        memcpy(program->get_var_addr(forced_values[i].index), &forced_data[forced_values[i].offset], forced_values[i].size);
+    }
+    program->force_overlay();
+}
+
+//-----------------------------------------------------------------------------
+// Forgets the forced values. Called by the scan thread when an online change
+// swaps in a program, which starts with nothing forced
+//-----------------------------------------------------------------------------
+void resetForcedVariables()
+{
+    forced_count = 0;
+    forced_data_size = 0;
+}
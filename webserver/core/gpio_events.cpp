@@ -0,0 +1,180 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file watches the edges of the GPIO inputs that run event tasks (see
+// program_workers.cpp). The hardware layers of the boards with a GPIO
+// character device hand it the line of each of their digital inputs. The
+// lines with an event task are requested as line events, the same kernel
+// interface libgpiod uses, and an I/O thread waits on all of them with
+// epoll. Each edge runs its programs right away with the kernel timestamp of
+// the edge, instead of one scan later. The timestamp is also kept as the time
+// of the change the next scan finds on the input (sequence of events).
+//
+// The scan keeps polling the inputs as before. The programs bound to an
+// input whose edges can't be requested stay on the scan.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <linux/gpio.h>
+
+#include "ladder.h"
+
+#define GPIO_EVENT_MAX_LINES    64
+
+struct GpioEventLine
+{
+    int fd;
+    uint32_t input;     // %IX byte * 8 + bit
+};
+
+static GpioEventLine event_lines[GPIO_EVENT_MAX_LINES];
+static int event_line_count = 0;
+static int event_epoll = -1;
+static pthread_t event_thread;
+static bool event_thread_started = false;
+static volatile bool run_gpio_events = false;
+
+//-----------------------------------------------------------------------------
+// Thread waiting for the edges of the event lines
+//-----------------------------------------------------------------------------
+static void *gpioEventThread(void *arg)
+{
+    setThreadClass(THREAD_CLASS_IO, "gpio_events");
+
+    struct epoll_event ready[GPIO_EVENT_MAX_LINES];
+    while (run_gpio_events)
+    {
+        int count = epoll_wait(event_epoll, ready, GPIO_EVENT_MAX_LINES, 100);
+        for (int i = 0; i < count; i++)
+        {
+            GpioEventLine *line = &event_lines[ready[i].data.u32];
+            struct gpioevent_data event;
+            while (read(line->fd, &event, sizeof(event)) == sizeof(event))
+            {
+                // The kernel stamps the edges on CLOCK_MONOTONIC
+                struct timespec timestamp;
+                timestamp.tv_sec = (time_t)(event.timestamp / 1000000000ULL);
+                timestamp.tv_nsec = (long)(event.timestamp % 1000000000ULL);
+                recordInputEdge(line->input, &timestamp);
+                runEventTasks(line->input, event.id == GPIOEVENT_EVENT_RISING_EDGE, &timestamp);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Requests the edges of the inputs with an event task on a GPIO chip and
+// starts the thread that runs them. lines holds the line on the chip of
+// every digital input of the hardware layer, from %IX0.0 up, -1 for an input
+// that is not on the chip. Called by the hardware layer once the inputs are
+// configured
+//-----------------------------------------------------------------------------
+void startGpioEvents(const char *chip, const int *lines, int count)
+{
+    char log_msg[1000];
+
+    int chip_fd = -1;
+    for (int i = 0; i < count && event_line_count < GPIO_EVENT_MAX_LINES; i++)
+    {
+        int edges = getEventTaskEdges((uint32_t)i);
+        if (edges == 0 || lines[i] < 0) continue;
+
+        if (chip_fd < 0)
+        {
+            chip_fd = open(chip, O_RDONLY);
+            if (chip_fd < 0)
+            {
+                sprintf(log_msg, "GPIO events: can't open %s (%s), the event tasks run on the scan\n", chip, strerror(errno));
+                openplc_log(log_msg);
+                return;
+            }
+        }
+
+        struct gpioevent_request request;
+        memset(&request, 0, sizeof(request));
+        request.lineoffset = (uint32_t)lines[i];
+        request.handleflags = GPIOHANDLE_REQUEST_INPUT;
+        request.eventflags = edges == EVENT_EDGE_BOTH ? GPIOEVENT_REQUEST_BOTH_EDGES :
+                             edges == EVENT_EDGE_RISING ? GPIOEVENT_REQUEST_RISING_EDGE : GPIOEVENT_REQUEST_FALLING_EDGE;
+        snprintf(request.consumer_label, sizeof(request.consumer_label), "openplc");
+        if (ioctl(chip_fd, GPIO_GET_LINEEVENT_IOCTL, &request) < 0)
+        {
+            sprintf(log_msg, "GPIO events: can't request the edges of line %d (%s)\n", lines[i], strerror(errno));
+            openplc_log(log_msg);
+            continue;
+        }
+
+        fcntl(request.fd, F_SETFL, fcntl(request.fd, F_GETFL) | O_NONBLOCK);
+        event_lines[event_line_count].fd = request.fd;
+        event_lines[event_line_count].input = (uint32_t)i;
+        event_line_count++;
+    }
+    if (chip_fd >= 0) close(chip_fd);
+    if (event_line_count == 0) return;
+
+    event_epoll = epoll_create1(EPOLL_CLOEXEC);
+    for (int i = 0; i < event_line_count; i++)
+    {
+        struct epoll_event watch;
+        watch.events = EPOLLIN;
+        watch.data.u32 = (uint32_t)i;
+        epoll_ctl(event_epoll, EPOLL_CTL_ADD, event_lines[i].fd, &watch);
+    }
+
+    run_gpio_events = true;
+    if (pthread_create(&event_thread, NULL, gpioEventThread, NULL) != 0)
+    {
+        sprintf(log_msg, "GPIO events: failed to start the event thread\n");
+        openplc_log(log_msg);
+        run_gpio_events = false;
+        stopGpioEvents();
+        return;
+    }
+    event_thread_started = true;
+    for (int i = 0; i < event_line_count; i++) armEventTasks(event_lines[i].input);
+
+    sprintf(log_msg, "GPIO events: watching %d inputs on %s\n", event_line_count, chip);
+    openplc_log(log_msg);
+}
+
+//-----------------------------------------------------------------------------
+// Stops the event thread and releases the lines
+//-----------------------------------------------------------------------------
+void stopGpioEvents()
+{
+    run_gpio_events = false;
+    if (event_thread_started)
+    {
+        pthread_join(event_thread, NULL);
+        event_thread_started = false;
+    }
+
+    for (int i = 0; i < event_line_count; i++) close(event_lines[i].fd);
+    event_line_count = 0;
+    if (event_epoll >= 0) close(event_epoll);
+    event_epoll = -1;
+}
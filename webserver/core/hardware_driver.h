@@ -0,0 +1,64 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file is appended to a hardware layer that is built as an additional
+// driver (see compile_program.sh). The build renames the I/O pointer tables
+// and bufferLock used by the layer, so the definitions below give it a
+// private view of the process image that hardware_drivers.cpp fills with
+// the points bound to the driver. The layer is registered by a static
+// constructor; all other symbols of the object are made local after it is
+// compiled, so several layers can be linked in the same runtime.
+//-----------------------------------------------------------------------------
+
+#ifndef HARDWARE_DRIVER_NAME
+#error "HARDWARE_DRIVER_NAME must be defined when building a hardware driver"
+#endif
+
+#ifndef HARDWARE_DRIVER_RANGES
+#define HARDWARE_DRIVER_RANGES ""
+#endif
+
+IEC_BOOL *bool_input[BUFFER_SIZE][8];
+IEC_BOOL *bool_output[BUFFER_SIZE][8];
+IEC_BYTE *byte_input[BUFFER_SIZE];
+IEC_BYTE *byte_output[BUFFER_SIZE];
+IEC_UINT *int_input[BUFFER_SIZE];
+IEC_UINT *int_output[BUFFER_SIZE];
+IEC_UDINT *dint_input[BUFFER_SIZE];
+IEC_UDINT *dint_output[BUFFER_SIZE];
+IEC_ULINT *lint_input[BUFFER_SIZE];
+IEC_ULINT *lint_output[BUFFER_SIZE];
+pthread_mutex_t bufferLock = PTHREAD_MUTEX_INITIALIZER;
+
+static HardwareDriverTables hardware_driver_tables =
+{
+    bool_input, bool_output, byte_input, byte_output, int_input, int_output,
+    dint_input, dint_output, lint_input, lint_output, &bufferLock
+};
+
+static HardwareDriver hardware_driver =
+{
+    HARDWARE_DRIVER_NAME, HARDWARE_DRIVER_RANGES,
+    initializeHardware, finalizeHardware, updateBuffersIn, updateBuffersOut,
+    &hardware_driver_tables
+};
+
+static void __attribute__((constructor)) hardware_driver_register()
+{
+    registerHardwareDriver(&hardware_driver);
+}
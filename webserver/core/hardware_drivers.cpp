@@ -0,0 +1,467 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the registry of additional hardware drivers. Besides
+// the hardware layer linked as hardware_layer.cpp, other layers can be built
+// as drivers (see hardware_driver.h), each one bound to address ranges of
+// the process image. A driver works on a shadow copy of its points and runs
+// its updateBuffersOut/updateBuffersIn on its own I/O thread, started by the
+// scan once the outputs are copied. The I/O of the drivers therefore runs
+// while the next scan executes the program, and the scan only copies the
+// shadow values from and to the located variables.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "ladder.h"
+
+#define MAX_HARDWARE_DRIVERS    8
+#define MAX_DRIVER_RANGES       32
+
+enum
+{
+    TABLE_BOOL_IN, TABLE_BOOL_OUT,
+    TABLE_BYTE_IN, TABLE_BYTE_OUT,
+    TABLE_INT_IN, TABLE_INT_OUT,
+    TABLE_DINT_IN, TABLE_DINT_OUT,
+    TABLE_LINT_IN, TABLE_LINT_OUT
+};
+
+struct DriverRange
+{
+    int table;
+    int first;
+    int last;           // inclusive, bools are counted as byte * 8 + bit
+};
+
+// Values of the bound points, seen by the driver through its tables
+struct DriverShadow
+{
+    IEC_BOOL bool_in[BUFFER_SIZE * 8];
+    IEC_BOOL bool_out[BUFFER_SIZE * 8];
+    IEC_BYTE byte_in[BUFFER_SIZE];
+    IEC_BYTE byte_out[BUFFER_SIZE];
+    IEC_UINT int_in[BUFFER_SIZE];
+    IEC_UINT int_out[BUFFER_SIZE];
+    IEC_UDINT dint_in[BUFFER_SIZE];
+    IEC_UDINT dint_out[BUFFER_SIZE];
+    IEC_ULINT lint_in[BUFFER_SIZE];
+    IEC_ULINT lint_out[BUFFER_SIZE];
+};
+
+struct DriverState
+{
+    HardwareDriver *driver;
+    DriverRange ranges[MAX_DRIVER_RANGES];
+    int range_count;
+    DriverShadow *shadow;
+
+    pthread_t thread;
+    bool thread_started;
+    pthread_mutex_t cycleLock;
+    pthread_cond_t cycleSignal;
+    bool running;
+    uint32_t cycle;     // bumped by the scan once the outputs are copied
+};
+
+// Filled by static constructors, before main
+static HardwareDriver *registered_drivers[MAX_HARDWARE_DRIVERS];
+static int registered_count = 0;
+
+static DriverState drivers[MAX_HARDWARE_DRIVERS];
+static int driver_count = 0;
+
+//-----------------------------------------------------------------------------
+// Called by the static constructor of each driver object
+//-----------------------------------------------------------------------------
+void registerHardwareDriver(HardwareDriver *driver)
+{
+    if (registered_count < MAX_HARDWARE_DRIVERS)
+    {
+        registered_drivers[registered_count++] = driver;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Parses one location ([%]IX0.0, QW12, ...). Returns a pointer past it, or
+// NULL if the text isn't a location
+//-----------------------------------------------------------------------------
+static const char *parseLocation(const char *text, int *table, int *index)
+{
+    if (*text == '%') text++;
+
+    int direction;
+    if (*text == 'I') direction = 0;
+    else if (*text == 'Q') direction = 1;
+    else return NULL;
+    text++;
+
+    char size = *text++;
+    switch (size)
+    {
+        case 'X': *table = TABLE_BOOL_IN + direction; break;
+        case 'B': *table = TABLE_BYTE_IN + direction; break;
+        case 'W': *table = TABLE_INT_IN + direction; break;
+        case 'D': *table = TABLE_DINT_IN + direction; break;
+        case 'L': *table = TABLE_LINT_IN + direction; break;
+        default: return NULL;
+    }
+
+    if (!isdigit((unsigned char)*text)) return NULL;
+    char *end;
+    long value = strtol(text, &end, 10);
+    if (size == 'X')
+    {
+        if (*end != '.' || !isdigit((unsigned char)end[1])) return NULL;
+        long bit = strtol(end + 1, &end, 10);
+        if (bit > 7) return NULL;
+        value = value * 8 + bit;
+        if (value >= BUFFER_SIZE * 8) return NULL;
+    }
+    else if (value >= BUFFER_SIZE)
+    {
+        return NULL;
+    }
+
+    *index = (int)value;
+    return end;
+}
+
+//-----------------------------------------------------------------------------
+// Parses the address ranges of a driver, separated by commas or spaces.
+// Returns the number of ranges, or -1 if the text is malformed
+//-----------------------------------------------------------------------------
+static int parseRanges(const char *text, DriverRange *ranges, int max_ranges)
+{
+    int count = 0;
+    while (*text)
+    {
+        if (*text == ',' || isspace((unsigned char)*text))
+        {
+            text++;
+            continue;
+        }
+        if (count == max_ranges) return -1;
+
+        DriverRange *range = &ranges[count];
+        text = parseLocation(text, &range->table, &range->first);
+        if (text == NULL) return -1;
+        range->last = range->first;
+
+        if (*text == '-')
+        {
+            int table;
+            text = parseLocation(text + 1, &table, &range->last);
+            if (text == NULL || table != range->table || range->last < range->first) return -1;
+        }
+        count++;
+    }
+    return count;
+}
+
+//-----------------------------------------------------------------------------
+// Points the driver tables at the shadow values of the bound points that
+// are located on the program. Every other pointer is left NULL, so the
+// driver skips it as it does with unused I/O
+//-----------------------------------------------------------------------------
+static void bindDriver(DriverState *state)
+{
+    HardwareDriverTables *t = state->driver->tables;
+    DriverShadow *shadow = state->shadow;
+
+    pthread_mutex_lock(t->lock);
+    memset(t->bool_in, 0, sizeof(IEC_BOOL *) * BUFFER_SIZE * 8);
+    memset(t->bool_out, 0, sizeof(IEC_BOOL *) * BUFFER_SIZE * 8);
+    memset(t->byte_in, 0, sizeof(IEC_BYTE *) * BUFFER_SIZE);
+    memset(t->byte_out, 0, sizeof(IEC_BYTE *) * BUFFER_SIZE);
+    memset(t->int_in, 0, sizeof(IEC_UINT *) * BUFFER_SIZE);
+    memset(t->int_out, 0, sizeof(IEC_UINT *) * BUFFER_SIZE);
+    memset(t->dint_in, 0, sizeof(IEC_UDINT *) * BUFFER_SIZE);
+    memset(t->dint_out, 0, sizeof(IEC_UDINT *) * BUFFER_SIZE);
+    memset(t->lint_in, 0, sizeof(IEC_ULINT *) * BUFFER_SIZE);
+    memset(t->lint_out, 0, sizeof(IEC_ULINT *) * BUFFER_SIZE);
+
+    for (int r = 0; r < state->range_count; r++)
+    {
+        DriverRange *range = &state->ranges[r];
+        for (int i = range->first; i <= range->last; i++)
+        {
+            switch (range->table)
+            {
+                case TABLE_BOOL_IN:
+                    if (bool_input[i/8][i%8] != NULL) t->bool_in[i/8][i%8] = &shadow->bool_in[i];
+                    break;
+                case TABLE_BOOL_OUT:
+                    if (bool_output[i/8][i%8] != NULL) t->bool_out[i/8][i%8] = &shadow->bool_out[i];
+                    break;
+                case TABLE_BYTE_IN:
+                    if (byte_input[i] != NULL) t->byte_in[i] = &shadow->byte_in[i];
+                    break;
+                case TABLE_BYTE_OUT:
+                    if (byte_output[i] != NULL) t->byte_out[i] = &shadow->byte_out[i];
+                    break;
+                case TABLE_INT_IN:
+                    if (int_input[i] != NULL) t->int_in[i] = &shadow->int_in[i];
+                    break;
+                case TABLE_INT_OUT:
+                    if (int_output[i] != NULL) t->int_out[i] = &shadow->int_out[i];
+                    break;
+                case TABLE_DINT_IN:
+                    if (dint_input[i] != NULL) t->dint_in[i] = &shadow->dint_in[i];
+                    break;
+                case TABLE_DINT_OUT:
+                    if (dint_output[i] != NULL) t->dint_out[i] = &shadow->dint_out[i];
+                    break;
+                case TABLE_LINT_IN:
+                    if (lint_input[i] != NULL) t->lint_in[i] = &shadow->lint_in[i];
+                    break;
+                case TABLE_LINT_OUT:
+                    if (lint_output[i] != NULL) t->lint_out[i] = &shadow->lint_out[i];
+                    break;
+            }
+        }
+    }
+    pthread_mutex_unlock(t->lock);
+}
+
+//-----------------------------------------------------------------------------
+// I/O thread of a driver. Runs one exchange per scan; if the scan is faster
+// than the driver, the cycles it missed are merged into the next one
+//-----------------------------------------------------------------------------
+static void *driverThread(void *arg)
+{
+    setThreadClass(THREAD_CLASS_IO, "hw_driver");
+
+    DriverState *state = (DriverState *)arg;
+    uint32_t done = 0;
+
+    while (true)
+    {
+        pthread_mutex_lock(&state->cycleLock);
+        while (state->running && state->cycle == done)
+        {
+            pthread_cond_wait(&state->cycleSignal, &state->cycleLock);
+        }
+        if (!state->running)
+        {
+            pthread_mutex_unlock(&state->cycleLock);
+            break;
+        }
+        done = state->cycle;
+        pthread_mutex_unlock(&state->cycleLock);
+
+        state->driver->update_outputs();
+        state->driver->update_inputs();
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Parses the bindings of the registered drivers and initializes them. Called
+// right after the main hardware layer is initialized
+//-----------------------------------------------------------------------------
+void initializeHardwareDrivers()
+{
+    char log_msg[1000];
+
+    for (int d = 0; d < registered_count; d++)
+    {
+        HardwareDriver *driver = registered_drivers[d];
+        DriverState *state = &drivers[driver_count];
+
+        state->range_count = parseRanges(driver->ranges, state->ranges, MAX_DRIVER_RANGES);
+        if (state->range_count < 0)
+        {
+            sprintf(log_msg, "Hardware driver %s: invalid address ranges '%s', driver disabled\n", driver->name, driver->ranges);
+            openplc_log(log_msg);
+            continue;
+        }
+        state->shadow = (DriverShadow *)calloc(1, sizeof(DriverShadow));
+        if (state->shadow == NULL)
+        {
+            sprintf(log_msg, "Hardware driver %s: out of memory, driver disabled\n", driver->name);
+            openplc_log(log_msg);
+            continue;
+        }
+        state->driver = driver;
+        pthread_mutex_init(&state->cycleLock, NULL);
+        pthread_cond_init(&state->cycleSignal, NULL);
+        driver_count++;
+
+        bindDriver(state);
+        driver->initialize();
+
+        sprintf(log_msg, "Hardware driver %s loaded on %s\n", driver->name, driver->ranges);
+        openplc_log(log_msg);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Binds the drivers again, now that every located variable is known, reads
+// their first inputs and starts their I/O threads
+//-----------------------------------------------------------------------------
+void startHardwareDrivers()
+{
+    char log_msg[1000];
+
+    for (int d = 0; d < driver_count; d++)
+    {
+        DriverState *state = &drivers[d];
+        bindDriver(state);
+        state->driver->update_inputs();
+
+        state->running = true;
+        if (pthread_create(&state->thread, NULL, driverThread, state) == 0)
+        {
+            state->thread_started = true;
+        }
+        else
+        {
+            state->running = false;
+            sprintf(log_msg, "Hardware driver %s: failed to start its I/O thread\n", state->driver->name);
+            openplc_log(log_msg);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Copies the inputs acquired by the drivers to the located variables. Called
+// by the scan thread holding bufferLock
+//-----------------------------------------------------------------------------
+void exchangeHardwareDriverInputs()
+{
+    for (int d = 0; d < driver_count; d++)
+    {
+        DriverState *state = &drivers[d];
+        DriverShadow *shadow = state->shadow;
+
+        pthread_mutex_lock(state->driver->tables->lock);
+        for (int r = 0; r < state->range_count; r++)
+        {
+            DriverRange *range = &state->ranges[r];
+            for (int i = range->first; i <= range->last; i++)
+            {
+                switch (range->table)
+                {
+                    case TABLE_BOOL_IN:
+                        if (bool_input[i/8][i%8] != NULL) *bool_input[i/8][i%8] = shadow->bool_in[i];
+                        break;
+                    case TABLE_BYTE_IN:
+                        if (byte_input[i] != NULL) *byte_input[i] = shadow->byte_in[i];
+                        break;
+                    case TABLE_INT_IN:
+                        if (int_input[i] != NULL) *int_input[i] = shadow->int_in[i];
+                        break;
+                    case TABLE_DINT_IN:
+                        if (dint_input[i] != NULL) *dint_input[i] = shadow->dint_in[i];
+                        break;
+                    case TABLE_LINT_IN:
+                        if (lint_input[i] != NULL) *lint_input[i] = shadow->lint_in[i];
+                        break;
+                }
+            }
+        }
+        pthread_mutex_unlock(state->driver->tables->lock);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Copies the located outputs bound to a driver to its shadow values
+//-----------------------------------------------------------------------------
+static void copyDriverOutputs(DriverState *state)
+{
+    DriverShadow *shadow = state->shadow;
+
+    pthread_mutex_lock(state->driver->tables->lock);
+    for (int r = 0; r < state->range_count; r++)
+    {
+        DriverRange *range = &state->ranges[r];
+        for (int i = range->first; i <= range->last; i++)
+        {
+            switch (range->table)
+            {
+                case TABLE_BOOL_OUT:
+                    if (bool_output[i/8][i%8] != NULL) shadow->bool_out[i] = *bool_output[i/8][i%8];
+                    break;
+                case TABLE_BYTE_OUT:
+                    if (byte_output[i] != NULL) shadow->byte_out[i] = *byte_output[i];
+                    break;
+                case TABLE_INT_OUT:
+                    if (int_output[i] != NULL) shadow->int_out[i] = *int_output[i];
+                    break;
+                case TABLE_DINT_OUT:
+                    if (dint_output[i] != NULL) shadow->dint_out[i] = *dint_output[i];
+                    break;
+                case TABLE_LINT_OUT:
+                    if (lint_output[i] != NULL) shadow->lint_out[i] = *lint_output[i];
+                    break;
+            }
+        }
+    }
+    pthread_mutex_unlock(state->driver->tables->lock);
+}
+
+//-----------------------------------------------------------------------------
+// Copies the located outputs to the drivers and starts their exchange.
+// Called by the scan thread holding bufferLock, after the program ran
+//-----------------------------------------------------------------------------
+void exchangeHardwareDriverOutputs()
+{
+    for (int d = 0; d < driver_count; d++)
+    {
+        DriverState *state = &drivers[d];
+        copyDriverOutputs(state);
+
+        pthread_mutex_lock(&state->cycleLock);
+        state->cycle++;
+        pthread_cond_signal(&state->cycleSignal);
+        pthread_mutex_unlock(&state->cycleLock);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Stops the I/O threads, sends the last (disabled) outputs and finalizes the
+// drivers
+//-----------------------------------------------------------------------------
+void finalizeHardwareDrivers()
+{
+    for (int d = 0; d < driver_count; d++)
+    {
+        DriverState *state = &drivers[d];
+        if (state->thread_started)
+        {
+            pthread_mutex_lock(&state->cycleLock);
+            state->running = false;
+            pthread_cond_signal(&state->cycleSignal);
+            pthread_mutex_unlock(&state->cycleLock);
+            pthread_join(state->thread, NULL);
+            state->thread_started = false;
+        }
+
+        lockBuffer();
+        copyDriverOutputs(state);
+        unlockBuffer();
+        state->driver->update_outputs();
+        state->driver->finalize();
+    }
+}
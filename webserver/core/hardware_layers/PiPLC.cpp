@@ -126,7 +126,7 @@ void finalizeHardware()
 //-----------------------------------------------------------------------------
 void updateBuffersIn()
 {
-    pthread_mutex_lock(&bufferLock); //lock mutex
+    lockBuffer();
 
     //INPUT
     for (int i = 0; i < MAX_INPUT; i++)
@@ -134,7 +134,7 @@ void updateBuffersIn()
         if (bool_input[i/8][i%8] != NULL) *bool_input[i/8][i%8] = !gpioRead(inBufferPinMask[i]);
     }
 
-    pthread_mutex_unlock(&bufferLock); //unlock mutex
+    unlockBuffer();
 }
 
 //-----------------------------------------------------------------------------
@@ -144,7 +144,7 @@ void updateBuffersIn()
 //-----------------------------------------------------------------------------
 void updateBuffersOut()
 {
-    pthread_mutex_lock(&bufferLock); //lock mutex
+    lockBuffer();
 
     //OUTPUT
     for (int i = 0; i < MAX_OUTPUT; i++)
@@ -158,5 +158,5 @@ void updateBuffersOut()
         if (int_output[i] != NULL) gpioPWM(analogOutBufferPinMask[i], (*int_output[i] / 64));
     }
 
-    pthread_mutex_unlock(&bufferLock); //unlock mutex
+    unlockBuffer();
 }
@@ -55,7 +55,7 @@ void finalizeHardware()
 //-----------------------------------------------------------------------------
 void updateBuffersIn()
 {
-    pthread_mutex_lock(&bufferLock); //lock mutex
+    lockBuffer();
 
     /*********READING AND WRITING TO I/O**************
 
@@ -67,7 +67,7 @@ void updateBuffersIn()
 
     **************************************************/
 
-    pthread_mutex_unlock(&bufferLock); //unlock mutex
+    unlockBuffer();
 }
 
 //-----------------------------------------------------------------------------
@@ -77,7 +77,7 @@ void updateBuffersIn()
 //-----------------------------------------------------------------------------
 void updateBuffersOut()
 {
-    pthread_mutex_lock(&bufferLock); //lock mutex
+    lockBuffer();
 
     /*********READING AND WRITING TO I/O**************
 
@@ -89,6 +89,6 @@ void updateBuffersOut()
 
     **************************************************/
 
-    pthread_mutex_unlock(&bufferLock); //unlock mutex
+    unlockBuffer();
 }
 
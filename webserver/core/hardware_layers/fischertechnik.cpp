@@ -160,7 +160,7 @@ void updateBuffersIn()
     sendBytes[1] = 0; //make sure output is off
     sendBytes[2] = 0; //make sure output is off
 
-    pthread_mutex_lock(&bufferLock);
+    lockBuffer();
     for (i=0; i<8; i++)
     {
         if (bool_output[0][i] != NULL) sendBytes[1] = sendBytes[1] | (*bool_output[0][i] << i); //write each bit
@@ -169,11 +169,11 @@ void updateBuffersIn()
     {
         if (bool_output[1][i%8] != NULL) sendBytes[2] = sendBytes[2] | (*bool_output[1][i%8] << (i-8)); //write each bit
     }
-    pthread_mutex_unlock(&bufferLock);
+    unlockBuffer();
 
     sendOutput(sendBytes, recvBytes);
 
-    pthread_mutex_lock(&bufferLock);
+    lockBuffer();
     //if (int_input[0] != NULL) *int_input[0] = (int)(recvBytes[2] << 8) | (int)recvBytes[3]; //EX
     //if (int_input[1] != NULL) *int_input[1] = (int)(recvBytes[4] << 8) | (int)recvBytes[5]; //EY
 
@@ -188,7 +188,7 @@ void updateBuffersIn()
         //printf("%d\t", DiscreteInputBuffer0[i]);
     }
     //printf("\n");
-    pthread_mutex_unlock(&bufferLock);
+    unlockBuffer();
 }
 
 //-----------------------------------------------------------------------------
@@ -203,7 +203,7 @@ void updateBuffersOut()
     sendBytes[1] = 0; //make sure output is off
     sendBytes[2] = 0; //make sure output is off
 
-    pthread_mutex_lock(&bufferLock);
+    lockBuffer();
     for (i=0; i<8; i++)
     {
         if (bool_output[0][i] != NULL) sendBytes[1] = sendBytes[1] | (*bool_output[0][i] << i); //write each bit
@@ -212,11 +212,11 @@ void updateBuffersOut()
     {
         if (bool_output[1][i%8] != NULL) sendBytes[2] = sendBytes[2] | (*bool_output[1][i%8] << (i-8)); //write each bit
     }
-    pthread_mutex_unlock(&bufferLock);
+    unlockBuffer();
 
     sendOutput(sendBytes, recvBytes);
 
-    pthread_mutex_lock(&bufferLock);
+    lockBuffer();
     //if (int_input[0] != NULL) *int_input[0] = (int)(recvBytes[2] << 8) | (int)recvBytes[3]; //EX
     //if (int_input[1] != NULL) *int_input[1] = (int)(recvBytes[4] << 8) | (int)recvBytes[5]; //EY
 
@@ -231,6 +231,6 @@ void updateBuffersOut()
         //printf("%d\t", DiscreteInputBuffer0[i]);
     }
     //printf("\n");
-    pthread_mutex_unlock(&bufferLock);
+    unlockBuffer();
 }
 
@@ -43,6 +43,23 @@ char digital_outputs[1000][200];
 char analog_inputs[1000][200];
 char analog_outputs[1000][200];
 
+// File descriptors of the I/O found by searchForIO(). They are opened once
+// in initializeHardware() so the scan only does a pread()/pwrite() per point.
+int digital_inputs_fd[1000];
+int digital_outputs_fd[1000];
+int analog_inputs_fd[1000];
+int analog_outputs_fd[1000];
+int num_digital_inputs, num_digital_outputs, num_analog_inputs, num_analog_outputs;
+
+// Last values written to the outputs. sysfs writes are only issued when the
+// value changes, which for most outputs means almost never.
+int last_digital_out[1000];
+int last_analog_out[1000];
+
+// Values read from the inputs, filled before bufferLock is taken
+IEC_BOOL digital_in_values[1000];
+IEC_UINT analog_in_values[1000];
+
 
 //-----------------------------------------------------------------------------
 // This function is responsible for making I/O requests using SYSFS
@@ -90,6 +107,67 @@ int requestSYSFS(char *path, char *command)
     }
 }
 
+//-----------------------------------------------------------------------------
+// Opens every path on the list with the given flags. Returns how many
+// entries the list has.
+//-----------------------------------------------------------------------------
+int openIO(char paths[][200], int *fds, int flags)
+{
+    int count = 0;
+    while (paths[count][0] != '\0')
+    {
+        fds[count] = open(paths[count], flags);
+        if (fds[count] < 0)
+        {
+            char log_msg[1000];
+            sprintf(log_msg, "Neuron: Failed to open %s\n", paths[count]);
+            openplc_log(log_msg);
+        }
+        count++;
+    }
+
+    return count;
+}
+
+//-----------------------------------------------------------------------------
+// Closes the file descriptors opened by openIO()
+//-----------------------------------------------------------------------------
+void closeIO(int *fds, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (fds[i] >= 0) close(fds[i]);
+        fds[i] = -1;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Reads the current value of an already opened sysfs attribute. sysfs
+// regenerates the attribute on every read from offset 0, so there is no need
+// to reopen or seek the file.
+//-----------------------------------------------------------------------------
+int readIO(int fd)
+{
+    char buf[32];
+
+    if (fd < 0) return -1;
+
+    ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (len <= 0) return -1;
+
+    buf[len] = '\0';
+    return atoi(buf);
+}
+
+//-----------------------------------------------------------------------------
+// Writes a value to an already opened sysfs attribute
+//-----------------------------------------------------------------------------
+void writeIO(int fd, char *value)
+{
+    if (fd < 0) return;
+    pwrite(fd, value, strlen(value), 0);
+}
+
 //------------------------------------------------------------------------------------------------------------
 // Look for all available I/Os connected to Neuron. Scan from 1_01 to 10_20. With specific scan for user leds 
 //------------------------------------------------------------------------------------------------------------
@@ -285,6 +363,15 @@ void searchForIO()
 void initializeHardware()
 {
     searchForIO();
+
+    num_digital_inputs = openIO(digital_inputs, digital_inputs_fd, O_RDONLY);
+    num_digital_outputs = openIO(digital_outputs, digital_outputs_fd, O_WRONLY);
+    num_analog_inputs = openIO(analog_inputs, analog_inputs_fd, O_RDONLY);
+    num_analog_outputs = openIO(analog_outputs, analog_outputs_fd, O_WRONLY);
+
+    // Force the first scan to write every output
+    for (int i = 0; i < num_digital_outputs; i++) last_digital_out[i] = -1;
+    for (int i = 0; i < num_analog_outputs; i++) last_analog_out[i] = -1;
 }
 
 //-----------------------------------------------------------------------------
@@ -293,6 +380,10 @@ void initializeHardware()
 //-----------------------------------------------------------------------------
 void finalizeHardware()
 {
+    closeIO(digital_inputs_fd, num_digital_inputs);
+    closeIO(digital_outputs_fd, num_digital_outputs);
+    closeIO(analog_inputs_fd, num_analog_inputs);
+    closeIO(analog_outputs_fd, num_analog_outputs);
 }
 
 //-----------------------------------------------------------------------------
@@ -302,31 +393,33 @@ void finalizeHardware()
 //-----------------------------------------------------------------------------
 void updateBuffersIn()
 {
-    pthread_mutex_lock(&bufferLock); //lock mutex
-    
-    /* read digital inputs */
-    int i = 0;
-    while (digital_inputs[i][0] != '\0')
-    {   
-        if (bool_input[i/8][i%8] != NULL) *bool_input[i/8][i%8] = requestSYSFS(digital_inputs[i], "read");
-        i++;
+    /* read the hardware first, so the buffers are locked only for the copy */
+    for (int i = 0; i < num_digital_inputs; i++)
+    {
+        digital_in_values[i] = (readIO(digital_inputs_fd[i]) > 0);
     }
-    
-    /* read analog inputs */
-    i = 0;
-    while (analog_inputs[i][0] != '\0')
+
+    for (int i = 0; i < num_analog_inputs; i++)
     {
-        if (int_input[i] != NULL)
-        {
-            uint32_t value = (uint32_t)((float)requestSYSFS(analog_inputs[i], "read") * 6.5535);
-            if (value > 65535) value = 65535;
-            *int_input[i] = (uint16_t)value;
-        }
-        
-        i++;
+        int raw = readIO(analog_inputs_fd[i]);
+        uint32_t value = (raw < 0) ? 0 : (uint32_t)((float)raw * 6.5535);
+        if (value > 65535) value = 65535;
+        analog_in_values[i] = (uint16_t)value;
+    }
+
+    lockBuffer();
+
+    for (int i = 0; i < num_digital_inputs; i++)
+    {
+        if (bool_input[i/8][i%8] != NULL) *bool_input[i/8][i%8] = digital_in_values[i];
     }
 
-    pthread_mutex_unlock(&bufferLock); //unlock mutex
+    for (int i = 0; i < num_analog_inputs; i++)
+    {
+        if (int_input[i] != NULL) *int_input[i] = analog_in_values[i];
+    }
+
+    unlockBuffer();
 }
 
 //-----------------------------------------------------------------------------
@@ -336,37 +429,42 @@ void updateBuffersIn()
 //-----------------------------------------------------------------------------
 void updateBuffersOut()
 {
-    pthread_mutex_lock(&bufferLock); //lock mutex
-    
+    int digital_values[1000];
+    int analog_values[1000];
+
+    lockBuffer();
+
+    for (int i = 0; i < num_digital_outputs; i++)
+    {
+        digital_values[i] = (bool_output[i/8][i%8] != NULL) ? (*bool_output[i/8][i%8] != 0) : -1;
+    }
+
+    for (int i = 0; i < num_analog_outputs; i++)
+    {
+        analog_values[i] = (int_output[i] != NULL) ? *int_output[i] : -1;
+    }
+
+    unlockBuffer();
+
     /* write digital outputs */
-    int i = 0;
-    while (digital_outputs[i][0] != '\0')
+    for (int i = 0; i < num_digital_outputs; i++)
     {
-        if (bool_output[i/8][i%8] != NULL) 
+        if (digital_values[i] >= 0 && digital_values[i] != last_digital_out[i])
         {
-            if (*bool_output[i/8][i%8])
-                requestSYSFS(digital_outputs[i], "write=1");
-            else
-                requestSYSFS(digital_outputs[i], "write=0");
+            writeIO(digital_outputs_fd[i], (char *)(digital_values[i] ? "1" : "0"));
+            last_digital_out[i] = digital_values[i];
         }
-        i++;
     }
 
     /* write analog outputs */
-    i = 0;
-    while (analog_outputs[i][0] != '\0')
+    for (int i = 0; i < num_analog_outputs; i++)
     {
-        if (int_output[i] != NULL) 
+        if (analog_values[i] >= 0 && analog_values[i] != last_analog_out[i])
         {
-            char value_fmt[100];
             char value[100];
-            strcpy(value_fmt, "write=%f");
-            sprintf(value, value_fmt, ((float)*int_output[i]/6.5535));
-            requestSYSFS(analog_outputs[i], value);
+            sprintf(value, "%f", ((float)analog_values[i]/6.5535));
+            writeIO(analog_outputs_fd[i], value);
+            last_analog_out[i] = analog_values[i];
         }
-        i++;
     }
-    
-    pthread_mutex_unlock(&bufferLock); //unlock mutex
-    
 }
@@ -89,6 +89,14 @@ void initializeHardware()
     // 	}
     // }
 
+    //edges of the inputs bound to event tasks. The H616 GPIO numbers are the
+    //lines of the first GPIO chip
+    int inputLines[MAX_INPUT];
+    for (int i = 0; i < MAX_INPUT; i++)
+    {
+        inputLines[i] = wpiPinToGpio(inBufferPinMask[i]);
+    }
+    startGpioEvents("/dev/gpiochip0", inputLines, MAX_INPUT);
 }
 
 //-----------------------------------------------------------------------------
@@ -97,6 +105,7 @@ void initializeHardware()
 //-----------------------------------------------------------------------------
 void finalizeHardware()
 {
+    stopGpioEvents();
 }
 
 //-----------------------------------------------------------------------------
@@ -106,7 +115,7 @@ void finalizeHardware()
 //-----------------------------------------------------------------------------
 void updateBuffersIn()
 {
-    pthread_mutex_lock(&bufferLock); //lock mutex
+    lockBuffer();
 
     //INPUT
     for (int i = 0; i < MAX_INPUT; i++)
@@ -114,7 +123,7 @@ void updateBuffersIn()
         if (bool_input[i/8][i%8] != NULL) *bool_input[i/8][i%8] = digitalRead(inBufferPinMask[i]);
     }
 
-    pthread_mutex_unlock(&bufferLock); //unlock mutex
+    unlockBuffer();
 }
 
 //-----------------------------------------------------------------------------
@@ -124,7 +133,7 @@ void updateBuffersIn()
 //-----------------------------------------------------------------------------
 void updateBuffersOut()
 {
-    pthread_mutex_lock(&bufferLock); //lock mutex
+    lockBuffer();
 
     //OUTPUT
     for (int i = 0; i < MAX_OUTPUT; i++)
@@ -137,6 +146,6 @@ void updateBuffersOut()
     //     if (int_output[i] != NULL) pwmWrite(analogOutBufferPinMask[i], (*int_output[i] / 64));
     // }
 
-    pthread_mutex_unlock(&bufferLock); //unlock mutex
+    unlockBuffer();
 }
 
@@ -40,6 +40,9 @@
 #include <wiringSerial.h>
 #include <pthread.h>
 #include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
 
 #include "ladder.h"
 
@@ -59,6 +62,14 @@
 #define MAX_TEMP_IN         4
 #define MAX_HUMID_IN        4
 
+// Minimum time between two exchanges with the board. The DHT sensors on the
+// GPIOs need 30 ms cycles, the board alone takes 2.5 ms ones
+#define MIN_CYCLE_US        2500
+#define MIN_CYCLE_DHT_US    30000
+#define GPIO_CTRL_DHT_MASK  0xF0
+// Refresh period of the board while no scan is running
+#define IDLE_CYCLE_MS       100
+
 #define bitRead(value, bit) (((value) >> (bit)) & 0x01)
 #define bitSet(value, bit) ((value) |= (1UL << (bit)))
 #define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
@@ -176,6 +187,13 @@ int Spi_Set_Aout(int channel, uint16_t value);
 static uint8_t byJumper10V;
 static uint8_t byInitFlag = 0;
 
+// SPI devices opened by the setup. The transfer descriptors are filled once
+// there, each exchange only points them at its frame
+static int spi_fd[2] = {-1, -1};
+static struct spi_ioc_transfer spi_transfer[2];
+static struct spi_ioc_transfer dac_transfer[2];
+static unsigned char dac_frame[2][2];
+
 uint16_t crc16_calc(uint16_t crc, uint8_t data)
 {
     int i;
@@ -194,19 +212,23 @@ uint16_t crc16_calc(uint16_t crc, uint8_t data)
     return crc;
 }
 
-int Spi_AutoModeDAC(struct pixtOutDAC *OutputDataDAC) {
-    
-    Spi_Set_Aout(0, OutputDataDAC->wAOut0);
-    Spi_Set_Aout(1, OutputDataDAC->wAOut1);
-        
-    return 0;
+//-----------------------------------------------------------------------------
+// Exchanges a whole frame with the board on a single full duplex transfer
+//-----------------------------------------------------------------------------
+static int Spi_Burst(int spi_device, unsigned char *frame, int len)
+{
+    if (spi_fd[spi_device] < 0)
+    {
+        return wiringPiSPIDataRW(spi_device, frame, len);
+    }
+    spi_transfer[spi_device].tx_buf = (unsigned long)frame;
+    spi_transfer[spi_device].rx_buf = (unsigned long)frame;
+    spi_transfer[spi_device].len = len;
+    return ioctl(spi_fd[spi_device], SPI_IOC_MESSAGE(1), &spi_transfer[spi_device]);
 }
 
-int Spi_Set_Aout(int channel, uint16_t value)
+static void Spi_Dac_Frame(int channel, uint16_t value, unsigned char *spi_output)
 {
-    unsigned char spi_output[2];
-    int spi_device = 1;
-    int len = 2;
     uint16_t tmp;
 
     spi_output[0] = 0b00010000;
@@ -227,7 +249,32 @@ int Spi_Set_Aout(int channel, uint16_t value)
     tmp = value & 0b0000111111;
     tmp = tmp << 2;
     spi_output[1]=tmp;
+}
+
+int Spi_AutoModeDAC(struct pixtOutDAC *OutputDataDAC) {
 
+    if (spi_fd[1] < 0)
+    {
+        Spi_Set_Aout(0, OutputDataDAC->wAOut0);
+        Spi_Set_Aout(1, OutputDataDAC->wAOut1);
+        return 0;
+    }
+
+    Spi_Dac_Frame(0, OutputDataDAC->wAOut0, dac_frame[0]);
+    Spi_Dac_Frame(1, OutputDataDAC->wAOut1, dac_frame[1]);
+    if (ioctl(spi_fd[1], SPI_IOC_MESSAGE(2), dac_transfer) < 0)
+        return -1;
+
+    return 0;
+}
+
+int Spi_Set_Aout(int channel, uint16_t value)
+{
+    unsigned char spi_output[2];
+    int spi_device = 1;
+    int len = 2;
+
+    Spi_Dac_Frame(channel, value, spi_output);
     wiringPiSPIDataRW(spi_device, spi_output, len);
 
     return 0;
@@ -243,7 +290,7 @@ int Spi_AutoModeV2L(struct pixtOutV2L *OutputData, struct pixtInV2L *InputData)
     uint16_t crcSumDataRxCalc;
     uint16_t wTempValue;
     int i;
-    unsigned char spi_output[111];
+    static unsigned char spi_output[111]; //only used by the I/O thread
     int spi_device = 0;
     int len = 111;
     
@@ -324,7 +371,7 @@ int Spi_AutoModeV2L(struct pixtOutV2L *OutputData, struct pixtInV2L *InputData)
     
     //-------------------------------------------------------------------------
     //Initialise SPI Data Transfer with OutputData
-    wiringPiSPIDataRW(spi_device, spi_output, len);
+    Spi_Burst(spi_device, spi_output, len);
     //-------------------------------------------------------------------------
    
     //Calculate Header CRC16 Receive Checksum
@@ -554,40 +601,97 @@ int Spi_SetupV2(int spi_device)
     pinMode(pin_Spi_enable, OUTPUT);
     digitalWrite(pin_Spi_enable,1); 
     
-    wiringPiSPISetup(spi_device, Spi_frequency);
+    spi_fd[spi_device] = wiringPiSPISetup(spi_device, Spi_frequency);
+    memset(&spi_transfer[spi_device], 0, sizeof(spi_transfer[spi_device]));
+    spi_transfer[spi_device].speed_hz = Spi_frequency;
+    spi_transfer[spi_device].bits_per_word = 8;
+    if (spi_device == 1)
+    {
+        // Both DAC channels go on one message, with the chip select
+        // released between them
+        memset(dac_transfer, 0, sizeof(dac_transfer));
+        for (int i = 0; i < 2; i++)
+        {
+            dac_transfer[i].tx_buf = (unsigned long)dac_frame[i];
+            dac_transfer[i].rx_buf = (unsigned long)dac_frame[i];
+            dac_transfer[i].len = 2;
+            dac_transfer[i].speed_hz = Spi_frequency;
+            dac_transfer[i].bits_per_word = 8;
+        }
+        dac_transfer[0].cs_change = 1;
+    }
 
     return 0;
 }
 
 pthread_mutex_t localBufferLock; //mutex for the internal ADC buffer
+pthread_cond_t localBufferUpdate = PTHREAD_COND_INITIALIZER; //signaled when the scan updates the outputs
+static bool outputsUpdated = false;
 struct pixtInV2L InputData;
 struct pixtOutV2L OutputData;
 struct pixtOutDAC OutputDataDAC;
 static const uint8_t byModel = 76;
 
+//-----------------------------------------------------------------------------
+// Waits (holding localBufferLock) until the scan updates the outputs or the
+// idle refresh period expires
+//-----------------------------------------------------------------------------
+static void waitForOutputs()
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += IDLE_CYCLE_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_nsec -= 1000000000L;
+        deadline.tv_sec++;
+    }
+    while (!outputsUpdated)
+    {
+        if (pthread_cond_timedwait(&localBufferUpdate, &localBufferLock, &deadline) != 0) break;
+    }
+    outputsUpdated = false;
+}
+
+//-----------------------------------------------------------------------------
+// I/O thread. Exchanges the board state once per scan, right after the scan
+// updates the outputs, so the transfer runs while the next scan executes the
+// program and its inputs are ready for the scan after it
+//-----------------------------------------------------------------------------
 void *updateLocalBuffers(void *args)
 {
+    setThreadClass(THREAD_CLASS_IO, "pixtend2l_io");
+
     struct pixtInV2L InputData_thread;
     struct pixtOutV2L OutputData_thread;
     struct pixtOutDAC OutputDataDAC_thread;
+    struct timespec cycle_start;
+    long min_cycle_us;
 
     while(1)
     {
         pthread_mutex_lock(&localBufferLock);
+        waitForOutputs();
         memcpy(&OutputData_thread, &OutputData, sizeof(pixtOutV2L));
         memcpy(&OutputDataDAC_thread, &OutputDataDAC, sizeof(pixtOutDAC));
+        min_cycle_us = (OutputData.byGPIOCtrl & GPIO_CTRL_DHT_MASK) ? MIN_CYCLE_DHT_US : MIN_CYCLE_US;
         pthread_mutex_unlock(&localBufferLock);
 
         //Exchange PiXtend Data
+        clock_gettime(CLOCK_MONOTONIC, &cycle_start);
         OutputData_thread.byModelOut = byModel;
-        Spi_AutoModeV2L(&OutputData_thread, &InputData_thread);
+        int result = Spi_AutoModeV2L(&OutputData_thread, &InputData_thread);
         Spi_AutoModeDAC(&OutputDataDAC_thread);
 
-        pthread_mutex_lock(&localBufferLock);
-        memcpy(&InputData, &InputData_thread, sizeof(pixtInV2L));
-        pthread_mutex_unlock(&localBufferLock);
+        //Keep the last good inputs if the frame was corrupted
+        if (result == 0)
+        {
+            pthread_mutex_lock(&localBufferLock);
+            memcpy(&InputData, &InputData_thread, sizeof(pixtInV2L));
+            pthread_mutex_unlock(&localBufferLock);
+        }
 
-        sleep_ms(30); //For temperature measurement MUST be 30 ms
+        sleep_until(&cycle_start, min_cycle_us * 1000LL);
     }
 }
 
@@ -620,7 +724,7 @@ void finalizeHardware()
 void updateBuffersIn()
 {
     //lock mutexes
-    pthread_mutex_lock(&bufferLock);
+    lockBuffer();
     pthread_mutex_lock(&localBufferLock);
     
     //DIGITAL INPUT
@@ -706,7 +810,7 @@ void updateBuffersIn()
    
     //unlock mutexes
     pthread_mutex_unlock(&localBufferLock);
-    pthread_mutex_unlock(&bufferLock);
+    unlockBuffer();
 }
 
 //-----------------------------------------------------------------------------
@@ -719,7 +823,7 @@ void updateBuffersOut()
     int inum = 0;
 
     //lock mutexes
-    pthread_mutex_lock(&bufferLock);
+    lockBuffer();
     pthread_mutex_lock(&localBufferLock);   
     
     //DIGITAL OUTPUT
@@ -802,7 +906,11 @@ void updateBuffersOut()
     // PWM2 - PWM2Ctrl0 - 5
     if (byte_output[inum] != NULL) OutputData.byPWM2Ctrl0 = *byte_output[inum];
     
+    //wake up the I/O thread to send the new outputs
+    outputsUpdated = true;
+    pthread_cond_signal(&localBufferUpdate);
+
     //unlock mutexes
     pthread_mutex_unlock(&localBufferLock);
-    pthread_mutex_unlock(&bufferLock);
+    unlockBuffer();
 }
@@ -27,60 +27,72 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/socket.h>
-#include <arpa/inet.h>
 #include <unistd.h>
 #include <string.h>
-#include <sys/types.h> 
-#include <sys/select.h>
+#include <limits.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <atomic>
 
-#define MB_PORT		2605
+#define PSM_SHM_NAME        "/openplc_psm"
+#define PSM_IMAGE_MAGIC     0x494d5350  /* "PSMI" */
+#define PSM_IMAGE_VERSION   1
 
-#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
-#define bitSet(value, bit) ((value) |= (1UL << (bit)))
-#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
-#define bitWrite(value, bit, bitvalue) (bitvalue ? bitSet(value, bit) : bitClear(value, bit))
+#define PSM_DIGITAL_POINTS  400
+#define PSM_ANALOG_POINTS   50
+#define PSM_READ_RETRIES    4
 
-#define ERROR_LIMIT    10
 #define BUFFER_LIMIT   1024 
 
 #include "ladder.h"
 
-int psm = 0;
-int error_count = 0;
-
-
 //-----------------------------------------------------------------------------
-// Verify if error count is at the limit and, if true, disable PSM
+// Process image shared with the PSM script. The runtime owns the outputs and
+// the PSM owns the inputs; each side writes its half under a sequence counter
+// (odd while the writer is updating it). After publishing the outputs of a
+// scan the runtime bumps the scan word, which the script can sleep on to run
+// once per PLC cycle
 //-----------------------------------------------------------------------------
-void check_error_count()
+struct PsmImage
 {
-    if (error_count >= ERROR_LIMIT)
-    {
-        char log_msg[1000];
-        sprintf(log_msg, "PSM: Too many errors!\nPSM: PSM is disabled\n");
-        openplc_log(log_msg);
-    }
-}
+    uint32_t magic;
+    uint32_t version;
+    std::atomic<uint32_t> scan;         // futex, bumped after every scan
+    std::atomic<uint32_t> quit;         // set when the runtime stops
+    std::atomic<uint32_t> in_sequence;  // written by the PSM
+    std::atomic<uint32_t> out_sequence; // written by the runtime
+    uint32_t reserved[2];
+    uint8_t dig_in[PSM_DIGITAL_POINTS];
+    uint8_t dig_out[PSM_DIGITAL_POINTS];
+    uint16_t ana_in[PSM_ANALOG_POINTS];
+    uint16_t ana_out[PSM_ANALOG_POINTS];
+};
+
+static PsmImage *psm_image = NULL;
 
 
 //-----------------------------------------------------------------------------
 // PSM Thread - Start python3 interpreter running PSM script
 //-----------------------------------------------------------------------------
-void *start_psm()
+void *start_psm(void *arg)
 {
+    setThreadClass(THREAD_CLASS_IO, "psm_io");
+
     char log_msg[BUFFER_LIMIT];
     sprintf(log_msg, "PSM: Starting PSM...\n");
     openplc_log(log_msg);
-    char *cmd = "../.venv/bin/python3 -u ./core/psm/main.py 2>&1";
+    const char *cmd = "../.venv/bin/python3 -u ./core/psm/main.py 2>&1";
     
     FILE *psm_proc;
     if ((psm_proc = popen(cmd, "r")) == NULL)
     {
         sprintf(log_msg, "PSM: Error opening pipe!\n");
         openplc_log(log_msg);
-        return;
+        return NULL;
     }
     
     while (fgets(log_msg, BUFFER_LIMIT, psm_proc) != NULL)
@@ -92,271 +104,65 @@ void *start_psm()
     {
         sprintf(log_msg, "PSM: Error while starting Python interpreter\n");
         openplc_log(log_msg);
-        return;
     }
+    return NULL;
 }
 
 //-----------------------------------------------------------------------------
-// Initializes TCP socket and connects to python PSM module
+// Creates the shared process image. The script attaches to it once the
+// magic is set. Returns NULL if the region can't be created
 //-----------------------------------------------------------------------------
-int connect_to_psm(int debug)
+PsmImage *create_psm_image()
 {
     char log_msg[1000];
-    int sock = 0;
-    struct sockaddr_in serv_addr;
 
-    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    int fd = shm_open(PSM_SHM_NAME, O_CREAT | O_RDWR, 0660);
+    if (fd < 0)
     {
-        if (debug)
-        {
-            sprintf(log_msg, "PSM: Socket creation error \n");
-            openplc_log(log_msg);
-        }
-        return -1;
-    }
-
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(MB_PORT);
-
-    if (inet_pton(AF_INET, "127.0.0.1", &serv_addr.sin_addr) <= 0)
-    {
-        if (debug)
-        {
-            sprintf(log_msg, "PSM: Invalid address or address not supported\n");
-            openplc_log(log_msg);
-        }
-        return -1;
-    }
-
-    if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
-    {
-        if (debug)
-        {
-            sprintf(log_msg, "PSM: Connection to psm failed\n");
-            openplc_log(log_msg);
-        }
-        return -1;
-    }
-
-    return sock;
-}
-
-//-----------------------------------------------------------------------------
-// Read analog inputs from PSM through Modbus Read Input Register function
-//-----------------------------------------------------------------------------
-void read_ana_inp(int psm)
-{
-    char log_msg[1000];
-    //                          tid     pid     len   uid  fc  start   count
-    unsigned char request[] = {00, 01, 00, 00, 00, 06, 00, 04, 00, 00, 00, 25};
-    unsigned char buffer[1024];
-    send(psm, request, 12, 0);
-    read(psm, buffer, 1024);
-
-    //check if response is complete
-    if (buffer[8] < 50)
-        return;
-
-    pthread_mutex_lock(&bufferLock); //lock mutex
-    int k = 9; //start at the beginning of data
-    for (int i=0; i<25; i++)
-    {
-        if (int_input[i] != NULL) *int_input[i] = buffer[k+1] | (uint16_t)buffer[k] << 8;
-        k=k+2;
-    }
-    pthread_mutex_unlock(&bufferLock); //unlock mutex
-
-    request[9]=25; //request the next 25 items
-    buffer[8]=0; //zeroed previous response size
-    send(psm, request, 12, 0);
-    read(psm, buffer, 1024);
-
-    //check if response is complete
-    if (buffer[8] < 50)
-    {
-        sprintf(log_msg, "PSM: Error reading from analog inputs!\n");
+        sprintf(log_msg, "PSM: shm_open error: %s\n", strerror(errno));
         openplc_log(log_msg);
-        error_count++;
-        check_error_count();
-    }
-
-    pthread_mutex_lock(&bufferLock); //lock mutex
-    k = 9; //start at the beginning of data
-    for (int i=25; i<50; i++)
-    {
-        if (int_input[i] != NULL) *int_input[i] = buffer[k+1] | (uint16_t)buffer[k] << 8;
-        k=k+2;
-    }
-    pthread_mutex_unlock(&bufferLock); //unlock mutex
-}
-
-//-----------------------------------------------------------------------------
-// Write analog outputs to PSM through Modbus Write Holding Register function
-//-----------------------------------------------------------------------------
-void write_ana_out(int psm)
-{
-    char log_msg[1000];
-    //                           tid     pid     len  uid  fc  start   count  len
-    unsigned char request[] = {00, 01, 00, 00, 00, 57, 00, 16, 00, 00, 00, 25, 50, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00};
-    unsigned char buffer[1024];
-    
-    pthread_mutex_lock(&bufferLock); //lock mutex
-    int k = 13;
-    for (int i = 0; i < 25; i ++)
-    {
-        if (int_output[i] != NULL)
-        {
-            request[k] = (unsigned char)(*int_output[i] >> 8);
-            k++;
-            request[k] = (unsigned char)(*int_output[i]);
-            k++;
-        }
+        return NULL;
     }
-    pthread_mutex_unlock(&bufferLock); //unlock mutex
-    
-    send(psm, request, 63, 0);
-    read(psm, buffer, 1024);
-    
-    //check if response is complete
-    if (buffer[11] < 25)
+    if (ftruncate(fd, sizeof(PsmImage)) == -1)
     {
-        sprintf(log_msg, "PSM: Error writing to analog outputs!\n");
+        sprintf(log_msg, "PSM: ftruncate error: %s\n", strerror(errno));
         openplc_log(log_msg);
-        error_count++;
-        check_error_count();
-    }
-    
-    pthread_mutex_lock(&bufferLock); //lock mutex
-    //write next 25 items
-    request[9] = 25;
-    k = 13;
-    for (int i = 25; i < 50; i ++)
-    {
-        if (int_output[i] != NULL)
-        {
-            request[k] = (unsigned char)(*int_output[i] >> 8);
-            k++;
-            request[k] = (unsigned char)(*int_output[i]);
-            k++;
-        }
+        close(fd);
+        shm_unlink(PSM_SHM_NAME);
+        return NULL;
     }
-    pthread_mutex_unlock(&bufferLock); //unlock mutex
-    
-    send(psm, request, 63, 0);
-    read(psm, buffer, 1024);
-    
-    //check if response is complete
-    if (buffer[11] < 25)
+    void *ptr = mmap(NULL, sizeof(PsmImage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED)
     {
-        sprintf(log_msg, "PSM: Error writing to analog outputs!\n");
+        sprintf(log_msg, "PSM: mmap error: %s\n", strerror(errno));
         openplc_log(log_msg);
-        error_count++;
-        check_error_count();
+        shm_unlink(PSM_SHM_NAME);
+        return NULL;
     }
-}
 
-//-----------------------------------------------------------------------------
-// Read digital inputs from PSM through Modbus Read Input Status function
-//-----------------------------------------------------------------------------
-void read_dig_inp(int psm)
-{
-    char log_msg[1000];
-    //                          tid     pid     len   uid  fc  start   count
-    unsigned char request[] = {00, 01, 00, 00, 00, 06, 00, 02, 00, 00, 0x01, 0x90}; //reading 400 coils count = 0x0190
-    unsigned char buffer[1024];
-    send(psm, request, 12, 0);
-    read(psm, buffer, 1024);
-    
-    //check if response is complete
-    if (buffer[8] < 50)
-    {
-        sprintf(log_msg, "PSM: Error reading from digital inputs!\n");
-        openplc_log(log_msg);
-        error_count++;
-        check_error_count();
-    }
-        
-    
-    //format of bits on response
-    //byte 1 => coils 7 to 0
-    //byte 2 => coils 15 to 8
-    //byte 3 => coils 23 to 16
-    
-    //read inputs into buffer
-    pthread_mutex_lock(&bufferLock); //lock mutex
-    int a = 0;
-    for (int i = 9; i < 59; i++)
-    {
-        for (int j = 0; j < 8; j++)
-        {
-            if (bool_input[a/8][a%8] != NULL) *bool_input[a/8][a%8] = bitRead(buffer[i], j);
-            a++;
-        }
-    }
-    pthread_mutex_unlock(&bufferLock); //unlock mutex
-}
+    PsmImage *image = (PsmImage *)ptr;
+    memset(ptr, 0, sizeof(PsmImage));
+    image->version = PSM_IMAGE_VERSION;
+    // The magic goes last, the script waits for it before reading the rest
+    std::atomic_thread_fence(std::memory_order_release);
+    image->magic = PSM_IMAGE_MAGIC;
 
-//-----------------------------------------------------------------------------
-// Write digital outputs from PSM through Modbus Write Coils function
-//-----------------------------------------------------------------------------
-void write_dig_out(int psm)
-{
-    char log_msg[1000];
-    //                          tid     pid     len   uid  fc  start   count (400 coils - 50 bytes)
-    unsigned char request[] = {00, 01, 00, 00, 00, 57, 00, 15, 00, 00, 0x01, 0x90, 50, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00};
-    unsigned char buffer[1024];
-    
-    //write all coils from buffer to request
-    pthread_mutex_lock(&bufferLock); //lock mutex
-    for (int i = 0; i < 50; i++)
-    {
-        for (int j = 0; j < 8; j++)
-        {
-            if (bool_output[i][j] != NULL)
-            {
-                bitWrite(request[(i+13)], j, *bool_output[i][j]);
-            }
-        }
-    }
-    pthread_mutex_unlock(&bufferLock); //unlock mutex
-    
-    send(psm, request, 63, 0);
-    read(psm, buffer, 1024);
-    
-    //check if response is complete
-    if (buffer[10] != 0x01 && buffer[11] != 0x90)
-    {
-        sprintf(log_msg, "PSM: Error writing to digital outputs!\n");
-        openplc_log(log_msg);
-        error_count++;
-        check_error_count();
-    }
+    return image;
 }
 
 //-----------------------------------------------------------------------------
-// Write a special stop signal to PSM register signaling it to quit
+// Signals the PSM to quit and wakes it up if it is waiting for a scan
 //-----------------------------------------------------------------------------
-void stop_psm(int psm)
+void stop_psm()
 {
     char log_msg[1000];
-    //                          tid     pid     len   uid  fc  address value
-    unsigned char request[] = {00, 01, 00, 00, 00, 06, 00, 06, 00, 50, 00, 127};
-    unsigned char buffer[1024];
-
     sprintf(log_msg, "PSM: Stopping PSM...\n");
     openplc_log(log_msg);
-    
-    send(psm, request, 12, 0);
-    /*
-    size_t rsp_size = read(psm, buffer, 1024);
-    
-    //check response
-    if (buffer[11] != 127)
-    {
-        sprintf(log_msg, "PSM: Error while trying to stop PSM!\n");
-        openplc_log(log_msg);
-    }
-    */
+
+    psm_image->quit.store(1, std::memory_order_release);
+    psm_image->scan.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, (uint32_t *)&psm_image->scan, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
 }
 
 //-----------------------------------------------------------------------------
@@ -367,7 +173,7 @@ void kill_psm()
     char log_msg[BUFFER_LIMIT];
     sprintf(log_msg, "PSM: Killing previous PSM modules...\n");
     openplc_log(log_msg);
-    char *cmd = "ps aux | grep ./core/psm/main.py | awk '{print $2}'";
+    const char *cmd = "ps aux | grep ./core/psm/main.py | awk '{print $2}'";
     
     FILE *psm_proc;
     if ((psm_proc = popen(cmd, "r")) == NULL)
@@ -415,13 +221,24 @@ void kill_psm()
 //-----------------------------------------------------------------------------
 void initializeHardware()
 {
+    char log_msg[1000];
+
     //Verify if there is any old PSM running on the background and kill it
-    if ((psm = connect_to_psm(0)) >= 0)
+    int old_image = shm_open(PSM_SHM_NAME, O_RDWR, 0660);
+    if (old_image >= 0)
     {
         printf("PSM found..killing it!\n");
-        close(psm);
+        close(old_image);
+        shm_unlink(PSM_SHM_NAME);
         kill_psm();
-        sleepms(500);
+    }
+
+    psm_image = create_psm_image();
+    if (psm_image == NULL)
+    {
+        sprintf(log_msg, "PSM: Error creating the process image!\nPSM: PSM is disabled\n");
+        openplc_log(log_msg);
+        return;
     }
     
     //Start PSM thread
@@ -432,20 +249,6 @@ void initializeHardware()
     {
         pthread_detach(psm_thread);
     }
-    sleepms(2000);
-    
-    char log_msg[1000];
-    psm = connect_to_psm(1);
-    if (psm < 0)
-    {
-        sprintf(log_msg, "PSM: Error connecting to psm!\nPSM: PSM is disabled\n");
-        openplc_log(log_msg);
-    }
-    else
-    {
-        sprintf(log_msg, "PSM: Connected to PSM\n");
-        openplc_log(log_msg);
-    }
 }
 
 //-----------------------------------------------------------------------------
@@ -454,8 +257,12 @@ void initializeHardware()
 //-----------------------------------------------------------------------------
 void finalizeHardware()
 {
-    stop_psm(psm);
-    close(psm);
+    if (psm_image == NULL) return;
+
+    stop_psm();
+    munmap(psm_image, sizeof(PsmImage));
+    shm_unlink(PSM_SHM_NAME);
+    psm_image = NULL;
 }
 
 //-----------------------------------------------------------------------------
@@ -465,11 +272,31 @@ void finalizeHardware()
 //-----------------------------------------------------------------------------
 void updateBuffersIn()
 {
-    if (psm >= 0 && error_count < ERROR_LIMIT)
+    if (psm_image == NULL) return;
+
+    // Snapshot the inputs. The scan never waits for the PSM: if it keeps
+    // writing, the last copy is used as it is
+    uint8_t dig_in[PSM_DIGITAL_POINTS];
+    uint16_t ana_in[PSM_ANALOG_POINTS];
+    for (int retry = 0; retry < PSM_READ_RETRIES; retry++)
+    {
+        uint32_t seq = psm_image->in_sequence.load(std::memory_order_acquire);
+        memcpy(dig_in, psm_image->dig_in, sizeof(dig_in));
+        memcpy(ana_in, psm_image->ana_in, sizeof(ana_in));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (!(seq & 1) && seq == psm_image->in_sequence.load(std::memory_order_relaxed)) break;
+    }
+
+    lockBuffer();
+    for (int i = 0; i < PSM_DIGITAL_POINTS; i++)
+    {
+        if (bool_input[i/8][i%8] != NULL) *bool_input[i/8][i%8] = (dig_in[i] != 0);
+    }
+    for (int i = 0; i < PSM_ANALOG_POINTS; i++)
     {
-        read_dig_inp(psm);
-        read_ana_inp(psm);
+        if (int_input[i] != NULL) *int_input[i] = ana_in[i];
     }
+    unlockBuffer();
 }
 
 //-----------------------------------------------------------------------------
@@ -479,10 +306,26 @@ void updateBuffersIn()
 //-----------------------------------------------------------------------------
 void updateBuffersOut()
 {
-    if (psm >= 0 && error_count < ERROR_LIMIT)
+    if (psm_image == NULL) return;
+
+    uint32_t seq = psm_image->out_sequence.load(std::memory_order_relaxed);
+    psm_image->out_sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    lockBuffer();
+    for (int i = 0; i < PSM_DIGITAL_POINTS; i++)
     {
-        write_dig_out(psm);
-        write_ana_out(psm);
+        if (bool_output[i/8][i%8] != NULL) psm_image->dig_out[i] = *bool_output[i/8][i%8];
     }
-}
+    for (int i = 0; i < PSM_ANALOG_POINTS; i++)
+    {
+        if (int_output[i] != NULL) psm_image->ana_out[i] = *int_output[i];
+    }
+    unlockBuffer();
 
+    psm_image->out_sequence.store(seq + 2, std::memory_order_release);
+
+    // Scan handshake, wakes up the PSM if it is waiting for this scan
+    psm_image->scan.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, (uint32_t *)&psm_image->scan, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
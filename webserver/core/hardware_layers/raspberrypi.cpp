@@ -31,6 +31,9 @@
 #include <wiringPi.h>
 #include <wiringSerial.h>
 #include <pthread.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
 #include "ladder.h"
 
@@ -42,6 +45,12 @@
 #define MAX_OUTPUT 		11
 #define MAX_ANALOG_OUT		1
 
+//BCM283x/BCM2711 GPIO registers (32-bit word offsets on /dev/gpiomem)
+#define GPIO_MAP_SIZE       4096
+#define GPIO_GPSET0         7
+#define GPIO_GPCLR0         10
+#define GPIO_GPLEV0         13
+
 /********************I/O PINS CONFIGURATION*********************
  * A good source for RaspberryPi I/O pins information is:
  * http://pinout.xyz
@@ -61,6 +70,64 @@ int outBufferPinMask[MAX_OUTPUT] =	{ 15, 16, 4, 5, 6, 10, 11, 26, 27, 28, 29 };
 //output of the RaspberryPi
 int analogOutBufferPinMask[MAX_ANALOG_OUT] = { 1 };
 
+//Register level access to the GPIO bank. When it is mapped the digital I/O
+//is done with one level read and one set/clear write per scan, otherwise
+//it falls back to wiringPi one pin at a time
+static volatile uint32_t *gpio_regs = NULL;
+static uint8_t inBufferGpio[MAX_INPUT];
+static uint8_t outBufferGpio[MAX_OUTPUT];
+
+//-----------------------------------------------------------------------------
+// Maps the GPIO registers through /dev/gpiomem. The RP1 GPIOs of the
+// Raspberry Pi 5 have a different layout and keep using wiringPi
+//-----------------------------------------------------------------------------
+static void initializeGpioRegisters()
+{
+    char log_msg[1000];
+
+    FILE *model = fopen("/proc/device-tree/compatible", "r");
+    if (model != NULL)
+    {
+        char compatible[256];
+        size_t length = fread(compatible, 1, sizeof(compatible) - 1, model);
+        fclose(model);
+        // The file holds several NUL separated strings
+        for (size_t i = 0; i < length; i++) if (compatible[i] == '\0') compatible[i] = ' ';
+        compatible[length] = '\0';
+        if (strstr(compatible, "bcm2712") != NULL) return;
+    }
+
+    for (int i = 0; i < MAX_INPUT; i++)
+    {
+        int gpio = wpiPinToGpio(inBufferPinMask[i]);
+        if (gpio < 0 || gpio > 31) return;
+        inBufferGpio[i] = (uint8_t)gpio;
+    }
+    for (int i = 0; i < MAX_OUTPUT; i++)
+    {
+        int gpio = wpiPinToGpio(outBufferPinMask[i]);
+        if (gpio < 0 || gpio > 31) return;
+        outBufferGpio[i] = (uint8_t)gpio;
+    }
+
+    int fd = open("/dev/gpiomem", O_RDWR | O_SYNC);
+    if (fd < 0)
+    {
+        sprintf(log_msg, "Raspberry Pi: can't open /dev/gpiomem, using wiringPi for the digital I/O\n");
+        openplc_log(log_msg);
+        return;
+    }
+    void *regs = mmap(NULL, GPIO_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (regs == MAP_FAILED)
+    {
+        sprintf(log_msg, "Raspberry Pi: can't map the GPIO registers, using wiringPi for the digital I/O\n");
+        openplc_log(log_msg);
+        return;
+    }
+    gpio_regs = (volatile uint32_t *)regs;
+}
+
 //-----------------------------------------------------------------------------
 // This function is called by the main OpenPLC routine when it is initializing.
 // Hardware initialization procedures should be here.
@@ -91,6 +158,17 @@ void initializeHardware()
     {
         pinMode(analogOutBufferPinMask[i], PWM_OUTPUT);
     }
+
+    initializeGpioRegisters();
+
+    //edges of the inputs bound to event tasks. The BCM GPIO numbers are the
+    //lines of the first GPIO chip
+    int inputLines[MAX_INPUT];
+    for (int i = 0; i < MAX_INPUT; i++)
+    {
+        inputLines[i] = wpiPinToGpio(inBufferPinMask[i]);
+    }
+    startGpioEvents("/dev/gpiochip0", inputLines, MAX_INPUT);
 }
 
 //-----------------------------------------------------------------------------
@@ -99,6 +177,13 @@ void initializeHardware()
 //-----------------------------------------------------------------------------
 void finalizeHardware()
 {
+    stopGpioEvents();
+
+    if (gpio_regs != NULL)
+    {
+        munmap((void *)gpio_regs, GPIO_MAP_SIZE);
+        gpio_regs = NULL;
+    }
 }
 
 //-----------------------------------------------------------------------------
@@ -108,15 +193,26 @@ void finalizeHardware()
 //-----------------------------------------------------------------------------
 void updateBuffersIn()
 {
-    pthread_mutex_lock(&bufferLock); //lock mutex
+    lockBuffer();
 
     //INPUT
-    for (int i = 0; i < MAX_INPUT; i++)
+    if (gpio_regs != NULL)
+    {
+        uint32_t levels = gpio_regs[GPIO_GPLEV0];
+        for (int i = 0; i < MAX_INPUT; i++)
+        {
+            if (bool_input[i/8][i%8] != NULL) *bool_input[i/8][i%8] = (levels >> inBufferGpio[i]) & 0x01;
+        }
+    }
+    else
     {
-        if (bool_input[i/8][i%8] != NULL) *bool_input[i/8][i%8] = digitalRead(inBufferPinMask[i]);
+        for (int i = 0; i < MAX_INPUT; i++)
+        {
+            if (bool_input[i/8][i%8] != NULL) *bool_input[i/8][i%8] = digitalRead(inBufferPinMask[i]);
+        }
     }
 
-    pthread_mutex_unlock(&bufferLock); //unlock mutex
+    unlockBuffer();
 }
 
 //-----------------------------------------------------------------------------
@@ -126,12 +222,28 @@ void updateBuffersIn()
 //-----------------------------------------------------------------------------
 void updateBuffersOut()
 {
-    pthread_mutex_lock(&bufferLock); //lock mutex
+    lockBuffer();
 
     //OUTPUT
-    for (int i = 0; i < MAX_OUTPUT; i++)
+    if (gpio_regs != NULL)
     {
-        if (bool_output[i/8][i%8] != NULL) digitalWrite(outBufferPinMask[i], *bool_output[i/8][i%8]);
+        uint32_t set_mask = 0;
+        uint32_t clear_mask = 0;
+        for (int i = 0; i < MAX_OUTPUT; i++)
+        {
+            if (bool_output[i/8][i%8] == NULL) continue;
+            if (*bool_output[i/8][i%8]) set_mask |= 1UL << outBufferGpio[i];
+            else clear_mask |= 1UL << outBufferGpio[i];
+        }
+        if (set_mask) gpio_regs[GPIO_GPSET0] = set_mask;
+        if (clear_mask) gpio_regs[GPIO_GPCLR0] = clear_mask;
+    }
+    else
+    {
+        for (int i = 0; i < MAX_OUTPUT; i++)
+        {
+            if (bool_output[i/8][i%8] != NULL) digitalWrite(outBufferPinMask[i], *bool_output[i/8][i%8]);
+        }
     }
 
     //ANALOG OUT (PWM)
@@ -140,5 +252,5 @@ void updateBuffersOut()
         if (int_output[i] != NULL) pwmWrite(analogOutBufferPinMask[i], (*int_output[i] / 64));
     }
 
-    pthread_mutex_unlock(&bufferLock); //unlock mutex
+    unlockBuffer();
 }
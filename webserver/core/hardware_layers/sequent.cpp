@@ -34,8 +34,10 @@
 #include <string.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 #include <poll.h>
+#include <atomic>
 
 #include "ladder.h"
 
@@ -90,17 +92,70 @@ int log_error(int line)
     return ERROR;
 }
 
+//-----------------------------------------------------------------------------
+// I2C access. Card registers that are touched on every scan (input ports,
+// relay outputs) are moved to a dedicated I/O thread: the first access to a
+// register is a blocking transaction, as the card init and configuration
+// needs, and from the second access on a read returns the last value polled
+// by the I/O thread and a write is queued for it. The I/O thread keeps the
+// bus open and transfers all registers of a card on a single I2C_RDWR call,
+// so the scan thread never waits on the bus once the program is running.
+// Data is exchanged through a sequence counter on each register, so neither
+// side ever blocks on the other
+//-----------------------------------------------------------------------------
+#define I2C_MAX_REGISTERS       128
+#define I2C_MAX_MSGS            42      /* I2C_RDWR_IOCTL_MAX_MSGS */
+#define I2C_POLL_INTERVAL_US    1000
+
+#define I2C_REG_PENDING         0       /* not polled yet */
+#define I2C_REG_VALID           1
+#define I2C_REG_FAILED          2
+
+struct I2cRegister
+{
+    uint8_t addr;
+    uint8_t reg;
+    uint8_t size;
+    uint8_t accesses;                   // scan thread only
+    std::atomic<bool> polled;           // set by the scan, the I/O thread polls it
+    std::atomic<uint8_t> state;
+    std::atomic<uint32_t> sequence;     // odd while the writer updates data
+    uint8_t data[I2C_SMBUS_BLOCK_MAX];
+};
+
+struct I2cWrite
+{
+    uint8_t addr;
+    uint8_t reg;
+    uint8_t size;
+    uint8_t accesses;                   // scan thread only
+    std::atomic<uint32_t> sequence;     // odd while the scan updates data
+    std::atomic<uint32_t> requested;
+    std::atomic<uint32_t> done;
+    std::atomic<bool> failed;
+    uint8_t data[I2C_SMBUS_BLOCK_MAX];
+};
+
+static I2cRegister i2c_reads[I2C_MAX_REGISTERS];
+static I2cWrite i2c_writes[I2C_MAX_REGISTERS];
+static std::atomic<int> i2c_read_count(0);
+static std::atomic<int> i2c_write_count(0);
+
+static int i2c_file = -1;
+static int i2c_addr = 0;
+static std::atomic<bool> i2c_thread_running(false);
+static pthread_t i2c_thread;
+
 int i2cSetup(int addr)
 {
-    static int file = -1;
     char filename[32];
     char log_msg[1000];
 
-    if (file < 0)
+    if (i2c_file < 0)
     {
         sprintf(filename, "/dev/i2c-1");
 
-        if ( (file = open(filename, O_RDWR)) < 0)
+        if ( (i2c_file = open(filename, O_RDWR)) < 0)
         {
             sprintf(log_msg, "Failed to open the bus.\n");
             openplc_log(log_msg);
@@ -108,19 +163,103 @@ int i2cSetup(int addr)
             return ERROR;
         }
     }
-    if (ioctl(file, I2C_SLAVE, addr) < 0)
+    // Transfers are done with I2C_RDWR, which carries the slave address on
+    // every message, so the address is only recorded here
+    i2c_addr = addr;
+    return i2c_file;
+}
+
+//-----------------------------------------------------------------------------
+// Blocking register read as a combined transaction: the register address is
+// written and the data read back after a repeated start, so the I/O thread
+// can't steer the register pointer of the card in between
+//-----------------------------------------------------------------------------
+static int i2cTransferRead(int dev, int addr, int add, uint8_t *buff, int size)
+{
+    uint8_t reg = 0xff & add;
+    struct i2c_msg msgs[2];
+    struct i2c_rdwr_ioctl_data transfer;
+
+    msgs[0].addr = addr;
+    msgs[0].flags = 0;
+    msgs[0].len = 1;
+    msgs[0].buf = &reg;
+    msgs[1].addr = addr;
+    msgs[1].flags = I2C_M_RD;
+    msgs[1].len = size;
+    msgs[1].buf = buff;
+    transfer.msgs = msgs;
+    transfer.nmsgs = 2;
+
+    return ioctl(dev, I2C_RDWR, &transfer) == 2 ? OK : ERROR;
+}
+
+static int i2cTransferWrite(int dev, int addr, int add, uint8_t *buff, int size)
+{
+    uint8_t intBuff[I2C_SMBUS_BLOCK_MAX];
+    struct i2c_msg msg;
+    struct i2c_rdwr_ioctl_data transfer;
+
+    intBuff[0] = 0xff & add;
+    memcpy(&intBuff[1], buff, size);
+    msg.addr = addr;
+    msg.flags = 0;
+    msg.len = size + 1;
+    msg.buf = intBuff;
+    transfer.msgs = &msg;
+    transfer.nmsgs = 1;
+
+    return ioctl(dev, I2C_RDWR, &transfer) == 1 ? OK : ERROR;
+}
+
+static I2cRegister *findReadRegister(int addr, int add, int size)
+{
+    int count = i2c_read_count.load(std::memory_order_relaxed);
+    for (int i = 0; i < count; i++)
     {
-        sprintf(log_msg, "Failed to acquire bus access and/or talk to slave.\n");
-        openplc_log(log_msg);
-        return ERROR;
+        I2cRegister *r = &i2c_reads[i];
+        if (r->addr == addr && r->reg == add && r->size == size) return r;
     }
-    return file;
+    if (count == I2C_MAX_REGISTERS) return NULL;
+
+    I2cRegister *r = &i2c_reads[count];
+    r->addr = addr;
+    r->reg = add;
+    r->size = size;
+    r->accesses = 0;
+    r->polled.store(false, std::memory_order_relaxed);
+    r->state.store(I2C_REG_PENDING, std::memory_order_relaxed);
+    r->sequence.store(0, std::memory_order_relaxed);
+    i2c_read_count.store(count + 1, std::memory_order_release);
+    return r;
+}
+
+static I2cWrite *findWriteRegister(int addr, int add, int size)
+{
+    int count = i2c_write_count.load(std::memory_order_relaxed);
+    for (int i = 0; i < count; i++)
+    {
+        I2cWrite *w = &i2c_writes[i];
+        if (w->addr == addr && w->reg == add && w->size == size) return w;
+    }
+    if (count == I2C_MAX_REGISTERS) return NULL;
+
+    I2cWrite *w = &i2c_writes[count];
+    w->addr = addr;
+    w->reg = add;
+    w->size = size;
+    w->accesses = 0;
+    w->sequence.store(0, std::memory_order_relaxed);
+    w->requested.store(0, std::memory_order_relaxed);
+    w->done.store(0, std::memory_order_relaxed);
+    w->failed.store(false, std::memory_order_relaxed);
+    i2c_write_count.store(count + 1, std::memory_order_release);
+    return w;
 }
 
 int i2cMemRead(int dev, int add, uint8_t *buff, int size)
 {
-    uint8_t intBuff[I2C_SMBUS_BLOCK_MAX];
-    unsigned char log_msg[1000];
+    char log_msg[1000];
 
     if (NULL == buff)
     {
@@ -132,20 +271,40 @@ int i2cMemRead(int dev, int add, uint8_t *buff, int size)
         return ERROR;
     }
 
-    intBuff[0] = 0xff & add;
+    I2cRegister *r = NULL;
+    if (i2c_thread_running.load(std::memory_order_relaxed))
+    {
+        r = findReadRegister(i2c_addr, add, size);
+    }
 
-    if (write(dev, intBuff, 1) != 1)
+    if (r != NULL && r->polled.load(std::memory_order_relaxed))
     {
-#ifdef I2C_DEBUG
-        sprintf(log_msg, "Fail to select 0x%02hhx mem add!\n", add);
-        openplc_log(log_msg);
-#endif
-        return ERROR;
+        uint8_t state = r->state.load(std::memory_order_acquire);
+        if (state == I2C_REG_FAILED)
+        {
+            return ERROR;
+        }
+        if (state == I2C_REG_VALID)
+        {
+            uint32_t seq;
+            do
+            {
+                seq = r->sequence.load(std::memory_order_acquire);
+                memcpy(buff, r->data, size);
+                std::atomic_thread_fence(std::memory_order_acquire);
+            } while ((seq & 1) || seq != r->sequence.load(std::memory_order_relaxed));
+            return OK;
+        }
     }
-    if (read(dev, buff, size) != size)
+    else if (r != NULL && ++r->accesses > 1)
+    {
+        r->polled.store(true, std::memory_order_release);
+    }
+
+    if (i2cTransferRead(dev, i2c_addr, add, buff, size) != OK)
     {
 #ifdef I2C_DEBUG
-        sprintf(log_msg, "Fail to read memory!\n");
+        sprintf(log_msg, "Fail to read memory at 0x%02hhx address!\n", add);
         openplc_log(log_msg);
 #endif
         return ERROR;
@@ -155,7 +314,6 @@ int i2cMemRead(int dev, int add, uint8_t *buff, int size)
 
 int i2cMemWrite(int dev, int add, uint8_t *buff, int size)
 {
-    uint8_t intBuff[I2C_SMBUS_BLOCK_MAX];
     char log_msg[1000];
 
     if (NULL == buff)
@@ -168,10 +326,35 @@ int i2cMemWrite(int dev, int add, uint8_t *buff, int size)
         return ERROR;
     }
 
-    intBuff[0] = 0xff & add;
-    memcpy(&intBuff[1], buff, size);
+    I2cWrite *w = NULL;
+    if (i2c_thread_running.load(std::memory_order_relaxed))
+    {
+        w = findWriteRegister(i2c_addr, add, size);
+    }
 
-    if (write(dev, intBuff, size + 1) != size + 1)
+    if (w != NULL && w->accesses > 0)
+    {
+        // Report a failed transfer of a previous value once
+        if (w->failed.exchange(false, std::memory_order_relaxed))
+        {
+            sprintf(log_msg, "Fail to write memory at 0x%02hhx address!\n", add);
+            openplc_log(log_msg);
+            return ERROR;
+        }
+        uint32_t seq = w->sequence.load(std::memory_order_relaxed);
+        w->sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(w->data, buff, size);
+        w->sequence.store(seq + 2, std::memory_order_release);
+        w->requested.fetch_add(1, std::memory_order_release);
+        return OK;
+    }
+    if (w != NULL)
+    {
+        w->accesses = 1;
+    }
+
+    if (i2cTransferWrite(dev, i2c_addr, add, buff, size) != OK)
     {
         sprintf(log_msg, "Fail to write memory at 0x%02hhx address!\n", add);
         openplc_log(log_msg);
@@ -180,6 +363,139 @@ int i2cMemWrite(int dev, int add, uint8_t *buff, int size)
     return OK;
 }
 
+//-----------------------------------------------------------------------------
+// Transfers the queued writes and the polled reads of one card with a single
+// I2C_RDWR call (split if the card has more registers than the adapter takes
+// at once). A card that doesn't answer only fails its own registers
+//-----------------------------------------------------------------------------
+static void transferCard(int addr, int read_count, int write_count)
+{
+    struct i2c_msg msgs[I2C_MAX_MSGS];
+    struct i2c_rdwr_ioctl_data transfer;
+    uint8_t write_buffers[I2C_MAX_MSGS][I2C_SMBUS_BLOCK_MAX];
+    uint8_t read_buffers[I2C_MAX_MSGS / 2][I2C_SMBUS_BLOCK_MAX];
+    uint8_t reg_addresses[I2C_MAX_MSGS / 2];
+    I2cWrite *writes[I2C_MAX_MSGS];
+    uint32_t requested[I2C_MAX_MSGS];
+    I2cRegister *reads[I2C_MAX_MSGS / 2];
+    int w = 0, r = 0;
+
+    while (w < write_count || r < read_count)
+    {
+        int nmsgs = 0, nwrites = 0, nreads = 0;
+
+        for (; w < write_count && nmsgs < I2C_MAX_MSGS; w++)
+        {
+            I2cWrite *entry = &i2c_writes[w];
+            if (entry->addr != addr) continue;
+            uint32_t req = entry->requested.load(std::memory_order_acquire);
+            if (req == entry->done.load(std::memory_order_relaxed)) continue;
+
+            uint8_t *buffer = write_buffers[nwrites];
+            uint32_t seq;
+            do
+            {
+                seq = entry->sequence.load(std::memory_order_acquire);
+                memcpy(&buffer[1], entry->data, entry->size);
+                std::atomic_thread_fence(std::memory_order_acquire);
+            } while ((seq & 1) || seq != entry->sequence.load(std::memory_order_relaxed));
+            buffer[0] = entry->reg;
+
+            msgs[nmsgs].addr = addr;
+            msgs[nmsgs].flags = 0;
+            msgs[nmsgs].len = entry->size + 1;
+            msgs[nmsgs].buf = buffer;
+            writes[nwrites] = entry;
+            requested[nwrites] = req;
+            nwrites++;
+            nmsgs++;
+        }
+
+        for (; r < read_count && nmsgs + 2 <= I2C_MAX_MSGS; r++)
+        {
+            I2cRegister *entry = &i2c_reads[r];
+            if (entry->addr != addr || !entry->polled.load(std::memory_order_acquire)) continue;
+
+            reg_addresses[nreads] = entry->reg;
+            msgs[nmsgs].addr = addr;
+            msgs[nmsgs].flags = 0;
+            msgs[nmsgs].len = 1;
+            msgs[nmsgs].buf = &reg_addresses[nreads];
+            msgs[nmsgs + 1].addr = addr;
+            msgs[nmsgs + 1].flags = I2C_M_RD;
+            msgs[nmsgs + 1].len = entry->size;
+            msgs[nmsgs + 1].buf = read_buffers[nreads];
+            reads[nreads] = entry;
+            nreads++;
+            nmsgs += 2;
+        }
+
+        if (nmsgs == 0) break;
+
+        transfer.msgs = msgs;
+        transfer.nmsgs = nmsgs;
+        bool ok = (ioctl(i2c_file, I2C_RDWR, &transfer) == nmsgs);
+
+        for (int i = 0; i < nwrites; i++)
+        {
+            writes[i]->done.store(requested[i], std::memory_order_relaxed);
+            if (!ok) writes[i]->failed.store(true, std::memory_order_relaxed);
+        }
+        for (int i = 0; i < nreads; i++)
+        {
+            I2cRegister *entry = reads[i];
+            if (ok)
+            {
+                uint32_t seq = entry->sequence.load(std::memory_order_relaxed);
+                entry->sequence.store(seq + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                memcpy(entry->data, read_buffers[i], entry->size);
+                entry->sequence.store(seq + 2, std::memory_order_release);
+            }
+            entry->state.store(ok ? I2C_REG_VALID : I2C_REG_FAILED, std::memory_order_release);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// I/O thread. Flushes the queued writes and polls the registers of every card
+// found on the stack, one card per transfer
+//-----------------------------------------------------------------------------
+static void *i2cIoThread(void *arg)
+{
+    setThreadClass(THREAD_CLASS_IO, "sequent_io");
+
+    while (i2c_thread_running.load(std::memory_order_relaxed))
+    {
+        int read_count = i2c_read_count.load(std::memory_order_acquire);
+        int write_count = i2c_write_count.load(std::memory_order_acquire);
+        bool done[256] = {false};
+
+        for (int i = 0; i < write_count; i++)
+        {
+            int addr = i2c_writes[i].addr;
+            if (!done[addr])
+            {
+                done[addr] = true;
+                transferCard(addr, read_count, write_count);
+            }
+        }
+        for (int i = 0; i < read_count; i++)
+        {
+            int addr = i2c_reads[i].addr;
+            if (!done[addr])
+            {
+                done[addr] = true;
+                transferCard(addr, read_count, write_count);
+            }
+        }
+
+        usleep(I2C_POLL_INTERVAL_US);
+    }
+
+    return NULL;
+}
+
 //------------------------------------------------------------------------------
 // Eight Relays 8-Layer Stackable HAT for Raspberry Pi
 //------------------------------------------------------------------------------
@@ -1666,6 +1982,16 @@ int mosfets8Set(uint8_t stack, uint8_t val)
 //-----------------------------------------------------------------------------
 void initializeHardware()
 {
+    char log_msg[1000];
+
+    i2c_thread_running.store(true);
+    if (pthread_create(&i2c_thread, NULL, i2cIoThread, NULL) != 0)
+    {
+        // Without the I/O thread every access stays a blocking transfer
+        i2c_thread_running.store(false);
+        sprintf(log_msg, "Failed to start the I2C I/O thread\n");
+        openplc_log(log_msg);
+    }
 }
 
 //-----------------------------------------------------------------------------
@@ -1674,6 +2000,10 @@ void initializeHardware()
 //-----------------------------------------------------------------------------
 void finalizeHardware()
 {
+    if (i2c_thread_running.exchange(false))
+    {
+        pthread_join(i2c_thread, NULL);
+    }
 }
 
 //-----------------------------------------------------------------------------
@@ -1683,7 +2013,7 @@ void finalizeHardware()
 //-----------------------------------------------------------------------------
 void updateBuffersIn()
 {
-    pthread_mutex_lock(&bufferLock); //lock mutex
+    lockBuffer();
 
     /*********READING AND WRITING TO I/O**************
     *bool_input[0][0] = read_digital_input(0);
@@ -1692,7 +2022,7 @@ void updateBuffersIn()
     write_analog_output(0, *int_output[0]);
     **************************************************/
 
-    pthread_mutex_unlock(&bufferLock); //unlock mutex
+    unlockBuffer();
 }
 
 //-----------------------------------------------------------------------------
@@ -1702,7 +2032,7 @@ void updateBuffersIn()
 //-----------------------------------------------------------------------------
 void updateBuffersOut()
 {
-    pthread_mutex_lock(&bufferLock); //lock mutex
+    lockBuffer();
 
     /*********READING AND WRITING TO I/O**************
     *bool_input[0][0] = read_digital_input(0);
@@ -1711,5 +2041,5 @@ void updateBuffersOut()
     write_analog_output(0, *int_output[0]);
     **************************************************/
 
-    pthread_mutex_unlock(&bufferLock); //unlock mutex
+    unlockBuffer();
 }
@@ -55,6 +55,51 @@ struct plcData
     bool digitalOut[DIGITAL_BUF_SIZE];
 };
 
+//-----------------------------------------------------------------------------
+// Lockstep co-simulation. Instead of the fixed plcData struct the simulation
+// sends one step frame per simulation step: the header below followed by
+// analog_count analog inputs (uint16_t) and digital_count digital inputs (one
+// byte each). Every step frame runs exactly one scan, and the runtime replies
+// with the same header and the outputs at the same positions. While steps
+// keep coming the scan doesn't wait for its tick, so the simulation sets the
+// pace and can run faster than real time. If the simulation stops sending,
+// the runtime goes back to free running after LOCKSTEP_TIMEOUT_MS
+//-----------------------------------------------------------------------------
+#define STEP_FRAME_MAGIC        0x5353504f  /* "OPSS" */
+#define STEP_MAX_ANALOG         BUFFER_SIZE
+#define STEP_MAX_DIGITAL        (BUFFER_SIZE * 8)
+#define STEP_MAX_FRAME          (sizeof(struct stepHeader) + STEP_MAX_ANALOG * 2 + STEP_MAX_DIGITAL)
+#define LOCKSTEP_TIMEOUT_MS     1000
+
+struct stepHeader
+{
+    uint32_t magic;
+    uint32_t sequence;
+    uint16_t analog_count;
+    uint16_t digital_count;
+    uint32_t reserved;
+};
+
+// Step frame handed from the network thread to the scan
+static pthread_mutex_t stepLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stepReady = PTHREAD_COND_INITIALIZER;
+static uint8_t step_mailbox[STEP_MAX_FRAME];
+static bool step_pending = false;
+static struct sockaddr_in step_client;
+
+// Last reply, resent if the simulation repeats a step it got no reply for
+static uint8_t step_reply[STEP_MAX_FRAME];
+static size_t step_reply_size = 0;
+static uint32_t step_reply_sequence = 0;
+static bool step_active = false;     // a scan is running step_active_sequence
+static uint32_t step_active_sequence = 0;
+
+// Scan thread only
+static uint8_t step_frame[STEP_MAX_FRAME];
+static bool step_running = false;
+static bool lockstep = false;
+static int sim_socket = -1;
+
 //-----------------------------------------------------------------------------
 // Helper function - Makes the running thread sleep for the ammount of time
 // in milliseconds
@@ -104,31 +149,84 @@ int createUDPSocket(int port)
 }
 
 
+//-----------------------------------------------------------------------------
+// Returns the size of a valid step frame, or 0 if the datagram isn't one
+//-----------------------------------------------------------------------------
+static size_t stepFrameSize(const uint8_t *frame, int len)
+{
+    struct stepHeader header;
+    if (len < (int)sizeof(header)) return 0;
+    memcpy(&header, frame, sizeof(header));
+    if (header.magic != STEP_FRAME_MAGIC) return 0;
+    if (header.analog_count > STEP_MAX_ANALOG || header.digital_count > STEP_MAX_DIGITAL) return 0;
+
+    size_t size = sizeof(header) + header.analog_count * 2 + header.digital_count;
+    return (size_t)len == size ? size : 0;
+}
+
+//-----------------------------------------------------------------------------
+// Hands a step frame to the scan. A repeated step (the simulation lost the
+// reply) is answered with the last reply instead of running another scan
+//-----------------------------------------------------------------------------
+static void postStepFrame(int socket_fd, const uint8_t *frame, size_t size, struct sockaddr_in *client, socklen_t cli_len)
+{
+    struct stepHeader header;
+    memcpy(&header, frame, sizeof(header));
+
+    pthread_mutex_lock(&stepLock);
+    if (step_active && header.sequence == step_active_sequence)
+    {
+        // Being scanned, the reply is on its way
+    }
+    else if (step_reply_size > 0 && header.sequence == step_reply_sequence)
+    {
+        sendto(socket_fd, step_reply, step_reply_size, 0, (struct sockaddr *)client, cli_len);
+    }
+    else
+    {
+        memcpy(step_mailbox, frame, size);
+        step_client = *client;
+        step_pending = true;
+        pthread_cond_signal(&stepReady);
+    }
+    pthread_mutex_unlock(&stepLock);
+}
+
 //-----------------------------------------------------------------------------
 // Thread to send and receive data using UDP
 //-----------------------------------------------------------------------------
 void *exchangeData(void *arg)
 {
-    int socket_fd = createUDPSocket(PORT);
+    setThreadClass(THREAD_CLASS_IO, "simulink_io");
+
+    int socket_fd = sim_socket;
     int net_len;
     socklen_t cli_len;
     struct sockaddr_in client;
     struct plcData *plc_data = (struct plcData *)malloc(sizeof(struct plcData));
-
-    cli_len = sizeof(client);
+    uint8_t *frame = (uint8_t *)malloc(STEP_MAX_FRAME);
 
     while(1)
     {
         //printf("waiting for data...\n");
-        net_len = recvfrom(socket_fd, plc_data, sizeof(*plc_data), 0, (struct sockaddr *) &client, &cli_len);
+        cli_len = sizeof(client);
+        net_len = recvfrom(socket_fd, frame, STEP_MAX_FRAME, 0, (struct sockaddr *) &client, &cli_len);
         //printf("data received!\n");
         if (net_len < 0)
         {
             printf("Error receiving data on socket %d\n", socket_fd);
+            continue;
         }
-        else
+
+        size_t step_size = stepFrameSize(frame, net_len);
+        if (step_size > 0)
+        {
+            postStepFrame(socket_fd, frame, step_size, &client, cli_len);
+        }
+        else if (net_len == sizeof(*plc_data))
         {
-            pthread_mutex_lock(&bufferLock); //lock mutex
+            memcpy(plc_data, frame, sizeof(*plc_data));
+            lockBuffer();
             for (int i = 0; i < ANALOG_BUF_SIZE; i++)
             {
                 if (pinNotPresent(ignored_int_inputs, ARRAY_SIZE(ignored_int_inputs), i))
@@ -145,7 +243,7 @@ void *exchangeData(void *arg)
                 if (pinNotPresent(ignored_bool_outputs, ARRAY_SIZE(ignored_bool_outputs), i))
                     if (bool_output[i/8][i%8] != NULL) plc_data->digitalOut[i] = *bool_output[i/8][i%8];
             }
-            pthread_mutex_unlock(&bufferLock); //unlock mutex
+            unlockBuffer();
 
             //printf("sending data...\n");
             net_len = sendto(socket_fd, plc_data, sizeof(*plc_data), 0, (struct sockaddr *) &client, cli_len);
@@ -157,12 +255,61 @@ void *exchangeData(void *arg)
     }
 }
 
+//-----------------------------------------------------------------------------
+// Takes the next step frame. In lockstep the scan waits for it; otherwise it
+// only picks a frame that is already there. Returns true if a step was taken
+//-----------------------------------------------------------------------------
+static bool takeStepFrame()
+{
+    char log_msg[1000];
+    bool taken = false;
+
+    pthread_mutex_lock(&stepLock);
+    if (!step_pending && lockstep)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += LOCKSTEP_TIMEOUT_MS / 1000;
+        deadline.tv_nsec += (LOCKSTEP_TIMEOUT_MS % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_nsec -= 1000000000;
+            deadline.tv_sec++;
+        }
+        while (!step_pending)
+        {
+            if (pthread_cond_timedwait(&stepReady, &stepLock, &deadline) == ETIMEDOUT) break;
+        }
+    }
+    if (step_pending)
+    {
+        struct stepHeader header;
+        memcpy(&header, step_mailbox, sizeof(header));
+        memcpy(step_frame, step_mailbox, sizeof(header) + header.analog_count * 2 + header.digital_count);
+        step_pending = false;
+        step_active = true;
+        step_active_sequence = header.sequence;
+        taken = true;
+    }
+    pthread_mutex_unlock(&stepLock);
+
+    if (taken != lockstep)
+    {
+        lockstep = taken;
+        scan_paced_by_hardware = taken;
+        sprintf(log_msg, taken ? "Simulink: lockstep simulation started\n" : "Simulink: no simulation steps, back to free running\n");
+        openplc_log(log_msg);
+    }
+    return taken;
+}
+
 //-----------------------------------------------------------------------------
 // This function is called by the main OpenPLC routine when it is initializing.
 // Hardware initialization procedures should be here.
 //-----------------------------------------------------------------------------
 void initializeHardware()
 {
+    sim_socket = createUDPSocket(PORT);
     pthread_t thread;
     pthread_create(&thread, NULL, exchangeData, NULL);
 }
@@ -182,9 +329,31 @@ void finalizeHardware()
 //-----------------------------------------------------------------------------
 void updateBuffersIn()
 {
-    // This function here is blank because the thread that connects to the
-    // Interface program is already filling the OpenPLC buffers with the
-    // data that is being received.
+    // In free running mode the thread that connects to the Interface program
+    // is already filling the OpenPLC buffers with the data that is being
+    // received. In lockstep the inputs of the step are applied here
+    step_running = takeStepFrame();
+    if (!step_running) return;
+
+    struct stepHeader header;
+    memcpy(&header, step_frame, sizeof(header));
+    const uint8_t *analog = step_frame + sizeof(header);
+    const uint8_t *digital = analog + header.analog_count * 2;
+
+    lockBuffer();
+    for (int i = 0; i < header.analog_count; i++)
+    {
+        uint16_t value;
+        memcpy(&value, analog + i * 2, sizeof(value));
+        if (pinNotPresent(ignored_int_inputs, ARRAY_SIZE(ignored_int_inputs), i))
+            if (int_input[i] != NULL) *int_input[i] = value;
+    }
+    for (int i = 0; i < header.digital_count; i++)
+    {
+        if (pinNotPresent(ignored_bool_inputs, ARRAY_SIZE(ignored_bool_inputs), i))
+            if (bool_input[i/8][i%8] != NULL) *bool_input[i/8][i%8] = (digital[i] != 0);
+    }
+    unlockBuffer();
 }
 
 //-----------------------------------------------------------------------------
@@ -194,7 +363,43 @@ void updateBuffersIn()
 //-----------------------------------------------------------------------------
 void updateBuffersOut()
 {
-    // This function here is blank because the thread that connects to the
-    // Interface program is already filling the OpenPLC buffers with the
-    // data that is being received.
+    // Only the lockstep reply is sent from here, see updateBuffersIn()
+    if (!step_running) return;
+    step_running = false;
+
+    struct stepHeader header;
+    memcpy(&header, step_frame, sizeof(header));
+    uint8_t *analog = step_frame + sizeof(header);
+    uint8_t *digital = analog + header.analog_count * 2;
+
+    // The reply is built over the step frame, on the same positions
+    lockBuffer();
+    for (int i = 0; i < header.analog_count; i++)
+    {
+        uint16_t value = 0;
+        if (pinNotPresent(ignored_int_outputs, ARRAY_SIZE(ignored_int_outputs), i))
+            if (int_output[i] != NULL) value = *int_output[i];
+        memcpy(analog + i * 2, &value, sizeof(value));
+    }
+    for (int i = 0; i < header.digital_count; i++)
+    {
+        digital[i] = 0;
+        if (pinNotPresent(ignored_bool_outputs, ARRAY_SIZE(ignored_bool_outputs), i))
+            if (bool_output[i/8][i%8] != NULL) digital[i] = *bool_output[i/8][i%8];
+    }
+    unlockBuffer();
+
+    size_t size = sizeof(header) + header.analog_count * 2 + header.digital_count;
+    pthread_mutex_lock(&stepLock);
+    memcpy(step_reply, step_frame, size);
+    step_reply_size = size;
+    step_reply_sequence = header.sequence;
+    step_active = false;
+    struct sockaddr_in client = step_client;
+    pthread_mutex_unlock(&stepLock);
+
+    if (sendto(sim_socket, step_reply, size, 0, (struct sockaddr *)&client, sizeof(client)) < 0)
+    {
+        printf("Error sending data on socket %d\n", sim_socket);
+    }
 }
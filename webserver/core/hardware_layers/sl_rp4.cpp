@@ -143,7 +143,7 @@ void finalizeHardware()
 //-----------------------------------------------------------------------------
 void updateBuffersIn()
 {
-        pthread_mutex_lock(&bufferLock); //lock mutex
+        lockBuffer();
 
         /*********READING AND WRITING TO I/O**************
 
@@ -155,7 +155,7 @@ void updateBuffersIn()
 
         **************************************************/
 
-        pthread_mutex_unlock(&bufferLock); //unlock mutex
+        unlockBuffer();
 }
 
 //-----------------------------------------------------------------------------
@@ -165,7 +165,7 @@ void updateBuffersIn()
 //-----------------------------------------------------------------------------
 void updateBuffersOut()
 {
-        pthread_mutex_lock(&bufferLock); //lock mutex
+        lockBuffer();
 
         /*********READING AND WRITING TO I/O**************
 
@@ -177,5 +177,5 @@ void updateBuffersOut()
 
         **************************************************/
 
-        pthread_mutex_unlock(&bufferLock); //unlock mutex
+        unlockBuffer();
 }
@@ -65,6 +65,8 @@ void sleep_ms(int milliseconds)
 
 void *readAdcThread(void *args)
 {
+    setThreadClass(THREAD_CLASS_IO, "unipi_adc");
+
     while(1)
     {
         unsigned char config;
@@ -202,7 +204,7 @@ void finalizeHardware()
 void updateBuffersIn()
 {
     //printf("Digital Inputs:\n");
-    pthread_mutex_lock(&bufferLock); //lock mutex
+    lockBuffer();
     for (int i = 0; i < MAX_INPUT; i++)
     {
         if (bool_input[i/8][i%8] != NULL) *bool_input[i/8][i%8] = !digitalRead(inputPinMask[i]); //printf("[IO%d]: %d | ", i, !digitalRead(inputPinMask[i]));
@@ -215,7 +217,7 @@ void updateBuffersIn()
     }
     //printf("\n");
 
-    pthread_mutex_unlock(&bufferLock); //unlock mutex
+    unlockBuffer();
 }
 
 //-----------------------------------------------------------------------------
@@ -225,7 +227,7 @@ void updateBuffersIn()
 //-----------------------------------------------------------------------------
 void updateBuffersOut()
 {
-    pthread_mutex_lock(&bufferLock); //lock mutex
+    lockBuffer();
 
     //printf("\nDigital Outputs:\n");
     for (int i = 0; i < MAX_OUTPUT; i++)
@@ -235,5 +237,5 @@ void updateBuffersOut()
     
     if(int_output[0] != NULL) pwmWrite(ANALOG_OUT_PIN, (*int_output[0] / 64));
     
-    pthread_mutex_unlock(&bufferLock); //unlock mutex
+    unlockBuffer();
 }
@@ -0,0 +1,1046 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the historian. The tags configured on historian.cfg
+// are sampled from the published process image on every scan, compressed
+// with a deadband or the swinging door algorithm and appended to segment
+// files on disk.
+//
+// A segment is a memory mapped file with a small header followed by fixed
+// size records in time order, so a time range is found with a binary search.
+// Segments are named after their first record and the oldest ones are
+// deleted once there are more than max_segments. The record count on the
+// header is published after the record is written, so queries read the
+// active segment while it is being appended without any lock.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+
+#include "ladder.h"
+
+#define HISTORIAN_CONFIG_FILE       "historian.cfg"
+#define HISTORIAN_MAX_TAGS          256
+#define HISTORIAN_MAX_SEGMENTS      1024
+#define HISTORIAN_WAIT_TIMEOUT      1000
+#define HISTORIAN_MAGIC             "OPLCHST1"
+#define HISTORIAN_VERSION           1
+
+#define COMPRESSION_NONE            0
+#define COMPRESSION_DEADBAND        1
+#define COMPRESSION_SWINGING_DOOR   2
+
+#define TAG_UNSIGNED                0
+#define TAG_SIGNED                  1
+#define TAG_REAL                    2
+
+// Flags of a record
+#define RECORD_FIRST                0x01    // first point after the historian started
+
+struct HistorianRecord
+{
+    int64_t time;       // UTC, in ms
+    uint32_t tag;       // hash of the tag name
+    uint32_t flags;
+    double value;
+};
+
+struct SegmentHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    std::atomic<uint32_t> count;
+    uint32_t capacity;
+    int64_t first_time;
+    int64_t last_time;
+    uint8_t reserved[24];
+};
+
+static_assert(sizeof(HistorianRecord) == 24, "historian records are stored as is");
+static_assert(sizeof(SegmentHeader) == 64, "historian headers are stored as is");
+
+struct HistorianSegment
+{
+    char path[512];
+    int64_t first_time;
+    SegmentHeader *header;
+    size_t mapped_size;
+};
+
+struct HistorianTag
+{
+    char name[64];
+    uint32_t id;
+    size_t source;      // offset on ProcessImageSnapshot
+    uint8_t size;
+    int type;
+    int compression;
+    double deadband;
+    int64_t max_interval;
+
+    // Compression state
+    bool started;
+    bool has_pending;
+    int64_t archived_time;
+    double archived_value;
+    int64_t pending_time;       // last point received, not archived yet
+    double pending_value;
+    double slope_upper;
+    double slope_lower;
+};
+
+struct HistorianConfig
+{
+    char directory[256];
+    size_t segment_size;
+    int max_segments;
+    int sync_interval_ms;
+};
+
+static HistorianConfig config;
+static HistorianTag tags[HISTORIAN_MAX_TAGS];
+static int tag_count = 0;
+
+// Segments in time order. The last one is the active segment while the
+// historian runs. The list is only changed with segments_lock held, and
+// allocated when the historian first starts
+static HistorianSegment *segments = NULL;
+static int segment_count = 0;
+static HistorianSegment *active_segment = NULL;
+static pthread_mutex_t segments_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t synced_count = 0;
+static bool segment_failed = false;     // no new segment until the next sync
+static int64_t last_record_time = 0;
+
+static pthread_t historian_thread;
+static volatile bool historian_running = false;
+static uint64_t records_written = 0;
+static uint64_t scans_skipped = 0;
+
+//-----------------------------------------------------------------------------
+// Id of a tag on the records. It is a hash of its name, so the records of a
+// tag are still found after tags are added or removed from historian.cfg
+//-----------------------------------------------------------------------------
+static uint32_t tagId(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    while (*name)
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+//-----------------------------------------------------------------------------
+// Parses the location of a tag ([%]IX0.0, QW3, MD10, ...), or the name of a
+// tag of the tag database, into its offset on the snapshot and its size.
+// Returns false if it isn't on the process image
+//-----------------------------------------------------------------------------
+static bool parseLocation(const char *text, HistorianTag *tag)
+{
+    char area, width;
+    uint32_t position;
+    if (!parseTagLocation(text, &area, &width, &position))
+    {
+        const Tag *named = findTag(text);
+        if (named == NULL) return false;
+        area = named->area;
+        width = named->size;
+        position = named->position;
+    }
+
+    int32_t offset = tagImageOffset(area, width, position);
+    if (offset < 0) return false;
+
+    switch (width)
+    {
+        case 'X': tag->size = 1; break;
+        case 'W': tag->size = 2; break;
+        case 'D': tag->size = 4; break;
+        default: tag->size = 8; break;
+    }
+    tag->source = (size_t)offset;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Applies one "key = value" line of a [tag] section
+//-----------------------------------------------------------------------------
+static void applyTagSetting(HistorianTag *tag, char *key, char *value)
+{
+    char log_msg[1000];
+
+    if (strcmp(key, "name") == 0)
+    {
+        strncpy(tag->name, value, sizeof(tag->name) - 1);
+        tag->id = tagId(tag->name);
+    }
+    else if (strcmp(key, "location") == 0)
+    {
+        if (!parseLocation(value, tag))
+        {
+            sprintf(log_msg, "Historian: invalid location '%s'\n", value);
+            openplc_log(log_msg);
+            tag->size = 0;
+        }
+    }
+    else if (strcmp(key, "type") == 0)
+    {
+        if (strcmp(value, "signed") == 0) tag->type = TAG_SIGNED;
+        else if (strcmp(value, "real") == 0) tag->type = TAG_REAL;
+        else tag->type = TAG_UNSIGNED;
+    }
+    else if (strcmp(key, "compression") == 0)
+    {
+        if (strcmp(value, "none") == 0) tag->compression = COMPRESSION_NONE;
+        else if (strcmp(value, "swinging_door") == 0) tag->compression = COMPRESSION_SWINGING_DOOR;
+        else tag->compression = COMPRESSION_DEADBAND;
+    }
+    else if (strcmp(key, "deadband") == 0) tag->deadband = fabs(atof(value));
+    else if (strcmp(key, "max_interval") == 0) tag->max_interval = atoll(value);
+}
+
+//-----------------------------------------------------------------------------
+// Checks a [tag] section once it is complete. Returns false if it has to be
+// dropped
+//-----------------------------------------------------------------------------
+static bool validateTag(HistorianTag *tag)
+{
+    char log_msg[1000];
+
+    if (tag->name[0] == '\0' || tag->size == 0)
+    {
+        openplc_log((char *)"Historian: tag without a name or a valid location ignored\n");
+        return false;
+    }
+    for (HistorianTag *other = tags; other < tag; other++)
+    {
+        if (other->id == tag->id)
+        {
+            sprintf(log_msg, "Historian: tag '%s' is declared twice or clashes with '%s', ignored\n", tag->name, other->name);
+            openplc_log(log_msg);
+            return false;
+        }
+    }
+    if (tag->type == TAG_REAL && tag->size < 4) tag->type = TAG_UNSIGNED;
+    if (tag->compression == COMPRESSION_NONE) tag->deadband = 0;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Applies one line of historian.cfg. Each [tag] header starts a new tag, and
+// the settings before the first one are global. The context points to the
+// tag being filled
+//-----------------------------------------------------------------------------
+static void applyHistorianLine(const char *section, char *key, char *value, void *context)
+{
+    HistorianTag **tag = (HistorianTag **)context;
+    if (key == NULL)
+    {
+        if (strcmp(section, "tag") != 0) return;
+        if (*tag != NULL && validateTag(*tag)) tag_count++;
+        *tag = NULL;
+        if (tag_count == HISTORIAN_MAX_TAGS)
+        {
+            openplc_log((char *)"Historian: too many tags, the rest are ignored\n");
+            return;
+        }
+        *tag = &tags[tag_count];
+        memset(*tag, 0, sizeof(**tag));
+        (*tag)->compression = COMPRESSION_DEADBAND;
+        return;
+    }
+
+    if (*tag != NULL)
+    {
+        applyTagSetting(*tag, key, value);
+    }
+    else if (tag_count == 0)
+    {
+        if (strcmp(key, "directory") == 0) strncpy(config.directory, value, sizeof(config.directory) - 1);
+        else if (strcmp(key, "segment_size") == 0) config.segment_size = (size_t)atol(value) * 1024;
+        else if (strcmp(key, "max_segments") == 0) config.max_segments = atoi(value);
+        else if (strcmp(key, "sync_interval") == 0) config.sync_interval_ms = atoi(value) * 1000;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Reads historian.cfg. Returns false if the file is missing or declares no
+// tag, in which case the historian doesn't run
+//-----------------------------------------------------------------------------
+static bool loadHistorianConfig()
+{
+    strcpy(config.directory, "historian");
+    config.segment_size = 4096 * 1024;
+    config.max_segments = 16;
+    config.sync_interval_ms = 10000;
+    tag_count = 0;
+
+    HistorianTag *tag = NULL;
+    if (!parseSettingsFile(HISTORIAN_CONFIG_FILE, applyHistorianLine, &tag)) return false;
+    if (tag != NULL && validateTag(tag)) tag_count++;
+
+    if (config.segment_size < 64 * 1024) config.segment_size = 64 * 1024;
+    if (config.max_segments < 2) config.max_segments = 2;
+    if (config.max_segments >= HISTORIAN_MAX_SEGMENTS) config.max_segments = HISTORIAN_MAX_SEGMENTS - 1;
+    if (config.sync_interval_ms <= 0) config.sync_interval_ms = 10000;
+    return tag_count > 0;
+}
+
+static HistorianRecord *segmentRecords(const HistorianSegment *segment)
+{
+    return (HistorianRecord *)(segment->header + 1);
+}
+
+//-----------------------------------------------------------------------------
+// Maps an existing segment file. Returns false if it isn't a valid segment
+// or holds no record
+//-----------------------------------------------------------------------------
+static bool mapSegment(const char *path, HistorianSegment *segment)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) < 0 || (size_t)info.st_size < sizeof(SegmentHeader))
+    {
+        close(fd);
+        return false;
+    }
+    void *region = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) return false;
+
+    SegmentHeader *header = (SegmentHeader *)region;
+    size_t capacity = (info.st_size - sizeof(SegmentHeader)) / sizeof(HistorianRecord);
+    if (memcmp(header->magic, HISTORIAN_MAGIC, 8) != 0 || header->version != HISTORIAN_VERSION ||
+        header->record_size != sizeof(HistorianRecord) || header->count.load() == 0 ||
+        header->count.load() > capacity)
+    {
+        munmap(region, info.st_size);
+        return false;
+    }
+
+    strncpy(segment->path, path, sizeof(segment->path) - 1);
+    segment->path[sizeof(segment->path) - 1] = '\0';
+    segment->first_time = header->first_time;
+    segment->header = header;
+    segment->mapped_size = info.st_size;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Deletes the oldest segments until there are at most max_segments.
+// Called with segments_lock held
+//-----------------------------------------------------------------------------
+static void applyRetention()
+{
+    int excess = segment_count - config.max_segments;
+    if (excess <= 0) return;
+
+    for (int i = 0; i < excess; i++)
+    {
+        munmap(segments[i].header, segments[i].mapped_size);
+        unlink(segments[i].path);
+    }
+    memmove(segments, segments + excess, (segment_count - excess) * sizeof(HistorianSegment));
+    segment_count -= excess;
+}
+
+//-----------------------------------------------------------------------------
+// Maps the segments left on the directory by previous runs
+//-----------------------------------------------------------------------------
+static void loadSegments()
+{
+    char path[512];
+
+    last_record_time = 0;
+    DIR *dir = opendir(config.directory);
+    if (dir == NULL) return;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        size_t length = strlen(entry->d_name);
+        if (strncmp(entry->d_name, "seg_", 4) != 0 || length < 8 || strcmp(entry->d_name + length - 4, ".hst") != 0) continue;
+
+        snprintf(path, sizeof(path), "%s/%s", config.directory, entry->d_name);
+        HistorianSegment segment;
+        if (!mapSegment(path, &segment))
+        {
+            // Segments created right before a crash may have no record
+            unlink(path);
+            continue;
+        }
+        if (segment_count == HISTORIAN_MAX_SEGMENTS)
+        {
+            munmap(segment.header, segment.mapped_size);
+            continue;
+        }
+
+        // Insertion sort by the time of the first record
+        int i = segment_count++;
+        while (i > 0 && segments[i - 1].first_time > segment.first_time)
+        {
+            segments[i] = segments[i - 1];
+            i--;
+        }
+        segments[i] = segment;
+    }
+    closedir(dir);
+
+    if (segment_count > 0)
+    {
+        const HistorianSegment *last = &segments[segment_count - 1];
+        last_record_time = segmentRecords(last)[last->header->count.load() - 1].time;
+    }
+    applyRetention();
+}
+
+//-----------------------------------------------------------------------------
+// Creates a new segment starting at the given time and makes it the active
+// one. The file is allocated up front, so running out of disk space is seen
+// here and not as a fault when the mapping is written. Called with
+// segments_lock held
+//-----------------------------------------------------------------------------
+static bool openSegment(int64_t first_time)
+{
+    char log_msg[1000];
+    HistorianSegment *segment = &segments[segment_count];
+
+    int fd = -1;
+    for (int attempt = 0; attempt < 100 && fd < 0; attempt++)
+    {
+        if (attempt == 0) snprintf(segment->path, sizeof(segment->path), "%s/seg_%lld.hst", config.directory, (long long)first_time);
+        else snprintf(segment->path, sizeof(segment->path), "%s/seg_%lld_%d.hst", config.directory, (long long)first_time, attempt);
+        fd = open(segment->path, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd < 0 && errno != EEXIST) break;
+    }
+    if (fd < 0)
+    {
+        sprintf(log_msg, "Historian: failed to create segment on %s: %s\n", config.directory, strerror(errno));
+        openplc_log(log_msg);
+        return false;
+    }
+
+    int result = posix_fallocate(fd, 0, config.segment_size);
+    if (result != 0)
+    {
+        sprintf(log_msg, "Historian: failed to allocate segment %s: %s\n", segment->path, strerror(result));
+        openplc_log(log_msg);
+        close(fd);
+        unlink(segment->path);
+        return false;
+    }
+    void *region = mmap(NULL, config.segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED)
+    {
+        unlink(segment->path);
+        return false;
+    }
+
+    SegmentHeader *header = (SegmentHeader *)region;
+    memset((void *)header, 0, sizeof(*header));
+    memcpy(header->magic, HISTORIAN_MAGIC, 8);
+    header->version = HISTORIAN_VERSION;
+    header->record_size = sizeof(HistorianRecord);
+    header->capacity = (config.segment_size - sizeof(SegmentHeader)) / sizeof(HistorianRecord);
+    header->first_time = first_time;
+    header->last_time = first_time;
+
+    segment->first_time = first_time;
+    segment->header = header;
+    segment->mapped_size = config.segment_size;
+    segment_count++;
+    active_segment = segment;
+    synced_count = 0;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Writes the active segment to disk, shrinks its file to the records it
+// holds and maps it again read only. Called with segments_lock held
+//-----------------------------------------------------------------------------
+static void closeSegment()
+{
+    HistorianSegment *segment = active_segment;
+    if (segment == NULL) return;
+    active_segment = NULL;
+
+    char path[512];
+    strcpy(path, segment->path);
+
+    uint32_t count = segment->header->count.load();
+    msync(segment->header, segment->mapped_size, MS_SYNC);
+    munmap(segment->header, segment->mapped_size);
+
+    if (count == 0 || truncate(path, sizeof(SegmentHeader) + (size_t)count * sizeof(HistorianRecord)) < 0 ||
+        !mapSegment(path, segment))
+    {
+        unlink(path);
+        segment_count--;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Writes the records appended since the last call to disk
+//-----------------------------------------------------------------------------
+static void syncSegment()
+{
+    if (active_segment == NULL) return;
+
+    uint32_t count = active_segment->header->count.load(std::memory_order_relaxed);
+    if (count == synced_count) return;
+
+    // msync needs a page aligned address
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = sizeof(SegmentHeader) + (size_t)synced_count * sizeof(HistorianRecord);
+    size_t end = sizeof(SegmentHeader) + (size_t)count * sizeof(HistorianRecord);
+    start -= start % page;
+    msync((uint8_t *)active_segment->header + start, end - start, MS_SYNC);
+    msync(active_segment->header, sizeof(SegmentHeader), MS_SYNC);
+    synced_count = count;
+}
+
+//-----------------------------------------------------------------------------
+// Appends a record to the active segment, starting a new one when it is
+// full. Records are kept in time order even if the clock steps back
+//-----------------------------------------------------------------------------
+static void appendRecord(const HistorianTag *tag, int64_t time, double value, uint32_t flags)
+{
+    if (segment_failed) return;
+    if (time < last_record_time) time = last_record_time;
+
+    if (active_segment == NULL || active_segment->header->count.load(std::memory_order_relaxed) == active_segment->header->capacity)
+    {
+        pthread_mutex_lock(&segments_lock);
+        closeSegment();
+        applyRetention();
+        bool opened = segment_count < HISTORIAN_MAX_SEGMENTS && openSegment(time);
+        pthread_mutex_unlock(&segments_lock);
+        if (!opened)
+        {
+            segment_failed = true;
+            return;
+        }
+    }
+
+    SegmentHeader *header = active_segment->header;
+    uint32_t count = header->count.load(std::memory_order_relaxed);
+    HistorianRecord *record = segmentRecords(active_segment) + count;
+    record->time = time;
+    record->tag = tag->id;
+    record->flags = flags;
+    record->value = value;
+    header->last_time = time;
+    header->count.store(count + 1, std::memory_order_release);
+
+    last_record_time = time;
+    records_written++;
+}
+
+//-----------------------------------------------------------------------------
+// Value of a tag on the snapshot
+//-----------------------------------------------------------------------------
+static double readTagValue(const uint8_t *base, const HistorianTag *tag)
+{
+    const uint8_t *value = base + tag->source;
+    switch (tag->size)
+    {
+        case 1:
+            return *value != 0;
+        case 2:
+            if (tag->type == TAG_SIGNED) return *(const int16_t *)value;
+            return *(const uint16_t *)value;
+        case 4:
+            if (tag->type == TAG_SIGNED) return *(const int32_t *)value;
+            if (tag->type == TAG_REAL)
+            {
+                float real;
+                memcpy(&real, value, sizeof(real));
+                return real;
+            }
+            return *(const uint32_t *)value;
+        default:
+            if (tag->type == TAG_SIGNED) return (double)*(const int64_t *)value;
+            if (tag->type == TAG_REAL)
+            {
+                double real;
+                memcpy(&real, value, sizeof(real));
+                return real;
+            }
+            return (double)*(const uint64_t *)value;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Archives a point of a tag and makes it the start of the next door
+//-----------------------------------------------------------------------------
+static void archivePoint(HistorianTag *tag, int64_t time, double value, uint32_t flags)
+{
+    appendRecord(tag, time, value, flags);
+    tag->archived_time = time;
+    tag->archived_value = value;
+    tag->has_pending = false;
+}
+
+//-----------------------------------------------------------------------------
+// Compresses a new point of a tag. With a deadband a point is archived when
+// it moves more than the deadband away from the last archived one. The
+// swinging door archives the last point received when no line from the last
+// archived point can pass within the deadband of every point since
+//-----------------------------------------------------------------------------
+static void compressPoint(HistorianTag *tag, int64_t time, double value)
+{
+    if (!tag->started)
+    {
+        tag->started = true;
+        archivePoint(tag, time, value, RECORD_FIRST);
+        return;
+    }
+
+    if (tag->compression != COMPRESSION_SWINGING_DOOR)
+    {
+        if (fabs(value - tag->archived_value) > tag->deadband) archivePoint(tag, time, value, 0);
+    }
+    else if (time > tag->archived_time && (!tag->has_pending || time > tag->pending_time))
+    {
+        double span = (double)(time - tag->archived_time);
+        double upper = (value + tag->deadband - tag->archived_value) / span;
+        double lower = (value - tag->deadband - tag->archived_value) / span;
+        if (tag->has_pending)
+        {
+            if (upper > tag->slope_upper) upper = tag->slope_upper;
+            if (lower < tag->slope_lower) lower = tag->slope_lower;
+        }
+
+        if (tag->has_pending && lower > upper)
+        {
+            // The door closed, the new door starts on the last point
+            archivePoint(tag, tag->pending_time, tag->pending_value, 0);
+            span = (double)(time - tag->archived_time);
+            upper = (value + tag->deadband - tag->archived_value) / span;
+            lower = (value - tag->deadband - tag->archived_value) / span;
+        }
+        tag->slope_upper = upper;
+        tag->slope_lower = lower;
+        tag->pending_time = time;
+        tag->pending_value = value;
+        tag->has_pending = true;
+    }
+
+    // Points are archived at least every max_interval ms
+    if (tag->max_interval > 0 && time - tag->archived_time >= tag->max_interval)
+    {
+        archivePoint(tag, time, value, 0);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Historian thread. Samples the tags from every published process image
+//-----------------------------------------------------------------------------
+static void *historianThread(void *arg)
+{
+    (void)arg;
+    setThreadClass(THREAD_CLASS_BACKGROUND, "historian");
+
+    double *values = (double *)malloc(tag_count * sizeof(double));
+    uint32_t version = getProcessImageVersion();
+    struct timespec last_sync;
+    clock_gettime(CLOCK_MONOTONIC, &last_sync);
+
+    while (historian_running)
+    {
+        uint32_t current = waitProcessImage(version + getLoadShedStep(), HISTORIAN_WAIT_TIMEOUT);
+        if ((int32_t)(current - version) > 0)
+        {
+            scans_skipped += current - version - 1;
+            version = current;
+
+            uint32_t sequence;
+            const ProcessImageSnapshot *snap;
+            int64_t time;
+            do
+            {
+                snap = beginProcessImageRead(&sequence);
+                for (int i = 0; i < tag_count; i++) values[i] = readTagValue((const uint8_t *)snap, &tags[i]);
+                time = (int64_t)snap->timestamp;
+            } while (!endProcessImageRead(snap, sequence));
+
+            for (int i = 0; i < tag_count; i++) compressPoint(&tags[i], time, values[i]);
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec - last_sync.tv_sec) * 1000 + (now.tv_nsec - last_sync.tv_nsec) / 1000000 >= config.sync_interval_ms)
+        {
+            syncSegment();
+            segment_failed = false;
+            last_sync = now;
+        }
+    }
+
+    // The points still inside a door are archived, so the history reaches
+    // the last scan
+    for (int i = 0; i < tag_count; i++)
+    {
+        if (tags[i].has_pending) archivePoint(&tags[i], tags[i].pending_time, tags[i].pending_value, 0);
+    }
+    free(values);
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Index of the first record at or after the given time
+//-----------------------------------------------------------------------------
+static uint32_t findRecord(const HistorianRecord *records, uint32_t count, int64_t time)
+{
+    uint32_t low = 0, high = count;
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if (records[middle].time < time) low = middle + 1;
+        else high = middle;
+    }
+    return low;
+}
+
+//-----------------------------------------------------------------------------
+// Calls visit for every archived point of a tag between start and end (UTC,
+// in ms) in time order, until it returns false. The segments are found by
+// their first record and the records by a binary search on each segment
+//-----------------------------------------------------------------------------
+static void walkRecords(uint32_t id, int64_t start, int64_t end, bool (*visit)(const HistorianRecord *, void *), void *context)
+{
+    bool more = true;
+    pthread_mutex_lock(&segments_lock);
+    for (int s = 0; s < segment_count && more; s++)
+    {
+        const HistorianSegment *segment = &segments[s];
+        if (segment->first_time > end) break;
+        if (s + 1 < segment_count && segments[s + 1].first_time < start) continue;
+
+        const HistorianRecord *records = segmentRecords(segment);
+        uint32_t count = segment->header->count.load(std::memory_order_acquire);
+        for (uint32_t i = findRecord(records, count, start); i < count && records[i].time <= end && more; i++)
+        {
+            if (records[i].tag == id) more = visit(&records[i], context);
+        }
+    }
+    pthread_mutex_unlock(&segments_lock);
+}
+
+// Lines of a query reply are batched before they are sent
+struct QueryOutput
+{
+    LogWriter writer;
+    void *context;
+    char buffer[4096];
+    size_t length;
+    bool failed;
+};
+
+static void flushQueryOutput(QueryOutput *output)
+{
+    if (output->length > 0 && !output->failed && output->writer(output->context, output->buffer, output->length) < 0)
+    {
+        output->failed = true;
+    }
+    output->length = 0;
+}
+
+static void writeQueryPoint(QueryOutput *output, const HistorianRecord *record)
+{
+    if (output->length > sizeof(output->buffer) - 64) flushQueryOutput(output);
+    output->length += snprintf(output->buffer + output->length, sizeof(output->buffer) - output->length,
+                               "%lld %.15g\n", (long long)record->time, record->value);
+}
+
+// Points of a decimation bucket
+struct QueryBucket
+{
+    int64_t index;
+    bool used;
+    HistorianRecord min;
+    HistorianRecord max;
+};
+
+//-----------------------------------------------------------------------------
+// Sends the min and the max points of a bucket in time order
+//-----------------------------------------------------------------------------
+static void flushQueryBucket(QueryOutput *output, QueryBucket *bucket)
+{
+    if (!bucket->used) return;
+    bucket->used = false;
+
+    const HistorianRecord *a = &bucket->min, *b = &bucket->max;
+    if (b->time < a->time)
+    {
+        a = &bucket->max;
+        b = &bucket->min;
+    }
+    writeQueryPoint(output, a);
+    if (a->time != b->time || a->value != b->value) writeQueryPoint(output, b);
+}
+
+// Decimated query in progress
+struct QueryState
+{
+    QueryOutput output;
+    QueryBucket bucket;
+    int64_t start;
+    int64_t width;
+};
+
+static bool addQueryPoint(const HistorianRecord *record, void *context)
+{
+    QueryState *query = (QueryState *)context;
+    QueryBucket *bucket = &query->bucket;
+
+    int64_t index = (record->time - query->start) / query->width;
+    if (!bucket->used || index != bucket->index)
+    {
+        flushQueryBucket(&query->output, bucket);
+        bucket->used = true;
+        bucket->index = index;
+        bucket->min = *record;
+        bucket->max = *record;
+    }
+    else if (record->value < bucket->min.value) bucket->min = *record;
+    else if (record->value > bucket->max.value) bucket->max = *record;
+
+    return !query->output.failed;
+}
+
+//-----------------------------------------------------------------------------
+// Sends the archived points of a tag between start and end (UTC, in ms), one
+// "time value" line per point. When the range could hold more than
+// max_points points it is split in max_points / 2 buckets and only the
+// minimum and the maximum of each bucket are sent, which keeps the peaks
+//-----------------------------------------------------------------------------
+void sendHistorianQuery(LogWriter writer, void *context, const char *tag_name, int64_t start, int64_t end, int max_points)
+{
+    if (max_points < 2) max_points = 2;
+    int64_t buckets = max_points / 2;
+
+    QueryState query;
+    query.output.writer = writer;
+    query.output.context = context;
+    query.output.length = 0;
+    query.output.failed = false;
+    query.bucket.used = false;
+    query.start = start;
+    query.width = (end - start + buckets) / buckets;
+    if (query.width < 1) query.width = 1;
+
+    walkRecords(tagId(tag_name), start, end, addQueryPoint, &query);
+
+    flushQueryBucket(&query.output, &query.bucket);
+    flushQueryOutput(&query.output);
+}
+
+// Raw read in progress
+struct PointsRead
+{
+    HistorianPoint *points;
+    int max_points;
+    int count;
+    int skip;
+};
+
+static bool addRawPoint(const HistorianRecord *record, void *context)
+{
+    PointsRead *read = (PointsRead *)context;
+    if (read->skip > 0)
+    {
+        read->skip--;
+        return true;
+    }
+    read->points[read->count].time = record->time;
+    read->points[read->count].value = record->value;
+    return ++read->count < read->max_points;
+}
+
+//-----------------------------------------------------------------------------
+// Copies the archived points of a historian tag between start and end (UTC,
+// in ms) in time order, at most max_points of them, after skipping the
+// first skip points. Returns the number of points copied
+//-----------------------------------------------------------------------------
+int readHistorianPoints(uint32_t tag, int64_t start, int64_t end, int skip, HistorianPoint *points, int max_points)
+{
+    if (max_points <= 0) return 0;
+
+    PointsRead read;
+    read.points = points;
+    read.max_points = max_points;
+    read.count = 0;
+    read.skip = skip;
+    walkRecords(tag, start, end, addRawPoint, &read);
+
+    return read.count;
+}
+
+// Interval read in progress
+struct IntervalsRead
+{
+    HistorianInterval *intervals;
+    int64_t start;
+    int64_t width;
+};
+
+static bool addIntervalPoint(const HistorianRecord *record, void *context)
+{
+    IntervalsRead *read = (IntervalsRead *)context;
+    HistorianInterval *interval = &read->intervals[(record->time - read->start) / read->width];
+
+    if (interval->count == 0)
+    {
+        interval->min = interval->max = interval->first = record->value;
+        interval->min_time = interval->max_time = interval->first_time = record->time;
+    }
+    else if (record->value < interval->min)
+    {
+        interval->min = record->value;
+        interval->min_time = record->time;
+    }
+    else if (record->value > interval->max)
+    {
+        interval->max = record->value;
+        interval->max_time = record->time;
+    }
+    interval->last = record->value;
+    interval->last_time = record->time;
+    interval->sum += record->value;
+    interval->count++;
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Summarizes the archived points of a historian tag over count consecutive
+// intervals of width ms from start, in one pass over the records, so a trend
+// is read without copying every point
+//-----------------------------------------------------------------------------
+void readHistorianIntervals(uint32_t tag, int64_t start, int64_t width, int count, HistorianInterval *intervals)
+{
+    memset(intervals, 0, count * sizeof(HistorianInterval));
+    if (width < 1 || count <= 0) return;
+
+    IntervalsRead read;
+    read.intervals = intervals;
+    read.start = start;
+    read.width = width;
+    walkRecords(tag, start, start + width * count - 1, addIntervalPoint, &read);
+}
+
+//-----------------------------------------------------------------------------
+// Finds the historian tag that records a location ([%]IW0, ...). Returns
+// false if the historian doesn't run or doesn't record it
+//-----------------------------------------------------------------------------
+bool findHistorianTag(const char *location, uint32_t *id)
+{
+    HistorianTag located;
+    memset(&located, 0, sizeof(located));
+    if (!historian_running || !parseLocation(location, &located)) return false;
+
+    for (int i = 0; i < tag_count; i++)
+    {
+        if (tags[i].source == located.source && tags[i].size == located.size)
+        {
+            *id = tags[i].id;
+            return true;
+        }
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+// Starts the historian if historian.cfg declares any tag. Called once the
+// process image is published
+//-----------------------------------------------------------------------------
+void startHistorian()
+{
+    char log_msg[1000];
+
+    if (!loadHistorianConfig()) return;
+    if (mkdir(config.directory, 0755) < 0 && errno != EEXIST)
+    {
+        sprintf(log_msg, "Historian: failed to create %s: %s\n", config.directory, strerror(errno));
+        openplc_log(log_msg);
+        return;
+    }
+    if (segments == NULL) segments = (HistorianSegment *)calloc(HISTORIAN_MAX_SEGMENTS, sizeof(HistorianSegment));
+    if (segments == NULL)
+    {
+        openplc_log((char *)"Historian: failed to allocate the segment list\n");
+        return;
+    }
+    loadSegments();
+
+    records_written = 0;
+    scans_skipped = 0;
+    historian_running = true;
+    if (pthread_create(&historian_thread, NULL, historianThread, NULL) != 0)
+    {
+        historian_running = false;
+        openplc_log((char *)"Historian: failed to start the historian thread\n");
+        return;
+    }
+
+    sprintf(log_msg, "Historian: recording %d tags on %s (%d segments kept)\n", tag_count, config.directory, segment_count);
+    openplc_log(log_msg);
+}
+
+//-----------------------------------------------------------------------------
+// Stops the historian, if it was started, and closes the active segment
+//-----------------------------------------------------------------------------
+void stopHistorian()
+{
+    char log_msg[1000];
+
+    if (!historian_running) return;
+
+    historian_running = false;
+    pthread_join(historian_thread, NULL);
+
+    pthread_mutex_lock(&segments_lock);
+    closeSegment();
+    for (int i = 0; i < segment_count; i++) munmap(segments[i].header, segments[i].mapped_size);
+    segment_count = 0;
+    pthread_mutex_unlock(&segments_lock);
+
+    sprintf(log_msg, "Historian: stopped, %llu records written, %llu scans skipped\n",
+            (unsigned long long)records_written, (unsigned long long)scans_skipped);
+    openplc_log(log_msg);
+}
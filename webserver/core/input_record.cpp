@@ -0,0 +1,652 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the recording of the inputs of the PLC program and
+// their replay offline. While recording (start_input_record on the
+// interactive server) the scan thread logs, right before every run of the
+// program, what changed on the process image since the program last ran:
+// the inputs read from the hardware and the slaves, the protocol writes, the
+// forces and the special functions. With the tick, the scan time and a hash
+// of the outputs the program wrote, that is everything that makes a scan
+// differ from the one before, so the program can be run again on the same
+// scans without the hardware, as fast as it goes (openplc --replay), to
+// profile it or to compare two builds of it.
+//
+// Recording starts with a state export (see plc_state.cpp) to <path>.state,
+// taken while bufferLock is held on the same critical section that arms the
+// recording, so the replay starts from exactly the state the first change
+// applies to. Each scan is then a record of the log:
+//     varint  ticks since the last recorded scan
+//     varint  nanoseconds of scan time since the last recorded scan
+//     runs    varint words skipped since the last run plus one, varint
+//             words changed, the words themselves. A zero ends the runs
+//     uint64  hash of the output images once the program ran
+// The image is compared a 64 bit word at a time with a copy of it taken
+// after the last run, so a scan that only changes a few inputs is a few
+// bytes long. The records are written on preallocated chunks that a
+// background thread writes to the file, the scan thread never blocks on the
+// disk. If the writer falls behind by every chunk the recording stops.
+//
+// A replay only reproduces the scans if nothing else changes the program:
+// an online change stops the recording, and forcing variables that are not
+// located isn't recorded. The replay compares the outputs with the hashes
+// and reports the scans that diverge.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <atomic>
+
+#include "ladder.h"
+
+#define RECORD_MAGIC            "OPLCRECD"
+#define RECORD_FORMAT_VERSION   1
+#define RECORD_CHUNK_SIZE       (1024 * 1024)
+#define RECORD_CHUNKS           8
+
+extern unsigned long __tick;
+
+struct RecordHeader
+{
+    char magic[8];
+    uint16_t version;
+    uint16_t region_count;
+    uint32_t image_size;        //bytes of all the images
+    uint64_t tick;              //tick of the state the first record applies to
+    int64_t scan_time_ns;       //scan time of that state
+    uint64_t ticktime_ns;
+};
+
+struct RecordRegion
+{
+    void *data;
+    size_t size;
+    bool output;                //hashed after every run
+};
+
+static_assert(BUFFER_SIZE % 8 == 0, "the images are compared a word at a time");
+
+static const RecordRegion regions[] =
+{
+    {bool_input_image, sizeof(bool_input_image), false},
+    {bool_output_image, sizeof(bool_output_image), true},
+    {bool_memory_image, sizeof(bool_memory_image), false},
+    {byte_input_image, sizeof(byte_input_image), false},
+    {byte_output_image, sizeof(byte_output_image), true},
+    {byte_memory_image, sizeof(byte_memory_image), false},
+    {int_input_image, sizeof(int_input_image), false},
+    {int_output_image, sizeof(int_output_image), true},
+    {int_memory_image, sizeof(int_memory_image), false},
+    {dint_input_image, sizeof(dint_input_image), false},
+    {dint_output_image, sizeof(dint_output_image), true},
+    {dint_memory_image, sizeof(dint_memory_image), false},
+    {lint_input_image, sizeof(lint_input_image), false},
+    {lint_output_image, sizeof(lint_output_image), true},
+    {lint_memory_image, sizeof(lint_memory_image), false},
+    {real_input_image, sizeof(real_input_image), false},
+    {real_output_image, sizeof(real_output_image), true},
+    {real_memory_image, sizeof(real_memory_image), false},
+    {lreal_input_image, sizeof(lreal_input_image), false},
+    {lreal_output_image, sizeof(lreal_output_image), true},
+    {lreal_memory_image, sizeof(lreal_memory_image), false},
+};
+
+#define RECORD_REGION_COUNT     (sizeof(regions) / sizeof(regions[0]))
+
+//-----------------------------------------------------------------------------
+// Recording state. recording, the baseline and the chunk being filled are
+// only touched holding bufferLock: by the scan thread, and by the commands
+// that start and stop the recording
+//-----------------------------------------------------------------------------
+static bool recording = false;
+static uint64_t *baseline = NULL;           //image after the last run
+static void (*recorded_run)(unsigned long) = NULL;
+static unsigned long last_tick = 0;
+static int64_t last_scan_time_ns = 0;
+static unsigned long armed_tick = 0;        //where the recording started
+static int64_t armed_scan_time_ns = 0;
+static size_t chunk_used = 0;
+static uint64_t recorded_scans = 0;
+static bool overrun = false;
+
+//-----------------------------------------------------------------------------
+// Chunks handed to the writer thread. The scan thread fills chunk
+// filled % RECORD_CHUNKS, the writer writes them up to filled
+//-----------------------------------------------------------------------------
+static uint8_t *chunks[RECORD_CHUNKS];
+static size_t chunk_size[RECORD_CHUNKS];
+static std::atomic<uint64_t> filled(0);
+static std::atomic<uint64_t> written(0);
+static std::atomic<bool> record_open(false);
+static std::atomic<uint64_t> written_bytes(0);
+static int record_fd = -1;
+static pthread_t writer_thread;
+static bool writer_running = false;
+static char record_path[1024];
+
+//-----------------------------------------------------------------------------
+// Returns the bytes of all the images
+//-----------------------------------------------------------------------------
+static size_t imageSize()
+{
+    size_t size = 0;
+    for (size_t i = 0; i < RECORD_REGION_COUNT; i++) size += regions[i].size;
+    return size;
+}
+
+//-----------------------------------------------------------------------------
+// Largest record of a scan: every other word changed, each a run of its own
+//-----------------------------------------------------------------------------
+static size_t maxRecordSize()
+{
+    return imageSize() * 2 + 64;
+}
+
+static uint8_t *putVarint(uint8_t *out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+static bool getVarint(const uint8_t **in, const uint8_t *end, uint64_t *value)
+{
+    *value = 0;
+    for (int shift = 0; *in < end && shift < 64; shift += 7)
+    {
+        uint8_t byte = *(*in)++;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+static int64_t scanTimeNs()
+{
+    int32_t tv_sec, tv_nsec;
+    readScanTime(&tv_sec, &tv_nsec);
+    return (int64_t)tv_sec * 1000000000LL + tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+// Hash of the output images (FNV-1a over 64 bit words)
+//-----------------------------------------------------------------------------
+static uint64_t hashOutputs()
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t r = 0; r < RECORD_REGION_COUNT; r++)
+    {
+        if (!regions[r].output) continue;
+        const uint8_t *data = (const uint8_t *)regions[r].data;
+        for (size_t i = 0; i < regions[r].size; i += 8)
+        {
+            uint64_t word;
+            memcpy(&word, data + i, 8);
+            hash = (hash ^ word) * 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+//-----------------------------------------------------------------------------
+// Copies the images to the baseline
+//-----------------------------------------------------------------------------
+static void copyBaseline()
+{
+    uint8_t *position = (uint8_t *)baseline;
+    for (size_t r = 0; r < RECORD_REGION_COUNT; r++)
+    {
+        memcpy(position, regions[r].data, regions[r].size);
+        position += regions[r].size;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Writes the chunks the scan thread filled to the file, until the recording
+// is stopped and every chunk is written
+//-----------------------------------------------------------------------------
+static void *recordWriter(void *arg)
+{
+    char log_msg[1000];
+    setThreadClass(THREAD_CLASS_BACKGROUND, "input_record");
+
+    bool failed = false;
+    while (true)
+    {
+        bool open = record_open.load(std::memory_order_acquire);
+        uint64_t end = filled.load(std::memory_order_acquire);
+        uint64_t next = written.load(std::memory_order_relaxed);
+        for (; next < end; next++)
+        {
+            int slot = next % RECORD_CHUNKS;
+            if (!failed && write(record_fd, chunks[slot], chunk_size[slot]) != (ssize_t)chunk_size[slot])
+            {
+                sprintf(log_msg, "Input record: error writing %s, the scans that follow are lost\n", record_path);
+                openplc_log(log_msg);
+                failed = true;
+            }
+            written_bytes.fetch_add(chunk_size[slot], std::memory_order_relaxed);
+            written.store(next + 1, std::memory_order_release);
+        }
+        if (!open) break;
+        sleepms(20);
+    }
+
+    close(record_fd);
+    record_fd = -1;
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Hands the chunk being filled to the writer. Returns false if the writer
+// still holds every other chunk
+//-----------------------------------------------------------------------------
+static bool handOffChunk()
+{
+    uint64_t slot = filled.load(std::memory_order_relaxed);
+    chunk_size[slot % RECORD_CHUNKS] = chunk_used;
+    filled.store(slot + 1, std::memory_order_release);
+    chunk_used = 0;
+    return slot + 1 - written.load(std::memory_order_acquire) < RECORD_CHUNKS;
+}
+
+//-----------------------------------------------------------------------------
+// Stops the recording, handing what was recorded to the writer. Called with
+// bufferLock held
+//-----------------------------------------------------------------------------
+static void endRecording()
+{
+    if (!recording) return;
+    recording = false;
+    if (chunk_used > 0) handOffChunk();
+    record_open.store(false, std::memory_order_release);
+}
+
+//-----------------------------------------------------------------------------
+// Arms the recording on the state being exported, called by exportPlcState
+// with bufferLock held
+//-----------------------------------------------------------------------------
+static void armRecording()
+{
+    copyBaseline();
+    recorded_run = plcProgram()->config_run;
+    last_tick = __tick;
+    last_scan_time_ns = scanTimeNs();
+    armed_tick = last_tick;
+    armed_scan_time_ns = last_scan_time_ns;
+    chunk_used = 0;
+    recorded_scans = 0;
+    overrun = false;
+    recording = true;
+}
+
+//-----------------------------------------------------------------------------
+// Logs what changed on the images since the last run of the program. Called
+// by the scan thread with bufferLock held, right before the program runs
+//-----------------------------------------------------------------------------
+void recordScanInputs()
+{
+    if (!recording) return;
+
+    if (plcProgram()->config_run != recorded_run)
+    {
+        endRecording();
+        openplc_log((char *)"Input record: stopped by an online change\n");
+        return;
+    }
+    if (chunk_used + maxRecordSize() > RECORD_CHUNK_SIZE && !handOffChunk())
+    {
+        overrun = true;
+        endRecording();
+        openplc_log((char *)"Input record: stopped, the file can't be written as fast as the scans are recorded\n");
+        return;
+    }
+
+    uint8_t *out = chunks[filled.load(std::memory_order_relaxed) % RECORD_CHUNKS] + chunk_used;
+    uint8_t *start = out;
+    int64_t scan_time_ns = scanTimeNs();
+    out = putVarint(out, __tick - last_tick);
+    out = putVarint(out, (uint64_t)(scan_time_ns - last_scan_time_ns));
+    last_tick = __tick;
+    last_scan_time_ns = scan_time_ns;
+
+    size_t word = 0;
+    size_t last_end = 0;
+    for (size_t r = 0; r < RECORD_REGION_COUNT; r++)
+    {
+        const uint8_t *data = (const uint8_t *)regions[r].data;
+        size_t words = regions[r].size / 8;
+        for (size_t i = 0; i < words; i++)
+        {
+            uint64_t value;
+            memcpy(&value, data + i * 8, 8);
+            if (value == baseline[word + i]) continue;
+
+            size_t end = i + 1;
+            while (end < words)
+            {
+                memcpy(&value, data + end * 8, 8);
+                if (value == baseline[word + end]) break;
+                end++;
+            }
+
+            out = putVarint(out, word + i - last_end + 1);
+            out = putVarint(out, end - i);
+            memcpy(out, data + i * 8, (end - i) * 8);
+            memcpy(&baseline[word + i], data + i * 8, (end - i) * 8);
+            out += (end - i) * 8;
+            last_end = word + end;
+            i = end;
+        }
+        word += words;
+    }
+    out = putVarint(out, 0);
+    chunk_used += out - start;
+}
+
+//-----------------------------------------------------------------------------
+// Completes the record of the scan with the hash of the outputs and takes
+// the image the next scan is compared with. Called by the scan thread with
+// bufferLock held, right after the program ran
+//-----------------------------------------------------------------------------
+void recordScanOutputs()
+{
+    if (!recording) return;
+
+    uint64_t hash = hashOutputs();
+    memcpy(chunks[filled.load(std::memory_order_relaxed) % RECORD_CHUNKS] + chunk_used, &hash, sizeof(hash));
+    chunk_used += sizeof(hash);
+    copyBaseline();
+    recorded_scans++;
+}
+
+//-----------------------------------------------------------------------------
+// Stops the recording and waits for the writer to write it
+//-----------------------------------------------------------------------------
+void stopInputRecord()
+{
+    char log_msg[1000];
+
+    lockBuffer();
+    endRecording();
+    uint64_t scans = recorded_scans;
+    unlockBuffer();
+
+    if (!writer_running) return;
+    pthread_join(writer_thread, NULL);
+    writer_running = false;
+
+    sprintf(log_msg, "Input record: %llu scans recorded to %s (%llu bytes)\n", (unsigned long long)scans,
+            record_path, (unsigned long long)(written_bytes.load(std::memory_order_relaxed) + sizeof(RecordHeader)));
+    openplc_log(log_msg);
+}
+
+//-----------------------------------------------------------------------------
+// Starts recording the inputs of every scan to path, with the state they
+// apply to on <path>.state. A recording running is stopped first. Returns 0,
+// or -1 on error
+//-----------------------------------------------------------------------------
+int startInputRecord(const char *path)
+{
+    char log_msg[1000];
+    stopInputRecord();
+
+    if (baseline == NULL)
+    {
+        baseline = (uint64_t *)malloc(imageSize());
+        for (int i = 0; i < RECORD_CHUNKS && baseline != NULL; i++)
+        {
+            chunks[i] = (uint8_t *)malloc(RECORD_CHUNK_SIZE);
+            if (chunks[i] == NULL)
+            {
+                for (int j = 0; j < i; j++) free(chunks[j]);
+                free(baseline);
+                baseline = NULL;
+            }
+        }
+        if (baseline == NULL)
+        {
+            openplc_log((char *)"Input record: could not allocate the record buffers\n");
+            return -1;
+        }
+    }
+
+    snprintf(record_path, sizeof(record_path), "%s", path);
+    record_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (record_fd < 0)
+    {
+        sprintf(log_msg, "Input record: could not create %s\n", path);
+        openplc_log(log_msg);
+        return -1;
+    }
+
+    filled.store(0, std::memory_order_relaxed);
+    written.store(0, std::memory_order_relaxed);
+    written_bytes.store(0, std::memory_order_relaxed);
+    record_open.store(true, std::memory_order_relaxed);
+
+    char state_path[1100];
+    snprintf(state_path, sizeof(state_path), "%s.state", path);
+    bool started = exportPlcState(state_path, armRecording) == 0;
+
+    RecordHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RECORD_MAGIC, sizeof(header.magic));
+    header.version = RECORD_FORMAT_VERSION;
+    header.region_count = RECORD_REGION_COUNT;
+    header.image_size = (uint32_t)imageSize();
+    header.ticktime_ns = *plcProgram()->common_ticktime;
+    header.tick = armed_tick;
+    header.scan_time_ns = armed_scan_time_ns;
+
+    if (!started || write(record_fd, &header, sizeof(header)) != (ssize_t)sizeof(header))
+    {
+        lockBuffer();
+        endRecording();
+        unlockBuffer();
+        close(record_fd);
+        record_fd = -1;
+        unlink(path);
+        sprintf(log_msg, "Input record: could not start recording to %s\n", path);
+        openplc_log(log_msg);
+        return -1;
+    }
+
+    if (pthread_create(&writer_thread, NULL, recordWriter, NULL) != 0)
+    {
+        lockBuffer();
+        endRecording();
+        unlockBuffer();
+        close(record_fd);
+        record_fd = -1;
+        openplc_log((char *)"Input record: could not start the writer thread\n");
+        return -1;
+    }
+    writer_running = true;
+
+    sprintf(log_msg, "Input record: recording the scan inputs to %s\n", path);
+    openplc_log(log_msg);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Writes the state of the recording
+//-----------------------------------------------------------------------------
+int getInputRecordStatus(char *buffer, size_t buffer_size)
+{
+    lockBuffer();
+    bool running = recording;
+    uint64_t scans = recorded_scans;
+    bool stopped_by_overrun = overrun;
+    unlockBuffer();
+
+    int count = snprintf(buffer, buffer_size, "state=%s scans=%llu bytes=%llu overrun=%d path=%s\n",
+                         running ? "recording" : "stopped", (unsigned long long)scans,
+                         (unsigned long long)written_bytes.load(std::memory_order_relaxed),
+                         stopped_by_overrun ? 1 : 0, record_path);
+    if (count > (int)buffer_size) count = buffer_size;
+    return count;
+}
+
+//-----------------------------------------------------------------------------
+// Applies the runs of changed words of a record to the images. Returns false
+// if the record is malformed
+//-----------------------------------------------------------------------------
+static bool applyRecordRuns(const uint8_t **in, const uint8_t *end)
+{
+    size_t region = 0;
+    size_t region_word = 0;         //first word of region
+    size_t last_end = 0;
+    while (true)
+    {
+        uint64_t skip, count;
+        if (!getVarint(in, end, &skip)) return false;
+        if (skip == 0) return true;
+        if (!getVarint(in, end, &count) || count == 0 || count * 8 > (uint64_t)(end - *in)) return false;
+
+        size_t first = last_end + skip - 1;
+        while (region < RECORD_REGION_COUNT && first >= region_word + regions[region].size / 8)
+        {
+            region_word += regions[region].size / 8;
+            region++;
+        }
+        if (region == RECORD_REGION_COUNT || first + count > region_word + regions[region].size / 8) return false;
+
+        memcpy((uint8_t *)regions[region].data + (first - region_word) * 8, *in, count * 8);
+        *in += count * 8;
+        last_end = first + count;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Runs the program on the scans recorded on path, as fast as it goes, repeat
+// times, each one from the state the recording started on. The time every
+// run took is recorded on the scan profiler (program phase), which is
+// printed with the scans whose outputs differ from the recorded ones.
+// Called by main instead of starting the runtime, once the program is
+// initialized. Returns 0, or -1 if the recording can't be replayed
+//-----------------------------------------------------------------------------
+int replayInputRecord(const char *path, int repeat)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        printf("Replay: could not open %s\n", path);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long file_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *file = file_size > 0 ? (uint8_t *)malloc(file_size) : NULL;
+    bool read_ok = file != NULL && fread(file, 1, file_size, f) == (size_t)file_size;
+    fclose(f);
+
+    RecordHeader header;
+    if (read_ok && (size_t)file_size >= sizeof(header)) memcpy(&header, file, sizeof(header));
+    if (!read_ok || (size_t)file_size < sizeof(header) || memcmp(header.magic, RECORD_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != RECORD_FORMAT_VERSION || header.region_count != RECORD_REGION_COUNT ||
+        header.image_size != imageSize())
+    {
+        printf("Replay: %s is not an input recording of this runtime\n", path);
+        free(file);
+        return -1;
+    }
+    if (header.ticktime_ns != *plcProgram()->common_ticktime)
+    {
+        printf("Replay: warning, the recording ran on a %llu ns tick, the program has a %llu ns tick\n",
+               (unsigned long long)header.ticktime_ns, *plcProgram()->common_ticktime);
+    }
+
+    char state_path[1100];
+    snprintf(state_path, sizeof(state_path), "%s.state", path);
+    const uint8_t *end = file + file_size;
+    uint64_t scans = 0, diverged = 0, first_diverged = 0;
+    int64_t program_ns = 0;
+    struct timespec replay_start, replay_end;
+    clock_gettime(CLOCK_MONOTONIC, &replay_start);
+    for (int pass = 0; pass < repeat; pass++)
+    {
+        if (importPlcState(state_path) != 0)
+        {
+            printf("Replay: the state %s can't be loaded on this program\n", state_path);
+            free(file);
+            return -1;
+        }
+
+        unsigned long tick = header.tick;
+        int64_t scan_time_ns = header.scan_time_ns;
+        const uint8_t *in = file + sizeof(header);
+        uint64_t pass_scans = 0;
+        while (in < end)
+        {
+            uint64_t ticks, elapsed_ns, hash;
+            if (!getVarint(&in, end, &ticks) || !getVarint(&in, end, &elapsed_ns) ||
+                !applyRecordRuns(&in, end) || end - in < (ptrdiff_t)sizeof(hash))
+            {
+                // The last record is cut if the runtime stopped while recording
+                printf("Replay: the recording is truncated after %llu scans\n", (unsigned long long)pass_scans);
+                break;
+            }
+            memcpy(&hash, in, sizeof(hash));
+            in += sizeof(hash);
+
+            tick += ticks;
+            scan_time_ns += elapsed_ns;
+            setScanTime(scan_time_ns);
+            plcProgram()->update_time();
+
+            struct timespec start, finish;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            plcProgram()->config_run(tick);
+            clock_gettime(CLOCK_MONOTONIC, &finish);
+            int64_t run_ns = (finish.tv_sec - start.tv_sec) * 1000000000LL + (finish.tv_nsec - start.tv_nsec);
+            recordScanPhase(PROFILE_PROGRAM, (uint64_t)run_ns);
+            program_ns += run_ns;
+
+            scans++;
+            pass_scans++;
+            if (hashOutputs() != hash && diverged++ == 0) first_diverged = scans;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &replay_end);
+    free(file);
+
+    double wall_ms = (replay_end.tv_sec - replay_start.tv_sec) * 1000.0 + (replay_end.tv_nsec - replay_start.tv_nsec) / 1000000.0;
+    printf("###Replay: %llu scans in %.1f ms, %.1f ms running the program (%.2f us per scan)\n",
+           (unsigned long long)scans, wall_ms, program_ns / 1000000.0, scans > 0 ? program_ns / 1000.0 / scans : 0.0);
+    if (diverged > 0)
+        printf("###Replay: the outputs of %llu scans differ from the recording, the first on scan %llu\n",
+               (unsigned long long)diverged, (unsigned long long)first_diverged);
+    else
+        printf("###Replay: the outputs of every scan match the recording\n");
+
+    static char report[16384];
+    getScanHistogram(PROFILE_PROGRAM, report, sizeof(report));
+    printf("###Histogram:\n%s", report);
+    fflush(stdout);
+    return 0;
+}
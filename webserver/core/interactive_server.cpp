@@ -22,6 +22,20 @@
 // with the Python webserver GUI only.
 //
 // Thiago Alves, Jun 2018
+//
+// Besides the text protocol (one command per line, one connection per
+// command) clients can keep a connection open and send framed requests. A
+// frame is an 8-byte header (magic, type, request id and payload length, all
+// little endian) followed by the payload. Requests carry the command text.
+// Each request is answered by any number of data frames with the response
+// followed by one end frame, so clients can pipeline a batch of requests and
+// responses of any size are streamed.
+//
+// The requests of a framed client run concurrently, each on its own thread,
+// and their frames carry the request id, so a status query is answered while
+// a protocol is still starting. The commands that start, stop or reconfigure
+// parts of the runtime take the control lock and run one at a time; the
+// queries don't wait for them.
 //-----------------------------------------------------------------------------
 
 #include <stdio.h>
@@ -34,18 +48,62 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
 
 #include "ladder.h"
 #include "oplc_snap7.h"
 
-#define BUFFER_SIZE 1024
+#define COMMAND_BUFFER_SIZE 1024
+#define MAX_LOG_EVENTS_PER_REQUEST 512
+
+#define RPC_MAGIC           0xB7    // Never the first byte of a text command
+#define RPC_REQUEST         0x01
+#define RPC_DATA            0x81
+#define RPC_END             0x82
+#define RPC_HEADER_SIZE     8
+#define RPC_MAX_PENDING     16      // requests of a framed client running at once
+#define RPC_MAX_REQUEST     (256 * 1024)    // bulk commands, e.g. variables_read()
+
+//A framed connection, shared by the requests running for it
+struct InteractiveConnection
+{
+    pthread_mutex_t writeLock;      // the frames of the requests don't interleave
+    pthread_mutex_t pendingLock;
+    pthread_cond_t pendingDone;
+    int pending;                    // requests still running
+};
+
+//The client of a command. Replies are written as they are or framed,
+//depending on the protocol the client spoke first
+struct InteractiveClient
+{
+    int fd;
+    bool framed;
+    uint16_t request_id;
+    InteractiveConnection *connection;  // framed clients only
+};
+
+//A framed request running on its own thread. The command follows the
+//struct on the same allocation
+struct InteractiveRequest
+{
+    InteractiveClient client;
+    unsigned char *command;
+};
 
 //Global Variables
 bool ethercat_configured = 0;
-char ethercat_conf_file[BUFFER_SIZE];
+char ethercat_conf_file[COMMAND_BUFFER_SIZE];
 bool run_modbus = 0;
 uint16_t modbus_port = 502;
+bool run_modbus_rtu = 0;
+bool run_modbus_udp = 0;
+uint16_t modbus_udp_port = 502;
+char modbus_rtu_config[COMMAND_BUFFER_SIZE];
 bool run_snap7 = 0;
+bool run_mqtt = 0;
 bool run_dnp3 = 0;
 uint16_t dnp3_port = 20000;
 bool run_enip = 0;
@@ -54,19 +112,21 @@ bool run_opcua = 0;
 uint16_t opcua_port = 4840;
 bool run_pstorage = 0;
 uint16_t pstorage_polling = 10;
-unsigned char server_command[1024];
-int command_index = 0;
-bool processing_command = 0;
 time_t start_time;
 time_t end_time;
 
 //Global Threads
 pthread_t modbus_thread;
+pthread_t modbus_rtu_thread;
+pthread_t modbus_udp_thread;
 pthread_t dnp3_thread;
 pthread_t enip_thread;
 pthread_t opcua_thread;
 pthread_t pstorage_thread;
 
+//Held by the commands that change the runtime, see isConcurrentCommand()
+static pthread_mutex_t controlLock = PTHREAD_MUTEX_INITIALIZER;
+
 //-----------------------------------------------------------------------------
 // Configure Ethercat
 //-----------------------------------------------------------------------------
@@ -78,14 +138,61 @@ int configureEthercat(){
 //-----------------------------------------------------------------------------
 void *modbusThread(void *arg)
 {
+    setThreadClass(THREAD_CLASS_COMM, "modbus_server");
+
     startServer(modbus_port, MODBUS_PROTOCOL);
 }
 
+//-----------------------------------------------------------------------------
+// Start the Modbus/UDP Thread
+//-----------------------------------------------------------------------------
+void *modbusUdpThread(void *arg)
+{
+    setThreadClass(THREAD_CLASS_COMM, "modbus_udp");
+
+    startUdpServer(modbus_udp_port);
+    return nullptr;
+}
+
+//-----------------------------------------------------------------------------
+// Start the Modbus RTU Thread
+//-----------------------------------------------------------------------------
+void *modbusRtuThread(void *arg)
+{
+    setThreadClass(THREAD_CLASS_COMM, "modbus_rtu");
+
+    startModbusRtuServer(modbus_rtu_config);
+    run_modbus_rtu = 0;
+    return nullptr;
+}
+
+//-----------------------------------------------------------------------------
+// Stops the Modbus RTU Thread. The thread also ends on its own if the port
+// could not be opened, so it is joined whenever it was started
+//-----------------------------------------------------------------------------
+static void stopModbusRtuThread()
+{
+    char log_msg[1000];
+    if (modbus_rtu_config[0] == '\0') return;
+
+    bool was_running = run_modbus_rtu;
+    run_modbus_rtu = 0;
+    pthread_join(modbus_rtu_thread, NULL);
+    modbus_rtu_config[0] = '\0';
+    if (was_running)
+    {
+        sprintf(log_msg, "Modbus RTU slave was stopped\n");
+        openplc_log(log_msg);
+    }
+}
+
 //-----------------------------------------------------------------------------
 // Start the DNP3 Thread
 //-----------------------------------------------------------------------------
 void *dnp3Thread(void *arg)
 {
+    setThreadClass(THREAD_CLASS_COMM, "dnp3_server");
+
     dnp3StartServer(dnp3_port);
 }
 
@@ -94,7 +201,11 @@ void *dnp3Thread(void *arg)
 //-----------------------------------------------------------------------------
 void *enipThread(void *arg)
 {
+    setThreadClass(THREAD_CLASS_COMM, "enip_server");
+
+    startEnipDiscovery(enip_port);
     startServer(enip_port, ENIP_PROTOCOL);
+    stopEnipDiscovery();
     return nullptr;
 
 }
@@ -104,6 +215,8 @@ void *enipThread(void *arg)
 //-----------------------------------------------------------------------------
 void *opcuaThread(void *arg)
 {
+    setThreadClass(THREAD_CLASS_COMM, "opcua_server");
+
     opcuaStartServer(opcua_port);
     return nullptr;
 }
@@ -113,6 +226,8 @@ void *opcuaThread(void *arg)
 //-----------------------------------------------------------------------------
 void *pstorageThread(void *arg)
 {
+    setThreadClass(THREAD_CLASS_BACKGROUND, "pstorage");
+
     startPstorage();
 }
 
@@ -123,11 +238,13 @@ int readCommandArgument(unsigned char *command)
 {
     int i = 0;
     int j = 0;
-    unsigned char argument[1024];
+    unsigned char argument[COMMAND_BUFFER_SIZE];
+    argument[0] = '\0';
 
     while (command[i] != '(' && command[i] != '\0') i++;
     if (command[i] == '(') i++;
-    while (command[i] != ')' && command[i] != '\0')
+    //framed requests can be far longer than the argument buffer
+    while (command[i] != ')' && command[i] != '\0' && j < COMMAND_BUFFER_SIZE - 1)
     {
         argument[j] = command[i];
         i++;
@@ -145,11 +262,12 @@ unsigned char *readCommandArgumentStr(unsigned char *command)
     int i = 0;
     int j = 0;
     unsigned char *argument;
-    argument = (unsigned char *)malloc(1024 * sizeof(unsigned char));
+    argument = (unsigned char *)malloc(COMMAND_BUFFER_SIZE * sizeof(unsigned char));
+    argument[0] = '\0';
 
     while (command[i] != '(' && command[i] != '\0') i++;
     if (command[i] == '(') i++;
-    while (command[i] != ')' && command[i] != '\0')
+    while (command[i] != ')' && command[i] != '\0' && j < COMMAND_BUFFER_SIZE - 1)
     {
         argument[j] = command[i];
         i++;
@@ -160,6 +278,106 @@ unsigned char *readCommandArgumentStr(unsigned char *command)
     return argument;
 }
 
+//-----------------------------------------------------------------------------
+// Writes a whole buffer to the client socket. Returns 0 on success or -1 on
+// error
+//-----------------------------------------------------------------------------
+static int writeAll_interactive(int fd, const void *data, size_t length)
+{
+    const unsigned char *position = (const unsigned char *)data;
+    while (length > 0)
+    {
+        ssize_t written = send(fd, position, length, MSG_NOSIGNAL);
+        if (written < 0)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        position += written;
+        length -= written;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Reads exactly length bytes from the client socket. Returns 0 on success or
+// -1 if the connection was closed or failed
+//-----------------------------------------------------------------------------
+static int readAll_interactive(int fd, void *data, size_t length)
+{
+    unsigned char *position = (unsigned char *)data;
+    while (length > 0)
+    {
+        ssize_t count = read(fd, position, length);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return -1;
+        position += count;
+        length -= count;
+    }
+    return 0;
+}
+
+static void packFrameHeader(unsigned char *header, uint8_t type, uint16_t id, uint32_t length)
+{
+    header[0] = RPC_MAGIC;
+    header[1] = type;
+    header[2] = id & 0xFF;
+    header[3] = id >> 8;
+    header[4] = length & 0xFF;
+    header[5] = (length >> 8) & 0xFF;
+    header[6] = (length >> 16) & 0xFF;
+    header[7] = length >> 24;
+}
+
+//-----------------------------------------------------------------------------
+// Writes a frame header and its data. Returns 0 on success or -1 on error
+//-----------------------------------------------------------------------------
+static int sendFrame(int fd, const unsigned char *header, const void *data, size_t length)
+{
+    struct iovec parts[2];
+    parts[0].iov_base = (void *)header;
+    parts[0].iov_len = RPC_HEADER_SIZE;
+    parts[1].iov_base = (void *)data;
+    parts[1].iov_len = length;
+
+    // Header and data usually go out on a single segment. A client that
+    // went away must not raise SIGPIPE on the runtime
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = parts;
+    message.msg_iovlen = 2;
+    ssize_t written = sendmsg(fd, &message, MSG_NOSIGNAL);
+    if (written == (ssize_t)(RPC_HEADER_SIZE + length)) return 0;
+    if (written < 0 && errno != EINTR) return -1;
+    if (written < 0) written = 0;
+
+    if ((size_t)written < RPC_HEADER_SIZE)
+    {
+        if (writeAll_interactive(fd, header + written, RPC_HEADER_SIZE - written) < 0) return -1;
+        written = RPC_HEADER_SIZE;
+    }
+    return writeAll_interactive(fd, (const unsigned char *)data + (written - RPC_HEADER_SIZE),
+                                length - (written - RPC_HEADER_SIZE));
+}
+
+//-----------------------------------------------------------------------------
+// Sends part of the response to the command being processed. Returns 0 on
+// success or -1 on error
+//-----------------------------------------------------------------------------
+static int sendReply(void *context, const void *data, size_t length)
+{
+    InteractiveClient *client = (InteractiveClient *)context;
+    if (!client->framed) return writeAll_interactive(client->fd, data, length);
+    if (length == 0) return 0;
+
+    unsigned char header[RPC_HEADER_SIZE];
+    packFrameHeader(header, RPC_DATA, client->request_id, length);
+    pthread_mutex_lock(&client->connection->writeLock);
+    int result = sendFrame(client->fd, header, data, length);
+    pthread_mutex_unlock(&client->connection->writeLock);
+    return result;
+}
+
 //-----------------------------------------------------------------------------
 // Create the socket and bind it. Returns the file descriptor for the socket
 // created.
@@ -247,23 +465,36 @@ int listenToClient_interactive(int client_fd, unsigned char *buffer)
 }
 
 //-----------------------------------------------------------------------------
-// Process client's commands for the interactive server
+// Returns true for the commands that only read the state of the runtime (or
+// queue a write to the image), which run without waiting for the others
 //-----------------------------------------------------------------------------
-void processCommand(unsigned char *buffer, int client_fd)
+static bool isConcurrentCommand(const char *command)
 {
-    char log_msg[1200];
-    int count_char = 0;
+    static const char *concurrent_commands[] = {
+        "ping()", "exec_time()", "runtime_logs()", "runtime_events(", "scan_profile()", "lock_profile()",
+        "pou_profile()", "sample_profile()", "rate_limits()", "scan_scheduler()", "event_tasks()",
+        "redundancy_status()", "modbus_master_stats()", "s7_master_stats()", "network_variables_stats()",
+        "event_trace_status()", "input_record_status()", "historian_query(", "tag_info(", "tag_at(",
+        "monitor_subscribe(", "monitor_write(", "variables_read(", "variables_write(", NULL
+    };
 
-    if (processing_command)
+    for (int i = 0; concurrent_commands[i] != NULL; i++)
     {
-        count_char = sprintf(buffer, "Processing command...\n");
-        write(client_fd, buffer, count_char);
-        return;
+        if (strncmp(command, concurrent_commands[i], strlen(concurrent_commands[i])) == 0) return true;
     }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+// Runs one of the commands of the interactive server
+//-----------------------------------------------------------------------------
+static void runCommand(unsigned char *buffer, InteractiveClient *client)
+{
+    char log_msg[1200];
+    int count_char = 0;
 
     if (strncmp(buffer, "quit()", 6) == 0)
     {
-        processing_command = true;
         sprintf(log_msg, "Issued quit() command\n");
         openplc_log(log_msg);
         if (run_modbus)
@@ -273,6 +504,14 @@ void processCommand(unsigned char *buffer, int client_fd)
             sprintf(log_msg, "Modbus server was stopped\n");
             openplc_log(log_msg);
         }
+        if (run_modbus_udp)
+        {
+            run_modbus_udp = 0;
+            pthread_join(modbus_udp_thread, NULL);
+            sprintf(log_msg, "Modbus/UDP server was stopped\n");
+            openplc_log(log_msg);
+        }
+        stopModbusRtuThread();
         if (run_dnp3)
         {
             run_dnp3 = 0;
@@ -287,12 +526,17 @@ void processCommand(unsigned char *buffer, int client_fd)
             sprintf(log_msg, "Snap7 server was stopped\n");
             openplc_log(log_msg);
         }
+        if (run_mqtt)
+        {
+            run_mqtt = 0;
+            stopMqtt();
+            sprintf(log_msg, "MQTT client was stopped\n");
+            openplc_log(log_msg);
+        }
         run_openplc = 0;
-        processing_command = false;
     }
     else if (strncmp(buffer, "start_ethercat(", 15) == 0)
     {
-        processing_command = true;
         char *argument;
         argument = readCommandArgumentStr(buffer);
         strcpy(ethercat_conf_file, argument);
@@ -301,11 +545,9 @@ void processCommand(unsigned char *buffer, int client_fd)
         openplc_log(log_msg);
         //Configure ethercat
         ethercat_configured = configureEthercat();
-        processing_command = false;
     }
     else if (strncmp(buffer, "start_modbus(", 13) == 0)
     {
-        processing_command = true;
         modbus_port = readCommandArgument(buffer);
         sprintf(log_msg, "Issued start_modbus() command to start on port: %d\n", modbus_port);
         openplc_log(log_msg);
@@ -322,11 +564,9 @@ void processCommand(unsigned char *buffer, int client_fd)
         //Start Modbus server
         run_modbus = 1;
         pthread_create(&modbus_thread, NULL, modbusThread, NULL);
-        processing_command = false;
     }
     else if (strncmp(buffer, "stop_modbus()", 13) == 0)
     {
-        processing_command = true;
         sprintf(log_msg, "Issued stop_modbus() command\n");
         openplc_log(log_msg);
         if (run_modbus)
@@ -336,11 +576,54 @@ void processCommand(unsigned char *buffer, int client_fd)
             sprintf(log_msg, "Modbus server was stopped\n");
             openplc_log(log_msg);
         }
-        processing_command = false;
+    }
+    else if (strncmp(buffer, "start_modbus_udp(", 17) == 0)
+    {
+        modbus_udp_port = readCommandArgument(buffer);
+        sprintf(log_msg, "Issued start_modbus_udp() command to start on port: %d\n", modbus_udp_port);
+        openplc_log(log_msg);
+        if (run_modbus_udp)
+        {
+            sprintf(log_msg, "Modbus/UDP server already active. Restarting on port: %d\n", modbus_udp_port);
+            openplc_log(log_msg);
+            run_modbus_udp = 0;
+            pthread_join(modbus_udp_thread, NULL);
+        }
+        run_modbus_udp = 1;
+        pthread_create(&modbus_udp_thread, NULL, modbusUdpThread, NULL);
+    }
+    else if (strncmp(buffer, "stop_modbus_udp()", 17) == 0)
+    {
+        sprintf(log_msg, "Issued stop_modbus_udp() command\n");
+        openplc_log(log_msg);
+        if (run_modbus_udp)
+        {
+            run_modbus_udp = 0;
+            pthread_join(modbus_udp_thread, NULL);
+            sprintf(log_msg, "Modbus/UDP server was stopped\n");
+            openplc_log(log_msg);
+        }
+    }
+    else if (strncmp(buffer, "start_modbus_rtu(", 17) == 0)
+    {
+        char *argument;
+        argument = readCommandArgumentStr(buffer);
+        sprintf(log_msg, "Issued start_modbus_rtu() command to start on port: %s\n", argument);
+        openplc_log(log_msg);
+        stopModbusRtuThread();
+        strcpy(modbus_rtu_config, argument);
+        free(argument);
+        run_modbus_rtu = 1;
+        pthread_create(&modbus_rtu_thread, NULL, modbusRtuThread, NULL);
+    }
+    else if (strncmp(buffer, "stop_modbus_rtu()", 17) == 0)
+    {
+        sprintf(log_msg, "Issued stop_modbus_rtu() command\n");
+        openplc_log(log_msg);
+        stopModbusRtuThread();
     }
     else if (strncmp(buffer, "start_snap7()", 13) == 0)
     {
-        processing_command = true;
         sprintf(log_msg, "Issued start_snap7() command\n");
         openplc_log(log_msg);
         if (run_snap7)
@@ -356,11 +639,9 @@ void processCommand(unsigned char *buffer, int client_fd)
         //Start Modbus server
         run_snap7 = 1;
         startSnap7();
-        processing_command = false;
     }
     else if (strncmp(buffer, "stop_snap7()", 12) == 0)
     {
-        processing_command = true;
         sprintf(log_msg, "Issued stop_snap7() command\n");
         openplc_log(log_msg);
         if (run_snap7)
@@ -370,11 +651,37 @@ void processCommand(unsigned char *buffer, int client_fd)
             sprintf(log_msg, "Snap7 server was stopped\n");
             openplc_log(log_msg);
         }
-        processing_command = false;
+    }
+    else if (strncmp(buffer, "start_mqtt()", 12) == 0)
+    {
+        sprintf(log_msg, "Issued start_mqtt() command\n");
+        openplc_log(log_msg);
+        if (run_mqtt)
+        {
+            sprintf(log_msg, "MQTT client already active. Restarting it\n");
+            openplc_log(log_msg);
+            run_mqtt = 0;
+            stopMqtt();
+            sprintf(log_msg, "MQTT client was stopped\n");
+            openplc_log(log_msg);
+        }
+        run_mqtt = 1;
+        startMqtt();
+    }
+    else if (strncmp(buffer, "stop_mqtt()", 11) == 0)
+    {
+        sprintf(log_msg, "Issued stop_mqtt() command\n");
+        openplc_log(log_msg);
+        if (run_mqtt)
+        {
+            run_mqtt = 0;
+            stopMqtt();
+            sprintf(log_msg, "MQTT client was stopped\n");
+            openplc_log(log_msg);
+        }
     }
     else if (strncmp(buffer, "start_dnp3(", 11) == 0)
     {
-        processing_command = true;
         dnp3_port = readCommandArgument(buffer);
         sprintf(log_msg, "Issued start_dnp3() command to start on port: %d\n", dnp3_port);
         openplc_log(log_msg);
@@ -391,11 +698,9 @@ void processCommand(unsigned char *buffer, int client_fd)
         //Start DNP3 server
         run_dnp3 = 1;
         pthread_create(&dnp3_thread, NULL, dnp3Thread, NULL);
-        processing_command = false;
     }
     else if (strncmp(buffer, "stop_dnp3()", 11) == 0)
     {
-        processing_command = true;
         sprintf(log_msg, "Issued stop_dnp3() command\n");
         openplc_log(log_msg);
         if (run_dnp3)
@@ -405,11 +710,9 @@ void processCommand(unsigned char *buffer, int client_fd)
             sprintf(log_msg, "DNP3 server was stopped\n");
             openplc_log(log_msg);
         }
-        processing_command = false;
     }
     else if (strncmp(buffer, "start_enip(", 11) == 0)
     {
-        processing_command = true;
         enip_port = readCommandArgument(buffer);
         sprintf(log_msg, "Issued start_enip() command to start on port: %d\n", enip_port);
         openplc_log(log_msg);
@@ -426,11 +729,9 @@ void processCommand(unsigned char *buffer, int client_fd)
         //Start Enip server
         run_enip = 1;
         pthread_create(&enip_thread, NULL, enipThread, NULL);
-        processing_command = false;
     }
     else if (strncmp(buffer, "stop_enip()", 11) == 0)
     {
-        processing_command = true;
         sprintf(log_msg, "Issued stop_enip() command\n");
         openplc_log(log_msg);
         if (run_enip)
@@ -440,14 +741,17 @@ void processCommand(unsigned char *buffer, int client_fd)
             sprintf(log_msg, "EtherNet/IP server was stopped\n");
             openplc_log(log_msg);
         }
-        processing_command = false;
     }
     else if (strncmp(buffer, "start_opcua(", 12) == 0)
     {
-        processing_command = true;
         opcua_port = readCommandArgument(buffer);
         sprintf(log_msg, "Issued start_opcua() command on port: %d\n", opcua_port);
         openplc_log(log_msg);
+        // Server settings may follow the port: start_opcua(4840,max_sessions=200,...)
+        unsigned char *arguments = readCommandArgumentStr(buffer);
+        char *settings = strchr((char *)arguments, ',');
+        setOpcuaTuning(settings ? settings + 1 : "");
+        free(arguments);
         if (run_opcua)
         {
             sprintf(log_msg, "OPC UA server already active. Restarting on port: %d\n", opcua_port);
@@ -462,11 +766,218 @@ void processCommand(unsigned char *buffer, int client_fd)
         //Start OPC UA server
         run_opcua = 1;
         pthread_create(&opcua_thread, NULL, opcuaThread, NULL);
-        processing_command = false;
+    }
+    else if (strncmp(buffer, "opcua_data_source(", 18) == 0)
+    {
+        int enabled = readCommandArgument(buffer);
+        sprintf(log_msg, "Issued opcua_data_source() command: %s\n", enabled ? "enabled" : "disabled");
+        openplc_log(log_msg);
+        setOpcuaDataSourceMode(enabled != 0);
+    }
+    else if (strncmp(buffer, "opcua_security(", 15) == 0)
+    {
+        char *settings = readCommandArgumentStr(buffer);
+        sprintf(log_msg, "Issued opcua_security() command\n");
+        openplc_log(log_msg);
+        setOpcuaSecurity(settings);
+        free(settings);
+    }
+    else if (strncmp(buffer, "lock_profiling(", 15) == 0)
+    {
+        int enabled = readCommandArgument(buffer);
+        sprintf(log_msg, "Issued lock_profiling() command: %s\n", enabled ? "enabled" : "disabled");
+        openplc_log(log_msg);
+        setLockProfiling(enabled != 0);
+    }
+    else if (strncmp(buffer, "pou_profile_reset()", 19) == 0)
+    {
+        sprintf(log_msg, "Issued pou_profile_reset() command\n");
+        openplc_log(log_msg);
+        resetPouProfile();
+    }
+    else if (strncmp(buffer, "sample_profile_start(", 21) == 0)
+    {
+        int hz = readCommandArgument(buffer);
+        sprintf(log_msg, "Issued sample_profile_start() command: %d Hz\n", hz);
+        openplc_log(log_msg);
+        startSampleProfile(hz);
+    }
+    else if (strncmp(buffer, "sample_profile_stop()", 21) == 0)
+    {
+        sprintf(log_msg, "Issued sample_profile_stop() command\n");
+        openplc_log(log_msg);
+        stopSampleProfile();
+    }
+    else if (strncmp(buffer, "opcua_scan_sampling(", 20) == 0)
+    {
+        int decimation = readCommandArgument(buffer);
+        sprintf(log_msg, "Issued opcua_scan_sampling() command: %d\n", decimation);
+        openplc_log(log_msg);
+        setOpcuaScanSampling(decimation);
+    }
+    else if (strncmp(buffer, "modbus_response_cache(", 22) == 0)
+    {
+        int enabled = readCommandArgument(buffer);
+        sprintf(log_msg, "Issued modbus_response_cache() command: %s\n", enabled ? "enabled" : "disabled");
+        openplc_log(log_msg);
+        setModbusResponseCache(enabled != 0);
+    }
+    else if (strncmp(buffer, "scan_overrun_policy(", 20) == 0)
+    {
+        int policy = readCommandArgument(buffer);
+        sprintf(log_msg, "Issued scan_overrun_policy() command: %d\n", policy);
+        openplc_log(log_msg);
+        setScanOverrunPolicy(policy);
+    }
+    else if (strncmp(buffer, "load_shedding(", 14) == 0)
+    {
+        int overruns = readCommandArgument(buffer);
+        sprintf(log_msg, "Issued load_shedding() command: %d\n", overruns);
+        openplc_log(log_msg);
+        setLoadShedding(overruns);
+    }
+    else if (strncmp(buffer, "scan_phase_order(", 17) == 0)
+    {
+        int order = readCommandArgument(buffer);
+        sprintf(log_msg, "Issued scan_phase_order() command: %d\n", order);
+        openplc_log(log_msg);
+        setScanPhaseOrder(order);
+    }
+    else if (strncmp(buffer, "virtual_time(", 13) == 0)
+    {
+        int enabled = readCommandArgument(buffer);
+        sprintf(log_msg, "Issued virtual_time() command: %d\n", enabled);
+        openplc_log(log_msg);
+        setVirtualTime(enabled > 0);
+    }
+    else if (strncmp(buffer, "scan_watchdog(", 14) == 0)
+    {
+        int timeout = readCommandArgument(buffer);
+        sprintf(log_msg, "Issued scan_watchdog() command: %d ms\n", timeout);
+        openplc_log(log_msg);
+        setScanWatchdog(timeout);
+    }
+    else if (strncmp(buffer, "online_change(", 14) == 0)
+    {
+        char *argument;
+        argument = readCommandArgumentStr(buffer);
+        sprintf(log_msg, "Issued online_change() command: %s\n", argument);
+        openplc_log(log_msg);
+        int result = loadOnlineChange(argument);
+        free(argument);
+        if (result == 0)
+            count_char = sprintf(buffer, "OK\n");
+        else
+            count_char = sprintf(buffer, "Error: online change failed\n");
+        sendReply(client, buffer, count_char);
+        return;
+    }
+    else if (strncmp(buffer, "reload_modbus_master(", 21) == 0)
+    {
+        sprintf(log_msg, "Issued reload_modbus_master() command\n");
+        openplc_log(log_msg);
+        if (reloadMB() == 0)
+            count_char = sprintf(buffer, "OK\n");
+        else
+            count_char = sprintf(buffer, "Error: the new Modbus master devices were not applied\n");
+        sendReply(client, buffer, count_char);
+        return;
+    }
+    else if (strncmp(buffer, "state_export(", 13) == 0)
+    {
+        char *argument;
+        argument = readCommandArgumentStr(buffer);
+        sprintf(log_msg, "Issued state_export() command: %s\n", argument);
+        openplc_log(log_msg);
+        int result = exportPlcState(argument);
+        free(argument);
+        if (result == 0)
+            count_char = sprintf(buffer, "OK\n");
+        else
+            count_char = sprintf(buffer, "Error: state export failed\n");
+        sendReply(client, buffer, count_char);
+        return;
+    }
+    else if (strncmp(buffer, "state_import(", 13) == 0)
+    {
+        char *argument;
+        argument = readCommandArgumentStr(buffer);
+        sprintf(log_msg, "Issued state_import() command: %s\n", argument);
+        openplc_log(log_msg);
+        int result = importPlcState(argument);
+        free(argument);
+        if (result == 0)
+            count_char = sprintf(buffer, "OK\n");
+        else
+            count_char = sprintf(buffer, "Error: state import failed\n");
+        sendReply(client, buffer, count_char);
+        return;
+    }
+    else if (strncmp(buffer, "start_event_trace(", 18) == 0)
+    {
+        int freeze_us = readCommandArgument(buffer);
+        sprintf(log_msg, "Issued start_event_trace() command to freeze over %d us\n", freeze_us);
+        openplc_log(log_msg);
+        startEventTrace(freeze_us > 0 ? freeze_us : 0);
+    }
+    else if (strncmp(buffer, "stop_event_trace()", 18) == 0)
+    {
+        sprintf(log_msg, "Issued stop_event_trace() command\n");
+        openplc_log(log_msg);
+        stopEventTrace();
+    }
+    else if (strncmp(buffer, "event_trace_dump(", 17) == 0)
+    {
+        char *argument;
+        argument = readCommandArgumentStr(buffer);
+        sprintf(log_msg, "Issued event_trace_dump() command: %s\n", argument);
+        openplc_log(log_msg);
+        int result = dumpEventTrace(argument);
+        free(argument);
+        if (result == 0)
+            count_char = sprintf(buffer, "OK\n");
+        else
+            count_char = sprintf(buffer, "Error: event trace dump failed\n");
+        sendReply(client, buffer, count_char);
+        return;
+    }
+    else if (strncmp(buffer, "event_trace_status()", 20) == 0)
+    {
+        char status[512];
+        count_char = getEventTraceStatus(status, sizeof(status));
+        sendReply(client, status, count_char);
+        return;
+    }
+    else if (strncmp(buffer, "start_input_record(", 19) == 0)
+    {
+        char *argument;
+        argument = readCommandArgumentStr(buffer);
+        sprintf(log_msg, "Issued start_input_record() command: %s\n", argument);
+        openplc_log(log_msg);
+        int result = startInputRecord(argument);
+        free(argument);
+        if (result == 0)
+            count_char = sprintf(buffer, "OK\n");
+        else
+            count_char = sprintf(buffer, "Error: input record failed\n");
+        sendReply(client, buffer, count_char);
+        return;
+    }
+    else if (strncmp(buffer, "stop_input_record()", 19) == 0)
+    {
+        sprintf(log_msg, "Issued stop_input_record() command\n");
+        openplc_log(log_msg);
+        stopInputRecord();
+    }
+    else if (strncmp(buffer, "input_record_status()", 21) == 0)
+    {
+        char status[1200];
+        count_char = getInputRecordStatus(status, sizeof(status));
+        sendReply(client, status, count_char);
+        return;
     }
     else if (strncmp(buffer, "stop_opcua()", 12) == 0)
     {
-        processing_command = true;
         sprintf(log_msg, "Issued stop_opcua() command\n");
         openplc_log(log_msg);
         if (run_opcua)
@@ -478,11 +989,9 @@ void processCommand(unsigned char *buffer, int client_fd)
             sprintf(log_msg, "OPC UA server was stopped\n");
             openplc_log(log_msg);
         }
-        processing_command = false;
     }
     else if (strncmp(buffer, "start_pstorage(", 15) == 0)
     {
-        processing_command = true;
         pstorage_polling = readCommandArgument(buffer);
         sprintf(log_msg, "Issued start_pstorage() command with polling rate of %d seconds\n", pstorage_polling);
         openplc_log(log_msg);
@@ -494,11 +1003,16 @@ void processCommand(unsigned char *buffer, int client_fd)
         //Start Enip server
         run_pstorage = 1;
         pthread_create(&pstorage_thread, NULL, pstorageThread, NULL);
-        processing_command = false;
+    }
+    else if (strncmp(buffer, "pstorage_retain(", 16) == 0)
+    {
+        int enabled = readCommandArgument(buffer);
+        sprintf(log_msg, "Issued pstorage_retain() command: %s\n", enabled ? "enabled" : "disabled");
+        openplc_log(log_msg);
+        setPstorageRetain(enabled != 0);
     }
     else if (strncmp(buffer, "stop_pstorage()", 15) == 0)
     {
-        processing_command = true;
         sprintf(log_msg, "Issued stop_pstorage() command\n");
         openplc_log(log_msg);
         if (run_pstorage)
@@ -507,55 +1021,387 @@ void processCommand(unsigned char *buffer, int client_fd)
             sprintf(log_msg, "Persistent Storage thread was stopped\n");
             openplc_log(log_msg);
         }
-        processing_command = false;
     }
     else if (strncmp(buffer, "runtime_logs()", 14) == 0)
     {
-        processing_command = true;
         printf("Issued runtime_logs() command\n");
-        write(client_fd, log_buffer, log_index);
-        processing_command = false;
+        sendLogText(sendReply, client);
+        return;
+    }
+    else if (strncmp(buffer, "runtime_events(", 15) == 0)
+    {
+        uint64_t cursor = strtoull((char *)buffer + 15, NULL, 10);
+        sendLogEvents(sendReply, client, cursor, MAX_LOG_EVENTS_PER_REQUEST);
         return;
     }
+    else if (strncmp(buffer, "scan_profile()", 14) == 0)
+    {
+        char profile[4096];
+        count_char = getScanProfile(profile, sizeof(profile));
+        sendReply(client, profile, count_char);
+        return;
+    }
+    else if (strncmp(buffer, "lock_profile()", 14) == 0)
+    {
+        char profile[8192];
+        count_char = getLockProfile(profile, sizeof(profile));
+        sendReply(client, profile, count_char);
+        return;
+    }
+    else if (strncmp(buffer, "pou_profile()", 13) == 0)
+    {
+        char *profile = (char *)malloc(65536);
+        count_char = getPouProfile(profile, 65536);
+        sendReply(client, profile, count_char);
+        free(profile);
+        return;
+    }
+    else if (strncmp(buffer, "sample_profile()", 16) == 0)
+    {
+        char *profile = (char *)malloc(65536);
+        count_char = getSampleProfile(profile, 65536);
+        sendReply(client, profile, count_char);
+        free(profile);
+        return;
+    }
+    else if (strncmp(buffer, "rate_limits()", 13) == 0)
+    {
+        char stats[4096];
+        count_char = getRateLimitStats(stats, sizeof(stats));
+        sendReply(client, stats, count_char);
+        return;
+    }
+    else if (strncmp(buffer, "scan_scheduler()", 16) == 0)
+    {
+        char stats[1024];
+        count_char = getSchedulerStats(stats, sizeof(stats));
+        sendReply(client, stats, count_char);
+        return;
+    }
+    else if (strncmp(buffer, "thread_stats()", 14) == 0)
+    {
+        char *stats = (char *)malloc(65536);
+        count_char = getThreadStats(stats, 65536);
+        sendReply(client, stats, count_char);
+        free(stats);
+        return;
+    }
+    else if (strncmp(buffer, "event_tasks()", 13) == 0)
+    {
+        char stats[1024];
+        count_char = getEventTaskStats(stats, sizeof(stats));
+        sendReply(client, stats, count_char);
+        return;
+    }
+    else if (strncmp(buffer, "redundancy_status()", 19) == 0)
+    {
+        char status[1024];
+        count_char = getRedundancyStatus(status, sizeof(status));
+        sendReply(client, status, count_char);
+        return;
+    }
+    else if (strncmp(buffer, "modbus_master_stats()", 21) == 0)
+    {
+        sendMBStats(sendReply, client);
+        return;
+    }
+    else if (strncmp(buffer, "s7_master_stats()", 17) == 0)
+    {
+        sendS7MasterStats(sendReply, client);
+        return;
+    }
+    else if (strncmp(buffer, "network_variables_stats()", 25) == 0)
+    {
+        sendNetworkVariableStats(sendReply, client);
+        return;
+    }
+    else if (strncmp(buffer, "historian_query(", 16) == 0)
+    {
+        char tag_name[64];
+        long long start, end;
+        int max_points;
+        if (sscanf((char *)buffer + 16, "%63[^,],%lld,%lld,%d", tag_name, &start, &end, &max_points) == 4 && start <= end)
+        {
+            sendHistorianQuery(sendReply, client, tag_name, start, end, max_points);
+        }
+        else
+        {
+            count_char = sprintf(buffer, "Error: invalid historian query\n");
+            sendReply(client, buffer, count_char);
+        }
+        return;
+    }
+    else if (strncmp(buffer, "tag_info(", 9) == 0)
+    {
+        char tag_name[128];
+        char reply[1024];
+        const Tag *tag = NULL;
+        if (sscanf((char *)buffer + 9, "%127[^)]", tag_name) == 1) tag = findTag(tag_name);
+        if (tag != NULL)
+            count_char = formatTag(tag, reply, sizeof(reply));
+        else
+            count_char = sprintf(reply, "Error: no such tag\n");
+        sendReply(client, reply, count_char);
+        return;
+    }
+    else if (strncmp(buffer, "tag_at(", 7) == 0)
+    {
+        //tag_at(protocol,table,address[.bit]), e.g. tag_at(modbus,3,1025) or
+        //tag_at(s7,130,0.3) for %QX0.3 on the PA area
+        static const char *protocols[PROTOCOL_TYPES] = { "modbus", "dnp3", "enip", "opcua", "s7" };
+        char protocol_name[16];
+        unsigned int table = 0, address = 0, bit = 0;
+        char reply[1024];
+        const Tag *tag = NULL;
+        uint32_t element = 0;
+        if (sscanf((char *)buffer + 7, "%15[^,],%u,%u.%u", protocol_name, &table, &address, &bit) >= 3)
+        {
+            for (int protocol = 0; protocol < PROTOCOL_TYPES; protocol++)
+            {
+                if (strcmp(protocol_name, protocols[protocol]) == 0)
+                    tag = findTagAt(protocol, (uint16_t)table, address, (uint8_t)bit, &element);
+            }
+        }
+        if (tag != NULL)
+        {
+            count_char = sprintf(reply, "element=%u\n", element);
+            count_char += formatTag(tag, reply + count_char, sizeof(reply) - count_char);
+        }
+        else
+        {
+            count_char = sprintf(reply, "Error: no tag at the address\n");
+        }
+        sendReply(client, reply, count_char);
+        return;
+    }
+    else if (strncmp(buffer, "variables_read(", 15) == 0)
+    {
+        //variables_read(name,name,...), names of program variables (e.g.
+        //CONFIG0.RES0.INSTANCE0.COUNT) or tags, all read on the same scan
+        char *names = (char *)buffer + 15;
+        char *end = strrchr(names, ')');
+        if (end != NULL) *end = '\0';
+        sendVariableValues(sendReply, client, names);
+        return;
+    }
+    else if (strncmp(buffer, "variables_write(", 16) == 0)
+    {
+        //variables_write(name=value,name=value,...), all written on the same
+        //scan or none of them
+        char *assignments = (char *)buffer + 16;
+        char *end = strrchr(assignments, ')');
+        if (end != NULL) *end = '\0';
+        char error[256];
+        if (writeVariableValues(assignments, error, sizeof(error)) != 0)
+        {
+            sendReply(client, error, strlen(error));
+            return;
+        }
+    }
+    else if (strncmp(buffer, "monitor_subscribe(", 18) == 0)
+    {
+        //The stream lasts as long as the client wants it
+        sendMonitorStream(sendReply, client, client->fd, (char *)buffer + 18);
+        return;
+    }
+    else if (strncmp(buffer, "monitor_write(", 14) == 0)
+    {
+        char location[16];
+        unsigned long long value;
+        if (sscanf((char *)buffer + 14, "%15[^,],%llu", location, &value) != 2 || !writeMonitorPoint(location, value))
+        {
+            count_char = sprintf(buffer, "Error: invalid monitor write\n");
+            sendReply(client, buffer, count_char);
+            return;
+        }
+    }
     else if (strncmp(buffer, "exec_time()", 11) == 0)
     {
-        processing_command = true;
         time(&end_time);
         count_char = sprintf(buffer, "%llu\n", (unsigned long long)difftime(end_time, start_time));
-        write(client_fd, buffer, count_char);
-        processing_command = false;
+        sendReply(client, buffer, count_char);
         return;
     }
+    else if (strncmp(buffer, "ping()", 6) == 0)
+    {
+        //Liveness check, just answers OK
+    }
     else
     {
-        processing_command = true;
         count_char = sprintf(buffer, "Error: unrecognized command\n");
-        write(client_fd, buffer, count_char);
-        processing_command = false;
+        sendReply(client, buffer, count_char);
         return;
     }
 
     count_char = sprintf(buffer, "OK\n");
-    write(client_fd, buffer, count_char);
+    sendReply(client, buffer, count_char);
+}
+
+//-----------------------------------------------------------------------------
+// Process client's commands for the interactive server. The commands that
+// change the runtime wait for the one running, if any
+//-----------------------------------------------------------------------------
+void processCommand(unsigned char *buffer, InteractiveClient *client)
+{
+    if (isConcurrentCommand((char *)buffer))
+    {
+        runCommand(buffer, client);
+        return;
+    }
+
+    pthread_mutex_lock(&controlLock);
+    runCommand(buffer, client);
+    pthread_mutex_unlock(&controlLock);
 }
 
 //-----------------------------------------------------------------------------
-// Process client's request
+// Process client's request. The command is collected on the buffer of the
+// connection until the end of the line
 //-----------------------------------------------------------------------------
-void processMessage_interactive(unsigned char *buffer, int bufferSize, int client_fd)
+void processMessage_interactive(unsigned char *buffer, int bufferSize, InteractiveClient *client, unsigned char *command, int *command_index)
 {
     for (int i = 0; i < bufferSize; i++)
     {
-        if (buffer[i] == '\r' || buffer[i] == '\n' || command_index >= 1024)
+        if (buffer[i] == '\r' || buffer[i] == '\n' || *command_index >= 1024)
+        {
+            processCommand(command, client);
+            *command_index = 0;
+            break;
+        }
+        command[*command_index] = buffer[i];
+        (*command_index)++;
+        command[*command_index] = '\0';
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Ends the response to a framed request
+//-----------------------------------------------------------------------------
+static int sendEndFrame(InteractiveClient *client)
+{
+    unsigned char header[RPC_HEADER_SIZE];
+    packFrameHeader(header, RPC_END, client->request_id, 0);
+    pthread_mutex_lock(&client->connection->writeLock);
+    int result = writeAll_interactive(client->fd, header, sizeof(header));
+    pthread_mutex_unlock(&client->connection->writeLock);
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+// Thread running one framed request
+//-----------------------------------------------------------------------------
+static void *requestThread(void *arg)
+{
+    setThreadClass(THREAD_CLASS_BACKGROUND, "interactive_req");
+
+    InteractiveRequest *request = (InteractiveRequest *)arg;
+    InteractiveConnection *connection = request->client.connection;
+    processCommand(request->command, &request->client);
+    sendEndFrame(&request->client);
+    free(request);
+
+    pthread_mutex_lock(&connection->pendingLock);
+    connection->pending--;
+    pthread_cond_signal(&connection->pendingDone);
+    pthread_mutex_unlock(&connection->pendingLock);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Serves a client that sends framed requests, until it closes the connection.
+// Each request runs on its own thread and is answered once it is done, in
+// any order
+//-----------------------------------------------------------------------------
+static void handleFramedClient(InteractiveClient *client)
+{
+    unsigned char header[RPC_HEADER_SIZE];
+    char log_msg[1000];
+
+    // Replies are written as several small frames, don't let them wait on
+    // the peer's delayed ACK
+    int nodelay = 1;
+    setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    InteractiveConnection connection;
+    pthread_mutex_init(&connection.writeLock, NULL);
+    pthread_mutex_init(&connection.pendingLock, NULL);
+    pthread_cond_init(&connection.pendingDone, NULL);
+    connection.pending = 0;
+    client->connection = &connection;
+
+    while (run_openplc)
+    {
+        if (readAll_interactive(client->fd, header, sizeof(header)) < 0)
+        {
+            printf("Interactive Server: client ID: %d has closed the connection\n", client->fd);
+            break;
+        }
+
+        uint32_t length = header[4] | (header[5] << 8) | (header[6] << 16) | ((uint32_t)header[7] << 24);
+        if (header[0] != RPC_MAGIC || header[1] != RPC_REQUEST || length > RPC_MAX_REQUEST)
+        {
+            sprintf(log_msg, "Interactive Server: invalid request frame from client ID: %d\n", client->fd);
+            openplc_log(log_msg);
+            break;
+        }
+        // The replies of most commands are written over the command, which
+        // gets at least COMMAND_BUFFER_SIZE bytes
+        size_t command_size = (length > COMMAND_BUFFER_SIZE ? length : COMMAND_BUFFER_SIZE) + 1;
+        InteractiveRequest *request = (InteractiveRequest *)malloc(sizeof(InteractiveRequest) + command_size);
+        if (request == NULL) break;
+        request->command = (unsigned char *)(request + 1);
+        if (readAll_interactive(client->fd, request->command, length) < 0)
         {
-            processCommand(server_command, client_fd);
-            command_index = 0;
+            free(request);
             break;
         }
-        server_command[command_index] = buffer[i];
-        command_index++;
-        server_command[command_index] = '\0';
+        request->command[length] = '\0';
+        request->client = *client;
+        request->client.request_id = header[2] | (header[3] << 8);
+
+        // A monitor stream ends when the client sends anything, so it can't
+        // run while the next requests are read
+        if (strncmp((char *)request->command, "monitor_subscribe(", 18) == 0)
+        {
+            processCommand(request->command, &request->client);
+            int result = sendEndFrame(&request->client);
+            free(request);
+            if (result < 0) break;
+            continue;
+        }
+
+        pthread_mutex_lock(&connection.pendingLock);
+        while (connection.pending >= RPC_MAX_PENDING)
+        {
+            pthread_cond_wait(&connection.pendingDone, &connection.pendingLock);
+        }
+        connection.pending++;
+        pthread_mutex_unlock(&connection.pendingLock);
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, requestThread, request) == 0)
+        {
+            pthread_detach(thread);
+        }
+        else
+        {
+            requestThread(request);
+        }
     }
+
+    // The requests still running write to the socket, wait for them before
+    // it is closed
+    pthread_mutex_lock(&connection.pendingLock);
+    while (connection.pending > 0)
+    {
+        pthread_cond_wait(&connection.pendingDone, &connection.pendingLock);
+    }
+    pthread_mutex_unlock(&connection.pendingLock);
+
+    pthread_cond_destroy(&connection.pendingDone);
+    pthread_mutex_destroy(&connection.pendingLock);
+    pthread_mutex_destroy(&connection.writeLock);
+    client->connection = NULL;
 }
 
 //-----------------------------------------------------------------------------
@@ -563,12 +1409,32 @@ void processMessage_interactive(unsigned char *buffer, int bufferSize, int clien
 //-----------------------------------------------------------------------------
 void *handleConnections_interactive(void *arguments)
 {
+    setThreadClass(THREAD_CLASS_BACKGROUND, "interactive_cli");
+
     int client_fd = *(int *)arguments;
     unsigned char buffer[1024];
     int messageSize;
+    unsigned char command[COMMAND_BUFFER_SIZE + 1];
+    int command_index = 0;
 
     printf("Interactive Server: Thread created for client ID: %d\n", client_fd);
 
+    InteractiveClient client;
+    client.fd = client_fd;
+    client.framed = false;
+    client.request_id = 0;
+    client.connection = NULL;
+
+    //The first byte tells which protocol the client speaks
+    unsigned char first_byte;
+    if (recv(client_fd, &first_byte, 1, MSG_PEEK) == 1 && first_byte == RPC_MAGIC)
+    {
+        client.framed = true;
+        handleFramedClient(&client);
+        closeSocket(client_fd);
+        pthread_exit(NULL);
+    }
+
     while(run_openplc)
     {
         //unsigned char buffer[1024];
@@ -589,7 +1455,7 @@ void *handleConnections_interactive(void *arguments)
             break;
         }
 
-        processMessage_interactive(buffer, messageSize, client_fd);
+        processMessage_interactive(buffer, messageSize, &client, command, &command_index);
     }
     //printf("Debug: Closing client socket and calling pthread_exit in interactive_server.cpp\n");
     closeSocket(client_fd);
@@ -639,6 +1505,12 @@ void startInteractiveServer(int port)
     run_enip = 0;
     run_opcua = 0;
     run_pstorage = 0;
+    stopModbusRtuThread();
+    if (run_modbus_udp)
+    {
+        run_modbus_udp = 0;
+        pthread_join(modbus_udp_thread, NULL);
+    }
     pthread_join(modbus_thread, NULL);
     pthread_join(dnp3_thread, NULL);
     pthread_join(enip_thread, NULL);
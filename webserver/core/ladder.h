@@ -25,15 +25,28 @@
 
 #include <pthread.h>
 #include <stdint.h>
+#include <atomic>
+
+#include "plc_program.h"
 
 #define MODBUS_PROTOCOL     0
 #define DNP3_PROTOCOL       1
 #define ENIP_PROTOCOL       2
 #define OPCUA_PROTOCOL      3
+#define S7_PROTOCOL         4
+#define PROTOCOL_TYPES      5
 
 //Internal buffers for I/O and memory. These buffers are defined in the
-//auto-generated glueVars.cpp file
+//auto-generated glueVars.cpp file. Their size comes from image_size.h, which
+//glue_generator writes next to glueVars.cpp for the program being built
+#if defined(__has_include)
+#if __has_include("image_size.h")
+#include "image_size.h"
+#endif
+#endif
+#ifndef BUFFER_SIZE
 #define BUFFER_SIZE		1024
+#endif
 /*********************/
 /*  IEC Types defs   */
 /*********************/
@@ -55,7 +68,13 @@ typedef uint16_t   IEC_WORD;
 typedef uint32_t   IEC_DWORD;
 typedef uint64_t   IEC_LWORD;
 
+#ifdef OPLC_FIXED_REAL
+//Fixed point REAL (scripts/fixed_real), the same type as the program's
+#include "iec_fixed.h"
+typedef iec_fixed IEC_REAL;
+#else
 typedef float    IEC_REAL;
+#endif
 typedef double   IEC_LREAL;
 
 //Booleans
@@ -96,17 +115,422 @@ extern IEC_LREAL *lreal_memory[BUFFER_SIZE];
 //Special Functions
 extern IEC_ULINT *special_functions[BUFFER_SIZE];
 
+//Contiguous images holding the located variables. Every pointer on the
+//buffers above points to its slot on these arrays
+extern IEC_BOOL bool_input_image[BUFFER_SIZE][8];
+extern IEC_BOOL bool_output_image[BUFFER_SIZE][8];
+extern IEC_BOOL bool_memory_image[BUFFER_SIZE][8];
+extern IEC_BYTE byte_input_image[BUFFER_SIZE];
+extern IEC_BYTE byte_output_image[BUFFER_SIZE];
+extern IEC_BYTE byte_memory_image[BUFFER_SIZE];
+extern IEC_UINT int_input_image[BUFFER_SIZE];
+extern IEC_UINT int_output_image[BUFFER_SIZE];
+extern IEC_UINT int_memory_image[BUFFER_SIZE];
+extern IEC_UDINT dint_input_image[BUFFER_SIZE];
+extern IEC_UDINT dint_output_image[BUFFER_SIZE];
+extern IEC_UDINT dint_memory_image[BUFFER_SIZE];
+extern IEC_ULINT lint_input_image[BUFFER_SIZE];
+extern IEC_ULINT lint_output_image[BUFFER_SIZE];
+extern IEC_ULINT lint_memory_image[2 * BUFFER_SIZE];
+extern IEC_REAL real_input_image[BUFFER_SIZE];
+extern IEC_REAL real_output_image[BUFFER_SIZE];
+extern IEC_REAL real_memory_image[BUFFER_SIZE];
+extern IEC_LREAL lreal_input_image[BUFFER_SIZE];
+extern IEC_LREAL lreal_output_image[BUFFER_SIZE];
+extern IEC_LREAL lreal_memory_image[BUFFER_SIZE];
+
+//Presence bitmaps for the located variables. Booleans use one byte per
+//address (one bit per index), the other areas one bit per entry
+extern IEC_BYTE bool_input_present[BUFFER_SIZE];
+extern IEC_BYTE bool_output_present[BUFFER_SIZE];
+extern IEC_BYTE byte_input_present[BUFFER_SIZE / 8];
+extern IEC_BYTE byte_output_present[BUFFER_SIZE / 8];
+extern IEC_BYTE int_input_present[BUFFER_SIZE / 8];
+extern IEC_BYTE int_output_present[BUFFER_SIZE / 8];
+extern IEC_BYTE dint_input_present[BUFFER_SIZE / 8];
+extern IEC_BYTE dint_output_present[BUFFER_SIZE / 8];
+extern IEC_BYTE lint_input_present[BUFFER_SIZE / 8];
+extern IEC_BYTE lint_output_present[BUFFER_SIZE / 8];
+extern IEC_BYTE real_input_present[BUFFER_SIZE / 8];
+extern IEC_BYTE real_output_present[BUFFER_SIZE / 8];
+extern IEC_BYTE lreal_input_present[BUFFER_SIZE / 8];
+extern IEC_BYTE lreal_output_present[BUFFER_SIZE / 8];
+extern IEC_BYTE int_memory_present[BUFFER_SIZE / 8];
+extern IEC_BYTE dint_memory_present[BUFFER_SIZE / 8];
+extern IEC_BYTE lint_memory_present[BUFFER_SIZE / 8];
+extern IEC_BYTE real_memory_present[BUFFER_SIZE / 8];
+extern IEC_BYTE lreal_memory_present[BUFFER_SIZE / 8];
+#define isPresent(bitmap, index) (((bitmap)[(index) / 8] >> ((index) % 8)) & 0x01)
+
 //lock for the buffer
 extern pthread_mutex_t bufferLock;
 
 //Common task timer
 extern unsigned long long common_ticktime__;
 
+//Published process image. A copy of the located variables taken once per
+//scan that the protocol servers can read without holding bufferLock. The
+//bool areas are also published bit-packed, byte i holding %IXi.0 to %IXi.7
+//(%QX for the outputs) from the lowest bit up, so readers that want bit
+//fields or the bools that toggled work on 8 or 64 of them at a time. Every
+//area starts on a cache line of its own, so the header the readers poll and
+//the areas are never on the same line, and every change block of the
+//snapshot is one cache line
+#define PI_CACHE_LINE       64
+//The variables of the program declared RETAIN are not located, the scan
+//packs their values on the retain area of the snapshots, in the order of the
+//variable table of the program (see buildImageRanges)
+#define RETAIN_MEMORY_SIZE  8192
+
+struct alignas(PI_CACHE_LINE) ProcessImageSnapshot
+{
+    std::atomic<uint32_t> sequence;
+    uint32_t version; //value of getProcessImageVersion() once it is published
+    uint64_t timestamp; //UTC time (ms) at which the scan published it
+    alignas(PI_CACHE_LINE) IEC_BOOL bool_input[BUFFER_SIZE][8];
+    alignas(PI_CACHE_LINE) IEC_BOOL bool_output[BUFFER_SIZE][8];
+    alignas(PI_CACHE_LINE) IEC_UINT int_input[BUFFER_SIZE];
+    alignas(PI_CACHE_LINE) IEC_UINT int_output[BUFFER_SIZE];
+    alignas(PI_CACHE_LINE) IEC_UINT int_memory[BUFFER_SIZE];
+    alignas(PI_CACHE_LINE) IEC_UDINT dint_memory[BUFFER_SIZE];
+    alignas(PI_CACHE_LINE) IEC_ULINT lint_memory[BUFFER_SIZE];
+    alignas(PI_CACHE_LINE) IEC_BYTE bool_input_bits[BUFFER_SIZE];
+    alignas(PI_CACHE_LINE) IEC_BYTE bool_output_bits[BUFFER_SIZE];
+    alignas(PI_CACHE_LINE) IEC_BYTE retain_memory[RETAIN_MEMORY_SIZE];
+};
+
+//Changes between two published versions of the process image. The scan
+//compares each snapshot with the previous one and sets one bit for every
+//PI_CHANGE_BLOCK bytes of ProcessImageSnapshot that differ, so the protocol
+//servers only look at the parts of the image that changed
+#define PI_CHANGE_BLOCK     64
+#define PI_CHANGE_WORDS     ((sizeof(ProcessImageSnapshot) + PI_CHANGE_BLOCK * 64 - 1) / (PI_CHANGE_BLOCK * 64))
+struct ProcessImageChanges
+{
+    uint64_t dirty[PI_CHANGE_WORDS];
+};
+
+//Entries of a memory area (%MW, %MD, %ML) located by the program, built from
+//the presence bitmaps every time glueVars runs. Gaps of up to
+//IMAGE_RANGE_MERGE_GAP entries are merged, so the ranges are copied in bulk.
+//Only the ranges are published on the snapshots, the entries out of them
+//read as zero
+#define IMAGE_RANGE_MERGE_GAP   8
+#define IMAGE_RANGE_MAX         (BUFFER_SIZE / (IMAGE_RANGE_MERGE_GAP + 2) + 1)
+struct ImageRange
+{
+    uint32_t first;
+    uint32_t count;
+};
+struct ImageRanges
+{
+    int count;
+    uint32_t used;      //entries located on the area
+    ImageRange ranges[IMAGE_RANGE_MAX];
+};
+
+//Runtime tag database (tag_database.cpp). Every located variable of the
+//program is a tag, with its address on each protocol. The tables of the
+//addresses are the Modbus object types, the DNP3 static groups, the PCCC
+//file types (ENIP), the S7 areas or the number of the S7 DB and the OPC UA
+//namespace of the program nodes
+#define TAG_MODBUS_COILS            1
+#define TAG_MODBUS_DISCRETE_INPUTS  2
+#define TAG_MODBUS_HOLDING_REGS     3
+#define TAG_MODBUS_INPUT_REGS       4
+#define TAG_DNP3_BINARY_INPUTS      1
+#define TAG_DNP3_BINARY_OUTPUTS     10
+#define TAG_DNP3_ANALOG_INPUTS      30
+#define TAG_DNP3_ANALOG_OUTPUTS     40
+#define TAG_PCCC_OUTPUT_FILE        0x8b
+#define TAG_PCCC_INPUT_FILE         0x8c
+#define TAG_PCCC_INTEGER_FILE       0x89
+#define TAG_PCCC_LONG_FILE          0x91
+#define TAG_S7_PE                   0x81
+#define TAG_S7_PA                   0x82
+#define TAG_OPCUA_PROGRAM_NODES     1
+
+#define TAG_TYPE_BOOL               0
+#define TAG_TYPE_UNSIGNED           1
+#define TAG_TYPE_SIGNED             2
+#define TAG_TYPE_REAL               3
+
+struct TagAddress
+{
+    uint16_t table;         //0 if the protocol doesn't reach the tag
+    uint8_t bit;            //bit of a boolean on the byte or element
+    uint32_t address;       //register, point, element, byte or node id
+};
+
+struct Tag
+{
+    const char *name;
+    char location[16];      //location of the first entry, e.g. %QX0.1
+    char area;              //I, Q or M
+    char size;              //X, B, W, D, L, R or F
+    uint8_t type;           //TAG_TYPE_*
+    uint32_t position;      //entry on the area, byte * 8 + bit for booleans
+    uint32_t count;         //consecutive entries, more than 1 for an array
+    void *value;            //first entry on the images
+    int32_t image_offset;   //offset on ProcessImageSnapshot, -1 if not published
+    double deadband;        //engineering units
+    double scale;           //engineering value = raw * scale + offset
+    double offset;
+    TagAddress address[PROTOCOL_TYPES];    //of the first entry
+};
+
+//Phases of the scan cycle measured by the scan profiler
+#define PROFILE_INPUTS              0
+#define PROFILE_LOCK_WAIT           1
+#define PROFILE_ETHERCAT            2
+#define PROFILE_MB_INPUTS           3
+#define PROFILE_PROTOCOL_WRITES     4
+#define PROFILE_SPECIAL_FUNCTIONS   5
+#define PROFILE_PROGRAM             6
+#define PROFILE_MB_OUTPUTS          7
+#define PROFILE_PUBLISH_IMAGE       8
+#define PROFILE_OPCUA_SYNC          9
+#define PROFILE_OUTPUTS             10
+#define PROFILE_SCAN                11
+#define PROFILE_SLEEP_LATENCY       12
+#define PROFILE_PHASES              13
+
+//Kinds of the spans recorded by the trace points (event_trace.cpp)
+#define TRACE_SCAN_PHASE            0   //arg: PROFILE_* phase
+#define TRACE_PROTOCOL_REQUEST      1   //arg: protocol, code: function or command
+#define TRACE_LOCK_WAIT             2   //detail: LockSite
+#define TRACE_LOCK_HOLD             3   //detail: LockSite
+#define TRACE_MB_MASTER             4   //arg: function code, code: errno, detail: device name
+#define TRACE_PROGRAM               5   //detail: program name
+
+//Records a span on the event trace of the calling thread. While the trace
+//is stopped only the flag is read, the arguments are not evaluated
+extern bool event_tracing;
+#define TRACE_SPAN(kind, arg, code, detail, start, end) \
+    do { if (__builtin_expect(__atomic_load_n(&event_tracing, __ATOMIC_RELAXED), 0)) \
+             traceSpan(kind, arg, code, detail, start, end); } while (0)
+
+//Severity of the log messages
+#define LOG_LEVEL_DEBUG     0
+#define LOG_LEVEL_INFO      1
+#define LOG_LEVEL_WARNING   2
+#define LOG_LEVEL_ERROR     3
+
+//Origin of the log messages
+#define LOG_SOURCE_RUNTIME          0
+#define LOG_SOURCE_MODBUS_MASTER    1
+
+//Codes of the Modbus master messages (the first argument is the errno)
+#define LOG_CODE_MB_REQUEST_FAILED      1
+#define LOG_CODE_MB_DISCONNECTED        2
+#define LOG_CODE_MB_CONNECT_FAILED      3
+#define LOG_CODE_MB_CONNECTED           4
+
+//Codes of the runtime messages
+#define LOG_CODE_SCAN_OVERRUN           1   //arguments: overrun in us, late ticks
+#define LOG_CODE_SCAN_WATCHDOG          2   //arguments: watchdog timeout in ms
+#define LOG_CODE_HEAP_ALLOCATION        3   //arguments: allocation size, allocations so far
+
+//What happens when a real-time thread allocates from the heap
+#define HEAP_CHECK_OFF      0
+#define HEAP_CHECK_REPORT   1
+#define HEAP_CHECK_ABORT    2
+#define HEAP_CHECK_COUNT    3   //only counted, see heapAllocationCount()
+
+//Classes of the runtime threads (see threads.cfg)
+#define THREAD_CLASS_SCAN           0   //the scan cycle
+#define THREAD_CLASS_IO             1   //hardware layer and driver I/O
+#define THREAD_CLASS_COMM           2   //protocol servers and Modbus master
+#define THREAD_CLASS_BACKGROUND     3   //logs, persistent storage, watchdog, interactive server
+#define THREAD_CLASS_DNP3           4   //DNP3 thread pool
+#define THREAD_CLASS_PROGRAM        5   //workers running programs in parallel
+#define THREAD_CLASS_ETHERCAT       6   //EtherCAT master cycle (ethercat_cycle.cfg)
+#define THREAD_CLASSES              7
+
+//What the scheduler does when a scan misses its deadline
+#define SCAN_OVERRUN_CATCH_UP   0
+#define SCAN_OVERRUN_SKIP       1
+#define SCAN_OVERRUN_EXTEND     2
+
+//When the scan writes the physical outputs
+#define SCAN_OUTPUTS_FIRST      0
+#define SCAN_OUTPUTS_LAST       1
+
+//Counters of the scan scheduler since the runtime started
+struct SchedulerCounters
+{
+    uint64_t overruns;
+    uint64_t missed_ticks;
+    uint64_t watchdog_alarms;
+};
+
+//Areas that can be written through the process image write queue
+#define PI_BOOL_INPUT       0
+#define PI_BOOL_OUTPUT      1
+#define PI_INT_INPUT        2
+#define PI_INT_OUTPUT       3
+#define PI_INT_MEMORY       4
+#define PI_DINT_MEMORY      5
+#define PI_LINT_MEMORY      6
+
+//A write requested by a protocol server. Only the bits set on mask are
+//changed on the target variable
+struct ProcessImageWrite
+{
+    uint8_t area;
+    uint8_t bit;
+    uint16_t index;
+    IEC_ULINT value;
+    IEC_ULINT mask;
+};
+
+//A run of consecutive variables of an area written at once by a protocol
+//server. The values are big-endian, as on the wire, or packed eight per
+//byte (first one on bit 0) on the bool areas, where index counts bits
+struct ProcessImageRun
+{
+    uint8_t area;
+    uint16_t index;
+    uint16_t count;
+    const unsigned char *data;
+};
+
+//A force (or unforce) request for a debug variable
+struct ForceRequest
+{
+    uint16_t index;
+    bool forced;
+    uint16_t length;
+    const void *value;
+};
+
+//Private view of the process image of an additional hardware driver. The
+//pointers only lead to the points bound to the driver
+struct HardwareDriverTables
+{
+    IEC_BOOL *(*bool_in)[8];
+    IEC_BOOL *(*bool_out)[8];
+    IEC_BYTE **byte_in;
+    IEC_BYTE **byte_out;
+    IEC_UINT **int_in;
+    IEC_UINT **int_out;
+    IEC_UDINT **dint_in;
+    IEC_UDINT **dint_out;
+    IEC_ULINT **lint_in;
+    IEC_ULINT **lint_out;
+    pthread_mutex_t *lock; //the bufferLock of the driver
+};
+
+//A hardware layer built as an additional driver (see hardware_driver.h)
+struct HardwareDriver
+{
+    const char *name;
+    const char *ranges; //bound addresses, e.g. "%IX0.0-%IX1.7,%QW0-%QW7"
+    void (*initialize)();
+    void (*finalize)();
+    void (*update_inputs)();
+    void (*update_outputs)();
+    HardwareDriverTables *tables;
+};
+
+//Limits of the variable trace
+#define TRACE_MAX_VARS      64
+#define TRACE_MAX_SAMPLE    1024 //tick plus the values, in bytes
+
+//Trigger conditions, checked against a reference value
+#define TRACE_TRIGGER_EQUAL         1
+#define TRACE_TRIGGER_NOT_EQUAL     2
+#define TRACE_TRIGGER_ABOVE         3
+#define TRACE_TRIGGER_BELOW         4
+#define TRACE_TRIGGER_RISING        5 //was below the value, now it is not
+#define TRACE_TRIGGER_FALLING       6 //was above the value, now it is not
+
+//How the trigger variable is compared
+#define TRACE_TYPE_UNSIGNED     0
+#define TRACE_TYPE_SIGNED       1
+#define TRACE_TYPE_FLOAT        2
+
+//Trigger states
+#define TRACE_TRIGGER_NONE      0
+#define TRACE_TRIGGER_ARMED     1
+#define TRACE_TRIGGER_FIRED     2
+#define TRACE_TRIGGER_DONE      3 //post-trigger samples captured, trace stopped
+
+//A block of samples read from the variable trace
+struct TraceChunk
+{
+    bool running;
+    int trigger_state;
+    uint64_t trigger_index; //sample where the trigger condition was met
+    uint32_t sample_size;
+    uint64_t first;         //index of the first sample on the block
+    uint32_t samples;
+    uint32_t data_size;     //encoded size of the samples
+    uint64_t lost;          //samples overwritten before they were read
+};
+
+//A place where a profiled lock is taken. lockBuffer() declares one static
+//site per call, the lock profiler gives it a slot the first time it records
+//its times
+struct LockSite
+{
+    const char *lock_name;
+    const char *file;
+    int line;
+    const char *function;
+    int slot;               //slot + 1 on the lock profiler, 0 before
+};
+
+//An archived point of a historian tag
+struct HistorianPoint
+{
+    int64_t time;           //UTC, in ms
+    double value;
+};
+
+//Archived points of a historian tag over an interval of a trend
+struct HistorianInterval
+{
+    uint32_t count;         //points on the interval, the rest is 0 without any
+    double sum;
+    double min, max, first, last;
+    int64_t min_time, max_time, first_time, last_time;
+};
+
+//Edges of a digital input that run an event task (programs.cfg)
+#define EVENT_EDGE_RISING   1
+#define EVENT_EDGE_FALLING  2
+#define EVENT_EDGE_BOTH     3
+
+//Token bucket of the rate limits of the protocol servers (rate_limit.cpp)
+struct RateBucket
+{
+    double tokens;
+    uint64_t updated_ns;    //CLOCK_MONOTONIC time of the last refill
+};
+
+//Connection policy of a protocol server, from its section of rate_limits.cfg
+struct ConnectionLimits
+{
+    bool nodelay;           //TCP_NODELAY on the client sockets
+    int keepalive;          //idle seconds before the keepalive probes, 0: off
+    int idle_timeout;       //seconds a client may stay silent, 0: no limit
+    int max_connections;    //0: no limit. The least recently active client
+                            //is closed to make room for a new one
+};
+
+//Takes and releases bufferLock. While the lock profiler is on, the time
+//spent waiting for the lock and holding it is recorded for each call site
+#define lockBuffer() do { static LockSite lock_site = {"bufferLock", __FILE__, __LINE__, __func__, 0}; \
+                          lockProfiled(&bufferLock, &lock_site); } while (0)
+#define unlockBuffer() unlockProfiled(&bufferLock)
+
 //----------------------------------------------------------------------
 //FUNCTION PROTOTYPES
 //----------------------------------------------------------------------
 
-//MatIEC Compiler
+//MatIEC Compiler. The runtime runs the program through plcProgram(), so
+//an online change can replace it
 void config_run__(unsigned long tick);
 void config_init__(void);
 
@@ -122,23 +546,47 @@ void updateBuffersOut();
 
 //utils.cpp
 void sleep_until(struct timespec *ts, long long delay);
+unsigned long ticksToNextTask(unsigned long tick);
 void sleepms(int milliseconds);
+void startClockThread();
+// Set the start of the scan, all the time values of the scan derive from it
+void updateScanClock(const struct timespec *scan_start);
+// On virtual time, advance the scan clock by elapsed_ns instead
+void advanceScanClock(int64_t elapsed_ns, const struct timespec *scan_start);
+extern "C" void readScanTime(int32_t *tv_sec, int32_t *tv_nsec);
+void setScanTime(int64_t elapsed_ns);
 extern "C" void openplc_log(char *logmsg);
+extern "C" void openplc_log_level(int level, char *logmsg);
+extern "C" void openplc_log_event(int level, int source, int code, uint32_t arg0, uint32_t arg1, char *logmsg);
+// Sends data to a client, returns -1 on error
+typedef int (*LogWriter)(void *context, const void *data, size_t length);
+void sendLogText(LogWriter writer, void *context);
+void sendLogEvents(LogWriter writer, void *context, uint64_t cursor, int max_events);
+void initializeLog();
+void finalizeLog();
+void setLogLevel(int level);
+void setLogConsole(bool enabled);
 void handleSpecialFunctions();
 void timespec_diff(struct timespec *a, struct timespec *b, struct timespec *result);
+// Configuration files. The callback gets each [section] with a NULL key, then
+// each key = value of the section
+#define SETTINGS_LINE_SIZE 4096
+typedef void (*SettingCallback)(const char *section, char *key, char *value, void *context);
+char *trimSetting(char *s);
+bool parseSettingsFile(const char *path, SettingCallback setting, void *context);
 void *interactiveServerThread(void *arg);
 void disableOutputs();
 void RecordCycletimeLatency(long cycle_time, long sleep_latency);
 
 void setModbusRtsPin(uint8_t pin);
-extern unsigned char log_buffer[1000000];
-extern int log_index;
 
 //main.cpp
 extern uint8_t run_openplc;
+extern bool scan_paced_by_hardware;
 
 //server.cpp
 void startServer(uint16_t port, int protocol_type);
+void startUdpServer(uint16_t port);
 int getSO_ERROR(int fd);
 void closeSocket(int fd);
 bool SetSocketBlockingEnabled(int fd, bool blocking);
@@ -146,6 +594,8 @@ bool SetSocketBlockingEnabled(int fd, bool blocking);
 //interactive_server.cpp
 void startInteractiveServer(int port);
 extern bool run_modbus;
+extern bool run_modbus_rtu;
+extern bool run_modbus_udp;
 extern bool run_dnp3;
 extern bool run_enip;
 extern bool run_pstorage;
@@ -154,22 +604,50 @@ extern time_t start_time;
 extern time_t end_time;
 
 //modbus.cpp
-int readModbusMessage(int fd, unsigned char *buffer, size_t bufferSize);
+int getModbusFrameLength(unsigned char *buffer, int length, int maxSize);
 int processModbusMessage(unsigned char *buffer, int bufferSize);
 void mapUnusedIO();
+void setModbusResponseCache(bool enabled);
 
 //enip.cpp
-int processEnipMessage(unsigned char *buffer, int buffer_size);
+int getEnipFrameLength(unsigned char *buffer, int length, int max_size);
+int processEnipMessage(unsigned char *buffer, int buffer_size, int client_fd);
+void closeEnipSessions(int client_fd);
+void startEnipDiscovery(uint16_t port);
+void stopEnipDiscovery();
+
+//modbus_rtu_server.cpp
+void startModbusRtuServer(const char *port_config);
 
 //pccc.cpp ADDED Ulmer
 uint16_t processPCCCMessage(unsigned char *buffer, int buffer_size);
 
+//cip.cpp
+bool cipServiceSupported(unsigned char service);
+int processCIPMessage(unsigned char *buffer, int buffer_size);
+
 //modbus_master.cpp
 void initializeMB();
-void *querySlaveDevices(void *arg);
+// Rebuild the device table from mbconfig.cfg while running
+int reloadMB();
+void *pollBus(void *arg);
 void updateBuffersIn_MB();
 void updateBuffersOut_MB();
+// In step with the scan, wait for the polls of the scan about to run
+void waitMBInputs();
+void updateMBSpecialFunctions();
+void sendMBStats(LogWriter writer, void *context);
+int processGatewayMessage(unsigned char *buffer, int bufferSize);
 extern uint8_t rpi_modbus_rts_pin;     // If <> 0, expect hardware RTS to be used with this pin
+// Parsing of the mbconfig.cfg lines, also used for s7config.cfg
+void getData(char *line, char *buf, char separator1, char separator2);
+int getDeviceNumber(char *line);
+void getFunction(char *line, char *parameter);
+
+//s7_master.cpp
+void initializeS7Master();
+void updateBuffersIn_S7();
+void sendS7MasterStats(LogWriter writer, void *context);
 
 //dnp3.cpp
 void dnp3StartServer(int port);
@@ -179,16 +657,292 @@ void opcuaStartServer(int port);
 void initializeOpcua();
 void finalizeOpcua();
 void stopOpcua();
+void setOpcuaDataSourceMode(bool enabled);
+void setOpcuaScanSampling(int decimation);
+void setOpcuaTuning(const char *settings);
+void setOpcuaSecurity(const char *settings);
 // OPC UA thread
 extern pthread_t opcua_thread;
 void *opcuaThread(void *arg);
-// Sync OPC UA shadows from PLC buffers once per cycle
+// Copy the OPC UA node values once per cycle (bufferLock held)
 extern "C" void opcuaUpdateNodeValues();
+// Apply the client writes committed by the OPC UA thread (bufferLock held)
+extern "C" void opcuaApplyWrites();
+
+//opcua_pubsub.cpp
+void startOpcuaPubSub();
+void stopOpcuaPubSub();
+
+//variable_index.cpp
+void sendVariableValues(LogWriter writer, void *context, const char *names);
+int writeVariableValues(const char *assignments, char *error, size_t error_size);
+
+//network_variables.cpp
+void startNetworkVariables();
+void stopNetworkVariables();
+void updateBuffersIn_NetVars();
+void sendNetworkVariableStats(LogWriter writer, void *context);
+
+//log_file.cpp
+void startLogFile();
+void stopLogFile();
+void appendLogFile(uint64_t timestamp, int level, const char *text);
+
+//historian.cpp
+void startHistorian();
+void stopHistorian();
+void sendHistorianQuery(LogWriter writer, void *context, const char *tag_name, int64_t start, int64_t end, int max_points);
+bool findHistorianTag(const char *location, uint32_t *id);
+int readHistorianPoints(uint32_t tag, int64_t start, int64_t end, int skip, HistorianPoint *points, int max_points);
+void readHistorianIntervals(uint32_t tag, int64_t start, int64_t width, int count, HistorianInterval *intervals);
+
+//mqtt.cpp
+void startMqtt();
+void stopMqtt();
+
+//metrics.cpp
+void startMetrics();
+void stopMetrics();
+// Count the traffic of the protocol servers, callable from any thread
+void recordProtocolConnection(int protocol, bool opened);
+void recordProtocolRequest(int protocol, bool error);
+void recordProtocolLatency(int protocol, uint64_t duration_ns);
+void recordProtocolThrottled(int protocol);
+
+//program_workers.cpp
+//A program of a resource, on the table the resource run function generated
+//by iec2c -O t hands to __plc_run_programs()
+struct PlcResourceProgram
+{
+    const char *name;
+    void (*run)(void);
+};
+void startProgramWorkers();
+int getEventTaskEdges(uint32_t input);
+void armEventTasks(uint32_t input);
+// Run the programs bound to an edge of %IX input, from the thread that saw it
+void runEventTasks(uint32_t input, bool level, const struct timespec *timestamp);
+int getEventTaskStats(char *buffer, size_t buffer_size);
+extern "C" void __plc_run_programs(const PlcResourceProgram *programs, int count);
+
+//gpio_events.cpp
+// lines: line on the chip of every %IX of the hardware layer, -1 if none
+void startGpioEvents(const char *chip, const int *lines, int count);
+void stopGpioEvents();
+
+//rate_limit.cpp
+void loadRateLimits();
+int rateLimitClass(const struct sockaddr_in *address);
+int rateLimitPriority(int class_index);
+void openRateBucket(RateBucket *bucket, int class_index, uint64_t now_ns);
+void closeRateBucket(int class_index);
+bool takeRateToken(int protocol, RateBucket *bucket, int class_index, uint64_t now_ns, uint64_t *retry_ns);
+void getConnectionLimits(int protocol, ConnectionLimits *limits);
+int getRateLimitStats(char *buffer, size_t buffer_size);
+
+//monitor.cpp
+void sendMonitorStream(LogWriter writer, void *context, int client_fd, const char *arguments);
+bool writeMonitorPoint(const char *location, uint64_t value);
+
+//plc_state.cpp
+// locked, if any, is called holding bufferLock once the state is copied
+int exportPlcState(const char *path, void (*locked)(void) = NULL);
+int importPlcState(const char *path);
+
+//input_record.cpp
+int startInputRecord(const char *path);
+void stopInputRecord();
+int getInputRecordStatus(char *buffer, size_t buffer_size);
+// Log the scan inputs before the program runs and its outputs after (bufferLock held)
+void recordScanInputs();
+void recordScanOutputs();
+int replayInputRecord(const char *path, int repeat);
+
+//redundancy.cpp
+void startRedundancy();
+void stopRedundancy();
+// Copy the state for the standby (bufferLock held)
+void captureRedundancyState();
+// Whether the scan must follow the primary instead of running (bufferLock held)
+bool redundancyStandby();
+int getRedundancyStatus(char *buffer, size_t buffer_size);
 
 //persistent_storage.cpp
 void startPstorage();
 int readPersistentStorage();
+void setPstorageRetain(bool enabled);
+// Copy the retentive memory to its mapped region (bufferLock held)
+void updateRetainMemory();
+
+//process_image.cpp
+void initializeProcessImage();
+void publishProcessImage();
+void applyProcessImageWrites();
+const ProcessImageSnapshot *beginProcessImageRead(uint32_t *sequence);
+bool endProcessImageRead(const ProcessImageSnapshot *snap, uint32_t sequence);
+int queueProcessImageWrites(const ProcessImageWrite *writes, int count);
+int queueProcessImageBatch(const ProcessImageWrite *writes, int count, const ProcessImageRun *runs, int run_count);
+int applyProcessImageWritesSync(const ProcessImageWrite *writes, int count, int timeout_ms);
+uint32_t getProcessImageVersion();
+uint32_t waitProcessImage(uint32_t version, int timeout_ms);
+bool getProcessImageChanges(uint32_t since, uint32_t until, ProcessImageChanges *changes);
+bool processImageChanged(const ProcessImageChanges *changes, size_t offset, size_t size);
+void packBools(const IEC_BOOL *src, int count, unsigned char *dst);
+void copyPackedBits(const IEC_BYTE *bits, int start, int count, unsigned char *dst);
+// Sequence of events: UTC time (us) of the last change of an input
+void markInputScanTime();
+void recordInputEdge(uint32_t input, const struct timespec *timestamp);
+uint64_t getInputChangeTime(int area, uint32_t index);
+void buildImageRanges();
+const ImageRanges *getImageRanges(int area);
+uint32_t getRetainLayout();
+// Copy the RETAIN variables from or to a retain area (bufferLock held)
+void copyRetainVariables(IEC_BYTE *retain_memory);
+void restoreRetainVariables(const IEC_BYTE *retain_memory);
+
+//shared_image.cpp
+ProcessImageSnapshot *createSharedImage();
+void publishSharedImage(int index);
+int takeSharedImageWrites(ProcessImageWrite *writes, int max);
+void finalizeSharedImage();
+
+//tag_database.cpp
+void buildTagDatabase();
+size_t getTagCount();
+const Tag *getTag(size_t index);
+const Tag *findTag(const char *name);
+const Tag *findTagAt(int protocol, uint16_t table, uint32_t address, uint8_t bit, uint32_t *element);
+bool parseTagLocation(const char *text, char *area, char *size, uint32_t *position);
+int32_t tagImageOffset(char area, char size, uint32_t position);
+bool tagProtocolAddress(char area, char size, uint32_t position, int protocol, TagAddress *address);
+int formatTag(const Tag *tag, char *buffer, size_t buffer_size);
+
+//scan_profiler.cpp
+void recordScanPhase(int phase, uint64_t duration_ns);
+void profileScanPhase(int phase, struct timespec *phase_start);
+int getScanProfile(char *buffer, size_t buffer_size);
+int getScanHistogram(int phase, char *buffer, size_t buffer_size);
+const char *scanPhaseName(int phase);
+uint64_t getScanPhaseCounts(int phase, const uint64_t *bounds_ns, int bound_count, uint64_t *counts, uint64_t *sum_ns);
+
+//lock_profiler.cpp
+void lockProfiled(pthread_mutex_t *lock, LockSite *site);
+void unlockProfiled(pthread_mutex_t *lock);
+void setLockProfiling(bool enabled);
+int getLockProfile(char *buffer, size_t buffer_size);
+
+//pou_profiler.cpp
+void resetPouProfile();
+int getPouProfile(char *buffer, size_t buffer_size);
+
+//pid_engine.cpp
+void solvePidLoops();
+
+//sample_profiler.cpp
+void registerSampledThread();
+bool startSampleProfile(int hz);
+void stopSampleProfile();
+int getSampleProfile(char *buffer, size_t buffer_size);
+
+//event_trace.cpp
+void traceSpan(int kind, int arg, uint32_t code, const void *detail, const struct timespec *start, const struct timespec *end);
+bool startEventTrace(uint32_t freeze_us);
+void stopEventTrace();
+int dumpEventTrace(const char *path);
+int getEventTraceStatus(char *buffer, size_t buffer_size);
+
+//thread_config.cpp
+void loadThreadConfig();
+// Apply the affinity and scheduling of a thread class to the calling thread,
+// name it (NULL for the class name) and add it to the thread table
+void setThreadClass(int thread_class, const char *name);
+void setThreadName(const char *name);
+int getThreadHeapCheck(int thread_class);
+int getThreadStats(char *buffer, size_t buffer_size);
+
+//rt_memory.cpp
+void configureHeap();
+void prefaultStack(size_t size);
+void armHeapCheck(int mode);
+uint32_t heapAllocationCount();
+void logMemoryReport();
+
+//scan_scheduler.cpp
+void setScanOverrunPolicy(int policy);
+void setScanWatchdog(int timeout_ms);
+void setScanPhaseOrder(int order);
+void setLoadShedding(int overruns);
+uint32_t getLoadShedStep();
+bool shedScanWork();
+int getScanPhaseOrder();
+unsigned long waitNextScan(struct timespec *scan_start, long long tick_period, unsigned long ticks);
+void restartScanTimer(struct timespec *scan_start);
+uint64_t getScheduledScan();
+uint64_t waitScanScheduled(uint64_t seen, int timeout_ms);
+void setVirtualTime(bool enabled);
+bool virtualTimeScan();
+void startScanWatchdog();
+void stopScanWatchdog();
+void updateSchedulerSpecialFunctions();
+int getSchedulerStats(char *buffer, size_t buffer_size);
+void getSchedulerCounters(SchedulerCounters *counters);
+
+//trace.cpp
+// Copy the traced variables to the trace ring (bufferLock held)
+void captureTrace();
+int startTrace(const uint16_t *indexes, int count, uint16_t divider);
+void stopTrace();
+int armTraceTrigger(uint16_t index, uint8_t condition, uint8_t type, uint64_t value, uint32_t pre, uint32_t post);
+void readTrace(uint64_t cursor, uint8_t *out, size_t out_size, TraceChunk *chunk);
+
+//hardware_drivers.cpp
+void registerHardwareDriver(HardwareDriver *driver);
+void initializeHardwareDrivers();
+void startHardwareDrivers();
+void finalizeHardwareDrivers();
+// Copy the driver inputs to the program and its outputs to the drivers (bufferLock held)
+void exchangeHardwareDriverInputs();
+void exchangeHardwareDriverOutputs();
+
+//scan_alignment.cpp
+void loadScanAlignment();
+uint64_t alignScanDeadline(uint64_t deadline, long long tick_period);
+int getScanAlignmentStats(char *buffer, size_t buffer_size);
+
+//ethercat_cycle.cpp
+void startEthercatCycle();
+bool runEthercatCycle();
+void stopEthercatCycle();
+// Copy the EtherCAT inputs to the program and its outputs to the master (bufferLock held)
+void exchangeEthercatInputs();
+void exchangeEthercatOutputs();
+
+//forcing.cpp
+int queueForcedVariables(const ForceRequest *requests, int count);
+// Apply the force requests queued by the debugger (bufferLock held)
+void applyForcedVariables();
+// Write the forced values over the program variables (bufferLock held)
+void overlayForcedVariables();
+void resetForcedVariables();
+
+//startup.cpp
+void runStartupPhase(const char *name, void (*run)(void));
+int startStartupPhase(const char *name, void (*run)(void));
+void waitStartupPhase(int handle);
+void logStartupPhases();
+
+//online_change.cpp
+void initializePlcProgram();
+PlcProgram *plcProgram();
+int loadOnlineChange(const char *path);
+// Make the pointer tables read-only once glueVars ran
+void freezeImagePointers();
+// Swap in the program loaded by an online change (bufferLock held)
+void applyOnlineChange();
 
 //python_loader.cpp
 extern "C" int create_shm_name(char *buf, size_t size);
 extern "C" int python_block_loader(const char *script_name, const char *script_content, char *shm_name, size_t shm_in_size, size_t shm_out_size, void **shm_in_ptr, void **shm_out_ptr, pid_t pid);
+extern "C" int python_block_post(void *shm_in_ptr);
+extern "C" int python_block_wait(void *shm_in_ptr, long timeout_us);
+extern "C" int python_block_call(void *shm_in_ptr, long timeout_us);
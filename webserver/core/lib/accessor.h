@@ -82,6 +82,86 @@
 #define __INIT_LOCATED_VALUE(name, initial)\
 	*(name.value) = initial;
 
+// POU profiling macros (stage4 option f). They open and close the body of
+// every program and function block. The runtime adds the time of each call
+// to the profile of its POU type, keeping the time spent in the POUs it
+// calls apart
+typedef struct __plc_pou_profile_t {
+	const char *name;
+	unsigned long generation;
+	unsigned long long calls;
+	unsigned long long total_ns;
+	unsigned long long self_ns;
+	unsigned long long max_ns;
+	struct __plc_pou_profile_t *next;
+} __plc_pou_profile_t;
+typedef struct {
+	unsigned long long start_ns;
+	unsigned long long outer_child_ns;
+} __plc_pou_frame_t;
+#ifdef __cplusplus
+extern "C" {
+#endif
+void __plc_pou_enter(__plc_pou_frame_t *frame);
+void __plc_pou_exit(__plc_pou_profile_t *profile, __plc_pou_frame_t *frame);
+#ifdef __cplusplus
+}
+#endif
+#define __PROFILE_POU_ENTER(name)\
+	static __plc_pou_profile_t __pou_profile = {#name, 0, 0, 0, 0, 0, NULL};\
+	__plc_pou_frame_t __pou_frame;\
+	__plc_pou_enter(&__pou_frame);
+#define __PROFILE_POU_EXIT(name)\
+	__plc_pou_exit(&__pou_profile, &__pou_frame);
+
+
+
+// force overlay macro. Writes the forced value of a located variable over
+// its location, for the programs built with direct access
+#define __FORCE_LOCATED(name)\
+	if (name.flags & __IEC_FORCE_FLAG) *(name.value) = name.fvalue;
+
+
+// Direct access. With OPLC_DIRECT_ACCESS (release builds) the accessors
+// don't test the force flags, every access is a plain load or store. The
+// forced values are written over the variables by the force overlay that
+// the runtime runs before and after the program on each scan
+#ifdef OPLC_DIRECT_ACCESS
+
+// variable getting macros
+#define __GET_VAR(name, ...)\
+	name.value __VA_ARGS__
+#define __GET_EXTERNAL(name, ...)\
+	((*(name.value)) __VA_ARGS__)
+#define __GET_EXTERNAL_FB(name, ...)\
+	__GET_VAR(((*name) __VA_ARGS__))
+#define __GET_LOCATED(name, ...)\
+	((*(name.value)) __VA_ARGS__)
+
+#define __GET_VAR_BY_REF(name, ...)\
+	(&(name.value __VA_ARGS__))
+#define __GET_EXTERNAL_BY_REF(name, ...)\
+	(&((*(name.value)) __VA_ARGS__))
+#define __GET_EXTERNAL_FB_BY_REF(name, ...)\
+	__GET_EXTERNAL_BY_REF(((*name) __VA_ARGS__))
+#define __GET_LOCATED_BY_REF(name, ...)\
+	(&((*(name.value)) __VA_ARGS__))
+
+// variable setting macros
+#define __SET_VAR(prefix, name, suffix, new_value)\
+	prefix name.value suffix = new_value
+#define __SET_EXTERNAL(prefix, name, suffix, new_value)\
+	{(*(prefix name.value)) suffix = new_value;}
+#define __SET_EXTERNAL_FB(prefix, name, suffix, new_value)\
+	__SET_VAR((*(prefix name)), suffix, new_value)
+#define __SET_LOCATED(prefix, name, suffix, new_value)\
+	*(prefix name.value) suffix = new_value
+
+// force flag test macro
+#define __IS_VAR_FORCED(name, ...)\
+	0
+
+#else //OPLC_DIRECT_ACCESS
 
 // variable getting macros
 #define __GET_VAR(name, ...)\
@@ -102,6 +182,8 @@
 #define __GET_LOCATED_BY_REF(name, ...)\
 	((name.flags & __IEC_FORCE_FLAG) ? &(name.fvalue __VA_ARGS__) : &((*(name.value)) __VA_ARGS__))
 
+#endif //OPLC_DIRECT_ACCESS
+
 #define __GET_VAR_REF(name, ...)\
 	(&(name.value __VA_ARGS__))
 #define __GET_EXTERNAL_REF(name, ...)\
@@ -121,6 +203,8 @@
 	(*((*(name.value)) __VA_ARGS__))
 
 
+#ifndef OPLC_DIRECT_ACCESS
+
 // variable setting macros
 #define __SET_VAR(prefix, name, suffix, new_value)\
 	if (!(prefix name.flags & __IEC_FORCE_FLAG)) prefix name.value suffix = new_value
@@ -133,4 +217,11 @@
 #define __SET_LOCATED(prefix, name, suffix, new_value)\
 	if (!(prefix name.flags & __IEC_FORCE_FLAG)) *(prefix name.value) suffix = new_value
 
+// force flag test macro. The code that writes a variable without its setter
+// must check it first
+#define __IS_VAR_FORCED(name, ...)\
+	(name.flags & __IEC_FORCE_FLAG)
+
+#endif //OPLC_DIRECT_ACCESS
+
 #endif //__ACCESSOR_H
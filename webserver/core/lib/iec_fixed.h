@@ -0,0 +1,142 @@
+/*
+ * Fixed point REAL
+ *
+ * With OPLC_FIXED_REAL the IEC REAL type is a 32 bit signed fixed point number with
+ * OPLC_FIXED_FRAC_BITS fraction bits (Q15.16 by default) instead of a float, for the
+ * targets without a floating point unit. LREAL stays a double.
+ *
+ * The additions, subtractions, multiplications, divisions and comparisons of REAL values
+ * are done on the raw integer, and saturate at the limits of the type instead of wrapping
+ * around. The conversions from the integer types are shifts, and the conversions to them
+ * (REAL_TO_INT & co, see iec_std_lib.h) round on the raw integer. Only the functions that
+ * need a double (SQRT, SIN, EXPT, ..., the string conversions) and the REAL literals go
+ * through floating point, and the literals fold at compile time.
+ *
+ * The type is a trivially copyable struct, so it keeps the size and layout of an int32_t
+ * on the images and in the variables of the program, and may be passed to the va_args of
+ * the extensible functions.
+ */
+
+#ifndef _IEC_FIXED_H
+#define _IEC_FIXED_H
+
+#include <stdint.h>
+#include <type_traits>
+
+#ifndef OPLC_FIXED_FRAC_BITS
+#define OPLC_FIXED_FRAC_BITS 16
+#endif
+
+#if (OPLC_FIXED_FRAC_BITS < 1) || (OPLC_FIXED_FRAC_BITS > 30)
+#error "OPLC_FIXED_FRAC_BITS must be between 1 and 30"
+#endif
+
+#define __FIXED_ONE     (1LL << OPLC_FIXED_FRAC_BITS)
+#define __FIXED_HALF    (1LL << (OPLC_FIXED_FRAC_BITS - 1))
+#define __FIXED_MASK    (__FIXED_ONE - 1)
+
+static inline int32_t __fixed_saturate(int64_t raw) {
+  if (raw > INT32_MAX) return INT32_MAX;
+  if (raw < INT32_MIN) return INT32_MIN;
+  return (int32_t)raw;
+}
+
+struct iec_fixed {
+  int32_t raw;
+
+  iec_fixed() = default;
+
+  /* from the integer types */
+  template <typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+  iec_fixed(T value) {
+    if (std::is_signed<T>::value && (int64_t)value < (INT32_MIN >> OPLC_FIXED_FRAC_BITS)) raw = INT32_MIN;
+    else if (!std::is_signed<T>::value ? (uint64_t)value > (uint64_t)(INT32_MAX >> OPLC_FIXED_FRAC_BITS) :
+                                         (int64_t)value > (INT32_MAX >> OPLC_FIXED_FRAC_BITS)) raw = INT32_MAX;
+    else raw = (int32_t)((int64_t)value * __FIXED_ONE);
+  }
+
+  /* from the floating point types, rounded to the nearest step. NaN gives 0 */
+  template <typename T, typename std::enable_if<std::is_floating_point<T>::value, int>::type = 0>
+  iec_fixed(T value) {
+    double scaled = (double)value * __FIXED_ONE;
+    if (scaled >= (double)INT32_MAX) raw = INT32_MAX;
+    else if (scaled <= (double)INT32_MIN) raw = INT32_MIN;
+    else if (scaled == scaled) raw = (int32_t)(scaled + (scaled >= 0 ? 0.5 : -0.5));
+    else raw = 0;
+  }
+
+  static iec_fixed from_raw(int32_t raw) {
+    iec_fixed res;
+    res.raw = raw;
+    return res;
+  }
+
+  /* a single conversion, so the math functions get the double overload */
+  operator double() const {return (double)raw / __FIXED_ONE;}
+
+  iec_fixed operator-() const {return from_raw(raw == INT32_MIN ? INT32_MAX : -raw);}
+  iec_fixed operator+() const {return *this;}
+};
+
+static inline iec_fixed operator+(iec_fixed a, iec_fixed b) {
+  int32_t res;
+  if (__builtin_add_overflow(a.raw, b.raw, &res)) res = a.raw < 0 ? INT32_MIN : INT32_MAX;
+  return iec_fixed::from_raw(res);
+}
+static inline iec_fixed operator-(iec_fixed a, iec_fixed b) {
+  int32_t res;
+  if (__builtin_sub_overflow(a.raw, b.raw, &res)) res = a.raw < 0 ? INT32_MIN : INT32_MAX;
+  return iec_fixed::from_raw(res);
+}
+static inline iec_fixed operator*(iec_fixed a, iec_fixed b) {
+  int64_t product = (int64_t)a.raw * b.raw;
+  return iec_fixed::from_raw(__fixed_saturate((product + __FIXED_HALF) >> OPLC_FIXED_FRAC_BITS));
+}
+/* A division by zero saturates with the sign of the dividend, 0 / 0 gives 0 */
+static inline iec_fixed operator/(iec_fixed a, iec_fixed b) {
+  if (b.raw == 0) return iec_fixed::from_raw(a.raw > 0 ? INT32_MAX : a.raw < 0 ? INT32_MIN : 0);
+  return iec_fixed::from_raw(__fixed_saturate(((int64_t)a.raw * __FIXED_ONE) / b.raw));
+}
+
+static inline bool operator==(iec_fixed a, iec_fixed b) {return a.raw == b.raw;}
+static inline bool operator!=(iec_fixed a, iec_fixed b) {return a.raw != b.raw;}
+static inline bool operator<(iec_fixed a, iec_fixed b)  {return a.raw < b.raw;}
+static inline bool operator<=(iec_fixed a, iec_fixed b) {return a.raw <= b.raw;}
+static inline bool operator>(iec_fixed a, iec_fixed b)  {return a.raw > b.raw;}
+static inline bool operator>=(iec_fixed a, iec_fixed b) {return a.raw >= b.raw;}
+
+/* The other operand of a mixed operation (e.g. op < 0 in the library) becomes a fixed point
+ * value too. Without these the built-in operators on the double conversion would be as good
+ * a match, and the operation ambiguous.
+ */
+#define __fixed_mixed(OP, RES) \
+template <typename T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0> \
+static inline RES operator OP(iec_fixed a, T b) {return a OP iec_fixed(b);} \
+template <typename T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0> \
+static inline RES operator OP(T a, iec_fixed b) {return iec_fixed(a) OP b;}
+__fixed_mixed(+, iec_fixed)
+__fixed_mixed(-, iec_fixed)
+__fixed_mixed(*, iec_fixed)
+__fixed_mixed(/, iec_fixed)
+__fixed_mixed(==, bool)
+__fixed_mixed(!=, bool)
+__fixed_mixed(<, bool)
+__fixed_mixed(<=, bool)
+__fixed_mixed(>, bool)
+__fixed_mixed(>=, bool)
+#undef __fixed_mixed
+
+static inline iec_fixed &operator+=(iec_fixed &a, iec_fixed b) {return a = a + b;}
+static inline iec_fixed &operator-=(iec_fixed &a, iec_fixed b) {return a = a - b;}
+static inline iec_fixed &operator*=(iec_fixed &a, iec_fixed b) {return a = a * b;}
+static inline iec_fixed &operator/=(iec_fixed &a, iec_fixed b) {return a = a / b;}
+
+/* Rounds to the nearest integer, the halves to the even one like __real_round() */
+static inline int64_t __fixed_round(iec_fixed IN) {
+  int64_t magnitude = IN.raw < 0 ? -(int64_t)IN.raw : (int64_t)IN.raw;
+  int64_t res = (magnitude + __FIXED_HALF) >> OPLC_FIXED_FRAC_BITS;
+  if ((magnitude & __FIXED_MASK) == __FIXED_HALF) res &= ~1LL;
+  return IN.raw < 0 ? -res : res;
+}
+
+#endif /* _IEC_FIXED_H */
@@ -10,4 +10,9 @@
 
 extern "C" void openplc_log(char *logmsg);
 extern "C" int create_shm_name(char *buf, size_t size);
-extern "C" int python_block_loader(const char *script_name, const char *script_content, char *shm_name, size_t shm_in_size, size_t shm_out_size, void **shm_in_ptr, void **shm_out_ptr, pid_t pid);
\ No newline at end of file
+extern "C" int python_block_loader(const char *script_name, const char *script_content, char *shm_name, size_t shm_in_size, size_t shm_out_size, void **shm_in_ptr, void **shm_out_ptr, pid_t pid);
+// Synchronized exchange with the block script through its control region.
+// post hands shm_in over, wait gets shm_out back (0 ready, 1 timeout)
+extern "C" int python_block_post(void *shm_in_ptr);
+extern "C" int python_block_wait(void *shm_in_ptr, long timeout_us);
+extern "C" int python_block_call(void *shm_in_ptr, long timeout_us);
\ No newline at end of file
@@ -24,6 +24,17 @@
 #include "accessor.h"
 
 
+/* NOTE: The bodies of the timers (TP, TON and TOF) were changed by hand so the instances that are
+ *       not timing return before reading the time of the scan, and the ones that are timing check
+ *       their deadline without calling the variadic LE_TIME(). The outputs are the same as the
+ *       generated code, CURRENT_TIME is only updated while the timer runs.
+ */
+static inline BOOL __timer_expired(TIME start, TIME preset, TIME now) {
+  TIME deadline = __time_add(start, preset);
+  return __time_cmp(deadline, now) <= 0;
+}
+
+
 
 // FUNCTION_BLOCK R_TRIG
 // Data part
@@ -1407,6 +1418,12 @@ static void TP_body__(TP *data__) {
   else {
     __SET_VAR(data__->,ENO,,__BOOL_LITERAL(TRUE));
   }
+  // Idle: no pulse and IN not set, or pulse done and IN still set
+  if (((__GET_VAR(data__->STATE,) == 0) && !(__GET_VAR(data__->IN,))) ||
+      ((__GET_VAR(data__->STATE,) == 2) && __GET_VAR(data__->IN,))) {
+    __SET_VAR(data__->,PREV_IN,,__GET_VAR(data__->IN,));
+    return;
+  }
   // Initialise TEMP variables
 
   #define GetFbVar(var,...) __GET_VAR(data__->var,__VA_ARGS__)
@@ -1420,7 +1437,7 @@ __SET_VAR(data__->,CURRENT_TIME,,__CURRENT_TIME)
     __SET_VAR(data__->,Q,,__BOOL_LITERAL(TRUE));
     __SET_VAR(data__->,START_TIME,,__GET_VAR(data__->CURRENT_TIME,));
   } else if ((__GET_VAR(data__->STATE,) == 1)) {
-    if (LE_TIME(__BOOL_LITERAL(TRUE), NULL, 2, __time_add(__GET_VAR(data__->START_TIME,), __GET_VAR(data__->PT,)), __GET_VAR(data__->CURRENT_TIME,))) {
+    if (__timer_expired(__GET_VAR(data__->START_TIME,), __GET_VAR(data__->PT,), __GET_VAR(data__->CURRENT_TIME,))) {
       __SET_VAR(data__->,STATE,,2);
       __SET_VAR(data__->,Q,,__BOOL_LITERAL(FALSE));
       __SET_VAR(data__->,ET,,__GET_VAR(data__->PT,));
@@ -1467,6 +1484,14 @@ static void TON_body__(TON *data__) {
   else {
     __SET_VAR(data__->,ENO,,__BOOL_LITERAL(TRUE));
   }
+  // Idle: IN not set
+  if (!(__GET_VAR(data__->IN,))) {
+    __SET_VAR(data__->,ET,,__time_to_timespec(1, 0, 0, 0, 0, 0));
+    __SET_VAR(data__->,Q,,__BOOL_LITERAL(FALSE));
+    __SET_VAR(data__->,STATE,,0);
+    __SET_VAR(data__->,PREV_IN,,__BOOL_LITERAL(FALSE));
+    return;
+  }
   // Initialise TEMP variables
 
   #define GetFbVar(var,...) __GET_VAR(data__->var,__VA_ARGS__)
@@ -1485,7 +1510,7 @@ __SET_VAR(data__->,CURRENT_TIME,,__CURRENT_TIME)
       __SET_VAR(data__->,Q,,__BOOL_LITERAL(FALSE));
       __SET_VAR(data__->,STATE,,0);
     } else if ((__GET_VAR(data__->STATE,) == 1)) {
-      if (LE_TIME(__BOOL_LITERAL(TRUE), NULL, 2, __time_add(__GET_VAR(data__->START_TIME,), __GET_VAR(data__->PT,)), __GET_VAR(data__->CURRENT_TIME,))) {
+      if (__timer_expired(__GET_VAR(data__->START_TIME,), __GET_VAR(data__->PT,), __GET_VAR(data__->CURRENT_TIME,))) {
         __SET_VAR(data__->,STATE,,2);
         __SET_VAR(data__->,Q,,__BOOL_LITERAL(TRUE));
         __SET_VAR(data__->,ET,,__GET_VAR(data__->PT,));
@@ -1529,6 +1554,19 @@ static void TOF_body__(TOF *data__) {
   else {
     __SET_VAR(data__->,ENO,,__BOOL_LITERAL(TRUE));
   }
+  // Idle: IN set, or IN not set and not timing
+  if (__GET_VAR(data__->IN,)) {
+    __SET_VAR(data__->,ET,,__time_to_timespec(1, 0, 0, 0, 0, 0));
+    __SET_VAR(data__->,STATE,,0);
+    __SET_VAR(data__->,Q,,__BOOL_LITERAL(TRUE));
+    __SET_VAR(data__->,PREV_IN,,__BOOL_LITERAL(TRUE));
+    return;
+  }
+  if ((__GET_VAR(data__->STATE,) == 2) || ((__GET_VAR(data__->STATE,) == 0) && !(__GET_VAR(data__->PREV_IN,)))) {
+    __SET_VAR(data__->,Q,,__BOOL_LITERAL(FALSE));
+    __SET_VAR(data__->,PREV_IN,,__BOOL_LITERAL(FALSE));
+    return;
+  }
   // Initialise TEMP variables
 
   #define GetFbVar(var,...) __GET_VAR(data__->var,__VA_ARGS__)
@@ -1545,7 +1583,7 @@ __SET_VAR(data__->,CURRENT_TIME,,__CURRENT_TIME)
       __SET_VAR(data__->,ET,,__time_to_timespec(1, 0, 0, 0, 0, 0));
       __SET_VAR(data__->,STATE,,0);
     } else if ((__GET_VAR(data__->STATE,) == 1)) {
-      if (LE_TIME(__BOOL_LITERAL(TRUE), NULL, 2, __time_add(__GET_VAR(data__->START_TIME,), __GET_VAR(data__->PT,)), __GET_VAR(data__->CURRENT_TIME,))) {
+      if (__timer_expired(__GET_VAR(data__->START_TIME,), __GET_VAR(data__->PT,), __GET_VAR(data__->CURRENT_TIME,))) {
         __SET_VAR(data__->,STATE,,2);
         __SET_VAR(data__->,ET,,__GET_VAR(data__->PT,));
       } else {
@@ -1886,6 +1924,7 @@ __end:
 
 
 #include "communication.h"
+#include "pid_batch.h"
 #include "../c_blocks.h"
 #if defined(SEQUENT)
     #include "sm_cards.h"
@@ -337,7 +337,12 @@ __ANY_NBIT(__to_anyuint_)
 /***********************************/  
 
 /* workaround for va-args limitation on shorter than int params */
+#ifdef OPLC_FIXED_REAL
+/* the fixed point REAL is passed as it is, not promoted */
+#define VA_ARGS_REAL REAL
+#else
 #define VA_ARGS_REAL LREAL
+#endif
 #define VA_ARGS_LREAL LREAL
 #define VA_ARGS_SINT DINT
 #define VA_ARGS_INT DINT
@@ -1245,6 +1250,34 @@ __ANY_INT(__iec_)
 #undef __iec_
 
 
+    /***********************************/
+    /*     Length bounded copies       */
+    /***********************************/
+
+/* The functions below build their result in place and only copy the characters
+ * in use (len) of every string. The helpers doing the work take the strings by
+ * pointer, so no STRING is copied whole on the way. The unused part of the body
+ * of a result is cleared, so the result holds the same bytes as before (code
+ * that compares or persists whole STRING variables, or reads body as a C string,
+ * sees no difference).
+ */
+
+/* Appends count characters to res, as many as fit */
+static inline void __str_append(STRING *res, const uint8_t *src, __strlen_t count){
+    __strlen_t room = STR_MAX_LEN - res->len;
+    if (count > room) count = room;
+    if (count > 0) {
+        memcpy(&res->body[res->len], src, (size_t)count);
+        res->len += count;
+    }
+}
+
+/* Clears the unused part of the body of a result */
+static inline void __str_end(STRING *res){
+    memset(&res->body[res->len], 0, (size_t)(STR_MAX_LEN - res->len));
+}
+
+
     /****************/
     /*     LEFT     */
     /****************/
@@ -1253,10 +1286,10 @@ __ANY_INT(__iec_)
 static inline STRING LEFT__STRING__STRING__##TYPENAME(EN_ENO_PARAMS, STRING IN, TYPENAME L){\
     STRING res;\
     TEST_EN_COND(STRING, L < 0)\
-    res = __INIT_STRING;\
     L = L < (TYPENAME)IN.len ? L : (TYPENAME)IN.len;\
-    memcpy(&res.body, &IN.body, (size_t)L);\
-    res.len = (__strlen_t)L;\
+    res.len = 0;\
+    __str_append(&res, IN.body, (__strlen_t)L);\
+    __str_end(&res);\
     return res;\
 }
 __ANY_INT(__left)
@@ -1270,10 +1303,10 @@ __ANY_INT(__left)
 static inline STRING RIGHT__STRING__STRING__##TYPENAME(EN_ENO_PARAMS, STRING IN, TYPENAME L){\
   STRING res;\
   TEST_EN_COND(STRING, L < 0)\
-  res = __INIT_STRING;\
   L = L < (TYPENAME)IN.len ? L : (TYPENAME)IN.len;\
-  memcpy(&res.body, &IN.body[(TYPENAME)IN.len - L], (size_t)L);\
-  res.len = (__strlen_t)L;\
+  res.len = 0;\
+  __str_append(&res, &IN.body[(TYPENAME)IN.len - L], (__strlen_t)L);\
+  __str_end(&res);\
   return res;\
 }
 __ANY_INT(__right)
@@ -1287,13 +1320,13 @@ __ANY_INT(__right)
 static inline STRING MID__STRING__STRING__##TYPENAME##__##TYPENAME(EN_ENO_PARAMS, STRING IN, TYPENAME L, TYPENAME P){\
   STRING res;\
   TEST_EN_COND(STRING, L < 0 || P < 0)\
-  res = __INIT_STRING;\
+  res.len = 0;\
   if(P <= (TYPENAME)IN.len){\
 	P -= 1; /* now can be used as [index]*/\
 	L = L + P <= (TYPENAME)IN.len ? L : (TYPENAME)IN.len - P;\
-	memcpy(&res.body, &IN.body[P] , (size_t)L);\
-	res.len = (__strlen_t)L;\
+	__str_append(&res, &IN.body[P], (__strlen_t)L);\
   }\
+  __str_end(&res);\
   return res;\
 }
 __ANY_INT(__mid)
@@ -1303,60 +1336,68 @@ __ANY_INT(__mid)
     /*     CONCAT     */
     /******************/
 
+static inline void __concat(STRING *res, UINT param_count, const STRING *const *params){
+  UINT i;
+  res->len = 0;
+  for (i = 0; i < param_count && res->len < STR_MAX_LEN; i++)
+    __str_append(res, params[i]->body, params[i]->len);
+  __str_end(res);
+}
+
+#if defined(__cplusplus) && __cplusplus >= 201103L
+/* The generated code passes every input of CONCAT by value. Taking them as a
+ * variadic template binds them to references instead, so no input is copied
+ * (through va_arg they were copied twice: on the call and out of the list)
+ */
+template <typename... PARAMS>
+static inline STRING CONCAT(EN_ENO_PARAMS, UINT param_count, const PARAMS&... params){
+  STRING res;
+  TEST_EN(STRING)
+  const STRING *strings[] = {&params...};
+  __concat(&res, param_count < sizeof...(params) ? param_count : (UINT)sizeof...(params), strings);
+  return res;
+}
+#else
 static inline STRING CONCAT(EN_ENO_PARAMS, UINT param_count, ...){
   UINT i;
   STRING res;
   va_list ap;
-  __strlen_t charcount;
   TEST_EN(STRING)
-  charcount = 0;
-  res = __INIT_STRING;
+  res.len = 0;
 
   va_start (ap, param_count);         /* Initialize the argument list.  */
 
-  for (i = 0; i < param_count && charcount < STR_MAX_LEN; i++)
+  for (i = 0; i < param_count && res.len < STR_MAX_LEN; i++)
   {
     STRING tmp = va_arg(ap, STRING);
-    __strlen_t charrem = STR_MAX_LEN - charcount;
-    __strlen_t to_write = tmp.len > charrem ? charrem : tmp.len;
-    memcpy(&res.body[charcount], &tmp.body , to_write);
-    charcount += to_write;
+    __str_append(&res, tmp.body, tmp.len);
   }
 
-  res.len = charcount;
-
   va_end (ap);                  /* Clean up.  */
+  __str_end(&res);
   return res;
 }
+#endif
 
     /******************/
     /*     INSERT     */
     /******************/
 
-static inline STRING __insert(STRING IN1, STRING IN2, __strlen_t P){
-    STRING res;
-    __strlen_t to_copy;
-    res = __INIT_STRING;
-
-    to_copy = P > IN1.len ? IN1.len : P;
-    memcpy(&res.body, &IN1.body , to_copy);
-    P = res.len = to_copy;
-
-    to_copy = IN2.len + res.len > STR_MAX_LEN ? STR_MAX_LEN - res.len : IN2.len;
-    memcpy(&res.body[res.len], &IN2.body , to_copy);
-    res.len += to_copy;
-
-    to_copy = IN1.len - P < STR_MAX_LEN - res.len ? IN1.len - P : STR_MAX_LEN - res.len ;
-    memcpy(&res.body[res.len], &IN1.body[P] , to_copy);
-    res.len += to_copy;
-
-    return res;
+static inline void __insert(STRING *res, const STRING *IN1, const STRING *IN2, __strlen_t P){
+    __strlen_t to_copy = P > IN1->len ? IN1->len : P;
+    res->len = 0;
+    __str_append(res, IN1->body, to_copy);
+    __str_append(res, IN2->body, IN2->len);
+    __str_append(res, &IN1->body[to_copy], IN1->len - to_copy);
+    __str_end(res);
 }
 
 #define __iec_(TYPENAME) \
 static inline STRING INSERT__STRING__STRING__STRING__##TYPENAME(EN_ENO_PARAMS, STRING str1, STRING str2, TYPENAME P){\
+  STRING res;\
   TEST_EN_COND(STRING, P < 0)\
-  return (STRING)__insert(str1,str2,(__strlen_t)P);\
+  __insert(&res, &str1, &str2, (__strlen_t)P);\
+  return res;\
 }
 __ANY_INT(__iec_)
 #undef __iec_
@@ -1366,28 +1407,21 @@ __ANY_INT(__iec_)
     /*     DELETE     */
     /******************/
 
-static inline STRING __delete(STRING IN, __strlen_t L, __strlen_t P){
-    STRING res;
-    __strlen_t to_copy;
-    res = __INIT_STRING;
-
-    to_copy = P > IN.len ? IN.len : P-1;
-    memcpy(&res.body, &IN.body , to_copy);
-    P = res.len = to_copy;
-
-    if( IN.len > P + L ){
-        to_copy = IN.len - P - L;
-        memcpy(&res.body[res.len], &IN.body[P + L], to_copy);
-        res.len += to_copy;
-    }
-
-    return res;
+static inline void __delete(STRING *res, const STRING *IN, __strlen_t L, __strlen_t P){
+    __strlen_t to_copy = P > IN->len ? IN->len : P-1;
+    res->len = 0;
+    __str_append(res, IN->body, to_copy);
+    if( IN->len > to_copy + L )
+        __str_append(res, &IN->body[to_copy + L], IN->len - to_copy - L);
+    __str_end(res);
 }
 
 #define __iec_(TYPENAME) \
 static inline STRING DELETE__STRING__STRING__##TYPENAME##__##TYPENAME(EN_ENO_PARAMS, STRING str, TYPENAME L, TYPENAME P){\
+  STRING res;\
   TEST_EN_COND(STRING, L < 0 || P < 0)\
-  return (STRING)__delete(str,(__strlen_t)L,(__strlen_t)P);\
+  __delete(&res, &str, (__strlen_t)L, (__strlen_t)P);\
+  return res;\
 }
 __ANY_INT(__iec_)
 #undef __iec_
@@ -1397,38 +1431,24 @@ __ANY_INT(__iec_)
     /*     REPLACE     */
     /*******************/
 
-static inline STRING __replace(STRING IN1, STRING IN2, __strlen_t L, __strlen_t P){
-    STRING res;
-    __strlen_t to_copy;
-    res = __INIT_STRING;
+static inline void __replace(STRING *res, const STRING *IN1, const STRING *IN2, __strlen_t L, __strlen_t P){
+    __strlen_t to_copy = P > IN1->len ? IN1->len : P-1;
+    res->len = 0;
+    __str_append(res, IN1->body, to_copy);
+    __str_append(res, IN2->body, IN2->len < L ? IN2->len : L);
 
-    to_copy = P > IN1.len ? IN1.len : P-1;
-    memcpy(&res.body, &IN1.body , to_copy);
-    P = res.len = to_copy;
-
-    to_copy = IN2.len < L ? IN2.len : L;
-
-    if( to_copy + res.len > STR_MAX_LEN )
-       to_copy = STR_MAX_LEN - res.len;
-
-    memcpy(&res.body[res.len], &IN2.body , to_copy);
-    res.len += to_copy;
-
-    P += L;
-    if( res.len <  STR_MAX_LEN && P < IN1.len)
-    {
-        to_copy = IN1.len - P;
-        memcpy(&res.body[res.len], &IN1.body[P] , to_copy);
-        res.len += to_copy;
-    }
-
-    return res;
+    P = to_copy + L;
+    if( P < IN1->len )
+        __str_append(res, &IN1->body[P], IN1->len - P);
+    __str_end(res);
 }
 
 #define __iec_(TYPENAME) \
 static inline STRING REPLACE__STRING__STRING__STRING__##TYPENAME##__##TYPENAME(EN_ENO_PARAMS, STRING str1, STRING str2, TYPENAME L, TYPENAME P){\
+  STRING res;\
   TEST_EN_COND(STRING, L < 0 || P < 0)\
-  return (STRING)__replace(str1,str2,(__strlen_t)L,(__strlen_t)P);\
+  __replace(&res, &str1, &str2, (__strlen_t)L, (__strlen_t)P);\
+  return res;\
 }
 __ANY_INT(__iec_)
 #undef __iec_
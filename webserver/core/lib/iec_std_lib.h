@@ -229,6 +229,19 @@ static inline IEC_TIMESPEC __time_to_timespec(int sign, double mseconds, double
  *       They are therefore commented out. This however means that any change to the definition of IEC_TIMESPEC may require this
  *       macro to be updated too!
  */
+#ifdef OPLC_TIME_NS
+/* NOTE: With OPLC_TIME_NS the literal is first rounded to a whole number of nanoseconds, and then split
+ *       into seconds and nanoseconds with integer arithmetic. The result is always normalized, and
+ *       e.g. T#3.8s is exactly 3s 800 000 000 ns instead of being truncated to 3s 799 999 999 ns.
+ */
+#define __time_literal_ns(sign,mseconds,seconds,minutes,hours,days) \
+          ((long long)(((sign>=0)?1:-1)*(((((long double)days*24 + (long double)hours)*60 + (long double)minutes)*60 + (long double)seconds)*1e9L + (long double)mseconds*1e6L) + ((sign>=0)?0.5L:-0.5L)))
+#define __time_to_timespec(sign,mseconds,seconds,minutes,hours,days) \
+          ((IEC_TIMESPEC){\
+              /*tv_sec  =*/ ((long int)(__time_literal_ns(sign,mseconds,seconds,minutes,hours,days) / 1000000000LL)), \
+              /*tv_nsec =*/ ((long int)(__time_literal_ns(sign,mseconds,seconds,minutes,hours,days) % 1000000000LL)) \
+        })
+#else
 #define __time_to_timespec(sign,mseconds,seconds,minutes,hours,days) \
           ((IEC_TIMESPEC){\
               /*tv_sec  =*/ ((long int)   (((sign>=0)?1:-1)*((((long double)days*24 + (long double)hours)*60 + (long double)minutes)*60 + (long double)seconds + (long double)mseconds/1e3))), \
@@ -237,6 +250,7 @@ static inline IEC_TIMESPEC __time_to_timespec(int sign, double mseconds, double
                             ((long int)   (((sign>=0)?1:-1)*((((long double)days*24 + (long double)hours)*60 + (long double)minutes)*60 + (long double)seconds + (long double)mseconds/1e3)))   \
                             )*1e9))\
         })
+#endif
 
 
 
@@ -363,6 +377,40 @@ static inline IEC_TIMESPEC __dt_to_timespec(double seconds, double minutes, doub
 /* Time operations */
 /*******************/
 
+#ifdef OPLC_TIME_NS
+/* With OPLC_TIME_NS the time operations work on the time as a 64 bit count of nanoseconds: the
+ * additions and subtractions need no normalization branches, the comparisons are branch free, and
+ * the multiplications and divisions by integer values are exact.
+ */
+static inline LINT __time_to_ns(TIME t) {return (LINT)t.tv_sec * 1000000000LL + t.tv_nsec;}
+static inline TIME __ns_to_time(LINT ns){
+  TIME res = {(int32_t)(ns / 1000000000LL), (int32_t)(ns % 1000000000LL)};
+  return res;
+}
+
+#define __time_cmp(t1, t2) ((__time_to_ns(t1) > __time_to_ns(t2)) - (__time_to_ns(t1) < __time_to_ns(t2)))
+
+static inline TIME __time_add(TIME IN1, TIME IN2){
+  return __ns_to_time(__time_to_ns(IN1) + __time_to_ns(IN2));
+}
+static inline TIME __time_sub(TIME IN1, TIME IN2){
+  return __ns_to_time(__time_to_ns(IN1) - __time_to_ns(IN2));
+}
+static inline BOOL __time_integral_factor(LREAL IN2){
+  return (IN2 > -9.2e18) && (IN2 < 9.2e18) && ((LREAL)(LINT)IN2 == IN2);
+}
+static inline TIME __time_mul(TIME IN1, LREAL IN2){
+  if (__time_integral_factor(IN2))
+    return __ns_to_time(__time_to_ns(IN1) * (LINT)IN2);
+  long double ns = (long double)__time_to_ns(IN1) * IN2;
+  return __ns_to_time((LINT)(ns + (ns >= 0 ? 0.5L : -0.5L)));
+}
+static inline TIME __time_div(TIME IN1, LREAL IN2){
+  if (__time_integral_factor(IN2) && (IN2 != 0))
+    return __ns_to_time(__time_to_ns(IN1) / (LINT)IN2);
+  return __ns_to_time((LINT)((long double)__time_to_ns(IN1) / IN2));
+}
+#else
 #define __time_cmp(t1, t2) (t2.tv_sec == t1.tv_sec ? t1.tv_nsec - t2.tv_nsec : t1.tv_sec - t2.tv_sec)
 
 static inline TIME __time_add(TIME IN1, TIME IN2){
@@ -394,6 +442,7 @@ static inline TIME __time_div(TIME IN1, LREAL IN2){
   __normalize_timespec(&res);
   return res;
 }
+#endif
 
 
 /***************/
@@ -414,6 +463,12 @@ static inline LINT __preal_to_uint(LREAL IN) {
 static inline LINT __real_to_sint(LREAL IN)  {return (LINT)__preal_to_sint(IN);}
 static inline LWORD __real_to_bit(LREAL IN)  {return (LWORD)__preal_to_uint(IN);}
 static inline ULINT __real_to_uint(LREAL IN) {return (ULINT)__preal_to_uint(IN);}
+#ifdef OPLC_FIXED_REAL
+/* The fixed point REAL is rounded on its raw integer, without going through LREAL */
+static inline LINT __real_to_sint(REAL IN)  {return (LINT)__fixed_round(IN);}
+static inline LWORD __real_to_bit(REAL IN)  {return IN.raw < 0 ? 0 : (LWORD)__fixed_round(IN);}
+static inline ULINT __real_to_uint(REAL IN) {return IN.raw < 0 ? 0 : (ULINT)__fixed_round(IN);}
+#endif
 
     /***************/
     /*  TO_STRING  */
@@ -26,7 +26,13 @@ typedef uint16_t   IEC_WORD;
 typedef uint32_t   IEC_DWORD;
 typedef uint64_t   IEC_LWORD;
 
+#ifdef OPLC_FIXED_REAL
+/* REAL is a fixed point number on the targets without a floating point unit, see iec_fixed.h */
+#include "iec_fixed.h"
+typedef iec_fixed IEC_REAL;
+#else
 typedef float    IEC_REAL;
+#endif
 typedef double   IEC_LREAL;
 
 /* WARNING: When editing the definition of IEC_TIMESPEC, take note that 
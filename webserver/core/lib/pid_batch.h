@@ -0,0 +1,80 @@
+/************************************************************************
+ *                     DECLARATION OF PID_BATCH                         *
+************************************************************************/
+// The loops are computed by the runtime (pid_engine.cpp) once the program
+// has run, all instances together. A call hands the inputs of the instance
+// to its loop and gets back the output computed for the previous call
+
+extern "C" DINT __plc_pid_attach();
+extern "C" REAL __plc_pid_update(DINT slot, BOOL automatic, REAL pv, REAL sp, REAL x0,
+                                 REAL kp, REAL tr, REAL td, REAL cycle);
+
+// FUNCTION_BLOCK PID_BATCH
+// Data part
+typedef struct {
+  // FB Interface - IN, OUT, IN_OUT variables
+  __DECLARE_VAR(BOOL,EN)
+  __DECLARE_VAR(BOOL,ENO)
+  __DECLARE_VAR(BOOL,AUTO)
+  __DECLARE_VAR(REAL,PV)
+  __DECLARE_VAR(REAL,SP)
+  __DECLARE_VAR(REAL,X0)
+  __DECLARE_VAR(REAL,KP)
+  __DECLARE_VAR(REAL,TR)
+  __DECLARE_VAR(REAL,TD)
+  __DECLARE_VAR(TIME,CYCLE)
+  __DECLARE_VAR(REAL,XOUT)
+
+  // FB private variables - TEMP, private and located variables
+  __DECLARE_VAR(DINT,SLOT)
+
+} PID_BATCH;
+
+static void PID_BATCH_init__(PID_BATCH *data__, BOOL retain) {
+  __INIT_VAR(data__->EN,__BOOL_LITERAL(TRUE),retain)
+  __INIT_VAR(data__->ENO,__BOOL_LITERAL(TRUE),retain)
+  __INIT_VAR(data__->AUTO,__BOOL_LITERAL(FALSE),retain)
+  __INIT_VAR(data__->PV,0,retain)
+  __INIT_VAR(data__->SP,0,retain)
+  __INIT_VAR(data__->X0,0,retain)
+  __INIT_VAR(data__->KP,0,retain)
+  __INIT_VAR(data__->TR,0,retain)
+  __INIT_VAR(data__->TD,0,retain)
+  __INIT_VAR(data__->CYCLE,__time_to_timespec(1, 0, 0, 0, 0, 0),retain)
+  __INIT_VAR(data__->XOUT,0,retain)
+  __INIT_VAR(data__->SLOT,-1,retain)
+}
+
+// Code part
+static void PID_BATCH_body__(PID_BATCH *data__) {
+  // Control execution
+  if (!__GET_VAR(data__->EN)) {
+    __SET_VAR(data__->,ENO,,__BOOL_LITERAL(FALSE));
+    return;
+  }
+  else {
+    __SET_VAR(data__->,ENO,,__BOOL_LITERAL(TRUE));
+  }
+
+  // The loop is kept across online changes, the new instance gets the
+  // SLOT of the old one
+  DINT slot = __GET_VAR(data__->SLOT,);
+  if (slot < 0) {
+    slot = __plc_pid_attach();
+    __SET_VAR(data__->,SLOT,,slot);
+    if (slot < 0) {
+      __SET_VAR(data__->,ENO,,__BOOL_LITERAL(FALSE));
+      return;
+    }
+  }
+
+  __SET_VAR(data__->,XOUT,,__plc_pid_update(slot, __GET_VAR(data__->AUTO,), __GET_VAR(data__->PV,),
+                                            __GET_VAR(data__->SP,), __GET_VAR(data__->X0,),
+                                            __GET_VAR(data__->KP,), __GET_VAR(data__->TR,),
+                                            __GET_VAR(data__->TD,), (REAL)__time_to_real(__GET_VAR(data__->CYCLE,))));
+
+  goto __end;
+
+__end:
+  return;
+} // PID_BATCH_body__()
@@ -0,0 +1,312 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the lock profiler. Every place that takes bufferLock
+// does it through lockBuffer()/unlockBuffer(), which declare a static
+// LockSite for the call. While the profiler is on (lock_profiling(1) on the
+// interactive server) the time each call waited for the lock and the time
+// the lock was then held are recorded on histograms of the site, so the
+// holder that delays the scan can be told apart from the others. When it is
+// off, the wrappers only cost a relaxed load and a call. The same waits and
+// holds are recorded on the event trace while it runs (event_trace.cpp).
+//
+// Sites get a slot from a fixed table the first time they are profiled, so
+// nothing is allocated on the scan thread. The lock being held is tracked
+// per thread until it is released.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+
+#include "ladder.h"
+
+#ifdef OPLC_LOW_MEMORY
+#define LOCK_MAX_SITES          16
+#else
+#define LOCK_MAX_SITES          64
+#endif
+#define LOCK_SUB_BUCKET_BITS    2
+#define LOCK_SUB_BUCKETS        (1 << LOCK_SUB_BUCKET_BITS)
+#define LOCK_BUCKETS            (64 * LOCK_SUB_BUCKETS)
+#define HELD_LOCKS_MAX          4       // profiled locks a thread holds at once
+
+struct LockTimes
+{
+    std::atomic<uint64_t> buckets[LOCK_BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+};
+
+struct LockSlot
+{
+    const LockSite *site;
+    LockTimes wait;
+    LockTimes hold;
+};
+
+struct HeldLock
+{
+    pthread_mutex_t *lock;
+    LockSite *site;
+    LockSlot *slot;             // NULL if the lock profiler was off
+    struct timespec since;
+};
+
+static LockSlot slots[LOCK_MAX_SITES];
+static std::atomic<int> slots_used(0);
+static std::atomic<bool> lock_profiling(false);
+
+static thread_local HeldLock held[HELD_LOCKS_MAX];
+static thread_local int held_count = 0;
+
+//-----------------------------------------------------------------------------
+// Returns the nanoseconds elapsed between two times
+//-----------------------------------------------------------------------------
+static uint64_t elapsedNs(const struct timespec *start, const struct timespec *end)
+{
+    return (uint64_t)((end->tv_sec - start->tv_sec) * 1000000000LL + (end->tv_nsec - start->tv_nsec));
+}
+
+//-----------------------------------------------------------------------------
+// Histogram bucket of a value, 4 sub-buckets per power of two (~19%)
+//-----------------------------------------------------------------------------
+static int bucketIndex(uint64_t value)
+{
+    if (value < LOCK_SUB_BUCKETS) return (int)value;
+
+    int exponent = 63 - __builtin_clzll(value);
+    int sub_bucket = (int)((value >> (exponent - LOCK_SUB_BUCKET_BITS)) & (LOCK_SUB_BUCKETS - 1));
+    return (exponent - LOCK_SUB_BUCKET_BITS + 1) * LOCK_SUB_BUCKETS + sub_bucket;
+}
+
+static uint64_t bucketUpperBound(int index)
+{
+    if (index < LOCK_SUB_BUCKETS) return (uint64_t)index;
+
+    int exponent = index / LOCK_SUB_BUCKETS + LOCK_SUB_BUCKET_BITS - 1;
+    uint64_t sub_bucket = index % LOCK_SUB_BUCKETS;
+    return ((LOCK_SUB_BUCKETS + sub_bucket + 1) << (exponent - LOCK_SUB_BUCKET_BITS)) - 1;
+}
+
+//-----------------------------------------------------------------------------
+// Records a duration on a histogram. Several threads may record on the same
+// site, so every counter is updated atomically
+//-----------------------------------------------------------------------------
+static void recordLockTime(LockTimes *times, uint64_t duration_ns)
+{
+    times->buckets[bucketIndex(duration_ns)].fetch_add(1, std::memory_order_relaxed);
+    times->count.fetch_add(1, std::memory_order_relaxed);
+    times->sum.fetch_add(duration_ns, std::memory_order_relaxed);
+
+    uint64_t max = times->max.load(std::memory_order_relaxed);
+    while (duration_ns > max && !times->max.compare_exchange_weak(max, duration_ns, std::memory_order_relaxed));
+}
+
+//-----------------------------------------------------------------------------
+// Returns the slot of a site, assigning one the first time. Returns NULL
+// once the table is full
+//-----------------------------------------------------------------------------
+static LockSlot *siteSlot(LockSite *site)
+{
+    int slot = __atomic_load_n(&site->slot, __ATOMIC_ACQUIRE);
+    if (slot > 0) return &slots[slot - 1];
+
+    int index = slots_used.fetch_add(1, std::memory_order_relaxed);
+    if (index >= LOCK_MAX_SITES)
+    {
+        slots_used.store(LOCK_MAX_SITES, std::memory_order_relaxed);
+        return NULL;
+    }
+
+    // Another thread may assign the site at the same time, the slot of the
+    // one that loses stays unused
+    slots[index].site = site;
+    int expected = 0;
+    if (!__atomic_compare_exchange_n(&site->slot, &expected, index + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        slots[index].site = NULL;
+        return &slots[expected - 1];
+    }
+    return &slots[index];
+}
+
+//-----------------------------------------------------------------------------
+// Takes a lock for a call site, recording the time it waited for it on the
+// lock profiler and on the event trace, when they are on
+//-----------------------------------------------------------------------------
+void lockProfiled(pthread_mutex_t *lock, LockSite *site)
+{
+    bool profiling = lock_profiling.load(std::memory_order_relaxed);
+    if (!profiling && !__atomic_load_n(&event_tracing, __ATOMIC_RELAXED))
+    {
+        pthread_mutex_lock(lock);
+        return;
+    }
+
+    struct timespec start, acquired;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(lock);
+    clock_gettime(CLOCK_MONOTONIC, &acquired);
+
+    LockSlot *slot = profiling ? siteSlot(site) : NULL;
+    if (slot != NULL) recordLockTime(&slot->wait, elapsedNs(&start, &acquired));
+    TRACE_SPAN(TRACE_LOCK_WAIT, 0, 0, site, &start, &acquired);
+    if (held_count < HELD_LOCKS_MAX)
+    {
+        held[held_count].lock = lock;
+        held[held_count].site = site;
+        held[held_count].slot = slot;
+        held[held_count].since = acquired;
+        held_count++;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Releases a lock, recording the time it was held if it was taken while the
+// profiler or the event trace was on
+//-----------------------------------------------------------------------------
+void unlockProfiled(pthread_mutex_t *lock)
+{
+    for (int i = held_count - 1; i >= 0; i--)
+    {
+        if (held[i].lock != lock) continue;
+
+        struct timespec released;
+        clock_gettime(CLOCK_MONOTONIC, &released);
+        pthread_mutex_unlock(lock);
+        if (held[i].slot != NULL) recordLockTime(&held[i].slot->hold, elapsedNs(&held[i].since, &released));
+        TRACE_SPAN(TRACE_LOCK_HOLD, 0, 0, held[i].site, &held[i].since, &released);
+
+        held_count--;
+        for (int j = i; j < held_count; j++) held[j] = held[j + 1];
+        return;
+    }
+
+    pthread_mutex_unlock(lock);
+}
+
+//-----------------------------------------------------------------------------
+// Turns the lock profiler on or off. Turning it on clears the times recorded
+// before, the sites keep their slots
+//-----------------------------------------------------------------------------
+void setLockProfiling(bool enabled)
+{
+    if (enabled)
+    {
+        int used = slots_used.load(std::memory_order_relaxed);
+        for (int s = 0; s < used && s < LOCK_MAX_SITES; s++)
+        {
+            LockTimes *times[2] = { &slots[s].wait, &slots[s].hold };
+            for (LockTimes *t : times)
+            {
+                for (int i = 0; i < LOCK_BUCKETS; i++) t->buckets[i].store(0, std::memory_order_relaxed);
+                t->count.store(0, std::memory_order_relaxed);
+                t->sum.store(0, std::memory_order_relaxed);
+                t->max.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+    lock_profiling.store(enabled, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// Returns the value (in nanoseconds) below which the given fraction of the
+// samples of a histogram fall, clamped to its maximum
+//-----------------------------------------------------------------------------
+static uint64_t percentile(LockTimes *times, uint64_t total, double fraction)
+{
+    if (total == 0) return 0;
+
+    uint64_t target = (uint64_t)(fraction * total);
+    if (target == 0) target = 1;
+
+    uint64_t max = times->max.load(std::memory_order_relaxed);
+    uint64_t seen = 0;
+    for (int i = 0; i < LOCK_BUCKETS; i++)
+    {
+        seen += times->buckets[i].load(std::memory_order_relaxed);
+        if (seen >= target)
+        {
+            uint64_t bound = bucketUpperBound(i);
+            return bound > max ? max : bound;
+        }
+    }
+    return max;
+}
+
+//-----------------------------------------------------------------------------
+// Writes a text table with the wait and hold times (in microseconds) of
+// every call site, the sites that waited the longest in total first.
+// Returns the number of characters written
+//-----------------------------------------------------------------------------
+int getLockProfile(char *buffer, size_t buffer_size)
+{
+    int order[LOCK_MAX_SITES];
+    uint64_t waited[LOCK_MAX_SITES];
+    int count = 0;
+
+    int used = slots_used.load(std::memory_order_relaxed);
+    for (int s = 0; s < used && s < LOCK_MAX_SITES; s++)
+    {
+        if (slots[s].site == NULL) continue;
+        waited[s] = slots[s].wait.sum.load(std::memory_order_relaxed);
+
+        int i = count++;
+        while (i > 0 && waited[order[i - 1]] < waited[s])
+        {
+            order[i] = order[i - 1];
+            i--;
+        }
+        order[i] = s;
+    }
+
+    int written = snprintf(buffer, buffer_size, "lock profiling %s\n%-44s %10s %9s %9s %9s %11s %9s %9s %9s %11s\n",
+                           lock_profiling.load(std::memory_order_relaxed) ? "on" : "off",
+                           "site(us)", "count", "wait_p50", "wait_p99", "wait_max", "wait_total",
+                           "hold_p50", "hold_p99", "hold_max", "hold_total");
+
+    for (int n = 0; n < count && written < (int)buffer_size; n++)
+    {
+        LockSlot *slot = &slots[order[n]];
+        const LockSite *site = slot->site;
+        const char *file = strrchr(site->file, '/');
+        file = file != NULL ? file + 1 : site->file;
+
+        char name[128];
+        snprintf(name, sizeof(name), "%s %s:%d %s", site->lock_name, file, site->line, site->function);
+
+        uint64_t waits = slot->wait.count.load(std::memory_order_relaxed);
+        uint64_t holds = slot->hold.count.load(std::memory_order_relaxed);
+        written += snprintf(buffer + written, buffer_size - written,
+                            "%-44s %10llu %9.1f %9.1f %9.1f %11.1f %9.1f %9.1f %9.1f %11.1f\n",
+                            name, (unsigned long long)waits,
+                            percentile(&slot->wait, waits, 0.50) / 1000.0, percentile(&slot->wait, waits, 0.99) / 1000.0,
+                            slot->wait.max.load(std::memory_order_relaxed) / 1000.0, waited[order[n]] / 1000.0,
+                            percentile(&slot->hold, holds, 0.50) / 1000.0, percentile(&slot->hold, holds, 0.99) / 1000.0,
+                            slot->hold.max.load(std::memory_order_relaxed) / 1000.0,
+                            slot->hold.sum.load(std::memory_order_relaxed) / 1000.0);
+    }
+
+    if (written > (int)buffer_size) written = buffer_size;
+    return written;
+}
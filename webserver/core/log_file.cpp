@@ -0,0 +1,382 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the log file. When log_file.cfg gives it a path,
+// every message printed by the log drain thread (utils.cpp) is also kept
+// on disk, so the log of a runtime that crashed or was reset can still be
+// read.
+//
+// The drain thread only copies the formatted line to one of two buffers.
+// A writer thread swaps the buffers every flush interval (or sooner when
+// the active one is half full), writes the full one with a single write()
+// and calls fdatasync() every sync interval, so neither the threads that
+// log nor the console wait for the disk. The file is rotated when it gets
+// over its size or age: openplc.log becomes openplc.log.1, which becomes
+// openplc.log.2, and so on up to max_files. When the disk falls behind so
+// much that a buffer fills up, the lines that don't fit are counted and
+// the count is written to the file instead.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "ladder.h"
+
+#define LOG_FILE_CONFIG_FILE    "log_file.cfg"
+#define LOG_FILE_MAX_FILES      100
+#ifdef OPLC_LOW_MEMORY
+#define LOG_FILE_BUFFER_SIZE    (16 * 1024)     // each of the two buffers
+#else
+#define LOG_FILE_BUFFER_SIZE    (64 * 1024)     // each of the two buffers
+#endif
+
+struct LogFileConfig
+{
+    char path[256];
+    long max_size;              // bytes
+    long max_age;               // seconds, 0 for no limit
+    int max_files;
+    int flush_interval_ms;
+    int sync_interval_ms;
+    bool console;
+};
+
+static LogFileConfig config;
+
+// Lines waiting to be written. The drain thread appends to the active
+// buffer, the writer thread swaps them and writes the other one. Protected
+// by fileLock
+static char *buffers[2] = {NULL, NULL};
+static size_t buffer_length[2] = {0, 0};
+static int active_buffer = 0;
+static uint32_t lines_dropped = 0;
+static bool flush_requested = false;
+static pthread_mutex_t fileLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fileCond = PTHREAD_COND_INITIALIZER;
+
+// Only used by the writer thread (or after it stopped)
+static int log_fd = -1;
+static size_t file_size = 0;
+static time_t file_opened = 0;
+static struct timespec last_sync;
+
+static pthread_t log_file_thread;
+static volatile bool log_file_running = false;
+
+static const char *level_names[] = {"DEBUG", "INFO", "WARNING", "ERROR"};
+
+//-----------------------------------------------------------------------------
+// Applies one setting of log_file.cfg
+//-----------------------------------------------------------------------------
+static void applyLogFileSetting(const char *section, char *key, char *value, void *context)
+{
+    if (key == NULL) return;
+
+    if (strcmp(key, "path") == 0) strncpy(config.path, value, sizeof(config.path) - 1);
+    else if (strcmp(key, "max_size") == 0) config.max_size = atol(value) * 1024;
+    else if (strcmp(key, "max_age") == 0) config.max_age = atol(value) * 3600;
+    else if (strcmp(key, "max_files") == 0) config.max_files = atoi(value);
+    else if (strcmp(key, "flush_interval") == 0) config.flush_interval_ms = atoi(value);
+    else if (strcmp(key, "sync_interval") == 0) config.sync_interval_ms = atoi(value);
+    else if (strcmp(key, "console") == 0) config.console = strcmp(value, "false") != 0;
+}
+
+//-----------------------------------------------------------------------------
+// Reads log_file.cfg. Returns false if the file is missing or gives no
+// path, in which case there's no log file
+//-----------------------------------------------------------------------------
+static bool loadLogFileConfig()
+{
+    memset(&config, 0, sizeof(config));
+    config.max_size = 1024 * 1024;
+    config.max_age = 0;
+    config.max_files = 5;
+    config.flush_interval_ms = 1000;
+    config.sync_interval_ms = 5000;
+    config.console = true;
+
+    if (!parseSettingsFile(LOG_FILE_CONFIG_FILE, applyLogFileSetting, NULL)) return false;
+
+    if (config.max_size < 16 * 1024) config.max_size = 16 * 1024;
+    if (config.max_age < 0) config.max_age = 0;
+    if (config.max_files < 1) config.max_files = 1;
+    if (config.max_files > LOG_FILE_MAX_FILES) config.max_files = LOG_FILE_MAX_FILES;
+    if (config.flush_interval_ms < 10) config.flush_interval_ms = 10;
+    if (config.sync_interval_ms < 0) config.sync_interval_ms = 0;
+
+    return config.path[0] != '\0';
+}
+
+//-----------------------------------------------------------------------------
+// Opens the log file for appending. A file left by a previous run is kept
+// and counts towards the size limit
+//-----------------------------------------------------------------------------
+static bool openLogFile()
+{
+    log_fd = open(config.path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_fd < 0) return false;
+
+    struct stat st;
+    file_size = (fstat(log_fd, &st) == 0) ? (size_t)st.st_size : 0;
+    file_opened = time(NULL);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Closes the current file and shifts the rotated ones by one, dropping the
+// oldest, then opens a new file
+//-----------------------------------------------------------------------------
+static void rotateLogFile()
+{
+    char from[300], to[300];
+
+    fdatasync(log_fd);
+    close(log_fd);
+    log_fd = -1;
+
+    for (int i = config.max_files - 1; i >= 1; i--)
+    {
+        snprintf(from, sizeof(from), "%s.%d", config.path, i);
+        snprintf(to, sizeof(to), "%s.%d", config.path, i + 1);
+        rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", config.path);
+    rename(config.path, to);
+
+    openLogFile();
+    clock_gettime(CLOCK_MONOTONIC, &last_sync);
+}
+
+//-----------------------------------------------------------------------------
+// Writes a block to the log file, rotating it first if it is over its size
+// or age. Nothing is retried if the disk is full, the block is lost
+//-----------------------------------------------------------------------------
+static void writeLogFile(const char *data, size_t length)
+{
+    if (length == 0) return;
+
+    if (log_fd >= 0 && (file_size >= (size_t)config.max_size || (config.max_age > 0 && time(NULL) - file_opened >= config.max_age)))
+    {
+        rotateLogFile();
+    }
+    if (log_fd < 0 && !openLogFile()) return;
+
+    size_t written = 0;
+    while (written < length)
+    {
+        ssize_t n = write(log_fd, data + written, length - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        written += n;
+    }
+    file_size += written;
+}
+
+//-----------------------------------------------------------------------------
+// Takes the active buffer (and the count of the lines dropped) and writes
+// it to the file. Syncs the file if the sync interval elapsed, or always
+// when sync is set
+//-----------------------------------------------------------------------------
+static void flushLogFile(bool sync)
+{
+    pthread_mutex_lock(&fileLock);
+    int full = active_buffer;
+    active_buffer = 1 - active_buffer;
+    uint32_t dropped = lines_dropped;
+    lines_dropped = 0;
+    flush_requested = false;
+    pthread_mutex_unlock(&fileLock);
+
+    writeLogFile(buffers[full], buffer_length[full]);
+    buffer_length[full] = 0;
+    if (dropped > 0)
+    {
+        char line[128];
+        int length = snprintf(line, sizeof(line), "Log file behind, %u lines were dropped\n", dropped);
+        writeLogFile(line, length);
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long elapsed_ms = (now.tv_sec - last_sync.tv_sec) * 1000 + (now.tv_nsec - last_sync.tv_nsec) / 1000000;
+    if (log_fd >= 0 && (sync || elapsed_ms >= config.sync_interval_ms))
+    {
+        fdatasync(log_fd);
+        last_sync = now;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Thread that writes the buffered lines to the log file
+//-----------------------------------------------------------------------------
+static void *logFileThread(void *arg)
+{
+    setThreadClass(THREAD_CLASS_BACKGROUND, "log_file");
+
+    while (log_file_running)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += config.flush_interval_ms / 1000;
+        deadline.tv_nsec += (long)(config.flush_interval_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_nsec -= 1000000000;
+            deadline.tv_sec++;
+        }
+
+        pthread_mutex_lock(&fileLock);
+        while (log_file_running && !flush_requested)
+        {
+            if (pthread_cond_timedwait(&fileCond, &fileLock, &deadline) == ETIMEDOUT) break;
+        }
+        pthread_mutex_unlock(&fileLock);
+
+        flushLogFile(false);
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Appends a message to the log file. Called by the log drain thread for
+// every message it prints. timestamp is the CLOCK_MONOTONIC time of the
+// message, in ns. Never waits for the disk
+//-----------------------------------------------------------------------------
+void appendLogFile(uint64_t timestamp, int level, const char *text)
+{
+    if (!log_file_running) return;
+
+    // Wall clock time of the message, written in UTC
+    struct timespec now_mono, now_real;
+    clock_gettime(CLOCK_MONOTONIC, &now_mono);
+    clock_gettime(CLOCK_REALTIME, &now_real);
+    int64_t age = ((int64_t)now_mono.tv_sec * 1000000000LL + now_mono.tv_nsec) - (int64_t)timestamp;
+    int64_t real = (int64_t)now_real.tv_sec * 1000000000LL + now_real.tv_nsec - (age > 0 ? age : 0);
+    time_t seconds = (time_t)(real / 1000000000LL);
+    struct tm utc;
+    gmtime_r(&seconds, &utc);
+
+    size_t text_length = strlen(text);
+    while (text_length > 0 && (text[text_length - 1] == '\n' || text[text_length - 1] == '\r')) text_length--;
+
+    char line[512];
+    int length = snprintf(line, sizeof(line), "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ %-7s %.*s\n",
+                          utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday, utc.tm_hour, utc.tm_min, utc.tm_sec,
+                          (int)((real / 1000000) % 1000), level >= 0 && level <= LOG_LEVEL_ERROR ? level_names[level] : "?",
+                          (int)text_length, text);
+    if (length >= (int)sizeof(line))
+    {
+        length = sizeof(line) - 1;
+        line[length - 1] = '\n';
+    }
+
+    pthread_mutex_lock(&fileLock);
+    size_t *used = &buffer_length[active_buffer];
+    if (*used + length <= LOG_FILE_BUFFER_SIZE)
+    {
+        memcpy(buffers[active_buffer] + *used, line, length);
+        *used += length;
+    }
+    else
+    {
+        lines_dropped++;
+    }
+    if (*used >= LOG_FILE_BUFFER_SIZE / 2 && !flush_requested)
+    {
+        flush_requested = true;
+        pthread_cond_signal(&fileCond);
+    }
+    pthread_mutex_unlock(&fileLock);
+}
+
+//-----------------------------------------------------------------------------
+// Starts the log file writer if log_file.cfg gives a path. Called when the
+// log starts, before the first message is printed
+//-----------------------------------------------------------------------------
+void startLogFile()
+{
+    char log_msg[1000];
+
+    if (log_file_running || !loadLogFileConfig()) return;
+
+    // The directory of the file is created, but not its parents
+    char directory[256];
+    strncpy(directory, config.path, sizeof(directory) - 1);
+    directory[sizeof(directory) - 1] = '\0';
+    char *slash = strrchr(directory, '/');
+    if (slash != NULL && slash != directory)
+    {
+        *slash = '\0';
+        mkdir(directory, 0755);
+    }
+
+    if (buffers[0] == NULL)
+    {
+        buffers[0] = (char *)malloc(LOG_FILE_BUFFER_SIZE);
+        buffers[1] = (char *)malloc(LOG_FILE_BUFFER_SIZE);
+    }
+    if (buffers[0] == NULL || buffers[1] == NULL || !openLogFile())
+    {
+        sprintf(log_msg, "Log file: can't open %s => %s\n", config.path, strerror(errno));
+        openplc_log(log_msg);
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &last_sync);
+
+    log_file_running = true;
+    if (pthread_create(&log_file_thread, NULL, logFileThread, NULL) != 0)
+    {
+        log_file_running = false;
+        close(log_fd);
+        log_fd = -1;
+        openplc_log((char *)"Log file: failed to start the writer thread\n");
+        return;
+    }
+    setLogConsole(config.console);
+
+    sprintf(log_msg, "Log file: writing to %s (%ld kB per file, %d rotated files kept)\n",
+            config.path, config.max_size / 1024, config.max_files);
+    openplc_log(log_msg);
+}
+
+//-----------------------------------------------------------------------------
+// Stops the writer thread, writes what is still buffered and syncs the file.
+// Called once the log drain thread stopped
+//-----------------------------------------------------------------------------
+void stopLogFile()
+{
+    if (!log_file_running) return;
+
+    pthread_mutex_lock(&fileLock);
+    log_file_running = false;
+    pthread_cond_signal(&fileCond);
+    pthread_mutex_unlock(&fileLock);
+    pthread_join(log_file_thread, NULL);
+
+    flushLogFile(true);
+    close(log_fd);
+    log_fd = -1;
+}
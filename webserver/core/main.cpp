@@ -47,6 +47,7 @@ IEC_BOOL __DEBUG;
 unsigned long __tick = 0;
 pthread_mutex_t bufferLock; //mutex for the internal buffers
 uint8_t run_openplc = 1; //Variable to control OpenPLC Runtime execution
+bool scan_paced_by_hardware = false; //Set by hardware layers that pace the scan themselves
 //static pthread_t opcua_thread; // OPC UA server thread
 
 
@@ -63,11 +64,51 @@ uint64_t *lint_input_call_back(int a){ return lint_input[a]; }
 uint64_t *lint_output_call_back(int a){ return lint_output[a]; }
 void logger_callback(char *msg){ openplc_log(msg);}
 
+//-----------------------------------------------------------------------------
+// Startup phases (startup.cpp)
+//-----------------------------------------------------------------------------
+static void initializeProgram()
+{
+    plcProgram()->config_init();
+    plcProgram()->glue_vars();
+}
+
+static void initializeIO()
+{
+#ifdef _ethercat_src
+    type_logger_callback logger = logger_callback;
+    ethercat_configure("../utils/ethercat_src/build/ethercat.cfg", logger);
+#endif
+    initializeHardware();
+    initializeHardwareDrivers();
+    initializeMB();
+    initializeS7Master();
+
+    updateBuffersIn();
+    updateBuffersOut();
+}
+
+static void initializeRetentives()
+{
+    readPersistentStorage();
+}
+
+static void initializeServices()
+{
+    buildTagDatabase();
+    startOpcuaPubSub();
+    startNetworkVariables();
+    startHistorian();
+    startMetrics();
+    logMemoryReport();
+}
+
 int main(int argc,char **argv)
 {
     // Define the max/min/avg/total cycle and latency variables used in REAL-TIME computation(in nanoseconds)
     long cycle_avg, cycle_max, cycle_min, cycle_total;
     long latency_avg, latency_max, latency_min, latency_total;
+    unsigned long scan_count = 0;
     cycle_max = 0;
     cycle_min = LONG_MAX;
     cycle_total = 0;
@@ -75,6 +116,10 @@ int main(int argc,char **argv)
     latency_min = LONG_MAX;
     latency_total = 0;
 
+    configureHeap();
+    loadThreadConfig();
+    initializeLog();
+
     char log_msg[1000];
     sprintf(log_msg, "OpenPLC Runtime starting...\n");
     openplc_log(log_msg);
@@ -84,10 +129,22 @@ int main(int argc,char **argv)
     //======================================================
     tzset();
     time(&start_time);
+    startClockThread();
+    // openplc --replay <recording> [repeat] runs the program on the scans of
+    // an input recording (input_record.cpp) and exits, without the hardware
+    // or any server
+    bool replay = argc >= 3 && strcmp(argv[1], "--replay") == 0;
+
+    // openplc --virtual-time runs the scans back to back on a simulated
+    // clock (scan_scheduler.cpp), for simulations faster than real time
+    if (argc >= 2 && strcmp(argv[1], "--virtual-time") == 0) setVirtualTime(true);
     pthread_t interactive_thread;
-    pthread_create(&interactive_thread, NULL, interactiveServerThread, NULL);
-    config_init__();
-    glueVars();
+    if (!replay) pthread_create(&interactive_thread, NULL, interactiveServerThread, NULL);
+    initializePlcProgram();
+    runStartupPhase("program", initializeProgram);
+    // Workers for the parallel groups of programs.cfg, if any. The event
+    // tasks it binds to inputs are needed by the hardware layer
+    startProgramWorkers();
 
     //======================================================
     //               MUTEX INITIALIZATION
@@ -99,31 +156,38 @@ int main(int argc,char **argv)
     }
 
     //======================================================
-    //              HARDWARE INITIALIZATION
+    //                  INPUT REPLAY
     //======================================================
-#ifdef _ethercat_src
-    type_logger_callback logger = logger_callback; 
-    ethercat_configure("../utils/ethercat_src/build/ethercat.cfg", logger);
-#endif
-    initializeHardware();
-    initializeMB();
-
-    updateBuffersIn();
-    updateBuffersOut();
+    if (replay)
+    {
+        mapUnusedIO();
+        return replayInputRecord(argv[2], argc >= 4 && atoi(argv[3]) > 0 ? atoi(argv[3]) : 1) == 0 ? 0 : 1;
+    }
 
     //======================================================
-    //          PERSISTENT STORAGE INITIALIZATION
+    //          HARDWARE AND RETENTIVES, IN PARALLEL
     //======================================================
-    glueVars();
+    // The first scan needs the I/O and the retentive variables, they are
+    // initialized at the same time. The pointer tables don't change from
+    // here on
     mapUnusedIO();
-    readPersistentStorage();
-    //pthread_t persistentThread;
-    //pthread_create(&persistentThread, NULL, persistentStorage, NULL);
+    freezeImagePointers();
+    buildImageRanges();
+    int retentives = startStartupPhase("persistent storage", initializeRetentives);
+    runStartupPhase("I/O", initializeIO);
+    waitStartupPhase(retentives);
+    runStartupPhase("hardware drivers", startHardwareDrivers);
+    runStartupPhase("EtherCAT cycle", startEthercatCycle); // master thread of ethercat_cycle.cfg, if any
+
+    //======================================================
+    //          PUBLISHED PROCESS IMAGE INITIALIZATION
+    //======================================================
+    initializeProcessImage();
 
     //======================================================
     //            S7 PROTOCOL INITIALIZATION
     //======================================================
-    initializeSnap7();
+    runStartupPhase("S7 server", initializeSnap7);
 
     //======================================================
     //            OPC UA INITIALIZATION
@@ -131,20 +195,40 @@ int main(int argc,char **argv)
     initializeOpcua();
     // OPC UA server is started by the webserver based on database settings
 
+    //======================================================
+    //        TAG DATABASE AND SERVICES, IN BACKGROUND
+    //======================================================
+    // The OPC UA PubSub datasets of opcua_pubsub.cfg, the historian of
+    // historian.cfg and the /metrics of metrics.cfg are not needed by the
+    // scan, they start on the tag database while the scan runs
+    startStartupPhase("tag database and services", initializeServices);
+
+    //======================================================
+    //                  REDUNDANCY
+    //======================================================
+    runStartupPhase("redundancy", startRedundancy); // primary or standby of redundancy.cfg, if any
+
+    //======================================================
+    //                  RATE LIMITS
+    //======================================================
+    loadRateLimits(); // client classes and limits of rate_limits.cfg, if any
+
+    //======================================================
+    //                  SCAN ALIGNMENT
+    //======================================================
+    loadScanAlignment(); // tick grid of the network time base of scan_alignment.cfg, if any
+
 
 
 #ifdef __linux__
     //======================================================
     //              REAL-TIME INITIALIZATION
     //======================================================
-    // Set our thread to real time priority
-    struct sched_param sp;
-    sp.sched_priority = 30;
+    // Set our thread to real time priority and the CPUs configured for the
+    // scan class (threads.cfg)
     printf("Setting main thread priority to RT\n");
-    if(pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp))
-    {
-        printf("WARNING: Failed to set main thread to real-time priority\n");
-    }
+    setThreadClass(THREAD_CLASS_SCAN, "scan");
+    registerSampledThread();
 
     // Lock memory to ensure no swapping is done.
     printf("Locking main thread memory\n");
@@ -157,10 +241,17 @@ int main(int argc,char **argv)
     // Define the start, end, cycle time and latency time variables
     struct timespec cycle_start, cycle_end, cycle_time;
     struct timespec timer_start, timer_end, sleep_latency;
+    unsigned long virtual_ticks = 0; //ticks the last scan stood for, on virtual time
 
     //gets the starting point for the clock
     printf("Getting current time\n");
     clock_gettime(CLOCK_MONOTONIC, &timer_start);
+    startScanWatchdog();
+
+    logStartupPhases();
+
+    // From here on the scan thread is not expected to allocate from the heap
+    armHeapCheck(getThreadHeapCheck(THREAD_CLASS_SCAN));
 
     //======================================================
     //                    MAIN LOOP
@@ -169,101 +260,193 @@ int main(int argc,char **argv)
     {
         // Get the start time for the running cycle
         clock_gettime(CLOCK_MONOTONIC, &cycle_start);
+        if (virtual_ticks > 0) advanceScanClock((int64_t)virtual_ticks * *plcProgram()->common_ticktime, &cycle_start);
+        else updateScanClock(&cycle_start);
+        virtual_ticks = 0;
+        plcProgram()->update_time(); //__CURRENT_TIME of this scan
 
-        //make sure the buffer pointers are correct and
-        //attached to the user variables
-        glueVars();
-        
+        struct timespec phase_start = cycle_start;
 #ifdef _ethercat_src
-        boolvar_call_back bool_input_callback = bool_input_call_back;
-        boolvar_call_back bool_output_callback = bool_output_call_back;
-        int8var_call_back byte_input_callback = byte_input_call_back;
-        int8var_call_back byte_output_callback = byte_output_call_back;
-        int16var_call_back int_input_callback = int_input_call_back;
-        int16var_call_back int_output_callback = int_output_call_back;
-        int32var_call_back dint_input_callback = dint_input_call_back;
-        int32var_call_back dint_output_callback = dint_output_call_back;
-        int64var_call_back lint_input_callback = lint_input_call_back;
-        int64var_call_back lint_output_callback = lint_output_call_back;
-#endif
-        
-        updateBuffersIn(); //read input image
-
-        pthread_mutex_lock(&bufferLock); //lock mutex
-
-
-#ifdef _ethercat_src
-        if(ethercat_callcyclic(BUFFER_SIZE, 
-                bool_input_callback, 
-                bool_output_callback, 
-                byte_input_callback, 
-                byte_output_callback, 
-                int_input_callback, 
-                int_output_callback, 
-                dint_input_call_back, 
-                dint_output_call_back, 
-                lint_input_call_back, 
-                lint_output_call_back)){
+        // Exchange the EtherCAT process data as soon as the scan wakes up on
+        // its tick, before any hardware layer access that may take a variable
+        // time, so the frames leave the master at a fixed phase of the cycle
+        // and the slave sync events can be configured on the same period.
+        // When the master has a thread of its own (ethercat_cycle.cfg) the
+        // frames leave on its cycle instead, and the scan only swaps the
+        // process data with it
+        if (!runEthercatCycle())
+        {
             printf("EtherCAT cyclic failed\n");
             break;
         }
+        profileScanPhase(PROFILE_ETHERCAT, &phase_start);
 #endif
+        updateBuffersIn(); //read input image
+        markInputScanTime(); //the time the input changes of this scan are stamped with
+        waitMBInputs(); //slave devices polled in step with the scan
+        profileScanPhase(PROFILE_INPUTS, &phase_start);
+
+        lockBuffer();
+        profileScanPhase(PROFILE_LOCK_WAIT, &phase_start);
+        bool standby = redundancyStandby(); //a standby follows the primary instead of running
+        applyOnlineChange(); //swap in the program loaded by an online change
+
         updateBuffersIn_MB(); //update input image table with data from slave devices
+        updateBuffersIn_S7(); //and with the data blocks polled from remote S7 PLCs
+        updateBuffersIn_NetVars(); //and with the network variables of other runtimes
+        exchangeHardwareDriverInputs(); //inputs acquired by the drivers during the last scan
+        exchangeEthercatInputs(); //and by the EtherCAT master thread
+        profileScanPhase(PROFILE_MB_INPUTS, &phase_start);
+        applyProcessImageWrites(); //apply writes queued by the protocol servers
+        opcuaApplyWrites(); //apply the OPC UA client writes as one batch
+        applyForcedVariables(); //apply the debugger force requests as one batch
+        profileScanPhase(PROFILE_PROTOCOL_WRITES, &phase_start);
         handleSpecialFunctions();
-        config_run__(__tick++); // execute plc program logic
+        profileScanPhase(PROFILE_SPECIAL_FUNCTIONS, &phase_start);
+        overlayForcedVariables(); //direct access programs read the forced values
+        if (!standby)
+        {
+            recordScanInputs(); //log what changed since the last run, when recording
+            plcProgram()->config_run(__tick++); // execute plc program logic
+            solvePidLoops(); //compute the PID_BATCH loops called by the program
+            recordScanOutputs();
+        }
+        overlayForcedVariables(); //and don't publish what they wrote over them
+        profileScanPhase(PROFILE_PROGRAM, &phase_start);
         
         
         // Update Modbus outputs while holding the lock
-        updateBuffersOut_MB(); //update slave devices with data from the output image table
-        pthread_mutex_unlock(&bufferLock); //unlock mutex
-
-        // Update OPC UA node values from PLC variables so clients see latest values
-        // Do this OUTSIDE bufferLock to avoid deadlocks with the OPC UA server thread
-        opcuaUpdateNodeValues();
+        if (!standby)
+        {
+            updateBuffersOut_MB(); //update slave devices with data from the output image table
+            exchangeHardwareDriverOutputs(); //hand the outputs to the driver I/O threads
+            exchangeEthercatOutputs(); //and to the EtherCAT master thread
+        }
+        profileScanPhase(PROFILE_MB_OUTPUTS, &phase_start);
+
+        // Commit the physical outputs before the image is published, unless
+        // the scan is set to write them last (scan_phase_order). The
+        // publication takes the lock again, the protocol writes queued in
+        // the meantime wait for the next scan as usual
+        bool outputs_first = (getScanPhaseOrder() == SCAN_OUTPUTS_FIRST);
+        if (outputs_first)
+        {
+            unlockBuffer();
+            if (!standby) updateBuffersOut(); //write output image
+            lockBuffer();
+            profileScanPhase(PROFILE_OUTPUTS, &phase_start);
+        }
 
-        updateBuffersOut(); //write output image
-        
-        updateTime();
+        captureRedundancyState(); //copy the state for the standby, before the publication wakes its sender
+        publishProcessImage(); //publish the new image for lock-free protocol reads
+        updateSnap7Image(); //refresh the S7 server shadow areas
+        updateRetainMemory(); //copy the retentive memory to its mapped region
+        captureTrace(); //sample the traced debug variables
+        profileScanPhase(PROFILE_PUBLISH_IMAGE, &phase_start);
+
+        // Copy the OPC UA node values. The OPC UA thread writes the changed
+        // ones to its address space, so this never blocks on the server.
+        // While the scan is overloaded only some scans are copied
+        if (!shedScanWork()) opcuaUpdateNodeValues();
+        unlockBuffer();
+        profileScanPhase(PROFILE_OPCUA_SYNC, &phase_start);
+
+        if (!outputs_first)
+        {
+            if (!standby) updateBuffersOut(); //write output image
+            profileScanPhase(PROFILE_OUTPUTS, &phase_start);
+        }
 
         // Get the end time for the running cycle
         clock_gettime(CLOCK_MONOTONIC, &cycle_end);
         // Compute the time usage in one cycle and do max/min/total comparison/recording
         timespec_diff(&cycle_end, &cycle_start, &cycle_time);
-        if (cycle_time.tv_nsec > cycle_max)
-            cycle_max = cycle_time.tv_nsec;
-        if (cycle_time.tv_nsec < cycle_min)
-            cycle_min = cycle_time.tv_nsec;
-        cycle_total = cycle_total + cycle_time.tv_nsec;
-
-        sleep_until(&timer_start, common_ticktime__);
+        long cycle_ns = (long)cycle_time.tv_sec * 1000000000L + cycle_time.tv_nsec;
+        if (cycle_ns > cycle_max)
+            cycle_max = cycle_ns;
+        if (cycle_ns < cycle_min)
+            cycle_min = cycle_ns;
+        cycle_total = cycle_total + cycle_ns;
+        recordScanPhase(PROFILE_SCAN, (uint64_t)cycle_ns);
+        TRACE_SPAN(TRACE_SCAN_PHASE, PROFILE_SCAN, 0, NULL, &cycle_start, &cycle_end);
+
+        scan_count++;
+
+        // Skip the ticks on which no task is due, sleeping straight to the next one.
+        // __CURRENT_TIME doesn't count the scans: updateTime reads it from the
+        // scan clock, so the timers still advance by every tick skipped here
+        unsigned long idle_ticks = ticksToNextTask(__tick);
+        __tick += idle_ticks;
+        if (scan_paced_by_hardware)
+        {
+            // The hardware layer waits for the next step (lockstep simulation),
+            // so the scan doesn't wait for its tick
+            restartScanTimer(&timer_start);
+        }
+        else if (virtualTimeScan())
+        {
+            // The next scan starts right away, the scan clock is moved by
+            // the ticks this one stands for
+            virtual_ticks = idle_ticks + 1;
+            restartScanTimer(&timer_start);
+        }
+        else
+        {
+            // Sleep to the deadline of the next tick. Overruns are handled by
+            // the scheduler, which may drop the ticks that were missed
+            __tick += waitNextScan(&timer_start, *plcProgram()->common_ticktime, idle_ticks + 1);
+        }
 
         // Get the sleep end point which is also the start time/point of the next cycle
         clock_gettime(CLOCK_MONOTONIC, &timer_end);
         // Compute the time latency of the next cycle(caused by sleep) and do max/min/total comparison/recording
         timespec_diff(&timer_end, &timer_start, &sleep_latency);
-        if (sleep_latency.tv_nsec > latency_max)
-            latency_max = sleep_latency.tv_nsec;
-        if (sleep_latency.tv_nsec < latency_min)
-            latency_min = sleep_latency.tv_nsec;
-        latency_total = latency_total + sleep_latency.tv_nsec;
+        long latency_ns = (long)sleep_latency.tv_sec * 1000000000L + sleep_latency.tv_nsec;
+        if (latency_ns > latency_max)
+            latency_max = latency_ns;
+        if (latency_ns < latency_min)
+            latency_min = latency_ns;
+        latency_total = latency_total + latency_ns;
+        recordScanPhase(PROFILE_SLEEP_LATENCY, (uint64_t)latency_ns);
+        TRACE_SPAN(TRACE_SCAN_PHASE, PROFILE_SLEEP_LATENCY, 0, NULL, &timer_start, &timer_end);
 
         // Store the cycle_time/sleep_latency in microsecond, so it can be displayed in the webpage
-        RecordCycletimeLatency((long)cycle_time.tv_nsec / 1000, (long)sleep_latency.tv_nsec / 1000);
+        RecordCycletimeLatency(cycle_ns / 1000, latency_ns / 1000);
     }
 
+    armHeapCheck(HEAP_CHECK_OFF);
+
     // Compute/print the max/min/avg cycle time and latency
-    cycle_avg = (long)cycle_total / __tick;
-    latency_avg = (long)latency_total / __tick;
-    printf("###Summary: The maximum/minimum/average cycle time in microsecond is %ld/%ld/%ld\n",
-    cycle_max / 1000, cycle_min / 1000, cycle_avg / 1000);
-    printf("###Summary: The maximum/minimum/average latency in microsecond is %ld/%ld/%ld\n",
-    latency_max / 1000,   latency_min / 1000, latency_avg / 1000);
+    if (scan_count > 0)
+    {
+        cycle_avg = (long)cycle_total / scan_count;
+        latency_avg = (long)latency_total / scan_count;
+        printf("###Summary: The maximum/minimum/average cycle time in microsecond is %ld/%ld/%ld\n",
+        cycle_max / 1000, cycle_min / 1000, cycle_avg / 1000);
+        printf("###Summary: The maximum/minimum/average latency in microsecond is %ld/%ld/%ld\n",
+        latency_max / 1000,   latency_min / 1000, latency_avg / 1000);
+
+        // Full distribution of every phase, plus the cycle time and latency
+        // histograms, for qualifying boards and kernels (see utils/benchmark_src)
+        static char report[16384];
+        printf("###Profile:\n");
+        getScanProfile(report, sizeof(report));
+        printf("%s", report);
+        getScanHistogram(PROFILE_SCAN, report, sizeof(report));
+        printf("###Histogram:\n%s", report);
+        getScanHistogram(PROFILE_SLEEP_LATENCY, report, sizeof(report));
+        printf("###Histogram:\n%s", report);
+        fflush(stdout);
+    }
     
     //======================================================
     //             SHUTTING DOWN OPENPLC RUNTIME
     //======================================================
     pthread_join(interactive_thread, NULL);
+    stopScanWatchdog();
+    stopInputRecord();
 #ifdef _ethercat_src
+    stopEthercatCycle();
     ethercat_terminate_src();
 #endif
 
@@ -272,10 +455,18 @@ int main(int argc,char **argv)
     stopOpcua();
     pthread_join(opcua_thread, NULL);
     finalizeOpcua();
+    stopOpcuaPubSub();
+    stopNetworkVariables();
+    stopHistorian();
+    stopRedundancy();
+    stopMetrics();
     printf("Disabling outputs\n");
     disableOutputs();
     updateBuffersOut();
+    finalizeHardwareDrivers();
     finalizeHardware();
+    finalizeSharedImage();
+    finalizeLog();
     printf("Shutting down OpenPLC Runtime...\n");
     exit(0);
 }
\ No newline at end of file
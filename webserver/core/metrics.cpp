@@ -0,0 +1,490 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the metrics exporter. When metrics.cfg gives it a
+// port, a thread serves GET /metrics in the Prometheus text format (0.0.4,
+// which OpenMetrics scrapers also accept) with the scan phase histograms,
+// the scheduler counters, the traffic of the protocol servers and the
+// memory used by the process.
+//
+// Everything exported is kept on relaxed atomic counters that their owners
+// update as they go: the scan thread only ever increments its histograms,
+// and the protocol servers call recordProtocol*() from their own threads.
+// A scrape reads the counters, it never takes bufferLock nor waits for the
+// scan.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <atomic>
+
+#include "ladder.h"
+
+#define METRICS_CONFIG_FILE     "metrics.cfg"
+#define METRICS_OUTPUT_SIZE     (128 * 1024)
+#define METRICS_REQUEST_SIZE    4096
+#define METRICS_READ_TIMEOUT    1000
+#define METRICS_BOUNDS          17
+
+// Upper bounds of the histogram buckets, in nanoseconds. The same buckets
+// are used for the scan phases and the protocol requests
+static const uint64_t bounds_ns[METRICS_BOUNDS] =
+{
+    1000, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+    1000000, 2500000, 5000000, 10000000, 25000000, 50000000,
+    100000000, 250000000, 1000000000
+};
+
+static const char *protocol_names[PROTOCOL_TYPES] = { "modbus", "dnp3", "enip", "opcua", "s7" };
+
+struct ProtocolMetrics
+{
+    std::atomic<int64_t> connections;
+    std::atomic<uint64_t> connections_total;
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> errors;
+    std::atomic<uint64_t> throttled;
+    std::atomic<uint64_t> latency_buckets[METRICS_BOUNDS + 1]; // last one is +Inf
+    std::atomic<uint64_t> latency_sum;
+};
+
+struct MetricsConfig
+{
+    char port[8];
+    char bind[64];
+};
+
+struct MetricsOutput
+{
+    char *buffer;
+    size_t length;
+};
+
+static ProtocolMetrics protocols[PROTOCOL_TYPES];
+static MetricsConfig config;
+static pthread_t metrics_thread;
+static volatile bool metrics_running = false;
+static int listen_fd = -1;
+
+//-----------------------------------------------------------------------------
+// Applies one setting of metrics.cfg
+//-----------------------------------------------------------------------------
+static void applyMetricsSetting(const char *section, char *key, char *value, void *context)
+{
+    if (key == NULL) return;
+
+    if (strcmp(key, "port") == 0) strncpy(config.port, value, sizeof(config.port) - 1);
+    else if (strcmp(key, "bind") == 0) strncpy(config.bind, value, sizeof(config.bind) - 1);
+}
+
+//-----------------------------------------------------------------------------
+// Reads metrics.cfg. Returns false if the file is missing or gives no port,
+// in which case the exporter doesn't run
+//-----------------------------------------------------------------------------
+static bool loadMetricsConfig()
+{
+    memset(&config, 0, sizeof(config));
+
+    if (!parseSettingsFile(METRICS_CONFIG_FILE, applyMetricsSetting, NULL)) return false;
+
+    return atoi(config.port) > 0;
+}
+
+//-----------------------------------------------------------------------------
+// Counts a client connecting to (opened) or leaving (!opened) a protocol
+// server
+//-----------------------------------------------------------------------------
+void recordProtocolConnection(int protocol, bool opened)
+{
+    if (protocol < 0 || protocol >= PROTOCOL_TYPES) return;
+
+    ProtocolMetrics *m = &protocols[protocol];
+    if (opened)
+    {
+        m->connections.fetch_add(1, std::memory_order_relaxed);
+        m->connections_total.fetch_add(1, std::memory_order_relaxed);
+    }
+    else
+    {
+        m->connections.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Counts a request served by a protocol server, and whether it failed
+//-----------------------------------------------------------------------------
+void recordProtocolRequest(int protocol, bool error)
+{
+    if (protocol < 0 || protocol >= PROTOCOL_TYPES) return;
+
+    protocols[protocol].requests.fetch_add(1, std::memory_order_relaxed);
+    if (error) protocols[protocol].errors.fetch_add(1, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// Counts a request held back by the rate limits of a protocol server
+//-----------------------------------------------------------------------------
+void recordProtocolThrottled(int protocol)
+{
+    if (protocol < 0 || protocol >= PROTOCOL_TYPES) return;
+
+    protocols[protocol].throttled.fetch_add(1, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// Records the time a protocol server took to process a request
+//-----------------------------------------------------------------------------
+void recordProtocolLatency(int protocol, uint64_t duration_ns)
+{
+    if (protocol < 0 || protocol >= PROTOCOL_TYPES) return;
+
+    ProtocolMetrics *m = &protocols[protocol];
+    int bucket = 0;
+    while (bucket < METRICS_BOUNDS && duration_ns > bounds_ns[bucket]) bucket++;
+    m->latency_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    m->latency_sum.fetch_add(duration_ns, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// Appends formatted text to the output. Text that doesn't fit is dropped
+//-----------------------------------------------------------------------------
+static void appendMetric(MetricsOutput *out, const char *format, ...)
+{
+    if (out->length >= METRICS_OUTPUT_SIZE - 1) return;
+
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(out->buffer + out->length, METRICS_OUTPUT_SIZE - out->length, format, args);
+    va_end(args);
+    if (n < 0) return;
+    out->length += (size_t)n;
+    if (out->length >= METRICS_OUTPUT_SIZE) out->length = METRICS_OUTPUT_SIZE - 1;
+}
+
+//-----------------------------------------------------------------------------
+// Appends the buckets, sum and count of one histogram series. counts holds
+// the cumulative count of each bound
+//-----------------------------------------------------------------------------
+static void appendHistogram(MetricsOutput *out, const char *name, const char *label, const char *value,
+                            const uint64_t *counts, uint64_t total, uint64_t sum_ns)
+{
+    for (int b = 0; b < METRICS_BOUNDS; b++)
+    {
+        appendMetric(out, "%s_bucket{%s=\"%s\",le=\"%g\"} %llu\n", name, label, value,
+                     bounds_ns[b] / 1e9, (unsigned long long)counts[b]);
+    }
+    appendMetric(out, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %llu\n", name, label, value, (unsigned long long)total);
+    appendMetric(out, "%s_sum{%s=\"%s\"} %.9f\n", name, label, value, sum_ns / 1e9);
+    appendMetric(out, "%s_count{%s=\"%s\"} %llu\n", name, label, value, (unsigned long long)total);
+}
+
+//-----------------------------------------------------------------------------
+// Scan phases and scheduler counters
+//-----------------------------------------------------------------------------
+static void appendScanMetrics(MetricsOutput *out)
+{
+    uint64_t counts[METRICS_BOUNDS];
+    uint64_t sum_ns;
+
+    appendMetric(out, "# HELP openplc_scan_phase_seconds Time spent on each phase of the scan cycle. scan_total is the cycle time, "
+                      "sleep_latency the delay of the wake up and lock_wait the wait for bufferLock\n");
+    appendMetric(out, "# TYPE openplc_scan_phase_seconds histogram\n");
+    for (int phase = 0; phase < PROFILE_PHASES; phase++)
+    {
+        uint64_t total = getScanPhaseCounts(phase, bounds_ns, METRICS_BOUNDS, counts, &sum_ns);
+        appendHistogram(out, "openplc_scan_phase_seconds", "phase", scanPhaseName(phase), counts, total, sum_ns);
+    }
+
+    SchedulerCounters scheduler;
+    getSchedulerCounters(&scheduler);
+    appendMetric(out, "# HELP openplc_scan_overruns_total Scans that missed their deadline\n");
+    appendMetric(out, "# TYPE openplc_scan_overruns_total counter\n");
+    appendMetric(out, "openplc_scan_overruns_total %llu\n", (unsigned long long)scheduler.overruns);
+    appendMetric(out, "# HELP openplc_scan_missed_ticks_total Ticks skipped because of overruns\n");
+    appendMetric(out, "# TYPE openplc_scan_missed_ticks_total counter\n");
+    appendMetric(out, "openplc_scan_missed_ticks_total %llu\n", (unsigned long long)scheduler.missed_ticks);
+    appendMetric(out, "# HELP openplc_scan_watchdog_alarms_total Times the scan watchdog expired\n");
+    appendMetric(out, "# TYPE openplc_scan_watchdog_alarms_total counter\n");
+    appendMetric(out, "openplc_scan_watchdog_alarms_total %llu\n", (unsigned long long)scheduler.watchdog_alarms);
+}
+
+//-----------------------------------------------------------------------------
+// Connections, requests and request latencies of the protocol servers
+//-----------------------------------------------------------------------------
+static void appendProtocolMetrics(MetricsOutput *out)
+{
+    appendMetric(out, "# HELP openplc_protocol_connections Clients connected to a protocol server (OPC UA sessions)\n");
+    appendMetric(out, "# TYPE openplc_protocol_connections gauge\n");
+    for (int p = 0; p < PROTOCOL_TYPES; p++)
+    {
+        int64_t connections = protocols[p].connections.load(std::memory_order_relaxed);
+        appendMetric(out, "openplc_protocol_connections{protocol=\"%s\"} %lld\n", protocol_names[p], (long long)(connections < 0 ? 0 : connections));
+    }
+
+    appendMetric(out, "# HELP openplc_protocol_connections_total Clients accepted by a protocol server\n");
+    appendMetric(out, "# TYPE openplc_protocol_connections_total counter\n");
+    for (int p = 0; p < PROTOCOL_TYPES; p++)
+    {
+        appendMetric(out, "openplc_protocol_connections_total{protocol=\"%s\"} %llu\n", protocol_names[p],
+                     (unsigned long long)protocols[p].connections_total.load(std::memory_order_relaxed));
+    }
+
+    appendMetric(out, "# HELP openplc_protocol_requests_total Requests served by a protocol server (DNP3 commands, OPC UA node reads and writes)\n");
+    appendMetric(out, "# TYPE openplc_protocol_requests_total counter\n");
+    for (int p = 0; p < PROTOCOL_TYPES; p++)
+    {
+        appendMetric(out, "openplc_protocol_requests_total{protocol=\"%s\"} %llu\n", protocol_names[p],
+                     (unsigned long long)protocols[p].requests.load(std::memory_order_relaxed));
+    }
+
+    appendMetric(out, "# HELP openplc_protocol_errors_total Requests answered with an error or dropped\n");
+    appendMetric(out, "# TYPE openplc_protocol_errors_total counter\n");
+    for (int p = 0; p < PROTOCOL_TYPES; p++)
+    {
+        appendMetric(out, "openplc_protocol_errors_total{protocol=\"%s\"} %llu\n", protocol_names[p],
+                     (unsigned long long)protocols[p].errors.load(std::memory_order_relaxed));
+    }
+
+    appendMetric(out, "# HELP openplc_protocol_throttled_total Requests delayed by the rate limits (rate_limits.cfg)\n");
+    appendMetric(out, "# TYPE openplc_protocol_throttled_total counter\n");
+    for (int p = 0; p < PROTOCOL_TYPES; p++)
+    {
+        appendMetric(out, "openplc_protocol_throttled_total{protocol=\"%s\"} %llu\n", protocol_names[p],
+                     (unsigned long long)protocols[p].throttled.load(std::memory_order_relaxed));
+    }
+
+    appendMetric(out, "# HELP openplc_protocol_request_seconds Time taken to process a request (Modbus/TCP and EtherNet/IP)\n");
+    appendMetric(out, "# TYPE openplc_protocol_request_seconds histogram\n");
+    for (int p = 0; p < PROTOCOL_TYPES; p++)
+    {
+        if (p != MODBUS_PROTOCOL && p != ENIP_PROTOCOL) continue;
+
+        uint64_t counts[METRICS_BOUNDS];
+        uint64_t total = 0;
+        for (int b = 0; b < METRICS_BOUNDS; b++)
+        {
+            total += protocols[p].latency_buckets[b].load(std::memory_order_relaxed);
+            counts[b] = total;
+        }
+        total += protocols[p].latency_buckets[METRICS_BOUNDS].load(std::memory_order_relaxed);
+        appendHistogram(out, "openplc_protocol_request_seconds", "protocol", protocol_names[p], counts, total,
+                        protocols[p].latency_sum.load(std::memory_order_relaxed));
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Memory and CPU used by the process, with the names of the Prometheus
+// client libraries
+//-----------------------------------------------------------------------------
+static void appendProcessMetrics(MetricsOutput *out)
+{
+    unsigned long long size = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f != NULL)
+    {
+        if (fscanf(f, "%llu %llu", &size, &resident) != 2) size = resident = 0;
+        fclose(f);
+    }
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    appendMetric(out, "# HELP process_resident_memory_bytes Resident memory size in bytes\n");
+    appendMetric(out, "# TYPE process_resident_memory_bytes gauge\n");
+    appendMetric(out, "process_resident_memory_bytes %llu\n", resident * page_size);
+    appendMetric(out, "# HELP process_virtual_memory_bytes Virtual memory size in bytes\n");
+    appendMetric(out, "# TYPE process_virtual_memory_bytes gauge\n");
+    appendMetric(out, "process_virtual_memory_bytes %llu\n", size * page_size);
+
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        double cpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+        appendMetric(out, "# HELP process_cpu_seconds_total User and system CPU time spent in seconds\n");
+        appendMetric(out, "# TYPE process_cpu_seconds_total counter\n");
+        appendMetric(out, "process_cpu_seconds_total %.3f\n", cpu);
+        appendMetric(out, "# HELP process_major_page_faults_total Page faults that needed I/O\n");
+        appendMetric(out, "# TYPE process_major_page_faults_total counter\n");
+        appendMetric(out, "process_major_page_faults_total %ld\n", usage.ru_majflt);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Writes a whole buffer to a client. Returns false if the client is gone
+//-----------------------------------------------------------------------------
+static bool sendAll(int fd, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Reads the request of a scraper and answers it. Only GET /metrics is
+// served, every response closes the connection
+//-----------------------------------------------------------------------------
+static void serveClient(int fd, MetricsOutput *out)
+{
+    char request[METRICS_REQUEST_SIZE];
+    size_t length = 0;
+
+    while (length < sizeof(request) - 1)
+    {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, METRICS_READ_TIMEOUT) <= 0) return;
+        ssize_t n = recv(fd, request + length, sizeof(request) - 1 - length, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        length += (size_t)n;
+        request[length] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) break;
+    }
+    request[length] = '\0';
+
+    char header[256];
+    const char *status = NULL;
+    if (strncmp(request, "GET ", 4) != 0)
+    {
+        status = "405 Method Not Allowed";
+    }
+    else if (strncmp(request + 4, "/metrics ", 9) != 0 && strncmp(request + 4, "/metrics?", 9) != 0)
+    {
+        status = "404 Not Found";
+    }
+    if (status != NULL)
+    {
+        int n = snprintf(header, sizeof(header), "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status);
+        sendAll(fd, header, n);
+        return;
+    }
+
+    out->length = 0;
+    appendScanMetrics(out);
+    appendProtocolMetrics(out);
+    appendProcessMetrics(out);
+
+    int n = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                                             "Content-Length: %zu\r\nConnection: close\r\n\r\n", out->length);
+    if (sendAll(fd, header, n)) sendAll(fd, out->buffer, out->length);
+}
+
+//-----------------------------------------------------------------------------
+// Thread of the exporter. Serves the scrapers one at a time
+//-----------------------------------------------------------------------------
+static void *metricsThread(void *arg)
+{
+    setThreadClass(THREAD_CLASS_BACKGROUND, "metrics");
+
+    MetricsOutput out;
+    out.buffer = (char *)malloc(METRICS_OUTPUT_SIZE);
+    out.length = 0;
+    if (out.buffer == NULL)
+    {
+        openplc_log((char *)"Metrics: not enough memory for the exporter\n");
+        return NULL;
+    }
+
+    while (metrics_running)
+    {
+        struct pollfd pfd = {listen_fd, POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0) continue;
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) continue;
+
+        serveClient(fd, &out);
+        close(fd);
+    }
+
+    free(out.buffer);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Starts the exporter if metrics.cfg gives it a port
+//-----------------------------------------------------------------------------
+void startMetrics()
+{
+    char log_msg[1000];
+
+    if (metrics_running || !loadMetricsConfig()) return;
+
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(config.bind[0] ? config.bind : NULL, config.port, &hints, &result) == 0)
+    {
+        listen_fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+        int reuse = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (listen_fd >= 0 && (bind(listen_fd, result->ai_addr, result->ai_addrlen) != 0 || listen(listen_fd, 4) != 0))
+        {
+            close(listen_fd);
+            listen_fd = -1;
+        }
+        freeaddrinfo(result);
+    }
+    if (listen_fd < 0)
+    {
+        sprintf(log_msg, "Metrics: can't listen on port %s => %s\n", config.port, strerror(errno));
+        openplc_log(log_msg);
+        return;
+    }
+
+    metrics_running = true;
+    if (pthread_create(&metrics_thread, NULL, metricsThread, NULL) != 0)
+    {
+        metrics_running = false;
+        close(listen_fd);
+        listen_fd = -1;
+        openplc_log((char *)"Metrics: failed to start the exporter thread\n");
+        return;
+    }
+
+    sprintf(log_msg, "Metrics: serving /metrics on port %s\n", config.port);
+    openplc_log(log_msg);
+}
+
+//-----------------------------------------------------------------------------
+// Stops the exporter, if it was started
+//-----------------------------------------------------------------------------
+void stopMetrics()
+{
+    if (!metrics_running) return;
+
+    metrics_running = false;
+    pthread_join(metrics_thread, NULL);
+    close(listen_fd);
+    listen_fd = -1;
+}
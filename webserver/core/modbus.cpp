@@ -26,16 +26,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <stddef.h>
 #include <pthread.h>
 
 #include "ladder.h"
 #include <string.h>
+#include <atomic>
 
 #define MAX_DISCRETE_INPUT              8192
 #define MAX_COILS                       8192
 #define MAX_HOLD_REGS                   8192
 #define MAX_INP_REGS                    1024
 
+#define MAX_READ_BITS                   2000 // Largest quantity of coils/inputs a read can ask for
+#define MAX_READ_REGISTERS              125  // Largest quantity of registers a read can ask for
+#define MAX_WRITE_COILS                 1968 // Largest quantity of coils a write can set
+#define MAX_WRITE_REGISTERS             123  // Largest quantity of registers a write can set
+#define MAX_RW_WRITE_REGISTERS          121  // Largest quantity of registers a read/write can write
+#define MB_CACHE_SLOTS                  64   // Slots of the register read response cache
+
 #define MIN_16B_RANGE                   1024
 #define MAX_16B_RANGE                   2047
 #define MIN_32B_RANGE                   2048
@@ -52,11 +61,16 @@
 #define MB_FC_WRITE_REGISTER            6
 #define MB_FC_WRITE_MULTIPLE_COILS      15
 #define MB_FC_WRITE_MULTIPLE_REGISTERS  16
+#define MB_FC_READ_WRITE_MULTIPLE_REGISTERS 23
 #define MB_FC_DEBUG_INFO                0x41 // Request debug variables count
 #define MB_FC_DEBUG_SET                 0x42 // Debug set trace (force variable)
 #define MB_FC_DEBUG_GET                 0x43 // Debug get trace (read variables)
 #define MB_FC_DEBUG_GET_LIST            0x44 // Debug get trace list (read list of variables)
 #define MB_FC_DEBUG_GET_MD5             0x45 // Debug get current program MD5
+#define MB_FC_DEBUG_TRACE               0x46 // Debug variable trace (start, stop, read samples)
+#define MB_FC_DEBUG_SUBSCRIBE           0x47 // Debug subscription (register variables, poll changes)
+#define MB_FC_DEBUG_SET_LIST            0x48 // Debug set trace list (force a group of variables)
+#define MB_FC_DEBUG_DESCRIBE            0x49 // Debug program descriptor and variable layout
 #define MB_FC_ERROR                     255
 
 #define ERR_NONE                        0
@@ -75,12 +89,47 @@
 #define lowByte(w) ((unsigned char) ((w) & 0xff))
 #define highByte(w) ((unsigned char) ((w) >> 8))
 
-IEC_BOOL mb_discrete_input[MAX_DISCRETE_INPUT];
-IEC_BOOL mb_coils[MAX_COILS];
-IEC_UINT mb_input_regs[MAX_INP_REGS];
-IEC_UINT mb_holding_regs[MAX_HOLD_REGS];
+thread_local int MessageLength; // protocol workers process messages concurrently
+
+//-----------------------------------------------------------------------------
+// Holding register address map. Built once at startup so that the register
+// handlers resolve every address with a single lookup instead of walking the
+// 16/32/64-bit range ladder. Registers mapped to consecutive 16-bit slots of
+// the same image area form runs that are copied in bulk
+//-----------------------------------------------------------------------------
+struct HoldingRegisterDescriptor
+{
+    uint32_t image_offset;  // byte offset of the value on ProcessImageSnapshot
+    uint16_t index;         // index of the value on its process image area
+    uint16_t run_length;    // 16-bit registers left on this run, 0 for 32/64-bit lanes
+    uint8_t area;           // PI_* area written through the write queue
+    uint8_t width;          // size of the value in bytes
+    uint8_t shift;          // bit offset of this word inside the value
+};
 
-int MessageLength;
+static HoldingRegisterDescriptor holding_map[MAX_HOLD_REGS];
+
+//-----------------------------------------------------------------------------
+// Optional response cache for register reads. Redundant HMIs tend to poll the
+// same blocks, so the encoded payload of a read is kept on a direct-mapped
+// slot together with the version of the image it came from. A payload from an
+// older version is still served while the scans since then didn't change the
+// registers it holds. Workers never wait for a slot: if it is busy the read
+// is served normally
+//-----------------------------------------------------------------------------
+struct ResponseCacheEntry
+{
+    pthread_mutex_t lock;
+    uint32_t version;       // process image version the payload was read from
+    uint8_t function;
+    uint16_t start;
+    uint16_t count;         // 0 while the slot is empty
+    unsigned char payload[MAX_READ_REGISTERS * 2];
+};
+
+static ResponseCacheEntry response_cache[MB_CACHE_SLOTS];
+static pthread_once_t response_cache_once = PTHREAD_ONCE_INIT;
+static std::atomic<bool> response_cache_enabled(false);
 
 #include "debug.h"
 
@@ -101,6 +150,65 @@ extern unsigned long __tick;
 #define SAME_ENDIANNESS                  0
 #define REVERSE_ENDIANNESS               1
 #define MAX_MB_FRAME                     260
+#define MB_TRACE_START                   0x01
+#define MB_TRACE_STOP                    0x02
+#define MB_TRACE_READ                    0x03
+#define MB_TRACE_ARM                     0x04
+#define MAX_MB_FORCES                    1024 // Largest group of variables a DEBUG_SET_LIST can force
+#define MAX_TRACE_DATA                   8192 // Largest block of encoded samples on a trace response
+#define MB_SUBSCRIBE_SET                 0x01
+#define MB_SUBSCRIBE_POLL                0x02
+#define MAX_SUBSCRIBED_VARS              1024
+#define SUBSCRIPTION_SHADOW_SIZE         (64 * 1024)
+#define MAX_SUBSCRIPTION_DATA            4096 // Largest block of changes on a poll response
+#define MB_DESCRIBE_PROGRAM              0x01
+#define MB_DESCRIBE_LAYOUT               0x02
+#define MAX_LAYOUT_DATA                  8192 // Largest block of variable sizes on a layout response
+#define MAX_BUILD_INFO                   512
+#define BUILD_INFO_FILE                  "./core/openplc.build"
+
+//-----------------------------------------------------------------------------
+// Debug variable subscription. The client registers the variables once;
+// every poll compares them with the values it saw last (shadow) and stamps
+// the ones that changed with the poll sequence number
+//-----------------------------------------------------------------------------
+struct DebugSubscription
+{
+    pthread_mutex_t lock;
+    uint16_t count;
+    uint32_t sequence;
+    uint16_t indexes[MAX_SUBSCRIBED_VARS];
+    uint32_t offset[MAX_SUBSCRIBED_VARS];   // position of the value on shadow
+    uint16_t size[MAX_SUBSCRIBED_VARS];
+    uint32_t changed[MAX_SUBSCRIBED_VARS];  // sequence of the last change
+    uint32_t shadow_size;
+    uint8_t shadow[SUBSCRIPTION_SHADOW_SIZE];
+};
+
+static DebugSubscription subscription = {PTHREAD_MUTEX_INITIALIZER};
+
+//-----------------------------------------------------------------------------
+// Descriptor of the running program for the debugger: everything it checks
+// before attaching, built once per program (an online change replaces the
+// debug entry points, and the descriptor with them). The sizes of the debug
+// variables are kept as base-128 varints, with the position of every 64th
+// one, so a layout block starts anywhere without walking the table
+//-----------------------------------------------------------------------------
+struct ProgramDescriptor
+{
+    pthread_mutex_t lock;
+    size_t (*get_var_size)(size_t);         // program the descriptor was built for
+    uint16_t count;
+    uint32_t layout;                        // FNV-1a of the sizes, as on the state files
+    uint32_t total_size;
+    uint8_t md5_length;
+    uint16_t build_length;
+    char build[MAX_BUILD_INFO];             // core/openplc.build, one setting per line
+    uint8_t *sizes;
+    uint32_t *marks;                        // position on sizes of variable i * 64
+};
+
+static ProgramDescriptor descriptor = {PTHREAD_MUTEX_INITIALIZER};
 
 //-----------------------------------------------------------------------------
 // Concatenate two bytes into an int
@@ -114,48 +222,162 @@ int word(unsigned char byte1, unsigned char byte2)
 }
 
 //-----------------------------------------------------------------------------
-// This function sets the internal NULL OpenPLC buffers to point to valid
-// positions on the Modbus buffer
+// Initializes the response cache slots
 //-----------------------------------------------------------------------------
-void mapUnusedIO()
+static void initializeResponseCache()
 {
-    pthread_mutex_lock(&bufferLock);
-
-    for(int i = 0; i < MAX_DISCRETE_INPUT; i++)
+    for (int i = 0; i < MB_CACHE_SLOTS; i++)
     {
-        if (bool_input[i/8][i%8] == NULL) bool_input[i/8][i%8] = &mb_discrete_input[i];
+        pthread_mutex_init(&response_cache[i].lock, NULL);
+        response_cache[i].count = 0;
     }
+}
 
-    for(int i = 0; i < MAX_COILS; i++)
+//-----------------------------------------------------------------------------
+// Enables or disables the register read response cache
+//-----------------------------------------------------------------------------
+void setModbusResponseCache(bool enabled)
+{
+    pthread_once(&response_cache_once, initializeResponseCache);
+    response_cache_enabled.store(enabled, std::memory_order_release);
+}
+
+//-----------------------------------------------------------------------------
+// Returns the cache slot used by a read request
+//-----------------------------------------------------------------------------
+static ResponseCacheEntry *responseCacheSlot(int function, int start, int count)
+{
+    uint32_t key = ((uint32_t)start << 16) ^ ((uint32_t)count << 4) ^ (uint32_t)function;
+    key *= 2654435761U;
+    return &response_cache[key % MB_CACHE_SLOTS];
+}
+
+//-----------------------------------------------------------------------------
+// Returns true if the scans published after version since changed any of the
+// registers of a read request
+//-----------------------------------------------------------------------------
+static bool registersChanged(int function, int start, int count, uint32_t since, uint32_t version)
+{
+    ProcessImageChanges changes;
+    if (!getProcessImageChanges(since, version, &changes)) return true;
+
+    if (function == MB_FC_READ_INPUT_REGISTERS)
     {
-        if (bool_output[i/8][i%8] == NULL) bool_output[i/8][i%8] = &mb_coils[i];
+        return processImageChanged(&changes, offsetof(ProcessImageSnapshot, int_input) + start * sizeof(IEC_UINT), count * sizeof(IEC_UINT));
     }
+    for (int i = start; i < start + count; i++)
+    {
+        if (processImageChanged(&changes, holding_map[i].image_offset, holding_map[i].width)) return true;
+    }
+    return false;
+}
 
-    for (int i = 0; i < MAX_INP_REGS; i++)
+//-----------------------------------------------------------------------------
+// Copies a cached payload for the read request into payload if there is one
+// still valid for the given process image version. Returns true on a hit
+//-----------------------------------------------------------------------------
+static bool readCachedResponse(int function, int start, int count, uint32_t version, unsigned char *payload)
+{
+    ResponseCacheEntry *entry = responseCacheSlot(function, start, count);
+    if (pthread_mutex_trylock(&entry->lock) != 0) return false;
+
+    bool hit = (entry->count == count && entry->start == start && entry->function == function);
+    if (hit && entry->version != version)
     {
-        if (int_input[i] == NULL) int_input[i] = &mb_input_regs[i];
+        hit = !registersChanged(function, start, count, entry->version, version);
+        if (hit) entry->version = version;
     }
+    if (hit) memcpy(payload, entry->payload, count * 2);
+
+    pthread_mutex_unlock(&entry->lock);
+    return hit;
+}
+
+//-----------------------------------------------------------------------------
+// Stores the payload of a read request read from the given image version
+//-----------------------------------------------------------------------------
+static void storeCachedResponse(int function, int start, int count, uint32_t version, const unsigned char *payload)
+{
+    ResponseCacheEntry *entry = responseCacheSlot(function, start, count);
+    if (pthread_mutex_trylock(&entry->lock) != 0) return;
+
+    entry->version = version;
+    entry->function = function;
+    entry->start = start;
+    entry->count = count;
+    memcpy(entry->payload, payload, count * 2);
+
+    pthread_mutex_unlock(&entry->lock);
+}
+
+//-----------------------------------------------------------------------------
+// Fills one holding register descriptor. The first word of a 32 or 64-bit
+// register is the most significant one
+//-----------------------------------------------------------------------------
+static void mapHoldingRegister(int position, uint8_t area, uint32_t area_offset, int index, int width, int lane)
+{
+    HoldingRegisterDescriptor *d = &holding_map[position];
+    d->image_offset = area_offset + index * width;
+    d->index = index;
+    d->run_length = 0;
+    d->area = area;
+    d->width = width;
+    d->shift = (width / 2 - 1 - lane) * 16;
+}
 
-    for (int i = 0; i <= MAX_16B_RANGE; i++)
+//-----------------------------------------------------------------------------
+// Builds the holding register address map for the whole 0..MAX_HOLD_REGS
+// space and computes the length of the contiguous 16-bit runs
+//-----------------------------------------------------------------------------
+static void buildHoldingRegisterMap()
+{
+    for (int position = 0; position < MAX_HOLD_REGS; position++)
     {
-        if (i < MIN_16B_RANGE)  
+        if (position < MIN_16B_RANGE)
         {
-            if (int_output[i] == NULL)
-            {
-                int_output[i] = &mb_holding_regs[i];
-            }
+            mapHoldingRegister(position, PI_INT_OUTPUT, offsetof(ProcessImageSnapshot, int_output), position, 2, 0);
         }
+        else if (position <= MAX_16B_RANGE)
+        {
+            mapHoldingRegister(position, PI_INT_MEMORY, offsetof(ProcessImageSnapshot, int_memory), position - MIN_16B_RANGE, 2, 0);
+        }
+        else if (position <= MAX_32B_RANGE)
+        {
+            int offset = position - MIN_32B_RANGE;
+            mapHoldingRegister(position, PI_DINT_MEMORY, offsetof(ProcessImageSnapshot, dint_memory), offset / 2, 4, offset % 2);
+        }
+        else
+        {
+            int offset = position - MIN_64B_RANGE;
+            mapHoldingRegister(position, PI_LINT_MEMORY, offsetof(ProcessImageSnapshot, lint_memory), offset / 4, 8, offset % 4);
+        }
+    }
 
-        else if (i >= MIN_16B_RANGE && i <= MAX_16B_RANGE)
+    // Walk backwards so each 16-bit register knows how many follow it on the
+    // same area
+    for (int position = MAX_HOLD_REGS - 1; position >= 0; position--)
+    {
+        HoldingRegisterDescriptor *d = &holding_map[position];
+        if (d->width != 2) continue;
+
+        d->run_length = 1;
+        if (position + 1 < MAX_HOLD_REGS && holding_map[position + 1].width == 2 &&
+            holding_map[position + 1].area == d->area)
         {
-            if (int_memory[i - MIN_16B_RANGE] == NULL)
-            {
-                int_memory[i - MIN_16B_RANGE] = &mb_holding_regs[i];
-            }
+            d->run_length += holding_map[position + 1].run_length;
         }
     }
+}
 
-    pthread_mutex_unlock(&bufferLock);
+//-----------------------------------------------------------------------------
+// Prepares the Modbus address maps. glueVars points every buffer entry at its
+// slot of the images, so the addresses the program doesn't locate need no
+// storage of their own: the I/O ones are read from the images and the memory
+// ones read as zero (see buildImageRanges)
+//-----------------------------------------------------------------------------
+void mapUnusedIO()
+{
+    buildHoldingRegisterMap();
 }
 
 //-----------------------------------------------------------------------------
@@ -171,12 +393,12 @@ void ModbusError(unsigned char *buffer, int mb_error)
 }
 
 //-----------------------------------------------------------------------------
-// Implementation of Modbus/TCP Read Coils
+// Common implementation of Read Coils and Read Discrete Inputs. The bits are
+// read from the packed bool area at image_offset on the published snapshot
 //-----------------------------------------------------------------------------
-void ReadCoils(unsigned char *buffer, int bufferSize)
+static void ReadBits(unsigned char *buffer, int bufferSize, size_t image_offset, int max_bits)
 {
-    int Start, ByteDataLength, CoilDataLength;
-    int mb_error = ERR_NONE;
+    int Start, ByteDataLength, BitDataLength;
 
     //this request must have at least 12 bytes. If it doesn't, it's a corrupted message
     if (bufferSize < 12)
@@ -186,12 +408,19 @@ void ReadCoils(unsigned char *buffer, int bufferSize)
     }
 
     Start = word(buffer[8], buffer[9]);
-    CoilDataLength = word(buffer[10], buffer[11]);
-    ByteDataLength = CoilDataLength / 8; //calculating the size of the message in bytes
-    if(ByteDataLength * 8 < CoilDataLength) ByteDataLength++;
+    BitDataLength = word(buffer[10], buffer[11]);
+    ByteDataLength = BitDataLength / 8; //calculating the size of the message in bytes
+    if(ByteDataLength * 8 < BitDataLength) ByteDataLength++;
+
+    //asked for an invalid quantity of bits
+    if (BitDataLength < 1 || BitDataLength > MAX_READ_BITS)
+    {
+        ModbusError(buffer, ERR_ILLEGAL_DATA_VALUE);
+        return;
+    }
 
-    //asked for too many coils
-    if (ByteDataLength > 255)
+    //invalid address
+    if (Start + BitDataLength > max_bits)
     {
         ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
         return;
@@ -202,39 +431,24 @@ void ReadCoils(unsigned char *buffer, int bufferSize)
     buffer[5] = lowByte(ByteDataLength + 3); //Number of bytes after this one
     buffer[8] = ByteDataLength;     //Number of bytes of data
 
-    pthread_mutex_lock(&bufferLock);
-    for(int i = 0; i < ByteDataLength ; i++)
+    uint32_t sequence;
+    const ProcessImageSnapshot *image;
+    do
     {
-        for(int j = 0; j < 8; j++)
-        {
-            int position = Start + i * 8 + j;
-            if (position < MAX_COILS)
-            {
-                if (bool_output[position/8][position%8] != NULL)
-                {
-                    bitWrite(buffer[9 + i], j, *bool_output[position/8][position%8]);
-                }
-                else
-                {
-                    bitWrite(buffer[9 + i], j, 0);
-                }
-            }
-            else //invalid address
-            {
-                mb_error = ERR_ILLEGAL_DATA_ADDRESS;
-            }
-        }
-    }
-    pthread_mutex_unlock(&bufferLock);
+        image = beginProcessImageRead(&sequence);
+        const IEC_BYTE *bits = (const IEC_BYTE *)image + image_offset;
+        copyPackedBits(bits, Start, BitDataLength, &buffer[9]);
+    } while (!endProcessImageRead(image, sequence));
 
-    if (mb_error != ERR_NONE)
-    {
-        ModbusError(buffer, mb_error);
-    }
-    else
-    {
-        MessageLength = ByteDataLength + 9;
-    }
+    MessageLength = ByteDataLength + 9;
+}
+
+//-----------------------------------------------------------------------------
+// Implementation of Modbus/TCP Read Coils
+//-----------------------------------------------------------------------------
+void ReadCoils(unsigned char *buffer, int bufferSize)
+{
+    ReadBits(buffer, bufferSize, offsetof(ProcessImageSnapshot, bool_output_bits), MAX_COILS);
 }
 
 //-----------------------------------------------------------------------------
@@ -242,66 +456,68 @@ void ReadCoils(unsigned char *buffer, int bufferSize)
 //-----------------------------------------------------------------------------
 void ReadDiscreteInputs(unsigned char *buffer, int bufferSize)
 {
-    int Start, ByteDataLength, InputDataLength;
-    int mb_error = ERR_NONE;
-
-    //this request must have at least 12 bytes. If it doesn't, it's a corrupted message
-    if (bufferSize < 12)
-    {
-        ModbusError(buffer, ERR_ILLEGAL_DATA_VALUE);
-        return;
-    }
-
-    Start = word(buffer[8],buffer[9]);
-    InputDataLength = word(buffer[10],buffer[11]);
-    ByteDataLength = InputDataLength / 8;
-    if(ByteDataLength * 8 < InputDataLength) ByteDataLength++;
-
-    //asked for too many inputs
-    if (ByteDataLength > 255)
-    {
-        ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
-        return;
-    }
-
-    //Preparing response
-    buffer[4] = highByte(ByteDataLength + 3);
-    buffer[5] = lowByte(ByteDataLength + 3); //Number of bytes after this one
-    buffer[8] = ByteDataLength;     //Number of bytes of data
+    ReadBits(buffer, bufferSize, offsetof(ProcessImageSnapshot, bool_input_bits), MAX_DISCRETE_INPUT);
+}
 
-    pthread_mutex_lock(&bufferLock);
-    for(int i = 0; i < ByteDataLength ; i++)
+//-----------------------------------------------------------------------------
+// Copies count holding registers from start into out, big endian, all of
+// them from the same published snapshot. The range must be valid
+//-----------------------------------------------------------------------------
+static void copyHoldingRegisters(int start, int count, unsigned char *out)
+{
+    uint32_t sequence;
+    const ProcessImageSnapshot *image;
+    do
     {
-        for(int j = 0; j < 8; j++)
+        image = beginProcessImageRead(&sequence);
+        const unsigned char *base = (const unsigned char *)image;
+        unsigned char *dst = out;
+        int i = 0;
+        while (i < count)
         {
-            int position = Start + i * 8 + j;
-            if (position < MAX_DISCRETE_INPUT)
+            const HoldingRegisterDescriptor *d = &holding_map[start + i];
+            if (d->width == 2)
             {
-                if (bool_input[position/8][position%8] != NULL)
-                {
-                    bitWrite(buffer[9 + i], j, *bool_input[position/8][position%8]);
-                }
-                else
+                //16-bit run: bulk copy swapping every word to big endian
+                int run = d->run_length;
+                if (run > count - i) run = count - i;
+                const IEC_UINT *src = (const IEC_UINT *)(base + d->image_offset);
+                for (int j = 0; j < run; j++)
                 {
-                    bitWrite(buffer[9 + i], j, 0);
+                    dst[j * 2] = highByte(src[j]);
+                    dst[j * 2 + 1] = lowByte(src[j]);
                 }
+                dst += run * 2;
+                i += run;
             }
-            else //invalid address
+            else
             {
-                mb_error = ERR_ILLEGAL_DATA_ADDRESS;
+                //one word of a 32 or 64-bit register
+                IEC_ULINT value;
+                if (d->width == 4) value = *(const IEC_UDINT *)(base + d->image_offset);
+                else value = *(const IEC_ULINT *)(base + d->image_offset);
+                uint16_t tempValue = (uint16_t)(value >> d->shift);
+                dst[0] = highByte(tempValue);
+                dst[1] = lowByte(tempValue);
+                dst += 2;
+                i++;
             }
         }
-    }
-    pthread_mutex_unlock(&bufferLock);
+    } while (!endProcessImageRead(image, sequence));
+}
 
-    if (mb_error != ERR_NONE)
-    {
-        ModbusError(buffer, mb_error);
-    }
-    else
-    {
-        MessageLength = ByteDataLength + 9;
-    }
+//-----------------------------------------------------------------------------
+// Reads count holding registers from start into payload, from the response
+// cache when it is enabled and holds them
+//-----------------------------------------------------------------------------
+static void readHoldingRegisters(int start, int count, unsigned char *payload)
+{
+    bool use_cache = response_cache_enabled.load(std::memory_order_acquire);
+    uint32_t version = getProcessImageVersion();
+    if (use_cache && readCachedResponse(MB_FC_READ_HOLDING_REGISTERS, start, count, version, payload)) return;
+
+    copyHoldingRegisters(start, count, payload);
+    if (use_cache) storeCachedResponse(MB_FC_READ_HOLDING_REGISTERS, start, count, version, payload);
 }
 
 //-----------------------------------------------------------------------------
@@ -310,7 +526,6 @@ void ReadDiscreteInputs(unsigned char *buffer, int bufferSize)
 void ReadHoldingRegisters(unsigned char *buffer, int bufferSize)
 {
     int Start, WordDataLength, ByteDataLength;
-    int mb_error = ERR_NONE;
 
     //this request must have at least 12 bytes. If it doesn't, it's a corrupted message
     if (bufferSize < 12)
@@ -323,8 +538,15 @@ void ReadHoldingRegisters(unsigned char *buffer, int bufferSize)
     WordDataLength = word(buffer[10],buffer[11]);
     ByteDataLength = WordDataLength * 2;
 
-    //asked for too many registers
-    if (ByteDataLength > 255)
+    //asked for an invalid quantity of registers
+    if (WordDataLength < 1 || WordDataLength > MAX_READ_REGISTERS)
+    {
+        ModbusError(buffer, ERR_ILLEGAL_DATA_VALUE);
+        return;
+    }
+
+    //invalid address
+    if (Start + WordDataLength > MAX_HOLD_REGS)
     {
         ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
         return;
@@ -335,114 +557,8 @@ void ReadHoldingRegisters(unsigned char *buffer, int bufferSize)
     buffer[5] = lowByte(ByteDataLength + 3); //Number of bytes after this one
     buffer[8] = ByteDataLength;     //Number of bytes of data
 
-    pthread_mutex_lock(&bufferLock);
-    for(int i = 0; i < WordDataLength; i++)
-    {
-        int position = Start + i;
-        if (position < MIN_16B_RANGE)  
-        {
-            if (int_output[position] != NULL)
-            {
-                buffer[ 9 + i * 2] = highByte(*int_output[position]);
-                buffer[10 + i * 2] = lowByte(*int_output[position]);
-            }
-            else
-            {
-                buffer[ 9 + i * 2] = 0;
-                buffer[10 + i * 2] = 0;
-            }
-        }
-        //accessing memory
-        //16-bit registers
-        else if (position >= MIN_16B_RANGE && position <= MAX_16B_RANGE)
-        {
-            if (int_memory[position - MIN_16B_RANGE] != NULL)
-            {
-                buffer[ 9 + i * 2] = highByte(*int_memory[position - MIN_16B_RANGE]);
-                buffer[10 + i * 2] = lowByte(*int_memory[position - MIN_16B_RANGE]);
-            }
-            else
-            {
-                buffer[ 9 + i * 2] = 0;
-                buffer[10 + i * 2] = 0;
-            }
-        }
-        //32-bit registers
-        else if (position >= MIN_32B_RANGE && position <= MAX_32B_RANGE)
-        {
-            if (dint_memory[(position - MIN_32B_RANGE)/2] != NULL)
-            {
-                if ((position - MIN_32B_RANGE) % 2 == 0) //first word
-                {
-                    uint16_t tempValue = (uint16_t)(*dint_memory[(position - MIN_32B_RANGE)/2] >> 16);
-                    buffer[ 9 + i * 2] = highByte(tempValue);
-                    buffer[10 + i * 2] = lowByte(tempValue);
-                }
-                else //second word
-                {
-                    uint16_t tempValue = (uint16_t)(*dint_memory[(position - MIN_32B_RANGE)/2] & 0xffff);
-                    buffer[ 9 + i * 2] = highByte(tempValue);
-                    buffer[10 + i * 2] = lowByte(tempValue);
-                }
-            }
-            else
-            {
-                buffer[ 9 + i * 2] = mb_holding_regs[position];
-                buffer[10 + i * 2] = mb_holding_regs[position];
-            }
-        }
-        //64-bit registers
-        else if (position >= MIN_64B_RANGE && position <= MAX_64B_RANGE)
-        {
-            if (lint_memory[(position - MIN_64B_RANGE)/4] != NULL)
-            {
-                if ((position - MIN_64B_RANGE) % 4 == 0) //first word
-                {
-                    uint16_t tempValue = (uint16_t)(*lint_memory[(position - MIN_64B_RANGE)/4] >> 48);
-                    buffer[ 9 + i * 2] = highByte(tempValue);
-                    buffer[10 + i * 2] = lowByte(tempValue);
-                }
-                else if ((position - MIN_64B_RANGE) % 4 == 1)//second word
-                {
-                    uint16_t tempValue = (uint16_t)((*lint_memory[(position - MIN_64B_RANGE)/4] >> 32) & 0xffff);
-                    buffer[ 9 + i * 2] = highByte(tempValue);
-                    buffer[10 + i * 2] = lowByte(tempValue);
-                }
-                else if ((position - MIN_64B_RANGE) % 4 == 2)//third word
-                {
-                    uint16_t tempValue = (uint16_t)((*lint_memory[(position - MIN_64B_RANGE)/4] >> 16) & 0xffff);
-                    buffer[ 9 + i * 2] = highByte(tempValue);
-                    buffer[10 + i * 2] = lowByte(tempValue);
-                }
-                else if ((position - MIN_64B_RANGE) % 4 == 3)//fourth word
-                {
-                    uint16_t tempValue = (uint16_t)(*lint_memory[(position - MIN_64B_RANGE)/4] & 0xffff);
-                    buffer[ 9 + i * 2] = highByte(tempValue);
-                    buffer[10 + i * 2] = lowByte(tempValue);
-                }
-            }
-            else
-            {
-                buffer[ 9 + i * 2] = mb_holding_regs[position];
-                buffer[10 + i * 2] = mb_holding_regs[position];
-            }
-        }
-        //invalid address
-        else
-        {
-            mb_error = ERR_ILLEGAL_DATA_ADDRESS;
-        }
-    }
-    pthread_mutex_unlock(&bufferLock);
-
-    if (mb_error != ERR_NONE)
-    {
-        ModbusError(buffer, mb_error);
-    }
-    else
-    {
-        MessageLength = ByteDataLength + 9;
-    }
+    readHoldingRegisters(Start, WordDataLength, &buffer[9]);
+    MessageLength = ByteDataLength + 9;
 }
 
 //-----------------------------------------------------------------------------
@@ -451,7 +567,6 @@ void ReadHoldingRegisters(unsigned char *buffer, int bufferSize)
 void ReadInputRegisters(unsigned char *buffer, int bufferSize)
 {
     int Start, WordDataLength, ByteDataLength;
-    int mb_error = ERR_NONE;
 
     //this request must have at least 12 bytes. If it doesn't, it's a corrupted message
     if (bufferSize < 12)
@@ -464,8 +579,15 @@ void ReadInputRegisters(unsigned char *buffer, int bufferSize)
     WordDataLength = word(buffer[10],buffer[11]);
     ByteDataLength = WordDataLength * 2;
 
-    //asked for too many registers
-    if (ByteDataLength > 255)
+    //asked for an invalid quantity of registers
+    if (WordDataLength < 1 || WordDataLength > MAX_READ_REGISTERS)
+    {
+        ModbusError(buffer, ERR_ILLEGAL_DATA_VALUE);
+        return;
+    }
+
+    //invalid address
+    if (Start + WordDataLength > MAX_INP_REGS)
     {
         ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
         return;
@@ -476,38 +598,28 @@ void ReadInputRegisters(unsigned char *buffer, int bufferSize)
     buffer[5] = lowByte(ByteDataLength + 3); //Number of bytes after this one
     buffer[8] = ByteDataLength;     //Number of bytes of data
 
-    pthread_mutex_lock(&bufferLock);
-    for(int i = 0; i < WordDataLength; i++)
+    bool use_cache = response_cache_enabled.load(std::memory_order_acquire);
+    uint32_t version = getProcessImageVersion();
+    if (use_cache && readCachedResponse(MB_FC_READ_INPUT_REGISTERS, Start, WordDataLength, version, &buffer[9]))
     {
-        int position = Start + i;
-        if (position < MAX_INP_REGS)
-        {
-            if (int_input[position] != NULL)
-            {
-                buffer[ 9 + i * 2] = highByte(*int_input[position]);
-                buffer[10 + i * 2] = lowByte(*int_input[position]);
-            }
-            else
-            {
-                buffer[ 9 + i * 2] = 0;
-                buffer[10 + i * 2] = 0;
-            }
-        }
-        else //invalid address
-        {
-            mb_error = ERR_ILLEGAL_DATA_ADDRESS;
-        }
+        MessageLength = ByteDataLength + 9;
+        return;
     }
-    pthread_mutex_unlock(&bufferLock);
 
-    if (mb_error != ERR_NONE)
-    {
-        ModbusError(buffer, mb_error);
-    }
-    else
+    uint32_t sequence;
+    const ProcessImageSnapshot *image;
+    do
     {
-        MessageLength = ByteDataLength + 9;
-    }
+        image = beginProcessImageRead(&sequence);
+        for(int i = 0; i < WordDataLength; i++)
+        {
+            buffer[ 9 + i * 2] = highByte(image->int_input[Start + i]);
+            buffer[10 + i * 2] = lowByte(image->int_input[Start + i]);
+        }
+    } while (!endProcessImageRead(image, sequence));
+
+    if (use_cache) storeCachedResponse(MB_FC_READ_INPUT_REGISTERS, Start, WordDataLength, version, &buffer[9]);
+    MessageLength = ByteDataLength + 9;
 }
 
 //-----------------------------------------------------------------------------
@@ -529,22 +641,17 @@ void WriteCoil(unsigned char *buffer, int bufferSize)
 
     if (Start < MAX_COILS)
     {
-        unsigned char value;
-        if (word(buffer[10], buffer[11]) > 0)
-        {
-            value = 1;
-        }
-        else
-        {
-            value = 0;
-        }
+        ProcessImageWrite write;
+        write.area = PI_BOOL_OUTPUT;
+        write.index = Start/8;
+        write.bit = Start%8;
+        write.value = (word(buffer[10], buffer[11]) > 0) ? 1 : 0;
+        write.mask = 1;
 
-        pthread_mutex_lock(&bufferLock);
-        if (bool_output[Start/8][Start%8] != NULL)
+        if (queueProcessImageWrites(&write, 1) < 0)
         {
-            *bool_output[Start/8][Start%8] = value;
+            mb_error = ERR_SLAVE_DEVICE_BUSY;
         }
-        pthread_mutex_unlock(&bufferLock);
     }
 
     else //invalid address
@@ -565,66 +672,26 @@ void WriteCoil(unsigned char *buffer, int bufferSize)
 }
 
 /**
- * @brief Write a word to a register at the given position. The caller must hold the `bufferLock`.
+ * @brief Build the process image write for a word written to a register at the given position.
  *
  * @param position The position of the register.
  * @param value The word to write to the register.
+ * @param write The write to be queued.
  *
  * @return An error code, if an error occurred.
  */
-int writeToRegisterWithoutLocking(int position, uint16_t value)
+int buildRegisterWrite(int position, uint16_t value, ProcessImageWrite *write)
 {
-    //analog outputs
-    if (position < MIN_16B_RANGE) 
-    {
-        if (int_output[position] != NULL) *int_output[position] = value;
-    }
-    //accessing memory
-    //16-bit registers
-    else if (position >= MIN_16B_RANGE && position <= MAX_16B_RANGE)
-    {
-        if (int_memory[position - MIN_16B_RANGE] != NULL) *int_memory[position - MIN_16B_RANGE] = value;
-    }
-    //32-bit registers
-    else if (position >= MIN_32B_RANGE && position <= MAX_32B_RANGE)
-    {
-        if (dint_memory[(position - MIN_32B_RANGE) / 2] == NULL)
-        {
-            mb_holding_regs[position] = value;
-        }
-        else
-        {
-            // Overwrite one word of the 32 bit register:
-            // Calculate the bit offset of the word in the 32 bit register.
-            int bit_offset = (1 - ((position - MIN_32B_RANGE) % 2)) * 16;
-            // Mask the word.
-            *dint_memory[(position - MIN_32B_RANGE) / 2] &= ~(((uint32_t) 0xffff) << bit_offset);
-            // Overwrite the word.
-            *dint_memory[(position - MIN_32B_RANGE) / 2] |= ((uint32_t) value) << bit_offset;
-        }
-    }
-    //64-bit registers
-    else if (position >= MIN_64B_RANGE && position <= MAX_64B_RANGE)
-    {
-        if (lint_memory[(position - MIN_64B_RANGE) / 4] == NULL)
-        {
-            mb_holding_regs[position] = value;
-        }
-        else
-        {
-            // Overwrite one word of the 64 bit register:
-            // Calculate the bit offset of the word in the 64 bit register.
-            int bit_offset = (3 - ((position - MIN_64B_RANGE) % 4)) * 16;
-            // Mask the word.
-            *lint_memory[(position - MIN_64B_RANGE) / 4] &= ~(((uint64_t) 0xffff) << bit_offset);
-            // Overwrite the word.
-            *lint_memory[(position - MIN_64B_RANGE) / 4] |= ((uint64_t) value) << bit_offset;
-        }
-    }
-    else //invalid address
-    {
-        return ERR_ILLEGAL_DATA_ADDRESS;
-    }
+    //invalid address
+    if (position < 0 || position >= MAX_HOLD_REGS) return ERR_ILLEGAL_DATA_ADDRESS;
+
+    const HoldingRegisterDescriptor *d = &holding_map[position];
+    write->area = d->area;
+    write->index = d->index;
+    write->bit = 0;
+    write->value = ((IEC_ULINT) value) << d->shift;
+    write->mask = ((IEC_ULINT) 0xffff) << d->shift;
+
     return ERR_NONE;
 }
 
@@ -646,9 +713,12 @@ void WriteRegister(unsigned char *buffer, int bufferSize)
 
     Start = word(buffer[8],buffer[9]);
 
-    pthread_mutex_lock(&bufferLock);
-    mb_error = writeToRegisterWithoutLocking(Start, word(buffer[10], buffer[11]));
-    pthread_mutex_unlock(&bufferLock);
+    ProcessImageWrite write;
+    mb_error = buildRegisterWrite(Start, word(buffer[10], buffer[11]), &write);
+    if (mb_error == ERR_NONE && queueProcessImageWrites(&write, 1) < 0)
+    {
+        mb_error = ERR_SLAVE_DEVICE_BUSY;
+    }
 
     if (mb_error != ERR_NONE)
     {
@@ -682,8 +752,10 @@ void WriteMultipleCoils(unsigned char *buffer, int bufferSize)
     ByteDataLength = CoilDataLength / 8;
     if(ByteDataLength * 8 < CoilDataLength) ByteDataLength++;
 
-    //this request must have all the bytes it wants to write. If it doesn't, it's a corrupted message
-    if ( (bufferSize < (13 + ByteDataLength)) || (buffer[12] != ByteDataLength) )
+    //asked for an invalid quantity of coils, or the request doesn't have all
+    //the bytes it wants to write
+    if (CoilDataLength < 1 || CoilDataLength > MAX_WRITE_COILS ||
+        bufferSize < (13 + ByteDataLength) || buffer[12] != ByteDataLength)
     {
         ModbusError(buffer, ERR_ILLEGAL_DATA_VALUE);
         return;
@@ -693,23 +765,22 @@ void WriteMultipleCoils(unsigned char *buffer, int bufferSize)
     buffer[4] = 0;
     buffer[5] = 6; //Number of bytes after this one.
 
-    pthread_mutex_lock(&bufferLock);
-    for(int i = 0; i < ByteDataLength ; i++)
+    //the coils are queued as they came, packed, as a single run
+    ProcessImageRun run;
+    run.area = PI_BOOL_OUTPUT;
+    run.index = Start;
+    run.count = CoilDataLength;
+    run.data = &buffer[13];
+    if (Start + CoilDataLength > MAX_COILS) //invalid address
     {
-        for(int j = 0; j < 8; j++)
-        {
-            int position = Start + i * 8 + j;
-            if (position < MAX_COILS)
-            {
-                if (bool_output[position/8][position%8] != NULL) *bool_output[position/8][position%8] = bitRead(buffer[13 + i], j);
-            }
-            else //invalid address
-            {
-                mb_error = ERR_ILLEGAL_DATA_ADDRESS;
-            }
-        }
+        mb_error = ERR_ILLEGAL_DATA_ADDRESS;
+        run.count = (Start < MAX_COILS) ? MAX_COILS - Start : 0;
+    }
+
+    if (run.count > 0 && queueProcessImageBatch(NULL, 0, &run, 1) < 0)
+    {
+        mb_error = ERR_SLAVE_DEVICE_BUSY;
     }
-    pthread_mutex_unlock(&bufferLock);
 
     if (mb_error != ERR_NONE)
     {
@@ -721,6 +792,77 @@ void WriteMultipleCoils(unsigned char *buffer, int bufferSize)
     }
 }
 
+//-----------------------------------------------------------------------------
+// Queues the writes of count holding registers from start, with the values
+// as they came on the request (big endian), as a single batch. Returns an
+// error code, if an error occurred
+//-----------------------------------------------------------------------------
+static int queueRegisterWrites(int start, int count, const unsigned char *data)
+{
+    int mb_error = ERR_NONE;
+    ProcessImageWrite writes[MAX_WRITE_REGISTERS];
+    int write_count = 0;
+    ProcessImageRun runs[MAX_WRITE_REGISTERS];
+    int run_count = 0;
+
+    if (count > MAX_WRITE_REGISTERS) return ERR_ILLEGAL_DATA_VALUE;
+
+    //whole variables are queued as runs of their big-endian bytes, the
+    //words of 32 and 64-bit variables the request only writes in part as
+    //masked writes
+    for(int i = 0; i < count;)
+    {
+        int position = start + i;
+        if (position >= MAX_HOLD_REGS) //invalid address
+        {
+            mb_error = ERR_ILLEGAL_DATA_ADDRESS;
+            break;
+        }
+
+        const HoldingRegisterDescriptor *d = &holding_map[position];
+        int words = d->width / 2;
+        int run = 0;
+        if (d->width == 2)
+        {
+            run = d->run_length;
+            if (run > count - i) run = count - i;
+        }
+        else if (d->shift == (words - 1) * 16)
+        {
+            //consecutive whole variables of the same area
+            while (i + (run + 1) * words <= count && position + run * words < MAX_HOLD_REGS &&
+                   holding_map[position + run * words].area == d->area &&
+                   holding_map[position + run * words].index == d->index + run &&
+                   holding_map[position + run * words].shift == d->shift)
+            {
+                run++;
+            }
+        }
+
+        if (run > 0)
+        {
+            runs[run_count].area = d->area;
+            runs[run_count].index = d->index;
+            runs[run_count].count = run;
+            runs[run_count].data = &data[i * 2];
+            run_count++;
+            i += run * words;
+        }
+        else
+        {
+            buildRegisterWrite(position, word(data[i * 2], data[i * 2 + 1]), &writes[write_count++]);
+            i++;
+        }
+    }
+
+    if (write_count + run_count > 0 && queueProcessImageBatch(writes, write_count, runs, run_count) < 0)
+    {
+        mb_error = ERR_SLAVE_DEVICE_BUSY;
+    }
+
+    return mb_error;
+}
+
 //-----------------------------------------------------------------------------
 // Implementation of Modbus/TCP Write Multiple Registers
 //-----------------------------------------------------------------------------
@@ -740,8 +882,10 @@ void WriteMultipleRegisters(unsigned char *buffer, int bufferSize)
     WordDataLength = word(buffer[10],buffer[11]);
     ByteDataLength = WordDataLength * 2;
 
-    //this request must have all the bytes it wants to write. If it doesn't, it's a corrupted message
-    if ( (bufferSize < (13 + ByteDataLength)) || (buffer[12] != ByteDataLength) )
+    //asked for an invalid quantity of registers, or the request doesn't have
+    //all the bytes it wants to write
+    if (WordDataLength < 1 || WordDataLength > MAX_WRITE_REGISTERS ||
+        bufferSize < (13 + ByteDataLength) || buffer[12] != ByteDataLength)
     {
         ModbusError(buffer, ERR_ILLEGAL_DATA_VALUE);
         return;
@@ -751,17 +895,7 @@ void WriteMultipleRegisters(unsigned char *buffer, int bufferSize)
     buffer[4] = 0;
     buffer[5] = 6; //Number of bytes after this one.
 
-    pthread_mutex_lock(&bufferLock);
-    for(int i = 0; i < WordDataLength; i++)
-    {
-        int position = Start + i;
-        int error = writeToRegisterWithoutLocking(position, word(buffer[13 + i * 2], buffer[14 + i * 2]));
-        if (error != ERR_NONE)
-        {
-            mb_error = error;
-        }
-    }
-    pthread_mutex_unlock(&bufferLock);
+    mb_error = queueRegisterWrites(Start, WordDataLength, &buffer[13]);
 
     if (mb_error != ERR_NONE)
     {
@@ -773,6 +907,74 @@ void WriteMultipleRegisters(unsigned char *buffer, int bufferSize)
     }
 }
 
+//-----------------------------------------------------------------------------
+// Implementation of Modbus/TCP Read/Write Multiple Registers. The writes are
+// queued as one batch like on Write Multiple Registers and the registers are
+// read from a single snapshot, with the ones the request writes already
+// holding their new value, as the writes come first on this function
+//-----------------------------------------------------------------------------
+void ReadWriteMultipleRegisters(unsigned char *buffer, int bufferSize)
+{
+    int ReadStart, ReadWordLength, WriteStart, WriteWordLength, WriteByteLength;
+    unsigned char payload[MAX_READ_REGISTERS * 2];
+
+    //this request must have at least 17 bytes. If it doesn't, it's a corrupted message
+    if (bufferSize < 17)
+    {
+        ModbusError(buffer, ERR_ILLEGAL_DATA_VALUE);
+        return;
+    }
+
+    ReadStart = word(buffer[8],buffer[9]);
+    ReadWordLength = word(buffer[10],buffer[11]);
+    WriteStart = word(buffer[12],buffer[13]);
+    WriteWordLength = word(buffer[14],buffer[15]);
+    WriteByteLength = WriteWordLength * 2;
+
+    //asked for an invalid quantity of registers, or the request doesn't have
+    //all the bytes it wants to write
+    if (ReadWordLength < 1 || ReadWordLength > MAX_READ_REGISTERS ||
+        WriteWordLength < 1 || WriteWordLength > MAX_RW_WRITE_REGISTERS ||
+        bufferSize < (17 + WriteByteLength) || buffer[16] != WriteByteLength)
+    {
+        ModbusError(buffer, ERR_ILLEGAL_DATA_VALUE);
+        return;
+    }
+
+    //invalid address. Checked for both ranges before anything is written
+    if (ReadStart + ReadWordLength > MAX_HOLD_REGS || WriteStart + WriteWordLength > MAX_HOLD_REGS)
+    {
+        ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
+        return;
+    }
+
+    int mb_error = queueRegisterWrites(WriteStart, WriteWordLength, &buffer[17]);
+    if (mb_error != ERR_NONE)
+    {
+        ModbusError(buffer, mb_error);
+        return;
+    }
+
+    //the writes reach the image at the next scan boundary, the registers
+    //they overlap are answered with the written words
+    readHoldingRegisters(ReadStart, ReadWordLength, payload);
+    int first = (ReadStart > WriteStart) ? ReadStart : WriteStart;
+    int last = (ReadStart + ReadWordLength < WriteStart + WriteWordLength) ? ReadStart + ReadWordLength : WriteStart + WriteWordLength;
+    for (int position = first; position < last; position++)
+    {
+        payload[(position - ReadStart) * 2] = buffer[17 + (position - WriteStart) * 2];
+        payload[(position - ReadStart) * 2 + 1] = buffer[18 + (position - WriteStart) * 2];
+    }
+
+    //preparing response
+    int ByteDataLength = ReadWordLength * 2;
+    buffer[4] = highByte(ByteDataLength + 3);
+    buffer[5] = lowByte(ByteDataLength + 3); //Number of bytes after this one
+    buffer[8] = ByteDataLength;     //Number of bytes of data
+    memcpy(&buffer[9], payload, ByteDataLength);
+    MessageLength = ByteDataLength + 9;
+}
+
 /**
  * @brief Sends a Modbus response frame for the DEBUG_INFO function code.
  *
@@ -793,7 +995,7 @@ void WriteMultipleRegisters(unsigned char *buffer, int bufferSize)
  */
 void debugInfo(unsigned char *mb_frame)
 {
-    uint16_t variableCount = get_var_count();
+    uint16_t variableCount = plcProgram()->get_var_count();
     MessageLength = 10;
     mb_frame[7] = MB_FC_DEBUG_INFO;
     mb_frame[8] = (uint8_t)(variableCount >> 8); // High byte
@@ -824,7 +1026,7 @@ void debugInfo(unsigned char *mb_frame)
  */
 void debugSetTrace(unsigned char *mb_frame, uint16_t varidx, uint8_t flag, uint16_t len, void *value)
 {
-    uint16_t variableCount = get_var_count();
+    uint16_t variableCount = plcProgram()->get_var_count();
     if (varidx >= variableCount || len > (MAX_MB_FRAME - 7))
     {
         // Respond with an error indicating that the index is out of range
@@ -834,13 +1036,74 @@ void debugSetTrace(unsigned char *mb_frame, uint16_t varidx, uint8_t flag, uint1
         return;
     }
 
-    // Execute set trace command
-    set_trace((size_t)varidx, (bool)flag, value);
-
-    // Response
+    // Queue the set trace command, the scan thread applies it before the
+    // next cycle
+    ForceRequest request = {varidx, (bool)flag, len, value};
     MessageLength = 9;
     mb_frame[7] = MB_FC_DEBUG_SET;
-    mb_frame[8] = MB_DEBUG_SUCCESS;
+    mb_frame[8] = queueForcedVariables(&request, 1) == 0 ? MB_DEBUG_SUCCESS : MB_DEBUG_ERROR_OUT_OF_MEMORY;
+}
+
+/**
+ * @brief Sends a Modbus response frame for the DEBUG_SET_LIST function code.
+ *
+ * Forces or releases a group of variables. The whole group is applied by
+ * the scan thread at the start of the same cycle, or rejected.
+ *
+ * Modbus Request Frame (DEBUG_SET_LIST):
+ * +-----+-------+-------------------------------------------------+
+ * | MB  | Count | Entries                                         |
+ * | FC  |       |                                                 |
+ * +-----+-------+-------------------------------------------------+
+ * |0x48 | 2 B   | Index (2 bytes), Flag (1), Length (2), Value    |
+ * +-----+-------+-------------------------------------------------+
+ *
+ * Modbus Response Frame (DEBUG_SET_LIST):
+ * +-----+------+
+ * | MB  | Resp.|
+ * | FC  | Code |
+ * +-----+------+
+ * |0x48 | Code |
+ * +-----+------+
+ *
+ * @return void
+ */
+void debugSetTraceList(unsigned char *mb_frame, int bufferSize)
+{
+    ForceRequest requests[MAX_MB_FORCES];
+    uint16_t variableCount = plcProgram()->get_var_count();
+    uint16_t count = bufferSize >= 10 ? word(mb_frame[8], mb_frame[9]) : 0;
+    uint8_t code = MB_DEBUG_SUCCESS;
+
+    int position = 10;
+    for (int i = 0; i < count && code == MB_DEBUG_SUCCESS; i++)
+    {
+        if (i >= MAX_MB_FORCES || position + 5 > bufferSize)
+        {
+            code = MB_DEBUG_ERROR_OUT_OF_BOUNDS;
+            break;
+        }
+        requests[i].index = word(mb_frame[position], mb_frame[position + 1]);
+        requests[i].forced = mb_frame[position + 2] != 0;
+        requests[i].length = word(mb_frame[position + 3], mb_frame[position + 4]);
+        requests[i].value = &mb_frame[position + 5];
+        position += 5 + requests[i].length;
+        if (requests[i].index >= variableCount || position > bufferSize)
+        {
+            code = MB_DEBUG_ERROR_OUT_OF_BOUNDS;
+        }
+    }
+
+    if (code == MB_DEBUG_SUCCESS && count > 0 && queueForcedVariables(requests, count) < 0)
+    {
+        code = MB_DEBUG_ERROR_OUT_OF_MEMORY;
+    }
+
+    MessageLength = 9;
+    mb_frame[7] = MB_FC_DEBUG_SET_LIST;
+    mb_frame[8] = code;
+    mb_frame[4] = 0;
+    mb_frame[5] = 3;
 }
 
 /**
@@ -865,7 +1128,7 @@ void debugSetTrace(unsigned char *mb_frame, uint16_t varidx, uint8_t flag, uint1
  */
 void debugGetTrace(unsigned char *mb_frame, uint16_t startidx, uint16_t endidx)
 {
-    uint16_t variableCount = get_var_count();
+    uint16_t variableCount = plcProgram()->get_var_count();
     // Verify that startidx and endidx fall within the valid range of variables
     if (startidx >= variableCount || endidx >= variableCount || startidx > endidx) 
     {
@@ -882,10 +1145,10 @@ void debugGetTrace(unsigned char *mb_frame, uint16_t startidx, uint16_t endidx)
     
     for (uint16_t varidx = startidx; varidx <= endidx; varidx++) 
     {
-        size_t varSize = get_var_size(varidx);
+        size_t varSize = plcProgram()->get_var_size(varidx);
         if ((responseSize + 17) + varSize <= MAX_MB_FRAME) // Make sure the response fits
         {
-            void *varAddr = get_var_addr(varidx);
+            void *varAddr = plcProgram()->get_var_addr(varidx);
 
             // Copy the variable value to the response buffer
             memcpy(responsePtr, varAddr, varSize);
@@ -942,7 +1205,7 @@ void debugGetTraceList(unsigned char *mb_frame, uint16_t numIndexes, uint8_t *in
     uint16_t response_idx = 17;  // Start of response data in the response buffer
     uint16_t responseSize = 0;
     uint16_t lastVarIdx = 0;
-    uint16_t variableCount = get_var_count();
+    uint16_t variableCount = plcProgram()->get_var_count();
 
     #ifdef MBSERIAL
         #define VARIDX_SIZE 20
@@ -981,13 +1244,13 @@ void debugGetTraceList(unsigned char *mb_frame, uint16_t numIndexes, uint8_t *in
         }
 
         // Add requested indexes and their traces to the response buffer
-        size_t varSize = get_var_size(varidx_array[i]);
+        size_t varSize = plcProgram()->get_var_size(varidx_array[i]);
 
         // Make sure there is enough space in the response buffer
         if (response_idx + varSize <= MAX_MB_FRAME) 
         {
             // Add variable data to the response buffer
-            void *varAddr = get_var_addr(varidx_array[i]);
+            void *varAddr = plcProgram()->get_var_addr(varidx_array[i]);
             memcpy(&mb_frame[response_idx], varAddr, varSize);
             response_idx += varSize;
             responseSize += varSize;
@@ -1023,11 +1286,11 @@ void debugGetMd5(unsigned char *mb_frame, void *endianness)
     memcpy(&endian_check, endianness, 2);
     if (endian_check == 0xDEAD)
     {
-        set_endianness(SAME_ENDIANNESS);
+        plcProgram()->set_endianness(SAME_ENDIANNESS);
     }
     else if (endian_check == 0xADDE)
     {
-        set_endianness(REVERSE_ENDIANNESS);
+        plcProgram()->set_endianness(REVERSE_ENDIANNESS);
     }
     else
     {
@@ -1041,62 +1304,497 @@ void debugGetMd5(unsigned char *mb_frame, void *endianness)
     mb_frame[7] = MB_FC_DEBUG_GET_MD5;
     mb_frame[8] = MB_DEBUG_SUCCESS;
 
-    // Copy MD5 string byte by byte to mb_frame starting from index 3
-    int md5_len = 0;
-    for (md5_len = 0; md5[md5_len] != '\0'; md5_len++) 
-    {
-        mb_frame[md5_len + 9] = md5[md5_len];
-    }
-
-    // Calculate mb_frame_len (MD5 string length + 3)
+    // Copy the MD5 string after the response code
+    static const size_t md5_len = strlen(md5);
+    memcpy(&mb_frame[9], md5, md5_len);
     MessageLength = md5_len + 9;
 }
 
 //-----------------------------------------------------------------------------
-// Read one complete modbus message from the blocking file descriptor `fd`
-// into the `buffer`, which has a size of `bufferSize`.
-// If the message is too large only `bufferSize` bytes will be read.
-// Returns the number of bytes of the message that was read.
+// Returns the descriptor of the running program, building it the first time
+// the program is described. Called holding descriptor.lock. Returns NULL if
+// the layout table can't be allocated
 //-----------------------------------------------------------------------------
-int readModbusMessage(int fd, unsigned char *buffer, size_t bufferSize)
+static ProgramDescriptor *describeProgram()
 {
-    int messageSize = 0;
-    // Read the modbus TCP/IP ADU frame header up to the length field.
-#define MODBUS_HEADER_SIZE 6
-    if (bufferSize < MODBUS_HEADER_SIZE)
+    PlcProgram *program = plcProgram();
+    if (descriptor.get_var_size == program->get_var_size && descriptor.sizes != NULL) return &descriptor;
+
+    uint16_t count = program->get_var_count();
+    uint8_t *sizes = (uint8_t *)malloc((size_t)count * 5 + 1);
+    uint32_t *marks = (uint32_t *)malloc(((size_t)count / 64 + 1) * sizeof(uint32_t));
+    if (sizes == NULL || marks == NULL)
     {
-        return -1;
+        free(sizes);
+        free(marks);
+        return NULL;
     }
-    do
+
+    uint32_t layout = 2166136261u;
+    uint32_t total = 0;
+    uint32_t length = 0;
+    for (uint16_t i = 0; i < count; i++)
     {
-        int bytesRead = read(fd, buffer + messageSize, MODBUS_HEADER_SIZE - messageSize);
-        if (bytesRead <= 0)
+        uint32_t size = (uint32_t)program->get_var_size(i);
+        for (int b = 0; b < 4; b++)
+        {
+            layout ^= (size >> (b * 8)) & 0xFF;
+            layout *= 16777619u;
+        }
+        total += size;
+
+        if (i % 64 == 0) marks[i / 64] = length;
+        while (size >= 0x80)
         {
-            return bytesRead;
+            sizes[length++] = (uint8_t)(size | 0x80);
+            size >>= 7;
         }
-        messageSize += bytesRead;
-    } while (messageSize < MODBUS_HEADER_SIZE);
+        sizes[length++] = (uint8_t)size;
+    }
+
+    free(descriptor.sizes);
+    free(descriptor.marks);
+    descriptor.sizes = sizes;
+    descriptor.marks = marks;
+    descriptor.count = count;
+    descriptor.layout = layout;
+    descriptor.total_size = total;
+    descriptor.md5_length = (uint8_t)strlen(md5);
 
-    // Read the length (byte 5 & 6).
-    uint16_t length = ((uint16_t)buffer[4] << 8) | buffer[5];
-    size_t totalMessageSize = MODBUS_HEADER_SIZE + length;
-    if (totalMessageSize > bufferSize)
+    // The build profile and flags the program was compiled with
+    descriptor.build_length = 0;
+    FILE *f = fopen(BUILD_INFO_FILE, "r");
+    if (f != NULL)
     {
-        return -1;
+        descriptor.build_length = (uint16_t)fread(descriptor.build, 1, sizeof(descriptor.build), f);
+        fclose(f);
+    }
+    descriptor.get_var_size = program->get_var_size;
+    return &descriptor;
+}
+
+/**
+ * @brief Sends a Modbus response frame for the DEBUG_DESCRIBE function code.
+ *
+ * Everything the debugger checks before attaching, on one request: the MD5
+ * of the program, the number of debug variables, a hash of their sizes and
+ * the build options. The request carries the endianness check of
+ * DEBUG_GET_MD5, and sets the endianness the same way. The sizes themselves
+ * are downloaded in blocks with the layout subfunction, instead of asking
+ * for them one by one. The descriptor is built once per program.
+ *
+ * Modbus Request Frame (DEBUG_DESCRIBE):
+ * +-----+------+-----------------------------------------------------+
+ * | MB  | Sub  | Arguments                                           |
+ * | FC  | Func |                                                     |
+ * +-----+------+-----------------------------------------------------+
+ * |0x49 | 0x01 | Endianness check (2 bytes)                          |
+ * |0x49 | 0x02 | First variable index (2 bytes)                      |
+ * +-----+------+-----------------------------------------------------+
+ *
+ * Modbus Response Frame (DEBUG_DESCRIBE program):
+ * +-----+-------+------+-----+-------+--------+-------+-------+-------+
+ * | MB  | Resp. | MD5  | MD5 | Var   | Layout | Total | Build | Build |
+ * | FC  | Code  | Len  |     | Count | Hash   | Size  | Len   | Info  |
+ * +-----+-------+------+-----+-------+--------+-------+-------+-------+
+ * |0x49 | Code  | 1 B  | MD5 | 2 B   | 4 B    | 4 B   | 2 B   | Text  |
+ * +-----+-------+------+-----+-------+--------+-------+-------+-------+
+ *
+ * Modbus Response Frame (DEBUG_DESCRIBE layout):
+ * +-----+-------+-------+-------+-------+-------+
+ * | MB  | Resp. | First | Count | Data  | Data  |
+ * | FC  | Code  | Index |       | Size  | Bytes |
+ * +-----+-------+-------+-------+-------+-------+
+ * |0x49 | Code  | 2 B   | 2 B   | 2 B   | Data  |
+ * +-----+-------+-------+-------+-------+-------+
+ *
+ * The layout hash is the 32 bit FNV-1a of the sizes, each as 4 little endian
+ * bytes. The build info is the text of core/openplc.build (profile, flags,
+ * program and date, one per line). The layout data is the size of each
+ * variable from First Index as a base-128 varint; the client asks again
+ * from First Index + Count until it has every variable. All the other
+ * fields are big endian.
+ *
+ * @return void
+ */
+void debugDescribe(unsigned char *mb_frame, int bufferSize)
+{
+    uint8_t subfunction = bufferSize > 8 ? mb_frame[8] : 0;
+    uint8_t argument[2] = { bufferSize > 10 ? mb_frame[9] : (uint8_t)0, bufferSize > 10 ? mb_frame[10] : (uint8_t)0 };
+    mb_frame[7] = MB_FC_DEBUG_DESCRIBE;
+    mb_frame[8] = MB_DEBUG_ERROR_OUT_OF_BOUNDS;
+    MessageLength = 9;
+
+    pthread_mutex_lock(&descriptor.lock);
+    ProgramDescriptor *program = describeProgram();
+    if (program == NULL)
+    {
+        mb_frame[8] = MB_DEBUG_ERROR_OUT_OF_MEMORY;
+    }
+    else if (bufferSize >= 11 && subfunction == MB_DESCRIBE_PROGRAM)
+    {
+        uint16_t endian_check;
+        memcpy(&endian_check, argument, 2);
+        if (endian_check == 0xDEAD || endian_check == 0xADDE)
+        {
+            plcProgram()->set_endianness(endian_check == 0xDEAD ? SAME_ENDIANNESS : REVERSE_ENDIANNESS);
+
+            int position = 9;
+            mb_frame[8] = MB_DEBUG_SUCCESS;
+            mb_frame[position++] = program->md5_length;
+            memcpy(&mb_frame[position], md5, program->md5_length);
+            position += program->md5_length;
+            mb_frame[position++] = highByte(program->count);
+            mb_frame[position++] = lowByte(program->count);
+            for (int i = 0; i < 4; i++) mb_frame[position++] = (uint8_t)(program->layout >> (24 - i * 8));
+            for (int i = 0; i < 4; i++) mb_frame[position++] = (uint8_t)(program->total_size >> (24 - i * 8));
+            mb_frame[position++] = highByte(program->build_length);
+            mb_frame[position++] = lowByte(program->build_length);
+            memcpy(&mb_frame[position], program->build, program->build_length);
+            MessageLength = position + program->build_length;
+        }
+    }
+    else if (bufferSize >= 11 && subfunction == MB_DESCRIBE_LAYOUT)
+    {
+        uint16_t first = word(argument[0], argument[1]);
+        if (first <= program->count)
+        {
+            // Walk from the closest mark to the first variable asked for
+            uint32_t position = 0;
+            if (first < program->count)
+            {
+                position = program->marks[first / 64];
+                for (int i = first - first % 64; i < first; i++)
+                {
+                    while (program->sizes[position] & 0x80) position++;
+                    position++;
+                }
+            }
+
+            uint16_t count = 0;
+            uint32_t data_size = 0;
+            while (first + count < program->count)
+            {
+                uint32_t length = 1;
+                while (program->sizes[position + length - 1] & 0x80) length++;
+                if (data_size + length > MAX_LAYOUT_DATA) break;
+                memcpy(&mb_frame[15 + data_size], &program->sizes[position], length);
+                position += length;
+                data_size += length;
+                count++;
+            }
+
+            mb_frame[8] = MB_DEBUG_SUCCESS;
+            mb_frame[9] = highByte(first);
+            mb_frame[10] = lowByte(first);
+            mb_frame[11] = highByte(count);
+            mb_frame[12] = lowByte(count);
+            mb_frame[13] = highByte(data_size);
+            mb_frame[14] = lowByte(data_size);
+            MessageLength = 15 + data_size;
+        }
+    }
+    pthread_mutex_unlock(&descriptor.lock);
+
+    mb_frame[4] = highByte(MessageLength - 6);
+    mb_frame[5] = lowByte(MessageLength - 6);
+}
+
+/**
+ * @brief Sends a Modbus response frame for the DEBUG_TRACE function code.
+ *
+ * The trace samples the selected debug variables on the scan thread, every
+ * divider scans, into a ring on the runtime. The client starts it once and
+ * then downloads the samples in blocks, much larger than a regular Modbus
+ * frame, passing the index of the next sample it wants (cursor).
+ *
+ * Modbus Request Frame (DEBUG_TRACE):
+ * +-----+------+-----------------------------------------------------+
+ * | MB  | Sub  | Arguments                                           |
+ * | FC  | Func |                                                     |
+ * +-----+------+-----------------------------------------------------+
+ * |0x46 | 0x01 | Divider (2 bytes), Count (2 bytes), Indexes (2 each)|
+ * |0x46 | 0x02 | -                                                   |
+ * |0x46 | 0x03 | Cursor (8 bytes)                                    |
+ * |0x46 | 0x04 | Index (2 bytes), Condition (1), Type (1), Value (8), |
+ * |     |      | Pre-trigger samples (4), Post-trigger samples (4)   |
+ * +-----+------+-----------------------------------------------------+
+ *
+ * Modbus Response Frame (DEBUG_TRACE read):
+ * +-----+------+-----+-----+-------+------+---------+-----+------+------+-------+
+ * | MB  | Resp.| Run | Trg | First | Lost | Trigger | Smp | Smp  | Data | Data  |
+ * | FC  | Code |     | St. | Index |      | Index   |     | Size | Size | Bytes |
+ * +-----+------+-----+-----+-------+------+---------+-----+------+------+-------+
+ * |0x46 | Code | 1 B | 1 B | 8 B   | 4 B  | 8 B     | 2 B | 2 B  | 2 B  | Data  |
+ * +-----+------+-----+-----+-------+------+---------+-----+------+------+-------+
+ *
+ * Start answers with the sample size (2 bytes) after the response code, stop
+ * and arm only with the response code. Arming a trigger (oscilloscope mode)
+ * resumes a stopped trace; once the condition is met on the trigger index
+ * sample, the trace stops by itself after the post-trigger samples and the
+ * client reads from the trigger index minus the pre-trigger samples. The
+ * value is compared as an unsigned, signed or floating point (the value
+ * holds the bits of a double) number. All the fields are big endian. A sample is
+ * the tick (8 bytes) followed by the variable values, as on DEBUG_GET. Each
+ * sample is XORed with the previous one on the block (the first one with
+ * zeros) and runs of zero bytes are written as 0x00 followed by the run
+ * length.
+ *
+ * @return void
+ */
+void debugTrace(unsigned char *mb_frame, int bufferSize)
+{
+    uint8_t subfunction = bufferSize > 8 ? mb_frame[8] : 0;
+    mb_frame[7] = MB_FC_DEBUG_TRACE;
+    mb_frame[8] = MB_DEBUG_ERROR_OUT_OF_BOUNDS;
+    MessageLength = 9;
+
+    if (bufferSize >= 13 && subfunction == MB_TRACE_START)
+    {
+        uint16_t divider = word(mb_frame[9], mb_frame[10]);
+        uint16_t count = word(mb_frame[11], mb_frame[12]);
+        uint16_t indexes[TRACE_MAX_VARS];
+        int sample_size = -1;
+        if (count <= TRACE_MAX_VARS && bufferSize >= 13 + count * 2)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                indexes[i] = word(mb_frame[13 + i * 2], mb_frame[14 + i * 2]);
+            }
+            sample_size = startTrace(indexes, count, divider);
+        }
+
+        if (sample_size >= 0)
+        {
+            mb_frame[8] = MB_DEBUG_SUCCESS;
+            mb_frame[9] = highByte(sample_size);
+            mb_frame[10] = lowByte(sample_size);
+            MessageLength = 11;
+        }
+    }
+    else if (subfunction == MB_TRACE_STOP)
+    {
+        stopTrace();
+        mb_frame[8] = MB_DEBUG_SUCCESS;
+    }
+    else if (bufferSize >= 17 && subfunction == MB_TRACE_READ)
+    {
+        uint64_t cursor = 0;
+        for (int i = 0; i < 8; i++) cursor = (cursor << 8) | mb_frame[9 + i];
+
+        TraceChunk chunk;
+        readTrace(cursor, &mb_frame[37], MAX_TRACE_DATA, &chunk);
+        uint32_t lost = chunk.lost > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)chunk.lost;
+
+        mb_frame[8] = MB_DEBUG_SUCCESS;
+        mb_frame[9] = chunk.running ? 1 : 0;
+        mb_frame[10] = (uint8_t)chunk.trigger_state;
+        for (int i = 0; i < 8; i++) mb_frame[11 + i] = (uint8_t)(chunk.first >> (56 - i * 8));
+        for (int i = 0; i < 4; i++) mb_frame[19 + i] = (uint8_t)(lost >> (24 - i * 8));
+        for (int i = 0; i < 8; i++) mb_frame[23 + i] = (uint8_t)(chunk.trigger_index >> (56 - i * 8));
+        mb_frame[31] = highByte(chunk.samples);
+        mb_frame[32] = lowByte(chunk.samples);
+        mb_frame[33] = highByte(chunk.sample_size);
+        mb_frame[34] = lowByte(chunk.sample_size);
+        mb_frame[35] = highByte(chunk.data_size);
+        mb_frame[36] = lowByte(chunk.data_size);
+        MessageLength = 37 + chunk.data_size;
+    }
+    else if (bufferSize >= 29 && subfunction == MB_TRACE_ARM)
+    {
+        uint16_t varidx = word(mb_frame[9], mb_frame[10]);
+        uint64_t value = 0;
+        uint32_t pre = 0, post = 0;
+        for (int i = 0; i < 8; i++) value = (value << 8) | mb_frame[13 + i];
+        for (int i = 0; i < 4; i++) pre = (pre << 8) | mb_frame[21 + i];
+        for (int i = 0; i < 4; i++) post = (post << 8) | mb_frame[25 + i];
+
+        if (armTraceTrigger(varidx, mb_frame[11], mb_frame[12], value, pre, post) == 0)
+        {
+            mb_frame[8] = MB_DEBUG_SUCCESS;
+        }
     }
 
-    // Read the rest of the message.
-    while (messageSize < totalMessageSize)
+    mb_frame[4] = highByte(MessageLength - 6);
+    mb_frame[5] = lowByte(MessageLength - 6);
+}
+
+/**
+ * @brief Sends a Modbus response frame for the DEBUG_SUBSCRIBE function code.
+ *
+ * Instead of asking for an explicit list of variables on every request, the
+ * client registers the variables it monitors once (possibly over several
+ * requests, each one appending at a position) and then polls with the
+ * sequence number of the previous poll. Only the variables that changed
+ * since that sequence are returned. Sequence 0 returns all of them.
+ *
+ * Modbus Request Frame (DEBUG_SUBSCRIBE):
+ * +-----+------+-----------------------------------------------------+
+ * | MB  | Sub  | Arguments                                           |
+ * | FC  | Func |                                                     |
+ * +-----+------+-----------------------------------------------------+
+ * |0x47 | 0x01 | Position (2 bytes), Count (2 bytes), Indexes (2 each)|
+ * |0x47 | 0x02 | Sequence (4 bytes), Position (2 bytes)              |
+ * +-----+------+-----------------------------------------------------+
+ *
+ * Setting at position 0 replaces the subscription, other positions must
+ * follow the variables already registered. The response carries the number
+ * of subscribed variables (2 bytes) after the response code.
+ *
+ * Modbus Response Frame (DEBUG_SUBSCRIBE poll):
+ * +-----+-------+----------+----------+---------+-------+-------+
+ * | MB  | Resp. | Sequence | Next     | Changed | Data  | Data  |
+ * | FC  | Code  |          | Position | Count   | Size  | Bytes |
+ * +-----+-------+----------+----------+---------+-------+-------+
+ * |0x47 | Code  | 4 B      | 2 B      | 2 B     | 2 B   | Data  |
+ * +-----+-------+----------+----------+---------+-------+-------+
+ *
+ * Each changed variable is written as the distance to the position of the
+ * previous one on the response (the first one to the requested position),
+ * as a base-128 varint, followed by its value. Only a poll at position 0
+ * samples the variables; when the changes don't fit on one response, Next
+ * Position is different from the subscription size and the client polls
+ * again with the same sequence from there. Once it is done, the returned
+ * Sequence is the one to use on the next poll.
+ *
+ * @return void
+ */
+void debugSubscribe(unsigned char *mb_frame, int bufferSize)
+{
+    uint8_t subfunction = bufferSize > 8 ? mb_frame[8] : 0;
+    mb_frame[7] = MB_FC_DEBUG_SUBSCRIBE;
+    mb_frame[8] = MB_DEBUG_ERROR_OUT_OF_BOUNDS;
+    MessageLength = 9;
+
+    pthread_mutex_lock(&subscription.lock);
+    if (bufferSize >= 13 && subfunction == MB_SUBSCRIBE_SET)
+    {
+        uint16_t position = word(mb_frame[9], mb_frame[10]);
+        uint16_t count = word(mb_frame[11], mb_frame[12]);
+        uint16_t variableCount = plcProgram()->get_var_count();
+        bool valid = position <= subscription.count && position + count <= MAX_SUBSCRIBED_VARS &&
+                     bufferSize >= 13 + count * 2;
+
+        uint32_t shadow_size = position == 0 ? 0 : subscription.offset[position - 1] + subscription.size[position - 1];
+        for (int i = 0; valid && i < count; i++)
+        {
+            uint16_t varidx = word(mb_frame[13 + i * 2], mb_frame[14 + i * 2]);
+            size_t varSize = varidx < variableCount ? plcProgram()->get_var_size(varidx) : 0;
+            if (varidx >= variableCount || shadow_size + varSize > SUBSCRIPTION_SHADOW_SIZE ||
+                varSize > MAX_SUBSCRIPTION_DATA - 2)
+            {
+                valid = false;
+                break;
+            }
+            subscription.indexes[position + i] = varidx;
+            subscription.offset[position + i] = shadow_size;
+            subscription.size[position + i] = (uint16_t)varSize;
+            subscription.changed[position + i] = 0;
+            shadow_size += varSize;
+        }
+
+        if (valid)
+        {
+            subscription.count = position + count;
+            subscription.shadow_size = shadow_size;
+            // Values never sent are reported on the next poll, whatever its sequence
+            subscription.sequence++;
+            for (int i = position; i < subscription.count; i++) subscription.changed[i] = subscription.sequence;
+            if (count > 0) memset(&subscription.shadow[subscription.offset[position]], 0, shadow_size - subscription.offset[position]);
+
+            mb_frame[8] = MB_DEBUG_SUCCESS;
+            mb_frame[9] = highByte(subscription.count);
+            mb_frame[10] = lowByte(subscription.count);
+            MessageLength = 11;
+        }
+    }
+    else if (bufferSize >= 15 && subfunction == MB_SUBSCRIBE_POLL)
     {
-        int bytesRead = read(fd, buffer + messageSize, totalMessageSize - messageSize);
-        if (bytesRead <= 0)
+        uint32_t sequence = ((uint32_t)mb_frame[9] << 24) | ((uint32_t)mb_frame[10] << 16) |
+                            ((uint32_t)mb_frame[11] << 8) | mb_frame[12];
+        uint16_t position = word(mb_frame[13], mb_frame[14]);
+
+        if (position == 0)
+        {
+            subscription.sequence++;
+            for (int i = 0; i < subscription.count; i++)
+            {
+                uint8_t *shadow = &subscription.shadow[subscription.offset[i]];
+                void *varAddr = plcProgram()->get_var_addr(subscription.indexes[i]);
+                if (memcmp(shadow, varAddr, subscription.size[i]) != 0)
+                {
+                    memcpy(shadow, varAddr, subscription.size[i]);
+                    subscription.changed[i] = subscription.sequence;
+                }
+            }
+        }
+
+        uint8_t *responsePtr = &mb_frame[19];
+        size_t responseSize = 0;
+        uint16_t changedCount = 0;
+        uint16_t previous = position;
+        uint16_t next = position;
+        for (; next < subscription.count; next++)
         {
-            return bytesRead;
+            if (sequence != 0 && subscription.changed[next] <= sequence) continue;
+
+            // Gap (positions fit on a 2 byte varint) plus the value
+            if (responseSize + 2 + subscription.size[next] > MAX_SUBSCRIPTION_DATA) break;
+            uint16_t gap = next - previous;
+            if (gap >= 0x80)
+            {
+                responsePtr[responseSize++] = (uint8_t)(gap & 0x7F) | 0x80;
+                gap >>= 7;
+            }
+            responsePtr[responseSize++] = (uint8_t)gap;
+            memcpy(&responsePtr[responseSize], &subscription.shadow[subscription.offset[next]], subscription.size[next]);
+            responseSize += subscription.size[next];
+            previous = next;
+            changedCount++;
         }
-        messageSize += bytesRead;
+        if (next > subscription.count) next = subscription.count;
+
+        mb_frame[8] = MB_DEBUG_SUCCESS;
+        mb_frame[9] = (uint8_t)(subscription.sequence >> 24);
+        mb_frame[10] = (uint8_t)(subscription.sequence >> 16);
+        mb_frame[11] = (uint8_t)(subscription.sequence >> 8);
+        mb_frame[12] = (uint8_t)subscription.sequence;
+        mb_frame[13] = highByte(next);
+        mb_frame[14] = lowByte(next);
+        mb_frame[15] = highByte(changedCount);
+        mb_frame[16] = lowByte(changedCount);
+        mb_frame[17] = highByte(responseSize);
+        mb_frame[18] = lowByte(responseSize);
+        MessageLength = 19 + responseSize;
+    }
+    pthread_mutex_unlock(&subscription.lock);
+
+    mb_frame[4] = highByte(MessageLength - 6);
+    mb_frame[5] = lowByte(MessageLength - 6);
+}
+
+//-----------------------------------------------------------------------------
+// Returns the size of the Modbus/TCP ADU at the start of the buffer, 0 if it
+// has not been fully received yet, or -1 if it would not fit in a buffer of
+// maxSize bytes
+//-----------------------------------------------------------------------------
+int getModbusFrameLength(unsigned char *buffer, int length, int maxSize)
+{
+    // The MBAP header carries the frame length on bytes 5 and 6
+#define MODBUS_HEADER_SIZE 6
+    if (length < MODBUS_HEADER_SIZE)
+    {
+        return 0;
+    }
+
+    uint16_t frameLength = ((uint16_t)buffer[4] << 8) | buffer[5];
+    int totalMessageSize = MODBUS_HEADER_SIZE + frameLength;
+    if (totalMessageSize > maxSize)
+    {
+        return -1;
     }
 
-    return messageSize;
+    return (length >= totalMessageSize) ? totalMessageSize : 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -1114,6 +1812,14 @@ int processModbusMessage(unsigned char *buffer, int bufferSize)
     void *value = &buffer[13];
     void *endianness_check = &buffer[8];
 
+    //requests for the unit id of a slave device in gateway mode are
+    //answered by the device (see modbus_master.cpp)
+    int gateway_length = processGatewayMessage(buffer, bufferSize);
+    if (gateway_length >= 0)
+    {
+        return gateway_length;
+    }
+
     //check if the message is long enough
     if (bufferSize < 8)
     {
@@ -1168,6 +1874,12 @@ int processModbusMessage(unsigned char *buffer, int bufferSize)
         WriteMultipleRegisters(buffer, bufferSize);
     }
 
+    //************* Read/Write Multiple Registers *************
+    else if(buffer[7] == MB_FC_READ_WRITE_MULTIPLE_REGISTERS)
+    {
+        ReadWriteMultipleRegisters(buffer, bufferSize);
+    }
+
     //****************** Debug Info ******************
     else if(buffer[7] == MB_FC_DEBUG_INFO)
     {
@@ -1195,12 +1907,36 @@ int processModbusMessage(unsigned char *buffer, int bufferSize)
         debugSetTrace(buffer, field1, flag, len, value);
     }
 
+    //****************** Debug Set Trace List ******************
+    else if(buffer[7] == MB_FC_DEBUG_SET_LIST)
+    {
+        debugSetTraceList(buffer, bufferSize);
+    }
+
     //****************** Debug Get MD5 ******************
     else if(buffer[7] ==MB_FC_DEBUG_GET_MD5)
     {
         debugGetMd5(buffer, endianness_check);
     }
 
+    //****************** Debug Trace ******************
+    else if(buffer[7] == MB_FC_DEBUG_TRACE)
+    {
+        debugTrace(buffer, bufferSize);
+    }
+
+    //****************** Debug Subscribe ******************
+    else if(buffer[7] == MB_FC_DEBUG_SUBSCRIBE)
+    {
+        debugSubscribe(buffer, bufferSize);
+    }
+
+    //****************** Debug Describe ******************
+    else if(buffer[7] == MB_FC_DEBUG_DESCRIBE)
+    {
+        debugDescribe(buffer, bufferSize);
+    }
+
     //****************** Function Code Error ******************
     else
     {
@@ -31,7 +31,17 @@
 #include <modbus.h>
 #include <errno.h>
 #include <string.h>
-#include <pthread.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#include <linux/serial.h>
+#endif
+#include <atomic>
 
 #include <iostream>
 #include <fstream>
@@ -41,27 +51,121 @@
 
 #define MB_TCP                1
 #define MB_RTU                2
-#define MAX_MB_IO            400
+
+#define MB_RS485_OFF          0
+#define MB_RS485_RTS_HIGH     1     // RTS high while sending
+#define MB_RS485_RTS_LOW      2     // RTS low while sending
+
+//Slave device points are mapped from %IX100.0/%QX100.0 and %IW100/%QW100 up
+//to the end of the located variable buffers
+#define MB_IO_START          100
+#define MAX_MB_BOOL_IO       ((BUFFER_SIZE - MB_IO_START) * 8)
+#define MAX_MB_INT_IO        (BUFFER_SIZE - MB_IO_START)
 
 using namespace std;
 
-uint8_t bool_input_buf[MAX_MB_IO];
-uint8_t bool_output_buf[MAX_MB_IO];
-uint16_t int_input_buf[MAX_MB_IO];
-uint16_t int_output_buf[MAX_MB_IO];
 extern uint8_t rpi_modbus_rts_pin;     // If <> 0, expect hardware RTS to be used with this pin
 
-pthread_mutex_t ioLock;
-
 struct MB_address
 {
     uint16_t start_address;
     uint16_t num_regs;
 };
 
+//-----------------------------------------------------------------------------
+// Part of a request copied from or to the master buffers
+//-----------------------------------------------------------------------------
+struct MB_segment
+{
+    uint16_t request_offset;    // first point of the segment on the request
+    uint16_t buffer_offset;     // first point of the segment on the master buffer
+    uint16_t count;
+};
+
+//-----------------------------------------------------------------------------
+// One Modbus request issued on every poll of a device. The request list is
+// built at startup, coalescing the address blocks of the device
+//-----------------------------------------------------------------------------
+struct MB_request
+{
+    uint8_t function;
+    uint16_t start_address;
+    uint16_t num_regs;
+    int num_segments;
+    struct MB_segment *segments;
+
+    //write requests only: payload last acknowledged by the slave
+    bool acknowledged;
+    void *last_written;
+
+    //holding register write executed together with a holding register read
+    //as one FC23 transaction, on devices that combine them. The read request
+    //is flagged as paired and is not executed on its own
+    struct MB_request *paired_read;
+    bool paired;
+
+    //schedule of the blocks on the request
+    uint16_t period;            // ms between polls, 0 for the period of the device
+    int priority;               // requests with higher priority are issued first
+    struct timespec next_due;
+    bool selected;              // issued on the poll in progress
+};
+
+//Statistics, poll periods and priorities are kept per block type of the
+//requests of a device
+#define MB_BLOCK_DISCRETE_INPUTS    0
+#define MB_BLOCK_COILS              1
+#define MB_BLOCK_INPUT_REGISTERS    2
+#define MB_BLOCK_HOLDING_READ       3
+#define MB_BLOCK_HOLDING_WRITE      4
+#define MB_BLOCK_TYPES              5
+
+#define MB_LATENCY_BUCKETS          24
+
+//Device statistics on the located variables: 8 %ML per device from %ML1040
+#define MB_STATS_SPECIAL_START      16
+#define MB_STATS_PER_DEVICE         8
+
+//-----------------------------------------------------------------------------
+// Transactions of one block type of a device. Only the thread of the device
+// bus writes them and any thread may read them, so they are plain relaxed
+// atomics without locks
+//-----------------------------------------------------------------------------
+struct MB_block_stats
+{
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> errors;           // failed requests, timeouts included
+    std::atomic<uint64_t> timeouts;
+    std::atomic<uint64_t> latency_sum_us;   // round trips of the requests answered
+    std::atomic<uint64_t> latency_min_us;
+    std::atomic<uint64_t> latency_max_us;
+    std::atomic<uint64_t> histogram[MB_LATENCY_BUCKETS];    // bucket i: below 2^(i+1) us
+};
+
+struct MB_device_stats
+{
+    struct MB_block_stats blocks[MB_BLOCK_TYPES];
+    std::atomic<uint64_t> reconnects;
+    std::atomic<uint64_t> connect_failures;
+};
+
+//-----------------------------------------------------------------------------
+// A request sent on a pipelined TCP connection, waiting for its response
+//-----------------------------------------------------------------------------
+struct MB_pending
+{
+    struct MB_request *request;
+    struct timespec sent;
+    int first;                              // first point written (writes only)
+    int count;                              // points written (writes only)
+    uint8_t adu[MODBUS_TCP_MAX_ADU_LENGTH];
+    uint8_t payload[MODBUS_MAX_WRITE_BITS]; // points written (writes only)
+};
+
 struct MB_device
 {
     modbus_t *mb_ctx;
+    int index;                      // position of the device on mbconfig.cfg
     char dev_name[100];
     uint8_t protocol;
     char dev_address[100];
@@ -71,20 +175,245 @@ struct MB_device
     int rtu_data_bit;
     int rtu_stop_bit;
     int rtu_tx_pause;
+    int rtu_tx_pause_us;            // added to rtu_tx_pause (ms)
+    uint8_t rtu_rs485;              // MB_RS485_*: direction driven by the serial driver
+    bool rtu_low_latency;           // no receive buffering on the serial driver
     uint8_t dev_id;
-    bool isConnected;
+    uint16_t polling_period;
+    int priority;                   // devices with higher priority are polled first
+    uint16_t block_period[MB_BLOCK_TYPES];  // ms, 0 for polling_period
+    int block_priority[MB_BLOCK_TYPES];
+    uint8_t block_priority_set;     // bit per block type with a priority of its own
+    bool combine_holding;           // holding writes and reads in FC23 transactions
+    uint16_t holding_write_mask;    // if not 0, bits of the holding registers written with FC22
+    int max_outstanding;            // TCP requests in flight at once, 1 waits for each response
+    uint8_t gateway_unit_id;        // if not 0, server unit id forwarded to the device
+    bool separate_connection;       // TCP connection of its own, not shared with the devices at the same IP and port
+    int gateway_max_age;            // ms a gateway read answer is served from the cache
 
     struct MB_address discrete_inputs;
     struct MB_address coils;
     struct MB_address input_registers;
     struct MB_address holding_read_registers;
     struct MB_address holding_registers;
+
+    //position of the device points after %IX100.0/%QX100.0 and %IW100/%QW100
+    uint16_t bool_input_offset;
+    uint16_t bool_output_offset;
+    uint16_t int_input_offset;
+    uint16_t int_output_offset;
+
+    //position of the device points on the buffers of its bus
+    uint16_t bus_bool_input_offset;
+    uint16_t bus_bool_output_offset;
+    uint16_t bus_int_input_offset;
+    uint16_t bus_int_output_offset;
+
+    struct MB_bus *bus;
+    struct MB_device *previous;     // same device on the table this one replaces, while it is swapped in
+    struct timespec next_poll;      // earliest next_due of its requests
+    struct timespec next_refresh;   // next write of all the outputs
+
+    //requests of the device and of the devices polled with it
+    struct MB_device *group_leader;
+    struct MB_request *requests;
+    int num_requests;
+    struct MB_segment *segments;
+    int num_segments;
+    struct MB_pending *pending;     // max_outstanding slots, pipelined TCP devices only
+
+    //statistics of the requests executed by the device, for the devices it polls
+    struct MB_device_stats stats;
+
+    //request buffers, allocated with the device in parseConfig()
+    uint8_t bit_buffer[MODBUS_MAX_READ_BITS];
+    uint16_t register_buffer[MODBUS_MAX_READ_REGISTERS];
+    uint16_t combined_read_buffer[MODBUS_MAX_WR_READ_REGISTERS];
+};
+
+//-----------------------------------------------------------------------------
+// Triple buffer that passes the points of a bus between its polling thread
+// and the scan thread without locks. The producer fills its own buffer and
+// swaps it with the shared one; the consumer swaps its buffer with the
+// shared one when the shared one is fresh. Neither side ever waits
+//-----------------------------------------------------------------------------
+#define MB_FRESH_BUFFER     4
+
+struct MB_exchange
+{
+    uint8_t *bits[3];
+    uint16_t *registers[3];
+    int num_bits;
+    int num_registers;
+    std::atomic<int> shared;    // index of the shared buffer, with MB_FRESH_BUFFER if unseen
+    int producer;               // index of the buffer owned by the producer
+    int consumer;               // index of the buffer owned by the consumer
+};
+
+//-----------------------------------------------------------------------------
+// Maps a range of points of the bus buffers onto the located variables
+//-----------------------------------------------------------------------------
+struct MB_run
+{
+    uint16_t image_offset;      // first point after %IX100.0/%IW100 (or %Q)
+    uint16_t bus_offset;        // first point on the bus buffers
+    uint16_t count;
+};
+
+//-----------------------------------------------------------------------------
+// Gateway mode. Requests received by the Modbus server for the unit id of a
+// slave device are forwarded to it by the thread of its bus. Each bus with
+// gateway devices has a table of entries shared by the server workers and
+// the bus thread: a read entry holds the last answer to a request, so
+// clients asking for the same points while it is pending wait for the same
+// upstream request, and later ones are answered from it while it is fresh
+//-----------------------------------------------------------------------------
+#define MB_GATEWAY_ENTRIES              16
+
+#define MB_GATEWAY_EMPTY                0
+#define MB_GATEWAY_PENDING              1   // waiting for the bus thread
+#define MB_GATEWAY_DONE                 2   // answered, or failed with exception
+
+#define MB_EXCEPTION_ILLEGAL_FUNCTION   0x01
+#define MB_EXCEPTION_ILLEGAL_VALUE      0x03
+#define MB_EXCEPTION_BUSY               0x06
+#define MB_EXCEPTION_PATH_UNAVAILABLE   0x0A
+#define MB_EXCEPTION_TARGET_FAILED      0x0B
+
+struct MB_gateway_entry
+{
+    int state;
+    bool write;
+    struct MB_device *device;
+    uint8_t function;
+    uint16_t address;
+    uint16_t count;
+    int exception;                  // 0, or the exception code of the answer
+    int waiters;                    // clients waiting for the entry
+    struct timespec completed;
+    uint16_t registers[MODBUS_MAX_READ_REGISTERS];
+    uint8_t bits[MODBUS_MAX_READ_BITS];
+};
+
+struct MB_gateway
+{
+    pthread_mutex_t lock;
+    pthread_cond_t wake;            // entries are pending for the bus thread
+    pthread_cond_t done;            // entries were completed for the clients
+    int num_pending;
+    struct MB_gateway_entry entries[MB_GATEWAY_ENTRIES];
 };
 
-struct MB_device *mb_devices;
-uint8_t num_devices;
+//-----------------------------------------------------------------------------
+// A bus is a connection shared by one or more devices: TCP devices at the same
+// IP and port (the slaves behind a TCP to RTU gateway) share one, and so do
+// RTU devices on the same serial port. Each bus is polled by its own thread,
+// so a slow or offline bus only delays its devices
+//-----------------------------------------------------------------------------
+struct MB_bus
+{
+    modbus_t *mb_ctx;
+    uint8_t protocol;
+    bool isConnected;
+    int num_devices;
+    struct MB_device **devices;
+    int silent_requests;            // requests in a row that timed out, TCP buses of several devices
+
+    int current_slave;              // slave id last set on mb_ctx
+    long long frame_gap_ns;         // silent interval required between frames
+    struct timespec last_frame_end; // when the last response was received
+    struct timespec request_start;  // when the last request was sent
+    bool was_connected;             // a connection was open before
+
+    //reconnection of a bus that is down: attempts back off exponentially
+    //and only the first failure and a periodic summary are logged
+    struct timespec next_connect;   // earliest time of the next attempt
+    int backoff_ms;                 // wait after the next failed attempt
+    int failed_connects;            // failed attempts since the bus went down
+    struct timespec next_failure_log;
+    unsigned int jitter_seed;
+
+    //points of all the devices of the bus, produced by the polling thread
+    //(inputs) or by the scan (outputs), and where they go on the images
+    struct MB_exchange inputs;
+    struct MB_exchange outputs;
+    struct MB_run *bool_input_runs;
+    struct MB_run *int_input_runs;
+    struct MB_run *bool_output_runs;
+    struct MB_run *int_output_runs;
+    int num_runs;
+
+    struct MB_gateway *gateway;     // NULL if no device of the bus is a gateway unit
+
+    //in step with the scan: deadline of the last scan the bus was polled for
+    std::atomic<uint64_t> sync_done;
+
+    //polling thread, and the connection carried over by a reload
+    pthread_t thread;
+    bool running;
+    std::atomic<bool> stop;
+    struct MB_bus *previous;        // bus of the replaced table the connection comes from
+    bool handed_over;               // the connection went to the table that replaced this one
+};
+
+//-----------------------------------------------------------------------------
+// Device table built from mbconfig.cfg: the devices, the buses that poll them
+// and the settings they were configured with. A reload builds a new table
+// next to the running one and the scan swaps them (see reloadMB)
+//-----------------------------------------------------------------------------
+struct MB_master
+{
+    struct MB_device *devices;
+    int num_devices;
+    struct MB_bus *buses;
+    int num_buses;
+    struct MB_device *gateway_units[256];   // device of each server unit id in gateway mode
+    bool has_gateways;
+
+    uint16_t polling_period;
+    uint16_t timeout;
+    int write_refresh_period;
+    int reconnect_backoff_max;
+    int scan_sync_offset;
+    int scan_sync_deadline;
+
+    std::atomic<int> users;         // server workers and clients using the table (acquireMaster)
+};
+
+//table the scan runs with. Only the scan thread changes it, and the other
+//threads take it with acquireMaster
+static struct MB_master *master = NULL;
+static pthread_mutex_t masterLock = PTHREAD_MUTEX_INITIALIZER;
+static std::atomic<struct MB_master *> pending_master(NULL);
+static std::atomic<bool> master_swapped(false);
+static pthread_mutex_t reloadLock = PTHREAD_MUTEX_INITIALIZER;
+
+//set while the running table has gateway devices, so the server skips the
+//table for the other requests
+static std::atomic<bool> gateways_configured(false);
+
+#define MB_RELOAD_TIMEOUT_MS    5000    // longest wait for the scan to swap a reloaded table
+
+//settings of the running table, read by the polling threads
 uint16_t polling_period = 100;
 uint16_t timeout = 1000;
+int write_refresh_period = 0;   // >0 only writes changed outputs, with a full write every period (ms)
+int reconnect_backoff_max = 30000;  // longest wait between connection attempts (ms)
+int scan_sync_offset = 0;       // >0 polls every device this long before each scan (us)
+int scan_sync_deadline = 0;     // longest the scan waits past its start for those polls (us)
+
+#define MB_FAILURE_LOG_PERIOD   60000   // ms between summaries of repeated connection failures
+
+#define MB_SYNC_IDLE_WAIT       10      // ms the buses wait for a scan before serving the gateway
+
+//polls in step with the scan: the buses signal sync_cond when they are done
+//with a scan, the scan waits on it for the ones that are not
+static pthread_mutex_t sync_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sync_cond;
+static pthread_once_t sync_once = PTHREAD_ONCE_INIT;
+static std::atomic<uint64_t> sync_scans(0);
+static std::atomic<uint64_t> sync_late_scans(0);
+static bool sync_late_reported = false;
 
 //-----------------------------------------------------------------------------
 // Finds the data between the separators on the line provided
@@ -150,12 +479,41 @@ void getFunction(char *line, char *parameter)
     }
 }
 
-void parseConfig()
+//-----------------------------------------------------------------------------
+// Returns the block type of a per-block device parameter (e.g. Coils_Priority
+// for the suffix _Priority), or -1 if the parameter is not one
+//-----------------------------------------------------------------------------
+static int getConfigBlock(const char *parameter, const char *suffix)
+{
+    static const char *block_names[MB_BLOCK_TYPES] = {"Discrete_Inputs", "Coils", "Input_Registers",
+                                                      "Holding_Registers_Read", "Holding_Registers"};
+    char name[100];
+
+    for (int b = 0; b < MB_BLOCK_TYPES; b++)
+    {
+        snprintf(name, sizeof(name), "%s%s", block_names[b], suffix);
+        if (!strcmp(parameter, name)) return b;
+    }
+
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// Reads mbconfig.cfg into a new device table
+//-----------------------------------------------------------------------------
+static void parseConfig(struct MB_master *m)
 {
     string line;
     char line_str[1024];
     ifstream cfgfile("mbconfig.cfg");
 
+    m->polling_period = 100;
+    m->timeout = 1000;
+    m->write_refresh_period = 0;
+    m->reconnect_backoff_max = 30000;
+    m->scan_sync_offset = 0;
+    m->scan_sync_deadline = 0;
+
     if (cfgfile.is_open())
     {
         while (getline(cfgfile, line))
@@ -167,21 +525,46 @@ void parseConfig()
                 {
                     char temp_buffer[5];
                     getData(line_str, temp_buffer, '"', '"');
-                    num_devices = atoi(temp_buffer);
+                    m->num_devices = atoi(temp_buffer);
                     //initializes the allocated memory to zero
-                    mb_devices = calloc(num_devices, sizeof(struct MB_device));
+                    m->devices = calloc(m->num_devices, sizeof(struct MB_device));
+                    for (int i = 0; i < m->num_devices; i++) m->devices[i].index = i;
                 }
                 else if (!strncmp(line_str, "Polling_Period", 14))
                 {
                     char temp_buffer[10];
                     getData(line_str, temp_buffer, '"', '"');
-                    polling_period = atoi(temp_buffer);
+                    m->polling_period = atoi(temp_buffer);
                 }
                 else if (!strncmp(line_str, "Timeout", 7))
                 {
                     char temp_buffer[10];
                     getData(line_str, temp_buffer, '"', '"');
-                    timeout = atoi(temp_buffer);
+                    m->timeout = atoi(temp_buffer);
+                }
+                else if (!strncmp(line_str, "Write_Refresh_Period", 20))
+                {
+                    char temp_buffer[10];
+                    getData(line_str, temp_buffer, '"', '"');
+                    m->write_refresh_period = atoi(temp_buffer);
+                }
+                else if (!strncmp(line_str, "Reconnect_Backoff_Max", 21))
+                {
+                    char temp_buffer[10];
+                    getData(line_str, temp_buffer, '"', '"');
+                    m->reconnect_backoff_max = atoi(temp_buffer);
+                }
+                else if (!strncmp(line_str, "Scan_Sync_Offset", 16))
+                {
+                    char temp_buffer[10];
+                    getData(line_str, temp_buffer, '"', '"');
+                    m->scan_sync_offset = atoi(temp_buffer);
+                }
+                else if (!strncmp(line_str, "Scan_Sync_Deadline", 18))
+                {
+                    char temp_buffer[10];
+                    getData(line_str, temp_buffer, '"', '"');
+                    m->scan_sync_deadline = atoi(temp_buffer);
                 }
 
                 else if (!strncmp(line_str, "device", 6))
@@ -189,10 +572,12 @@ void parseConfig()
                     int deviceNumber = getDeviceNumber(line_str);
                     char functionType[100];
                     getFunction(line_str, functionType);
+                    int block;
+                    if (deviceNumber < 0 || deviceNumber >= m->num_devices) continue;
 
                     if (!strncmp(functionType, "name", 4))
                     {
-                        getData(line_str, mb_devices[deviceNumber].dev_name, '"', '"');
+                        getData(line_str, m->devices[deviceNumber].dev_name, '"', '"');
                     }
                     else if (!strncmp(functionType, "protocol", 8))
                     {
@@ -200,115 +585,195 @@ void parseConfig()
                         getData(line_str, temp_buffer, '"', '"');
 
                         if (!strncmp(temp_buffer, "TCP", 3))
-                            mb_devices[deviceNumber].protocol = MB_TCP;
+                            m->devices[deviceNumber].protocol = MB_TCP;
                         else if (!strncmp(temp_buffer, "RTU", 3))
-                            mb_devices[deviceNumber].protocol = MB_RTU;
+                            m->devices[deviceNumber].protocol = MB_RTU;
                     }
                     else if (!strncmp(functionType, "slave_id", 8))
                     {
                         char temp_buffer[5];
                         getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].dev_id = atoi(temp_buffer);
+                        m->devices[deviceNumber].dev_id = atoi(temp_buffer);
                     }
                     else if (!strncmp(functionType, "address", 7))
                     {
-                        getData(line_str, mb_devices[deviceNumber].dev_address, '"', '"');
+                        getData(line_str, m->devices[deviceNumber].dev_address, '"', '"');
                     }
                     else if (!strncmp(functionType, "IP_Port", 7))
                     {
                         char temp_buffer[6];
                         getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].ip_port = atoi(temp_buffer);
+                        m->devices[deviceNumber].ip_port = atoi(temp_buffer);
                     }
                     else if (!strncmp(functionType, "RTU_Baud_Rate", 13))
                     {
                         char temp_buffer[10];
                         getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].rtu_baud = atoi(temp_buffer);
+                        m->devices[deviceNumber].rtu_baud = atoi(temp_buffer);
                     }
                     else if (!strncmp(functionType, "RTU_Parity", 10))
                     {
                         char temp_buffer[3];
                         getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].rtu_parity = temp_buffer[0];
+                        m->devices[deviceNumber].rtu_parity = temp_buffer[0];
                     }
                     else if (!strncmp(functionType, "RTU_Data_Bits", 13))
                     {
                         char temp_buffer[6];
                         getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].rtu_data_bit = atoi(temp_buffer);
+                        m->devices[deviceNumber].rtu_data_bit = atoi(temp_buffer);
                     }
                     else if (!strncmp(functionType, "RTU_Stop_Bits", 13))
                     {
                         char temp_buffer[20];
                         getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].rtu_stop_bit = atoi(temp_buffer);
+                        m->devices[deviceNumber].rtu_stop_bit = atoi(temp_buffer);
+                    }
+                    else if (!strncmp(functionType, "Priority", 8))
+                    {
+                        char temp_buffer[10];
+                        getData(line_str, temp_buffer, '"', '"');
+                        m->devices[deviceNumber].priority = atoi(temp_buffer);
+                    }
+                    else if (!strncmp(functionType, "Polling_Period", 14))
+                    {
+                        char temp_buffer[10];
+                        getData(line_str, temp_buffer, '"', '"');
+                        m->devices[deviceNumber].polling_period = atoi(temp_buffer);
+                    }
+                    else if (!strncmp(functionType, "Max_Outstanding_Requests", 24))
+                    {
+                        char temp_buffer[10];
+                        getData(line_str, temp_buffer, '"', '"');
+                        m->devices[deviceNumber].max_outstanding = atoi(temp_buffer);
+                    }
+                    else if (!strncmp(functionType, "Gateway_Unit_ID", 15))
+                    {
+                        char temp_buffer[10];
+                        getData(line_str, temp_buffer, '"', '"');
+                        m->devices[deviceNumber].gateway_unit_id = atoi(temp_buffer);
+                    }
+                    else if (!strncmp(functionType, "Separate_Connection", 19))
+                    {
+                        char temp_buffer[10];
+                        getData(line_str, temp_buffer, '"', '"');
+                        m->devices[deviceNumber].separate_connection = (!strcmp(temp_buffer, "true") || !strcmp(temp_buffer, "True"));
+                    }
+                    else if (!strncmp(functionType, "Gateway_Max_Age", 15))
+                    {
+                        char temp_buffer[10];
+                        getData(line_str, temp_buffer, '"', '"');
+                        m->devices[deviceNumber].gateway_max_age = atoi(temp_buffer);
+                    }
+                    else if (!strncmp(functionType, "RTU_TX_Pause_Us", 15))
+                    {
+                        char temp_buffer[10];
+                        getData(line_str, temp_buffer, '"', '"');
+                        m->devices[deviceNumber].rtu_tx_pause_us = atoi(temp_buffer);
                     }
                     else if (!strncmp(functionType, "RTU_TX_Pause", 12))
                     {
                         char temp_buffer[10];
                         getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].rtu_tx_pause = atoi(temp_buffer);
+                        m->devices[deviceNumber].rtu_tx_pause = atoi(temp_buffer);
+                    }
+                    else if (!strncmp(functionType, "RTU_RS485", 9))
+                    {
+                        char temp_buffer[10];
+                        getData(line_str, temp_buffer, '"', '"');
+                        if (!strcmp(temp_buffer, "true") || !strcmp(temp_buffer, "True")) m->devices[deviceNumber].rtu_rs485 = MB_RS485_RTS_HIGH;
+                        else if (!strcmp(temp_buffer, "rts_low")) m->devices[deviceNumber].rtu_rs485 = MB_RS485_RTS_LOW;
+                    }
+                    else if (!strncmp(functionType, "RTU_Low_Latency", 15))
+                    {
+                        char temp_buffer[10];
+                        getData(line_str, temp_buffer, '"', '"');
+                        m->devices[deviceNumber].rtu_low_latency = (!strcmp(temp_buffer, "true") || !strcmp(temp_buffer, "True"));
+                    }
+                    else if ((block = getConfigBlock(functionType, "_Polling_Period")) != -1)
+                    {
+                        char temp_buffer[10];
+                        getData(line_str, temp_buffer, '"', '"');
+                        m->devices[deviceNumber].block_period[block] = atoi(temp_buffer);
+                    }
+                    else if ((block = getConfigBlock(functionType, "_Priority")) != -1)
+                    {
+                        char temp_buffer[10];
+                        getData(line_str, temp_buffer, '"', '"');
+                        m->devices[deviceNumber].block_priority[block] = atoi(temp_buffer);
+                        m->devices[deviceNumber].block_priority_set |= (1 << block);
                     }
                     else if (!strncmp(functionType, "Discrete_Inputs_Start", 21))
                     {
                         char temp_buffer[10];
                         getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].discrete_inputs.start_address = atoi(temp_buffer);
+                        m->devices[deviceNumber].discrete_inputs.start_address = atoi(temp_buffer);
                     }
                     else if (!strncmp(functionType, "Discrete_Inputs_Size", 20))
                     {
                         char temp_buffer[10];
                         getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].discrete_inputs.num_regs = atoi(temp_buffer);
+                        m->devices[deviceNumber].discrete_inputs.num_regs = atoi(temp_buffer);
                     }
                     else if (!strncmp(functionType, "Coils_Start", 11))
                     {
                         char temp_buffer[10];
                         getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].coils.start_address = atoi(temp_buffer);
+                        m->devices[deviceNumber].coils.start_address = atoi(temp_buffer);
                     }
                     else if (!strncmp(functionType, "Coils_Size", 10))
                     {
                         char temp_buffer[10];
                         getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].coils.num_regs = atoi(temp_buffer);
+                        m->devices[deviceNumber].coils.num_regs = atoi(temp_buffer);
                     }
                     else if (!strncmp(functionType, "Input_Registers_Start", 21))
                     {
                         char temp_buffer[10];
                         getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].input_registers.start_address = atoi(temp_buffer);
+                        m->devices[deviceNumber].input_registers.start_address = atoi(temp_buffer);
                     }
                     else if (!strncmp(functionType, "Input_Registers_Size", 20))
                     {
                         char temp_buffer[10];
                         getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].input_registers.num_regs = atoi(temp_buffer);
+                        m->devices[deviceNumber].input_registers.num_regs = atoi(temp_buffer);
                     }
                     else if (!strncmp(functionType, "Holding_Registers_Read_Start", 28))
                     {
                         char temp_buffer[10];
                         getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].holding_read_registers.start_address = atoi(temp_buffer);
+                        m->devices[deviceNumber].holding_read_registers.start_address = atoi(temp_buffer);
                     }
                     else if (!strncmp(functionType, "Holding_Registers_Read_Size", 27))
                     {
                         char temp_buffer[10];
                         getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].holding_read_registers.num_regs = atoi(temp_buffer);
+                        m->devices[deviceNumber].holding_read_registers.num_regs = atoi(temp_buffer);
+                    }
+                    else if (!strncmp(functionType, "Holding_Registers_Combine", 25))
+                    {
+                        char temp_buffer[10];
+                        getData(line_str, temp_buffer, '"', '"');
+                        m->devices[deviceNumber].combine_holding = (!strcmp(temp_buffer, "true") || !strcmp(temp_buffer, "True"));
+                    }
+                    else if (!strncmp(functionType, "Holding_Registers_Write_Mask", 28))
+                    {
+                        char temp_buffer[10];
+                        getData(line_str, temp_buffer, '"', '"');
+                        m->devices[deviceNumber].holding_write_mask = (uint16_t)strtol(temp_buffer, NULL, 0);
                     }
                     else if (!strncmp(functionType, "Holding_Registers_Start", 23))
                     {
                         char temp_buffer[10];
                         getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].holding_registers.start_address = atoi(temp_buffer);
+                        m->devices[deviceNumber].holding_registers.start_address = atoi(temp_buffer);
                     }
                     else if (!strncmp(functionType, "Holding_Registers_Size", 22))
                     {
                         char temp_buffer[10];
                         getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].holding_registers.num_regs = atoi(temp_buffer);
+                        m->devices[deviceNumber].holding_registers.num_regs = atoi(temp_buffer);
                     }
                 }
             }
@@ -323,25 +788,25 @@ void parseConfig()
 
     //Parser Debug
     ///*
-    for (int i = 0; i < num_devices; i++)
+    for (int i = 0; i < m->num_devices; i++)
     {
         printf("Device %d\n", i);
-        printf("Name: %s\n", mb_devices[i].dev_name);
-        printf("Protocol: %d\n", mb_devices[i].protocol);
-        printf("Address: %s\n", mb_devices[i].dev_address);
-        printf("IP Port: %d\n", mb_devices[i].ip_port);
-        printf("Baud rate: %d\n", mb_devices[i].rtu_baud);
-        printf("Parity: %c\n", mb_devices[i].rtu_parity);
-        printf("Data Bits: %d\n", mb_devices[i].rtu_data_bit);
-        printf("Stop Bits: %d\n", mb_devices[i].rtu_stop_bit);
-        printf("DI Start: %d\n", mb_devices[i].discrete_inputs.start_address);
-        printf("DI Size: %d\n", mb_devices[i].discrete_inputs.num_regs);
-        printf("Coils Start: %d\n", mb_devices[i].coils.start_address);
-        printf("Coils Size: %d\n", mb_devices[i].coils.num_regs);
-        printf("IR Start: %d\n", mb_devices[i].input_registers.start_address);
-        printf("IR Size: %d\n", mb_devices[i].input_registers.num_regs);
-        printf("HR Start: %d\n", mb_devices[i].holding_registers.start_address);
-        printf("HR Size: %d\n", mb_devices[i].holding_registers.num_regs);
+        printf("Name: %s\n", m->devices[i].dev_name);
+        printf("Protocol: %d\n", m->devices[i].protocol);
+        printf("Address: %s\n", m->devices[i].dev_address);
+        printf("IP Port: %d\n", m->devices[i].ip_port);
+        printf("Baud rate: %d\n", m->devices[i].rtu_baud);
+        printf("Parity: %c\n", m->devices[i].rtu_parity);
+        printf("Data Bits: %d\n", m->devices[i].rtu_data_bit);
+        printf("Stop Bits: %d\n", m->devices[i].rtu_stop_bit);
+        printf("DI Start: %d\n", m->devices[i].discrete_inputs.start_address);
+        printf("DI Size: %d\n", m->devices[i].discrete_inputs.num_regs);
+        printf("Coils Start: %d\n", m->devices[i].coils.start_address);
+        printf("Coils Size: %d\n", m->devices[i].coils.num_regs);
+        printf("IR Start: %d\n", m->devices[i].input_registers.start_address);
+        printf("IR Size: %d\n", m->devices[i].input_registers.num_regs);
+        printf("HR Start: %d\n", m->devices[i].holding_registers.start_address);
+        printf("HR Size: %d\n", m->devices[i].holding_registers.num_regs);
         printf("\n\n");
     }
     //*/
@@ -349,374 +814,2692 @@ void parseConfig()
 
 
 //-----------------------------------------------------------------------------
-// Thread to poll each slave device
+// Allocates the buffers of an exchange
 //-----------------------------------------------------------------------------
-void *querySlaveDevices(void *arg)
+static void createExchange(struct MB_exchange *exchange, int num_bits, int num_registers)
 {
-    while (run_openplc)
+    exchange->num_bits = num_bits;
+    exchange->num_registers = num_registers;
+    for (int i = 0; i < 3; i++)
     {
-        char log_msg[1000];
-        
-        uint16_t bool_input_index = 0;
-        uint16_t bool_output_index = 0;
-        uint16_t int_input_index = 0;
-        uint16_t int_output_index = 0;
+        //allocate at least one point so that the buffers are never NULL
+        exchange->bits[i] = (uint8_t *)calloc(num_bits + 1, sizeof(uint8_t));
+        exchange->registers[i] = (uint16_t *)calloc(num_registers + 1, sizeof(uint16_t));
+    }
+    exchange->producer = 0;
+    exchange->shared.store(1);
+    exchange->consumer = 2;
+}
 
-        for (int i = 0; i < num_devices; i++)
-        {
-            //Check if there is a connected RTU device using the same port
-            bool found_sharing = false;
-            bool rtu_port_connected = false;
-            if (mb_devices[i].protocol == MB_RTU)
-            {
-                for (int a = 0; a < num_devices; a++)
-                {
-                    if (a != i && !strcmp(mb_devices[i].dev_address, mb_devices[a].dev_address))
-                    {
-                        found_sharing = true;
-                        if (mb_devices[a].isConnected)
-                        {
-                            rtu_port_connected = true;
-                        }
-                    }
-                }
-                if (found_sharing)
-                {
-                    //Must reset mb context to current device's slave id
-                    modbus_set_slave(mb_devices[i].mb_ctx, mb_devices[i].dev_id);
-                }
-            }
+//-----------------------------------------------------------------------------
+// Publishes the producer buffer of an exchange. With keep_contents the new
+// producer buffer starts as a copy of the published one, for producers that
+// only update part of the points each time
+//-----------------------------------------------------------------------------
+static void publishExchange(struct MB_exchange *exchange, bool keep_contents)
+{
+    int published = exchange->producer;
+    exchange->producer = exchange->shared.exchange(published | MB_FRESH_BUFFER, std::memory_order_acq_rel) & 3;
 
-            //Verify if device is connected
-            if (!mb_devices[i].isConnected && !rtu_port_connected)
-            {
-                sprintf(log_msg, "Device %s is disconnected. Attempting to reconnect...\n", mb_devices[i].dev_name);
-                openplc_log(log_msg);
-                if (modbus_connect(mb_devices[i].mb_ctx) == -1)
-                {
+    if (keep_contents)
+    {
+        memcpy(exchange->bits[exchange->producer], exchange->bits[published], exchange->num_bits);
+        memcpy(exchange->registers[exchange->producer], exchange->registers[published], exchange->num_registers * sizeof(uint16_t));
+    }
+}
 
-                    sprintf(log_msg, "Connection failed on MB device %s: %s\n", mb_devices[i].dev_name, modbus_strerror(errno));
-                    openplc_log(log_msg);
-                    
-                    if (special_functions[2] != NULL) *special_functions[2]++;
-                    
-                    // Because this device is not connected, we skip those input registers
-                    bool_input_index += (mb_devices[i].discrete_inputs.num_regs);
-                    int_input_index += (mb_devices[i].input_registers.num_regs);
-                    int_input_index += (mb_devices[i].holding_read_registers.num_regs);
-                    bool_output_index += (mb_devices[i].coils.num_regs);
-                    int_output_index += (mb_devices[i].holding_registers.num_regs);
-                }
-                else
-                {
-                    sprintf(log_msg, "Connected to MB device %s\n", mb_devices[i].dev_name);
-                    openplc_log(log_msg);
-                    mb_devices[i].isConnected = true;
-                }
-            }
-            if (mb_devices[i].isConnected || rtu_port_connected)
-            {
+//-----------------------------------------------------------------------------
+// Takes the last published buffer of an exchange, if it was not seen yet. The
+// consumer buffer always holds the newest points seen
+//-----------------------------------------------------------------------------
+static void consumeExchange(struct MB_exchange *exchange)
+{
+    if ((exchange->shared.load(std::memory_order_relaxed) & MB_FRESH_BUFFER) == 0) return;
+    exchange->consumer = exchange->shared.exchange(exchange->consumer, std::memory_order_acq_rel) & 3;
+}
 
-                struct timespec ts;
-                ts.tv_sec = 0;
-                if (mb_devices[i].protocol == MB_RTU)
-                {
-                    ts.tv_nsec = (1000*1000*1000*28)/mb_devices[i].rtu_baud;
-                }
-                else
-                {
-                    ts.tv_nsec = 0;                    
-                }
+//-----------------------------------------------------------------------------
+// Increments the communication error counter (%ML1026). The counter is shared
+// by all the bus threads
+//-----------------------------------------------------------------------------
+static void countCommError()
+{
+    if (special_functions[2] != NULL) __atomic_fetch_add(special_functions[2], 1, __ATOMIC_RELAXED);
+}
 
-                //Read discrete inputs
-                if (mb_devices[i].discrete_inputs.num_regs != 0)
-                {
-                    sleepms(mb_devices[i].rtu_tx_pause);
-                    uint8_t *tempBuff;
-                    tempBuff = (uint8_t *)malloc(mb_devices[i].discrete_inputs.num_regs);
-                    nanosleep(&ts, NULL); 
-                    int return_val = modbus_read_input_bits(mb_devices[i].mb_ctx, mb_devices[i].discrete_inputs.start_address,
-                                                            mb_devices[i].discrete_inputs.num_regs, tempBuff);
-                    if (return_val == -1)
-                    {
-                        if (mb_devices[i].protocol != MB_RTU)
-                        {
-                            modbus_close(mb_devices[i].mb_ctx);
-                            mb_devices[i].isConnected = false;
-                        }
-                        
-                        sprintf(log_msg, "Modbus Read Discrete Input Registers failed on MB device %s: %s\n", mb_devices[i].dev_name, modbus_strerror(errno));
-                        openplc_log(log_msg);
-                        bool_input_index += (mb_devices[i].discrete_inputs.num_regs);
-                        if (special_functions[2] != NULL) *special_functions[2]++;
-                    }
-                    else
-                    {
-                        pthread_mutex_lock(&ioLock);
-                        for (int j = 0; j < return_val; j++)
-                        {
-                            bool_input_buf[bool_input_index] = tempBuff[j];
-                            bool_input_index++;
-                        }
-                        pthread_mutex_unlock(&ioLock);
-                    }
-
-                    free(tempBuff);
-                }
+//-----------------------------------------------------------------------------
+// Adds the given number of milliseconds to a timespec
+//-----------------------------------------------------------------------------
+static void addMilliseconds(struct timespec *ts, int milliseconds)
+{
+    ts->tv_sec += milliseconds / 1000;
+    ts->tv_nsec += (long)(milliseconds % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000)
+    {
+        ts->tv_nsec -= 1000000000;
+        ts->tv_sec++;
+    }
+}
 
-                //Write coils
-                if (mb_devices[i].coils.num_regs != 0)
-                {
-                    sleepms(mb_devices[i].rtu_tx_pause);
-                    uint8_t *tempBuff;
-                    tempBuff = (uint8_t *)malloc(mb_devices[i].coils.num_regs);
+//-----------------------------------------------------------------------------
+// Returns true if timespec a is earlier than timespec b
+//-----------------------------------------------------------------------------
+static bool timeBefore(struct timespec *a, struct timespec *b)
+{
+    return (a->tv_sec < b->tv_sec) || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
 
-                    pthread_mutex_lock(&ioLock);
-                    for (int j = 0; j < mb_devices[i].coils.num_regs; j++)
-                    {
-                        tempBuff[j] = bool_output_buf[bool_output_index];
-                        bool_output_index++;
-                    }
-                    pthread_mutex_unlock(&ioLock);
+//-----------------------------------------------------------------------------
+// Adds to a statistic. Statistics have a single writer, so no atomic
+// read-modify-write is needed
+//-----------------------------------------------------------------------------
+static inline void statAdd(std::atomic<uint64_t> *stat, uint64_t value)
+{
+    stat->store(stat->load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
 
-                    nanosleep(&ts, NULL); 
-                    int return_val = modbus_write_bits(mb_devices[i].mb_ctx, mb_devices[i].coils.start_address, mb_devices[i].coils.num_regs, tempBuff);
-                    if (return_val == -1)
-                    {
-                        if (mb_devices[i].protocol != MB_RTU)
-                        {
-                            modbus_close(mb_devices[i].mb_ctx);
-                            mb_devices[i].isConnected = false;
-                        }
+//-----------------------------------------------------------------------------
+// Returns the statistics block type of a request function
+//-----------------------------------------------------------------------------
+static int statBlock(uint8_t function)
+{
+    switch (function)
+    {
+        case MODBUS_FC_READ_DISCRETE_INPUTS:    return MB_BLOCK_DISCRETE_INPUTS;
+        case MODBUS_FC_WRITE_MULTIPLE_COILS:    return MB_BLOCK_COILS;
+        case MODBUS_FC_READ_INPUT_REGISTERS:    return MB_BLOCK_INPUT_REGISTERS;
+        case MODBUS_FC_READ_HOLDING_REGISTERS:  return MB_BLOCK_HOLDING_READ;
+        default:                                return MB_BLOCK_HOLDING_WRITE;
+    }
+}
 
-                        sprintf(log_msg, "Modbus Write Coils failed on MB device %s: %s\n", mb_devices[i].dev_name, modbus_strerror(errno));
-                        openplc_log(log_msg);
-                        if (special_functions[2] != NULL) *special_functions[2]++;
-                    }
-                    
-                    free(tempBuff);
-                }
+//-----------------------------------------------------------------------------
+// Records a transaction of a device started at start and ended at the last
+// frame end of its bus. Must be called before errno is changed
+//-----------------------------------------------------------------------------
+static void recordTransaction(struct MB_device *dev, uint8_t function, const struct timespec *start, bool ok)
+{
+    TRACE_SPAN(TRACE_MB_MASTER, function, ok ? 0 : errno, dev->dev_name, start, &dev->bus->last_frame_end);
 
-                //Read input registers
-                if (mb_devices[i].input_registers.num_regs != 0)
-                {
-                    sleepms(mb_devices[i].rtu_tx_pause);
-                    uint16_t *tempBuff;
-                    tempBuff = (uint16_t *)malloc(2*mb_devices[i].input_registers.num_regs);
-                    nanosleep(&ts, NULL); 
-                    int return_val = modbus_read_input_registers(    mb_devices[i].mb_ctx, mb_devices[i].input_registers.start_address,
-                                                                    mb_devices[i].input_registers.num_regs, tempBuff);
-                    if (return_val == -1)
-                    {
-                        if (mb_devices[i].protocol != MB_RTU)
-                        {
-                            modbus_close(mb_devices[i].mb_ctx);
-                            mb_devices[i].isConnected = false;
-                        }
-                        
-                        sprintf(log_msg, "Modbus Read Input Registers failed on MB device %s: %s\n", mb_devices[i].dev_name, modbus_strerror(errno));
-                        openplc_log(log_msg);
-                        int_input_index += (mb_devices[i].input_registers.num_regs);
-                        if (special_functions[2] != NULL) *special_functions[2]++;
-                    }
-                    else
-                    {
-                        pthread_mutex_lock(&ioLock);
-                        for (int j = 0; j < return_val; j++)
-                        {
-                            int_input_buf[int_input_index] = tempBuff[j];
-                            int_input_index++;
-                        }
-                        pthread_mutex_unlock(&ioLock);
-                    }
-
-                    free(tempBuff);
-                }
+    struct MB_block_stats *stats = &dev->stats.blocks[statBlock(function)];
+    statAdd(&stats->requests, 1);
+    if (!ok)
+    {
+        statAdd(&stats->errors, 1);
+        if (errno == ETIMEDOUT) statAdd(&stats->timeouts, 1);
+        return;
+    }
+    dev->bus->silent_requests = 0;
 
-                //Read holding registers
-                if (mb_devices[i].holding_read_registers.num_regs != 0)
-                {
-                    sleepms(mb_devices[i].rtu_tx_pause);
-                    uint16_t *tempBuff;
-                    tempBuff = (uint16_t *)malloc(2*mb_devices[i].holding_read_registers.num_regs);
-                    nanosleep(&ts, NULL); 
-                    int return_val = modbus_read_registers(mb_devices[i].mb_ctx, mb_devices[i].holding_read_registers.start_address,
-                                                           mb_devices[i].holding_read_registers.num_regs, tempBuff);
-                    if (return_val == -1)
-                    {
-                        if (mb_devices[i].protocol != MB_RTU)
-                        {
-                            modbus_close(mb_devices[i].mb_ctx);
-                            mb_devices[i].isConnected = false;
-                        }
-                        sprintf(log_msg, "Modbus Read Holding Registers failed on MB device %s: %s\n", mb_devices[i].dev_name, modbus_strerror(errno));
-                        openplc_log(log_msg);
-                        int_input_index += (mb_devices[i].holding_read_registers.num_regs);
-                        if (special_functions[2] != NULL) *special_functions[2]++;
-                    }
-                    else
-                    {
-                        pthread_mutex_lock(&ioLock);
-                        for (int j = 0; j < return_val; j++)
-                        {
-                            int_input_buf[int_input_index] = tempBuff[j];
-                            int_input_index++;
-                        }
-                        pthread_mutex_unlock(&ioLock);
-                    }
-
-                    free(tempBuff);
-                }
+    struct timespec *end = &dev->bus->last_frame_end;
+    long long us = (end->tv_sec - start->tv_sec) * 1000000LL + (end->tv_nsec - start->tv_nsec) / 1000;
+    if (us < 0) us = 0;
 
-                //Write holding registers
-                if (mb_devices[i].holding_registers.num_regs != 0)
-                {
-                    sleepms(mb_devices[i].rtu_tx_pause);
-                    uint16_t *tempBuff;
-                    tempBuff = (uint16_t *)malloc(2*mb_devices[i].holding_registers.num_regs);
-
-                    pthread_mutex_lock(&ioLock);
-                    for (int j = 0; j < mb_devices[i].holding_registers.num_regs; j++)
-                    {
-                        tempBuff[j] = int_output_buf[int_output_index];
-                        int_output_index++;
-                    }
-                    pthread_mutex_unlock(&ioLock);
-
-                    nanosleep(&ts, NULL); 
-                    int return_val = modbus_write_registers(mb_devices[i].mb_ctx, mb_devices[i].holding_registers.start_address,
-                                                            mb_devices[i].holding_registers.num_regs, tempBuff);
-                    if (return_val == -1)
-                    {
-                        if (mb_devices[i].protocol != MB_RTU)
-                        {
-                            modbus_close(mb_devices[i].mb_ctx);
-                            mb_devices[i].isConnected = false;
-                        }
-                        
-                        sprintf(log_msg, "Modbus Write Holding Registers failed on MB device %s: %s\n", mb_devices[i].dev_name, modbus_strerror(errno));
-                        openplc_log(log_msg);
-                        if (special_functions[2] != NULL) *special_functions[2]++;
-                    }
-                    
-                    free(tempBuff);
-                }
-            }
-        }
-        sleepms(polling_period);
-    }
+    statAdd(&stats->latency_sum_us, us);
+    uint64_t min_us = stats->latency_min_us.load(std::memory_order_relaxed);
+    if (min_us == 0 || (uint64_t)us < min_us) stats->latency_min_us.store(us == 0 ? 1 : us, std::memory_order_relaxed);
+    if ((uint64_t)us > stats->latency_max_us.load(std::memory_order_relaxed)) stats->latency_max_us.store(us, std::memory_order_relaxed);
+
+    int bucket = 0;
+    while (bucket < MB_LATENCY_BUCKETS - 1 && us >= (2LL << bucket)) bucket++;
+    statAdd(&stats->histogram[bucket], 1);
 }
 
 //-----------------------------------------------------------------------------
-// This function is called by the main OpenPLC routine when it is initializing.
-// Modbus master initialization procedures are here.
+// Tells whether the TCP connection of a device is still usable after a failed
+// request. An exception answer came through it. On a connection shared by
+// the slaves behind a gateway, a slave that doesn't answer must not drop the
+// others: the connection is flushed and kept, and only closed once as many
+// requests in a row as the bus has devices went unanswered. Pipelined devices
+// may still have answers in flight and close it as before
 //-----------------------------------------------------------------------------
-void initializeMB()
+static bool connectionUsable(struct MB_device *dev, int error)
 {
-    parseConfig();
+    struct MB_bus *bus = dev->bus;
+    if (dev->pending != NULL) return false;
 
-    for (int i = 0; i < num_devices; i++)
+    if (error > MODBUS_ENOBASE && error <= EMBXGTAR)
     {
-        if (mb_devices[i].protocol == MB_TCP)
-        {
-            mb_devices[i].mb_ctx = modbus_new_tcp(mb_devices[i].dev_address, mb_devices[i].ip_port);
+        bus->silent_requests = 0;
+        return true;
+    }
+
+    if (bus->num_devices < 2 || (error != ETIMEDOUT && error != EMBBADDATA)) return false;
+    if (++bus->silent_requests >= bus->num_devices) return false;
+    modbus_flush(bus->mb_ctx);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Handles a failed request on a device. TCP connections that are not usable
+// any more are closed so that they are reopened on the next poll
+//-----------------------------------------------------------------------------
+static void requestFailed(struct MB_device *dev, const char *request)
+{
+    char log_msg[1000];
+    int error = errno;
+
+    if (dev->protocol != MB_RTU && !connectionUsable(dev, error))
+    {
+        dev->bus->silent_requests = 0;
+        modbus_close(dev->mb_ctx);
+        dev->bus->isConnected = false;
+    }
+
+    sprintf(log_msg, "Modbus %s failed on MB device %s: %s\n", request, dev->dev_name, modbus_strerror(error));
+    openplc_log_event(LOG_LEVEL_ERROR, LOG_SOURCE_MODBUS_MASTER, LOG_CODE_MB_REQUEST_FAILED, error, dev->index, log_msg);
+    countCommError();
+}
+
+//-----------------------------------------------------------------------------
+// Adds a block of points to the request list of a device, merging it into the
+// last request when the block has the same schedule and overlaps or follows
+// it (only follows, for writes) and splitting it at the largest quantity a
+// single request can move. Holding register writes that may be combined with
+// a read are limited to the quantity an FC23 transaction can write
+//-----------------------------------------------------------------------------
+static void addRequestBlock(struct MB_device *dev, uint8_t function, uint16_t start, uint16_t count, uint16_t buffer_offset,
+                            uint16_t period, int priority)
+{
+    bool is_write = (function == MODBUS_FC_WRITE_MULTIPLE_COILS || function == MODBUS_FC_WRITE_MULTIPLE_REGISTERS ||
+                     function == MODBUS_FC_MASK_WRITE_REGISTER);
+    int limit;
+    switch (function)
+    {
+        case MODBUS_FC_READ_DISCRETE_INPUTS:    limit = MODBUS_MAX_READ_BITS; break;
+        case MODBUS_FC_WRITE_MULTIPLE_COILS:    limit = MODBUS_MAX_WRITE_BITS; break;
+        case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+            limit = dev->combine_holding ? MODBUS_MAX_WR_WRITE_REGISTERS : MODBUS_MAX_WRITE_REGISTERS;
+            break;
+        case MODBUS_FC_MASK_WRITE_REGISTER:     limit = MODBUS_MAX_WRITE_REGISTERS; break;
+        default:                                limit = MODBUS_MAX_READ_REGISTERS; break;
+    }
+
+    int address = start;
+    int remaining = count;
+    while (remaining > 0)
+    {
+        struct MB_request *req = NULL;
+        if (dev->num_requests > 0)
+        {
+            req = &dev->requests[dev->num_requests - 1];
+            int end = req->start_address + req->num_regs;
+            bool joins = is_write ? (address == end) : (address >= req->start_address && address <= end);
+            if (req->function != function || req->period != period || req->priority != priority ||
+                !joins || address >= req->start_address + limit)
+            {
+                req = NULL;
+            }
+        }
+
+        if (req == NULL)
+        {
+            req = &dev->requests[dev->num_requests++];
+            req->function = function;
+            req->start_address = address;
+            req->num_regs = 0;
+            req->num_segments = 0;
+            req->segments = &dev->segments[dev->num_segments];
+            req->period = period;
+            req->priority = priority;
+        }
+
+        int take = req->start_address + limit - address;
+        if (take > remaining) take = remaining;
+
+        struct MB_segment *seg = &req->segments[req->num_segments++];
+        dev->num_segments++;
+        seg->request_offset = address - req->start_address;
+        seg->buffer_offset = buffer_offset;
+        seg->count = take;
+        if (address + take - req->start_address > req->num_regs)
+        {
+            req->num_regs = address + take - req->start_address;
+        }
+
+        address += take;
+        buffer_offset += take;
+        remaining -= take;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// A block of points of one function code, collected from all the devices
+// polled together
+//-----------------------------------------------------------------------------
+struct MB_block
+{
+    uint16_t start;
+    uint16_t count;
+    uint16_t buffer_offset;
+    uint16_t period;
+    int priority;
+};
+
+//blocks with the same schedule are sorted together, so they can be merged
+static int compareBlocks(const void *a, const void *b)
+{
+    const struct MB_block *block_a = (const struct MB_block *)a;
+    const struct MB_block *block_b = (const struct MB_block *)b;
+    if (block_a->period != block_b->period) return (int)block_a->period - (int)block_b->period;
+    if (block_a->priority != block_b->priority) return (block_a->priority > block_b->priority) ? -1 : 1;
+    return (int)block_a->start - (int)block_b->start;
+}
+
+//-----------------------------------------------------------------------------
+// Builds the request list of a group leader for one function code from the
+// blocks of every device in its group
+//-----------------------------------------------------------------------------
+static void addGroupRequests(struct MB_master *m, struct MB_device *leader, uint8_t function)
+{
+    struct MB_block *blocks = (struct MB_block *)malloc(m->num_devices * sizeof(struct MB_block));
+    int num_blocks = 0;
+
+    for (int i = 0; i < m->num_devices; i++)
+    {
+        struct MB_device *dev = &m->devices[i];
+        if (dev->group_leader != leader) continue;
+
+        struct MB_block *block = &blocks[num_blocks];
+        switch (function)
+        {
+            case MODBUS_FC_READ_DISCRETE_INPUTS:
+                block->start = dev->discrete_inputs.start_address;
+                block->count = dev->discrete_inputs.num_regs;
+                block->buffer_offset = dev->bus_bool_input_offset;
+                break;
+            case MODBUS_FC_WRITE_MULTIPLE_COILS:
+                block->start = dev->coils.start_address;
+                block->count = dev->coils.num_regs;
+                block->buffer_offset = dev->bus_bool_output_offset;
+                break;
+            case MODBUS_FC_READ_INPUT_REGISTERS:
+                block->start = dev->input_registers.start_address;
+                block->count = dev->input_registers.num_regs;
+                block->buffer_offset = dev->bus_int_input_offset;
+                break;
+            case MODBUS_FC_READ_HOLDING_REGISTERS:
+                //holding registers are placed right after the input registers
+                block->start = dev->holding_read_registers.start_address;
+                block->count = dev->holding_read_registers.num_regs;
+                block->buffer_offset = dev->bus_int_input_offset + dev->input_registers.num_regs;
+                break;
+            case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+            case MODBUS_FC_MASK_WRITE_REGISTER:
+                block->start = dev->holding_registers.start_address;
+                block->count = dev->holding_registers.num_regs;
+                block->buffer_offset = dev->bus_int_output_offset;
+                break;
+        }
+
+        //blocks without a schedule of their own follow the device
+        int type = statBlock(function);
+        block->period = dev->block_period[type];
+        block->priority = (dev->block_priority_set & (1 << type)) ? dev->block_priority[type] : dev->priority;
+        if (block->count > 0) num_blocks++;
+    }
+
+    qsort(blocks, num_blocks, sizeof(struct MB_block), compareBlocks);
+    for (int i = 0; i < num_blocks; i++)
+    {
+        addRequestBlock(leader, function, blocks[i].start, blocks[i].count, blocks[i].buffer_offset,
+                        blocks[i].period, blocks[i].priority);
+    }
+
+    free(blocks);
+}
+
+//-----------------------------------------------------------------------------
+// Groups the devices that are polled together. Devices on the same connection
+// with the same slave id, polling period, priority, holding register write
+// mode and pipelining are polled by the first of them (the group leader)
+//-----------------------------------------------------------------------------
+static void groupDevices(struct MB_master *m)
+{
+    for (int i = 0; i < m->num_devices; i++)
+    {
+        struct MB_device *dev = &m->devices[i];
+        dev->group_leader = dev;
+        for (int a = 0; a < i; a++)
+        {
+            struct MB_device *other = &m->devices[a];
+            if (other->group_leader == other && other->mb_ctx == dev->mb_ctx &&
+                other->dev_id == dev->dev_id && other->polling_period == dev->polling_period &&
+                other->priority == dev->priority && other->combine_holding == dev->combine_holding &&
+                other->holding_write_mask == dev->holding_write_mask &&
+                other->max_outstanding == dev->max_outstanding)
+            {
+                dev->group_leader = other;
+                break;
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Pairs the holding register writes of a group leader with its holding
+// register reads of the same schedule, in request order, so that each pair is
+// executed as one FC23 transaction. Reads or writes left without a pair are
+// executed on their own
+//-----------------------------------------------------------------------------
+static void pairHoldingRequests(struct MB_device *leader)
+{
+    for (int w = 0; w < leader->num_requests; w++)
+    {
+        struct MB_request *write = &leader->requests[w];
+        if (write->function != MODBUS_FC_WRITE_MULTIPLE_REGISTERS) continue;
+
+        for (int r = 0; r < leader->num_requests; r++)
+        {
+            struct MB_request *read = &leader->requests[r];
+            if (read->function == MODBUS_FC_READ_HOLDING_REGISTERS && !read->paired &&
+                read->period == write->period && read->priority == write->priority)
+            {
+                write->paired_read = read;
+                read->paired = true;
+                break;
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Builds the request lists of the group leaders, coalescing the blocks of
+// their groups into the minimum number of requests. Runs once at startup, so
+// the poll loop never allocates
+//-----------------------------------------------------------------------------
+static void buildRequests(struct MB_master *m)
+{
+    for (int i = 0; i < m->num_devices; i++)
+    {
+        struct MB_device *dev = &m->devices[i];
+        if (dev->group_leader != dev) continue;
+
+        //every block chunk can start a request, and adds one segment
+        int max_requests = 0;
+        for (int a = 0; a < m->num_devices; a++)
+        {
+            struct MB_device *member = &m->devices[a];
+            if (member->group_leader != dev) continue;
+            max_requests += 5 + member->discrete_inputs.num_regs / MODBUS_MAX_READ_BITS +
+                            member->coils.num_regs / MODBUS_MAX_WRITE_BITS +
+                            member->input_registers.num_regs / MODBUS_MAX_READ_REGISTERS +
+                            member->holding_read_registers.num_regs / MODBUS_MAX_READ_REGISTERS +
+                            member->holding_registers.num_regs / MODBUS_MAX_WR_WRITE_REGISTERS;
+        }
+        dev->requests = (struct MB_request *)calloc(max_requests, sizeof(struct MB_request));
+        dev->segments = (struct MB_segment *)calloc(max_requests, sizeof(struct MB_segment));
+
+        //same order the blocks were polled in before the requests were coalesced
+        addGroupRequests(m, dev, MODBUS_FC_READ_DISCRETE_INPUTS);
+        addGroupRequests(m, dev, MODBUS_FC_WRITE_MULTIPLE_COILS);
+        addGroupRequests(m, dev, MODBUS_FC_READ_INPUT_REGISTERS);
+        addGroupRequests(m, dev, MODBUS_FC_READ_HOLDING_REGISTERS);
+        addGroupRequests(m, dev, dev->holding_write_mask != 0 ? MODBUS_FC_MASK_WRITE_REGISTER : MODBUS_FC_WRITE_MULTIPLE_REGISTERS);
+
+        for (int r = 0; r < dev->num_requests; r++)
+        {
+            struct MB_request *req = &dev->requests[r];
+            if (req->function == MODBUS_FC_WRITE_MULTIPLE_COILS)
+            {
+                req->last_written = calloc(req->num_regs, sizeof(uint8_t));
+            }
+            else if (req->function == MODBUS_FC_WRITE_MULTIPLE_REGISTERS || req->function == MODBUS_FC_MASK_WRITE_REGISTER)
+            {
+                req->last_written = calloc(req->num_regs, sizeof(uint16_t));
+            }
+        }
+
+        if (dev->combine_holding) pairHoldingRequests(dev);
+
+        if (dev->protocol == MB_TCP && dev->max_outstanding > 1)
+        {
+            dev->pending = (struct MB_pending *)calloc(dev->max_outstanding, sizeof(struct MB_pending));
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Computes the silent interval of a bus. RTU frames must be separated by 3.5
+// character times, fixed at 1.75ms above 19200 baud by the Modbus serial line
+// spec. The TX pause configured for the device is added on top of it
+//-----------------------------------------------------------------------------
+static long long frameGap(struct MB_device *dev)
+{
+    long long gap = (long long)dev->rtu_tx_pause * 1000000 + (long long)dev->rtu_tx_pause_us * 1000;
+
+    if (dev->protocol == MB_RTU && dev->rtu_baud > 0)
+    {
+        if (dev->rtu_baud > 19200)
+        {
+            gap += 1750000;
+        }
+        else
+        {
+            //start bit + data bits + parity bit + stop bits
+            int char_bits = 1 + dev->rtu_data_bit + (dev->rtu_parity == 'N' ? 0 : 1) + dev->rtu_stop_bit;
+            gap += (35LL * char_bits * 1000000000LL) / (10LL * dev->rtu_baud);
+        }
+    }
+
+    return gap;
+}
+
+//-----------------------------------------------------------------------------
+// Waits until the silent interval since the last frame on the bus has passed
+// and selects the slave of the device before a request is sent
+//-----------------------------------------------------------------------------
+static void waitBeforeRequest(struct MB_device *dev)
+{
+    struct MB_bus *bus = dev->bus;
+
+    if (bus->current_slave != dev->dev_id)
+    {
+        modbus_set_slave(dev->mb_ctx, dev->dev_id);
+        bus->current_slave = dev->dev_id;
+    }
+
+    if (bus->frame_gap_ns > 0)
+    {
+        struct timespec send_time = bus->last_frame_end;
+        send_time.tv_sec += bus->frame_gap_ns / 1000000000LL;
+        send_time.tv_nsec += bus->frame_gap_ns % 1000000000LL;
+        if (send_time.tv_nsec >= 1000000000)
+        {
+            send_time.tv_nsec -= 1000000000;
+            send_time.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &send_time, NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &bus->request_start);
+}
+
+//-----------------------------------------------------------------------------
+// Records the end of a transaction on the bus, where the next silent interval
+// starts
+//-----------------------------------------------------------------------------
+static void markFrameEnd(struct MB_bus *bus)
+{
+    clock_gettime(CLOCK_MONOTONIC, &bus->last_frame_end);
+}
+
+//-----------------------------------------------------------------------------
+// Finds the span of points that differ between the payload of a write request
+// and the last payload acknowledged for it. Returns the number of points on
+// the span (0 if nothing changed) and its first point on *first
+//-----------------------------------------------------------------------------
+static int changedSpan(struct MB_request *req, const void *payload, int point_size, int *first)
+{
+    const uint8_t *current = (const uint8_t *)payload;
+    const uint8_t *last = (const uint8_t *)req->last_written;
+    int size = req->num_regs * point_size;
+
+    int begin = 0;
+    while (begin < size && current[begin] == last[begin]) begin++;
+    if (begin == size) return 0;
+
+    int end = size - 1;
+    while (current[end] == last[end]) end--;
+
+    *first = begin / point_size;
+    return end / point_size - *first + 1;
+}
+
+//-----------------------------------------------------------------------------
+// Writes the payload of a write request. With full_write false only the span
+// of points that changed since the last acknowledged write is sent. A write
+// paired with a read is sent with the read as one FC23 transaction, and the
+// read is still done on its own when there is nothing to write. Returns the
+// value returned by libmodbus, or 0 if there was nothing to write
+//-----------------------------------------------------------------------------
+static int writeOutputs(struct MB_device *dev, struct MB_request *req, void *payload, bool full_write)
+{
+    int point_size = (req->function == MODBUS_FC_WRITE_MULTIPLE_COILS) ? sizeof(uint8_t) : sizeof(uint16_t);
+    int first = 0;
+    int count = req->num_regs;
+
+    if (!full_write && req->acknowledged)
+    {
+        count = changedSpan(req, payload, point_size, &first);
+        if (count == 0 && req->paired_read == NULL) return 0;
+    }
+
+    waitBeforeRequest(dev);
+
+    int return_val;
+    if (req->function == MODBUS_FC_WRITE_MULTIPLE_COILS)
+    {
+        return_val = modbus_write_bits(dev->mb_ctx, req->start_address + first, count, (uint8_t *)payload + first);
+    }
+    else if (req->paired_read != NULL)
+    {
+        struct MB_request *read = req->paired_read;
+        if (count > 0)
+        {
+            return_val = modbus_write_and_read_registers(dev->mb_ctx, req->start_address + first, count, (uint16_t *)payload + first,
+                                                         read->start_address, read->num_regs, dev->combined_read_buffer);
+        }
+        else
+        {
+            return_val = modbus_read_registers(dev->mb_ctx, read->start_address, read->num_regs, dev->combined_read_buffer);
+        }
+    }
+    else
+    {
+        return_val = modbus_write_registers(dev->mb_ctx, req->start_address + first, count, (uint16_t *)payload + first);
+    }
+    markFrameEnd(dev->bus);
+    recordTransaction(dev, req->function, &dev->bus->request_start, return_val != -1);
+
+    if (return_val != -1)
+    {
+        memcpy((uint8_t *)req->last_written + first * point_size, (uint8_t *)payload + first * point_size, count * point_size);
+        if (count == req->num_regs) req->acknowledged = true;
+    }
+
+    return return_val;
+}
+
+//-----------------------------------------------------------------------------
+// Writes the payload of a mask write request, one FC22 transaction per
+// register, setting only the bits of holding_write_mask so the slave keeps
+// the other bits. With full_write false only the registers whose masked bits
+// changed since the last acknowledged write are sent. Returns -1 on failure
+//-----------------------------------------------------------------------------
+static int writeMaskedOutputs(struct MB_device *dev, struct MB_request *req, uint16_t *payload, bool full_write)
+{
+    uint16_t mask = dev->holding_write_mask;
+    uint16_t *last = (uint16_t *)req->last_written;
+    bool write_all = full_write || !req->acknowledged;
+
+    for (int r = 0; r < req->num_regs; r++)
+    {
+        if (!write_all && ((payload[r] ^ last[r]) & mask) == 0) continue;
+
+        waitBeforeRequest(dev);
+        int return_val = modbus_mask_write_register(dev->mb_ctx, req->start_address + r, ~mask, payload[r] & mask);
+        markFrameEnd(dev->bus);
+        recordTransaction(dev, req->function, &dev->bus->request_start, return_val != -1);
+        if (return_val == -1) return -1;
+
+        last[r] = payload[r];
+    }
+
+    req->acknowledged = true;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Executes one request of a device, copying the points between the request
+// buffers of the device and the buffers of its bus
+//-----------------------------------------------------------------------------
+static void executeRequest(struct MB_device *dev, struct MB_request *req, bool full_write)
+{
+    struct MB_exchange *inputs = &dev->bus->inputs;
+    struct MB_exchange *outputs = &dev->bus->outputs;
+    int return_val = 0;
+
+    //executed by the write it is paired with
+    if (req->paired) return;
+
+    switch (req->function)
+    {
+        case MODBUS_FC_READ_DISCRETE_INPUTS:
+            waitBeforeRequest(dev);
+            return_val = modbus_read_input_bits(dev->mb_ctx, req->start_address, req->num_regs, dev->bit_buffer);
+            markFrameEnd(dev->bus);
+            recordTransaction(dev, req->function, &dev->bus->request_start, return_val != -1);
+            if (return_val == -1)
+            {
+                requestFailed(dev, "Read Discrete Input Registers");
+                return;
+            }
+            for (int s = 0; s < req->num_segments; s++)
+            {
+                struct MB_segment *seg = &req->segments[s];
+                memcpy(&inputs->bits[inputs->producer][seg->buffer_offset], &dev->bit_buffer[seg->request_offset], seg->count);
+            }
+            break;
+
+        case MODBUS_FC_WRITE_MULTIPLE_COILS:
+            for (int s = 0; s < req->num_segments; s++)
+            {
+                struct MB_segment *seg = &req->segments[s];
+                memcpy(&dev->bit_buffer[seg->request_offset], &outputs->bits[outputs->consumer][seg->buffer_offset], seg->count);
+            }
+            return_val = writeOutputs(dev, req, dev->bit_buffer, full_write);
+            if (return_val == -1)
+            {
+                requestFailed(dev, "Write Coils");
+            }
+            break;
+
+        case MODBUS_FC_READ_INPUT_REGISTERS:
+        case MODBUS_FC_READ_HOLDING_REGISTERS:
+            waitBeforeRequest(dev);
+            if (req->function == MODBUS_FC_READ_INPUT_REGISTERS)
+            {
+                return_val = modbus_read_input_registers(dev->mb_ctx, req->start_address, req->num_regs, dev->register_buffer);
+            }
+            else
+            {
+                return_val = modbus_read_registers(dev->mb_ctx, req->start_address, req->num_regs, dev->register_buffer);
+            }
+            markFrameEnd(dev->bus);
+            recordTransaction(dev, req->function, &dev->bus->request_start, return_val != -1);
+            if (return_val == -1)
+            {
+                requestFailed(dev, req->function == MODBUS_FC_READ_INPUT_REGISTERS ? "Read Input Registers" : "Read Holding Registers");
+                return;
+            }
+            for (int s = 0; s < req->num_segments; s++)
+            {
+                struct MB_segment *seg = &req->segments[s];
+                memcpy(&inputs->registers[inputs->producer][seg->buffer_offset], &dev->register_buffer[seg->request_offset], 2*seg->count);
+            }
+            break;
+
+        case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+            for (int s = 0; s < req->num_segments; s++)
+            {
+                struct MB_segment *seg = &req->segments[s];
+                memcpy(&dev->register_buffer[seg->request_offset], &outputs->registers[outputs->consumer][seg->buffer_offset], 2*seg->count);
+            }
+            return_val = writeOutputs(dev, req, dev->register_buffer, full_write);
+            if (return_val == -1)
+            {
+                requestFailed(dev, req->paired_read != NULL ? "Write/Read Holding Registers" : "Write Holding Registers");
+                return;
+            }
+            if (req->paired_read != NULL)
+            {
+                for (int s = 0; s < req->paired_read->num_segments; s++)
+                {
+                    struct MB_segment *seg = &req->paired_read->segments[s];
+                    memcpy(&inputs->registers[inputs->producer][seg->buffer_offset], &dev->combined_read_buffer[seg->request_offset], 2*seg->count);
+                }
+            }
+            break;
+
+        case MODBUS_FC_MASK_WRITE_REGISTER:
+            for (int s = 0; s < req->num_segments; s++)
+            {
+                struct MB_segment *seg = &req->segments[s];
+                memcpy(&dev->register_buffer[seg->request_offset], &outputs->registers[outputs->consumer][seg->buffer_offset], 2*seg->count);
+            }
+            if (writeMaskedOutputs(dev, req, dev->register_buffer, full_write) == -1)
+            {
+                requestFailed(dev, "Mask Write Holding Registers");
+            }
+            break;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Name of the request of a function code on the log
+//-----------------------------------------------------------------------------
+static const char *requestName(uint8_t function)
+{
+    switch (function)
+    {
+        case MODBUS_FC_READ_DISCRETE_INPUTS:        return "Read Discrete Input Registers";
+        case MODBUS_FC_WRITE_MULTIPLE_COILS:        return "Write Coils";
+        case MODBUS_FC_READ_INPUT_REGISTERS:        return "Read Input Registers";
+        case MODBUS_FC_READ_HOLDING_REGISTERS:      return "Read Holding Registers";
+        default:                                    return "Write Holding Registers";
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Sends one request of a pipelined device without waiting for its response.
+// Returns 1 if the request was sent, 0 if it is a write with nothing to send
+// or -1 on failure
+//-----------------------------------------------------------------------------
+static int sendPipelined(struct MB_device *dev, struct MB_request *req, bool full_write, struct MB_pending *pending)
+{
+    struct MB_exchange *outputs = &dev->bus->outputs;
+    const void *src = NULL;
+
+    pending->request = req;
+    pending->first = 0;
+    pending->count = req->num_regs;
+
+    if (req->function == MODBUS_FC_WRITE_MULTIPLE_COILS || req->function == MODBUS_FC_WRITE_MULTIPLE_REGISTERS)
+    {
+        bool coils = (req->function == MODBUS_FC_WRITE_MULTIPLE_COILS);
+        int point_size = coils ? sizeof(uint8_t) : sizeof(uint16_t);
+        for (int s = 0; s < req->num_segments; s++)
+        {
+            struct MB_segment *seg = &req->segments[s];
+            if (coils)
+            {
+                memcpy(&pending->payload[seg->request_offset], &outputs->bits[outputs->consumer][seg->buffer_offset], seg->count);
+            }
+            else
+            {
+                memcpy(&pending->payload[2*seg->request_offset], &outputs->registers[outputs->consumer][seg->buffer_offset], 2*seg->count);
+            }
+        }
+
+        if (!full_write && req->acknowledged)
+        {
+            pending->count = changedSpan(req, pending->payload, point_size, &pending->first);
+            if (pending->count == 0) return 0;
+        }
+        src = &pending->payload[pending->first * point_size];
+    }
+
+    waitBeforeRequest(dev);
+    pending->sent = dev->bus->request_start;
+    if (modbus_send_request_nb(dev->mb_ctx, req->function, req->start_address + pending->first, pending->count, src, pending->adu) == -1)
+    {
+        markFrameEnd(dev->bus);
+        recordTransaction(dev, req->function, &pending->sent, false);
+        return -1;
+    }
+
+    return 1;
+}
+
+//-----------------------------------------------------------------------------
+// Waits for the response of one of the requests in flight on a pipelined
+// device and completes that request. Returns false on failure
+//-----------------------------------------------------------------------------
+static bool receivePipelined(struct MB_device *dev, int *num_pending)
+{
+    struct MB_exchange *inputs = &dev->bus->inputs;
+    uint8_t rsp[MODBUS_TCP_MAX_ADU_LENGTH];
+    struct timespec deadline;
+    int rsp_length = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    addMilliseconds(&deadline, timeout);
+
+    while ((rsp_length = modbus_receive_confirmation_nb(dev->mb_ctx, rsp)) == 0)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (!timeBefore(&now, &deadline))
+        {
+            errno = ETIMEDOUT;
+            rsp_length = -1;
+            break;
+        }
+
+        struct pollfd pfd;
+        pfd.fd = modbus_get_socket(dev->mb_ctx);
+        pfd.events = POLLIN;
+        int wait_ms = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000 + 1;
+        poll(&pfd, 1, wait_ms);
+    }
+    markFrameEnd(dev->bus);
+
+    //the slave answers the requests in flight in any order
+    int p = 0;
+    if (rsp_length > 0)
+    {
+        while (p < *num_pending && modbus_get_transaction_id(dev->pending[p].adu) != modbus_get_transaction_id(rsp)) p++;
+    }
+    if (rsp_length == -1 || p == *num_pending)
+    {
+        if (rsp_length != -1) errno = EMBBADDATA;
+        recordTransaction(dev, dev->pending[0].request->function, &dev->pending[0].sent, false);
+        requestFailed(dev, requestName(dev->pending[0].request->function));
+        return false;
+    }
+
+    struct MB_pending *pending = &dev->pending[p];
+    struct MB_request *req = pending->request;
+    bool bits = (req->function == MODBUS_FC_READ_DISCRETE_INPUTS || req->function == MODBUS_FC_WRITE_MULTIPLE_COILS);
+    void *dest = bits ? (void *)dev->bit_buffer : (void *)dev->register_buffer;
+    bool ok = (modbus_check_confirmation(dev->mb_ctx, pending->adu, rsp, rsp_length, dest) != -1);
+    recordTransaction(dev, req->function, &pending->sent, ok);
+    if (!ok)
+    {
+        requestFailed(dev, requestName(req->function));
+        return false;
+    }
+
+    switch (req->function)
+    {
+        case MODBUS_FC_READ_DISCRETE_INPUTS:
+            for (int s = 0; s < req->num_segments; s++)
+            {
+                struct MB_segment *seg = &req->segments[s];
+                memcpy(&inputs->bits[inputs->producer][seg->buffer_offset], &dev->bit_buffer[seg->request_offset], seg->count);
+            }
+            break;
+
+        case MODBUS_FC_READ_INPUT_REGISTERS:
+        case MODBUS_FC_READ_HOLDING_REGISTERS:
+            for (int s = 0; s < req->num_segments; s++)
+            {
+                struct MB_segment *seg = &req->segments[s];
+                memcpy(&inputs->registers[inputs->producer][seg->buffer_offset], &dev->register_buffer[seg->request_offset], 2*seg->count);
+            }
+            break;
+
+        default:
+        {
+            int point_size = bits ? sizeof(uint8_t) : sizeof(uint16_t);
+            memcpy((uint8_t *)req->last_written + pending->first * point_size, &pending->payload[pending->first * point_size], pending->count * point_size);
+            if (pending->count == req->num_regs) req->acknowledged = true;
+            break;
+        }
+    }
+
+    //keep the slots in flight packed at the start of the array
+    (*num_pending)--;
+    if (p != *num_pending) memcpy(pending, &dev->pending[*num_pending], sizeof(struct MB_pending));
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Executes the requests of a pipelined TCP device, keeping up to
+// max_outstanding of them in flight on the connection. Combined and mask
+// writes have no pipelined form: the requests in flight are completed first
+// and they are executed on their own
+//-----------------------------------------------------------------------------
+static void pollPipelined(struct MB_device *dev, bool full_write)
+{
+    int num_pending = 0;
+
+    for (int r = 0; r < dev->num_requests; r++)
+    {
+        struct MB_request *req = &dev->requests[r];
+        if (req->paired || !req->selected) continue;
+
+        if (req->paired_read != NULL || req->function == MODBUS_FC_MASK_WRITE_REGISTER)
+        {
+            while (num_pending > 0)
+            {
+                if (!receivePipelined(dev, &num_pending)) return;
+            }
+            executeRequest(dev, req, full_write);
+            if (!dev->bus->isConnected) return;
+            continue;
+        }
+
+        if (num_pending == dev->max_outstanding && !receivePipelined(dev, &num_pending)) return;
+
+        int sent = sendPipelined(dev, req, full_write, &dev->pending[num_pending]);
+        if (sent == -1)
+        {
+            requestFailed(dev, requestName(req->function));
+            return;
+        }
+        num_pending += sent;
+    }
+
+    while (num_pending > 0)
+    {
+        if (!receivePipelined(dev, &num_pending)) return;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Selects the requests of a device issued on its next poll: the ones due at
+// now with the given priority. Polls in step with the scan (synchronized)
+// issue every request due regardless of its priority, and the requests
+// without a period of their own on every scan
+//-----------------------------------------------------------------------------
+static void selectRequests(struct MB_device *dev, struct timespec *now, int priority, bool synchronized)
+{
+    for (int r = 0; r < dev->num_requests; r++)
+    {
+        struct MB_request *req = &dev->requests[r];
+        bool due = !timeBefore(now, &req->next_due);
+        if (synchronized) req->selected = due || req->period == 0;
+        else req->selected = due && req->priority == priority;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Schedules the next poll of the requests issued on the last poll of a
+// device. A request that fell behind (e.g. because of a timeout) restarts its
+// period from now instead of bursting. The device is due again when the
+// first of its requests is
+//-----------------------------------------------------------------------------
+static void scheduleRequests(struct MB_device *dev)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    dev->next_poll = now;
+    addMilliseconds(&dev->next_poll, dev->polling_period);
+    for (int r = 0; r < dev->num_requests; r++)
+    {
+        struct MB_request *req = &dev->requests[r];
+        if (req->selected)
+        {
+            int period = (req->period != 0) ? req->period : dev->polling_period;
+            addMilliseconds(&req->next_due, period);
+            if (timeBefore(&req->next_due, &now))
+            {
+                req->next_due = now;
+                addMilliseconds(&req->next_due, period);
+            }
+            req->selected = false;
+        }
+        if (!req->paired && timeBefore(&req->next_due, &dev->next_poll)) dev->next_poll = req->next_due;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Executes one poll of a slave device: reads the inputs and writes the
+// outputs of its selected requests. Must be called by the thread that owns
+// the device bus
+//-----------------------------------------------------------------------------
+static void pollDevice(struct MB_device *dev)
+{
+    //with write-on-change enabled, all the outputs are still written
+    //periodically in case the slave lost them
+    bool full_write = true;
+    if (write_refresh_period > 0)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (timeBefore(&now, &dev->next_refresh))
+        {
+            full_write = false;
+        }
+        else
+        {
+            dev->next_refresh = now;
+            addMilliseconds(&dev->next_refresh, write_refresh_period);
+        }
+    }
+
+    //take the newest outputs written by the scan
+    consumeExchange(&dev->bus->outputs);
+
+    if (dev->pending != NULL)
+    {
+        pollPipelined(dev, full_write);
+    }
+    else
+    {
+        for (int r = 0; r < dev->num_requests && dev->bus->isConnected; r++)
+        {
+            if (dev->requests[r].selected) executeRequest(dev, &dev->requests[r], full_write);
+        }
+    }
+
+    //hand the inputs read to the scan
+    publishExchange(&dev->bus->inputs, true);
+}
+
+//-----------------------------------------------------------------------------
+// Picks the next device to poll on a bus: among the devices with requests
+// due, the one with the highest priority request, and among those the one
+// with the earliest deadline, so requests of the same priority are issued in
+// deadline order. Returns NULL if no request is due, with the time the next
+// one is due on *wake_up. The priority of the requests to issue is returned
+// on *priority
+//-----------------------------------------------------------------------------
+static struct MB_device *nextDueDevice(struct MB_bus *bus, struct timespec *wake_up, int *priority)
+{
+    struct timespec now;
+    struct MB_device *next = NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    *wake_up = now;
+    addMilliseconds(wake_up, polling_period);
+
+    for (int i = 0; i < bus->num_devices; i++)
+    {
+        struct MB_device *dev = bus->devices[i];
+        bool due = false;
+        int due_priority = 0;
+        if (!timeBefore(&now, &dev->next_poll))
+        {
+            //with nothing due (e.g. a device without requests), the device
+            //waits for its first request, or for its period
+            struct timespec first_due = now;
+            addMilliseconds(&first_due, dev->polling_period);
+            for (int r = 0; r < dev->num_requests; r++)
+            {
+                struct MB_request *req = &dev->requests[r];
+                if (req->paired) continue;
+                if (timeBefore(&now, &req->next_due))
+                {
+                    if (timeBefore(&req->next_due, &first_due)) first_due = req->next_due;
+                    continue;
+                }
+                if (!due || req->priority > due_priority) due_priority = req->priority;
+                due = true;
+            }
+            if (!due) dev->next_poll = first_due;
+        }
+
+        if (!due)
+        {
+            if (timeBefore(&dev->next_poll, wake_up)) *wake_up = dev->next_poll;
+        }
+        else if (next == NULL || due_priority > *priority ||
+                 (due_priority == *priority && timeBefore(&dev->next_poll, &next->next_poll)))
+        {
+            next = dev;
+            *priority = due_priority;
+        }
+    }
+
+    return next;
+}
+
+//-----------------------------------------------------------------------------
+// Sends a gateway request to its device. Returns 0, or the exception code for
+// the clients if the request failed
+//-----------------------------------------------------------------------------
+static int forwardGatewayRequest(struct MB_gateway_entry *entry)
+{
+    struct MB_device *dev = entry->device;
+    modbus_t *ctx = dev->mb_ctx;
+    int return_val = -1;
+
+    waitBeforeRequest(dev);
+    switch (entry->function)
+    {
+        case MODBUS_FC_READ_COILS:
+            return_val = modbus_read_bits(ctx, entry->address, entry->count, entry->bits);
+            break;
+        case MODBUS_FC_READ_DISCRETE_INPUTS:
+            return_val = modbus_read_input_bits(ctx, entry->address, entry->count, entry->bits);
+            break;
+        case MODBUS_FC_READ_HOLDING_REGISTERS:
+            return_val = modbus_read_registers(ctx, entry->address, entry->count, entry->registers);
+            break;
+        case MODBUS_FC_READ_INPUT_REGISTERS:
+            return_val = modbus_read_input_registers(ctx, entry->address, entry->count, entry->registers);
+            break;
+        case MODBUS_FC_WRITE_SINGLE_COIL:
+            return_val = modbus_write_bit(ctx, entry->address, entry->bits[0]);
+            break;
+        case MODBUS_FC_WRITE_SINGLE_REGISTER:
+            return_val = modbus_write_register(ctx, entry->address, entry->registers[0]);
+            break;
+        case MODBUS_FC_WRITE_MULTIPLE_COILS:
+            return_val = modbus_write_bits(ctx, entry->address, entry->count, entry->bits);
+            break;
+        case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+            return_val = modbus_write_registers(ctx, entry->address, entry->count, entry->registers);
+            break;
+    }
+    markFrameEnd(dev->bus);
+    if (return_val != -1)
+    {
+        dev->bus->silent_requests = 0;
+        return 0;
+    }
+
+    //exceptions of the slave are passed on to the clients as they are
+    if (errno > MODBUS_ENOBASE && errno < MODBUS_ENOBASE + MODBUS_EXCEPTION_MAX)
+    {
+        return errno - MODBUS_ENOBASE;
+    }
+
+    int exception = (errno == ETIMEDOUT) ? MB_EXCEPTION_TARGET_FAILED : MB_EXCEPTION_PATH_UNAVAILABLE;
+    requestFailed(dev, "Gateway request");
+    return exception;
+}
+
+//-----------------------------------------------------------------------------
+// Executes the gateway requests pending on a bus. Called by the bus thread
+//-----------------------------------------------------------------------------
+static void serveGateway(struct MB_bus *bus)
+{
+    struct MB_gateway *gateway = bus->gateway;
+    if (gateway == NULL) return;
+
+    pthread_mutex_lock(&gateway->lock);
+    for (int e = 0; e < MB_GATEWAY_ENTRIES && gateway->num_pending > 0; e++)
+    {
+        struct MB_gateway_entry *entry = &gateway->entries[e];
+        if (entry->state != MB_GATEWAY_PENDING) continue;
+
+        //clients do not touch a pending entry, it can be used unlocked
+        if (bus->isConnected)
+        {
+            pthread_mutex_unlock(&gateway->lock);
+            int exception = forwardGatewayRequest(entry);
+            pthread_mutex_lock(&gateway->lock);
+            entry->exception = exception;
+        }
+        else
+        {
+            entry->exception = MB_EXCEPTION_PATH_UNAVAILABLE;
+        }
+
+        entry->state = MB_GATEWAY_DONE;
+        clock_gettime(CLOCK_MONOTONIC, &entry->completed);
+        gateway->num_pending--;
+
+        if (entry->write)
+        {
+            //answers cached for the points written are no longer fresh
+            uint8_t read_function = (entry->function == MODBUS_FC_WRITE_SINGLE_COIL || entry->function == MODBUS_FC_WRITE_MULTIPLE_COILS) ?
+                                    MODBUS_FC_READ_COILS : MODBUS_FC_READ_HOLDING_REGISTERS;
+            for (int r = 0; r < MB_GATEWAY_ENTRIES; r++)
+            {
+                struct MB_gateway_entry *read = &gateway->entries[r];
+                if (read->state == MB_GATEWAY_DONE && !read->write && read->device == entry->device &&
+                    read->function == read_function && read->address < entry->address + entry->count &&
+                    entry->address < read->address + read->count)
+                {
+                    read->completed.tv_sec = 0;
+                    read->completed.tv_nsec = 0;
+                }
+            }
+
+            //a client that gave up waiting left the entry behind
+            if (entry->waiters == 0) entry->state = MB_GATEWAY_EMPTY;
+        }
+    }
+    pthread_cond_broadcast(&gateway->done);
+    pthread_mutex_unlock(&gateway->lock);
+}
+
+//-----------------------------------------------------------------------------
+// Sleeps until wake_up, or until a gateway request is pending on the bus
+//-----------------------------------------------------------------------------
+static void waitForWork(struct MB_bus *bus, struct timespec *wake_up)
+{
+    struct MB_gateway *gateway = bus->gateway;
+    if (gateway == NULL)
+    {
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, wake_up, NULL);
+        return;
+    }
+
+    pthread_mutex_lock(&gateway->lock);
+    if (gateway->num_pending == 0)
+    {
+        pthread_cond_timedwait(&gateway->wake, &gateway->lock, wake_up);
+    }
+    pthread_mutex_unlock(&gateway->lock);
+}
+
+//-----------------------------------------------------------------------------
+// Tunes the serial port of an RTU bus once it is open, with the options of
+// its devices: RS-485 direction switched by the driver (TIOCSRS485) right as
+// the frame ends instead of by user space, and no receive buffering, so a
+// response is handed over as it arrives instead of on the next driver tick
+// (ASYNC_LOW_LATENCY, and latency_timer on the FTDI USB adapters, 16ms by
+// default). Settings the port does not support are logged and left out
+//-----------------------------------------------------------------------------
+static void configureSerialPort(struct MB_bus *bus)
+{
+#ifdef __linux__
+    char log_msg[1000];
+    struct MB_device *port_dev = bus->devices[0];
+    uint8_t rs485 = MB_RS485_OFF;
+    bool low_latency = false;
+    for (int d = 0; d < bus->num_devices; d++)
+    {
+        if (rs485 == MB_RS485_OFF) rs485 = bus->devices[d]->rtu_rs485;
+        if (bus->devices[d]->rtu_low_latency) low_latency = true;
+    }
+
+    int fd = modbus_get_socket(bus->mb_ctx);
+    if (fd < 0) return;
+
+    if (rs485 != MB_RS485_OFF)
+    {
+        struct serial_rs485 rs485_conf;
+        memset(&rs485_conf, 0, sizeof(rs485_conf));
+        rs485_conf.flags = SER_RS485_ENABLED;
+        rs485_conf.flags |= (rs485 == MB_RS485_RTS_HIGH) ? SER_RS485_RTS_ON_SEND : SER_RS485_RTS_AFTER_SEND;
+        if (ioctl(fd, TIOCSRS485, &rs485_conf) < 0)
+        {
+            sprintf(log_msg, "MB device %s: RS-485 direction control not supported by %s: %s\n", port_dev->dev_name, port_dev->dev_address, strerror(errno));
+            openplc_log_level(LOG_LEVEL_WARNING, log_msg);
+        }
+    }
+
+    if (low_latency)
+    {
+        struct serial_struct serial;
+        if (ioctl(fd, TIOCGSERIAL, &serial) == 0)
+        {
+            serial.flags |= ASYNC_LOW_LATENCY;
+            ioctl(fd, TIOCSSERIAL, &serial);
+        }
+
+        //USB serial adapters hold the received bytes for latency_timer ms
+        char real_path[PATH_MAX];
+        if (realpath(port_dev->dev_address, real_path) != NULL)
+        {
+            char timer_path[PATH_MAX + 64];
+            snprintf(timer_path, sizeof(timer_path), "/sys/bus/usb-serial/devices/%s/latency_timer", basename(real_path));
+            int timer_fd = open(timer_path, O_WRONLY);
+            if (timer_fd >= 0)
+            {
+                if (write(timer_fd, "1", 1) != 1)
+                {
+                    sprintf(log_msg, "MB device %s: failed to lower the latency timer of %s: %s\n", port_dev->dev_name, port_dev->dev_address, strerror(errno));
+                    openplc_log_level(LOG_LEVEL_WARNING, log_msg);
+                }
+                close(timer_fd);
+            }
+        }
+    }
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Tries to open the connection of a bus that is down, on behalf of the device
+// due for a poll. After a failed attempt the bus waits before the next one,
+// twice as long each time up to reconnect_backoff_max, with a +-25% jitter so
+// that devices that went down together do not retry in lockstep. Only the
+// first failure of an outage is logged, then a summary once a minute
+//-----------------------------------------------------------------------------
+static void reconnectBus(struct MB_bus *bus, struct MB_device *dev)
+{
+    char log_msg[1000];
+    struct timespec now;
+
+    if (bus->failed_connects == 0)
+    {
+        sprintf(log_msg, "Device %s is disconnected. Attempting to reconnect...\n", dev->dev_name);
+        openplc_log_event(LOG_LEVEL_WARNING, LOG_SOURCE_MODBUS_MASTER, LOG_CODE_MB_DISCONNECTED, 0, dev->index, log_msg);
+    }
+
+    if (modbus_connect(bus->mb_ctx) == -1)
+    {
+        int error = errno;
+        countCommError();
+        statAdd(&dev->stats.connect_failures, 1);
+        bus->failed_connects++;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (bus->failed_connects == 1 || !timeBefore(&now, &bus->next_failure_log))
+        {
+            if (bus->failed_connects == 1)
+            {
+                sprintf(log_msg, "Connection failed on MB device %s: %s\n", dev->dev_name, modbus_strerror(error));
+            }
+            else
+            {
+                sprintf(log_msg, "Connection still failing on MB device %s after %d attempts: %s\n", dev->dev_name, bus->failed_connects, modbus_strerror(error));
+            }
+            openplc_log_event(LOG_LEVEL_ERROR, LOG_SOURCE_MODBUS_MASTER, LOG_CODE_MB_CONNECT_FAILED, error, dev->index, log_msg);
+            bus->next_failure_log = now;
+            addMilliseconds(&bus->next_failure_log, MB_FAILURE_LOG_PERIOD);
+        }
+
+        if (bus->backoff_ms <= 0) bus->backoff_ms = dev->polling_period;
+        int jitter = bus->backoff_ms / 2;
+        int wait_ms = bus->backoff_ms - jitter / 2 + (jitter > 0 ? (int)(rand_r(&bus->jitter_seed) % (jitter + 1)) : 0);
+        bus->next_connect = now;
+        addMilliseconds(&bus->next_connect, wait_ms);
+
+        bus->backoff_ms *= 2;
+        if (bus->backoff_ms > reconnect_backoff_max) bus->backoff_ms = reconnect_backoff_max;
+        return;
+    }
+
+    if (bus->failed_connects > 0)
+    {
+        sprintf(log_msg, "Connected to MB device %s after %d failed attempts\n", dev->dev_name, bus->failed_connects);
+    }
+    else
+    {
+        sprintf(log_msg, "Connected to MB device %s\n", dev->dev_name);
+    }
+    openplc_log_event(LOG_LEVEL_INFO, LOG_SOURCE_MODBUS_MASTER, LOG_CODE_MB_CONNECTED, 0, dev->index, log_msg);
+    if (bus->protocol == MB_RTU) configureSerialPort(bus);
+    bus->isConnected = true;
+    bus->failed_connects = 0;
+    bus->backoff_ms = 0;
+    if (bus->was_connected) statAdd(&dev->stats.reconnects, 1);
+    bus->was_connected = true;
+
+    //the slaves may have restarted, so write all their outputs
+    for (int d = 0; d < bus->num_devices; d++)
+    {
+        bus->devices[d]->next_refresh.tv_sec = 0;
+        bus->devices[d]->next_refresh.tv_nsec = 0;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Makes the scan wait for the buses on CLOCK_MONOTONIC, like the scan deadlines
+//-----------------------------------------------------------------------------
+static void initializeSyncCond()
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sync_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+//-----------------------------------------------------------------------------
+// Converts a CLOCK_MONOTONIC time in nanoseconds to a timespec
+//-----------------------------------------------------------------------------
+static void syncTime(uint64_t ns, struct timespec *ts)
+{
+    ts->tv_sec = ns / 1000000000ULL;
+    ts->tv_nsec = ns % 1000000000ULL;
+}
+
+//-----------------------------------------------------------------------------
+// Polls a bus in step with the scan instead of on the polling periods: once
+// the scan scheduler knows when the next scan starts, every device of the bus
+// is polled scan_sync_offset us before it. All the buses do it at the same
+// time, each on its own thread, and the scan takes the inputs of all of them
+// together (waitMBInputs). The gateway requests are served in between
+//-----------------------------------------------------------------------------
+static void pollBusSynchronized(struct MB_bus *bus)
+{
+    uint64_t scheduled = 0;
+    struct timespec now;
+
+    while (run_openplc && !bus->stop.load(std::memory_order_acquire))
+    {
+        serveGateway(bus);
+
+        uint64_t next = waitScanScheduled(scheduled, MB_SYNC_IDLE_WAIT);
+        if (next == scheduled) continue;
+        scheduled = next;
+
+        struct timespec start;
+        syncTime(scheduled - (uint64_t)scan_sync_offset * 1000ULL, &start);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        while (run_openplc && !bus->stop.load(std::memory_order_acquire) && timeBefore(&now, &start))
+        {
+            waitForWork(bus, &start);
+            serveGateway(bus);
+            clock_gettime(CLOCK_MONOTONIC, &now);
+        }
+
+        //a bus that is down is still only retried once its backoff passed
+        if (!bus->isConnected && !timeBefore(&now, &bus->next_connect))
+        {
+            reconnectBus(bus, bus->devices[0]);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        for (int i = 0; i < bus->num_devices && bus->isConnected; i++)
+        {
+            selectRequests(bus->devices[i], &now, 0, true);
+            pollDevice(bus->devices[i]);
+            scheduleRequests(bus->devices[i]);
+        }
+
+        //a bus that is down is done too, the scan keeps its last inputs
+        pthread_once(&sync_once, initializeSyncCond);
+        pthread_mutex_lock(&sync_lock);
+        bus->sync_done.store(scheduled, std::memory_order_release);
+        pthread_cond_broadcast(&sync_cond);
+        pthread_mutex_unlock(&sync_lock);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Thread to poll the slave devices of one bus. Every device is polled on its
+// own period, and the thread sleeps until the next device is due
+//-----------------------------------------------------------------------------
+void *pollBus(void *arg)
+{
+    setThreadClass(THREAD_CLASS_COMM, "modbus_master");
+
+    struct MB_bus *bus = (struct MB_bus *)arg;
+    struct timespec now;
+
+#ifdef __linux__
+    //the silent interval of an RTU bus is a few hundred us at high baud
+    //rates, more than the default 50us timer slack would add to each wait
+    if (bus->protocol == MB_RTU && bus->frame_gap_ns > 0) prctl(PR_SET_TIMERSLACK, 1UL);
+#endif
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    bus->last_frame_end = now;
+    bus->next_connect = now;
+    bus->jitter_seed = (unsigned int)(now.tv_nsec ^ (uintptr_t)bus);
+    for (int i = 0; i < bus->num_devices; i++)
+    {
+        bus->devices[i]->next_poll = now;
+        for (int r = 0; r < bus->devices[i]->num_requests; r++)
+        {
+            bus->devices[i]->requests[r].next_due = now;
+        }
+    }
+
+    if (scan_sync_offset > 0)
+    {
+        pollBusSynchronized(bus);
+        return NULL;
+    }
+
+    while (run_openplc && !bus->stop.load(std::memory_order_acquire))
+    {
+        serveGateway(bus);
+
+        struct timespec wake_up;
+        int priority;
+        struct MB_device *dev = nextDueDevice(bus, &wake_up, &priority);
+        if (dev == NULL)
+        {
+            waitForWork(bus, &wake_up);
+            continue;
+        }
+
+        //a bus that is down is only retried once its backoff has passed,
+        //its devices wait for it without being polled
+        if (!bus->isConnected)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (timeBefore(&now, &bus->next_connect))
+            {
+                for (int d = 0; d < bus->num_devices; d++)
+                {
+                    if (timeBefore(&bus->devices[d]->next_poll, &bus->next_connect)) bus->devices[d]->next_poll = bus->next_connect;
+                }
+                continue;
+            }
+            reconnectBus(bus, dev);
+        }
+
+        //a failed reconnection leaves the requests due, the device waits
+        //for the next attempt
+        if (bus->isConnected)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            selectRequests(dev, &now, priority, false);
+            pollDevice(dev);
+            scheduleRequests(dev);
+        }
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Computes once where the points of each device are placed on the located
+// variables. Devices are laid out in configuration order. A device that does
+// not fit on the located variable space has its I/O disabled
+//-----------------------------------------------------------------------------
+static void assignDeviceOffsets(struct MB_master *m)
+{
+    int bool_input_index = 0;
+    int bool_output_index = 0;
+    int int_input_index = 0;
+    int int_output_index = 0;
+
+    for (int i = 0; i < m->num_devices; i++)
+    {
+        struct MB_device *dev = &m->devices[i];
+
+        if (bool_input_index + dev->discrete_inputs.num_regs > MAX_MB_BOOL_IO ||
+            bool_output_index + dev->coils.num_regs > MAX_MB_BOOL_IO ||
+            int_input_index + dev->input_registers.num_regs + dev->holding_read_registers.num_regs > MAX_MB_INT_IO ||
+            int_output_index + dev->holding_registers.num_regs > MAX_MB_INT_IO)
+        {
+            char log_msg[1000];
+            sprintf(log_msg, "Warning: MB device %s does not fit on the slave device address space (%d bits and %d registers per direction). Its I/O is disabled\n",
+                    dev->dev_name, MAX_MB_BOOL_IO, MAX_MB_INT_IO);
+            openplc_log_level(LOG_LEVEL_WARNING, log_msg);
+            dev->discrete_inputs.num_regs = 0;
+            dev->coils.num_regs = 0;
+            dev->input_registers.num_regs = 0;
+            dev->holding_read_registers.num_regs = 0;
+            dev->holding_registers.num_regs = 0;
+        }
+
+        dev->bool_input_offset = bool_input_index;
+        dev->bool_output_offset = bool_output_index;
+        dev->int_input_offset = int_input_index;
+        dev->int_output_offset = int_output_index;
+
+        bool_input_index += dev->discrete_inputs.num_regs;
+        bool_output_index += dev->coils.num_regs;
+        int_input_index += dev->input_registers.num_regs + dev->holding_read_registers.num_regs;
+        int_output_index += dev->holding_registers.num_regs;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Groups the group leaders into buses by their connection context
+//-----------------------------------------------------------------------------
+static void createBuses(struct MB_master *m)
+{
+    m->buses = (struct MB_bus *)calloc(m->num_devices, sizeof(struct MB_bus));
+    m->num_buses = 0;
+
+    for (int i = 0; i < m->num_devices; i++)
+    {
+        //devices polled by a group leader are not scheduled on their own
+        if (m->devices[i].group_leader != &m->devices[i])
+        {
+            m->devices[i].bus = m->devices[i].group_leader->bus;
+            continue;
+        }
+
+        struct MB_bus *bus = NULL;
+        for (int b = 0; b < m->num_buses; b++)
+        {
+            if (m->buses[b].mb_ctx == m->devices[i].mb_ctx) bus = &m->buses[b];
+        }
+
+        if (bus == NULL)
+        {
+            bus = &m->buses[m->num_buses++];
+            bus->mb_ctx = m->devices[i].mb_ctx;
+            bus->protocol = m->devices[i].protocol;
+            bus->isConnected = false;
+            bus->devices = (struct MB_device **)calloc(m->num_devices, sizeof(struct MB_device *));
+            bus->current_slave = -1;
+            bus->frame_gap_ns = 0;
+        }
+
+        //devices sharing a port may have different TX pauses, keep the longest
+        long long gap = frameGap(&m->devices[i]);
+        if (gap > bus->frame_gap_ns) bus->frame_gap_ns = gap;
+
+        bus->devices[bus->num_devices++] = &m->devices[i];
+        m->devices[i].bus = bus;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Lays out the points of every device on the buffers of its bus, creates the
+// bus exchanges and the runs that map the bus buffers onto the located
+// variables
+//-----------------------------------------------------------------------------
+static void createBusBuffers(struct MB_master *m)
+{
+    for (int b = 0; b < m->num_buses; b++)
+    {
+        struct MB_bus *bus = &m->buses[b];
+        int bool_inputs = 0, int_inputs = 0, bool_outputs = 0, int_outputs = 0;
+
+        bus->bool_input_runs = (struct MB_run *)calloc(m->num_devices, sizeof(struct MB_run));
+        bus->int_input_runs = (struct MB_run *)calloc(m->num_devices, sizeof(struct MB_run));
+        bus->bool_output_runs = (struct MB_run *)calloc(m->num_devices, sizeof(struct MB_run));
+        bus->int_output_runs = (struct MB_run *)calloc(m->num_devices, sizeof(struct MB_run));
+        bus->num_runs = 0;
+
+        for (int i = 0; i < m->num_devices; i++)
+        {
+            struct MB_device *dev = &m->devices[i];
+            if (dev->bus != bus) continue;
+
+            int n = bus->num_runs++;
+            dev->bus_bool_input_offset = bool_inputs;
+            bus->bool_input_runs[n].image_offset = dev->bool_input_offset;
+            bus->bool_input_runs[n].bus_offset = bool_inputs;
+            bus->bool_input_runs[n].count = dev->discrete_inputs.num_regs;
+            bool_inputs += dev->discrete_inputs.num_regs;
+
+            dev->bus_int_input_offset = int_inputs;
+            bus->int_input_runs[n].image_offset = dev->int_input_offset;
+            bus->int_input_runs[n].bus_offset = int_inputs;
+            bus->int_input_runs[n].count = dev->input_registers.num_regs + dev->holding_read_registers.num_regs;
+            int_inputs += dev->input_registers.num_regs + dev->holding_read_registers.num_regs;
+
+            dev->bus_bool_output_offset = bool_outputs;
+            bus->bool_output_runs[n].image_offset = dev->bool_output_offset;
+            bus->bool_output_runs[n].bus_offset = bool_outputs;
+            bus->bool_output_runs[n].count = dev->coils.num_regs;
+            bool_outputs += dev->coils.num_regs;
+
+            dev->bus_int_output_offset = int_outputs;
+            bus->int_output_runs[n].image_offset = dev->int_output_offset;
+            bus->int_output_runs[n].bus_offset = int_outputs;
+            bus->int_output_runs[n].count = dev->holding_registers.num_regs;
+            int_outputs += dev->holding_registers.num_regs;
+        }
+
+        createExchange(&bus->inputs, bool_inputs, int_inputs);
+        createExchange(&bus->outputs, bool_outputs, int_outputs);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Maps the server unit ids of the gateway devices and creates the gateway
+// tables of their buses
+//-----------------------------------------------------------------------------
+static void createGateways(struct MB_master *m)
+{
+    for (int i = 0; i < m->num_devices; i++)
+    {
+        struct MB_device *dev = &m->devices[i];
+        uint8_t unit = dev->gateway_unit_id;
+        if (unit == 0) continue;
+
+        char log_msg[1000];
+        if (unit > 247 || m->gateway_units[unit] != NULL)
+        {
+            sprintf(log_msg, "Warning: gateway unit id %d of MB device %s is invalid or already used\n", unit, dev->dev_name);
+            openplc_log_level(LOG_LEVEL_WARNING, log_msg);
+            continue;
+        }
+
+        struct MB_bus *bus = dev->bus;
+        if (bus->gateway == NULL)
+        {
+            pthread_condattr_t attr;
+            pthread_condattr_init(&attr);
+            pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+            bus->gateway = (struct MB_gateway *)calloc(1, sizeof(struct MB_gateway));
+            pthread_mutex_init(&bus->gateway->lock, NULL);
+            pthread_cond_init(&bus->gateway->wake, &attr);
+            pthread_cond_init(&bus->gateway->done, &attr);
+            pthread_condattr_destroy(&attr);
+        }
+        m->gateway_units[unit] = dev;
+        m->has_gateways = true;
+
+        sprintf(log_msg, "Modbus server unit id %d is forwarded to MB device %s\n", unit, dev->dev_name);
+        openplc_log(log_msg);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Returns true if two devices are configured with the same connection
+//-----------------------------------------------------------------------------
+static bool sameConnection(struct MB_device *a, struct MB_device *b)
+{
+    if (a->protocol != b->protocol || strcmp(a->dev_address, b->dev_address) != 0) return false;
+
+    if (a->protocol == MB_TCP)
+    {
+        return a->ip_port == b->ip_port && a->separate_connection == b->separate_connection;
+    }
+    return a->rtu_baud == b->rtu_baud && a->rtu_parity == b->rtu_parity && a->rtu_data_bit == b->rtu_data_bit &&
+           a->rtu_stop_bit == b->rtu_stop_bit && a->rtu_rs485 == b->rtu_rs485 && a->rtu_low_latency == b->rtu_low_latency;
+}
+
+//-----------------------------------------------------------------------------
+// Finds a connection of the previous table opened for a device configured
+// like dev and not taken over yet. The connection is handed over to the new
+// table. Returns NULL if there is none
+//-----------------------------------------------------------------------------
+static modbus_t *takeOverConnection(struct MB_device *dev, struct MB_master *previous)
+{
+    if (previous == NULL) return NULL;
+
+    for (int j = 0; j < previous->num_devices; j++)
+    {
+        struct MB_device *old = &previous->devices[j];
+        if (old->mb_ctx == NULL || old->bus->handed_over || !sameConnection(dev, old)) continue;
+
+        //the connection was opened with the settings of the first device on it
+        bool first = true;
+        for (int k = 0; k < j && first; k++)
+        {
+            if (previous->devices[k].mb_ctx == old->mb_ctx) first = false;
+        }
+        if (!first) continue;
+
+        old->bus->handed_over = true;
+        return old->mb_ctx;
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Creates the connection contexts of the devices of a new table. Devices at
+// the same IP and port or on the same serial port share one. On a reload, the
+// connections of the previous table are taken over by the devices configured
+// the same way instead of opening new ones
+//-----------------------------------------------------------------------------
+static void createContexts(struct MB_master *m, struct MB_master *previous)
+{
+    char log_msg[1000];
+
+    for (int i = 0; i < m->num_devices; i++)
+    {
+        struct MB_device *dev = &m->devices[i];
+
+        //devices without a period of their own use the global one
+        if (dev->polling_period == 0)
+        {
+            dev->polling_period = m->polling_period;
+        }
+
+        //Devices at the same IP and port are slaves behind one gateway,
+        //they share its connection and switch the unit id per request.
+        //Devices on the same serial port share it
+        int share_index = -1;
+        for (int a = 0; a < i; a++)
+        {
+            struct MB_device *other = &m->devices[a];
+            if (dev->protocol == MB_TCP && !dev->separate_connection && other->protocol == MB_TCP &&
+                !other->separate_connection && other->ip_port == dev->ip_port &&
+                strcmp(other->dev_address, dev->dev_address) == 0)
+            {
+                share_index = a;
+                break;
+            }
+            if (dev->protocol == MB_RTU && strcmp(other->dev_address, dev->dev_address) == 0)
+            {
+                share_index = a;
+                break;
+            }
+        }
+        if (share_index != -1)
+        {
+            struct MB_device *other = &m->devices[share_index];
+            if (dev->protocol == MB_TCP)
+            {
+                sprintf(log_msg, "MB device %s shares the connection of MB device %s\n", dev->dev_name, other->dev_name);
+                openplc_log(log_msg);
+            }
+            else if (dev->rtu_baud != other->rtu_baud || dev->rtu_parity != other->rtu_parity ||
+                     dev->rtu_data_bit != other->rtu_data_bit || dev->rtu_stop_bit != other->rtu_stop_bit)
+            {
+                sprintf(log_msg, "Warning MB device %s port setting missmatch\n", dev->dev_name);
+                openplc_log_level(LOG_LEVEL_WARNING, log_msg);
+            }
+            dev->mb_ctx = other->mb_ctx;
+        }
+        else
+        {
+            dev->mb_ctx = takeOverConnection(dev, previous);
+        }
+
+        if (dev->mb_ctx == NULL && dev->protocol == MB_TCP)
+        {
+            dev->mb_ctx = modbus_new_tcp(dev->dev_address, dev->ip_port);
+        }
+        else if (dev->mb_ctx == NULL && dev->protocol == MB_RTU)
+        {
+            dev->mb_ctx = modbus_new_rtu(dev->dev_address, dev->rtu_baud, dev->rtu_parity, dev->rtu_data_bit, dev->rtu_stop_bit);
+
+            // If hardware layer set modbus_rts_pin, enable Pi specific rts handling,
+            // unless the serial driver switches the direction (RTU_RS485)
+            if (rpi_modbus_rts_pin != 0 && dev->rtu_rs485 == MB_RS485_OFF)
+            {
+                modbus_enable_rpi(dev->mb_ctx,TRUE);
+                modbus_configure_rpi_bcm_pin(dev->mb_ctx,rpi_modbus_rts_pin);
+                modbus_rpi_pin_export_direction(dev->mb_ctx);
+            }
+        }
+
+        //slave id
+        modbus_set_slave(dev->mb_ctx, dev->dev_id);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Links the buses of a new table to the buses of the previous one whose
+// connection they took over, and its devices to the previous devices that
+// read the same inputs from the same slave
+//-----------------------------------------------------------------------------
+static void linkPrevious(struct MB_master *m, struct MB_master *previous)
+{
+    for (int b = 0; b < m->num_buses; b++)
+    {
+        for (int o = 0; o < previous->num_buses; o++)
+        {
+            if (previous->buses[o].mb_ctx == m->buses[b].mb_ctx) m->buses[b].previous = &previous->buses[o];
+        }
+    }
+
+    for (int i = 0; i < m->num_devices; i++)
+    {
+        struct MB_device *dev = &m->devices[i];
+        for (int j = 0; j < previous->num_devices && dev->previous == NULL; j++)
+        {
+            struct MB_device *old = &previous->devices[j];
+            if (old->mb_ctx == dev->mb_ctx && old->dev_id == dev->dev_id &&
+                !memcmp(&old->discrete_inputs, &dev->discrete_inputs, sizeof(struct MB_address)) &&
+                !memcmp(&old->input_registers, &dev->input_registers, sizeof(struct MB_address)) &&
+                !memcmp(&old->holding_read_registers, &dev->holding_read_registers, sizeof(struct MB_address)))
+            {
+                dev->previous = old;
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Builds a device table from mbconfig.cfg, with the connections of the
+// previous table (if not NULL) taken over where possible. Nothing is started
+//-----------------------------------------------------------------------------
+static struct MB_master *buildMaster(struct MB_master *previous)
+{
+    struct MB_master *m = (struct MB_master *)calloc(1, sizeof(struct MB_master));
+
+    parseConfig(m);
+    createContexts(m, previous);
+    assignDeviceOffsets(m);
+    groupDevices(m);
+    createBuses(m);
+    createBusBuffers(m);
+    buildRequests(m);
+    createGateways(m);
+    if (previous != NULL) linkPrevious(m, previous);
+
+    return m;
+}
+
+//-----------------------------------------------------------------------------
+// Frees a device table that no thread uses any more. The connections that
+// were not handed over to another table are closed
+//-----------------------------------------------------------------------------
+static void freeMaster(struct MB_master *m)
+{
+    for (int b = 0; b < m->num_buses; b++)
+    {
+        struct MB_bus *bus = &m->buses[b];
+        if (!bus->handed_over)
+        {
+            modbus_close(bus->mb_ctx);
+            modbus_free(bus->mb_ctx);
+        }
+
+        for (int i = 0; i < 3; i++)
+        {
+            free(bus->inputs.bits[i]);
+            free(bus->inputs.registers[i]);
+            free(bus->outputs.bits[i]);
+            free(bus->outputs.registers[i]);
+        }
+        free(bus->devices);
+        free(bus->bool_input_runs);
+        free(bus->int_input_runs);
+        free(bus->bool_output_runs);
+        free(bus->int_output_runs);
+
+        if (bus->gateway != NULL)
+        {
+            pthread_mutex_destroy(&bus->gateway->lock);
+            pthread_cond_destroy(&bus->gateway->wake);
+            pthread_cond_destroy(&bus->gateway->done);
+            free(bus->gateway);
+        }
+    }
+
+    for (int i = 0; i < m->num_devices; i++)
+    {
+        struct MB_device *dev = &m->devices[i];
+        for (int r = 0; r < dev->num_requests; r++)
+        {
+            free(dev->requests[r].last_written);
+        }
+        free(dev->requests);
+        free(dev->segments);
+        free(dev->pending);
+    }
+
+    free(m->buses);
+    free(m->devices);
+    free(m);
+}
+
+//-----------------------------------------------------------------------------
+// Starts the polling thread of every bus of a table
+//-----------------------------------------------------------------------------
+static void startBusThreads(struct MB_master *m)
+{
+    for (int b = 0; b < m->num_buses; b++)
+    {
+        struct MB_bus *bus = &m->buses[b];
+        bus->stop.store(false, std::memory_order_relaxed);
+        bus->running = (pthread_create(&bus->thread, NULL, pollBus, bus) == 0);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Stops the polling threads of a table. A thread stops between two polls, so
+// this waits for at most a poll and the idle wait of its bus
+//-----------------------------------------------------------------------------
+static void stopBusThreads(struct MB_master *m)
+{
+    for (int b = 0; b < m->num_buses; b++)
+    {
+        struct MB_bus *bus = &m->buses[b];
+        bus->stop.store(true, std::memory_order_release);
+        if (bus->gateway != NULL)
+        {
+            pthread_mutex_lock(&bus->gateway->lock);
+            pthread_cond_broadcast(&bus->gateway->wake);
+            pthread_mutex_unlock(&bus->gateway->lock);
         }
-        else if (mb_devices[i].protocol == MB_RTU)
+    }
+
+    for (int b = 0; b < m->num_buses; b++)
+    {
+        struct MB_bus *bus = &m->buses[b];
+        if (bus->running) pthread_join(bus->thread, NULL);
+        bus->running = false;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Carries the state of the connections taken over from the previous table,
+// once its threads are stopped
+//-----------------------------------------------------------------------------
+static void inheritConnections(struct MB_master *m)
+{
+    for (int b = 0; b < m->num_buses; b++)
+    {
+        struct MB_bus *bus = &m->buses[b];
+        if (bus->previous == NULL) continue;
+
+        bus->isConnected = bus->previous->isConnected;
+        bus->was_connected = bus->previous->was_connected;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Gives the connections taken over by a table that was not swapped in back to
+// the previous table
+//-----------------------------------------------------------------------------
+static void returnConnections(struct MB_master *m)
+{
+    for (int b = 0; b < m->num_buses; b++)
+    {
+        struct MB_bus *bus = &m->buses[b];
+        if (bus->previous == NULL) continue;
+
+        bus->previous->handed_over = false;
+        bus->handed_over = true;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Makes the settings of a table the running ones and starts its threads
+//-----------------------------------------------------------------------------
+static void startMaster(struct MB_master *m)
+{
+    polling_period = m->polling_period;
+    timeout = m->timeout;
+    write_refresh_period = m->write_refresh_period;
+    reconnect_backoff_max = m->reconnect_backoff_max;
+    scan_sync_offset = m->scan_sync_offset;
+    scan_sync_deadline = m->scan_sync_deadline;
+
+    //timeout
+    uint32_t to_sec = timeout / 1000;
+    uint32_t to_usec = (timeout % 1000) * 1000;
+    for (int b = 0; b < m->num_buses; b++)
+    {
+        modbus_set_response_timeout(m->buses[b].mb_ctx, to_sec, to_usec);
+    }
+
+    startBusThreads(m);
+}
+
+//-----------------------------------------------------------------------------
+// Takes the running table for a thread other than the scan. The table is not
+// freed by a reload until it is released
+//-----------------------------------------------------------------------------
+static struct MB_master *acquireMaster()
+{
+    pthread_mutex_lock(&masterLock);
+    struct MB_master *m = master;
+    if (m != NULL) m->users.fetch_add(1, std::memory_order_acquire);
+    pthread_mutex_unlock(&masterLock);
+    return m;
+}
+
+static void releaseMaster(struct MB_master *m)
+{
+    if (m != NULL) m->users.fetch_sub(1, std::memory_order_release);
+}
+
+//-----------------------------------------------------------------------------
+// Swaps in the table of a reload at the start of a scan. The devices that
+// read the same inputs as before start from the values they had until they
+// are polled, and the points no device maps any more read 0. Called by the
+// scan with the buffers locked
+//-----------------------------------------------------------------------------
+static void swapMaster()
+{
+    if (pending_master.load(std::memory_order_relaxed) == NULL) return;
+
+    //a server worker is taking the running table, try on the next scan
+    if (pthread_mutex_trylock(&masterLock) != 0) return;
+
+    struct MB_master *next = pending_master.exchange(NULL, std::memory_order_acquire);
+    if (next != NULL)
+    {
+        for (int i = 0; i < next->num_devices; i++)
         {
-            //Check if there is a device using the same port
-            int share_index = -1;
-            for (int a = 0; a < num_devices && a < i; a++)
-            {
-                if (strcmp(mb_devices[i].dev_address, mb_devices[a].dev_address) == 0)
-                {
-                    share_index = a;
-                    break;
-                }
-            }
-            if (share_index != -1)
+            struct MB_device *dev = &next->devices[i];
+            struct MB_device *old = dev->previous;
+            if (old == NULL) continue;
+
+            struct MB_exchange *inputs = &dev->bus->inputs;
+            int registers = dev->input_registers.num_regs + dev->holding_read_registers.num_regs;
+            for (int e = 0; e < 3; e++)
             {
-                if (mb_devices[i].rtu_baud != mb_devices[share_index].rtu_baud || mb_devices[i].rtu_parity != mb_devices[share_index].rtu_parity || 
-                    mb_devices[i].rtu_data_bit != mb_devices[share_index].rtu_data_bit || mb_devices[i].rtu_stop_bit != mb_devices[share_index].rtu_stop_bit)
-                {
-                    char log_msg[1000];
-                    sprintf(log_msg, "Warning MB device %s port setting missmatch\n", mb_devices[i].dev_name);
-                    openplc_log(log_msg);
-                }
-                mb_devices[i].mb_ctx = mb_devices[share_index].mb_ctx;
+                memcpy(&inputs->bits[e][dev->bus_bool_input_offset], &bool_input_image[0][0] + MB_IO_START * 8 + old->bool_input_offset, dev->discrete_inputs.num_regs * sizeof(IEC_BOOL));
+                memcpy(&inputs->registers[e][dev->bus_int_input_offset], &int_input_image[MB_IO_START + old->int_input_offset], registers * sizeof(IEC_UINT));
             }
-            else
-            {
-                mb_devices[i].mb_ctx = modbus_new_rtu(mb_devices[i].dev_address, mb_devices[i].rtu_baud,
-                                                mb_devices[i].rtu_parity, mb_devices[i].rtu_data_bit,
-                                                mb_devices[i].rtu_stop_bit);
+            dev->previous = NULL;
+        }
 
-                // If hardware layer set modbus_rts_pin, enable Pi specific rts handling
-                if (rpi_modbus_rts_pin != 0) 
-                {
-                    modbus_enable_rpi(mb_devices[i].mb_ctx,TRUE);
-                    modbus_configure_rpi_bcm_pin(mb_devices[i].mb_ctx,rpi_modbus_rts_pin);
-                    modbus_rpi_pin_export_direction(mb_devices[i].mb_ctx);
-                }
-            }
+        for (int i = 0; master != NULL && i < master->num_devices; i++)
+        {
+            struct MB_device *old = &master->devices[i];
+            memset(&bool_input_image[0][0] + MB_IO_START * 8 + old->bool_input_offset, 0, old->discrete_inputs.num_regs * sizeof(IEC_BOOL));
+            memset(&int_input_image[MB_IO_START + old->int_input_offset], 0, (old->input_registers.num_regs + old->holding_read_registers.num_regs) * sizeof(IEC_UINT));
         }
-        
-        //slave id
 
-        modbus_set_slave(mb_devices[i].mb_ctx, mb_devices[i].dev_id);
+        master = next;
+        gateways_configured.store(next->has_gateways, std::memory_order_relaxed);
+        master_swapped.store(true, std::memory_order_release);
+    }
 
+    pthread_mutex_unlock(&masterLock);
+}
+
+//-----------------------------------------------------------------------------
+// This function is called by the main OpenPLC routine when it is initializing.
+// Modbus master initialization procedures are here.
+//-----------------------------------------------------------------------------
+void initializeMB()
+{
+    struct MB_master *m = buildMaster(NULL);
 
-        //timeout
-        uint32_t to_sec = timeout / 1000;
-        uint32_t to_usec = (timeout % 1000) * 1000;
-        modbus_set_response_timeout(mb_devices[i].mb_ctx, to_sec, to_usec);
-        
-    }
-    
     //Initialize comm error counter
     if (special_functions[2] != NULL) *special_functions[2] = 0;
-    
-    if (num_devices > 0)
+
+    master = m;
+    gateways_configured.store(m->has_gateways, std::memory_order_relaxed);
+    startMaster(m);
+}
+
+//-----------------------------------------------------------------------------
+// Reloads mbconfig.cfg while the runtime runs. The new device table is built
+// next to the running one, the polling threads of the running table are
+// stopped and the scan swaps the tables at the start of a cycle. Devices with
+// the same connection settings keep their connection open. Returns 0 once the
+// new table runs, or -1 if the scan did not pick it up, in which case the
+// running table goes on as it was
+//-----------------------------------------------------------------------------
+int reloadMB()
+{
+    char log_msg[1000];
+
+    pthread_mutex_lock(&reloadLock);
+
+    //only the scan changes the running table, and only for a reload
+    pthread_mutex_lock(&masterLock);
+    struct MB_master *previous = master;
+    pthread_mutex_unlock(&masterLock);
+
+    struct MB_master *next = buildMaster(previous);
+    if (previous != NULL) stopBusThreads(previous);
+    inheritConnections(next);
+
+    master_swapped.store(false, std::memory_order_relaxed);
+    pending_master.store(next, std::memory_order_release);
+
+    int waited = 0;
+    while (!master_swapped.load(std::memory_order_acquire) && waited < MB_RELOAD_TIMEOUT_MS && run_openplc)
+    {
+        sleepms(10);
+        waited += 10;
+    }
+
+    struct MB_master *expected = next;
+    if (!master_swapped.load(std::memory_order_acquire) && pending_master.compare_exchange_strong(expected, NULL))
+    {
+        sprintf(log_msg, "Modbus master: the scan did not pick up the reloaded devices, the running ones are kept\n");
+        openplc_log(log_msg);
+        returnConnections(next);
+        freeMaster(next);
+        if (previous != NULL) startBusThreads(previous);
+        pthread_mutex_unlock(&reloadLock);
+        return -1;
+    }
+
+    startMaster(next);
+
+    int kept = 0;
+    for (int b = 0; b < next->num_buses; b++)
+    {
+        if (next->buses[b].previous != NULL) kept++;
+    }
+
+    //server workers may still wait for the gateways of the previous table
+    if (previous != NULL)
+    {
+        while (previous->users.load(std::memory_order_acquire) > 0) sleepms(10);
+        freeMaster(previous);
+    }
+
+    sprintf(log_msg, "Modbus master: reloaded %d devices on %d buses, %d connections kept\n", next->num_devices, next->num_buses, kept);
+    openplc_log(log_msg);
+
+    pthread_mutex_unlock(&reloadLock);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Returns true once every bus was polled for the scan starting at target
+//-----------------------------------------------------------------------------
+static bool busesSynchronized(uint64_t target)
+{
+    for (int b = 0; b < master->num_buses; b++)
+    {
+        if (master->buses[b].sync_done.load(std::memory_order_acquire) < target) return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// With the master in step with the scan, waits until every bus polled its
+// devices for the scan about to run, so all the inputs it reads are from the
+// same moment. The scan waits at most scan_sync_deadline us past its start,
+// then goes on with the inputs of the late buses from the scan before.
+// Called by the scan before it locks the buffers
+//-----------------------------------------------------------------------------
+void waitMBInputs()
+{
+    char log_msg[1000];
+
+    if (scan_sync_offset <= 0 || master == NULL || master->num_buses == 0) return;
+    uint64_t target = getScheduledScan();
+    if (target == 0) return;
+
+    sync_scans.fetch_add(1, std::memory_order_relaxed);
+    if (busesSynchronized(target))
+    {
+        sync_late_reported = false;
+        return;
+    }
+
+    struct timespec deadline;
+    syncTime(target + (uint64_t)scan_sync_deadline * 1000ULL, &deadline);
+
+    pthread_once(&sync_once, initializeSyncCond);
+    pthread_mutex_lock(&sync_lock);
+    bool complete;
+    while (!(complete = busesSynchronized(target)))
     {
-        pthread_t thread;
-        int ret = pthread_create(&thread, NULL, querySlaveDevices, NULL);
-        if (ret==0) 
+        if (pthread_cond_timedwait(&sync_cond, &sync_lock, &deadline) != 0)
         {
-            pthread_detach(thread);
+            complete = busesSynchronized(target);
+            break;
         }
     }
+    pthread_mutex_unlock(&sync_lock);
+
+    if (complete)
+    {
+        sync_late_reported = false;
+        return;
+    }
+
+    //report only the first of a sequence of late scans
+    sync_late_scans.fetch_add(1, std::memory_order_relaxed);
+    if (!sync_late_reported)
+    {
+        sync_late_reported = true;
+        sprintf(log_msg, "Modbus master: slave devices not polled %d us after the scan start, the scan uses older inputs\n", scan_sync_deadline);
+        openplc_log(log_msg);
+    }
 }
 
 //-----------------------------------------------------------------------------
 // This function is called by the OpenPLC in a loop. Here the internal buffers
 // must be updated to reflect the actual Input state.
+// The copy never waits for a polling thread: the newest inputs handed over by
+// each bus are copied, or the ones seen on the previous cycle
 //-----------------------------------------------------------------------------
 void updateBuffersIn_MB()
 {
-    pthread_mutex_lock(&ioLock);
+    swapMaster();
+    if (master == NULL) return;
 
-    for (int i = 0; i < MAX_MB_IO; i++)
+    for (int b = 0; b < master->num_buses; b++)
     {
-        if (bool_input[100+(i/8)][i%8] != NULL) *bool_input[100+(i/8)][i%8] = bool_input_buf[i];
-        if (int_input[100+i] != NULL) *int_input[100+i] = int_input_buf[i];
-    }
+        struct MB_bus *bus = &master->buses[b];
+        consumeExchange(&bus->inputs);
+        uint8_t *bits = bus->inputs.bits[bus->inputs.consumer];
+        uint16_t *registers = bus->inputs.registers[bus->inputs.consumer];
 
-    pthread_mutex_unlock(&ioLock);
+        //every located variable lives on its slot of the contiguous images
+        for (int r = 0; r < bus->num_runs; r++)
+        {
+            struct MB_run *bool_run = &bus->bool_input_runs[r];
+            struct MB_run *int_run = &bus->int_input_runs[r];
+            memcpy(&bool_input_image[0][0] + MB_IO_START * 8 + bool_run->image_offset, &bits[bool_run->bus_offset], bool_run->count * sizeof(IEC_BOOL));
+            memcpy(&int_input_image[MB_IO_START + int_run->image_offset], &registers[int_run->bus_offset], int_run->count * sizeof(IEC_UINT));
+        }
+    }
 }
 
 
 //-----------------------------------------------------------------------------
 // This function is called by the OpenPLC in a loop. Here the internal buffers
-// must be updated to reflect the actual Output state.
+// must be updated to reflect the actual Output state. The outputs of each bus
+// are handed over to its polling thread without waiting for it
 //-----------------------------------------------------------------------------
 void updateBuffersOut_MB()
 {
-    pthread_mutex_lock(&ioLock);
+    if (master == NULL) return;
+
+    for (int b = 0; b < master->num_buses; b++)
+    {
+        struct MB_bus *bus = &master->buses[b];
+        uint8_t *bits = bus->outputs.bits[bus->outputs.producer];
+        uint16_t *registers = bus->outputs.registers[bus->outputs.producer];
+
+        for (int r = 0; r < bus->num_runs; r++)
+        {
+            struct MB_run *bool_run = &bus->bool_output_runs[r];
+            struct MB_run *int_run = &bus->int_output_runs[r];
+            memcpy(&bits[bool_run->bus_offset], &bool_output_image[0][0] + MB_IO_START * 8 + bool_run->image_offset, bool_run->count * sizeof(IEC_BOOL));
+            memcpy(&registers[int_run->bus_offset], &int_output_image[MB_IO_START + int_run->image_offset], int_run->count * sizeof(IEC_UINT));
+        }
+
+        publishExchange(&bus->outputs, false);
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+// Totals of the statistics of a device over its block types
+//-----------------------------------------------------------------------------
+struct MB_stats_summary
+{
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t timeouts;
+    uint64_t min_us;
+    uint64_t avg_us;
+    uint64_t p99_us;
+    uint64_t max_us;
+};
+
+//-----------------------------------------------------------------------------
+// Sums the statistics of the given block types of a device. The p99 latency
+// is the upper bound of the histogram bucket that holds it
+//-----------------------------------------------------------------------------
+static void summarizeStats(struct MB_device *dev, int first_block, int last_block, struct MB_stats_summary *summary)
+{
+    uint64_t histogram[MB_LATENCY_BUCKETS] = { 0 };
+    uint64_t latency_sum = 0;
+
+    memset(summary, 0, sizeof(struct MB_stats_summary));
+    for (int b = first_block; b <= last_block; b++)
+    {
+        struct MB_block_stats *stats = &dev->stats.blocks[b];
+        summary->requests += stats->requests.load(std::memory_order_relaxed);
+        summary->errors += stats->errors.load(std::memory_order_relaxed);
+        summary->timeouts += stats->timeouts.load(std::memory_order_relaxed);
+        latency_sum += stats->latency_sum_us.load(std::memory_order_relaxed);
+
+        uint64_t min_us = stats->latency_min_us.load(std::memory_order_relaxed);
+        if (min_us != 0 && (summary->min_us == 0 || min_us < summary->min_us)) summary->min_us = min_us;
+        uint64_t max_us = stats->latency_max_us.load(std::memory_order_relaxed);
+        if (max_us > summary->max_us) summary->max_us = max_us;
+
+        for (int i = 0; i < MB_LATENCY_BUCKETS; i++)
+        {
+            histogram[i] += stats->histogram[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t answered = 0;
+    for (int i = 0; i < MB_LATENCY_BUCKETS; i++) answered += histogram[i];
+    if (answered == 0) return;
+
+    summary->avg_us = latency_sum / answered;
+    uint64_t seen = 0;
+    for (int i = 0; i < MB_LATENCY_BUCKETS; i++)
+    {
+        seen += histogram[i];
+        if (seen * 100 >= answered * 99)
+        {
+            summary->p99_us = 2ULL << i;
+            break;
+        }
+    }
+    if (summary->p99_us > summary->max_us) summary->p99_us = summary->max_us;
+}
+
+//-----------------------------------------------------------------------------
+// Copies the statistics of the slave devices to the located variables, 8 per
+// device from %ML1040: requests, errors, timeouts, reconnects and the min,
+// average, p99 and max round trip (us). Devices polled with another one show
+// the statistics of their group. Called by the scan on every cycle
+//-----------------------------------------------------------------------------
+void updateMBSpecialFunctions()
+{
+    if (master == NULL) return;
+
+    for (int i = 0; i < master->num_devices; i++)
+    {
+        int base = MB_STATS_SPECIAL_START + i * MB_STATS_PER_DEVICE;
+        if (base + MB_STATS_PER_DEVICE > BUFFER_SIZE) break;
+
+        bool mapped = false;
+        for (int v = 0; v < MB_STATS_PER_DEVICE; v++)
+        {
+            if (special_functions[base + v] != NULL) mapped = true;
+        }
+        if (!mapped) continue;
+
+        struct MB_device *dev = master->devices[i].group_leader;
+        struct MB_stats_summary summary;
+        summarizeStats(dev, 0, MB_BLOCK_TYPES - 1, &summary);
+
+        uint64_t values[MB_STATS_PER_DEVICE] = { summary.requests, summary.errors, summary.timeouts,
+                                                 dev->stats.reconnects.load(std::memory_order_relaxed),
+                                                 summary.min_us, summary.avg_us, summary.p99_us, summary.max_us };
+        for (int v = 0; v < MB_STATS_PER_DEVICE; v++)
+        {
+            if (special_functions[base + v] != NULL) *special_functions[base + v] = values[v];
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Sends the lines of the slave devices of a table to a client
+//-----------------------------------------------------------------------------
+static void sendDeviceStats(struct MB_master *m, LogWriter writer, void *context)
+{
+    static const char *block_names[MB_BLOCK_TYPES] = { "discrete_inputs", "coils", "input_registers", "holding_read", "holding_write" };
+    char line[512];
+    int length;
+
+    for (int i = 0; i < m->num_devices; i++)
+    {
+        struct MB_device *dev = &m->devices[i];
+        if (dev->group_leader != dev)
+        {
+            length = snprintf(line, sizeof(line), "device %d name %s polled_with %d\n", i, dev->dev_name, dev->group_leader->index);
+            if (writer(context, line, length) < 0) return;
+            continue;
+        }
+
+        length = snprintf(line, sizeof(line), "device %d name %s reconnects %llu connect_failures %llu\n", i, dev->dev_name,
+                          (unsigned long long)dev->stats.reconnects.load(std::memory_order_relaxed),
+                          (unsigned long long)dev->stats.connect_failures.load(std::memory_order_relaxed));
+        if (writer(context, line, length) < 0) return;
+
+        for (int b = 0; b < MB_BLOCK_TYPES; b++)
+        {
+            struct MB_stats_summary summary;
+            summarizeStats(dev, b, b, &summary);
+            if (summary.requests == 0) continue;
+
+            length = snprintf(line, sizeof(line), "block %d %s requests %llu errors %llu timeouts %llu min_us %llu avg_us %llu p99_us %llu max_us %llu\n",
+                              i, block_names[b], (unsigned long long)summary.requests, (unsigned long long)summary.errors,
+                              (unsigned long long)summary.timeouts, (unsigned long long)summary.min_us, (unsigned long long)summary.avg_us,
+                              (unsigned long long)summary.p99_us, (unsigned long long)summary.max_us);
+            if (writer(context, line, length) < 0) return;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Sends the statistics of the slave devices to a client. Each device has a
+// line with its connection counters, followed by a line per block type that
+// had traffic. Devices polled with another one (polled_with) have their
+// requests counted on that device
+//-----------------------------------------------------------------------------
+void sendMBStats(LogWriter writer, void *context)
+{
+    char line[512];
+    int length;
+
+    if (scan_sync_offset > 0)
+    {
+        length = snprintf(line, sizeof(line), "scan_sync offset_us %d deadline_us %d scans %llu late_scans %llu\n",
+                          scan_sync_offset, scan_sync_deadline,
+                          (unsigned long long)sync_scans.load(std::memory_order_relaxed),
+                          (unsigned long long)sync_late_scans.load(std::memory_order_relaxed));
+        if (writer(context, line, length) < 0) return;
+    }
+
+    struct MB_master *m = acquireMaster();
+    if (m == NULL) return;
+    sendDeviceStats(m, writer, context);
+    releaseMaster(m);
+}
+
+//-----------------------------------------------------------------------------
+// Returns true if a gateway entry was completed less than max_age ms ago
+//-----------------------------------------------------------------------------
+static bool gatewayEntryFresh(struct MB_gateway_entry *entry, int max_age)
+{
+    if (entry->completed.tv_sec == 0 && entry->completed.tv_nsec == 0) return false;
+
+    struct timespec now, expires = entry->completed;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    addMilliseconds(&expires, max_age);
+    return timeBefore(&now, &expires);
+}
+
+//-----------------------------------------------------------------------------
+// Builds the response to a gateway request on the request frame, from the
+// answer held by its entry. Returns the length of the response
+//-----------------------------------------------------------------------------
+static int gatewayResponse(unsigned char *buffer, struct MB_gateway_entry *entry, int exception)
+{
+    int length;
+
+    if (exception != 0)
+    {
+        buffer[7] |= 0x80;
+        buffer[8] = exception;
+        length = 9;
+    }
+    else if (entry->write)
+    {
+        //the response echoes the address and the value or quantity
+        length = 12;
+    }
+    else if (entry->function == MODBUS_FC_READ_COILS || entry->function == MODBUS_FC_READ_DISCRETE_INPUTS)
+    {
+        int byte_count = (entry->count + 7) / 8;
+        buffer[8] = byte_count;
+        memset(&buffer[9], 0, byte_count);
+        for (int i = 0; i < entry->count; i++)
+        {
+            if (entry->bits[i]) buffer[9 + i / 8] |= 1 << (i % 8);
+        }
+        length = 9 + byte_count;
+    }
+    else
+    {
+        buffer[8] = 2 * entry->count;
+        for (int i = 0; i < entry->count; i++)
+        {
+            buffer[9 + 2*i] = entry->registers[i] >> 8;
+            buffer[10 + 2*i] = entry->registers[i] & 0xFF;
+        }
+        length = 9 + 2 * entry->count;
+    }
+
+    buffer[4] = (length - 6) >> 8;
+    buffer[5] = (length - 6) & 0xFF;
+    return length;
+}
+
+//-----------------------------------------------------------------------------
+// Checks the request of a gateway client and fills the fields of a new entry
+// for it. Returns 0, or the exception code if the request is not valid
+//-----------------------------------------------------------------------------
+static int parseGatewayRequest(unsigned char *buffer, int bufferSize, struct MB_gateway_entry *request)
+{
+    if (bufferSize < 12) return MB_EXCEPTION_ILLEGAL_VALUE;
+
+    request->function = buffer[7];
+    request->address = ((uint16_t)buffer[8] << 8) | buffer[9];
+    request->count = ((uint16_t)buffer[10] << 8) | buffer[11];
+    request->write = false;
+
+    int max_count;
+    switch (request->function)
+    {
+        case MODBUS_FC_READ_COILS:
+        case MODBUS_FC_READ_DISCRETE_INPUTS:    max_count = MODBUS_MAX_READ_BITS; break;
+        case MODBUS_FC_READ_HOLDING_REGISTERS:
+        case MODBUS_FC_READ_INPUT_REGISTERS:    max_count = MODBUS_MAX_READ_REGISTERS; break;
+
+        case MODBUS_FC_WRITE_SINGLE_COIL:
+            request->write = true;
+            request->bits[0] = (request->count == 0xFF00);
+            request->count = 1;
+            return 0;
+
+        case MODBUS_FC_WRITE_SINGLE_REGISTER:
+            request->write = true;
+            request->registers[0] = request->count;
+            request->count = 1;
+            return 0;
+
+        case MODBUS_FC_WRITE_MULTIPLE_COILS:
+            request->write = true;
+            if (request->count < 1 || request->count > MODBUS_MAX_WRITE_BITS || bufferSize < 13 + (request->count + 7) / 8)
+            {
+                return MB_EXCEPTION_ILLEGAL_VALUE;
+            }
+            for (int i = 0; i < request->count; i++)
+            {
+                request->bits[i] = (buffer[13 + i / 8] >> (i % 8)) & 1;
+            }
+            return 0;
+
+        case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+            request->write = true;
+            if (request->count < 1 || request->count > MODBUS_MAX_WRITE_REGISTERS || bufferSize < 13 + 2 * request->count)
+            {
+                return MB_EXCEPTION_ILLEGAL_VALUE;
+            }
+            for (int i = 0; i < request->count; i++)
+            {
+                request->registers[i] = ((uint16_t)buffer[13 + 2*i] << 8) | buffer[14 + 2*i];
+            }
+            return 0;
+
+        default:
+            return MB_EXCEPTION_ILLEGAL_FUNCTION;
+    }
+
+    if (request->count < 1 || request->count > max_count) return MB_EXCEPTION_ILLEGAL_VALUE;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Finds a free gateway entry: an empty one, or else the least recently
+// completed read that no client is waiting for. Returns NULL if all are busy
+//-----------------------------------------------------------------------------
+static struct MB_gateway_entry *allocateGatewayEntry(struct MB_gateway *gateway)
+{
+    struct MB_gateway_entry *oldest = NULL;
+    for (int e = 0; e < MB_GATEWAY_ENTRIES; e++)
+    {
+        struct MB_gateway_entry *entry = &gateway->entries[e];
+        if (entry->state == MB_GATEWAY_EMPTY) return entry;
+        if (entry->state == MB_GATEWAY_DONE && !entry->write && entry->waiters == 0 &&
+            (oldest == NULL || timeBefore(&entry->completed, &oldest->completed)))
+        {
+            oldest = entry;
+        }
+    }
+    return oldest;
+}
+
+//-----------------------------------------------------------------------------
+// Passes a request to the bus thread of a gateway device and waits for the
+// answer. The response is built on the request frame
+//-----------------------------------------------------------------------------
+static int forwardGatewayMessage(struct MB_device *dev, unsigned char *buffer, int bufferSize)
+{
+    struct MB_gateway *gateway = dev->bus->gateway;
+    static thread_local struct MB_gateway_entry request;
+    int exception = parseGatewayRequest(buffer, bufferSize, &request);
+    if (exception != 0) return gatewayResponse(buffer, &request, exception);
+    request.device = dev;
+
+    pthread_mutex_lock(&gateway->lock);
+
+    //a read of the same points shares the entry of the last one
+    struct MB_gateway_entry *entry = NULL;
+    if (!request.write)
+    {
+        for (int e = 0; e < MB_GATEWAY_ENTRIES && entry == NULL; e++)
+        {
+            struct MB_gateway_entry *candidate = &gateway->entries[e];
+            if (candidate->state != MB_GATEWAY_EMPTY && !candidate->write && candidate->device == dev &&
+                candidate->function == request.function && candidate->address == request.address &&
+                candidate->count == request.count)
+            {
+                entry = candidate;
+            }
+        }
+
+        if (entry != NULL && entry->state == MB_GATEWAY_DONE && entry->exception == 0 && gatewayEntryFresh(entry, dev->gateway_max_age))
+        {
+            int length = gatewayResponse(buffer, entry, 0);
+            pthread_mutex_unlock(&gateway->lock);
+            return length;
+        }
+    }
+
+    if (entry == NULL)
+    {
+        entry = allocateGatewayEntry(gateway);
+        if (entry == NULL)
+        {
+            pthread_mutex_unlock(&gateway->lock);
+            return gatewayResponse(buffer, &request, MB_EXCEPTION_BUSY);
+        }
+        memcpy(entry, &request, sizeof(struct MB_gateway_entry));
+        entry->state = MB_GATEWAY_EMPTY;
+        entry->waiters = 0;
+    }
+
+    if (entry->state != MB_GATEWAY_PENDING)
+    {
+        entry->state = MB_GATEWAY_PENDING;
+        entry->exception = 0;
+        gateway->num_pending++;
+        pthread_cond_signal(&gateway->wake);
+    }
 
-    for (int i = 0; i < MAX_MB_IO; i++)
+    //the bus thread may be polling its devices. Wait long enough for a poll
+    //and the request to time out
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    addMilliseconds(&deadline, 4 * timeout + dev->polling_period);
+
+    entry->waiters++;
+    while (entry->state == MB_GATEWAY_PENDING)
     {
-        if (bool_output[100+(i/8)][i%8] != NULL) bool_output_buf[i] = *bool_output[100+(i/8)][i%8];
-        if (int_output[100+i] != NULL) int_output_buf[i] = *int_output[100+i];
+        if (pthread_cond_timedwait(&gateway->done, &gateway->lock, &deadline) == ETIMEDOUT) break;
     }
+    entry->waiters--;
+
+    int length = gatewayResponse(buffer, entry, entry->state == MB_GATEWAY_DONE ? entry->exception : MB_EXCEPTION_TARGET_FAILED);
+    if (entry->write && entry->state == MB_GATEWAY_DONE && entry->waiters == 0) entry->state = MB_GATEWAY_EMPTY;
+
+    pthread_mutex_unlock(&gateway->lock);
+    return length;
+}
+
+//-----------------------------------------------------------------------------
+// Called by the Modbus server for every request. Requests for the unit id of
+// a gateway device are answered through the device, and the response is built
+// on the request frame. Returns the length of the response, or -1 if the unit
+// id is not a gateway unit and the request must be processed locally. The
+// calling server worker waits for the answer of the device
+//-----------------------------------------------------------------------------
+int processGatewayMessage(unsigned char *buffer, int bufferSize)
+{
+    if (bufferSize < 8 || !gateways_configured.load(std::memory_order_relaxed)) return -1;
+
+    struct MB_master *m = acquireMaster();
+    if (m == NULL) return -1;
+
+    int length = -1;
+    struct MB_device *dev = m->gateway_units[buffer[6]];
+    if (dev != NULL) length = forwardGatewayMessage(dev, buffer, bufferSize);
 
-    pthread_mutex_unlock(&ioLock);
+    releaseMaster(m);
+    return length;
 }
@@ -0,0 +1,366 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the Modbus RTU slave. It answers the requests of a
+// serial master the same way the Modbus/TCP server does: each RTU frame is
+// turned into a TCP frame for processModbusMessage(), and its response back
+// into an RTU frame.
+//
+// RTU frames have no length field. A frame ends when the line has been silent
+// for 3.5 character times, so the port is read into a ring as the bytes come
+// and the bytes received up to a silence are taken as a frame. Frames with a
+// bad CRC or for another slave are dropped, broadcasts (slave 0) are
+// processed without an answer.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "ladder.h"
+
+#define RTU_RING_SIZE           4096    // power of two
+#define RTU_MAX_ADU             256     // slave id + PDU + CRC
+#define RTU_MIN_ADU             4       // slave id + function + CRC
+#define RTU_BROADCAST           0
+#define RTU_BUFFER_SIZE         10000   // processModbusMessage() responses, as the TCP server
+#define MBAP_SIZE               7
+#define RTU_IDLE_WAIT_MS        100     // run_modbus_rtu is checked this often
+
+struct RtuPortConfig
+{
+    char device[100];
+    int baud;
+    char parity;
+    int data_bits;
+    int stop_bits;
+    uint8_t slave_id;
+};
+
+struct RtuServerStats
+{
+    unsigned long frames;
+    unsigned long crc_errors;
+    unsigned long overruns;
+    unsigned long other_slaves;
+};
+
+//-----------------------------------------------------------------------------
+// Computes the Modbus CRC-16 of a frame
+//-----------------------------------------------------------------------------
+static uint16_t rtuCrc(const unsigned char *data, int length)
+{
+    uint16_t crc = 0xFFFF;
+    for (int i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the termios speed of a baud rate, or 0 if there is none
+//-----------------------------------------------------------------------------
+static speed_t rtuSpeed(int baud)
+{
+    switch (baud)
+    {
+        case 1200: return B1200;
+        case 2400: return B2400;
+        case 4800: return B4800;
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+#ifdef B230400
+        case 230400: return B230400;
+#endif
+#ifdef B460800
+        case 460800: return B460800;
+#endif
+#ifdef B921600
+        case 921600: return B921600;
+#endif
+        default: return 0;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Parses the port settings: device,baud,parity,data_bits,stop_bits,slave_id
+// e.g. /dev/ttyS0,19200,E,8,1,1. Returns false if they are not valid
+//-----------------------------------------------------------------------------
+static bool parsePortConfig(const char *text, RtuPortConfig *config)
+{
+    int slave_id;
+    if (sscanf(text, "%99[^,],%d,%c,%d,%d,%d", config->device, &config->baud, &config->parity,
+               &config->data_bits, &config->stop_bits, &slave_id) != 6)
+    {
+        return false;
+    }
+    if (config->parity != 'N' && config->parity != 'E' && config->parity != 'O') return false;
+    if (config->data_bits < 5 || config->data_bits > 8) return false;
+    if (config->stop_bits != 1 && config->stop_bits != 2) return false;
+    if (slave_id < 1 || slave_id > 247 || rtuSpeed(config->baud) == 0) return false;
+    config->slave_id = (uint8_t)slave_id;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Opens the serial port in raw mode. Returns the descriptor, or -1
+//-----------------------------------------------------------------------------
+static int openPort(const RtuPortConfig *config)
+{
+    int fd = open(config->device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0) return -1;
+
+    struct termios tios;
+    memset(&tios, 0, sizeof(tios));
+    cfsetispeed(&tios, rtuSpeed(config->baud));
+    cfsetospeed(&tios, rtuSpeed(config->baud));
+
+    tios.c_cflag |= CREAD | CLOCAL;
+    switch (config->data_bits)
+    {
+        case 5: tios.c_cflag |= CS5; break;
+        case 6: tios.c_cflag |= CS6; break;
+        case 7: tios.c_cflag |= CS7; break;
+        default: tios.c_cflag |= CS8; break;
+    }
+    if (config->stop_bits == 2) tios.c_cflag |= CSTOPB;
+    if (config->parity != 'N')
+    {
+        tios.c_cflag |= PARENB;
+        if (config->parity == 'O') tios.c_cflag |= PARODD;
+        tios.c_iflag |= INPCK;
+    }
+    tios.c_cc[VMIN] = 0;
+    tios.c_cc[VTIME] = 0;
+
+    if (tcsetattr(fd, TCSANOW, &tios) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    tcflush(fd, TCIOFLUSH);
+    return fd;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the silence that ends a frame: 3.5 character times, fixed at 1.75ms
+// above 19200 baud by the Modbus serial line spec
+//-----------------------------------------------------------------------------
+static long frameSilenceNs(const RtuPortConfig *config)
+{
+    if (config->baud > 19200) return 1750000;
+
+    //start bit + data bits + parity bit + stop bits
+    int char_bits = 1 + config->data_bits + (config->parity == 'N' ? 0 : 1) + config->stop_bits;
+    return (long)((35LL * char_bits * 1000000000LL) / (10LL * config->baud));
+}
+
+//-----------------------------------------------------------------------------
+// Answers an RTU request. The frame is at buffer + MBAP_SIZE - 1, where its
+// slave id takes the place of the unit id of a TCP frame, so it is processed
+// in place once the MBAP header is written before it
+//-----------------------------------------------------------------------------
+static void processFrame(int fd, unsigned char *buffer, int frame_length, uint8_t slave_id, RtuServerStats *stats)
+{
+    char log_msg[1000];
+    unsigned char *frame = buffer + MBAP_SIZE - 1;
+
+    uint16_t crc = (uint16_t)frame[frame_length - 2] | ((uint16_t)frame[frame_length - 1] << 8);
+    if (rtuCrc(frame, frame_length - 2) != crc)
+    {
+        stats->crc_errors++;
+        return;
+    }
+
+    uint8_t address = frame[0];
+    if (address != slave_id && address != RTU_BROADCAST)
+    {
+        stats->other_slaves++;
+        return;
+    }
+    stats->frames++;
+
+    int pdu_length = frame_length - 3;
+    buffer[0] = 0;
+    buffer[1] = 0;
+    buffer[2] = 0;
+    buffer[3] = 0;
+    buffer[4] = (unsigned char)((pdu_length + 1) >> 8);
+    buffer[5] = (unsigned char)(pdu_length + 1);
+    int response_length = processModbusMessage(buffer, MBAP_SIZE + pdu_length);
+    if (address == RTU_BROADCAST || response_length <= MBAP_SIZE) return;
+
+    //the response PDU follows the unit id, which is the slave id again
+    int adu_length = response_length - MBAP_SIZE + 1;
+    if (adu_length + 2 > RTU_MAX_ADU)
+    {
+        sprintf(log_msg, "Modbus RTU: response of function 0x%02X does not fit an RTU frame\n", frame[1]);
+        openplc_log(log_msg);
+        return;
+    }
+    frame[0] = slave_id;
+    crc = rtuCrc(frame, adu_length);
+    frame[adu_length] = (unsigned char)(crc & 0xFF);
+    frame[adu_length + 1] = (unsigned char)(crc >> 8);
+
+    int written = 0;
+    while (written < adu_length + 2)
+    {
+        ssize_t n = write(fd, frame + written, adu_length + 2 - written);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EINTR)
+            {
+                struct pollfd pfd = { fd, POLLOUT, 0 };
+                poll(&pfd, 1, RTU_IDLE_WAIT_MS);
+                continue;
+            }
+            return;
+        }
+        written += (int)n;
+    }
+    tcdrain(fd);
+}
+
+//-----------------------------------------------------------------------------
+// Runs the Modbus RTU slave on a serial port until run_modbus_rtu is cleared.
+// port_config holds the port settings (see parsePortConfig)
+//-----------------------------------------------------------------------------
+void startModbusRtuServer(const char *port_config)
+{
+    char log_msg[1000];
+    RtuPortConfig config;
+    RtuServerStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    if (!parsePortConfig(port_config, &config))
+    {
+        sprintf(log_msg, "Modbus RTU: invalid port settings '%s'\n", port_config);
+        openplc_log(log_msg);
+        return;
+    }
+
+    int fd = openPort(&config);
+    if (fd < 0)
+    {
+        sprintf(log_msg, "Modbus RTU: failed to open %s: %s\n", config.device, strerror(errno));
+        openplc_log(log_msg);
+        return;
+    }
+    sprintf(log_msg, "Modbus RTU slave %d listening on %s at %d baud\n", config.slave_id, config.device, config.baud);
+    openplc_log(log_msg);
+
+    //the ring and the frame buffer are allocated once, nothing is allocated
+    //per frame
+    unsigned char *ring = (unsigned char *)malloc(RTU_RING_SIZE);
+    unsigned char *buffer = (unsigned char *)malloc(RTU_BUFFER_SIZE);
+    unsigned int head = 0;          // next byte written by read()
+    unsigned int frame_start = 0;   // first byte of the frame being received
+    bool dropping = false;          // the frame is too long, dropped at the silence
+
+    struct timespec silence;
+    long silence_ns = frameSilenceNs(&config);
+    silence.tv_sec = silence_ns / 1000000000L;
+    silence.tv_nsec = silence_ns % 1000000000L;
+    struct timespec idle;
+    idle.tv_sec = RTU_IDLE_WAIT_MS / 1000;
+    idle.tv_nsec = (RTU_IDLE_WAIT_MS % 1000) * 1000000L;
+
+    while (run_modbus_rtu && run_openplc)
+    {
+        //while a frame is coming in, wait only as long as the silence that
+        //ends it
+        bool receiving = (head != frame_start || dropping);
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int ready = ppoll(&pfd, 1, receiving ? &silence : &idle, NULL);
+        if (ready < 0)
+        {
+            if (errno == EINTR) continue;
+            sprintf(log_msg, "Modbus RTU: error waiting on %s: %s\n", config.device, strerror(errno));
+            openplc_log(log_msg);
+            break;
+        }
+
+        if (ready > 0)
+        {
+            if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+            {
+                sprintf(log_msg, "Modbus RTU: %s was closed\n", config.device);
+                openplc_log(log_msg);
+                break;
+            }
+
+            unsigned int index = head & (RTU_RING_SIZE - 1);
+            unsigned int room = RTU_RING_SIZE - index;
+            ssize_t n = read(fd, ring + index, room);
+            if (n > 0) head += (unsigned int)n;
+
+            //a frame longer than any RTU frame is line noise, dropped
+            //until the next silence
+            if (head - frame_start > RTU_MAX_ADU)
+            {
+                dropping = true;
+                frame_start = head;
+            }
+            continue;
+        }
+
+        if (!receiving) continue;
+
+        //silence: the bytes since frame_start are a frame
+        int frame_length = (int)(head - frame_start);
+        if (!dropping && frame_length >= RTU_MIN_ADU)
+        {
+            unsigned char *frame = buffer + MBAP_SIZE - 1;
+            for (int i = 0; i < frame_length; i++)
+            {
+                frame[i] = ring[(frame_start + i) & (RTU_RING_SIZE - 1)];
+            }
+            processFrame(fd, buffer, frame_length, config.slave_id, &stats);
+        }
+        else
+        {
+            stats.overruns++;
+        }
+        frame_start = head;
+        dropping = false;
+    }
+
+    sprintf(log_msg, "Modbus RTU slave stopped: %lu frames, %lu CRC errors, %lu bad frames, %lu for other slaves\n",
+            stats.frames, stats.crc_errors, stats.overruns, stats.other_slaves);
+    openplc_log(log_msg);
+
+    free(buffer);
+    free(ring);
+    close(fd);
+}
@@ -0,0 +1,303 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the monitoring feed of the web dashboard. A client
+// of the interactive server subscribes to a list of locations and from then
+// on its connection carries one update per published process image: the
+// version (tick) and timestamp of the snapshot, followed by the locations
+// whose values changed since the previous update. The first update carries
+// every location. Only the locations on blocks the scans changed are read.
+//
+// Updates look like:
+//
+//     tick 1234 1767225600000
+//     IX0.0 1
+//     MD3 1078530011
+//
+// Values are the raw bits of the location, as unsigned integers. The stream
+// ends when the client sends anything or closes the connection.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <poll.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+#include "ladder.h"
+
+#define MONITOR_MAX_POINTS      4096
+#define MONITOR_LINE_SIZE       40
+#define MONITOR_HEARTBEAT       1000
+
+struct MonitorPoint
+{
+    char name[16];
+    size_t source;
+    uint8_t size;
+    uint8_t area;
+    uint8_t bit;
+    uint16_t index;
+    uint64_t last;
+};
+
+//-----------------------------------------------------------------------------
+// Parses one location of the process image ([%]IX0.0, QW3, ...) into a
+// point. The source is left at the start of its area. Returns a pointer past
+// the location, or NULL if it isn't one
+//-----------------------------------------------------------------------------
+static const char *parsePoint(const char *text, MonitorPoint *point)
+{
+    if (*text == '%') text++;
+    char area = *text++;
+    char width = *text++;
+    if (!isdigit((unsigned char)*text)) return NULL;
+
+    char *end;
+    long value = strtol(text, &end, 10);
+    long bit = 0;
+    if (width == 'X')
+    {
+        if (*end != '.' || !isdigit((unsigned char)end[1])) return NULL;
+        bit = strtol(end + 1, &end, 10);
+        if (bit > 7) return NULL;
+    }
+    if (value >= BUFFER_SIZE) return NULL;
+
+    if (area == 'I' && width == 'X') point->area = PI_BOOL_INPUT;
+    else if (area == 'Q' && width == 'X') point->area = PI_BOOL_OUTPUT;
+    else if (area == 'I' && width == 'W') point->area = PI_INT_INPUT;
+    else if (area == 'Q' && width == 'W') point->area = PI_INT_OUTPUT;
+    else if (area == 'M' && width == 'W') point->area = PI_INT_MEMORY;
+    else if (area == 'M' && width == 'D') point->area = PI_DINT_MEMORY;
+    else if (area == 'M' && width == 'L') point->area = PI_LINT_MEMORY;
+    else return NULL;
+
+    switch (point->area)
+    {
+        case PI_BOOL_INPUT: point->source = offsetof(ProcessImageSnapshot, bool_input); break;
+        case PI_BOOL_OUTPUT: point->source = offsetof(ProcessImageSnapshot, bool_output); break;
+        case PI_INT_INPUT: point->source = offsetof(ProcessImageSnapshot, int_input); break;
+        case PI_INT_OUTPUT: point->source = offsetof(ProcessImageSnapshot, int_output); break;
+        case PI_INT_MEMORY: point->source = offsetof(ProcessImageSnapshot, int_memory); break;
+        case PI_DINT_MEMORY: point->source = offsetof(ProcessImageSnapshot, dint_memory); break;
+        default: point->source = offsetof(ProcessImageSnapshot, lint_memory); break;
+    }
+
+    switch (width)
+    {
+        case 'X': point->size = 1; break;
+        case 'W': point->size = 2; break;
+        case 'D': point->size = 4; break;
+        default: point->size = 8; break;
+    }
+    point->index = (uint16_t)value;
+    point->bit = (uint8_t)bit;
+    return end;
+}
+
+//-----------------------------------------------------------------------------
+// Expands a list of locations and ranges ("%IX0.0-%IX0.7, QW0, MD2-MD5") into
+// points. Returns the number of points, or -1 if the list is malformed
+//-----------------------------------------------------------------------------
+static int parsePoints(const char *text, MonitorPoint *points, int max_points)
+{
+    static const char *prefixes[] = {"IX", "QX", "IW", "QW", "MW", "MD", "ML"};
+    int count = 0;
+
+    while (*text && *text != ')')
+    {
+        if (*text == ',' || isspace((unsigned char)*text))
+        {
+            text++;
+            continue;
+        }
+
+        MonitorPoint first, last;
+        text = parsePoint(text, &first);
+        if (text == NULL) return -1;
+        last = first;
+        if (*text == '-')
+        {
+            text = parsePoint(text + 1, &last);
+            if (text == NULL || last.area != first.area) return -1;
+        }
+
+        // Position of the value on its area, in bits for the booleans
+        bool boolean = first.size == 1;
+        int from = boolean ? first.index * 8 + first.bit : first.index;
+        int to = boolean ? last.index * 8 + last.bit : last.index;
+        for (int position = from; position <= to; position++)
+        {
+            if (count == max_points) return -1;
+            MonitorPoint *point = &points[count++];
+            *point = first;
+            point->index = (uint16_t)(boolean ? position / 8 : position);
+            point->bit = (uint8_t)(boolean ? position % 8 : 0);
+            point->source = first.source + (size_t)position * first.size;
+            if (boolean) snprintf(point->name, sizeof(point->name), "%s%d.%d", prefixes[first.area], point->index, point->bit);
+            else snprintf(point->name, sizeof(point->name), "%s%d", prefixes[first.area], point->index);
+        }
+    }
+    return count;
+}
+
+static uint64_t readPoint(const uint8_t *base, const MonitorPoint *point)
+{
+    const uint8_t *value = base + point->source;
+    switch (point->size)
+    {
+        case 1: return *value != 0;
+        case 2: return *(const uint16_t *)value;
+        case 4: return *(const uint32_t *)value;
+        default: return *(const uint64_t *)value;
+    }
+}
+
+static uint64_t monotonicMs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+//-----------------------------------------------------------------------------
+// Returns true once the client sent something or closed the connection
+//-----------------------------------------------------------------------------
+static bool clientLeft(int client_fd)
+{
+    struct pollfd pfd = {client_fd, POLLIN, 0};
+    return poll(&pfd, 1, 0) != 0;
+}
+
+//-----------------------------------------------------------------------------
+// Streams the locations of a monitor_subscribe(interval,points) command to
+// the client until it leaves. Updates are sent at most once every interval
+// ms (0: on every scan) and, with nothing changing, a bare tick line goes out
+// every second so the client can tell the stream is alive
+//-----------------------------------------------------------------------------
+void sendMonitorStream(LogWriter writer, void *context, int client_fd, const char *arguments)
+{
+    char log_msg[1000];
+    char *end;
+    long interval = strtol(arguments, &end, 10);
+    if (end == arguments || *end != ',' || interval < 0)
+    {
+        const char *error = "Error: invalid monitor subscription\n";
+        writer(context, error, strlen(error));
+        return;
+    }
+
+    MonitorPoint *points = (MonitorPoint *)malloc(MONITOR_MAX_POINTS * sizeof(MonitorPoint));
+    uint64_t *sampled = (uint64_t *)malloc(MONITOR_MAX_POINTS * sizeof(uint64_t));
+    int count = points != NULL && sampled != NULL ? parsePoints(end + 1, points, MONITOR_MAX_POINTS) : -1;
+    char *update = count > 0 ? (char *)malloc(64 + (size_t)count * MONITOR_LINE_SIZE) : NULL;
+    if (update == NULL)
+    {
+        const char *error = "Error: invalid monitor subscription\n";
+        writer(context, error, strlen(error));
+        free(points);
+        free(sampled);
+        return;
+    }
+
+    sprintf(log_msg, "Monitor: client %d subscribed to %d locations\n", client_fd, count);
+    openplc_log(log_msg);
+
+    bool first = true;
+    uint32_t version = 0;
+    uint64_t last_sent = 0;
+    while (run_openplc && !clientLeft(client_fd))
+    {
+        uint32_t current = waitProcessImage(version + getLoadShedStep(), 250);
+        if (!first && current == version)
+        {
+            // No scan published, keep the client informed anyway
+            if (monotonicMs() - last_sent < MONITOR_HEARTBEAT) continue;
+        }
+        else if (!first && interval > 0)
+        {
+            uint64_t elapsed = monotonicMs() - last_sent;
+            if (elapsed < (uint64_t)interval) sleepms((int)(interval - elapsed));
+        }
+
+        uint32_t sequence;
+        const ProcessImageSnapshot *snap;
+        ProcessImageChanges changes;
+        uint64_t timestamp;
+        do
+        {
+            snap = beginProcessImageRead(&sequence);
+            current = snap->version;
+            timestamp = snap->timestamp;
+            if (first) memset(&changes, 0xFF, sizeof(changes));
+            else getProcessImageChanges(version, current, &changes);
+            for (int i = 0; i < count; i++)
+            {
+                if (processImageChanged(&changes, points[i].source, points[i].size))
+                {
+                    sampled[i] = readPoint((const uint8_t *)snap, &points[i]);
+                }
+            }
+        } while (!endProcessImageRead(snap, sequence));
+
+        size_t length = sprintf(update, "tick %u %llu\n", current, (unsigned long long)timestamp);
+        for (int i = 0; i < count; i++)
+        {
+            MonitorPoint *point = &points[i];
+            if (!processImageChanged(&changes, point->source, point->size)) continue;
+            if (!first && sampled[i] == point->last) continue;
+            point->last = sampled[i];
+            length += sprintf(update + length, "%s %llu\n", point->name, (unsigned long long)sampled[i]);
+        }
+
+        if (writer(context, update, length) < 0) break;
+        version = current;
+        last_sent = monotonicMs();
+        first = false;
+    }
+
+    sprintf(log_msg, "Monitor: client %d unsubscribed\n", client_fd);
+    openplc_log(log_msg);
+    free(update);
+    free(points);
+    free(sampled);
+}
+
+//-----------------------------------------------------------------------------
+// Queues a write to an output or memory location from the monitoring page.
+// Returns false if the location can't be written or the queue is full
+//-----------------------------------------------------------------------------
+bool writeMonitorPoint(const char *location, uint64_t value)
+{
+    MonitorPoint point;
+    const char *end = parsePoint(location, &point);
+    if (end == NULL || *end != '\0') return false;
+    if (point.area == PI_BOOL_INPUT || point.area == PI_INT_INPUT) return false;
+
+    ProcessImageWrite write;
+    write.area = point.area;
+    write.index = point.index;
+    write.bit = point.bit;
+    write.value = point.size == 1 ? (value != 0) : value;
+    write.mask = point.size == 8 ? ~0ULL : (1ULL << (point.size * 8)) - 1;
+    return queueProcessImageWrites(&write, 1) >= 0;
+}
@@ -0,0 +1,1072 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements an MQTT client that publishes the process image as a
+// Sparkplug B edge node. The metrics configured on mqtt.cfg are announced on
+// NBIRTH with their names and aliases, and from then on only the metrics
+// that changed are sent, many per NDATA message, by alias. The will message
+// is the NDEATH of the session.
+//
+// One thread owns the socket, which is non-blocking. It follows the process
+// image through its change sets, so metrics on blocks the scan didn't touch
+// are not even read, and it never blocks on a slow broker: messages that
+// don't fit on the send buffer are dropped and their metrics sent later.
+// MQTT 3.1.1 and the Sparkplug protobuf payload are encoded here, only QoS 0
+// is used for the data and there is no TLS.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "ladder.h"
+
+#define MQTT_CONFIG_FILE        "mqtt.cfg"
+#define MQTT_MAX_METRICS        4096
+#define MQTT_RX_BUFFER          65536
+#define MQTT_MAX_BACKOFF        30000
+#define MQTT_REBIRTH_METRIC     "Node Control/Rebirth"
+
+// MQTT control packets
+#define MQTT_CONNECT            0x10
+#define MQTT_CONNACK            0x20
+#define MQTT_PUBLISH            0x30
+#define MQTT_SUBSCRIBE          0x82
+#define MQTT_SUBACK             0x90
+#define MQTT_PINGREQ            0xC0
+#define MQTT_PINGRESP           0xD0
+#define MQTT_DISCONNECT         0xE0
+
+// Sparkplug B data types
+#define SPB_UINT16              6
+#define SPB_UINT32              7
+#define SPB_UINT64              8
+#define SPB_BOOLEAN             11
+
+// Fields of the Sparkplug B Payload and Metric messages
+#define PAYLOAD_TIMESTAMP       1
+#define PAYLOAD_METRICS         2
+#define PAYLOAD_SEQ             3
+#define METRIC_NAME             1
+#define METRIC_ALIAS            2
+#define METRIC_DATATYPE         4
+#define METRIC_INT_VALUE        10
+#define METRIC_LONG_VALUE       11
+#define METRIC_FLOAT_VALUE      12
+#define METRIC_DOUBLE_VALUE     13
+#define METRIC_BOOLEAN_VALUE    14
+
+// Protobuf wire types
+#define WIRE_VARINT             0
+#define WIRE_FIXED64            1
+#define WIRE_BYTES              2
+#define WIRE_FIXED32            5
+
+struct MqttMetric
+{
+    char name[16];
+    size_t source;      // offset on ProcessImageSnapshot
+    uint8_t size;
+    uint8_t datatype;
+    uint8_t area;       // PI_* area for the writes of NCMD
+    uint8_t bit;
+    uint16_t index;
+    uint64_t last;      // last value sent
+    bool pending;       // changed and not sent yet
+};
+
+struct MqttConfig
+{
+    char broker[256];
+    char port[8];
+    char client_id[128];
+    char username[128];
+    char password[128];
+    char group_id[64];
+    char edge_node_id[64];
+    int keepalive;
+    int interval_ms;
+    bool writable;
+};
+
+// Growable byte buffer used to encode payloads and packets
+struct MqttBuffer
+{
+    uint8_t *data;
+    size_t length;
+    size_t capacity;
+};
+
+static MqttConfig config;
+static MqttMetric *metrics = NULL;
+static uint64_t *sampled = NULL;       // values read from the last snapshot
+static int metric_count = 0;
+
+static pthread_t mqtt_thread;
+static volatile bool mqtt_running = false;
+static int mqtt_socket = -1;
+static bool mqtt_connected = false;    // CONNACK received
+static MqttBuffer tx = {NULL, 0, 0};
+static size_t tx_limit = 0;
+static uint8_t rx[MQTT_RX_BUFFER];
+static size_t rx_length = 0;
+
+static uint64_t bd_seq = 0;
+static uint8_t message_seq = 0;
+static uint32_t image_version = 0;
+static bool birth_needed = false;
+static struct timespec last_received;
+
+//-----------------------------------------------------------------------------
+// Milliseconds elapsed between two times
+//-----------------------------------------------------------------------------
+static long long elapsedMs(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000LL + (to->tv_nsec - from->tv_nsec) / 1000000;
+}
+
+//-----------------------------------------------------------------------------
+// Buffer helpers. Appending never fails, the buffer grows as needed
+//-----------------------------------------------------------------------------
+static void reserve(MqttBuffer *buffer, size_t extra)
+{
+    if (buffer->length + extra <= buffer->capacity) return;
+    size_t capacity = buffer->capacity ? buffer->capacity : 1024;
+    while (capacity < buffer->length + extra) capacity *= 2;
+    buffer->data = (uint8_t *)realloc(buffer->data, capacity);
+    buffer->capacity = capacity;
+}
+
+static void putByte(MqttBuffer *buffer, uint8_t value)
+{
+    reserve(buffer, 1);
+    buffer->data[buffer->length++] = value;
+}
+
+static void putBytes(MqttBuffer *buffer, const void *data, size_t length)
+{
+    reserve(buffer, length);
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+}
+
+static void putVarint(MqttBuffer *buffer, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        putByte(buffer, (uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    putByte(buffer, (uint8_t)value);
+}
+
+// MQTT strings have a 16-bit big endian length
+static void putString(MqttBuffer *buffer, const char *text)
+{
+    size_t length = strlen(text);
+    putByte(buffer, (uint8_t)(length >> 8));
+    putByte(buffer, (uint8_t)length);
+    putBytes(buffer, text, length);
+}
+
+//-----------------------------------------------------------------------------
+// Protobuf encoders for the Sparkplug payload
+//-----------------------------------------------------------------------------
+static void pbVarint(MqttBuffer *buffer, int field, uint64_t value)
+{
+    putVarint(buffer, (uint64_t)(field << 3 | WIRE_VARINT));
+    putVarint(buffer, value);
+}
+
+static void pbString(MqttBuffer *buffer, int field, const char *text)
+{
+    size_t length = strlen(text);
+    putVarint(buffer, (uint64_t)(field << 3 | WIRE_BYTES));
+    putVarint(buffer, length);
+    putBytes(buffer, text, length);
+}
+
+// Encodes a metric as a field of the payload. The value is encoded on the
+// field that matches its data type
+static void pbMetric(MqttBuffer *payload, const char *name, uint64_t alias, uint32_t datatype, uint64_t value)
+{
+    uint8_t encoded[192];
+    MqttBuffer metric = {encoded, 0, sizeof(encoded)};
+    if (name != NULL) pbString(&metric, METRIC_NAME, name);
+    pbVarint(&metric, METRIC_ALIAS, alias);
+    if (name != NULL) pbVarint(&metric, METRIC_DATATYPE, datatype);
+    if (datatype == SPB_BOOLEAN) pbVarint(&metric, METRIC_BOOLEAN_VALUE, value != 0);
+    else if (datatype == SPB_UINT64) pbVarint(&metric, METRIC_LONG_VALUE, value);
+    else pbVarint(&metric, METRIC_INT_VALUE, value);
+
+    putVarint(payload, (uint64_t)(PAYLOAD_METRICS << 3 | WIRE_BYTES));
+    putVarint(payload, metric.length);
+    putBytes(payload, metric.data, metric.length);
+}
+
+//-----------------------------------------------------------------------------
+// Sparkplug topic of a message type of this edge node
+//-----------------------------------------------------------------------------
+static void nodeTopic(char *topic, size_t size, const char *type)
+{
+    snprintf(topic, size, "spBv1.0/%s/%s/%s", config.group_id, type, config.edge_node_id);
+}
+
+//-----------------------------------------------------------------------------
+// Parses one location of the process image into a metric. The source is
+// left at the start of its area. Returns a pointer past the location, or
+// NULL if it isn't one
+//-----------------------------------------------------------------------------
+static const char *parseMetric(const char *text, MqttMetric *metric)
+{
+    if (*text == '%') text++;
+    char area = *text++;
+    char width = *text++;
+    if (!isdigit((unsigned char)*text)) return NULL;
+
+    char *end;
+    long value = strtol(text, &end, 10);
+    long bit = 0;
+    if (width == 'X')
+    {
+        if (*end != '.' || !isdigit((unsigned char)end[1])) return NULL;
+        bit = strtol(end + 1, &end, 10);
+        if (bit > 7) return NULL;
+    }
+    if (value >= BUFFER_SIZE) return NULL;
+
+    if (area == 'I' && width == 'X')
+    {
+        metric->source = offsetof(ProcessImageSnapshot, bool_input);
+        metric->area = PI_BOOL_INPUT;
+    }
+    else if (area == 'Q' && width == 'X')
+    {
+        metric->source = offsetof(ProcessImageSnapshot, bool_output);
+        metric->area = PI_BOOL_OUTPUT;
+    }
+    else if (area == 'I' && width == 'W')
+    {
+        metric->source = offsetof(ProcessImageSnapshot, int_input);
+        metric->area = PI_INT_INPUT;
+    }
+    else if (area == 'Q' && width == 'W')
+    {
+        metric->source = offsetof(ProcessImageSnapshot, int_output);
+        metric->area = PI_INT_OUTPUT;
+    }
+    else if (area == 'M' && width == 'W')
+    {
+        metric->source = offsetof(ProcessImageSnapshot, int_memory);
+        metric->area = PI_INT_MEMORY;
+    }
+    else if (area == 'M' && width == 'D')
+    {
+        metric->source = offsetof(ProcessImageSnapshot, dint_memory);
+        metric->area = PI_DINT_MEMORY;
+    }
+    else if (area == 'M' && width == 'L')
+    {
+        metric->source = offsetof(ProcessImageSnapshot, lint_memory);
+        metric->area = PI_LINT_MEMORY;
+    }
+    else return NULL;
+
+    switch (width)
+    {
+        case 'X': metric->size = 1; metric->datatype = SPB_BOOLEAN; break;
+        case 'W': metric->size = 2; metric->datatype = SPB_UINT16; break;
+        case 'D': metric->size = 4; metric->datatype = SPB_UINT32; break;
+        default: metric->size = 8; metric->datatype = SPB_UINT64; break;
+    }
+    metric->index = (uint16_t)value;
+    metric->bit = (uint8_t)bit;
+    return end;
+}
+
+//-----------------------------------------------------------------------------
+// Appends the metrics of a "metrics = %IX0.0-%IX0.7, %QW0" line. Ranges of
+// booleans go through every bit. Returns false if the list is malformed
+//-----------------------------------------------------------------------------
+static bool parseMetrics(const char *text)
+{
+    static const char *prefixes[] = {"IX", "QX", "IW", "QW", "MW", "MD", "ML"};
+
+    while (*text)
+    {
+        if (*text == ',' || isspace((unsigned char)*text))
+        {
+            text++;
+            continue;
+        }
+
+        MqttMetric first, last;
+        text = parseMetric(text, &first);
+        if (text == NULL) return false;
+        last = first;
+        if (*text == '-')
+        {
+            text = parseMetric(text + 1, &last);
+            if (text == NULL || last.area != first.area) return false;
+        }
+
+        // Position of the value on its area, in bits for the booleans
+        bool boolean = first.size == 1;
+        int from = boolean ? first.index * 8 + first.bit : first.index;
+        int to = boolean ? last.index * 8 + last.bit : last.index;
+        for (int position = from; position <= to; position++)
+        {
+            if (metric_count == MQTT_MAX_METRICS) return false;
+            MqttMetric *metric = &metrics[metric_count++];
+            *metric = first;
+            metric->index = (uint16_t)(boolean ? position / 8 : position);
+            metric->bit = (uint8_t)(boolean ? position % 8 : 0);
+            metric->source = first.source + (size_t)position * first.size;
+            if (boolean) snprintf(metric->name, sizeof(metric->name), "%s%d.%d", prefixes[first.area], metric->index, metric->bit);
+            else snprintf(metric->name, sizeof(metric->name), "%s%d", prefixes[first.area], metric->index);
+        }
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Applies one setting of mqtt.cfg
+//-----------------------------------------------------------------------------
+static void applyMqttSetting(const char *section, char *key, char *value, void *context)
+{
+    char log_msg[1000];
+    if (key == NULL) return;
+
+    if (strcmp(key, "broker") == 0) strncpy(config.broker, value, sizeof(config.broker) - 1);
+    else if (strcmp(key, "port") == 0) strncpy(config.port, value, sizeof(config.port) - 1);
+    else if (strcmp(key, "client_id") == 0) strncpy(config.client_id, value, sizeof(config.client_id) - 1);
+    else if (strcmp(key, "username") == 0) strncpy(config.username, value, sizeof(config.username) - 1);
+    else if (strcmp(key, "password") == 0) strncpy(config.password, value, sizeof(config.password) - 1);
+    else if (strcmp(key, "group_id") == 0) strncpy(config.group_id, value, sizeof(config.group_id) - 1);
+    else if (strcmp(key, "edge_node_id") == 0) strncpy(config.edge_node_id, value, sizeof(config.edge_node_id) - 1);
+    else if (strcmp(key, "keepalive") == 0) config.keepalive = atoi(value);
+    else if (strcmp(key, "interval") == 0) config.interval_ms = atoi(value);
+    else if (strcmp(key, "writable") == 0) config.writable = strcmp(value, "true") == 0;
+    else if (strcmp(key, "metrics") == 0)
+    {
+        if (!parseMetrics(value))
+        {
+            sprintf(log_msg, "MQTT: invalid or too many metrics on '%s'\n", value);
+            openplc_log(log_msg);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Reads mqtt.cfg. Returns false if the file is missing or declares no
+// metric, in which case the client isn't started
+//-----------------------------------------------------------------------------
+static bool loadMqttConfig()
+{
+    memset(&config, 0, sizeof(config));
+    strcpy(config.broker, "127.0.0.1");
+    strcpy(config.port, "1883");
+    strcpy(config.group_id, "OpenPLC");
+    strcpy(config.edge_node_id, "openplc");
+    config.keepalive = 30;
+    config.interval_ms = 100;
+    metric_count = 0;
+    if (metrics == NULL)
+    {
+        metrics = (MqttMetric *)calloc(MQTT_MAX_METRICS, sizeof(MqttMetric));
+        sampled = (uint64_t *)calloc(MQTT_MAX_METRICS, sizeof(uint64_t));
+    }
+
+    if (!parseSettingsFile(MQTT_CONFIG_FILE, applyMqttSetting, NULL)) return false;
+
+    if (config.client_id[0] == '\0') snprintf(config.client_id, sizeof(config.client_id), "%s-%s", config.group_id, config.edge_node_id);
+    if (config.keepalive < 5) config.keepalive = 5;
+    if (config.interval_ms < 10) config.interval_ms = 10;
+    return metric_count > 0;
+}
+
+//-----------------------------------------------------------------------------
+// Appends an MQTT packet to the send buffer. Returns false, leaving the
+// buffer as it was, if the broker is so far behind that it doesn't fit
+//-----------------------------------------------------------------------------
+static bool queuePacket(uint8_t type, const MqttBuffer *body)
+{
+    if (tx.length + body->length + 5 > tx_limit) return false;
+    putByte(&tx, type);
+    putVarint(&tx, body->length);
+    putBytes(&tx, body->data, body->length);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Queues a QoS 0 publish of a Sparkplug payload
+//-----------------------------------------------------------------------------
+static bool queuePublish(const char *topic, const MqttBuffer *payload)
+{
+    MqttBuffer body = {NULL, 0, 0};
+    putString(&body, topic);
+    putBytes(&body, payload->data, payload->length);
+    bool queued = queuePacket(MQTT_PUBLISH, &body);
+    free(body.data);
+    return queued;
+}
+
+//-----------------------------------------------------------------------------
+// Encodes the NDEATH payload, which only carries the bdSeq of the session
+//-----------------------------------------------------------------------------
+static void encodeDeath(MqttBuffer *payload)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    pbVarint(payload, PAYLOAD_TIMESTAMP, (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+
+    uint8_t encoded[64];
+    MqttBuffer metric = {encoded, 0, sizeof(encoded)};
+    pbString(&metric, METRIC_NAME, "bdSeq");
+    pbVarint(&metric, METRIC_DATATYPE, SPB_UINT64);
+    pbVarint(&metric, METRIC_LONG_VALUE, bd_seq);
+    putVarint(payload, (uint64_t)(PAYLOAD_METRICS << 3 | WIRE_BYTES));
+    putVarint(payload, metric.length);
+    putBytes(payload, metric.data, metric.length);
+}
+
+//-----------------------------------------------------------------------------
+// Reads the value of a metric from a snapshot
+//-----------------------------------------------------------------------------
+static uint64_t readMetric(const uint8_t *base, const MqttMetric *metric)
+{
+    const uint8_t *value = base + metric->source;
+    switch (metric->size)
+    {
+        case 1: return *value != 0;
+        case 2: return *(const uint16_t *)value;
+        case 4: return *(const uint32_t *)value;
+        default: return *(const uint64_t *)value;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Updates the metrics from the published process image and marks the ones
+// that changed as pending. Only the metrics on blocks changed since the last
+// call are read, unless all is set. Returns the timestamp of the snapshot
+//-----------------------------------------------------------------------------
+static uint64_t sampleMetrics(bool all)
+{
+    uint32_t sequence;
+    const ProcessImageSnapshot *snap;
+    ProcessImageChanges changes;
+    uint32_t version;
+    uint64_t timestamp;
+    do
+    {
+        snap = beginProcessImageRead(&sequence);
+        version = snap->version;
+        timestamp = snap->timestamp;
+        if (all) memset(&changes, 0xFF, sizeof(changes));
+        else getProcessImageChanges(image_version, version, &changes);
+        for (int i = 0; i < metric_count; i++)
+        {
+            if (processImageChanged(&changes, metrics[i].source, metrics[i].size))
+            {
+                sampled[i] = readMetric((const uint8_t *)snap, &metrics[i]);
+            }
+        }
+    } while (!endProcessImageRead(snap, sequence));
+
+    for (int i = 0; i < metric_count; i++)
+    {
+        MqttMetric *metric = &metrics[i];
+        if (!processImageChanged(&changes, metric->source, metric->size) || sampled[i] == metric->last) continue;
+        metric->last = sampled[i];
+        metric->pending = true;
+    }
+    image_version = version;
+    return timestamp;
+}
+
+//-----------------------------------------------------------------------------
+// Queues the NBIRTH with every metric, by name and alias, and the rebirth
+// control
+//-----------------------------------------------------------------------------
+static void queueBirth()
+{
+    char topic[256];
+    MqttBuffer payload = {NULL, 0, 0};
+
+    uint64_t timestamp = sampleMetrics(true);
+    message_seq = 0;
+    pbVarint(&payload, PAYLOAD_TIMESTAMP, timestamp);
+
+    uint8_t encoded[64];
+    MqttBuffer metric = {encoded, 0, sizeof(encoded)};
+    pbString(&metric, METRIC_NAME, "bdSeq");
+    pbVarint(&metric, METRIC_DATATYPE, SPB_UINT64);
+    pbVarint(&metric, METRIC_LONG_VALUE, bd_seq);
+    putVarint(&payload, (uint64_t)(PAYLOAD_METRICS << 3 | WIRE_BYTES));
+    putVarint(&payload, metric.length);
+    putBytes(&payload, metric.data, metric.length);
+
+    metric.length = 0;
+    pbString(&metric, METRIC_NAME, MQTT_REBIRTH_METRIC);
+    pbVarint(&metric, METRIC_DATATYPE, SPB_BOOLEAN);
+    pbVarint(&metric, METRIC_BOOLEAN_VALUE, 0);
+    putVarint(&payload, (uint64_t)(PAYLOAD_METRICS << 3 | WIRE_BYTES));
+    putVarint(&payload, metric.length);
+    putBytes(&payload, metric.data, metric.length);
+
+    for (int i = 0; i < metric_count; i++)
+    {
+        pbMetric(&payload, metrics[i].name, i, metrics[i].datatype, metrics[i].last);
+        metrics[i].pending = false;
+    }
+    pbVarint(&payload, PAYLOAD_SEQ, message_seq++);
+
+    nodeTopic(topic, sizeof(topic), "NBIRTH");
+    birth_needed = !queuePublish(topic, &payload);
+    free(payload.data);
+}
+
+//-----------------------------------------------------------------------------
+// Queues an NDATA with the metrics that changed, by alias. Metrics that
+// can't be queued stay pending for the next one
+//-----------------------------------------------------------------------------
+static void queueData()
+{
+    char topic[256];
+    uint64_t timestamp = sampleMetrics(false);
+
+    MqttBuffer payload = {NULL, 0, 0};
+    pbVarint(&payload, PAYLOAD_TIMESTAMP, timestamp);
+    int count = 0;
+    for (int i = 0; i < metric_count; i++)
+    {
+        if (!metrics[i].pending) continue;
+        pbMetric(&payload, NULL, i, metrics[i].datatype, metrics[i].last);
+        count++;
+    }
+    if (count > 0)
+    {
+        pbVarint(&payload, PAYLOAD_SEQ, message_seq);
+        nodeTopic(topic, sizeof(topic), "NDATA");
+        if (queuePublish(topic, &payload))
+        {
+            message_seq++;
+            for (int i = 0; i < metric_count; i++) metrics[i].pending = false;
+        }
+    }
+    free(payload.data);
+}
+
+//-----------------------------------------------------------------------------
+// Decodes a protobuf varint. Returns NULL if it runs past end
+//-----------------------------------------------------------------------------
+static const uint8_t *pbReadVarint(const uint8_t *data, const uint8_t *end, uint64_t *value)
+{
+    *value = 0;
+    for (int shift = 0; data < end && shift < 64; shift += 7)
+    {
+        uint8_t byte = *data++;
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return data;
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Applies one metric of an NCMD: the rebirth request or a write to a metric
+// of an output or memory location, when writes are enabled
+//-----------------------------------------------------------------------------
+static void applyCommandMetric(const uint8_t *data, const uint8_t *end)
+{
+    char name[64] = "";
+    uint64_t alias = UINT64_MAX;
+    uint64_t value = 0;
+    bool has_value = false;
+
+    while (data < end)
+    {
+        uint64_t key, length;
+        data = pbReadVarint(data, end, &key);
+        if (data == NULL) return;
+        int field = (int)(key >> 3);
+        switch (key & 7)
+        {
+            case WIRE_VARINT:
+            {
+                uint64_t number;
+                data = pbReadVarint(data, end, &number);
+                if (data == NULL) return;
+                if (field == METRIC_ALIAS) alias = number;
+                else if (field == METRIC_INT_VALUE || field == METRIC_LONG_VALUE || field == METRIC_BOOLEAN_VALUE)
+                {
+                    value = number;
+                    has_value = true;
+                }
+                break;
+            }
+            case WIRE_FIXED64:
+                if (end - data < 8) return;
+                if (field == METRIC_DOUBLE_VALUE)
+                {
+                    double number;
+                    memcpy(&number, data, 8);
+                    value = (uint64_t)(int64_t)number;
+                    has_value = true;
+                }
+                data += 8;
+                break;
+            case WIRE_FIXED32:
+                if (end - data < 4) return;
+                if (field == METRIC_FLOAT_VALUE)
+                {
+                    float number;
+                    memcpy(&number, data, 4);
+                    value = (uint64_t)(int64_t)number;
+                    has_value = true;
+                }
+                data += 4;
+                break;
+            case WIRE_BYTES:
+                data = pbReadVarint(data, end, &length);
+                if (data == NULL || length > (uint64_t)(end - data)) return;
+                if (field == METRIC_NAME && length < sizeof(name))
+                {
+                    memcpy(name, data, length);
+                    name[length] = '\0';
+                }
+                data += length;
+                break;
+            default:
+                return;
+        }
+    }
+    if (!has_value) return;
+
+    if (strcmp(name, MQTT_REBIRTH_METRIC) == 0)
+    {
+        if (value != 0) birth_needed = true;
+        return;
+    }
+
+    int i = alias < (uint64_t)metric_count ? (int)alias : -1;
+    for (int m = 0; i < 0 && name[0] != '\0' && m < metric_count; m++)
+    {
+        if (strcmp(metrics[m].name, name) == 0) i = m;
+    }
+    if (i < 0 || !config.writable) return;
+
+    MqttMetric *metric = &metrics[i];
+    if (metric->area == PI_BOOL_INPUT || metric->area == PI_INT_INPUT) return;
+
+    ProcessImageWrite write;
+    write.area = metric->area;
+    write.index = metric->index;
+    write.bit = metric->bit;
+    write.value = metric->size == 1 ? (value != 0) : value;
+    write.mask = metric->size == 8 ? ~0ULL : (1ULL << (metric->size * 8)) - 1;
+    if (queueProcessImageWrites(&write, 1) < 0)
+    {
+        openplc_log((char *)"MQTT: write queue full, NCMD write dropped\n");
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Handles an NCMD payload
+//-----------------------------------------------------------------------------
+static void handleCommand(const uint8_t *data, const uint8_t *end)
+{
+    while (data < end)
+    {
+        uint64_t key, length;
+        data = pbReadVarint(data, end, &key);
+        if (data == NULL) return;
+        switch (key & 7)
+        {
+            case WIRE_VARINT:
+                data = pbReadVarint(data, end, &length);
+                if (data == NULL) return;
+                break;
+            case WIRE_FIXED64:
+                data += 8;
+                break;
+            case WIRE_FIXED32:
+                data += 4;
+                break;
+            case WIRE_BYTES:
+                data = pbReadVarint(data, end, &length);
+                if (data == NULL || length > (uint64_t)(end - data)) return;
+                if ((key >> 3) == PAYLOAD_METRICS) applyCommandMetric(data, data + length);
+                data += length;
+                break;
+            default:
+                return;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Handles the packets received so far. Returns false if the session must be
+// closed
+//-----------------------------------------------------------------------------
+static bool handleReceived()
+{
+    char log_msg[1000];
+    size_t offset = 0;
+
+    while (offset < rx_length)
+    {
+        // Fixed header: type and a remaining length of up to 4 bytes
+        size_t remaining = 0;
+        size_t header = 1;
+        int shift = 0;
+        while (true)
+        {
+            if (offset + header >= rx_length) goto incomplete;
+            uint8_t byte = rx[offset + header++];
+            remaining |= (size_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) break;
+            shift += 7;
+            if (shift > 21) return false;
+        }
+        if (header + remaining > sizeof(rx)) return false;
+        if (offset + header + remaining > rx_length) goto incomplete;
+
+        {
+            uint8_t type = rx[offset] & 0xF0;
+            const uint8_t *body = rx + offset + header;
+            if (type == MQTT_CONNACK)
+            {
+                if (remaining < 2 || body[1] != 0)
+                {
+                    sprintf(log_msg, "MQTT: broker refused the connection (code %d)\n", remaining < 2 ? -1 : body[1]);
+                    openplc_log(log_msg);
+                    return false;
+                }
+                mqtt_connected = true;
+                birth_needed = true;
+            }
+            else if (type == MQTT_PUBLISH && remaining >= 2)
+            {
+                size_t topic_length = (body[0] << 8) | body[1];
+                size_t skip = 2 + topic_length + ((rx[offset] & 0x06) ? 2 : 0);
+                if (skip <= remaining) handleCommand(body + skip, body + remaining);
+            }
+        }
+        offset += header + remaining;
+    }
+
+incomplete:
+    memmove(rx, rx + offset, rx_length - offset);
+    rx_length -= offset;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Closes the session, announcing the death of the node if it was connected
+//-----------------------------------------------------------------------------
+static void closeSession(bool graceful)
+{
+    if (mqtt_socket < 0) return;
+
+    if (graceful && mqtt_connected)
+    {
+        char topic[256];
+        MqttBuffer payload = {NULL, 0, 0};
+        encodeDeath(&payload);
+        nodeTopic(topic, sizeof(topic), "NDEATH");
+        queuePublish(topic, &payload);
+        free(payload.data);
+        MqttBuffer empty = {NULL, 0, 0};
+        queuePacket(MQTT_DISCONNECT, &empty);
+
+        // Best effort, the socket is left blocking for a moment
+        fcntl(mqtt_socket, F_SETFL, fcntl(mqtt_socket, F_GETFL) & ~O_NONBLOCK);
+        struct timeval timeout = {1, 0};
+        setsockopt(mqtt_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        send(mqtt_socket, tx.data, tx.length, MSG_NOSIGNAL);
+    }
+    close(mqtt_socket);
+    mqtt_socket = -1;
+    mqtt_connected = false;
+    tx.length = 0;
+    rx_length = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Opens the TCP connection and queues CONNECT, with the NDEATH as the will,
+// and the NCMD subscription. Returns false if the broker can't be reached
+//-----------------------------------------------------------------------------
+static bool openSession()
+{
+    char log_msg[1000];
+    char topic[256];
+
+    struct addrinfo hints, *addresses;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int result = getaddrinfo(config.broker, config.port, &hints, &addresses);
+    if (result != 0)
+    {
+        sprintf(log_msg, "MQTT: can't resolve %s: %s\n", config.broker, gai_strerror(result));
+        openplc_log(log_msg);
+        return false;
+    }
+
+    mqtt_socket = socket(addresses->ai_family, SOCK_STREAM, 0);
+    if (mqtt_socket < 0)
+    {
+        freeaddrinfo(addresses);
+        return false;
+    }
+    SetSocketBlockingEnabled(mqtt_socket, false);
+    int nodelay = 1;
+    setsockopt(mqtt_socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    result = connect(mqtt_socket, addresses->ai_addr, addresses->ai_addrlen);
+    freeaddrinfo(addresses);
+    if (result < 0 && errno != EINPROGRESS)
+    {
+        close(mqtt_socket);
+        mqtt_socket = -1;
+        return false;
+    }
+
+    bd_seq++;
+    MqttBuffer body = {NULL, 0, 0};
+    putString(&body, "MQTT");
+    putByte(&body, 4);
+    uint8_t flags = 0x02 | 0x04 | 0x08;     // clean session, will with QoS 1
+    if (config.username[0] != '\0') flags |= 0x80;
+    if (config.password[0] != '\0') flags |= 0x40;
+    putByte(&body, flags);
+    putByte(&body, (uint8_t)(config.keepalive >> 8));
+    putByte(&body, (uint8_t)config.keepalive);
+    putString(&body, config.client_id);
+    nodeTopic(topic, sizeof(topic), "NDEATH");
+    putString(&body, topic);
+    MqttBuffer death = {NULL, 0, 0};
+    encodeDeath(&death);
+    putByte(&body, (uint8_t)(death.length >> 8));
+    putByte(&body, (uint8_t)death.length);
+    putBytes(&body, death.data, death.length);
+    free(death.data);
+    if (config.username[0] != '\0') putString(&body, config.username);
+    if (config.password[0] != '\0') putString(&body, config.password);
+    queuePacket(MQTT_CONNECT, &body);
+
+    body.length = 0;
+    putByte(&body, 0);
+    putByte(&body, 1);
+    nodeTopic(topic, sizeof(topic), "NCMD");
+    putString(&body, topic);
+    putByte(&body, 0);
+    queuePacket(MQTT_SUBSCRIBE, &body);
+    free(body.data);
+
+    clock_gettime(CLOCK_MONOTONIC, &last_received);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Adds a number of milliseconds to a time
+//-----------------------------------------------------------------------------
+static void addMs(struct timespec *time, long long ms)
+{
+    time->tv_sec += ms / 1000;
+    time->tv_nsec += (ms % 1000) * 1000000;
+    if (time->tv_nsec >= 1000000000)
+    {
+        time->tv_nsec -= 1000000000;
+        time->tv_sec++;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// MQTT thread. Keeps the session up and publishes the changed metrics at
+// most once per interval. Lost sessions are opened again with an increasing
+// delay
+//-----------------------------------------------------------------------------
+static void *mqttThread(void *arg)
+{
+    (void)arg;
+    setThreadClass(THREAD_CLASS_COMM, "mqtt");
+
+    char log_msg[1000];
+    long long backoff = 1000;
+    bool ping_outstanding = false;
+    struct timespec next_attempt, next_data;
+    clock_gettime(CLOCK_MONOTONIC, &next_attempt);
+    next_data = next_attempt;
+
+    while (mqtt_running)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        if (mqtt_socket < 0)
+        {
+            if (elapsedMs(&next_attempt, &now) < 0)
+            {
+                sleepms(100);
+                continue;
+            }
+            ping_outstanding = false;
+            if (!openSession())
+            {
+                next_attempt = now;
+                addMs(&next_attempt, backoff);
+                backoff = backoff * 2 < MQTT_MAX_BACKOFF ? backoff * 2 : MQTT_MAX_BACKOFF;
+                continue;
+            }
+        }
+
+        if (mqtt_connected)
+        {
+            if (birth_needed)
+            {
+                queueBirth();
+            }
+            else if (elapsedMs(&next_data, &now) >= 0)
+            {
+                if (getProcessImageVersion() != image_version) queueData();
+                next_data = now;
+                addMs(&next_data, config.interval_ms);
+            }
+
+            // QoS 0 publishes get no answer, pings show the broker is alive
+            if (!ping_outstanding && elapsedMs(&last_received, &now) >= config.keepalive * 500LL)
+            {
+                MqttBuffer empty = {NULL, 0, 0};
+                ping_outstanding = queuePacket(MQTT_PINGREQ, &empty);
+            }
+        }
+
+        struct pollfd fd;
+        fd.fd = mqtt_socket;
+        fd.events = POLLIN | (tx.length > 0 ? POLLOUT : 0);
+        fd.revents = 0;
+        if (poll(&fd, 1, mqtt_connected ? config.interval_ms : 100) < 0 && errno != EINTR) break;
+
+        bool failed = (fd.revents & (POLLERR | POLLHUP)) != 0;
+        if (!failed && (fd.revents & POLLOUT) && tx.length > 0)
+        {
+            ssize_t sent = send(mqtt_socket, tx.data, tx.length, MSG_NOSIGNAL);
+            if (sent > 0)
+            {
+                memmove(tx.data, tx.data + sent, tx.length - sent);
+                tx.length -= sent;
+            }
+            else if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                failed = true;
+            }
+        }
+        if (!failed && (fd.revents & POLLIN))
+        {
+            ssize_t count = recv(mqtt_socket, rx + rx_length, sizeof(rx) - rx_length, 0);
+            if (count > 0)
+            {
+                rx_length += count;
+                clock_gettime(CLOCK_MONOTONIC, &last_received);
+                ping_outstanding = false;
+                failed = !handleReceived();
+                if (mqtt_connected) backoff = 1000;
+            }
+            else if (count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            {
+                failed = true;
+            }
+        }
+
+        // Nothing heard for a keepalive and a half, not even the ping
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (!failed && elapsedMs(&last_received, &now) > config.keepalive * 1500LL) failed = true;
+
+        if (failed)
+        {
+            if (mqtt_connected)
+            {
+                sprintf(log_msg, "MQTT: connection to %s:%s lost\n", config.broker, config.port);
+                openplc_log(log_msg);
+            }
+            closeSession(false);
+            next_attempt = now;
+            addMs(&next_attempt, backoff);
+            backoff = backoff * 2 < MQTT_MAX_BACKOFF ? backoff * 2 : MQTT_MAX_BACKOFF;
+        }
+    }
+
+    closeSession(true);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Starts the MQTT client if mqtt.cfg declares any metric
+//-----------------------------------------------------------------------------
+void startMqtt()
+{
+    char log_msg[1000];
+
+    if (mqtt_running) return;
+    if (!loadMqttConfig())
+    {
+        openplc_log((char *)"MQTT: no metrics on mqtt.cfg, client not started\n");
+        return;
+    }
+
+    // Room for a few full data messages, more means the broker can't keep up
+    tx_limit = 4096 + (size_t)metric_count * 64 * 4;
+    tx.length = 0;
+    reserve(&tx, tx_limit);
+    image_version = getProcessImageVersion();
+
+    mqtt_running = true;
+    if (pthread_create(&mqtt_thread, NULL, mqttThread, NULL) != 0)
+    {
+        mqtt_running = false;
+        openplc_log((char *)"MQTT: failed to start the client thread\n");
+        return;
+    }
+
+    sprintf(log_msg, "MQTT: publishing %d metrics as %s/%s to %s:%s\n", metric_count, config.group_id,
+            config.edge_node_id, config.broker, config.port);
+    openplc_log(log_msg);
+}
+
+//-----------------------------------------------------------------------------
+// Stops the MQTT client, sending the NDEATH of the node first
+//-----------------------------------------------------------------------------
+void stopMqtt()
+{
+    if (!mqtt_running) return;
+
+    mqtt_running = false;
+    pthread_join(mqtt_thread, NULL);
+}
@@ -0,0 +1,897 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the network variables, which runtimes exchange
+// without a master polling them. The [publish] sections of
+// network_variables.cfg are sent as one UDP multicast frame each, for every
+// process image the scan publishes. The [subscribe] sections name the frames
+// of other runtimes to receive and the inputs they go to.
+//
+// A frame is a 20 byte header followed by the values: the booleans packed 8
+// per byte, then the other fields little endian, in the order of the
+// section. The header carries a sequence number, so the old and duplicated
+// frames are dropped, and a hash of the field sizes, so a subscription that
+// doesn't match the publication is reported instead of misread.
+//
+// The receiver thread hands the latest frame of each subscription to the
+// scan through a triple buffer. The scan copies it to the inputs while it is
+// fresh; once no frame arrived for the timeout of the subscription the
+// inputs are cleared (or hold their values) and its status input drops.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <atomic>
+
+#include "ladder.h"
+
+#define NETVARS_CONFIG_FILE         "network_variables.cfg"
+#ifdef OPLC_LOW_MEMORY
+#define NETVARS_MAX_PUBLICATIONS    4
+#define NETVARS_MAX_SUBSCRIPTIONS   8
+#define NETVARS_MAX_FIELDS          512
+#else
+#define NETVARS_MAX_PUBLICATIONS    16
+#define NETVARS_MAX_SUBSCRIPTIONS   32
+#define NETVARS_MAX_FIELDS          4096
+#endif
+#define NETVARS_MAX_FRAME           1472    // one Ethernet frame
+#define NETVARS_HEADER_SIZE         20
+#define NETVARS_VERSION             1
+#define NETVARS_FRESH_BUFFER        4
+#define NETVARS_WAIT_TIMEOUT        1000    // ms the threads wait before checking they must stop
+
+// A field of a section: where it is on the snapshot (publications) or on
+// the input image (subscriptions), and where it is on the frame
+struct NetVarField
+{
+    size_t source;      // offset on ProcessImageSnapshot
+    void *target;       // input image entry
+    uint8_t size;       // 1 (bit), 2, 4 or 8 bytes
+    uint16_t offset;    // byte of the value on the frame, after the header
+    uint8_t bit;        // bit of a boolean on its byte
+};
+
+struct NetVarPublication
+{
+    uint16_t id;
+    int first_field;
+    int field_count;
+    uint32_t layout;
+    uint8_t frame[NETVARS_MAX_FRAME];
+    size_t frame_size;
+    uint32_t sequence;
+
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> send_errors;
+};
+
+struct NetVarSubscription
+{
+    uint16_t node;
+    uint16_t id;
+    int first_field;
+    int field_count;
+    uint32_t layout;
+    size_t frame_size;
+    int timeout_ms;
+    bool hold;                  // inputs keep their values once stale
+    IEC_BOOL *status;           // input set while the values are fresh
+
+    // receiver thread only
+    bool started;
+    uint32_t session;
+    uint32_t sequence;
+    bool layout_reported;
+
+    // triple buffer that passes the values from the receiver to the scan
+    uint8_t buffers[3][NETVARS_MAX_FRAME];
+    std::atomic<int> shared;    // index of the shared buffer, with NETVARS_FRESH_BUFFER if unseen
+    int producer;
+    int consumer;
+    std::atomic<int64_t> received_ns;   // CLOCK_MONOTONIC time of the last frame, 0 before
+
+    // scan thread only
+    bool fresh;
+
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> lost;             // sequence numbers skipped
+    std::atomic<uint64_t> dropped;          // old or duplicated frames
+    std::atomic<uint64_t> layout_errors;
+    std::atomic<uint64_t> timeouts;         // fresh to stale transitions
+};
+
+struct NetVarsConfig
+{
+    struct in_addr address;
+    uint16_t port;
+    struct in_addr interface;
+    int ttl;
+    uint16_t node;
+};
+
+// Section of network_variables.cfg being read
+struct NetVarsSection
+{
+    NetVarPublication *publication;
+    NetVarSubscription *subscription;
+    bool in_section;
+};
+
+static NetVarsConfig config;
+static NetVarPublication publications[NETVARS_MAX_PUBLICATIONS];
+static int publication_count = 0;
+static NetVarSubscription subscriptions[NETVARS_MAX_SUBSCRIPTIONS];
+static int subscription_count = 0;
+static NetVarField fields[NETVARS_MAX_FIELDS];
+static int field_count = 0;
+static uint32_t session = 0;
+
+static pthread_t publisher_thread;
+static pthread_t receiver_thread;
+static volatile bool netvars_running = false;
+static int netvars_socket = -1;
+
+//-----------------------------------------------------------------------------
+// Little endian encoders and decoders
+//-----------------------------------------------------------------------------
+static void putU16(uint8_t *p, uint16_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static void putU32(uint8_t *p, uint32_t value)
+{
+    putU16(p, (uint16_t)value);
+    putU16(p + 2, (uint16_t)(value >> 16));
+}
+
+static void putU64(uint8_t *p, uint64_t value)
+{
+    putU32(p, (uint32_t)value);
+    putU32(p + 4, (uint32_t)(value >> 32));
+}
+
+static uint16_t getU16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t getU32(const uint8_t *p)
+{
+    return getU16(p) | ((uint32_t)getU16(p + 2) << 16);
+}
+
+static uint64_t getU64(const uint8_t *p)
+{
+    return getU32(p) | ((uint64_t)getU32(p + 4) << 32);
+}
+
+static int64_t monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the input image entry of a location, or NULL if it isn't a %IX,
+// %IW, %ID or %IL location
+//-----------------------------------------------------------------------------
+static void *inputEntry(char area, char width, uint32_t position)
+{
+    if (area != 'I') return NULL;
+    switch (width)
+    {
+        case 'X': return &bool_input_image[position / 8][position % 8];
+        case 'W': return &int_input_image[position];
+        case 'D': return &dint_input_image[position];
+        case 'L': return &lint_input_image[position];
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Parses one location of a field list into a field. Publications take any
+// location the snapshots publish, subscriptions only inputs. Returns false
+// if the location isn't one of those
+//-----------------------------------------------------------------------------
+static bool parseField(const char *text, bool input, NetVarField *field, char *area, char *width, uint32_t *position)
+{
+    if (!parseTagLocation(text, area, width, position)) return false;
+
+    memset(field, 0, sizeof(*field));
+    switch (*width)
+    {
+        case 'X': field->size = 1; break;
+        case 'W': field->size = 2; break;
+        case 'D': field->size = 4; break;
+        case 'L': field->size = 8; break;
+        default: return false;
+    }
+
+    if (input)
+    {
+        field->target = inputEntry(*area, *width, *position);
+        return field->target != NULL;
+    }
+    int32_t offset = tagImageOffset(*area, *width, *position);
+    if (offset < 0) return false;
+    field->source = (size_t)offset;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Appends the fields of a "fields = %QX0.0-%QX0.7, %QW0-%QW3" line to a
+// section. Returns false if the list is malformed or there are too many
+// fields
+//-----------------------------------------------------------------------------
+static bool parseFields(const char *text, bool input, int *count)
+{
+    char list[1024];
+    strncpy(list, text, sizeof(list) - 1);
+    list[sizeof(list) - 1] = '\0';
+
+    char *saveptr;
+    for (char *item = strtok_r(list, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr))
+    {
+        item = trimSetting(item);
+        if (*item == '\0') continue;
+
+        char *dash = strchr(item, '-');
+        if (dash != NULL) *dash = '\0';
+
+        NetVarField first;
+        char area, width;
+        uint32_t start, last;
+        if (!parseField(trimSetting(item), input, &first, &area, &width, &start)) return false;
+        last = start;
+        if (dash != NULL)
+        {
+            NetVarField end;
+            char last_area, last_width;
+            if (!parseField(trimSetting(dash + 1), input, &end, &last_area, &last_width, &last)) return false;
+            if (last_area != area || last_width != width || last < start) return false;
+        }
+
+        for (uint32_t position = start; position <= last; position++)
+        {
+            if (field_count == NETVARS_MAX_FIELDS) return false;
+            NetVarField *field = &fields[field_count++];
+            parseField(item, input, field, &area, &width, &start);
+            if (input) field->target = inputEntry(area, width, position);
+            else field->source = (size_t)tagImageOffset(area, width, position);
+            (*count)++;
+        }
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Places the fields of a section on the frame: the booleans packed first,
+// then the other values. Returns the size of the frame, or 0 if it doesn't
+// fit. The layout is a hash of the field sizes in order
+//-----------------------------------------------------------------------------
+static size_t layoutFields(int first, int count, uint32_t *layout)
+{
+    int bits = 0;
+    size_t offset = 0;
+    uint32_t hash = 2166136261u;
+    for (int i = first; i < first + count; i++)
+    {
+        if (fields[i].size == 1) bits++;
+        hash = (hash ^ fields[i].size) * 16777619u;
+    }
+    *layout = hash;
+
+    int bit = 0;
+    offset = (bits + 7) / 8;
+    for (int i = first; i < first + count; i++)
+    {
+        NetVarField *field = &fields[i];
+        if (field->size == 1)
+        {
+            field->offset = (uint16_t)(bit / 8);
+            field->bit = (uint8_t)(bit % 8);
+            bit++;
+        }
+        else
+        {
+            field->offset = (uint16_t)offset;
+            offset += field->size;
+        }
+    }
+
+    if (NETVARS_HEADER_SIZE + offset > NETVARS_MAX_FRAME) return 0;
+    return NETVARS_HEADER_SIZE + offset;
+}
+
+//-----------------------------------------------------------------------------
+// Applies one "key = value" line before the first section
+//-----------------------------------------------------------------------------
+static void applyNetVarsSetting(char *key, char *value)
+{
+    char log_msg[1000];
+
+    if (strcmp(key, "address") == 0 || strcmp(key, "interface") == 0)
+    {
+        struct in_addr *address = strcmp(key, "address") == 0 ? &config.address : &config.interface;
+        if (inet_pton(AF_INET, value, address) != 1)
+        {
+            sprintf(log_msg, "Network variables: invalid %s '%s'\n", key, value);
+            openplc_log(log_msg);
+        }
+    }
+    else if (strcmp(key, "port") == 0) config.port = (uint16_t)atoi(value);
+    else if (strcmp(key, "ttl") == 0) config.ttl = atoi(value);
+    else if (strcmp(key, "node") == 0) config.node = (uint16_t)atoi(value);
+}
+
+//-----------------------------------------------------------------------------
+// Applies one "key = value" line of a [publish] or [subscribe] section
+//-----------------------------------------------------------------------------
+static void applySectionSetting(NetVarPublication *publication, NetVarSubscription *subscription, char *key, char *value)
+{
+    char log_msg[1000];
+
+    if (strcmp(key, "id") == 0)
+    {
+        if (publication != NULL) publication->id = (uint16_t)atoi(value);
+        else subscription->id = (uint16_t)atoi(value);
+    }
+    else if (strcmp(key, "fields") == 0)
+    {
+        bool parsed;
+        if (publication != NULL)
+        {
+            if (publication->field_count == 0) publication->first_field = field_count;
+            parsed = parseFields(value, false, &publication->field_count);
+        }
+        else
+        {
+            if (subscription->field_count == 0) subscription->first_field = field_count;
+            parsed = parseFields(value, true, &subscription->field_count);
+        }
+        if (!parsed)
+        {
+            sprintf(log_msg, "Network variables: invalid fields '%s'\n", value);
+            openplc_log(log_msg);
+        }
+    }
+    else if (subscription == NULL)
+    {
+        return;
+    }
+    else if (strcmp(key, "node") == 0) subscription->node = (uint16_t)atoi(value);
+    else if (strcmp(key, "timeout") == 0) subscription->timeout_ms = atoi(value);
+    else if (strcmp(key, "on_timeout") == 0) subscription->hold = (strcmp(value, "hold") == 0);
+    else if (strcmp(key, "status") == 0)
+    {
+        char area, width;
+        uint32_t position;
+        if (!parseTagLocation(value, &area, &width, &position) || area != 'I' || width != 'X')
+        {
+            sprintf(log_msg, "Network variables: the status '%s' must be a %%IX input\n", value);
+            openplc_log(log_msg);
+        }
+        else
+        {
+            subscription->status = &bool_input_image[position / 8][position % 8];
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Applies one line of network_variables.cfg: a [publish] or [subscribe]
+// header starts a new section, and the settings before the first one are
+// global
+//-----------------------------------------------------------------------------
+static void applyNetVarsLine(const char *name, char *key, char *value, void *context)
+{
+    NetVarsSection *section = (NetVarsSection *)context;
+    if (key == NULL)
+    {
+        if (strcmp(name, "publish") != 0 && strcmp(name, "subscribe") != 0) return;
+
+        section->in_section = true;
+        section->publication = NULL;
+        section->subscription = NULL;
+        if (name[0] == 'p' && publication_count < NETVARS_MAX_PUBLICATIONS)
+        {
+            NetVarPublication *publication = &publications[publication_count++];
+            publication->id = (uint16_t)publication_count;
+            publication->first_field = field_count;
+            publication->field_count = 0;
+            section->publication = publication;
+        }
+        else if (name[0] == 's' && subscription_count < NETVARS_MAX_SUBSCRIPTIONS)
+        {
+            NetVarSubscription *subscription = &subscriptions[subscription_count++];
+            subscription->node = 0;
+            subscription->id = 1;
+            subscription->first_field = field_count;
+            subscription->field_count = 0;
+            subscription->timeout_ms = 100;
+            subscription->hold = false;
+            subscription->status = NULL;
+            section->subscription = subscription;
+        }
+        else
+        {
+            openplc_log((char *)"Network variables: too many sections, the rest are ignored\n");
+        }
+        return;
+    }
+
+    if (!section->in_section) applyNetVarsSetting(key, value);
+    else if (section->publication != NULL || section->subscription != NULL) applySectionSetting(section->publication, section->subscription, key, value);
+}
+
+//-----------------------------------------------------------------------------
+// Reads network_variables.cfg. Returns false if the file is missing or
+// declares no section, in which case the network variables don't run
+//-----------------------------------------------------------------------------
+static bool loadNetVarsConfig()
+{
+    inet_pton(AF_INET, "239.0.0.2", &config.address);
+    config.port = 20000;
+    config.interface.s_addr = htonl(INADDR_ANY);
+    config.ttl = 1;
+    config.node = 1;
+    publication_count = 0;
+    subscription_count = 0;
+    field_count = 0;
+
+    NetVarsSection section = {NULL, NULL, false};
+    if (!parseSettingsFile(NETVARS_CONFIG_FILE, applyNetVarsLine, &section)) return false;
+
+    return publication_count > 0 || subscription_count > 0;
+}
+
+//-----------------------------------------------------------------------------
+// Lays out the frames of the sections and drops the ones that are empty or
+// too large. Returns false if nothing is left
+//-----------------------------------------------------------------------------
+static bool prepareSections()
+{
+    char log_msg[1000];
+
+    int kept = 0;
+    for (int p = 0; p < publication_count; p++)
+    {
+        NetVarPublication *publication = &publications[p];
+        publication->frame_size = publication->field_count > 0 ? layoutFields(publication->first_field, publication->field_count, &publication->layout) : 0;
+        if (publication->frame_size == 0)
+        {
+            sprintf(log_msg, "Network variables: publication %d is empty or larger than %d bytes, ignored\n", publication->id, NETVARS_MAX_FRAME);
+            openplc_log(log_msg);
+            continue;
+        }
+
+        memset(publication->frame, 0, sizeof(publication->frame));
+        publication->frame[0] = 'N';
+        publication->frame[1] = 'V';
+        publication->frame[2] = NETVARS_VERSION;
+        putU16(publication->frame + 4, config.node);
+        putU16(publication->frame + 6, publication->id);
+        putU32(publication->frame + 8, session);
+        putU32(publication->frame + 16, publication->layout);
+        publication->sequence = 0;
+        publication->frames.store(0, std::memory_order_relaxed);
+        publication->send_errors.store(0, std::memory_order_relaxed);
+        if (kept != p) memmove((void *)&publications[kept], (void *)publication, sizeof(NetVarPublication));
+        kept++;
+    }
+    publication_count = kept;
+
+    kept = 0;
+    for (int s = 0; s < subscription_count; s++)
+    {
+        NetVarSubscription *subscription = &subscriptions[s];
+        subscription->frame_size = subscription->field_count > 0 ? layoutFields(subscription->first_field, subscription->field_count, &subscription->layout) : 0;
+        if (subscription->frame_size == 0 || subscription->node == 0 || subscription->node == config.node)
+        {
+            sprintf(log_msg, "Network variables: subscription %d of node %d has no fields, no valid node or is too large, ignored\n",
+                    subscription->id, subscription->node);
+            openplc_log(log_msg);
+            continue;
+        }
+        if (subscription->timeout_ms <= 0) subscription->timeout_ms = 100;
+
+        subscription->started = false;
+        subscription->layout_reported = false;
+        subscription->shared.store(0, std::memory_order_relaxed);
+        subscription->producer = 1;
+        subscription->consumer = 2;
+        subscription->received_ns.store(0, std::memory_order_relaxed);
+        subscription->fresh = false;
+        subscription->frames.store(0, std::memory_order_relaxed);
+        subscription->lost.store(0, std::memory_order_relaxed);
+        subscription->dropped.store(0, std::memory_order_relaxed);
+        subscription->layout_errors.store(0, std::memory_order_relaxed);
+        subscription->timeouts.store(0, std::memory_order_relaxed);
+        if (kept != s) memmove((void *)&subscriptions[kept], (void *)subscription, sizeof(NetVarSubscription));
+        kept++;
+    }
+    subscription_count = kept;
+
+    return publication_count > 0 || subscription_count > 0;
+}
+
+//-----------------------------------------------------------------------------
+// Copies the fields of a publication from a snapshot to its frame
+//-----------------------------------------------------------------------------
+static void encodePublication(NetVarPublication *publication, const uint8_t *snap)
+{
+    uint8_t *payload = publication->frame + NETVARS_HEADER_SIZE;
+    for (int i = publication->first_field; i < publication->first_field + publication->field_count; i++)
+    {
+        const NetVarField *field = &fields[i];
+        const uint8_t *value = snap + field->source;
+        switch (field->size)
+        {
+            case 1:
+                if (*value) payload[field->offset] |= (uint8_t)(1 << field->bit);
+                else payload[field->offset] &= (uint8_t)~(1 << field->bit);
+                break;
+            case 2: putU16(payload + field->offset, *(const uint16_t *)value); break;
+            case 4: putU32(payload + field->offset, *(const uint32_t *)value); break;
+            case 8: putU64(payload + field->offset, *(const uint64_t *)value); break;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Publisher thread. Sends the frames of every publication for each process
+// image the scan publishes
+//-----------------------------------------------------------------------------
+static void *publisherThread(void *arg)
+{
+    (void)arg;
+    setThreadClass(THREAD_CLASS_COMM, "netvar_publish");
+
+    struct sockaddr_in destination;
+    memset(&destination, 0, sizeof(destination));
+    destination.sin_family = AF_INET;
+    destination.sin_addr = config.address;
+    destination.sin_port = htons(config.port);
+
+    uint32_t version = getProcessImageVersion();
+    bool send_failed = false;
+    while (netvars_running)
+    {
+        uint32_t current = waitProcessImage(version + 1, NETVARS_WAIT_TIMEOUT);
+        if ((int32_t)(current - version) <= 0) continue;
+        version = current;
+
+        uint32_t sequence;
+        const ProcessImageSnapshot *snap;
+        do
+        {
+            snap = beginProcessImageRead(&sequence);
+            for (int p = 0; p < publication_count; p++) encodePublication(&publications[p], (const uint8_t *)snap);
+        } while (!endProcessImageRead(snap, sequence));
+
+        for (int p = 0; p < publication_count; p++)
+        {
+            NetVarPublication *publication = &publications[p];
+            putU32(publication->frame + 12, ++publication->sequence);
+            if (sendto(netvars_socket, publication->frame, publication->frame_size, 0, (struct sockaddr *)&destination, sizeof(destination)) < 0)
+            {
+                publication->send_errors.fetch_add(1, std::memory_order_relaxed);
+                // Logged once until the network comes back
+                if (!send_failed)
+                {
+                    char log_msg[1000];
+                    sprintf(log_msg, "Network variables: send failed: %s\n", strerror(errno));
+                    openplc_log(log_msg);
+                }
+                send_failed = true;
+                continue;
+            }
+            publication->frames.fetch_add(1, std::memory_order_relaxed);
+            send_failed = false;
+        }
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Takes a frame for a subscription. Old and duplicated frames are dropped; a
+// publisher that restarted (new session) starts its sequence again
+//-----------------------------------------------------------------------------
+static void receiveFrame(NetVarSubscription *subscription, const uint8_t *frame, size_t size)
+{
+    char log_msg[1000];
+
+    if (getU32(frame + 16) != subscription->layout || size != subscription->frame_size)
+    {
+        subscription->layout_errors.fetch_add(1, std::memory_order_relaxed);
+        if (!subscription->layout_reported)
+        {
+            sprintf(log_msg, "Network variables: the fields of publication %d of node %d don't match the subscription\n",
+                    subscription->id, subscription->node);
+            openplc_log(log_msg);
+            subscription->layout_reported = true;
+        }
+        return;
+    }
+
+    uint32_t frame_session = getU32(frame + 8);
+    uint32_t sequence = getU32(frame + 12);
+    if (subscription->started && frame_session == subscription->session)
+    {
+        int32_t ahead = (int32_t)(sequence - subscription->sequence);
+        if (ahead <= 0)
+        {
+            subscription->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (ahead > 1) subscription->lost.fetch_add(ahead - 1, std::memory_order_relaxed);
+    }
+    subscription->started = true;
+    subscription->session = frame_session;
+    subscription->sequence = sequence;
+
+    memcpy(subscription->buffers[subscription->producer], frame + NETVARS_HEADER_SIZE, size - NETVARS_HEADER_SIZE);
+    subscription->producer = subscription->shared.exchange(subscription->producer | NETVARS_FRESH_BUFFER, std::memory_order_acq_rel) & 3;
+    subscription->received_ns.store(monotonicNs(), std::memory_order_release);
+    subscription->frames.fetch_add(1, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// Receiver thread. Takes the frames of the subscribed publications
+//-----------------------------------------------------------------------------
+static void *receiverThread(void *arg)
+{
+    (void)arg;
+    setThreadClass(THREAD_CLASS_COMM, "netvar_receive");
+
+    uint8_t frame[NETVARS_MAX_FRAME];
+    while (netvars_running)
+    {
+        ssize_t size = recv(netvars_socket, frame, sizeof(frame), 0);
+        if (size < NETVARS_HEADER_SIZE) continue;
+        if (frame[0] != 'N' || frame[1] != 'V' || frame[2] != NETVARS_VERSION) continue;
+
+        uint16_t node = getU16(frame + 4);
+        uint16_t id = getU16(frame + 6);
+        for (int s = 0; s < subscription_count; s++)
+        {
+            if (subscriptions[s].node == node && subscriptions[s].id == id)
+            {
+                receiveFrame(&subscriptions[s], frame, (size_t)size);
+                break;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Creates the socket, bound to the port and member of the group when there
+// is any subscription
+//-----------------------------------------------------------------------------
+static bool openSocket()
+{
+    char log_msg[1000];
+
+    netvars_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (netvars_socket < 0)
+    {
+        sprintf(log_msg, "Network variables: failed to create socket: %s\n", strerror(errno));
+        openplc_log(log_msg);
+        return false;
+    }
+
+    unsigned char ttl = (unsigned char)config.ttl;
+    setsockopt(netvars_socket, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    if (config.interface.s_addr != htonl(INADDR_ANY))
+    {
+        setsockopt(netvars_socket, IPPROTO_IP, IP_MULTICAST_IF, &config.interface, sizeof(config.interface));
+    }
+    struct timeval timeout = { NETVARS_WAIT_TIMEOUT / 1000, (NETVARS_WAIT_TIMEOUT % 1000) * 1000 };
+    setsockopt(netvars_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if (subscription_count == 0) return true;
+
+    int reuse = 1;
+    setsockopt(netvars_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(config.port);
+    if (bind(netvars_socket, (struct sockaddr *)&local, sizeof(local)) < 0)
+    {
+        sprintf(log_msg, "Network variables: failed to bind port %d: %s\n", config.port, strerror(errno));
+        openplc_log(log_msg);
+        close(netvars_socket);
+        netvars_socket = -1;
+        return false;
+    }
+
+    if (IN_MULTICAST(ntohl(config.address.s_addr)))
+    {
+        struct ip_mreq membership;
+        membership.imr_multiaddr = config.address;
+        membership.imr_interface = config.interface;
+        if (setsockopt(netvars_socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0)
+        {
+            sprintf(log_msg, "Network variables: failed to join the group: %s\n", strerror(errno));
+            openplc_log(log_msg);
+        }
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Starts the network variables if network_variables.cfg declares any
+// section. Called once the process image is published
+//-----------------------------------------------------------------------------
+void startNetworkVariables()
+{
+    char log_msg[1000];
+
+    if (!loadNetVarsConfig()) return;
+    session = (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16);
+    if (!prepareSections() || !openSocket()) return;
+
+    netvars_running = true;
+    bool publisher = publication_count > 0 && pthread_create(&publisher_thread, NULL, publisherThread, NULL) == 0;
+    bool receiver = subscription_count > 0 && pthread_create(&receiver_thread, NULL, receiverThread, NULL) == 0;
+    if ((publication_count > 0 && !publisher) || (subscription_count > 0 && !receiver))
+    {
+        netvars_running = false;
+        if (publisher) pthread_join(publisher_thread, NULL);
+        if (receiver) pthread_join(receiver_thread, NULL);
+        close(netvars_socket);
+        netvars_socket = -1;
+        openplc_log((char *)"Network variables: failed to start the threads\n");
+        return;
+    }
+
+    char address[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &config.address, address, sizeof(address));
+    sprintf(log_msg, "Network variables: node %d publishing %d and subscribed to %d frames on %s:%d\n",
+            config.node, publication_count, subscription_count, address, config.port);
+    openplc_log(log_msg);
+}
+
+//-----------------------------------------------------------------------------
+// Stops the network variables, if they were started
+//-----------------------------------------------------------------------------
+void stopNetworkVariables()
+{
+    if (!netvars_running) return;
+
+    netvars_running = false;
+    if (publication_count > 0) pthread_join(publisher_thread, NULL);
+    if (subscription_count > 0) pthread_join(receiver_thread, NULL);
+    close(netvars_socket);
+    netvars_socket = -1;
+}
+
+//-----------------------------------------------------------------------------
+// Copies the values of a subscription to the inputs, or clears them
+//-----------------------------------------------------------------------------
+static void writeSubscription(NetVarSubscription *subscription, const uint8_t *payload)
+{
+    for (int i = subscription->first_field; i < subscription->first_field + subscription->field_count; i++)
+    {
+        const NetVarField *field = &fields[i];
+        const uint8_t *value = payload + field->offset;
+        switch (field->size)
+        {
+            case 1: *(IEC_BOOL *)field->target = payload ? (*value >> field->bit) & 1 : 0; break;
+            case 2: *(IEC_UINT *)field->target = payload ? getU16(value) : 0; break;
+            case 4: *(IEC_UDINT *)field->target = payload ? getU32(value) : 0; break;
+            case 8: *(IEC_ULINT *)field->target = payload ? getU64(value) : 0; break;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// This function is called by the OpenPLC in a loop, with the buffers locked.
+// The latest values of each subscription are copied to its inputs while
+// they are fresh. It never waits for the receiver thread
+//-----------------------------------------------------------------------------
+void updateBuffersIn_NetVars()
+{
+    if (subscription_count == 0 || !netvars_running) return;
+
+    int64_t now = monotonicNs();
+    for (int s = 0; s < subscription_count; s++)
+    {
+        NetVarSubscription *subscription = &subscriptions[s];
+        if (subscription->shared.load(std::memory_order_relaxed) & NETVARS_FRESH_BUFFER)
+        {
+            subscription->consumer = subscription->shared.exchange(subscription->consumer, std::memory_order_acq_rel) & 3;
+        }
+
+        int64_t received = subscription->received_ns.load(std::memory_order_acquire);
+        bool fresh = received != 0 && now - received <= (int64_t)subscription->timeout_ms * 1000000LL;
+        if (fresh)
+        {
+            writeSubscription(subscription, subscription->buffers[subscription->consumer]);
+        }
+        else if (!subscription->hold)
+        {
+            writeSubscription(subscription, NULL);
+        }
+
+        if (subscription->fresh && !fresh) subscription->timeouts.fetch_add(1, std::memory_order_relaxed);
+        subscription->fresh = fresh;
+        if (subscription->status != NULL) *subscription->status = fresh;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Sends the counters of the publications and subscriptions to a client, one
+// line each
+//-----------------------------------------------------------------------------
+void sendNetworkVariableStats(LogWriter writer, void *context)
+{
+    char line[512];
+    int length;
+
+    if (!netvars_running)
+    {
+        length = snprintf(line, sizeof(line), "network variables not running\n");
+        writer(context, line, length);
+        return;
+    }
+
+    for (int p = 0; p < publication_count; p++)
+    {
+        NetVarPublication *publication = &publications[p];
+        length = snprintf(line, sizeof(line), "publish node %d id %d fields %d bytes %d frames %llu send_errors %llu\n",
+                          config.node, publication->id, publication->field_count, (int)publication->frame_size,
+                          (unsigned long long)publication->frames.load(std::memory_order_relaxed),
+                          (unsigned long long)publication->send_errors.load(std::memory_order_relaxed));
+        if (writer(context, line, length) < 0) return;
+    }
+
+    int64_t now = monotonicNs();
+    for (int s = 0; s < subscription_count; s++)
+    {
+        NetVarSubscription *subscription = &subscriptions[s];
+        int64_t received = subscription->received_ns.load(std::memory_order_relaxed);
+        length = snprintf(line, sizeof(line), "subscribe node %d id %d fields %d frames %llu lost %llu dropped %llu layout_errors %llu timeouts %llu age_ms %lld\n",
+                          subscription->node, subscription->id, subscription->field_count,
+                          (unsigned long long)subscription->frames.load(std::memory_order_relaxed),
+                          (unsigned long long)subscription->lost.load(std::memory_order_relaxed),
+                          (unsigned long long)subscription->dropped.load(std::memory_order_relaxed),
+                          (unsigned long long)subscription->layout_errors.load(std::memory_order_relaxed),
+                          (unsigned long long)subscription->timeouts.load(std::memory_order_relaxed),
+                          received != 0 ? (long long)((now - received) / 1000000) : -1LL);
+        if (writer(context, line, length) < 0) return;
+    }
+}
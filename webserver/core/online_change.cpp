@@ -0,0 +1,387 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the online change of the PLC program. The runtime
+// runs the program through the entry points of a PlcProgram (plc_program.h),
+// which start as the ones of the program linked in the executable. A new
+// program built as a shared object (compile_program.sh online) is loaded
+// and prepared by the thread that requested the change, and the scan thread
+// swaps it in at the start of a scan: the new program is initialized on the
+// process image of the running one, the variables with the same name and
+// type get the values of the old program, and the next config_run__ is
+// already the new one. The I/O and the located variables are never touched.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <atomic>
+
+#include "ladder.h"
+
+#define ONLINE_CHANGE_TIMEOUT_MS    10000
+
+struct VariableCopy
+{
+    void *destination;
+    const void *source;
+    size_t size;
+};
+
+struct ImageArea
+{
+    void *data;
+    size_t size;
+};
+
+struct OnlineChange
+{
+    void *handle;
+    PlcProgram program;
+    std::vector<VariableCopy> copies;
+    std::vector<unsigned char> image_backup;
+};
+
+//-----------------------------------------------------------------------------
+// Areas that the initialization of a program writes through its located
+// variables. They are saved before and restored after the new program is
+// initialized, so the running process image is kept
+//-----------------------------------------------------------------------------
+static const ImageArea image_areas[] =
+{
+    { bool_input_image, sizeof(bool_input_image) },
+    { bool_output_image, sizeof(bool_output_image) },
+    { bool_memory_image, sizeof(bool_memory_image) },
+    { byte_input_image, sizeof(byte_input_image) },
+    { byte_output_image, sizeof(byte_output_image) },
+    { byte_memory_image, sizeof(byte_memory_image) },
+    { int_input_image, sizeof(int_input_image) },
+    { int_output_image, sizeof(int_output_image) },
+    { int_memory_image, sizeof(int_memory_image) },
+    { dint_input_image, sizeof(dint_input_image) },
+    { dint_output_image, sizeof(dint_output_image) },
+    { dint_memory_image, sizeof(dint_memory_image) },
+    { lint_input_image, sizeof(lint_input_image) },
+    { lint_output_image, sizeof(lint_output_image) },
+    { lint_memory_image, sizeof(lint_memory_image) },
+    { real_input_image, sizeof(real_input_image) },
+    { real_output_image, sizeof(real_output_image) },
+    { real_memory_image, sizeof(real_memory_image) },
+    { lreal_input_image, sizeof(lreal_input_image) },
+    { lreal_output_image, sizeof(lreal_output_image) },
+    { lreal_memory_image, sizeof(lreal_memory_image) },
+};
+
+//-----------------------------------------------------------------------------
+// Presence bitmaps. The new program flags its own located variables on them
+//-----------------------------------------------------------------------------
+static const ImageArea presence_bitmaps[] =
+{
+    { bool_input_present, sizeof(bool_input_present) },
+    { bool_output_present, sizeof(bool_output_present) },
+    { byte_input_present, sizeof(byte_input_present) },
+    { byte_output_present, sizeof(byte_output_present) },
+    { int_input_present, sizeof(int_input_present) },
+    { int_output_present, sizeof(int_output_present) },
+    { dint_input_present, sizeof(dint_input_present) },
+    { dint_output_present, sizeof(dint_output_present) },
+    { lint_input_present, sizeof(lint_input_present) },
+    { lint_output_present, sizeof(lint_output_present) },
+    { real_input_present, sizeof(real_input_present) },
+    { real_output_present, sizeof(real_output_present) },
+    { lreal_input_present, sizeof(lreal_input_present) },
+    { lreal_output_present, sizeof(lreal_output_present) },
+    { int_memory_present, sizeof(int_memory_present) },
+    { dint_memory_present, sizeof(dint_memory_present) },
+    { lint_memory_present, sizeof(lint_memory_present) },
+    { real_memory_present, sizeof(real_memory_present) },
+    { lreal_memory_present, sizeof(lreal_memory_present) },
+};
+
+//-----------------------------------------------------------------------------
+// Pointer tables glued by glueVars. They point at the images and don't change
+// once the program is glued, so they are kept read-only and only the glueVars
+// of an online change writes them
+//-----------------------------------------------------------------------------
+static const ImageArea pointer_tables[] =
+{
+    { bool_input, sizeof(bool_input) }, { bool_output, sizeof(bool_output) },
+    { byte_input, sizeof(byte_input) }, { byte_output, sizeof(byte_output) },
+    { int_input, sizeof(int_input) }, { int_output, sizeof(int_output) },
+    { dint_input, sizeof(dint_input) }, { dint_output, sizeof(dint_output) },
+    { lint_input, sizeof(lint_input) }, { lint_output, sizeof(lint_output) },
+    { real_input, sizeof(real_input) }, { real_output, sizeof(real_output) },
+    { lreal_input, sizeof(lreal_input) }, { lreal_output, sizeof(lreal_output) },
+    { int_memory, sizeof(int_memory) }, { dint_memory, sizeof(dint_memory) },
+    { lint_memory, sizeof(lint_memory) }, { real_memory, sizeof(real_memory) },
+    { lreal_memory, sizeof(lreal_memory) }, { special_functions, sizeof(special_functions) },
+};
+static bool pointers_frozen = false;
+
+static PlcProgram linked_program;
+static std::atomic<PlcProgram *> active_program(&linked_program);
+
+// Change prepared by loadOnlineChange() and applied by the scan thread
+static std::atomic<OnlineChange *> pending_change(NULL);
+static std::atomic<bool> change_applied(false);
+static pthread_mutex_t changeLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Programs loaded so far. They are never unloaded, as the protocol threads
+// may still be using the debug functions of a program that was replaced
+static std::vector<OnlineChange *> loaded_programs;
+
+//-----------------------------------------------------------------------------
+// Sets the program linked in the executable as the active one. Must be
+// called before the program is initialized
+//-----------------------------------------------------------------------------
+void initializePlcProgram()
+{
+    getPlcProgram(&linked_program);
+    active_program.store(&linked_program, std::memory_order_release);
+}
+
+//-----------------------------------------------------------------------------
+// Returns the program the scan is running
+//-----------------------------------------------------------------------------
+PlcProgram *plcProgram()
+{
+    return active_program.load(std::memory_order_acquire);
+}
+
+//-----------------------------------------------------------------------------
+// Matches the variables of the new program with the ones of the running
+// program by name and type. Returns the number of variables carried over
+//-----------------------------------------------------------------------------
+static size_t matchVariables(const PlcProgram *from, const PlcProgram *to, std::vector<VariableCopy> *copies)
+{
+    std::map<std::string, const PlcVariable *> running;
+    for (size_t i = 0; i < from->variable_count; i++)
+    {
+        running[from->variables[i].name] = &from->variables[i];
+    }
+
+    for (size_t i = 0; i < to->variable_count; i++)
+    {
+        const PlcVariable *var = &to->variables[i];
+        std::map<std::string, const PlcVariable *>::iterator old = running.find(var->name);
+        if (old == running.end()) continue;
+        if (strcmp(old->second->type, var->type) != 0 || old->second->size != var->size) continue;
+
+        VariableCopy copy = { var->value, old->second->value, var->size };
+        copies->push_back(copy);
+    }
+
+    return copies->size();
+}
+
+//-----------------------------------------------------------------------------
+// Loads the program built as a shared object at path and waits for the scan
+// thread to swap it in. Returns 0 on success, or -1 if the program could not
+// be loaded or was not swapped in time
+//-----------------------------------------------------------------------------
+int loadOnlineChange(const char *path)
+{
+    char log_msg[1000];
+
+    pthread_mutex_lock(&changeLock);
+
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL)
+    {
+        sprintf(log_msg, "Online change: failed to load %s: %s\n", path, dlerror());
+        openplc_log(log_msg);
+        pthread_mutex_unlock(&changeLock);
+        return -1;
+    }
+
+    void (*get_program)(PlcProgram *) = (void (*)(PlcProgram *))dlsym(handle, "getPlcProgram");
+    if (get_program == NULL)
+    {
+        sprintf(log_msg, "Online change: %s is not a PLC program\n", path);
+        openplc_log(log_msg);
+        dlclose(handle);
+        pthread_mutex_unlock(&changeLock);
+        return -1;
+    }
+
+    OnlineChange *change = new OnlineChange;
+    change->handle = handle;
+    get_program(&change->program);
+    if (change->program.version != PLC_PROGRAM_VERSION)
+    {
+        sprintf(log_msg, "Online change: %s was built for another runtime version\n", path);
+        openplc_log(log_msg);
+        dlclose(handle);
+        delete change;
+        pthread_mutex_unlock(&changeLock);
+        return -1;
+    }
+    // The images belong to the runtime, the new program must be built for
+    // the same size (glue_generator --image-size)
+    if (change->program.image_size != BUFFER_SIZE)
+    {
+        sprintf(log_msg, "Online change: %s was built for images of %u entries, the runtime has %d\n", path, change->program.image_size, BUFFER_SIZE);
+        openplc_log(log_msg);
+        dlclose(handle);
+        delete change;
+        pthread_mutex_unlock(&changeLock);
+        return -1;
+    }
+
+    // Both sides must store REAL the same way (scripts/fixed_real)
+    if (change->program.real_frac_bits != PLC_REAL_FRAC_BITS)
+    {
+        sprintf(log_msg, "Online change: %s was built with another REAL format, restart the runtime to run it\n", path);
+        openplc_log(log_msg);
+        dlclose(handle);
+        delete change;
+        pthread_mutex_unlock(&changeLock);
+        return -1;
+    }
+
+    size_t image_size = 0;
+    for (size_t i = 0; i < sizeof(image_areas) / sizeof(image_areas[0]); i++)
+    {
+        image_size += image_areas[i].size;
+    }
+    change->image_backup.resize(image_size);
+
+    PlcProgram *running = plcProgram();
+    size_t matched = matchVariables(running, &change->program, &change->copies);
+
+    // The trace samples the debug variables of the running program
+    stopTrace();
+
+    change_applied.store(false, std::memory_order_relaxed);
+    pending_change.store(change, std::memory_order_release);
+
+    int waited = 0;
+    while (!change_applied.load(std::memory_order_acquire) && waited < ONLINE_CHANGE_TIMEOUT_MS && run_openplc)
+    {
+        sleepms(10);
+        waited += 10;
+    }
+
+    OnlineChange *expected = change;
+    if (!change_applied.load(std::memory_order_acquire) && pending_change.compare_exchange_strong(expected, NULL))
+    {
+        sprintf(log_msg, "Online change: the scan did not pick up %s\n", path);
+        openplc_log(log_msg);
+        dlclose(handle);
+        delete change;
+        pthread_mutex_unlock(&changeLock);
+        return -1;
+    }
+
+    loaded_programs.push_back(change);
+    // The tags follow the located variables of the new program
+    buildTagDatabase();
+    sprintf(log_msg, "Online change: %s is running, %lu of %lu variables carried over\n", path,
+            (unsigned long)matched, (unsigned long)change->program.variable_count);
+    openplc_log(log_msg);
+
+    pthread_mutex_unlock(&changeLock);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Sets the protection of the whole pages of the pointer tables. The pages
+// they share with other variables at their ends are left writable
+//-----------------------------------------------------------------------------
+static void protectPointerTables(int protection)
+{
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < sizeof(pointer_tables) / sizeof(pointer_tables[0]); i++)
+    {
+        uintptr_t start = ((uintptr_t)pointer_tables[i].data + page - 1) & ~(page - 1);
+        uintptr_t end = ((uintptr_t)pointer_tables[i].data + pointer_tables[i].size) & ~(page - 1);
+        if (end > start) mprotect((void *)start, end - start, protection);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Makes the pointer tables read-only. Called once the program is glued, so
+// the threads that resolve a location can keep the pointer, and a stray
+// write to the tables faults instead of moving a variable
+//-----------------------------------------------------------------------------
+void freezeImagePointers()
+{
+    protectPointerTables(PROT_READ);
+    pointers_frozen = true;
+}
+
+//-----------------------------------------------------------------------------
+// Swaps in the program prepared by loadOnlineChange(). Called by the scan
+// thread before the program runs, holding bufferLock
+//-----------------------------------------------------------------------------
+void applyOnlineChange()
+{
+    if (pending_change.load(std::memory_order_relaxed) == NULL) return;
+    OnlineChange *change = pending_change.exchange(NULL, std::memory_order_acquire);
+    if (change == NULL) return;
+
+    PlcProgram *program = &change->program;
+
+    // The initialization writes the initial values of the located variables
+    // to the process image, which must keep the values of the running scan
+    unsigned char *backup = change->image_backup.data();
+    for (size_t i = 0; i < sizeof(image_areas) / sizeof(image_areas[0]); i++)
+    {
+        memcpy(backup, image_areas[i].data, image_areas[i].size);
+        backup += image_areas[i].size;
+    }
+    program->config_init();
+    backup = change->image_backup.data();
+    for (size_t i = 0; i < sizeof(image_areas) / sizeof(image_areas[0]); i++)
+    {
+        memcpy(image_areas[i].data, backup, image_areas[i].size);
+        backup += image_areas[i].size;
+    }
+
+    for (size_t i = 0; i < sizeof(presence_bitmaps) / sizeof(presence_bitmaps[0]); i++)
+    {
+        memset(presence_bitmaps[i].data, 0, presence_bitmaps[i].size);
+    }
+    // The new program points the buffers at the same slots of the images,
+    // only its special functions may differ
+    if (pointers_frozen) protectPointerTables(PROT_READ | PROT_WRITE);
+    for (int i = 0; i < BUFFER_SIZE; i++)
+    {
+        special_functions[i] = NULL;
+    }
+    program->glue_vars();
+    if (pointers_frozen) protectPointerTables(PROT_READ);
+    buildImageRanges();
+
+    for (size_t i = 0; i < change->copies.size(); i++)
+    {
+        memcpy(change->copies[i].destination, change->copies[i].source, change->copies[i].size);
+    }
+
+    program->update_time();
+    resetForcedVariables();
+    resetPouProfile();
+    active_program.store(program, std::memory_order_release);
+    change_applied.store(true, std::memory_order_release);
+}
@@ -20,27 +20,40 @@
 // It exposes all PLC runtime variables as OPC UA nodes for reading and writing.
 // 
 // Features:
-// - Scans all OpenPLC runtime variables (bool_input, bool_output, int_input, etc.)
+// - Exports the located variables listed on the address space table that the
+//   glue generator builds with the program (see plc_program.h)
+// - Historical Access to the nodes recorded by the historian
+// - Exports ranges of locations as one array node, with IndexRange support
+// - Optionally samples the nodes on the scan, stamped with the scan time
 // - Creates corresponding OPC UA nodes in the address space
 // - Handles read/write operations from OPC UA clients
 // - Thread-safe access to PLC variables using mutex locks
+// - Optional Basic256Sha256 and Aes128_Sha256_RsaOaep security policies
 //
 //-----------------------------------------------------------------------------
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <strings.h>
 #include <pthread.h>
 #include <signal.h>
 #include <unistd.h>
 #include <time.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 
 // OPC UA includes
 #include <open62541/server.h>
 #include <open62541/server_config_default.h>
 #include <open62541/plugin/log_stdout.h>
 #include <open62541/plugin/accesscontrol_default.h>
+#ifdef UA_ENABLE_HISTORIZING
+#include <open62541/plugin/historydatabase.h>
+#endif
 
 #include "ladder.h"
 
@@ -49,15 +62,66 @@ static UA_Server *g_opcua_server = NULL;
 static pthread_mutex_t opcua_mutex = PTHREAD_MUTEX_INITIALIZER;
 static bool g_opcua_running = false;
 static UA_UInt16 g_namespace_index = 1;
+// When set, nodes are created as data sources that read the values copied by
+// the sync stage on demand instead of being pushed to the address space. The
+// requested mode is latched when the server starts
+static bool g_data_source_requested = false;
+static bool g_data_source_mode = false;
+// When set (scan sampling), the values are sampled by the PLC thread every
+// g_scan_sampling scans and every change is queued with the time of its scan,
+// so the nodes receive each change in order with that SourceTimestamp.
+// MonitoredItems with a sampling interval of 0 are sampled on those writes.
+// Latched when the server starts, not used with data source nodes
+static unsigned int g_scan_sampling_requested = 0;
+static unsigned int g_scan_sampling = 0;
+
+// Server limits and network buffers given on start_opcua(). Zero keeps the
+// open62541 default of the setting
+struct OpcServerTuning {
+    UA_UInt32 maxSessions;
+    UA_UInt32 maxSubscriptions;
+    UA_UInt32 maxSubscriptionsPerSession;
+    UA_UInt32 maxMonitoredItems;
+    UA_UInt32 maxMonitoredItemsPerSubscription;
+    UA_UInt32 maxNotificationsPerPublish;
+    UA_UInt32 maxNodesPerRead;
+    UA_UInt32 maxNodesPerWrite;
+    UA_Double minPublishingInterval;    // ms
+    UA_Double minSamplingInterval;      // ms
+    UA_UInt32 sendBufferSize;           // bytes, also the chunk size
+    UA_UInt32 recvBufferSize;
+    UA_UInt32 maxMessageSize;
+    UA_UInt32 maxChunkCount;
+    UA_UInt32 maxSecurityTokenLifetime; // ms, the asymmetric crypto runs on each renewal
+    UA_UInt32 maxReferencesPerNode;     // references per Browse result, the rest on continuation points
+    UA_UInt32 maxNodesPerBrowse;
+    UA_UInt32 flatAddressSpace;         // 1 for every variable right under ProgramVariables
+};
 
-// Binding passed as node context for callbacks
-typedef struct OpcVarBinding {
-    void *variablePtr; // original PLC pointer (unused for reads now)
-    const UA_DataType *dataType;
-    // Shadow value pointer owned by OPC UA; read callback uses only this
-    void *shadowPtr;
-    struct OpcVarBinding *next;
-} OpcVarBinding;
+// References a Browse returns at once when no max_references_per_node is
+// given, so a client that asks for them all still gets them in pages
+#define OPC_BROWSE_PAGE_SIZE    1000
+static OpcServerTuning g_tuning;
+
+// Security policies given on opcua_security(). The certificate and the key
+// are read once and kept across restarts, a file is only read again when its
+// path or its modification time changes
+#define OPC_POLICY_NONE             0x01
+#define OPC_POLICY_BASIC256SHA256   0x02
+#define OPC_POLICY_AES128           0x04
+struct OpcSecurityFile {
+    char path[256];
+    char loadedPath[256];
+    time_t mtime;
+    UA_ByteString data;
+};
+struct OpcServerSecurity {
+    unsigned int policies;
+    char applicationUri[256];
+    OpcSecurityFile certificate;
+    OpcSecurityFile privateKey;
+};
+static OpcServerSecurity g_security = { OPC_POLICY_NONE };
 
 static const char* uaTypeName(const UA_DataType *t) {
     if (!t) return "<null>";
@@ -81,18 +145,193 @@ static void formatNodeId(const UA_NodeId *id, char *buf, size_t buflen) {
     }
 }
 
-// Head of linked list of all bindings for shadow synchronization
-static OpcVarBinding *g_binding_head = NULL;
-
-// Simple node tracking for periodic updates
+// Node table. Every exported variable gets one slot, allocated once at
+// startup with the exact number of candidates so that the entries (which are
+// the node contexts) never move. The slot index is the node's syncIndex
 struct OpcNodeInfo {
     UA_NodeId nodeId;
     void *variablePtr;
     const UA_DataType *dataType;
-    OpcNodeInfo *next;
+    size_t count;  // elements of an array node, 1 for a scalar node
+    int syncIndex; // slot on the node table and on the sync arrays below
+    bool historized;        // recorded by the historian, see Historical Access
+    uint32_t historyTag;    // historian tag of the node
 };
-static OpcNodeInfo *g_node_list = NULL;
+static OpcNodeInfo *g_nodes = NULL;
 static int g_node_count = 0;
+static int g_node_capacity = 0;
+
+// Sync stage state. Once per scan the PLC thread copies the raw value of every
+// node into g_sync_values (while holding bufferLock, so the copy is consistent).
+// The OPC UA thread takes that copy, compares it against the last values it
+// wrote to the address space and only calls UA_Server_writeValue for the nodes
+// that changed. g_sync_lock is only ever trylock'ed by the PLC thread, so the
+// scan never blocks on the OPC UA thread. Array nodes are contiguous on the
+// images, so each one is copied with a single memcpy. The nodes of an input
+// (%IX, %IW) take the time the input changed as SourceTimestamp (sequence of
+// events, see getInputChangeTime)
+struct OpcSyncEntry {
+    void *variablePtr;
+    size_t size;    // size of one element
+    size_t count;   // elements, 1 for a scalar node
+    size_t offset;  // offset of the value on the sync buffers, 8 byte aligned
+    int inputArea;  // PI_BOOL_INPUT or PI_INT_INPUT for the node of an input, -1 otherwise
+    uint32_t inputIndex;
+};
+static pthread_mutex_t g_sync_lock = PTHREAD_MUTEX_INITIALIZER;
+static OpcSyncEntry *g_sync_entries = NULL; // indexed by syncIndex
+static UA_Byte *g_sync_values = NULL;       // written by the PLC thread
+static size_t g_sync_size = 0;              // bytes on each sync buffer
+static unsigned long g_sync_generation = 0; // bumped on every PLC copy
+static int g_sync_count = 0;
+static int g_sync_eventfd = -1;             // signaled after every PLC copy
+
+// Longest time the OPC UA thread sleeps without checking the network. The
+// server is iterated without blocking so that a PLC copy can wake it, hence
+// this bounds the latency of client requests
+#define OPCUA_MAX_WAIT_MS 5
+
+// Client writes. Writes are staged while the server processes requests and
+// committed as one batch when UA_Server_run_iterate returns, so all the nodes
+// of a Write service call land on the same scan. The batch goes into a
+// bounded MPSC ring: producers reserve slots with a CAS on g_ring_reserved,
+// fill them and then commit in reservation order. The scan thread drains
+// everything committed right before the program runs
+#define OPCUA_WRITE_RING_SIZE 4096 // must be a power of two
+
+struct OpcWrite {
+    int syncIndex;
+    UA_UInt32 element; // element of an array node, 0 for a scalar node
+    UA_UInt64 value;
+};
+static OpcWrite g_write_ring[OPCUA_WRITE_RING_SIZE];
+static std::atomic<unsigned long> g_ring_reserved(0);
+static std::atomic<unsigned long> g_ring_committed(0);
+static std::atomic<unsigned long> g_ring_consumed(0);
+
+// Owned by the OPC UA thread only
+static OpcWrite g_staged_writes[OPCUA_WRITE_RING_SIZE];
+static int g_staged_count = 0;
+static UA_Byte *g_pending_values = NULL;        // last copy taken from the PLC
+static UA_Byte *g_published_values = NULL;      // last values written to the nodes
+static bool *g_published_valid = NULL;
+static unsigned long g_published_generation = 0;
+static bool g_publishing = false;               // set while the sync writes a node
+
+// Scan sampling. The PLC thread compares every sampled scan with the values
+// it queued last (kept on g_sync_values) and appends the changes to an SPSC
+// ring drained by the OPC UA thread. Scalar changes carry their value; for an
+// array node the OPC UA thread takes the array from g_sync_values. When the
+// ring is full the remaining nodes keep their old value on g_sync_values, so
+// their change is queued on a later scan
+#define OPCUA_CHANGE_RING_SIZE 16384 // must be a power of two
+
+struct OpcChange {
+    int syncIndex;
+    UA_UInt64 value;
+    UA_DateTime timestamp;
+};
+static OpcChange g_change_ring[OPCUA_CHANGE_RING_SIZE];
+static std::atomic<unsigned long> g_change_head(0); // written by the PLC thread
+static std::atomic<unsigned long> g_change_tail(0); // written by the OPC UA thread
+static unsigned int g_scan_counter = 0;             // PLC thread only
+static bool *g_scan_dirty = NULL;                   // nodes written by a client, requeued on the next sample
+
+//-----------------------------------------------------------------------------
+// Stage a client value for the PLC variable behind a node. It is handed to
+// the scan thread when the current server iteration ends. Array nodes take
+// either the whole array or the elements of a one dimension index range,
+// staged as one write per element
+//-----------------------------------------------------------------------------
+static UA_StatusCode writePlcValue(OpcNodeInfo *info, const UA_Variant *value, const UA_NumericRange *range) {
+    if (!info || !info->variablePtr || !info->dataType) return UA_STATUSCODE_BADINTERNALERROR;
+    if (value->data == NULL || value->type == NULL) return UA_STATUSCODE_BADTYPEMISMATCH;
+    if (value->type != info->dataType) return UA_STATUSCODE_BADTYPEMISMATCH;
+    if (info->syncIndex < 0 || info->syncIndex >= g_sync_count) return UA_STATUSCODE_BADINTERNALERROR;
+
+    bool ranged = (range != NULL && range->dimensionsSize > 0);
+    size_t first = 0;
+    size_t count = 1;
+    if (info->count == 1) {
+        if (ranged) return UA_STATUSCODE_BADINDEXRANGEINVALID;
+        if (!UA_Variant_isScalar(value)) return UA_STATUSCODE_BADTYPEMISMATCH;
+    } else {
+        if (UA_Variant_isScalar(value) || value->data == UA_EMPTY_ARRAY_SENTINEL) return UA_STATUSCODE_BADTYPEMISMATCH;
+        count = value->arrayLength;
+        if (ranged) {
+            if (range->dimensionsSize != 1) return UA_STATUSCODE_BADINDEXRANGENODATA;
+            first = range->dimensions[0].min;
+            if (range->dimensions[0].max - range->dimensions[0].min + 1 != count) return UA_STATUSCODE_BADINDEXRANGEINVALID;
+        } else if (count != info->count) {
+            return UA_STATUSCODE_BADTYPEMISMATCH;
+        }
+        if (first + count > info->count) return UA_STATUSCODE_BADINDEXRANGENODATA;
+    }
+    if (g_staged_count + count > OPCUA_WRITE_RING_SIZE) return UA_STATUSCODE_BADRESOURCEUNAVAILABLE;
+
+    size_t size = info->dataType->memSize;
+    for (size_t i = 0; i < count; i++) {
+        OpcWrite *w = &g_staged_writes[g_staged_count++];
+        w->syncIndex = info->syncIndex;
+        w->element = (UA_UInt32)(first + i);
+        w->value = 0;
+        memcpy(&w->value, (const UA_Byte*)value->data + i * size, size);
+    }
+
+    return UA_STATUSCODE_GOOD;
+}
+
+//-----------------------------------------------------------------------------
+// Commit a batch of writes to the ring. Either the whole batch is committed
+// or nothing is, in which case false is returned and the caller retries later
+//-----------------------------------------------------------------------------
+static bool commitWrites(const OpcWrite *writes, int count) {
+    if (count == 0) return true;
+
+    unsigned long start = g_ring_reserved.load(std::memory_order_relaxed);
+    do {
+        if (start + count - g_ring_consumed.load(std::memory_order_acquire) > OPCUA_WRITE_RING_SIZE) return false;
+    } while (!g_ring_reserved.compare_exchange_weak(start, start + count, std::memory_order_relaxed));
+
+    for (int i = 0; i < count; i++) {
+        g_write_ring[(start + i) & (OPCUA_WRITE_RING_SIZE - 1)] = writes[i];
+    }
+
+    // Batches become visible in the order they were reserved
+    while (g_ring_committed.load(std::memory_order_acquire) != start) sched_yield();
+    g_ring_committed.store(start + count, std::memory_order_release);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Hand the writes staged during the last server iteration to the scan thread
+//-----------------------------------------------------------------------------
+static void flushStagedWrites() {
+    if (commitWrites(g_staged_writes, g_staged_count)) g_staged_count = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Apply every committed client write. Called by the scan thread with
+// bufferLock held, before the program logic executes. If the OPC UA thread
+// holds the sync table the writes are left for the next cycle
+//-----------------------------------------------------------------------------
+extern "C" void opcuaApplyWrites() {
+    unsigned long consumed = g_ring_consumed.load(std::memory_order_relaxed);
+    unsigned long committed = g_ring_committed.load(std::memory_order_acquire);
+    if (consumed == committed) return;
+    if (pthread_mutex_trylock(&g_sync_lock) != 0) return;
+
+    for (unsigned long i = consumed; i != committed; i++) {
+        const OpcWrite *w = &g_write_ring[i & (OPCUA_WRITE_RING_SIZE - 1)];
+        if (w->syncIndex < 0 || w->syncIndex >= g_sync_count) continue;
+        const OpcSyncEntry *entry = &g_sync_entries[w->syncIndex];
+        if (w->element >= entry->count) continue;
+        memcpy((UA_Byte*)entry->variablePtr + w->element * entry->size, &w->value, entry->size);
+    }
+    g_ring_consumed.store(committed, std::memory_order_release);
+
+    pthread_mutex_unlock(&g_sync_lock);
+}
 
 // onWrite callback for simple variable nodes: copy client value into PLC memory
 static void onVariableValueWrite(UA_Server *server,
@@ -106,38 +345,20 @@ static void onVariableValueWrite(UA_Server *server,
     (void)sessionId;
     (void)sessionContext;
     (void)nodeId;
-    (void)range;
     if (!nodeContext || !data || !data->hasValue) return;
+    // Values written by the sync come from the PLC, don't write them back
+    if (g_publishing) return;
     OpcNodeInfo *info = (OpcNodeInfo*)nodeContext;
-    if (!info || !info->variablePtr || !info->dataType) return;
-    if (!UA_Variant_isScalar(&data->value) || data->value.data == NULL || data->value.type == NULL) return;
-    if (data->value.type != info->dataType) return;
-
-    pthread_mutex_lock(&bufferLock);
-    if (info->dataType == &UA_TYPES[UA_TYPES_BOOLEAN]) {
-        *(IEC_BOOL*)info->variablePtr = *(const UA_Boolean*)data->value.data;
-    } else if (info->dataType == &UA_TYPES[UA_TYPES_BYTE]) {
-        *(IEC_BYTE*)info->variablePtr = *(const UA_Byte*)data->value.data;
-    } else if (info->dataType == &UA_TYPES[UA_TYPES_SBYTE]) {
-        *(IEC_SINT*)info->variablePtr = *(const UA_SByte*)data->value.data;
-    } else if (info->dataType == &UA_TYPES[UA_TYPES_INT16]) {
-        *(IEC_INT*)info->variablePtr = *(const UA_Int16*)data->value.data;
-    } else if (info->dataType == &UA_TYPES[UA_TYPES_INT32]) {
-        *(IEC_DINT*)info->variablePtr = *(const UA_Int32*)data->value.data;
-    } else if (info->dataType == &UA_TYPES[UA_TYPES_INT64]) {
-        *(IEC_LINT*)info->variablePtr = *(const UA_Int64*)data->value.data;
-    } else if (info->dataType == &UA_TYPES[UA_TYPES_UINT16]) {
-        *(IEC_UINT*)info->variablePtr = *(const UA_UInt16*)data->value.data;
-    } else if (info->dataType == &UA_TYPES[UA_TYPES_UINT32]) {
-        *(IEC_UDINT*)info->variablePtr = *(const UA_UInt32*)data->value.data;
-    } else if (info->dataType == &UA_TYPES[UA_TYPES_UINT64]) {
-        *(IEC_ULINT*)info->variablePtr = *(const UA_UInt64*)data->value.data;
-    } else if (info->dataType == &UA_TYPES[UA_TYPES_FLOAT]) {
-        *(IEC_REAL*)info->variablePtr = *(const UA_Float*)data->value.data;
-    } else if (info->dataType == &UA_TYPES[UA_TYPES_DOUBLE]) {
-        *(IEC_LREAL*)info->variablePtr = *(const UA_Double*)data->value.data;
-    }
-    pthread_mutex_unlock(&bufferLock);
+    bool written = writePlcValue(info, &data->value, range) == UA_STATUSCODE_GOOD;
+    recordProtocolRequest(OPCUA_PROTOCOL, !written);
+    if (!written) return;
+
+    // The node now holds the client value. Force the next sync to rewrite it
+    // even if the PLC keeps the variable at the value published before
+    if (g_published_valid && info->syncIndex >= 0 && info->syncIndex < g_sync_count) {
+        g_published_valid[info->syncIndex] = false;
+        if (g_scan_dirty) __atomic_store_n(&g_scan_dirty[info->syncIndex], true, __ATOMIC_RELEASE);
+    }
 }
 
 // Node ID definitions for different variable types
@@ -168,12 +389,11 @@ static UA_StatusCode writeVariableValue(UA_Server *server, const UA_NodeId *sess
                                       const UA_DataValue *dataValue);
 
 static void addVariableNode(UA_Server *server, const char *nodeName, UA_NodeId parentNodeId,
-                           UA_NodeId nodeId, void *variablePtr, UA_DataType *dataType);
+                           UA_NodeId nodeId, void *variablePtr, UA_DataType *dataType, size_t count);
 
 static void scanAndCreateNodes(UA_Server *server);
 static int createNodesFromLocatedVariables(UA_Server *server);
 static void createProgramVariablesFolder(UA_Server *server, UA_NodeId *outFolderId);
-static bool resolvePointerFromLocation(const char *location, void **outPtr, const UA_DataType **outType);
 static void createFolderStructure(UA_Server *server);
 static void registerNamespace(UA_Server *server);
 
@@ -201,84 +421,78 @@ static void logOpen62541AbiInfo(UA_Server *server) {
 }
 
 //-----------------------------------------------------------------------------
-// Read handler for OPC UA variables
+// SourceTimestamp of a node: the time its input last changed for the node of
+// an input, fallback for the other nodes
+//-----------------------------------------------------------------------------
+static UA_DateTime sourceTimestamp(const OpcSyncEntry *entry, UA_DateTime fallback) {
+    if (entry->inputArea < 0) return fallback;
+    uint64_t changed = getInputChangeTime(entry->inputArea, entry->inputIndex);
+    return changed ? UA_DATETIME_UNIX_EPOCH + (UA_DateTime)changed * UA_DATETIME_USEC : fallback;
+}
+
+//-----------------------------------------------------------------------------
+// Read handler for data source nodes. Returns the value copied by the sync
+// stage on the last scan, so a read never touches the PLC buffers. Reads of
+// an index range of an array node only copy the requested elements
 //-----------------------------------------------------------------------------
 static UA_StatusCode readVariableValue(UA_Server *server, const UA_NodeId *sessionId,
                                      void *sessionContext, const UA_NodeId *nodeId,
                                      void *nodeContext, UA_Boolean sourceTimeStamp,
                                      const UA_NumericRange *range, UA_DataValue *dataValue) {
+    (void)server;
     (void)sessionId;
     (void)sessionContext;
-    (void)sourceTimeStamp;
-    (void)range;
+    (void)nodeId;
 
-    if (!nodeContext || !dataValue) {
+    OpcNodeInfo *info = (OpcNodeInfo*)nodeContext;
+    if (!info || !info->dataType || !dataValue) {
         return UA_STATUSCODE_BADINTERNALERROR;
     }
-    // Do not call UA_DataValue_init here to avoid ABI-size mismatches
 
-    // No locking in the minimal test path
-    
-    // Cast the node context to binding
-    OpcVarBinding *binding = (OpcVarBinding*)nodeContext;
-    // No logging in the minimal test path
-
-    if (!binding || !binding->dataType || !binding->shadowPtr) {
-        // During node creation, nodeContext may be NULL. Return GOOD with no value.
-        dataValue->hasValue = false;
-        dataValue->hasStatus = true;
-        dataValue->status = UA_STATUSCODE_GOOD;
-        dataValue->hasSourceTimestamp = false;
-        return UA_STATUSCODE_GOOD;
-    }
-    // Read solely from shadow cache
-    UA_StatusCode sc = UA_STATUSCODE_BADTYPEMISMATCH;
-    if (binding->dataType == &UA_TYPES[UA_TYPES_BOOLEAN]) {
-        UA_Boolean v = *(const UA_Boolean*)binding->shadowPtr;
-        sc = UA_Variant_setScalarCopy(&dataValue->value, &v, &UA_TYPES[UA_TYPES_BOOLEAN]);
-    } else if (binding->dataType == &UA_TYPES[UA_TYPES_BYTE]) {
-        UA_Byte v = *(const UA_Byte*)binding->shadowPtr;
-        sc = UA_Variant_setScalarCopy(&dataValue->value, &v, &UA_TYPES[UA_TYPES_BYTE]);
-    } else if (binding->dataType == &UA_TYPES[UA_TYPES_SBYTE]) {
-        UA_SByte v = *(const UA_SByte*)binding->shadowPtr;
-        sc = UA_Variant_setScalarCopy(&dataValue->value, &v, &UA_TYPES[UA_TYPES_SBYTE]);
-    } else if (binding->dataType == &UA_TYPES[UA_TYPES_INT16]) {
-        UA_Int16 v = *(const UA_Int16*)binding->shadowPtr;
-        sc = UA_Variant_setScalarCopy(&dataValue->value, &v, &UA_TYPES[UA_TYPES_INT16]);
-    } else if (binding->dataType == &UA_TYPES[UA_TYPES_INT32]) {
-        UA_Int32 v = *(const UA_Int32*)binding->shadowPtr;
-        sc = UA_Variant_setScalarCopy(&dataValue->value, &v, &UA_TYPES[UA_TYPES_INT32]);
-    } else if (binding->dataType == &UA_TYPES[UA_TYPES_INT64]) {
-        UA_Int64 v = *(const UA_Int64*)binding->shadowPtr;
-        sc = UA_Variant_setScalarCopy(&dataValue->value, &v, &UA_TYPES[UA_TYPES_INT64]);
-    } else if (binding->dataType == &UA_TYPES[UA_TYPES_UINT16]) {
-        UA_UInt16 v = *(const UA_UInt16*)binding->shadowPtr;
-        sc = UA_Variant_setScalarCopy(&dataValue->value, &v, &UA_TYPES[UA_TYPES_UINT16]);
-    } else if (binding->dataType == &UA_TYPES[UA_TYPES_UINT32]) {
-        UA_UInt32 v = *(const UA_UInt32*)binding->shadowPtr;
-        sc = UA_Variant_setScalarCopy(&dataValue->value, &v, &UA_TYPES[UA_TYPES_UINT32]);
-    } else if (binding->dataType == &UA_TYPES[UA_TYPES_UINT64]) {
-        UA_UInt64 v = *(const UA_UInt64*)binding->shadowPtr;
-        sc = UA_Variant_setScalarCopy(&dataValue->value, &v, &UA_TYPES[UA_TYPES_UINT64]);
-    } else if (binding->dataType == &UA_TYPES[UA_TYPES_FLOAT]) {
-        UA_Float v = *(const UA_Float*)binding->shadowPtr;
-        sc = UA_Variant_setScalarCopy(&dataValue->value, &v, &UA_TYPES[UA_TYPES_FLOAT]);
-    } else if (binding->dataType == &UA_TYPES[UA_TYPES_DOUBLE]) {
-        UA_Double v = *(const UA_Double*)binding->shadowPtr;
-        sc = UA_Variant_setScalarCopy(&dataValue->value, &v, &UA_TYPES[UA_TYPES_DOUBLE]);
-    }
-    //dataValue->hasValue = (sc == UA_STATUSCODE_GOOD);
-    dataValue->hasValue = false;
-    //dataValue->status = sc;
-    dataValue->status = UA_STATUSCODE_GOOD;
-    dataValue->hasStatus = true;
-    dataValue->hasSourceTimestamp = false;
-    //return sc;
+    // Nodes are read for type checking while they are created, before the
+    // sync table exists. Report a zero of the right type in that case
+    UA_StatusCode sc;
+    UA_DateTime time = UA_DateTime_now();
+    if (info->count == 1) {
+        if (range != NULL && range->dimensionsSize > 0) return UA_STATUSCODE_BADINDEXRANGEINVALID;
+        UA_UInt64 raw = 0;
+        pthread_mutex_lock(&g_sync_lock);
+        if (info->syncIndex >= 0 && info->syncIndex < g_sync_count) {
+            const OpcSyncEntry *entry = &g_sync_entries[info->syncIndex];
+            memcpy(&raw, g_sync_values + entry->offset, entry->size);
+            time = sourceTimestamp(entry, time);
+        }
+        pthread_mutex_unlock(&g_sync_lock);
+        sc = UA_Variant_setScalarCopy(&dataValue->value, &raw, info->dataType);
+    } else {
+        pthread_mutex_lock(&g_sync_lock);
+        if (info->syncIndex >= 0 && info->syncIndex < g_sync_count) {
+            UA_Variant array;
+            UA_Variant_setArray(&array, g_sync_values + g_sync_entries[info->syncIndex].offset, info->count, info->dataType);
+            if (range != NULL && range->dimensionsSize > 0) {
+                sc = UA_Variant_copyRange(&array, &dataValue->value, *range);
+            } else {
+                sc = UA_Variant_setArrayCopy(&dataValue->value, array.data, info->count, info->dataType);
+            }
+        } else {
+            void *zeros = UA_Array_new(info->count, info->dataType);
+            sc = zeros ? UA_STATUSCODE_GOOD : UA_STATUSCODE_BADOUTOFMEMORY;
+            if (zeros) UA_Variant_setArray(&dataValue->value, zeros, info->count, info->dataType);
+        }
+        pthread_mutex_unlock(&g_sync_lock);
+    }
+    if (g_opcua_running) recordProtocolRequest(OPCUA_PROTOCOL, sc != UA_STATUSCODE_GOOD);
+    if (sc != UA_STATUSCODE_GOOD) return sc;
+    dataValue->hasValue = true;
+    if (sourceTimeStamp) {
+        dataValue->sourceTimestamp = time;
+        dataValue->hasSourceTimestamp = true;
+    }
     return UA_STATUSCODE_GOOD;
 }
 
 //-----------------------------------------------------------------------------
-// Write handler for OPC UA variables
+// Write handler for data source nodes
 //-----------------------------------------------------------------------------
 static UA_StatusCode writeVariableValue(UA_Server *server, const UA_NodeId *sessionId,
                                       void *sessionContext, const UA_NodeId *nodeId,
@@ -288,101 +502,31 @@ static UA_StatusCode writeVariableValue(UA_Server *server, const UA_NodeId *sess
     (void)sessionId;
     (void)sessionContext;
     (void)nodeId;
-    (void)range;
 
     if (!nodeContext || !dataValue || !dataValue->hasValue) {
+        recordProtocolRequest(OPCUA_PROTOCOL, true);
         return UA_STATUSCODE_BADINTERNALERROR;
     }
-
-    // Lock the buffer mutex to ensure thread safety
-    pthread_mutex_lock(&bufferLock);
-    
-    // Cast the node context to binding
-    OpcVarBinding *binding = (OpcVarBinding*)nodeContext;
-    char nid[64];
-    formatNodeId(nodeId, nid, sizeof(nid));
-    char log_msg_cb[256];
-    snprintf(log_msg_cb, sizeof(log_msg_cb), "OPCUA WRITE cb for %s ctx=%p var=%p type=%s hasValue=%d\n", nid, (void*)binding, binding ? binding->variablePtr : NULL, binding ? uaTypeName(binding->dataType) : "<null>", dataValue->hasValue);
-    openplc_log(log_msg_cb);
-    
-    // Validate variant
-    if (!UA_Variant_isScalar(&dataValue->value) || dataValue->value.data == NULL || dataValue->value.type == NULL) {
-        pthread_mutex_unlock(&bufferLock);
-        return UA_STATUSCODE_BADTYPEMISMATCH;
-    }
-    if (dataValue->value.type != binding->dataType) {
-        pthread_mutex_unlock(&bufferLock);
-        return UA_STATUSCODE_BADTYPEMISMATCH;
-    }
-
-    // Write the value based on data type into PLC variable and update shadow
-    if (binding->dataType == &UA_TYPES[UA_TYPES_BOOLEAN]) {
-        UA_Boolean v = *(const UA_Boolean*)dataValue->value.data;
-        *(UA_Boolean*)binding->variablePtr = v;
-        if (binding->shadowPtr) *(UA_Boolean*)binding->shadowPtr = v;
-    } else if (binding->dataType == &UA_TYPES[UA_TYPES_BYTE]) {
-        UA_Byte v = *(const UA_Byte*)dataValue->value.data;
-        *(UA_Byte*)binding->variablePtr = v;
-        if (binding->shadowPtr) *(UA_Byte*)binding->shadowPtr = v;
-    } else if (binding->dataType == &UA_TYPES[UA_TYPES_SBYTE]) {
-        UA_SByte v = *(const UA_SByte*)dataValue->value.data;
-        *(UA_SByte*)binding->variablePtr = v;
-        if (binding->shadowPtr) *(UA_SByte*)binding->shadowPtr = v;
-    } else if (binding->dataType == &UA_TYPES[UA_TYPES_INT16]) {
-        UA_Int16 v = *(const UA_Int16*)dataValue->value.data;
-        *(UA_Int16*)binding->variablePtr = v;
-        if (binding->shadowPtr) *(UA_Int16*)binding->shadowPtr = v;
-    } else if (binding->dataType == &UA_TYPES[UA_TYPES_INT32]) {
-        UA_Int32 v = *(const UA_Int32*)dataValue->value.data;
-        *(UA_Int32*)binding->variablePtr = v;
-        if (binding->shadowPtr) *(UA_Int32*)binding->shadowPtr = v;
-    } else if (binding->dataType == &UA_TYPES[UA_TYPES_INT64]) {
-        UA_Int64 v = *(const UA_Int64*)dataValue->value.data;
-        *(UA_Int64*)binding->variablePtr = v;
-        if (binding->shadowPtr) *(UA_Int64*)binding->shadowPtr = v;
-    } else if (binding->dataType == &UA_TYPES[UA_TYPES_UINT16]) {
-        UA_UInt16 v = *(const UA_UInt16*)dataValue->value.data;
-        *(UA_UInt16*)binding->variablePtr = v;
-        if (binding->shadowPtr) *(UA_UInt16*)binding->shadowPtr = v;
-    } else if (binding->dataType == &UA_TYPES[UA_TYPES_UINT32]) {
-        UA_UInt32 v = *(const UA_UInt32*)dataValue->value.data;
-        *(UA_UInt32*)binding->variablePtr = v;
-        if (binding->shadowPtr) *(UA_UInt32*)binding->shadowPtr = v;
-    } else if (binding->dataType == &UA_TYPES[UA_TYPES_UINT64]) {
-        UA_UInt64 v = *(const UA_UInt64*)dataValue->value.data;
-        *(UA_UInt64*)binding->variablePtr = v;
-        if (binding->shadowPtr) *(UA_UInt64*)binding->shadowPtr = v;
-    } else if (binding->dataType == &UA_TYPES[UA_TYPES_FLOAT]) {
-        UA_Float v = *(const UA_Float*)dataValue->value.data;
-        *(UA_Float*)binding->variablePtr = v;
-        if (binding->shadowPtr) *(UA_Float*)binding->shadowPtr = v;
-    } else if (binding->dataType == &UA_TYPES[UA_TYPES_DOUBLE]) {
-        UA_Double v = *(const UA_Double*)dataValue->value.data;
-        *(UA_Double*)binding->variablePtr = v;
-        if (binding->shadowPtr) *(UA_Double*)binding->shadowPtr = v;
-    } else {
-        pthread_mutex_unlock(&bufferLock);
-        return UA_STATUSCODE_BADTYPEMISMATCH;
-    }
-    
-    pthread_mutex_unlock(&bufferLock);
-    
-    return UA_STATUSCODE_GOOD;
+    UA_StatusCode sc = writePlcValue((OpcNodeInfo*)nodeContext, &dataValue->value, range);
+    recordProtocolRequest(OPCUA_PROTOCOL, sc != UA_STATUSCODE_GOOD);
+    return sc;
 }
 
 //-----------------------------------------------------------------------------
-// Add a variable node to the OPC UA address space
+// Add a variable node to the OPC UA address space. With a count above 1 the
+// node is a one dimension array of that many consecutive variables
 //-----------------------------------------------------------------------------
 static void addVariableNode(UA_Server *server, const char *nodeName, UA_NodeId parentNodeId,
-                           UA_NodeId nodeId, void *variablePtr, UA_DataType *dataType) {
+                           UA_NodeId nodeId, void *variablePtr, UA_DataType *dataType, size_t count) {
     if (!variablePtr) return; // Skip NULL pointers
     if (!dataType) return; // Skip NULL data types
     
     char log_msg[1000];
-    char nid[64];
-    formatNodeId(&nodeId, nid, sizeof(nid));
-    sprintf(log_msg, "Creating node: %s id=%s parent=ns=%u;i=%u var=%p type=%s\n", nodeName, nid, parentNodeId.namespaceIndex, parentNodeId.identifier.numeric, variablePtr, uaTypeName(dataType));
-    openplc_log(log_msg);
+    if (g_node_count >= g_node_capacity) {
+        sprintf(log_msg, "OPC UA node table is full, skipping %s\n", nodeName);
+        openplc_log(log_msg);
+        return;
+    }
     
     UA_VariableAttributes attr; 
     UA_VariableAttributes_init(&attr);
@@ -393,7 +537,16 @@ static void addVariableNode(UA_Server *server, const char *nodeName, UA_NodeId p
     attr.valueRank = UA_VALUERANK_SCALAR; // Set as scalar value
     
     // Provide an initial value matching the declared dataType to satisfy type checking
-    if (dataType == &UA_TYPES[UA_TYPES_BOOLEAN]) {
+    if (count > 1) {
+        attr.valueRank = UA_VALUERANK_ONE_DIMENSION;
+        attr.arrayDimensions = (UA_UInt32*)UA_Array_new(1, &UA_TYPES[UA_TYPES_UINT32]);
+        if (attr.arrayDimensions) {
+            attr.arrayDimensions[0] = (UA_UInt32)count;
+            attr.arrayDimensionsSize = 1;
+        }
+        void *zeros = UA_Array_new(count, dataType);
+        if (zeros) UA_Variant_setArray(&attr.value, zeros, count, dataType);
+    } else if (dataType == &UA_TYPES[UA_TYPES_BOOLEAN]) {
         UA_Boolean v = (UA_Boolean)0;
         UA_Variant_setScalarCopy(&attr.value, &v, &UA_TYPES[UA_TYPES_BOOLEAN]);
     } else if (dataType == &UA_TYPES[UA_TYPES_BYTE]) {
@@ -428,47 +581,53 @@ static void addVariableNode(UA_Server *server, const char *nodeName, UA_NodeId p
         UA_Variant_setScalarCopy(&attr.value, &v, &UA_TYPES[UA_TYPES_DOUBLE]);
     }
 
-    // Create simple variable node (no callbacks for now)
-    UA_StatusCode retval = UA_Server_addVariableNode(server, nodeId, parentNodeId,
+    // Node info is the context of the callbacks, so it must exist before the
+    // node does. The slot is only taken if the node is created
+    OpcNodeInfo *nodeInfo = &g_nodes[g_node_count];
+    nodeInfo->nodeId = nodeId;
+    nodeInfo->variablePtr = variablePtr;
+    nodeInfo->dataType = dataType;
+    nodeInfo->count = count;
+    nodeInfo->syncIndex = g_node_count;
+
+    UA_StatusCode retval;
+    if (g_data_source_mode) {
+        UA_DataSource dataSource;
+        dataSource.read = readVariableValue;
+        dataSource.write = writeVariableValue;
+        retval = UA_Server_addDataSourceVariableNode(server, nodeId, parentNodeId,
+                                                    UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+                                                    UA_QUALIFIEDNAME(g_namespace_index, nodeName),
+                                                    UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
+                                                    attr, dataSource, nodeInfo, NULL);
+    } else {
+        retval = UA_Server_addVariableNode(server, nodeId, parentNodeId,
                                                     UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
                                                     UA_QUALIFIEDNAME(g_namespace_index, nodeName),
                                                     UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
                                                     attr, NULL, NULL);
+    }
     
     if (retval == UA_STATUSCODE_GOOD) {
-        sprintf(log_msg, "Node %s added successfully\n", nodeName);
-        openplc_log(log_msg);
-        
-        // Store node info for periodic updates
-        OpcNodeInfo *nodeInfo = (OpcNodeInfo*)malloc(sizeof(OpcNodeInfo));
-        if (nodeInfo) {
-            nodeInfo->nodeId = nodeId;
-            nodeInfo->variablePtr = variablePtr;
-            nodeInfo->dataType = dataType;
-            pthread_mutex_lock(&opcua_mutex);
-            nodeInfo->next = g_node_list;
-            g_node_list = nodeInfo;
-            g_node_count++;
-            pthread_mutex_unlock(&opcua_mutex);
-            char reg_msg[256];
-            snprintf(reg_msg, sizeof(reg_msg), "Registered node for updates: %s ptr=%p type=%s (total=%d)\n",
-                     nodeName, variablePtr, uaTypeName(dataType), g_node_count);
-            openplc_log(reg_msg);
+        pthread_mutex_lock(&opcua_mutex);
+        g_node_count++;
+        pthread_mutex_unlock(&opcua_mutex);
 
+        if (!g_data_source_mode) {
             // Attach nodeContext and onWrite callback to support client writes
             UA_Server_setNodeContext(server, nodeId, nodeInfo);
             UA_ValueCallback cb; memset(&cb, 0, sizeof(cb));
             cb.onRead = NULL; // reads are handled by periodic updates
             cb.onWrite = onVariableValueWrite;
             UA_Server_setVariableNode_valueCallback(server, nodeId, cb);
-        } else {
-            openplc_log("Failed to allocate OpcNodeInfo; node will not be updated periodically\n");
         }
     } else if (retval == UA_STATUSCODE_BADNODEIDEXISTS) {
         sprintf(log_msg, "Node %s already exists, skipping\n", nodeName);
         openplc_log(log_msg);
     } else {
-        sprintf(log_msg, "Failed to add node %s: %s\n", nodeName, UA_StatusCode_name(retval));
+        char nid[64];
+        formatNodeId(&nodeId, nid, sizeof(nid));
+        snprintf(log_msg, sizeof(log_msg), "Failed to add node %s (id=%s type=%s): %s\n", nodeName, nid, uaTypeName(dataType), UA_StatusCode_name(retval));
         openplc_log(log_msg);
     }
     
@@ -477,85 +636,321 @@ static void addVariableNode(UA_Server *server, const char *nodeName, UA_NodeId p
 
 }
 
-// Update all OPC UA node values from PLC variables
+//-----------------------------------------------------------------------------
+// Allocate the node table for up to 'capacity' nodes. Must be called before
+// any node is added
+//-----------------------------------------------------------------------------
+static bool createNodeTable(int capacity) {
+    pthread_mutex_lock(&opcua_mutex);
+    free(g_nodes);
+    g_nodes = NULL;
+    g_node_count = 0;
+    g_node_capacity = 0;
+    if (capacity > 0) {
+        g_nodes = (OpcNodeInfo*)calloc(capacity, sizeof(OpcNodeInfo));
+        if (g_nodes) g_node_capacity = capacity;
+    }
+    pthread_mutex_unlock(&opcua_mutex);
+
+    if (capacity > 0 && !g_nodes) {
+        openplc_log("Failed to allocate OPC UA node table; no nodes will be created\n");
+        return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Build the sync arrays for the nodes created at startup. Must be called
+// before g_opcua_running is set
+//-----------------------------------------------------------------------------
+static void createSyncTable() {
+    int count = g_node_count;
+    if (count == 0) return;
+
+    // Every value starts 8 byte aligned, so the variants can point at them
+    size_t total = 0;
+    for (int i = 0; i < count; i++) {
+        total += (g_nodes[i].dataType->memSize * g_nodes[i].count + 7) & ~(size_t)7;
+    }
+
+    OpcSyncEntry *entries = (OpcSyncEntry*)calloc(count, sizeof(OpcSyncEntry));
+    UA_Byte *values = (UA_Byte*)calloc(total, 1);
+    g_pending_values = (UA_Byte*)calloc(total, 1);
+    g_published_values = (UA_Byte*)calloc(total, 1);
+    g_published_valid = (bool*)calloc(count, sizeof(bool));
+    bool *dirty = (bool*)calloc(count, sizeof(bool));
+    if (!entries || !values || !g_pending_values || !g_published_values || !g_published_valid || !dirty) {
+        openplc_log("Failed to allocate OPC UA sync table; node values will not be updated\n");
+        free(entries);
+        free(values);
+        free(dirty);
+        free(g_pending_values); g_pending_values = NULL;
+        free(g_published_values); g_published_values = NULL;
+        free(g_published_valid); g_published_valid = NULL;
+        return;
+    }
+
+    // The located variables point to their slot on the images
+    const IEC_BOOL *bool_inputs = &bool_input_image[0][0];
+    size_t offset = 0;
+    for (int i = 0; i < count; i++) {
+        entries[i].variablePtr = g_nodes[i].variablePtr;
+        entries[i].size = g_nodes[i].dataType->memSize;
+        entries[i].count = g_nodes[i].count;
+        entries[i].offset = offset;
+        entries[i].inputArea = -1;
+        entries[i].inputIndex = 0;
+        const UA_Byte *ptr = (const UA_Byte*)g_nodes[i].variablePtr;
+        if (entries[i].count == 1 && entries[i].size == sizeof(IEC_BOOL) &&
+            ptr >= (const UA_Byte*)bool_inputs && ptr < (const UA_Byte*)(bool_inputs + BUFFER_SIZE * 8)) {
+            entries[i].inputArea = PI_BOOL_INPUT;
+            entries[i].inputIndex = (uint32_t)((const IEC_BOOL*)ptr - bool_inputs);
+        } else if (entries[i].count == 1 && entries[i].size == sizeof(IEC_UINT) &&
+                   ptr >= (const UA_Byte*)int_input_image && ptr < (const UA_Byte*)(int_input_image + BUFFER_SIZE)) {
+            entries[i].inputArea = PI_INT_INPUT;
+            entries[i].inputIndex = (uint32_t)((const IEC_UINT*)ptr - int_input_image);
+        }
+        offset += (entries[i].size * entries[i].count + 7) & ~(size_t)7;
+    }
+
+    int efd = -1;
+#ifdef __linux__
+    efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd < 0) openplc_log("Failed to create OPC UA eventfd; node updates will follow the network poll\n");
+#endif
+
+    pthread_mutex_lock(&g_sync_lock);
+    g_sync_entries = entries;
+    g_sync_values = values;
+    g_sync_size = total;
+    g_sync_eventfd = efd;
+    g_sync_generation = 0;
+    g_published_generation = 0;
+    g_scan_dirty = dirty;
+    g_scan_counter = 0;
+    g_change_tail.store(g_change_head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    g_sync_count = count;
+    pthread_mutex_unlock(&g_sync_lock);
+}
+
+//-----------------------------------------------------------------------------
+// Release the sync arrays and the node table. Called by the OPC UA thread
+// when the server stops
+//-----------------------------------------------------------------------------
+static void destroySyncTable() {
+    pthread_mutex_lock(&g_sync_lock);
+    free(g_sync_entries); g_sync_entries = NULL;
+    free(g_sync_values); g_sync_values = NULL;
+    free(g_scan_dirty); g_scan_dirty = NULL;
+    g_sync_size = 0;
+    g_sync_count = 0;
+    // Writes still on the ring refer to this table, drop them
+    g_ring_consumed.store(g_ring_committed.load(std::memory_order_acquire), std::memory_order_release);
+    g_staged_count = 0;
+    if (g_sync_eventfd >= 0) close(g_sync_eventfd);
+    g_sync_eventfd = -1;
+    pthread_mutex_unlock(&g_sync_lock);
+
+    free(g_pending_values); g_pending_values = NULL;
+    free(g_published_values); g_published_values = NULL;
+    free(g_published_valid); g_published_valid = NULL;
+
+    createNodeTable(0);
+}
+
+//-----------------------------------------------------------------------------
+// Scan sampling, called by the PLC thread with bufferLock and g_sync_lock
+// held. Every g_scan_sampling scans the nodes that changed since they were
+// last queued go to the change ring, stamped with the time of this scan (the
+// time they changed for the inputs)
+//-----------------------------------------------------------------------------
+static void sampleScanChanges() {
+    if (++g_scan_counter < g_scan_sampling) return;
+    g_scan_counter = 0;
+
+    UA_DateTime now = UA_DateTime_now();
+    unsigned long head = g_change_head.load(std::memory_order_relaxed);
+    unsigned long tail = g_change_tail.load(std::memory_order_acquire);
+    bool queued = false;
+
+    for (int i = 0; i < g_sync_count; i++) {
+        const OpcSyncEntry *entry = &g_sync_entries[i];
+        size_t size = entry->size * entry->count;
+        UA_Byte *last = g_sync_values + entry->offset;
+        bool dirty = __atomic_load_n(&g_scan_dirty[i], __ATOMIC_ACQUIRE);
+        if (!dirty && memcmp(last, entry->variablePtr, size) == 0) continue;
+        if (head - tail >= OPCUA_CHANGE_RING_SIZE) break;
+
+        if (dirty) __atomic_store_n(&g_scan_dirty[i], false, __ATOMIC_RELAXED);
+        memcpy(last, entry->variablePtr, size);
+        OpcChange *change = &g_change_ring[head & (OPCUA_CHANGE_RING_SIZE - 1)];
+        change->syncIndex = i;
+        change->value = 0;
+        if (entry->count == 1) memcpy(&change->value, last, size);
+        change->timestamp = sourceTimestamp(entry, now);
+        head++;
+        queued = true;
+    }
+
+    if (!queued) return;
+    g_change_head.store(head, std::memory_order_release);
+    if (g_sync_eventfd >= 0) {
+        uint64_t one = 1;
+        ssize_t ret = write(g_sync_eventfd, &one, sizeof(one));
+        (void)ret;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// OPC UA sync stage, called by the PLC thread once per scan with bufferLock
+// held. It only copies the raw node values; building variants and writing
+// them to the address space is left to the OPC UA thread. If the OPC UA
+// thread is busy taking the previous copy, this scan is simply skipped
+//-----------------------------------------------------------------------------
 extern "C" void opcuaUpdateNodeValues() {
-    // Debug: always log that this function is called
-    //openplc_log("opcuaUpdateNodeValues() called\n");
-    
-    if (!g_opcua_server || !g_opcua_running) {
-        char debug_msg[200];
-        sprintf(debug_msg, "opcuaUpdateNodeValues() - server not running (server=%p, running=%d), skipping\n", 
-                (void*)g_opcua_server, g_opcua_running);
-        openplc_log(debug_msg);
+    if (pthread_mutex_trylock(&g_sync_lock) != 0) return;
+
+    if (g_scan_sampling > 0) {
+        sampleScanChanges();
+        pthread_mutex_unlock(&g_sync_lock);
         return;
     }
-    
-    pthread_mutex_lock(&opcua_mutex);
-    OpcNodeInfo *it = g_node_list;
-    int nodeCount = 0;
-    
-    while (it != NULL) {
-        nodeCount++;
-        if (it->variablePtr && it->dataType) {
-            UA_Variant value;
-            UA_Variant_init(&value);
-            
-            // Read current value from PLC variable
-            if (it->dataType == &UA_TYPES[UA_TYPES_BOOLEAN]) {
-                UA_Boolean v = *(IEC_BOOL*)it->variablePtr;
-                UA_Variant_setScalarCopy(&value, &v, &UA_TYPES[UA_TYPES_BOOLEAN]);
-            } else if (it->dataType == &UA_TYPES[UA_TYPES_BYTE]) {
-                UA_Byte v = *(IEC_BYTE*)it->variablePtr;
-                UA_Variant_setScalarCopy(&value, &v, &UA_TYPES[UA_TYPES_BYTE]);
-            } else if (it->dataType == &UA_TYPES[UA_TYPES_SBYTE]) {
-                UA_SByte v = *(IEC_SINT*)it->variablePtr;
-                UA_Variant_setScalarCopy(&value, &v, &UA_TYPES[UA_TYPES_SBYTE]);
-            } else if (it->dataType == &UA_TYPES[UA_TYPES_INT16]) {
-                UA_Int16 v = *(IEC_INT*)it->variablePtr;
-                UA_Variant_setScalarCopy(&value, &v, &UA_TYPES[UA_TYPES_INT16]);
-            } else if (it->dataType == &UA_TYPES[UA_TYPES_INT32]) {
-                UA_Int32 v = *(IEC_DINT*)it->variablePtr;
-                UA_Variant_setScalarCopy(&value, &v, &UA_TYPES[UA_TYPES_INT32]);
-            } else if (it->dataType == &UA_TYPES[UA_TYPES_INT64]) {
-                UA_Int64 v = *(IEC_LINT*)it->variablePtr;
-                UA_Variant_setScalarCopy(&value, &v, &UA_TYPES[UA_TYPES_INT64]);
-            } else if (it->dataType == &UA_TYPES[UA_TYPES_UINT16]) {
-                UA_UInt16 v = *(IEC_UINT*)it->variablePtr;
-                UA_Variant_setScalarCopy(&value, &v, &UA_TYPES[UA_TYPES_UINT16]);
-            } else if (it->dataType == &UA_TYPES[UA_TYPES_UINT32]) {
-                UA_UInt32 v = *(IEC_UDINT*)it->variablePtr;
-                UA_Variant_setScalarCopy(&value, &v, &UA_TYPES[UA_TYPES_UINT32]);
-            } else if (it->dataType == &UA_TYPES[UA_TYPES_UINT64]) {
-                UA_UInt64 v = *(IEC_ULINT*)it->variablePtr;
-                UA_Variant_setScalarCopy(&value, &v, &UA_TYPES[UA_TYPES_UINT64]);
-            } else if (it->dataType == &UA_TYPES[UA_TYPES_FLOAT]) {
-                UA_Float v = *(IEC_REAL*)it->variablePtr;
-                UA_Variant_setScalarCopy(&value, &v, &UA_TYPES[UA_TYPES_FLOAT]);
-            } else if (it->dataType == &UA_TYPES[UA_TYPES_DOUBLE]) {
-                UA_Double v = *(IEC_LREAL*)it->variablePtr;
-                UA_Variant_setScalarCopy(&value, &v, &UA_TYPES[UA_TYPES_DOUBLE]);
-            }
-            
-            // Write value to OPC UA node
-            UA_StatusCode retval = UA_Server_writeValue(g_opcua_server, it->nodeId, value);
-            if (retval != UA_STATUSCODE_GOOD) {
-                // Log error but continue with other nodes
-                char log_msg[200];
-                sprintf(log_msg, "Failed to update node value: %s\n", UA_StatusCode_name(retval));
-                openplc_log(log_msg);
-            }
-            
-            UA_Variant_clear(&value);
+
+    for (int i = 0; i < g_sync_count; i++) {
+        const OpcSyncEntry *entry = &g_sync_entries[i];
+        memcpy(g_sync_values + entry->offset, entry->variablePtr, entry->size * entry->count);
+    }
+    if (g_sync_count > 0) {
+        g_sync_generation++;
+        // Data source nodes are sampled by the server, no need to wake it
+        if (g_sync_eventfd >= 0 && !g_data_source_mode) {
+            uint64_t one = 1;
+            ssize_t ret = write(g_sync_eventfd, &one, sizeof(one));
+            (void)ret;
         }
-        it = it->next;
     }
-    
-    // Optionally log the total nodes processed
-    // char debug_msg[200];
-    // sprintf(debug_msg, "Processed %d OPC UA nodes\n", nodeCount);
-    // openplc_log(debug_msg);
-    
-    pthread_mutex_unlock(&opcua_mutex);
+
+    pthread_mutex_unlock(&g_sync_lock);
+}
+
+//-----------------------------------------------------------------------------
+// Sleep until the PLC signals a new copy, the server has timed work to do or
+// OPCUA_MAX_WAIT_MS elapse, whichever comes first. Runs on the OPC UA thread
+//-----------------------------------------------------------------------------
+static void waitForServerWork(UA_UInt16 server_timeout_ms) {
+    int timeout = server_timeout_ms < OPCUA_MAX_WAIT_MS ? server_timeout_ms : OPCUA_MAX_WAIT_MS;
+    if (timeout <= 0) return;
+
+    // Only the OPC UA thread replaces the eventfd, so it can be read unlocked
+    struct pollfd pfd;
+    pfd.fd = g_sync_eventfd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, timeout) > 0 && (pfd.revents & POLLIN)) {
+        uint64_t count;
+        ssize_t ret = read(g_sync_eventfd, &count, sizeof(count));
+        (void)ret;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Write to the address space every node whose value changed since the last
+// call. Runs on the OPC UA thread
+//-----------------------------------------------------------------------------
+static void publishChangedNodes(UA_Server *server) {
+    // Data source nodes read the sync values on demand
+    if (g_data_source_mode) return;
+
+    pthread_mutex_lock(&g_sync_lock);
+    int count = g_sync_count;
+    bool updated = (g_sync_generation != g_published_generation);
+    if (updated) {
+        memcpy(g_pending_values, g_sync_values, g_sync_size);
+        g_published_generation = g_sync_generation;
+    }
+    pthread_mutex_unlock(&g_sync_lock);
+
+    if (!updated) return;
+
+    for (int i = 0; i < count; i++) {
+        const OpcSyncEntry *entry = &g_sync_entries[i];
+        size_t size = entry->size * entry->count;
+        UA_Byte *pending = g_pending_values + entry->offset;
+        if (g_published_valid[i] && memcmp(pending, g_published_values + entry->offset, size) == 0) continue;
+
+        OpcNodeInfo *node = &g_nodes[i];
+        UA_Variant value;
+        if (node->count > 1) {
+            UA_Variant_setArray(&value, pending, node->count, node->dataType);
+        } else {
+            UA_Variant_setScalar(&value, pending, node->dataType);
+        }
+        g_publishing = true;
+        UA_StatusCode retval;
+        if (entry->inputArea >= 0) {
+            // The inputs carry the time they changed
+            UA_DataValue dv;
+            UA_DataValue_init(&dv);
+            dv.value = value;
+            dv.hasValue = true;
+            dv.sourceTimestamp = sourceTimestamp(entry, UA_DateTime_now());
+            dv.hasSourceTimestamp = true;
+            retval = UA_Server_writeDataValue(server, node->nodeId, dv);
+        } else {
+            retval = UA_Server_writeValue(server, node->nodeId, value);
+        }
+        g_publishing = false;
+        if (retval != UA_STATUSCODE_GOOD) {
+            char log_msg[200];
+            sprintf(log_msg, "Failed to update node value: %s\n", UA_StatusCode_name(retval));
+            openplc_log(log_msg);
+            continue;
+        }
+        memcpy(g_published_values + entry->offset, pending, size);
+        g_published_valid[i] = true;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Write the changes queued by the scan sampling to the address space, in the
+// order of their scans and with the scan time as SourceTimestamp. Runs on the
+// OPC UA thread
+//-----------------------------------------------------------------------------
+static void publishScanChanges(UA_Server *server) {
+    unsigned long tail = g_change_tail.load(std::memory_order_relaxed);
+    unsigned long head = g_change_head.load(std::memory_order_acquire);
+
+    for (; tail != head; tail++) {
+        const OpcChange *change = &g_change_ring[tail & (OPCUA_CHANGE_RING_SIZE - 1)];
+        OpcNodeInfo *node = &g_nodes[change->syncIndex];
+
+        UA_DataValue dv;
+        UA_DataValue_init(&dv);
+        UA_UInt64 scalar = change->value;
+        if (node->count > 1) {
+            // Arrays are sent with their latest sampled value
+            const OpcSyncEntry *entry = &g_sync_entries[change->syncIndex];
+            pthread_mutex_lock(&g_sync_lock);
+            memcpy(g_pending_values + entry->offset, g_sync_values + entry->offset, entry->size * entry->count);
+            pthread_mutex_unlock(&g_sync_lock);
+            UA_Variant_setArray(&dv.value, g_pending_values + entry->offset, node->count, node->dataType);
+        } else {
+            UA_Variant_setScalar(&dv.value, &scalar, node->dataType);
+        }
+        dv.hasValue = true;
+        dv.sourceTimestamp = change->timestamp;
+        dv.hasSourceTimestamp = true;
+
+        g_publishing = true;
+        UA_StatusCode retval = UA_Server_writeDataValue(server, node->nodeId, dv);
+        g_publishing = false;
+        if (retval != UA_STATUSCODE_GOOD) {
+            char log_msg[200];
+            sprintf(log_msg, "Failed to update node value: %s\n", UA_StatusCode_name(retval));
+            openplc_log(log_msg);
+        }
+    }
+    g_change_tail.store(tail, std::memory_order_release);
 }
 
 //-----------------------------------------------------------------------------
@@ -715,469 +1110,481 @@ static void createProgramVariablesFolder(UA_Server *server, UA_NodeId *outFolder
 }
 
 
-// Resolve pointer and UA type from IEC location token like %IX0.0, %QW10, %MD954
-static bool resolvePointerFromLocation(const char *location, void **outPtr, const UA_DataType **outType) {
-    if (!location || !outPtr || !outType) return false;
-    char debug_msg[256]; // Declare debug_msg in this function scope
-    // Expect a leading '%'
-    if (location[0] != '%') return false;
-    char area = location[1]; // I,Q,M
-    char type = location[2]; // X,B,W,D,L,R,F (F=LREAL for double precision)
-    const char *rest = location + 3;
-
-    int index1 = 0;
-    int index2 = -1;
-    // For bit addresses %IXa.b -> parse a and b
-    if (type == 'X') {
-        // format: number '.' number
-        index1 = atoi(rest);
-        const char *dot = strchr(rest, '.');
-        if (!dot) return false;
-        index2 = atoi(dot + 1);
-        if (index2 < 0 || index2 >= 8) return false;
-    } else {
-        index1 = atoi(rest);
+//-----------------------------------------------------------------------------
+// Adds a folder of the program variables hierarchy, unless it exists. The
+// folders have string node ids made of their path, which stay the same
+// across programs, and numeric ids are left to the variables
+//-----------------------------------------------------------------------------
+static void addProgramFolder(UA_Server *server, const UA_NodeId &parent, const char *path,
+                             const char *name, UA_NodeId *outFolderId) {
+    *outFolderId = UA_NODEID_STRING_ALLOC(g_namespace_index, path);
+    UA_ObjectAttributes attr = UA_ObjectAttributes_default;
+    attr.displayName = UA_LOCALIZEDTEXT("en-US", (char*)name);
+    UA_StatusCode rc = UA_Server_addObjectNode(server, *outFolderId, parent,
+                           UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                           UA_QUALIFIEDNAME(g_namespace_index, (char*)name),
+                           UA_NODEID_NUMERIC(0, UA_NS0ID_FOLDERTYPE),
+                           attr, NULL, NULL);
+    if (rc != UA_STATUSCODE_GOOD && rc != UA_STATUSCODE_BADNODEIDEXISTS) {
+        char log_msg[512];
+        snprintf(log_msg, sizeof(log_msg), "Failed to create the %s folder: %s\n", path, UA_StatusCode_name(rc));
+        openplc_log(log_msg);
     }
+}
 
-    // Use a more robust approach: try to access the array and handle errors gracefully
-    // This approach works for any PLC program regardless of which data types are defined
-    
-    switch (area) {
-        case 'I':
-            if (type == 'X') { 
-                if (index1>=0 && index1<BUFFER_SIZE && bool_input[index1][index2] != NULL) { 
-                    *outPtr = (void*)bool_input[index1][index2]; 
-                    *outType = &UA_TYPES[UA_TYPES_BOOLEAN]; 
-                    return *outPtr != NULL; 
-                } 
-            }
-            if (type == 'B') { 
-                if (index1>=0 && index1<BUFFER_SIZE && byte_input[index1] != NULL) { 
-                    *outPtr = (void*)byte_input[index1]; 
-                    *outType = &UA_TYPES[UA_TYPES_BYTE]; 
-                    return *outPtr != NULL; 
-                } 
-            }
-            if (type == 'W') { 
-                if (index1>=0 && index1<BUFFER_SIZE && int_input[index1] != NULL) { 
-                    *outPtr = (void*)int_input[index1]; 
-                    *outType = &UA_TYPES[UA_TYPES_UINT16]; 
-                    return *outPtr != NULL; 
-                } 
-            }
-            if (type == 'D') { 
-                if (index1>=0 && index1<BUFFER_SIZE && dint_input[index1] != NULL) { 
-                    *outPtr = (void*)dint_input[index1]; 
-                    *outType = &UA_TYPES[UA_TYPES_UINT32]; 
-                    return *outPtr != NULL; 
-                } 
-            }
-            if (type == 'L') { 
-                if (index1>=0 && index1<BUFFER_SIZE && lint_input[index1] != NULL) { 
-                    *outPtr = (void*)lint_input[index1]; 
-                    *outType = &UA_TYPES[UA_TYPES_UINT64]; 
-                    return *outPtr != NULL; 
-                } 
-            }
-            if (type == 'R') { 
-                if (index1>=0 && index1<BUFFER_SIZE && real_input[index1] != NULL) { 
-                    *outPtr = (void*)real_input[index1]; 
-                    *outType = &UA_TYPES[UA_TYPES_FLOAT]; 
-                    return *outPtr != NULL; 
-                } 
-            }
-            if (type == 'F') { 
-                if (index1>=0 && index1<BUFFER_SIZE && lreal_input[index1] != NULL) { 
-                    *outPtr = (void*)lreal_input[index1]; 
-                    *outType = &UA_TYPES[UA_TYPES_DOUBLE]; 
-                    return *outPtr != NULL; 
-                } 
-            }
-            break;
-        case 'Q':
-            if (type == 'X') { 
-                if (index1>=0 && index1<BUFFER_SIZE && bool_output[index1][index2] != NULL) { 
-                    *outPtr = (void*)bool_output[index1][index2]; 
-                    *outType = &UA_TYPES[UA_TYPES_BOOLEAN]; 
-                    return *outPtr != NULL; 
-                } 
-            }
-            if (type == 'B') { 
-                if (index1>=0 && index1<BUFFER_SIZE && byte_output[index1] != NULL) { 
-                    *outPtr = (void*)byte_output[index1]; 
-                    *outType = &UA_TYPES[UA_TYPES_BYTE]; 
-                    return *outPtr != NULL; 
-                } 
-            }
-            if (type == 'W') { 
-                sprintf(debug_msg, "Checking int_output[%d]: ptr=%p, BUFFER_SIZE=%d\n", 
-                        index1, int_output[index1], BUFFER_SIZE);
-                openplc_log(debug_msg);
-                if (index1>=0 && index1<BUFFER_SIZE && int_output[index1] != NULL) { 
-                    *outPtr = (void*)int_output[index1]; 
-                    *outType = &UA_TYPES[UA_TYPES_UINT16]; 
-                    sprintf(debug_msg, "Successfully mapped int_output[%d] -> ptr=%p\n", index1, *outPtr);
-                    openplc_log(debug_msg);
-                    return *outPtr != NULL; 
-                } else {
-                    sprintf(debug_msg, "int_output[%d] is NULL or out of bounds\n", index1);
-                    openplc_log(debug_msg);
-                }
-            }
-            if (type == 'D') { 
-                if (index1>=0 && index1<BUFFER_SIZE && dint_output[index1] != NULL) { 
-                    *outPtr = (void*)dint_output[index1]; 
-                    *outType = &UA_TYPES[UA_TYPES_UINT32]; 
-                    return *outPtr != NULL; 
-                } 
-            }
-            if (type == 'L') { 
-                if (index1>=0 && index1<BUFFER_SIZE && lint_output[index1] != NULL) { 
-                    *outPtr = (void*)lint_output[index1]; 
-                    *outType = &UA_TYPES[UA_TYPES_UINT64]; 
-                    return *outPtr != NULL; 
-                } 
-            }
-            if (type == 'R') { 
-                if (index1>=0 && index1<BUFFER_SIZE && real_output[index1] != NULL) { 
-                    *outPtr = (void*)real_output[index1]; 
-                    *outType = &UA_TYPES[UA_TYPES_FLOAT]; 
-                    return *outPtr != NULL; 
-                } 
-            }
-            if (type == 'F') { 
-                if (index1>=0 && index1<BUFFER_SIZE && lreal_output[index1] != NULL) { 
-                    *outPtr = (void*)lreal_output[index1]; 
-                    *outType = &UA_TYPES[UA_TYPES_DOUBLE]; 
-                    return *outPtr != NULL; 
-                } 
-            }
-            break;
-        case 'M':
-            if (type == 'W') { 
-                if (index1>=0 && index1<BUFFER_SIZE && int_memory[index1] != NULL) { 
-                    *outPtr = (void*)int_memory[index1]; 
-                    *outType = &UA_TYPES[UA_TYPES_UINT16]; 
-                    return *outPtr != NULL; 
-                } 
-            }
-            if (type == 'D') { 
-                if (index1>=0 && index1<BUFFER_SIZE && dint_memory[index1] != NULL) { 
-                    *outPtr = (void*)dint_memory[index1]; 
-                    *outType = &UA_TYPES[UA_TYPES_UINT32]; 
-                    return *outPtr != NULL; 
-                } 
-            }
-            if (type == 'L') { 
-                if (index1>=0 && index1<BUFFER_SIZE && lint_memory[index1] != NULL) { 
-                    *outPtr = (void*)lint_memory[index1]; 
-                    *outType = &UA_TYPES[UA_TYPES_UINT64]; 
-                    return *outPtr != NULL; 
-                } 
-            }
-            if (type == 'R') { 
-                if (index1>=0 && index1<BUFFER_SIZE && real_memory[index1] != NULL) { 
-                    *outPtr = (void*)real_memory[index1]; 
-                    *outType = &UA_TYPES[UA_TYPES_FLOAT]; 
-                    return *outPtr != NULL; 
-                } 
-            }
-            if (type == 'F') { 
-                if (index1>=0 && index1<BUFFER_SIZE && lreal_memory[index1] != NULL) { 
-                    *outPtr = (void*)lreal_memory[index1]; 
-                    *outType = &UA_TYPES[UA_TYPES_DOUBLE]; 
-                    return *outPtr != NULL; 
-                } 
-            }
-            break;
+//-----------------------------------------------------------------------------
+// Folder of a located variable, by area, POU and type, as the folders of
+// createFolderStructure() split the images:
+//     ProgramVariables/Inputs/Motor1/Word
+// The POU is what comes before the last dot of the name (OPCUA_VARIABLES.csv
+// names such as Motor1.Speed), the variables without one go right under the
+// area. Browsing a folder of thousands of variables took minutes on some
+// clients, so the folders stay small and the rest is paged by the
+// continuation points (max_references_per_node)
+//-----------------------------------------------------------------------------
+struct ProgramFolderCache {
+    char path[300];
+    UA_NodeId folderId;
+};
+
+static void programVariableFolder(UA_Server *server, const UA_NodeId &programFolder,
+                                  const PlcLocatedVariable *var, ProgramFolderCache *cache, UA_NodeId *outFolderId) {
+    const char *area;
+    switch (var->location[1]) {
+        case 'I': area = "Inputs"; break;
+        case 'Q': area = "Outputs"; break;
+        default: area = "Memory"; break;
     }
-    return false;
+    const char *type;
+    switch (var->size) {
+        case 'X': type = "Bool"; break;
+        case 'B': type = "Byte"; break;
+        case 'W': type = "Word"; break;
+        case 'D': type = "DWord"; break;
+        case 'L': type = "LWord"; break;
+        case 'R': type = "Real"; break;
+        default: type = "LReal"; break;
+    }
+    char pou[128] = "";
+    const char *dot = strrchr(var->name, '.');
+    if (dot != NULL && dot > var->name) {
+        snprintf(pou, sizeof(pou), "%.*s", (int)(dot - var->name), var->name);
+    }
+
+    char path[300];
+    if (pou[0] != '\0') snprintf(path, sizeof(path), "ProgramVariables/%s/%s/%s", area, pou, type);
+    else snprintf(path, sizeof(path), "ProgramVariables/%s/%s", area, type);
+
+    // The variables of a folder usually come one after the other
+    if (strcmp(path, cache->path) == 0) {
+        *outFolderId = cache->folderId;
+        return;
+    }
+
+    char areaPath[64];
+    snprintf(areaPath, sizeof(areaPath), "ProgramVariables/%s", area);
+    UA_NodeId areaFolder, parent;
+    addProgramFolder(server, programFolder, areaPath, area, &areaFolder);
+    parent = areaFolder;
+    UA_NodeId pouFolder = UA_NODEID_NULL;
+    if (pou[0] != '\0') {
+        char pouPath[256];
+        snprintf(pouPath, sizeof(pouPath), "%s/%s", areaPath, pou);
+        addProgramFolder(server, areaFolder, pouPath, pou, &pouFolder);
+        parent = pouFolder;
+    }
+    UA_NodeId typeFolder;
+    addProgramFolder(server, parent, path, type, &typeFolder);
+    UA_NodeId_clear(&areaFolder);
+    UA_NodeId_clear(&pouFolder);
+
+    UA_NodeId_clear(&cache->folderId);
+    snprintf(cache->path, sizeof(cache->path), "%s", path);
+    cache->folderId = typeFolder;
+    *outFolderId = typeFolder;
 }
 
-// Structure to hold variable name mapping
-typedef struct VariableMapping {
-    char technicalName[64];
-    char displayName[128];
-    int index; // Index in the CSV for ordering
-    struct VariableMapping *next;
-} VariableMapping;
-
-// Try OPCUA_VARIABLES.csv first (simple mapping file), then fallback to VARIABLES.csv
-static VariableMapping* parseOpcuaVariablesCsv() {
-    VariableMapping *head = NULL;
-    const char *candidates[] = {
-        "OPCUA_VARIABLES.csv",
-        "./OPCUA_VARIABLES.csv",
-        "core/OPCUA_VARIABLES.csv",
-        "./core/OPCUA_VARIABLES.csv",
-        "../core/OPCUA_VARIABLES.csv",
-        "../OPCUA_VARIABLES.csv"
-    };
-    FILE *f = NULL;
-    for (size_t i = 0; i < sizeof(candidates)/sizeof(candidates[0]); i++) {
-        f = fopen(candidates[i], "r");
-        if (f) break;
+// UA type of the located variables of a size (X, B, W, D, L, R or F)
+static const UA_DataType *uaTypeForSize(char size) {
+    switch (size) {
+        case 'X': return &UA_TYPES[UA_TYPES_BOOLEAN];
+        case 'B': return &UA_TYPES[UA_TYPES_BYTE];
+        case 'W': return &UA_TYPES[UA_TYPES_UINT16];
+        case 'D': return &UA_TYPES[UA_TYPES_UINT32];
+        case 'L': return &UA_TYPES[UA_TYPES_UINT64];
+#ifdef OPLC_FIXED_REAL
+        // The raw fixed point value, the tag scale tells the engineering value
+        case 'R': return &UA_TYPES[UA_TYPES_INT32];
+#else
+        case 'R': return &UA_TYPES[UA_TYPES_FLOAT];
+#endif
+        case 'F': return &UA_TYPES[UA_TYPES_DOUBLE];
     }
-    if (!f) return NULL; // not present
+    return NULL;
+}
 
-    char log_msg[256];
-    sprintf(log_msg, "Using OPCUA_VARIABLES.csv for node creation\n");
-    openplc_log(log_msg);
+//-----------------------------------------------------------------------------
+// Historical Access. The scalar nodes of the locations recorded by the
+// historian (historian.cfg) are historizing, and their HistoryRead requests
+// are answered from the historian segments: raw reads return the archived
+// points, processed reads summarize them per interval on the server, so a
+// trend never needs every point sent to the client. Only forward reads are
+// served
+//-----------------------------------------------------------------------------
+#ifdef UA_ENABLE_HISTORIZING
+// Values of a node returned by one request, the rest is left to a
+// continuation point
+#define OPCUA_HISTORY_MAX_VALUES 10000
+
+// Continuation point: where the next read starts, and the points at that
+// time that were already returned
+struct OpcHistoryContinuation {
+    int64_t start;
+    int32_t skip;
+};
 
-    char line[1024];
-    int csvIndex = 0;
-    int isHeaderChecked = 0;
-    while (fgets(line, sizeof(line), f)) {
-        // Skip comments (# or //) and empty
-        if (line[0] == '\n' || line[0] == '\r' || line[0] == '#') continue;
-        if (line[0] == '/' && line[1] == '/') continue;
-
-        // CSV format: name,location,datatype
-        char *tokens[4];
-        int tokenCount = 0;
-        char *saveptr = NULL;
-        char *token = strtok_r(line, ",", &saveptr);
-        while (token && tokenCount < 4) { tokens[tokenCount++] = token; token = strtok_r(NULL, ",", &saveptr); }
-        if (tokenCount < 2) continue;
-
-        // Trim whitespace and newlines
-        for (int i = 0; i < tokenCount; i++) {
-            while (*tokens[i]==' '||*tokens[i]=='\t') tokens[i]++;
-            size_t L = strlen(tokens[i]);
-            while (L>0 && (tokens[i][L-1]=='\n' || tokens[i][L-1]=='\r' || tokens[i][L-1]==' ' || tokens[i][L-1]=='\t')) {
-                tokens[i][--L] = '\0';
-            }
-        }
+static int64_t uaTimeToMs(UA_DateTime time) {
+    return (time - UA_DATETIME_UNIX_EPOCH) / UA_DATETIME_MSEC;
+}
 
-        // Skip header line if present
-        if (!isHeaderChecked) {
-            isHeaderChecked = 1;
-            if (strcasecmp(tokens[0], "name") == 0) continue;
-        }
+static UA_DateTime msToUaTime(int64_t ms) {
+    return UA_DATETIME_UNIX_EPOCH + ms * UA_DATETIME_MSEC;
+}
 
-        const char *name = tokens[0];
-        const char *location = tokens[1];
-        // datatype (tokens[2]) is optional for now
-
-        // Store mapping->displayName = name, mapping->technicalName = location
-        VariableMapping *mapping = (VariableMapping*)malloc(sizeof(VariableMapping));
-        if (mapping) {
-            snprintf(mapping->technicalName, sizeof(mapping->technicalName), "%s", location);
-            snprintf(mapping->displayName, sizeof(mapping->displayName), "%s", name);
-            mapping->index = csvIndex++;
-            mapping->next = head;
-            head = mapping;
-        }
+static OpcNodeInfo *findHistorizedNode(const UA_NodeId *nodeId) {
+    for (int i = 0; i < g_node_count; i++) {
+        if (g_nodes[i].historized && UA_NodeId_equal(&g_nodes[i].nodeId, nodeId)) return &g_nodes[i];
     }
-    fclose(f);
-
-    // Log count
-    int count = 0; for (VariableMapping *t = head; t; t = t->next) count++;
-    sprintf(log_msg, "Parsed OPCUA_VARIABLES.csv, created %d mappings\n", count);
-    openplc_log(log_msg);
-    return head;
+    return NULL;
 }
 
-// Find display name for a technical name
-static const char* findDisplayName(VariableMapping *mapping, const char *technicalName) {
-    while (mapping) {
-        if (strcmp(mapping->technicalName, technicalName) == 0) {
-            return mapping->displayName;
-        }
-        mapping = mapping->next;
+// Archived value as the type of its node
+static void setHistoryValue(UA_Variant *variant, const UA_DataType *type, double value) {
+    union {
+        UA_Boolean b; UA_Byte u8; UA_UInt16 u16; UA_UInt32 u32; UA_UInt64 u64;
+        UA_Int32 i32; UA_Float f; UA_Double d;
+    } raw;
+    if (type == &UA_TYPES[UA_TYPES_BOOLEAN]) raw.b = value != 0;
+    else if (type == &UA_TYPES[UA_TYPES_BYTE]) raw.u8 = (UA_Byte)value;
+    else if (type == &UA_TYPES[UA_TYPES_UINT16]) raw.u16 = (UA_UInt16)value;
+    else if (type == &UA_TYPES[UA_TYPES_UINT32]) raw.u32 = (UA_UInt32)value;
+    else if (type == &UA_TYPES[UA_TYPES_UINT64]) raw.u64 = (UA_UInt64)value;
+    else if (type == &UA_TYPES[UA_TYPES_INT32]) raw.i32 = (UA_Int32)value;
+    else if (type == &UA_TYPES[UA_TYPES_FLOAT]) raw.f = (UA_Float)value;
+    else {
+        raw.d = value;
+        type = &UA_TYPES[UA_TYPES_DOUBLE];
     }
-    return technicalName; // Return technical name if no mapping found
+    UA_Variant_setScalarCopy(variant, &raw, type);
 }
 
-// Find display name by index (for cases where names don't match but order does)
-static const char* findDisplayNameByIndex(VariableMapping *mapping, int index) {
-    while (mapping) {
-        if (mapping->index == index) {
-            return mapping->displayName;
-        }
-        mapping = mapping->next;
+static void setHistoryTimestamps(UA_DataValue *dv, UA_DateTime time, UA_TimestampsToReturn timestamps) {
+    if (timestamps == UA_TIMESTAMPSTORETURN_SOURCE || timestamps == UA_TIMESTAMPSTORETURN_BOTH) {
+        dv->sourceTimestamp = time;
+        dv->hasSourceTimestamp = true;
+    }
+    if (timestamps == UA_TIMESTAMPSTORETURN_SERVER || timestamps == UA_TIMESTAMPSTORETURN_BOTH) {
+        dv->serverTimestamp = time;
+        dv->hasServerTimestamp = true;
     }
-    return NULL; // Return NULL if no mapping found
 }
 
-// Free variable mapping
-static void freeVariableMapping(VariableMapping *mapping) {
-    while (mapping) {
-        VariableMapping *next = mapping->next;
-        free(mapping);
-        mapping = next;
+//-----------------------------------------------------------------------------
+// Reads the continuation point of a node. Returns false if it is invalid
+//-----------------------------------------------------------------------------
+static bool readContinuation(const UA_ByteString *point, OpcHistoryContinuation *continuation) {
+    if (point->length == 0) return true;
+    if (point->length != sizeof(OpcHistoryContinuation)) return false;
+    memcpy(continuation, point->data, sizeof(OpcHistoryContinuation));
+    return continuation->skip >= 0;
+}
+
+static void setContinuation(UA_HistoryReadResult *result, int64_t start, int32_t skip) {
+    OpcHistoryContinuation continuation;
+    memset(&continuation, 0, sizeof(continuation));
+    continuation.start = start;
+    continuation.skip = skip;
+    if (UA_ByteString_allocBuffer(&result->continuationPoint, sizeof(continuation)) == UA_STATUSCODE_GOOD) {
+        memcpy(result->continuationPoint.data, &continuation, sizeof(continuation));
     }
 }
 
-// Fallback: parse LOCATED_VARIABLES.h entries like __LOCATED_VAR(BOOL,__QX0_1,Q,X,0,1)
-static int createNodesFromLocatedVariables(UA_Server *server) {
-    UA_NodeId programFolder;
-    createProgramVariablesFolder(server, &programFolder);
-    char debug_msg[256]; // Declare debug_msg at the beginning of the function
-    
-    // Prefer OPCUA_VARIABLES.csv; if present, USE ONLY it and skip LOCATED_VARIABLES.h
-    VariableMapping *varMapping = parseOpcuaVariablesCsv();
-    if (varMapping) {
-        int addedFromCsv = 0;
-        for (VariableMapping *m = varMapping; m != NULL; m = m->next) {
-            const char *nodeName = m->displayName;    // friendly name
-            const char *location = m->technicalName;  // IEC location like %QX0.0
-            void *ptr = NULL; const UA_DataType *uaType = NULL;
-            if (!resolvePointerFromLocation(location, &ptr, &uaType)) {
-                char log_msg[256];
-                sprintf(log_msg, "OPCUA_VARIABLES.csv: failed to resolve %s for '%s'\n", location, nodeName);
-                openplc_log(log_msg);
-                continue;
+//-----------------------------------------------------------------------------
+// Finds the node and the time range of a history read, with its continuation
+// point. Returns the status of the node
+//-----------------------------------------------------------------------------
+static UA_StatusCode startHistoryRead(const UA_HistoryReadValueId *read, UA_DateTime startTime, UA_DateTime endTime,
+                                      OpcNodeInfo **node, int64_t *start, int64_t *end, int32_t *skip) {
+    *node = findHistorizedNode(&read->nodeId);
+    if (*node == NULL) return UA_STATUSCODE_BADHISTORYOPERATIONUNSUPPORTED;
+    if (startTime == 0) return UA_STATUSCODE_BADINVALIDTIMESTAMPARGUMENT;
+
+    *start = uaTimeToMs(startTime);
+    *end = endTime == 0 ? INT64_MAX : uaTimeToMs(endTime);
+    if (*end < *start) return UA_STATUSCODE_BADHISTORYOPERATIONUNSUPPORTED;
+
+    OpcHistoryContinuation continuation = { *start, 0 };
+    if (!readContinuation(&read->continuationPoint, &continuation)) return UA_STATUSCODE_BADCONTINUATIONPOINTINVALID;
+    *start = continuation.start;
+    *skip = continuation.skip;
+    return UA_STATUSCODE_GOOD;
+}
+
+//-----------------------------------------------------------------------------
+// HistoryRead of the raw archived points. Reads past numValuesPerNode (or
+// OPCUA_HISTORY_MAX_VALUES) return a continuation point. The bounding values
+// are not returned
+//-----------------------------------------------------------------------------
+static void readHistoryRaw(UA_Server *server, void *hdbContext, const UA_NodeId *sessionId, void *sessionContext,
+                           const UA_RequestHeader *requestHeader, const UA_ReadRawModifiedDetails *details,
+                           UA_TimestampsToReturn timestampsToReturn, UA_Boolean releaseContinuationPoints,
+                           size_t nodesToReadSize, const UA_HistoryReadValueId *nodesToRead,
+                           UA_HistoryReadResponse *response, UA_HistoryData * const * const historyData) {
+    for (size_t i = 0; i < nodesToReadSize; i++) {
+        UA_HistoryReadResult *result = &response->results[i];
+        if (releaseContinuationPoints) continue;
+        if (details->endTime == 0 && details->numValuesPerNode == 0) {
+            result->statusCode = UA_STATUSCODE_BADINVALIDTIMESTAMPARGUMENT;
+            continue;
+        }
+
+        OpcNodeInfo *node;
+        int64_t start, end;
+        int32_t skip;
+        result->statusCode = startHistoryRead(&nodesToRead[i], details->startTime, details->endTime, &node, &start, &end, &skip);
+        if (result->statusCode != UA_STATUSCODE_GOOD) continue;
+
+        int limit = OPCUA_HISTORY_MAX_VALUES;
+        if (details->numValuesPerNode > 0 && details->numValuesPerNode < (UA_UInt32)limit) limit = (int)details->numValuesPerNode;
+
+        // One point more tells if a continuation point is needed
+        HistorianPoint *points = (HistorianPoint*)malloc((limit + 1) * sizeof(HistorianPoint));
+        if (points == NULL) {
+            result->statusCode = UA_STATUSCODE_BADOUTOFMEMORY;
+            continue;
+        }
+        int count = readHistorianPoints(node->historyTag, start, end, skip, points, limit + 1);
+
+        if (count > limit) {
+            int64_t next = points[limit].time;
+            int32_t next_skip = next == start ? skip : 0;
+            for (int p = 0; p < limit; p++) {
+                if (points[p].time == next) next_skip++;
+            }
+            setContinuation(result, next, next_skip);
+            count = limit;
+        }
+
+        UA_HistoryData *data = historyData[i];
+        if (count > 0) {
+            data->dataValues = (UA_DataValue*)UA_Array_new(count, &UA_TYPES[UA_TYPES_DATAVALUE]);
+            if (data->dataValues == NULL) {
+                result->statusCode = UA_STATUSCODE_BADOUTOFMEMORY;
+                count = 0;
             }
-            static UA_UInt32 nextId = 4000000;
-            UA_NodeId nodeId = UA_NODEID_NUMERIC(g_namespace_index, nextId++);
-            addVariableNode(server, nodeName, programFolder, nodeId, ptr, (UA_DataType*)uaType);
-            addedFromCsv++;
+            data->dataValuesSize = count;
+        }
+        for (int p = 0; p < count; p++) {
+            UA_DataValue *dv = &data->dataValues[p];
+            setHistoryValue(&dv->value, node->dataType, points[p].value);
+            dv->hasValue = true;
+            setHistoryTimestamps(dv, msToUaTime(points[p].time), timestampsToReturn);
         }
-        freeVariableMapping(varMapping);
-        return addedFromCsv;
+        if (count == 0 && result->statusCode == UA_STATUSCODE_GOOD) result->statusCode = UA_STATUSCODE_GOODNODATA;
+        free(points);
     }
-    
-    // Debug: Check buffer state before parsing
-    sprintf(debug_msg, "Buffer state: int_output[0]=%p, bool_output[4][0]=%p, bool_output[4][2]=%p\n", 
-            int_output[0], bool_output[4][0], bool_output[4][2]);
-    openplc_log(debug_msg);
-    
+}
 
-    // Try multiple common locations for LOCATED_VARIABLES.h
-    const char *hdrCandidates[] = {
-        "LOCATED_VARIABLES.h",
-        "./LOCATED_VARIABLES.h",
-        "core/LOCATED_VARIABLES.h",
-        "./core/LOCATED_VARIABLES.h",
-        "../core/LOCATED_VARIABLES.h",
-        "../LOCATED_VARIABLES.h"
-    };
-    FILE *f = NULL;
-    for (size_t i=0; i<sizeof(hdrCandidates)/sizeof(hdrCandidates[0]); i++) {
-        f = fopen(hdrCandidates[i], "r");
-        if (f) break;
+//-----------------------------------------------------------------------------
+// Value of an aggregate over an interval. Average and Range are calculated
+// on the archived points, not weighted by time. Returns false if the
+// aggregate is not supported
+//-----------------------------------------------------------------------------
+static bool setAggregateValue(UA_DataValue *dv, const UA_NodeId *aggregate, const HistorianInterval *interval,
+                              const UA_DataType *type) {
+    if (aggregate->namespaceIndex != 0 || aggregate->identifierType != UA_NODEIDTYPE_NUMERIC) return false;
+
+    UA_UInt32 id = aggregate->identifier.numeric;
+    if (id == UA_NS0ID_AGGREGATEFUNCTION_COUNT) {
+        UA_UInt32 count = interval->count;
+        UA_Variant_setScalarCopy(&dv->value, &count, &UA_TYPES[UA_TYPES_UINT32]);
+        dv->hasValue = true;
+        return true;
     }
-    if (!f) {
-        char log_msg[256];
-        sprintf(log_msg, "LOCATED_VARIABLES.h not found in common locations. No nodes created.\n");
-        openplc_log(log_msg);
-        return 0;
-    }
-    int added = 0;
-    int seen = 0;
-    int locatedVarIndex = 0; // Track index of located variables
-    char line[1024];
-    while (fgets(line, sizeof(line), f)) {
-        // Debug: Log every line being read
-        sprintf(debug_msg, "Reading line: %s", line);
-        openplc_log(debug_msg);
-        // Trim leading spaces
-        char *p = line;
-        while (*p==' ' || *p=='\t' || *p=='\r' || *p=='\n') p++;
-        // Quick filter: look for macro substring
-        if (strstr(p, "__LOCATED_VAR(") == NULL) continue;
-        seen++;
-        
-        // Debug: Log that we found a __LOCATED_VAR line
-        sprintf(debug_msg, "Found __LOCATED_VAR line: %s", p);
-        openplc_log(debug_msg);
-        // Extract inside parentheses
-        char *lpar = strchr(p, '(');
-        char *rpar = lpar ? strrchr(lpar, ')') : NULL;
-        if (!lpar || !rpar) continue;
-        *rpar = '\0';
-        char *args = lpar + 1;
-
-        // Tokenize by comma
-        char *tokens[8]; int n=0; char *saveptr=NULL; char *tok = strtok_r(args, ",", &saveptr);
-        while (tok && n<8) { tokens[n++] = tok; tok = strtok_r(NULL, ",", &saveptr); }
-        
-        // Debug: Log tokenization results
-        sprintf(debug_msg, "Tokenized %d tokens: ", n);
-        for (int i = 0; i < n; i++) {
-            char temp[64];
-            sprintf(temp, "[%d]=%s ", i, tokens[i]);
-            strcat(debug_msg, temp);
+    if (id != UA_NS0ID_AGGREGATEFUNCTION_AVERAGE && id != UA_NS0ID_AGGREGATEFUNCTION_MINIMUM &&
+        id != UA_NS0ID_AGGREGATEFUNCTION_MAXIMUM && id != UA_NS0ID_AGGREGATEFUNCTION_RANGE &&
+        id != UA_NS0ID_AGGREGATEFUNCTION_START && id != UA_NS0ID_AGGREGATEFUNCTION_END) {
+        return false;
+    }
+
+    if (interval->count == 0) {
+        dv->status = UA_STATUSCODE_BADNODATA;
+        dv->hasStatus = true;
+        return true;
+    }
+
+    switch (id) {
+        case UA_NS0ID_AGGREGATEFUNCTION_AVERAGE: setHistoryValue(&dv->value, NULL, interval->sum / interval->count); break;
+        case UA_NS0ID_AGGREGATEFUNCTION_RANGE: setHistoryValue(&dv->value, NULL, interval->max - interval->min); break;
+        case UA_NS0ID_AGGREGATEFUNCTION_MINIMUM: setHistoryValue(&dv->value, type, interval->min); break;
+        case UA_NS0ID_AGGREGATEFUNCTION_MAXIMUM: setHistoryValue(&dv->value, type, interval->max); break;
+        case UA_NS0ID_AGGREGATEFUNCTION_START: setHistoryValue(&dv->value, type, interval->first); break;
+        default: setHistoryValue(&dv->value, type, interval->last); break;
+    }
+    dv->hasValue = true;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// HistoryRead of aggregates (Count, Minimum, Maximum, Average, Range, Start,
+// End) over the processing intervals. Each interval is stamped with its
+// start. Requests of more than OPCUA_HISTORY_MAX_VALUES intervals return a
+// continuation point
+//-----------------------------------------------------------------------------
+static void readHistoryProcessed(UA_Server *server, void *hdbContext, const UA_NodeId *sessionId, void *sessionContext,
+                                 const UA_RequestHeader *requestHeader, const UA_ReadProcessedDetails *details,
+                                 UA_TimestampsToReturn timestampsToReturn, UA_Boolean releaseContinuationPoints,
+                                 size_t nodesToReadSize, const UA_HistoryReadValueId *nodesToRead,
+                                 UA_HistoryReadResponse *response, UA_HistoryData * const * const historyData) {
+    if (details->aggregateTypeSize != nodesToReadSize) {
+        response->responseHeader.serviceResult = UA_STATUSCODE_BADAGGREGATELISTMISMATCH;
+        return;
+    }
+
+    for (size_t i = 0; i < nodesToReadSize; i++) {
+        UA_HistoryReadResult *result = &response->results[i];
+        if (releaseContinuationPoints) continue;
+        if (details->endTime == 0) {
+            result->statusCode = UA_STATUSCODE_BADINVALIDTIMESTAMPARGUMENT;
+            continue;
         }
-        strcat(debug_msg, "\n");
-        openplc_log(debug_msg);
-        
-        if (n < 5) {
-            sprintf(debug_msg, "Skipping: insufficient tokens (need at least 5, got %d)\n", n);
-            openplc_log(debug_msg);
+
+        OpcNodeInfo *node;
+        int64_t start, end;
+        int32_t skip;
+        result->statusCode = startHistoryRead(&nodesToRead[i], details->startTime, details->endTime, &node, &start, &end, &skip);
+        if (result->statusCode != UA_STATUSCODE_GOOD) continue;
+
+        // The end time is not part of the last interval. An interval of 0
+        // is the whole range
+        int64_t width = (int64_t)details->processingInterval;
+        if (width <= 0) width = end - start;
+        if (width <= 0 || end <= start) {
+            result->statusCode = UA_STATUSCODE_GOODNODATA;
             continue;
         }
+        int64_t remaining = (end - start + width - 1) / width;
+        int count = remaining > OPCUA_HISTORY_MAX_VALUES ? OPCUA_HISTORY_MAX_VALUES : (int)remaining;
+
+        HistorianInterval *intervals = (HistorianInterval*)malloc(count * sizeof(HistorianInterval));
+        UA_HistoryData *data = historyData[i];
+        data->dataValues = (UA_DataValue*)UA_Array_new(count, &UA_TYPES[UA_TYPES_DATAVALUE]);
+        if (intervals == NULL || data->dataValues == NULL) {
+            free(intervals);
+            result->statusCode = UA_STATUSCODE_BADOUTOFMEMORY;
+            continue;
+        }
+        data->dataValuesSize = count;
+
+        // The last interval of the range may be shorter
+        readHistorianIntervals(node->historyTag, start, width, count, intervals);
+        if (count == remaining) {
+            int64_t last_end = start + width * count;
+            if (last_end > end) {
+                HistorianInterval *last = &intervals[count - 1];
+                int64_t last_start = start + width * (count - 1);
+                readHistorianIntervals(node->historyTag, last_start, end - last_start, 1, last);
+            }
+        }
 
-        // tokens: [0]=IEC type, [1]=__NAME, [2]=Area(I/Q/M), [3]=Type(X/B/W/D/L), [4]=idx1, [5]=idx2
-        char *nameTok = tokens[1];
-        while (*nameTok==' '||*nameTok=='\t') nameTok++;
-        if (strncmp(nameTok, "__", 2) == 0) nameTok += 2; // strip leading __
-        
-        // Try to find display name by technical name first, then by index
-        const char *displayName = findDisplayName(varMapping, nameTok);
-        if (strcmp(displayName, nameTok) == 0) {
-            // No match found, try by index
-            displayName = findDisplayNameByIndex(varMapping, locatedVarIndex);
-            if (!displayName) {
-                displayName = nameTok; // Fallback to technical name
+        for (int p = 0; p < count; p++) {
+            UA_DataValue *dv = &data->dataValues[p];
+            if (!setAggregateValue(dv, &details->aggregateType[i], &intervals[p], node->dataType)) {
+                result->statusCode = UA_STATUSCODE_BADAGGREGATENOTSUPPORTED;
+                break;
             }
+            setHistoryTimestamps(dv, msToUaTime(start + width * p), timestampsToReturn);
         }
-        
-        char dispName[128];
-        snprintf(dispName, sizeof(dispName), "%s", displayName);
-        
-        // Debug: Log what we're parsing
-        sprintf(debug_msg, "Parsing variable[%d]: technical='%s', display='%s', area=%c, type=%c, idx1=%d, idx2=%d\n", 
-                locatedVarIndex, nameTok, dispName, tokens[2][0], tokens[3][0], atoi(tokens[4]), (n>=6) ? atoi(tokens[5]) : 0);
-        openplc_log(debug_msg);
-
-        // Compose a location string to reuse resolver
-        while (tokens[2][0]==' '||tokens[2][0]=='\t') tokens[2]++;
-        while (tokens[3][0]==' '||tokens[3][0]=='\t') tokens[3]++;
-        char area = tokens[2][0];
-        char typ = tokens[3][0];
-        int idx1 = atoi(tokens[4]);
-        int idx2 = (n>=6) ? atoi(tokens[5]) : 0;
-        
-        // Debug: Log the parsed values
-        sprintf(debug_msg, "Parsed values: area=%c, type=%c, idx1=%d, idx2=%d\n", area, typ, idx1, idx2);
-        openplc_log(debug_msg);
+        free(intervals);
+
+        if (result->statusCode != UA_STATUSCODE_GOOD) {
+            UA_Array_delete(data->dataValues, data->dataValuesSize, &UA_TYPES[UA_TYPES_DATAVALUE]);
+            data->dataValues = NULL;
+            data->dataValuesSize = 0;
+        } else if (count < remaining) {
+            setContinuation(result, start + width * count, 0);
+        }
+    }
+}
 
-        char location[64];
-        if (typ == 'X') snprintf(location, sizeof(location), "%%%cX%d.%d", area, idx1, idx2);
-        else snprintf(location, sizeof(location), "%%%c%c%d", area, typ, idx1);
-        
-        // Debug: Log the location string
-        sprintf(debug_msg, "Generated location string: %s\n", location);
-        openplc_log(debug_msg);
+//-----------------------------------------------------------------------------
+// Makes a node historizing if the historian records its location
+//-----------------------------------------------------------------------------
+static bool historizeNode(UA_Server *server, OpcNodeInfo *info, const char *location) {
+    if (info->count > 1 || !findHistorianTag(location, &info->historyTag)) return false;
+
+    info->historized = true;
+    UA_Server_writeHistorizing(server, info->nodeId, true);
+    UA_Server_writeAccessLevel(server, info->nodeId, UA_ACCESSLEVELMASK_READ | UA_ACCESSLEVELMASK_WRITE |
+                                                     UA_ACCESSLEVELMASK_HISTORYREAD);
+    return true;
+}
+
+static void configureHistory(UA_ServerConfig *cfg) {
+    memset(&cfg->historyDatabase, 0, sizeof(cfg->historyDatabase));
+    cfg->historyDatabase.readRaw = readHistoryRaw;
+    cfg->historyDatabase.readProcessed = readHistoryProcessed;
+    cfg->accessHistoryDataCapability = true;
+    cfg->maxReturnDataValues = OPCUA_HISTORY_MAX_VALUES;
+}
+#else
+static bool historizeNode(UA_Server *server, OpcNodeInfo *info, const char *location) {
+    return false;
+}
 
-        void *ptr = NULL; const UA_DataType *uaType = NULL;
-        if (!resolvePointerFromLocation(location, &ptr, &uaType)) {
+static void configureHistory(UA_ServerConfig *cfg) {
+}
+#endif
+
+// Add the nodes of the located variables from the address space table the
+// glue generator builds with the program (named after OPCUA_VARIABLES.csv
+// when the program was compiled with it), on the folders of
+// programVariableFolder() unless flat_address_space is set
+static int createNodesFromLocatedVariables(UA_Server *server) {
+    UA_NodeId programFolder;
+    createProgramVariablesFolder(server, &programFolder);
+    ProgramFolderCache folders;
+    memset(&folders, 0, sizeof(folders));
+    folders.folderId = UA_NODEID_NULL;
+
+    const PlcProgram *program = plcProgram();
+    if (!createNodeTable((int)program->located_variable_count)) return 0;
+    int historized = 0;
+
+    for (size_t i = 0; i < program->located_variable_count; i++) {
+        const PlcLocatedVariable *var = &program->located_variables[i];
+        const UA_DataType *type = uaTypeForSize(var->size);
+        if (type == NULL) {
             char log_msg[256];
-            sprintf(log_msg, "Failed to resolve: %s (area=%c, type=%c, idx1=%d, idx2=%d)\n", 
-                    location, area, typ, idx1, idx2);
+            snprintf(log_msg, sizeof(log_msg), "Unsupported located variable %s for '%s'\n", var->location, var->name);
             openplc_log(log_msg);
             continue;
         }
-
-        static UA_UInt32 nextId = 4000000;
-        UA_NodeId nodeId = UA_NODEID_NUMERIC(g_namespace_index, nextId++);
-        addVariableNode(server, dispName, programFolder, nodeId, ptr, (UA_DataType*)uaType);
-        added++;
-        locatedVarIndex++; // Increment index for next variable
+        UA_NodeId nodeId = UA_NODEID_NUMERIC(g_namespace_index, var->node_id);
+        UA_NodeId parent = programFolder;
+        if (!g_tuning.flatAddressSpace) programVariableFolder(server, programFolder, var, &folders, &parent);
+        int added = g_node_count;
+        addVariableNode(server, var->name, parent, nodeId, var->value, (UA_DataType*)type, var->count > 1 ? var->count : 1);
+        if (g_node_count > added && historizeNode(server, &g_nodes[added], var->location)) historized++;
     }
-    fclose(f);
-    if (added == 0) {
+    UA_NodeId_clear(&folders.folderId);
+
+    if (historized > 0) {
         char log_msg[256];
-        sprintf(log_msg, "No located variables found in LOCATED_VARIABLES.h (seen %d macro lines)\n", seen);
+        snprintf(log_msg, sizeof(log_msg), "OPC UA history of %d nodes read from the historian\n", historized);
         openplc_log(log_msg);
     }
-    
-    // Clean up variable mapping
-    freeVariableMapping(varMapping);
-    
-    return added;
+    return g_node_count;
 }
 
 //-----------------------------------------------------------------------------
@@ -1195,6 +1602,310 @@ void finalizeOpcua() {
     // No-op. The server is deleted at the end of opcuaStartServer().
 }
 
+//-----------------------------------------------------------------------------
+// Selects how located variables are exposed. Takes effect the next time the
+// server is started
+//-----------------------------------------------------------------------------
+void setOpcuaDataSourceMode(bool enabled) {
+    g_data_source_requested = enabled;
+}
+
+//-----------------------------------------------------------------------------
+// Sets the server limits and buffer sizes from a list of "key=value" pairs
+// separated by commas, e.g. "max_sessions=200,send_buffer_size=262144". The
+// settings left out keep their defaults. Takes effect the next time the
+// server is started
+//-----------------------------------------------------------------------------
+void setOpcuaTuning(const char *settings) {
+    struct TuningKey {
+        const char *name;
+        UA_UInt32 *value;
+    };
+    const TuningKey keys[] = {
+        { "max_sessions", &g_tuning.maxSessions },
+        { "max_subscriptions", &g_tuning.maxSubscriptions },
+        { "max_subscriptions_per_session", &g_tuning.maxSubscriptionsPerSession },
+        { "max_monitored_items", &g_tuning.maxMonitoredItems },
+        { "max_monitored_items_per_subscription", &g_tuning.maxMonitoredItemsPerSubscription },
+        { "max_notifications_per_publish", &g_tuning.maxNotificationsPerPublish },
+        { "max_nodes_per_read", &g_tuning.maxNodesPerRead },
+        { "max_nodes_per_write", &g_tuning.maxNodesPerWrite },
+        { "send_buffer_size", &g_tuning.sendBufferSize },
+        { "recv_buffer_size", &g_tuning.recvBufferSize },
+        { "max_message_size", &g_tuning.maxMessageSize },
+        { "max_chunk_count", &g_tuning.maxChunkCount },
+        { "max_security_token_lifetime", &g_tuning.maxSecurityTokenLifetime },
+        { "max_references_per_node", &g_tuning.maxReferencesPerNode },
+        { "max_nodes_per_browse", &g_tuning.maxNodesPerBrowse },
+        { "flat_address_space", &g_tuning.flatAddressSpace },
+    };
+
+    memset(&g_tuning, 0, sizeof(g_tuning));
+    const char *p = settings;
+    while (p && *p) {
+        char key[64];
+        double value;
+        int consumed = 0;
+        if (sscanf(p, " %63[a-z_] = %lf%n", key, &value, &consumed) == 2 && value >= 0) {
+            bool known = false;
+            if (strcmp(key, "min_publishing_interval") == 0) {
+                g_tuning.minPublishingInterval = value;
+                known = true;
+            } else if (strcmp(key, "min_sampling_interval") == 0) {
+                g_tuning.minSamplingInterval = value;
+                known = true;
+            }
+            for (size_t i = 0; !known && i < sizeof(keys) / sizeof(keys[0]); i++) {
+                if (strcmp(key, keys[i].name) == 0) {
+                    *keys[i].value = (UA_UInt32)value;
+                    known = true;
+                }
+            }
+            if (!known) {
+                char log_msg[200];
+                snprintf(log_msg, sizeof(log_msg), "Unknown OPC UA server setting '%s', ignoring it\n", key);
+                openplc_log(log_msg);
+            }
+        }
+        p = strchr(p + consumed, ',');
+        if (p) p++;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Applies the limits given on start_opcua() to a server configured with the
+// minimal configuration. The buffer sizes are applied by the caller
+//-----------------------------------------------------------------------------
+static void applyServerTuning(UA_ServerConfig *cfg) {
+    if (g_tuning.maxSessions) cfg->maxSessions = (UA_UInt16)(g_tuning.maxSessions > 0xFFFF ? 0xFFFF : g_tuning.maxSessions);
+    if (g_tuning.maxNodesPerRead) cfg->maxNodesPerRead = g_tuning.maxNodesPerRead;
+    if (g_tuning.maxNodesPerWrite) cfg->maxNodesPerWrite = g_tuning.maxNodesPerWrite;
+    if (g_tuning.maxNodesPerBrowse) cfg->maxNodesPerBrowse = g_tuning.maxNodesPerBrowse;
+    cfg->maxReferencesPerNode = g_tuning.maxReferencesPerNode ? g_tuning.maxReferencesPerNode : OPC_BROWSE_PAGE_SIZE;
+    if (g_tuning.maxSecurityTokenLifetime) cfg->maxSecurityTokenLifetime = g_tuning.maxSecurityTokenLifetime;
+#ifdef UA_ENABLE_SUBSCRIPTIONS
+    if (g_tuning.maxSubscriptions) cfg->maxSubscriptions = g_tuning.maxSubscriptions;
+    if (g_tuning.maxSubscriptionsPerSession) cfg->maxSubscriptionsPerSession = g_tuning.maxSubscriptionsPerSession;
+    if (g_tuning.maxMonitoredItems) cfg->maxMonitoredItems = g_tuning.maxMonitoredItems;
+    if (g_tuning.maxMonitoredItemsPerSubscription) cfg->maxMonitoredItemsPerSubscription = g_tuning.maxMonitoredItemsPerSubscription;
+    if (g_tuning.maxNotificationsPerPublish) cfg->maxNotificationsPerPublish = g_tuning.maxNotificationsPerPublish;
+    if (g_tuning.minPublishingInterval > 0) cfg->publishingIntervalLimits.min = g_tuning.minPublishingInterval;
+    if (g_tuning.minSamplingInterval > 0) cfg->samplingIntervalLimits.min = g_tuning.minSamplingInterval;
+#endif
+
+    // Message size and chunk count limits of the TCP connections
+#if UA_OPEN62541_VER_MAJOR > 1 || (UA_OPEN62541_VER_MAJOR == 1 && UA_OPEN62541_VER_MINOR >= 4)
+    if (g_tuning.maxMessageSize) cfg->tcpMaxMsgSize = g_tuning.maxMessageSize;
+    if (g_tuning.maxChunkCount) cfg->tcpMaxChunks = g_tuning.maxChunkCount;
+#else
+    for (size_t i = 0; i < cfg->networkLayersSize; i++) {
+        UA_ConnectionConfig *conn = &cfg->networkLayers[i].localConnectionConfig;
+        if (g_tuning.maxMessageSize) {
+            conn->localMaxMessageSize = g_tuning.maxMessageSize;
+            conn->remoteMaxMessageSize = g_tuning.maxMessageSize;
+        }
+        if (g_tuning.maxChunkCount) {
+            conn->localMaxChunkCount = g_tuning.maxChunkCount;
+            conn->remoteMaxChunkCount = g_tuning.maxChunkCount;
+        }
+    }
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Session callbacks of the access control, wrapped to count the sessions for
+// the metrics exporter
+//-----------------------------------------------------------------------------
+static UA_StatusCode (*g_activate_session)(UA_Server *server, UA_AccessControl *ac,
+                                           const UA_EndpointDescription *endpointDescription,
+                                           const UA_ByteString *secureChannelRemoteCertificate,
+                                           const UA_NodeId *sessionId,
+                                           const UA_ExtensionObject *userIdentityToken,
+                                           void **sessionContext) = NULL;
+static void (*g_close_session)(UA_Server *server, UA_AccessControl *ac,
+                               const UA_NodeId *sessionId, void *sessionContext) = NULL;
+
+static UA_StatusCode countActivateSession(UA_Server *server, UA_AccessControl *ac,
+                                          const UA_EndpointDescription *endpointDescription,
+                                          const UA_ByteString *secureChannelRemoteCertificate,
+                                          const UA_NodeId *sessionId,
+                                          const UA_ExtensionObject *userIdentityToken,
+                                          void **sessionContext) {
+    UA_StatusCode sc = g_activate_session(server, ac, endpointDescription, secureChannelRemoteCertificate,
+                                          sessionId, userIdentityToken, sessionContext);
+    if (sc == UA_STATUSCODE_GOOD) recordProtocolConnection(OPCUA_PROTOCOL, true);
+    return sc;
+}
+
+static void countCloseSession(UA_Server *server, UA_AccessControl *ac,
+                              const UA_NodeId *sessionId, void *sessionContext) {
+    recordProtocolConnection(OPCUA_PROTOCOL, false);
+    g_close_session(server, ac, sessionId, sessionContext);
+}
+
+static void countSessions(UA_ServerConfig *cfg) {
+    if (!cfg->accessControl.activateSession || !cfg->accessControl.closeSession) return;
+    g_activate_session = cfg->accessControl.activateSession;
+    g_close_session = cfg->accessControl.closeSession;
+    cfg->accessControl.activateSession = countActivateSession;
+    cfg->accessControl.closeSession = countCloseSession;
+}
+
+//-----------------------------------------------------------------------------
+// Sets the security policies from a list of "key=value" pairs separated by
+// commas, e.g. "policies=basic256sha256+aes128,certificate=/etc/opc/cert.der,
+// private_key=/etc/opc/key.der". The policies are none, basic256sha256 and
+// aes128 (Aes128_Sha256_RsaOaep) joined by '+', application_uri must match
+// the URI of the certificate. Takes effect the next time the server is
+// started
+//-----------------------------------------------------------------------------
+void setOpcuaSecurity(const char *settings) {
+    unsigned int policies = 0;
+    g_security.applicationUri[0] = '\0';
+    g_security.certificate.path[0] = '\0';
+    g_security.privateKey.path[0] = '\0';
+
+    const char *p = settings;
+    while (p && *p) {
+        char key[64];
+        char value[256];
+        char log_msg[400];
+        if (sscanf(p, " %63[a-z_] = %255[^,]", key, value) == 2) {
+            if (strcmp(key, "policies") == 0) {
+                char *save = NULL;
+                for (char *name = strtok_r(value, "+", &save); name; name = strtok_r(NULL, "+", &save)) {
+                    if (strcmp(name, "none") == 0) policies |= OPC_POLICY_NONE;
+                    else if (strcmp(name, "basic256sha256") == 0) policies |= OPC_POLICY_BASIC256SHA256;
+                    else if (strcmp(name, "aes128") == 0) policies |= OPC_POLICY_AES128;
+                    else {
+                        snprintf(log_msg, sizeof(log_msg), "Unknown OPC UA security policy '%s', ignoring it\n", name);
+                        openplc_log(log_msg);
+                    }
+                }
+            } else if (strcmp(key, "certificate") == 0) {
+                snprintf(g_security.certificate.path, sizeof(g_security.certificate.path), "%s", value);
+            } else if (strcmp(key, "private_key") == 0) {
+                snprintf(g_security.privateKey.path, sizeof(g_security.privateKey.path), "%s", value);
+            } else if (strcmp(key, "application_uri") == 0) {
+                snprintf(g_security.applicationUri, sizeof(g_security.applicationUri), "%s", value);
+            } else {
+                snprintf(log_msg, sizeof(log_msg), "Unknown OPC UA security setting '%s', ignoring it\n", key);
+                openplc_log(log_msg);
+            }
+        }
+        p = strchr(p, ',');
+        if (p) p++;
+    }
+
+    g_security.policies = policies ? policies : OPC_POLICY_NONE;
+}
+
+//-----------------------------------------------------------------------------
+// Reads a certificate or key file, unless the copy read before is still
+// current. Returns false if the file can't be read
+//-----------------------------------------------------------------------------
+static bool loadSecurityFile(OpcSecurityFile *file) {
+    char log_msg[400];
+    struct stat st;
+    if (file->path[0] == '\0' || stat(file->path, &st) != 0 || st.st_size <= 0) {
+        snprintf(log_msg, sizeof(log_msg), "OPC UA security: can't read '%s'\n", file->path);
+        openplc_log(log_msg);
+        return false;
+    }
+    if (file->data.length > 0 && strcmp(file->loadedPath, file->path) == 0 && file->mtime == st.st_mtime) {
+        return true;
+    }
+
+    UA_ByteString_clear(&file->data);
+    file->loadedPath[0] = '\0';
+    FILE *fp = fopen(file->path, "rb");
+    if (fp == NULL || UA_ByteString_allocBuffer(&file->data, (size_t)st.st_size) != UA_STATUSCODE_GOOD ||
+        fread(file->data.data, 1, file->data.length, fp) != file->data.length) {
+        snprintf(log_msg, sizeof(log_msg), "OPC UA security: can't read '%s'\n", file->path);
+        openplc_log(log_msg);
+        UA_ByteString_clear(&file->data);
+        if (fp) fclose(fp);
+        return false;
+    }
+    fclose(fp);
+
+    snprintf(file->loadedPath, sizeof(file->loadedPath), "%s", file->path);
+    file->mtime = st.st_mtime;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Adds the security policies given on opcua_security() to a server configured
+// with the minimal configuration, which only has the None policy. The
+// endpoints are signed and encrypted, the None endpoint is only kept when the
+// none policy is listed (the None channel still serves the discovery). The
+// certificate and the key are only used to open the secure channels, the
+// messages on a channel use the symmetric keys derived when it was opened
+//-----------------------------------------------------------------------------
+static UA_StatusCode configureSecurity(UA_ServerConfig *cfg) {
+    char log_msg[400];
+    if ((g_security.policies & ~OPC_POLICY_NONE) == 0) return UA_STATUSCODE_GOOD;
+
+#ifdef UA_ENABLE_ENCRYPTION
+    if (!loadSecurityFile(&g_security.certificate) || !loadSecurityFile(&g_security.privateKey)) {
+        return UA_STATUSCODE_BADCERTIFICATEINVALID;
+    }
+    const UA_ByteString *certificate = &g_security.certificate.data;
+    const UA_ByteString *privateKey = &g_security.privateKey.data;
+
+    UA_StatusCode sc = UA_STATUSCODE_GOOD;
+    if (g_security.policies & OPC_POLICY_BASIC256SHA256) {
+        sc = UA_ServerConfig_addSecurityPolicyBasic256Sha256(cfg, certificate, privateKey);
+    }
+    if (sc == UA_STATUSCODE_GOOD && (g_security.policies & OPC_POLICY_AES128)) {
+        sc = UA_ServerConfig_addSecurityPolicyAes128Sha256RsaOaep(cfg, certificate, privateKey);
+    }
+    if (sc != UA_STATUSCODE_GOOD) return sc;
+
+    if (!(g_security.policies & OPC_POLICY_NONE)) {
+        for (size_t i = 0; i < cfg->endpointsSize; i++) {
+            UA_EndpointDescription_clear(&cfg->endpoints[i]);
+        }
+        UA_free(cfg->endpoints);
+        cfg->endpoints = NULL;
+        cfg->endpointsSize = 0;
+    }
+    if (g_security.policies & OPC_POLICY_BASIC256SHA256) {
+        sc = UA_ServerConfig_addEndpoint(cfg, UA_STRING((char *)"http://opcfoundation.org/UA/SecurityPolicy#Basic256Sha256"),
+                                         UA_MESSAGESECURITYMODE_SIGNANDENCRYPT);
+    }
+    if (sc == UA_STATUSCODE_GOOD && (g_security.policies & OPC_POLICY_AES128)) {
+        sc = UA_ServerConfig_addEndpoint(cfg, UA_STRING((char *)"http://opcfoundation.org/UA/SecurityPolicy#Aes128_Sha256_RsaOaep"),
+                                         UA_MESSAGESECURITYMODE_SIGNANDENCRYPT);
+    }
+    if (sc != UA_STATUSCODE_GOOD) return sc;
+
+    if (g_security.applicationUri[0] != '\0') {
+        UA_String_clear(&cfg->applicationDescription.applicationUri);
+        cfg->applicationDescription.applicationUri = UA_STRING_ALLOC(g_security.applicationUri);
+    }
+
+    snprintf(log_msg, sizeof(log_msg), "OPC UA security policies:%s%s%s\n",
+             (g_security.policies & OPC_POLICY_NONE) ? " None" : "",
+             (g_security.policies & OPC_POLICY_BASIC256SHA256) ? " Basic256Sha256" : "",
+             (g_security.policies & OPC_POLICY_AES128) ? " Aes128_Sha256_RsaOaep" : "");
+    openplc_log(log_msg);
+    return UA_STATUSCODE_GOOD;
+#else
+    snprintf(log_msg, sizeof(log_msg), "OPC UA security policies need open62541 built with encryption\n");
+    openplc_log(log_msg);
+    return UA_STATUSCODE_BADSECURITYPOLICYREJECTED;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Samples the nodes on every 'decimation' scans (0 disables the scan
+// sampling). Takes effect the next time the server is started
+//-----------------------------------------------------------------------------
+void setOpcuaScanSampling(int decimation) {
+    g_scan_sampling_requested = decimation > 0 ? (unsigned int)decimation : 0;
+}
+
 //-----------------------------------------------------------------------------
 // Stop flag setter for external callers
 //-----------------------------------------------------------------------------
@@ -1247,6 +1958,11 @@ void opcuaStartServer(int port) {
     // Reset all state
     g_opcua_running = false;
     g_namespace_index = 1;
+    g_data_source_mode = g_data_source_requested;
+    g_scan_sampling = g_data_source_mode ? 0 : g_scan_sampling_requested;
+    if (g_data_source_mode && g_scan_sampling_requested > 0) {
+        openplc_log("OPC UA scan sampling is not available with data source nodes, ignoring it\n");
+    }
     
     // Create a fresh server and configure minimal server with given port
     g_opcua_server = UA_Server_new();
@@ -1269,7 +1985,9 @@ void opcuaStartServer(int port) {
         return;
     }
     
-    UA_StatusCode configRet = UA_ServerConfig_setMinimal(cfg, (UA_UInt16)port, NULL);
+    // Zero buffer sizes make open62541 use its defaults
+    UA_StatusCode configRet = UA_ServerConfig_setMinimalCustomBuffer(cfg, (UA_UInt16)port, NULL,
+                                                                     g_tuning.sendBufferSize, g_tuning.recvBufferSize);
     if (configRet != UA_STATUSCODE_GOOD) {
         sprintf(log_msg, "Failed to configure server: %s\n", UA_StatusCode_name(configRet));
         openplc_log(log_msg);
@@ -1278,9 +1996,29 @@ void opcuaStartServer(int port) {
         return;
     }
     
+    configRet = configureSecurity(cfg);
+    if (configRet != UA_STATUSCODE_GOOD) {
+        sprintf(log_msg, "Failed to configure the security policies: %s\n", UA_StatusCode_name(configRet));
+        openplc_log(log_msg);
+        UA_Server_delete(g_opcua_server);
+        g_opcua_server = NULL;
+        return;
+    }
+    
+    applyServerTuning(cfg);
+    configureHistory(cfg);
+    countSessions(cfg);
     sprintf(log_msg, "Server configured successfully\n");
     openplc_log(log_msg);
 
+    // A sampling interval of 0 samples the item on every write of the node,
+    // which the scan sampling does once per changed value
+    if (g_scan_sampling > 0) {
+        cfg->samplingIntervalLimits.min = 0.0;
+        sprintf(log_msg, "OPC UA nodes sampled every %u scans\n", g_scan_sampling);
+        openplc_log(log_msg);
+    }
+
     // Register namespace first
     registerNamespace(g_opcua_server);
     // Log ABI/runtime info
@@ -1290,6 +2028,7 @@ void opcuaStartServer(int port) {
     sprintf(log_msg, "About to scan and create nodes...\n");
     openplc_log(log_msg);
     scanAndCreateNodes(g_opcua_server);
+    createSyncTable();
     
     sprintf(log_msg, "Node creation completed, setting running flag...\n");
     openplc_log(log_msg);
@@ -1306,6 +2045,7 @@ void opcuaStartServer(int port) {
     if (retval != UA_STATUSCODE_GOOD) {
         sprintf(log_msg, "OPC UA server startup failed: %s\n", UA_StatusCode_name(retval));
         openplc_log(log_msg);
+        destroySyncTable();
         UA_Server_delete(g_opcua_server);
         g_opcua_server = NULL;
         g_opcua_running = false;
@@ -1315,14 +2055,22 @@ void opcuaStartServer(int port) {
     sprintf(log_msg, "OPC UA server startup completed, entering run loop...\n");
     openplc_log(log_msg);
     
-    // Non-blocking run loop with longer sleep to allow main thread to run
+    // Event driven run loop. The server is iterated without blocking and the
+    // thread then waits for its next timed event or for a new PLC copy
     while (g_opcua_running) {
-        UA_Server_run_iterate(g_opcua_server, true);
-        usleep(50000); // 50ms sleep to allow main thread to run
+        UA_UInt16 timeout = UA_Server_run_iterate(g_opcua_server, false);
+        flushStagedWrites();
+        if (g_scan_sampling > 0) {
+            publishScanChanges(g_opcua_server);
+        } else {
+            publishChangedNodes(g_opcua_server);
+        }
+        waitForServerWork(timeout);
     }
     
     sprintf(log_msg, "OPC UA server stopped\n");
     openplc_log(log_msg);
+    destroySyncTable();
 
     // Clean up server instance to ensure clean restarts
     UA_Server_delete(g_opcua_server);
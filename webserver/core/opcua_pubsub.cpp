@@ -0,0 +1,545 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements an OPC UA PubSub publisher (UADP over UDP, OPC UA
+// Part 14). The DataSets configured on opcua_pubsub.cfg are published as one
+// NetworkMessage per interval, taken from the published process image, so
+// any number of subscribers costs the scan nothing and needs no session on
+// the OPC UA server.
+//
+// The fields have a fixed size, so the whole NetworkMessage is encoded once
+// when the publisher starts. Each cycle only rewrites the sequence numbers,
+// the timestamp and the field values at their known offsets.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ladder.h"
+
+#define PUBSUB_CONFIG_FILE      "opcua_pubsub.cfg"
+#define PUBSUB_MAX_DATASETS     32
+#define PUBSUB_MAX_FIELDS       1024
+#define PUBSUB_MAX_MESSAGE      1472    // one Ethernet frame, UADP chunking is not supported
+
+// UADP header flags
+#define UADP_VERSION            0x01
+#define UADP_PUBLISHER_ID       0x10
+#define UADP_GROUP_HEADER       0x20
+#define UADP_PAYLOAD_HEADER     0x40
+#define UADP_EXTENDED_FLAGS1    0x80
+#define UADP_PUBLISHER_UINT16   0x01
+#define UADP_TIMESTAMP          0x20
+#define UADP_WRITER_GROUP_ID    0x01
+#define UADP_GROUP_VERSION      0x02
+#define UADP_SEQUENCE_NUMBER    0x08
+#define UADP_DATASET_VALID      0x01
+#define UADP_DATASET_SEQUENCE   0x08
+
+// Built-in type ids of the field variants
+#define UA_TYPE_BOOLEAN         1
+#define UA_TYPE_UINT16          5
+#define UA_TYPE_UINT32          7
+#define UA_TYPE_UINT64          9
+
+// 100 ns intervals between 1601-01-01 and 1970-01-01
+#define UA_DATETIME_UNIX_EPOCH  116444736000000000LL
+
+// A field of a DataSet: where its value is on the snapshot and where it goes
+// on the encoded message
+struct PubSubField
+{
+    size_t source;      // offset on ProcessImageSnapshot
+    uint16_t offset;    // offset of the value on the message
+    uint8_t size;       // 1, 2, 4 or 8 bytes
+};
+
+struct PubSubDataSet
+{
+    uint16_t writer_id;
+    int first_field;
+    int field_count;
+    uint16_t sequence_offset;
+    uint16_t sequence;
+};
+
+struct PubSubConfig
+{
+    struct in_addr address;
+    uint16_t port;
+    struct in_addr interface;
+    int ttl;
+    uint16_t publisher_id;
+    uint16_t writer_group_id;
+    int interval_ms;
+};
+
+static PubSubConfig config;
+static PubSubDataSet datasets[PUBSUB_MAX_DATASETS];
+static int dataset_count = 0;
+static PubSubField fields[PUBSUB_MAX_FIELDS];
+static int field_count = 0;
+
+static uint8_t message[PUBSUB_MAX_MESSAGE];
+static size_t message_size = 0;
+static uint16_t group_sequence_offset = 0;
+static uint16_t timestamp_offset = 0;
+static uint16_t group_sequence = 0;
+
+static pthread_t pubsub_thread;
+static volatile bool pubsub_running = false;
+static int pubsub_socket = -1;
+
+//-----------------------------------------------------------------------------
+// Little endian encoders. They return the offset past the encoded value
+//-----------------------------------------------------------------------------
+static size_t putU8(size_t offset, uint8_t value)
+{
+    message[offset] = value;
+    return offset + 1;
+}
+
+static size_t putU16(size_t offset, uint16_t value)
+{
+    message[offset] = (uint8_t)value;
+    message[offset + 1] = (uint8_t)(value >> 8);
+    return offset + 2;
+}
+
+static size_t putU32(size_t offset, uint32_t value)
+{
+    offset = putU16(offset, (uint16_t)value);
+    return putU16(offset, (uint16_t)(value >> 16));
+}
+
+static size_t putU64(size_t offset, uint64_t value)
+{
+    offset = putU32(offset, (uint32_t)value);
+    return putU32(offset, (uint32_t)(value >> 32));
+}
+
+//-----------------------------------------------------------------------------
+// Parses one location of the process image ([%]IX0.0, QW3, MD10, ...) into
+// its offset on the snapshot and its size. The snapshot holds the bits and
+// words of the inputs and outputs and the words, double and long words of
+// the memory. Returns a pointer past the location, or NULL if the text isn't
+// one of those
+//-----------------------------------------------------------------------------
+static const char *parseField(const char *text, size_t *source, uint8_t *size, int *index)
+{
+    if (*text == '%') text++;
+    char area = *text++;
+    char width = *text++;
+    if (!isdigit((unsigned char)*text)) return NULL;
+
+    char *end;
+    long value = strtol(text, &end, 10);
+    if (width == 'X')
+    {
+        if (*end != '.' || !isdigit((unsigned char)end[1])) return NULL;
+        long bit = strtol(end + 1, &end, 10);
+        if (bit > 7) return NULL;
+        value = value * 8 + bit;
+        if (value >= BUFFER_SIZE * 8) return NULL;
+    }
+    else if (value >= BUFFER_SIZE)
+    {
+        return NULL;
+    }
+
+    if (area == 'I' && width == 'X') *source = offsetof(ProcessImageSnapshot, bool_input);
+    else if (area == 'Q' && width == 'X') *source = offsetof(ProcessImageSnapshot, bool_output);
+    else if (area == 'I' && width == 'W') *source = offsetof(ProcessImageSnapshot, int_input);
+    else if (area == 'Q' && width == 'W') *source = offsetof(ProcessImageSnapshot, int_output);
+    else if (area == 'M' && width == 'W') *source = offsetof(ProcessImageSnapshot, int_memory);
+    else if (area == 'M' && width == 'D') *source = offsetof(ProcessImageSnapshot, dint_memory);
+    else if (area == 'M' && width == 'L') *source = offsetof(ProcessImageSnapshot, lint_memory);
+    else return NULL;
+
+    switch (width)
+    {
+        case 'X': *size = 1; break;
+        case 'W': *size = 2; break;
+        case 'D': *size = 4; break;
+        default: *size = 8; break;
+    }
+    *index = (int)value;
+    return end;
+}
+
+//-----------------------------------------------------------------------------
+// Appends the fields of a "fields = %IW0-%IW7, %MD0" line to a DataSet.
+// Returns false if the list is malformed or there are too many fields
+//-----------------------------------------------------------------------------
+static bool parseFields(PubSubDataSet *dataset, const char *text)
+{
+    while (*text)
+    {
+        if (*text == ',' || isspace((unsigned char)*text))
+        {
+            text++;
+            continue;
+        }
+
+        size_t source, last_source;
+        uint8_t size, last_size;
+        int first, last;
+        text = parseField(text, &source, &size, &first);
+        if (text == NULL) return false;
+        last = first;
+        if (*text == '-')
+        {
+            text = parseField(text + 1, &last_source, &last_size, &last);
+            if (text == NULL || last_source != source || last < first) return false;
+        }
+
+        for (int i = first; i <= last; i++)
+        {
+            if (field_count == PUBSUB_MAX_FIELDS) return false;
+            PubSubField *field = &fields[field_count++];
+            field->source = source + (size_t)i * size;
+            field->size = size;
+            dataset->field_count++;
+        }
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Applies one "key = value" line before the first [dataset] section
+//-----------------------------------------------------------------------------
+static void applyPubSubSetting(char *key, char *value)
+{
+    char log_msg[1000];
+
+    if (strcmp(key, "address") == 0)
+    {
+        if (inet_pton(AF_INET, value, &config.address) != 1)
+        {
+            sprintf(log_msg, "OPC UA PubSub: invalid address '%s'\n", value);
+            openplc_log(log_msg);
+        }
+    }
+    else if (strcmp(key, "interface") == 0)
+    {
+        if (inet_pton(AF_INET, value, &config.interface) != 1)
+        {
+            sprintf(log_msg, "OPC UA PubSub: invalid interface address '%s'\n", value);
+            openplc_log(log_msg);
+        }
+    }
+    else if (strcmp(key, "port") == 0) config.port = (uint16_t)atoi(value);
+    else if (strcmp(key, "ttl") == 0) config.ttl = atoi(value);
+    else if (strcmp(key, "publisher_id") == 0) config.publisher_id = (uint16_t)atoi(value);
+    else if (strcmp(key, "writer_group_id") == 0) config.writer_group_id = (uint16_t)atoi(value);
+    else if (strcmp(key, "interval") == 0) config.interval_ms = atoi(value);
+}
+
+//-----------------------------------------------------------------------------
+// Applies one line of opcua_pubsub.cfg. Each [dataset] header starts a new
+// DataSet, and the settings before the first one are global. The context
+// points to the DataSet being filled
+//-----------------------------------------------------------------------------
+static void applyPubSubLine(const char *section, char *key, char *value, void *context)
+{
+    char log_msg[1000];
+    PubSubDataSet **dataset = (PubSubDataSet **)context;
+    if (key == NULL)
+    {
+        if (strcmp(section, "dataset") != 0) return;
+        if (dataset_count == PUBSUB_MAX_DATASETS)
+        {
+            openplc_log((char *)"OPC UA PubSub: too many datasets, the rest are ignored\n");
+            *dataset = NULL;
+            return;
+        }
+        *dataset = &datasets[dataset_count++];
+        (*dataset)->writer_id = (uint16_t)dataset_count;
+        (*dataset)->first_field = field_count;
+        (*dataset)->field_count = 0;
+        (*dataset)->sequence = 0;
+        return;
+    }
+
+    if (*dataset == NULL)
+    {
+        if (dataset_count == 0) applyPubSubSetting(key, value);
+    }
+    else if (strcmp(key, "writer_id") == 0)
+    {
+        (*dataset)->writer_id = (uint16_t)atoi(value);
+    }
+    else if (strcmp(key, "fields") == 0)
+    {
+        if (!parseFields(*dataset, value))
+        {
+            sprintf(log_msg, "OPC UA PubSub: invalid fields '%s' on dataset %d\n", value, (*dataset)->writer_id);
+            openplc_log(log_msg);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Reads opcua_pubsub.cfg. Returns false if the file is missing or declares
+// no DataSet, in which case nothing is published
+//-----------------------------------------------------------------------------
+static bool loadPubSubConfig()
+{
+    inet_pton(AF_INET, "239.0.0.1", &config.address);
+    config.port = 4840;
+    config.interface.s_addr = htonl(INADDR_ANY);
+    config.ttl = 1;
+    config.publisher_id = 1;
+    config.writer_group_id = 1;
+    config.interval_ms = 100;
+    dataset_count = 0;
+    field_count = 0;
+
+    PubSubDataSet *dataset = NULL;
+    if (!parseSettingsFile(PUBSUB_CONFIG_FILE, applyPubSubLine, &dataset)) return false;
+
+    if (config.interval_ms <= 0) config.interval_ms = 100;
+    return dataset_count > 0;
+}
+
+//-----------------------------------------------------------------------------
+// Encodes the NetworkMessage with every value at zero and records the
+// offsets rewritten on each cycle. Returns false if it doesn't fit on one
+// datagram
+//-----------------------------------------------------------------------------
+static bool encodeNetworkMessage()
+{
+    // Worst case size, checked before anything is written
+    size_t needed = 2 + 2 + 1 + 2 + 4 + 2 + 1 + 2 * dataset_count + 8 + 2 * dataset_count;
+    for (int d = 0; d < dataset_count; d++)
+    {
+        needed += 1 + 2 + 2;
+        for (int i = 0; i < datasets[d].field_count; i++) needed += 1 + fields[datasets[d].first_field + i].size;
+    }
+    if (needed > PUBSUB_MAX_MESSAGE || dataset_count > 255) return false;
+
+    memset(message, 0, sizeof(message));
+    size_t offset = 0;
+    offset = putU8(offset, UADP_VERSION | UADP_PUBLISHER_ID | UADP_GROUP_HEADER | UADP_PAYLOAD_HEADER | UADP_EXTENDED_FLAGS1);
+    offset = putU8(offset, UADP_PUBLISHER_UINT16 | UADP_TIMESTAMP);
+    offset = putU16(offset, config.publisher_id);
+
+    // Group header. The version changes on every start, so the subscribers
+    // see that the layout may have changed
+    offset = putU8(offset, UADP_WRITER_GROUP_ID | UADP_GROUP_VERSION | UADP_SEQUENCE_NUMBER);
+    offset = putU16(offset, config.writer_group_id);
+    offset = putU32(offset, (uint32_t)(time(NULL) - 946684800)); // seconds since 2000
+    group_sequence_offset = (uint16_t)offset;
+    offset = putU16(offset, 0);
+
+    // Payload header
+    offset = putU8(offset, (uint8_t)dataset_count);
+    for (int d = 0; d < dataset_count; d++) offset = putU16(offset, datasets[d].writer_id);
+
+    timestamp_offset = (uint16_t)offset;
+    offset = putU64(offset, 0);
+
+    // With more than one DataSetMessage their sizes come first
+    if (dataset_count > 1)
+    {
+        for (int d = 0; d < dataset_count; d++)
+        {
+            size_t size = 1 + 2 + 2;
+            for (int i = 0; i < datasets[d].field_count; i++) size += 1 + fields[datasets[d].first_field + i].size;
+            offset = putU16(offset, (uint16_t)size);
+        }
+    }
+
+    // Key frame DataSetMessages, every field as a variant
+    for (int d = 0; d < dataset_count; d++)
+    {
+        PubSubDataSet *dataset = &datasets[d];
+        offset = putU8(offset, UADP_DATASET_VALID | UADP_DATASET_SEQUENCE);
+        dataset->sequence_offset = (uint16_t)offset;
+        offset = putU16(offset, 0);
+        offset = putU16(offset, (uint16_t)dataset->field_count);
+        for (int i = 0; i < dataset->field_count; i++)
+        {
+            PubSubField *field = &fields[dataset->first_field + i];
+            uint8_t type = UA_TYPE_BOOLEAN;
+            if (field->size == 2) type = UA_TYPE_UINT16;
+            else if (field->size == 4) type = UA_TYPE_UINT32;
+            else if (field->size == 8) type = UA_TYPE_UINT64;
+            offset = putU8(offset, type);
+            field->offset = (uint16_t)offset;
+            offset += field->size;
+        }
+    }
+
+    message_size = offset;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Copies the values of the published process image into the message
+//-----------------------------------------------------------------------------
+static void updateNetworkMessage()
+{
+    uint32_t sequence;
+    const ProcessImageSnapshot *snap;
+    uint64_t timestamp;
+    do
+    {
+        snap = beginProcessImageRead(&sequence);
+        const uint8_t *base = (const uint8_t *)snap;
+        for (int i = 0; i < field_count; i++)
+        {
+            const PubSubField *field = &fields[i];
+            const uint8_t *value = base + field->source;
+            switch (field->size)
+            {
+                case 1: putU8(field->offset, *value != 0); break;
+                case 2: putU16(field->offset, *(const uint16_t *)value); break;
+                case 4: putU32(field->offset, *(const uint32_t *)value); break;
+                case 8: putU64(field->offset, *(const uint64_t *)value); break;
+            }
+        }
+        timestamp = snap->timestamp;
+    } while (!endProcessImageRead(snap, sequence));
+
+    putU64(timestamp_offset, (uint64_t)((int64_t)timestamp * 10000 + UA_DATETIME_UNIX_EPOCH));
+    putU16(group_sequence_offset, group_sequence++);
+    for (int d = 0; d < dataset_count; d++)
+    {
+        putU16(datasets[d].sequence_offset, datasets[d].sequence++);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Publisher thread. Sends one NetworkMessage per interval, on an absolute
+// schedule so the stream doesn't drift
+//-----------------------------------------------------------------------------
+static void *pubsubThread(void *arg)
+{
+    (void)arg;
+    setThreadClass(THREAD_CLASS_COMM, "opcua_pubsub");
+
+    struct sockaddr_in destination;
+    memset(&destination, 0, sizeof(destination));
+    destination.sin_family = AF_INET;
+    destination.sin_addr = config.address;
+    destination.sin_port = htons(config.port);
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    bool send_failed = false;
+    while (pubsub_running)
+    {
+        updateNetworkMessage();
+        if (sendto(pubsub_socket, message, message_size, 0, (struct sockaddr *)&destination, sizeof(destination)) < 0)
+        {
+            // Logged once until the network comes back
+            if (!send_failed)
+            {
+                char log_msg[1000];
+                sprintf(log_msg, "OPC UA PubSub: send failed: %s\n", strerror(errno));
+                openplc_log(log_msg);
+            }
+            send_failed = true;
+        }
+        else
+        {
+            send_failed = false;
+        }
+
+        next.tv_nsec += (long)config.interval_ms * 1000000;
+        while (next.tv_nsec >= 1000000000)
+        {
+            next.tv_nsec -= 1000000000;
+            next.tv_sec++;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR);
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Starts the publisher if opcua_pubsub.cfg declares any DataSet. Called once
+// the process image is published
+//-----------------------------------------------------------------------------
+void startOpcuaPubSub()
+{
+    char log_msg[1000];
+
+    if (!loadPubSubConfig()) return;
+    if (!encodeNetworkMessage())
+    {
+        sprintf(log_msg, "OPC UA PubSub: the datasets don't fit on a %d byte message, publisher disabled\n", PUBSUB_MAX_MESSAGE);
+        openplc_log(log_msg);
+        return;
+    }
+
+    pubsub_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (pubsub_socket < 0)
+    {
+        sprintf(log_msg, "OPC UA PubSub: failed to create socket: %s\n", strerror(errno));
+        openplc_log(log_msg);
+        return;
+    }
+    unsigned char ttl = (unsigned char)config.ttl;
+    setsockopt(pubsub_socket, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    if (config.interface.s_addr != htonl(INADDR_ANY))
+    {
+        setsockopt(pubsub_socket, IPPROTO_IP, IP_MULTICAST_IF, &config.interface, sizeof(config.interface));
+    }
+
+    pubsub_running = true;
+    if (pthread_create(&pubsub_thread, NULL, pubsubThread, NULL) != 0)
+    {
+        pubsub_running = false;
+        close(pubsub_socket);
+        pubsub_socket = -1;
+        openplc_log((char *)"OPC UA PubSub: failed to start the publisher thread\n");
+        return;
+    }
+
+    char address[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &config.address, address, sizeof(address));
+    sprintf(log_msg, "OPC UA PubSub: publishing %d datasets (%d fields, %d bytes) to %s:%d every %d ms\n",
+            dataset_count, field_count, (int)message_size, address, config.port, config.interval_ms);
+    openplc_log(log_msg);
+}
+
+//-----------------------------------------------------------------------------
+// Stops the publisher, if it was started
+//-----------------------------------------------------------------------------
+void stopOpcuaPubSub()
+{
+    if (!pubsub_running) return;
+
+    pubsub_running = false;
+    pthread_join(pubsub_thread, NULL);
+    close(pubsub_socket);
+    pubsub_socket = -1;
+}
@@ -34,73 +34,70 @@
 
 //--------------------------------------------------------------Defines--------------------------------------------------------------------------------//
 
-/*------------Maximum/Minimum Sizes for each buffer------------------*/
-#define MAX_DISCRETE_INPUT              1024 // Digital Inputs
-#define MAX_COILS                       1024 // Digital Outputs
-#define MAX_HOLD_REGS                   1024 // Pure registers Analog Outputs
-//#define MAX_INP_REGS                    1024 // Analog Inputs
-
-#define MIN_16B_RANGE                   1024 //Holding Register Size 16bit (memory)
-#define MAX_16B_RANGE                   2047 //Holding Register Size 16bit (memory)
-#define MAX_32B_RANGE                   2047 //Holding Register Size 32bit (memory)
+/*------------Maximum/Minimum Sizes for each file------------------*/
+#define PCCC_MAX_DATA_SIZE              244  // Largest data payload of a typed read/write
+#define PCCC_MAX_BIT_ELEMENTS           (BUFFER_SIZE / 2) // 16 bits per element
+#define MIN_16B_RANGE                   1024 // N file elements from here on are %MW
+#define MAX_16B_RANGE                   (MIN_16B_RANGE + BUFFER_SIZE)
 
 /*------------File Type for PCCC--------------*/
 #define PCCC_INPUT_LOGICAL_SLOT			0x8c
 #define PCCC_OUTPUT_LOGICAL_SLOT		0x8b
+#define PCCC_BIT                        0x85
 #define PCCC_INTEGER					0x89
 #define PCCC_FLOATING_POINT				0x8A
+#define PCCC_LONG                       0x91
+
+/*------------Status codes for PCCC replies--------------*/
+#define PCCC_STS_SUCCESS                0x00
+#define PCCC_STS_ILLEGAL_COMMAND        0x10
+#define PCCC_STS_HOST_PROBLEM           0x20
+#define PCCC_STS_EXTENDED               0xf0
 
-#define PCCC_FN_OUTPUT					0x00
-#define PCCC_FN_INPUT					0x01
-#define PCCC_FN_INT						0x07
-#define PCCC_FN_FLOAT					0x08
+#define PCCC_EXT_ILLEGAL_VALUE          0x01
+#define PCCC_EXT_UNUSABLE_ADDRESS       0x06
+#define PCCC_EXT_WRONG_SIZE             0x07
+#define PCCC_EXT_TOO_LARGE              0x0a
 
 /*----------------Define functions for bit/byte operations-------------------*/
-#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
-#define bitSet(value, bit) ((value) |= (1UL << (bit)))
-#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
-#define bitWrite(value, bit, bitvalue) (bitvalue ? bitSet(value, bit) : bitClear(value, bit))
 #define lowByte(w) ((unsigned char) ((w) & 0xff))
 #define highByte(w) ((unsigned char) ((w) >> 8))
 /*---------------------------------------------------------------------------*/
 
-/*-----PLC Buffers - These buffer store the contents from OpenPLC-----------*/
-IEC_BOOL pccc_discrete_input[MAX_DISCRETE_INPUT];
-IEC_BOOL pccc_coils[MAX_COILS];
-//IEC_UINT pccc_input_regs[MAX_INP_REGS];
-IEC_UINT pccc_holding_regs[MAX_HOLD_REGS];
 //-----------------------------------------------------------------------------------------------------------------------------------------------------//
 
-thread_local int Pccc_MessageLength;
-
 using namespace std;
 //-----------------------------------------------------------Structure Defines--------------------------------------------------//
 struct pccc_header //Structure for the Header Information for EthernetIP
 {
-    unsigned char *Data;    
-    unsigned char *Data_Size;	
-    
-    unsigned char *HD_length = 5;//[5] -> Typical Header Length for Command; Response Header Length is 4
     unsigned char *HD_CMD_Code;//[1] -> Command Code
     unsigned char *HD_Status;//[1] -> Status Code
     unsigned char *HD_TransactionNum;//[2] -> Transaction Number
     unsigned char *HD_Data_Function_Code;//[1] -> Function code MSB
-    unsigned char *HD_Ext_Status; //Ext Status -> only appended if Status = 0x0f[1]
-
-    unsigned char resp_cod_hex = 0x4f; //Response Hex Value
-    unsigned char *RP_CMD_Code = &resp_cod_hex;//[1] -> Reply Command Code = 0x4f
 };
 
-struct protected_logical_read_command //Struct for Reply and Command values of Read
-{	
-    unsigned char *CMD_Byte_Size;//[1]	
-    unsigned char *RP_EXT_Status;//[1]* -> Ext Status -> only appended if Status = 0x0f[1]
+//-----------------------------------------------------------------------------
+// Logical address of a typed read/write (file number, file type, element and
+// sub-element) and where the data that follows it starts on the request
+//-----------------------------------------------------------------------------
+struct pccc_address
+{
+    uint16_t file_number;
+    uint8_t file_type;
+    uint16_t element;
+    uint16_t sub_element;
+    int data_offset;
 };
 
-struct protected_logical_write_command
-{	
-    unsigned char *CMD_Byte_Size;//[1]*
-    unsigned char *RP_EXT_Status;//[1]* -> Ext Status -> only appended if Status = 0x0f[1]
+//-----------------------------------------------------------------------------
+// How a data file is mapped on the process image. Bit files (O, I) pack 16
+// located bits per element, word files (B, N) are 16-bit elements and F and
+// L files are 32-bit elements
+//-----------------------------------------------------------------------------
+struct pccc_file
+{
+    int element_size;   // bytes
+    int max_elements;
 };
 //--------------------------------------------------------------------------------------------------------------------------------------//
 
@@ -111,16 +108,6 @@ uint16_t ParsePCCCData(unsigned char *buffer, int buffer_size);
 uint16_t Protected_Logical_Read_Reply(pccc_header, unsigned char *buffer, int buffer_size);
 uint16_t Protected_Logical_Write_Reply(pccc_header, unsigned char *buffer, int buffer_size);
 
-void Pccc_ReadCoils(unsigned char *buffer, int buffer_size);
-void Pccc_WriteCoil(unsigned char *buffer, int buffer_size);
-void Pccc_ReadDiscreteInputs(unsigned char *buffer, int buffer_size);
-void Pccc_ReadHoldingRegisters(unsigned char *buffer, int buffer_size);
-//void Pccc_ReadInputRegisters(unsigned char *buffer, int buffer_size);
-void Pccc_WriteRegister(unsigned char *buffer, int buffer_size);
-
-int word_pccc(unsigned char byte1, unsigned char byte2);
-int an_word_pccc(unsigned char byte1, unsigned char byte2);
-
 //----------------------------------------------------------------------------//
 
 //This function takes in the data from enip.cpp and places the data in the appropriate structure variables
@@ -128,9 +115,6 @@ uint16_t processPCCCMessage(unsigned char *buffer, int buffer_size)
 {
     /* Variables */
     int new_pccc_length; //New PCCC Length
-    pccc_header header;
-    header.Data = buffer;
-    header.Data_Size = buffer_size;
     
     /*Determine the new pccc length*/
     new_pccc_length = ParsePCCCData(buffer,buffer_size);
@@ -142,6 +126,9 @@ uint16_t ParsePCCCData(unsigned char *buffer, int buffer_size)
     /*Variables*/
     int new_pccc_length; //Variable for new PCCC length
     pccc_header header;
+
+    if (buffer_size < 5)
+        return -1;
     
     header.HD_CMD_Code = &buffer[0];//[1] -> Command Code
     header.HD_Status = &buffer[1];////[1] -> Status Code
@@ -180,398 +167,308 @@ uint16_t Command_Protocol(pccc_header header, unsigned char *buffer, int buffer_
     }//return length as -1 to signify that the CMD Code/Function Code was not recognize
 }
 
-uint16_t Protected_Logical_Read_Reply(pccc_header header, unsigned char *buffer, int buffer_size)
+//-----------------------------------------------------------------------------
+// Reads one field of a logical address. Values above 254 are sent as 0xFF
+// followed by the 16-bit value. Returns false if the request is too short
+//-----------------------------------------------------------------------------
+static bool readAddressField(unsigned char *buffer, int buffer_size, int *offset, uint16_t *value)
 {
-    /*Variables*/
-    protected_logical_read_command protected_LR;
-    protected_LR.CMD_Byte_Size = &buffer[5];//Byte Size of data to be read
-    
-    /*Determining Data Length*/
-    unsigned int len_resp = 4;
-    len_resp = len_resp + (unsigned int)*protected_LR.CMD_Byte_Size;
-    
-    /*check if the message is long enough- Left in for future error handling setup*/
-    /*if (buffer_size < 8)
-    {
-        //PCCC Error Handling; Make sure that the buffer size is at least 8
-    }*/
-
-    //****************** Read Coils **********************//
-    if(buffer[6] == PCCC_FN_OUTPUT && buffer[7] == PCCC_OUTPUT_LOGICAL_SLOT) // Done/Tested
+    if (*offset >= buffer_size) return false;
+    if (buffer[*offset] != 0xff)
     {
-        Pccc_ReadCoils(buffer, buffer_size);
-    }
-    
-    //*************** Read Discrete Inputs ***************//
-    else if(buffer[6] == PCCC_FN_INPUT && buffer[7] == PCCC_INPUT_LOGICAL_SLOT)// Done/Tested
-    {
-        Pccc_ReadDiscreteInputs(buffer, buffer_size);
+        *value = buffer[(*offset)++];
+        return true;
     }
 
-    //****************** Read Holding Registers[PURE, 16Bit Mem, 32bit MEM] ******************//
-    else if((buffer[6] == PCCC_FN_INT || buffer[6] == PCCC_FN_FLOAT)  && (buffer[7] == PCCC_INTEGER || buffer[7] == PCCC_FLOATING_POINT))//Done/Tested
-    {
-        Pccc_ReadHoldingRegisters(buffer, buffer_size);
-    }
-    else
-    {
-        char log_msg[1000];
-        sprintf(log_msg, "PCCC: Error occured while processing Protected Logical Read\n");
-        openplc_log(log_msg); 
-        return -1;
-    }//return length as -1 to signify that the CMD Code/Function Code was not recognize
-    
-    /*Creating the reply packet and memcpy the data into the buffer*/
-    memmove(&buffer[0], header.RP_CMD_Code, 1); //0x4f Response Code
-    memmove(&buffer[1], header.HD_Status, 1); //Same from COMMAND REQUEST
-    memmove(&buffer[2], header.HD_TransactionNum, 2);//Same from COMMAND REQUEST
-    
-    return len_resp; //Return the Resonse Packet Length for PCCC	
+    if (*offset + 2 >= buffer_size) return false;
+    *value = (uint16_t)buffer[*offset + 1] | ((uint16_t)buffer[*offset + 2] << 8);
+    *offset += 3;
+    return true;
 }
 
-uint16_t Protected_Logical_Write_Reply(pccc_header header,unsigned char *buffer, int buffer_size) // Connected
-{	
-    /*Variables*/
-    protected_logical_write_command protected_LW;	
-    protected_LW.CMD_Byte_Size = &buffer[5];//Byte Size of data to be read
-    
-    /*Determining link of new PCCC Packet*/
-    uint16_t len_resp = header.HD_length - 1;
-    
-    /*Creating the reply packet and memcpy the data into the buffer*/
-    memmove(&buffer[0], header.RP_CMD_Code, 1);
-    memmove(&buffer[1], header.HD_Status, 1);
-    memmove(&buffer[2], header.HD_TransactionNum, 2);
-    
-    /*check if the message is long enough- Left in for future error handling setup*/
-    /*if (buffer_size < 8)
-    {
-        //PCCC Error Handling; Make sure that the buffer size is at least 8
-    }*/
-    
-    //****************** Write Coil **********************//
-    if(buffer[6] == PCCC_FN_OUTPUT && buffer[7] == PCCC_OUTPUT_LOGICAL_SLOT)// Done/Tested
-    {
-        Pccc_WriteCoil(buffer, buffer_size);
-    }
-
-    //****************** Write Register ******************//
-    else if((buffer[6] == PCCC_FN_FLOAT || buffer[6] == PCCC_FN_INT) && (buffer[7] == PCCC_INTEGER || buffer[7] == PCCC_FLOATING_POINT))//Done/Tested
-    {
-        Pccc_WriteRegister(buffer, buffer_size);
-    }
+//-----------------------------------------------------------------------------
+// Parses the logical address of a typed read/write (three address fields)
+//-----------------------------------------------------------------------------
+static bool parseAddress(unsigned char *buffer, int buffer_size, pccc_address *address)
+{
+    int offset = 6;
+    if (!readAddressField(buffer, buffer_size, &offset, &address->file_number)) return false;
+    if (offset >= buffer_size) return false;
+    address->file_type = buffer[offset++];
+    if (!readAddressField(buffer, buffer_size, &offset, &address->element)) return false;
+    if (!readAddressField(buffer, buffer_size, &offset, &address->sub_element)) return false;
+    address->data_offset = offset;
+    return true;
+}
 
-    //****************** Function Code Error ******************/
-    /*Left in for future error handling setup*/
-    else
+//-----------------------------------------------------------------------------
+// Returns the mapping of a file type, or false if the type is not supported
+//-----------------------------------------------------------------------------
+static bool getFileMapping(uint8_t file_type, pccc_file *file)
+{
+    switch (file_type)
     {
-        //PCCC Error Handling; Make sure that the buffer size is at least 8. If none of the defined File Type and File Numbers match, error unrecognized File Type and File Number.
+        case PCCC_OUTPUT_LOGICAL_SLOT:
+        case PCCC_INPUT_LOGICAL_SLOT:
+            file->element_size = 2;
+            file->max_elements = PCCC_MAX_BIT_ELEMENTS;
+            return true;
+        case PCCC_BIT:
+            file->element_size = 2;
+            file->max_elements = BUFFER_SIZE;
+            return true;
+        case PCCC_INTEGER:
+            file->element_size = 2;
+            file->max_elements = MAX_16B_RANGE;
+            return true;
+        case PCCC_FLOATING_POINT:
+        case PCCC_LONG:
+            file->element_size = 4;
+            file->max_elements = BUFFER_SIZE;
+            return true;
     }
-    return len_resp;	
+    return false;
 }
 
 //-----------------------------------------------------------------------------
-// Concatenate two bytes into an int
+// Checks the address and size of a typed read/write. Returns the number of
+// elements accessed or -1 with the reply status on buffer
 //-----------------------------------------------------------------------------
-int word_pccc(unsigned char byte1, unsigned char byte2)
+static int checkAccess(unsigned char *buffer, int buffer_size, pccc_address *address, pccc_file *file)
 {
-    int returnValue;
-    returnValue = (int)(byte1) | (int)byte2;
+    int byte_size = buffer[5];
+    int ext_status = 0;
 
-    return returnValue;
+    if (!parseAddress(buffer, buffer_size, address))
+    {
+        buffer[1] = PCCC_STS_ILLEGAL_COMMAND;
+        return -1;
+    }
+
+    if (!getFileMapping(address->file_type, file))
+        ext_status = PCCC_EXT_UNUSABLE_ADDRESS;
+    else if (byte_size > PCCC_MAX_DATA_SIZE)
+        ext_status = PCCC_EXT_TOO_LARGE;
+    else if (byte_size == 0 || byte_size % file->element_size != 0)
+        ext_status = PCCC_EXT_ILLEGAL_VALUE;
+    else if (address->element + byte_size / file->element_size > file->max_elements)
+        ext_status = PCCC_EXT_WRONG_SIZE;
+
+    if (ext_status != 0)
+    {
+        buffer[1] = PCCC_STS_EXTENDED;
+        buffer[4] = ext_status;
+        return -1;
+    }
+
+    return byte_size / file->element_size;
 }
+
 //-----------------------------------------------------------------------------
-// Concatenate two bytes into an int
+// Copies 16-bit words to a little-endian reply
 //-----------------------------------------------------------------------------
-int an_word_pccc(unsigned char byte1, unsigned char byte2)
+static void copyWords(unsigned char *dst, const IEC_UINT *src, int count)
 {
-    int returnValue;
-    returnValue = (int)(byte1) | (int)(byte2 << 8);
-
-    return returnValue;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(dst, src, count * 2);
+#else
+    for (int i = 0; i < count; i++)
+    {
+        dst[2*i] = lowByte(src[i]);
+        dst[2*i + 1] = highByte(src[i]);
+    }
+#endif
 }
 
 //-----------------------------------------------------------------------------
-// Implementation of PCCC Read Coils
+// Copies 32-bit values to a little-endian reply
 //-----------------------------------------------------------------------------
-void Pccc_ReadCoils(unsigned char *buffer, int buffer_size) //Working QX Read
+static void copyDoubleWords(unsigned char *dst, const IEC_UDINT *src, int count)
 {
-    int Start, ByteDataLength, Mask;
-    
-    /*check if the message is long enough- Left in for future error handling setup*/
-    /*if (buffer_size < 10)
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(dst, src, count * 4);
+#else
+    for (int i = 0; i < count; i++)
     {
-        //PCCC Error Handling (Fill in?); This Request must have at least 10 bytes. If it doesn't, its a corrupted message
-    }*/
-    
-    Start = word_pccc(buffer[8],buffer[9]); //Start based on the Element and Subelemnt values in the Command Packet
-    Mask = log2( word_pccc(buffer[10],buffer[11]) ); //Save the byte size or byte data length to the variable from the command packet
-    ByteDataLength = buffer[5];
-    pthread_mutex_lock(&bufferLock);
-    
-    /*----Reading the values from the PLC bool_output buffer and writing to the PCCC buffer based on position----*/
-    for (int i = 0; i < ByteDataLength; i++)
-    {
-        for(int j = 0; j < 8; j++)
-        {
-            int position = Start + i * 8 + j;
-            if (position < MAX_COILS)
-            {
-                if(bool_output[position/8][position%8] != NULL)
-                {
-                    bitWrite(buffer[4+i], j, *bool_output[position/8][position%8]);
-                }
-                else
-                {
-                    bitWrite(buffer[4+i],j,0);
-                }
-            }
-            else
-            {
-                //PCCC Error Handling (Fill in?); If the position is greater than the MAX COILS, ERROR Overflow?
-            }
-        }
+        dst[4*i] = src[i];
+        dst[4*i + 1] = src[i] >> 8;
+        dst[4*i + 2] = src[i] >> 16;
+        dst[4*i + 3] = src[i] >> 24;
     }
-    pthread_mutex_unlock(&bufferLock);
-    
-    /*Left in for future error handling setup*/
-    /*if (pccc_error != ERR_NONE)
-    {
-        //PCCC Error Handling (Fill in?); Deetermine if there was an error:
-    }*/
+#endif
 }
 
 //-----------------------------------------------------------------------------
-// Implementation of PCCC Read Discrete Inputs
+// Copies the requested elements of a file from the published process image.
+// Every file is a contiguous region of the image, so the copy is done in bulk
 //-----------------------------------------------------------------------------
-void Pccc_ReadDiscreteInputs(unsigned char *buffer, int buffer_size) //Working IX Read Only
+static void readFile(const ProcessImageSnapshot *snap, pccc_address *address, int count, unsigned char *dst)
 {
-    int Start, ByteDataLength;
-    
-    /*This Request must have at least 10 bytes. If it doesn't, its a corrupted messageLeft in for future error handling setup*/
-    /*if (buffer_size < 10)
-    {
-        //PCCC Error Handling (Fill in?); This Request must have at least 10 bytes. If it doesn't, its a corrupted message
-    }*/
-    
-    Start = word_pccc(buffer[8],buffer[9]);//Start based on the Element and Subelemnt values in the Command Packet
-    ByteDataLength = buffer[5];//Save the byte size or byte data length to the variable from the command packet
-    pthread_mutex_lock(&bufferLock);
-    
-    /*--------Reading the values from the PLC bool_input buffer and writing to the PCCC buffer based on position--------*/
-    for (int i = 0; i < ByteDataLength; i++)
+    int element = address->element;
+    switch (address->file_type)
     {
-        for(int j = 0; j < 8; j++)
+        case PCCC_OUTPUT_LOGICAL_SLOT:
+            // 16 located bits per element, already packed LSB first on the snapshot
+            memcpy(dst, &snap->bool_output_bits[element * 2], count * 2);
+            break;
+        case PCCC_INPUT_LOGICAL_SLOT:
+            memcpy(dst, &snap->bool_input_bits[element * 2], count * 2);
+            break;
+        case PCCC_BIT:
+            copyWords(dst, &snap->int_memory[element], count);
+            break;
+        case PCCC_INTEGER:
         {
-            int position = Start + i * 8 + j;
-            if (position < MAX_DISCRETE_INPUT)
+            // %QW first, then %MW from element 1024 on
+            int output_count = 0;
+            if (element < MIN_16B_RANGE)
             {
-                if(bool_input[position/8][position%8] != NULL)
-                {
-                    bitWrite(buffer[4+i], j, *bool_input[position/8][position%8]);
-                }
-                else
-                {
-                    bitWrite(buffer[4+i],j,0);
-                }
+                output_count = (element + count <= MIN_16B_RANGE) ? count : MIN_16B_RANGE - element;
+                copyWords(dst, &snap->int_output[element], output_count);
             }
-            else
+            if (output_count < count)
             {
-                //PCCC Error Handling (Fill in?); If the position is greater than the MAX, ERROR Overflow?
+                int memory_start = element + output_count - MIN_16B_RANGE;
+                copyWords(dst + 2 * output_count, &snap->int_memory[memory_start], count - output_count);
             }
+            break;
         }
+        case PCCC_FLOATING_POINT:
+        case PCCC_LONG:
+            copyDoubleWords(dst, &snap->dint_memory[element], count);
+            break;
     }
-    pthread_mutex_unlock(&bufferLock);
-    
-    /*Left in for future error handling setup*/
-    /*if (mb_error != ERR_NONE)
-    {
-        //PCCC Error Handling (Fill in?); Deetermine if there was an error:
-    }*/
-    
 }
 
 //-----------------------------------------------------------------------------
-// Implementation of PCCC Read Holding Registers
+// Implementation of PCCC Protected Typed Logical Read with three address
+// fields. Elements are read lock-free from the published process image
 //-----------------------------------------------------------------------------
-void Pccc_ReadHoldingRegisters(unsigned char *buffer, int buffer_size) // QW Read
-{	
-    int Start, an_Start, WordDataLength, ByteDataLength;
+uint16_t Protected_Logical_Read_Reply(pccc_header header, unsigned char *buffer, int buffer_size)
+{
+    pccc_address address;
+    pccc_file file;
+    unsigned char data[PCCC_MAX_DATA_SIZE];
 
-    /*this request must have at least 10 bytes. If it doesn't, it's a corrupted message - Left in for future error handling setup*/
-    /*if (buffer_size < 10)
-    {
-        //PCCC Error Handling (Fill in?); This Request must have at least 10 bytes. If it doesn't, its a corrupted message
-    }*/
+    if (buffer_size < 6)
+        return -1;
 
-    Start = word_pccc(buffer[8],buffer[9]);//Start based on the Element and Subelemnt values in the Command Packet
-    ByteDataLength = buffer[5];//Save the byte size or byte data length to the variable from the command packet
-    WordDataLength = ByteDataLength / 2;//Calculate the word data length based on the byte data length
-    unsigned int Temp_FileT = buffer[7];//Value will be changed potentially during this process, save the File Type Value from command packet
-    unsigned int Temp_FileN = buffer[6];//Value will be changed potentially during this process, save the File Number Value from command packet
+    int byte_size = buffer[5];
+    buffer[0] = 0x4f; //Response Code
+    int count = checkAccess(buffer, buffer_size, &address, &file);
+    if (count < 0)
+        return (buffer[1] == PCCC_STS_EXTENDED) ? 5 : 4;
 
-    /*asked for too many registers - Left in for future error handling setup*/
-    /*if (ByteDataLength > 255)
+    uint32_t sequence;
+    const ProcessImageSnapshot *snap;
+    do
     {
-        //PCCC Error Handling (Fill in?); This Request must have at greater than 255 bytes. If it does, its a corrupted message
-        //return;
-    }*/
+        snap = beginProcessImageRead(&sequence);
+        readFile(snap, &address, count, data);
+    } while (!endProcessImageRead(snap, sequence));
 
-    pthread_mutex_lock(&bufferLock);
-    /*--------Reading the values from the PLC int_output, int_memory, and dint_memory buffer and writing to the PCCC buffer based on position--------*/
-    for(int i = 0; i < WordDataLength; i++)
+    buffer[1] = PCCC_STS_SUCCESS;
+    memcpy(&buffer[4], data, byte_size);
+    
+    return 4 + byte_size; //Return the Resonse Packet Length for PCCC	
+}
+
+//-----------------------------------------------------------------------------
+// Builds the writes for one element of a file. Only the bits set on the mask
+// are written. Returns the number of writes stored
+//-----------------------------------------------------------------------------
+static int buildElementWrites(pccc_address *address, int element, uint32_t value, uint32_t mask, ProcessImageWrite *writes)
+{
+    int count = 0;
+    switch (address->file_type)
     {
-        int position = Start + i;
-        //int an_position = an_Start + i;
-        if ((position <= MIN_16B_RANGE) && (Temp_FileN == PCCC_FN_INT && Temp_FileT == PCCC_INTEGER))
-        {
-            if (int_output[position] != NULL)
+        case PCCC_OUTPUT_LOGICAL_SLOT:
+            for (int bit = 0; bit < 16; bit++)
             {
-                buffer[ 4 + position * 2] = lowByte(*int_output[position]);
-                buffer[5 + position * 2] = highByte(*int_output[position]);
+                if (((mask >> bit) & 1) == 0) continue;
+                int position = element * 16 + bit;
+                writes[count].area = PI_BOOL_OUTPUT;
+                writes[count].index = position / 8;
+                writes[count].bit = position % 8;
+                writes[count].value = (value >> bit) & 1;
+                writes[count].mask = 1;
+                count++;
             }
-            else
-            {
-                buffer[ 4 + position * 2] = 0;
-                buffer[5 + position * 2] = 0;
-            }
-        }
-        //accessing memory
-        //16-bit registers
-        else if ((position >= MIN_16B_RANGE && position <= MAX_16B_RANGE) && (Temp_FileN == PCCC_FN_INT && Temp_FileT == PCCC_INTEGER))
-        {
-            if (int_memory[position - MIN_16B_RANGE] != NULL)
-            {
-                buffer[ 4 + position * 2] = lowByte(*int_memory[position - MIN_16B_RANGE]);
-                buffer[5 + position * 2] = highByte(*int_memory[position - MIN_16B_RANGE]);
-            }
-            else
-            {
-                buffer[ 4 + position * 2] = 0;
-                buffer[5 + position * 2] = 0;
-            }
-        }
-        
-        //32-bit registers
-        else if (Temp_FileN == PCCC_FN_FLOAT && Temp_FileT == PCCC_FLOATING_POINT && (position % 2 == 0))
-        {
-            position = position/2;
-            uint32_t tempValue = *dint_memory[position];
-            
-            buffer[4+(4*position)] = tempValue;
-            buffer[5+(4*position)] = tempValue >> 8;
-            buffer[6+(4*position)] = tempValue >> 16;
-            buffer[7+(4*position)] = tempValue >> 24;
-        
-        }
-        /*Left in for future error handling setup-Invalid Address*/
-        else
-        {
-            //PCCC Error Handling (Fill in?); If none of the above are recognized, error
-        }
-
+            return count;
+        case PCCC_BIT:
+            writes[0].area = PI_INT_MEMORY;
+            writes[0].index = element;
+            break;
+        case PCCC_INTEGER:
+            writes[0].area = (element < MIN_16B_RANGE) ? PI_INT_OUTPUT : PI_INT_MEMORY;
+            writes[0].index = (element < MIN_16B_RANGE) ? element : element - MIN_16B_RANGE;
+            break;
+        case PCCC_FLOATING_POINT:
+        case PCCC_LONG:
+            writes[0].area = PI_DINT_MEMORY;
+            writes[0].index = element;
+            break;
+        default:
+            return 0;
     }
-    pthread_mutex_unlock(&bufferLock);
 
+    if (mask == 0) return 0;
+    writes[0].bit = 0;
+    writes[0].value = value & mask;
+    writes[0].mask = mask;
+    return 1;
 }
 
 //-----------------------------------------------------------------------------
-// Implementation of PCCC Write Coil
+// Implementation of PCCC Protected Typed Logical Write (0xAA) and Masked
+// Write (0xAB) with three address fields. All elements of a request are
+// queued as one group, so the scan applies them together
 //-----------------------------------------------------------------------------
- void Pccc_WriteCoil(unsigned char *buffer, int buffer_size) //QX Write NEEDS WRITE MULTIPLE
- {
-    int Start, Mask;
-    int mask_offset = 0;
-    
-    /*Left in for future error handling setup*/
-    /*if(buffer_size < 10)
-    {
-        //ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
-        //return;
-    }
-    */
-    
-    /*For the Write Mask, there has to be a maskoffset due to an extra two bytes */
-    if((unsigned int)buffer[4] == 0xAB)
+uint16_t Protected_Logical_Write_Reply(pccc_header header,unsigned char *buffer, int buffer_size) // Connected
+{	
+    pccc_address address;
+    pccc_file file;
+    ProcessImageWrite writes[PCCC_MAX_DATA_SIZE * 8];
+    int num_writes = 0;
+
+    if (buffer_size < 6)
+        return -1;
+
+    bool masked = (buffer[4] == 0xAB);
+    int byte_size = buffer[5];
+    int count = checkAccess(buffer, buffer_size, &address, &file);
+    buffer[0] = 0x4f;
+    if (count < 0)
+        return (buffer[1] == PCCC_STS_EXTENDED) ? 5 : 4;
+
+    // The masked write carries one mask per element before the data
+    unsigned char *mask_data = &buffer[address.data_offset];
+    unsigned char *data = masked ? mask_data + byte_size : mask_data;
+    if (address.data_offset + (masked ? 2 : 1) * byte_size > buffer_size ||
+        address.file_type == PCCC_INPUT_LOGICAL_SLOT)
     {
-        mask_offset = buffer[5]; //Byte Size 
+        buffer[1] = PCCC_STS_EXTENDED;
+        buffer[4] = (address.file_type == PCCC_INPUT_LOGICAL_SLOT) ? PCCC_EXT_UNUSABLE_ADDRESS : PCCC_EXT_WRONG_SIZE;
+        return 5;
     }
-    
-    Start = word_pccc(buffer[8],buffer[9]);//Start based on the Element and Subelemnt values in the Command Packet
-    Mask = log2( word_pccc(buffer[10],buffer[11]) );// Maskoffset based on the mask value in Masked Protected Write Command Packet
-    
-    /*--------Determines if the values inside the PCCC data has a 1 or 0 in it. Writes that value to the bool_output based on the contents of the data in PCCC Buffer-------*/
-    if(Start < MAX_COILS)
+
+    for (int i = 0; i < count; i++)
     {
-        unsigned char value;
-        if(word_pccc(buffer[10 + mask_offset],buffer[11 + mask_offset]) > 0)
-        {
-            value = 1;
-        }
-        else
-        {
-            value = 0; 
-        }
-        pthread_mutex_lock(&bufferLock);
-        if(bool_output[Start][Mask] != NULL)
+        uint32_t value = 0;
+        uint32_t mask = 0;
+        for (int b = 0; b < file.element_size; b++)
         {
-            *bool_output[Start][Mask] = value;
+            value |= (uint32_t)data[i * file.element_size + b] << (8 * b);
+            mask |= (uint32_t)(masked ? mask_data[i * file.element_size + b] : 0xff) << (8 * b);
         }
-        pthread_mutex_unlock(&bufferLock);
+        num_writes += buildElementWrites(&address, address.element + i, value, mask, &writes[num_writes]);
     }
-    
-}
 
-
-//-----------------------------------------------------------------------------
-// Implementation of PCCC Write Holding Register
-//-----------------------------------------------------------------------------
-void Pccc_WriteRegister(unsigned char *buffer, int buffer_size) // QW Write
-{
-    int Start, WordDataLength, ByteDataLength;
-
-    Start = word_pccc(buffer[8],buffer[9]);//Start based on the Element and Subelemnt values in the Command Packet
-    int an_Start = an_word_pccc(buffer[8],buffer[9]);//Different Start method for INTs based on the Element and Subelemnt values in the Command Packet
-    ByteDataLength = buffer[5];//Save the byte size or byte data length to the variable from the command packet
-    WordDataLength = ByteDataLength / 2;//Calculate the word data length based on the byte data length
-    unsigned int Temp_FileT = buffer[7];//Value will be changed potentially during this process, save the File Type Value from command packet
-    unsigned int Temp_FileN = buffer[6];//Value will be changed potentially during this process, save the File Number Value from command packet
-
-    pthread_mutex_lock(&bufferLock);
-    
-    /*--------Determines if the values inside the PCCC data has data. Writes that value to the appropriate PLC Buffer based on the contents of the data in PCCC Buffer-------*/
-    for(int i = 0; i < WordDataLength; i++)
+    buffer[1] = PCCC_STS_SUCCESS;
+    if (num_writes > 0 && queueProcessImageWrites(writes, num_writes) < 0)
     {
-        int position = Start + i;
-        //analog outputs
-        if ((position <= MIN_16B_RANGE) && (Temp_FileN == PCCC_FN_INT && (Temp_FileT == PCCC_INTEGER)))
-        {
-            if (int_output[position] != NULL) *int_output[position] =  an_word_pccc(buffer[10 + i], buffer[11 + i]);//look at this closer
-        }
-        //accessing memory
-        //16-bit registers
-        else if ((position >= MIN_16B_RANGE && position <= MAX_16B_RANGE) && (Temp_FileN == PCCC_FN_OUTPUT && (Temp_FileT == PCCC_INTEGER)))
-        {
-            if (int_memory[position - MIN_16B_RANGE] != NULL) *int_memory[position - MIN_16B_RANGE] = an_word_pccc(buffer[10 + i], buffer[11 + i]);//look at this closer
-        }
-        //32-bit registers
-        if (Temp_FileN == PCCC_FN_FLOAT && (Temp_FileT == PCCC_FLOATING_POINT))
-        {
-            if (dint_memory[position] != NULL)
-            {
-                uint32_t tempValue = buffer[10 + i] | buffer[11 + i] << 8 | buffer[12 + i] << 16 | buffer[13 + i] <<24;//look at this closer
-                
-                *dint_memory[position] = tempValue;
-                
-                i += 4;
-            }
-            else
-            {
-                pccc_holding_regs[position] = an_word_pccc(buffer[10 + i], buffer[11 + i]);//look at this closer might need to copy from temp
-            }
-        }
-    
-    pthread_mutex_unlock(&bufferLock);
-
+        buffer[1] = PCCC_STS_HOST_PROBLEM;
     }
-}
\ No newline at end of file
+
+    return 4;
+}
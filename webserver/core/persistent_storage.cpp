@@ -21,56 +21,983 @@
 //
 // Added modifications from gexod to include %MD and %ML into the persistent file
 // See https://openplc.discussion.community/post/variable-retain-function-9914880?highlight=retain&trail=30
+//
+// The memory is stored as a base image (persistent.file) plus a write-ahead
+// journal (persistent.file.journal). Every poll appends only the changed byte
+// ranges to the journal with a single write and fdatasync. When the journal
+// grows too much it is compacted into a new base image, which replaces the
+// old one atomically. The base image starts with a header holding the CRC of
+// each area and the layout of the located variables it was stored with, so
+// it is read with a single read and restored with one copy per area, and an
+// area whose variables were located differently is not restored at all.
+// Besides %MW, %MD and %ML, the image holds the variables the program
+// declares RETAIN, packed by the scan on the retain area of the published
+// snapshots, so they are journaled with the same dirty block tracking.
+//
+// Optionally (pstorage_retain) the memory is kept instead on a memory mapped
+// region (persistent.file.retain, which may be a symlink to a FRAM/NVRAM
+// device) holding two copies of the image, each one behind a CRC'd header.
+// The scan thread copies the changed blocks into the copy that is not
+// durable, and the storage thread syncs it with msync and makes it the
+// durable one. A power cut during a sync leaves the other copy intact.
 //-----------------------------------------------------------------------------
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <time.h>
 #include <pthread.h>
+#include <limits.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32         (1 << 7)
+#endif
+#endif
 
 #include "ladder.h"
 
 #define FILE_PATH "persistent.file"
 
+#define JOURNAL_MAGIC       0x524a504f  // "OPJR"
+#define CHUNK_SIZE          8           // Granularity of the change detection
+#define MERGE_GAP           16          // Closer ranges are merged, a range header costs 8 bytes
+#define DIRTY_BLOCK_SIZE    64          // Granularity of the first change detection pass
+
+#define PERSISTENT_MAGIC    0x5350504f  // "OPPS"
+#define PERSISTENT_VERSION  3           // The raw images of older versions had no header
+#define PERSISTENT_SECTIONS 4           // %MW, %MD, %ML and the RETAIN variables
+#define PERSISTENT_HEADER_SIZE 128
+
+#define RETAIN_MAGIC        0x4e544552  // "RETN"
+#define RETAIN_VERSION      3           // Version 1 had no layouts nor RETAIN variables
+#define RETAIN_SLOT_SIZE    32768       // Page aligned room for a header and an image
+#define RETAIN_SLOT_SIZE_V1 16384
+#define RETAIN_BLOCK_SIZE   64          // Granularity of the copies into the region
+#define RETAIN_SYNC_INTERVAL 50         // Minimum time (ms) between two syncs
+
+//-----------------------------------------------------------------------------
+// Layout of persistent.file. The journal records its changes as byte ranges
+// on this same layout. It keeps the first PERSISTENT_ENTRIES of each area
+// whatever the size of the images, so the files stay readable after the
+// program is rebuilt with larger images. The retain area of the published
+// snapshots holds the variables declared RETAIN, and goes last so the
+// journals of older versions still apply
+//-----------------------------------------------------------------------------
+#define PERSISTENT_ENTRIES  1024
+
+struct PersistentImage
+{
+    uint16_t int_memory[PERSISTENT_ENTRIES];
+    uint32_t dint_memory[PERSISTENT_ENTRIES];
+    uint64_t lint_memory[PERSISTENT_ENTRIES];
+    uint8_t retain_memory[RETAIN_MEMORY_SIZE];
+};
+
+// Size of the image on the files of version 1
+#define PERSISTENT_IMAGE_SIZE_V1 offsetof(PersistentImage, retain_memory)
+
+// Header of persistent.file, followed by the image. Each section is one area
+// of the image, and its layout is the CRC-32C of the presence bitmap of the
+// area when it was stored, or getRetainLayout() for the RETAIN variables
+struct PersistentSection
+{
+    uint32_t offset;        // On the image
+    uint32_t size;
+    uint32_t crc;           // CRC-32C of the values
+    uint32_t layout;
+};
+
+struct PersistentHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t image_size;
+    uint32_t section_count;
+    PersistentSection sections[PERSISTENT_SECTIONS];
+    uint32_t header_crc;    // CRC-32C of the fields above
+};
+
+struct PersistentFile
+{
+    PersistentHeader header;
+    uint8_t reserved[PERSISTENT_HEADER_SIZE - sizeof(PersistentHeader)];
+    PersistentImage image;
+};
+
+// Area of the memory behind each section. The RETAIN variables have no
+// memory nor presence bitmap, they are copied by process_image.cpp
+struct PersistentArea
+{
+    const char *name;
+    size_t offset;
+    size_t size;
+    size_t element_size;
+    void *memory;
+    const IEC_BYTE *present;
+};
+
+// A journal record is a header followed by payload_size bytes of ranges, each
+// one a JournalRange followed by its data
+struct JournalHeader
+{
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t payload_size;
+    uint32_t crc;           // CRC-32C of the payload
+};
+
+struct JournalRange
+{
+    uint32_t offset;
+    uint32_t length;
+};
+
+// Each copy of the image on the retentive memory region. A copy is only
+// valid if both CRCs match, so a torn sync is always detected
+struct RetainHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t generation;    // The valid copy with the highest one is current
+    uint32_t data_size;
+    uint32_t data_crc;      // CRC-32C of the image
+    uint32_t layout[PERSISTENT_SECTIONS]; // As on PersistentSection
+    uint32_t header_crc;    // CRC-32C of the fields above
+};
+
+struct RetainSlot
+{
+    RetainHeader header;
+    uint8_t reserved[64 - sizeof(RetainHeader)];
+    PersistentImage image;
+};
+
+static_assert(sizeof(PersistentHeader) <= PERSISTENT_HEADER_SIZE, "Persistent memory header is too large");
+static_assert(sizeof(RetainSlot) <= RETAIN_SLOT_SIZE, "Retentive memory does not fit on a region slot");
+static_assert(sizeof(PersistentImage) % DIRTY_BLOCK_SIZE == 0, "Retentive memory must be made of whole blocks");
+
+#define RETAIN_REGION_SIZE  (2 * RETAIN_SLOT_SIZE)
+
+// The journal is compacted when it would grow beyond this size
+#define JOURNAL_LIMIT       (4 * sizeof(PersistentImage))
+// Changes that do not fit on one record are written as a new base image
+#define MAX_PAYLOAD_SIZE    (sizeof(PersistentImage))
+#define DIRTY_BLOCKS        (sizeof(PersistentImage) / DIRTY_BLOCK_SIZE)
+
 uint8_t pstorage_read = false;
 
-uint32_t combined_checksum = 0; // Stored checksum for detecting changes
+static PersistentImage persisted_image;     // What the files on disk hold
+static PersistentImage current_image;       // Memory read on the last poll
+static PersistentFile file_buffer;          // persistent.file as read or written
+
+static const PersistentArea persistent_areas[PERSISTENT_SECTIONS] =
+{
+    { "%MW", offsetof(PersistentImage, int_memory), sizeof(uint16_t) * PERSISTENT_ENTRIES, sizeof(uint16_t), int_memory_image, int_memory_present },
+    { "%MD", offsetof(PersistentImage, dint_memory), sizeof(uint32_t) * PERSISTENT_ENTRIES, sizeof(uint32_t), dint_memory_image, dint_memory_present },
+    { "%ML", offsetof(PersistentImage, lint_memory), sizeof(uint64_t) * PERSISTENT_ENTRIES, sizeof(uint64_t), lint_memory_image, lint_memory_present },
+    { "RETAIN", offsetof(PersistentImage, retain_memory), RETAIN_MEMORY_SIZE, 0, NULL, NULL },
+};
+
+// Layout of the located variables persisted_image was stored with, per area.
+// Unknown for the files of older versions and for corrupt sections
+static uint32_t stored_layout[PERSISTENT_SECTIONS];
+static bool stored_layout_known[PERSISTENT_SECTIONS];
+static bool base_current = false;           // persistent.file has this format and layouts
+static uint8_t record_buffer[sizeof(JournalHeader) + MAX_PAYLOAD_SIZE];
+
+// persistent.file may be a symlink (i.e. to a docker volume). The base image
+// is replaced and the journal is kept next to the file it points to
+static char file_path[PATH_MAX];
+static char temp_file_path[PATH_MAX + 8];
+static char journal_path[PATH_MAX + 8];
+static char directory_path[PATH_MAX];
+static char retain_path[PATH_MAX + 8];
+
+static int journal_fd = -1;
+static off_t journal_size = 0;
+static uint32_t journal_sequence = 0;
+static uint32_t crc32c_table[256];
+static int crc32c_hardware = -1;        // Unknown until the first CRC
+static uint64_t dirty_blocks[(DIRTY_BLOCKS + 63) / 64];
+
+// Only one storage thread may own the files at a time
+static pthread_mutex_t pstorageLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Retentive memory region. retainLock is held by the storage thread while it
+// syncs a copy, and the scan thread only tries it (never blocks on a sync)
+static bool pstorage_retain = false;    // Mode for the next storage thread
+static bool retain_active = false;      // The scan thread may update the region
+static bool retain_pending = false;     // The copy that is not durable holds newer values
+static int retain_fd = -1;
+static uint8_t *retain_region = NULL;
+static int retain_durable = 0;          // Copy that was synced last
+static uint32_t retain_generation = 0;
+static RetainSlot retain_slot_buffer;
+static pthread_mutex_t retainLock = PTHREAD_MUTEX_INITIALIZER;
+
+//-----------------------------------------------------------------------------
+// CRC-32C with the CRC instructions of the CPU, 8 bytes at a time. Only
+// called once the CPU is known to have them
+//-----------------------------------------------------------------------------
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware(uint32_t crc, const uint8_t *data, size_t length)
+{
+    uint64_t crc64 = crc;
+    for (; length >= 8; data += 8, length -= 8)
+    {
+        uint64_t value;
+        memcpy(&value, data, sizeof(value));
+        crc64 = _mm_crc32_u64(crc64, value);
+    }
+    crc = (uint32_t)crc64;
+    for (; length > 0; data++, length--)
+    {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return crc;
+}
+#elif defined(__aarch64__)
+__attribute__((target("+crc")))
+static uint32_t crc32cHardware(uint32_t crc, const uint8_t *data, size_t length)
+{
+    for (; length >= 8; data += 8, length -= 8)
+    {
+        uint64_t value;
+        memcpy(&value, data, sizeof(value));
+        crc = __builtin_aarch64_crc32cx(crc, value);
+    }
+    for (; length > 0; data++, length--)
+    {
+        crc = __builtin_aarch64_crc32cb(crc, *data);
+    }
+    return crc;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// Checks once if the CPU can compute the CRC-32C by itself, and builds the
+// lookup table otherwise
+//-----------------------------------------------------------------------------
+static void initializeCrc32c()
+{
+#if defined(__x86_64__)
+    crc32c_hardware = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+#elif defined(__aarch64__)
+    crc32c_hardware = (getauxval(AT_HWCAP) & HWCAP_CRC32) ? 1 : 0;
+#else
+    crc32c_hardware = 0;
+#endif
+
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int b = 0; b < 8; b++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+        }
+        crc32c_table[i] = crc;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Computes the CRC-32C (Castagnoli) of a buffer
+//-----------------------------------------------------------------------------
+static uint32_t crc32c(const uint8_t *data, size_t length)
+{
+    if (crc32c_hardware < 0) initializeCrc32c();
+
+    uint32_t crc = 0xFFFFFFFF;
+#if defined(__x86_64__) || defined(__aarch64__)
+    if (crc32c_hardware) return crc32cHardware(crc, data, length) ^ 0xFFFFFFFF;
+#endif
+    for (size_t i = 0; i < length; i++)
+    {
+        crc = crc32c_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+//-----------------------------------------------------------------------------
+// Computes the layout of the located variables of an area, as stored on the
+// headers
+//-----------------------------------------------------------------------------
+static uint32_t areaLayout(const PersistentArea *area)
+{
+    if (area->present == NULL) return getRetainLayout();
+    return crc32c(area->present, PERSISTENT_ENTRIES / 8);
+}
+
+//-----------------------------------------------------------------------------
+// Writes a whole buffer to a file descriptor. Returns 0 on success or -1 on
+// error
+//-----------------------------------------------------------------------------
+static int writeAll(int fd, const void *buffer, size_t length)
+{
+    const uint8_t *data = (const uint8_t *)buffer;
+    while (length > 0)
+    {
+        ssize_t written = write(fd, data, length);
+        if (written < 0)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += written;
+        length -= written;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Reads up to length bytes from a file descriptor. Returns the number of
+// bytes read, which is only short at the end of the file
+//-----------------------------------------------------------------------------
+static size_t readAll(int fd, void *buffer, size_t length)
+{
+    uint8_t *data = (uint8_t *)buffer;
+    size_t total = 0;
+    while (total < length)
+    {
+        ssize_t count = read(fd, data + total, length - total);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) break;
+        total += count;
+    }
+    return total;
+}
+
+//-----------------------------------------------------------------------------
+// Finds where the storage files are
+//-----------------------------------------------------------------------------
+static void resolveStoragePaths()
+{
+    if (realpath(FILE_PATH, file_path) == NULL)
+    {
+        strcpy(file_path, FILE_PATH);
+    }
+    sprintf(temp_file_path, "%s.tmp", file_path);
+    sprintf(journal_path, "%s.journal", file_path);
+    sprintf(retain_path, "%s.retain", file_path);
+
+    char path_copy[PATH_MAX];
+    strcpy(path_copy, file_path);
+    strcpy(directory_path, dirname(path_copy));
+}
+
+//-----------------------------------------------------------------------------
+// Copies the retentive memory from the published process image
+//-----------------------------------------------------------------------------
+static void readMemoryImage(PersistentImage *image)
+{
+    uint32_t sequence;
+    const ProcessImageSnapshot *snap;
+    do
+    {
+        snap = beginProcessImageRead(&sequence);
+        memcpy(image->int_memory, snap->int_memory, sizeof(image->int_memory));
+        memcpy(image->dint_memory, snap->dint_memory, sizeof(image->dint_memory));
+        memcpy(image->lint_memory, snap->lint_memory, sizeof(image->lint_memory));
+        memcpy(image->retain_memory, snap->retain_memory, sizeof(image->retain_memory));
+    } while (!endProcessImageRead(snap, sequence));
+}
+
+//-----------------------------------------------------------------------------
+// Writes current_image as the new base image and empties the journal. The
+// image is written to a temporary file that replaces persistent.file only
+// once it is on disk, so a power cut leaves either the old or the new base.
+// A journal that survives a cut right after the rename is simply replayed
+// again, since its records hold absolute values
+//-----------------------------------------------------------------------------
+static int compactStorage()
+{
+    char log_msg[1000];
+
+    PersistentHeader *header = &file_buffer.header;
+    memset(&file_buffer, 0, sizeof(file_buffer.header) + sizeof(file_buffer.reserved));
+    memcpy(&file_buffer.image, &current_image, sizeof(file_buffer.image));
+    header->magic = PERSISTENT_MAGIC;
+    header->version = PERSISTENT_VERSION;
+    header->image_size = sizeof(PersistentImage);
+    header->section_count = PERSISTENT_SECTIONS;
+    for (int i = 0; i < PERSISTENT_SECTIONS; i++)
+    {
+        const PersistentArea *area = &persistent_areas[i];
+        header->sections[i].offset = area->offset;
+        header->sections[i].size = area->size;
+        header->sections[i].crc = crc32c((const uint8_t *)&file_buffer.image + area->offset, area->size);
+        header->sections[i].layout = areaLayout(area);
+    }
+    header->header_crc = crc32c((const uint8_t *)header, offsetof(PersistentHeader, header_crc));
+
+    int fd = open(temp_file_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        sprintf(log_msg, "Persistent Storage: Error creating persistent memory file: %s\n", strerror(errno));
+        openplc_log(log_msg);
+        return -1;
+    }
+
+    if (writeAll(fd, &file_buffer, sizeof(file_buffer)) < 0 || fdatasync(fd) < 0)
+    {
+        sprintf(log_msg, "Persistent Storage: Error writing persistent memory file: %s\n", strerror(errno));
+        openplc_log(log_msg);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    if (rename(temp_file_path, file_path) < 0)
+    {
+        sprintf(log_msg, "Persistent Storage: Error replacing persistent memory file: %s\n", strerror(errno));
+        openplc_log(log_msg);
+        return -1;
+    }
+
+    // Make the rename itself durable
+    int dir_fd = open(directory_path, O_RDONLY);
+    if (dir_fd >= 0)
+    {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    if (ftruncate(journal_fd, 0) == 0 && fdatasync(journal_fd) == 0)
+    {
+        journal_size = 0;
+    }
+    memcpy(&persisted_image, &current_image, sizeof(persisted_image));
+    base_current = true;
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Marks the blocks that differ between current_image and persisted_image.
+// Returns false if none does, which is what most polls find
+//-----------------------------------------------------------------------------
+static bool markDirtyBlocks()
+{
+    const uint8_t *current = (const uint8_t *)&current_image;
+    const uint8_t *persisted = (const uint8_t *)&persisted_image;
+    bool dirty = false;
+
+    memset(dirty_blocks, 0, sizeof(dirty_blocks));
+    for (size_t block = 0; block < DIRTY_BLOCKS; block++)
+    {
+        size_t offset = block * DIRTY_BLOCK_SIZE;
+        if (memcmp(current + offset, persisted + offset, DIRTY_BLOCK_SIZE) != 0)
+        {
+            dirty_blocks[block / 64] |= (uint64_t)1 << (block % 64);
+            dirty = true;
+        }
+    }
+    return dirty;
+}
+
+static bool blockDirty(size_t block)
+{
+    return (dirty_blocks[block / 64] & ((uint64_t)1 << (block % 64))) != 0;
+}
+
+//-----------------------------------------------------------------------------
+// Checks a chunk for changes. Chunks on clean blocks are never compared
+//-----------------------------------------------------------------------------
+static bool chunkChanged(size_t offset)
+{
+    if (!blockDirty(offset / DIRTY_BLOCK_SIZE)) return false;
+    return memcmp((const uint8_t *)&current_image + offset, (const uint8_t *)&persisted_image + offset, CHUNK_SIZE) != 0;
+}
+
+//-----------------------------------------------------------------------------
+// Builds a journal record payload with the ranges that differ between
+// current_image and persisted_image. Returns the payload size, 0 if nothing
+// changed or -1 if the changes do not fit on one record
+//-----------------------------------------------------------------------------
+static int buildJournalPayload(uint8_t *payload)
+{
+    const uint8_t *current = (const uint8_t *)&current_image;
+    const size_t image_size = sizeof(PersistentImage);
+    size_t payload_size = 0;
+    size_t offset = 0;
+
+    if (!markDirtyBlocks()) return 0;
+
+    while (offset < image_size)
+    {
+        // Find the next changed chunk, skipping whole clean blocks
+        while (offset < image_size && !chunkChanged(offset))
+        {
+            size_t block = offset / DIRTY_BLOCK_SIZE;
+            offset = blockDirty(block) ? offset + CHUNK_SIZE : (block + 1) * DIRTY_BLOCK_SIZE;
+        }
+        if (offset >= image_size) break;
+
+        // Extend the range until the next MERGE_GAP bytes are unchanged
+        size_t start = offset;
+        size_t end = offset + CHUNK_SIZE;
+        size_t probe = end;
+        while (probe < image_size && probe < end + MERGE_GAP)
+        {
+            if (chunkChanged(probe))
+            {
+                end = probe + CHUNK_SIZE;
+            }
+            probe += CHUNK_SIZE;
+        }
+
+        size_t length = end - start;
+        if (payload_size + sizeof(JournalRange) + length > MAX_PAYLOAD_SIZE) return -1;
+
+        JournalRange range;
+        range.offset = start;
+        range.length = length;
+        memcpy(payload + payload_size, &range, sizeof(range));
+        memcpy(payload + payload_size + sizeof(range), current + start, length);
+        payload_size += sizeof(range) + length;
+
+        offset = end;
+    }
+
+    return payload_size;
+}
+
+//-----------------------------------------------------------------------------
+// Persists the changes between current_image and persisted_image, appending
+// them to the journal or compacting the storage. Returns 0 on success or -1
+// on error, in which case the same changes are tried again on the next call
+//-----------------------------------------------------------------------------
+static int flushStorage()
+{
+    char log_msg[1000];
+    JournalHeader *header = (JournalHeader *)record_buffer;
+    uint8_t *payload = record_buffer + sizeof(JournalHeader);
+
+    int payload_size = buildJournalPayload(payload);
+    if (payload_size == 0) return 0;
+
+    size_t record_size = sizeof(JournalHeader) + payload_size;
+    if (payload_size < 0 || journal_size + record_size > JOURNAL_LIMIT)
+    {
+        return compactStorage();
+    }
+
+    header->magic = JOURNAL_MAGIC;
+    header->sequence = journal_sequence;
+    header->payload_size = payload_size;
+    header->crc = crc32c(payload, payload_size);
+
+    if (writeAll(journal_fd, record_buffer, record_size) < 0 || fdatasync(journal_fd) < 0)
+    {
+        sprintf(log_msg, "Persistent Storage: Error writing journal: %s\n", strerror(errno));
+        openplc_log(log_msg);
+        // Drop whatever part of the record made it to the file
+        if (ftruncate(journal_fd, journal_size) < 0)
+        {
+            journal_size = JOURNAL_LIMIT; // Forces a compaction on the next flush
+        }
+        return -1;
+    }
+
+    journal_size += record_size;
+    journal_sequence++;
+    memcpy(&persisted_image, &current_image, sizeof(persisted_image));
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Returns one of the two copies of the image on the mapped region
+//-----------------------------------------------------------------------------
+static RetainSlot *retainSlot(int index)
+{
+    return (RetainSlot *)(retain_region + index * RETAIN_SLOT_SIZE);
+}
+
+//-----------------------------------------------------------------------------
+// Checks the header and the data of a copy of the image. Copies of version 1
+// are only valid if v1 is set: their header CRC sits where the layouts are
+// now, and their image has no RETAIN variables
+//-----------------------------------------------------------------------------
+static bool validRetainSlot(const RetainSlot *slot, bool v1)
+{
+    const RetainHeader *header = &slot->header;
+    size_t data_size = sizeof(PersistentImage);
+    bool valid_header;
+    if (header->version == RETAIN_VERSION)
+    {
+        valid_header = header->header_crc == crc32c((const uint8_t *)header, offsetof(RetainHeader, header_crc));
+    }
+    else
+    {
+        data_size = PERSISTENT_IMAGE_SIZE_V1;
+        valid_header = v1 && header->version == 1 &&
+                       header->layout[0] == crc32c((const uint8_t *)header, offsetof(RetainHeader, layout));
+    }
+    return header->magic == RETAIN_MAGIC && valid_header && header->data_size == data_size &&
+           header->data_crc == crc32c((const uint8_t *)&slot->image, data_size);
+}
+
+//-----------------------------------------------------------------------------
+// Copies the blocks of src that differ from dst, so that only the pages
+// that really changed are dirtied. Returns true if anything was copied
+//-----------------------------------------------------------------------------
+static bool copyChangedBlocks(void *dst, const void *src, size_t size)
+{
+    uint8_t *to = (uint8_t *)dst;
+    const uint8_t *from = (const uint8_t *)src;
+    bool changed = false;
+    for (size_t offset = 0; offset < size; offset += RETAIN_BLOCK_SIZE)
+    {
+        if (memcmp(to + offset, from + offset, RETAIN_BLOCK_SIZE) != 0)
+        {
+            memcpy(to + offset, from + offset, RETAIN_BLOCK_SIZE);
+            changed = true;
+        }
+    }
+    return changed;
+}
 
-// Function to calculate a simple XOR-based checksum for all three arrays together
-uint32_t calculate_combined_checksum() 
+//-----------------------------------------------------------------------------
+// Copies the retentive memory into the copy of the region that is not
+// durable. Must be called by the scan thread with bufferLock held, at the end
+// of the cycle. If the storage thread is syncing the region the values are
+// simply copied on the next cycle
+//-----------------------------------------------------------------------------
+void updateRetainMemory()
 {
-    uint32_t checksum = 0;
+    if (!__atomic_load_n(&retain_active, __ATOMIC_ACQUIRE)) return;
+    if (pthread_mutex_trylock(&retainLock) != 0) return;
+    if (!retain_active)
+    {
+        pthread_mutex_unlock(&retainLock);
+        return;
+    }
 
-    // Calculate checksum for int_memory
-    for (size_t i = 0; i < BUFFER_SIZE; i++) 
+    // The RETAIN variables are taken from the snapshot the scan just
+    // published, which only the scan thread itself could rewrite
+    uint32_t sequence;
+    const ProcessImageSnapshot *snap = beginProcessImageRead(&sequence);
+
+    if (!retain_pending && retain_generation > 0)
     {
-        if (int_memory[i] != NULL)
+        PersistentImage *durable = &retainSlot(retain_durable)->image;
+        if (memcmp(durable->int_memory, int_memory_image, sizeof(durable->int_memory)) == 0 &&
+            memcmp(durable->dint_memory, dint_memory_image, sizeof(durable->dint_memory)) == 0 &&
+            memcmp(durable->lint_memory, lint_memory_image, sizeof(durable->lint_memory)) == 0 &&
+            memcmp(durable->retain_memory, snap->retain_memory, sizeof(durable->retain_memory)) == 0)
         {
-            checksum ^= *int_memory[i];
+            pthread_mutex_unlock(&retainLock);
+            return;
         }
     }
 
-    // Calculate checksum for dint_memory
-    for (size_t i = 0; i < BUFFER_SIZE; i++) 
+    // The other copy is compared with itself, since it may be two syncs old
+    PersistentImage *target = &retainSlot(1 - retain_durable)->image;
+    bool changed = copyChangedBlocks(target->int_memory, int_memory_image, sizeof(target->int_memory));
+    changed |= copyChangedBlocks(target->dint_memory, dint_memory_image, sizeof(target->dint_memory));
+    changed |= copyChangedBlocks(target->lint_memory, lint_memory_image, sizeof(target->lint_memory));
+    changed |= copyChangedBlocks(target->retain_memory, snap->retain_memory, sizeof(target->retain_memory));
+    if (changed) __atomic_store_n(&retain_pending, true, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&retainLock);
+}
+
+//-----------------------------------------------------------------------------
+// Seals the copy that is not durable with a new header and syncs it, making
+// it the durable one. Must be called with retainLock held. Returns 0 on
+// success or -1 on error, in which case the sync is tried again later
+//-----------------------------------------------------------------------------
+static int syncRetainRegion()
+{
+    RetainSlot *target = retainSlot(1 - retain_durable);
+    RetainHeader *header = &target->header;
+    header->magic = RETAIN_MAGIC;
+    header->version = RETAIN_VERSION;
+    header->generation = retain_generation + 1;
+    header->data_size = sizeof(PersistentImage);
+    header->data_crc = crc32c((const uint8_t *)&target->image, sizeof(target->image));
+    for (int i = 0; i < PERSISTENT_SECTIONS; i++)
+    {
+        header->layout[i] = areaLayout(&persistent_areas[i]);
+    }
+    header->header_crc = crc32c((const uint8_t *)header, offsetof(RetainHeader, header_crc));
+
+    if (msync(target, RETAIN_SLOT_SIZE, MS_SYNC) < 0)
+    {
+        char log_msg[1000];
+        sprintf(log_msg, "Persistent Storage: Error syncing retentive memory: %s\n", strerror(errno));
+        openplc_log(log_msg);
+        return -1;
+    }
+
+    retain_durable = 1 - retain_durable;
+    retain_generation++;
+    __atomic_store_n(&retain_pending, false, __ATOMIC_RELEASE);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Maps the retentive memory region, creating it if needed, and finds its
+// durable copy. Returns 0 on success or -1 on error
+//-----------------------------------------------------------------------------
+static int openRetainRegion()
+{
+    char log_msg[1000];
+    struct stat retain_stat;
+
+    retain_fd = open(retain_path, O_RDWR | O_CREAT, 0644);
+    if (retain_fd < 0 || fstat(retain_fd, &retain_stat) < 0)
+    {
+        sprintf(log_msg, "Persistent Storage: Error opening retentive memory: %s\n", strerror(errno));
+        openplc_log(log_msg);
+        if (retain_fd >= 0) close(retain_fd);
+        retain_fd = -1;
+        return -1;
+    }
+
+    // Devices are used as they are, regular files are grown to fit the region
+    if (S_ISREG(retain_stat.st_mode) && retain_stat.st_size < RETAIN_REGION_SIZE &&
+        ftruncate(retain_fd, RETAIN_REGION_SIZE) < 0)
+    {
+        sprintf(log_msg, "Persistent Storage: Error creating retentive memory: %s\n", strerror(errno));
+        openplc_log(log_msg);
+        close(retain_fd);
+        retain_fd = -1;
+        return -1;
+    }
+
+    void *region = mmap(NULL, RETAIN_REGION_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, retain_fd, 0);
+    if (region == MAP_FAILED)
+    {
+        sprintf(log_msg, "Persistent Storage: Error mapping retentive memory: %s\n", strerror(errno));
+        openplc_log(log_msg);
+        close(retain_fd);
+        retain_fd = -1;
+        return -1;
+    }
+    retain_region = (uint8_t *)region;
+
+    bool valid[2] = {validRetainSlot(retainSlot(0), false), validRetainSlot(retainSlot(1), false)};
+    if (valid[0] && valid[1])
+    {
+        int32_t age = (int32_t)(retainSlot(1)->header.generation - retainSlot(0)->header.generation);
+        retain_durable = (age > 0) ? 1 : 0;
+    }
+    else if (valid[0] || valid[1])
+    {
+        retain_durable = valid[0] ? 0 : 1;
+    }
+
+    if (valid[0] || valid[1])
+    {
+        retain_generation = retainSlot(retain_durable)->header.generation;
+        retain_pending = false;
+    }
+    else
+    {
+        // Nothing durable yet, the first cycle fills copy 0 entirely
+        retain_durable = 1;
+        retain_generation = 0;
+        retain_pending = false;
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Unmaps the retentive memory region
+//-----------------------------------------------------------------------------
+static void closeRetainRegion()
+{
+    munmap(retain_region, RETAIN_REGION_SIZE);
+    retain_region = NULL;
+    close(retain_fd);
+    retain_fd = -1;
+}
+
+//-----------------------------------------------------------------------------
+// Invalidates the retentive memory region once its values are on the base
+// image, so that it does not override the journal on the next start
+//-----------------------------------------------------------------------------
+static void removeRetainRegion()
+{
+    struct stat retain_stat;
+    if (stat(retain_path, &retain_stat) < 0) return;
+
+    if (S_ISREG(retain_stat.st_mode))
+    {
+        unlink(retain_path);
+        return;
+    }
+
+    // A device can not be removed, its headers are cleared instead
+    int fd = open(retain_path, O_WRONLY);
+    if (fd < 0) return;
+    static const off_t slots[] = { 0, RETAIN_SLOT_SIZE_V1, RETAIN_SLOT_SIZE };
+    RetainHeader header;
+    memset(&header, 0, sizeof(header));
+    for (size_t i = 0; i < sizeof(slots) / sizeof(slots[0]); i++)
+    {
+        if (lseek(fd, slots[i], SEEK_SET) >= 0) writeAll(fd, &header, sizeof(header));
+    }
+    fdatasync(fd);
+    close(fd);
+}
+
+//-----------------------------------------------------------------------------
+// Reads the durable copy of the retentive memory region into image, and its
+// layouts, leaving them untouched if the region has no valid copy. The slots
+// of a version 1 region are looked for too. Returns the generation that was
+// read or 0 if none
+//-----------------------------------------------------------------------------
+static uint32_t readRetainRegion(PersistentImage *image)
+{
+    static const off_t slots[] = { 0, RETAIN_SLOT_SIZE_V1, RETAIN_SLOT_SIZE };
+    int fd = open(retain_path, O_RDONLY);
+    if (fd < 0) return 0;
+
+    uint32_t generation = 0;
+    bool found = false;
+    for (size_t i = 0; i < sizeof(slots) / sizeof(slots[0]); i++)
     {
-        if (dint_memory[i] != NULL)
+        memset(&retain_slot_buffer, 0, sizeof(retain_slot_buffer));
+        if (lseek(fd, slots[i], SEEK_SET) < 0 ||
+            readAll(fd, &retain_slot_buffer, sizeof(retain_slot_buffer)) < offsetof(RetainSlot, image) ||
+            !validRetainSlot(&retain_slot_buffer, true))
+        {
+            continue;
+        }
+
+        if (!found || (int32_t)(retain_slot_buffer.header.generation - generation) > 0)
         {
-            checksum ^= *dint_memory[i];
+            memcpy(image, &retain_slot_buffer.image, retain_slot_buffer.header.data_size);
+            generation = retain_slot_buffer.header.generation;
+            found = true;
+            for (int s = 0; s < PERSISTENT_SECTIONS; s++)
+            {
+                stored_layout[s] = retain_slot_buffer.header.layout[s];
+                stored_layout_known[s] = (retain_slot_buffer.header.version == RETAIN_VERSION);
+            }
         }
     }
+    close(fd);
+
+    return found ? generation : 0;
+}
 
-    // Calculate checksum for lint_memory
-    for (size_t i = 0; i < BUFFER_SIZE; i++) 
+//-----------------------------------------------------------------------------
+// Selects how the next storage thread keeps the memory: on the retentive
+// memory region (true) or on the journal (false)
+//-----------------------------------------------------------------------------
+void setPstorageRetain(bool enabled)
+{
+    pstorage_retain = enabled;
+}
+
+//-----------------------------------------------------------------------------
+// Storage thread loop when the memory is kept on the retentive memory
+// region. The scan thread updates the region, and this loop syncs it after
+// the cycles that changed it. Returns -1 if the region can not be used
+//-----------------------------------------------------------------------------
+static int runRetainStorage()
+{
+    if (openRetainRegion() < 0) return -1;
+
+    char log_msg[1000];
+    sprintf(log_msg, "Persistent Storage: Using retentive memory region %s\n", retain_path);
+    openplc_log(log_msg);
+    __atomic_store_n(&retain_active, true, __ATOMIC_RELEASE);
+
+    while (run_pstorage)
+    {
+        waitProcessImage(getProcessImageVersion() + 1, 1000);
+        if (!__atomic_load_n(&retain_pending, __ATOMIC_ACQUIRE)) continue;
+
+        pthread_mutex_lock(&retainLock);
+        syncRetainRegion();
+        pthread_mutex_unlock(&retainLock);
+        sleepms(RETAIN_SYNC_INTERVAL);
+    }
+
+    // Sync the last changes and keep what is durable in case the journal is
+    // used next
+    pthread_mutex_lock(&retainLock);
+    __atomic_store_n(&retain_active, false, __ATOMIC_RELEASE);
+    if (retain_pending) syncRetainRegion();
+    if (retain_generation > 0)
     {
-        if (lint_memory[i] != NULL)
+        memcpy(&persisted_image, &retainSlot(retain_durable)->image, sizeof(persisted_image));
+    }
+    closeRetainRegion();
+    pthread_mutex_unlock(&retainLock);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Storage thread loop when the memory is kept on the journal. Polls the
+// memory every pstorage_polling seconds and journals its changes
+//-----------------------------------------------------------------------------
+static void runJournalStorage()
+{
+    char log_msg[1000];
+    journal_fd = open(journal_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (journal_fd < 0)
+    {
+        sprintf(log_msg, "Persistent Storage: Error opening journal: %s\n", strerror(errno));
+        openplc_log(log_msg);
+        return;
+    }
+
+    // Fold what was recovered at startup (any torn record at the end of the
+    // journal, or a retentive memory region left from a previous run) into a
+    // fresh base image. A base image of an older version or of other layouts
+    // is replaced too, so that the journal records always follow the layouts
+    // on the header of the base image
+    struct stat journal_stat;
+    struct stat retain_stat;
+    bool has_retain = (stat(retain_path, &retain_stat) == 0);
+    if (has_retain || !base_current || (fstat(journal_fd, &journal_stat) == 0 && journal_stat.st_size > 0))
+    {
+        memcpy(&current_image, &persisted_image, sizeof(current_image));
+        if (compactStorage() == 0)
+        {
+            if (has_retain) removeRetainRegion();
+        }
+        else if (fstat(journal_fd, &journal_stat) == 0 && journal_stat.st_size > journal_size)
         {
-            checksum ^= (uint32_t)(*lint_memory[i] ^ (*lint_memory[i] >> 32));
+            // Keep the journal, but never append after a torn record
+            ftruncate(journal_fd, journal_size);
         }
     }
 
-    return checksum;
+    //Run the main thread
+    while (run_pstorage)
+    {
+        readMemoryImage(&current_image);
+        flushStorage();
+        sleepms(pstorage_polling*1000);
+    }
+
+    // Save the last changes before leaving
+    readMemoryImage(&current_image);
+    flushStorage();
+
+    close(journal_fd);
+    journal_fd = -1;
 }
 
 //-----------------------------------------------------------------------------
@@ -83,207 +1010,255 @@ void startPstorage()
     //We can only start persistent storage after the persistent.file was read
     while (pstorage_read == false)
         sleepms(100);
-    
+
     char log_msg[1000];
+    pthread_mutex_lock(&pstorageLock);
     sprintf(log_msg, "Starting Persistent Storage thread\n");
     openplc_log(log_msg);
 
-    //Run the main thread
-    while (run_pstorage)
+    if (!pstorage_retain || runRetainStorage() < 0)
     {
-        // Calculate the combined checksum
-        uint32_t new_checksum = calculate_combined_checksum();
-        if (new_checksum == combined_checksum) 
+        if (pstorage_retain)
         {
-            // No changes detected, skip saving
-            sleepms(pstorage_polling*1000);
-            continue;
+            sprintf(log_msg, "Persistent Storage: Falling back to the journal\n");
+            openplc_log(log_msg);
         }
+        runJournalStorage();
+    }
+
+    pthread_mutex_unlock(&pstorageLock);
+}
+
+//-----------------------------------------------------------------------------
+// Replays the journal records on persisted_image. Stops at the first record
+// that is incomplete or fails its CRC, which is what a power cut during a
+// write leaves at the end of the journal
+//-----------------------------------------------------------------------------
+static void replayJournal()
+{
+    char log_msg[1000];
+    int fd = open(journal_path, O_RDONLY);
+    if (fd < 0) return;
 
-        // Open persisten.file for writing
-        FILE *file = fopen(FILE_PATH, "wb");
-        if (file == NULL) 
+    int records = 0;
+    journal_size = 0;
+    JournalHeader header;
+    uint8_t *payload = record_buffer + sizeof(JournalHeader);
+    while (true)
+    {
+        size_t count = readAll(fd, &header, sizeof(header));
+        if (count == 0) break;
+        if (count < sizeof(header) || header.magic != JOURNAL_MAGIC || header.payload_size > MAX_PAYLOAD_SIZE ||
+            readAll(fd, payload, header.payload_size) < header.payload_size ||
+            crc32c(payload, header.payload_size) != header.crc)
         {
-            sprintf(log_msg, "Persistent Storage: Error creating persistent memory file!\n");
+            sprintf(log_msg, "Persistent Storage: Discarding incomplete journal record\n");
             openplc_log(log_msg);
-            return;
+            break;
         }
-        // Update the stored checksum
-        combined_checksum = new_checksum;
 
-        // Write the contents of int_memory
-        for (size_t i = 0; i < BUFFER_SIZE; i++) 
+        // Validate every range before applying any of them
+        uint32_t position = 0;
+        bool valid = true;
+        while (position < header.payload_size)
         {
-            uint16_t value = (int_memory[i] != NULL) ? *int_memory[i] : 0;
-            if (fwrite(&value, sizeof(uint16_t), 1, file) != 1)
+            JournalRange range;
+            if (header.payload_size - position < sizeof(range))
             {
-                sprintf(log_msg, "Persistent Storage: Error writing int_memory to file\n");
-                openplc_log(log_msg);
+                valid = false;
+                break;
             }
-        }
-        // Write the contents of dint_memory
-        for (size_t i = 0; i < BUFFER_SIZE; i++) 
-        {
-            uint32_t value = (dint_memory[i] != NULL) ? *dint_memory[i] : 0;
-            if (fwrite(&value, sizeof(uint32_t), 1, file) != 1) 
+            memcpy(&range, payload + position, sizeof(range));
+            position += sizeof(range);
+            if (range.length > header.payload_size - position || range.offset > sizeof(PersistentImage) ||
+                range.length > sizeof(PersistentImage) - range.offset)
             {
-                sprintf(log_msg, "Persistent Storage: Error writing dint_memory to file\n");
-                openplc_log(log_msg);
+                valid = false;
+                break;
             }
+            position += range.length;
         }
-
-        // Write the contents of lint_memory
-        for (size_t i = 0; i < BUFFER_SIZE; i++) 
+        if (!valid)
         {
-            uint64_t value = (lint_memory[i] != NULL) ? *lint_memory[i] : 0;
-            if (fwrite(&value, sizeof(uint64_t), 1, file) != 1) 
-            {
-                sprintf(log_msg, "Persistent Storage: Error writing lint_memory to file\n");
-                openplc_log(log_msg);
-            }
+            sprintf(log_msg, "Persistent Storage: Discarding invalid journal record\n");
+            openplc_log(log_msg);
+            break;
         }
 
-        // Flush and sync to ensure data is written to disk
-        /*
-        fflush(file);
-        int fd = fileno(file);
-        fsync(fd);  // Ensure data reaches the disk
-        */
-
-        fclose(file);
+        position = 0;
+        while (position < header.payload_size)
+        {
+            JournalRange range;
+            memcpy(&range, payload + position, sizeof(range));
+            position += sizeof(range);
+            memcpy((uint8_t *)&persisted_image + range.offset, payload + position, range.length);
+            position += range.length;
+        }
 
-        sleepms(pstorage_polling*1000);
+        journal_sequence = header.sequence + 1;
+        journal_size += sizeof(header) + header.payload_size;
+        records++;
     }
+    close(fd);
 
-    
+    if (records > 0)
+    {
+        sprintf(log_msg, "Persistent Storage: Replayed %d journal records\n", records);
+        openplc_log(log_msg);
+    }
 }
 
 //-----------------------------------------------------------------------------
-// This function reads the contents from persistent.file into OpenPLC internal
-// buffers. Must be called when OpenPLC is initializing. If persistent storage
-// is disabled, the persistent.file will not be found and the function will
-// exit gracefully.
+// Reads the base image into persisted_image with a single read and checks
+// its header and the CRC of each section. A raw image of an older version is
+// taken as it is, with unknown layouts, and a corrupt section is left zeroed
 //-----------------------------------------------------------------------------
-int readPersistentStorage()
+static void readBaseImage(int fd)
 {
     char log_msg[1000];
-    FILE *file = fopen(FILE_PATH, "rb");
-    if (file == NULL) 
+    const PersistentHeader *header = &file_buffer.header;
+    size_t size = readAll(fd, &file_buffer, sizeof(file_buffer));
+
+    if (size < sizeof(PersistentHeader) || header->magic != PERSISTENT_MAGIC)
     {
-        sprintf(log_msg, "Persistent Storage is empty\n");
+        // A short raw image leaves the rest zeroed
+        memcpy(&persisted_image, &file_buffer, (size < sizeof(persisted_image)) ? size : sizeof(persisted_image));
+        return;
+    }
+
+    if (size != sizeof(file_buffer) || header->version != PERSISTENT_VERSION ||
+        header->image_size != sizeof(PersistentImage) || header->section_count != PERSISTENT_SECTIONS ||
+        header->header_crc != crc32c((const uint8_t *)header, offsetof(PersistentHeader, header_crc)))
+    {
+        sprintf(log_msg, "Persistent Storage: Discarding invalid persistent memory file\n");
         openplc_log(log_msg);
-        pstorage_read = true;
-        return 0;
+        return;
     }
-    
-    pthread_mutex_lock(&bufferLock); //lock mutex
-    // Read the contents into int_memory
-    for (size_t i = 0; i < BUFFER_SIZE; i++) 
+
+    base_current = true;
+    for (int i = 0; i < PERSISTENT_SECTIONS; i++)
     {
-        uint16_t value;
-        // Read each value individually
-        if (fread(&value, sizeof(uint16_t), 1, file) != 1) 
+        const PersistentArea *area = &persistent_areas[i];
+        const PersistentSection *section = &header->sections[i];
+        const uint8_t *values = (const uint8_t *)&file_buffer.image + area->offset;
+        if (section->offset != area->offset || section->size != area->size || section->crc != crc32c(values, area->size))
         {
-            if (feof(file)) break; // Stop on end of file
-            sprintf(log_msg, "Error reading int_memory from file");
+            sprintf(log_msg, "Persistent Storage: Discarding corrupt %s values\n", area->name);
             openplc_log(log_msg);
-            pthread_mutex_unlock(&bufferLock); //unlock mutex
-            fclose(file);
-            pstorage_read = true;
-            return;
-        }
-        
-        // Only assign if value is non-zero
-        if (value != 0)
-        {
-            // Allocate memory if the pointer is NULL
-            if (int_memory[i] == NULL) 
-            {
-                int_memory[i] = malloc(sizeof(uint16_t));
-                if (int_memory[i] == NULL) 
-                {
-                    sprintf(log_msg, "Error allocating memory for int_memory[%d]", i);
-                    openplc_log(log_msg);
-                    continue;
-                }
-            }
-            *int_memory[i] = value; // Store the value
+            base_current = false;
+            continue;
         }
+
+        memcpy((uint8_t *)&persisted_image + area->offset, values, area->size);
+        stored_layout[i] = section->layout;
+        stored_layout_known[i] = true;
+        if (section->layout != areaLayout(area)) base_current = false;
     }
+}
 
-    // Read the contents into dint_memory
-    for (size_t i = 0; i < BUFFER_SIZE; i++) 
+//-----------------------------------------------------------------------------
+// Restores persisted_image into the memory images and the RETAIN variables.
+// An area stored with the current layout is copied as a whole, one stored
+// with another layout is skipped, and one with an unknown layout only gets
+// its non-zero values, so the initial values of the program are kept for
+// anything never stored. The RETAIN variables are only restored with their
+// layout. Afterwards persisted_image follows the memory, which is what the
+// files hold once they are rewritten. Must be called with bufferLock held
+//-----------------------------------------------------------------------------
+static void restoreMemoryImages()
+{
+    static const uint8_t zero[sizeof(uint64_t)] = {0};
+    char log_msg[1000];
+
+    for (int i = 0; i < PERSISTENT_SECTIONS; i++)
     {
-        uint32_t value;
-        // Read each value individually
-        if (fread(&value, sizeof(uint32_t), 1, file) != 1) 
-        {
-            if (feof(file)) break; // Stop on end of file
-            sprintf(log_msg, "Error reading dint_memory from file");
-            openplc_log(log_msg);
-            pthread_mutex_unlock(&bufferLock); //unlock mutex
-            fclose(file);
-            pstorage_read = true;
-            return;
-        }
-        
-        // Only assign if value is non-zero
-        if (value != 0)
+        const PersistentArea *area = &persistent_areas[i];
+        uint8_t *stored = (uint8_t *)&persisted_image + area->offset;
+        uint8_t *memory = (uint8_t *)area->memory;
+
+        if (memory == NULL)
         {
-            // Allocate memory if the pointer is NULL
-            if (dint_memory[i] == NULL) 
+            if (stored_layout_known[i] && stored_layout[i] == areaLayout(area))
             {
-                dint_memory[i] = malloc(sizeof(uint32_t));
-                if (dint_memory[i] == NULL) 
-                {
-                    sprintf(log_msg, "Error allocating memory for dint_memory[%d]", i);
-                    openplc_log(log_msg);
-                    continue;
-                }
+                restoreRetainVariables(stored);
             }
-            *dint_memory[i] = value; // Store the value
+            else if (stored_layout_known[i])
+            {
+                sprintf(log_msg, "Persistent Storage: RETAIN variables were declared differently when stored, not restoring them\n");
+                openplc_log(log_msg);
+            }
+            memset(stored, 0, area->size);
+            copyRetainVariables(stored);
+            continue;
         }
-    }
 
-    // Read the contents into lint_memory
-    for (size_t i = 0; i < BUFFER_SIZE; i++) 
-    {
-        uint64_t value;
-        // Read each value individually
-        if (fread(&value, sizeof(uint64_t), 1, file) != 1) 
+        if (stored_layout_known[i] && stored_layout[i] == areaLayout(area))
         {
-            if (feof(file)) break; // Stop on end of file
-            sprintf(log_msg, "Error reading lint_memory from file");
+            memcpy(memory, stored, area->size);
+        }
+        else if (stored_layout_known[i])
+        {
+            sprintf(log_msg, "Persistent Storage: %s variables were located differently when stored, not restoring them\n", area->name);
             openplc_log(log_msg);
-            pthread_mutex_unlock(&bufferLock); //unlock mutex
-            fclose(file);
-            pstorage_read = true;
-            return;
         }
-        
-        // Only assign if value is non-zero
-        if (value != 0)
+        else
         {
-            // Allocate memory if the pointer is NULL
-            if (lint_memory[i] == NULL) 
+            for (size_t offset = 0; offset < area->size; offset += area->element_size)
             {
-                lint_memory[i] = malloc(sizeof(uint64_t));
-                if (lint_memory[i] == NULL) 
-                {
-                    sprintf(log_msg, "Error allocating memory for lint_memory[%d]", i);
-                    openplc_log(log_msg);
-                    continue;
-                }
+                if (memcmp(stored + offset, zero, area->element_size) != 0)
+                    memcpy(memory + offset, stored + offset, area->element_size);
             }
-            *lint_memory[i] = value; // Store the value
         }
+
+        memcpy(stored, memory, area->size);
     }
-    pthread_mutex_unlock(&bufferLock); //unlock mutex
+}
 
-    fclose(file);
+//-----------------------------------------------------------------------------
+// This function reads the contents from persistent.file into OpenPLC internal
+// buffers. Must be called when OpenPLC is initializing. If persistent storage
+// is disabled, the persistent.file will not be found and the function will
+// exit gracefully.
+//-----------------------------------------------------------------------------
+int readPersistentStorage()
+{
+    char log_msg[1000];
+    memset(&persisted_image, 0, sizeof(persisted_image));
+    memset(stored_layout_known, 0, sizeof(stored_layout_known));
+    base_current = false;
+    resolveStoragePaths();
+
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0 && access(journal_path, F_OK) != 0 && access(retain_path, F_OK) != 0)
+    {
+        sprintf(log_msg, "Persistent Storage is empty\n");
+        openplc_log(log_msg);
+        pstorage_read = true;
+        return 0;
+    }
+
+    if (fd >= 0)
+    {
+        readBaseImage(fd);
+        close(fd);
+    }
+    replayJournal();
+
+    // The region is only left behind by a run that kept the memory on it, so
+    // its durable copy is newer than the journal
+    uint32_t generation = readRetainRegion(&persisted_image);
+    if (generation > 0)
+    {
+        sprintf(log_msg, "Persistent Storage: Loaded retentive memory region (generation %u)\n", generation);
+        openplc_log(log_msg);
+    }
+
+    lockBuffer();
+    restoreMemoryImages();
+    unlockBuffer();
 
     sprintf(log_msg, "Persistent Storage: Finished reading persistent memory\n");
     openplc_log(log_msg);
     pstorage_read = true;
     return 0;
-}
\ No newline at end of file
+}
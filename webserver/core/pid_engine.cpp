@@ -0,0 +1,181 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file computes the loops of the PID_BATCH blocks (lib/pid_batch.h).
+// Every instance gets a loop the first time it runs. The loops are kept as
+// one array per input and state, and the scan thread computes all of the
+// loops called during the scan once the program has run, several loops per
+// SIMD instruction. The algorithm is the one of the PID block with its
+// INTEGRAL and DERIVATIVE blocks.
+//
+// A call of the block stores the inputs on its loop and returns the output
+// computed for its previous call, so XOUT reaches the outputs one scan later
+// than with PID. The loops not called during a scan keep their state.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "ladder.h"
+#include "iec_types_all.h"
+
+#ifdef OPLC_LOW_MEMORY
+#define PID_ENGINE_MAX_LOOPS    256
+#else
+#define PID_ENGINE_MAX_LOOPS    4096
+#endif
+#define PID_ENGINE_LANES        8   // loops computed together
+
+// The loops are computed PID_ENGINE_LANES at a time with the vector
+// extension of GCC, on the SIMD unit of the target (SSE, AVX, NEON)
+typedef float PidVector __attribute__((vector_size(PID_ENGINE_LANES * sizeof(float)), may_alias));
+typedef int32_t PidMask __attribute__((vector_size(PID_ENGINE_LANES * sizeof(int32_t)), may_alias));
+
+struct PidLoops
+{
+    // Inputs of the last call
+    float pv[PID_ENGINE_MAX_LOOPS];
+    float sp[PID_ENGINE_MAX_LOOPS];
+    float x0[PID_ENGINE_MAX_LOOPS];
+    float kp[PID_ENGINE_MAX_LOOPS];
+    float tr[PID_ENGINE_MAX_LOOPS];
+    float td[PID_ENGINE_MAX_LOOPS];
+    float cycle[PID_ENGINE_MAX_LOOPS];      // seconds
+    int32_t automatic[PID_ENGINE_MAX_LOOPS];
+    int32_t called[PID_ENGINE_MAX_LOOPS];   // called since the last solve
+
+    // State, the outputs of INTEGRAL and the last inputs of DERIVATIVE
+    float iterm[PID_ENGINE_MAX_LOOPS];
+    float x1[PID_ENGINE_MAX_LOOPS];
+    float x2[PID_ENGINE_MAX_LOOPS];
+    float x3[PID_ENGINE_MAX_LOOPS];
+    float xout[PID_ENGINE_MAX_LOOPS];
+};
+
+static PidLoops loops __attribute__((aligned(64)));
+static int loop_count = 0;
+static bool full_reported = false;
+static pthread_mutex_t pidLock = PTHREAD_MUTEX_INITIALIZER;
+
+//-----------------------------------------------------------------------------
+// Gives a loop to a PID_BATCH instance. Returns the loop, or -1 when all of
+// them are taken
+//-----------------------------------------------------------------------------
+extern "C" DINT __plc_pid_attach()
+{
+    pthread_mutex_lock(&pidLock);
+    int slot = -1;
+    if (loop_count < PID_ENGINE_MAX_LOOPS)
+    {
+        slot = loop_count;
+        loops.called[slot] = 0;
+        loops.iterm[slot] = 0;
+        loops.x1[slot] = 0;
+        loops.x2[slot] = 0;
+        loops.x3[slot] = 0;
+        loops.xout[slot] = 0;
+        __atomic_store_n(&loop_count, loop_count + 1, __ATOMIC_RELEASE);
+    }
+    else if (!full_reported)
+    {
+        char log_msg[1000];
+        sprintf(log_msg, "PID engine: all %d loops taken, the other PID_BATCH instances don't run\n", PID_ENGINE_MAX_LOOPS);
+        openplc_log(log_msg);
+        full_reported = true;
+    }
+    pthread_mutex_unlock(&pidLock);
+
+    return slot;
+}
+
+//-----------------------------------------------------------------------------
+// Call of a PID_BATCH instance. Stores the inputs for the next solve and
+// returns the output of the last one
+//-----------------------------------------------------------------------------
+extern "C" REAL __plc_pid_update(DINT slot, BOOL automatic, REAL pv, REAL sp, REAL x0,
+                                 REAL kp, REAL tr, REAL td, REAL cycle)
+{
+    if (slot < 0 || slot >= __atomic_load_n(&loop_count, __ATOMIC_ACQUIRE)) return 0;
+
+    loops.pv[slot] = pv;
+    loops.sp[slot] = sp;
+    loops.x0[slot] = x0;
+    loops.kp[slot] = kp;
+    loops.tr[slot] = tr;
+    loops.td[slot] = td;
+    loops.cycle[slot] = cycle;
+    loops.automatic[slot] = automatic ? 1 : 0;
+    loops.called[slot] = 1;
+
+    return loops.xout[slot];
+}
+
+//-----------------------------------------------------------------------------
+// Computes PID_ENGINE_LANES loops from first, one lane per loop. Every lane
+// computes both sides of each choice and the step, and keeps the step only
+// when its loop was called
+//-----------------------------------------------------------------------------
+static inline void solveLanes(int first)
+{
+    PidVector *pv = (PidVector *)(loops.pv + first);
+    PidVector *sp = (PidVector *)(loops.sp + first);
+    PidVector *x0 = (PidVector *)(loops.x0 + first);
+    PidVector *kp = (PidVector *)(loops.kp + first);
+    PidVector *tr = (PidVector *)(loops.tr + first);
+    PidVector *td = (PidVector *)(loops.td + first);
+    PidVector *cycle = (PidVector *)(loops.cycle + first);
+    PidMask *called = (PidMask *)(loops.called + first);
+    PidVector *iterm = (PidVector *)(loops.iterm + first);
+    PidVector *x1 = (PidVector *)(loops.x1 + first);
+    PidVector *x2 = (PidVector *)(loops.x2 + first);
+    PidVector *x3 = (PidVector *)(loops.x3 + first);
+    PidVector *xout = (PidVector *)(loops.xout + first);
+
+    const PidVector zero = {};
+    PidMask run = *(PidMask *)(loops.automatic + first) != 0;
+    PidMask step = *called != 0;
+    PidVector error = *pv - *sp;
+
+    // INTEGRAL, reset to the manual output adjustment while not in auto
+    PidVector integral = run ? *iterm + error * *cycle : *tr * (*x0 - error);
+    // DERIVATIVE
+    PidVector derivative = run ? (3.0f * (error - *x3) + *x1 - *x2) / (10.0f * *cycle) : zero;
+    PidVector out = *kp * (error + integral / *tr + derivative * *td);
+
+    PidVector next3 = run ? *x2 : error;
+    PidVector next2 = run ? *x1 : error;
+    *iterm = step ? integral : *iterm;
+    *x3 = step ? next3 : *x3;
+    *x2 = step ? next2 : *x2;
+    *x1 = step ? error : *x1;
+    *xout = step ? out : *xout;
+    *called = PidMask{};
+}
+
+//-----------------------------------------------------------------------------
+// Computes the loops called during the scan. Called by the scan thread after
+// the program, with the buffer lock held
+//-----------------------------------------------------------------------------
+void solvePidLoops()
+{
+    int count = __atomic_load_n(&loop_count, __ATOMIC_ACQUIRE);
+    for (int first = 0; first < count; first += PID_ENGINE_LANES)
+    {
+        solveLanes(first);
+    }
+}
@@ -0,0 +1,131 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file describes the entry points of a PLC program to the runtime. The
+// glueVars.cpp generated for every program fills a PlcProgram with them, so
+// the runtime can run the program linked in the executable or one loaded
+// from a shared object by an online change (see online_change.cpp). Both
+// sides must agree on PLC_PROGRAM_VERSION.
+//-----------------------------------------------------------------------------
+
+#ifndef PLC_PROGRAM_H
+#define PLC_PROGRAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PLC_PROGRAM_VERSION     8
+
+//Fraction bits of the fixed point REAL (OPLC_FIXED_REAL), 0 when REAL is a float
+#ifdef OPLC_FIXED_REAL
+#define PLC_REAL_FRAC_BITS      OPLC_FIXED_FRAC_BITS
+#else
+#define PLC_REAL_FRAC_BITS      0
+#endif
+
+//Flag set by config_init on the variables declared RETAIN (__IEC_RETAIN_FLAG)
+#define PLC_VARIABLE_RETAIN     0x04
+
+//A variable of the program that is not located. Online changes carry the
+//value over to the variable with the same name and type on the new program,
+//and the ones flagged PLC_VARIABLE_RETAIN are kept by the persistent storage
+struct PlcVariable
+{
+    const char *name;       //path of the variable (e.g. CONFIG0.RES0.INSTANCE0.COUNT)
+    const char *type;       //IEC type name
+    void *value;
+    size_t size;
+    const uint8_t *flags;   //flags of the variable, set by config_init
+};
+
+//A located variable exported by the OPC UA server. The table is generated
+//with the program, so the address space doesn't depend on any file
+struct PlcLocatedVariable
+{
+    uint32_t node_id;
+    const char *name;       //display name of the node
+    const char *location;   //IEC location (e.g. %QX0.1)
+    char size;              //X, B, W, D, L, R or F
+    void *value;            //slot of the variable on the images
+    uint32_t count;         //consecutive slots, more than 1 for an array node
+};
+
+//Address of a located variable on a protocol server
+struct PlcProtocolAddress
+{
+    uint16_t table;         //0 if the protocol doesn't reach the variable
+    uint8_t bit;            //bit of a boolean on the byte or element
+    uint32_t address;       //register, point, element or byte
+};
+
+//A located variable with its address on every protocol server. The glue
+//generator resolves the addresses with the map of tagProtocolAddress(), so
+//the runtime doesn't translate any location of the program
+struct PlcProtocolMapping
+{
+    char area;              //I, Q or M
+    char size;              //X, B, W, D, L, R or F
+    uint32_t position;      //entry on the area, byte * 8 + bit for booleans
+    void *value;            //slot of the variable on the images
+    PlcProtocolAddress modbus;
+    PlcProtocolAddress dnp3;
+    PlcProtocolAddress pccc;
+    PlcProtocolAddress s7;
+};
+
+struct PlcProgram
+{
+    int version;
+    unsigned int image_size;                //entries of the I/O and memory images (BUFFER_SIZE)
+    unsigned int real_frac_bits;            //PLC_REAL_FRAC_BITS
+
+    //MatIEC program
+    void (*config_init)(void);
+    void (*config_run)(unsigned long tick);
+    unsigned long long *common_ticktime;
+    unsigned long *task_count;              //NULL for programs without task table
+    unsigned long *task_period_ticks;
+
+    //glueVars.cpp
+    void (*glue_vars)(void);
+    void (*update_time)(void);
+    const PlcVariable *variables;
+    size_t variable_count;
+    const PlcLocatedVariable *located_variables;
+    size_t located_variable_count;
+    const PlcProtocolMapping *protocol_map;
+    size_t protocol_map_count;
+
+    //debug.cpp
+    uint16_t (*get_var_count)(void);
+    size_t (*get_var_size)(size_t);
+    void *(*get_var_addr)(size_t);
+    void (*set_trace)(size_t, bool, void *);
+    void (*trace_reset)(void);
+    void (*set_endianness)(uint8_t);
+
+    //NULL unless the program was built with direct access (OPLC_DIRECT_ACCESS).
+    //Copies the forced values of the located variables over their locations
+    void (*force_overlay)(void);
+};
+
+//Fills program with the entry points of the program of the object it is
+//defined on. Defined by the generated glueVars.cpp
+extern "C" void getPlcProgram(PlcProgram *program);
+
+#endif
@@ -0,0 +1,426 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the export and import of the whole state of the PLC
+// program, for the warm start of a standby unit or to reproduce the state of
+// a field unit offline. The state is every debug variable of the program
+// (get_var_addr / get_var_size) and the located variables, which live on the
+// process image arrays. Both are copied holding bufferLock, so the state is
+// always the one between two scans.
+//
+// The file is a StateHeader followed by sections, each a StateSection and
+// its data, and a 32 bit FNV-1a checksum of everything before it. The data of
+// the sections is run length encoded: 0x00 followed by the number of zero
+// bytes, any other byte as itself. Readers skip the sections they don't know.
+// Values are stored in the byte order of the runtime, and a state is only
+// imported into a program with the same variable layout.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ladder.h"
+
+#define STATE_MAGIC             "OPLCSTAT"
+#define STATE_FORMAT_VERSION    1
+
+#define STATE_SECTION_VARIABLES 1   //debug variables, in index order
+#define STATE_SECTION_IMAGE     2   //process image arrays, in state_images order
+
+extern unsigned long __tick;
+
+struct StateHeader
+{
+    char magic[8];
+    uint16_t version;
+    uint16_t sections;
+    uint32_t variable_count;
+    uint32_t layout;            //FNV-1a of the sizes of the debug variables
+    uint32_t image_size;
+    uint64_t tick;
+    uint64_t timestamp;         //UTC, ms since 1970
+};
+
+struct StateSection
+{
+    uint32_t type;
+    uint32_t encoded_size;
+    uint32_t size;              //size once decoded
+};
+
+struct StateImage
+{
+    void *data;
+    size_t size;
+};
+
+static const StateImage state_images[] =
+{
+    {bool_input_image, sizeof(bool_input_image)},
+    {bool_output_image, sizeof(bool_output_image)},
+    {bool_memory_image, sizeof(bool_memory_image)},
+    {byte_input_image, sizeof(byte_input_image)},
+    {byte_output_image, sizeof(byte_output_image)},
+    {byte_memory_image, sizeof(byte_memory_image)},
+    {int_input_image, sizeof(int_input_image)},
+    {int_output_image, sizeof(int_output_image)},
+    {int_memory_image, sizeof(int_memory_image)},
+    {dint_input_image, sizeof(dint_input_image)},
+    {dint_output_image, sizeof(dint_output_image)},
+    {dint_memory_image, sizeof(dint_memory_image)},
+    {lint_input_image, sizeof(lint_input_image)},
+    {lint_output_image, sizeof(lint_output_image)},
+    {lint_memory_image, sizeof(lint_memory_image)},
+    {real_input_image, sizeof(real_input_image)},
+    {real_output_image, sizeof(real_output_image)},
+    {real_memory_image, sizeof(real_memory_image)},
+    {lreal_input_image, sizeof(lreal_input_image)},
+    {lreal_output_image, sizeof(lreal_output_image)},
+    {lreal_memory_image, sizeof(lreal_memory_image)},
+};
+
+#define STATE_IMAGE_COUNT       (sizeof(state_images) / sizeof(state_images[0]))
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t length)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static size_t imageSize()
+{
+    size_t size = 0;
+    for (size_t i = 0; i < STATE_IMAGE_COUNT; i++) size += state_images[i].size;
+    return size;
+}
+
+//-----------------------------------------------------------------------------
+// Describes the debug variables of the running program: their total size
+// and a hash of their sizes, which changes with the layout of the program
+//-----------------------------------------------------------------------------
+static uint32_t variableLayout(PlcProgram *program, uint32_t *count, size_t *size)
+{
+    uint32_t hash = 2166136261u;
+    *count = program->get_var_count();
+    *size = 0;
+    for (uint32_t i = 0; i < *count; i++)
+    {
+        uint32_t var_size = (uint32_t)program->get_var_size(i);
+        hash = fnv1a(hash, &var_size, sizeof(var_size));
+        *size += var_size;
+    }
+    return hash;
+}
+
+//-----------------------------------------------------------------------------
+// Run length encodes the zero bytes of data into out, which must hold one
+// and a half times length plus two bytes. Returns the encoded size
+//-----------------------------------------------------------------------------
+static size_t encodeZeros(const uint8_t *data, size_t length, uint8_t *out)
+{
+    size_t encoded = 0;
+    size_t i = 0;
+    while (i < length)
+    {
+        if (data[i] != 0)
+        {
+            out[encoded++] = data[i++];
+            continue;
+        }
+
+        uint8_t run = 0;
+        while (i < length && run < 255 && data[i] == 0)
+        {
+            run++;
+            i++;
+        }
+        out[encoded++] = 0x00;
+        out[encoded++] = run;
+    }
+    return encoded;
+}
+
+//-----------------------------------------------------------------------------
+// Decodes encodeZeros output into exactly length bytes. Returns false if the
+// data is malformed or doesn't decode to length bytes
+//-----------------------------------------------------------------------------
+static bool decodeZeros(const uint8_t *data, size_t encoded, uint8_t *out, size_t length)
+{
+    size_t position = 0;
+    for (size_t i = 0; i < encoded; i++)
+    {
+        if (data[i] != 0)
+        {
+            if (position == length) return false;
+            out[position++] = data[i];
+            continue;
+        }
+
+        if (++i == encoded || data[i] > length - position) return false;
+        memset(out + position, 0, data[i]);
+        position += data[i];
+    }
+    return position == length;
+}
+
+//-----------------------------------------------------------------------------
+// Appends a section with the encoded data to the file being built
+//-----------------------------------------------------------------------------
+static size_t appendSection(uint8_t *file, size_t length, uint32_t type, const uint8_t *data, size_t size)
+{
+    StateSection section;
+    section.type = type;
+    section.size = (uint32_t)size;
+    section.encoded_size = (uint32_t)encodeZeros(data, size, file + length + sizeof(section));
+    memcpy(file + length, &section, sizeof(section));
+    return length + sizeof(section) + section.encoded_size;
+}
+
+//-----------------------------------------------------------------------------
+// Writes the state of the program to path. locked, if any, is called right
+// after the state is copied, still holding bufferLock, so the caller can
+// start from the same state. Returns 0, or -1 on error
+//-----------------------------------------------------------------------------
+int exportPlcState(const char *path, void (*locked)(void))
+{
+    char log_msg[1000];
+    size_t image_size = imageSize();
+
+    // The buffers are sized before taking the lock. An online change that
+    // lands in between changes the layout, and the copy is sized again
+    uint8_t *raw = NULL;
+    StateHeader header;
+    size_t variables_size = 0;
+    for (int attempt = 0; attempt < 3 && raw == NULL; attempt++)
+    {
+        uint32_t count;
+        uint32_t layout = variableLayout(plcProgram(), &count, &variables_size);
+        raw = (uint8_t *)malloc(variables_size + image_size);
+        if (raw == NULL) break;
+
+        lockBuffer();
+        PlcProgram *program = plcProgram();
+        size_t size;
+        if (variableLayout(program, &header.variable_count, &size) != layout || header.variable_count != count)
+        {
+            unlockBuffer();
+            free(raw);
+            raw = NULL;
+            continue;
+        }
+        uint8_t *position = raw;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            size_t var_size = program->get_var_size(i);
+            memcpy(position, program->get_var_addr(i), var_size);
+            position += var_size;
+        }
+        for (size_t i = 0; i < STATE_IMAGE_COUNT; i++)
+        {
+            memcpy(position, state_images[i].data, state_images[i].size);
+            position += state_images[i].size;
+        }
+        header.tick = __tick;
+        if (locked != NULL) locked();
+        unlockBuffer();
+        header.layout = layout;
+    }
+    if (raw == NULL)
+    {
+        openplc_log((char *)"PLC state: could not copy the program variables\n");
+        return -1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    memcpy(header.magic, STATE_MAGIC, sizeof(header.magic));
+    header.version = STATE_FORMAT_VERSION;
+    header.sections = 2;
+    header.image_size = (uint32_t)image_size;
+    header.timestamp = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+    // Worst case of the encoding is a lone zero byte every other byte
+    size_t total = variables_size + image_size;
+    uint8_t *file = (uint8_t *)malloc(sizeof(header) + 2 * sizeof(StateSection) + total + total / 2 + 16);
+    if (file == NULL)
+    {
+        free(raw);
+        return -1;
+    }
+    memcpy(file, &header, sizeof(header));
+    size_t length = sizeof(header);
+    length = appendSection(file, length, STATE_SECTION_VARIABLES, raw, variables_size);
+    length = appendSection(file, length, STATE_SECTION_IMAGE, raw + variables_size, image_size);
+    uint32_t checksum = fnv1a(2166136261u, file, length);
+    memcpy(file + length, &checksum, sizeof(checksum));
+    length += sizeof(checksum);
+    free(raw);
+
+    // Written next to the target and renamed, a reader never sees half a file
+    char temp_path[1100];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE *f = fopen(temp_path, "wb");
+    bool written = f != NULL && fwrite(file, 1, length, f) == length;
+    if (f != NULL && fclose(f) != 0) written = false;
+    free(file);
+    if (!written || rename(temp_path, path) != 0)
+    {
+        unlink(temp_path);
+        sprintf(log_msg, "PLC state: error writing %s\n", path);
+        openplc_log(log_msg);
+        return -1;
+    }
+
+    sprintf(log_msg, "PLC state: %u variables exported to %s (%zu bytes)\n", header.variable_count, path, length);
+    openplc_log(log_msg);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Loads the state on path into the running program, between two scans.
+// Returns 0, or -1 if the file is invalid or was exported from a program
+// with another layout
+//-----------------------------------------------------------------------------
+int importPlcState(const char *path)
+{
+    char log_msg[1000];
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        sprintf(log_msg, "PLC state: could not open %s\n", path);
+        openplc_log(log_msg);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long file_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *file = file_size > 0 ? (uint8_t *)malloc(file_size) : NULL;
+    bool read_ok = file != NULL && fread(file, 1, file_size, f) == (size_t)file_size;
+    fclose(f);
+
+    StateHeader header;
+    uint32_t checksum;
+    size_t length = (size_t)file_size - sizeof(checksum);
+    if (read_ok && (size_t)file_size >= sizeof(header) + sizeof(checksum))
+    {
+        memcpy(&header, file, sizeof(header));
+        memcpy(&checksum, file + length, sizeof(checksum));
+    }
+    if (!read_ok || (size_t)file_size < sizeof(header) + sizeof(checksum) ||
+        memcmp(header.magic, STATE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != STATE_FORMAT_VERSION || fnv1a(2166136261u, file, length) != checksum)
+    {
+        free(file);
+        sprintf(log_msg, "PLC state: %s is not a valid state file\n", path);
+        openplc_log(log_msg);
+        return -1;
+    }
+
+    size_t image_size = imageSize();
+    size_t variables_size;
+    uint32_t count;
+    uint32_t layout = variableLayout(plcProgram(), &count, &variables_size);
+    if (count != header.variable_count || layout != header.layout || header.image_size != image_size)
+    {
+        free(file);
+        sprintf(log_msg, "PLC state: %s was exported from a different program\n", path);
+        openplc_log(log_msg);
+        return -1;
+    }
+
+    uint8_t *variables = (uint8_t *)malloc(variables_size + image_size);
+    uint8_t *image = variables != NULL ? variables + variables_size : NULL;
+    bool has_variables = false, has_image = false, valid = variables != NULL;
+    size_t position = sizeof(header);
+    for (int i = 0; valid && i < header.sections; i++)
+    {
+        StateSection section;
+        if (position + sizeof(section) > length)
+        {
+            valid = false;
+            break;
+        }
+        memcpy(&section, file + position, sizeof(section));
+        position += sizeof(section);
+        if (section.encoded_size > length - position)
+        {
+            valid = false;
+            break;
+        }
+
+        if (section.type == STATE_SECTION_VARIABLES)
+        {
+            valid = section.size == variables_size && decodeZeros(file + position, section.encoded_size, variables, variables_size);
+            has_variables = true;
+        }
+        else if (section.type == STATE_SECTION_IMAGE)
+        {
+            valid = section.size == image_size && decodeZeros(file + position, section.encoded_size, image, image_size);
+            has_image = true;
+        }
+        position += section.encoded_size;
+    }
+    free(file);
+    if (!valid || !has_variables || !has_image)
+    {
+        free(variables);
+        sprintf(log_msg, "PLC state: %s is not a valid state file\n", path);
+        openplc_log(log_msg);
+        return -1;
+    }
+
+    lockBuffer();
+    PlcProgram *program = plcProgram();
+    size_t size;
+    bool same_program = variableLayout(program, &count, &size) == layout && count == header.variable_count;
+    if (same_program)
+    {
+        const uint8_t *value = variables;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            size_t var_size = program->get_var_size(i);
+            memcpy(program->get_var_addr(i), value, var_size);
+            value += var_size;
+        }
+        for (size_t i = 0; i < STATE_IMAGE_COUNT; i++)
+        {
+            memcpy(state_images[i].data, image, state_images[i].size);
+            image += state_images[i].size;
+        }
+    }
+    unlockBuffer();
+    free(variables);
+
+    if (!same_program)
+    {
+        openplc_log((char *)"PLC state: the program changed during the import\n");
+        return -1;
+    }
+    sprintf(log_msg, "PLC state: %u variables imported from %s (tick %llu)\n", count, path, (unsigned long long)header.tick);
+    openplc_log(log_msg);
+    return 0;
+}
@@ -0,0 +1,166 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the POU profiler. Programs compiled with stage4
+// option f (scripts/pou_profiling) open and close the body of every program
+// and function block with __PROFILE_POU_ENTER/EXIT (lib/accessor.h), which
+// land here. Each POU type has a static profile on the program, linked on a
+// list the first time it is called. The time of a call is added to the
+// total of its type, and the time of the POUs it called is taken out of its
+// self time, so the table tells which POU types the scan time goes to.
+//
+// Calls are counted from every thread that runs the program (scan thread,
+// program workers, event tasks), each keeping its own call stack.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "ladder.h"
+#include "accessor.h"
+
+#define POU_PROFILE_MAX_ROWS    1024
+
+// Profiles called since the last reset. A reset starts a new generation, the
+// profiles of an older one are linked again (and zeroed) on their next call
+static __plc_pou_profile_t *profiles = NULL;
+static unsigned long generation = 1;
+static pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Time spent in the POUs called by the running body, on this thread
+static __thread unsigned long long child_ns = 0;
+
+static inline unsigned long long monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+// Links a profile on the list of the current generation
+//-----------------------------------------------------------------------------
+static void linkProfile(__plc_pou_profile_t *profile)
+{
+    pthread_mutex_lock(&profileLock);
+    if (profile->generation != generation)
+    {
+        __atomic_store_n(&profile->calls, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&profile->total_ns, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&profile->self_ns, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&profile->max_ns, 0, __ATOMIC_RELAXED);
+        profile->next = profiles;
+        profiles = profile;
+        __atomic_store_n(&profile->generation, generation, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&profileLock);
+}
+
+//-----------------------------------------------------------------------------
+// Start of a POU body
+//-----------------------------------------------------------------------------
+extern "C" void __plc_pou_enter(__plc_pou_frame_t *frame)
+{
+    frame->outer_child_ns = child_ns;
+    child_ns = 0;
+    frame->start_ns = monotonicNs();
+}
+
+//-----------------------------------------------------------------------------
+// End of a POU body. The POU that called it sees the whole call as time of
+// its children
+//-----------------------------------------------------------------------------
+extern "C" void __plc_pou_exit(__plc_pou_profile_t *profile, __plc_pou_frame_t *frame)
+{
+    unsigned long long elapsed = monotonicNs() - frame->start_ns;
+    unsigned long long self = elapsed > child_ns ? elapsed - child_ns : 0;
+    child_ns = frame->outer_child_ns + elapsed;
+
+    if (__atomic_load_n(&profile->generation, __ATOMIC_ACQUIRE) != __atomic_load_n(&generation, __ATOMIC_RELAXED)) linkProfile(profile);
+
+    __atomic_fetch_add(&profile->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&profile->total_ns, elapsed, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&profile->self_ns, self, __ATOMIC_RELAXED);
+    if (elapsed > __atomic_load_n(&profile->max_ns, __ATOMIC_RELAXED)) __atomic_store_n(&profile->max_ns, elapsed, __ATOMIC_RELAXED);
+}
+
+//-----------------------------------------------------------------------------
+// Clears the profile. Also called when an online change swaps the program,
+// so the table only holds the POUs of the running one
+//-----------------------------------------------------------------------------
+void resetPouProfile()
+{
+    pthread_mutex_lock(&profileLock);
+    profiles = NULL;
+    __atomic_store_n(&generation, generation + 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&profileLock);
+}
+
+//-----------------------------------------------------------------------------
+// Writes a text table with the calls and times (in microseconds) of every
+// POU type called since the last reset, the longest self time first.
+// Returns the number of characters written
+//-----------------------------------------------------------------------------
+int getPouProfile(char *buffer, size_t buffer_size)
+{
+    static __plc_pou_profile_t *rows[POU_PROFILE_MAX_ROWS];
+    static unsigned long long self[POU_PROFILE_MAX_ROWS];
+    int count = 0;
+
+    pthread_mutex_lock(&profileLock);
+    for (__plc_pou_profile_t *p = profiles; p != NULL && count < POU_PROFILE_MAX_ROWS; p = p->next)
+    {
+        unsigned long long s = __atomic_load_n(&p->self_ns, __ATOMIC_RELAXED);
+        int i = count++;
+        while (i > 0 && self[i - 1] < s)
+        {
+            rows[i] = rows[i - 1];
+            self[i] = self[i - 1];
+            i--;
+        }
+        rows[i] = p;
+        self[i] = s;
+    }
+
+    unsigned long long self_sum = 0;
+    for (int i = 0; i < count; i++) self_sum += self[i];
+
+    int written = snprintf(buffer, buffer_size, "%-32s %12s %12s %12s %10s %10s %7s\n",
+                           "pou(us)", "calls", "self_total", "total", "self_avg", "max", "self%");
+    for (int i = 0; i < count && written < (int)buffer_size; i++)
+    {
+        unsigned long long calls = __atomic_load_n(&rows[i]->calls, __ATOMIC_RELAXED);
+        written += snprintf(buffer + written, buffer_size - written, "%-32s %12llu %12.1f %12.1f %10.2f %10.1f %7.2f\n",
+                            rows[i]->name, calls, self[i] / 1000.0,
+                            __atomic_load_n(&rows[i]->total_ns, __ATOMIC_RELAXED) / 1000.0,
+                            calls > 0 ? self[i] / 1000.0 / calls : 0.0,
+                            __atomic_load_n(&rows[i]->max_ns, __ATOMIC_RELAXED) / 1000.0,
+                            self_sum > 0 ? 100.0 * self[i] / self_sum : 0.0);
+    }
+    pthread_mutex_unlock(&profileLock);
+
+    if (count == 0 && written < (int)buffer_size)
+    {
+        written += snprintf(buffer + written, buffer_size - written, "no POU timed, build the program with scripts/pou_profiling set to true\n");
+    }
+
+    if (written > (int)buffer_size) written = buffer_size;
+    return written;
+}
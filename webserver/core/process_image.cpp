@@ -0,0 +1,984 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the published process image used by the protocol
+// servers. Once per scan the main loop copies the located variables into one
+// of two snapshots and publishes it with a sequence counter (seqlock), so
+// readers never need bufferLock. Writes coming from the protocol servers are
+// appended to a write-intent queue that the scan thread applies at the start
+// of the next cycle.
+//
+// Every snapshot is also compared with the previous one, once, on the scan
+// thread. The resulting change sets of the last PI_CHANGE_HISTORY versions
+// are kept, so each protocol server asks which blocks changed since the
+// version it last looked at instead of comparing the whole image itself.
+//
+// The memory areas are only published on the ranges located by the program
+// (see buildImageRanges), so a sparse program copies a few entries instead
+// of the whole areas and the protocol servers read zeros on the gaps. The
+// variables declared RETAIN are packed on the retain area, which is what the
+// persistent storage keeps of them. The
+// I/O areas are always published whole: the hardware layers and the Modbus
+// master fill entries the program doesn't locate.
+//
+// The bool areas are published twice: one IEC_BOOL per entry, as the program
+// sees them, and packed eight entries per byte. Packing takes a vector
+// compare per 16 entries on the scan thread, and lets the readers build bit
+// fields (Modbus coils, PCCC I/O files) and find the bools that toggled (DNP3
+// events) 8 or 64 at a time instead of one by one.
+//
+// The snapshots are on the shared memory segment of shared_image.cpp when it
+// can be created, so local processes read them without going through a
+// protocol server. The writes those processes queue on the segment are
+// applied with the ones of the protocol servers.
+//
+// The inputs (%IX and %IW) also carry the time they last changed, for the
+// sequence of events of DNP3 and OPC UA. A change is stamped with the time
+// the scan read the inputs, or with the time of the edge when the GPIO
+// events saw it happen before that. The times are kept apart from the
+// snapshots and written before the version that changes them is published,
+// so a reader always finds the time of the value it read or of a later
+// change of the same input.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "ladder.h"
+
+#ifdef OPLC_LOW_MEMORY
+#define PI_QUEUE_SIZE       2048            // still fits a full Modbus coil write
+#define PI_RUN_DATA_SIZE    (8 * 1024)      // bytes of the queued runs, per queue
+#else
+#define PI_QUEUE_SIZE       4096
+#define PI_RUN_DATA_SIZE    (32 * 1024)     // bytes of the queued runs, per queue
+#endif
+#define PI_RUN              0x80            // area flag of a queued run
+#define PI_CHANGE_HISTORY   64
+#define PI_SHARED_WRITES    256             // writes of the shared image applied per scan
+#define PI_HUGE_PAGE        (2 * 1024 * 1024)
+#ifndef MADV_COLLAPSE
+#define MADV_COLLAPSE       25
+#endif
+
+static_assert(sizeof(ProcessImageSnapshot) % 8 == 0, "snapshots are compared a word at a time");
+static_assert(BUFFER_SIZE % 8 == 0, "the inputs are stamped a word at a time");
+
+//-----------------------------------------------------------------------------
+// Snapshot storage. Readers pick the buffer pointed by published_index, the
+// scan thread always writes on the other one. The state written by the scan,
+// by the readers that wait for it and by the producers of writes is kept on
+// separate cache lines, so none of them invalidates the lines of the others.
+// snapshots points to the shared image once it is created
+//-----------------------------------------------------------------------------
+static ProcessImageSnapshot private_snapshots[2];
+static ProcessImageSnapshot *snapshots = private_snapshots;
+alignas(PI_CACHE_LINE) static std::atomic<int> published_index(0);
+static std::atomic<uint32_t> published_version(0);
+
+//-----------------------------------------------------------------------------
+// Change sets of the last versions. Version v is on slot v % PI_CHANGE_HISTORY
+// and holds the changes from version v - 1
+//-----------------------------------------------------------------------------
+static ProcessImageChanges change_history[PI_CHANGE_HISTORY];
+
+//-----------------------------------------------------------------------------
+// Publication signal for the threads that follow the scan. The scan thread
+// only takes publishLock when somebody is waiting on it
+//-----------------------------------------------------------------------------
+alignas(PI_CACHE_LINE) static pthread_mutex_t publishLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t publishCond;
+static std::atomic<int> publish_waiters(0);
+
+//-----------------------------------------------------------------------------
+// Located ranges of the memory areas, indexed by area - PI_INT_MEMORY. A new
+// program is indexed on the set the protocol servers are not reading. The
+// snapshots remember the generation of the ranges they were copied with, so
+// the entries a new program no longer locates are cleared once
+//-----------------------------------------------------------------------------
+#define IMAGE_RANGE_AREAS   (PI_LINT_MEMORY - PI_INT_MEMORY + 1)
+static ImageRanges image_ranges[2][IMAGE_RANGE_AREAS];
+static std::atomic<int> ranges_index(0);
+static uint32_t ranges_generation = 0;
+static uint32_t snapshot_generation[2] = {0, 0};
+
+//-----------------------------------------------------------------------------
+// Variables declared RETAIN, with their offsets on the retain area. Indexed
+// with the ranges and only used with bufferLock held. The layout identifies
+// the names, types and sizes of the variables on the area
+//-----------------------------------------------------------------------------
+struct RetainVariable
+{
+    void *value;
+    uint32_t offset;
+    uint32_t size;
+};
+static std::vector<RetainVariable> retain_variables;
+static std::atomic<uint32_t> retain_layout(0);
+
+//-----------------------------------------------------------------------------
+// Sequence of events. UTC times, in us, of the last change of every input and
+// of the last edge the GPIO events saw on each %IX. input_scan_time is the
+// time the scan read the inputs, only used by the scan thread
+//-----------------------------------------------------------------------------
+static std::atomic<uint64_t> bool_input_times[BUFFER_SIZE * 8];
+static std::atomic<uint64_t> int_input_times[BUFFER_SIZE];
+static std::atomic<uint64_t> bool_input_edges[BUFFER_SIZE * 8];
+static uint64_t input_scan_time = 0;
+
+//-----------------------------------------------------------------------------
+// Write-intent queues. Producers append to the active queue holding
+// queueLock. The scan thread only swaps the active queue (with trylock, so it
+// never blocks on a producer) and drains the retired one without any lock
+//-----------------------------------------------------------------------------
+// A run is queued as one entry with PI_RUN set on its area, the index of its
+// first variable, its number of variables on mask and the offset of its
+// values on the run data of the queue on value
+//-----------------------------------------------------------------------------
+static ProcessImageWrite write_queues[2][PI_QUEUE_SIZE];
+alignas(PI_CACHE_LINE) static int write_queue_count[2] = {0, 0};
+static unsigned char run_data[2][PI_RUN_DATA_SIZE];
+static int run_data_length[2] = {0, 0};
+static int active_queue = 0;
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+// Every swap retires the active queue as the next generation. The writes
+// queued while queue_generation is g are applied once applied_generation
+// reaches g + 1
+static uint32_t queue_generation = 0;
+static std::atomic<uint32_t> applied_generation(0);
+
+//-----------------------------------------------------------------------------
+// Copies the located ranges of a memory area
+//-----------------------------------------------------------------------------
+static void copyRanges(void *destination, const void *source, size_t entry_size, const ImageRanges *ranges)
+{
+    for (int i = 0; i < ranges->count; i++)
+    {
+        size_t offset = ranges->ranges[i].first * entry_size;
+        memcpy((unsigned char *)destination + offset, (const unsigned char *)source + offset, ranges->ranges[i].count * entry_size);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Packs count booleans from a contiguous bool image into bytes, LSB first, as
+// they are laid out on the packed snapshot areas and on Modbus responses.
+// Unused bits of the last byte are cleared. Sixteen (SSE2) or eight (SWAR)
+// booleans are packed per step
+//-----------------------------------------------------------------------------
+void packBools(const IEC_BOOL *src, int count, unsigned char *dst)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i values = _mm_loadu_si128((const __m128i *)(src + i));
+        int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(values, zero)) & 0xffff;
+        dst[i / 8] = mask & 0xff;
+        dst[i / 8 + 1] = mask >> 8;
+    }
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; i + 8 <= count; i += 8)
+    {
+        uint64_t values;
+        memcpy(&values, src + i, sizeof(values));
+        //fold every non zero byte into its lowest bit
+        values |= values >> 4;
+        values |= values >> 2;
+        values |= values >> 1;
+        values &= 0x0101010101010101ULL;
+        //gather the lowest bit of byte k into bit 56 + k
+        dst[i / 8] = (unsigned char)((values * 0x0102040810204080ULL) >> 56);
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        if ((i % 8) == 0) dst[i / 8] = 0;
+        if (src[i] != 0) dst[i / 8] |= 1 << (i % 8);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Copies count bits starting at bit start of a packed bool area into dst,
+// LSB first. Each byte of dst takes the two packed bytes it straddles, so a
+// request is served eight bools per step. Unused bits of the last byte are
+// cleared
+//-----------------------------------------------------------------------------
+void copyPackedBits(const IEC_BYTE *bits, int start, int count, unsigned char *dst)
+{
+    const IEC_BYTE *src = bits + start / 8;
+    int shift = start % 8;
+
+    for (int i = 0; i < count; i += 8)
+    {
+        int remaining = count - i < 8 ? count - i : 8;
+        unsigned value = src[i / 8] >> shift;
+        if (shift + remaining > 8) value |= src[i / 8 + 1] << (8 - shift);
+        dst[i / 8] = value & ((1U << remaining) - 1);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Copies the current located variables into the given snapshot. The glue
+// code keeps every buffer pointer on its slot of the contiguous images, so
+// the I/O areas are copied with a few memcpy calls and the memory areas with
+// one per located range. Must be called with bufferLock held
+//-----------------------------------------------------------------------------
+static void copyProcessImage(ProcessImageSnapshot *snap, int slot)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    snap->timestamp = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+    memcpy(snap->bool_input, bool_input_image, sizeof(snap->bool_input));
+    memcpy(snap->bool_output, bool_output_image, sizeof(snap->bool_output));
+    packBools(&snap->bool_input[0][0], BUFFER_SIZE * 8, snap->bool_input_bits);
+    packBools(&snap->bool_output[0][0], BUFFER_SIZE * 8, snap->bool_output_bits);
+    memcpy(snap->int_input, int_input_image, sizeof(snap->int_input));
+    memcpy(snap->int_output, int_output_image, sizeof(snap->int_output));
+
+    if (snapshot_generation[slot] != ranges_generation)
+    {
+        memset(snap->int_memory, 0, sizeof(snap->int_memory));
+        memset(snap->dint_memory, 0, sizeof(snap->dint_memory));
+        memset(snap->lint_memory, 0, sizeof(snap->lint_memory));
+        memset(snap->retain_memory, 0, sizeof(snap->retain_memory));
+        snapshot_generation[slot] = ranges_generation;
+    }
+    const ImageRanges *ranges = image_ranges[ranges_index.load(std::memory_order_relaxed)];
+    copyRanges(snap->int_memory, int_memory_image, sizeof(IEC_UINT), &ranges[PI_INT_MEMORY - PI_INT_MEMORY]);
+    copyRanges(snap->dint_memory, dint_memory_image, sizeof(IEC_UDINT), &ranges[PI_DINT_MEMORY - PI_INT_MEMORY]);
+    copyRanges(snap->lint_memory, lint_memory_image, sizeof(IEC_ULINT), &ranges[PI_LINT_MEMORY - PI_INT_MEMORY]);
+    copyRetainVariables(snap->retain_memory);
+}
+
+//-----------------------------------------------------------------------------
+// Marks the blocks that differ between two snapshots. Each block is reduced
+// with a xor/or over its words, which the compiler turns into vector code
+//-----------------------------------------------------------------------------
+static void compareSnapshots(const ProcessImageSnapshot *current, const ProcessImageSnapshot *previous, ProcessImageChanges *changes)
+{
+    const uint64_t *a = (const uint64_t *)current;
+    const uint64_t *b = (const uint64_t *)previous;
+    const size_t words = sizeof(ProcessImageSnapshot) / 8;
+    const size_t block_words = PI_CHANGE_BLOCK / 8;
+
+    memset(changes, 0, sizeof(*changes));
+    for (size_t block = 0; block * block_words < words; block++)
+    {
+        size_t first = block * block_words;
+        size_t count = words - first < block_words ? words - first : block_words;
+        uint64_t diff = 0;
+        for (size_t w = 0; w < count; w++) diff |= a[first + w] ^ b[first + w];
+        if (diff != 0) changes->dirty[block / 64] |= 1ULL << (block % 64);
+    }
+}
+
+static uint64_t realtimeUs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+//-----------------------------------------------------------------------------
+// Records the time the scan read the inputs. Called by the scan thread right
+// after the hardware layer updated them
+//-----------------------------------------------------------------------------
+void markInputScanTime()
+{
+    input_scan_time = realtimeUs();
+}
+
+//-----------------------------------------------------------------------------
+// Records an edge of a digital input (%IX byte * 8 + bit) seen by the GPIO
+// events, with its CLOCK_MONOTONIC time. The scan that finds the input
+// changed stamps the change with it
+//-----------------------------------------------------------------------------
+void recordInputEdge(uint32_t input, const struct timespec *timestamp)
+{
+    if (input >= BUFFER_SIZE * 8) return;
+
+    struct timespec monotonic, realtime;
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    int64_t age_us = ((int64_t)(monotonic.tv_sec - timestamp->tv_sec) * 1000000000LL + (monotonic.tv_nsec - timestamp->tv_nsec)) / 1000;
+    uint64_t now_us = (uint64_t)realtime.tv_sec * 1000000ULL + realtime.tv_nsec / 1000;
+    bool_input_edges[input].store(now_us - (age_us > 0 ? age_us : 0), std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// Returns the UTC time, in us, of the last change of an input: PI_BOOL_INPUT
+// (index is byte * 8 + bit) or PI_INT_INPUT. 0 if it never changed
+//-----------------------------------------------------------------------------
+uint64_t getInputChangeTime(int area, uint32_t index)
+{
+    if (area == PI_BOOL_INPUT && index < BUFFER_SIZE * 8) return bool_input_times[index].load(std::memory_order_acquire);
+    if (area == PI_INT_INPUT && index < BUFFER_SIZE) return int_input_times[index].load(std::memory_order_acquire);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Stamps the inputs that differ between a new snapshot and the previous one.
+// The packed bools are compared 64 at a time and the %IW four at a time, so
+// a scan without input changes only costs a pass over 10 KB
+//-----------------------------------------------------------------------------
+static void stampInputChanges(const ProcessImageSnapshot *current, const ProcessImageSnapshot *previous)
+{
+    uint64_t scan_time = input_scan_time ? input_scan_time : current->timestamp * 1000;
+
+    for (int word = 0; word < BUFFER_SIZE / 8; word++)
+    {
+        uint64_t a, b;
+        memcpy(&a, current->bool_input_bits + word * 8, sizeof(a));
+        memcpy(&b, previous->bool_input_bits + word * 8, sizeof(b));
+        for (uint64_t toggled = a ^ b; toggled != 0; toggled &= toggled - 1)
+        {
+            int input = word * 64 + __builtin_ctzll(toggled);
+            uint64_t time = scan_time;
+            // An edge newer than the last change and not after the read is
+            // the one the scan found
+            uint64_t edge = bool_input_edges[input].load(std::memory_order_relaxed);
+            if (edge > bool_input_times[input].load(std::memory_order_relaxed) && edge <= scan_time) time = edge;
+            bool_input_times[input].store(time, std::memory_order_release);
+        }
+    }
+
+    for (int i = 0; i < BUFFER_SIZE; i += 4)
+    {
+        uint64_t a, b;
+        memcpy(&a, &current->int_input[i], sizeof(a));
+        memcpy(&b, &previous->int_input[i], sizeof(b));
+        if (a == b) continue;
+        for (int j = i; j < i + 4; j++)
+        {
+            if (current->int_input[j] != previous->int_input[j]) int_input_times[j].store(scan_time, std::memory_order_release);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Publishes a new snapshot of the process image. Must be called by the scan
+// thread with bufferLock held, after the program logic has executed
+//-----------------------------------------------------------------------------
+void publishProcessImage()
+{
+    int next = 1 - published_index.load(std::memory_order_relaxed);
+    ProcessImageSnapshot *snap = &snapshots[next];
+
+    // An odd sequence tells readers that this buffer is being rewritten
+    snap->sequence.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    uint32_t version = published_version.load(std::memory_order_relaxed) + 1;
+    copyProcessImage(snap, next);
+    snap->version = version;
+
+    snap->sequence.fetch_add(1, std::memory_order_release);
+
+    // The slot is filled before the version that names it is published
+    compareSnapshots(snap, &snapshots[1 - next], &change_history[version % PI_CHANGE_HISTORY]);
+    stampInputChanges(snap, &snapshots[1 - next]);
+
+    published_index.store(next, std::memory_order_release);
+    published_version.fetch_add(1, std::memory_order_release);
+    publishSharedImage(next);
+
+    if (publish_waiters.load(std::memory_order_acquire) > 0)
+    {
+        pthread_mutex_lock(&publishLock);
+        pthread_cond_broadcast(&publishCond);
+        pthread_mutex_unlock(&publishLock);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Hashes a field of the retain layout (FNV-1a)
+//-----------------------------------------------------------------------------
+static uint32_t hashRetainLayout(uint32_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+//-----------------------------------------------------------------------------
+// Indexes the variables the program flagged as RETAIN on config_init, each
+// one aligned to its size on the retain area. The ones that don't fit are
+// left out and logged
+//-----------------------------------------------------------------------------
+static void buildRetainVariables()
+{
+    const PlcProgram *program = plcProgram();
+    uint32_t layout = 2166136261u;
+    size_t offset = 0;
+    size_t skipped = 0;
+
+    retain_variables.clear();
+    for (size_t i = 0; i < program->variable_count; i++)
+    {
+        const PlcVariable *var = &program->variables[i];
+        if (var->flags == NULL || (*var->flags & PLC_VARIABLE_RETAIN) == 0) continue;
+
+        size_t align = var->size >= 8 ? 8 : var->size >= 4 ? 4 : var->size >= 2 ? 2 : 1;
+        size_t start = (offset + align - 1) & ~(align - 1);
+        if (start + var->size > RETAIN_MEMORY_SIZE)
+        {
+            skipped++;
+            continue;
+        }
+
+        RetainVariable retained = { var->value, (uint32_t)start, (uint32_t)var->size };
+        retain_variables.push_back(retained);
+        offset = start + var->size;
+
+        uint32_t size = var->size;
+        layout = hashRetainLayout(layout, var->name, strlen(var->name) + 1);
+        layout = hashRetainLayout(layout, var->type, strlen(var->type) + 1);
+        layout = hashRetainLayout(layout, &size, sizeof(size));
+    }
+    retain_layout.store(layout, std::memory_order_release);
+
+    if (skipped > 0)
+    {
+        char log_msg[1000];
+        sprintf(log_msg, "Process image: %lu RETAIN variables don't fit on the %d bytes of the retain area and are not kept\n",
+                (unsigned long)skipped, RETAIN_MEMORY_SIZE);
+        openplc_log(log_msg);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Indexes the entries of the memory areas located by the program from the
+// presence bitmaps that glueVars fills, and the variables declared RETAIN.
+// Must be called after glueVars, with bufferLock held once the scan is
+// running
+//-----------------------------------------------------------------------------
+void buildImageRanges()
+{
+    static const IEC_BYTE *present[IMAGE_RANGE_AREAS] = { int_memory_present, dint_memory_present, lint_memory_present };
+
+    int next = 1 - ranges_index.load(std::memory_order_relaxed);
+    for (int area = 0; area < IMAGE_RANGE_AREAS; area++)
+    {
+        ImageRanges *ranges = &image_ranges[next][area];
+        ranges->count = 0;
+        ranges->used = 0;
+        for (uint32_t i = 0; i < BUFFER_SIZE; i++)
+        {
+            if (present[area][i / 8] == 0)
+            {
+                i |= 7;
+                continue;
+            }
+            if ((present[area][i / 8] & (1 << (i % 8))) == 0) continue;
+
+            ranges->used++;
+            if (ranges->count > 0)
+            {
+                ImageRange *last = &ranges->ranges[ranges->count - 1];
+                if (i - (last->first + last->count) <= IMAGE_RANGE_MERGE_GAP)
+                {
+                    last->count = i - last->first + 1;
+                    continue;
+                }
+            }
+            ranges->ranges[ranges->count].first = i;
+            ranges->ranges[ranges->count].count = 1;
+            ranges->count++;
+        }
+    }
+
+    buildRetainVariables();
+    ranges_index.store(next, std::memory_order_release);
+    ranges_generation++;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the located ranges of a memory area (PI_INT_MEMORY, PI_DINT_MEMORY
+// or PI_LINT_MEMORY), NULL for any other area
+//-----------------------------------------------------------------------------
+const ImageRanges *getImageRanges(int area)
+{
+    if (area < PI_INT_MEMORY || area > PI_LINT_MEMORY) return NULL;
+    return &image_ranges[ranges_index.load(std::memory_order_acquire)][area - PI_INT_MEMORY];
+}
+
+//-----------------------------------------------------------------------------
+// Returns the layout of the variables on the retain area, which changes with
+// any program that declares other RETAIN variables
+//-----------------------------------------------------------------------------
+uint32_t getRetainLayout()
+{
+    return retain_layout.load(std::memory_order_acquire);
+}
+
+//-----------------------------------------------------------------------------
+// Copies the values of the variables declared RETAIN to a retain area. Must
+// be called with bufferLock held
+//-----------------------------------------------------------------------------
+void copyRetainVariables(IEC_BYTE *retain_memory)
+{
+    for (size_t i = 0; i < retain_variables.size(); i++)
+    {
+        const RetainVariable *var = &retain_variables[i];
+        memcpy(retain_memory + var->offset, var->value, var->size);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Copies a retain area, laid out as getRetainLayout() says, back to the
+// variables declared RETAIN. Must be called with bufferLock held
+//-----------------------------------------------------------------------------
+void restoreRetainVariables(const IEC_BYTE *retain_memory)
+{
+    for (size_t i = 0; i < retain_variables.size(); i++)
+    {
+        const RetainVariable *var = &retain_variables[i];
+        memcpy(var->value, retain_memory + var->offset, var->size);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Returns a counter that changes every time a new snapshot is published. A
+// reader that sees version v is guaranteed to read snapshot v or a newer one
+//-----------------------------------------------------------------------------
+uint32_t getProcessImageVersion()
+{
+    return published_version.load(std::memory_order_acquire);
+}
+
+//-----------------------------------------------------------------------------
+// Blocks until the published version reaches the given one or timeout_ms
+// milliseconds have elapsed. Returns the current version, which the caller
+// compares with the one it asked for to tell a timeout apart
+//-----------------------------------------------------------------------------
+uint32_t waitProcessImage(uint32_t version, int timeout_ms)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_nsec -= 1000000000;
+        deadline.tv_sec++;
+    }
+
+    pthread_mutex_lock(&publishLock);
+    publish_waiters.fetch_add(1, std::memory_order_release);
+    uint32_t current = getProcessImageVersion();
+    while ((int32_t)(current - version) < 0)
+    {
+        if (pthread_cond_timedwait(&publishCond, &publishLock, &deadline) != 0)
+        {
+            current = getProcessImageVersion();
+            break;
+        }
+        current = getProcessImageVersion();
+    }
+    publish_waiters.fetch_sub(1, std::memory_order_relaxed);
+    pthread_mutex_unlock(&publishLock);
+
+    return current;
+}
+
+//-----------------------------------------------------------------------------
+// Fills changes with the blocks that changed after version since, up to
+// version until (normally the version field of the snapshot just read).
+// Returns false, with every block marked, when since is too old for the
+// history kept
+//-----------------------------------------------------------------------------
+bool getProcessImageChanges(uint32_t since, uint32_t until, ProcessImageChanges *changes)
+{
+    uint32_t span = until - since;
+    if (span < PI_CHANGE_HISTORY - 1)
+    {
+        memset(changes, 0, sizeof(*changes));
+        for (uint32_t v = since + 1; v != until + 1; v++)
+        {
+            const ProcessImageChanges *slot = &change_history[v % PI_CHANGE_HISTORY];
+            for (size_t w = 0; w < PI_CHANGE_WORDS; w++) changes->dirty[w] |= slot->dirty[w];
+        }
+
+        // The scan rewrites the slot of version v while it prepares version
+        // v + PI_CHANGE_HISTORY, check it didn't get there while reading
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if ((uint32_t)(getProcessImageVersion() - since) < PI_CHANGE_HISTORY - 1) return true;
+    }
+
+    memset(changes, 0xFF, sizeof(*changes));
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+// Returns true if any block holding the bytes [offset, offset + size) of
+// ProcessImageSnapshot is marked on changes
+//-----------------------------------------------------------------------------
+bool processImageChanged(const ProcessImageChanges *changes, size_t offset, size_t size)
+{
+    size_t last = (offset + size - 1) / PI_CHANGE_BLOCK;
+    for (size_t block = offset / PI_CHANGE_BLOCK; block <= last; block++)
+    {
+        if (changes->dirty[block / 64] & (1ULL << (block % 64))) return true;
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+// Starts a lock-free read of the published snapshot. The caller must copy
+// what it needs and then call endProcessImageRead() with the same sequence,
+// retrying the whole read if it returns false
+//-----------------------------------------------------------------------------
+const ProcessImageSnapshot *beginProcessImageRead(uint32_t *sequence)
+{
+    while (true)
+    {
+        const ProcessImageSnapshot *snap = &snapshots[published_index.load(std::memory_order_acquire)];
+        uint32_t seq = snap->sequence.load(std::memory_order_acquire);
+        if ((seq & 1) == 0)
+        {
+            *sequence = seq;
+            return snap;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Finishes a read started with beginProcessImageRead(). Returns false if the
+// scan thread rewrote the snapshot while it was being read
+//-----------------------------------------------------------------------------
+bool endProcessImageRead(const ProcessImageSnapshot *snap, uint32_t sequence)
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return snap->sequence.load(std::memory_order_relaxed) == sequence;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the size of the values of a run: bytes per variable, or 0 for the
+// bool areas, whose values are packed eight per byte
+//-----------------------------------------------------------------------------
+static int runWidth(uint8_t area)
+{
+    switch (area)
+    {
+        case PI_INT_INPUT:
+        case PI_INT_OUTPUT:
+        case PI_INT_MEMORY:
+            return 2;
+        case PI_DINT_MEMORY:
+            return 4;
+        case PI_LINT_MEMORY:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Returns the bytes the values of a run take on the queue
+//-----------------------------------------------------------------------------
+static int runSize(const ProcessImageRun *run)
+{
+    int width = runWidth(run->area);
+    return width > 0 ? run->count * width : (run->count + 7) / 8;
+}
+
+//-----------------------------------------------------------------------------
+// Appends a group of writes and runs to the write-intent queue. The group is
+// queued as a whole or not at all, and applied in order with everything else
+// on the queue. Returns 0 on success or -1 if the queue is full
+//-----------------------------------------------------------------------------
+int queueProcessImageBatch(const ProcessImageWrite *writes, int count, const ProcessImageRun *runs, int run_count)
+{
+    int data_size = 0;
+    for (int r = 0; r < run_count; r++) data_size += runSize(&runs[r]);
+
+    pthread_mutex_lock(&queueLock);
+    int *queue_count = &write_queue_count[active_queue];
+    int *data_length = &run_data_length[active_queue];
+    if (*queue_count + count + run_count > PI_QUEUE_SIZE || *data_length + data_size > PI_RUN_DATA_SIZE)
+    {
+        pthread_mutex_unlock(&queueLock);
+        return -1;
+    }
+
+    ProcessImageWrite *queue = write_queues[active_queue];
+    for (int r = 0; r < run_count; r++)
+    {
+        ProcessImageWrite *entry = &queue[(*queue_count)++];
+        entry->area = runs[r].area | PI_RUN;
+        entry->bit = 0;
+        entry->index = runs[r].index;
+        entry->mask = runs[r].count;
+        entry->value = *data_length;
+
+        int size = runSize(&runs[r]);
+        memcpy(&run_data[active_queue][*data_length], runs[r].data, size);
+        *data_length += size;
+    }
+
+    memcpy(&queue[*queue_count], writes, count * sizeof(ProcessImageWrite));
+    *queue_count += count;
+    pthread_mutex_unlock(&queueLock);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Appends a group of writes to the write-intent queue. The group is queued
+// as a whole or not at all. Returns 0 on success or -1 if the queue is full
+//-----------------------------------------------------------------------------
+int queueProcessImageWrites(const ProcessImageWrite *writes, int count)
+{
+    return queueProcessImageBatch(writes, count, NULL, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Queues a group of writes and waits until a scan applied all of them, for
+// up to timeout_ms milliseconds. A full queue is retried after every scan.
+// Returns 0 once the writes are applied, -1 if the queue stayed full or -2 if
+// they were not applied in time
+//-----------------------------------------------------------------------------
+int applyProcessImageWritesSync(const ProcessImageWrite *writes, int count, int timeout_ms)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_nsec -= 1000000000;
+        deadline.tv_sec++;
+    }
+
+    bool queued = false;
+    uint32_t ticket = 0;
+    while (true)
+    {
+        uint32_t version = getProcessImageVersion();
+        if (!queued)
+        {
+            pthread_mutex_lock(&queueLock);
+            int *queue_count = &write_queue_count[active_queue];
+            if (*queue_count + count <= PI_QUEUE_SIZE)
+            {
+                memcpy(&write_queues[active_queue][*queue_count], writes, count * sizeof(ProcessImageWrite));
+                *queue_count += count;
+                ticket = queue_generation + 1;
+                queued = true;
+            }
+            pthread_mutex_unlock(&queueLock);
+        }
+        if (queued && (int32_t)(applied_generation.load(std::memory_order_acquire) - ticket) >= 0) return 0;
+
+        // The scan publishes the image after it applied the writes
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long remaining_ms = (deadline.tv_sec - now.tv_sec) * 1000LL + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+        if (remaining_ms <= 0) return queued ? -2 : -1;
+        waitProcessImage(version + 1, (int)remaining_ms);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Applies a queued run. The values go straight to the images, where glueVars
+// points every buffer entry, byte-swapped from big-endian a whole run at a
+// time. Must be called with bufferLock held
+//-----------------------------------------------------------------------------
+static void applyRun(const ProcessImageWrite *w, const unsigned char *data)
+{
+    uint8_t area = w->area & ~PI_RUN;
+    int count = (int)w->mask;
+    int limit = (area == PI_BOOL_INPUT || area == PI_BOOL_OUTPUT) ? BUFFER_SIZE * 8 : BUFFER_SIZE;
+    if (w->index + count > limit) return;
+
+    switch (area)
+    {
+        case PI_BOOL_INPUT:
+        case PI_BOOL_OUTPUT:
+        {
+            IEC_BOOL *bits = (area == PI_BOOL_INPUT) ? &bool_input_image[0][0] : &bool_output_image[0][0];
+            for (int i = 0; i < count; i++) bits[w->index + i] = (data[i / 8] >> (i % 8)) & 1;
+            break;
+        }
+        case PI_INT_INPUT:
+        case PI_INT_OUTPUT:
+        case PI_INT_MEMORY:
+        {
+            IEC_UINT *words = (area == PI_INT_INPUT) ? int_input_image : (area == PI_INT_OUTPUT) ? int_output_image : int_memory_image;
+            memcpy(&words[w->index], data, count * sizeof(IEC_UINT));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            for (int i = 0; i < count; i++) words[w->index + i] = __builtin_bswap16(words[w->index + i]);
+#endif
+            break;
+        }
+        case PI_DINT_MEMORY:
+        {
+            memcpy(&dint_memory_image[w->index], data, count * sizeof(IEC_UDINT));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            for (int i = 0; i < count; i++) dint_memory_image[w->index + i] = __builtin_bswap32(dint_memory_image[w->index + i]);
+#endif
+            break;
+        }
+        case PI_LINT_MEMORY:
+        {
+            memcpy(&lint_memory_image[w->index], data, count * sizeof(IEC_ULINT));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            for (int i = 0; i < count; i++) lint_memory_image[w->index + i] = __builtin_bswap64(lint_memory_image[w->index + i]);
+#endif
+            break;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Applies a single queued write. Must be called with bufferLock held
+//-----------------------------------------------------------------------------
+static void applyWrite(const ProcessImageWrite *w)
+{
+    if (w->index >= BUFFER_SIZE) return;
+
+    switch (w->area)
+    {
+        case PI_BOOL_INPUT:
+            if (w->bit < 8 && bool_input[w->index][w->bit] != NULL) *bool_input[w->index][w->bit] = (w->value != 0);
+            break;
+        case PI_BOOL_OUTPUT:
+            if (w->bit < 8 && bool_output[w->index][w->bit] != NULL) *bool_output[w->index][w->bit] = (w->value != 0);
+            break;
+        case PI_INT_INPUT:
+            if (int_input[w->index] != NULL) *int_input[w->index] = (*int_input[w->index] & ~w->mask) | (w->value & w->mask);
+            break;
+        case PI_INT_OUTPUT:
+            if (int_output[w->index] != NULL) *int_output[w->index] = (*int_output[w->index] & ~w->mask) | (w->value & w->mask);
+            break;
+        case PI_INT_MEMORY:
+            if (int_memory[w->index] != NULL) *int_memory[w->index] = (*int_memory[w->index] & ~w->mask) | (w->value & w->mask);
+            break;
+        case PI_DINT_MEMORY:
+            if (dint_memory[w->index] != NULL) *dint_memory[w->index] = (*dint_memory[w->index] & ~w->mask) | (w->value & w->mask);
+            break;
+        case PI_LINT_MEMORY:
+            if (lint_memory[w->index] != NULL) *lint_memory[w->index] = (*lint_memory[w->index] & ~w->mask) | (w->value & w->mask);
+            break;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Applies all writes queued by the protocol servers since the last call. Must
+// be called by the scan thread with bufferLock held, before the program logic
+// executes. If a producer is holding the queue the writes are simply left for
+// the next cycle
+//-----------------------------------------------------------------------------
+void applyProcessImageWrites()
+{
+    ProcessImageWrite shared[PI_SHARED_WRITES];
+    int shared_count = takeSharedImageWrites(shared, PI_SHARED_WRITES);
+    for (int i = 0; i < shared_count; i++) applyWrite(&shared[i]);
+
+    if (pthread_mutex_trylock(&queueLock) != 0) return;
+    int retired = active_queue;
+    if (write_queue_count[retired] == 0)
+    {
+        pthread_mutex_unlock(&queueLock);
+        return;
+    }
+    active_queue = 1 - active_queue;
+    uint32_t generation = ++queue_generation;
+    pthread_mutex_unlock(&queueLock);
+
+    for (int i = 0; i < write_queue_count[retired]; i++)
+    {
+        const ProcessImageWrite *w = &write_queues[retired][i];
+        if (w->area & PI_RUN) applyRun(w, &run_data[retired][w->value]);
+        else applyWrite(w);
+    }
+    write_queue_count[retired] = 0;
+    run_data_length[retired] = 0;
+    applied_generation.store(generation, std::memory_order_release);
+}
+
+//-----------------------------------------------------------------------------
+// Backs the images with 2 MB pages, so a scan walks them with one TLB entry
+// instead of one per 4 KB page. Release builds (OPLC_HUGE_PAGES) lay the
+// images out on a section of whole 2 MB pages of their own (glueVars.cpp).
+// They are collapsed right away where the kernel can (MADV_COLLAPSE, Linux
+// 6.1), otherwise khugepaged does it later. Without transparent huge pages
+// the images stay on 4 KB pages
+//-----------------------------------------------------------------------------
+static void backWithHugePages()
+{
+#if defined(__linux__) && defined(OPLC_HUGE_PAGES)
+    char log_msg[1000];
+    uintptr_t start = (uintptr_t)bool_input_image;
+    uintptr_t end = ((uintptr_t)lreal_memory_image + sizeof(lreal_memory_image) + PI_HUGE_PAGE - 1) & ~(uintptr_t)(PI_HUGE_PAGE - 1);
+    if (start % PI_HUGE_PAGE != 0 || madvise((void *)start, end - start, MADV_HUGEPAGE) != 0)
+    {
+        sprintf(log_msg, "Process image: huge pages are not available\n");
+        openplc_log(log_msg);
+        return;
+    }
+
+    bool collapsed = madvise((void *)start, end - start, MADV_COLLAPSE) == 0;
+    sprintf(log_msg, "Process image on %lu huge pages%s\n", (unsigned long)((end - start) / PI_HUGE_PAGE), collapsed ? "" : ", collapsed later");
+    openplc_log(log_msg);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Initializes the publication signal and publishes the first snapshot so
+// that the protocol servers never read an empty image before the first scan
+// completes. The snapshots move to the shared image before anything reads
+// them
+//-----------------------------------------------------------------------------
+void initializeProcessImage()
+{
+    backWithHugePages();
+
+    ProcessImageSnapshot *shared = createSharedImage();
+    if (shared != NULL) snapshots = shared;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&publishCond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    lockBuffer();
+    publishProcessImage();
+    unlockBuffer();
+}
@@ -0,0 +1,514 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the parallel execution of the programs of a resource.
+// Programs compiled with iec2c -O t (scripts/parallel_programs) don't call
+// their programs one after the other: the resource run function hands a
+// table of them to __plc_run_programs(). The programs that programs.cfg lists
+// on the same parallel group write disjoint variables, so when they follow
+// each other on the table they are run at the same time, by the scan thread
+// and a pool of worker threads. The scan thread waits for all of them before
+// going on with the next program, so the outputs are only updated once every
+// program of the scan ran. The other programs run on the scan thread, in
+// order, as before.
+//
+// Nothing checks that the programs of a group really don't share what they
+// write, that is up to whoever lists them.
+//
+// The programs bound to an event on programs.cfg are left out of the scan
+// once the hardware layer watches the edges of their input (see
+// gpio_events.cpp). They run on the thread that saw the edge, holding
+// bufferLock. On a hardware layer without edge events they stay on the scan.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <atomic>
+
+#include "ladder.h"
+
+#define PROGRAM_CONFIG_FILE     "programs.cfg"
+#define PROGRAM_MAX             64      // programs of a resource
+#define PROGRAM_NAME_MAX        64
+#define PROGRAM_MAX_WORKERS     16
+#define PROGRAM_GROUP_EVENT     -2      // runs on its event, not on the scan
+#define EVENT_TASK_MAX          32
+
+struct ParallelProgram
+{
+    char name[PROGRAM_NAME_MAX];
+    int group;
+};
+
+// Programs listed on programs.cfg
+static ParallelProgram parallel_programs[PROGRAM_MAX];
+static int parallel_program_count = 0;
+static int worker_count = 0;
+
+// A program run on the edges of a digital input instead of on the scan
+struct EventTask
+{
+    char name[PROGRAM_NAME_MAX];
+    uint32_t input;         // %IX byte * 8 + bit
+    int edges;              // EVENT_EDGE_*
+    bool armed;             // the hardware layer watches the edges
+};
+
+// Event tasks listed on programs.cfg
+static EventTask event_tasks[EVENT_TASK_MAX];
+static int event_task_count = 0;
+static std::atomic<uint64_t> event_runs(0);
+static std::atomic<uint64_t> event_misses(0);
+
+// Settings of programs.cfg while it is read
+struct ProgramSettings
+{
+    int groups;
+    int largest_group;
+    int workers;
+};
+
+// Group of every program of the last table run, -1 for the ones that run
+// on the scan thread. Rebuilt when the table changes (online change)
+static const PlcResourceProgram *planned_table = NULL;
+static int planned_count = 0;
+static int planned_group[PROGRAM_MAX];
+static char planned_name[PROGRAM_MAX][PROGRAM_NAME_MAX];
+
+// Batch of programs being run in parallel. The batch, the generation and the
+// number of workers in it are changed under work_lock
+static pthread_mutex_t work_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t work_done = PTHREAD_COND_INITIALIZER;
+static const PlcResourceProgram *batch = NULL;
+static const char (*batch_names)[PROGRAM_NAME_MAX] = NULL;
+static int batch_count = 0;
+static unsigned long batch_generation = 0;
+static int batch_workers = 0;
+static std::atomic<int> batch_next(0);
+static std::atomic<int> batch_pending(0);
+
+//-----------------------------------------------------------------------------
+// Runs a program, recording it on the event trace while it runs
+//-----------------------------------------------------------------------------
+static void runProgram(const PlcResourceProgram *program, const char *name)
+{
+    if (!__atomic_load_n(&event_tracing, __ATOMIC_RELAXED))
+    {
+        program->run();
+        return;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    program->run();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    TRACE_SPAN(TRACE_PROGRAM, 0, 0, name, &start, &end);
+}
+
+//-----------------------------------------------------------------------------
+// Runs the programs of the current batch that no other thread took yet
+//-----------------------------------------------------------------------------
+static void runBatchPrograms(const PlcResourceProgram *programs, const char (*names)[PROGRAM_NAME_MAX], int count)
+{
+    int i;
+    while ((i = batch_next.fetch_add(1, std::memory_order_relaxed)) < count)
+    {
+        runProgram(&programs[i], names[i]);
+        if (batch_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            pthread_mutex_lock(&work_lock);
+            pthread_cond_broadcast(&work_done);
+            pthread_mutex_unlock(&work_lock);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Thread of the worker pool. Joins every batch posted by the scan thread
+//-----------------------------------------------------------------------------
+static void *programWorker(void *arg)
+{
+    setThreadClass(THREAD_CLASS_PROGRAM, "program_worker");
+    armHeapCheck(getThreadHeapCheck(THREAD_CLASS_PROGRAM));
+
+    unsigned long seen = 0;
+    while (run_openplc)
+    {
+        pthread_mutex_lock(&work_lock);
+        while (batch_generation == seen) pthread_cond_wait(&work_ready, &work_lock);
+        seen = batch_generation;
+        const PlcResourceProgram *programs = batch;
+        const char (*names)[PROGRAM_NAME_MAX] = batch_names;
+        int count = batch_count;
+        batch_workers++;
+        pthread_mutex_unlock(&work_lock);
+
+        runBatchPrograms(programs, names, count);
+
+        pthread_mutex_lock(&work_lock);
+        if (--batch_workers == 0) pthread_cond_broadcast(&work_done);
+        pthread_mutex_unlock(&work_lock);
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Runs programs at the same time on the scan thread and the workers, and
+// returns once all of them ran. A worker that wakes up late joins a batch
+// that is over, so a new batch is only posted once it left
+//-----------------------------------------------------------------------------
+static void runParallelPrograms(const PlcResourceProgram *programs, const char (*names)[PROGRAM_NAME_MAX], int count)
+{
+    pthread_mutex_lock(&work_lock);
+    while (batch_workers > 0) pthread_cond_wait(&work_done, &work_lock);
+    batch = programs;
+    batch_names = names;
+    batch_count = count;
+    batch_next.store(0, std::memory_order_relaxed);
+    batch_pending.store(count, std::memory_order_relaxed);
+    batch_generation++;
+    pthread_cond_broadcast(&work_ready);
+    pthread_mutex_unlock(&work_lock);
+
+    runBatchPrograms(programs, names, count);
+
+    pthread_mutex_lock(&work_lock);
+    while (batch_pending.load(std::memory_order_acquire) > 0 || batch_workers > 0)
+    {
+        pthread_cond_wait(&work_done, &work_lock);
+    }
+    pthread_mutex_unlock(&work_lock);
+}
+
+//-----------------------------------------------------------------------------
+// Finds the parallel group of every program of a table
+//-----------------------------------------------------------------------------
+static void planPrograms(const PlcResourceProgram *programs, int count)
+{
+    char log_msg[1000];
+
+    planned_table = programs;
+    planned_count = count;
+    for (int i = 0; i < count; i++)
+    {
+        planned_group[i] = -1;
+        snprintf(planned_name[i], PROGRAM_NAME_MAX, "%s", programs[i].name);
+        for (int p = 0; p < parallel_program_count; p++)
+        {
+            if (strcasecmp(parallel_programs[p].name, programs[i].name) == 0)
+            {
+                planned_group[i] = parallel_programs[p].group;
+            }
+        }
+        for (int e = 0; e < event_task_count; e++)
+        {
+            if (event_tasks[e].armed && strcasecmp(event_tasks[e].name, programs[i].name) == 0) planned_group[i] = PROGRAM_GROUP_EVENT;
+        }
+    }
+
+    for (int p = 0; p < parallel_program_count; p++)
+    {
+        bool found = false;
+        for (int i = 0; i < count; i++)
+        {
+            if (strcasecmp(parallel_programs[p].name, programs[i].name) == 0) found = true;
+        }
+        if (!found)
+        {
+            sprintf(log_msg, "Programs config: the resource has no program %s\n", parallel_programs[p].name);
+            openplc_log(log_msg);
+        }
+    }
+
+    for (int e = 0; e < event_task_count; e++)
+    {
+        bool found = false;
+        for (int i = 0; i < count; i++)
+        {
+            if (strcasecmp(event_tasks[e].name, programs[i].name) == 0) found = true;
+        }
+        if (!found)
+        {
+            sprintf(log_msg, "Programs config: the resource has no program %s for the event task\n", event_tasks[e].name);
+            openplc_log(log_msg);
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        int last = i;
+        while (planned_group[i] >= 0 && last + 1 < count && planned_group[last + 1] == planned_group[i]) last++;
+        if (last > i)
+        {
+            sprintf(log_msg, "Programs %s to %s run in parallel\n", programs[i].name, programs[last].name);
+            openplc_log(log_msg);
+        }
+        i = last;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Runs the programs of a resource, called by the resource run function of
+// the programs compiled with iec2c -O t. The programs of a parallel group
+// that follow each other on the table run together
+//-----------------------------------------------------------------------------
+extern "C" void __plc_run_programs(const PlcResourceProgram *programs, int count)
+{
+    if (count > PROGRAM_MAX || (worker_count == 0 && event_task_count == 0))
+    {
+        for (int i = 0; i < count; i++) programs[i].run();
+        return;
+    }
+
+    if (programs != planned_table || count != planned_count) planPrograms(programs, count);
+
+    for (int i = 0; i < count; i++)
+    {
+        if (planned_group[i] == PROGRAM_GROUP_EVENT) continue;
+
+        int last = i;
+        while (planned_group[i] >= 0 && last + 1 < count && planned_group[last + 1] == planned_group[i]) last++;
+
+        if (last == i) runProgram(&programs[i], planned_name[i]);
+        else runParallelPrograms(&programs[i], &planned_name[i], last - i + 1);
+        i = last;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Returns the edges (EVENT_EDGE_*) of a digital input that run an event task,
+// 0 if none does. input is the byte of %IX * 8 + its bit
+//-----------------------------------------------------------------------------
+int getEventTaskEdges(uint32_t input)
+{
+    int edges = 0;
+    for (int e = 0; e < event_task_count; e++)
+    {
+        if (event_tasks[e].input == input) edges |= event_tasks[e].edges;
+    }
+
+    return edges;
+}
+
+//-----------------------------------------------------------------------------
+// Takes the event tasks of a digital input out of the scan, called by the
+// hardware layer once it watches the edges of the input
+//-----------------------------------------------------------------------------
+void armEventTasks(uint32_t input)
+{
+    for (int e = 0; e < event_task_count; e++)
+    {
+        if (event_tasks[e].input == input) event_tasks[e].armed = true;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Runs the event tasks of an edge of a digital input, called by the thread
+// of the hardware layer that saw it. The new level is stored on the input
+// before the programs run, the time of the edge (CLOCK_MONOTONIC) goes to
+// the special function registers and the outputs are written right after
+//-----------------------------------------------------------------------------
+void runEventTasks(uint32_t input, bool level, const struct timespec *timestamp)
+{
+    int edge = level ? EVENT_EDGE_RISING : EVENT_EDGE_FALLING;
+    bool ran = false;
+
+    struct timespec mono, real;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+    int64_t edge_ns = (int64_t)timestamp->tv_sec * 1000000000LL + timestamp->tv_nsec;
+    int64_t mono_ns = (int64_t)mono.tv_sec * 1000000000LL + mono.tv_nsec;
+    int64_t real_ns = (int64_t)real.tv_sec * 1000000000LL + real.tv_nsec;
+
+    lockBuffer();
+    if (input / 8 < BUFFER_SIZE && bool_input[input / 8][input % 8] != NULL) *bool_input[input / 8][input % 8] = level;
+
+    // The table is only known once the scan ran the resource, and the
+    // event can't run while an online change is swapping the program
+    const PlcResourceProgram *programs = planned_table;
+    for (int e = 0; e < event_task_count; e++)
+    {
+        if (event_tasks[e].input != input || !(event_tasks[e].edges & edge)) continue;
+
+        int i = 0;
+        while (i < planned_count && strcasecmp(planned_name[i], event_tasks[e].name) != 0) i++;
+        if (programs == NULL || i == planned_count)
+        {
+            event_misses.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        // Time of the edge, UTC in microseconds [%ML1033] and the delay
+        // from the edge to the program, in microseconds [%ML1034]
+        if (special_functions[9] != NULL) *special_functions[9] = (edge_ns + real_ns - mono_ns) / 1000;
+        if (special_functions[10] != NULL) *special_functions[10] = (mono_ns - edge_ns) / 1000;
+
+        runProgram(&programs[i], planned_name[i]);
+        event_runs.fetch_add(1, std::memory_order_relaxed);
+        ran = true;
+    }
+    unlockBuffer();
+
+    if (ran) updateBuffersOut();
+}
+
+//-----------------------------------------------------------------------------
+// Writes a text summary of the event tasks. Returns the number of
+// characters written
+//-----------------------------------------------------------------------------
+int getEventTaskStats(char *buffer, size_t buffer_size)
+{
+    return snprintf(buffer, buffer_size, "event_tasks: %d\nevent_runs: %llu\nevent_misses: %llu\n", event_task_count,
+                    (unsigned long long)event_runs.load(std::memory_order_relaxed),
+                    (unsigned long long)event_misses.load(std::memory_order_relaxed));
+}
+
+//-----------------------------------------------------------------------------
+// Parses the value of an event line, PROGRAM, %IXn.m, rising|falling|both
+//-----------------------------------------------------------------------------
+static bool parseEventTask(char *value, EventTask *task)
+{
+    char *name = strtok(value, ", \t");
+    char *location = strtok(NULL, ", \t");
+    char *edge = strtok(NULL, ", \t");
+    if (name == NULL || location == NULL) return false;
+
+    char area, size;
+    uint32_t position;
+    if (!parseTagLocation(location, &area, &size, &position) || area != 'I' || size != 'X') return false;
+
+    if (edge == NULL || strcasecmp(edge, "rising") == 0) task->edges = EVENT_EDGE_RISING;
+    else if (strcasecmp(edge, "falling") == 0) task->edges = EVENT_EDGE_FALLING;
+    else if (strcasecmp(edge, "both") == 0) task->edges = EVENT_EDGE_BOTH;
+    else return false;
+
+    snprintf(task->name, sizeof(task->name), "%s", name);
+    task->input = position;
+    task->armed = false;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Applies one setting of programs.cfg
+//-----------------------------------------------------------------------------
+static void applyProgramSetting(const char *section, char *key, char *value, void *context)
+{
+    char log_msg[1000];
+    ProgramSettings *settings = (ProgramSettings *)context;
+    if (key == NULL) return;
+
+    if (strcmp(key, "workers") == 0)
+    {
+        settings->workers = atoi(value);
+    }
+    else if (strcmp(key, "parallel") == 0)
+    {
+        int members = 0;
+        for (char *name = strtok(value, ", \t"); name != NULL; name = strtok(NULL, ", \t"))
+        {
+            if (parallel_program_count >= PROGRAM_MAX)
+            {
+                sprintf(log_msg, "Programs config: too many programs, %s is left out\n", name);
+                openplc_log(log_msg);
+                continue;
+            }
+            ParallelProgram *program = &parallel_programs[parallel_program_count++];
+            snprintf(program->name, sizeof(program->name), "%s", name);
+            program->group = settings->groups;
+            members++;
+        }
+        if (members > settings->largest_group) settings->largest_group = members;
+        settings->groups++;
+    }
+    else if (strcmp(key, "event") == 0)
+    {
+        if (event_task_count >= EVENT_TASK_MAX)
+        {
+            sprintf(log_msg, "Programs config: too many event tasks, '%s' is left out\n", value);
+            openplc_log(log_msg);
+        }
+        else if (!parseEventTask(value, &event_tasks[event_task_count]))
+        {
+            sprintf(log_msg, "Programs config: invalid event task '%s'\n", value);
+            openplc_log(log_msg);
+        }
+        else
+        {
+            event_task_count++;
+        }
+    }
+    else
+    {
+        sprintf(log_msg, "Programs config: unknown setting '%s'\n", key);
+        openplc_log(log_msg);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Reads programs.cfg and starts the worker pool if it lists parallel groups:
+//     workers = 2              worker threads, besides the scan thread
+//                              (default: the largest group less one)
+//     parallel = CELL1, CELL2  programs that may run at the same time
+//     event = COUNT, %IX0.3, rising
+//                              program run on the edges of an input
+//                              instead of on the scan
+// A missing file runs every program on the scan thread
+//-----------------------------------------------------------------------------
+void startProgramWorkers()
+{
+    char log_msg[1000];
+    ProgramSettings settings = {0, 0, -1};
+    if (!parseSettingsFile(PROGRAM_CONFIG_FILE, applyProgramSetting, &settings)) return;
+    int groups = settings.groups;
+    int largest_group = settings.largest_group;
+    int workers = settings.workers;
+
+    if (event_task_count > 0)
+    {
+        sprintf(log_msg, "Running %d programs on input events\n", event_task_count);
+        openplc_log(log_msg);
+    }
+
+    if (largest_group < 2) return;
+    if (workers < 0) workers = largest_group - 1;
+    if (workers > PROGRAM_MAX_WORKERS) workers = PROGRAM_MAX_WORKERS;
+
+    for (int i = 0; i < workers; i++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, programWorker, NULL) != 0)
+        {
+            sprintf(log_msg, "Programs config: failed to start a program worker\n");
+            openplc_log(log_msg);
+            break;
+        }
+        pthread_detach(thread);
+        worker_count++;
+    }
+
+    sprintf(log_msg, "Running %d parallel program groups on %d workers\n", groups, worker_count);
+    openplc_log(log_msg);
+}
@@ -1,7 +1,18 @@
-import threading
+"""OpenPLC Python SubModule (PSM) runtime interface.
+
+The runtime shares its I/O with the PSM through a process image in shared
+memory (/dev/shm/openplc_psm). The PSM writes the inputs and reads the
+outputs; each side updates its half under a sequence counter, and the
+runtime bumps a scan counter after every PLC cycle. wait_scan() sleeps on
+that counter, so a PSM loop can run once per scan instead of on a timer.
+"""
+
+import ctypes
+import mmap
+import os
+import platform
+import struct
 import time
-from pymodbus.server.sync import ModbusTcpServer
-from pymodbus.datastore import ModbusSequentialDataBlock, ModbusSlaveContext, ModbusServerContext
 from enum import Enum
 
 class var_type(Enum):
@@ -10,14 +21,39 @@ class var_type(Enum):
     DIG_OUT = 2
     ANA_INP = 3
     ANA_OUT = 4
-    
-KILL_SIGNAL = 127
 
-#Initialize points database
-d_inputs = ModbusSequentialDataBlock(0, [0]*400)
-d_outputs = ModbusSequentialDataBlock(0, [0]*400)
-a_inputs = ModbusSequentialDataBlock(0, [0]*50)
-a_outputs = ModbusSequentialDataBlock(0, [0]*51)
+IMAGE_PATH = '/dev/shm/openplc_psm'
+IMAGE_MAGIC = 0x494d5350
+IMAGE_VERSION = 1
+
+DIGITAL_POINTS = 400
+ANALOG_POINTS = 50
+
+OFFSET_SCAN = 8
+OFFSET_QUIT = 12
+OFFSET_IN_SEQUENCE = 16
+OFFSET_OUT_SEQUENCE = 20
+OFFSET_DIG_IN = 32
+OFFSET_DIG_OUT = OFFSET_DIG_IN + DIGITAL_POINTS
+OFFSET_ANA_IN = OFFSET_DIG_OUT + DIGITAL_POINTS
+OFFSET_ANA_OUT = OFFSET_ANA_IN + 2 * ANALOG_POINTS
+IMAGE_SIZE = OFFSET_ANA_OUT + 2 * ANALOG_POINTS
+
+FUTEX_WAIT = 0
+SYS_FUTEX = {'x86_64': 202, 'aarch64': 98, 'riscv64': 98,
+             'i386': 240, 'i686': 240, 'armv7l': 240, 'armv6l': 240}.get(platform.machine())
+
+_libc = ctypes.CDLL(None, use_errno=True)
+
+_image = None
+_words = None
+_scan = None
+_last_scan = 0
+
+
+class _Timespec(ctypes.Structure):
+    _fields_ = [('tv_sec', ctypes.c_long), ('tv_nsec', ctypes.c_long)]
+
 
 def extract_variable(variable_name):
     #init variables
@@ -74,23 +110,37 @@ def extract_variable(variable_name):
         io_type = var_type.NONE
 
     return io_type, address
-    
+
+def _read_outputs(offset, fmt):
+    #read a value written by the runtime, retrying while a scan is publishing
+    while True:
+        seq = _words[OFFSET_OUT_SEQUENCE // 4]
+        value = struct.unpack_from(fmt, _image, offset)[0]
+        if not (seq & 1) and seq == _words[OFFSET_OUT_SEQUENCE // 4]:
+            return value
+
+def _write_inputs(offset, fmt, value):
+    seq = _words[OFFSET_IN_SEQUENCE // 4]
+    _words[OFFSET_IN_SEQUENCE // 4] = (seq + 1) & 0xFFFFFFFF
+    struct.pack_into(fmt, _image, offset, value)
+    _words[OFFSET_IN_SEQUENCE // 4] = (seq + 2) & 0xFFFFFFFF
+
 def get_var(variable_name):
     var = extract_variable(variable_name)
     io_type = var[0]
     address = var[1]
 
-    if (io_type == var_type.DIG_INP):
-        return d_inputs.getValues(address)[0]
+    if (io_type == var_type.DIG_INP and address < DIGITAL_POINTS):
+        return _image[OFFSET_DIG_IN + address] != 0
 
-    elif (io_type == var_type.DIG_OUT):
-        return d_outputs.getValues(address)[0]
+    elif (io_type == var_type.DIG_OUT and address < DIGITAL_POINTS):
+        return _read_outputs(OFFSET_DIG_OUT + address, '<B') != 0
 
-    elif (io_type == var_type.ANA_INP):
-        return a_inputs.getValues(address)[0]
+    elif (io_type == var_type.ANA_INP and address < ANALOG_POINTS):
+        return struct.unpack_from('<H', _image, OFFSET_ANA_IN + 2 * address)[0]
 
-    elif (io_type == var_type.ANA_OUT):
-        return a_outputs.getValues(address)[0]
+    elif (io_type == var_type.ANA_OUT and address < ANALOG_POINTS):
+        return _read_outputs(OFFSET_ANA_OUT + 2 * address, '<H')
 
     else:
         return 0
@@ -101,55 +151,70 @@ def set_var(variable_name, value):
     io_type = var[0]
     address = var[1]
 
-    if (io_type == var_type.DIG_INP):
-        return d_inputs.setValues(address, value)
-
-    elif (io_type == var_type.DIG_OUT):
-        return d_outputs.setValues(address, value)
-
-    elif (io_type == var_type.ANA_INP):
-        return a_inputs.setValues(address, value)
+    if (io_type == var_type.DIG_INP and address < DIGITAL_POINTS):
+        _write_inputs(OFFSET_DIG_IN + address, '<B', 1 if value else 0)
 
-    elif (io_type == var_type.ANA_OUT):
-        return a_outputs.setValues(address, value)
+    elif (io_type == var_type.ANA_INP and address < ANALOG_POINTS):
+        _write_inputs(OFFSET_ANA_IN + 2 * address, '<H', int(value) & 0xFFFF)
 
-    else:
-        return 0
+    #outputs are owned by the runtime and rewritten every scan
+    return 0
 
 def should_quit():
-    if a_outputs.getValues(50)[0] == KILL_SIGNAL:
-        return True
-    return False
-
-global mtcp_server
-
-def run_server():
-    global mtcp_server
-    store = ModbusSlaveContext(di=d_inputs, co=d_outputs, ir=a_inputs, hr=a_outputs, zero_mode=True)
-    context = ModbusServerContext(slaves=store, single=True)
-
-    #run server
-    mtcp_server = ModbusTcpServer(context, address=("localhost", 2605))
-    mtcp_server.serve_forever()
-    
-#def monitor_server():
-#    global server_running
-#    while(server_running):
-#        if a_outputs.getValues(50)[0] == KILL_SIGNAL:
-#            self.stop()
-#            server_running = False
-#        time.sleep(1)
-    
-server_thread = threading.Thread(target=run_server)
-#monitor_thread = threading.Thread(target=monitor_server)
-
-def start():
-    global server_running
-    #server_running = True
-    server_thread.start()
-    #monitor_thread.start()
+    return _words[OFFSET_QUIT // 4] != 0
+
+def wait_scan(timeout=None):
+    """Sleeps until the runtime completes a scan since the last call.
+    Returns False on timeout"""
+    global _last_scan
+    deadline = None if timeout is None else time.monotonic() + timeout
+    while _scan.value == _last_scan and not should_quit():
+        remaining = None
+        if deadline is not None:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                return False
+        if SYS_FUTEX is None:
+            time.sleep(0.001)
+            continue
+        ts = None
+        if remaining is not None:
+            ts = ctypes.byref(_Timespec(int(remaining), int((remaining % 1) * 1e9)))
+        _libc.syscall(SYS_FUTEX, ctypes.byref(_scan), FUTEX_WAIT, _last_scan, ts, None, 0)
+    _last_scan = _scan.value
+    return True
+
+def start(timeout=10.0):
+    #attach to the process image created by the runtime
+    global _image, _words, _scan, _last_scan
+    deadline = time.monotonic() + timeout
+    while True:
+        try:
+            fd = os.open(IMAGE_PATH, os.O_RDWR)
+            try:
+                _image = mmap.mmap(fd, IMAGE_SIZE)
+            finally:
+                os.close(fd)
+            magic, version = struct.unpack_from('<II', _image, 0)
+            if magic == IMAGE_MAGIC:
+                break
+            _image.close()
+        except (OSError, ValueError):
+            pass
+        if time.monotonic() > deadline:
+            raise RuntimeError('No OpenPLC process image at ' + IMAGE_PATH)
+        time.sleep(0.01)
+    if version != IMAGE_VERSION:
+        raise RuntimeError('Unsupported process image version %d' % version)
+
+    _words = memoryview(_image)[:OFFSET_DIG_IN].cast('I')
+    _scan = ctypes.c_uint32.from_buffer(_image, OFFSET_SCAN)
+    _last_scan = _scan.value
 
 def stop():
-    mtcp_server.server_close()
-    mtcp_server.shutdown()
-    
+    global _image, _words, _scan
+    _words.release()
+    _words = None
+    _scan = None
+    _image.close()
+    _image = None
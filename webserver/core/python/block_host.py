@@ -0,0 +1,93 @@
+"""Shared interpreter for the OpenPLC Python function blocks.
+
+The runtime starts this script once and sends one line per block on stdin:
+
+    load <slot> <shm name> <script path>
+
+Every block script runs on its own thread of this interpreter, so modules
+are imported once and the interpreter memory is shared. Blocks that serve
+their requests through openplc_block are dispatched from a single thread
+waiting on the host channel: all the blocks requested on a scan are run
+and completed in one batch.
+"""
+
+import builtins
+import hashlib
+import os
+import sys
+import threading
+import traceback
+
+import openplc_block
+
+
+class BlockHost:
+    def __init__(self, host_name):
+        self.channel = openplc_block.BlockChannel(host_name)
+        self.slots = {}
+        self.handlers = {}
+        self.lock = threading.Lock()
+        self.code_cache = {}
+
+    def register(self, index, handler):
+        with self.lock:
+            self.handlers[index] = handler
+
+    def dispatch(self):
+        while True:
+            with self.lock:
+                handlers = dict(self.handlers)
+            # Only wait on the slots with a handler, the scripts that wait on
+            # their own slot are woken by the same doorbell
+            done = self.channel.wait(timeout=1.0, slots=list(handlers))
+            for index in done:
+                try:
+                    handlers[index](index)
+                except Exception:
+                    traceback.print_exc()
+            if done:
+                self.channel.complete(*done)
+
+    def compile_script(self, path):
+        with open(path, 'rb') as f:
+            source = f.read()
+        key = hashlib.sha1(source).hexdigest()
+        code = self.code_cache.get(key)
+        if code is None:
+            code = compile(source, path, 'exec')
+            self.code_cache[key] = code
+        return code
+
+    def run_block(self, shm_name, path):
+        try:
+            code = self.compile_script(path)
+            namespace = {'__name__': '__main__', '__file__': path, '__builtins__': builtins}
+            exec(code, namespace)
+        except SystemExit:
+            pass
+        except Exception:
+            traceback.print_exc()
+        print('Block %s (%s) finished' % (shm_name, path))
+
+    def load(self, index, shm_name, path):
+        self.slots[shm_name] = index
+        thread = threading.Thread(target=self.run_block, args=(shm_name, path), name=shm_name, daemon=True)
+        thread.start()
+
+
+def main():
+    host = BlockHost(sys.argv[1])
+    openplc_block._host = host
+    threading.Thread(target=host.dispatch, name='dispatcher', daemon=True).start()
+
+    for line in sys.stdin:
+        fields = line.rstrip('\n').split(' ', 3)
+        if len(fields) == 4 and fields[0] == 'load':
+            host.load(int(fields[1]), fields[2], fields[3])
+
+    # The runtime closed the command channel, take the blocks down with it
+    os._exit(0)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,167 @@
+"""Script side of the OpenPLC Python function block channel.
+
+The runtime creates a control region (<shm name>_ctl) next to the _in and
+_out regions of every Python block. Each block has a slot on it with two
+counters: the runtime bumps `request` once the inputs are ready, the script
+sets `response` to the same value once the outputs are written. Neither
+side touches a data region while the other one owns it, and both sleep on
+futexes (the channel doorbell and completion words) instead of polling.
+
+Typical use from a block script:
+
+    channel = openplc_block.BlockChannel(shm_name)
+    shm_in = openplc_block.open_region(shm_name, '_in')
+    shm_out = openplc_block.open_region(shm_name, '_out')
+    channel.serve(lambda slot: compute(shm_in, shm_out))
+
+When the script runs inside the shared block host (block_host.py), the
+same calls bind to the block's slot on the host channel, and serve() hands
+the handler to the host, which runs all the blocks requested on a scan
+in one batch.
+"""
+
+import ctypes
+import mmap
+import os
+import platform
+import struct
+import threading
+import time
+
+CHANNEL_MAGIC = 0x4b4c4250
+CHANNEL_VERSION = 1
+HEADER_SIZE = 64
+SLOT_SIZE = 64
+MAX_SLOTS = 64
+CHANNEL_SIZE = HEADER_SIZE + SLOT_SIZE * MAX_SLOTS
+
+OFFSET_SLOT_COUNT = 8
+OFFSET_DOORBELL = 16
+OFFSET_COMPLETION = 20
+
+FUTEX_WAIT = 0
+FUTEX_WAKE = 1
+SYS_FUTEX = {'x86_64': 202, 'aarch64': 98, 'riscv64': 98,
+             'i386': 240, 'i686': 240, 'armv7l': 240, 'armv6l': 240}.get(platform.machine())
+
+_libc = ctypes.CDLL(None, use_errno=True)
+
+# Set by block_host.py when the blocks run on the shared interpreter
+_host = None
+
+
+class _Timespec(ctypes.Structure):
+    _fields_ = [('tv_sec', ctypes.c_long), ('tv_nsec', ctypes.c_long)]
+
+
+def _shm_path(shm_name, suffix):
+    return '/dev/shm/' + shm_name.lstrip('/') + suffix
+
+
+def open_region(shm_name, suffix, size=0):
+    """Maps one of the regions of a block (suffix is '_in', '_out' or '_ctl')"""
+    fd = os.open(_shm_path(shm_name, suffix), os.O_RDWR)
+    try:
+        return mmap.mmap(fd, size or os.fstat(fd).st_size)
+    finally:
+        os.close(fd)
+
+
+class BlockChannel:
+    def __init__(self, shm_name, timeout=10.0):
+        self._own = None
+        if _host is not None and shm_name in _host.slots:
+            # Hosted block, use its slot on the host channel
+            host_channel = _host.channel
+            self._mm = host_channel._mm
+            self._words = host_channel._words
+            self._doorbell = host_channel._doorbell
+            self._completion = host_channel._completion
+            self._own = [_host.slots[shm_name]]
+            return
+
+        deadline = time.monotonic() + timeout
+        while True:
+            try:
+                self._mm = open_region(shm_name, '_ctl', CHANNEL_SIZE)
+                magic, version = struct.unpack_from('<II', self._mm, 0)
+                if magic == CHANNEL_MAGIC:
+                    break
+                self._mm.close()
+            except (OSError, ValueError):
+                pass
+            if time.monotonic() > deadline:
+                raise RuntimeError('No control region for ' + shm_name)
+            time.sleep(0.01)
+        if version != CHANNEL_VERSION:
+            raise RuntimeError('Unsupported channel version %d' % version)
+
+        self._words = memoryview(self._mm).cast('I')
+        self._doorbell = ctypes.c_uint32.from_buffer(self._mm, OFFSET_DOORBELL)
+        self._completion = ctypes.c_uint32.from_buffer(self._mm, OFFSET_COMPLETION)
+
+    def slot_count(self):
+        return self._words[OFFSET_SLOT_COUNT // 4]
+
+    def slot_info(self, index):
+        """Returns (shm name, input size, output size) of a slot"""
+        base = HEADER_SIZE + index * SLOT_SIZE
+        in_size, out_size = struct.unpack_from('<II', self._mm, base + 8)
+        name = bytes(self._mm[base + 16:base + 64]).split(b'\0', 1)[0].decode()
+        return name, in_size, out_size
+
+    def _request(self, index):
+        return self._words[(HEADER_SIZE + index * SLOT_SIZE) // 4]
+
+    def _response(self, index):
+        return self._words[(HEADER_SIZE + index * SLOT_SIZE) // 4 + 1]
+
+    def _futex(self, word, op, value, timeout):
+        if SYS_FUTEX is None:
+            # Unknown architecture, fall back to a short sleep
+            if op == FUTEX_WAIT:
+                time.sleep(0.001)
+            return
+        ts = None
+        if timeout is not None:
+            ts = ctypes.byref(_Timespec(int(timeout), int((timeout % 1) * 1e9)))
+        _libc.syscall(SYS_FUTEX, ctypes.byref(word), op, value, ts, None, 0)
+
+    def pending(self, slots=None):
+        """Returns the slots (of the given ones) with a request waiting for its response"""
+        if slots is None:
+            slots = self._own if self._own is not None else range(self.slot_count())
+        return [i for i in slots if self._request(i) != self._response(i)]
+
+    def wait(self, timeout=None, slots=None):
+        """Sleeps until at least one slot has a request, returns the pending slots"""
+        deadline = None if timeout is None else time.monotonic() + timeout
+        while True:
+            doorbell = self._doorbell.value
+            pending = self.pending(slots)
+            if pending:
+                return pending
+            remaining = None
+            if deadline is not None:
+                remaining = deadline - time.monotonic()
+                if remaining <= 0:
+                    return []
+            self._futex(self._doorbell, FUTEX_WAIT, doorbell, remaining)
+
+    def complete(self, *indexes):
+        """Hands the output regions of the slots back to the runtime"""
+        for index in indexes:
+            self._words[(HEADER_SIZE + index * SLOT_SIZE) // 4 + 1] = self._request(index)
+        self._completion.value = (self._completion.value + 1) & 0xFFFFFFFF
+        self._futex(self._completion, FUTEX_WAKE, 0x7FFFFFFF, None)
+
+    def serve(self, handler):
+        """Calls handler(slot) for every request, forever"""
+        if self._own is not None:
+            for index in self._own:
+                _host.register(index, handler)
+            threading.Event().wait()
+        while True:
+            for index in self.wait():
+                handler(index)
+                self.complete(index)
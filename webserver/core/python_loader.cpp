@@ -18,6 +18,19 @@
 //
 // This file is responsible for loading function blocks written in Python
 // Thiago Alves, Ago 2025
+//
+// Every block gets a control region (<shm name>_ctl) next to its input and
+// output regions. The runtime and the script hand the data regions back and
+// forth through per-block request/response counters on it: the runtime only
+// writes shm_in and reads shm_out while no request is pending, the script
+// only touches them while one is. Both sides sleep on futexes instead of
+// polling (see core/python/openplc_block.py for the script side).
+//
+// Blocks are hosted by a single long-lived interpreter (block_host.py) that
+// runs every block script on its own thread. All those blocks share one
+// control region, so the host serves the blocks requested on a scan with a
+// single wakeup. If the host can't be started, or it is full, a block falls
+// back to its own interpreter and control region.
 //-----------------------------------------------------------------------------
 
 #include <stdio.h>
@@ -29,12 +42,93 @@
 #include <errno.h>
 #include <sys/mman.h>
 #include <fcntl.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include <atomic>
 
 
 #include "ladder.h"
 
+#define PY_CHANNEL_MAGIC        0x4b4c4250 // "PBLK"
+#define PY_CHANNEL_VERSION      1
+#define PY_MAX_SLOTS            64
+#define PY_MAX_BLOCKS           256
+
+//-----------------------------------------------------------------------------
+// Layout of the control region. A channel can carry several blocks (slots),
+// all served by the process waiting on its doorbell
+//-----------------------------------------------------------------------------
+struct PythonBlockSlot
+{
+    std::atomic<uint32_t> request;      // bumped once shm_in is ready
+    std::atomic<uint32_t> response;     // set to request once shm_out is ready
+    uint32_t in_size;
+    uint32_t out_size;
+    char shm_name[48];                  // base name of the data regions
+};
+
+struct PythonBlockChannel
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t reserved;
+    std::atomic<uint32_t> doorbell;     // futex, bumped on every request
+    std::atomic<uint32_t> completion;   // futex, bumped on every response
+    uint32_t padding[10];
+    PythonBlockSlot slots[PY_MAX_SLOTS];
+};
+
+struct PythonBlock
+{
+    void *shm_in_ptr;
+    PythonBlockChannel *channel;
+    PythonBlockSlot *slot;
+};
+
+static PythonBlock python_blocks[PY_MAX_BLOCKS];
+static int python_block_count = 0;
+static pthread_mutex_t pythonBlocksLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Shared interpreter hosting the blocks
+static PythonBlockChannel *host_channel = NULL;
+static int host_commands = -1;
+static pid_t host_pid = -1;
+static bool host_failed = false;
+
+// Several threads of the block host can sleep on the same doorbell
+static void futexWake(std::atomic<uint32_t> *word)
+{
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static void futexWait(std::atomic<uint32_t> *word, uint32_t value, const struct timespec *timeout)
+{
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, value, timeout, NULL, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Forwards the output of a Python interpreter to the runtime log
+//-----------------------------------------------------------------------------
+static void logPythonOutput(FILE *fp)
+{
+    char log_msg[1024];
+    char buffer[512];
+    while (fgets(buffer, sizeof(buffer), fp) != NULL)
+    {
+        snprintf(log_msg, sizeof(log_msg), "[Python] %s", buffer);
+        openplc_log(log_msg);
+    }
+}
+
 void *runner_thread(void *arg)
 {
+    setThreadClass(THREAD_CLASS_BACKGROUND, "python_runner");
+
     char log_msg[1024];
     const char *cmd = (const char *)arg;
     FILE *fp = popen(cmd, "r");
@@ -45,12 +139,7 @@ void *runner_thread(void *arg)
         return NULL;
     }
 
-    char buffer[512];
-    while (fgets(buffer, sizeof(buffer), fp) != NULL)
-    {
-        snprintf(log_msg, sizeof(log_msg), "[Python] %s", buffer);
-        openplc_log(log_msg);
-    }
+    logPythonOutput(fp);
 
     pclose(fp);
     return NULL;
@@ -75,6 +164,281 @@ int create_shm_name(char *buf, size_t size)
     return 0;
 }
 
+//-----------------------------------------------------------------------------
+// Creates the control region <shm_name>_ctl, with no slots. Returns NULL if
+// the region can't be created
+//-----------------------------------------------------------------------------
+static PythonBlockChannel *createChannel(const char *shm_name)
+{
+    char log_msg[1024];
+    char shm_ctl_name[1024];
+    snprintf(shm_ctl_name, sizeof(shm_ctl_name), "%s_ctl", shm_name);
+
+    int shm_ctl_fd = shm_open(shm_ctl_name, O_CREAT | O_RDWR, 0660);
+    if (shm_ctl_fd < 0)
+    {
+        snprintf(log_msg, sizeof(log_msg), "shm_open error: %s", strerror(errno));
+        openplc_log(log_msg);
+        return NULL;
+    }
+    if (ftruncate(shm_ctl_fd, sizeof(PythonBlockChannel)) == -1)
+    {
+        snprintf(log_msg, sizeof(log_msg), "ftruncate error: %s", strerror(errno));
+        openplc_log(log_msg);
+        close(shm_ctl_fd);
+        shm_unlink(shm_ctl_name);
+        return NULL;
+    }
+    void *ptr = mmap(NULL, sizeof(PythonBlockChannel), PROT_READ | PROT_WRITE, MAP_SHARED, shm_ctl_fd, 0);
+    close(shm_ctl_fd);
+    if (ptr == MAP_FAILED)
+    {
+        snprintf(log_msg, sizeof(log_msg), "mmap error: %s", strerror(errno));
+        openplc_log(log_msg);
+        shm_unlink(shm_ctl_name);
+        return NULL;
+    }
+
+    PythonBlockChannel *channel = (PythonBlockChannel *)ptr;
+    memset(ptr, 0, sizeof(PythonBlockChannel));
+    channel->version = PY_CHANNEL_VERSION;
+    // The magic goes last, the script waits for it before reading the rest
+    std::atomic_thread_fence(std::memory_order_release);
+    channel->magic = PY_CHANNEL_MAGIC;
+
+    return channel;
+}
+
+//-----------------------------------------------------------------------------
+// Adds a block to a channel and makes it visible to the script side.
+// Returns the slot, or NULL if the channel is full
+//-----------------------------------------------------------------------------
+static PythonBlockSlot *addChannelSlot(PythonBlockChannel *channel, const char *shm_name, size_t shm_in_size, size_t shm_out_size)
+{
+    uint32_t index = channel->slot_count;
+    if (index >= PY_MAX_SLOTS) return NULL;
+
+    PythonBlockSlot *slot = &channel->slots[index];
+    slot->in_size = (uint32_t)shm_in_size;
+    slot->out_size = (uint32_t)shm_out_size;
+    snprintf(slot->shm_name, sizeof(slot->shm_name), "%s", shm_name);
+    __atomic_store_n(&channel->slot_count, index + 1, __ATOMIC_RELEASE);
+
+    return slot;
+}
+
+static void *hostOutputThread(void *arg)
+{
+    setThreadClass(THREAD_CLASS_BACKGROUND, "python_output");
+
+    FILE *fp = (FILE *)arg;
+    logPythonOutput(fp);
+    fclose(fp);
+    waitpid(host_pid, NULL, 0);
+
+    char log_msg[] = "[Python loader] Block host interpreter exited\n";
+    openplc_log(log_msg);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Starts the interpreter that hosts the blocks, with its shared control
+// region. Blocks are handed to it through its stdin, a socket so that a
+// dead host never raises SIGPIPE on the runtime. Called holding
+// pythonBlocksLock. Returns false if the host couldn't be started
+//-----------------------------------------------------------------------------
+static bool startBlockHost()
+{
+    char log_msg[1024];
+    char host_name[64];
+    char cmd[512];
+    int commands[2];
+    int output[2];
+
+    snprintf(host_name, sizeof(host_name), "/openplc_blocks_%d", (int)getpid());
+    host_channel = createChannel(host_name);
+    if (host_channel == NULL) return false;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, commands) < 0)
+    {
+        snprintf(log_msg, sizeof(log_msg), "[Python loader] socketpair error: %s\n", strerror(errno));
+        openplc_log(log_msg);
+        return false;
+    }
+    if (pipe2(output, O_CLOEXEC) < 0)
+    {
+        snprintf(log_msg, sizeof(log_msg), "[Python loader] pipe error: %s\n", strerror(errno));
+        openplc_log(log_msg);
+        close(commands[0]);
+        close(commands[1]);
+        return false;
+    }
+
+    snprintf(cmd, sizeof(cmd), "PYTHONPATH=./core/python exec python3 -u ./core/python/block_host.py %s", host_name);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(commands[1], STDIN_FILENO);
+        dup2(output[1], STDOUT_FILENO);
+        dup2(output[1], STDERR_FILENO);
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+    close(commands[1]);
+    close(output[1]);
+    if (pid < 0)
+    {
+        snprintf(log_msg, sizeof(log_msg), "[Python loader] fork error: %s\n", strerror(errno));
+        openplc_log(log_msg);
+        close(commands[0]);
+        close(output[0]);
+        return false;
+    }
+
+    host_pid = pid;
+    pthread_t tid;
+    FILE *fp = fdopen(output[0], "r");
+    if (fp == NULL || pthread_create(&tid, NULL, hostOutputThread, fp) != 0)
+    {
+        snprintf(log_msg, sizeof(log_msg), "[Python loader] Failed to follow the block host output\n");
+        openplc_log(log_msg);
+        if (fp != NULL) fclose(fp);
+        else close(output[0]);
+    }
+    else
+    {
+        pthread_detach(tid);
+    }
+
+    host_commands = commands[0];
+    snprintf(log_msg, sizeof(log_msg), "[Python loader] Block host started (pid %d)\n", (int)pid);
+    openplc_log(log_msg);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Hands a block script to the shared interpreter. Returns false if the block
+// must run on its own interpreter instead
+//-----------------------------------------------------------------------------
+static bool hostPythonBlock(const char *script_name, const char *shm_name, size_t shm_in_size, size_t shm_out_size, void *shm_in_ptr)
+{
+    char command[1024];
+    bool hosted = false;
+
+    pthread_mutex_lock(&pythonBlocksLock);
+    if (host_channel == NULL && !host_failed)
+    {
+        host_failed = !startBlockHost();
+    }
+
+    if (host_channel != NULL && host_commands >= 0 && python_block_count < PY_MAX_BLOCKS)
+    {
+        uint32_t index = host_channel->slot_count;
+        int length = snprintf(command, sizeof(command), "load %u %s %s\n", index, shm_name, script_name);
+        if (length < (int)sizeof(command))
+        {
+            PythonBlockSlot *slot = addChannelSlot(host_channel, shm_name, shm_in_size, shm_out_size);
+            if (slot != NULL && send(host_commands, command, length, MSG_NOSIGNAL) == length)
+            {
+                PythonBlock *block = &python_blocks[python_block_count];
+                block->shm_in_ptr = shm_in_ptr;
+                block->channel = host_channel;
+                block->slot = slot;
+                __atomic_store_n(&python_block_count, python_block_count + 1, __ATOMIC_RELEASE);
+                hosted = true;
+            }
+            else if (slot != NULL)
+            {
+                // The host is gone, the slot stays unused
+                close(host_commands);
+                host_commands = -1;
+            }
+        }
+    }
+    pthread_mutex_unlock(&pythonBlocksLock);
+
+    return hosted;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the channel slot of the block whose input region is shm_in_ptr
+//-----------------------------------------------------------------------------
+static PythonBlock *findPythonBlock(void *shm_in_ptr)
+{
+    int count = __atomic_load_n(&python_block_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++)
+    {
+        if (python_blocks[i].shm_in_ptr == shm_in_ptr) return &python_blocks[i];
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Hands the input region of a block to its script. Returns 0, 1 if the
+// previous request was not answered yet (the inputs are left untouched on
+// the script side) or -1 if the block has no control region
+//-----------------------------------------------------------------------------
+int python_block_post(void *shm_in_ptr)
+{
+    PythonBlock *block = findPythonBlock(shm_in_ptr);
+    if (block == NULL) return -1;
+
+    PythonBlockSlot *slot = block->slot;
+    uint32_t request = slot->request.load(std::memory_order_relaxed);
+    if (slot->response.load(std::memory_order_acquire) != request) return 1;
+
+    slot->request.store(request + 1, std::memory_order_release);
+    block->channel->doorbell.fetch_add(1, std::memory_order_release);
+    futexWake(&block->channel->doorbell);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Waits up to timeout_us microseconds for the script to answer the last
+// request of a block. Returns 0 once the output region is ready, 1 on
+// timeout or -1 if the block has no control region
+//-----------------------------------------------------------------------------
+int python_block_wait(void *shm_in_ptr, long timeout_us)
+{
+    PythonBlock *block = findPythonBlock(shm_in_ptr);
+    if (block == NULL) return -1;
+
+    PythonBlockSlot *slot = block->slot;
+    struct timespec now, deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_us / 1000000;
+    deadline.tv_nsec += (timeout_us % 1000000) * 1000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    while (true)
+    {
+        uint32_t completion = block->channel->completion.load(std::memory_order_acquire);
+        if (slot->response.load(std::memory_order_acquire) == slot->request.load(std::memory_order_relaxed)) return 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        struct timespec remaining;
+        timespec_diff(&deadline, &now, &remaining);
+        if (remaining.tv_sec < 0 || (remaining.tv_sec == 0 && remaining.tv_nsec <= 0)) return 1;
+        futexWait(&block->channel->completion, completion, &remaining);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Runs a block on its script and waits up to timeout_us microseconds for
+// the outputs. Returns like python_block_wait()
+//-----------------------------------------------------------------------------
+int python_block_call(void *shm_in_ptr, long timeout_us)
+{
+    int result = python_block_post(shm_in_ptr);
+    if (result < 0) return result;
+    return python_block_wait(shm_in_ptr, timeout_us);
+}
+
 int python_block_loader(const char *script_name, const char *script_content, char *shm_name, size_t shm_in_size, size_t shm_out_size, void **shm_in_ptr, void **shm_out_ptr, pid_t pid)
 {
     char log_msg[1024];
@@ -161,6 +525,29 @@ int python_block_loader(const char *script_name, const char *script_content, cha
     close(shm_in_fd);
     close(shm_out_fd);
 
+    if (hostPythonBlock(script_name, shm_name, shm_in_size, shm_out_size, *shm_in_ptr))
+    {
+        return 0;
+    }
+
+    // Blocks without a control region still work, their scripts just have
+    // to synchronize on the data regions by themselves
+    PythonBlockChannel *channel = createChannel(shm_name);
+    if (channel != NULL)
+    {
+        pthread_mutex_lock(&pythonBlocksLock);
+        PythonBlockSlot *slot = addChannelSlot(channel, shm_name, shm_in_size, shm_out_size);
+        if (python_block_count < PY_MAX_BLOCKS)
+        {
+            PythonBlock *block = &python_blocks[python_block_count];
+            block->shm_in_ptr = *shm_in_ptr;
+            block->channel = channel;
+            block->slot = slot;
+            __atomic_store_n(&python_block_count, python_block_count + 1, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&pythonBlocksLock);
+    }
+
     char *cmd = malloc(512);
     if (cmd == NULL) 
     {
@@ -168,7 +555,7 @@ int python_block_loader(const char *script_name, const char *script_content, cha
         openplc_log(log_msg);
         return -1;
     }
-    snprintf(cmd, 512, "python3 -u %s 2>&1", script_name);
+    snprintf(cmd, 512, "PYTHONPATH=./core/python python3 -u %s 2>&1", script_name);
 
     pthread_t tid;
     if (pthread_create(&tid, NULL, runner_thread, cmd) != 0) 
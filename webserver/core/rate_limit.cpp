@@ -0,0 +1,382 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the rate limits of the protocol servers of server.cpp
+// (Modbus/TCP and EtherNet/IP). Every client belongs to a priority class of
+// rate_limits.cfg, picked by its address. Each connection has a token bucket
+// with the rate of its class, and each protocol a bucket shared by all its
+// clients, of which the lower priority classes leave a reserve to the
+// classes above. A request that finds no token waits on the connection
+// buffer, and the worker stops reading the client until the bucket refills,
+// so a flooding client only slows itself down instead of the scan.
+//
+// The protocol sections also set the connection policy of the server: the
+// socket options of the clients, the idle timeout and the number of
+// clients kept open.
+//
+// Without rate_limits.cfg every client is on the default class, with no
+// limit.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <atomic>
+
+#include "ladder.h"
+
+#define RATE_LIMIT_CONFIG_FILE  "rate_limits.cfg"
+#define RATE_MAX_CLASSES        8
+#define RATE_MAX_NETWORKS       16
+
+struct RateNetwork
+{
+    uint32_t address;           // host order
+    uint32_t mask;
+};
+
+struct RateClass
+{
+    char name[32];
+    int priority;               // 0 is the highest
+    double rate;                // requests per second of a connection, 0 for no limit
+    double burst;
+    int network_count;
+    RateNetwork networks[RATE_MAX_NETWORKS];
+    std::atomic<int64_t> connections;
+    std::atomic<uint64_t> allowed[PROTOCOL_TYPES];
+    std::atomic<uint64_t> throttled[PROTOCOL_TYPES];
+};
+
+struct ProtocolLimit
+{
+    double rate;                // requests per second of all clients, 0 for no limit
+    double burst;
+    double reserve;             // tokens each priority level leaves to the ones above
+    pthread_mutex_t lock;
+    RateBucket bucket;
+    ConnectionLimits connections;
+};
+
+// Section of rate_limits.cfg being read
+struct RateLimitSection
+{
+    ProtocolLimit *limit;
+    RateClass *cls;
+    bool in_class;
+};
+
+static const char *protocol_names[PROTOCOL_TYPES] = { "modbus", "dnp3", "enip", "opcua", "s7" };
+
+static RateClass classes[RATE_MAX_CLASSES];
+static int class_count = 1;
+static ProtocolLimit limits[PROTOCOL_TYPES];
+
+//-----------------------------------------------------------------------------
+// Parses a list of addresses and networks (10.0.0.0/24, 192.168.1.20) into
+// the networks of a class
+//-----------------------------------------------------------------------------
+static void parseNetworks(RateClass *cls, char *value)
+{
+    char log_msg[1000];
+    char *save = NULL;
+    for (char *item = strtok_r(value, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+    {
+        item = trimSetting(item);
+        int bits = 32;
+        char *slash = strchr(item, '/');
+        if (slash != NULL)
+        {
+            *slash = '\0';
+            bits = atoi(slash + 1);
+        }
+
+        struct in_addr address;
+        if (inet_pton(AF_INET, item, &address) != 1 || bits < 0 || bits > 32 || cls->network_count >= RATE_MAX_NETWORKS)
+        {
+            sprintf(log_msg, "Rate limits: invalid client '%s' on class %s\n", item, cls->name);
+            openplc_log(log_msg);
+            continue;
+        }
+
+        RateNetwork *network = &cls->networks[cls->network_count++];
+        network->mask = bits == 0 ? 0 : 0xFFFFFFFFu << (32 - bits);
+        network->address = ntohl(address.s_addr) & network->mask;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Returns the class of a name, adding it if it is new. The default class is
+// always the first one. Returns NULL once the table is full
+//-----------------------------------------------------------------------------
+static RateClass *findClass(const char *name)
+{
+    for (int i = 0; i < class_count; i++)
+    {
+        if (strcmp(classes[i].name, name) == 0) return &classes[i];
+    }
+    if (class_count >= RATE_MAX_CLASSES) return NULL;
+
+    RateClass *cls = &classes[class_count++];
+    strncpy(cls->name, name, sizeof(cls->name) - 1);
+    return cls;
+}
+
+//-----------------------------------------------------------------------------
+// Applies one line of rate_limits.cfg to the section being read
+//-----------------------------------------------------------------------------
+static void applyRateLimitLine(const char *name, char *key, char *value, void *context)
+{
+    char log_msg[1000];
+    RateLimitSection *section = (RateLimitSection *)context;
+    if (key == NULL)
+    {
+        section->limit = NULL;
+        section->cls = NULL;
+        section->in_class = (strcmp(name, "class") == 0);
+        for (int p = 0; p < PROTOCOL_TYPES; p++)
+        {
+            if (strcmp(name, protocol_names[p]) == 0) section->limit = &limits[p];
+        }
+        return;
+    }
+
+    if (section->limit != NULL)
+    {
+        if (strcmp(key, "rate") == 0) section->limit->rate = atof(value);
+        else if (strcmp(key, "burst") == 0) section->limit->burst = atof(value);
+        else if (strcmp(key, "reserve") == 0) section->limit->reserve = atof(value);
+        else if (strcmp(key, "nodelay") == 0) section->limit->connections.nodelay = (strcmp(value, "false") != 0);
+        else if (strcmp(key, "keepalive") == 0) section->limit->connections.keepalive = atoi(value);
+        else if (strcmp(key, "idle_timeout") == 0) section->limit->connections.idle_timeout = atoi(value);
+        else if (strcmp(key, "max_connections") == 0) section->limit->connections.max_connections = atoi(value);
+    }
+    else if (section->in_class && strcmp(key, "name") == 0)
+    {
+        section->cls = findClass(value);
+        if (section->cls == NULL)
+        {
+            sprintf(log_msg, "Rate limits: too many classes, '%s' is ignored\n", value);
+            openplc_log(log_msg);
+        }
+    }
+    else if (section->cls != NULL)
+    {
+        if (strcmp(key, "priority") == 0) section->cls->priority = atoi(value);
+        else if (strcmp(key, "rate") == 0) section->cls->rate = atof(value);
+        else if (strcmp(key, "burst") == 0) section->cls->burst = atof(value);
+        else if (strcmp(key, "clients") == 0) parseNetworks(section->cls, value);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Reads rate_limits.cfg. A [class] section gets its settings once its name
+// is known, so the name must come first. The protocol sections ([modbus],
+// [enip]) set the limits shared by all the clients of the server
+//-----------------------------------------------------------------------------
+void loadRateLimits()
+{
+    char log_msg[1000];
+
+    strcpy(classes[0].name, "default");
+    for (int p = 0; p < PROTOCOL_TYPES; p++)
+    {
+        pthread_mutex_init(&limits[p].lock, NULL);
+        limits[p].connections.nodelay = true;
+    }
+
+    RateLimitSection section = {NULL, NULL, false};
+    if (!parseSettingsFile(RATE_LIMIT_CONFIG_FILE, applyRateLimitLine, &section)) return;
+
+    // A bucket holds at least one second of its rate unless told otherwise,
+    // and starts full
+    for (int i = 0; i < class_count; i++)
+    {
+        if (classes[i].burst < 1) classes[i].burst = classes[i].rate > 1 ? classes[i].rate : 1;
+        if (classes[i].priority < 0) classes[i].priority = 0;
+    }
+    for (int p = 0; p < PROTOCOL_TYPES; p++)
+    {
+        if (limits[p].burst < 1) limits[p].burst = limits[p].rate > 1 ? limits[p].rate : 1;
+        limits[p].bucket.tokens = limits[p].burst;
+        if (limits[p].rate > 0)
+        {
+            sprintf(log_msg, "Rate limits: %s limited to %.0f requests/s\n", protocol_names[p], limits[p].rate);
+            openplc_log(log_msg);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Returns the connection policy of a server
+//-----------------------------------------------------------------------------
+void getConnectionLimits(int protocol, ConnectionLimits *connection_limits)
+{
+    *connection_limits = limits[protocol].connections;
+    if (connection_limits->keepalive < 0) connection_limits->keepalive = 0;
+    if (connection_limits->idle_timeout < 0) connection_limits->idle_timeout = 0;
+    if (connection_limits->max_connections < 0) connection_limits->max_connections = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the class of a client address, the first class that lists it or
+// the default class
+//-----------------------------------------------------------------------------
+int rateLimitClass(const struct sockaddr_in *address)
+{
+    uint32_t host = ntohl(address->sin_addr.s_addr);
+    for (int i = 1; i < class_count; i++)
+    {
+        for (int n = 0; n < classes[i].network_count; n++)
+        {
+            if ((host & classes[i].networks[n].mask) == classes[i].networks[n].address) return i;
+        }
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the priority of a class, 0 being the highest
+//-----------------------------------------------------------------------------
+int rateLimitPriority(int class_index)
+{
+    return classes[class_index].priority;
+}
+
+//-----------------------------------------------------------------------------
+// Starts the bucket of a new connection of a class, full
+//-----------------------------------------------------------------------------
+void openRateBucket(RateBucket *bucket, int class_index, uint64_t now_ns)
+{
+    bucket->tokens = classes[class_index].burst;
+    bucket->updated_ns = now_ns;
+    classes[class_index].connections.fetch_add(1, std::memory_order_relaxed);
+}
+
+void closeRateBucket(int class_index)
+{
+    classes[class_index].connections.fetch_sub(1, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// Adds the tokens earned since the last update of a bucket
+//-----------------------------------------------------------------------------
+static void refillBucket(RateBucket *bucket, double rate, double burst, uint64_t now_ns)
+{
+    if (now_ns > bucket->updated_ns)
+    {
+        bucket->tokens += (now_ns - bucket->updated_ns) * rate / 1e9;
+        if (bucket->tokens > burst) bucket->tokens = burst;
+    }
+    bucket->updated_ns = now_ns;
+}
+
+//-----------------------------------------------------------------------------
+// Takes the token of a request from the bucket of the connection and the one
+// of the protocol. Returns false if either is empty, with the nanoseconds
+// until the request may be retried on retry_ns
+//-----------------------------------------------------------------------------
+bool takeRateToken(int protocol, RateBucket *bucket, int class_index, uint64_t now_ns, uint64_t *retry_ns)
+{
+    RateClass *cls = &classes[class_index];
+
+    if (cls->rate > 0)
+    {
+        refillBucket(bucket, cls->rate, cls->burst, now_ns);
+        if (bucket->tokens < 1)
+        {
+            *retry_ns = (uint64_t)((1 - bucket->tokens) * 1e9 / cls->rate) + 1;
+            cls->throttled[protocol].fetch_add(1, std::memory_order_relaxed);
+            recordProtocolThrottled(protocol);
+            return false;
+        }
+    }
+
+    ProtocolLimit *limit = &limits[protocol];
+    if (limit->rate > 0)
+    {
+        // The lower classes leave part of the bucket to the ones above. A
+        // class may always wait for a full bucket
+        double needed = 1 + limit->reserve * cls->priority;
+        if (needed > limit->burst) needed = limit->burst;
+
+        pthread_mutex_lock(&limit->lock);
+        refillBucket(&limit->bucket, limit->rate, limit->burst, now_ns);
+        bool available = limit->bucket.tokens >= needed;
+        if (available) limit->bucket.tokens -= 1;
+        else *retry_ns = (uint64_t)((needed - limit->bucket.tokens) * 1e9 / limit->rate) + 1;
+        pthread_mutex_unlock(&limit->lock);
+
+        if (!available)
+        {
+            cls->throttled[protocol].fetch_add(1, std::memory_order_relaxed);
+            recordProtocolThrottled(protocol);
+            return false;
+        }
+    }
+
+    if (cls->rate > 0) bucket->tokens -= 1;
+    cls->allowed[protocol].fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Writes a text table with the limits and the requests allowed and
+// throttled on every class. Returns the number of characters written
+//-----------------------------------------------------------------------------
+int getRateLimitStats(char *buffer, size_t buffer_size)
+{
+    int written = 0;
+    for (int p = 0; p < PROTOCOL_TYPES && written < (int)buffer_size; p++)
+    {
+        if (p != MODBUS_PROTOCOL && p != ENIP_PROTOCOL) continue;
+        if (limits[p].rate > 0)
+            written += snprintf(buffer + written, buffer_size - written, "%s rate=%g/s burst=%g reserve=%g\n",
+                                protocol_names[p], limits[p].rate, limits[p].burst, limits[p].reserve);
+        else
+            written += snprintf(buffer + written, buffer_size - written, "%s rate=unlimited\n", protocol_names[p]);
+    }
+
+    if (written < (int)buffer_size)
+        written += snprintf(buffer + written, buffer_size - written, "%-16s %8s %10s %11s %8s %14s %16s\n",
+                            "class", "priority", "rate", "connections", "protocol", "allowed", "throttled");
+
+    for (int i = 0; i < class_count && written < (int)buffer_size; i++)
+    {
+        RateClass *cls = &classes[i];
+        char rate[16];
+        if (cls->rate > 0) snprintf(rate, sizeof(rate), "%g/s", cls->rate);
+        else strcpy(rate, "unlimited");
+        int64_t connections = cls->connections.load(std::memory_order_relaxed);
+
+        for (int p = 0; p < PROTOCOL_TYPES && written < (int)buffer_size; p++)
+        {
+            if (p != MODBUS_PROTOCOL && p != ENIP_PROTOCOL) continue;
+            written += snprintf(buffer + written, buffer_size - written, "%-16s %8d %10s %11lld %8s %14llu %16llu\n",
+                                cls->name, cls->priority, rate, (long long)(connections < 0 ? 0 : connections), protocol_names[p],
+                                (unsigned long long)cls->allowed[p].load(std::memory_order_relaxed),
+                                (unsigned long long)cls->throttled[p].load(std::memory_order_relaxed));
+        }
+    }
+
+    if (written > (int)buffer_size) written = buffer_size;
+    return written;
+}
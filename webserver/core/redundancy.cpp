@@ -0,0 +1,825 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements hot standby redundancy between two runtimes running
+// the same program. The primary streams the state of the program to the
+// standby after every scan; the standby doesn't run the program nor drive
+// its outputs, it only applies that state, and takes over once the updates
+// stop for takeover_scans of its own scans.
+//
+// The state is made of the debug variables of the program, as exported by
+// state_export(), and the memory areas of the process image; each unit
+// reads its own inputs. The scan thread of the primary copies it, holding
+// bufferLock, to a triple buffer just before the process image is published. A sender thread compares the
+// latest copy with the last one it sent, in blocks of 64 bytes, and sends
+// only the ranges of blocks that changed. The first message of a connection
+// carries the whole state. When the link can't keep up, copies are skipped
+// and the next delta covers them, so every message leaves the standby on
+// the state of one scan of the primary.
+//
+// Messages are a SyncHeader, range_count SyncRange and the data of the
+// ranges, in the byte order of the runtime. The standby refuses the state
+// of a program with another layout.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <atomic>
+
+#include "ladder.h"
+
+#define REDUNDANCY_CONFIG_FILE  "redundancy.cfg"
+#define SYNC_MAGIC              0x4F505359  //"OPSY"
+#define SYNC_VERSION            1
+#define SYNC_FLAG_FULL          1
+#define SYNC_BLOCK              64
+#define SLOT_INDEX              3
+#define SLOT_NEW                4
+
+#define ROLE_NONE               0
+#define ROLE_PRIMARY            1
+#define ROLE_STANDBY            2
+
+extern unsigned long __tick;
+
+struct SyncHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint32_t layout;            //hash of the sizes of the state regions
+    uint32_t state_size;
+    uint64_t sequence;
+    uint64_t tick;
+    uint32_t range_count;
+    uint32_t data_size;
+};
+
+struct SyncRange
+{
+    uint32_t offset;
+    uint32_t length;
+};
+
+//A piece of the state: a debug variable or a memory area of the image
+struct StateRegion
+{
+    uint8_t *address;
+    uint32_t offset;
+    uint32_t size;
+};
+
+struct RedundancyConfig
+{
+    int role;
+    char peer[128];
+    char port[8];
+    char bind[64];
+    int takeover_scans;
+    int startup_grace_ms;
+};
+
+static RedundancyConfig config;
+static pthread_t redundancy_thread;
+static volatile bool redundancy_running = false;
+
+//-----------------------------------------------------------------------------
+// Layout of the state, built by the redundancy thread holding bufferLock
+//-----------------------------------------------------------------------------
+static StateRegion *regions = NULL;
+static int region_count = 0;
+static uint32_t state_size = 0;
+static uint32_t state_layout = 0;
+static PlcProgram *layout_program = NULL;
+
+//-----------------------------------------------------------------------------
+// Primary: triple buffer between the scan thread and the sender. The scan
+// thread owns write_slot, the sender read_slot, and ready_slot holds the
+// latest copy, flagged with SLOT_NEW until the sender takes it
+//-----------------------------------------------------------------------------
+static uint8_t *slots[3] = {NULL, NULL, NULL};
+static uint64_t slot_tick[3];
+static int write_slot = 0;
+static int read_slot = 2;
+static std::atomic<int> ready_slot(1);
+static std::atomic<bool> capture_enabled(false);
+static std::atomic<bool> layout_stale(false);
+
+//-----------------------------------------------------------------------------
+// Standby: the scan thread counts its scans without updates and takes over
+//-----------------------------------------------------------------------------
+static std::atomic<uint64_t> updates_applied(0);
+static std::atomic<bool> taken_over(false);
+static uint64_t updates_seen = 0;
+static int scans_missed = 0;
+static struct timespec grace_deadline;
+
+//-----------------------------------------------------------------------------
+// Statistics for redundancy_status()
+//-----------------------------------------------------------------------------
+static std::atomic<bool> link_up(false);
+static std::atomic<uint64_t> messages(0);
+static std::atomic<uint64_t> bytes(0);
+static std::atomic<uint32_t> last_message_size(0);
+static std::atomic<uint64_t> last_sequence(0);
+
+//-----------------------------------------------------------------------------
+// Applies one setting of redundancy.cfg
+//-----------------------------------------------------------------------------
+static void applyRedundancySetting(const char *section, char *key, char *value, void *context)
+{
+    if (key == NULL) return;
+
+    if (strcmp(key, "role") == 0)
+    {
+        if (strcmp(value, "primary") == 0) config.role = ROLE_PRIMARY;
+        else if (strcmp(value, "standby") == 0) config.role = ROLE_STANDBY;
+    }
+    else if (strcmp(key, "peer") == 0) strncpy(config.peer, value, sizeof(config.peer) - 1);
+    else if (strcmp(key, "port") == 0) strncpy(config.port, value, sizeof(config.port) - 1);
+    else if (strcmp(key, "bind") == 0) strncpy(config.bind, value, sizeof(config.bind) - 1);
+    else if (strcmp(key, "takeover_scans") == 0) config.takeover_scans = atoi(value);
+    else if (strcmp(key, "startup_grace") == 0) config.startup_grace_ms = atoi(value);
+}
+
+//-----------------------------------------------------------------------------
+// Reads redundancy.cfg. Returns false if the file is missing or doesn't
+// give this runtime a role
+//-----------------------------------------------------------------------------
+static bool loadRedundancyConfig()
+{
+    memset(&config, 0, sizeof(config));
+    strcpy(config.port, "43629");
+    config.takeover_scans = 5;
+    config.startup_grace_ms = 5000;
+
+    if (!parseSettingsFile(REDUNDANCY_CONFIG_FILE, applyRedundancySetting, NULL)) return false;
+
+    if (config.takeover_scans < 1) config.takeover_scans = 1;
+    if (config.role == ROLE_PRIMARY && config.peer[0] == '\0')
+    {
+        openplc_log((char *)"Redundancy: the primary needs the address of the standby (peer)\n");
+        return false;
+    }
+    return config.role != ROLE_NONE;
+}
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t length)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+//-----------------------------------------------------------------------------
+// Describes the state of the running program: its debug variables and the
+// memory areas of the image. Called holding bufferLock. Returns false if
+// there's no memory for the table
+//-----------------------------------------------------------------------------
+static bool buildLayout()
+{
+    static const StateRegion memory_areas[] =
+    {
+        {&bool_memory_image[0][0], 0, sizeof(bool_memory_image)},
+        {byte_memory_image, 0, sizeof(byte_memory_image)},
+        {(uint8_t *)int_memory_image, 0, sizeof(int_memory_image)},
+        {(uint8_t *)dint_memory_image, 0, sizeof(dint_memory_image)},
+        {(uint8_t *)lint_memory_image, 0, sizeof(lint_memory_image)},
+        {(uint8_t *)real_memory_image, 0, sizeof(real_memory_image)},
+        {(uint8_t *)lreal_memory_image, 0, sizeof(lreal_memory_image)},
+    };
+    const int memory_count = sizeof(memory_areas) / sizeof(memory_areas[0]);
+
+    PlcProgram *program = plcProgram();
+    int count = program->get_var_count() + memory_count;
+    StateRegion *table = (StateRegion *)malloc(count * sizeof(StateRegion));
+    if (table == NULL) return false;
+
+    uint32_t hash = 2166136261u;
+    uint32_t offset = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (i < count - memory_count)
+        {
+            table[i].address = (uint8_t *)program->get_var_addr(i);
+            table[i].size = (uint32_t)program->get_var_size(i);
+        }
+        else
+        {
+            table[i] = memory_areas[i - (count - memory_count)];
+        }
+        table[i].offset = offset;
+        offset += table[i].size;
+        hash = fnv1a(hash, &table[i].size, sizeof(table[i].size));
+    }
+
+    free(regions);
+    regions = table;
+    region_count = count;
+    state_size = offset;
+    state_layout = hash;
+    layout_program = program;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Copies length bytes of state, starting at offset, to the regions they
+// belong to (bufferLock held)
+//-----------------------------------------------------------------------------
+static void applyRange(uint32_t offset, uint32_t length, const uint8_t *data)
+{
+    // Last region starting at or before offset
+    int low = 0, high = region_count - 1;
+    while (low < high)
+    {
+        int middle = (low + high + 1) / 2;
+        if (regions[middle].offset <= offset) low = middle;
+        else high = middle - 1;
+    }
+
+    for (int i = low; i < region_count && length > 0; i++)
+    {
+        uint32_t skip = offset - regions[i].offset;
+        if (skip >= regions[i].size) continue;
+        uint32_t piece = regions[i].size - skip < length ? regions[i].size - skip : length;
+        memcpy(regions[i].address + skip, data, piece);
+        data += piece;
+        offset += piece;
+        length -= piece;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Copies the state to the triple buffer. Called by the scan thread of the
+// primary, holding bufferLock, before the process image is published so
+// that the sender, woken by the publication, finds it
+//-----------------------------------------------------------------------------
+void captureRedundancyState()
+{
+    if (!capture_enabled.load(std::memory_order_acquire)) return;
+    if (plcProgram() != layout_program)
+    {
+        // Online change, the sender rebuilds the layout
+        capture_enabled.store(false, std::memory_order_relaxed);
+        layout_stale.store(true, std::memory_order_release);
+        return;
+    }
+
+    uint8_t *slot = slots[write_slot];
+    for (int i = 0; i < region_count; i++)
+    {
+        memcpy(slot + regions[i].offset, regions[i].address, regions[i].size);
+    }
+    slot_tick[write_slot] = __tick;
+    write_slot = ready_slot.exchange(write_slot | SLOT_NEW, std::memory_order_acq_rel) & SLOT_INDEX;
+}
+
+//-----------------------------------------------------------------------------
+// Tells the scan thread whether this runtime is a standby that must not run
+// the program nor drive its outputs. Counts the scans without updates from
+// the primary and takes over after takeover_scans of them. Called by the
+// scan thread holding bufferLock
+//-----------------------------------------------------------------------------
+bool redundancyStandby()
+{
+    if (config.role != ROLE_STANDBY || !redundancy_running) return false;
+    if (taken_over.load(std::memory_order_relaxed)) return false;
+
+    uint64_t applied = updates_applied.load(std::memory_order_acquire);
+    if (applied != updates_seen)
+    {
+        updates_seen = applied;
+        scans_missed = 0;
+        return true;
+    }
+
+    // Give the primary time to connect when both units start
+    if (applied == 0)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec < grace_deadline.tv_sec ||
+            (now.tv_sec == grace_deadline.tv_sec && now.tv_nsec < grace_deadline.tv_nsec)) return true;
+    }
+
+    if (++scans_missed < config.takeover_scans) return true;
+    taken_over.store(true, std::memory_order_release);
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+// Writes a whole buffer to the socket, giving up once the peer stops
+// reading for a second. Returns false on error
+//-----------------------------------------------------------------------------
+static bool sendAll(int fd, const uint8_t *data, size_t length)
+{
+    while (length > 0)
+    {
+        struct pollfd pfd = {fd, POLLOUT, 0};
+        if (poll(&pfd, 1, 1000) <= 0) return false;
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+        if (sent <= 0) return false;
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Reads exactly length bytes from the socket. Returns false if the peer
+// closed the connection, went silent for timeout_ms or the thread must stop
+//-----------------------------------------------------------------------------
+static bool receiveAll(int fd, void *buffer, size_t length, int timeout_ms)
+{
+    uint8_t *data = (uint8_t *)buffer;
+    while (length > 0)
+    {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready <= 0 || !redundancy_running || taken_over.load(std::memory_order_relaxed)) return false;
+        ssize_t count = recv(fd, data, length, 0);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return false;
+        data += count;
+        length -= count;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Opens the link to the standby. Returns the socket, or -1
+//-----------------------------------------------------------------------------
+static int connectToStandby()
+{
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(config.peer, config.port, &hints, &result) != 0) return -1;
+
+    int fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (fd >= 0 && connect(fd, result->ai_addr, result->ai_addrlen) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    if (fd < 0) return -1;
+
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    return fd;
+}
+
+//-----------------------------------------------------------------------------
+// Rebuilds the layout and the buffers of the primary for the running
+// program. The scan thread stops copying while they are replaced
+//-----------------------------------------------------------------------------
+static bool preparePrimary(uint8_t **sent, uint8_t **message, size_t *message_capacity)
+{
+    capture_enabled.store(false, std::memory_order_relaxed);
+    lockBuffer();
+    bool built = buildLayout();
+    for (int i = 0; built && i < 3; i++)
+    {
+        free(slots[i]);
+        slots[i] = (uint8_t *)malloc(state_size ? state_size : 1);
+        built = slots[i] != NULL;
+    }
+    write_slot = 0;
+    ready_slot.store(1, std::memory_order_relaxed);
+    read_slot = 2;
+    layout_stale.store(false, std::memory_order_relaxed);
+    unlockBuffer();
+
+    // Worst case is every other block dirty, a range for each
+    size_t blocks = state_size / SYNC_BLOCK + 1;
+    *message_capacity = sizeof(SyncHeader) + (blocks / 2 + 1) * sizeof(SyncRange) + state_size;
+    free(*sent);
+    free(*message);
+    *sent = (uint8_t *)malloc(state_size ? state_size : 1);
+    *message = (uint8_t *)malloc(*message_capacity);
+    return built && *sent != NULL && *message != NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Builds the message that takes the standby from sent to state, and updates
+// sent. Returns its size
+//-----------------------------------------------------------------------------
+static size_t buildDelta(const uint8_t *state, uint8_t *sent, bool full, uint64_t sequence, uint64_t tick, uint8_t *message)
+{
+    SyncHeader header;
+    header.magic = SYNC_MAGIC;
+    header.version = SYNC_VERSION;
+    header.flags = full ? SYNC_FLAG_FULL : 0;
+    header.layout = state_layout;
+    header.state_size = state_size;
+    header.sequence = sequence;
+    header.tick = tick;
+    header.range_count = 0;
+    header.data_size = 0;
+
+    // Ranges are collected first, their data follows them
+    SyncRange *ranges = (SyncRange *)(message + sizeof(header));
+    if (full)
+    {
+        ranges[0].offset = 0;
+        ranges[0].length = state_size;
+        header.range_count = 1;
+    }
+    else
+    {
+        bool open = false;
+        for (uint32_t offset = 0; offset < state_size; offset += SYNC_BLOCK)
+        {
+            uint32_t length = state_size - offset < SYNC_BLOCK ? state_size - offset : SYNC_BLOCK;
+            bool dirty = memcmp(state + offset, sent + offset, length) != 0;
+            if (dirty && open)
+            {
+                ranges[header.range_count - 1].length += length;
+            }
+            else if (dirty)
+            {
+                ranges[header.range_count].offset = offset;
+                ranges[header.range_count].length = length;
+                header.range_count++;
+            }
+            open = dirty;
+        }
+    }
+
+    uint8_t *data = (uint8_t *)(ranges + header.range_count);
+    for (uint32_t i = 0; i < header.range_count; i++)
+    {
+        memcpy(data + header.data_size, state + ranges[i].offset, ranges[i].length);
+        memcpy(sent + ranges[i].offset, state + ranges[i].offset, ranges[i].length);
+        header.data_size += ranges[i].length;
+    }
+    memcpy(message, &header, sizeof(header));
+    return sizeof(header) + header.range_count * sizeof(SyncRange) + header.data_size;
+}
+
+//-----------------------------------------------------------------------------
+// Thread of the primary: connects to the standby and sends it the state of
+// every scan it manages to, as deltas
+//-----------------------------------------------------------------------------
+static void *primaryThread(void *arg)
+{
+    char log_msg[1000];
+    uint8_t *sent = NULL, *message = NULL;
+    size_t message_capacity = 0;
+    int fd = -1;
+    uint64_t sequence = 0;
+    bool full = true;
+    int backoff = 100;
+
+    setThreadClass(THREAD_CLASS_COMM, "redundancy_pri");
+
+    while (redundancy_running)
+    {
+        if (fd < 0)
+        {
+            fd = connectToStandby();
+            if (fd < 0)
+            {
+                sleepms(backoff);
+                backoff = backoff * 2 < 5000 ? backoff * 2 : 5000;
+                continue;
+            }
+            backoff = 100;
+            if (!preparePrimary(&sent, &message, &message_capacity))
+            {
+                openplc_log((char *)"Redundancy: not enough memory for the state of the program\n");
+                close(fd);
+                fd = -1;
+                sleepms(5000);
+                continue;
+            }
+            full = true;
+            capture_enabled.store(true, std::memory_order_release);
+            link_up.store(true, std::memory_order_relaxed);
+            sprintf(log_msg, "Redundancy: connected to the standby %s, state of %u bytes\n", config.peer, state_size);
+            openplc_log(log_msg);
+        }
+
+        if (layout_stale.load(std::memory_order_acquire))
+        {
+            if (!preparePrimary(&sent, &message, &message_capacity))
+            {
+                close(fd);
+                fd = -1;
+                link_up.store(false, std::memory_order_relaxed);
+                continue;
+            }
+            full = true;
+            capture_enabled.store(true, std::memory_order_release);
+        }
+
+        if (!(ready_slot.load(std::memory_order_acquire) & SLOT_NEW))
+        {
+            waitProcessImage(getProcessImageVersion() + 1, 100);
+            continue;
+        }
+        read_slot = ready_slot.exchange(read_slot, std::memory_order_acq_rel) & SLOT_INDEX;
+
+        size_t length = buildDelta(slots[read_slot], sent, full, ++sequence, slot_tick[read_slot], message);
+        if (!sendAll(fd, message, length))
+        {
+            sprintf(log_msg, "Redundancy: link to the standby %s lost\n", config.peer);
+            openplc_log(log_msg);
+            capture_enabled.store(false, std::memory_order_relaxed);
+            link_up.store(false, std::memory_order_relaxed);
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        full = false;
+        messages.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(length, std::memory_order_relaxed);
+        last_message_size.store((uint32_t)length, std::memory_order_relaxed);
+        last_sequence.store(sequence, std::memory_order_relaxed);
+    }
+
+    capture_enabled.store(false, std::memory_order_relaxed);
+    link_up.store(false, std::memory_order_relaxed);
+    if (fd >= 0) close(fd);
+    free(sent);
+    free(message);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Receives the messages of one connection of the primary and applies them,
+// until the link drops or this unit takes over
+//-----------------------------------------------------------------------------
+static void receiveState(int fd)
+{
+    char log_msg[1000];
+    uint8_t *body = NULL;
+    size_t body_capacity = 0;
+    bool synced = false;
+
+    while (redundancy_running)
+    {
+        SyncHeader header;
+        // The primary sends a message every scan, a long silence is a dead link
+        if (!receiveAll(fd, &header, sizeof(header), 2000)) break;
+        if (header.magic != SYNC_MAGIC || header.version != SYNC_VERSION)
+        {
+            openplc_log((char *)"Redundancy: invalid message from the primary\n");
+            break;
+        }
+
+        size_t length = (size_t)header.range_count * sizeof(SyncRange) + header.data_size;
+        if (header.data_size > header.state_size || header.range_count > header.state_size / SYNC_BLOCK + 1)
+        {
+            openplc_log((char *)"Redundancy: invalid message from the primary\n");
+            break;
+        }
+        if (length > body_capacity)
+        {
+            uint8_t *larger = (uint8_t *)realloc(body, length);
+            if (larger == NULL) break;
+            body = larger;
+            body_capacity = length;
+        }
+        if (!receiveAll(fd, body, length, 2000)) break;
+
+        // Takeover is decided holding bufferLock, no state lands after it
+        lockBuffer();
+        if (taken_over.load(std::memory_order_relaxed))
+        {
+            unlockBuffer();
+            break;
+        }
+        bool valid = true;
+        if (layout_program != plcProgram()) valid = buildLayout();
+        valid = valid && header.layout == state_layout && header.state_size == state_size;
+        valid = valid && (synced || (header.flags & SYNC_FLAG_FULL));
+        const SyncRange *ranges = (const SyncRange *)body;
+        const uint8_t *data = body + header.range_count * sizeof(SyncRange);
+
+        // Every range is checked, and their data must add up to the data of
+        // the message, before the first one is applied
+        bool well_formed = true;
+        size_t data_total = 0;
+        for (uint32_t i = 0; valid && i < header.range_count; i++)
+        {
+            if (ranges[i].offset > state_size || ranges[i].length > state_size - ranges[i].offset)
+            {
+                well_formed = false;
+                break;
+            }
+            data_total += ranges[i].length;
+        }
+        well_formed = well_formed && (!valid || data_total == header.data_size);
+        valid = valid && well_formed;
+
+        for (uint32_t i = 0; valid && i < header.range_count; i++)
+        {
+            applyRange(ranges[i].offset, ranges[i].length, data);
+            data += ranges[i].length;
+        }
+        if (valid) __tick = header.tick;
+        unlockBuffer();
+
+        if (!well_formed)
+        {
+            openplc_log((char *)"Redundancy: invalid state ranges from the primary, its state is ignored\n");
+            break;
+        }
+        if (!valid)
+        {
+            openplc_log((char *)"Redundancy: the primary runs a different program, its state is ignored\n");
+            break;
+        }
+        if (!synced)
+        {
+            sprintf(log_msg, "Redundancy: synchronized with the primary, state of %u bytes\n", state_size);
+            openplc_log(log_msg);
+        }
+        synced = true;
+        updates_applied.fetch_add(1, std::memory_order_release);
+        messages.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(sizeof(header) + length, std::memory_order_relaxed);
+        last_message_size.store((uint32_t)(sizeof(header) + length), std::memory_order_relaxed);
+        last_sequence.store(header.sequence, std::memory_order_relaxed);
+    }
+    free(body);
+}
+
+//-----------------------------------------------------------------------------
+// Thread of the standby: waits for the primary and applies its state until
+// this unit takes over
+//-----------------------------------------------------------------------------
+static void *standbyThread(void *arg)
+{
+    char log_msg[1000];
+    setThreadClass(THREAD_CLASS_COMM, "redundancy_stby");
+
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    int listen_fd = -1;
+    if (getaddrinfo(config.bind[0] ? config.bind : NULL, config.port, &hints, &result) == 0)
+    {
+        listen_fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+        int reuse = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (listen_fd >= 0 && (bind(listen_fd, result->ai_addr, result->ai_addrlen) != 0 || listen(listen_fd, 1) != 0))
+        {
+            close(listen_fd);
+            listen_fd = -1;
+        }
+        freeaddrinfo(result);
+    }
+    if (listen_fd < 0)
+    {
+        sprintf(log_msg, "Redundancy: can't listen on port %s => %s\n", config.port, strerror(errno));
+        openplc_log(log_msg);
+    }
+
+    bool announced = false;
+    while (redundancy_running)
+    {
+        if (taken_over.load(std::memory_order_acquire))
+        {
+            // The primary is not followed anymore, even if it comes back
+            if (!announced)
+            {
+                openplc_log((char *)"Redundancy: no updates from the primary, this unit took over\n");
+                announced = true;
+                if (listen_fd >= 0) close(listen_fd);
+                listen_fd = -1;
+            }
+            sleepms(100);
+            continue;
+        }
+        if (listen_fd < 0)
+        {
+            sleepms(100);
+            continue;
+        }
+
+        struct pollfd pfd = {listen_fd, POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0) continue;
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) continue;
+
+        int nodelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+        link_up.store(true, std::memory_order_relaxed);
+        openplc_log((char *)"Redundancy: primary connected\n");
+        receiveState(fd);
+        link_up.store(false, std::memory_order_relaxed);
+        close(fd);
+        if (!taken_over.load(std::memory_order_relaxed)) openplc_log((char *)"Redundancy: link to the primary lost\n");
+    }
+
+    if (listen_fd >= 0) close(listen_fd);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Starts the redundancy link if redundancy.cfg gives this runtime a role.
+// Must be called before the first scan, a standby starts without running
+// the program
+//-----------------------------------------------------------------------------
+void startRedundancy()
+{
+    char log_msg[1000];
+
+    if (redundancy_running || !loadRedundancyConfig()) return;
+
+    clock_gettime(CLOCK_MONOTONIC, &grace_deadline);
+    grace_deadline.tv_sec += config.startup_grace_ms / 1000;
+    grace_deadline.tv_nsec += (long)(config.startup_grace_ms % 1000) * 1000000;
+    if (grace_deadline.tv_nsec >= 1000000000)
+    {
+        grace_deadline.tv_nsec -= 1000000000;
+        grace_deadline.tv_sec++;
+    }
+
+    redundancy_running = true;
+    void *(*thread)(void *) = config.role == ROLE_PRIMARY ? primaryThread : standbyThread;
+    if (pthread_create(&redundancy_thread, NULL, thread, NULL) != 0)
+    {
+        redundancy_running = false;
+        openplc_log((char *)"Redundancy: failed to start the redundancy thread\n");
+        return;
+    }
+
+    if (config.role == ROLE_PRIMARY) sprintf(log_msg, "Redundancy: primary, sending the state to %s:%s\n", config.peer, config.port);
+    else sprintf(log_msg, "Redundancy: standby, waiting for the primary on port %s\n", config.port);
+    openplc_log(log_msg);
+}
+
+void stopRedundancy()
+{
+    if (!redundancy_running) return;
+
+    redundancy_running = false;
+    pthread_join(redundancy_thread, NULL);
+}
+
+//-----------------------------------------------------------------------------
+// Writes the role, the state of the link and its statistics to buffer.
+// Returns the length written
+//-----------------------------------------------------------------------------
+int getRedundancyStatus(char *buffer, size_t buffer_size)
+{
+    const char *role = "none";
+    const char *state = "disabled";
+    if (config.role == ROLE_PRIMARY && redundancy_running)
+    {
+        role = "primary";
+        state = "active";
+    }
+    else if (config.role == ROLE_STANDBY && redundancy_running)
+    {
+        role = "standby";
+        if (taken_over.load()) state = "active (took over)";
+        else state = updates_applied.load() > 0 ? "standby (synchronized)" : "standby (waiting)";
+    }
+
+    int length = snprintf(buffer, buffer_size,
+                          "role: %s\nstate: %s\nlink: %s\nmessages: %llu\nbytes: %llu\nlast_message: %u\nsequence: %llu\nstate_size: %u\n",
+                          role, state, link_up.load() ? "up" : "down",
+                          (unsigned long long)messages.load(), (unsigned long long)bytes.load(),
+                          last_message_size.load(), (unsigned long long)last_sequence.load(), state_size);
+    return length < (int)buffer_size ? length : (int)buffer_size - 1;
+}
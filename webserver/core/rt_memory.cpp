@@ -0,0 +1,207 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the memory setup of the real-time threads. The heap
+// is configured so the memory locked by mlockall() is never given back to
+// the system, the stacks of the real-time threads are touched up front so
+// they don't page fault while running, and the heap allocations made by a
+// thread can be reported (or made fatal) once its initialization is done.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <atomic>
+
+#include "ladder.h"
+
+#define MAX_STACK_PREFAULT  (4 * 1024 * 1024)
+
+// glibc entry points of the allocator, used by the checked versions below
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+static __thread int heap_check_mode = HEAP_CHECK_OFF;
+static __thread bool heap_check_reporting = false;
+static std::atomic<uint32_t> heap_check_count(0);
+
+//-----------------------------------------------------------------------------
+// Keeps the freed heap memory in the process and serves the large blocks
+// from the heap instead of separate mappings, so the pages locked at startup
+// are reused instead of being unmapped and faulted in again
+//-----------------------------------------------------------------------------
+void configureHeap()
+{
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Touches size bytes of the calling thread stack, so the pages are mapped
+// (and locked, after mlockall) before the thread enters its cycle
+//-----------------------------------------------------------------------------
+void __attribute__((noinline)) prefaultStack(size_t size)
+{
+    if (size > MAX_STACK_PREFAULT) size = MAX_STACK_PREFAULT;
+
+    volatile unsigned char *stack = (volatile unsigned char *)__builtin_alloca(size);
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < size; i += page)
+    {
+        stack[i] = 0;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Sets what happens when the calling thread allocates from the heap:
+// HEAP_CHECK_OFF    - nothing, the allocation is just made
+// HEAP_CHECK_REPORT - the allocation is made and reported on the log
+// HEAP_CHECK_ABORT  - the allocation is reported and the runtime aborts
+// HEAP_CHECK_COUNT  - the allocation is made and only counted (benchmarks)
+//-----------------------------------------------------------------------------
+void armHeapCheck(int mode)
+{
+    heap_check_mode = mode;
+}
+
+//-----------------------------------------------------------------------------
+// Reports a heap allocation made by a checked thread. Only the first one and
+// then every power of two are logged, so an allocation done every scan only
+// shows up a few times
+//-----------------------------------------------------------------------------
+static void heapAllocationCaught(size_t size, void *caller)
+{
+    if (heap_check_mode == HEAP_CHECK_COUNT)
+    {
+        heap_check_count.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    if (heap_check_reporting) return;
+    heap_check_reporting = true;
+
+    uint32_t count = heap_check_count.fetch_add(1, std::memory_order_relaxed) + 1;
+    char log_msg[256];
+    snprintf(log_msg, sizeof(log_msg), "Heap allocation of %lu bytes from a real-time thread (caller %p, %u so far)\n", (unsigned long)size, caller, count);
+
+    if (heap_check_mode == HEAP_CHECK_ABORT)
+    {
+        // The log thread may not get to run, so the message goes straight out
+        if (write(STDERR_FILENO, log_msg, strlen(log_msg)) < 0) {}
+        abort();
+    }
+
+    if ((count & (count - 1)) == 0)
+    {
+        openplc_log_event(LOG_LEVEL_WARNING, LOG_SOURCE_RUNTIME, LOG_CODE_HEAP_ALLOCATION, (uint32_t)size, count, log_msg);
+    }
+    heap_check_reporting = false;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the number of heap allocations caught on the checked threads so far
+//-----------------------------------------------------------------------------
+uint32_t heapAllocationCount()
+{
+    return heap_check_count.load(std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// Checked versions of the allocator. They only differ from the glibc ones on
+// the threads that armed the heap check
+//-----------------------------------------------------------------------------
+extern "C" void *malloc(size_t size)
+{
+    if (__builtin_expect(heap_check_mode != HEAP_CHECK_OFF, 0)) heapAllocationCaught(size, __builtin_return_address(0));
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    if (__builtin_expect(heap_check_mode != HEAP_CHECK_OFF, 0)) heapAllocationCaught(count * size, __builtin_return_address(0));
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    if (__builtin_expect(heap_check_mode != HEAP_CHECK_OFF, 0)) heapAllocationCaught(size, __builtin_return_address(0));
+    return __libc_realloc(ptr, size);
+}
+
+//-----------------------------------------------------------------------------
+// Reads a "Vm..." line of /proc/self/status, in kB. Returns -1 if the line
+// is missing
+//-----------------------------------------------------------------------------
+static long readProcessStatus(const char *key)
+{
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status == NULL) return -1;
+
+    char line[256];
+    long value = -1;
+    size_t key_length = strlen(key);
+    while (fgets(line, sizeof(line), status) != NULL)
+    {
+        if (strncmp(line, key, key_length) == 0 && line[key_length] == ':')
+        {
+            value = atol(line + key_length + 1);
+            break;
+        }
+    }
+    fclose(status);
+    return value;
+}
+
+// Bounds of the static data, placed by the linker
+extern char __data_start;
+extern char _edata;
+extern char _end;
+
+//-----------------------------------------------------------------------------
+// Logs the memory the runtime uses once it started: the static data of the
+// runtime and the program (tables and buffers sized at build time), the image
+// size of the program, and how much of the process is resident and locked by
+// mlockall()
+//-----------------------------------------------------------------------------
+void logMemoryReport()
+{
+    char log_msg[1000];
+
+    unsigned long data_kb = (unsigned long)(&_edata - &__data_start) / 1024;
+    unsigned long bss_kb = (unsigned long)(&_end - &_edata) / 1024;
+#ifdef OPLC_LOW_MEMORY
+    const char *build = "low memory build";
+#else
+    const char *build = "standard build";
+#endif
+    sprintf(log_msg, "Memory: %lu kB of static data (%lu kB initialized), I/O image of %d entries, %s\n",
+            data_kb + bss_kb, data_kb, BUFFER_SIZE, build);
+    openplc_log(log_msg);
+
+    long resident = readProcessStatus("VmRSS");
+    long locked = readProcessStatus("VmLck");
+    long heap = readProcessStatus("VmData");
+    if (resident >= 0)
+    {
+        sprintf(log_msg, "Memory: %ld kB resident, %ld kB locked, %ld kB of data and heap mappings\n", resident, locked, heap);
+        openplc_log(log_msg);
+    }
+}
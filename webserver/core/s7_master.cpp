@@ -0,0 +1,743 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file is the S7 master. It parses the s7config.cfg file, which lists
+// remote Siemens PLCs the same way mbconfig.cfg lists the Modbus slave
+// devices, and polls blocks of their data blocks into the input image. Each
+// PLC is polled by its own thread with the snap7 client: the blocks are cut
+// into the items of as few ReadMultiVars requests as the PDU size negotiated
+// with the PLC allows, so a poll is usually a single round trip.
+//
+// The blocks are copied to %IW (each pair of DB bytes is a big-endian word)
+// or to %IX (each DB byte fills the 8 bits of an input byte), from the
+// position given for each block, which must not be used by other I/O.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include <atomic>
+
+#include <iostream>
+#include <fstream>
+#include <string>
+
+#include "ladder.h"
+#include "oplc_snap7.h"
+
+using namespace std;
+
+#define S7_MAX_BLOCKS           32      // blocks polled from each PLC
+#define S7_DEFAULT_PDU          960     // PDU requested, the PLC answers with the one it supports
+#define S7_MIN_PDU              240
+
+//sizes of a read request and of its answer (header, function and item count)
+#define S7_REQUEST_HEADER       12
+#define S7_REQUEST_ITEM         12
+#define S7_ANSWER_HEADER        14
+#define S7_ANSWER_ITEM          4       // return code, transport size, length
+
+#define S7_FAILURE_LOG_PERIOD   60000   // ms between summaries of repeated connection failures
+#define S7_BACKOFF_MAX          30000   // longest wait between connection attempts (ms)
+
+#define S7_FRESH_BUFFER         4
+
+//-----------------------------------------------------------------------------
+// A range of a data block and where it goes on the input image
+//-----------------------------------------------------------------------------
+struct S7_block
+{
+    int db_number;
+    int start;                  // first byte on the data block
+    int size;                   // bytes
+    bool bits;                  // to %IX instead of %IW
+    int image_start;            // first %IW word, or first %IX byte
+    int buffer_offset;          // first byte on the device buffers
+};
+
+//-----------------------------------------------------------------------------
+// A piece of a block read as one item of a ReadMultiVars request. Blocks
+// larger than an answer can hold are cut into several items
+//-----------------------------------------------------------------------------
+struct S7_item
+{
+    int db_number;
+    int start;
+    int size;
+    int buffer_offset;
+};
+
+struct S7_request
+{
+    int first_item;
+    int num_items;
+};
+
+//-----------------------------------------------------------------------------
+// Statistics of a PLC. Only its thread writes them and any thread may read
+// them, so they are plain relaxed atomics without locks
+//-----------------------------------------------------------------------------
+struct S7_device_stats
+{
+    std::atomic<uint64_t> polls;
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> errors;           // failed requests, timeouts included
+    std::atomic<uint64_t> timeouts;
+    std::atomic<uint64_t> item_errors;      // items the PLC refused in requests answered
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> latency_sum_us;   // round trips of the requests answered
+    std::atomic<uint64_t> latency_min_us;
+    std::atomic<uint64_t> latency_max_us;
+    std::atomic<uint64_t> reconnects;
+    std::atomic<uint64_t> connect_failures;
+    std::atomic<int> pdu_length;            // negotiated on the last connection
+};
+
+struct S7_device
+{
+    TS7Client *client;
+    char dev_name[100];
+    char dev_address[100];
+    int rack;
+    int slot;
+    int polling_period;
+    int pdu_request;
+
+    struct S7_block blocks[S7_MAX_BLOCKS];
+    int num_blocks;
+    int buffer_size;            // bytes of all the blocks
+
+    //items and requests of a poll, laid out for the negotiated PDU
+    struct S7_item *items;
+    int num_items;
+    struct S7_request *requests;
+    int num_requests;
+    TS7DataItem request_items[MaxVars];
+
+    //triple buffer that passes the blocks from the thread to the scan
+    //without locks, like the buffers of the Modbus buses
+    uint8_t *buffers[3];
+    std::atomic<int> shared;    // index of the shared buffer, with S7_FRESH_BUFFER if unseen
+    int producer;
+    int consumer;
+
+    //reconnection of a PLC that is down: attempts back off exponentially
+    //and only the first failure and a periodic summary are logged
+    bool connected;
+    bool was_connected;
+    int backoff_ms;
+    int failed_connects;
+    struct timespec next_failure_log;
+    struct timespec next_poll;
+
+    struct S7_device_stats stats;
+};
+
+static struct S7_device *s7_devices = NULL;
+static int num_s7_devices = 0;
+static int s7_polling_period = 100;
+static int s7_timeout = 1000;
+
+//-----------------------------------------------------------------------------
+// Adds the given number of milliseconds to a timespec
+//-----------------------------------------------------------------------------
+static void addMilliseconds(struct timespec *ts, int milliseconds)
+{
+    ts->tv_sec += milliseconds / 1000;
+    ts->tv_nsec += (long)(milliseconds % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000)
+    {
+        ts->tv_nsec -= 1000000000;
+        ts->tv_sec++;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Returns true if timespec a is earlier than timespec b
+//-----------------------------------------------------------------------------
+static bool timeBefore(struct timespec *a, struct timespec *b)
+{
+    return (a->tv_sec < b->tv_sec) || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+//-----------------------------------------------------------------------------
+// Adds to a statistic. Statistics have a single writer, so no atomic
+// read-modify-write is needed
+//-----------------------------------------------------------------------------
+static inline void statAdd(std::atomic<uint64_t> *stat, uint64_t value)
+{
+    stat->store(stat->load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// Increments the communication error counter (%ML1026), shared with the
+// Modbus master
+//-----------------------------------------------------------------------------
+static void countCommError()
+{
+    if (special_functions[2] != NULL) __atomic_fetch_add(special_functions[2], 1, __ATOMIC_RELAXED);
+}
+
+//-----------------------------------------------------------------------------
+// Returns the snap7 text of an error
+//-----------------------------------------------------------------------------
+static const char *s7ErrorText(int error, char *text, int size)
+{
+    Cli_ErrorText(error, text, size);
+    return text;
+}
+
+//-----------------------------------------------------------------------------
+// Parses the setting of a block of a PLC. parameter is what follows the
+// device number, e.g. "block2.DB_Number"
+//-----------------------------------------------------------------------------
+static void parseBlockSetting(struct S7_device *dev, char *parameter, char *line)
+{
+    char temp_buffer[20];
+    int block_number = atoi(parameter + 5);
+    char *key = strchr(parameter, '.');
+
+    if (key == NULL || block_number < 0 || block_number >= S7_MAX_BLOCKS)
+    {
+        char log_msg[1000];
+        sprintf(log_msg, "S7 master: ignoring %s of PLC %s, up to %d blocks are polled from each PLC\n", parameter, dev->dev_name, S7_MAX_BLOCKS);
+        openplc_log(log_msg);
+        return;
+    }
+    key++;
+
+    struct S7_block *block = &dev->blocks[block_number];
+    if (block_number >= dev->num_blocks) dev->num_blocks = block_number + 1;
+    getData(line, temp_buffer, '"', '"');
+
+    if (!strncmp(key, "DB_Number", 9))
+        block->db_number = atoi(temp_buffer);
+    else if (!strncmp(key, "Start", 5))
+        block->start = atoi(temp_buffer);
+    else if (!strncmp(key, "Size", 4))
+        block->size = atoi(temp_buffer);
+    else if (!strncmp(key, "Type", 4))
+        block->bits = !strcmp(temp_buffer, "bool") || !strcmp(temp_buffer, "BOOL");
+    else if (!strncmp(key, "Input_Start", 11))
+        block->image_start = atoi(temp_buffer);
+}
+
+//-----------------------------------------------------------------------------
+// Parses the s7config.cfg file. It has the format of mbconfig.cfg: global
+// settings and device<n>.<setting> lines, with block<m>.<setting> lines for
+// the blocks polled from each PLC
+//-----------------------------------------------------------------------------
+static void parseS7Config()
+{
+    string line;
+    char line_str[1024];
+    ifstream cfgfile("s7config.cfg");
+
+    if (!cfgfile.is_open()) return;
+
+    while (getline(cfgfile, line))
+    {
+        strncpy(line_str, line.c_str(), 1024);
+        line_str[1023] = '\0';
+        if (line_str[0] == '#' || strlen(line_str) <= 1) continue;
+
+        if (!strncmp(line_str, "Num_Devices", 11))
+        {
+            char temp_buffer[5];
+            getData(line_str, temp_buffer, '"', '"');
+            num_s7_devices = atoi(temp_buffer);
+            if (num_s7_devices < 0) num_s7_devices = 0;
+            s7_devices = new S7_device[num_s7_devices]();
+        }
+        else if (!strncmp(line_str, "Polling_Period", 14))
+        {
+            char temp_buffer[10];
+            getData(line_str, temp_buffer, '"', '"');
+            s7_polling_period = atoi(temp_buffer);
+        }
+        else if (!strncmp(line_str, "Timeout", 7))
+        {
+            char temp_buffer[10];
+            getData(line_str, temp_buffer, '"', '"');
+            s7_timeout = atoi(temp_buffer);
+        }
+        else if (!strncmp(line_str, "device", 6))
+        {
+            int deviceNumber = getDeviceNumber(line_str);
+            if (deviceNumber < 0 || deviceNumber >= num_s7_devices) continue;
+            struct S7_device *dev = &s7_devices[deviceNumber];
+
+            char parameter[100];
+            getFunction(line_str, parameter);
+
+            if (!strncmp(parameter, "block", 5))
+            {
+                parseBlockSetting(dev, parameter, line_str);
+            }
+            else if (!strncmp(parameter, "name", 4))
+            {
+                getData(line_str, dev->dev_name, '"', '"');
+            }
+            else if (!strncmp(parameter, "address", 7))
+            {
+                getData(line_str, dev->dev_address, '"', '"');
+            }
+            else if (!strncmp(parameter, "Rack", 4))
+            {
+                char temp_buffer[5];
+                getData(line_str, temp_buffer, '"', '"');
+                dev->rack = atoi(temp_buffer);
+            }
+            else if (!strncmp(parameter, "Slot", 4))
+            {
+                char temp_buffer[5];
+                getData(line_str, temp_buffer, '"', '"');
+                dev->slot = atoi(temp_buffer);
+            }
+            else if (!strncmp(parameter, "Polling_Period", 14))
+            {
+                char temp_buffer[10];
+                getData(line_str, temp_buffer, '"', '"');
+                dev->polling_period = atoi(temp_buffer);
+            }
+            else if (!strncmp(parameter, "PDU_Size", 8))
+            {
+                char temp_buffer[10];
+                getData(line_str, temp_buffer, '"', '"');
+                dev->pdu_request = atoi(temp_buffer);
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Checks the blocks of a PLC and lays them out on its buffers. Blocks that
+// are empty or fall outside the input image are dropped
+//-----------------------------------------------------------------------------
+static void layoutBlocks(struct S7_device *dev)
+{
+    char log_msg[1000];
+    int kept = 0;
+
+    dev->buffer_size = 0;
+    for (int b = 0; b < dev->num_blocks; b++)
+    {
+        struct S7_block block = dev->blocks[b];
+        if (block.size <= 0) continue;
+
+        int image_end = block.bits ? block.image_start + block.size : block.image_start + (block.size + 1) / 2;
+        if (block.db_number <= 0 || block.start < 0 || block.image_start < 0 || image_end > BUFFER_SIZE)
+        {
+            sprintf(log_msg, "S7 master: block %d of PLC %s (DB%d.DBB%d, %d bytes to %s%d) is not valid, it is not polled\n",
+                    b, dev->dev_name, block.db_number, block.start, block.size, block.bits ? "%IX" : "%IW", block.image_start);
+            openplc_log(log_msg);
+            continue;
+        }
+
+        block.buffer_offset = dev->buffer_size;
+        dev->buffer_size += block.size;
+        dev->blocks[kept++] = block;
+    }
+    dev->num_blocks = kept;
+
+    for (int i = 0; i < 3; i++)
+    {
+        //at least one byte so that the buffers are never NULL
+        dev->buffers[i] = (uint8_t *)calloc(dev->buffer_size + 1, 1);
+    }
+    dev->producer = 0;
+    dev->shared.store(1);
+    dev->consumer = 2;
+}
+
+//-----------------------------------------------------------------------------
+// Cuts the blocks of a PLC into the items and requests of a poll for the PDU
+// negotiated on its connection. A request takes items while both the request
+// and its answer fit the PDU, and up to the MaxVars items snap7 handles
+//-----------------------------------------------------------------------------
+static void planRequests(struct S7_device *dev, int pdu_length)
+{
+    //the largest item an answer can hold alone, even sized so a piece
+    //never needs a fill byte
+    int max_item = (pdu_length - S7_ANSWER_HEADER - S7_ANSWER_ITEM) & ~1;
+    int max_items = (pdu_length - S7_REQUEST_HEADER) / S7_REQUEST_ITEM;
+    if (max_items > MaxVars) max_items = MaxVars;
+
+    int total_items = 0;
+    for (int b = 0; b < dev->num_blocks; b++)
+    {
+        total_items += (dev->blocks[b].size + max_item - 1) / max_item;
+    }
+
+    delete[] dev->items;
+    delete[] dev->requests;
+    dev->items = new S7_item[total_items + 1];
+    dev->requests = new S7_request[total_items + 1];
+    dev->num_items = 0;
+    dev->num_requests = 0;
+
+    for (int b = 0; b < dev->num_blocks; b++)
+    {
+        struct S7_block *block = &dev->blocks[b];
+        for (int done = 0; done < block->size; done += max_item)
+        {
+            struct S7_item *item = &dev->items[dev->num_items++];
+            item->db_number = block->db_number;
+            item->start = block->start + done;
+            item->size = block->size - done < max_item ? block->size - done : max_item;
+            item->buffer_offset = block->buffer_offset + done;
+        }
+    }
+
+    //pack the items in order, the answer of each one is padded to even
+    int answer_size = 0;
+    struct S7_request *request = NULL;
+    for (int i = 0; i < dev->num_items; i++)
+    {
+        int item_size = S7_ANSWER_ITEM + ((dev->items[i].size + 1) & ~1);
+        if (request == NULL || request->num_items == max_items || answer_size + item_size > pdu_length)
+        {
+            request = &dev->requests[dev->num_requests++];
+            request->first_item = i;
+            request->num_items = 0;
+            answer_size = S7_ANSWER_HEADER;
+        }
+        request->num_items++;
+        answer_size += item_size;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Publishes the producer buffer of a PLC. The new producer buffer starts as a
+// copy of the published one, so the items refused by the PLC keep their last
+// values
+//-----------------------------------------------------------------------------
+static void publishBlocks(struct S7_device *dev)
+{
+    int published = dev->producer;
+    dev->producer = dev->shared.exchange(published | S7_FRESH_BUFFER, std::memory_order_acq_rel) & 3;
+    memcpy(dev->buffers[dev->producer], dev->buffers[published], dev->buffer_size);
+}
+
+//-----------------------------------------------------------------------------
+// Records a request to a PLC that started at start
+//-----------------------------------------------------------------------------
+static void recordRequest(struct S7_device *dev, const struct timespec *start, int result, int bytes)
+{
+    statAdd(&dev->stats.requests, 1);
+    if (result != 0)
+    {
+        statAdd(&dev->stats.errors, 1);
+        if ((result & 0xFFFF) == ETIMEDOUT) statAdd(&dev->stats.timeouts, 1);
+        return;
+    }
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long long us = (end.tv_sec - start->tv_sec) * 1000000LL + (end.tv_nsec - start->tv_nsec) / 1000;
+    if (us < 0) us = 0;
+
+    statAdd(&dev->stats.bytes, bytes);
+    statAdd(&dev->stats.latency_sum_us, us);
+    uint64_t min_us = dev->stats.latency_min_us.load(std::memory_order_relaxed);
+    if (min_us == 0 || (uint64_t)us < min_us) dev->stats.latency_min_us.store(us == 0 ? 1 : us, std::memory_order_relaxed);
+    if ((uint64_t)us > dev->stats.latency_max_us.load(std::memory_order_relaxed)) dev->stats.latency_max_us.store(us, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// Connects to a PLC and lays out the requests for the PDU it accepted. A
+// failed attempt schedules the next one with an exponential backoff
+//-----------------------------------------------------------------------------
+static void connectDevice(struct S7_device *dev)
+{
+    char log_msg[1000];
+    char error_text[256];
+    struct timespec now;
+
+    if (dev->failed_connects == 0 && dev->was_connected)
+    {
+        sprintf(log_msg, "PLC %s is disconnected. Attempting to reconnect...\n", dev->dev_name);
+        openplc_log_level(LOG_LEVEL_WARNING, log_msg);
+    }
+
+    int result = dev->client->ConnectTo(dev->dev_address, dev->rack, dev->slot);
+    if (result != 0)
+    {
+        countCommError();
+        statAdd(&dev->stats.connect_failures, 1);
+        dev->failed_connects++;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (dev->failed_connects == 1 || !timeBefore(&now, &dev->next_failure_log))
+        {
+            if (dev->failed_connects == 1)
+            {
+                sprintf(log_msg, "Connection failed on PLC %s: %s\n", dev->dev_name, s7ErrorText(result, error_text, sizeof(error_text)));
+            }
+            else
+            {
+                sprintf(log_msg, "Connection still failing on PLC %s after %d attempts: %s\n", dev->dev_name, dev->failed_connects, s7ErrorText(result, error_text, sizeof(error_text)));
+            }
+            openplc_log_level(LOG_LEVEL_ERROR, log_msg);
+            dev->next_failure_log = now;
+            addMilliseconds(&dev->next_failure_log, S7_FAILURE_LOG_PERIOD);
+        }
+
+        if (dev->backoff_ms <= 0) dev->backoff_ms = dev->polling_period;
+        dev->next_poll = now;
+        addMilliseconds(&dev->next_poll, dev->backoff_ms);
+        dev->backoff_ms *= 2;
+        if (dev->backoff_ms > S7_BACKOFF_MAX) dev->backoff_ms = S7_BACKOFF_MAX;
+        return;
+    }
+
+    int pdu_length = dev->client->PDULength();
+    if (pdu_length < S7_MIN_PDU) pdu_length = S7_MIN_PDU;
+    planRequests(dev, pdu_length);
+    dev->stats.pdu_length.store(pdu_length, std::memory_order_relaxed);
+
+    sprintf(log_msg, "Connected to PLC %s, PDU size %d, %d blocks polled with %d requests\n",
+            dev->dev_name, pdu_length, dev->num_blocks, dev->num_requests);
+    openplc_log_level(LOG_LEVEL_INFO, log_msg);
+
+    if (dev->was_connected) statAdd(&dev->stats.reconnects, 1);
+    dev->connected = true;
+    dev->was_connected = true;
+    dev->failed_connects = 0;
+    dev->backoff_ms = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Reads every block of a PLC, a ReadMultiVars request at a time, and
+// publishes them. A request that fails at the connection level drops the
+// connection, which is reopened on the next poll
+//-----------------------------------------------------------------------------
+static void pollDevice(struct S7_device *dev)
+{
+    char log_msg[1000];
+    char error_text[256];
+    uint8_t *buffer = dev->buffers[dev->producer];
+
+    statAdd(&dev->stats.polls, 1);
+    for (int r = 0; r < dev->num_requests; r++)
+    {
+        struct S7_request *request = &dev->requests[r];
+        int bytes = 0;
+        for (int i = 0; i < request->num_items; i++)
+        {
+            struct S7_item *item = &dev->items[request->first_item + i];
+            TS7DataItem *data_item = &dev->request_items[i];
+            data_item->Area = S7AreaDB;
+            data_item->WordLen = S7WLByte;
+            data_item->Result = 0;
+            data_item->DBNumber = item->db_number;
+            data_item->Start = item->start;
+            data_item->Amount = item->size;
+            data_item->pdata = buffer + item->buffer_offset;
+            bytes += item->size;
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int result = dev->client->ReadMultiVars(dev->request_items, request->num_items);
+        recordRequest(dev, &start, result, bytes);
+
+        if (result != 0)
+        {
+            countCommError();
+            sprintf(log_msg, "S7 read failed on PLC %s: %s\n", dev->dev_name, s7ErrorText(result, error_text, sizeof(error_text)));
+            openplc_log_level(LOG_LEVEL_ERROR, log_msg);
+
+            //the TCP and ISO errors are in the low bits, the client ones above
+            if ((result & 0x000FFFFF) != 0 || !dev->client->Connected())
+            {
+                dev->client->Disconnect();
+                dev->connected = false;
+                break;
+            }
+            continue;
+        }
+
+        for (int i = 0; i < request->num_items; i++)
+        {
+            if (dev->request_items[i].Result != 0) statAdd(&dev->stats.item_errors, 1);
+        }
+    }
+
+    publishBlocks(dev);
+}
+
+//-----------------------------------------------------------------------------
+// Thread that polls a PLC
+//-----------------------------------------------------------------------------
+static void *pollS7Device(void *arg)
+{
+    setThreadClass(THREAD_CLASS_COMM, "s7_master");
+
+    struct S7_device *dev = (struct S7_device *)arg;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &dev->next_poll);
+    while (run_openplc)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (timeBefore(&now, &dev->next_poll))
+        {
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &dev->next_poll, NULL);
+            continue;
+        }
+
+        if (!dev->connected)
+        {
+            connectDevice(dev);
+            if (!dev->connected) continue;
+        }
+
+        pollDevice(dev);
+
+        //a PLC that fell behind restarts its period from now instead of bursting
+        addMilliseconds(&dev->next_poll, dev->polling_period);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (timeBefore(&dev->next_poll, &now))
+        {
+            dev->next_poll = now;
+            addMilliseconds(&dev->next_poll, dev->polling_period);
+        }
+    }
+
+    dev->client->Disconnect();
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Parses s7config.cfg and starts a polling thread for each PLC configured
+//-----------------------------------------------------------------------------
+void initializeS7Master()
+{
+    char log_msg[1000];
+
+    parseS7Config();
+    for (int i = 0; i < num_s7_devices; i++)
+    {
+        struct S7_device *dev = &s7_devices[i];
+        if (dev->polling_period <= 0) dev->polling_period = s7_polling_period;
+        if (dev->pdu_request <= 0) dev->pdu_request = S7_DEFAULT_PDU;
+        layoutBlocks(dev);
+
+        dev->client = new TS7Client();
+        int32_t value = s7_timeout;
+        dev->client->SetParam(p_i32_PingTimeout, &value);
+        dev->client->SetParam(p_i32_SendTimeout, &value);
+        dev->client->SetParam(p_i32_RecvTimeout, &value);
+        value = dev->pdu_request;
+        dev->client->SetParam(p_i32_PDURequest, &value);
+
+        if (dev->num_blocks == 0)
+        {
+            sprintf(log_msg, "S7 master: PLC %s has no blocks to poll\n", dev->dev_name);
+            openplc_log(log_msg);
+            continue;
+        }
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, pollS7Device, dev) == 0)
+        {
+            pthread_detach(thread);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// This function is called by the OpenPLC in a loop, with the buffers locked.
+// The newest blocks of each PLC are copied to the input image, or the ones
+// seen on the previous cycle. It never waits for a polling thread
+//-----------------------------------------------------------------------------
+void updateBuffersIn_S7()
+{
+    for (int i = 0; i < num_s7_devices; i++)
+    {
+        struct S7_device *dev = &s7_devices[i];
+        if (dev->num_blocks == 0) continue;
+
+        if (dev->shared.load(std::memory_order_relaxed) & S7_FRESH_BUFFER)
+        {
+            dev->consumer = dev->shared.exchange(dev->consumer, std::memory_order_acq_rel) & 3;
+        }
+        uint8_t *buffer = dev->buffers[dev->consumer];
+
+        for (int b = 0; b < dev->num_blocks; b++)
+        {
+            struct S7_block *block = &dev->blocks[b];
+            uint8_t *data = buffer + block->buffer_offset;
+
+            if (block->bits)
+            {
+                for (int k = 0; k < block->size; k++)
+                {
+                    for (int bit = 0; bit < 8; bit++)
+                    {
+                        bool_input_image[block->image_start + k][bit] = (data[k] >> bit) & 1;
+                    }
+                }
+            }
+            else
+            {
+                for (int k = 0; k < block->size; k += 2)
+                {
+                    uint16_t low = k + 1 < block->size ? data[k + 1] : 0;
+                    int_input_image[block->image_start + k / 2] = (IEC_UINT)((data[k] << 8) | low);
+                }
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Sends the statistics of the PLCs to a client, a line per PLC
+//-----------------------------------------------------------------------------
+void sendS7MasterStats(LogWriter writer, void *context)
+{
+    char line[512];
+
+    for (int i = 0; i < num_s7_devices; i++)
+    {
+        struct S7_device *dev = &s7_devices[i];
+        struct S7_device_stats *stats = &dev->stats;
+
+        uint64_t requests = stats->requests.load(std::memory_order_relaxed);
+        uint64_t errors = stats->errors.load(std::memory_order_relaxed);
+        uint64_t answered = requests - errors;
+        uint64_t avg_us = answered > 0 ? stats->latency_sum_us.load(std::memory_order_relaxed) / answered : 0;
+
+        int length = snprintf(line, sizeof(line), "plc %d name %s connected %d pdu %d blocks %d requests_per_poll %d polls %llu requests %llu errors %llu timeouts %llu "
+                              "item_errors %llu bytes %llu min_us %llu avg_us %llu max_us %llu reconnects %llu connect_failures %llu\n",
+                              i, dev->dev_name, dev->connected ? 1 : 0, stats->pdu_length.load(std::memory_order_relaxed), dev->num_blocks, dev->num_requests,
+                              (unsigned long long)stats->polls.load(std::memory_order_relaxed), (unsigned long long)requests,
+                              (unsigned long long)errors, (unsigned long long)stats->timeouts.load(std::memory_order_relaxed),
+                              (unsigned long long)stats->item_errors.load(std::memory_order_relaxed),
+                              (unsigned long long)stats->bytes.load(std::memory_order_relaxed),
+                              (unsigned long long)stats->latency_min_us.load(std::memory_order_relaxed), (unsigned long long)avg_us,
+                              (unsigned long long)stats->latency_max_us.load(std::memory_order_relaxed),
+                              (unsigned long long)stats->reconnects.load(std::memory_order_relaxed),
+                              (unsigned long long)stats->connect_failures.load(std::memory_order_relaxed));
+        if (writer(context, line, length) < 0) return;
+    }
+}
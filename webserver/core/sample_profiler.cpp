@@ -0,0 +1,374 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the sampling profiler of the scan thread. While it
+// runs, a timer on the CPU clock of the scan thread sends it SIGPROF at the
+// requested rate and the handler stores the interrupted program counter, so
+// the cost on the scan is a few instructions per sample and nothing when
+// stopped. Being a CPU time clock, the timer doesn't fire while the thread
+// sleeps between scans.
+//
+// The report groups the samples by the line they map to, through addr2line
+// on the object holding each address (the runtime or the program loaded by
+// an online change). Programs built with scripts/st_line_profiling carry
+// #line directives and line tables, so the lines are the ones of the ST
+// file. The samples outside the program are counted per object.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <ucontext.h>
+#include <sys/syscall.h>
+
+#include "ladder.h"
+
+#ifdef OPLC_LOW_MEMORY
+#define SAMPLE_PROFILE_MAX_SAMPLES  4096
+#define SAMPLE_PROFILE_MAX_ROWS     128
+#else
+#define SAMPLE_PROFILE_MAX_SAMPLES  32768
+#define SAMPLE_PROFILE_MAX_ROWS     512
+#endif
+#define SAMPLE_PROFILE_MIN_HZ       10
+#define SAMPLE_PROFILE_MAX_HZ       10000
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// The sample buffer and the report tables are allocated by the first
+// profile, so a runtime that is never profiled doesn't lock them
+static uintptr_t *samples = NULL;
+static uintptr_t *unique = NULL;
+static unsigned long *counts = NULL;
+static unsigned long sample_count = 0;      // taken, can be over the buffer
+static pthread_t sampled_thread;
+static pid_t sampled_tid = 0;
+static timer_t sample_timer;
+static bool sampling = false;
+static int sample_hz = 0;
+static pthread_mutex_t sampleLock = PTHREAD_MUTEX_INITIALIZER;
+
+struct SampleRow
+{
+    char location[192];
+    unsigned long count;
+};
+
+static inline uintptr_t interruptedPc(void *context)
+{
+    ucontext_t *uc = (ucontext_t *)context;
+#if defined(__x86_64__)
+    return (uintptr_t)uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__i386__)
+    return (uintptr_t)uc->uc_mcontext.gregs[REG_EIP];
+#elif defined(__aarch64__)
+    return (uintptr_t)uc->uc_mcontext.pc;
+#elif defined(__arm__)
+    return (uintptr_t)uc->uc_mcontext.arm_pc;
+#else
+    return 0;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// SIGPROF handler, runs on the scan thread
+//-----------------------------------------------------------------------------
+static void sampleHandler(int sig, siginfo_t *info, void *context)
+{
+    unsigned long index = __atomic_fetch_add(&sample_count, 1, __ATOMIC_RELAXED);
+    if (index < SAMPLE_PROFILE_MAX_SAMPLES) samples[index] = interruptedPc(context);
+}
+
+//-----------------------------------------------------------------------------
+// Marks the calling thread as the one to sample. Called by the scan thread
+// before the first scan
+//-----------------------------------------------------------------------------
+void registerSampledThread()
+{
+    sampled_thread = pthread_self();
+    sampled_tid = (pid_t)syscall(SYS_gettid);
+}
+
+//-----------------------------------------------------------------------------
+// Stops the sampling. The samples taken are kept for the report
+//-----------------------------------------------------------------------------
+void stopSampleProfile()
+{
+    pthread_mutex_lock(&sampleLock);
+    if (sampling)
+    {
+        timer_delete(sample_timer);
+        sampling = false;
+    }
+    pthread_mutex_unlock(&sampleLock);
+}
+
+//-----------------------------------------------------------------------------
+// Drops the samples taken so far and samples the scan thread hz times per
+// second of its CPU time. Returns false when the sampling can't start
+//-----------------------------------------------------------------------------
+bool startSampleProfile(int hz)
+{
+    char log_msg[1000];
+
+    if (sampled_tid == 0) return false;
+    if (hz < SAMPLE_PROFILE_MIN_HZ) hz = SAMPLE_PROFILE_MIN_HZ;
+    if (hz > SAMPLE_PROFILE_MAX_HZ) hz = SAMPLE_PROFILE_MAX_HZ;
+
+    stopSampleProfile();
+
+    pthread_mutex_lock(&sampleLock);
+    if (samples == NULL)
+    {
+        uintptr_t *buffer = (uintptr_t *)malloc(SAMPLE_PROFILE_MAX_SAMPLES * (2 * sizeof(uintptr_t) + sizeof(unsigned long)));
+        if (buffer == NULL)
+        {
+            pthread_mutex_unlock(&sampleLock);
+            return false;
+        }
+        samples = buffer;
+        unique = buffer + SAMPLE_PROFILE_MAX_SAMPLES;
+        counts = (unsigned long *)(unique + SAMPLE_PROFILE_MAX_SAMPLES);
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = sampleHandler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+
+    clockid_t clock;
+    if (pthread_getcpuclockid(sampled_thread, &clock) != 0)
+    {
+        pthread_mutex_unlock(&sampleLock);
+        return false;
+    }
+
+    struct sigevent event;
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_notify_thread_id = sampled_tid;
+    if (timer_create(clock, &event, &sample_timer) != 0)
+    {
+        sprintf(log_msg, "Sample profiler: can't create the timer (%s)\n", strerror(errno));
+        openplc_log(log_msg);
+        pthread_mutex_unlock(&sampleLock);
+        return false;
+    }
+
+    __atomic_store_n(&sample_count, 0, __ATOMIC_RELAXED);
+    struct itimerspec period;
+    period.it_interval.tv_sec = 0;
+    period.it_interval.tv_nsec = 1000000000L / hz;
+    period.it_value = period.it_interval;
+    timer_settime(sample_timer, 0, &period, NULL);
+    sampling = true;
+    sample_hz = hz;
+    pthread_mutex_unlock(&sampleLock);
+
+    sprintf(log_msg, "Sample profiler: sampling the scan thread at %d Hz\n", hz);
+    openplc_log(log_msg);
+    return true;
+}
+
+static int compareAddresses(const void *a, const void *b)
+{
+    uintptr_t x = *(const uintptr_t *)a, y = *(const uintptr_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void addRow(SampleRow *rows, int *row_count, const char *location, unsigned long count)
+{
+    for (int i = 0; i < *row_count; i++)
+    {
+        if (strcmp(rows[i].location, location) == 0)
+        {
+            rows[i].count += count;
+            return;
+        }
+    }
+    // Past the table the samples go on the last row
+    if (*row_count == SAMPLE_PROFILE_MAX_ROWS)
+    {
+        snprintf(rows[SAMPLE_PROFILE_MAX_ROWS - 1].location, sizeof(rows[0].location), "(other)");
+        rows[SAMPLE_PROFILE_MAX_ROWS - 1].count += count;
+        return;
+    }
+    snprintf(rows[*row_count].location, sizeof(rows[0].location), "%s", location);
+    rows[*row_count].count = count;
+    (*row_count)++;
+}
+
+static bool isStLine(const char *location)
+{
+    const char *colon = strrchr(location, ':');
+    if (colon == NULL) return false;
+    int length = (int)(colon - location);
+    return (length > 3 && strncmp(colon - 3, ".st", 3) == 0) || (length > 4 && strncmp(colon - 4, ".evt", 4) == 0);
+}
+
+//-----------------------------------------------------------------------------
+// Symbolizes the addresses in [first, last) that belong to the same object
+// with one run of addr2line, adding them to the rows
+//-----------------------------------------------------------------------------
+static void symbolizeObject(uintptr_t *unique, unsigned long *counts, int first, int last, SampleRow *rows, int *row_count)
+{
+    Dl_info info;
+    dladdr((void *)unique[first], &info);
+
+    // The runtime itself shows up with no name (or argv[0]) on the link map
+    char runtime[512];
+    const char *object = info.dli_fname;
+    if (object == NULL || object[0] != '/')
+    {
+        ssize_t length = readlink("/proc/self/exe", runtime, sizeof(runtime) - 1);
+        runtime[length > 0 ? length : 0] = '\0';
+        object = runtime;
+    }
+    const char *object_name = strrchr(object, '/') ? strrchr(object, '/') + 1 : object;
+    bool position_independent = ((ElfW(Ehdr) *)info.dli_fbase)->e_type == ET_DYN;
+
+    char addresses[] = "/tmp/openplc_samples_XXXXXX";
+    int fd = mkstemp(addresses);
+    FILE *list = fd >= 0 ? fdopen(fd, "w") : NULL;
+    FILE *lines = NULL;
+    if (list != NULL)
+    {
+        for (int i = first; i < last; i++)
+        {
+            uintptr_t address = position_independent ? unique[i] - (uintptr_t)info.dli_fbase : unique[i];
+            fprintf(list, "%lx\n", (unsigned long)address);
+        }
+        fclose(list);
+
+        char command[1024];
+        snprintf(command, sizeof(command), "addr2line -e '%s' < %s 2>/dev/null", object, addresses);
+        lines = popen(command, "r");
+    }
+
+    char location[192];
+    char other[192];
+    snprintf(other, sizeof(other), "[%s]", object_name);
+    for (int i = first; i < last; i++)
+    {
+        if (lines != NULL && fgets(location, sizeof(location), lines) != NULL)
+        {
+            location[strcspn(location, " \r\n")] = '\0';
+            addRow(rows, row_count, isStLine(location) ? location : other, counts[i]);
+        }
+        else
+        {
+            addRow(rows, row_count, other, counts[i]);
+        }
+    }
+
+    if (lines != NULL) pclose(lines);
+    if (fd >= 0) unlink(addresses);
+}
+
+//-----------------------------------------------------------------------------
+// Writes a text table with the samples taken on every ST line, the most
+// sampled first. Returns the number of characters written
+//-----------------------------------------------------------------------------
+int getSampleProfile(char *buffer, size_t buffer_size)
+{
+    static SampleRow rows[SAMPLE_PROFILE_MAX_ROWS];
+
+    pthread_mutex_lock(&sampleLock);
+    unsigned long taken = __atomic_load_n(&sample_count, __ATOMIC_RELAXED);
+    int stored = taken < SAMPLE_PROFILE_MAX_SAMPLES ? (int)taken : SAMPLE_PROFILE_MAX_SAMPLES;
+    if (stored > 0) memcpy(unique, samples, stored * sizeof(uintptr_t));
+    bool running = sampling;
+    int hz = sample_hz;
+    pthread_mutex_unlock(&sampleLock);
+
+    // Count each address once
+    qsort(unique, stored, sizeof(uintptr_t), compareAddresses);
+    int unique_count = 0;
+    for (int i = 0; i < stored; i++)
+    {
+        if (unique_count > 0 && unique[unique_count - 1] == unique[i])
+        {
+            counts[unique_count - 1]++;
+        }
+        else
+        {
+            unique[unique_count] = unique[i];
+            counts[unique_count++] = 1;
+        }
+    }
+
+    // The addresses are sorted, so the ones of an object are contiguous
+    int row_count = 0;
+    for (int first = 0; first < unique_count;)
+    {
+        Dl_info info;
+        int last = first + 1;
+        if (dladdr((void *)unique[first], &info) == 0 || info.dli_fbase == NULL)
+        {
+            addRow(rows, &row_count, "[unknown]", counts[first]);
+            first = last;
+            continue;
+        }
+        while (last < unique_count)
+        {
+            Dl_info next;
+            if (dladdr((void *)unique[last], &next) == 0 || next.dli_fbase != info.dli_fbase) break;
+            last++;
+        }
+        symbolizeObject(unique, counts, first, last, rows, &row_count);
+        first = last;
+    }
+
+    // Most sampled first
+    for (int i = 1; i < row_count; i++)
+    {
+        SampleRow row = rows[i];
+        int j = i;
+        while (j > 0 && rows[j - 1].count < row.count)
+        {
+            rows[j] = rows[j - 1];
+            j--;
+        }
+        rows[j] = row;
+    }
+
+    int written = snprintf(buffer, buffer_size, "samples %lu at %d Hz%s%s\n", taken, hz,
+                           running ? ", running" : "",
+                           taken > SAMPLE_PROFILE_MAX_SAMPLES ? ", buffer full (restart to sample again)" : "");
+    written += snprintf(buffer + written, buffer_size > (size_t)written ? buffer_size - written : 0,
+                        "%8s %7s  %s\n", "samples", "%", "line");
+    for (int i = 0; i < row_count && written < (int)buffer_size; i++)
+    {
+        written += snprintf(buffer + written, buffer_size - written, "%8lu %7.2f  %s\n",
+                            rows[i].count, stored > 0 ? 100.0 * rows[i].count / stored : 0.0, rows[i].location);
+    }
+
+    if (written > (int)buffer_size) written = buffer_size;
+    return written;
+}
@@ -0,0 +1,235 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file aligns the start of the scans to a network time base. Without
+// it the tick grid starts wherever the runtime started, and it drifts with
+// the oscillator of the board, so two PLCs on the same period start their
+// scans at any phase from each other. With scan_alignment.cfg the scans
+// start on the multiples of the tick since the epoch of a reference clock:
+// CLOCK_TAI or CLOCK_REALTIME disciplined by PTP (phc2sys) or NTP, or the
+// PTP hardware clock of the NIC itself. Every runtime on the same clock and
+// period then starts its scans at the same time, within the precision of the
+// clock, and the latency of the data they exchange (network variables,
+// coordinated lines) is bounded by the period.
+//
+// The scan still sleeps on CLOCK_MONOTONIC, the reference clock is only read
+// to correct its deadlines: the first scan steps to the next boundary of the
+// grid, and from there on the phase error is slewed out by at most
+// max_slew ppm of the period per scan, so the tick grid of the program never
+// jumps. An error larger than step_threshold (the reference clock stepped,
+// or an overrun on the extend policy) is corrected with a step again.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <atomic>
+
+#include "ladder.h"
+
+#define ALIGNMENT_CONFIG_FILE   "scan_alignment.cfg"
+
+#ifndef CLOCK_TAI
+#define CLOCK_TAI               11
+#endif
+
+// Clock id of a dynamic POSIX clock (a PTP hardware clock) from its file
+#define FD_TO_CLOCKID(fd)       ((~(clockid_t)(fd) << 3) | 3)
+
+#define ALIGNMENT_SAMPLES       3   // reads of the clocks, the tightest is kept
+
+struct ScanAlignmentConfig
+{
+    bool enabled;
+    char clock_name[64];
+    clockid_t clock;
+    long long offset_ns;        // offset of the scan starts from the multiples of the tick
+    long long max_slew_ppm;     // largest correction per scan, in ppm of the tick
+    long long step_ns;          // errors over this are stepped instead of slewed
+};
+
+static ScanAlignmentConfig config;
+static int ptp_fd = -1;
+static bool stepped = false;    // scan thread only
+
+// Statistics, only updated by the scan thread
+static std::atomic<long long> phase_error_ns(0);
+static std::atomic<long long> max_phase_error_ns(0);
+static std::atomic<uint64_t> step_count(0);
+static std::atomic<uint64_t> clock_errors(0);
+
+//-----------------------------------------------------------------------------
+// Offset of the reference clock from CLOCK_MONOTONIC, in nanoseconds. The
+// clocks are read a few times and the read with the shortest window is kept
+//-----------------------------------------------------------------------------
+static bool readClockOffset(long long *offset)
+{
+    long long best_window = -1;
+    for (int i = 0; i < ALIGNMENT_SAMPLES; i++)
+    {
+        struct timespec before, reference, after;
+        clock_gettime(CLOCK_MONOTONIC, &before);
+        if (clock_gettime(config.clock, &reference) != 0) return false;
+        clock_gettime(CLOCK_MONOTONIC, &after);
+
+        long long before_ns = (long long)before.tv_sec * 1000000000LL + before.tv_nsec;
+        long long after_ns = (long long)after.tv_sec * 1000000000LL + after.tv_nsec;
+        long long reference_ns = (long long)reference.tv_sec * 1000000000LL + reference.tv_nsec;
+        long long window = after_ns - before_ns;
+        if (best_window < 0 || window < best_window)
+        {
+            best_window = window;
+            *offset = reference_ns - (before_ns + window / 2);
+        }
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Applies one setting of scan_alignment.cfg
+//-----------------------------------------------------------------------------
+static void applyScanAlignmentSetting(const char *section, char *key, char *value, void *context)
+{
+    if (key == NULL) return;
+
+    if (strcmp(key, "enabled") == 0) config.enabled = (strcmp(value, "true") == 0);
+    else if (strcmp(key, "clock") == 0) snprintf(config.clock_name, sizeof(config.clock_name), "%s", value);
+    else if (strcmp(key, "offset") == 0) config.offset_ns = atoll(value) * 1000;
+    else if (strcmp(key, "max_slew") == 0) config.max_slew_ppm = atoll(value);
+    else if (strcmp(key, "step_threshold") == 0) config.step_ns = atoll(value) * 1000;
+}
+
+//-----------------------------------------------------------------------------
+// Reads scan_alignment.cfg. A missing file leaves the scans on the grid of
+// CLOCK_MONOTONIC
+//-----------------------------------------------------------------------------
+void loadScanAlignment()
+{
+    char log_msg[1000];
+
+    memset(&config, 0, sizeof(config));
+    strcpy(config.clock_name, "tai");
+    config.max_slew_ppm = 500;
+    config.step_ns = 1000000;
+
+    if (!parseSettingsFile(ALIGNMENT_CONFIG_FILE, applyScanAlignmentSetting, NULL)) return;
+
+    if (!config.enabled) return;
+    if (config.offset_ns < 0) config.offset_ns = 0;
+    if (config.max_slew_ppm < 1) config.max_slew_ppm = 1;
+    if (config.step_ns < 0) config.step_ns = 0;
+
+    if (strcmp(config.clock_name, "tai") == 0) config.clock = CLOCK_TAI;
+    else if (strcmp(config.clock_name, "realtime") == 0) config.clock = CLOCK_REALTIME;
+    else
+    {
+        ptp_fd = open(config.clock_name, O_RDONLY);
+        if (ptp_fd < 0)
+        {
+            sprintf(log_msg, "Scan alignment: could not open the clock %s, the scans are not aligned\n", config.clock_name);
+            openplc_log(log_msg);
+            config.enabled = false;
+            return;
+        }
+        config.clock = FD_TO_CLOCKID(ptp_fd);
+    }
+
+    long long offset;
+    if (!readClockOffset(&offset))
+    {
+        sprintf(log_msg, "Scan alignment: could not read the clock %s, the scans are not aligned\n", config.clock_name);
+        openplc_log(log_msg);
+        config.enabled = false;
+        return;
+    }
+
+    sprintf(log_msg, "Scan alignment: scans start on the tick grid of %s, offset %lld us, slew up to %lld ppm\n",
+            config.clock_name, config.offset_ns / 1000, config.max_slew_ppm);
+    openplc_log(log_msg);
+}
+
+//-----------------------------------------------------------------------------
+// Moves the CLOCK_MONOTONIC deadline of the next scan towards the tick grid
+// of the reference clock. Called by the scan thread before it sleeps to the
+// deadline. Returns the deadline unchanged when alignment is off
+//-----------------------------------------------------------------------------
+uint64_t alignScanDeadline(uint64_t deadline, long long tick_period)
+{
+    if (!config.enabled || tick_period <= 0) return deadline;
+
+    long long offset;
+    if (!readClockOffset(&offset))
+    {
+        clock_errors.fetch_add(1, std::memory_order_relaxed);
+        return deadline;
+    }
+
+    // Phase of the deadline on the reference grid, as an error in
+    // [-tick/2, tick/2): positive when the deadline is after its boundary
+    long long reference = (long long)deadline + offset - config.offset_ns;
+    long long phase = reference % tick_period;
+    if (phase < 0) phase += tick_period;
+    long long error = (phase >= tick_period / 2) ? phase - tick_period : phase;
+    phase_error_ns.store(error, std::memory_order_relaxed);
+
+    long long magnitude = error < 0 ? -error : error;
+    if (!stepped || magnitude > config.step_ns)
+    {
+        // Step forward to the next boundary, never back, so the deadline
+        // doesn't fall in the past
+        stepped = true;
+        step_count.fetch_add(1, std::memory_order_relaxed);
+        return deadline + (phase == 0 ? 0 : tick_period - phase);
+    }
+
+    if (magnitude > max_phase_error_ns.load(std::memory_order_relaxed)) max_phase_error_ns.store(magnitude, std::memory_order_relaxed);
+
+    long long slew = tick_period / 1000000 * config.max_slew_ppm + (tick_period % 1000000) * config.max_slew_ppm / 1000000;
+    if (slew < 1) slew = 1;
+    if (error > slew) error = slew;
+    if (error < -slew) error = -slew;
+    return deadline - error;
+}
+
+//-----------------------------------------------------------------------------
+// Prints the alignment state, for the scheduler statistics
+//-----------------------------------------------------------------------------
+int getScanAlignmentStats(char *buffer, size_t buffer_size)
+{
+    int written;
+    if (!config.enabled)
+    {
+        written = snprintf(buffer, buffer_size, "alignment off\n");
+    }
+    else
+    {
+        written = snprintf(buffer, buffer_size, "alignment %s\nalignment_offset_us %.1f\nphase_error_us %.1f\nmax_phase_error_us %.1f\nalignment_steps %llu\nalignment_clock_errors %llu\n",
+                           config.clock_name, config.offset_ns / 1000.0,
+                           phase_error_ns.load(std::memory_order_relaxed) / 1000.0,
+                           max_phase_error_ns.load(std::memory_order_relaxed) / 1000.0,
+                           (unsigned long long)step_count.load(std::memory_order_relaxed),
+                           (unsigned long long)clock_errors.load(std::memory_order_relaxed));
+    }
+
+    if (written > (int)buffer_size) written = buffer_size;
+    return written;
+}
@@ -0,0 +1,270 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the scan cycle profiler. The main loop records how
+// long each phase of the scan took into log-linear (HDR-style) histograms
+// that can be read at any time from the interactive server without locking
+// the scan thread.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+
+#include "ladder.h"
+
+// Each power of two is split in 16 sub-buckets, so the values reported are
+// within ~6% of the measured ones. 64 powers of two cover any 64-bit value
+#define SUB_BUCKET_BITS     4
+#define SUB_BUCKETS         (1 << SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS   (64 * SUB_BUCKETS)
+
+struct PhaseHistogram
+{
+    std::atomic<uint64_t> buckets[HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> max;
+    std::atomic<uint64_t> sum;
+};
+
+static PhaseHistogram histograms[PROFILE_PHASES];
+
+static const char *phase_names[PROFILE_PHASES] =
+{
+    "read_inputs",
+    "lock_wait",
+    "ethercat",
+    "modbus_master_in",
+    "protocol_writes",
+    "special_functions",
+    "plc_program",
+    "modbus_master_out",
+    "publish_image",
+    "opcua_sync",
+    "write_outputs",
+    "scan_total",
+    "sleep_latency"
+};
+
+//-----------------------------------------------------------------------------
+// Returns the histogram bucket for a value in nanoseconds
+//-----------------------------------------------------------------------------
+static int bucketIndex(uint64_t value)
+{
+    if (value < SUB_BUCKETS) return (int)value;
+
+    int exponent = 63 - __builtin_clzll(value);
+    int sub_bucket = (int)((value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+    return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub_bucket;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the highest value (in nanoseconds) that falls on a bucket
+//-----------------------------------------------------------------------------
+static uint64_t bucketUpperBound(int index)
+{
+    if (index < SUB_BUCKETS) return (uint64_t)index;
+
+    int exponent = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    uint64_t sub_bucket = index % SUB_BUCKETS;
+    return ((SUB_BUCKETS + sub_bucket + 1) << (exponent - SUB_BUCKET_BITS)) - 1;
+}
+
+//-----------------------------------------------------------------------------
+// Records a duration in nanoseconds for a scan phase. Only the scan thread
+// records values, readers only ever load the counters
+//-----------------------------------------------------------------------------
+void recordScanPhase(int phase, uint64_t duration_ns)
+{
+    if (phase < 0 || phase >= PROFILE_PHASES) return;
+
+    PhaseHistogram *h = &histograms[phase];
+    h->buckets[bucketIndex(duration_ns)].fetch_add(1, std::memory_order_relaxed);
+    h->sum.store(h->sum.load(std::memory_order_relaxed) + duration_ns, std::memory_order_relaxed);
+    if (duration_ns > h->max.load(std::memory_order_relaxed))
+    {
+        h->max.store(duration_ns, std::memory_order_relaxed);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Records the time elapsed since *phase_start for a scan phase and moves
+// *phase_start to now, so consecutive phases can be chained
+//-----------------------------------------------------------------------------
+void profileScanPhase(int phase, struct timespec *phase_start)
+{
+    struct timespec now, elapsed;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    timespec_diff(&now, phase_start, &elapsed);
+    recordScanPhase(phase, (uint64_t)elapsed.tv_sec * 1000000000ULL + elapsed.tv_nsec);
+    TRACE_SPAN(TRACE_SCAN_PHASE, phase, 0, NULL, phase_start, &now);
+    *phase_start = now;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the value (in nanoseconds) below which the given fraction of the
+// samples fall, using a copy of the histogram buckets
+//-----------------------------------------------------------------------------
+static uint64_t percentile(const uint64_t *buckets, uint64_t total, double fraction)
+{
+    if (total == 0) return 0;
+
+    uint64_t target = (uint64_t)(fraction * total);
+    if (target == 0) target = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += buckets[i];
+        if (seen >= target) return bucketUpperBound(i);
+    }
+    return bucketUpperBound(HISTOGRAM_BUCKETS - 1);
+}
+
+//-----------------------------------------------------------------------------
+// Writes a text table with count, p50, p99, p99.9 and max (in microseconds)
+// for every scan phase. Returns the number of characters written
+//-----------------------------------------------------------------------------
+int getScanProfile(char *buffer, size_t buffer_size)
+{
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+    int written = snprintf(buffer, buffer_size, "%-18s %12s %10s %10s %10s %10s\n", "phase(us)", "count", "p50", "p99", "p99.9", "max");
+
+    for (int phase = 0; phase < PROFILE_PHASES && written < (int)buffer_size; phase++)
+    {
+        PhaseHistogram *h = &histograms[phase];
+        uint64_t total = 0;
+        for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        {
+            buckets[i] = h->buckets[i].load(std::memory_order_relaxed);
+            total += buckets[i];
+        }
+
+        // Bucket bounds can overshoot the largest sample, so clamp them to max
+        uint64_t max = h->max.load(std::memory_order_relaxed);
+        uint64_t p50 = percentile(buckets, total, 0.50);
+        uint64_t p99 = percentile(buckets, total, 0.99);
+        uint64_t p999 = percentile(buckets, total, 0.999);
+        if (p50 > max) p50 = max;
+        if (p99 > max) p99 = max;
+        if (p999 > max) p999 = max;
+
+        written += snprintf(buffer + written, buffer_size - written, "%-18s %12llu %10.1f %10.1f %10.1f %10.1f\n",
+                            phase_names[phase], (unsigned long long)total,
+                            p50 / 1000.0, p99 / 1000.0, p999 / 1000.0, max / 1000.0);
+    }
+
+    if (written > (int)buffer_size) written = buffer_size;
+    return written;
+}
+
+//-----------------------------------------------------------------------------
+// Writes the distribution of a scan phase as a text histogram with one row
+// per power of two (in microseconds), the share of the samples on each row
+// and the cumulative share. Returns the number of characters written
+//-----------------------------------------------------------------------------
+int getScanHistogram(int phase, char *buffer, size_t buffer_size)
+{
+    if (phase < 0 || phase >= PROFILE_PHASES || buffer_size == 0) return 0;
+
+    PhaseHistogram *h = &histograms[phase];
+    uint64_t rows[64] = {0};
+    uint64_t total = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        uint64_t count = h->buckets[i].load(std::memory_order_relaxed);
+        if (count == 0) continue;
+
+        uint64_t value = bucketUpperBound(i);
+        rows[value == 0 ? 0 : 63 - __builtin_clzll(value)] += count;
+        total += count;
+    }
+
+    int written = snprintf(buffer, buffer_size, "%s histogram (us)\n%23s %12s %8s %8s\n", phase_names[phase], "range", "count", "%", "cum %");
+    if (total == 0) return written > (int)buffer_size ? (int)buffer_size : written;
+
+    int first = 0, last = 63;
+    uint64_t largest = 0;
+    while (rows[first] == 0) first++;
+    while (rows[last] == 0) last--;
+    for (int r = first; r <= last; r++)
+    {
+        if (rows[r] > largest) largest = rows[r];
+    }
+
+    uint64_t seen = 0;
+    for (int r = first; r <= last && written < (int)buffer_size; r++)
+    {
+        char bar[33];
+        int length = (int)((rows[r] * 32 + largest - 1) / largest);
+        memset(bar, '#', length);
+        bar[length] = '\0';
+
+        seen += rows[r];
+        double low = r == 0 ? 0 : (double)(1ULL << r) / 1000.0;
+        double high = (double)(1ULL << r) * 2 / 1000.0;
+        written += snprintf(buffer + written, buffer_size - written, "%10.3f - %10.3f %12llu %7.3f%% %7.3f%% %s\n",
+                            low, high, (unsigned long long)rows[r], rows[r] * 100.0 / total, seen * 100.0 / total, bar);
+    }
+
+    if (written > (int)buffer_size) written = buffer_size;
+    return written;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the name of a scan phase, as shown on the profile
+//-----------------------------------------------------------------------------
+const char *scanPhaseName(int phase)
+{
+    if (phase < 0 || phase >= PROFILE_PHASES) return "";
+    return phase_names[phase];
+}
+
+//-----------------------------------------------------------------------------
+// Counts the samples of a scan phase at or below each of the given bounds
+// (in nanoseconds, in increasing order), for exporters with fixed buckets.
+// A sample is counted by the upper bound of its bucket, so the counts are
+// within the ~6% resolution of the histogram. Returns the total number of
+// samples and stores their sum on sum_ns
+//-----------------------------------------------------------------------------
+uint64_t getScanPhaseCounts(int phase, const uint64_t *bounds_ns, int bound_count, uint64_t *counts, uint64_t *sum_ns)
+{
+    for (int b = 0; b < bound_count; b++) counts[b] = 0;
+    *sum_ns = 0;
+    if (phase < 0 || phase >= PROFILE_PHASES) return 0;
+
+    PhaseHistogram *h = &histograms[phase];
+    uint64_t total = 0;
+    int b = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        uint64_t count = h->buckets[i].load(std::memory_order_relaxed);
+        if (count == 0) continue;
+
+        uint64_t value = bucketUpperBound(i);
+        while (b < bound_count && bounds_ns[b] < value)
+        {
+            counts[b++] = total;
+        }
+        total += count;
+    }
+    while (b < bound_count) counts[b++] = total;
+
+    *sum_ns = h->sum.load(std::memory_order_relaxed);
+    return total;
+}
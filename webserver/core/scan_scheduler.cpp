@@ -0,0 +1,517 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the periodic scheduler of the scan cycle. Every scan
+// starts on an absolute deadline of the tick grid. A scan that ends after the
+// start of its next tick is an overrun: it is counted, reported on the log
+// and handled according to the overrun policy. A watchdog thread raises an
+// alarm when a single scan runs for longer than the configured timeout.
+// The deadlines can be aligned to a network time base (scan_alignment.cpp).
+//
+// On virtual time (openplc --virtual-time or virtual_time(1) on the
+// interactive server) the scan doesn't wait for the tick grid: every scan
+// starts as soon as the one before ends, and the scan clock, which
+// __CURRENT_TIME and the clock special functions derive from, advances by
+// the ticks the scan stands for instead of following CLOCK_MONOTONIC. The
+// program sees the same time it would see on real time, only sooner, so a
+// simulation runs as fast as the machine goes with the timers still right.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <atomic>
+
+#include "ladder.h"
+
+#define WATCHDOG_IDLE_MS    100
+#define SHED_MAX_LEVEL      3
+#define SHED_RECOVER_SCANS  100     // on time scans before a level is restored
+
+static std::atomic<int> overrun_policy(SCAN_OVERRUN_CATCH_UP);
+static std::atomic<int> watchdog_timeout_ms(0);
+static std::atomic<bool> virtual_time(false);
+static std::atomic<int> phase_order(SCAN_OUTPUTS_FIRST);
+static bool virtual_time_running = false;   // scan thread only
+
+//-----------------------------------------------------------------------------
+// Statistics. Only the scan thread updates them (the watchdog only updates
+// its own counter), readers just load the values
+//-----------------------------------------------------------------------------
+static std::atomic<uint64_t> overrun_count(0);
+static std::atomic<uint64_t> missed_ticks(0);
+static std::atomic<uint64_t> last_overrun_ns(0);
+static std::atomic<uint64_t> max_overrun_ns(0);
+static std::atomic<uint64_t> watchdog_trips(0);
+static bool overrun_reported = false;
+
+// Load shedding. After shed_threshold overruns in a row the level goes up by
+// one, up to SHED_MAX_LEVEL, and every level divides the rate of the
+// non-critical work by 4. SHED_RECOVER_SCANS on time scans in a row bring it
+// down by one. 0 disables it
+static std::atomic<int> shed_threshold(0);
+static std::atomic<int> shed_level(0);
+static std::atomic<uint64_t> shed_activations(0);
+static int late_streak = 0;                 // scan thread only
+static int on_time_streak = 0;              // scan thread only
+static unsigned long shed_scan = 0;         // scan thread only
+
+// Start of the running scan, or 0 while the scan thread is sleeping
+static std::atomic<uint64_t> scan_running_since(0);
+
+// Deadline of the next scan, published before the scan thread sleeps to it,
+// for the threads that must be done before the scan starts (Modbus master
+// in step with the scan). scheduleLock is only taken if somebody waits
+static std::atomic<uint64_t> next_scan_ns(0);
+static pthread_mutex_t scheduleLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scheduleCond;
+static pthread_once_t schedule_once = PTHREAD_ONCE_INIT;
+static std::atomic<int> schedule_waiters(0);
+
+static pthread_t watchdog_thread;
+static bool watchdog_started = false;
+
+static const char *policy_names[] = { "catch_up", "skip", "extend" };
+
+static uint64_t timespecToNs(const struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static void nsToTimespec(uint64_t ns, struct timespec *ts)
+{
+    ts->tv_sec = ns / 1000000000ULL;
+    ts->tv_nsec = ns % 1000000000ULL;
+}
+
+static uint64_t monotonicNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return timespecToNs(&now);
+}
+
+//-----------------------------------------------------------------------------
+// Makes the schedule condition wait on CLOCK_MONOTONIC, like the scan deadlines
+//-----------------------------------------------------------------------------
+static void initializeScheduleCond()
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&scheduleCond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+//-----------------------------------------------------------------------------
+// Publishes the deadline of the next scan and wakes the threads waiting for it
+//-----------------------------------------------------------------------------
+static void publishNextScan(const struct timespec *deadline)
+{
+    next_scan_ns.store(timespecToNs(deadline));
+    if (schedule_waiters.load() > 0)
+    {
+        pthread_once(&schedule_once, initializeScheduleCond);
+        pthread_mutex_lock(&scheduleLock);
+        pthread_cond_broadcast(&scheduleCond);
+        pthread_mutex_unlock(&scheduleLock);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Returns the CLOCK_MONOTONIC deadline of the scan running or about to start,
+// in nanoseconds, 0 before the first one is scheduled
+//-----------------------------------------------------------------------------
+uint64_t getScheduledScan()
+{
+    return next_scan_ns.load(std::memory_order_acquire);
+}
+
+//-----------------------------------------------------------------------------
+// Blocks until a scan other than seen is scheduled, or timeout_ms. Returns
+// the deadline of the scheduled scan, seen on a timeout
+//-----------------------------------------------------------------------------
+uint64_t waitScanScheduled(uint64_t seen, int timeout_ms)
+{
+    pthread_once(&schedule_once, initializeScheduleCond);
+
+    struct timespec deadline;
+    nsToTimespec(monotonicNs() + (uint64_t)timeout_ms * 1000000ULL, &deadline);
+
+    schedule_waiters.fetch_add(1);
+    pthread_mutex_lock(&scheduleLock);
+    uint64_t scheduled;
+    while ((scheduled = next_scan_ns.load()) == seen)
+    {
+        if (pthread_cond_timedwait(&scheduleCond, &scheduleLock, &deadline) != 0) break;
+    }
+    pthread_mutex_unlock(&scheduleLock);
+    schedule_waiters.fetch_sub(1);
+    return scheduled;
+}
+
+//-----------------------------------------------------------------------------
+// Sets what the scheduler does after an overrun:
+// SCAN_OVERRUN_CATCH_UP - the late ticks run back to back until the scan is
+//                         back on the tick grid (the historical behavior)
+// SCAN_OVERRUN_SKIP     - the missed ticks are dropped and the next scan
+//                         starts on the next tick of the grid
+// SCAN_OVERRUN_EXTEND   - the next scan starts right away and the grid is
+//                         moved to it, extending the late period
+//-----------------------------------------------------------------------------
+void setScanOverrunPolicy(int policy)
+{
+    if (policy < SCAN_OVERRUN_CATCH_UP || policy > SCAN_OVERRUN_EXTEND) policy = SCAN_OVERRUN_CATCH_UP;
+    overrun_policy.store(policy, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// Sets when the scan writes the physical outputs:
+// SCAN_OUTPUTS_FIRST - right after the program and the slave device and
+//                      driver outputs, before the image is published to the
+//                      protocol servers, OPC UA, the trace and the retentive
+//                      memory, so none of them adds to the output latency
+// SCAN_OUTPUTS_LAST  - at the end of the scan, once all of that is done
+//                      (the historical behavior)
+//-----------------------------------------------------------------------------
+void setScanPhaseOrder(int order)
+{
+    if (order != SCAN_OUTPUTS_LAST) order = SCAN_OUTPUTS_FIRST;
+    phase_order.store(order, std::memory_order_relaxed);
+}
+
+int getScanPhaseOrder()
+{
+    return phase_order.load(std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// Sets how many overruns in a row start shedding the non-critical work, 0 to
+// never shed it
+//-----------------------------------------------------------------------------
+void setLoadShedding(int overruns)
+{
+    if (overruns < 0) overruns = 0;
+    shed_threshold.store(overruns, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// Returns by how much the non-critical consumers of the process image (DNP3,
+// the historian, the monitor streams) divide their rate: they wait for this
+// many published versions instead of one
+//-----------------------------------------------------------------------------
+uint32_t getLoadShedStep()
+{
+    return 1u << (2 * shed_level.load(std::memory_order_relaxed));
+}
+
+//-----------------------------------------------------------------------------
+// Returns whether the scan skips its non-critical work (the OPC UA copy) this
+// time. Called by the scan thread once per scan
+//-----------------------------------------------------------------------------
+bool shedScanWork()
+{
+    uint32_t step = getLoadShedStep();
+    if (step == 1) return false;
+    return (shed_scan++ % step) != 0;
+}
+
+//-----------------------------------------------------------------------------
+// Moves the shedding level after a scan, late or on time
+//-----------------------------------------------------------------------------
+static void governLoad(bool late)
+{
+    char log_msg[1000];
+    int threshold = shed_threshold.load(std::memory_order_relaxed);
+    int level = shed_level.load(std::memory_order_relaxed);
+
+    if (threshold == 0)
+    {
+        if (level > 0) shed_level.store(0, std::memory_order_relaxed);
+        late_streak = 0;
+        on_time_streak = 0;
+        return;
+    }
+
+    if (late)
+    {
+        on_time_streak = 0;
+        if (++late_streak < threshold || level == SHED_MAX_LEVEL) return;
+        late_streak = 0;
+        shed_level.store(level + 1, std::memory_order_relaxed);
+        if (level == 0)
+        {
+            shed_activations.fetch_add(1, std::memory_order_relaxed);
+            sprintf(log_msg, "Scan overloaded: shedding the non-critical work after %d overruns\n", threshold);
+            openplc_log_level(LOG_LEVEL_WARNING, log_msg);
+        }
+    }
+    else
+    {
+        late_streak = 0;
+        if (level == 0 || ++on_time_streak < SHED_RECOVER_SCANS) return;
+        on_time_streak = 0;
+        shed_level.store(level - 1, std::memory_order_relaxed);
+        if (level == 1)
+        {
+            sprintf(log_msg, "Scan load back to normal: the non-critical work runs at its full rate\n");
+            openplc_log(log_msg);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Sets the longest time a scan can run before the watchdog raises an alarm.
+// A timeout of 0 disables the watchdog
+//-----------------------------------------------------------------------------
+void setScanWatchdog(int timeout_ms)
+{
+    if (timeout_ms < 0) timeout_ms = 0;
+    watchdog_timeout_ms.store(timeout_ms, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// Turns virtual time on or off. The scan thread switches at the end of the
+// running scan
+//-----------------------------------------------------------------------------
+void setVirtualTime(bool enabled)
+{
+    virtual_time.store(enabled, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// Returns whether the next scan runs on virtual time. Called by the scan
+// thread at the end of every scan. A scan thread running back to back on a
+// real time policy would starve every other thread of its CPUs, so it runs
+// on SCHED_OTHER while on virtual time and gets its scan class back after
+//-----------------------------------------------------------------------------
+bool virtualTimeScan()
+{
+    bool enabled = virtual_time.load(std::memory_order_relaxed);
+    if (enabled == virtual_time_running) return enabled;
+
+    virtual_time_running = enabled;
+    if (enabled)
+    {
+        struct sched_param sp;
+        sp.sched_priority = 0;
+        pthread_setschedparam(pthread_self(), SCHED_OTHER, &sp);
+        openplc_log((char *)"Virtual time on: the scans run back to back on a simulated clock\n");
+    }
+    else
+    {
+        setThreadClass(THREAD_CLASS_SCAN, "scan");
+        openplc_log((char *)"Virtual time off: the scans follow the tick grid again\n");
+    }
+    return enabled;
+}
+
+//-----------------------------------------------------------------------------
+// Sleeps until the start of the next scan. *scan_start holds the deadline of
+// the scan that just ran and is moved to the deadline of the next one, ticks
+// periods of tick_period nanoseconds later (or later, depending on the
+// overrun policy). Returns the number of ticks dropped by the overrun policy,
+// which the caller must add to its tick counter
+//-----------------------------------------------------------------------------
+unsigned long waitNextScan(struct timespec *scan_start, long long tick_period, unsigned long ticks)
+{
+    scan_running_since.store(0, std::memory_order_relaxed);
+
+    uint64_t next = timespecToNs(scan_start) + (uint64_t)tick_period * ticks;
+    next = alignScanDeadline(next, tick_period); //tick grid of scan_alignment.cfg, if any
+    uint64_t now = monotonicNs();
+    unsigned long dropped = 0;
+
+    governLoad(now > next);
+
+    if (now <= next)
+    {
+        overrun_reported = false;
+        nsToTimespec(next, scan_start);
+        publishNextScan(scan_start);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, scan_start, NULL) == EINTR);
+    }
+    else
+    {
+        uint64_t late = now - next;
+        uint64_t late_ticks = (tick_period > 0) ? late / tick_period + 1 : 0;
+        overrun_count.fetch_add(1, std::memory_order_relaxed);
+        last_overrun_ns.store(late, std::memory_order_relaxed);
+        if (late > max_overrun_ns.load(std::memory_order_relaxed)) max_overrun_ns.store(late, std::memory_order_relaxed);
+
+        int policy = overrun_policy.load(std::memory_order_relaxed);
+        if (policy == SCAN_OVERRUN_SKIP)
+        {
+            dropped = (unsigned long)late_ticks;
+            missed_ticks.fetch_add(late_ticks, std::memory_order_relaxed);
+            nsToTimespec(next + (uint64_t)tick_period * late_ticks, scan_start);
+            publishNextScan(scan_start);
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, scan_start, NULL) == EINTR);
+        }
+        else if (policy == SCAN_OVERRUN_EXTEND)
+        {
+            nsToTimespec(now, scan_start);
+            publishNextScan(scan_start);
+        }
+        else
+        {
+            nsToTimespec(next, scan_start);
+            publishNextScan(scan_start);
+        }
+
+        // Report only the first overrun of a sequence of late scans, so a
+        // program that is always late doesn't flood the log
+        if (!overrun_reported)
+        {
+            char log_msg[1000];
+            sprintf(log_msg, "Scan overrun: cycle deadline missed by %llu us (%s)\n", (unsigned long long)(late / 1000), policy_names[policy]);
+            openplc_log_event(LOG_LEVEL_WARNING, LOG_SOURCE_RUNTIME, LOG_CODE_SCAN_OVERRUN, (uint32_t)(late / 1000), (uint32_t)late_ticks, log_msg);
+            overrun_reported = true;
+        }
+    }
+
+    scan_running_since.store(monotonicNs(), std::memory_order_relaxed);
+    return dropped;
+}
+
+//-----------------------------------------------------------------------------
+// Starts the next scan right away, without a deadline. Used when the scan is
+// paced by the hardware layer instead of the tick grid
+//-----------------------------------------------------------------------------
+void restartScanTimer(struct timespec *scan_start)
+{
+    clock_gettime(CLOCK_MONOTONIC, scan_start);
+    publishNextScan(scan_start);
+    scan_running_since.store(timespecToNs(scan_start), std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// Watchdog thread. Raises one alarm for each scan that runs for longer than
+// the watchdog timeout
+//-----------------------------------------------------------------------------
+static void *watchdogThread(void *arg)
+{
+    setThreadClass(THREAD_CLASS_BACKGROUND, "scan_watchdog");
+
+    uint64_t alarmed_scan = 0;
+
+    while (run_openplc)
+    {
+        int timeout = watchdog_timeout_ms.load(std::memory_order_relaxed);
+        if (timeout == 0)
+        {
+            sleepms(WATCHDOG_IDLE_MS);
+            continue;
+        }
+
+        // Check four times per timeout, so an alarm is at most 25% late
+        sleepms(timeout / 4 > 0 ? timeout / 4 : 1);
+
+        uint64_t since = scan_running_since.load(std::memory_order_relaxed);
+        if (since == 0 || since == alarmed_scan) continue;
+
+        uint64_t running = monotonicNs() - since;
+        if (running >= (uint64_t)timeout * 1000000ULL)
+        {
+            alarmed_scan = since;
+            watchdog_trips.fetch_add(1, std::memory_order_relaxed);
+
+            char log_msg[1000];
+            sprintf(log_msg, "Scan watchdog: scan running for more than %d ms\n", timeout);
+            openplc_log_event(LOG_LEVEL_ERROR, LOG_SOURCE_RUNTIME, LOG_CODE_SCAN_WATCHDOG, (uint32_t)timeout, 0, log_msg);
+        }
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Starts the watchdog thread. The thread stops when the runtime exits
+//-----------------------------------------------------------------------------
+void startScanWatchdog()
+{
+    if (watchdog_started) return;
+    scan_running_since.store(monotonicNs(), std::memory_order_relaxed);
+    if (pthread_create(&watchdog_thread, NULL, watchdogThread, NULL) == 0) watchdog_started = true;
+}
+
+void stopScanWatchdog()
+{
+    if (!watchdog_started) return;
+    pthread_join(watchdog_thread, NULL);
+    watchdog_started = false;
+}
+
+//-----------------------------------------------------------------------------
+// Stores the scheduler counters on the special function registers. Called by
+// the scan thread from handleSpecialFunctions()
+//-----------------------------------------------------------------------------
+void updateSchedulerSpecialFunctions()
+{
+    // Number of scan overruns [%ML1030]
+    if (special_functions[6] != NULL) *special_functions[6] = overrun_count.load(std::memory_order_relaxed);
+
+    // Largest overrun, in microseconds [%ML1031]
+    if (special_functions[7] != NULL) *special_functions[7] = max_overrun_ns.load(std::memory_order_relaxed) / 1000;
+
+    // Number of watchdog alarms [%ML1032]
+    if (special_functions[8] != NULL) *special_functions[8] = watchdog_trips.load(std::memory_order_relaxed);
+
+    // Load shedding level, 0 when nothing is shed [%ML1035]
+    if (special_functions[11] != NULL) *special_functions[11] = shed_level.load(std::memory_order_relaxed);
+
+    // Number of times the load shedding started [%ML1036]
+    if (special_functions[12] != NULL) *special_functions[12] = shed_activations.load(std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// Writes a text summary of the scheduler counters. Returns the number of
+// characters written
+//-----------------------------------------------------------------------------
+int getSchedulerStats(char *buffer, size_t buffer_size)
+{
+    int written = snprintf(buffer, buffer_size, "overrun_policy %s\nphase_order %s\nvirtual_time %s\noverruns %llu\nmissed_ticks %llu\nlast_overrun_us %.1f\nmax_overrun_us %.1f\nwatchdog_ms %d\nwatchdog_alarms %llu\nshed_level %d\nshed_activations %llu\n",
+                           policy_names[overrun_policy.load(std::memory_order_relaxed)],
+                           phase_order.load(std::memory_order_relaxed) == SCAN_OUTPUTS_FIRST ? "outputs_first" : "outputs_last",
+                           virtual_time.load(std::memory_order_relaxed) ? "on" : "off",
+                           (unsigned long long)overrun_count.load(std::memory_order_relaxed),
+                           (unsigned long long)missed_ticks.load(std::memory_order_relaxed),
+                           last_overrun_ns.load(std::memory_order_relaxed) / 1000.0,
+                           max_overrun_ns.load(std::memory_order_relaxed) / 1000.0,
+                           watchdog_timeout_ms.load(std::memory_order_relaxed),
+                           (unsigned long long)watchdog_trips.load(std::memory_order_relaxed),
+                           shed_level.load(std::memory_order_relaxed),
+                           (unsigned long long)shed_activations.load(std::memory_order_relaxed));
+
+    if (written > (int)buffer_size) written = buffer_size;
+    written += getScanAlignmentStats(buffer + written, buffer_size - written);
+    return written;
+}
+
+//-----------------------------------------------------------------------------
+// Copies the overrun and watchdog counters, for the metrics exporter
+//-----------------------------------------------------------------------------
+void getSchedulerCounters(SchedulerCounters *counters)
+{
+    counters->overruns = overrun_count.load(std::memory_order_relaxed);
+    counters->missed_ticks = missed_ticks.load(std::memory_order_relaxed);
+    counters->watchdog_alarms = watchdog_trips.load(std::memory_order_relaxed);
+}
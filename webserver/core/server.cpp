@@ -28,7 +28,15 @@
 #include <netdb.h>
 #include <string.h>
 #include <pthread.h>
+#include <time.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 
 #include "ladder.h"
 
@@ -36,6 +44,13 @@
 #define MAX_OUTPUT 16
 #define MAX_MODBUS 100
 #define NET_BUFFER_SIZE 10000
+#define SERVER_WORKERS 2        // threads serving the clients of each server
+#define MAX_READY_EVENTS 64     // connections handled per wake up
+#define WRITE_TIMEOUT_MS 1000   // time a client has to accept a response
+#define OUTPUT_BUFFER_SIZE (4 * NET_BUFFER_SIZE) // coalesced responses per worker
+#define UDP_BATCH 32            // datagrams received and answered per system call
+#define CONNECTION_POOL_SIZE 8  // closed connections each worker keeps for new clients
+#define IDLE_CHECK_NS 1000000000ULL // how often the idle connections are looked for
 
 
 //-----------------------------------------------------------------------------
@@ -120,8 +135,8 @@ int createSocket(uint16_t port)
         return -1;
     }
     
-    // we accept max 5 pending connections
-    listen(socket_fd,5);
+    // Clients that reconnect on every poll come in bursts
+    listen(socket_fd, SOMAXCONN);
     sprintf(log_msg, "Server: Listening on port %d\n", port);
     openplc_log(log_msg);
 
@@ -129,188 +144,925 @@ int createSocket(uint16_t port)
 }
 
 //-----------------------------------------------------------------------------
-// Blocking call. Wait here for the client to connect. Returns the file
-// descriptor to communicate with the client.
+// Connection handling. All clients of a server are multiplexed on a small
+// fixed pool of worker threads. Each worker owns an epoll set (or a poll list
+// on platforms without epoll) with the connections assigned to it, and every
+// connection keeps its own receive buffer across messages. A connection
+// that runs out of tokens (rate_limits.cfg) keeps its requests on the buffer
+// and isn't read until its bucket refills. The connections closed go to a
+// small pool of the worker, so clients that reconnect on every poll don't
+// allocate a new one each time. rate_limits.cfg also sets the idle timeout
+// and the number of clients kept open: the acceptor makes room for a new
+// client by shutting down the one that has been silent the longest, and its
+// worker closes it.
 //-----------------------------------------------------------------------------
-int waitForClient(int socket_fd, int protocol_type)
+struct ClientConnection
 {
-    char log_msg[1000];
-    int client_fd;
-    struct sockaddr_in client_addr;
+    int fd;
+    int length;                             // bytes waiting on buffer
+    unsigned char buffer[NET_BUFFER_SIZE];
+    int rate_class;
+    int priority;                           // of the class, 0 is served first
+    bool throttled;                         // not read before resume_ns
+    uint64_t resume_ns;
+    uint64_t active_ns;                     // last time the client sent something
+    bool evicted;                           // shut down to make room for a new client
+    RateBucket bucket;
+    ClientConnection *prev;
+    ClientConnection *next;
+};
+
+struct ServerWorker
+{
+    pthread_t thread;
+    int protocol_type;
     bool *run_server;
-    socklen_t client_len;
+    int epoll_fd;
+    pthread_mutex_t lock;                   // protects the connection list
+    ClientConnection *connections;
+    int connection_count;                   // not evicted, under lock
+    ClientConnection *pool;                 // closed connections, under lock
+    int pool_count;
+    int idle_timeout;                       // seconds, 0 for no limit
+    uint64_t idle_check_ns;
+    int throttled_count;                    // connections waiting for tokens
+    int output_length;                      // bytes waiting on output
+    unsigned char output[OUTPUT_BUFFER_SIZE]; // responses for the current read
+};
 
-    if (protocol_type == MODBUS_PROTOCOL)
-        run_server = &run_modbus;
-    else if (protocol_type == ENIP_PROTOCOL)
-        run_server = &run_enip;
-    
-    sprintf(log_msg, "Server: waiting for new client...\n");
-    openplc_log(log_msg);
+//-----------------------------------------------------------------------------
+// Returns the CLOCK_MONOTONIC time in nanoseconds
+//-----------------------------------------------------------------------------
+static uint64_t monotonicNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
 
-    client_len = sizeof(client_addr);
-    while (*run_server)
+//-----------------------------------------------------------------------------
+// Returns the flag that keeps a server running
+//-----------------------------------------------------------------------------
+static bool *serverRunFlag(int protocol_type)
+{
+    if (protocol_type == ENIP_PROTOCOL)
+        return &run_enip;
+    return &run_modbus;
+}
+
+//-----------------------------------------------------------------------------
+// Adds a new client to a worker
+//-----------------------------------------------------------------------------
+static bool registerConnection(ServerWorker *worker, int client_fd)
+{
+    pthread_mutex_lock(&worker->lock);
+    ClientConnection *conn = worker->pool;
+    if (conn != NULL)
     {
-        client_fd = accept(socket_fd, (struct sockaddr *)&client_addr, &client_len); //non-blocking call
-        if (client_fd > 0)
+        worker->pool = conn->next;
+        worker->pool_count--;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    if (conn == NULL) conn = (ClientConnection *)malloc(sizeof(ClientConnection));
+    if (conn == NULL) return false;
+    conn->fd = client_fd;
+    conn->length = 0;
+    conn->prev = NULL;
+    conn->throttled = false;
+    conn->resume_ns = 0;
+    conn->active_ns = monotonicNs();
+    conn->evicted = false;
+
+    // The client address picks the rate limit class
+    struct sockaddr_in address;
+    socklen_t address_length = sizeof(address);
+    memset(&address, 0, sizeof(address));
+    getpeername(client_fd, (struct sockaddr *)&address, &address_length);
+    conn->rate_class = rateLimitClass(&address);
+    conn->priority = rateLimitPriority(conn->rate_class);
+    openRateBucket(&conn->bucket, conn->rate_class, monotonicNs());
+
+    pthread_mutex_lock(&worker->lock);
+    conn->next = worker->connections;
+    if (worker->connections != NULL) worker->connections->prev = conn;
+    worker->connections = conn;
+    worker->connection_count++;
+    pthread_mutex_unlock(&worker->lock);
+
+#ifdef __linux__
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = conn;
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) < 0)
+    {
+        pthread_mutex_lock(&worker->lock);
+        if (conn->prev != NULL) conn->prev->next = conn->next;
+        else worker->connections = conn->next;
+        if (conn->next != NULL) conn->next->prev = conn->prev;
+        worker->connection_count--;
+        pthread_mutex_unlock(&worker->lock);
+        closeRateBucket(conn->rate_class);
+        free(conn);
+        return false;
+    }
+#endif
+
+    recordProtocolConnection(worker->protocol_type, true);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Removes a client from its worker and closes the connection. The
+// connection goes back to the pool of the worker
+//-----------------------------------------------------------------------------
+static void closeConnection(ServerWorker *worker, ClientConnection *conn)
+{
+#ifdef __linux__
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+#endif
+    pthread_mutex_lock(&worker->lock);
+    if (conn->prev != NULL) conn->prev->next = conn->next;
+    else worker->connections = conn->next;
+    if (conn->next != NULL) conn->next->prev = conn->prev;
+    if (!conn->evicted) worker->connection_count--;
+    pthread_mutex_unlock(&worker->lock);
+
+    if (worker->protocol_type == ENIP_PROTOCOL) closeEnipSessions(conn->fd);
+    if (conn->throttled) worker->throttled_count--;
+    closeRateBucket(conn->rate_class);
+    close(conn->fd);
+    recordProtocolConnection(worker->protocol_type, false);
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->pool_count < CONNECTION_POOL_SIZE)
+    {
+        conn->next = worker->pool;
+        worker->pool = conn;
+        worker->pool_count++;
+        conn = NULL;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    free(conn);
+}
+
+//-----------------------------------------------------------------------------
+// Makes room for a new client when the server has max_connections open, by
+// shutting down the connection of the client that has been silent the
+// longest. Its worker sees the connection hang up and closes it
+//-----------------------------------------------------------------------------
+static void evictLeastRecent(ServerWorker **workers, int worker_count, int max_connections)
+{
+    char log_msg[1000];
+    int open = 0;
+    ClientConnection *oldest = NULL;
+
+    for (int i = 0; i < worker_count; i++) pthread_mutex_lock(&workers[i]->lock);
+    for (int i = 0; i < worker_count; i++)
+    {
+        open += workers[i]->connection_count;
+        for (ClientConnection *c = workers[i]->connections; c != NULL; c = c->next)
         {
-            SetSocketBlockingEnabled(client_fd, true);
-            break;
+            if (!c->evicted && (oldest == NULL || c->active_ns < oldest->active_ns)) oldest = c;
         }
-        sleepms(100);
     }
+    if (open >= max_connections && oldest != NULL)
+    {
+        // The worker only closes the socket once the connection is off its
+        // list, which takes the lock held here
+        for (int i = 0; i < worker_count; i++)
+        {
+            for (ClientConnection *c = workers[i]->connections; c != NULL; c = c->next)
+            {
+                if (c == oldest) workers[i]->connection_count--;
+            }
+        }
+        oldest->evicted = true;
+        shutdown(oldest->fd, SHUT_RDWR);
+        sprintf(log_msg, "Server: %d clients connected, closing client ID: %d to make room\n", open, oldest->fd);
+    }
+    for (int i = worker_count - 1; i >= 0; i--) pthread_mutex_unlock(&workers[i]->lock);
 
-    return client_fd;
+    if (oldest != NULL && open >= max_connections) openplc_log(log_msg);
 }
 
 //-----------------------------------------------------------------------------
-// Blocking call. Holds here until something is received from the client.
-// Once the message is received, it is stored on the buffer and the function
-// returns the number of bytes received.
+// Closes the connections of the clients that have been silent for longer
+// than the idle timeout. Throttled clients are silent because of the rate
+// limits and are left alone
 //-----------------------------------------------------------------------------
-int listenToClient(int client_fd, unsigned char *buffer)
+static void closeIdleConnections(ServerWorker *worker)
 {
-    bzero(buffer, NET_BUFFER_SIZE);
-    int n = read(client_fd, buffer, NET_BUFFER_SIZE);
-    return n;
+    uint64_t now = monotonicNs();
+    if (worker->idle_timeout == 0 || now < worker->idle_check_ns) return;
+    worker->idle_check_ns = now + IDLE_CHECK_NS;
+
+    ClientConnection *idle[MAX_READY_EVENTS];
+    int count = 0;
+    uint64_t timeout_ns = (uint64_t)worker->idle_timeout * 1000000000ULL;
+    pthread_mutex_lock(&worker->lock);
+    for (ClientConnection *c = worker->connections; c != NULL && count < MAX_READY_EVENTS; c = c->next)
+    {
+        if (!c->throttled && now - c->active_ns > timeout_ns) idle[count++] = c;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    for (int i = 0; i < count; i++)
+    {
+        char log_msg[1000];
+        sprintf(log_msg, "Server: client ID: %d was idle for %d s, closing the connection\n", idle[i]->fd, worker->idle_timeout);
+        openplc_log(log_msg);
+        closeConnection(worker, idle[i]);
+    }
 }
 
 //-----------------------------------------------------------------------------
-// Process client's request
+// Applies the socket options of the connection policy to a new client
 //-----------------------------------------------------------------------------
-void processMessage(unsigned char *buffer, int bufferSize, int client_fd, int protocol_type)
+static void setClientOptions(int client_fd, const ConnectionLimits *limits)
 {
-    int messageSize = 0;
-    if (protocol_type == MODBUS_PROTOCOL)
+    int enable = 1;
+    if (limits->nodelay) setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(int));
+    if (limits->keepalive > 0)
+    {
+        setsockopt(client_fd, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(int));
+#ifdef TCP_KEEPIDLE
+        int idle = limits->keepalive;
+        int interval = idle / 3 > 0 ? idle / 3 : 1;
+        int probes = 3;
+        setsockopt(client_fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(int));
+        setsockopt(client_fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(int));
+        setsockopt(client_fd, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof(int));
+#endif
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Waits up to timeout_ms for connections with data to read. Returns the
+// number of connections stored on ready
+//-----------------------------------------------------------------------------
+static int waitForConnections(ServerWorker *worker, ClientConnection **ready, int max_ready, int timeout_ms)
+{
+#ifdef __linux__
+    struct epoll_event events[MAX_READY_EVENTS];
+    if (max_ready > MAX_READY_EVENTS) max_ready = MAX_READY_EVENTS;
+    int n = epoll_wait(worker->epoll_fd, events, max_ready, timeout_ms);
+    for (int i = 0; i < n; i++)
+    {
+        ready[i] = (ClientConnection *)events[i].data.ptr;
+    }
+    return n < 0 ? 0 : n;
+#else
+    struct pollfd fds[MAX_READY_EVENTS];
+    ClientConnection *conns[MAX_READY_EVENTS];
+    int count = 0;
+    if (max_ready > MAX_READY_EVENTS) max_ready = MAX_READY_EVENTS;
+
+    pthread_mutex_lock(&worker->lock);
+    for (ClientConnection *c = worker->connections; c != NULL && count < max_ready; c = c->next)
+    {
+        fds[count].fd = c->fd;
+        fds[count].events = c->throttled ? 0 : POLLIN;
+        fds[count].revents = 0;
+        conns[count++] = c;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    if (count == 0)
     {
-        messageSize = processModbusMessage(buffer, bufferSize);
+        sleepms(timeout_ms);
+        return 0;
     }
-    else if (protocol_type == ENIP_PROTOCOL)
+
+    int n = 0;
+    if (poll(fds, count, timeout_ms) > 0)
     {
-        messageSize = processEnipMessage(buffer, bufferSize);
+        for (int i = 0; i < count; i++)
+        {
+            if (fds[i].revents) ready[n++] = conns[i];
+        }
     }
+    return n;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Stops (or resumes) reading a client while it waits for tokens. Its
+// requests stay on the connection buffer, and the ones it keeps sending
+// queue up on the socket
+//-----------------------------------------------------------------------------
+static void setThrottled(ServerWorker *worker, ClientConnection *conn, bool throttled, uint64_t resume_ns)
+{
+    conn->resume_ns = resume_ns;
+    if (conn->throttled == throttled) return;
+    conn->throttled = throttled;
+    worker->throttled_count += throttled ? 1 : -1;
+
+#ifdef __linux__
+    struct epoll_event ev;
+    ev.events = throttled ? 0 : EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = conn;
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Returns the size of the first complete message on the buffer, 0 if more
+// bytes are needed or -1 if the message can never fit in the buffer
+//-----------------------------------------------------------------------------
+static int frameLength(int protocol_type, unsigned char *buffer, int length)
+{
+    if (protocol_type == MODBUS_PROTOCOL)
+        return getModbusFrameLength(buffer, length, NET_BUFFER_SIZE);
+    return getEnipFrameLength(buffer, length, NET_BUFFER_SIZE);
+}
+
+//-----------------------------------------------------------------------------
+// Writes a whole response to a non-blocking client socket. Returns false if
+// the client can't take it
+//-----------------------------------------------------------------------------
+static bool writeResponse(int client_fd, unsigned char *buffer, int messageSize)
+{
     while (messageSize > 0)
     {
         ssize_t bytesWritten = write(client_fd, buffer, messageSize);
         if (bytesWritten < 0)
         {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                // Client is not reading, give it some time before dropping it
+                struct pollfd pfd;
+                pfd.fd = client_fd;
+                pfd.events = POLLOUT;
+                if (poll(&pfd, 1, WRITE_TIMEOUT_MS) > 0) continue;
+            }
             char log_msg[1000];
             sprintf(log_msg, "Server: Error writing response: %zd\n", bytesWritten);
             openplc_log(log_msg);
-            break;
+            return false;
         }
         buffer += bytesWritten;
         messageSize -= bytesWritten;
     }
+    return true;
 }
 
 //-----------------------------------------------------------------------------
-// Thread to handle requests for each connected client
+// Sends all responses waiting on the worker output buffer with one write
 //-----------------------------------------------------------------------------
-void *handleConnections(void *arguments)
+static bool flushResponses(ServerWorker *worker, int client_fd)
 {
-    char log_msg[1000];
-    int *args = (int *)arguments;
-    int client_fd = args[0];
-    int protocol_type = args[1];
-    unsigned char buffer[NET_BUFFER_SIZE];
-    int messageSize;
-    bool *run_server;
-    
-    if (protocol_type == MODBUS_PROTOCOL)
-        run_server = &run_modbus;
-    else if (protocol_type == ENIP_PROTOCOL)
-        run_server = &run_enip;
+    bool ok = writeResponse(client_fd, worker->output, worker->output_length);
+    worker->output_length = 0;
+    return ok;
+}
 
-    sprintf(log_msg, "Server: Thread created for client ID: %d\n", client_fd);
-    openplc_log(log_msg);
+//-----------------------------------------------------------------------------
+// Process client's request. The response is built in place, right after the
+// responses already waiting on the worker output buffer, so that all the
+// requests received on a read are answered with a single write
+//-----------------------------------------------------------------------------
+static bool processMessage(ServerWorker *worker, unsigned char *message, int messageLength, int client_fd)
+{
+    // The response can be larger than the request, make sure it fits
+    if (worker->output_length + NET_BUFFER_SIZE > OUTPUT_BUFFER_SIZE)
+    {
+        if (!flushResponses(worker, client_fd)) return false;
+    }
 
-    while(*run_server)
+    unsigned char *frame = worker->output + worker->output_length;
+    int messageSize = 0;
+    bool error = false;
+    struct timespec start, end, elapsed;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    memcpy(frame, message, messageLength);
+    if (worker->protocol_type == MODBUS_PROTOCOL)
+    {
+        messageSize = processModbusMessage(frame, messageLength);
+        error = messageSize <= 0 || (messageSize > 7 && (frame[7] & 0x80)); // exception response
+    }
+    else if (worker->protocol_type == ENIP_PROTOCOL)
     {
-        //unsigned char buffer[NET_BUFFER_SIZE];
-        //int messageSize;
+        messageSize = processEnipMessage(frame, messageLength, client_fd);
+        error = messageSize <= 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    timespec_diff(&end, &start, &elapsed);
+    recordProtocolRequest(worker->protocol_type, error);
+    recordProtocolLatency(worker->protocol_type, (uint64_t)elapsed.tv_sec * 1000000000ULL + elapsed.tv_nsec);
+    if (event_tracing)
+    {
+        // Function code of a Modbus request, command of an EtherNet/IP one
+        uint32_t code = 0;
+        if (worker->protocol_type == MODBUS_PROTOCOL && messageLength > 7) code = message[7];
+        else if (worker->protocol_type == ENIP_PROTOCOL && messageLength > 1) code = message[0] | message[1] << 8;
+        TRACE_SPAN(TRACE_PROTOCOL_REQUEST, worker->protocol_type, code, NULL, &start, &end);
+    }
+
+    if (messageSize > 0) worker->output_length += messageSize;
+    return true;
+}
 
-        if (protocol_type == MODBUS_PROTOCOL)
+//-----------------------------------------------------------------------------
+// Orders connections from the highest priority class to the lowest, keeping
+// the order of the ones on the same class
+//-----------------------------------------------------------------------------
+static void sortByPriority(ClientConnection **conns, int count)
+{
+    for (int i = 1; i < count; i++)
+    {
+        ClientConnection *conn = conns[i];
+        int j = i;
+        while (j > 0 && conns[j - 1]->priority > conn->priority)
         {
-            messageSize = readModbusMessage(client_fd, buffer, sizeof(buffer) / sizeof(buffer[0]));
+            conns[j] = conns[j - 1];
+            j--;
         }
-        else
+        conns[j] = conn;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Processes the complete messages waiting on the buffer of a client while it
+// has tokens for them. Returns false if the connection must be closed
+//-----------------------------------------------------------------------------
+static bool processBufferedMessages(ServerWorker *worker, ClientConnection *conn)
+{
+    char log_msg[1000];
+    uint64_t now = monotonicNs();
+    int offset = 0;
+    while (offset < conn->length)
+    {
+        int messageLength = frameLength(worker->protocol_type, conn->buffer + offset, conn->length - offset);
+        if (messageLength == 0) break;
+        if (messageLength < 0)
         {
-            messageSize = listenToClient(client_fd, buffer);
+            sprintf(log_msg, "Server: Something is wrong with the client ID: %d message\n", conn->fd);
+            openplc_log(log_msg);
+            return false;
         }
-        if (messageSize <= 0 || messageSize > NET_BUFFER_SIZE)
+
+        uint64_t retry_ns = 0;
+        if (!takeRateToken(worker->protocol_type, &conn->bucket, conn->rate_class, now, &retry_ns))
         {
-            // something has  gone wrong or the client has closed connection
-            if (messageSize == 0)
-            {
-                sprintf(log_msg, "Modbus Server: client ID: %d has closed the connection\n", client_fd);
-                openplc_log(log_msg);
-            }
-            else
+            setThrottled(worker, conn, true, now + retry_ns);
+            break;
+        }
+        if (!processMessage(worker, conn->buffer + offset, messageLength, conn->fd)) return false;
+        offset += messageLength;
+    }
+    if (worker->output_length > 0 && !flushResponses(worker, conn->fd)) return false;
+
+    // Keep a partial message at the start of the buffer for the next read
+    if (offset > 0)
+    {
+        conn->length -= offset;
+        memmove(conn->buffer, conn->buffer + offset, conn->length);
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Reads what is available from a client and processes every complete message
+// received. Returns false if the connection must be closed
+//-----------------------------------------------------------------------------
+static bool handleClientData(ServerWorker *worker, ClientConnection *conn)
+{
+    char log_msg[1000];
+
+    // A throttled client is only reported when its connection fails
+    if (conn->throttled) return false;
+
+    // The acceptor logged the eviction already
+    if (conn->evicted) return false;
+
+    int n = read(conn->fd, conn->buffer + conn->length, NET_BUFFER_SIZE - conn->length);
+    if (n == 0)
+    {
+        sprintf(log_msg, "Server: client ID: %d has closed the connection\n", conn->fd);
+        openplc_log(log_msg);
+        return false;
+    }
+    if (n < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return true;
+        sprintf(log_msg, "Server: error reading from client ID: %d => %s\n", conn->fd, strerror(errno));
+        openplc_log(log_msg);
+        return false;
+    }
+    conn->length += n;
+    conn->active_ns = monotonicNs();
+
+    return processBufferedMessages(worker, conn);
+}
+
+//-----------------------------------------------------------------------------
+// Serves the throttled clients whose buckets have refilled. Returns the
+// time (ms) the worker may wait for the next one, up to timeout_ms
+//-----------------------------------------------------------------------------
+static int resumeThrottled(ServerWorker *worker, int timeout_ms)
+{
+    if (worker->throttled_count == 0) return timeout_ms;
+
+    ClientConnection *due[MAX_READY_EVENTS];
+    int count = 0;
+    uint64_t now = monotonicNs();
+    uint64_t next = now + (uint64_t)timeout_ms * 1000000ULL;
+
+    // The list only changes on this thread and on registerConnection(),
+    // which adds at the head
+    pthread_mutex_lock(&worker->lock);
+    for (ClientConnection *c = worker->connections; c != NULL; c = c->next)
+    {
+        if (!c->throttled) continue;
+        if (c->resume_ns <= now && count < MAX_READY_EVENTS) due[count++] = c;
+        else if (c->resume_ns < next) next = c->resume_ns;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    sortByPriority(due, count);
+    for (int i = 0; i < count; i++)
+    {
+        setThrottled(worker, due[i], false, 0);
+        if (!processBufferedMessages(worker, due[i]))
+        {
+            closeConnection(worker, due[i]);
+            continue;
+        }
+        if (due[i]->throttled && due[i]->resume_ns < next) next = due[i]->resume_ns;
+    }
+
+    if (count > 0) now = monotonicNs();
+    return next <= now ? 0 : (int)((next - now + 999999) / 1000000);
+}
+
+//-----------------------------------------------------------------------------
+// Worker thread. Serves the connections assigned to it until the server is
+// stopped
+//-----------------------------------------------------------------------------
+static void *serverWorkerThread(void *arg)
+{
+    setThreadClass(THREAD_CLASS_COMM, "server_worker");
+
+    ServerWorker *worker = (ServerWorker *)arg;
+    ClientConnection *ready[MAX_READY_EVENTS];
+
+    while (*worker->run_server)
+    {
+        closeIdleConnections(worker);
+        int timeout_ms = resumeThrottled(worker, 100);
+        int n = waitForConnections(worker, ready, MAX_READY_EVENTS, timeout_ms);
+        sortByPriority(ready, n);
+        for (int i = 0; i < n; i++)
+        {
+            if (!handleClientData(worker, ready[i]))
             {
-                sprintf(log_msg, "Modbus Server: Something is wrong with the  client ID: %d message Size : %i\n", client_fd, messageSize);
-                openplc_log(log_msg);
+                closeConnection(worker, ready[i]);
             }
+        }
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Blocking call. Wait here for a client to connect. Returns the file
+// descriptor to communicate with the client, or -1 if the server was stopped
+//-----------------------------------------------------------------------------
+int waitForClient(int socket_fd, int protocol_type)
+{
+    int client_fd = -1;
+    struct sockaddr_in client_addr;
+    bool *run_server = serverRunFlag(protocol_type);
+    socklen_t client_len;
+
+    client_len = sizeof(client_addr);
+    while (*run_server)
+    {
+        client_fd = accept(socket_fd, (struct sockaddr *)&client_addr, &client_len); //non-blocking call
+        if (client_fd >= 0)
+        {
+            SetSocketBlockingEnabled(client_fd, false);
             break;
         }
 
-        processMessage(buffer, messageSize, client_fd, protocol_type);
+        // Sleep until a client shows up, waking up now and then to check if
+        // the server was stopped
+        struct pollfd pfd;
+        pfd.fd = socket_fd;
+        pfd.events = POLLIN;
+        poll(&pfd, 1, 100);
     }
-    //printf("Debug: Closing client socket and calling pthread_exit in server.cpp\n");
-    close(client_fd);
-    sprintf(log_msg, "Terminating Modbus connections thread\r\n");
-    openplc_log(log_msg);
-    pthread_exit(NULL);
+
+    return client_fd;
 }
 
 //-----------------------------------------------------------------------------
-// Function to start the server. It receives the port number as argument and
-// creates an infinite loop to listen and parse the messages sent by the
-// clients
+// Function to start the server. It receives the port number as argument,
+// starts the worker pool and hands every accepted client to one of the
+// workers until the server is stopped
 //-----------------------------------------------------------------------------
 void startServer(uint16_t port, int protocol_type)
 {
     char log_msg[1000];
     int socket_fd, client_fd;
-    bool *run_server;
+    bool *run_server = serverRunFlag(protocol_type);
+    ServerWorker *workers[SERVER_WORKERS];
+    int worker_count = 0;
+    int next_worker = 0;
+    ConnectionLimits limits;
+    getConnectionLimits(protocol_type, &limits);
     
     socket_fd = createSocket(port);
-    
-    if (protocol_type == MODBUS_PROTOCOL)
+    if (socket_fd < 0) return;
+
+    for (int i = 0; i < SERVER_WORKERS; i++)
+    {
+        ServerWorker *worker = (ServerWorker *)malloc(sizeof(ServerWorker));
+        if (worker == NULL) break;
+        worker->protocol_type = protocol_type;
+        worker->run_server = run_server;
+        worker->connections = NULL;
+        worker->connection_count = 0;
+        worker->pool = NULL;
+        worker->pool_count = 0;
+        worker->idle_timeout = limits.idle_timeout;
+        worker->idle_check_ns = 0;
+        worker->throttled_count = 0;
+        worker->output_length = 0;
+        pthread_mutex_init(&worker->lock, NULL);
+#ifdef __linux__
+        worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (worker->epoll_fd < 0)
+        {
+            free(worker);
+            break;
+        }
+#else
+        worker->epoll_fd = -1;
+#endif
+        if (pthread_create(&worker->thread, NULL, serverWorkerThread, worker) != 0)
+        {
+            if (worker->epoll_fd >= 0) close(worker->epoll_fd);
+            free(worker);
+            break;
+        }
+        workers[worker_count++] = worker;
+    }
+
+    if (worker_count == 0)
     {
-        //mapUnusedIO();
-        run_server = &run_modbus;
+        sprintf(log_msg, "Server: Error creating worker threads!\n");
+        openplc_log(log_msg);
+        close(socket_fd);
+        return;
     }
-    else if (protocol_type == ENIP_PROTOCOL)
-        run_server = &run_enip;
     
+    sprintf(log_msg, "Server: waiting for new clients...\n");
+    openplc_log(log_msg);
+
     while(*run_server)
     {
         client_fd = waitForClient(socket_fd, protocol_type); //block until a client connects
         if (client_fd < 0)
         {
-            sprintf(log_msg, "Server: Error accepting client!\n");
-            openplc_log(log_msg);
+            if (*run_server)
+            {
+                sprintf(log_msg, "Server: Error accepting client!\n");
+                openplc_log(log_msg);
+            }
+            continue;
         }
 
-        else
+        setClientOptions(client_fd, &limits);
+        if (limits.max_connections > 0) evictLeastRecent(workers, worker_count, limits.max_connections);
+
+        ServerWorker *worker = workers[next_worker];
+        next_worker = (next_worker + 1) % worker_count;
+        if (!registerConnection(worker, client_fd))
         {
-            int arguments[2];
-            pthread_t thread;
-            int ret = -1;
-            sprintf(log_msg, "Server: Client accepted! Creating thread for the new client ID: %d...\n", client_fd);
+            sprintf(log_msg, "Server: Error registering client ID: %d\n", client_fd);
             openplc_log(log_msg);
-            arguments[0] = client_fd;
-            arguments[1] = protocol_type;
-            ret = pthread_create(&thread, NULL, handleConnections, (void*)arguments);
-            if (ret==0) 
+            close(client_fd);
+            continue;
+        }
+        sprintf(log_msg, "Server: Client accepted! Client ID: %d\n", client_fd);
+        openplc_log(log_msg);
+    }
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        pthread_join(workers[i]->thread, NULL);
+        while (workers[i]->connections != NULL)
+        {
+            closeConnection(workers[i], workers[i]->connections);
+        }
+        while (workers[i]->pool != NULL)
+        {
+            ClientConnection *conn = workers[i]->pool;
+            workers[i]->pool = conn->next;
+            free(conn);
+        }
+        if (workers[i]->epoll_fd >= 0) close(workers[i]->epoll_fd);
+        pthread_mutex_destroy(&workers[i]->lock);
+        free(workers[i]);
+    }
+    close(socket_fd);
+    sprintf(log_msg, "Terminating Server thread\r\n");
+    openplc_log(log_msg);
+}
+
+//-----------------------------------------------------------------------------
+// Modbus/UDP. Every datagram carries one Modbus/TCP ADU and gets its response
+// back on a datagram to its sender, so all the clients are served from one
+// socket by one thread, without connections. Datagrams are received and
+// answered in batches of up to UDP_BATCH (recvmmsg/sendmmsg), each one
+// processed in place on a buffer of its own
+//-----------------------------------------------------------------------------
+struct UdpDatagram
+{
+    struct sockaddr_in from;
+    struct iovec iov;
+    unsigned char buffer[NET_BUFFER_SIZE];
+};
+
+//-----------------------------------------------------------------------------
+// Creates the UDP socket of the Modbus/UDP server. Returns -1 on failure
+//-----------------------------------------------------------------------------
+static int createUdpSocket(uint16_t port)
+{
+    char log_msg[1000];
+    struct sockaddr_in server_addr;
+
+    int socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (socket_fd < 0)
+    {
+        sprintf(log_msg, "Server: error creating datagram socket => %s\n", strerror(errno));
+        openplc_log(log_msg);
+        return -1;
+    }
+
+    int enable = 1;
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) < 0)
+        perror("setsockopt(SO_REUSEADDR) failed");
+    SetSocketBlockingEnabled(socket_fd, false);
+
+    bzero((char *) &server_addr, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(port);
+    if (bind(socket_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    {
+        sprintf(log_msg, "Server: error binding datagram socket => %s\n", strerror(errno));
+        openplc_log(log_msg);
+        close(socket_fd);
+        return -1;
+    }
+
+    sprintf(log_msg, "Server: Modbus/UDP listening on port %d\n", port);
+    openplc_log(log_msg);
+    return socket_fd;
+}
+
+//-----------------------------------------------------------------------------
+// Receives the datagrams waiting on the socket, up to UDP_BATCH. Returns how
+// many were received, their lengths on lengths
+//-----------------------------------------------------------------------------
+static int receiveDatagrams(int socket_fd, UdpDatagram *datagrams, int *lengths)
+{
+#ifdef __linux__
+    struct mmsghdr messages[UDP_BATCH];
+    memset(messages, 0, sizeof(messages));
+    for (int i = 0; i < UDP_BATCH; i++)
+    {
+        datagrams[i].iov.iov_base = datagrams[i].buffer;
+        datagrams[i].iov.iov_len = NET_BUFFER_SIZE;
+        messages[i].msg_hdr.msg_name = &datagrams[i].from;
+        messages[i].msg_hdr.msg_namelen = sizeof(datagrams[i].from);
+        messages[i].msg_hdr.msg_iov = &datagrams[i].iov;
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int count = recvmmsg(socket_fd, messages, UDP_BATCH, MSG_DONTWAIT, NULL);
+    for (int i = 0; i < count; i++)
+    {
+        //a truncated datagram is dropped
+        lengths[i] = (messages[i].msg_hdr.msg_flags & MSG_TRUNC) ? 0 : (int)messages[i].msg_len;
+    }
+    return count < 0 ? 0 : count;
+#else
+    int count = 0;
+    while (count < UDP_BATCH)
+    {
+        socklen_t from_len = sizeof(datagrams[count].from);
+        ssize_t length = recvfrom(socket_fd, datagrams[count].buffer, NET_BUFFER_SIZE, MSG_DONTWAIT,
+                                  (struct sockaddr *)&datagrams[count].from, &from_len);
+        if (length < 0) break;
+        lengths[count++] = (int)length;
+    }
+    return count;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Sends the responses of a batch, lengths of 0 are skipped
+//-----------------------------------------------------------------------------
+static void sendDatagrams(int socket_fd, UdpDatagram *datagrams, int *lengths, int count)
+{
+#ifdef __linux__
+    struct mmsghdr messages[UDP_BATCH];
+    int responses = 0;
+    memset(messages, 0, sizeof(messages));
+    for (int i = 0; i < count; i++)
+    {
+        if (lengths[i] <= 0) continue;
+        datagrams[i].iov.iov_base = datagrams[i].buffer;
+        datagrams[i].iov.iov_len = lengths[i];
+        messages[responses].msg_hdr.msg_name = &datagrams[i].from;
+        messages[responses].msg_hdr.msg_namelen = sizeof(datagrams[i].from);
+        messages[responses].msg_hdr.msg_iov = &datagrams[i].iov;
+        messages[responses].msg_hdr.msg_iovlen = 1;
+        responses++;
+    }
+
+    //a response the socket has no room for is lost, as any datagram
+    int sent = 0;
+    while (sent < responses)
+    {
+        int n = sendmmsg(socket_fd, messages + sent, responses - sent, MSG_DONTWAIT);
+        if (n <= 0) break;
+        sent += n;
+    }
+#else
+    for (int i = 0; i < count; i++)
+    {
+        if (lengths[i] <= 0) continue;
+        sendto(socket_fd, datagrams[i].buffer, lengths[i], MSG_DONTWAIT,
+               (struct sockaddr *)&datagrams[i].from, sizeof(datagrams[i].from));
+    }
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Function to start the Modbus/UDP server. Serves the datagrams received on
+// the port until run_modbus_udp is cleared
+//-----------------------------------------------------------------------------
+void startUdpServer(uint16_t port)
+{
+    char log_msg[1000];
+    int socket_fd = createUdpSocket(port);
+    if (socket_fd < 0) return;
+
+    UdpDatagram *datagrams = (UdpDatagram *)malloc(UDP_BATCH * sizeof(UdpDatagram));
+    if (datagrams == NULL)
+    {
+        close(socket_fd);
+        return;
+    }
+    int lengths[UDP_BATCH];
+
+    while (run_modbus_udp)
+    {
+        int count = receiveDatagrams(socket_fd, datagrams, lengths);
+        if (count == 0)
+        {
+            // Sleep until a datagram shows up, waking up now and then to
+            // check if the server was stopped
+            struct pollfd pfd;
+            pfd.fd = socket_fd;
+            pfd.events = POLLIN;
+            poll(&pfd, 1, 100);
+            continue;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            //a datagram holds exactly one ADU, anything else is dropped
+            unsigned char *frame = datagrams[i].buffer;
+            if (lengths[i] <= 0 || getModbusFrameLength(frame, lengths[i], NET_BUFFER_SIZE) != lengths[i])
             {
-                pthread_detach(thread);
+                lengths[i] = 0;
+                continue;
             }
+
+            struct timespec start, end, elapsed;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            uint32_t code = frame[7];
+            lengths[i] = processModbusMessage(frame, lengths[i]);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            timespec_diff(&end, &start, &elapsed);
+            recordProtocolRequest(MODBUS_PROTOCOL, lengths[i] <= 0 || (lengths[i] > 7 && (frame[7] & 0x80)));
+            recordProtocolLatency(MODBUS_PROTOCOL, (uint64_t)elapsed.tv_sec * 1000000000ULL + elapsed.tv_nsec);
+            if (event_tracing) TRACE_SPAN(TRACE_PROTOCOL_REQUEST, MODBUS_PROTOCOL, code, NULL, &start, &end);
         }
+
+        sendDatagrams(socket_fd, datagrams, lengths, count);
     }
+
+    free(datagrams);
     close(socket_fd);
-    close(client_fd);
-    sprintf(log_msg, "Terminating Server thread\r\n");
+    sprintf(log_msg, "Terminating Modbus/UDP Server thread\r\n");
     openplc_log(log_msg);
 }
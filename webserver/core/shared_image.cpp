@@ -0,0 +1,182 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file shares the published process image with local processes. The
+// two snapshots of process_image.cpp live on a POSIX shared memory segment
+// (see shared_image.h for its layout and the client side), so the scan
+// publishes straight to it and other processes read the snapshots where the
+// scan wrote them, with the same seqlock the protocol servers use. The
+// writes they queue on the segment are taken by the scan thread next to the
+// ones of the protocol servers.
+//
+// The segment is created again on every start, so a client that still maps
+// the one of a stopped runtime sees running go to 0 and opens the new one.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+
+#include "ladder.h"
+#include "shared_image.h"
+
+static_assert(sizeof(SharedImageWrite) == sizeof(ProcessImageWrite) &&
+              offsetof(SharedImageWrite, value) == offsetof(ProcessImageWrite, value) &&
+              offsetof(SharedImageWrite, mask) == offsetof(ProcessImageWrite, mask),
+              "shared writes are taken as process image writes");
+static_assert((SHARED_IMAGE_QUEUE_SIZE & (SHARED_IMAGE_QUEUE_SIZE - 1)) == 0, "the queue size is a power of two");
+
+static SharedImageHeader *shared_header = NULL;
+static SharedImageCell *shared_cells = NULL;
+
+//-----------------------------------------------------------------------------
+// Rounds a segment offset up to a cache line
+//-----------------------------------------------------------------------------
+static size_t alignLine(size_t offset)
+{
+    return (offset + PI_CACHE_LINE - 1) & ~(size_t)(PI_CACHE_LINE - 1);
+}
+
+//-----------------------------------------------------------------------------
+// Describes an area of the snapshots on the header
+//-----------------------------------------------------------------------------
+static void describeArea(SharedImageHeader *header, int area, size_t offset, size_t size, size_t entry_size)
+{
+    header->areas[area].offset = (uint32_t)offset;
+    header->areas[area].count = (uint32_t)(size / entry_size);
+    header->areas[area].entry_size = (uint32_t)entry_size;
+}
+
+//-----------------------------------------------------------------------------
+// Creates the shared segment and returns the two snapshots on it, for the
+// process image to publish on. Returns NULL, and the process image keeps its
+// snapshots private, if the segment can't be created
+//-----------------------------------------------------------------------------
+ProcessImageSnapshot *createSharedImage()
+{
+    char log_msg[1000];
+    size_t snapshots_offset = alignLine(sizeof(SharedImageHeader));
+    size_t queue_offset = alignLine(snapshots_offset + 2 * sizeof(ProcessImageSnapshot));
+    size_t size = queue_offset + SHARED_IMAGE_QUEUE_SIZE * sizeof(SharedImageCell);
+
+    shm_unlink(SHARED_IMAGE_NAME);
+    int fd = shm_open(SHARED_IMAGE_NAME, O_CREAT | O_EXCL | O_RDWR, 0660);
+    if (fd < 0 || ftruncate(fd, size) != 0)
+    {
+        sprintf(log_msg, "Shared image: can't create %s: %s\n", SHARED_IMAGE_NAME, strerror(errno));
+        openplc_log(log_msg);
+        if (fd >= 0)
+        {
+            close(fd);
+            shm_unlink(SHARED_IMAGE_NAME);
+        }
+        return NULL;
+    }
+
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED)
+    {
+        sprintf(log_msg, "Shared image: can't map %s: %s\n", SHARED_IMAGE_NAME, strerror(errno));
+        openplc_log(log_msg);
+        shm_unlink(SHARED_IMAGE_NAME);
+        return NULL;
+    }
+
+    // The segment starts zeroed, the header and the cells only need the
+    // fields that are not
+    SharedImageHeader *header = (SharedImageHeader *)ptr;
+    header->version = SHARED_IMAGE_VERSION;
+    header->segment_size = (uint32_t)size;
+    header->snapshot_size = sizeof(ProcessImageSnapshot);
+    header->snapshot_offset[0] = (uint32_t)snapshots_offset;
+    header->snapshot_offset[1] = (uint32_t)(snapshots_offset + sizeof(ProcessImageSnapshot));
+    header->queue_offset = (uint32_t)queue_offset;
+    header->queue_size = SHARED_IMAGE_QUEUE_SIZE;
+    header->pid = getpid();
+    header->sequence_offset = offsetof(ProcessImageSnapshot, sequence);
+    header->version_offset = offsetof(ProcessImageSnapshot, version);
+    header->timestamp_offset = offsetof(ProcessImageSnapshot, timestamp);
+    describeArea(header, SHARED_IMAGE_BOOL_INPUT, offsetof(ProcessImageSnapshot, bool_input), sizeof(((ProcessImageSnapshot *)0)->bool_input), sizeof(IEC_BOOL));
+    describeArea(header, SHARED_IMAGE_BOOL_OUTPUT, offsetof(ProcessImageSnapshot, bool_output), sizeof(((ProcessImageSnapshot *)0)->bool_output), sizeof(IEC_BOOL));
+    describeArea(header, SHARED_IMAGE_INT_INPUT, offsetof(ProcessImageSnapshot, int_input), sizeof(((ProcessImageSnapshot *)0)->int_input), sizeof(IEC_UINT));
+    describeArea(header, SHARED_IMAGE_INT_OUTPUT, offsetof(ProcessImageSnapshot, int_output), sizeof(((ProcessImageSnapshot *)0)->int_output), sizeof(IEC_UINT));
+    describeArea(header, SHARED_IMAGE_INT_MEMORY, offsetof(ProcessImageSnapshot, int_memory), sizeof(((ProcessImageSnapshot *)0)->int_memory), sizeof(IEC_UINT));
+    describeArea(header, SHARED_IMAGE_DINT_MEMORY, offsetof(ProcessImageSnapshot, dint_memory), sizeof(((ProcessImageSnapshot *)0)->dint_memory), sizeof(IEC_UDINT));
+    describeArea(header, SHARED_IMAGE_LINT_MEMORY, offsetof(ProcessImageSnapshot, lint_memory), sizeof(((ProcessImageSnapshot *)0)->lint_memory), sizeof(IEC_ULINT));
+    describeArea(header, SHARED_IMAGE_BOOL_INPUT_BITS, offsetof(ProcessImageSnapshot, bool_input_bits), sizeof(((ProcessImageSnapshot *)0)->bool_input_bits), 1);
+    describeArea(header, SHARED_IMAGE_BOOL_OUTPUT_BITS, offsetof(ProcessImageSnapshot, bool_output_bits), sizeof(((ProcessImageSnapshot *)0)->bool_output_bits), 1);
+    describeArea(header, SHARED_IMAGE_RETAIN_MEMORY, offsetof(ProcessImageSnapshot, retain_memory), RETAIN_MEMORY_SIZE, 1);
+
+    shared_cells = (SharedImageCell *)((unsigned char *)ptr + queue_offset);
+    for (uint32_t i = 0; i < SHARED_IMAGE_QUEUE_SIZE; i++) shared_cells[i].sequence.store(i, std::memory_order_relaxed);
+
+    header->running.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = SHARED_IMAGE_MAGIC;
+    shared_header = header;
+
+    sprintf(log_msg, "Shared image: process image published on %s (%lu bytes)\n", SHARED_IMAGE_NAME, (unsigned long)size);
+    openplc_log(log_msg);
+    return (ProcessImageSnapshot *)((unsigned char *)ptr + snapshots_offset);
+}
+
+//-----------------------------------------------------------------------------
+// Tells the clients which snapshot was published last. Called by the scan
+// thread once the snapshot is complete
+//-----------------------------------------------------------------------------
+void publishSharedImage(int index)
+{
+    if (shared_header != NULL) shared_header->published.store(index, std::memory_order_release);
+}
+
+//-----------------------------------------------------------------------------
+// Takes up to max writes queued by the clients, in order. Called by the scan
+// thread only. A client that stops between taking a cell and filling it
+// holds the writes queued after it until the runtime restarts
+//-----------------------------------------------------------------------------
+int takeSharedImageWrites(ProcessImageWrite *writes, int max)
+{
+    if (shared_header == NULL) return 0;
+
+    uint32_t head = shared_header->queue_head.load(std::memory_order_relaxed);
+    int count = 0;
+    while (count < max)
+    {
+        SharedImageCell *cell = &shared_cells[head & (SHARED_IMAGE_QUEUE_SIZE - 1)];
+        if (cell->sequence.load(std::memory_order_acquire) != head + 1) break;
+
+        memcpy(&writes[count++], &cell->write, sizeof(ProcessImageWrite));
+        cell->sequence.store(head + SHARED_IMAGE_QUEUE_SIZE, std::memory_order_release);
+        head++;
+    }
+    shared_header->queue_head.store(head, std::memory_order_relaxed);
+    return count;
+}
+
+//-----------------------------------------------------------------------------
+// Tells the clients the runtime stopped and removes the segment name. The
+// mapping stays, the protocol servers may still read the snapshots on it
+//-----------------------------------------------------------------------------
+void finalizeSharedImage()
+{
+    if (shared_header == NULL) return;
+    shared_header->running.store(0, std::memory_order_release);
+    shm_unlink(SHARED_IMAGE_NAME);
+}
@@ -0,0 +1,298 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// Layout of the process image the runtime shares with local processes, and
+// the client side of it. The runtime publishes its per-scan snapshots on the
+// POSIX shared memory segment SHARED_IMAGE_NAME: a header describing where
+// every area is, the two snapshots the scan alternates between and a queue
+// of writes applied at the start of the next scan. This header doesn't need
+// anything from the runtime, an application only includes it:
+//
+//     SharedImageClient image;
+//     if (openSharedImage(&image))
+//     {
+//         uint16_t level;
+//         readSharedImage(&image, SHARED_IMAGE_INT_INPUT, 3, 1, &level, NULL);
+//
+//         SharedImageWrite start = { SHARED_IMAGE_BOOL_OUTPUT, 2, 0, 1, 1 };
+//         queueSharedImageWrite(&image, &start);    // %QX0.2 := TRUE
+//     }
+//
+// Reads follow the seqlock of the snapshots, exactly like the protocol
+// servers of the runtime: take the snapshot with beginSharedImageRead(),
+// copy what is needed straight from it and retry when endSharedImageRead()
+// says the scan rewrote it in the meantime. The writes go on a bounded
+// multi-producer queue, with the same meaning as the writes of the protocol
+// servers: only the bits set on mask change.
+//-----------------------------------------------------------------------------
+
+#ifndef SHARED_IMAGE_H
+#define SHARED_IMAGE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+
+#define SHARED_IMAGE_NAME           "/openplc_image"
+#define SHARED_IMAGE_MAGIC          0x4d494c50 // "PLIM"
+#define SHARED_IMAGE_VERSION        1
+#define SHARED_IMAGE_QUEUE_SIZE     1024       // writes, a power of two
+#define SHARED_IMAGE_SPINS          100000     // reads of a snapshot being rewritten before giving up
+
+//Areas of a snapshot. The first seven are the ones that can be written
+#define SHARED_IMAGE_BOOL_INPUT         0   // %IX, one byte per bool
+#define SHARED_IMAGE_BOOL_OUTPUT        1   // %QX, one byte per bool
+#define SHARED_IMAGE_INT_INPUT          2   // %IW
+#define SHARED_IMAGE_INT_OUTPUT         3   // %QW
+#define SHARED_IMAGE_INT_MEMORY         4   // %MW
+#define SHARED_IMAGE_DINT_MEMORY        5   // %MD
+#define SHARED_IMAGE_LINT_MEMORY        6   // %ML
+#define SHARED_IMAGE_BOOL_INPUT_BITS    7   // %IX, eight per byte from the lowest bit up
+#define SHARED_IMAGE_BOOL_OUTPUT_BITS   8   // %QX, eight per byte from the lowest bit up
+#define SHARED_IMAGE_RETAIN_MEMORY      9   // variables declared RETAIN
+#define SHARED_IMAGE_AREAS              10
+
+//Where an area is on a snapshot. The bool areas count bools (%IX0.0 is
+//entry 0, %IX1.0 entry 8), the bits areas and the retain area count bytes
+struct SharedImageArea
+{
+    uint32_t offset;
+    uint32_t count;
+    uint32_t entry_size;
+    uint32_t reserved;
+};
+
+//A write queued for the next scan. Only the bits set on mask are changed on
+//the target variable, bit selects the bool of a byte on the bool areas
+struct SharedImageWrite
+{
+    uint8_t area;
+    uint8_t bit;
+    uint16_t index;
+    uint64_t value;
+    uint64_t mask;
+};
+
+//A slot of the write queue. Its sequence tells producers and the scan
+//whose turn it is
+struct SharedImageCell
+{
+    std::atomic<uint32_t> sequence;
+    uint32_t reserved;
+    SharedImageWrite write;
+};
+
+//Start of the segment. The snapshots and the queue cells follow at the
+//offsets it gives, every one of them on a cache line of its own
+struct SharedImageHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t segment_size;
+    uint32_t snapshot_size;
+    uint32_t snapshot_offset[2];
+    uint32_t queue_offset;
+    uint32_t queue_size;
+    int32_t pid;                                // runtime publishing the image
+    uint32_t sequence_offset;                   // fields of every snapshot
+    uint32_t version_offset;
+    uint32_t timestamp_offset;                  // UTC time (ms) of the scan
+    SharedImageArea areas[SHARED_IMAGE_AREAS];
+    alignas(64) std::atomic<uint32_t> published;    // snapshot last published
+    std::atomic<uint32_t> running;                  // 0 once the runtime stopped
+    alignas(64) std::atomic<uint32_t> queue_tail;   // next cell of the producers
+    alignas(64) std::atomic<uint32_t> queue_head;   // next cell of the scan
+};
+
+struct SharedImageClient
+{
+    SharedImageHeader *header;
+    size_t size;
+};
+
+//-----------------------------------------------------------------------------
+// Maps the image shared by the runtime. Returns false if it is not running
+// or publishes another layout version
+//-----------------------------------------------------------------------------
+inline bool openSharedImage(SharedImageClient *client, const char *name = SHARED_IMAGE_NAME)
+{
+    client->header = NULL;
+    client->size = 0;
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(SharedImageHeader))
+    {
+        close(fd);
+        return false;
+    }
+
+    void *ptr = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) return false;
+
+    SharedImageHeader *header = (SharedImageHeader *)ptr;
+    if (header->magic != SHARED_IMAGE_MAGIC || header->version != SHARED_IMAGE_VERSION ||
+        header->segment_size != (uint32_t)info.st_size)
+    {
+        munmap(ptr, info.st_size);
+        return false;
+    }
+
+    client->header = header;
+    client->size = info.st_size;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Unmaps the image
+//-----------------------------------------------------------------------------
+inline void closeSharedImage(SharedImageClient *client)
+{
+    if (client->header != NULL) munmap(client->header, client->size);
+    client->header = NULL;
+    client->size = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Returns true while the runtime that published the image runs. A client
+// whose runtime stopped opens the image again to follow the next one
+//-----------------------------------------------------------------------------
+inline bool sharedImageRunning(const SharedImageClient *client)
+{
+    return client->header != NULL && client->header->running.load(std::memory_order_acquire) != 0;
+}
+
+//-----------------------------------------------------------------------------
+// Starts a read of the last published snapshot. The caller copies what it
+// needs, with sharedImageArea(), and calls endSharedImageRead() with the same
+// sequence, retrying the whole read if it returns false. Returns NULL if the
+// runtime stopped in the middle of a scan
+//-----------------------------------------------------------------------------
+inline const unsigned char *beginSharedImageRead(const SharedImageClient *client, uint32_t *sequence)
+{
+    const SharedImageHeader *header = client->header;
+    for (int spin = 0; spin < SHARED_IMAGE_SPINS; spin++)
+    {
+        uint32_t index = header->published.load(std::memory_order_acquire) & 1;
+        const unsigned char *snap = (const unsigned char *)header + header->snapshot_offset[index];
+        uint32_t seq = ((const std::atomic<uint32_t> *)(snap + header->sequence_offset))->load(std::memory_order_acquire);
+        if ((seq & 1) == 0)
+        {
+            *sequence = seq;
+            return snap;
+        }
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Finishes a read started with beginSharedImageRead(). Returns false if the
+// scan rewrote the snapshot while it was being read
+//-----------------------------------------------------------------------------
+inline bool endSharedImageRead(const SharedImageClient *client, const unsigned char *snap, uint32_t sequence)
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return ((const std::atomic<uint32_t> *)(snap + client->header->sequence_offset))->load(std::memory_order_relaxed) == sequence;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the first entry of an area on a snapshot, NULL for an unknown area
+//-----------------------------------------------------------------------------
+inline const void *sharedImageArea(const SharedImageClient *client, const unsigned char *snap, int area)
+{
+    if (area < 0 || area >= SHARED_IMAGE_AREAS) return NULL;
+    return snap + client->header->areas[area].offset;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the version of a snapshot, one more on every scan
+//-----------------------------------------------------------------------------
+inline uint32_t sharedImageVersion(const SharedImageClient *client, const unsigned char *snap)
+{
+    uint32_t version;
+    memcpy(&version, snap + client->header->version_offset, sizeof(version));
+    return version;
+}
+
+//-----------------------------------------------------------------------------
+// Copies count entries of an area, starting at entry first, from one
+// consistent snapshot. The version of that snapshot goes to version unless
+// it is NULL. Returns false if the range is out of the area or the runtime
+// stopped
+//-----------------------------------------------------------------------------
+inline bool readSharedImage(const SharedImageClient *client, int area, uint32_t first, uint32_t count, void *values, uint32_t *version)
+{
+    if (client->header == NULL || area < 0 || area >= SHARED_IMAGE_AREAS) return false;
+    const SharedImageArea *layout = &client->header->areas[area];
+    if (first > layout->count || count > layout->count - first) return false;
+
+    while (true)
+    {
+        uint32_t sequence;
+        const unsigned char *snap = beginSharedImageRead(client, &sequence);
+        if (snap == NULL) return false;
+
+        memcpy(values, snap + layout->offset + (size_t)first * layout->entry_size, (size_t)count * layout->entry_size);
+        if (version != NULL) *version = sharedImageVersion(client, snap);
+        if (endSharedImageRead(client, snap, sequence)) return true;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Queues a write for the next scan. Returns 0 on success or -1 if the queue
+// is full. Several processes and threads can queue at the same time
+//-----------------------------------------------------------------------------
+inline int queueSharedImageWrite(const SharedImageClient *client, const SharedImageWrite *write)
+{
+    SharedImageHeader *header = client->header;
+    SharedImageCell *cells = (SharedImageCell *)((unsigned char *)header + header->queue_offset);
+    uint32_t mask = header->queue_size - 1;
+
+    uint32_t position = header->queue_tail.load(std::memory_order_relaxed);
+    while (true)
+    {
+        SharedImageCell *cell = &cells[position & mask];
+        int32_t turn = (int32_t)(cell->sequence.load(std::memory_order_acquire) - position);
+        if (turn == 0)
+        {
+            if (header->queue_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                cell->write = *write;
+                cell->sequence.store(position + 1, std::memory_order_release);
+                return 0;
+            }
+        }
+        else if (turn < 0)
+        {
+            return -1;
+        }
+        else
+        {
+            position = header->queue_tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+#endif
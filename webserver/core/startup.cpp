@@ -0,0 +1,191 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file times the initialization phases of the runtime. main() runs the
+// phases the first scan needs (the I/O, the retentive variables) on its own
+// thread or on a startup thread it waits for, and the ones the scan doesn't
+// need (the tag database and the services built on it) on startup threads
+// it never waits for. Once the first scan is about to run, the time every
+// phase took is logged.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdint.h>
+
+#include "ladder.h"
+
+#define STARTUP_PHASE_MAX   16
+
+struct StartupPhase
+{
+    const char *name;
+    void (*run)(void);
+    pthread_t thread;
+    bool threaded;
+    bool done;
+    uint64_t start_ns;
+    uint64_t end_ns;
+};
+
+static StartupPhase phases[STARTUP_PHASE_MAX];
+static int phase_count = 0;
+static uint64_t startup_ns = 0;
+static bool phases_logged = false;
+static pthread_mutex_t phaseLock = PTHREAD_MUTEX_INITIALIZER;
+
+//-----------------------------------------------------------------------------
+// Returns the monotonic time in nanoseconds
+//-----------------------------------------------------------------------------
+static uint64_t startupClock()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+// Takes a slot for a phase, NULL if they are all taken
+//-----------------------------------------------------------------------------
+static StartupPhase *newPhase(const char *name, void (*run)(void))
+{
+    if (startup_ns == 0) startup_ns = startupClock();
+    if (phase_count >= STARTUP_PHASE_MAX) return NULL;
+
+    StartupPhase *phase = &phases[phase_count++];
+    memset(phase, 0, sizeof(*phase));
+    phase->name = name;
+    phase->run = run;
+    return phase;
+}
+
+//-----------------------------------------------------------------------------
+// Runs a phase, timing it
+//-----------------------------------------------------------------------------
+static void *startupThread(void *arg)
+{
+    StartupPhase *phase = (StartupPhase *)arg;
+    uint64_t start = startupClock();
+    phase->run();
+    uint64_t end = startupClock();
+
+    pthread_mutex_lock(&phaseLock);
+    phase->start_ns = start;
+    phase->end_ns = end;
+    phase->done = true;
+    bool late = phases_logged;
+    pthread_mutex_unlock(&phaseLock);
+
+    // A background phase that outlived the log reports on its own
+    if (late)
+    {
+        char log_msg[1000];
+        sprintf(log_msg, "Startup: %s took %.1f ms, in the background\n", phase->name, (end - start) / 1e6);
+        openplc_log(log_msg);
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Runs a startup phase on the calling thread
+//-----------------------------------------------------------------------------
+void runStartupPhase(const char *name, void (*run)(void))
+{
+    StartupPhase *phase = newPhase(name, run);
+    if (phase == NULL) run();
+    else startupThread(phase);
+}
+
+//-----------------------------------------------------------------------------
+// Thread of a phase started in the background
+//-----------------------------------------------------------------------------
+static void *startupPhaseThread(void *arg)
+{
+    setThreadName("startup");
+    return startupThread(arg);
+}
+
+//-----------------------------------------------------------------------------
+// Starts a startup phase on a thread of its own and returns its handle for
+// waitStartupPhase(). The phase runs on the calling thread, and -1 is
+// returned, if the thread can't be started
+//-----------------------------------------------------------------------------
+int startStartupPhase(const char *name, void (*run)(void))
+{
+    StartupPhase *phase = newPhase(name, run);
+    if (phase == NULL)
+    {
+        run();
+        return -1;
+    }
+
+    if (pthread_create(&phase->thread, NULL, startupPhaseThread, phase) != 0)
+    {
+        startupThread(phase);
+        return -1;
+    }
+    phase->threaded = true;
+    return (int)(phase - phases);
+}
+
+//-----------------------------------------------------------------------------
+// Waits for a phase started by startStartupPhase() to finish
+//-----------------------------------------------------------------------------
+void waitStartupPhase(int handle)
+{
+    if (handle < 0 || handle >= phase_count || !phases[handle].threaded) return;
+    pthread_join(phases[handle].thread, NULL);
+    phases[handle].threaded = false;
+}
+
+//-----------------------------------------------------------------------------
+// Logs the time every phase took and the time to the first scan. The phases
+// still running in the background are logged as such and left running
+//-----------------------------------------------------------------------------
+void logStartupPhases()
+{
+    char log_msg[1000];
+    uint64_t now = startupClock();
+
+    pthread_mutex_lock(&phaseLock);
+    for (int i = 0; i < phase_count; i++)
+    {
+        const StartupPhase *phase = &phases[i];
+        if (phase->done)
+        {
+            sprintf(log_msg, "Startup: %s took %.1f ms\n", phase->name, (phase->end_ns - phase->start_ns) / 1e6);
+        }
+        else
+        {
+            sprintf(log_msg, "Startup: %s still running in the background\n", phase->name);
+        }
+        openplc_log(log_msg);
+
+        // Background phases keep their threads, nobody joins them
+        if (phases[i].threaded && !phase->done) pthread_detach(phases[i].thread);
+        else if (phases[i].threaded) pthread_join(phases[i].thread, NULL);
+        phases[i].threaded = false;
+    }
+    phases_logged = true;
+    pthread_mutex_unlock(&phaseLock);
+
+    sprintf(log_msg, "Startup: first scan %.1f ms after the runtime started\n", (now - startup_ns) / 1e6);
+    openplc_log(log_msg);
+}
@@ -0,0 +1,742 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the runtime tag database. It is built when the
+// program starts and after every online change from the metadata generated
+// with the program: the located variable table of glueVars.cpp (named after
+// OPCUA_VARIABLES.csv when the program was compiled with it) and the
+// protocol map, which adds the located variables the table leaves out.
+// tags.cfg then names the tags and gives them a type, a deadband and a
+// scaling.
+//
+// The translation of a location into the address of every protocol lives
+// here, once, and each tag keeps the result. The glue generator resolves the
+// located variables of the protocol map with the same translation, so their
+// tags take the addresses from the program. Tags are found by name or by
+// any protocol address with a single hash lookup. A database is never freed
+// once it is replaced, so the tags handed out stay valid.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "ladder.h"
+
+#define TAG_CONFIG_FILE     "tags.cfg"
+
+// Address ranges of the protocols, the same ones their servers map
+#define MODBUS_MAX_BITS         8192
+#define MODBUS_MAX_INP_REGS     1024
+#define MODBUS_MIN_16B_RANGE    1024
+#define MODBUS_MIN_32B_RANGE    2048
+#define MODBUS_MIN_64B_RANGE    4096
+#define DNP3_MAX_BINARY         8192
+#define DNP3_MAX_16B_RANGE      2047
+#define DNP3_MAX_32B_RANGE      4095
+#define DNP3_MAX_64B_RANGE      8191
+#define PCCC_MIN_16B_RANGE      1024
+
+struct AddressSlot
+{
+    uint64_t key;           // 0 while the slot is empty
+    uint32_t tag;
+    uint32_t element;
+};
+
+struct TagDatabase
+{
+    std::vector<Tag> tags;
+    std::vector<char *> names;          // names made up from the locations
+    std::vector<uint32_t> by_name;      // tag + 1, 0 while the slot is empty
+    std::vector<AddressSlot> by_address;
+};
+
+// tags.cfg while it is read. The settings of a section are kept until the
+// tag they apply to is known
+struct TagConfigReader
+{
+    TagDatabase *db;
+    std::unordered_map<uint64_t, uint32_t> *locations;
+    std::vector<std::pair<std::string, std::string> > settings;
+    bool in_section;
+};
+
+static std::atomic<TagDatabase *> database(NULL);
+static std::vector<TagDatabase *> retired_databases;
+static pthread_mutex_t databaseLock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *protocol_names[PROTOCOL_TYPES] = { "modbus", "dnp3", "enip", "opcua", "s7" };
+static const char *type_names[] = { "bool", "unsigned", "signed", "real" };
+
+static uint32_t hashName(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    while (*name)
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint64_t hashKey(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key;
+}
+
+//-----------------------------------------------------------------------------
+// Key of a protocol address on the lookup table. It is never 0
+//-----------------------------------------------------------------------------
+static uint64_t addressKey(int protocol, uint16_t table, uint32_t address, uint8_t bit)
+{
+    return ((uint64_t)(protocol + 1) << 56) | ((uint64_t)table << 40) | ((uint64_t)bit << 32) | address;
+}
+
+//-----------------------------------------------------------------------------
+// Key of a location, to find the tag that holds an entry of an area
+//-----------------------------------------------------------------------------
+static uint64_t locationKey(char area, char size, uint32_t position)
+{
+    return ((uint64_t)(uint8_t)area << 40) | ((uint64_t)(uint8_t)size << 32) | position;
+}
+
+//-----------------------------------------------------------------------------
+// Parses a location ([%]IX0.0, QW3, MD10, ...) into its area, size and
+// position (byte * 8 + bit for booleans). Returns false if it isn't a
+// location of the images
+//-----------------------------------------------------------------------------
+bool parseTagLocation(const char *text, char *area, char *size, uint32_t *position)
+{
+    if (*text == '%') text++;
+    if (strchr("IQM", text[0]) == NULL || text[0] == '\0') return false;
+    if (strchr("XBWDLRF", text[1]) == NULL || text[1] == '\0') return false;
+    if (!isdigit((unsigned char)text[2])) return false;
+
+    char *end;
+    unsigned long value = strtoul(text + 2, &end, 10);
+    if (text[1] == 'X')
+    {
+        if (*end != '.' || !isdigit((unsigned char)end[1])) return false;
+        unsigned long bit = strtoul(end + 1, &end, 10);
+        if (bit > 7 || value >= BUFFER_SIZE) return false;
+        value = value * 8 + bit;
+    }
+    else if (value >= BUFFER_SIZE)
+    {
+        return false;
+    }
+    if (*end != '\0') return false;
+    if (text[0] == 'M' && (text[1] == 'X' || text[1] == 'B')) return false;
+
+    *area = text[0];
+    *size = text[1];
+    *position = (uint32_t)value;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the offset of an entry on ProcessImageSnapshot, or -1 if the
+// snapshots don't publish its area
+//-----------------------------------------------------------------------------
+int32_t tagImageOffset(char area, char size, uint32_t position)
+{
+    if (area == 'I' && size == 'X') return offsetof(ProcessImageSnapshot, bool_input) + position;
+    if (area == 'Q' && size == 'X') return offsetof(ProcessImageSnapshot, bool_output) + position;
+    if (area == 'I' && size == 'W') return offsetof(ProcessImageSnapshot, int_input) + position * 2;
+    if (area == 'Q' && size == 'W') return offsetof(ProcessImageSnapshot, int_output) + position * 2;
+    if (area == 'M' && size == 'W') return offsetof(ProcessImageSnapshot, int_memory) + position * 2;
+    if (area == 'M' && size == 'D') return offsetof(ProcessImageSnapshot, dint_memory) + position * 4;
+    if (area == 'M' && size == 'L') return offsetof(ProcessImageSnapshot, lint_memory) + position * 8;
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the entry of a location on the images
+//-----------------------------------------------------------------------------
+static void *imageValue(char area, char size, uint32_t position)
+{
+    switch (size)
+    {
+        case 'X':
+            if (area == 'I') return &bool_input_image[position / 8][position % 8];
+            if (area == 'Q') return &bool_output_image[position / 8][position % 8];
+            return &bool_memory_image[position / 8][position % 8];
+        case 'B':
+            if (area == 'I') return &byte_input_image[position];
+            if (area == 'Q') return &byte_output_image[position];
+            return &byte_memory_image[position];
+        case 'W':
+            if (area == 'I') return &int_input_image[position];
+            if (area == 'Q') return &int_output_image[position];
+            return &int_memory_image[position];
+        case 'D':
+            if (area == 'I') return &dint_input_image[position];
+            if (area == 'Q') return &dint_output_image[position];
+            return &dint_memory_image[position];
+        case 'L':
+            if (area == 'I') return &lint_input_image[position];
+            if (area == 'Q') return &lint_output_image[position];
+            return &lint_memory_image[position];
+        case 'R':
+            if (area == 'I') return &real_input_image[position];
+            if (area == 'Q') return &real_output_image[position];
+            return &real_memory_image[position];
+        default:
+            if (area == 'I') return &lreal_input_image[position];
+            if (area == 'Q') return &lreal_output_image[position];
+            return &lreal_memory_image[position];
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Translates an entry of the images into its address on a protocol. This is
+// the address map every protocol server implements: Modbus and DNP3 put %QW,
+// %MW, %MD and %ML one after the other on the holding registers / analog
+// outputs, PCCC packs 16 bits per element and puts %MW after %QW on the N
+// file, S7 uses the PE and PA areas and DB2, DB102, DB1002 and DB1004.
+// OPC UA nodes come from the located variable table instead. Returns false
+// if the protocol doesn't reach the entry
+//-----------------------------------------------------------------------------
+bool tagProtocolAddress(char area, char size, uint32_t position, int protocol, TagAddress *address)
+{
+    address->table = 0;
+    address->bit = 0;
+    address->address = 0;
+
+    switch (protocol)
+    {
+        case MODBUS_PROTOCOL:
+            if (size == 'X' && area != 'M' && position < MODBUS_MAX_BITS)
+            {
+                address->table = (area == 'I') ? TAG_MODBUS_DISCRETE_INPUTS : TAG_MODBUS_COILS;
+                address->address = position;
+            }
+            else if (position >= MODBUS_MIN_16B_RANGE)
+            {
+                return false;
+            }
+            else if (area == 'I' && size == 'W' && position < MODBUS_MAX_INP_REGS)
+            {
+                address->table = TAG_MODBUS_INPUT_REGS;
+                address->address = position;
+            }
+            else if (area != 'I')
+            {
+                address->table = TAG_MODBUS_HOLDING_REGS;
+                if (area == 'Q' && size == 'W') address->address = position;
+                else if (area == 'M' && size == 'W') address->address = MODBUS_MIN_16B_RANGE + position;
+                else if (area == 'M' && size == 'D') address->address = MODBUS_MIN_32B_RANGE + position * 2;
+                else if (area == 'M' && size == 'L') address->address = MODBUS_MIN_64B_RANGE + position * 4;
+                else address->table = 0;
+            }
+            break;
+
+        case DNP3_PROTOCOL:
+            if (size == 'X' && area != 'M' && position < DNP3_MAX_BINARY)
+            {
+                address->table = (area == 'I') ? TAG_DNP3_BINARY_INPUTS : TAG_DNP3_BINARY_OUTPUTS;
+                address->address = position;
+            }
+            else if (area == 'I' && size == 'W' && position < MODBUS_MAX_INP_REGS)
+            {
+                address->table = TAG_DNP3_ANALOG_INPUTS;
+                address->address = position;
+            }
+            else if (area == 'Q' && size == 'W' && position < MODBUS_MIN_16B_RANGE)
+            {
+                address->table = TAG_DNP3_ANALOG_OUTPUTS;
+                address->address = position;
+            }
+            else if (area == 'M')
+            {
+                uint32_t point = 0, last = 0;
+                if (size == 'W') { point = MODBUS_MIN_16B_RANGE + position; last = DNP3_MAX_16B_RANGE; }
+                else if (size == 'D') { point = MODBUS_MIN_32B_RANGE + position; last = DNP3_MAX_32B_RANGE; }
+                else if (size == 'L') { point = MODBUS_MIN_64B_RANGE + position; last = DNP3_MAX_64B_RANGE; }
+                if (point < last)
+                {
+                    address->table = TAG_DNP3_ANALOG_OUTPUTS;
+                    address->address = point;
+                }
+            }
+            break;
+
+        case ENIP_PROTOCOL:
+            if (size == 'X' && area != 'M')
+            {
+                address->table = (area == 'I') ? TAG_PCCC_INPUT_FILE : TAG_PCCC_OUTPUT_FILE;
+                address->address = position / 16;
+                address->bit = position % 16;
+            }
+            else if (area == 'Q' && size == 'W' && position < PCCC_MIN_16B_RANGE)
+            {
+                address->table = TAG_PCCC_INTEGER_FILE;
+                address->address = position;
+            }
+            else if (area == 'M' && size == 'W')
+            {
+                address->table = TAG_PCCC_INTEGER_FILE;
+                address->address = PCCC_MIN_16B_RANGE + position;
+            }
+            else if (area == 'M' && size == 'D')
+            {
+                address->table = TAG_PCCC_LONG_FILE;
+                address->address = position;
+            }
+            break;
+
+        case S7_PROTOCOL:
+            if (size == 'X' && area != 'M')
+            {
+                address->table = (area == 'I') ? TAG_S7_PE : TAG_S7_PA;
+                address->address = position / 8;
+                address->bit = position % 8;
+            }
+            else if (size == 'W')
+            {
+                address->table = (area == 'I') ? 2 : (area == 'Q') ? 102 : 1002;
+                address->address = position * 2;
+            }
+            else if (area == 'M' && size == 'D')
+            {
+                address->table = 1004;
+                address->address = position * 4;
+            }
+            break;
+    }
+
+    return address->table != 0;
+}
+
+//-----------------------------------------------------------------------------
+// Registers the addresses of every entry of a tag on the lookup table. The
+// registers of a 32 or 64-bit Modbus value all lead to it
+//-----------------------------------------------------------------------------
+static void indexTagAddresses(TagDatabase *db, uint32_t index)
+{
+    const Tag *tag = &db->tags[index];
+    size_t mask = db->by_address.size() - 1;
+
+    for (uint32_t element = 0; element < tag->count; element++)
+    {
+        for (int protocol = 0; protocol < PROTOCOL_TYPES; protocol++)
+        {
+            TagAddress address;
+            int words = 1;
+            if (protocol == OPCUA_PROTOCOL)
+            {
+                if (element > 0 || tag->address[protocol].table == 0) continue;
+                address = tag->address[protocol];
+            }
+            else
+            {
+                if (element == 0) address = tag->address[protocol];
+                else tagProtocolAddress(tag->area, tag->size, tag->position + element, protocol, &address);
+                if (address.table == 0) continue;
+                if (protocol == MODBUS_PROTOCOL && tag->size == 'D') words = 2;
+                if (protocol == MODBUS_PROTOCOL && tag->size == 'L') words = 4;
+            }
+
+            for (int word = 0; word < words; word++)
+            {
+                uint64_t key = addressKey(protocol, address.table, address.address + word, address.bit);
+                size_t slot = hashKey(key) & mask;
+                while (db->by_address[slot].key != 0 && db->by_address[slot].key != key) slot = (slot + 1) & mask;
+                if (db->by_address[slot].key == key) continue; // the first tag keeps the address
+
+                db->by_address[slot].key = key;
+                db->by_address[slot].tag = index;
+                db->by_address[slot].element = element;
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Returns the number of lookup slots for the given number of keys, a power
+// of two at least twice as large
+//-----------------------------------------------------------------------------
+static size_t tableSize(size_t keys)
+{
+    size_t size = 16;
+    while (size < keys * 2) size *= 2;
+    return size;
+}
+
+//-----------------------------------------------------------------------------
+// Fills the fields a tag takes from its location. The protocol addresses are
+// left out when the caller has them already
+//-----------------------------------------------------------------------------
+static void initializeTag(Tag *tag, const char *name, char area, char size, uint32_t position, uint32_t count, bool translate = true)
+{
+    memset(tag, 0, sizeof(*tag));
+    tag->name = name;
+    if (size == 'X') snprintf(tag->location, sizeof(tag->location), "%%%c%c%u.%u", area, size, position / 8, position % 8);
+    else snprintf(tag->location, sizeof(tag->location), "%%%c%c%u", area, size, position);
+    tag->area = area;
+    tag->size = size;
+    tag->type = (size == 'X') ? TAG_TYPE_BOOL : (size == 'R' || size == 'F') ? TAG_TYPE_REAL : TAG_TYPE_UNSIGNED;
+    tag->position = position;
+    tag->count = count;
+    tag->value = imageValue(area, size, position);
+    tag->image_offset = tagImageOffset(area, size, position);
+    tag->scale = 1.0;
+#ifdef OPLC_FIXED_REAL
+    // A fixed point REAL is a signed raw count of 1 / 2^frac_bits
+    if (size == 'R')
+    {
+        tag->type = TAG_TYPE_SIGNED;
+        tag->scale = 1.0 / (1 << OPLC_FIXED_FRAC_BITS);
+    }
+#endif
+    for (int protocol = 0; protocol < PROTOCOL_TYPES && translate; protocol++)
+    {
+        tagProtocolAddress(area, size, position, protocol, &tag->address[protocol]);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Copies an address resolved by the glue generator
+//-----------------------------------------------------------------------------
+static void copyProtocolAddress(TagAddress *address, const PlcProtocolAddress *resolved)
+{
+    address->table = resolved->table;
+    address->bit = resolved->bit;
+    address->address = resolved->address;
+}
+
+//-----------------------------------------------------------------------------
+// Adds a tag named after its location. The addresses of an entry of the
+// protocol map are taken from it
+//-----------------------------------------------------------------------------
+static Tag *addLocationTag(TagDatabase *db, char area, char size, uint32_t position, const PlcProtocolMapping *map = NULL)
+{
+    Tag tag;
+    initializeTag(&tag, NULL, area, size, position, 1, map == NULL);
+    if (map != NULL)
+    {
+        tag.value = map->value;
+        copyProtocolAddress(&tag.address[MODBUS_PROTOCOL], &map->modbus);
+        copyProtocolAddress(&tag.address[DNP3_PROTOCOL], &map->dnp3);
+        copyProtocolAddress(&tag.address[ENIP_PROTOCOL], &map->pccc);
+        copyProtocolAddress(&tag.address[S7_PROTOCOL], &map->s7);
+    }
+    char *name = strdup(tag.location + 1);
+    char *dot = strchr(name, '.');
+    if (dot != NULL) *dot = '_';
+    db->names.push_back(name);
+    tag.name = name;
+    db->tags.push_back(tag);
+    return &db->tags.back();
+}
+
+//-----------------------------------------------------------------------------
+// Applies one "key = value" line of a [tag] section of tags.cfg
+//-----------------------------------------------------------------------------
+static void applyTagSetting(Tag *tag, TagDatabase *db, char *key, char *value)
+{
+    if (strcmp(key, "name") == 0)
+    {
+        char *name = strdup(value);
+        db->names.push_back(name);
+        tag->name = name;
+    }
+    else if (strcmp(key, "type") == 0 && tag->size != 'X')
+    {
+        if (strcmp(value, "signed") == 0) tag->type = TAG_TYPE_SIGNED;
+        else if (strcmp(value, "real") == 0) tag->type = TAG_TYPE_REAL;
+        else tag->type = TAG_TYPE_UNSIGNED;
+    }
+    else if (strcmp(key, "deadband") == 0) tag->deadband = atof(value);
+    else if (strcmp(key, "scale") == 0) tag->scale = atof(value);
+    else if (strcmp(key, "offset") == 0) tag->offset = atof(value);
+}
+
+//-----------------------------------------------------------------------------
+// Applies the settings of a [tag] section of tags.cfg, once the whole section
+// was read. The tag is found by location, or by name when the section gives
+// no location, and a location the program doesn't use gets a new tag
+//-----------------------------------------------------------------------------
+static void applyTagSection(TagConfigReader *reader)
+{
+    char log_msg[1000];
+
+    const char *location = NULL, *name = NULL;
+    for (size_t i = 0; i < reader->settings.size(); i++)
+    {
+        if (reader->settings[i].first == "location") location = reader->settings[i].second.c_str();
+        else if (reader->settings[i].first == "name") name = reader->settings[i].second.c_str();
+    }
+
+    Tag *tag = NULL;
+    char area, size;
+    uint32_t position;
+    if (location != NULL)
+    {
+        if (!parseTagLocation(location, &area, &size, &position))
+        {
+            sprintf(log_msg, "Tags: invalid location '%s' on %s\n", location, TAG_CONFIG_FILE);
+            openplc_log(log_msg);
+        }
+        else
+        {
+            std::unordered_map<uint64_t, uint32_t>::iterator found = reader->locations->find(locationKey(area, size, position));
+            if (found != reader->locations->end())
+            {
+                tag = &reader->db->tags[found->second];
+            }
+            else
+            {
+                tag = addLocationTag(reader->db, area, size, position);
+                (*reader->locations)[locationKey(area, size, position)] = reader->db->tags.size() - 1;
+            }
+        }
+    }
+    else if (name != NULL)
+    {
+        for (size_t i = 0; i < reader->db->tags.size() && tag == NULL; i++)
+        {
+            if (strcmp(reader->db->tags[i].name, name) == 0) tag = &reader->db->tags[i];
+        }
+        if (tag == NULL)
+        {
+            sprintf(log_msg, "Tags: no tag named '%s' for %s\n", name, TAG_CONFIG_FILE);
+            openplc_log(log_msg);
+        }
+    }
+
+    for (size_t i = 0; tag != NULL && i < reader->settings.size(); i++)
+    {
+        applyTagSetting(tag, reader->db, (char *)reader->settings[i].first.c_str(), (char *)reader->settings[i].second.c_str());
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Collects the settings of each [tag] section of tags.cfg
+//-----------------------------------------------------------------------------
+static void applyTagConfigLine(const char *section, char *key, char *value, void *context)
+{
+    TagConfigReader *reader = (TagConfigReader *)context;
+    if (key == NULL)
+    {
+        if (strcmp(section, "tag") != 0) return;
+        if (reader->in_section) applyTagSection(reader);
+        reader->settings.clear();
+        reader->in_section = true;
+    }
+    else if (reader->in_section)
+    {
+        reader->settings.push_back(std::make_pair(std::string(key), std::string(value)));
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Reads tags.cfg. The last section ends with the file
+//-----------------------------------------------------------------------------
+static void loadTagConfig(TagDatabase *db, std::unordered_map<uint64_t, uint32_t> *locations)
+{
+    TagConfigReader reader;
+    reader.db = db;
+    reader.locations = locations;
+    reader.in_section = false;
+    if (!parseSettingsFile(TAG_CONFIG_FILE, applyTagConfigLine, &reader)) return;
+    if (reader.in_section) applyTagSection(&reader);
+}
+
+//-----------------------------------------------------------------------------
+// Builds the tag database of the running program and makes it the current
+// one. Called after glueVars, when the program starts and after an online
+// change. It allocates, so it must not run on the scan thread
+//-----------------------------------------------------------------------------
+void buildTagDatabase()
+{
+    char log_msg[1000];
+    TagDatabase *db = new TagDatabase;
+    std::unordered_map<uint64_t, uint32_t> locations;
+
+    // Tags of the located variable table, with their OPC UA nodes
+    const PlcProgram *program = plcProgram();
+    for (size_t i = 0; i < program->located_variable_count; i++)
+    {
+        const PlcLocatedVariable *var = &program->located_variables[i];
+        char first[32];
+        strncpy(first, var->location, sizeof(first) - 1);
+        first[sizeof(first) - 1] = '\0';
+        char *dots = strstr(first, "..");
+        if (dots != NULL) *dots = '\0';
+
+        char area, size;
+        uint32_t position;
+        if (!parseTagLocation(first, &area, &size, &position)) continue;
+        uint32_t count = var->count > 1 ? var->count : 1;
+        uint32_t limit = (size == 'X') ? BUFFER_SIZE * 8 : BUFFER_SIZE;
+        if (position + count > limit) continue;
+
+        Tag tag;
+        initializeTag(&tag, var->name, area, size, position, count);
+        tag.address[OPCUA_PROTOCOL].table = TAG_OPCUA_PROGRAM_NODES;
+        tag.address[OPCUA_PROTOCOL].address = var->node_id;
+        db->tags.push_back(tag);
+        for (uint32_t element = 0; element < count; element++)
+        {
+            uint64_t key = locationKey(area, size, position + element);
+            if (locations.find(key) == locations.end()) locations[key] = db->tags.size() - 1;
+        }
+    }
+
+    // Located variables the table doesn't export, named after their location
+    for (size_t i = 0; i < program->protocol_map_count; i++)
+    {
+        const PlcProtocolMapping *map = &program->protocol_map[i];
+        uint64_t key = locationKey(map->area, map->size, map->position);
+        if (locations.find(key) != locations.end()) continue;
+
+        addLocationTag(db, map->area, map->size, map->position, map);
+        locations[key] = db->tags.size() - 1;
+    }
+
+    loadTagConfig(db, &locations);
+
+    // Lookup tables
+    size_t elements = 0;
+    for (size_t i = 0; i < db->tags.size(); i++) elements += db->tags[i].count;
+    db->by_name.assign(tableSize(db->tags.size()), 0);
+    db->by_address.assign(tableSize(elements * (PROTOCOL_TYPES + 3)), AddressSlot());
+    size_t mask = db->by_name.size() - 1;
+    for (uint32_t i = 0; i < db->tags.size(); i++)
+    {
+        size_t slot = hashName(db->tags[i].name) & mask;
+        bool taken = false;
+        while (db->by_name[slot] != 0)
+        {
+            if (strcmp(db->tags[db->by_name[slot] - 1].name, db->tags[i].name) == 0) taken = true;
+            slot = (slot + 1) & mask;
+        }
+        if (taken)
+        {
+            sprintf(log_msg, "Tags: more than one tag is named '%s', only the first one is found by name\n", db->tags[i].name);
+            openplc_log(log_msg);
+        }
+        else
+        {
+            db->by_name[slot] = i + 1;
+        }
+        indexTagAddresses(db, i);
+    }
+
+    pthread_mutex_lock(&databaseLock);
+    TagDatabase *previous = database.exchange(db, std::memory_order_acq_rel);
+    if (previous != NULL) retired_databases.push_back(previous);
+    pthread_mutex_unlock(&databaseLock);
+
+    sprintf(log_msg, "Tag database: %lu tags\n", (unsigned long)db->tags.size());
+    openplc_log(log_msg);
+}
+
+//-----------------------------------------------------------------------------
+// Returns the number of tags of the current database
+//-----------------------------------------------------------------------------
+size_t getTagCount()
+{
+    TagDatabase *db = database.load(std::memory_order_acquire);
+    return db != NULL ? db->tags.size() : 0;
+}
+
+//-----------------------------------------------------------------------------
+// Returns a tag of the current database by its index, or NULL
+//-----------------------------------------------------------------------------
+const Tag *getTag(size_t index)
+{
+    TagDatabase *db = database.load(std::memory_order_acquire);
+    if (db == NULL || index >= db->tags.size()) return NULL;
+    return &db->tags[index];
+}
+
+//-----------------------------------------------------------------------------
+// Finds a tag by name. Returns NULL if there is none
+//-----------------------------------------------------------------------------
+const Tag *findTag(const char *name)
+{
+    TagDatabase *db = database.load(std::memory_order_acquire);
+    if (db == NULL) return NULL;
+
+    size_t mask = db->by_name.size() - 1;
+    for (size_t slot = hashName(name) & mask; db->by_name[slot] != 0; slot = (slot + 1) & mask)
+    {
+        const Tag *tag = &db->tags[db->by_name[slot] - 1];
+        if (strcmp(tag->name, name) == 0) return tag;
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Finds the tag at an address of a protocol. element receives the entry of
+// the tag at the address (0 unless it is an array). Returns NULL if no tag
+// is at the address
+//-----------------------------------------------------------------------------
+const Tag *findTagAt(int protocol, uint16_t table, uint32_t address, uint8_t bit, uint32_t *element)
+{
+    TagDatabase *db = database.load(std::memory_order_acquire);
+    if (db == NULL || protocol < 0 || protocol >= PROTOCOL_TYPES) return NULL;
+
+    uint64_t key = addressKey(protocol, table, address, bit);
+    size_t mask = db->by_address.size() - 1;
+    for (size_t slot = hashKey(key) & mask; db->by_address[slot].key != 0; slot = (slot + 1) & mask)
+    {
+        if (db->by_address[slot].key != key) continue;
+        if (element != NULL) *element = db->by_address[slot].element;
+        return &db->tags[db->by_address[slot].tag];
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Writes a tag and its address on every protocol as text. Returns the
+// number of characters written
+//-----------------------------------------------------------------------------
+int formatTag(const Tag *tag, char *buffer, size_t buffer_size)
+{
+    int written = snprintf(buffer, buffer_size, "name=%s location=%s count=%u type=%s deadband=%g scale=%g offset=%g\n",
+                           tag->name, tag->location, tag->count, type_names[tag->type], tag->deadband, tag->scale, tag->offset);
+
+    for (int protocol = 0; protocol < PROTOCOL_TYPES && written < (int)buffer_size; protocol++)
+    {
+        const TagAddress *address = &tag->address[protocol];
+        if (address->table == 0)
+            written += snprintf(buffer + written, buffer_size - written, "%s=none\n", protocol_names[protocol]);
+        else if (tag->size == 'X' && (protocol == ENIP_PROTOCOL || protocol == S7_PROTOCOL))
+            written += snprintf(buffer + written, buffer_size - written, "%s=%u:%u.%u\n", protocol_names[protocol],
+                                address->table, address->address, address->bit);
+        else
+            written += snprintf(buffer + written, buffer_size - written, "%s=%u:%u\n", protocol_names[protocol],
+                                address->table, address->address);
+    }
+
+    if (written > (int)buffer_size) written = buffer_size;
+    return written;
+}
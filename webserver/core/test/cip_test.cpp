@@ -0,0 +1,157 @@
+// Catch2 will provide a main() function
+#define CATCH_CONFIG_MAIN
+// The alternate signal stack of catch.hpp doesn't build with glibc >= 2.34
+#define CATCH_CONFIG_NO_POSIX_SIGNALS
+#include "../../../utils/glue_generator_src/test/catch.hpp"
+#include <vector>
+
+// The CIP services are static functions of cip.cpp, so the file is included
+// directly. The tag database and the process image it uses are stubbed below
+#include "../cip.cpp"
+
+static ProcessImageSnapshot snapshot;
+static Tag words_tag;
+static int batch_count = 0;
+static int batch_bytes = 0;
+
+const Tag *findTag(const char *name)
+{
+    return strcmp(name, "WORDS") == 0 ? &words_tag : NULL;
+}
+
+const ProcessImageSnapshot *beginProcessImageRead(uint32_t *sequence)
+{
+    *sequence = 0;
+    return &snapshot;
+}
+
+bool endProcessImageRead(const ProcessImageSnapshot *snap, uint32_t sequence)
+{
+    return true;
+}
+
+int queueProcessImageBatch(const ProcessImageWrite *writes, int count, const ProcessImageRun *runs, int run_count)
+{
+    batch_count++;
+    for (int i = 0; i < run_count; i++) batch_bytes += runs[i].count * 2;
+    return 0;
+}
+
+static void setUp()
+{
+    memset(&words_tag, 0, sizeof(words_tag));
+    words_tag.name = "WORDS";
+    words_tag.area = 'M';
+    words_tag.size = 'W';
+    words_tag.type = TAG_TYPE_UNSIGNED;
+    words_tag.count = 4096;
+    words_tag.image_offset = 0;
+    batch_count = 0;
+    batch_bytes = 0;
+}
+
+// Request path of the WORDS tag, with an element segment when element_segment
+// isn't empty
+static void putTagPath(std::vector<unsigned char> &request, const std::vector<unsigned char> &element_segment)
+{
+    request.push_back((unsigned char)((8 + element_segment.size()) / 2));
+    unsigned char name[] = { 0x91, 5, 'W', 'O', 'R', 'D', 'S', 0 };
+    request.insert(request.end(), name, name + sizeof(name));
+    request.insert(request.end(), element_segment.begin(), element_segment.end());
+}
+
+static std::vector<unsigned char> writeTagRequest(uint16_t count)
+{
+    std::vector<unsigned char> request;
+    request.push_back(CIP_SVC_WRITE_TAG);
+    putTagPath(request, std::vector<unsigned char>());
+    unsigned char header[] = { CIP_TYPE_UINT, 0, (unsigned char)(count & 0xFF), (unsigned char)(count >> 8) };
+    request.insert(request.end(), header, header + sizeof(header));
+    request.insert(request.end(), count * 2, 0x55);
+    return request;
+}
+
+SCENARIO("Read Tag element segments", "[cip]") {
+    GIVEN("A tag of 4096 words") {
+        setUp();
+        unsigned char buffer[64];
+
+        WHEN("A 32-bit element segment points past the end of the address space") {
+            std::vector<unsigned char> request;
+            request.push_back(CIP_SVC_READ_TAG);
+            unsigned char segment[] = { 0x2A, 0, 0xFF, 0xFF, 0xFF, 0xFF };
+            putTagPath(request, std::vector<unsigned char>(segment, segment + sizeof(segment)));
+            request.push_back(1);
+            request.push_back(0);
+            memcpy(buffer, request.data(), request.size());
+
+            REQUIRE(processCIPMessage(buffer, request.size()) == 6);
+            REQUIRE(buffer[2] == CIP_STS_GENERAL_ERROR);
+            REQUIRE(readLE16(&buffer[4]) == CIP_EXT_BEYOND_END);
+        }
+
+        WHEN("A 32-bit element segment points to the last element") {
+            std::vector<unsigned char> request;
+            request.push_back(CIP_SVC_READ_TAG);
+            unsigned char segment[] = { 0x2A, 0, 0xFF, 0x0F, 0x00, 0x00 };
+            putTagPath(request, std::vector<unsigned char>(segment, segment + sizeof(segment)));
+            request.push_back(1);
+            request.push_back(0);
+            memcpy(buffer, request.data(), request.size());
+
+            REQUIRE(processCIPMessage(buffer, request.size()) == 8);
+            REQUIRE(buffer[2] == CIP_STS_SUCCESS);
+        }
+
+        WHEN("The element count runs past the end of the tag") {
+            std::vector<unsigned char> request;
+            request.push_back(CIP_SVC_READ_TAG);
+            unsigned char segment[] = { 0x2A, 0, 0xFF, 0x0F, 0x00, 0x00 };
+            putTagPath(request, std::vector<unsigned char>(segment, segment + sizeof(segment)));
+            request.push_back(2);
+            request.push_back(0);
+            memcpy(buffer, request.data(), request.size());
+
+            REQUIRE(processCIPMessage(buffer, request.size()) == 6);
+            REQUIRE(buffer[2] == CIP_STS_GENERAL_ERROR);
+        }
+    }
+}
+
+SCENARIO("Write Tag data larger than a message", "[cip]") {
+    GIVEN("A tag of 4096 words") {
+        setUp();
+        static unsigned char buffer[10000];
+
+        WHEN("A single write carries more than CIP_MAX_MESSAGE_SIZE bytes") {
+            std::vector<unsigned char> request = writeTagRequest(2100);
+            memcpy(buffer, request.data(), request.size());
+
+            REQUIRE(processCIPMessage(buffer, request.size()) == 4);
+            REQUIRE(buffer[2] == CIP_STS_NO_RESOURCES);
+            REQUIRE(batch_count == 0);
+        }
+
+        WHEN("The writes of a Multiple Service Packet add up to more than CIP_MAX_MESSAGE_SIZE bytes") {
+            std::vector<unsigned char> service = writeTagRequest(750);
+            std::vector<unsigned char> request;
+            unsigned char header[] = { CIP_SVC_MULTIPLE_SERVICE, 2, 0x20, 0x02, 0x24, 0x01, 3, 0 };
+            request.insert(request.end(), header, header + sizeof(header));
+            for (int s = 0; s < 3; s++)
+            {
+                uint16_t offset = 8 + s * service.size();
+                request.push_back(offset & 0xFF);
+                request.push_back(offset >> 8);
+            }
+            for (int s = 0; s < 3; s++) request.insert(request.end(), service.begin(), service.end());
+            memcpy(buffer, request.data(), request.size());
+
+            REQUIRE(processCIPMessage(buffer, request.size()) > 0);
+            REQUIRE(buffer[2] == CIP_STS_EMBEDDED_ERROR);
+            REQUIRE(batch_count == 1);
+            REQUIRE(batch_bytes == 3000);
+            int third = 4 + readLE16(&buffer[10]);
+            REQUIRE(buffer[third + 2] == CIP_STS_NO_RESOURCES);
+        }
+    }
+}
@@ -0,0 +1,498 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the CPU affinity and scheduling configuration of the
+// runtime threads. Every thread belongs to a class (scan, I/O, communication
+// or background) and applies the settings of its class from threads.cfg when
+// it starts. A class can be made exclusive, so the threads of the classes
+// without a CPU list of their own are kept away from its CPUs. The stack of
+// the threads can be prefaulted, and the heap allocations they make after
+// their initialization can be checked (see rt_memory.cpp).
+//
+// Every thread is also named after what it does (as shown by top -H) and
+// registered on the thread table. thread_stats() of the interactive server
+// lists the threads of /proc/self/task with their class, CPU time, CPU
+// usage since the last call, context switches, scheduling and affinity, so
+// the threads started by the libraries (open62541, Snap7, asio) show up too.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sched.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "ladder.h"
+
+#define THREAD_CONFIG_FILE  "threads.cfg"
+#define MAX_RUNTIME_THREADS 256
+#define THREAD_NAME_SIZE    16      // names are cut to 15 characters by the kernel
+
+struct ThreadClassConfig
+{
+    bool pinned;            // cpus holds the CPUs of the class
+    bool exclusive;         // no other class may use these CPUs
+    cpu_set_t cpus;
+    bool scheduled;         // policy and priority were configured
+    int policy;
+    int priority;
+    size_t stack_prefault;  // bytes of stack touched when the thread starts
+    int heap_check;         // HEAP_CHECK_* mode armed after the initialization
+};
+
+static const char *class_names[THREAD_CLASSES] = { "scan", "io", "comm", "background", "dnp3", "program", "ethercat" };
+
+// The scan thread, the program workers and the EtherCAT master run with
+// real-time priority and a prefaulted stack unless configured otherwise. The
+// master is above the scan, its frames must leave on time
+static ThreadClassConfig classes[THREAD_CLASSES] =
+{
+    { false, false, {}, true, SCHED_FIFO, 30, 256 * 1024, HEAP_CHECK_OFF },
+    { false, false, {}, false, SCHED_OTHER, 0, 0, HEAP_CHECK_OFF },
+    { false, false, {}, false, SCHED_OTHER, 0, 0, HEAP_CHECK_OFF },
+    { false, false, {}, false, SCHED_OTHER, 0, 0, HEAP_CHECK_OFF },
+    { false, false, {}, false, SCHED_OTHER, 0, 0, HEAP_CHECK_OFF },
+    { false, false, {}, true, SCHED_FIFO, 30, 256 * 1024, HEAP_CHECK_OFF },
+    { false, false, {}, true, SCHED_FIFO, 40, 256 * 1024, HEAP_CHECK_OFF },
+};
+
+// CPUs left to the classes without a CPU list
+static cpu_set_t shared_cpus;
+static bool shared_cpus_restricted = false;
+
+// Thread table. A thread is added when it applies its class, or when
+// thread_stats() first finds it on /proc/self/task, and removed when it is
+// no longer there. Protected by threadTableLock
+struct RuntimeThread
+{
+    pid_t tid;                  // 0 for a free entry
+    int thread_class;           // -1 for the threads started by the libraries
+    char name[THREAD_NAME_SIZE];
+    unsigned long long cpu_ticks;   // at the last thread_stats()
+    bool seen;
+};
+
+static RuntimeThread thread_table[MAX_RUNTIME_THREADS];
+static pthread_mutex_t threadTableLock = PTHREAD_MUTEX_INITIALIZER;
+static struct timespec last_stats_time;
+
+//-----------------------------------------------------------------------------
+// Parses a CPU list such as "0-2,5". Returns false if the list is invalid
+//-----------------------------------------------------------------------------
+static bool parseCpuList(const char *list, cpu_set_t *cpus)
+{
+    CPU_ZERO(cpus);
+    const char *p = list;
+    while (*p != '\0')
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE) return false;
+        long last = first;
+        p = end;
+        if (*p == '-')
+        {
+            p++;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first || last >= CPU_SETSIZE) return false;
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++) CPU_SET(cpu, cpus);
+
+        while (*p == ',' || isspace((unsigned char)*p)) p++;
+    }
+
+    return CPU_COUNT(cpus) > 0;
+}
+
+//-----------------------------------------------------------------------------
+// Applies one "key = value" line of threads.cfg to a thread class
+//-----------------------------------------------------------------------------
+static void applyThreadSetting(ThreadClassConfig *config, char *key, char *value)
+{
+    char log_msg[1000];
+
+    if (strcmp(key, "cpus") == 0)
+    {
+        config->pinned = parseCpuList(value, &config->cpus);
+        if (!config->pinned)
+        {
+            sprintf(log_msg, "Thread config: invalid CPU list '%s'\n", value);
+            openplc_log(log_msg);
+        }
+    }
+    else if (strcmp(key, "exclusive") == 0)
+    {
+        config->exclusive = (strcmp(value, "true") == 0 || strcmp(value, "True") == 0);
+    }
+    else if (strcmp(key, "policy") == 0)
+    {
+        config->scheduled = true;
+        if (strcmp(value, "fifo") == 0) config->policy = SCHED_FIFO;
+        else if (strcmp(value, "rr") == 0) config->policy = SCHED_RR;
+        else config->policy = SCHED_OTHER;
+    }
+    else if (strcmp(key, "priority") == 0)
+    {
+        config->scheduled = true;
+        config->priority = atoi(value);
+    }
+    else if (strcmp(key, "stack_prefault") == 0)
+    {
+        config->stack_prefault = (size_t)atoi(value) * 1024;
+    }
+    else if (strcmp(key, "heap_check") == 0)
+    {
+        if (strcmp(value, "report") == 0) config->heap_check = HEAP_CHECK_REPORT;
+        else if (strcmp(value, "abort") == 0) config->heap_check = HEAP_CHECK_ABORT;
+        else config->heap_check = HEAP_CHECK_OFF;
+    }
+    else
+    {
+        sprintf(log_msg, "Thread config: unknown setting '%s'\n", key);
+        openplc_log(log_msg);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Applies one line of threads.cfg. The context points to the class of the
+// section being read, NULL before the first one or on an unknown class
+//-----------------------------------------------------------------------------
+static void applyThreadLine(const char *section, char *key, char *value, void *context)
+{
+    char log_msg[1000];
+    ThreadClassConfig **config = (ThreadClassConfig **)context;
+    if (key == NULL)
+    {
+        *config = NULL;
+        for (int i = 0; i < THREAD_CLASSES; i++)
+        {
+            if (strcmp(section, class_names[i]) == 0) *config = &classes[i];
+        }
+        if (*config == NULL)
+        {
+            sprintf(log_msg, "Thread config: unknown thread class '%s'\n", section);
+            openplc_log(log_msg);
+        }
+        return;
+    }
+
+    if (*config != NULL) applyThreadSetting(*config, key, value);
+}
+
+//-----------------------------------------------------------------------------
+// Reads threads.cfg. Each [class] section holds the settings of one thread
+// class:
+//     cpus = 0-2,5             CPUs the threads of the class may run on
+//     exclusive = true         keep the classes without cpus off these CPUs
+//     policy = fifo|rr|other   scheduling policy
+//     priority = 30            real-time priority (fifo and rr)
+//     stack_prefault = 256     KB of stack touched when the thread starts
+//     heap_check = off|report|abort
+//                              what to do on heap allocations once the
+//                              thread is initialized (scan thread and
+//                              program workers)
+// A missing file keeps the default settings. Must be called before the
+// runtime threads are created
+//-----------------------------------------------------------------------------
+void loadThreadConfig()
+{
+    char log_msg[1000];
+    ThreadClassConfig *config = NULL;
+    parseSettingsFile(THREAD_CONFIG_FILE, applyThreadLine, &config);
+
+    // The classes without a CPU list share the CPUs not owned by an exclusive class
+    CPU_ZERO(&shared_cpus);
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    for (long cpu = 0; cpu < online && cpu < CPU_SETSIZE; cpu++) CPU_SET(cpu, &shared_cpus);
+    for (int i = 0; i < THREAD_CLASSES; i++)
+    {
+        if (classes[i].pinned && classes[i].exclusive)
+        {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            {
+                if (CPU_ISSET(cpu, &classes[i].cpus)) CPU_CLR(cpu, &shared_cpus);
+            }
+            shared_cpus_restricted = true;
+        }
+    }
+    if (shared_cpus_restricted && CPU_COUNT(&shared_cpus) == 0)
+    {
+        sprintf(log_msg, "Thread config: exclusive classes leave no CPU to the other threads\n");
+        openplc_log(log_msg);
+        shared_cpus_restricted = false;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Finds the entry of a thread on the table, or takes a free one for it.
+// Returns NULL when the table is full. threadTableLock must be held
+//-----------------------------------------------------------------------------
+static RuntimeThread *threadEntry(pid_t tid)
+{
+    RuntimeThread *free_entry = NULL;
+    for (int i = 0; i < MAX_RUNTIME_THREADS; i++)
+    {
+        if (thread_table[i].tid == tid) return &thread_table[i];
+        if (thread_table[i].tid == 0 && free_entry == NULL) free_entry = &thread_table[i];
+    }
+    // Threads that exited since the last thread_stats() free their entry
+    for (int i = 0; i < MAX_RUNTIME_THREADS && free_entry == NULL; i++)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/self/task/%d", (int)thread_table[i].tid);
+        if (access(path, F_OK) != 0) free_entry = &thread_table[i];
+    }
+    if (free_entry != NULL)
+    {
+        memset(free_entry, 0, sizeof(*free_entry));
+        free_entry->tid = tid;
+        free_entry->thread_class = -1;
+    }
+    return free_entry;
+}
+
+//-----------------------------------------------------------------------------
+// Adds a thread to the thread table, or updates its class and name
+//-----------------------------------------------------------------------------
+static void registerThread(pid_t tid, int thread_class, const char *name)
+{
+    pthread_mutex_lock(&threadTableLock);
+    RuntimeThread *entry = threadEntry(tid);
+    if (entry != NULL)
+    {
+        entry->thread_class = thread_class;
+        snprintf(entry->name, sizeof(entry->name), "%s", name);
+    }
+    pthread_mutex_unlock(&threadTableLock);
+}
+
+//-----------------------------------------------------------------------------
+// Applies the settings of a thread class to the calling thread, names it
+// (NULL for the name of the class) and registers it on the thread table.
+// Called by every runtime thread when it starts, so threads created at any
+// time get the configured affinity and priority
+//-----------------------------------------------------------------------------
+void setThreadClass(int thread_class, const char *name)
+{
+    if (thread_class < 0 || thread_class >= THREAD_CLASSES) return;
+
+    char log_msg[1000];
+    ThreadClassConfig *config = &classes[thread_class];
+
+    if (config->pinned || shared_cpus_restricted)
+    {
+        cpu_set_t *cpus = config->pinned ? &config->cpus : &shared_cpus;
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), cpus) != 0)
+        {
+            sprintf(log_msg, "WARNING: Failed to set the CPU affinity of a %s thread\n", class_names[thread_class]);
+            openplc_log(log_msg);
+        }
+    }
+
+    if (config->scheduled)
+    {
+        struct sched_param sp;
+        sp.sched_priority = (config->policy == SCHED_OTHER) ? 0 : config->priority;
+        if (pthread_setschedparam(pthread_self(), config->policy, &sp) != 0)
+        {
+            sprintf(log_msg, "WARNING: Failed to set the scheduling of a %s thread\n", class_names[thread_class]);
+            openplc_log(log_msg);
+        }
+    }
+
+    // Named after what it does, as shown by top -H and on the event trace
+    char thread_name[THREAD_NAME_SIZE];
+    snprintf(thread_name, sizeof(thread_name), "%s", name != NULL ? name : class_names[thread_class]);
+    pthread_setname_np(pthread_self(), thread_name);
+    registerThread((pid_t)syscall(SYS_gettid), thread_class, thread_name);
+
+    if (config->stack_prefault > 0) prefaultStack(config->stack_prefault);
+}
+
+//-----------------------------------------------------------------------------
+// Returns the heap check mode configured for a thread class. The thread arms
+// it with armHeapCheck() when its initialization is done
+//-----------------------------------------------------------------------------
+int getThreadHeapCheck(int thread_class)
+{
+    if (thread_class < 0 || thread_class >= THREAD_CLASSES) return HEAP_CHECK_OFF;
+    return classes[thread_class].heap_check;
+}
+
+//-----------------------------------------------------------------------------
+// Names a thread that keeps the scheduling it was created with (the startup
+// phases) and registers it on the thread table
+//-----------------------------------------------------------------------------
+void setThreadName(const char *name)
+{
+    char thread_name[THREAD_NAME_SIZE];
+    snprintf(thread_name, sizeof(thread_name), "%s", name);
+    pthread_setname_np(pthread_self(), thread_name);
+    registerThread((pid_t)syscall(SYS_gettid), -1, thread_name);
+}
+
+//-----------------------------------------------------------------------------
+// Reads the scheduling fields of /proc/self/task/<tid>/stat. Returns false
+// if the thread is gone
+//-----------------------------------------------------------------------------
+static bool readTaskStat(pid_t tid, char *comm, size_t comm_size, char *state, unsigned long long *cpu_ticks,
+                         int *processor, int *rt_priority, int *policy, long *nice)
+{
+    char path[64];
+    char line[1024];
+    snprintf(path, sizeof(path), "/proc/self/task/%d/stat", (int)tid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return false;
+    bool ok = (fgets(line, sizeof(line), f) != NULL);
+    fclose(f);
+    if (!ok) return false;
+
+    // The name is between parentheses and may hold spaces
+    char *open = strchr(line, '(');
+    char *close = strrchr(line, ')');
+    if (open == NULL || close == NULL || close < open) return false;
+    snprintf(comm, comm_size, "%.*s", (int)(close - open - 1), open + 1);
+
+    // Fields from the state (3) on, see proc(5)
+    unsigned long long utime = 0, stime = 0;
+    unsigned int rt = 0, pol = 0;
+    int cpu = 0;
+    int fields = sscanf(close + 2,
+                        "%c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d %*d %*d %ld %*d %*d %*u %*u %*d %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*d %d %u %u",
+                        state, &utime, &stime, nice, &cpu, &rt, &pol);
+    if (fields < 4) return false;
+    *cpu_ticks = utime + stime;
+    *processor = (fields >= 5) ? cpu : -1;
+    *rt_priority = (fields >= 6) ? (int)rt : 0;
+    *policy = (fields >= 7) ? (int)pol : SCHED_OTHER;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Reads the context switches and the allowed CPUs of
+// /proc/self/task/<tid>/status
+//-----------------------------------------------------------------------------
+static void readTaskStatus(pid_t tid, unsigned long long *voluntary, unsigned long long *involuntary, char *cpus, size_t cpus_size)
+{
+    char path[64];
+    char line[512];
+    *voluntary = 0;
+    *involuntary = 0;
+    snprintf(cpus, cpus_size, "-");
+    snprintf(path, sizeof(path), "/proc/self/task/%d/status", (int)tid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return;
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (strncmp(line, "voluntary_ctxt_switches:", 24) == 0) *voluntary = strtoull(line + 24, NULL, 10);
+        else if (strncmp(line, "nonvoluntary_ctxt_switches:", 27) == 0) *involuntary = strtoull(line + 27, NULL, 10);
+        else if (strncmp(line, "Cpus_allowed_list:", 18) == 0) snprintf(cpus, cpus_size, "%s", trimSetting(line + 18));
+    }
+    fclose(f);
+}
+
+//-----------------------------------------------------------------------------
+// Writes one line per thread of the runtime: its class, CPU time, CPU usage
+// since the last call (or since the thread started, on the first one),
+// voluntary and involuntary context switches, scheduling policy and
+// priority, the CPUs it may run on and the one it last ran on. Returns the
+// number of characters written
+//-----------------------------------------------------------------------------
+int getThreadStats(char *buffer, size_t buffer_size)
+{
+    static const char *policy_names[] = { "other", "fifo", "rr", "batch", "iso", "idle", "deadline" };
+    long ticks_per_second = sysconf(_SC_CLK_TCK);
+    if (ticks_per_second <= 0) ticks_per_second = 100;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    int written = snprintf(buffer, buffer_size, "%-7s %-15s %-10s %10s %6s %10s %10s %-6s %4s %-10s %3s %s\n",
+                           "tid", "name", "class", "cpu_ms", "cpu_%", "vol_cs", "invol_cs", "policy", "prio", "cpus", "cpu", "state");
+
+    pthread_mutex_lock(&threadTableLock);
+    double elapsed = (now.tv_sec - last_stats_time.tv_sec) + (now.tv_nsec - last_stats_time.tv_nsec) / 1e9;
+    bool first = (last_stats_time.tv_sec == 0 && last_stats_time.tv_nsec == 0);
+    last_stats_time = now;
+    for (int i = 0; i < MAX_RUNTIME_THREADS; i++) thread_table[i].seen = false;
+
+    DIR *dir = opendir("/proc/self/task");
+    if (dir != NULL)
+    {
+        struct dirent *task;
+        while ((task = readdir(dir)) != NULL)
+        {
+            pid_t tid = (pid_t)atoi(task->d_name);
+            if (tid <= 0) continue;
+
+            char comm[THREAD_NAME_SIZE * 2];
+            char state;
+            unsigned long long cpu_ticks;
+            int processor, rt_priority, policy;
+            long nice;
+            if (!readTaskStat(tid, comm, sizeof(comm), &state, &cpu_ticks, &processor, &rt_priority, &policy, &nice)) continue;
+
+            unsigned long long voluntary, involuntary;
+            char cpus[128];
+            readTaskStatus(tid, &voluntary, &involuntary, cpus, sizeof(cpus));
+
+            // The threads the runtime didn't register are added with the
+            // name the kernel has for them
+            RuntimeThread *entry = threadEntry(tid);
+            double usage = 0;
+            const char *name = comm;
+            const char *class_name = "-";
+            if (entry != NULL)
+            {
+                if (entry->name[0] == '\0') snprintf(entry->name, sizeof(entry->name), "%s", comm);
+                if (!first && elapsed > 0 && cpu_ticks >= entry->cpu_ticks)
+                    usage = (double)(cpu_ticks - entry->cpu_ticks) / ticks_per_second / elapsed * 100;
+                entry->cpu_ticks = cpu_ticks;
+                entry->seen = true;
+                name = entry->name;
+                if (entry->thread_class >= 0) class_name = class_names[entry->thread_class];
+            }
+
+            const char *policy_name = (policy >= 0 && policy < 7) ? policy_names[policy] : "?";
+            int priority = (policy == SCHED_FIFO || policy == SCHED_RR) ? rt_priority : (int)nice;
+
+            if (written < (int)buffer_size)
+            {
+                written += snprintf(buffer + written, buffer_size - written, "%-7d %-15s %-10s %10llu %6.1f %10llu %10llu %-6s %4d %-10s %3d %c\n",
+                                    (int)tid, name, class_name, cpu_ticks * 1000 / ticks_per_second, usage,
+                                    voluntary, involuntary, policy_name, priority, cpus, processor, state);
+            }
+        }
+        closedir(dir);
+    }
+
+    // Forget the threads that are gone
+    for (int i = 0; i < MAX_RUNTIME_THREADS; i++)
+    {
+        if (thread_table[i].tid != 0 && !thread_table[i].seen) thread_table[i].tid = 0;
+    }
+    pthread_mutex_unlock(&threadTableLock);
+
+    if (written > (int)buffer_size) written = buffer_size;
+    return written;
+}
@@ -0,0 +1,391 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the variable trace engine used by the debugger. The
+// scan thread copies a configured set of debug variables, every Nth scan,
+// into a preallocated ring of tick-stamped samples. Clients download the ring
+// in bulk without stopping the scan: the scan thread only publishes how many
+// samples it has written, and readers discard the samples it may have
+// overwritten while they were being copied.
+//
+// A trigger can be armed on top of a running trace, like an oscilloscope: a
+// condition on one variable is checked on every sample and, once it is met,
+// the trace keeps the samples before it and stops after the requested number
+// of samples following it.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <atomic>
+
+#include "ladder.h"
+#include "debug.h"
+
+#ifdef OPLC_LOW_MEMORY
+#define TRACE_RING_BYTES    (128 * 1024)
+#else
+#define TRACE_RING_BYTES    (1024 * 1024)
+#endif
+#define TRACE_TICK_SIZE     8
+
+extern unsigned long __tick;
+
+//-----------------------------------------------------------------------------
+// Trace configuration. It is only changed holding traceLock and bufferLock,
+// so the scan thread (bufferLock) and the readers (traceLock) always see a
+// consistent one
+//-----------------------------------------------------------------------------
+static uint16_t trace_count = 0;
+static void *trace_addr[TRACE_MAX_VARS];
+static uint16_t trace_size[TRACE_MAX_VARS];
+static uint32_t trace_sample_size = 0;
+static uint32_t trace_capacity = 0;
+static uint16_t trace_divider = 1;
+static uint16_t trace_scans = 0;
+static std::atomic<bool> trace_running(false);
+
+//-----------------------------------------------------------------------------
+// Trigger configuration, changed under the same locks. The scan thread moves
+// the trigger from armed to fired to done
+//-----------------------------------------------------------------------------
+union TriggerValue
+{
+    int64_t i;
+    uint64_t u;
+    double f;
+};
+
+static void *trigger_addr = NULL;
+static uint16_t trigger_size = 0;
+static uint8_t trigger_condition = 0;
+static uint8_t trigger_type = 0;
+static TriggerValue trigger_value;
+static TriggerValue trigger_previous;
+static bool trigger_has_previous = false;
+static uint32_t trigger_post = 0;
+static std::atomic<int> trigger_state(TRACE_TRIGGER_NONE);
+static std::atomic<uint64_t> trigger_index(0);
+
+// Allocated by the first trace, so a runtime that never traces doesn't lock it
+static uint8_t *trace_ring = NULL;
+static std::atomic<uint64_t> trace_head(0); // samples written since start
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+
+//-----------------------------------------------------------------------------
+// Reads the trigger variable, widened to the type it is compared as
+//-----------------------------------------------------------------------------
+static TriggerValue readTriggerValue()
+{
+    TriggerValue value;
+    value.u = 0;
+    if (trigger_type == TRACE_TYPE_FLOAT)
+    {
+        if (trigger_size == 4)
+        {
+            float f;
+            memcpy(&f, trigger_addr, 4);
+            value.f = f;
+        }
+        else
+        {
+            memcpy(&value.f, trigger_addr, 8);
+        }
+        return value;
+    }
+
+    switch (trigger_size)
+    {
+        case 1:
+            value.u = *(uint8_t *)trigger_addr;
+            if (trigger_type == TRACE_TYPE_SIGNED) value.i = (int8_t)value.u;
+            break;
+        case 2:
+            value.u = *(uint16_t *)trigger_addr;
+            if (trigger_type == TRACE_TYPE_SIGNED) value.i = (int16_t)value.u;
+            break;
+        case 4:
+            value.u = *(uint32_t *)trigger_addr;
+            if (trigger_type == TRACE_TYPE_SIGNED) value.i = (int32_t)value.u;
+            break;
+        default:
+            memcpy(&value.u, trigger_addr, 8);
+            break;
+    }
+    return value;
+}
+
+//-----------------------------------------------------------------------------
+// Compares two trigger values. Returns a negative number, zero or a positive
+// number when a is smaller, equal or larger than b
+//-----------------------------------------------------------------------------
+static int compareTriggerValues(TriggerValue a, TriggerValue b)
+{
+    if (trigger_type == TRACE_TYPE_FLOAT) return (a.f > b.f) - (a.f < b.f);
+    if (trigger_type == TRACE_TYPE_SIGNED) return (a.i > b.i) - (a.i < b.i);
+    return (a.u > b.u) - (a.u < b.u);
+}
+
+//-----------------------------------------------------------------------------
+// Checks the trigger condition against the current value of its variable
+//-----------------------------------------------------------------------------
+static bool triggerConditionMet()
+{
+    TriggerValue current = readTriggerValue();
+    int now = compareTriggerValues(current, trigger_value);
+    int before = trigger_has_previous ? compareTriggerValues(trigger_previous, trigger_value) : 0;
+    bool edge_valid = trigger_has_previous;
+    trigger_previous = current;
+    trigger_has_previous = true;
+
+    switch (trigger_condition)
+    {
+        case TRACE_TRIGGER_EQUAL:       return now == 0;
+        case TRACE_TRIGGER_NOT_EQUAL:   return now != 0;
+        case TRACE_TRIGGER_ABOVE:       return now > 0;
+        case TRACE_TRIGGER_BELOW:       return now < 0;
+        case TRACE_TRIGGER_RISING:      return edge_valid && before < 0 && now >= 0;
+        case TRACE_TRIGGER_FALLING:     return edge_valid && before > 0 && now <= 0;
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+// Copies the traced variables to the ring. Called by the scan thread after
+// the program ran, holding bufferLock
+//-----------------------------------------------------------------------------
+void captureTrace()
+{
+    if (!trace_running.load(std::memory_order_relaxed)) return;
+    if (++trace_scans < trace_divider) return;
+    trace_scans = 0;
+
+    uint64_t head = trace_head.load(std::memory_order_relaxed);
+    uint8_t *sample = &trace_ring[(head % trace_capacity) * trace_sample_size];
+
+    uint64_t tick = __tick;
+    memcpy(sample, &tick, TRACE_TICK_SIZE);
+    sample += TRACE_TICK_SIZE;
+    for (int i = 0; i < trace_count; i++)
+    {
+        memcpy(sample, trace_addr[i], trace_size[i]);
+        sample += trace_size[i];
+    }
+
+    trace_head.store(head + 1, std::memory_order_release);
+
+    int state = trigger_state.load(std::memory_order_relaxed);
+    if (state == TRACE_TRIGGER_ARMED && triggerConditionMet())
+    {
+        trigger_index.store(head, std::memory_order_relaxed);
+        trigger_state.store(TRACE_TRIGGER_FIRED, std::memory_order_release);
+        state = TRACE_TRIGGER_FIRED;
+    }
+    if (state == TRACE_TRIGGER_FIRED && head >= trigger_index.load(std::memory_order_relaxed) + trigger_post)
+    {
+        trace_running.store(false, std::memory_order_relaxed);
+        trigger_state.store(TRACE_TRIGGER_DONE, std::memory_order_release);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Starts a new trace of the debug variables on indexes, sampled every
+// divider scans. Samples of a previous trace are discarded. Returns the
+// sample size, or -1 if the variables are invalid or don't fit on a sample
+//-----------------------------------------------------------------------------
+int startTrace(const uint16_t *indexes, int count, uint16_t divider)
+{
+    if (count <= 0 || count > TRACE_MAX_VARS || divider == 0) return -1;
+
+    uint16_t variableCount = plcProgram()->get_var_count();
+    uint32_t sample_size = TRACE_TICK_SIZE;
+    uint16_t sizes[TRACE_MAX_VARS];
+    for (int i = 0; i < count; i++)
+    {
+        if (indexes[i] >= variableCount) return -1;
+        sizes[i] = (uint16_t)plcProgram()->get_var_size(indexes[i]);
+        sample_size += sizes[i];
+    }
+    if (sample_size > TRACE_MAX_SAMPLE) return -1;
+
+    pthread_mutex_lock(&traceLock);
+    if (trace_ring == NULL) trace_ring = (uint8_t *)malloc(TRACE_RING_BYTES);
+    if (trace_ring == NULL)
+    {
+        pthread_mutex_unlock(&traceLock);
+        return -1;
+    }
+    lockBuffer();
+    for (int i = 0; i < count; i++)
+    {
+        trace_addr[i] = plcProgram()->get_var_addr(indexes[i]);
+        trace_size[i] = sizes[i];
+    }
+    trace_count = (uint16_t)count;
+    trace_sample_size = sample_size;
+    trace_capacity = TRACE_RING_BYTES / sample_size;
+    trace_divider = divider;
+    trace_scans = divider - 1; // first sample on the next scan
+    trace_head.store(0, std::memory_order_relaxed);
+    trace_running.store(true, std::memory_order_relaxed);
+    trigger_state.store(TRACE_TRIGGER_NONE, std::memory_order_relaxed);
+    unlockBuffer();
+    pthread_mutex_unlock(&traceLock);
+
+    return (int)sample_size;
+}
+
+//-----------------------------------------------------------------------------
+// Stops sampling. The samples already captured can still be read
+//-----------------------------------------------------------------------------
+void stopTrace()
+{
+    pthread_mutex_lock(&traceLock);
+    lockBuffer();
+    trace_running.store(false, std::memory_order_relaxed);
+    unlockBuffer();
+    pthread_mutex_unlock(&traceLock);
+}
+
+//-----------------------------------------------------------------------------
+// Arms a trigger on the debug variable at index. The trace resumes sampling
+// if it was stopped, and stops by itself post samples after the one where
+// the condition was met. The ring must hold the pre samples before it too.
+// value holds the raw bits of the reference value (a double for floats).
+// Returns 0, or -1 if there is no trace or the arguments are invalid
+//-----------------------------------------------------------------------------
+int armTraceTrigger(uint16_t index, uint8_t condition, uint8_t type, uint64_t value, uint32_t pre, uint32_t post)
+{
+    if (index >= plcProgram()->get_var_count()) return -1;
+    if (condition < TRACE_TRIGGER_EQUAL || condition > TRACE_TRIGGER_FALLING) return -1;
+    if (type > TRACE_TYPE_FLOAT) return -1;
+
+    size_t size = plcProgram()->get_var_size(index);
+    if (size != 1 && size != 2 && size != 4 && size != 8) return -1;
+    if (type == TRACE_TYPE_FLOAT && size != 4 && size != 8) return -1;
+
+    int result = -1;
+    pthread_mutex_lock(&traceLock);
+    // One slot of margin for the sample being written
+    if (trace_capacity > 0 && (uint64_t)pre + post + 2 <= trace_capacity)
+    {
+        lockBuffer();
+        trigger_addr = plcProgram()->get_var_addr(index);
+        trigger_size = (uint16_t)size;
+        trigger_condition = condition;
+        trigger_type = type;
+        memcpy(&trigger_value, &value, sizeof(value));
+        trigger_has_previous = false;
+        trigger_post = post;
+        trigger_state.store(TRACE_TRIGGER_ARMED, std::memory_order_relaxed);
+        trace_running.store(true, std::memory_order_relaxed);
+        unlockBuffer();
+        result = 0;
+    }
+    pthread_mutex_unlock(&traceLock);
+
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+// Encodes a sample XORed with the previous one, writing zero bytes as runs
+// (0x00 followed by the run length). Returns the encoded size
+//-----------------------------------------------------------------------------
+static size_t encodeSample(const uint8_t *sample, const uint8_t *previous, uint32_t size, uint8_t *out)
+{
+    size_t length = 0;
+    uint32_t i = 0;
+    while (i < size)
+    {
+        uint8_t delta = sample[i] ^ previous[i];
+        if (delta != 0)
+        {
+            out[length++] = delta;
+            i++;
+            continue;
+        }
+
+        uint8_t run = 0;
+        while (i < size && run < 255 && sample[i] == previous[i])
+        {
+            run++;
+            i++;
+        }
+        out[length++] = 0x00;
+        out[length++] = run;
+    }
+    return length;
+}
+
+//-----------------------------------------------------------------------------
+// Encodes the samples from cursor on into out, stopping when the next one
+// could not fit on out_size bytes. Samples no longer on the ring are skipped.
+// The first encoded sample is XORed with zeros, so every response can be
+// decoded on its own
+//-----------------------------------------------------------------------------
+void readTrace(uint64_t cursor, uint8_t *out, size_t out_size, TraceChunk *chunk)
+{
+    memset(chunk, 0, sizeof(*chunk));
+
+    pthread_mutex_lock(&traceLock);
+    chunk->sample_size = trace_sample_size;
+    chunk->trigger_state = trigger_state.load(std::memory_order_acquire);
+    chunk->trigger_index = trigger_index.load(std::memory_order_relaxed);
+    chunk->running = trace_running.load(std::memory_order_relaxed);
+    if (trace_capacity == 0)
+    {
+        pthread_mutex_unlock(&traceLock);
+        return;
+    }
+
+    static uint8_t zeros[TRACE_MAX_SAMPLE];
+    for (int attempt = 0; attempt < 4; attempt++)
+    {
+        uint64_t head = trace_head.load(std::memory_order_acquire);
+        // Keep one slot of margin, the scan thread may be writing it
+        uint64_t oldest = head >= trace_capacity ? head - trace_capacity + 1 : 0;
+        uint64_t first = cursor < oldest ? oldest : cursor;
+        if (first > head) first = head;
+
+        size_t length = 0;
+        uint32_t samples = 0;
+        const uint8_t *previous = zeros;
+        for (uint64_t index = first; index < head; index++)
+        {
+            if (length + 2 * trace_sample_size > out_size) break;
+            const uint8_t *sample = &trace_ring[(index % trace_capacity) * trace_sample_size];
+            length += encodeSample(sample, previous, trace_sample_size, out + length);
+            previous = sample;
+            samples++;
+        }
+
+        // Anything the scan thread wrapped over while we copied is torn
+        uint64_t new_head = trace_head.load(std::memory_order_acquire);
+        uint64_t new_oldest = new_head >= trace_capacity ? new_head - trace_capacity + 1 : 0;
+        if (first >= new_oldest)
+        {
+            chunk->first = first;
+            chunk->samples = samples;
+            chunk->data_size = (uint32_t)length;
+            chunk->lost = cursor < first ? first - cursor : 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&traceLock);
+}
@@ -29,13 +29,86 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <limits.h>
+#include <ctype.h>
+#include <atomic>
 
 #include "ladder.h"
 
-pthread_mutex_t logLock; //mutex for the internal log
-unsigned char log_buffer[1000000]; //A very large buffer to store all logs
-int log_index = 0;
-int log_counter = 0;
+#ifdef OPLC_LOW_MEMORY
+#define LOG_RING_SIZE       128         // Must be a power of two
+#else
+#define LOG_RING_SIZE       1024        // Must be a power of two
+#endif
+#define LOG_ENTRY_SIZE      256
+#define LOG_DRAIN_INTERVAL  20          // ms between two drains of the ring
+#define LOG_RATE_SLOTS      64
+#define LOG_RATE_BURST      10          // Repeats of a message shown per window
+#define LOG_RATE_WINDOW     10          // Seconds
+#ifdef OPLC_LOW_MEMORY
+#define LOG_EVENT_COUNT     512         // Records kept for runtime_events()
+#else
+#define LOG_EVENT_COUNT     4096        // Records kept for runtime_events()
+#endif
+#define LOG_EXPORT_BATCH    64          // Records copied at a time by the exports
+
+pthread_mutex_t logLock = PTHREAD_MUTEX_INITIALIZER; //mutex for the event log
+
+// One log message. The text is what is printed on the console, the other
+// fields let the webserver tell the messages apart without parsing it
+struct LogRecord
+{
+    uint64_t timestamp;     // CLOCK_MONOTONIC, in ns
+    uint8_t level;
+    uint8_t source;
+    uint16_t code;
+    uint32_t args[2];
+    char text[LOG_ENTRY_SIZE];
+};
+
+// Messages waiting to be printed. Producers claim an entry with a CAS on
+// log_head and never block: when the ring is full the message is dropped
+// and counted. The sequence of an entry is relative to its position on the
+// ring, so a zeroed ring is empty and the ring can be used before main()
+struct LogEntry
+{
+    std::atomic<uint32_t> sequence;
+    LogRecord record;
+};
+
+static LogEntry log_ring[LOG_RING_SIZE];
+static std::atomic<uint32_t> log_head(0);
+static std::atomic<uint32_t> log_dropped(0);
+static uint32_t log_tail = 0;               // Only used by the drain thread
+static int log_min_level = LOG_LEVEL_INFO;
+static bool log_console = true;
+static bool run_log_drain = false;
+static pthread_t log_thread;
+
+// Event log, the last LOG_EVENT_COUNT printed messages. Record n is on
+// log_events[n % LOG_EVENT_COUNT], and log_next_event is the sequence of the
+// next one. Both are protected by logLock
+struct LogEvent
+{
+    uint64_t sequence;
+    LogRecord record;
+};
+
+static LogEvent log_events[LOG_EVENT_COUNT];
+static uint64_t log_next_event = 0;
+
+// Repeated messages, keyed by their text without digits
+struct LogRate
+{
+    uint32_t hash;
+    time_t window_start;
+    int count;
+    int suppressed;
+    LogRecord record;
+};
+
+static LogRate log_rates[LOG_RATE_SLOTS];
+
 int64_t cycle_counter = 0;
 uint8_t rpi_modbus_rts_pin;     // If <> 0, expect hardware RTS to be used with this pin
 
@@ -60,6 +133,42 @@ void sleep_until(struct timespec *ts, long long delay)
     clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, ts,  NULL);
 }
 
+/**
+ * @brief Computes how many ticks can be skipped before a task is due
+ *
+ * MatIEC runs each task only on the ticks that are multiples of its period, so
+ * on the other ticks the main loop has nothing to execute. This function looks
+ * at the task table and returns how many ticks, starting at the given one, have
+ * no task due. Tasks without an interval (or a program without task table)
+ * make every tick due.
+ *
+ * @param tick The next tick to be executed
+ * @return The number of idle ticks before the next tick with a task due
+ */
+unsigned long ticksToNextTask(unsigned long tick)
+{
+    //Task table generated by the MatIEC compiler on Config0.c. Programs
+    //compiled by older versions of the compiler don't have it
+    PlcProgram *program = plcProgram();
+    if (program->task_count == NULL || *program->task_count == 0)
+        return 0;
+
+    unsigned long idle_ticks = ULONG_MAX;
+    for (unsigned long i = 0; i < *program->task_count; i++)
+    {
+        unsigned long period = program->task_period_ticks[i];
+        if (period <= 1)
+            return 0;
+
+        unsigned long remainder = tick % period;
+        unsigned long wait = (remainder == 0) ? 0 : period - remainder;
+        if (wait < idle_ticks)
+            idle_ticks = wait;
+    }
+
+    return idle_ticks;
+}
+
 /**
  * @brief Makes the running thread sleep for the specified amount of time in milliseconds
  *
@@ -105,39 +214,470 @@ void timespec_diff(struct timespec *a, struct timespec *b, struct timespec *resu
 }
 
 /**
- * @brief Logs messages and prints them on the console
+ * @brief Removes the spaces around a setting, in place
  *
- * This function logs messages to a global buffer and prints them to the console.
- * It uses a mutex to ensure thread-safe access to the shared log buffer.
+ * @param s The text to be trimmed
+ * @return A pointer to the first character of the trimmed text
+ */
+char *trimSetting(char *s)
+{
+    while (isspace((unsigned char)*s)) s++;
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) *--end = '\0';
+    return s;
+}
+
+/**
+ * @brief Reads a configuration file of key = value lines
  *
- * @param logmsg Pointer to a null-terminated string containing the message to be logged
+ * Blank lines and lines starting with # are skipped, as are lines without
+ * an =. A [name] line starts a section: the callback is called once with
+ * the section name and a NULL key, and then for each of its settings with
+ * the same section name. Settings before the first section have an empty
+ * section name. Key and value are trimmed and may be modified by the
+ * callback.
+ *
+ * @param path The file to be read
+ * @param setting Called for each section and setting, in file order
+ * @param context Passed to the callback
+ * @return false if the file could not be opened
  */
-void openplc_log(char *logmsg)
+bool parseSettingsFile(const char *path, SettingCallback setting, void *context)
+{
+    char line[SETTINGS_LINE_SIZE];
+    char section[64] = "";
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return false;
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        char *text = trimSetting(line);
+        if (*text == '#' || *text == '\0') continue;
+
+        char *end = text + strlen(text) - 1;
+        if (*text == '[' && *end == ']')
+        {
+            *end = '\0';
+            snprintf(section, sizeof(section), "%s", trimSetting(text + 1));
+            setting(section, NULL, NULL, context);
+            continue;
+        }
+
+        char *equal = strchr(text, '=');
+        if (equal == NULL) continue;
+        *equal = '\0';
+        setting(section, trimSetting(text), trimSetting(equal + 1), context);
+    }
+    fclose(f);
+
+    return true;
+}
+
+/**
+ * @brief Returns the CLOCK_MONOTONIC time in nanoseconds
+ */
+static uint64_t logTimestamp()
 {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Prints a message on the console, stores it on the event log and
+ * passes it to the log file
+ *
+ * Only called by the drain thread (or after it stopped), so the console
+ * never stalls the threads that log. The console is flushed once per
+ * drain, not per message.
+ *
+ * @param record The message to be printed
+ */
+static void writeLog(const LogRecord *record)
+{
+    if (log_console) fputs(record->text, stdout);
+    appendLogFile(record->timestamp, record->level, record->text);
+
     pthread_mutex_lock(&logLock); // lock mutex
+    LogEvent *event = &log_events[log_next_event % LOG_EVENT_COUNT];
+    event->sequence = log_next_event++;
+    memcpy(&event->record, record, sizeof(event->record));
+    pthread_mutex_unlock(&logLock); // unlock mutex
+}
 
-    printf("%s", logmsg);
+/**
+ * @brief Prints a message generated by the log itself
+ */
+static void writeLogText(int level, const char *text)
+{
+    LogRecord record;
+    memset(&record, 0, sizeof(record));
+    record.timestamp = logTimestamp();
+    record.level = level;
+    record.source = LOG_SOURCE_RUNTIME;
+    snprintf(record.text, sizeof(record.text), "%s", text);
+    writeLog(&record);
+}
 
-    size_t msg_len = strlen(logmsg);
-    if (log_index + msg_len >= sizeof(log_buffer) - 1)
+/**
+ * @brief Hashes a message ignoring its digits
+ *
+ * Counters, addresses and times change between repeats of the same
+ * message, so they are left out of the key used for rate limiting.
+ */
+static uint32_t hashLogMessage(const char *text)
+{
+    uint32_t hash = 2166136261u;
+    for (; *text != '\0'; text++)
     {
-        // Buffer overflow protection: clear the buffer if it's nearly full
-        log_index = 0;
+        if (*text >= '0' && *text <= '9') continue;
+        hash = (hash ^ (uint8_t)*text) * 16777619u;
     }
+    return hash;
+}
 
-    memcpy(&log_buffer[log_index], logmsg, msg_len);
-    log_index += msg_len;
-    log_buffer[log_index] = '\0';
-    
-    log_counter++;
-    if (log_counter >= 1000)
+/**
+ * @brief Reports how many repeats of a message were suppressed
+ */
+static void flushLogRate(LogRate *rate)
+{
+    if (rate->suppressed > 0)
     {
-        // Clear log buffer
-        log_counter = 0;
-        log_index = 0;
+        char msg[LOG_ENTRY_SIZE + 64];
+        snprintf(msg, sizeof(msg), "Suppressed %d repeats of: %s", rate->suppressed, rate->record.text);
+        writeLogText(rate->record.level, msg);
     }
+    rate->suppressed = 0;
+}
 
-    pthread_mutex_unlock(&logLock); // unlock mutex
+/**
+ * @brief Prints a message unless it was repeated too often
+ *
+ * Each message is shown at most LOG_RATE_BURST times every LOG_RATE_WINDOW
+ * seconds. The repeats above that are counted and reported once the window
+ * is over.
+ */
+static void rateLimitLog(const LogRecord *record, time_t now)
+{
+    uint32_t hash = hashLogMessage(record->text);
+    LogRate *rate = &log_rates[hash % LOG_RATE_SLOTS];
+
+    if (rate->hash != hash || now - rate->window_start >= LOG_RATE_WINDOW)
+    {
+        flushLogRate(rate);
+        rate->hash = hash;
+        rate->window_start = now;
+        rate->count = 0;
+        memcpy(&rate->record, record, sizeof(rate->record));
+    }
+
+    if (++rate->count > LOG_RATE_BURST)
+    {
+        rate->suppressed++;
+        return;
+    }
+    writeLog(record);
+}
+
+/**
+ * @brief Prints all the messages waiting on the log ring
+ *
+ * Must only be called by one thread at a time (the drain thread).
+ */
+static void drainLog()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    time_t now = ts.tv_sec;
+
+    while (true)
+    {
+        LogEntry *entry = &log_ring[log_tail & (LOG_RING_SIZE - 1)];
+        uint32_t lap = log_tail & ~(uint32_t)(LOG_RING_SIZE - 1);
+        if (entry->sequence.load(std::memory_order_acquire) != lap + 1) break;
+
+        rateLimitLog(&entry->record, now);
+        entry->sequence.store(lap + LOG_RING_SIZE, std::memory_order_release);
+        log_tail++;
+    }
+
+    uint32_t dropped = log_dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0)
+    {
+        char msg[100];
+        sprintf(msg, "Log buffer full, %u messages were dropped\n", dropped);
+        writeLogText(LOG_LEVEL_WARNING, msg);
+    }
+
+    for (int i = 0; i < LOG_RATE_SLOTS; i++)
+    {
+        if (log_rates[i].suppressed > 0 && now - log_rates[i].window_start >= LOG_RATE_WINDOW)
+        {
+            flushLogRate(&log_rates[i]);
+        }
+    }
+    fflush(stdout);
+}
+
+/**
+ * @brief Thread that prints the log messages queued by the other threads
+ */
+static void *logDrainThread(void *arg)
+{
+    setThreadClass(THREAD_CLASS_BACKGROUND, "log_drain");
+
+    while (run_log_drain)
+    {
+        drainLog();
+        sleepms(LOG_DRAIN_INTERVAL);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Starts the thread that prints the log messages
+ *
+ * Messages logged before this call wait on the log ring.
+ */
+void initializeLog()
+{
+    startLogFile();
+    run_log_drain = true;
+    pthread_create(&log_thread, NULL, logDrainThread, NULL);
+}
+
+/**
+ * @brief Stops the log thread and prints whatever is still queued,
+ * including the counts of suppressed repeats
+ */
+void finalizeLog()
+{
+    if (run_log_drain)
+    {
+        run_log_drain = false;
+        pthread_join(log_thread, NULL);
+    }
+    drainLog();
+    for (int i = 0; i < LOG_RATE_SLOTS; i++)
+    {
+        flushLogRate(&log_rates[i]);
+    }
+    fflush(stdout);
+    stopLogFile();
+}
+
+/**
+ * @brief Sets the lowest severity that is logged
+ *
+ * @param level One of the LOG_LEVEL_* values
+ */
+void setLogLevel(int level)
+{
+    log_min_level = level;
+}
+
+/**
+ * @brief Sets whether the log is printed on the console
+ *
+ * The log file turns it off when log_file.cfg asks for it, so a runtime
+ * with its stdout redirected to a slow disk doesn't write everything twice.
+ *
+ * @param enabled false to keep the messages off stdout
+ */
+void setLogConsole(bool enabled)
+{
+    log_console = enabled;
+}
+
+/**
+ * @brief Copies up to max_events records of the event log, starting at the
+ * given sequence (or at the oldest record kept, if it is older)
+ *
+ * @param cursor Sequence of the first record wanted
+ * @param events Where the records are copied to
+ * @param max_events Room on events
+ * @param next_event Set to the sequence of the next record to be logged
+ * @return The number of records copied
+ */
+static int copyLogEvents(uint64_t cursor, LogEvent *events, int max_events, uint64_t *next_event)
+{
+    pthread_mutex_lock(&logLock);
+    uint64_t oldest = (log_next_event > LOG_EVENT_COUNT) ? log_next_event - LOG_EVENT_COUNT : 0;
+    if (cursor < oldest) cursor = oldest;
+
+    int count = 0;
+    while (cursor + count < log_next_event && count < max_events)
+    {
+        memcpy(&events[count], &log_events[(cursor + count) % LOG_EVENT_COUNT], sizeof(LogEvent));
+        count++;
+    }
+    *next_event = log_next_event;
+    pthread_mutex_unlock(&logLock);
+
+    return count;
+}
+
+/**
+ * @brief Sends the text of every record on the event log to a client
+ *
+ * The records are copied a batch at a time, so a slow client never holds
+ * logLock while the socket blocks.
+ *
+ * @param writer Function that sends the data to the client
+ * @param context Passed to writer
+ */
+void sendLogText(LogWriter writer, void *context)
+{
+    static LogEvent batch[LOG_EXPORT_BATCH];
+    uint64_t cursor = 0;
+    uint64_t next_event;
+
+    while (true)
+    {
+        int count = copyLogEvents(cursor, batch, LOG_EXPORT_BATCH, &next_event);
+        if (count == 0) break;
+        for (int i = 0; i < count; i++)
+        {
+            if (writer(context, batch[i].record.text, strlen(batch[i].record.text)) < 0) return;
+        }
+        cursor = batch[count - 1].sequence + 1;
+    }
+}
+
+/**
+ * @brief Sends the records of the event log from the given sequence on,
+ * one per line, to a client
+ *
+ * The first line holds the sequence of the first record sent and the one
+ * of the next record that will be logged, which is the cursor for the next
+ * call. A next sequence lower than the cursor means the runtime restarted.
+ * Each record line holds its sequence, timestamp (ms), level, source, code,
+ * arguments and text separated by tabs. At most max_events are sent, and
+ * the response ends with an empty line.
+ *
+ * @param writer Function that sends the data to the client
+ * @param context Passed to writer
+ * @param cursor Sequence of the first record wanted
+ * @param max_events Maximum number of records to send
+ */
+void sendLogEvents(LogWriter writer, void *context, uint64_t cursor, int max_events)
+{
+    static LogEvent batch[LOG_EXPORT_BATCH];
+    char line[LOG_ENTRY_SIZE + 128];
+    uint64_t next_event;
+    bool first = true;
+
+    while (max_events > 0)
+    {
+        int wanted = (max_events < LOG_EXPORT_BATCH) ? max_events : LOG_EXPORT_BATCH;
+        int count = copyLogEvents(cursor, batch, wanted, &next_event);
+        if (first)
+        {
+            int length = sprintf(line, "%llu %llu\n", (unsigned long long)(count > 0 ? batch[0].sequence : next_event),
+                                 (unsigned long long)next_event);
+            if (writer(context, line, length) < 0) return;
+            first = false;
+        }
+        if (count == 0) break;
+
+        for (int i = 0; i < count; i++)
+        {
+            const LogRecord *record = &batch[i].record;
+            int length = snprintf(line, sizeof(line), "%llu\t%llu\t%d\t%d\t%d\t%u\t%u\t%s",
+                                  (unsigned long long)batch[i].sequence, (unsigned long long)(record->timestamp / 1000000),
+                                  record->level, record->source, record->code, record->args[0], record->args[1], record->text);
+            if (length > (int)sizeof(line) - 1) length = sizeof(line) - 1;
+            // Every record takes exactly one line
+            if (length > 0 && line[length - 1] == '\n') length--;
+            for (int c = 0; c < length; c++)
+            {
+                if (line[c] == '\n' || line[c] == '\r') line[c] = ' ';
+            }
+            line[length++] = '\n';
+            if (writer(context, line, length) < 0) return;
+        }
+        cursor = batch[count - 1].sequence + 1;
+        max_events -= count;
+    }
+
+    writer(context, "\n", 1);
+}
+
+/**
+ * @brief Logs a message with its severity, source, code and arguments
+ *
+ * The message is queued on a lock-free ring and printed by the log thread,
+ * so this is safe to call from the scan thread: it never takes a lock or
+ * touches the console. Messages longer than an entry are truncated.
+ *
+ * @param level One of the LOG_LEVEL_* values
+ * @param source One of the LOG_SOURCE_* values
+ * @param code Identifies the message within its source, 0 for free text
+ * @param arg0 First argument of the message (i.e. an errno)
+ * @param arg1 Second argument of the message
+ * @param logmsg Pointer to a null-terminated string containing the message to be logged
+ */
+void openplc_log_event(int level, int source, int code, uint32_t arg0, uint32_t arg1, char *logmsg)
+{
+    if (level < log_min_level) return;
+
+    uint32_t pos = log_head.load(std::memory_order_relaxed);
+    LogEntry *entry;
+    while (true)
+    {
+        entry = &log_ring[pos & (LOG_RING_SIZE - 1)];
+        uint32_t lap = pos & ~(uint32_t)(LOG_RING_SIZE - 1);
+        int32_t diff = (int32_t)(entry->sequence.load(std::memory_order_acquire) - lap);
+        if (diff == 0)
+        {
+            if (log_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        }
+        else if (diff < 0)
+        {
+            // The drain thread did not free this entry yet
+            log_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            pos = log_head.load(std::memory_order_relaxed);
+        }
+    }
+
+    LogRecord *record = &entry->record;
+    record->timestamp = logTimestamp();
+    record->level = level;
+    record->source = source;
+    record->code = code;
+    record->args[0] = arg0;
+    record->args[1] = arg1;
+    strncpy(record->text, logmsg, LOG_ENTRY_SIZE - 1);
+    record->text[LOG_ENTRY_SIZE - 1] = '\0';
+    entry->sequence.store((pos & ~(uint32_t)(LOG_RING_SIZE - 1)) + 1, std::memory_order_release);
+}
+
+/**
+ * @brief Logs a free text message with the given severity
+ *
+ * @param level One of the LOG_LEVEL_* values
+ * @param logmsg Pointer to a null-terminated string containing the message to be logged
+ */
+void openplc_log_level(int level, char *logmsg)
+{
+    openplc_log_event(level, LOG_SOURCE_RUNTIME, 0, 0, 0, logmsg);
+}
+
+/**
+ * @brief Logs messages and prints them on the console
+ *
+ * Logs an informational message. See openplc_log_event().
+ *
+ * @param logmsg Pointer to a null-terminated string containing the message to be logged
+ */
+void openplc_log(char *logmsg)
+{
+    openplc_log_level(LOG_LEVEL_INFO, logmsg);
 }
 
 /**
@@ -151,6 +691,8 @@ void openplc_log(char *logmsg)
  */
 void *interactiveServerThread(void *arg)
 {
+    setThreadClass(THREAD_CLASS_BACKGROUND, "interactive");
+
     startInteractiveServer(43628);
     return NULL;
 }
@@ -185,6 +727,134 @@ void disableOutputs()
     }
 }
 
+// Offsets of the clocks from CLOCK_MONOTONIC, refreshed by the clock thread,
+// so the scan derives every time value from the single clock_gettime() it
+// does at its start
+#define CLOCK_REFRESH_INTERVAL  60          // Seconds
+
+static std::atomic<int64_t> realtime_offset(0);     // CLOCK_REALTIME - CLOCK_MONOTONIC, in ns
+static std::atomic<int64_t> local_time_offset(0);   // local time - UTC, in seconds
+static int64_t runtime_start_ns = 0;                // CLOCK_MONOTONIC at startup
+static int64_t scan_monotonic_ns = 0;               // CLOCK_MONOTONIC at the scan start
+static int64_t virtual_offset_ns = 0;               // scan clock ahead of CLOCK_MONOTONIC after virtual time
+
+static int64_t timespecNs(const struct timespec *ts)
+{
+    return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+/**
+ * @brief Recomputes the real time and local time offsets
+ *
+ * Reading the timezone may take the libc locks and read the tz files, so
+ * this only runs at startup and from the clock thread.
+ */
+static void refreshClockOffsets()
+{
+    struct timespec mono, real;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+    realtime_offset.store(timespecNs(&real) - timespecNs(&mono), std::memory_order_relaxed);
+
+    tzset();
+    struct tm current_time;
+    time_t rawtime = real.tv_sec;
+    localtime_r(&rawtime, &current_time);
+
+    // Adjust for local time, adding one hour for daylight saving time
+    int64_t offset = -(int64_t)timezone;
+    if (current_time.tm_isdst > 0) offset += 3600;
+    local_time_offset.store(offset, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Clock thread, refreshes the clock offsets every minute so DST
+ * changes and clock adjustments show up on the special functions
+ */
+static void *clockThread(void *arg)
+{
+    setThreadClass(THREAD_CLASS_BACKGROUND, "plc_clock");
+
+    int elapsed = 0;
+    while (run_openplc)
+    {
+        sleepms(1000);
+        if (++elapsed >= CLOCK_REFRESH_INTERVAL)
+        {
+            refreshClockOffsets();
+            elapsed = 0;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Computes the clock offsets and starts the thread that keeps them
+ * up to date. Must be called before the first scan
+ */
+void startClockThread()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    runtime_start_ns = timespecNs(&now);
+    scan_monotonic_ns = runtime_start_ns;
+    refreshClockOffsets();
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, clockThread, NULL) == 0) pthread_detach(thread);
+}
+
+/**
+ * @brief Stores the start time of the scan, read by the scan thread from
+ * CLOCK_MONOTONIC. All the time values of the scan are derived from it
+ *
+ * @param scan_start CLOCK_MONOTONIC time of the scan start
+ */
+void updateScanClock(const struct timespec *scan_start)
+{
+    scan_monotonic_ns = timespecNs(scan_start) + virtual_offset_ns;
+}
+
+/**
+ * @brief Advances the scan clock by the ticks the last scan stands for,
+ * instead of reading it from CLOCK_MONOTONIC, on virtual time. The clock
+ * never goes back: once back on real time it keeps the lead it took
+ *
+ * @param elapsed_ns Time the scan clock advances
+ * @param scan_start CLOCK_MONOTONIC time of the scan start
+ */
+void advanceScanClock(int64_t elapsed_ns, const struct timespec *scan_start)
+{
+    scan_monotonic_ns += elapsed_ns;
+    virtual_offset_ns = scan_monotonic_ns - timespecNs(scan_start);
+}
+
+/**
+ * @brief Sets the time elapsed since the runtime started of the running scan.
+ * Used by the replay of an input recording, which runs the scans at the scan
+ * times they were recorded with
+ *
+ * @param elapsed_ns Time elapsed since the runtime started, in nanoseconds
+ */
+void setScanTime(int64_t elapsed_ns)
+{
+    scan_monotonic_ns = runtime_start_ns + elapsed_ns;
+}
+
+/**
+ * @brief Returns the time elapsed since the runtime started, at the start of
+ * the running scan. Used by the glue code to update __CURRENT_TIME
+ *
+ * @param tv_sec Where the seconds of the elapsed time are stored
+ * @param tv_nsec Where the nanoseconds of the elapsed time are stored
+ */
+void readScanTime(int32_t *tv_sec, int32_t *tv_nsec)
+{
+    int64_t elapsed = scan_monotonic_ns - runtime_start_ns;
+    *tv_sec = (int32_t)(elapsed / 1000000000LL);
+    *tv_nsec = (int32_t)(elapsed % 1000000000LL);
+}
+
 /**
  * @brief Handles special functions for the OpenPLC runtime
  *
@@ -194,35 +864,27 @@ void disableOutputs()
  * - Number of cycles (stored in %ML1025)
  * - Communication error counter (implemented elsewhere)
  *
+ * The times are derived from the scan start and the cached clock offsets,
+ * so no libc time call is made on the scan.
+ *
  * @note The function assumes that the `special_functions` array is properly initialized
  *       and that indices 0, 1, and 3 are valid.
  */
 void handleSpecialFunctions()
 {
-    time_t rawtime;
-    struct tm *current_time;
-    
-    time(&rawtime);
-    
+    int64_t realtime_ns = scan_monotonic_ns + realtime_offset.load(std::memory_order_relaxed);
+    int64_t rawtime = realtime_ns / 1000000000LL;
+
     // Store the UTC clock in [%ML1027]
     if (special_functions[3] != NULL) 
     {
         *special_functions[3] = rawtime;
     }
 
-    current_time = localtime(&rawtime);
-    
-    // Adjust for local time
-    time_t localtime = rawtime - timezone;
-    if (current_time->tm_isdst > 0) 
-    {
-        localtime += 3600; // Add one hour for daylight saving time
-    }
-        
     // Store local time in [%ML1024]
     if (special_functions[0] != NULL) 
     {
-        *special_functions[0] = localtime;
+        *special_functions[0] = rawtime + local_time_offset.load(std::memory_order_relaxed);
     }
     
     // Increment and store number of cycles [%ML1025]
@@ -235,6 +897,13 @@ void handleSpecialFunctions()
     // Communication error counter [%ML1026]
     /* Implemented in modbus_master.cpp */
 
+    // Slave device statistics [%ML1040 on, 8 per device]
+    updateMBSpecialFunctions();
+
+    // Scan overruns [%ML1030], largest overrun [%ML1031], watchdog alarms [%ML1032],
+    // load shedding level [%ML1035] and activations [%ML1036]
+    updateSchedulerSpecialFunctions();
+
     // Insert other special functions below
 }
 
@@ -0,0 +1,583 @@
+//-----------------------------------------------------------------------------
+// Copyright 2026 Thiago Alves
+// This file is part of the OpenPLC Runtime.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This file implements the access to the variables of the program by name.
+// The index maps the path of every variable that is not located, the members
+// of the function block instances included (e.g.
+// CONFIG0.RES0.INSTANCE0.TON0.ET), and the name of every tag of the tag
+// database to its address, size and type. It is built from the variable
+// table of glueVars.cpp the first time it is used, and again once an online
+// change or a new tag database replaces what it was built from. Names are
+// matched regardless of case, like IEC identifiers.
+//
+// variables_read() copies all the values asked for holding bufferLock once,
+// so they come from the same scan, and formats them afterwards.
+// variables_write() parses all the values first and writes them holding
+// bufferLock once, so the program sees all of them on the same scan, or none
+// if any name or value is invalid. An index replaced in the meantime is
+// never freed, so the lookups need no lock.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "ladder.h"
+#include "plc_program.h"
+#include "iec_types_all.h"
+
+#define VARIABLE_REPLY_CHUNK    8192
+
+// How a value is shown and parsed
+#define VALUE_BOOL              0
+#define VALUE_SIGNED            1
+#define VALUE_UNSIGNED          2
+#define VALUE_REAL              3   // float, or fixed point with PLC_REAL_FRAC_BITS
+#define VALUE_LREAL             4
+#define VALUE_TIME              5   // IEC_TIMESPEC, shown in ns
+#define VALUE_STRING            6
+#define VALUE_RAW               7   // structures and arrays, shown as hex bytes
+
+extern unsigned long __tick;
+
+struct NamedVariable
+{
+    const char *name;
+    void *value;
+    uint32_t size;
+    uint8_t kind;           // VALUE_*
+};
+
+struct VariableIndex
+{
+    const PlcVariable *variables;   // table of the program it was built from
+    const Tag *first_tag;           // first tag of the database it was built from
+    unsigned int real_frac_bits;
+    std::vector<NamedVariable> entries;
+    std::vector<uint32_t> by_name;  // entry + 1, 0 while the slot is empty
+};
+
+static std::atomic<VariableIndex *> current_index(NULL);
+static std::vector<VariableIndex *> retired_indexes;
+static pthread_mutex_t indexLock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t hashName(const char *name, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t)toupper((unsigned char)name[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the kind of value of an IEC type
+//-----------------------------------------------------------------------------
+static uint8_t typeKind(const char *type, size_t size)
+{
+    static const char *signed_types[] = { "SINT", "INT", "DINT", "LINT", NULL };
+    static const char *unsigned_types[] = { "USINT", "UINT", "UDINT", "ULINT", "BYTE", "WORD", "DWORD", "LWORD", NULL };
+    static const char *time_types[] = { "TIME", "DATE", "TOD", "DT", NULL };
+
+    if (strcmp(type, "BOOL") == 0 && size == 1) return VALUE_BOOL;
+    for (int i = 0; signed_types[i] != NULL; i++)
+    {
+        if (strcmp(type, signed_types[i]) == 0 && size <= 8) return VALUE_SIGNED;
+    }
+    for (int i = 0; unsigned_types[i] != NULL; i++)
+    {
+        if (strcmp(type, unsigned_types[i]) == 0 && size <= 8) return VALUE_UNSIGNED;
+    }
+    for (int i = 0; time_types[i] != NULL; i++)
+    {
+        if (strcmp(type, time_types[i]) == 0 && size == sizeof(IEC_TIMESPEC)) return VALUE_TIME;
+    }
+    if (strcmp(type, "REAL") == 0 && size == 4) return VALUE_REAL;
+    if (strcmp(type, "LREAL") == 0 && size == 8) return VALUE_LREAL;
+    if (strcmp(type, "STRING") == 0 && size == sizeof(IEC_STRING)) return VALUE_STRING;
+    return VALUE_RAW;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the entry of a name on an index, or -1 if there is none
+//-----------------------------------------------------------------------------
+static int findEntry(const VariableIndex *index, const char *name, size_t length)
+{
+    size_t mask = index->by_name.size() - 1;
+    for (size_t slot = hashName(name, length) & mask; index->by_name[slot] != 0; slot = (slot + 1) & mask)
+    {
+        const NamedVariable *entry = &index->entries[index->by_name[slot] - 1];
+        if (strncasecmp(entry->name, name, length) == 0 && entry->name[length] == '\0') return (int)(index->by_name[slot] - 1);
+    }
+    return -1;
+}
+
+static void addEntry(VariableIndex *index, const NamedVariable &entry)
+{
+    size_t length = strlen(entry.name);
+    if (findEntry(index, entry.name, length) >= 0) return;
+
+    index->entries.push_back(entry);
+    size_t mask = index->by_name.size() - 1;
+    size_t slot = hashName(entry.name, length) & mask;
+    while (index->by_name[slot] != 0) slot = (slot + 1) & mask;
+    index->by_name[slot] = (uint32_t)index->entries.size();
+}
+
+//-----------------------------------------------------------------------------
+// Builds the index of the variables of a program and of the tags. The
+// variables of the program win over tags with the same name
+//-----------------------------------------------------------------------------
+static VariableIndex *buildIndex(const PlcProgram *program, const Tag *first_tag)
+{
+    VariableIndex *index = new VariableIndex;
+    index->variables = program->variables;
+    index->first_tag = first_tag;
+    index->real_frac_bits = program->real_frac_bits;
+
+    size_t tag_count = getTagCount();
+    size_t slots = 16;
+    while (slots < (program->variable_count + tag_count) * 2) slots *= 2;
+    index->by_name.assign(slots, 0);
+    index->entries.reserve(program->variable_count + tag_count);
+
+    for (size_t i = 0; i < program->variable_count; i++)
+    {
+        const PlcVariable *var = &program->variables[i];
+        NamedVariable entry = { var->name, var->value, (uint32_t)var->size, typeKind(var->type, var->size) };
+        addEntry(index, entry);
+    }
+
+    for (size_t i = 0; i < tag_count; i++)
+    {
+        const Tag *tag = getTag(i);
+        if (tag == NULL || tag->count != 1 || tag->value == NULL) continue;
+
+        NamedVariable entry = { tag->name, tag->value, 1, VALUE_UNSIGNED };
+        switch (tag->size)
+        {
+            case 'W': entry.size = 2; break;
+            case 'D': case 'R': entry.size = 4; break;
+            case 'L': case 'F': entry.size = 8; break;
+        }
+        if (tag->type == TAG_TYPE_BOOL) entry.kind = VALUE_BOOL;
+        else if (tag->type == TAG_TYPE_SIGNED) entry.kind = VALUE_SIGNED;
+        else if (tag->type == TAG_TYPE_REAL && entry.size == 4) entry.kind = VALUE_REAL;
+        else if (tag->type == TAG_TYPE_REAL && entry.size == 8) entry.kind = VALUE_LREAL;
+        addEntry(index, entry);
+    }
+
+    return index;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the index of the program running and of the current tags,
+// building it if they changed
+//-----------------------------------------------------------------------------
+static VariableIndex *currentIndex()
+{
+    const PlcProgram *program = plcProgram();
+    const Tag *first_tag = getTag(0);
+    VariableIndex *index = current_index.load(std::memory_order_acquire);
+    if (index != NULL && index->variables == program->variables && index->first_tag == first_tag) return index;
+
+    pthread_mutex_lock(&indexLock);
+    index = current_index.load(std::memory_order_acquire);
+    if (index == NULL || index->variables != program->variables || index->first_tag != first_tag)
+    {
+        if (index != NULL) retired_indexes.push_back(index);
+        index = buildIndex(program, first_tag);
+        current_index.store(index, std::memory_order_release);
+    }
+    pthread_mutex_unlock(&indexLock);
+
+    return index;
+}
+
+//-----------------------------------------------------------------------------
+// Splits a comma separated list in place, leaving the commas inside quotes
+// alone. Blanks around the items are removed
+//-----------------------------------------------------------------------------
+static void splitList(char *list, std::vector<char *> *items)
+{
+    char *item = list;
+    bool quoted = false;
+    for (char *c = list; ; c++)
+    {
+        if (quoted && *c == '$' && c[1] != '\0')
+        {
+            c++;
+            continue;
+        }
+        if (*c == '\'') quoted = !quoted;
+        if ((*c == ',' && !quoted) || *c == '\0')
+        {
+            bool last = (*c == '\0');
+            *c = '\0';
+            while (isspace((unsigned char)*item)) item++;
+            char *end = item + strlen(item);
+            while (end > item && isspace((unsigned char)end[-1])) *--end = '\0';
+            if (*item != '\0') items->push_back(item);
+            if (last) break;
+            item = c + 1;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Appends a value to a reply
+//-----------------------------------------------------------------------------
+static void formatValue(const NamedVariable *entry, const uint8_t *value, unsigned int real_frac_bits, std::string *reply)
+{
+    char text[64];
+    switch (entry->kind)
+    {
+        case VALUE_BOOL:
+            reply->append(*value ? "1" : "0");
+            return;
+        case VALUE_SIGNED:
+        {
+            int64_t number = 0;
+            switch (entry->size)
+            {
+                case 1: number = *(const int8_t *)value; break;
+                case 2: number = *(const int16_t *)value; break;
+                case 4: number = *(const int32_t *)value; break;
+                case 8: number = *(const int64_t *)value; break;
+            }
+            snprintf(text, sizeof(text), "%lld", (long long)number);
+            break;
+        }
+        case VALUE_UNSIGNED:
+        {
+            uint64_t number = 0;
+            memcpy(&number, value, entry->size);
+            snprintf(text, sizeof(text), "%llu", (unsigned long long)number);
+            break;
+        }
+        case VALUE_REAL:
+            if (real_frac_bits > 0)
+                snprintf(text, sizeof(text), "%.9g", (double)*(const int32_t *)value / (double)(1LL << real_frac_bits));
+            else
+                snprintf(text, sizeof(text), "%.9g", (double)*(const float *)value);
+            break;
+        case VALUE_LREAL:
+            snprintf(text, sizeof(text), "%.17g", *(const double *)value);
+            break;
+        case VALUE_TIME:
+        {
+            const IEC_TIMESPEC *stamp = (const IEC_TIMESPEC *)value;
+            snprintf(text, sizeof(text), "%lld", (long long)stamp->tv_sec * 1000000000LL + stamp->tv_nsec);
+            break;
+        }
+        case VALUE_STRING:
+        {
+            // IEC string literal, with $ escapes for the quotes and the
+            // characters that aren't printable
+            const IEC_STRING *string = (const IEC_STRING *)value;
+            int length = string->len < 0 ? 0 : string->len > STR_MAX_LEN ? STR_MAX_LEN : string->len;
+            reply->push_back('\'');
+            for (int i = 0; i < length; i++)
+            {
+                uint8_t c = string->body[i];
+                if (c == '\'' || c == '$') { reply->push_back('$'); reply->push_back((char)c); }
+                else if (c < 0x20 || c >= 0x7F) { snprintf(text, sizeof(text), "$%02X", c); reply->append(text); }
+                else reply->push_back((char)c);
+            }
+            reply->push_back('\'');
+            return;
+        }
+        default:
+            reply->append("16#");
+            for (uint32_t i = 0; i < entry->size; i++)
+            {
+                snprintf(text, sizeof(text), "%02X", value[i]);
+                reply->append(text);
+            }
+            return;
+    }
+    reply->append(text);
+}
+
+static int hexDigit(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// Parses a value in the format of formatValue into out, which has the size
+// of the variable. Returns false if the text isn't a value of its kind
+//-----------------------------------------------------------------------------
+static bool parseValue(const NamedVariable *entry, const char *text, unsigned int real_frac_bits, uint8_t *out)
+{
+    char *end;
+    memset(out, 0, entry->size);
+    switch (entry->kind)
+    {
+        case VALUE_BOOL:
+            if (strcasecmp(text, "1") == 0 || strcasecmp(text, "TRUE") == 0) *out = 1;
+            else if (strcasecmp(text, "0") != 0 && strcasecmp(text, "FALSE") != 0) return false;
+            return true;
+        case VALUE_SIGNED:
+        {
+            long long number = strtoll(text, &end, 0);
+            if (end == text || *end != '\0') return false;
+            if (entry->size < 8 && (number < -(1LL << (entry->size * 8 - 1)) || number >= (1LL << (entry->size * 8 - 1)))) return false;
+            memcpy(out, &number, entry->size);
+            return true;
+        }
+        case VALUE_UNSIGNED:
+        {
+            if (*text == '-') return false;
+            unsigned long long number = strtoull(text, &end, 0);
+            if (end == text || *end != '\0') return false;
+            if (entry->size < 8 && number >= (1ULL << (entry->size * 8))) return false;
+            memcpy(out, &number, entry->size);
+            return true;
+        }
+        case VALUE_REAL:
+        case VALUE_LREAL:
+        {
+            double number = strtod(text, &end);
+            if (end == text || *end != '\0') return false;
+            if (entry->kind == VALUE_LREAL)
+            {
+                memcpy(out, &number, 8);
+            }
+            else if (real_frac_bits > 0)
+            {
+                double scaled = number * (double)(1LL << real_frac_bits);
+                int32_t raw = scaled >= 2147483647.0 ? INT32_MAX : scaled <= -2147483648.0 ? INT32_MIN :
+                              (int32_t)(scaled + (scaled >= 0 ? 0.5 : -0.5));
+                memcpy(out, &raw, 4);
+            }
+            else
+            {
+                float single = (float)number;
+                memcpy(out, &single, 4);
+            }
+            return true;
+        }
+        case VALUE_TIME:
+        {
+            long long ns = strtoll(text, &end, 0);
+            if (end == text || *end != '\0') return false;
+            IEC_TIMESPEC stamp;
+            stamp.tv_sec = (int32_t)(ns / 1000000000LL);
+            stamp.tv_nsec = (int32_t)(ns % 1000000000LL);
+            memcpy(out, &stamp, sizeof(stamp));
+            return true;
+        }
+        case VALUE_STRING:
+        {
+            size_t length = strlen(text);
+            if (length < 2 || text[0] != '\'' || text[length - 1] != '\'') return false;
+            IEC_STRING string;
+            memset(&string, 0, sizeof(string));
+            int count = 0;
+            for (size_t i = 1; i < length - 1; i++)
+            {
+                uint8_t c = (uint8_t)text[i];
+                if (c == '$')
+                {
+                    if (i + 1 < length - 1 && (text[i + 1] == '\'' || text[i + 1] == '$')) c = (uint8_t)text[++i];
+                    else if (i + 2 < length - 1 && hexDigit(text[i + 1]) >= 0 && hexDigit(text[i + 2]) >= 0)
+                    {
+                        c = (uint8_t)(hexDigit(text[i + 1]) * 16 + hexDigit(text[i + 2]));
+                        i += 2;
+                    }
+                    else return false;
+                }
+                else if (c == '\'') return false;
+                if (count == STR_MAX_LEN) return false;
+                string.body[count++] = c;
+            }
+            string.len = (__strlen_t)count;
+            memcpy(out, &string, sizeof(string));
+            return true;
+        }
+        default:
+            if (strncmp(text, "16#", 3) != 0 || strlen(text + 3) != entry->size * 2) return false;
+            for (uint32_t i = 0; i < entry->size; i++)
+            {
+                int high = hexDigit(text[3 + i * 2]);
+                int low = hexDigit(text[4 + i * 2]);
+                if (high < 0 || low < 0) return false;
+                out[i] = (uint8_t)(high * 16 + low);
+            }
+            return true;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Sends the values of a comma separated list of variable names to a client,
+// all copied on the same scan. The first line holds the tick of the scan,
+// then a NAME=value line per name, in order, with ? for the unknown names
+//-----------------------------------------------------------------------------
+void sendVariableValues(LogWriter writer, void *context, const char *names)
+{
+    std::string list(names);
+    std::vector<char *> items;
+    splitList(&list[0], &items);
+
+    VariableIndex *index = NULL;
+    std::vector<int> entries(items.size());
+    std::vector<uint8_t> values;
+    unsigned long tick = 0;
+
+    // An online change may swap the program between the lookup and the
+    // copy, the names are looked up again on its index
+    for (int attempt = 0; attempt < 3; attempt++)
+    {
+        index = currentIndex();
+        size_t total = 0;
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            entries[i] = findEntry(index, items[i], strlen(items[i]));
+            if (entries[i] >= 0) total += index->entries[entries[i]].size;
+        }
+        values.resize(total);
+
+        lockBuffer();
+        if (plcProgram()->variables != index->variables)
+        {
+            unlockBuffer();
+            index = NULL;
+            continue;
+        }
+        uint8_t *position = values.data();
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            if (entries[i] < 0) continue;
+            const NamedVariable *entry = &index->entries[entries[i]];
+            memcpy(position, entry->value, entry->size);
+            position += entry->size;
+        }
+        tick = __tick;
+        unlockBuffer();
+        break;
+    }
+
+    std::string reply;
+    if (index == NULL)
+    {
+        reply = "Error: the program changed during the read\n";
+        writer(context, reply.data(), reply.size());
+        return;
+    }
+
+    char line[64];
+    snprintf(line, sizeof(line), "scan=%lu\n", tick);
+    reply.append(line);
+    const uint8_t *position = values.data();
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        reply.append(items[i]);
+        reply.push_back('=');
+        if (entries[i] < 0)
+        {
+            reply.append("?");
+        }
+        else
+        {
+            const NamedVariable *entry = &index->entries[entries[i]];
+            formatValue(entry, position, index->real_frac_bits, &reply);
+            position += entry->size;
+        }
+        reply.push_back('\n');
+
+        if (reply.size() >= VARIABLE_REPLY_CHUNK)
+        {
+            if (writer(context, reply.data(), reply.size()) < 0) return;
+            reply.clear();
+        }
+    }
+    writer(context, reply.data(), reply.size());
+}
+
+//-----------------------------------------------------------------------------
+// Writes a comma separated list of NAME=value assignments, all on the same
+// scan. Nothing is written if any name or value is invalid. Returns 0 on
+// success or -1 with the reason on error
+//-----------------------------------------------------------------------------
+int writeVariableValues(const char *assignments, char *error, size_t error_size)
+{
+    std::string list(assignments);
+    std::vector<char *> items;
+    splitList(&list[0], &items);
+
+    for (int attempt = 0; attempt < 3; attempt++)
+    {
+        VariableIndex *index = currentIndex();
+        std::vector<int> entries(items.size());
+        std::vector<uint8_t> values;
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            char *equal = strchr(items[i], '=');
+            size_t length = equal != NULL ? (size_t)(equal - items[i]) : strlen(items[i]);
+            while (length > 0 && isspace((unsigned char)items[i][length - 1])) length--;
+            entries[i] = findEntry(index, items[i], length);
+            if (equal == NULL || entries[i] < 0)
+            {
+                snprintf(error, error_size, "Error: no such variable %.*s\n", (int)length, items[i]);
+                return -1;
+            }
+
+            const char *text = equal + 1;
+            while (isspace((unsigned char)*text)) text++;
+            const NamedVariable *entry = &index->entries[entries[i]];
+            size_t offset = values.size();
+            values.resize(offset + entry->size);
+            if (!parseValue(entry, text, index->real_frac_bits, &values[offset]))
+            {
+                snprintf(error, error_size, "Error: invalid value for %s\n", entry->name);
+                return -1;
+            }
+        }
+
+        lockBuffer();
+        if (plcProgram()->variables != index->variables)
+        {
+            unlockBuffer();
+            continue;
+        }
+        const uint8_t *position = values.data();
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            const NamedVariable *entry = &index->entries[entries[i]];
+            memcpy(entry->value, position, entry->size);
+            position += entry->size;
+        }
+        unlockBuffer();
+        return 0;
+    }
+
+    snprintf(error, error_size, "Error: the program changed during the write\n");
+    return -1;
+}
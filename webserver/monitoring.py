@@ -1,6 +1,6 @@
-import time, threading
+import socket, threading
 from struct import *
-from pymodbus.client.sync import ModbusTcpClient
+from openplc import RPC_PORT, RPC_MAGIC, RPC_REQUEST, RPC_END
 
 class debug_var():
     name = ''
@@ -11,7 +11,11 @@ class debug_var():
 
 debug_vars = []
 monitor_active = False
-mb_client = None
+monitor_socket = None
+monitor_ready = threading.Event()
+
+# Locations the runtime can stream, the ones on other areas are not monitored
+MONITOR_AREAS = ('IX', 'QX', 'IW', 'QW', 'MW', 'MD', 'ML')
 
 def parse_st(st_file):
     global debug_vars
@@ -44,110 +48,169 @@ def parse_st(st_file):
 
 def cleanup():
     del debug_vars[:]
-    
-def modbus_monitor():
-    global mb_client
-    for debug_data in debug_vars:
-        if (debug_data.location.find('IX')) > 0:
-            #Reading Input Status
-            mb_address = debug_data.location.split('%IX')[1].split('.')
-            result = mb_client.read_discrete_inputs(int(mb_address[0])*8 + int(mb_address[1]), 1)
-            debug_data.value = result.bits[0]
-            
-        elif (debug_data.location.find('QX')) > 0:
-            #Reading Coils
-            mb_address = debug_data.location.split('%QX')[1].split('.')
-            if (len(mb_address) < 2):
-                result = mb_client.read_coils(int(mb_address[0])*8, 1)
+
+def point_name(location):
+    # Name of a location on the monitoring stream (%QX0 -> QX0.0, %IW3 -> IW3)
+    name = location.strip().lstrip('%')
+    if name[:2] not in MONITOR_AREAS:
+        return None
+    if name[1] == 'X' and name.find('.') < 0:
+        name += '.0'
+    return name
+
+def point_list(names):
+    # Subscription list, with consecutive locations of an area merged into
+    # ranges so hundreds of points fit on a single command
+    positions = {}
+    for name in names:
+        area = name[:2]
+        if area[1] == 'X':
+            byte, bit = name[2:].split('.')
+            position = int(byte)*8 + int(bit)
+        else:
+            position = int(name[2:])
+        positions.setdefault(area, set()).add(position)
+
+    def location(area, position):
+        if area[1] == 'X':
+            return area + str(position // 8) + '.' + str(position % 8)
+        return area + str(position)
+
+    ranges = []
+    for area in sorted(positions):
+        ordered = sorted(positions[area])
+        first = last = ordered[0]
+        for position in ordered[1:] + [None]:
+            if position is not None and position == last + 1:
+                last = position
+                continue
+            if first == last:
+                ranges.append(location(area, first))
             else:
-                result = mb_client.read_coils(int(mb_address[0])*8 + int(mb_address[1]), 1)
-            debug_data.value = result.bits[0]
-            
-        elif (debug_data.location.find('IW')) > 0:
-            #Reading Input Registers
-            mb_address = debug_data.location.split('%IW')[1]
-            result = mb_client.read_input_registers(int(mb_address), 1)
-            debug_data.value = result.registers[0]
-            
-        elif (debug_data.location.find('QW')) > 0:
-            #Reading Holding Registers
-            mb_address = debug_data.location.split('%QW')[1]
-            result = mb_client.read_holding_registers(int(mb_address), 1)
-            debug_data.value = result.registers[0]
-            
-        elif (debug_data.location.find('MW')) > 0:
-            #Reading Word Memory
-            mb_address = debug_data.location.split('%MW')[1]
-            result = mb_client.read_holding_registers(int(mb_address) + 1024, 1)
-            debug_data.value = result.registers[0]
-            
-        elif (debug_data.location.find('MD')) > 0:
-            #Reading Double Memory
-            mb_address = debug_data.location.split('%MD')[1]
-            result = mb_client.read_holding_registers((int(mb_address)*2) + 2048, 2)
-            if (debug_data.type == 'SINT') or (debug_data.type == 'INT') or (debug_data.type == 'DINT'):
-                #signed integer
-                float_pack = pack('>HH', result.registers[0], result.registers[1])
-                debug_data.value = unpack('>i', float_pack)[0]
-                
-            if (debug_data.type == 'USINT') or (debug_data.type == 'UINT') or (debug_data.type == 'UDINT'):
-                #unsigned integer
-                float_pack = pack('>HH', result.registers[0], result.registers[1])
-                debug_data.value = unpack('>I', float_pack)[0]
-                
-            if (debug_data.type == 'REAL'):
-                #32-bit float
-                float_pack = pack('>HH', result.registers[0], result.registers[1])
-                debug_data.value = unpack('>f', float_pack)[0]
-                
-        elif (debug_data.location.find('ML')) > 0:
-            #Reading Long Memory
-            mb_address = debug_data.location.split('%ML')[1]
-            result = mb_client.read_holding_registers((int(mb_address)*4) + 4096, 4)
-            if (debug_data.type == 'SINT') or (debug_data.type == 'INT') or (debug_data.type == 'DINT') or (debug_data.type == 'LINT'):
-                #signed integer
-                float_pack = pack('>HHHH', result.registers[0], result.registers[1], result.registers[2], result.registers[3])
-                debug_data.value = unpack('>q', float_pack)[0]
-                
-            if (debug_data.type == 'USINT') or (debug_data.type == 'UINT') or (debug_data.type == 'UDINT') or (debug_data.type == 'ULINT'):
-                #unsigned integer
-                float_pack = pack('>HHHH', result.registers[0], result.registers[1], result.registers[2], result.registers[3])
-                debug_data.value = unpack('>Q', float_pack)[0]
-                
-            if (debug_data.type == 'REAL') or (debug_data.type == 'LREAL'):
-                #64-bit float
-                float_pack = pack('>HHHH', result.registers[0], result.registers[1], result.registers[2], result.registers[3])
-                debug_data.value = unpack('>d', float_pack)[0]
-            
-    
-    if (monitor_active == True):
-        threading.Timer(0.5, modbus_monitor).start()
+                ranges.append(location(area, first) + '-' + location(area, last))
+            if position is not None:
+                first = last = position
+    return ','.join(ranges)
 
-def write_value(point_address, point_value):
-    global mb_client
+def fixed_real_bits():
+    # Fraction bits of REAL on programs built with scripts/fixed_real, 0 when
+    # REAL is a float
+    try:
+        with open('./scripts/fixed_real') as f: setting = f.read().strip()
+    except IOError:
+        return 0
+    if setting == 'true':
+        return 16
+    return int(setting) if setting.isdigit() else 0
+
+def decode_value(debug_data, raw, real_bits=0):
+    # Values come as the raw bits of the location
+    if (debug_data.location.find('W')) > 0:
+        if (debug_data.type == 'SINT') or (debug_data.type == 'INT'):
+            return unpack('<h', pack('<H', raw))[0]
+    elif (debug_data.location.find('MD')) > 0:
+        if (debug_data.type == 'SINT') or (debug_data.type == 'INT') or (debug_data.type == 'DINT'):
+            return unpack('<i', pack('<I', raw))[0]
+        if (debug_data.type == 'REAL'):
+            if real_bits > 0:
+                return unpack('<i', pack('<I', raw))[0] / float(1 << real_bits)
+            return unpack('<f', pack('<I', raw))[0]
+    elif (debug_data.location.find('ML')) > 0:
+        if (debug_data.type == 'SINT') or (debug_data.type == 'INT') or (debug_data.type == 'DINT') or (debug_data.type == 'LINT'):
+            return unpack('<q', pack('<Q', raw))[0]
+        if (debug_data.type == 'REAL') or (debug_data.type == 'LREAL'):
+            return unpack('<d', pack('<Q', raw))[0]
+    return raw
+
+def recv_exact(s, length):
+    data = b""
+    while len(data) < length:
+        chunk = s.recv(length - len(data))
+        if not chunk:
+            raise socket.error("Connection closed by the runtime")
+        data += chunk
+    return data
+
+def monitor_stream(s):
+    # Applies the updates streamed by the runtime until the subscription ends
+    global monitor_active
+    points = {}
+    for debug_data in debug_vars:
+        name = point_name(debug_data.location)
+        if name is not None:
+            points.setdefault(name, []).append(debug_data)
+    real_bits = fixed_real_bits()
+
+    try:
+        if points:
+            payload = ('monitor_subscribe(0,' + point_list(points.keys()) + ')').encode('utf-8')
+            s.sendall(pack('<BBHI', RPC_MAGIC, RPC_REQUEST, 0, len(payload)) + payload)
+        while points and monitor_socket is s:
+            magic, frame_type, frame_id, length = unpack('<BBHI', recv_exact(s, 8))
+            data = recv_exact(s, length).decode('utf-8', errors='replace')
+            if magic != RPC_MAGIC or frame_type == RPC_END:
+                break
+            for line in data.splitlines():
+                fields = line.split(' ')
+                if fields[0] == 'Error:':
+                    print('Monitoring: ' + line)
+                elif len(fields) == 2 and fields[0] in points:
+                    for debug_data in points[fields[0]]:
+                        debug_data.value = decode_value(debug_data, int(fields[1]), real_bits)
+            monitor_ready.set()
+    except (socket.error, ValueError):
+        pass
+    monitor_ready.set()
+    s.close()
+    # A newer subscription may have replaced this one already
+    if monitor_socket is s:
+        monitor_active = False
 
-    # COILS
+def write_value(point_address, point_value):
+    # Only coils are written from the monitoring page
     if (point_address.find('QX')) > 0:
-        mb_address = point_address.split('%QX')[1].split('.')
-        if (len(mb_address) < 2):
-            result = mb_client.write_coil(int(mb_address[0])*8, int(point_value))
-        else:
-            result = mb_client.write_coil(int(mb_address[0])*8 + int(mb_address[1]), int(point_value))
+        name = point_name(point_address)
+        try:
+            s = socket.create_connection(('localhost', RPC_PORT), timeout=2)
+            payload = ('monitor_write(' + name + ',' + str(int(point_value)) + ')').encode('utf-8')
+            s.sendall(pack('<BBHI', RPC_MAGIC, RPC_REQUEST, 0, len(payload)) + payload)
+            while True:
+                magic, frame_type, frame_id, length = unpack('<BBHI', recv_exact(s, 8))
+                recv_exact(s, length)
+                if frame_type == RPC_END:
+                    break
+            s.close()
+        except socket.error:
+            pass
     
-def start_monitor(modbus_port_cfg):
+def start_monitor():
     global monitor_active
-    global mb_client
+    global monitor_socket
     
     if (monitor_active != True):
+        try:
+            monitor_socket = socket.create_connection(('localhost', RPC_PORT), timeout=2)
+        except socket.error:
+            return
+        monitor_socket.settimeout(None)
         monitor_active = True
-        mb_client = ModbusTcpClient('127.0.0.1', port=modbus_port_cfg)
-        
-        modbus_monitor()
+        monitor_ready.clear()
+        monitor_thread = threading.Thread(target=monitor_stream, args=(monitor_socket,))
+        monitor_thread.daemon = True
+        monitor_thread.start()
+        # The first update carries every value, wait for it so the page
+        # doesn't show zeros
+        monitor_ready.wait(1)
 
 def stop_monitor():
     global monitor_active
-    global mb_client
+    global monitor_socket
     
     if (monitor_active != False):
         monitor_active = False
-        mb_client.close()
\ No newline at end of file
+        s = monitor_socket
+        monitor_socket = None
+        try:
+            s.shutdown(socket.SHUT_RDWR)
+        except socket.error:
+            pass
@@ -1,9 +1,10 @@
 #Use this for OpenPLC console: http://eyalarubas.com/python-subproc-nonblock.html
 import subprocess
 import socket
+import struct
 import errno
 import time
-from threading import Thread, Lock
+from threading import Thread, Lock, Event
 from queue import Queue, Empty
 import os
 import os.path
@@ -70,6 +71,20 @@ class NonBlockingStreamReader:
 
 class UnexpectedEndOfStream(Exception): pass
 
+class _PendingRequest:
+    # A request sent to the runtime, completed by the reader thread once its
+    # end frame arrives
+    def __init__(self):
+        self.data = b""
+        self.failed = False
+        self.done = Event()
+
+# Framed requests on a persistent connection to the interactive server
+RPC_PORT = 43628
+RPC_MAGIC = 0xB7
+RPC_REQUEST = 0x01
+RPC_END = 0x82
+
 class runtime:
     def __init__(self):
         self.project_file = ""
@@ -79,7 +94,13 @@ class runtime:
         self.compilation_error_str = ""
         self.compilation_object = None
         self.compilation_error = None
+        self.online_change_pending = False
         self.runtime_status = "Stopped"
+        self._sock = None
+        self._rpc_lock = Lock()
+        self._pending_lock = Lock()
+        self._pending = {}
+        self._next_id = 0
 
     def start_runtime(self):
         # Check if runtime is already running by trying to connect to RPC server
@@ -99,22 +120,135 @@ class runtime:
             self.theprocess = subprocess.Popen(['./core/openplc'])  # XXX: iPAS
             self.runtime_status = "Running"
 
+    def _connection(self):
+        # Called with _rpc_lock held
+        if self._sock is None:
+            s = socket.create_connection(('localhost', RPC_PORT), timeout=2)
+            s.settimeout(None)
+            s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            self._sock = s
+            Thread(target=self._read_responses, args=(s,), daemon=True).start()
+        return self._sock
+
+    def _disconnect(self, s=None):
+        # Closes the connection (only if it is still s, when given) and fails
+        # the requests waiting on it
+        with self._pending_lock:
+            if s is None:
+                s = self._sock
+            if s is None or s is not self._sock:
+                return
+            self._sock = None
+            pending = self._pending
+            self._pending = {}
+        try:
+            s.close()
+        except socket.error:
+            pass
+        for request in pending.values():
+            request.failed = True
+            request.done.set()
+
+    def _recv_exact(self, s, length):
+        data = b""
+        while len(data) < length:
+            chunk = s.recv(length - len(data))
+            if not chunk:
+                raise socket.error("Connection closed by the runtime")
+            data += chunk
+        return data
+
+    def _read_responses(self, s):
+        # Hands the response frames to the requests they belong to. The
+        # runtime runs the requests concurrently and ends them in any order
+        try:
+            while True:
+                magic, frame_type, frame_id, length = struct.unpack('<BBHI', self._recv_exact(s, 8))
+                if magic != RPC_MAGIC:
+                    raise socket.error("Unexpected response frame")
+                data = self._recv_exact(s, length)
+                with self._pending_lock:
+                    request = self._pending.get(frame_id)
+                    if request is not None and frame_type == RPC_END:
+                        del self._pending[frame_id]
+                if request is None:
+                    raise socket.error("Response to an unknown request")
+                request.data += data
+                if frame_type == RPC_END:
+                    request.done.set()
+        except (socket.error, OSError):
+            self._disconnect(s)
+
+    def _send_requests(self, msgs):
+        # Sends a batch of commands and returns their pending requests
+        with self._rpc_lock:
+            s = self._connection()
+            requests = []
+            frames = b""
+            with self._pending_lock:
+                for msg in msgs:
+                    while self._next_id in self._pending:
+                        self._next_id = (self._next_id + 1) & 0xFFFF
+                    request_id = self._next_id
+                    self._next_id = (self._next_id + 1) & 0xFFFF
+                    request = _PendingRequest()
+                    self._pending[request_id] = request
+                    requests.append(request)
+                    payload = msg.encode('utf-8')
+                    frames += struct.pack('<BBHI', RPC_MAGIC, RPC_REQUEST, request_id, len(payload)) + payload
+            try:
+                s.sendall(frames)
+            except socket.error:
+                self._disconnect(s)
+                raise
+            return requests
+
+    def _request(self, msgs):
+        # Sends a batch of commands on the persistent connection and returns
+        # their responses, in order. Other threads may send their commands
+        # while these run, so a status query doesn't wait for a protocol to
+        # start. A connection that went stale (i.e. the runtime restarted) is
+        # reopened once
+        for attempt in range(2):
+            reused = self._sock is not None
+            try:
+                requests = self._send_requests(msgs)
+                responses = []
+                for request in requests:
+                    request.done.wait()
+                    if request.failed:
+                        raise socket.error("Connection closed by the runtime")
+                    responses.append(request.data.decode('utf-8', errors='replace'))
+                return responses
+            except socket.error:
+                if attempt == 1 or not reused:
+                    raise
+
     def _rpc(self, msg, timeout=1000):
         data = ""
         if not self.runtime_status == "Running":
             return data
         try:
-            s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
-            s.connect(('localhost', 43628))
-            s.send(f'{msg}\n'.encode('utf-8'))
-            data = s.recv(timeout).decode('utf-8')
-            s.close()
+            data = self._request([msg])[0]
             self.runtime_status = "Running"
         except socket.error as serr:
             print(f'Socket error during {msg}, is the runtime active?')
             self.runtime_status = "Stopped"
         return data
 
+    def rpc_batch(self, msgs):
+        # Sends several commands at once, returns their responses in order
+        if not self.runtime_status == "Running":
+            return [""] * len(msgs)
+        try:
+            responses = self._request(msgs)
+            self.runtime_status = "Running"
+            return responses
+        except socket.error as serr:
+            print(f'Socket error during {msgs}, is the runtime active?')
+            self.runtime_status = "Stopped"
+            return [""] * len(msgs)
+
     def stop_runtime(self):
         print("Stopping OpenPLC runtime...")
         if (self.status() == "Running"):
@@ -155,12 +289,19 @@ class runtime:
         time.sleep(2)  # Give time for cleanup
         self.start_runtime()
     
-    def compile_program(self, st_file):
-        if (self.status() == "Running"):
+    def compile_program(self, st_file, online=False):
+        # An online change builds the program as a shared object and swaps it
+        # into the running runtime, which keeps scanning during the build
+        online = online and self.status() == "Running"
+        if (not online and self.status() == "Running"):
             self.stop_runtime()
         
         self.is_compiling = True
         self.compilation_status_str = ""
+        self.online_change_pending = online
+        compile_args = ['./scripts/compile_program.sh', str(st_file)]
+        if online:
+            compile_args.append('online')
         
         # Extract debug information from program
         with open('./st_files/' + st_file, "r") as f:
@@ -216,7 +357,7 @@ class runtime:
 
             # Start compilation
             try:
-                a = subprocess.Popen(['./scripts/compile_program.sh', str(st_file)], stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+                a = subprocess.Popen(compile_args, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
                 self.compilation_object = NonBlockingStreamReader(a.stdout)
                 # self.compilation_error = NonBlockingStreamReader(a.stderr)
             except Exception as e:
@@ -244,7 +385,7 @@ class runtime:
                 f.write(c_debug)
 
             # Start compilation
-            a = subprocess.Popen(['./scripts/compile_program.sh', str(st_file)], stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+            a = subprocess.Popen(compile_args, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
             self.compilation_object = NonBlockingStreamReader(a.stdout)
             # self.compilation_error = NonBlockingStreamReader(a.stderr)
     
@@ -253,6 +394,9 @@ class runtime:
             line = self.compilation_object.readline()
             if not line: break
             self.compilation_status_str += line
+        if self.online_change_pending and "Compilation finished successfully!" in self.compilation_status_str:
+            self.online_change_pending = False
+            self.compilation_status_str += self.online_change() + "\n"
         return self.compilation_status_str
 
     def get_compilation_error(self):
@@ -270,13 +414,10 @@ class runtime:
         except Exception as e:
             print(f"Error checking compilation status: {e}")
 
-        # Try to connect to RPC server to check if runtime is actually running
+        # Ping the runtime on the persistent connection to check if it is
+        # actually running
         try:
-            s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
-            s.settimeout(2)  # Short timeout
-            s.connect(('localhost', 43628))
-            s.close()
-            # If we can connect, runtime is running
+            self._request(['ping()'])
             self.runtime_status = "Running"
             return self.runtime_status
         except (socket.error, ConnectionRefusedError):
@@ -290,12 +431,33 @@ class runtime:
     def stop_modbus(self):
         return self._rpc(f'stop_modbus()')
 
+    def start_modbus_udp(self, port_num):
+        return self._rpc(f'start_modbus_udp({port_num})')
+
+    def stop_modbus_udp(self):
+        return self._rpc(f'stop_modbus_udp()')
+
+    def start_modbus_rtu(self, port_config):
+        return self._rpc(f'start_modbus_rtu({port_config})')
+
+    def stop_modbus_rtu(self):
+        return self._rpc(f'stop_modbus_rtu()')
+
+    def set_modbus_response_cache(self, enabled):
+        return self._rpc(f'modbus_response_cache({1 if enabled else 0})')
+
     def start_snap7(self):
         return self._rpc(f'start_snap7()')
 
     def stop_snap7(self):
         return self._rpc(f'stop_snap7()')
 
+    def start_mqtt(self):
+        return self._rpc(f'start_mqtt()')
+
+    def stop_mqtt(self):
+        return self._rpc(f'stop_mqtt()')
+
     def start_dnp3(self, port_num):
         return self._rpc(f'start_dnp3({port_num})')
         
@@ -308,20 +470,182 @@ class runtime:
     def stop_enip(self):
         return self._rpc(f'stop_enip()')
 
-    def start_opcua(self, port_num):
+    def start_opcua(self, port_num, tuning=''):
+        # tuning holds the server limits, e.g. "max_sessions=200,max_chunk_count=64"
+        if tuning:
+            return self._rpc(f'start_opcua({port_num},{tuning})')
         return self._rpc(f'start_opcua({port_num})')
     
     def stop_opcua(self):
         return self._rpc(f'stop_opcua()')
+
+    def set_opcua_data_source(self, enabled):
+        return self._rpc(f'opcua_data_source({1 if enabled else 0})')
+
+    def set_opcua_scan_sampling(self, decimation):
+        return self._rpc(f'opcua_scan_sampling({decimation})')
+
+    def set_opcua_security(self, settings):
+        return self._rpc(f'opcua_security({settings})')
  
     def start_pstorage(self, poll_rate):
         return self._rpc(f'start_pstorage({poll_rate})')
                 
     def stop_pstorage(self):
         return self._rpc(f'stop_pstorage()')
+
+    def set_pstorage_retain(self, enabled):
+        return self._rpc(f'pstorage_retain({1 if enabled else 0})')
+
+    def set_lock_profiling(self, enabled):
+        return self._rpc(f'lock_profiling({1 if enabled else 0})')
+
+    def start_event_trace(self, freeze_us=0):
+        # With freeze_us the trace stops on the first scan longer than it
+        return self._rpc(f'start_event_trace({int(freeze_us)})')
+
+    def stop_event_trace(self):
+        return self._rpc(f'stop_event_trace()')
+
+    def dump_event_trace(self, path):
+        return self._rpc(f'event_trace_dump({path})',10000).startswith('OK')
+
+    def event_trace_status(self):
+        return self._rpc(f'event_trace_status()',10000)
+
+    def start_input_record(self, path):
+        # Replayed offline with ./core/openplc --replay <path>
+        return self._rpc(f'start_input_record({path})',10000).startswith('OK')
+
+    def stop_input_record(self):
+        return self._rpc(f'stop_input_record()',10000)
+
+    def input_record_status(self):
+        return self._rpc(f'input_record_status()',10000)
+
+    def set_scan_overrun_policy(self, policy):
+        policies = {'catch_up': 0, 'skip': 1, 'extend': 2}
+        return self._rpc(f'scan_overrun_policy({policies.get(policy, 0)})')
+
+    def set_scan_phase_order(self, order):
+        # outputs_first writes the physical outputs before the publication
+        orders = {'outputs_first': 0, 'outputs_last': 1}
+        return self._rpc(f'scan_phase_order({orders.get(order, 0)})')
+
+    def set_load_shedding(self, overruns):
+        # Overruns in a row before the non-critical work is slowed down, 0 disables it
+        return self._rpc(f'load_shedding({int(overruns)})')
+
+    def set_virtual_time(self, enabled):
+        # Scans run back to back, the PLC clock advances by a tick per tick
+        return self._rpc(f'virtual_time({1 if enabled else 0})')
+
+    def set_scan_watchdog(self, timeout_ms):
+        return self._rpc(f'scan_watchdog({int(timeout_ms)})')
+
+    def online_change(self):
+        # Swaps in the program built by the last online compilation
+        try:
+            with open('./core/online/latest', "r") as f:
+                program = f.read().strip()
+        except OSError:
+            return "Online change failed: no program was built"
+        if self._rpc(f'online_change({program})').startswith('OK'):
+            return "Online change applied"
+        return "Online change failed, check the runtime logs"
+
+    def export_state(self, path):
+        # Saves the variables of the running program, for a standby unit
+        # or to reproduce it offline
+        return self._rpc(f'state_export({path})').startswith('OK')
+
+    def import_state(self, path):
+        return self._rpc(f'state_import({path})').startswith('OK')
     
     def logs(self):
         return self._rpc(f'runtime_logs()',1000000)
+
+    def events(self, cursor):
+        return self._rpc(f'runtime_events({cursor})')
         
     def exec_time(self):
         return self._rpc(f'exec_time()',10000) or "N/A"
+
+    def scan_profile(self):
+        return self._rpc(f'scan_profile()',10000)
+
+    def lock_profile(self):
+        return self._rpc(f'lock_profile()',10000)
+
+    def pou_profile(self):
+        # Time of every program and function block type, for programs built
+        # with scripts/pou_profiling
+        return self._rpc(f'pou_profile()',10000)
+
+    def reset_pou_profile(self):
+        return self._rpc(f'pou_profile_reset()')
+
+    def start_sample_profile(self, hz):
+        # Samples the scan thread hz times per second of its CPU time. The
+        # lines are the ones of the ST file for programs built with
+        # scripts/st_line_profiling
+        return self._rpc(f'sample_profile_start({hz})')
+
+    def stop_sample_profile(self):
+        return self._rpc(f'sample_profile_stop()')
+
+    def sample_profile(self):
+        return self._rpc(f'sample_profile()',30000)
+
+    def rate_limits(self):
+        return self._rpc(f'rate_limits()',10000)
+
+    def scan_scheduler(self):
+        return self._rpc(f'scan_scheduler()',10000)
+
+    def thread_stats(self):
+        # One line per thread: class, CPU time and usage since the last call,
+        # context switches, scheduling and affinity
+        return self._rpc(f'thread_stats()',10000)
+
+    def event_tasks(self):
+        return self._rpc(f'event_tasks()',10000)
+
+    def modbus_master_stats(self):
+        return self._rpc(f'modbus_master_stats()',10000)
+
+    def reload_modbus_master(self):
+        return self._rpc(f'reload_modbus_master()',10000)
+
+    def network_variables_stats(self):
+        return self._rpc(f'network_variables_stats()',10000)
+
+    def read_variables(self, names):
+        # Reads program variables (e.g. CONFIG0.RES0.INSTANCE0.COUNT) and tags
+        # by name, all from the same scan. Returns a dict with the values as
+        # text, None for the unknown names
+        values = {}
+        reply = self._rpc(f'variables_read({",".join(names)})',10000)
+        for line in reply.splitlines():
+            name, sep, value = line.partition('=')
+            if sep and name != 'scan':
+                values[name] = None if value == '?' else value
+        return values
+
+    def write_variables(self, values):
+        # Writes a dict of name: value, all on the same scan or none of them
+        assignments = ",".join(f'{name}={value}' for name, value in values.items())
+        return self._rpc(f'variables_write({assignments})',10000)
+
+    def redundancy_status(self):
+        return self._rpc(f'redundancy_status()',10000)
+
+    def historian_query(self, tag, start_ms, end_ms, max_points=1000):
+        return self._rpc(f'historian_query({tag},{int(start_ms)},{int(end_ms)},{int(max_points)})',10000)
+
+    def tag_info(self, name):
+        return self._rpc(f'tag_info({name})',10000)
+
+    def tag_at(self, protocol, table, address, bit=None):
+        location = f'{int(address)}' if bit is None else f'{int(address)}.{int(bit)}'
+        return self._rpc(f'tag_at({protocol},{int(table)},{location})',10000)
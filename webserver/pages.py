@@ -840,8 +840,7 @@ monitoring_tail = """
         
         function loadData()
         {
-            html_modbus_port = document.getElementById('modbus_port_cfg');
-            url = 'monitor-update?mb_port=' + html_modbus_port.value;
+            url = 'monitor-update';
             try
             {
                 req = new XMLHttpRequest();
@@ -4,6 +4,21 @@ if [ $# -eq 0 ]; then
     exit 1
 fi
 
+# With "online" as second argument the program is built as a shared object
+# on core/online instead of a new runtime, so the running runtime can swap it
+# in (online change). core/online/latest holds the path of the last one built
+ONLINE_CHANGE=0
+if [ "$2" = "online" ]; then
+    ONLINE_CHANGE=1
+fi
+
+# With scripts/build_host naming a build host the program is compiled there
+# and the signed result installed here (remote_build.sh). The build host
+# runs this script with OPENPLC_BUILD_JOB set
+if [ -z "$OPENPLC_BUILD_JOB" ] && [ -s "$(dirname "$0")/build_host" ]; then
+    exec "$(dirname "$0")/remote_build.sh" "$@"
+fi
+
 #move into the scripts folder if you're not there already
 cd scripts &>/dev/null
 
@@ -16,8 +31,57 @@ echo "$1" > ../active_program
 
 #compiling the ST file into C
 cd ..
+# With scripts/event_rungs holding "true" the ladder rungs are evaluated only
+# when the variables they use change (st_optimizer -e). The rewritten program
+# goes to st_files/<program>.evt, the uploaded one is kept as it is
+ST_FILE=./st_files/"$1"
+if [ "$(cat scripts/event_rungs 2>/dev/null)" = "true" ] && [ -x ./st_optimizer ]; then
+    echo "Making the rungs event driven..."
+    if ./st_optimizer -e ./st_files/"$1" ./st_files/"$1".evt; then
+        ST_FILE=./st_files/"$1".evt
+    else
+        echo "Warning: st_optimizer failed, compiling the program as uploaded"
+    fi
+fi
+# With scripts/pou_units holding "true" iec2c places the code of every POU on
+# its own translation unit (POUS_<pou>.c, stage4 option u) instead of POUS.c.
+# The units are compiled in parallel and cached (compile_pou_units), so an
+# upload only recompiles the POUs that changed
+IEC2C_OPTIONS=""
+STAGE4_OPTIONS=""
+if [ "$(cat scripts/pou_units 2>/dev/null)" = "true" ]; then
+    STAGE4_OPTIONS="u"
+fi
+# With scripts/parallel_programs holding "true" the resource hands its
+# programs to the runtime (stage4 option t), which runs the parallel groups
+# of programs.cfg on worker threads
+if [ "$(cat scripts/parallel_programs 2>/dev/null)" = "true" ]; then
+    STAGE4_OPTIONS="${STAGE4_OPTIONS:+$STAGE4_OPTIONS,}t"
+fi
+# With scripts/pou_profiling holding "true" the body of every program and
+# function block is timed (stage4 option f), see pou_profile()
+if [ "$(cat scripts/pou_profiling 2>/dev/null)" = "true" ]; then
+    STAGE4_OPTIONS="${STAGE4_OPTIONS:+$STAGE4_OPTIONS,}f"
+fi
+# With scripts/st_line_profiling holding "true" the generated C carries #line
+# directives back to the lines of the ST file (stage4 option l) and is built
+# with line tables (-g1), so sample_profile() can tell the ST lines the scan
+# thread spends its time on
+ST_LINE_PROFILING=0
+if [ "$(cat scripts/st_line_profiling 2>/dev/null)" = "true" ]; then
+    ST_LINE_PROFILING=1
+    STAGE4_OPTIONS="${STAGE4_OPTIONS:+$STAGE4_OPTIONS,}l"
+fi
+if [ -n "$STAGE4_OPTIONS" ]; then
+    IEC2C_OPTIONS="-O $STAGE4_OPTIONS"
+fi
+# The library element names found when pre-parsing the standard library are
+# cached in core/.build_cache (iec2c -L), so the library is pre-parsed again
+# only when the files under lib/ or iec2c itself change
+mkdir -p ./core/.build_cache
+rm -f POUS_*.c
 echo "Generating C files..."
-./iec2c -f -l -p -r -R -a ./st_files/"$1"
+./iec2c -f -l -p -r -R -a -L ./core/.build_cache/ieclib.cache $IEC2C_OPTIONS "$ST_FILE"
 if [ $? -ne 0 ]; then
     echo "Error generating C files"
     echo "Compilation finished with errors!"
@@ -27,6 +91,9 @@ fi
 # stick reference to ethercat_src in there for CoE access etc functionality that needs to be accessed from PLC
 if [ "$ETHERCAT_OPT" = "ethercat" ]; then
     sed -i '7s/^/#include "ethercat_src.h" /' Res0.c
+    for unit in $(ls POUS_*.c 2>/dev/null); do
+        sed -i '1i #include "ethercat_src.h"' "$unit"
+    done
 fi
 
 # I prefer copying every time these two (small files) because could be useful to have a copy of them for testing
@@ -34,7 +101,8 @@ echo "Including Siemens S7 Protocol via snap7"
 cp -f ../utils/snap7_src/wrapper/oplc_snap7.* ./core
 
 echo "Moving Files..."
-mv -f POUS.c POUS.h LOCATED_VARIABLES.h VARIABLES.csv Config0.c Config0.h Res0.c ./core/
+rm -f ./core/POUS_*.c
+mv -f POUS.c POUS.h LOCATED_VARIABLES.h VARIABLES.csv Config0.c Config0.h Res0.c $(ls POUS_*.c 2>/dev/null) ./core/
 if [ $? -ne 0 ]; then
     echo "Error moving files"
     echo "Compilation finished with errors!"
@@ -61,32 +129,333 @@ fi
 
 echo "Using open62541 pkg-config: $OPEN62541_PC (version $(pkg-config --modversion "$OPEN62541_PC"))"
 
+# Build profile, selected on scripts/build_profile (debug when missing):
+#   debug       no optimization, the historical build
+#   release     -O2 tuned for the build machine, with LTO across the program
+#               (POUS, Res0, glueVars) and the runtime
+#   pgo-record  release build instrumented to record a profile of the scan
+#               on core/pgo. Run the program for a while, then stop it
+#   pgo         release build optimized with the profile recorded on core/pgo
+#   small       release build for boards with little memory: optimized for
+#               size, and the runtime reserves smaller logs, queues and
+#               diagnostic buffers (OPLC_LOW_MEMORY). No huge pages
+# The release profiles build the program with direct access to its variables
+# (OPLC_DIRECT_ACCESS on lib/accessor.h): the accessors don't check the force
+# flags and the runtime writes the forced values over the variables instead.
+# They also do the TIME arithmetic on 64 bit nanoseconds (OPLC_TIME_NS on
+# lib/iec_std_lib.h), which is exact for literals and integer factors.
+# On Linux they put the I/O and memory images on huge pages (OPLC_HUGE_PAGES),
+# except small.
+# The profile and flags used are written to core/openplc.build
+BUILD_PROFILE=$(cat scripts/build_profile 2>/dev/null)
+if [ -z "$BUILD_PROFILE" ]; then
+    BUILD_PROFILE="debug"
+fi
+case "$(uname -m)" in
+    x86_64|i?86) ARCH_FLAGS="-march=native" ;;
+    arm*|aarch64) ARCH_FLAGS="-mcpu=native" ;;
+    *) ARCH_FLAGS="" ;;
+esac
+if [ "$OPENPLC_PLATFORM" = "win" ]; then
+    ARCH_FLAGS=""
+fi
+# A build host compiling for another platform keeps its cross toolchain on
+# scripts/toolchain_<platform>, a shell fragment that puts a g++ for the
+# target first on PATH, points pkg-config to the sysroot
+# (PKG_CONFIG_SYSROOT_DIR, PKG_CONFIG_LIBDIR) and sets the ARCH_FLAGS of
+# the target CPU
+if [ -f "scripts/toolchain_$OPENPLC_PLATFORM" ]; then
+    echo "Using the toolchain of scripts/toolchain_$OPENPLC_PLATFORM"
+    . "scripts/toolchain_$OPENPLC_PLATFORM"
+fi
+PGO_DIR="$(pwd)/../core/pgo"
+case "$BUILD_PROFILE" in
+    debug)
+        PROFILE_OPT=""
+        PROFILE_FLAGS=""
+        ;;
+    release)
+        PROFILE_OPT="-O2 $ARCH_FLAGS"
+        PROFILE_FLAGS="$PROFILE_OPT -flto -DOPLC_DIRECT_ACCESS -DOPLC_TIME_NS"
+        ;;
+    pgo-record)
+        rm -rf "$PGO_DIR"
+        PROFILE_OPT="-O2 $ARCH_FLAGS"
+        PROFILE_FLAGS="$PROFILE_OPT -flto -fprofile-generate -fprofile-update=atomic -fprofile-dir=$PGO_DIR -DOPLC_DIRECT_ACCESS -DOPLC_TIME_NS"
+        ;;
+    pgo)
+        if [ ! -d "$PGO_DIR" ]; then
+            echo "Error: no profile recorded on core/pgo, build with the pgo-record profile first"
+            echo "Compilation finished with errors!"
+            exit 1
+        fi
+        PROFILE_OPT="-O2 $ARCH_FLAGS"
+        PROFILE_FLAGS="$PROFILE_OPT -flto -fprofile-use -fprofile-partial-training -fprofile-correction -fprofile-dir=$PGO_DIR -DOPLC_DIRECT_ACCESS -DOPLC_TIME_NS"
+        ;;
+    small)
+        PROFILE_OPT="-Os $ARCH_FLAGS"
+        PROFILE_FLAGS="$PROFILE_OPT -flto -DOPLC_DIRECT_ACCESS -DOPLC_TIME_NS -DOPLC_LOW_MEMORY"
+        ;;
+    *)
+        echo "Error: unknown build profile '$BUILD_PROFILE'"
+        echo "Compilation finished with errors!"
+        exit 1
+        ;;
+esac
+if [ "$BUILD_PROFILE" != "debug" ] && [ "$BUILD_PROFILE" != "small" ] && [ "$(uname -s)" = "Linux" ]; then
+    PROFILE_FLAGS="$PROFILE_FLAGS -DOPLC_HUGE_PAGES"
+fi
+if [ "$ST_LINE_PROFILING" = "1" ]; then
+    PROFILE_FLAGS="$PROFILE_FLAGS -g1"
+fi
+# With scripts/fixed_real holding "true" REAL is a Q15.16 fixed point number
+# instead of a float (core/lib/iec_fixed.h), for the targets without a
+# floating point unit. A number sets the fraction bits instead of 16
+FIXED_REAL="$(cat scripts/fixed_real 2>/dev/null)"
+if [ "$FIXED_REAL" = "true" ]; then
+    PROFILE_FLAGS="$PROFILE_FLAGS -DOPLC_FIXED_REAL"
+elif [ -n "$FIXED_REAL" ] && [ "$FIXED_REAL" -ge 1 ] 2>/dev/null && [ "$FIXED_REAL" -le 30 ]; then
+    PROFILE_FLAGS="$PROFILE_FLAGS -DOPLC_FIXED_REAL -DOPLC_FIXED_FRAC_BITS=$FIXED_REAL"
+fi
+if [ "$ONLINE_CHANGE" = "1" ]; then
+    if [ "$OPENPLC_PLATFORM" = "win" ]; then
+        echo "Error: online changes are not supported on Windows"
+        echo "Compilation finished with errors!"
+        exit 1
+    fi
+    PROFILE_FLAGS="$PROFILE_FLAGS -fPIC"
+fi
+echo "Build profile: $BUILD_PROFILE $PROFILE_FLAGS"
+
+record_build_profile() {
+    printf 'profile=%s\nflags=%s\nprogram=%s\ndate=%s\n' "$BUILD_PROFILE" "$PROFILE_FLAGS" "$(cat ../active_program)" "$(date -u +%Y-%m-%dT%H:%M:%SZ)" > openplc.build
+}
+
+# The runtime sources are compiled one by one into core/.build_cache, keyed
+# by a hash of the compiler version, the flags and the preprocessed source,
+# so an upload only recompiles what changed (usually glueVars and debug.cpp).
+# Each source is compiled under a fixed name in .build_cache/obj first, which
+# keeps the names of the PGO profiles stable across profiles.
+# RUNTIME_ARGS holds the flags and libraries of the platform. The runtime
+# exports its symbols, so the programs loaded by an online change use its
+# buffers and process image.
+build_runtime() {
+    if [ "$ONLINE_CHANGE" = "1" ]; then
+        build_online_program
+        return $?
+    fi
+    mkdir -p .build_cache/obj
+    local compiler
+    compiler=$(g++ -dumpfullversion -dumpversion 2>/dev/null)
+    local profile_hash=""
+    if [ "$BUILD_PROFILE" = "pgo" ]; then
+        profile_hash=$(cat "$PGO_DIR"/* 2>/dev/null | sha256sum | cut -c1-16)
+    fi
+    local objects=""
+    local pids=""
+    local src
+    for src in *.cpp; do
+        local key
+        key=$( (echo "$compiler $profile_hash $RUNTIME_ARGS"; g++ -E "$src" $RUNTIME_ARGS 2>/dev/null) | sha256sum | cut -c1-32)
+        local obj=".build_cache/$key.o"
+        objects="$objects $obj"
+        if [ ! -f "$obj" ]; then
+            echo "Compiling $src"
+            local tmp=".build_cache/obj/${src%.cpp}.o"
+            (g++ -c "$src" -o "$tmp" $RUNTIME_ARGS && mv -f "$tmp" "$obj") &
+            pids="$pids $!"
+        fi
+    done
+    local failed=0
+    local pid
+    for pid in $pids; do
+        wait $pid || failed=1
+    done
+    if [ $failed -ne 0 ]; then
+        return 1
+    fi
+
+    # Objects not used by this build for a week are dropped
+    find .build_cache -maxdepth 1 -name '*.o' -mtime +7 -delete 2>/dev/null
+    touch $objects
+    local export_flags="-rdynamic -ldl"
+    if [ "$OPENPLC_PLATFORM" = "win" ]; then
+        export_flags=""
+    fi
+    g++ $objects *.o $POU_OBJECTS -o openplc $RUNTIME_ARGS $export_flags
+}
+
+# Builds the program (Config0, Res0, glueVars, debug and the C blocks) as a
+# shared object for an online change. Its own symbols are bound inside the
+# object, the buffers and images are the ones of the running runtime.
+build_online_program() {
+    mkdir -p online
+    local program
+    program="$(pwd)/online/program_$(date +%Y%m%d%H%M%S).so"
+    local sources="glueVars.cpp debug.cpp"
+    if [ -f c_blocks_code.cpp ]; then
+        sources="$sources c_blocks_code.cpp"
+    fi
+    g++ -shared -Wl,-Bsymbolic -DOPLC_ONLINE_PROGRAM $sources Config0.o Res0.o $POU_OBJECTS -o "$program" $RUNTIME_ARGS
+    if [ $? -ne 0 ]; then
+        return 1
+    fi
+    echo "$program" > online/latest
+    find online -name 'program_*.so' -mtime +7 -delete 2>/dev/null
+    return 0
+}
+
+# Compiles the POUs that iec2c placed on their own units (scripts/pou_units)
+# with the flags given, the ones of Res0.c. Like the runtime sources, they
+# are compiled in parallel into core/.build_cache/pous, keyed by a hash of the
+# compiler version, the flags and the preprocessed unit. POUS.h only changes
+# with the declarations of the POUs, so editing the code of a POU recompiles
+# that POU alone. POU_OBJECTS lists the objects to link
+POU_OBJECTS=""
+compile_pou_units() {
+    POU_OBJECTS=""
+    if ! ls POUS_*.c >/dev/null 2>&1; then
+        return 0
+    fi
+    mkdir -p .build_cache/pous/obj
+    local compiler
+    compiler=$(g++ -dumpfullversion -dumpversion 2>/dev/null)
+    local profile_hash=""
+    if [ "$BUILD_PROFILE" = "pgo" ]; then
+        profile_hash=$(cat "$PGO_DIR"/* 2>/dev/null | sha256sum | cut -c1-16)
+    fi
+    local pids=""
+    local unit
+    for unit in POUS_*.c; do
+        local key
+        key=$( (echo "$compiler $profile_hash $*"; g++ -E "$unit" "$@" 2>/dev/null) | sha256sum | cut -c1-32)
+        local obj=".build_cache/pous/$key.o"
+        POU_OBJECTS="$POU_OBJECTS $obj"
+        if [ ! -f "$obj" ]; then
+            echo "Compiling $unit"
+            local tmp=".build_cache/pous/obj/${unit%.c}.o"
+            (g++ -c "$unit" -o "$tmp" "$@" && mv -f "$tmp" "$obj") &
+            pids="$pids $!"
+        fi
+    done
+    local failed=0
+    local pid
+    for pid in $pids; do
+        wait $pid || failed=1
+    done
+    if [ $failed -ne 0 ]; then
+        return 1
+    fi
+
+    find .build_cache/pous -maxdepth 1 -name '*.o' -mtime +7 -delete 2>/dev/null
+    touch $POU_OBJECTS
+    return 0
+}
+
+# Additional hardware layers, listed on scripts/hardware_drivers, are built as
+# drivers linked next to the main hardware layer. Each line names a layer of
+# core/hardware_layers and the addresses bound to it, e.g.:
+#   simulink %IX100.0-%IX101.7,%QX100.0-%QX101.7,%IW100-%IW107,%QW100-%QW107
+# The layer is compiled with its I/O tables and bufferLock renamed to the
+# private ones of core/hardware_driver.h, and every symbol it defines is made
+# local, so it can't clash with the main layer or with other drivers.
+compile_hardware_drivers() {
+    rm -f hw_driver_*.o
+    if [ ! -f ../scripts/hardware_drivers ]; then
+        return 0
+    fi
+    local renames=""
+    for table in bool_input bool_output byte_input byte_output int_input int_output \
+                 dint_input dint_output lint_input lint_output bufferLock; do
+        renames="$renames -D$table=driver_$table"
+    done
+    while read -r driver ranges; do
+        if [ -z "$driver" ] || [ "${driver:0:1}" = "#" ]; then
+            continue
+        fi
+        echo "Compiling hardware driver $driver"
+        printf '#include "hardware_layers/%s.cpp"\n#include "hardware_driver.h"\n' "$driver" | \
+            g++ -std=gnu++11 -x c++ - -c -o "hw_driver_$driver.o" -I . -I ./lib -fpermissive -w $PROFILE_OPT $renames \
+                -DHARDWARE_DRIVER_NAME="\"$driver\"" -DHARDWARE_DRIVER_RANGES="\"$ranges\""
+        if [ $? -ne 0 ]; then
+            return 1
+        fi
+        nm --defined-only -g "hw_driver_$driver.o" | awk '$2 != "W" && $2 != "V" && $2 != "u" { print $3 }' > hw_driver_symbols
+        objcopy --localize-symbols=hw_driver_symbols "hw_driver_$driver.o"
+        if [ $? -ne 0 ]; then
+            return 1
+        fi
+    done < ../scripts/hardware_drivers
+    rm -f hw_driver_symbols
+    return 0
+}
+
+# The I/O and memory images are sized by glue_generator for the located
+# variables of the program, leaving the number of entries on
+# scripts/image_headroom free after the highest one used (none when missing).
+# They never get smaller than 1024 entries. The size is written to
+# core/image_size.h, which every runtime source includes, so glueVars is
+# generated before anything else is compiled. A program built for an online
+# change keeps the size of the running runtime.
+generate_glue_vars() {
+    local options
+    if [ "$ONLINE_CHANGE" = "1" ]; then
+        local size
+        size=$(tr -d '\r' 2>/dev/null < image_size.h | awk '$1 == "#define" && $2 == "BUFFER_SIZE" { print $3 }')
+        options="--image-size ${size:-1024}"
+    else
+        local headroom
+        headroom=$(cat ../scripts/image_headroom 2>/dev/null)
+        options="--headroom ${headroom:-0}"
+    fi
+    echo "Generating glueVars..."
+    ./glue_generator $options
+}
+
 #compiling for each platform
 cd core
+generate_glue_vars
+if [ $? -ne 0 ]; then
+    echo "Error generating glueVars"
+    echo "Compilation finished with errors!"
+    exit 1
+fi
+compile_hardware_drivers
+if [ $? -ne 0 ]; then
+    echo "Error compiling hardware drivers"
+    echo "Compilation finished with errors!"
+    exit 1
+fi
 if [ "$OPENPLC_PLATFORM" = "win" ]; then
     echo "Compiling for Windows"
     echo "Generating object files..."
-    g++ -I ./lib -c Config0.c -w
+    g++ -I ./lib -c Config0.c -w $PROFILE_FLAGS
     if [ $? -ne 0 ]; then
         echo "Error compiling C files"
         echo "Compilation finished with errors!"
         exit 1
     fi
-    g++ -I ./lib -c Res0.c -w
+    g++ -I ./lib -c Res0.c -w $PROFILE_FLAGS
+    if [ $? -ne 0 ]; then
+        echo "Error compiling C files"
+        echo "Compilation finished with errors!"
+        exit 1
+    fi
+    compile_pou_units -I ./lib -w $PROFILE_FLAGS
     if [ $? -ne 0 ]; then
         echo "Error compiling C files"
         echo "Compilation finished with errors!"
         exit 1
     fi
-    echo "Generating glueVars..."
-    ./glue_generator
     echo "Compiling main program..."
-    g++ *.cpp *.o -o openplc -I ./lib -pthread -fpermissive -I /usr/local/include/modbus -L /usr/local/lib snap7.lib -lmodbus `pkg-config --cflags --libs "$OPEN62541_PC"` -w 
+    RUNTIME_ARGS="-I ./lib -pthread -fpermissive -I /usr/local/include/modbus -L /usr/local/lib snap7.lib -lmodbus `pkg-config --cflags --libs "$OPEN62541_PC"` -w $PROFILE_FLAGS"
+    build_runtime
     if [ $? -ne 0 ]; then
         echo "Error compiling C files"
         echo "Compilation finished with errors!"
         exit 1
     fi
+    record_build_profile
     echo "Compilation finished successfully!"
     exit 0
     
@@ -94,9 +463,9 @@ elif [ "$OPENPLC_PLATFORM" = "linux" ]; then
     echo "Compiling for Linux"
     echo "Generating object files..."
     if [ "$OPENPLC_DRIVER" = "sl_rp4" ]; then
-        g++ -std=gnu++11 -I ./lib -c Config0.c -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal -w -DSL_RP4
+        g++ -std=gnu++11 -I ./lib -c Config0.c -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal -w -DSL_RP4 $PROFILE_FLAGS
     else
-        g++ -std=gnu++11 -I ./lib -c Config0.c -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal -w
+        g++ -std=gnu++11 -I ./lib -c Config0.c -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal -w $PROFILE_FLAGS
     fi
     if [ $? -ne 0 ]; then
         echo "Error compiling C files"
@@ -104,28 +473,38 @@ elif [ "$OPENPLC_PLATFORM" = "linux" ]; then
         exit 1
     fi
     if [ "$OPENPLC_DRIVER" = "sl_rp4" ]; then
-        g++ -std=gnu++11 -I ./lib -c Res0.c -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal -w $ETHERCAT_INC -DSL_RP4
+        g++ -std=gnu++11 -I ./lib -c Res0.c -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal -w $ETHERCAT_INC -DSL_RP4 $PROFILE_FLAGS
     else
-        g++ -std=gnu++11 -I ./lib -c Res0.c -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal -w $ETHERCAT_INC 
+        g++ -std=gnu++11 -I ./lib -c Res0.c -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal -w $ETHERCAT_INC $PROFILE_FLAGS
+    fi
+    if [ $? -ne 0 ]; then
+        echo "Error compiling C files"
+        echo "Compilation finished with errors!"
+        exit 1
+    fi
+    if [ "$OPENPLC_DRIVER" = "sl_rp4" ]; then
+        compile_pou_units -std=gnu++11 -I ./lib -w $ETHERCAT_INC -DSL_RP4 $PROFILE_FLAGS
+    else
+        compile_pou_units -std=gnu++11 -I ./lib -w $ETHERCAT_INC $PROFILE_FLAGS
     fi
     if [ $? -ne 0 ]; then
         echo "Error compiling C files"
         echo "Compilation finished with errors!"
         exit 1
     fi
-    echo "Generating glueVars..."
-    ./glue_generator
     echo "Compiling main program..."
     if [ "$OPENPLC_DRIVER" = "sl_rp4" ]; then
-        g++ -std=gnu++11 *.cpp *.o -o openplc -I ./lib -pthread -lrt -fpermissive `pkg-config --cflags --libs libmodbus` -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal `pkg-config --cflags --libs "$OPEN62541_PC"` -w $ETHERCAT_INC -DSL_RP4
+        RUNTIME_ARGS="-std=gnu++11 -I ./lib -pthread -lrt -fpermissive `pkg-config --cflags --libs libmodbus` -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal `pkg-config --cflags --libs "$OPEN62541_PC"` -w $ETHERCAT_INC -DSL_RP4 $PROFILE_FLAGS"
     else
-        g++ -std=gnu++11 *.cpp *.o -o openplc -I ./lib -pthread -lrt -fpermissive `pkg-config --cflags --libs libmodbus` -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal `pkg-config --cflags --libs "$OPEN62541_PC"` -w $ETHERCAT_INC 
+        RUNTIME_ARGS="-std=gnu++11 -I ./lib -pthread -lrt -fpermissive `pkg-config --cflags --libs libmodbus` -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal `pkg-config --cflags --libs "$OPEN62541_PC"` -w $ETHERCAT_INC $PROFILE_FLAGS"
     fi
+    build_runtime
     if [ $? -ne 0 ]; then
         echo "Error compiling C files"
         echo "Compilation finished with errors!"
         exit 1
     fi
+    record_build_profile
     echo "Compilation finished successfully!"
     exit 0
     
@@ -133,9 +512,9 @@ elif [ "$OPENPLC_PLATFORM" = "rpi" ]; then
     echo "Compiling for Raspberry Pi"
     echo "Generating object files..."
     if [ "$OPENPLC_DRIVER" = "sequent" ]; then
-        g++ -std=gnu++11 -I ./lib -c Config0.c -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal -w -DSEQUENT
+        g++ -std=gnu++11 -I ./lib -c Config0.c -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal -w -DSEQUENT $PROFILE_FLAGS
     else
-        g++ -std=gnu++11 -I ./lib -c Config0.c -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal -w
+        g++ -std=gnu++11 -I ./lib -c Config0.c -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal -w $PROFILE_FLAGS
     fi
     if [ $? -ne 0 ]; then
         echo "Error compiling C files"
@@ -143,28 +522,38 @@ elif [ "$OPENPLC_PLATFORM" = "rpi" ]; then
         exit 1
     fi
     if [ "$OPENPLC_DRIVER" = "sequent" ]; then
-        g++ -std=gnu++11 -I ./lib -c Res0.c -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal -w -DSEQUENT
+        g++ -std=gnu++11 -I ./lib -c Res0.c -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal -w -DSEQUENT $PROFILE_FLAGS
     else
-        g++ -std=gnu++11 -I ./lib -c Res0.c -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal -w
+        g++ -std=gnu++11 -I ./lib -c Res0.c -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal -w $PROFILE_FLAGS
+    fi
+    if [ $? -ne 0 ]; then
+        echo "Error compiling C files"
+        echo "Compilation finished with errors!"
+        exit 1
+    fi
+    if [ "$OPENPLC_DRIVER" = "sequent" ]; then
+        compile_pou_units -std=gnu++11 -I ./lib -w -DSEQUENT $PROFILE_FLAGS
+    else
+        compile_pou_units -std=gnu++11 -I ./lib -w $PROFILE_FLAGS
     fi
     if [ $? -ne 0 ]; then
         echo "Error compiling C files"
         echo "Compilation finished with errors!"
         exit 1
     fi
-    echo "Generating glueVars..."
-    ./glue_generator
     echo "Compiling main program..."
     if [ "$OPENPLC_DRIVER" = "sequent" ]; then
-        g++ -DSEQUENT -std=gnu++11 *.cpp *.o -o openplc -I ./lib -lrt -lwiringPi -lpthread -fpermissive `pkg-config --cflags --libs libmodbus` -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal `pkg-config --cflags --libs "$OPEN62541_PC"` -w 
+        RUNTIME_ARGS="-DSEQUENT -std=gnu++11 -I ./lib -lrt -lwiringPi -lpthread -fpermissive `pkg-config --cflags --libs libmodbus` -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal `pkg-config --cflags --libs "$OPEN62541_PC"` -w $PROFILE_FLAGS"
     else
-        g++ -std=gnu++11 *.cpp *.o -o openplc -I ./lib -lrt -lwiringPi -lpthread -fpermissive `pkg-config --cflags --libs libmodbus` -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal `pkg-config --cflags --libs "$OPEN62541_PC"` -w
+        RUNTIME_ARGS="-std=gnu++11 -I ./lib -lrt -lwiringPi -lpthread -fpermissive `pkg-config --cflags --libs libmodbus` -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal `pkg-config --cflags --libs "$OPEN62541_PC"` -w $PROFILE_FLAGS"
     fi
+    build_runtime
     if [ $? -ne 0 ]; then
         echo "Error compiling C files"
         echo "Compilation finished with errors!"
         exit 1
     fi
+    record_build_profile
     echo "Compilation finished successfully!"
     exit 0
 
@@ -172,27 +561,33 @@ elif [ "$OPENPLC_PLATFORM" = "opi" ]; then
     WIRINGOP_INC="-I/usr/local/include -L/usr/local/lib -lwiringPi -lwiringPiDev"
     echo "Compiling for Orange Pi"
     echo "Generating object files..."
-    g++ -std=gnu++11 -I ./lib -c Config0.c -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal -w $WIRINGOP_INC
+    g++ -std=gnu++11 -I ./lib -c Config0.c -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal -w $WIRINGOP_INC $PROFILE_FLAGS
     if [ $? -ne 0 ]; then
         echo "Error compiling C files"
         echo "Compilation finished with errors!"
         exit 1
     fi
-    g++ -std=gnu++11 -I ./lib -c Res0.c -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal -w $WIRINGOP_INC
+    g++ -std=gnu++11 -I ./lib -c Res0.c -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal -w $WIRINGOP_INC $PROFILE_FLAGS
+    if [ $? -ne 0 ]; then
+        echo "Error compiling C files"
+        echo "Compilation finished with errors!"
+        exit 1
+    fi
+    compile_pou_units -std=gnu++11 -I ./lib -w $WIRINGOP_INC $PROFILE_FLAGS
     if [ $? -ne 0 ]; then
         echo "Error compiling C files"
         echo "Compilation finished with errors!"
         exit 1
     fi
-    echo "Generating glueVars..."
-    ./glue_generator
     echo "Compiling main program..."
-    g++ -std=gnu++11 *.cpp *.o -o openplc -I ./lib -lrt -lpthread -fpermissive `pkg-config --cflags --libs libmodbus` -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal `pkg-config --cflags --libs "$OPEN62541_PC"` -w $WIRINGOP_INC
+    RUNTIME_ARGS="-std=gnu++11 -I ./lib -lrt -lpthread -fpermissive `pkg-config --cflags --libs libmodbus` -lsnap7 -lasiodnp3 -lasiopal -lopendnp3 -lopenpal `pkg-config --cflags --libs "$OPEN62541_PC"` -w $WIRINGOP_INC $PROFILE_FLAGS"
+    build_runtime
     if [ $? -ne 0 ]; then
         echo "Error compiling C files"
         echo "Compilation finished with errors!"
         exit 1
     fi
+    record_build_profile
     echo "Compilation finished successfully!"
     exit 0
 
@@ -0,0 +1,173 @@
+#!/bin/bash
+# Compiles the program on a build host instead of the PLC.
+#
+# scripts/build_host names the build host, on its first line:
+#   builder@10.0.0.9:/opt/OpenPLC_v3/webserver    over ssh (keys, no password)
+#   container:openplc-rpi:/opt/OpenPLC_v3/webserver    on a local container
+# The path is the webserver folder of an OpenPLC checkout of the same
+# version, installed on the build host. Use one checkout per PLC: its
+# core/.build_cache keeps the objects of the previous builds, so the
+# uploads stay incremental.
+#
+# The PLC sends its core sources (with the debug and C block files of the
+# upload), the ST file and the build options of scripts/, and the build
+# host runs compile_program.sh on them. For another platform than its own,
+# the build host keeps the cross toolchain and sysroot of the platform on
+# scripts/toolchain_<platform>, which compile_program.sh sources.
+#
+# The build host signs a manifest of the files it returns with
+# scripts/build_host.key (openssl, RSA or EC key) and the PLC only installs
+# them once the signature checks against scripts/build_host.pub. A PLC
+# with no public key refuses the build.
+#
+# The pgo profiles record their profile on a path of the build host and
+# are built locally.
+#
+# Usage, on the PLC:     remote_build.sh <program> [online]
+#        on the host:    remote_build.sh --build <program> [online]
+
+# Build options sent to the build host. The ones missing on the PLC are
+# removed on the build host too
+OPTION_FILES="openplc_platform openplc_driver ethercat build_profile event_rungs pou_units \
+parallel_programs pou_profiling st_line_profiling fixed_real image_headroom hardware_drivers"
+
+# Files of core/ returned by the build, besides the runtime or the online
+# program
+RESULT_FILES="openplc.build image_size.h glueVars.cpp VARIABLES.csv LOCATED_VARIABLES.h \
+POUS.c POUS.h Config0.c Config0.h Res0.c"
+
+cd "$(dirname "$0")/.." || exit 1
+
+fail() {
+    echo "Error: $1"
+    echo "Compilation finished with errors!"
+    exit 1
+}
+
+# Runs on the build host: takes the sources on stdin, builds, and writes the
+# signed result on stdout. The log of the build goes to stderr
+build_job() {
+    local program="$1"
+    local online="$2"
+
+    exec 9>.remote_build.lock
+    flock 9
+
+    local option
+    for option in $OPTION_FILES; do
+        rm -f "scripts/$option"
+    done
+    rm -f core/POUS_*.c
+    tar xzf - || { echo "Error: can't unpack the sources" >&2; exit 1; }
+
+    OPENPLC_BUILD_JOB=1 ./scripts/compile_program.sh "$program" $online 1>&2
+    if [ $? -ne 0 ]; then
+        exit 1
+    fi
+
+    cd core || exit 1
+    local files=""
+    local file
+    for file in $RESULT_FILES $(ls POUS_*.c 2>/dev/null); do
+        [ -f "$file" ] && files="$files $file"
+    done
+    if [ "$online" = "online" ]; then
+        files="$files online/$(basename "$(cat online/latest)")"
+    else
+        files="$files openplc"
+    fi
+    sha256sum $files > remote_build.manifest
+    openssl dgst -sha256 -sign ../scripts/build_host.key -out remote_build.sig remote_build.manifest 1>&2
+    if [ $? -ne 0 ]; then
+        echo "Error: can't sign the build with scripts/build_host.key" >&2
+        exit 1
+    fi
+    tar czf - $files remote_build.manifest remote_build.sig
+}
+
+if [ "$1" = "--build" ]; then
+    build_job "$2" "$3"
+    exit $?
+fi
+
+# On the PLC
+PROGRAM="$1"
+ONLINE=""
+if [ "$2" = "online" ]; then
+    ONLINE="online"
+fi
+
+TARGET=$(head -n 1 scripts/build_host | tr -d '\r')
+if [ "${TARGET%%:*}" = "container" ]; then
+    TARGET=${TARGET#container:}
+    CONTAINER=${TARGET%%:*}
+else
+    CONTAINER=""
+fi
+HOST=${TARGET%%:*}
+REMOTE_DIR=${TARGET#*:}
+if [ -z "$HOST" ] || [ "$REMOTE_DIR" = "$TARGET" ]; then
+    fail "scripts/build_host must hold host:path"
+fi
+if [ ! -f scripts/build_host.pub ]; then
+    fail "no scripts/build_host.pub to check the builds of $HOST"
+fi
+case "$(cat scripts/build_profile 2>/dev/null)" in
+    pgo|pgo-record)
+        fail "the pgo profiles can't be built on a build host, remove scripts/build_host"
+        ;;
+esac
+
+remote_exec() {
+    if [ -n "$CONTAINER" ]; then
+        docker exec -i "$CONTAINER" bash -c "$1"
+    else
+        ssh -o BatchMode=yes "$HOST" "$1"
+    fi
+}
+
+echo "$PROGRAM" > active_program
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+options=""
+for option in $OPTION_FILES; do
+    [ -f "scripts/$option" ] && options="$options scripts/$option"
+done
+tar czf "$WORK/sources.tgz" --exclude='core/.build_cache' --exclude='core/online' --exclude='core/pgo' \
+    --exclude='core/openplc' --exclude='*.o' core "st_files/$PROGRAM" $options
+if [ $? -ne 0 ]; then
+    fail "can't pack the sources"
+fi
+
+# The log is shown as the build goes. Its last line is renamed, the build
+# only finished once the result is installed
+echo "Compiling on build host $HOST..."
+remote_exec "cd '$REMOTE_DIR' && ./scripts/remote_build.sh --build '$PROGRAM' $ONLINE" < "$WORK/sources.tgz" 2>&1 >"$WORK/result.tgz" | \
+    sed -u 's/^Compilation finished/Build host: compilation finished/'
+if [ "${PIPESTATUS[0]}" -ne 0 ]; then
+    fail "the build failed on $HOST"
+fi
+
+mkdir -p "$WORK/result"
+tar xzf "$WORK/result.tgz" -C "$WORK/result" || fail "can't unpack the build of $HOST"
+openssl dgst -sha256 -verify scripts/build_host.pub -signature "$WORK/result/remote_build.sig" \
+    "$WORK/result/remote_build.manifest" >/dev/null 2>&1 || fail "the build of $HOST has a bad signature"
+(cd "$WORK/result" && sha256sum -c --quiet remote_build.manifest) || fail "the build of $HOST doesn't match its manifest"
+
+# Only the files of the manifest are installed, and only under core/
+echo "Installing the build..."
+while read -r hash file; do
+    case "$file" in
+        ""|/*|*..*) fail "the build of $HOST names a bad file: $file" ;;
+    esac
+    mkdir -p "core/$(dirname "$file")"
+    mv -f "$WORK/result/$file" "core/$file" || fail "can't install $file"
+    if [ -n "$ONLINE" ] && [ "${file#online/}" != "$file" ]; then
+        echo "$(pwd)/core/$file" > core/online/latest
+    fi
+done < "$WORK/result/remote_build.manifest"
+echo "host=$HOST" >> core/openplc.build
+
+echo "Compilation finished successfully!"
+exit 0
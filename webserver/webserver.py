@@ -16,8 +16,10 @@ import socket
 import mimetypes
 import ssl
 import threading
+import collections
 import logging
 import errno
+import re
 
 import flask
 import flask_login
@@ -42,6 +44,38 @@ logging.basicConfig(
 
 openplc_runtime = openplc.runtime()
 
+# Runtime log records fetched so far. Only the records after the cursor are
+# requested from the runtime on every refresh
+RUNTIME_LOG_LINES = 4096
+runtime_log_lock = threading.Lock()
+runtime_log_lines = collections.deque(maxlen=RUNTIME_LOG_LINES)
+runtime_log_cursor = 0
+
+
+def runtime_logs_text():
+    global runtime_log_cursor
+    with runtime_log_lock:
+        for _ in range(16):
+            data = openplc_runtime.events(runtime_log_cursor)
+            lines = data.split('\n')
+            header = lines[0].split(' ')
+            if (len(header) != 2):
+                break
+            first_event, next_event = int(header[0]), int(header[1])
+            if (next_event < runtime_log_cursor):
+                # The runtime restarted, its records start again from 0
+                runtime_log_lines.clear()
+                runtime_log_cursor = 0
+                continue
+            for line in lines[1:]:
+                fields = line.split('\t', 7)
+                if (len(fields) == 8):
+                    runtime_log_lines.append(fields[7] + '\n')
+                    runtime_log_cursor = int(fields[0]) + 1
+            if (runtime_log_cursor >= next_event or first_event == next_event):
+                break
+        return ''.join(runtime_log_lines)
+
 from pathlib import Path
 BASE_DIR   = Path(__file__).parent
 CERT_FILE  = (BASE_DIR / "certOPENPLC.pem").resolve()
@@ -72,7 +106,7 @@ def restapi_callback_get(argument: str, data: dict) -> dict:
         return {"status": "STOP:OK"}
 
     elif argument == "runtime-logs":
-        logs = openplc_runtime.logs()
+        logs = runtime_logs_text()
         return {"runtime-logs": logs}
 
     elif argument == "compilation-status":
@@ -207,7 +241,7 @@ def restapi_callback_post(argument: str, data: dict) -> dict:
             
             # Call RPC method to start OPC UA server (same as HTTP implementation)
             print(f"Starting OPC UA server from REST API on port {port}...")
-            result = openplc_runtime.start_opcua(port)  # RPC call to start OPC UA server
+            result = openplc_runtime.start_opcua(port, opcua_tuning())  # RPC call to start OPC UA server
             
             if result:
                 print("OPC UA server started successfully")
@@ -308,6 +342,24 @@ def is_allowed_file(file):
     except Exception:
         return False
 
+def opcua_tuning():
+    """Returns the OPC UA server limits stored on the Opcua_tuning setting,
+    a list of key=value pairs such as "max_sessions=200,max_chunk_count=64"
+    """
+    conn = create_connection("openplc.db")
+    if (conn == None):
+        return ''
+    try:
+        cur = conn.cursor()
+        cur.execute("SELECT Value FROM Settings WHERE Key = 'Opcua_tuning'")
+        row = cur.fetchone()
+        cur.close()
+        conn.close()
+        # Only the characters of the key=value list reach the runtime
+        return re.sub(r'[^a-z0-9_=.,]', '', row[0]) if row and row[0] else ''
+    except Exception:
+        return ''
+
 def configure_runtime():
     global openplc_runtime
     database = "openplc.db"
@@ -321,6 +373,37 @@ def configure_runtime():
             cur.close()
             conn.close()
 
+            # Server modes must be set before the servers are started
+            for row in rows:
+                if (row[0] == "Opcua_data_source"):
+                    openplc_runtime.set_opcua_data_source(row[1] == "true")
+                elif (row[0] == "Opcua_scan_sampling"):
+                    if (row[1] != "disabled"):
+                        openplc_runtime.set_opcua_scan_sampling(int(row[1]))
+                    else:
+                        openplc_runtime.set_opcua_scan_sampling(0)
+                elif (row[0] == "Opcua_security"):
+                    # Only the characters of the key=value list and of the paths reach the runtime
+                    openplc_runtime.set_opcua_security(re.sub(r'[^A-Za-z0-9_=.,+/:-]', '', row[1] or ''))
+                elif (row[0] == "Modbus_response_cache"):
+                    openplc_runtime.set_modbus_response_cache(row[1] == "true")
+                elif (row[0] == "Pstorage_retain"):
+                    openplc_runtime.set_pstorage_retain(row[1] == "true")
+                elif (row[0] == "Scan_overrun_policy"):
+                    openplc_runtime.set_scan_overrun_policy(row[1])
+                elif (row[0] == "Scan_phase_order"):
+                    openplc_runtime.set_scan_phase_order(row[1])
+                elif (row[0] == "Load_shedding"):
+                    if (row[1] != "disabled"):
+                        openplc_runtime.set_load_shedding(int(row[1]))
+                    else:
+                        openplc_runtime.set_load_shedding(0)
+                elif (row[0] == "Scan_watchdog"):
+                    if (row[1] != "disabled"):
+                        openplc_runtime.set_scan_watchdog(int(row[1]))
+                    else:
+                        openplc_runtime.set_scan_watchdog(0)
+
             for row in rows:
                 if (row[0] == "Modbus_port"):
                     if (row[1] != "disabled"):
@@ -329,6 +412,18 @@ def configure_runtime():
                     else:
                         print("Disabling Modbus")
                         openplc_runtime.stop_modbus()
+                elif (row[0] == "Modbus_udp_port"):
+                    if (row[1] != "disabled"):
+                        print("Enabling Modbus/UDP on port " + str(int(row[1])))
+                        openplc_runtime.start_modbus_udp(int(row[1]))
+                    else:
+                        openplc_runtime.stop_modbus_udp()
+                elif (row[0] == "Modbus_rtu"):
+                    if (row[1] != "disabled"):
+                        print("Enabling Modbus RTU on " + str(row[1]))
+                        openplc_runtime.start_modbus_rtu(str(row[1]))
+                    else:
+                        openplc_runtime.stop_modbus_rtu()
                 elif (row[0] == "Dnp3_port"):
                     if (row[1] != "disabled"):
                         print("Enabling DNP3 on port " + str(int(row[1])))
@@ -346,7 +441,7 @@ def configure_runtime():
                 elif (row[0] == "Opcua_port"):
                     if (row[1] != "disabled"):
                         print("Enabling OPC UA on port " + str(int(row[1])))
-                        openplc_runtime.start_opcua(int(row[1]))
+                        openplc_runtime.start_opcua(int(row[1]), opcua_tuning())
                     else:
                         print("Disabling OPC UA")
                         openplc_runtime.stop_opcua()
@@ -357,6 +452,13 @@ def configure_runtime():
                     else:
                         print("Disabling S7 Protocol")
                         openplc_runtime.stop_snap7()
+                elif (row[0] == "Mqtt"):
+                    if (row[1] != "false"):
+                        print("Enabling MQTT")
+                        openplc_runtime.start_mqtt()
+                    else:
+                        print("Disabling MQTT")
+                        openplc_runtime.stop_mqtt()
                 elif (row[0] == "Pstorage_polling"):
                     if (row[1] != "disabled"):
                         print("Enabling Persistent Storage with polling rate of " + str(int(row[1])) + " seconds")
@@ -372,6 +474,12 @@ def configure_runtime():
 
 
 def delete_persistent_file():
+    # The journal and the retentive memory region live next to the real file,
+    # which may be behind a symlink
+    for suffix in (".journal", ".retain"):
+        path = os.path.realpath("persistent.file") + suffix
+        if (os.path.isfile(path)):
+            os.remove(path)
     if (os.path.isfile("persistent.file")):
         os.remove("persistent.file")
     print("persistent.file removed!")
@@ -394,14 +502,26 @@ def generate_mbconfig():
             rows = cur.fetchall()
             cur.close()
                     
+            slave_write_refresh = "0"
+            slave_sync_offset = "0"
+            slave_sync_deadline = "0"
             for row in rows:
                 if (row[0] == "Slave_polling"):
                     slave_polling = str(row[1])
                 elif (row[0] == "Slave_timeout"):
                     slave_timeout = str(row[1])
+                elif (row[0] == "Slave_write_refresh"):
+                    slave_write_refresh = str(row[1])
+                elif (row[0] == "Slave_sync_offset"):
+                    slave_sync_offset = str(row[1])
+                elif (row[0] == "Slave_sync_deadline"):
+                    slave_sync_deadline = str(row[1])
                     
             mbconfig += '\nPolling_Period = "' + slave_polling + '"'
             mbconfig += '\nTimeout = "' + slave_timeout + '"'
+            mbconfig += '\nWrite_Refresh_Period = "' + slave_write_refresh + '"'
+            mbconfig += '\nScan_Sync_Offset = "' + slave_sync_offset + '"'
+            mbconfig += '\nScan_Sync_Deadline = "' + slave_sync_deadline + '"'
             
             cur = conn.cursor()
             cur.execute("SELECT * FROM Slave_dev")
@@ -450,6 +570,10 @@ def generate_mbconfig():
                 device_counter += 1
                 
             with open('./mbconfig.cfg', 'w+') as f: f.write(mbconfig)
+
+            # a running runtime picks up the new device list without a restart
+            if (openplc_runtime.status() == "Running"):
+                openplc_runtime.reload_modbus_master()
             
         except Error as e:
             print("error connecting to the database" + str(e))
@@ -802,7 +926,7 @@ def start_opcua():
     else:
         try:
             print("Starting OPC UA server from web interface...")
-            result = openplc_runtime.start_opcua(4840)  # Default OPC UA port
+            result = openplc_runtime.start_opcua(4840, opcua_tuning())  # Default OPC UA port
             if result:
                 print("OPC UA server started successfully")
             else:
@@ -855,7 +979,7 @@ def runtime_logs():
     if (flask_login.current_user.is_authenticated == False):
         return flask.redirect(flask.url_for('login'))
     else:
-        return openplc_runtime.logs()
+        return runtime_logs_text()
 
 
 @app.route('/dashboard')
@@ -1032,7 +1156,10 @@ def reload_program():
                 return_str += "<label for='prog_descr'><b>Description</b></label><textarea type='text' rows='10' style='resize:vertical' id='prog_descr' name='program_descr' disabled>" + str(row[2]) + "</textarea>"
                 return_str += "<label for='prog_file'><b>File</b></label><input type='text' id='prog_file' name='program_file' value='" + str(row[3]) + "' disabled>"
                 return_str += "<label for='prog_date'><b>Date Uploaded</b></label><input type='text' id='prog_date' name='program_date' value='" + time.strftime('%b %d, %Y - %I:%M%p', time.localtime(row[4])) + "' disabled>"
-                return_str += "<br><br><center><a href='compile-program?file=" + str(row[3]) + "' class='button' style='width: 200px; height: 53px; margin: 0px 20px 0px 20px;'><b>Launch program</b></a><a href='update-program?id=" + str(prog_id) + "' class='button' style='width: 200px; height: 53px; margin: 0px 20px 0px 20px;'><b>Update program</b></a><a href='remove-program?id=" + str(prog_id) + "' class='button' style='width: 200px; height: 53px; margin: 0px 20px 0px 20px;'><b>Remove program</b></a></center>"
+                return_str += "<br><br><center><a href='compile-program?file=" + str(row[3]) + "' class='button' style='width: 200px; height: 53px; margin: 0px 20px 0px 20px;'><b>Launch program</b></a>"
+                if (openplc_runtime.status() == "Running"):
+                    return_str += "<a href='compile-program?file=" + str(row[3]) + "&online=true' class='button' style='width: 200px; height: 53px; margin: 0px 20px 0px 20px;'><b>Online change</b></a>"
+                return_str += "<a href='update-program?id=" + str(prog_id) + "' class='button' style='width: 200px; height: 53px; margin: 0px 20px 0px 20px;'><b>Update program</b></a><a href='remove-program?id=" + str(prog_id) + "' class='button' style='width: 200px; height: 53px; margin: 0px 20px 0px 20px;'><b>Remove program</b></a></center>"
                 return_str += """
                 </div>
             </div>
@@ -1295,6 +1422,7 @@ def compile_program():
     else:
         if (openplc_runtime.status() == "Compiling"): return draw_compiling_page()
         st_file = flask.request.args.get('file')
+        online = flask.request.args.get('online') == 'true'
         
         #load information about the program being compiled into the openplc_runtime object
         database = "openplc.db"
@@ -1314,8 +1442,11 @@ def compile_program():
         else:
             print("error connecting to the database")
         
-        delete_persistent_file()
-        openplc_runtime.compile_program(st_file)
+        # An online change keeps the running program state, including the
+        # persistent storage
+        if not online:
+            delete_persistent_file()
+        openplc_runtime.compile_program(st_file, online)
         
         return draw_compiling_page()
 
@@ -1798,80 +1929,37 @@ def monitoring():
                             </tr>"""
         
         if (openplc_runtime.status() == "Running"):
-            #Check Modbus Server status
-            modbus_enabled = False
-            modbus_port_cfg = 502
-            database = "openplc.db"
-            conn = create_connection(database)
-            if (conn != None):
-                try:
-                    print("Openning database")
-                    cur = conn.cursor()
-                    cur.execute("SELECT * FROM Settings")
-                    rows = cur.fetchall()
-                    cur.close()
-                    conn.close()
-
-                    for row in rows:
-                        if (row[0] == "Modbus_port"):
-                            if (row[1] != "disabled"):
-                                modbus_enabled = True
-                                modbus_port_cfg = int(row[1])
-                            else:
-                                modbus_enabled = False
-            
-                except Error as e:
-                    return "error connecting to the database" + str(e)
-            else:
-                return "Error opening DB"
-            
-            if modbus_enabled == True:
-                monitor.start_monitor(modbus_port_cfg)
-                data_index = 0
-                for debug_data in monitor.debug_vars:
-                    return_str += '<tr style="height:60px">' # onclick="document.location=\'point-info?table_id=' + str(data_index) + '\'">'
-                    return_str += '<td>' + debug_data.name + '</td><td>' + debug_data.type + '</td><td>' + debug_data.location + '</td><td>'
-                    if (debug_data.location.find('QX') != -1):
-                        return_str += '<button class="write-button true" onclick="fetch(\'/point-write?value=1&address=' + str(debug_data.location) + '\')">true</button>'
-                        return_str += '<button class="write-button false" onclick="fetch(\'/point-write?value=0&address=' + str(debug_data.location) + '\')">false</button>'
-                    return_str += '</td><td valign="middle">'
-                    if (debug_data.type == 'BOOL'):
-                        if (debug_data.value == 0):
-                            return_str += '<img src="/static/bool_false.png" alt="bool_false" style="width:40px;height:40px;vertical-align:middle; margin-right:10px">FALSE</td>'
-                        else:
-                            return_str += '<img src="/static/bool_true.png" alt="bool_true" style="width:40px;height:40px;vertical-align:middle; margin-right:10px">TRUE</td>'
-                    elif (debug_data.type == 'UINT'):
-                        percentage = (debug_data.value*100)/65535
-                        return_str += '<div class="w3-grey w3-round" style="height:40px"><div class="w3-container w3-blue w3-round" style="height:40px;width:' + str(int(percentage)) + '%"><p style="margin-top:10px">' + str(debug_data.value) + '</p></div></div></td>'
-                    elif (debug_data.type == 'INT'):
-                        percentage = ((debug_data.value + 32768)*100)/65535
-                        debug_data.value = ctypes.c_short(debug_data.value).value
-                        return_str += '<div class="w3-grey w3-round" style="height:40px"><div class="w3-container w3-blue w3-round" style="height:40px;width:' + str(int(percentage)) + '%"><p style="margin-top:10px">' + str(debug_data.value) + '</p></div></div></td>'
-                    elif (debug_data.type == 'REAL') or (debug_data.type == 'LREAL'):
-                        return_str += "{:10.4f}".format(debug_data.value)
+            monitor.start_monitor()
+            data_index = 0
+            for debug_data in monitor.debug_vars:
+                return_str += '<tr style="height:60px">' # onclick="document.location=\'point-info?table_id=' + str(data_index) + '\'">'
+                return_str += '<td>' + debug_data.name + '</td><td>' + debug_data.type + '</td><td>' + debug_data.location + '</td><td>'
+                if (debug_data.location.find('QX') != -1):
+                    return_str += '<button class="write-button true" onclick="fetch(\'/point-write?value=1&address=' + str(debug_data.location) + '\')">true</button>'
+                    return_str += '<button class="write-button false" onclick="fetch(\'/point-write?value=0&address=' + str(debug_data.location) + '\')">false</button>'
+                return_str += '</td><td valign="middle">'
+                if (debug_data.type == 'BOOL'):
+                    if (debug_data.value == 0):
+                        return_str += '<img src="/static/bool_false.png" alt="bool_false" style="width:40px;height:40px;vertical-align:middle; margin-right:10px">FALSE</td>'
                     else:
-                        return_str += str(debug_data.value)
-                    return_str += '</tr>'
-                    data_index += 1
-                return_str += """
-                        </table>
-                    </div>
-                    <input type='hidden' id='modbus_port_cfg' name='modbus_port_cfg' value='""" + str(modbus_port_cfg) + "'>"
-                return_str += pages.monitoring_tail
-            
-            #Modbus Server is not enabled
-            else:
-                return_str += """
-                        </table>
-                        <br>
-                        <br>
-                        <h2>You must enable Modbus Server on Settings to be able to monitor your program!</h2>
-                    </div>
-                </div>
-            </div>
-        </div>
-    </body>
-</html>"""
+                        return_str += '<img src="/static/bool_true.png" alt="bool_true" style="width:40px;height:40px;vertical-align:middle; margin-right:10px">TRUE</td>'
+                elif (debug_data.type == 'UINT'):
+                    percentage = (debug_data.value*100)/65535
+                    return_str += '<div class="w3-grey w3-round" style="height:40px"><div class="w3-container w3-blue w3-round" style="height:40px;width:' + str(int(percentage)) + '%"><p style="margin-top:10px">' + str(debug_data.value) + '</p></div></div></td>'
+                elif (debug_data.type == 'INT'):
+                    percentage = ((debug_data.value + 32768)*100)/65535
+                    debug_data.value = ctypes.c_short(debug_data.value).value
+                    return_str += '<div class="w3-grey w3-round" style="height:40px"><div class="w3-container w3-blue w3-round" style="height:40px;width:' + str(int(percentage)) + '%"><p style="margin-top:10px">' + str(debug_data.value) + '</p></div></div></td>'
+                elif (debug_data.type == 'REAL') or (debug_data.type == 'LREAL'):
+                    return_str += "{:10.4f}".format(debug_data.value)
+                else:
+                    return_str += str(debug_data.value)
+                return_str += '</tr>'
+                data_index += 1
+            return_str += """
+                    </table>
+                </div>"""
+            return_str += pages.monitoring_tail
             
         #Runtime is not running        
         else:
@@ -1901,8 +1989,7 @@ def monitor_update():
         
         #if (openplc_runtime.status() == "Running"):
         if (True):
-            mb_port_cfg = flask.request.args.get('mb_port')
-            monitor.start_monitor(int(mb_port_cfg))
+            monitor.start_monitor()
             data_index = 0
             for debug_data in monitor.debug_vars:
                 return_str += '<tr style="height:60px">' # onclick="document.location=\'point-info?table_id=' + str(data_index) + '\'">'